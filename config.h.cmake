@@ -3,16 +3,22 @@
 
 #cmakedefine HAVE_BACKTRACE_SYMBOLS
 #cmakedefine HAVE_PIPE2
+#cmakedefine HAVE_SYNCFS
+#cmakedefine HAVE_RENAMEAT2
 #cmakedefine HAVE_VFORK
 #cmakedefine HAVE_DLADDR
 #cmakedefine HAVE_LIBEXECINFO
 #cmakedefine HAVE_CXXABI_H
+#cmakedefine HAVE_SYS_SDT_H
 #cmakedefine HAVE_NICE
 #cmakedefine HAVE_EDITLINE
 #cmakedefine HAVE_SYSTEMD
 
 #cmakedefine ICINGA2_UNITY_BUILD
+#cmakedefine ICINGA2_COMPACT_VALUE
 #cmakedefine ICINGA2_STACKTRACE_USE_BACKTRACE_SYMBOLS
+#cmakedefine ICINGA2_WITH_JEMALLOC
+#cmakedefine ICINGA2_WITH_MIMALLOC
 
 #define ICINGA_CONFIGDIR "${ICINGA2_FULL_CONFIGDIR}"
 #define ICINGA_DATADIR "${ICINGA2_FULL_DATADIR}"
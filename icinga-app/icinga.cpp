@@ -445,6 +445,12 @@ static int Main()
 
 	Application::GetTP().Restart();
 
+	Timer::SetTimingWheel(Configuration::TimingWheel);
+
+	if (Configuration::AsyncLogging) {
+		Logger::EnableAsyncLogging();
+	}
+
 	/* Ensure that all defined constants work in the way we expect them. */
 	HandleLegacyDefines();
 
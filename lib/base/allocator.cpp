@@ -0,0 +1,143 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/allocator.hpp"
+#include "base/perfdatavalue.hpp"
+#include "base/statsfunction.hpp"
+#include <cstddef>
+#include <cstdint>
+
+#if defined(ICINGA2_WITH_JEMALLOC)
+#	include <jemalloc/jemalloc.h>
+#elif defined(ICINGA2_WITH_MIMALLOC)
+#	include <mimalloc.h>
+#elif defined(__GLIBC__)
+#	include <malloc.h>
+#endif
+
+using namespace icinga;
+
+REGISTER_STATSFUNCTION(Allocator, &Allocator::StatsFunc);
+
+#ifdef ICINGA2_WITH_JEMALLOC
+/* Read by jemalloc at its initialization, the MALLOC_CONF environment variable still takes precedence.
+ * Most allocations are small and short-lived (strings, values, dictionary nodes), so the thread caches
+ * are made larger, while unused pages are returned to the system by a background thread instead of
+ * during allocations, so that the RSS follows the actual usage without slowing down the workers. */
+extern "C" {
+const char *malloc_conf = "background_thread:true,lg_tcache_max:16,dirty_decay_ms:5000,muzzy_decay_ms:5000";
+}
+
+/**
+ * @returns The given size_t statistic of jemalloc, e.g. "stats.allocated".
+ */
+static double GetJemallocStat(const char *name)
+{
+	size_t value = 0;
+	size_t length = sizeof(value);
+
+	if (mallctl(name, &value, &length, nullptr, 0))
+		return 0;
+
+	return value;
+}
+#endif /* ICINGA2_WITH_JEMALLOC */
+
+/**
+ * @returns "jemalloc", "mimalloc" or "system".
+ */
+String Allocator::GetName()
+{
+#if defined(ICINGA2_WITH_JEMALLOC)
+	return "jemalloc";
+#elif defined(ICINGA2_WITH_MIMALLOC)
+	return "mimalloc";
+#else
+	return "system";
+#endif
+}
+
+/**
+ * Determines the bytes allocated by the application ("allocated"), the ones in pages the allocator
+ * uses for them ("active") and the ones actually mapped into memory ("resident") as far as the allocator
+ * tells them. "fragmentation" is the share of the resident (or else the active) bytes which aren't allocated.
+ *
+ * @returns The statistics and the allocator's "name".
+ */
+Dictionary::Ptr Allocator::GetStats()
+{
+	Dictionary::Ptr stats = new Dictionary({
+		{ "name", GetName() }
+	});
+
+	double allocated = -1;
+	double active = -1;
+	double resident = -1;
+
+#if defined(ICINGA2_WITH_JEMALLOC)
+	/* The statistics are cached and only refreshed by writing to the "epoch". */
+	uint64_t epoch = 1;
+	size_t length = sizeof(epoch);
+
+	mallctl("epoch", &epoch, &length, &epoch, length);
+
+	allocated = GetJemallocStat("stats.allocated");
+	active = GetJemallocStat("stats.active");
+	resident = GetJemallocStat("stats.resident");
+
+	stats->Set("mapped", GetJemallocStat("stats.mapped"));
+	stats->Set("retained", GetJemallocStat("stats.retained"));
+	stats->Set("metadata", GetJemallocStat("stats.metadata"));
+#elif defined(ICINGA2_WITH_MIMALLOC)
+	size_t elapsedMsecs, userMsecs, systemMsecs, currentRss, peakRss, currentCommit, peakCommit, pageFaults;
+
+	mi_process_info(&elapsedMsecs, &userMsecs, &systemMsecs, &currentRss, &peakRss, &currentCommit, &peakCommit, &pageFaults);
+
+	active = currentCommit;
+	resident = currentRss;
+
+	stats->Set("peak_active", peakCommit);
+	stats->Set("peak_resident", peakRss);
+#elif defined(__GLIBC__)
+#	if __GLIBC_PREREQ(2, 33)
+	struct mallinfo2 info = mallinfo2();
+
+	/* Chunks allocated via mmap(2) are returned to the system as soon as they're freed. */
+	allocated = info.uordblks + info.hblkhd;
+	active = info.arena + info.hblkhd;
+
+	stats->Set("arena_free", info.fordblks);
+	stats->Set("arena_releasable", info.keepcost);
+#	endif /* __GLIBC_PREREQ(2, 33) */
+#endif
+
+	if (allocated >= 0)
+		stats->Set("allocated", allocated);
+
+	if (active >= 0)
+		stats->Set("active", active);
+
+	if (resident >= 0)
+		stats->Set("resident", resident);
+
+	double held = resident > 0 ? resident : active;
+
+	if (allocated >= 0 && held > 0)
+		stats->Set("fragmentation", allocated < held ? 1 - allocated / held : 0);
+
+	return stats;
+}
+
+void Allocator::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
+{
+	Dictionary::Ptr stats = GetStats();
+
+	status->Set("allocator", stats);
+
+	for (const char *key : { "allocated", "active", "resident" }) {
+		if (stats->Contains(key))
+			perfdata->Add(new PerfdataValue(String("allocator_") + key, stats->Get(key), false, "bytes"));
+	}
+
+	if (stats->Contains("fragmentation"))
+		perfdata->Add(new PerfdataValue("allocator_fragmentation", stats->Get("fragmentation")));
+}
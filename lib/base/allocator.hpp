@@ -0,0 +1,30 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include "base/i2-base.hpp"
+#include "base/array.hpp"
+#include "base/dictionary.hpp"
+#include "base/string.hpp"
+
+namespace icinga
+{
+
+/**
+ * Reports on the malloc(3) implementation Icinga 2 was linked against (see the ICINGA2_ALLOCATOR CMake variable).
+ *
+ * @ingroup base
+ */
+class Allocator
+{
+public:
+	static String GetName();
+	static Dictionary::Ptr GetStats();
+
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+};
+
+}
+
+#endif /* ALLOCATOR_H */
@@ -50,6 +50,7 @@ Application::Ptr Application::m_Instance = nullptr;
 bool Application::m_ShuttingDown = false;
 bool Application::m_RequestRestart = false;
 bool Application::m_RequestReopenLogs = false;
+std::function<bool ()> Application::m_ReloadHandler;
 pid_t Application::m_ReloadProcess = 0;
 
 #ifndef _WIN32
@@ -112,6 +113,8 @@ void Application::Exit(int rc)
 	std::cout.flush();
 	std::cerr.flush();
 
+	Logger::DrainAsyncLogQueue();
+
 	for (const Logger::Ptr& logger : Logger::GetLoggers()) {
 		logger->Flush();
 	}
@@ -312,6 +315,9 @@ void Application::RunEventLoop()
 		if (m_RequestRestart) {
 			m_RequestRestart = false;         // we are now handling the request, once is enough
 
+			if (m_ReloadHandler && m_ReloadHandler())
+				continue;
+
 #ifdef _WIN32
 			// are we already restarting? ignore request if we already are
 			if (!l_Restarting) {
@@ -450,6 +456,17 @@ void Application::RequestRestart()
 	m_RequestRestart = true;
 }
 
+/**
+ * Sets a handler which is called by the event loop for a restart request before the restart
+ * is actually done. If it returns true, the request was handled without a restart.
+ *
+ * @param handler The handler.
+ */
+void Application::SetReloadHandler(const std::function<bool ()>& handler)
+{
+	m_ReloadHandler = handler;
+}
+
 /**
  * Signals the application to reopen log files during the
  * next execution of the event loop.
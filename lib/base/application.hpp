@@ -10,6 +10,7 @@
 #include "base/configuration.hpp"
 #include "base/shared-memory.hpp"
 #include <cstdint>
+#include <functional>
 #include <iosfwd>
 #include <type_traits>
 
@@ -61,6 +62,8 @@ public:
 	static void RequestRestart();
 	static void RequestReopenLogs();
 
+	static void SetReloadHandler(const std::function<bool ()>& handler);
+
 #ifndef _WIN32
 	static void SetUmbrellaProcess(pid_t pid);
 #endif /* _WIN32 */
@@ -128,6 +131,7 @@ private:
 	static bool m_RequestRestart; /**< A restart was requested through SIGHUP */
 	static pid_t m_ReloadProcess; /**< The PID of a subprocess doing a reload, only valid when l_Restarting==true */
 	static bool m_RequestReopenLogs; /**< Whether we should re-open log files. */
+	static std::function<bool ()> m_ReloadHandler; /**< Handles a reload in-process if it returns true */
 
 #ifndef _WIN32
 	static pid_t m_UmbrellaProcess; /**< The PID of the Icinga umbrella process */
@@ -336,6 +336,12 @@ void Array::Freeze()
 	m_Frozen = true;
 }
 
+bool Array::IsFrozen() const
+{
+	ObjectLock olock(this);
+	return m_Frozen;
+}
+
 Value Array::GetFieldByName(const String& field, bool sandboxed, const DebugInfo& debugInfo) const
 {
 	int index;
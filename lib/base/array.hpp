@@ -98,6 +98,7 @@ public:
 
 	Array::Ptr Unique() const;
 	void Freeze();
+	bool IsFrozen() const;
 
 	Value GetFieldByName(const String& field, bool sandboxed, const DebugInfo& debugInfo) const override;
 	void SetFieldByName(const String& field, const Value& value, bool overrideFrozen, const DebugInfo& debugInfo) override;
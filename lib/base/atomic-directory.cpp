@@ -0,0 +1,203 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/atomic-directory.hpp"
+#include "base/exception.hpp"
+#include "base/logger.hpp"
+#include "base/utility.hpp"
+#include <utility>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#	include <io.h>
+#else /* _WIN32 */
+#	include <errno.h>
+#	include <stdio.h>
+#	include <unistd.h>
+#endif /* _WIN32 */
+
+using namespace icinga;
+
+/* E.g. "/var/lib/icinga2/api/zones/" -> "/var/lib/icinga2/api/zones" to put the siblings next to it. */
+static String StripTrailingSeparators(String path)
+{
+	while (path.GetLength() > 1 && (path[path.GetLength() - 1] == '/' || path[path.GetLength() - 1] == '\\'))
+		path = path.SubStr(0, path.GetLength() - 1);
+
+	return path;
+}
+
+/**
+ * Restores the previous directory if a crash happened while it was being replaced without an atomic swap.
+ *
+ * @param directory The directory Commit() replaces.
+ */
+void AtomicDirectory::Recover(const String& directory)
+{
+	String path = StripTrailingSeparators(directory);
+	String oldPath = path + ".old";
+
+	if (!Utility::PathExists(path) && Utility::PathExists(oldPath)) {
+		Log(LogWarning, "AtomicDirectory")
+			<< "Restoring '" << path << "' from '" << oldPath << "' as it hasn't been replaced completely.";
+
+		Utility::RenameFile(oldPath, path);
+	}
+}
+
+AtomicDirectory::AtomicDirectory(String path, int mode)
+	: m_Path(StripTrailingSeparators(std::move(path))), m_StagingPath(m_Path + ".new")
+{
+	Recover(m_Path);
+
+	/* Left behind by a crash before Commit(). */
+	if (Utility::PathExists(m_StagingPath))
+		Utility::RemoveDirRecursive(m_StagingPath);
+
+	Utility::MkDirP(m_StagingPath, mode);
+}
+
+AtomicDirectory::~AtomicDirectory()
+{
+	if (!m_Committed) {
+		try {
+			if (Utility::PathExists(m_StagingPath))
+				Utility::RemoveDirRecursive(m_StagingPath);
+		} catch (...) {
+			// Destructor must not throw
+		}
+	}
+}
+
+/**
+ * Syncs the staging directory to disk and replaces the directory with it.
+ */
+void AtomicDirectory::Commit()
+{
+	SyncTree(m_StagingPath);
+
+	String oldPath = m_Path + ".old";
+
+	if (Utility::PathExists(oldPath))
+		Utility::RemoveDirRecursive(oldPath);
+
+	bool exchanged = false;
+
+#ifdef HAVE_RENAMEAT2
+	if (Utility::PathExists(m_Path)) {
+		if (renameat2(AT_FDCWD, m_StagingPath.CStr(), AT_FDCWD, m_Path.CStr(), RENAME_EXCHANGE) == 0) {
+			exchanged = true;
+		} else if (errno != EINVAL && errno != ENOSYS) {
+			auto error (errno);
+
+			BOOST_THROW_EXCEPTION(posix_error()
+				<< boost::errinfo_api_function("renameat2")
+				<< boost::errinfo_errno(error)
+				<< boost::errinfo_file_name(m_StagingPath));
+		}
+	}
+#endif /* HAVE_RENAMEAT2 */
+
+	if (!exchanged) {
+		/* Without an atomic swap (e.g. on Windows) there's a moment without the directory, see Recover(). */
+		if (Utility::PathExists(m_Path))
+			Utility::RenameFile(m_Path, oldPath);
+
+		Utility::RenameFile(m_StagingPath, m_Path);
+	}
+
+	SyncPath(Utility::DirName(m_Path), true);
+
+	m_Committed = true;
+
+	/* After the exchange the staging directory holds the previous content. */
+	String previous = exchanged ? m_StagingPath : oldPath;
+
+	if (Utility::PathExists(previous))
+		Utility::RemoveDirRecursive(previous);
+}
+
+/**
+ * Syncs all files and directories in the given directory to disk, at once if the platform allows it.
+ */
+void AtomicDirectory::SyncTree(const String& path)
+{
+#ifdef HAVE_SYNCFS
+	int fd = open(path.CStr(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd >= 0) {
+		int rc = syncfs(fd);
+		auto error (errno);
+
+		(void)close(fd);
+
+		if (rc < 0) {
+			BOOST_THROW_EXCEPTION(posix_error()
+				<< boost::errinfo_api_function("syncfs")
+				<< boost::errinfo_errno(error)
+				<< boost::errinfo_file_name(path));
+		}
+
+		return;
+	}
+#endif /* HAVE_SYNCFS */
+
+	Utility::GlobRecursive(path, "*", [](const String& file) { SyncPath(file, false); }, GlobFile);
+	Utility::GlobRecursive(path, "*", [](const String& dir) { SyncPath(dir, true); }, GlobDirectory);
+
+	SyncPath(path, true);
+}
+
+void AtomicDirectory::SyncPath(const String& path, bool directory)
+{
+#ifdef _WIN32
+	/* NTFS doesn't need (and doesn't allow) directories to be flushed. */
+	if (directory)
+		return;
+
+	int fd = _open(path.CStr(), _O_RDWR | _O_BINARY);
+
+	if (fd < 0) {
+		auto error (errno);
+
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("_open")
+			<< boost::errinfo_errno(error)
+			<< boost::errinfo_file_name(path));
+	}
+
+	int rc = _commit(fd);
+	auto error (errno);
+
+	(void)_close(fd);
+
+	if (rc < 0) {
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("_commit")
+			<< boost::errinfo_errno(error)
+			<< boost::errinfo_file_name(path));
+	}
+#else /* _WIN32 */
+	int fd = open(path.CStr(), (directory ? O_RDONLY | O_DIRECTORY : O_RDONLY) | O_CLOEXEC);
+
+	if (fd < 0) {
+		auto error (errno);
+
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("open")
+			<< boost::errinfo_errno(error)
+			<< boost::errinfo_file_name(path));
+	}
+
+	int rc = fsync(fd);
+	auto error (errno);
+
+	(void)close(fd);
+
+	if (rc < 0) {
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("fsync")
+			<< boost::errinfo_errno(error)
+			<< boost::errinfo_file_name(path));
+	}
+#endif /* _WIN32 */
+}
@@ -0,0 +1,49 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef ATOMIC_DIRECTORY_H
+#define ATOMIC_DIRECTORY_H
+
+#include "base/i2-base.hpp"
+#include "base/string.hpp"
+
+namespace icinga
+{
+
+/**
+ * Atomically replaces a directory with a new one whose content is written to a staging directory first.
+ *
+ * In contrast to writing every file via AtomicFile, the staging directory is synced to disk at once.
+ * So a crash leaves either the old or the new directory behind, without an fsync(2) per file.
+ *
+ * @ingroup base
+ */
+class AtomicDirectory
+{
+public:
+	static void Recover(const String& directory);
+
+	AtomicDirectory(String path, int mode);
+	~AtomicDirectory();
+
+	AtomicDirectory(const AtomicDirectory&) = delete;
+	AtomicDirectory& operator=(const AtomicDirectory&) = delete;
+
+	inline const String& GetStagingPath() const noexcept
+	{
+		return m_StagingPath;
+	}
+
+	void Commit();
+
+private:
+	String m_Path;
+	String m_StagingPath;
+	bool m_Committed{false};
+
+	static void SyncTree(const String& path);
+	static void SyncPath(const String& path, bool directory);
+};
+
+}
+
+#endif /* ATOMIC_DIRECTORY_H */
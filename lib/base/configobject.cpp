@@ -7,6 +7,7 @@
 #include "base/serializer.hpp"
 #include "base/netstring.hpp"
 #include "base/json.hpp"
+#include "base/object-packer.hpp"
 #include "base/stdiostream.hpp"
 #include "base/debug.hpp"
 #include "base/objectlock.hpp"
@@ -17,16 +18,35 @@
 #include "base/workqueue.hpp"
 #include "base/context.hpp"
 #include "base/application.hpp"
+#include "base/utility.hpp"
+#include <atomic>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <stdexcept>
 #include <boost/exception/errinfo_api_function.hpp>
 #include <boost/exception/errinfo_errno.hpp>
 #include <boost/exception/errinfo_file_name.hpp>
 
+#ifndef _WIN32
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif /* _WIN32 */
+
 using namespace icinga;
 
 REGISTER_TYPE_WITH_PROTOTYPE(ConfigObject, ConfigObject::GetPrototype());
 
-boost::signals2::signal<void (const ConfigObject::Ptr&)> ConfigObject::OnStateChanged;
+Signal<void (const ConfigObject::Ptr&)> ConfigObject::OnStateChanged;
+Signal<void (const std::vector<ConfigObject::Ptr>&, const Value&)> ConfigObject::OnBatchActivated;
+
+/* Starts at the current time in microseconds, so that counters keep growing across restarts. */
+std::atomic<uint_fast64_t> ConfigObject::m_LastChangeCounter (static_cast<uint_fast64_t>(Utility::GetTime() * 1000000));
 
 bool ConfigObject::IsActive() const
 {
@@ -116,7 +136,12 @@ void ConfigObject::ModifyAttribute(const String& attr, const Value& value, bool
 	Value newValue;
 
 	if (tokens.size() > 1) {
-		newValue = oldValue.Clone();
+		/* Only the dictionaries along the path are copied, the others may be shared with other objects (see ValuePool). */
+		if (oldValue.IsObjectType<Dictionary>())
+			newValue = static_cast<Dictionary::Ptr>(oldValue)->ShallowClone();
+		else
+			newValue = oldValue.Clone();
+
 		Value current = newValue;
 
 		if (current.IsEmpty()) {
@@ -135,10 +160,17 @@ void ConfigObject::ModifyAttribute(const String& attr, const Value& value, bool
 			const String& key = tokens[i];
 			prefix += "." + key;
 
-			if (!dict->Get(key, &current)) {
-				current = new Dictionary();
-				dict->Set(key, current);
+			Value child;
+
+			if (!dict->Get(key, &child)) {
+				child = new Dictionary();
+				dict->Set(key, child);
+			} else if (child.IsObjectType<Dictionary>()) {
+				child = static_cast<Dictionary::Ptr>(child)->ShallowClone();
+				dict->Set(key, child);
 			}
+
+			current = child;
 		}
 
 		if (!current.IsObjectType<Dictionary>())
@@ -200,6 +232,8 @@ void ConfigObject::ModifyAttribute(const String& attr, const Value& value, bool
 
 	if (updated_original_attributes)
 		NotifyOriginalAttributes();
+
+	MarkModifiedAttributesDirty();
 }
 
 void ConfigObject::RestoreAttribute(const String& attr, bool updateVersion)
@@ -313,6 +347,8 @@ void ConfigObject::RestoreAttribute(const String& attr, bool updateVersion)
 
 	if (updateVersion)
 		SetVersion(Utility::GetTime());
+
+	MarkModifiedAttributesDirty();
 }
 
 bool ConfigObject::IsAttributeModified(const String& attr) const
@@ -339,6 +375,10 @@ void ConfigObject::Unregister()
 
 	TypeImpl<ConfigObject>::Ptr type = static_pointer_cast<TypeImpl<ConfigObject> >(GetReflectionType());
 	type->UnregisterObject(this);
+
+	/* Its modified attributes must not be restored into an object created with the same name later. */
+	if (GetOriginalAttributes())
+		MarkModifiedAttributesDirty();
 }
 
 void ConfigObject::Start(bool runtimeCreated)
@@ -373,6 +413,7 @@ void ConfigObject::Activate(bool runtimeCreated, const Value& cookie)
 			SetAuthority(true);
 	}
 
+	BumpChangeCounter();
 	NotifyActive(cookie);
 }
 
@@ -404,9 +445,63 @@ void ConfigObject::Deactivate(bool runtimeRemoved, const Value& cookie)
 
 	ASSERT(GetStopCalled());
 
+	BumpChangeCounter();
 	NotifyActive(cookie);
 }
 
+/**
+ * Records a change of this object, i.e. a change of any of its (notified) attributes or its activation state.
+ * The counters are globally increasing, so that each object's and each type's (see below) counter of their
+ * latest change can be compared to previous ones.
+ */
+void ConfigObject::BumpChangeCounter()
+{
+	auto counter (m_LastChangeCounter.fetch_add(1) + 1);
+
+	m_ChangeCounter.store(counter);
+
+	auto ctype (dynamic_cast<ConfigType*>(GetReflectionType().get()));
+
+	if (ctype)
+		ctype->UpdateChangeCounter(counter);
+}
+
+/**
+ * @returns The counter of this object's latest change (see BumpChangeCounter()).
+ */
+uint_fast64_t ConfigObject::GetChangeCounter() const
+{
+	return m_ChangeCounter.load();
+}
+
+/**
+ * @returns Whether any thread updates fields of this object in a FieldUpdateBatch, i.e. not all of
+ *          the changes so far are reflected by the change counter yet.
+ */
+bool ConfigObject::HasFieldUpdateBatch() const
+{
+	return m_FieldUpdateBatches.load() > 0;
+}
+
+/**
+ * @returns A counter which changes whenever one of this object's attributes is modified or restored at runtime.
+ *          It's taken from the same sequence as the change counters, so it's unique across all objects.
+ */
+uint_fast64_t ConfigObject::GetModifiedAttributesCounter() const
+{
+	return m_ModifiedAttributesCounter.load();
+}
+
+/**
+ * @returns The counter of the latest change of any object of the given type or 0 for non-config types.
+ */
+uint_fast64_t ConfigObject::GetChangeCounter(const Type::Ptr& type)
+{
+	auto ctype (dynamic_cast<ConfigType*>(type.get()));
+
+	return ctype ? ctype->GetChangeCounter() : 0;
+}
+
 void ConfigObject::OnConfigLoaded()
 {
 	/* Nothing to do here. */
@@ -458,6 +553,452 @@ void ConfigObject::SetAuthority(bool authority)
 	}
 }
 
+/* Binary state files start with this, older state files with the netstring length of their first JSON object. */
+static const char l_StateFileMagic[] = "I2STATE\1";
+static const char l_StateJournalMagic[] = "I2JOURN\1";
+static const size_t l_StateFileMagicLength = sizeof(l_StateFileMagic) - 1;
+
+/* Objects per section, sections are packed and restored in parallel. */
+static const size_t l_StateSectionSize = 10000;
+
+/* The generation of the latest state file written by this process (0 if none) and of the journal appended to it. */
+static std::atomic<uint_fast64_t> l_StateGeneration (0);
+static std::atomic<uint_fast64_t> l_StateJournalGeneration (0);
+
+static std::mutex l_DirtyStateMutex;
+static std::vector<ConfigObject::Ptr> l_DirtyStateObjects;
+
+static const char l_ModAttrJournalMagic[] = "I2MODAT\1";
+
+static std::mutex l_DirtyModAttrMutex;
+static std::vector<ConfigObject::Ptr> l_DirtyModAttrObjects;
+static std::atomic<bool> l_ModAttrJournalCompacted (false);
+
+struct StateSection
+{
+	Type::Ptr SectionType;
+	std::vector<ConfigObject::Ptr> Objects;
+	std::vector<std::vector<int>> Fields;
+	std::string Data;
+};
+
+/**
+ * The contents of a state file, mapped into memory where possible.
+ */
+struct StateFileContents
+{
+	const char *Data = nullptr;
+	size_t Size = 0;
+
+#ifndef _WIN32
+	void *Mapping = nullptr;
+
+	~StateFileContents()
+	{
+		if (Mapping)
+			munmap(Mapping, Size);
+	}
+#else /* _WIN32 */
+	std::string Buffer;
+#endif /* _WIN32 */
+};
+
+static void ReadStateFile(const String& filename, StateFileContents& contents)
+{
+#ifndef _WIN32
+	int fd = open(filename.CStr(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("open")
+			<< boost::errinfo_errno(errno)
+			<< boost::errinfo_file_name(filename));
+	}
+
+	struct stat statbuf;
+
+	if (fstat(fd, &statbuf) < 0) {
+		int error = errno;
+		close(fd);
+
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("fstat")
+			<< boost::errinfo_errno(error)
+			<< boost::errinfo_file_name(filename));
+	}
+
+	if (statbuf.st_size > 0) {
+		void *mapping = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (mapping == MAP_FAILED) {
+			int error = errno;
+			close(fd);
+
+			BOOST_THROW_EXCEPTION(posix_error()
+				<< boost::errinfo_api_function("mmap")
+				<< boost::errinfo_errno(error)
+				<< boost::errinfo_file_name(filename));
+		}
+
+		(void)madvise(mapping, statbuf.st_size, MADV_WILLNEED);
+
+		contents.Mapping = mapping;
+		contents.Data = static_cast<const char *>(mapping);
+		contents.Size = statbuf.st_size;
+	}
+
+	close(fd);
+#else /* _WIN32 */
+	std::ifstream fp (filename.CStr(), std::ios_base::in | std::ios_base::binary);
+	contents.Buffer.assign(std::istreambuf_iterator<char>(fp), std::istreambuf_iterator<char>());
+
+	if (fp.bad()) {
+		BOOST_THROW_EXCEPTION(std::runtime_error("Could not read state file '" + filename + "'."));
+	}
+
+	contents.Data = contents.Buffer.data();
+	contents.Size = contents.Buffer.size();
+#endif /* _WIN32 */
+}
+
+/**
+ * Appends to the state journal and flushes it to disk, or starts a new journal if truncate is set.
+ */
+static void WriteStateJournal(const String& filename, const std::string& data, bool truncate)
+{
+#ifndef _WIN32
+	int fd = open(filename.CStr(), O_WRONLY | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : O_APPEND), 0600);
+
+	if (fd < 0) {
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("open")
+			<< boost::errinfo_errno(errno)
+			<< boost::errinfo_file_name(filename));
+	}
+
+	for (size_t offset = 0; offset < data.size();) {
+		ssize_t rc = write(fd, data.data() + offset, data.size() - offset);
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+
+		if (rc < 0) {
+			int error = errno;
+			close(fd);
+
+			BOOST_THROW_EXCEPTION(posix_error()
+				<< boost::errinfo_api_function("write")
+				<< boost::errinfo_errno(error)
+				<< boost::errinfo_file_name(filename));
+		}
+
+		offset += rc;
+	}
+
+	if (fsync(fd) < 0) {
+		int error = errno;
+		close(fd);
+
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("fsync")
+			<< boost::errinfo_errno(error)
+			<< boost::errinfo_file_name(filename));
+	}
+
+	close(fd);
+#else /* _WIN32 */
+	std::ofstream fp (filename.CStr(), std::ios_base::out | std::ios_base::binary | (truncate ? std::ios_base::trunc : std::ios_base::app));
+	fp.write(data.data(), data.size());
+	fp.flush();
+
+	if (!fp) {
+		BOOST_THROW_EXCEPTION(std::runtime_error("Could not write state journal '" + filename + "'."));
+	}
+#endif /* _WIN32 */
+}
+
+/**
+ * Calls the callback for every length-prefixed chunk (see PackUInt64()) in the given range.
+ *
+ * @returns Whether the range was complete, i.e. didn't end with a truncated chunk.
+ */
+static bool ForEachStateChunk(const char *begin, const char *end, const std::function<void (const char *, const char *)>& callback)
+{
+	while (begin < end) {
+		if (end - begin < 8)
+			return false;
+
+		uint_least64_t length = UnpackUInt64(begin, end);
+
+		if (!length || length > uint_least64_t(end - begin))
+			return false;
+
+		callback(begin, begin + length);
+		begin += length;
+	}
+
+	return true;
+}
+
+/**
+ * Takes the objects whose state fields changed since the last call together with these fields.
+ */
+static std::vector<std::pair<ConfigObject::Ptr, std::vector<int>>> TakeDirtyState()
+{
+	std::vector<ConfigObject::Ptr> objects;
+
+	{
+		std::unique_lock<std::mutex> lock (l_DirtyStateMutex);
+		objects.swap(l_DirtyStateObjects);
+	}
+
+	std::vector<std::pair<ConfigObject::Ptr, std::vector<int>>> result;
+	result.reserve(objects.size());
+
+	for (ConfigObject::Ptr& object : objects) {
+		std::vector<int> fields = object->TakeDirtyStateFields();
+
+		if (!fields.empty())
+			result.emplace_back(std::move(object), std::move(fields));
+	}
+
+	return result;
+}
+
+/**
+ * Packs the state of a section's objects. The field names are written once into the section's
+ * header, the objects refer to them by their index.
+ *
+ * Layout (see PackObject() for values and uint64):
+ *   section: (string)type (array of strings)fields (uint64)objects.length (object[])objects
+ *   object: (string)name (uint64)attributes.length (attribute[])attributes
+ *   attribute: (uint64)field index (any)value
+ */
+static void PackStateSection(StateSection& section, int attributeTypes)
+{
+	std::map<String, uint_least64_t> fieldIndexes;
+	ArrayData fields;
+	std::string body;
+	uint_least64_t count = 0;
+
+	std::string attributes;
+	uint_least64_t length;
+
+	/* The attributes are the same as Serialize() returns, but they're packed directly. */
+	auto packAttribute ([&fieldIndexes, &fields, &attributes, &length](const String& name, const Value& value) {
+		auto index (fieldIndexes.emplace(name, fields.size()));
+
+		if (index.second)
+			fields.emplace_back(name);
+
+		PackUInt64(index.first->second, attributes);
+		PackObject(value, attributes);
+		length++;
+	});
+
+	for (size_t i = 0; i < section.Objects.size(); i++) {
+		const ConfigObject::Ptr& object (section.Objects[i]);
+		Type::Ptr type = object->GetReflectionType();
+
+		attributes.clear();
+		length = 0;
+
+		{
+			ObjectLock olock(object);
+
+			if (section.Fields.empty()) {
+				object->VisitFields(attributeTypes, [attributeTypes, &packAttribute](const char *name, const Value& value) {
+					if (strcmp(name, "type") != 0)
+						packAttribute(name, Serialize(value, attributeTypes));
+				});
+
+				packAttribute("type", type->GetName());
+			} else {
+				/* Only the given fields, without the type. */
+				for (int fid : section.Fields[i]) {
+					Field field = type->GetFieldInfo(fid);
+
+					if (field.Attributes & attributeTypes)
+						packAttribute(field.Name, Serialize(object->GetField(fid), attributeTypes));
+				}
+			}
+		}
+
+		PackObject(object->GetName(), body);
+		PackUInt64(length, body);
+		body += attributes;
+
+		count++;
+	}
+
+	PackObject(section.SectionType->GetName(), section.Data);
+	PackObject(new Array(std::move(fields)), section.Data);
+	PackUInt64(count, section.Data);
+	section.Data += body;
+
+	section.Objects.clear();
+	section.Fields.clear();
+}
+
+/**
+ * Packs the given sections in parallel and passes them to the callback in order, length-prefixed.
+ * Only a few sections are kept in memory at once.
+ */
+static void PackStateSections(std::vector<StateSection>& sections, int attributeTypes, const std::function<void (const std::string&)>& callback)
+{
+	WorkQueue upq(0, Configuration::Concurrency);
+	upq.SetName("ConfigObject::DumpObjects");
+
+	size_t batchSize = std::max(Configuration::Concurrency, 1) * 2;
+
+	for (size_t offset = 0; offset < sections.size(); offset += batchSize) {
+		size_t end = std::min(offset + batchSize, sections.size());
+
+		for (size_t i = offset; i < end; i++) {
+			upq.Enqueue([&sections, i, attributeTypes]() { PackStateSection(sections[i], attributeTypes); });
+		}
+
+		upq.Join();
+
+		if (upq.HasExceptions()) {
+			upq.ReportExceptions("ConfigObject");
+			BOOST_THROW_EXCEPTION(std::runtime_error("Could not pack program state."));
+		}
+
+		for (size_t i = offset; i < end; i++) {
+			std::string section;
+			PackUInt64(sections[i].Data.size(), section);
+			section += sections[i].Data;
+
+			std::string().swap(sections[i].Data);
+
+			callback(section);
+		}
+	}
+}
+
+/**
+ * Records that a state field of this object changed, so that DumpDirtyObjects() persists it.
+ *
+ * @param fieldId The field's ID.
+ */
+void ConfigObject::MarkStateDirty(int fieldId)
+{
+	std::unique_lock<std::mutex> lock (m_DirtyStateMutex);
+
+	if (std::find(m_DirtyStateFields.begin(), m_DirtyStateFields.end(), fieldId) != m_DirtyStateFields.end())
+		return;
+
+	m_DirtyStateFields.push_back(fieldId);
+
+	if (m_DirtyStateFields.size() == 1) {
+		std::unique_lock<std::mutex> dirtyLock (l_DirtyStateMutex);
+		l_DirtyStateObjects.emplace_back(this);
+	}
+}
+
+/**
+ * Same as above, for several fields at once.
+ *
+ * @param fieldIds The fields' IDs.
+ */
+void ConfigObject::MarkStateDirty(const std::vector<int>& fieldIds)
+{
+	std::unique_lock<std::mutex> lock (m_DirtyStateMutex);
+
+	bool wasClean = m_DirtyStateFields.empty();
+
+	for (int fieldId : fieldIds) {
+		if (std::find(m_DirtyStateFields.begin(), m_DirtyStateFields.end(), fieldId) == m_DirtyStateFields.end())
+			m_DirtyStateFields.push_back(fieldId);
+	}
+
+	if (wasClean && !m_DirtyStateFields.empty()) {
+		std::unique_lock<std::mutex> dirtyLock (l_DirtyStateMutex);
+		l_DirtyStateObjects.emplace_back(this);
+	}
+}
+
+/**
+ * @returns The state fields changed since the last call (see MarkStateDirty()).
+ */
+std::vector<int> ConfigObject::TakeDirtyStateFields()
+{
+	std::vector<int> fields;
+
+	std::unique_lock<std::mutex> lock (m_DirtyStateMutex);
+	fields.swap(m_DirtyStateFields);
+
+	return fields;
+}
+
+static thread_local FieldUpdateBatch *l_FieldUpdateBatch = nullptr;
+
+FieldUpdateBatch::FieldUpdateBatch(ConfigObject *object)
+	: m_Object(object), m_Previous(l_FieldUpdateBatch)
+{
+	l_FieldUpdateBatch = this;
+	object->m_FieldUpdateBatches.fetch_add(1);
+}
+
+FieldUpdateBatch::~FieldUpdateBatch()
+{
+	Commit();
+}
+
+/**
+ * Ends the batch before it's destroyed, e.g. before emitting signals whose handlers compare change counters.
+ * Must be called in the thread which created the batch, in the reverse order of nested batches.
+ */
+void FieldUpdateBatch::Commit()
+{
+	if (!m_Active)
+		return;
+
+	m_Active = false;
+
+	VERIFY(l_FieldUpdateBatch == this);
+	l_FieldUpdateBatch = m_Previous;
+
+	if (m_Changed)
+		m_Object->BumpChangeCounter();
+
+	if (!m_StateFields.empty())
+		m_Object->MarkStateDirty(m_StateFields);
+
+	/* Only now readers can tell by the change counter that they've missed a change, see HasFieldUpdateBatch(). */
+	m_Object->m_FieldUpdateBatches.fetch_sub(1);
+}
+
+/**
+ * Called by the setters of all fields (see mkclass) instead of updating the bookkeeping themselves.
+ *
+ * @param object The object whose field has been set.
+ * @param stateFieldId The field's ID if it's a state field, -1 otherwise.
+ * @returns Whether a batch for the object is in progress in the current thread, i.e. the caller must not update anything itself.
+ */
+bool FieldUpdateBatch::Defer(ConfigObject *object, int stateFieldId)
+{
+	for (auto batch (l_FieldUpdateBatch); batch; batch = batch->m_Previous) {
+		if (batch->m_Object != object)
+			continue;
+
+		batch->m_Changed = true;
+
+		if (stateFieldId != -1 && std::find(batch->m_StateFields.begin(), batch->m_StateFields.end(), stateFieldId) == batch->m_StateFields.end())
+			batch->m_StateFields.push_back(stateFieldId);
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Writes the state of all objects to a new state file, the journal appended to the previous one is removed.
+ *
+ * Layout: (char[8])magic (uint64)generation (uint64 length-prefixed section[])sections, see PackStateSection().
+ */
 void ConfigObject::DumpObjects(const String& filename, int attributeTypes)
 {
 	Log(LogInformation, "ConfigObject")
@@ -469,8 +1010,10 @@ void ConfigObject::DumpObjects(const String& filename, int attributeTypes)
 		Log(LogWarning, "ConfigObject") << DiagnosticInformation(ex);
 	}
 
-	AtomicFile fp (filename, 0600);
-	StdioStream::Ptr sfp = new StdioStream(&fp, false);
+	/* Everything changed so far is part of this state file. */
+	(void)TakeDirtyState();
+
+	std::vector<StateSection> sections;
 
 	for (const Type::Ptr& type : Type::GetAllTypes()) {
 		auto *dtype = dynamic_cast<ConfigType *>(type.get());
@@ -478,26 +1021,113 @@ void ConfigObject::DumpObjects(const String& filename, int attributeTypes)
 		if (!dtype)
 			continue;
 
-		for (const ConfigObject::Ptr& object : dtype->GetObjects()) {
-			Dictionary::Ptr update = Serialize(object, attributeTypes);
+		std::vector<ConfigObject::Ptr> objects = dtype->GetObjects();
 
-			if (!update)
-				continue;
+		for (size_t offset = 0; offset < objects.size(); offset += l_StateSectionSize) {
+			auto end (objects.begin() + std::min(offset + l_StateSectionSize, objects.size()));
+			sections.push_back({ type, std::vector<ConfigObject::Ptr>(objects.begin() + offset, end), {}, std::string() });
+		}
+	}
 
-			Dictionary::Ptr persistentObject = new Dictionary({
-				{ "type", type->GetName() },
-				{ "name", object->GetName() },
-				{ "update", update }
-			});
+	uint_fast64_t generation = std::max(static_cast<uint_fast64_t>(Utility::GetTime() * 1000000), l_StateGeneration.load() + 1);
+
+	std::string header (l_StateFileMagic, l_StateFileMagicLength);
+	PackUInt64(generation, header);
+
+	try {
+		AtomicFile fp (filename, 0600);
+		fp << header;
 
-			String json = JsonEncode(persistentObject);
+		PackStateSections(sections, attributeTypes, [&fp](const std::string& section) { fp << section; });
 
-			NetString::WriteStringToStream(sfp, json);
+		fp.Commit();
+	} catch (const std::exception&) {
+		/* The changes taken above aren't persisted anywhere, the next dump has to be a full one. */
+		l_StateGeneration.store(0);
+		throw;
+	}
+
+	l_StateGeneration.store(generation);
+	l_StateJournalGeneration.store(0);
+
+	String journal = filename + ".journal";
+
+	if (Utility::PathExists(journal)) {
+		try {
+			Utility::Remove(journal);
+		} catch (const std::exception& ex) {
+			/* It's ignored on restore anyway, as its generation doesn't match. */
+			Log(LogWarning, "ConfigObject") << DiagnosticInformation(ex);
 		}
 	}
+}
 
-	sfp->Close();
-	fp.Commit();
+/**
+ * Appends the state fields changed since the last dump to the state file's journal. Unlike DumpObjects(),
+ * this only writes a few fields of the objects which changed. The journal is replayed by RestoreObjects().
+ *
+ * Layout: (char[8])magic (uint64)state file generation (uint64 length-prefixed record[])records,
+ * where every record holds the length-prefixed sections of one dump.
+ *
+ * @returns false if this process hasn't written the state file yet, i.e. a full dump is required.
+ */
+bool ConfigObject::DumpDirtyObjects(const String& filename, int attributeTypes)
+{
+	uint_fast64_t generation = l_StateGeneration.load();
+
+	if (!generation)
+		return false;
+
+	auto dirty (TakeDirtyState());
+
+	if (dirty.empty())
+		return true;
+
+	Log(LogInformation, "ConfigObject")
+		<< "Appending the state of " << dirty.size() << " changed objects to the journal of file '" << filename << "'";
+
+	std::map<Type *, std::vector<size_t>> typeSections;
+	std::vector<StateSection> sections;
+
+	for (auto& entry : dirty) {
+		Type::Ptr type = entry.first->GetReflectionType();
+		auto& indexes (typeSections[type.get()]);
+
+		if (indexes.empty() || sections[indexes.back()].Objects.size() >= l_StateSectionSize) {
+			indexes.push_back(sections.size());
+			sections.push_back({ type, {}, {}, std::string() });
+		}
+
+		StateSection& section (sections[indexes.back()]);
+		section.Objects.emplace_back(std::move(entry.first));
+		section.Fields.emplace_back(std::move(entry.second));
+	}
+
+	bool truncate = l_StateJournalGeneration.load() != generation;
+
+	try {
+		std::string record;
+		PackStateSections(sections, attributeTypes, [&record](const std::string& section) { record += section; });
+
+		std::string data;
+
+		if (truncate) {
+			data.append(l_StateJournalMagic, l_StateFileMagicLength);
+			PackUInt64(generation, data);
+		}
+
+		PackUInt64(record.size(), data);
+		data += record;
+
+		WriteStateJournal(filename + ".journal", data, truncate);
+	} catch (const std::exception&) {
+		/* The changes taken above are lost and the journal may end with a partial record, start over with a full dump. */
+		l_StateGeneration.store(0);
+		throw;
+	}
+
+	l_StateJournalGeneration.store(generation);
+	return true;
 }
 
 void ConfigObject::RestoreObject(const String& message, int attributeTypes)
@@ -522,6 +1152,67 @@ void ConfigObject::RestoreObject(const String& message, int attributeTypes)
 	object->SetStateLoaded(true);
 }
 
+/**
+ * Restores the objects of a section packed by PackStateSection().
+ *
+ * @param journal Whether the section is part of the journal, i.e. only updates objects restored before.
+ * @returns The number of objects restored.
+ */
+unsigned long ConfigObject::RestoreStateSection(const char *begin, const char *end, int attributeTypes, bool journal)
+{
+	String typeName = UnpackObject(begin, end);
+	Array::Ptr fields = UnpackObject(begin, end);
+
+	if (!fields)
+		BOOST_THROW_EXCEPTION(std::invalid_argument("State file section for type '" + typeName + "' has no field names."));
+
+	auto *ctype = dynamic_cast<ConfigType *>(Type::GetByName(typeName).get());
+
+	uint_least64_t count = UnpackUInt64(begin, end);
+	unsigned long restored = 0;
+
+	for (uint_least64_t i = 0; i < count; i++) {
+		String name = UnpackObject(begin, end);
+		uint_least64_t length = UnpackUInt64(begin, end);
+
+		DictionaryData update;
+		update.reserve(length);
+
+		for (uint_least64_t j = 0; j < length; j++) {
+			uint_least64_t index = UnpackUInt64(begin, end);
+
+			if (index >= fields->GetLength())
+				BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid field index in state file section for type '" + typeName + "'."));
+
+			Value value = UnpackObject(begin, end);
+			update.emplace_back(fields->Get(index), std::move(value));
+		}
+
+		if (!ctype)
+			continue;
+
+		ConfigObject::Ptr object = ctype->GetObject(name);
+
+		if (!object)
+			continue;
+
+#ifdef I2_DEBUG
+		Log(LogDebug, "ConfigObject")
+			<< "Restoring object '" << name << "' of type '" << typeName << "'.";
+#endif /* I2_DEBUG */
+		Deserialize(object, new Dictionary(std::move(update)), false, attributeTypes);
+
+		if (!journal) {
+			object->OnStateLoaded();
+			object->SetStateLoaded(true);
+		}
+
+		restored++;
+	}
+
+	return restored;
+}
+
 void ConfigObject::RestoreObjects(const String& filename, int attributeTypes)
 {
 	if (!Utility::PathExists(filename))
@@ -530,35 +1221,98 @@ void ConfigObject::RestoreObjects(const String& filename, int attributeTypes)
 	Log(LogInformation, "ConfigObject")
 		<< "Restoring program state from file '" << filename << "'";
 
-	std::fstream fp;
-	fp.open(filename.CStr(), std::ios_base::in);
+	/* Declared before the queue, the sections of binary state files point into it. */
+	StateFileContents contents;
+	ReadStateFile(filename, contents);
 
-	StdioStream::Ptr sfp = new StdioStream (&fp, false);
-
-	unsigned long restored = 0;
+	std::atomic<unsigned long> restored (0);
+	unsigned long journalRecords = 0;
 
 	WorkQueue upq(25000, Configuration::Concurrency);
 	upq.SetName("ConfigObject::RestoreObjects");
 
-	String message;
-	StreamReadContext src;
-	for (;;) {
-		StreamReadStatus srs = NetString::ReadStringFromStream(sfp, &message, src);
+	if (contents.Size >= l_StateFileMagicLength + 8 && memcmp(contents.Data, l_StateFileMagic, l_StateFileMagicLength) == 0) {
+		const char *begin = contents.Data + l_StateFileMagicLength;
+		const char *end = contents.Data + contents.Size;
 
-		if (srs == StatusEof)
-			break;
+		uint_least64_t generation = UnpackUInt64(begin, end);
 
-		if (srs != StatusNewItem)
-			continue;
+		bool complete = ForEachStateChunk(begin, end, [&upq, &restored, attributeTypes](const char *sectionBegin, const char *sectionEnd) {
+			upq.Enqueue([sectionBegin, sectionEnd, attributeTypes, &restored]() {
+				restored.fetch_add(RestoreStateSection(sectionBegin, sectionEnd, attributeTypes, false));
+			});
+		});
 
-		upq.Enqueue([message, attributeTypes]() { RestoreObject(message, attributeTypes); });
-		restored++;
-	}
+		if (!complete) {
+			Log(LogWarning, "ConfigObject")
+				<< "State file '" << filename << "' is truncated, ignoring the rest of it.";
+		}
+
+		upq.Join();
+
+		String journal = filename + ".journal";
+		StateFileContents journalContents;
+
+		if (Utility::PathExists(journal))
+			ReadStateFile(journal, journalContents);
+
+		begin = journalContents.Data;
+		end = journalContents.Data + journalContents.Size;
+
+		if (journalContents.Size >= l_StateFileMagicLength + 8 && memcmp(begin, l_StateJournalMagic, l_StateFileMagicLength) == 0) {
+			begin += l_StateFileMagicLength;
+
+			if (UnpackUInt64(begin, end) == generation) {
+				/* Sections of the same record refer to different objects, records have to be replayed in order. */
+				complete = ForEachStateChunk(begin, end, [&upq, &journalRecords, attributeTypes](const char *recordBegin, const char *recordEnd) {
+					ForEachStateChunk(recordBegin, recordEnd, [&upq, attributeTypes](const char *sectionBegin, const char *sectionEnd) {
+						upq.Enqueue([sectionBegin, sectionEnd, attributeTypes]() {
+							RestoreStateSection(sectionBegin, sectionEnd, attributeTypes, true);
+						});
+					});
+
+					upq.Join();
+					journalRecords++;
+				});
+
+				if (!complete) {
+					Log(LogWarning, "ConfigObject")
+						<< "State journal '" << journal << "' is truncated, ignoring the rest of it.";
+				}
+			} else {
+				Log(LogWarning, "ConfigObject")
+					<< "Ignoring state journal '" << journal << "' which doesn't belong to the state file.";
+			}
+		}
+	} else {
+		std::fstream fp;
+		fp.open(filename.CStr(), std::ios_base::in);
+
+		StdioStream::Ptr sfp = new StdioStream (&fp, false);
+
+		String message;
+		StreamReadContext src;
+		for (;;) {
+			StreamReadStatus srs = NetString::ReadStringFromStream(sfp, &message, src);
+
+			if (srs == StatusEof)
+				break;
 
-	sfp->Close();
+			if (srs != StatusNewItem)
+				continue;
+
+			upq.Enqueue([message, attributeTypes]() { RestoreObject(message, attributeTypes); });
+			restored++;
+		}
+
+		sfp->Close();
+	}
 
 	upq.Join();
 
+	if (upq.HasExceptions())
+		upq.ReportExceptions("ConfigObject");
+
 	unsigned long no_state = 0;
 
 	for (const Type::Ptr& type : Type::GetAllTypes()) {
@@ -578,7 +1332,8 @@ void ConfigObject::RestoreObjects(const String& filename, int attributeTypes)
 	}
 
 	Log(LogInformation, "ConfigObject")
-		<< "Restored " << restored << " objects. Loaded " << no_state << " new objects without state.";
+		<< "Restored " << restored.load() << " objects and replayed " << journalRecords << " journal records. Loaded "
+		<< no_state << " new objects without state.";
 }
 
 void ConfigObject::StopObjects()
@@ -616,56 +1371,246 @@ void ConfigObject::DumpModifiedAttributes(const std::function<void(const ConfigO
 			continue;
 
 		for (const ConfigObject::Ptr& object : dtype->GetObjects()) {
-			Dictionary::Ptr originalAttributes = object->GetOriginalAttributes();
+			DumpModifiedAttributes(object, callback);
+		}
+	}
+}
 
-			if (!originalAttributes)
-				continue;
+void ConfigObject::DumpModifiedAttributes(const ConfigObject::Ptr& object, const std::function<void(const ConfigObject::Ptr&, const String&, const Value&)>& callback)
+{
+	Dictionary::Ptr originalAttributes = object->GetOriginalAttributes();
 
-			ObjectLock olock(originalAttributes);
-			for (const Dictionary::Pair& kv : originalAttributes) {
-				String key = kv.first;
+	if (!originalAttributes)
+		return;
 
-				Type::Ptr type = object->GetReflectionType();
+	ObjectLock olock(originalAttributes);
+	for (const Dictionary::Pair& kv : originalAttributes) {
+		String key = kv.first;
 
-				std::vector<String> tokens = key.Split(".");
+		Type::Ptr type = object->GetReflectionType();
 
-				String fieldName = tokens[0];
-				int fid = type->GetFieldId(fieldName);
+		std::vector<String> tokens = key.Split(".");
 
-				Value currentValue = object->GetField(fid);
-				Value modifiedValue;
+		String fieldName = tokens[0];
+		int fid = type->GetFieldId(fieldName);
 
-				if (tokens.size() > 1) {
-					Value current = currentValue;
+		Value currentValue = object->GetField(fid);
+		Value modifiedValue;
 
-					for (std::vector<String>::size_type i = 1; i < tokens.size() - 1; i++) {
-						if (!current.IsObjectType<Dictionary>())
-							BOOST_THROW_EXCEPTION(std::invalid_argument("Value must be a dictionary."));
+		if (tokens.size() > 1) {
+			Value current = currentValue;
 
-						Dictionary::Ptr dict = current;
-						const String& key = tokens[i];
+			for (std::vector<String>::size_type i = 1; i < tokens.size() - 1; i++) {
+				if (!current.IsObjectType<Dictionary>())
+					BOOST_THROW_EXCEPTION(std::invalid_argument("Value must be a dictionary."));
 
-						if (!dict->Contains(key))
-							break;
+				Dictionary::Ptr dict = current;
+				const String& key = tokens[i];
 
-						current = dict->Get(key);
-					}
+				if (!dict->Contains(key))
+					break;
+
+				current = dict->Get(key);
+			}
+
+			if (!current.IsObjectType<Dictionary>())
+				BOOST_THROW_EXCEPTION(std::invalid_argument("Value must be a dictionary."));
+
+			Dictionary::Ptr dict = current;
+			const String& key = tokens[tokens.size() - 1];
+
+			modifiedValue = dict->Get(key);
+		} else
+			modifiedValue = currentValue;
+
+		callback(object, key, modifiedValue);
+	}
+}
+
+/**
+ * Records that attributes of this object were modified or restored, so that DumpModifiedAttributesJournal() persists them.
+ */
+void ConfigObject::MarkModifiedAttributesDirty()
+{
+	m_ModifiedAttributesCounter.store(m_LastChangeCounter.fetch_add(1) + 1);
+
+	if (m_ModifiedAttributesDirty.exchange(true))
+		return;
+
+	std::unique_lock<std::mutex> lock (l_DirtyModAttrMutex);
+	l_DirtyModAttrObjects.emplace_back(this);
+}
+
+/**
+ * Appends a record of all modified attributes of an object to the journal.
+ *
+ * Layout: (uint64)record.length (array)record, record: [ type, name, version, { attribute: value } ]
+ * An empty dictionary drops the modifications of all previous records of the object.
+ */
+static void PackModifiedAttributesRecord(const ConfigObject::Ptr& object, bool registered, std::string& output)
+{
+	DictionaryData attrs;
+
+	if (registered) {
+		ConfigObject::DumpModifiedAttributes(object, [&attrs](const ConfigObject::Ptr&, const String& attr, const Value& value) {
+			attrs.emplace_back(attr, value);
+		});
+	}
+
+	std::string record;
+	PackObject(new Array({
+		object->GetReflectionType()->GetName(),
+		object->GetName(),
+		object->GetVersion(),
+		new Dictionary(std::move(attrs))
+	}), record);
+
+	PackUInt64(record.size(), output);
+	output += record;
+}
+
+/**
+ * Persists the modified attributes of all objects into a journal which RestoreModifiedAttributesJournal()
+ * applies without the config compiler. Only objects whose attributes changed since the last call are appended,
+ * unless compact is set (or this process hasn't written the journal yet), which rewrites it with one record per object.
+ *
+ * Layout: (char[8])magic (uint64 length-prefixed record[])records, see PackModifiedAttributesRecord().
+ *
+ * @param filename The journal file.
+ * @param compact Whether to rewrite the journal.
+ */
+void ConfigObject::DumpModifiedAttributesJournal(const String& filename, bool compact)
+{
+	if (!l_ModAttrJournalCompacted.load())
+		compact = true;
+
+	std::vector<ConfigObject::Ptr> dirty;
+
+	{
+		std::unique_lock<std::mutex> lock (l_DirtyModAttrMutex);
+		dirty.swap(l_DirtyModAttrObjects);
+	}
+
+	/* Changes from now on register the object again. */
+	for (const ConfigObject::Ptr& object : dirty) {
+		object->m_ModifiedAttributesDirty.store(false);
+	}
 
-					if (!current.IsObjectType<Dictionary>())
-						BOOST_THROW_EXCEPTION(std::invalid_argument("Value must be a dictionary."));
+	try {
+		if (compact) {
+			try {
+				Utility::Glob(filename + ".tmp.*", &Utility::Remove, GlobFile);
+			} catch (const std::exception& ex) {
+				Log(LogWarning, "ConfigObject") << DiagnosticInformation(ex);
+			}
+
+			std::string data (l_ModAttrJournalMagic, l_StateFileMagicLength);
 
-					Dictionary::Ptr dict = current;
-					const String& key = tokens[tokens.size() - 1];
+			for (const Type::Ptr& type : Type::GetAllTypes()) {
+				auto *dtype = dynamic_cast<ConfigType *>(type.get());
 
-					modifiedValue = dict->Get(key);
-				} else
-					modifiedValue = currentValue;
+				if (!dtype)
+					continue;
+
+				for (const ConfigObject::Ptr& object : dtype->GetObjects()) {
+					Dictionary::Ptr originalAttributes = object->GetOriginalAttributes();
 
-				callback(object, key, modifiedValue);
+					if (originalAttributes && originalAttributes->GetLength())
+						PackModifiedAttributesRecord(object, true, data);
+				}
 			}
+
+			AtomicFile fp (filename, 0600);
+			fp << data;
+			fp.Commit();
+
+			l_ModAttrJournalCompacted.store(true);
+			return;
 		}
+
+		if (dirty.empty())
+			return;
+
+		std::string data;
+
+		for (const ConfigObject::Ptr& object : dirty) {
+			PackModifiedAttributesRecord(object, GetObject(object->GetReflectionType()->GetName(), object->GetName()) == object, data);
+		}
+
+		WriteStateJournal(filename, data, false);
+	} catch (const std::exception&) {
+		/* The changes taken above are lost and the journal may end with a partial record, rewrite it next time. */
+		l_ModAttrJournalCompacted.store(false);
+		throw;
 	}
+}
+
+/**
+ * Applies the modified attributes persisted by DumpModifiedAttributesJournal().
+ *
+ * @param filename The journal file.
+ */
+void ConfigObject::RestoreModifiedAttributesJournal(const String& filename)
+{
+	Log(LogInformation, "ConfigObject")
+		<< "Restoring modified attributes from file '" << filename << "'";
+
+	StateFileContents contents;
+	ReadStateFile(filename, contents);
+
+	if (contents.Size < l_StateFileMagicLength || memcmp(contents.Data, l_ModAttrJournalMagic, l_StateFileMagicLength) != 0)
+		BOOST_THROW_EXCEPTION(std::invalid_argument("File '" + filename + "' isn't a modified attributes journal."));
+
+	/* Only the latest record of an object counts. */
+	std::map<std::pair<String, String>, Array::Ptr> records;
+
+	bool complete = ForEachStateChunk(contents.Data + l_StateFileMagicLength, contents.Data + contents.Size, [&records](const char *begin, const char *end) {
+		Array::Ptr record = UnpackObject(begin, end);
 
+		if (!record || record->GetLength() != 4 || !record->Get(3).IsObjectType<Dictionary>())
+			BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid record in modified attributes journal."));
+
+		records[std::make_pair(String(record->Get(0)), String(record->Get(1)))] = record;
+	});
+
+	if (!complete) {
+		Log(LogWarning, "ConfigObject")
+			<< "Modified attributes journal '" << filename << "' is truncated, ignoring the rest of it.";
+	}
+
+	unsigned long restored = 0;
+
+	for (auto& kv : records) {
+		ConfigObject::Ptr object = GetObject(kv.first.first, kv.first.second);
+
+		if (!object)
+			continue;
+
+		Dictionary::Ptr attrs = kv.second->Get(3);
+
+		if (!attrs->GetLength())
+			continue;
+
+		{
+			ObjectLock olock(attrs);
+
+			for (const Dictionary::Pair& attr : attrs) {
+				try {
+					object->ModifyAttribute(attr.first, attr.second, false);
+				} catch (const std::exception& ex) {
+					Log(LogWarning, "ConfigObject")
+						<< "Cannot restore modified attribute '" << attr.first << "' of object '" << object->GetName()
+						<< "' of type '" << kv.first.first << "': " << DiagnosticInformation(ex, false);
+				}
+			}
+		}
+
+		object->SetVersion(kv.second->Get(2));
+		restored++;
+	}
+
+	Log(LogInformation, "ConfigObject")
+		<< "Restored modified attributes of " << restored << " objects.";
 }
 
 ConfigObject::Ptr ConfigObject::GetObject(const String& type, const String& name)
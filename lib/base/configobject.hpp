@@ -8,7 +8,12 @@
 #include "base/object.hpp"
 #include "base/type.hpp"
 #include "base/dictionary.hpp"
+#include "base/signal.hpp"
 #include <boost/signals2.hpp>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
 
 namespace icinga
 {
@@ -25,7 +30,13 @@ class ConfigObject : public ObjectImpl<ConfigObject>
 public:
 	DECLARE_OBJECT(ConfigObject);
 
-	static boost::signals2::signal<void (const ConfigObject::Ptr&)> OnStateChanged;
+	static Signal<void (const ConfigObject::Ptr&)> OnStateChanged;
+
+	/* Emitted once for all objects activated by one runtime transaction. For them OnActiveChanged
+	 * is emitted while they carry the "ConfigObjectBatch" extension, so handlers may skip them there.
+	 * If the transaction fails, it's emitted only for the objects which couldn't be deactivated again.
+	 */
+	static Signal<void (const std::vector<ConfigObject::Ptr>&, const Value&)> OnBatchActivated;
 
 	bool IsActive() const;
 	bool IsPaused() const;
@@ -48,6 +59,16 @@ public:
 	void Deactivate(bool runtimeRemoved = false, const Value& cookie = Empty);
 	void SetAuthority(bool authority);
 
+	void BumpChangeCounter();
+	uint_fast64_t GetChangeCounter() const;
+	static uint_fast64_t GetChangeCounter(const Type::Ptr& type);
+	bool HasFieldUpdateBatch() const;
+	uint_fast64_t GetModifiedAttributesCounter() const;
+
+	void MarkStateDirty(int fieldId);
+	void MarkStateDirty(const std::vector<int>& fieldIds);
+	std::vector<int> TakeDirtyStateFields();
+
 	void Start(bool runtimeCreated = false) override;
 	void Stop(bool runtimeRemoved = false) override;
 
@@ -72,17 +93,62 @@ public:
 	static ConfigObject::Ptr GetObject(const String& type, const String& name);
 
 	static void DumpObjects(const String& filename, int attributeTypes = FAState);
+	static bool DumpDirtyObjects(const String& filename, int attributeTypes = FAState);
 	static void RestoreObjects(const String& filename, int attributeTypes = FAState);
 	static void StopObjects();
 
 	static void DumpModifiedAttributes(const std::function<void(const ConfigObject::Ptr&, const String&, const Value&)>& callback);
+	static void DumpModifiedAttributes(const ConfigObject::Ptr& object, const std::function<void(const ConfigObject::Ptr&, const String&, const Value&)>& callback);
+	static void DumpModifiedAttributesJournal(const String& filename, bool compact);
+	static void RestoreModifiedAttributesJournal(const String& filename);
 
 	static Object::Ptr GetPrototype();
 
 private:
 	ConfigObject::Ptr m_Zone;
+	std::atomic<uint_fast64_t> m_ChangeCounter{0};
+	std::atomic<uint_fast32_t> m_FieldUpdateBatches{0}; /**< In progress in any thread, see FieldUpdateBatch */
+
+	std::mutex m_DirtyStateMutex;
+	std::vector<int> m_DirtyStateFields;
+	std::atomic<bool> m_ModifiedAttributesDirty{false};
+	std::atomic<uint_fast64_t> m_ModifiedAttributesCounter{m_LastChangeCounter.fetch_add(1) + 1};
+
+	static std::atomic<uint_fast64_t> m_LastChangeCounter;
 
 	static void RestoreObject(const String& message, int attributeTypes);
+	void MarkModifiedAttributesDirty();
+	static unsigned long RestoreStateSection(const char *begin, const char *end, int attributeTypes, bool journal);
+
+	friend class FieldUpdateBatch;
+};
+
+/**
+ * Collects the bookkeeping of the fields of an object set by the current thread while it exists, i.e. the
+ * change counter is bumped once and the changed state fields are marked dirty at once when it's committed
+ * or destroyed. The On<Field>Changed signals are still emitted by every setter.
+ *
+ * @ingroup base
+ */
+class FieldUpdateBatch
+{
+public:
+	FieldUpdateBatch(ConfigObject *object);
+	~FieldUpdateBatch();
+
+	FieldUpdateBatch(const FieldUpdateBatch&) = delete;
+	FieldUpdateBatch& operator=(const FieldUpdateBatch&) = delete;
+
+	void Commit();
+
+	static bool Defer(ConfigObject *object, int stateFieldId);
+
+private:
+	ConfigObject *m_Object;
+	FieldUpdateBatch *m_Previous;
+	bool m_Active{true};
+	bool m_Changed{false};
+	std::vector<int> m_StateFields;
 };
 
 #define DECLARE_OBJECTNAME(klass)						\
@@ -43,6 +43,7 @@ void ConfigType::RegisterObject(const ConfigObject::Ptr& object)
 
 		m_ObjectMap[name] = object;
 		m_ObjectVector.push_back(object);
+		m_Snapshot = nullptr;
 	}
 }
 
@@ -55,6 +56,7 @@ void ConfigType::UnregisterObject(const ConfigObject::Ptr& object)
 
 		m_ObjectMap.erase(name);
 		m_ObjectVector.erase(std::remove(m_ObjectVector.begin(), m_ObjectVector.end(), object), m_ObjectVector.end());
+		m_Snapshot = nullptr;
 	}
 }
 
@@ -64,13 +66,63 @@ std::vector<ConfigObject::Ptr> ConfigType::GetObjects() const
 	return m_ObjectVector;
 }
 
+ConfigObjectSnapshot<ConfigObject> ConfigType::GetObjectSnapshot() const
+{
+	return ConfigObjectSnapshot<ConfigObject>(GetSnapshot());
+}
+
+/**
+ * Copies m_ObjectVector only once after each change (and only if requested), not on every call.
+ * The copy is shared by all callers until the next change.
+ */
+std::shared_ptr<const ConfigType::ObjectVector> ConfigType::GetSnapshot() const
+{
+	{
+		std::shared_lock<decltype(m_Mutex)> lock (m_Mutex);
+
+		if (m_Snapshot)
+			return m_Snapshot;
+	}
+
+	std::unique_lock<decltype(m_Mutex)> lock (m_Mutex);
+
+	if (!m_Snapshot)
+		m_Snapshot = std::make_shared<const ObjectVector>(m_ObjectVector);
+
+	return m_Snapshot;
+}
+
 std::vector<ConfigObject::Ptr> ConfigType::GetObjectsHelper(Type *type)
 {
 	return static_cast<TypeImpl<ConfigObject> *>(type)->GetObjects();
 }
 
+std::shared_ptr<const ConfigType::ObjectVector> ConfigType::GetObjectSnapshotHelper(Type *type)
+{
+	return static_cast<TypeImpl<ConfigObject> *>(type)->GetSnapshot();
+}
+
 int ConfigType::GetObjectCount() const
 {
 	std::shared_lock<decltype(m_Mutex)> lock (m_Mutex);
 	return m_ObjectVector.size();
 }
+
+/**
+ * @returns The counter of the latest change of any object of this type. See ConfigObject::BumpChangeCounter().
+ */
+uint_fast64_t ConfigType::GetChangeCounter() const
+{
+	return m_ChangeCounter.load();
+}
+
+/**
+ * Raises the counter of the latest change of any object of this type to the given one (if greater).
+ */
+void ConfigType::UpdateChangeCounter(uint_fast64_t counter)
+{
+	auto current (m_ChangeCounter.load());
+
+	while (current < counter && !m_ChangeCounter.compare_exchange_weak(current, counter)) {
+	}
+}
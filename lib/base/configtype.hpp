@@ -7,14 +7,97 @@
 #include "base/object.hpp"
 #include "base/type.hpp"
 #include "base/dictionary.hpp"
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
 #include <shared_mutex>
 #include <unordered_map>
+#include <vector>
 
 namespace icinga
 {
 
 class ConfigObject;
 
+/**
+ * An immutable list of all objects of a type at some point in time, see ConfigType::GetObjectSnapshot().
+ * It holds references to all of them, so it can be iterated without touching their reference counts.
+ *
+ * @ingroup base
+ */
+template<typename T>
+class ConfigObjectSnapshot
+{
+public:
+	typedef std::vector<intrusive_ptr<ConfigObject> > ObjectVector;
+
+	class Iterator
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef T *value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef T * const *pointer;
+		typedef T *reference;
+
+		inline Iterator(typename ObjectVector::const_iterator it)
+			: m_It(it)
+		{ }
+
+		inline T *operator*() const
+		{
+			return static_cast<T *>(m_It->get());
+		}
+
+		inline Iterator& operator++()
+		{
+			++m_It;
+			return *this;
+		}
+
+		inline bool operator==(const Iterator& other) const
+		{
+			return m_It == other.m_It;
+		}
+
+		inline bool operator!=(const Iterator& other) const
+		{
+			return m_It != other.m_It;
+		}
+
+	private:
+		typename ObjectVector::const_iterator m_It;
+	};
+
+	inline ConfigObjectSnapshot(std::shared_ptr<const ObjectVector> objects)
+		: m_Objects(std::move(objects))
+	{ }
+
+	inline Iterator begin() const
+	{
+		return Iterator(m_Objects->begin());
+	}
+
+	inline Iterator end() const
+	{
+		return Iterator(m_Objects->end());
+	}
+
+	inline size_t size() const
+	{
+		return m_Objects->size();
+	}
+
+	inline bool empty() const
+	{
+		return m_Objects->empty();
+	}
+
+private:
+	std::shared_ptr<const ObjectVector> m_Objects;
+};
+
 class ConfigType
 {
 public:
@@ -26,6 +109,7 @@ public:
 	void UnregisterObject(const intrusive_ptr<ConfigObject>& object);
 
 	std::vector<intrusive_ptr<ConfigObject> > GetObjects() const;
+	ConfigObjectSnapshot<ConfigObject> GetObjectSnapshot() const;
 
 	template<typename T>
 	static TypeImpl<T> *Get()
@@ -46,8 +130,21 @@ for (const auto& object : objects) {
 		return result;
 	}
 
+	/**
+	 * Prefer this over GetObjectsByType() for iterating over many objects.
+	 * It doesn't copy the objects unless they've changed since the last call.
+	 */
+	template<typename T>
+	static ConfigObjectSnapshot<T> GetObjectSnapshot()
+	{
+		return ConfigObjectSnapshot<T>(GetObjectSnapshotHelper(T::TypeInstance.get()));
+	}
+
 	int GetObjectCount() const;
 
+	uint_fast64_t GetChangeCounter() const;
+	void UpdateChangeCounter(uint_fast64_t counter);
+
 private:
 	typedef std::unordered_map<String, intrusive_ptr<ConfigObject> > ObjectMap;
 	typedef std::vector<intrusive_ptr<ConfigObject> > ObjectVector;
@@ -55,8 +152,13 @@ private:
 	mutable std::shared_timed_mutex m_Mutex;
 	ObjectMap m_ObjectMap;
 	ObjectVector m_ObjectVector;
+	mutable std::shared_ptr<const ObjectVector> m_Snapshot; /**< m_ObjectVector, nullptr if it has changed since */
+	std::atomic<uint_fast64_t> m_ChangeCounter{0};
+
+	std::shared_ptr<const ObjectVector> GetSnapshot() const;
 
 	static std::vector<intrusive_ptr<ConfigObject> > GetObjectsHelper(Type *type);
+	static std::shared_ptr<const ObjectVector> GetObjectSnapshotHelper(Type *type);
 };
 
 }
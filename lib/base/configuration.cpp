@@ -23,29 +23,42 @@ String Configuration::ApiBindHost = []() {
 }();
 
 String Configuration::ApiBindPort{"5665"};
+bool Configuration::AsyncLogging{false};
 bool Configuration::AttachDebugger{false};
 String Configuration::CacheDir;
 int Configuration::Concurrency{1};
 bool Configuration::ConcurrencyWasModified{false};
 String Configuration::ConfigDir;
+int Configuration::CoroutineStackPoolSize{128};
+Dictionary::Ptr Configuration::CpuAffinity;
 String Configuration::DataDir;
 String Configuration::EventEngine;
 String Configuration::IncludeConfDir;
 String Configuration::InitRunDir;
+bool Configuration::InternCheckResults{false};
 String Configuration::LogDir;
+int Configuration::MaxProcessOutputSize{16 * 1024 * 1024};
 String Configuration::ModAttrPath;
 String Configuration::ObjectsPath;
 String Configuration::PidPath;
 String Configuration::PkgDataDir;
 String Configuration::PrefixDir;
+bool Configuration::ProfileFunctions{false};
+bool Configuration::ProfileObjectLocks{false};
+bool Configuration::ProfileSubsystems{false};
 String Configuration::ProgramData;
 int Configuration::RLimitFiles;
 int Configuration::RLimitProcesses;
 int Configuration::RLimitStack;
 String Configuration::RunAsGroup;
 String Configuration::RunAsUser;
+bool Configuration::ScriptBytecode{true};
+bool Configuration::ShardedIoEngine{false};
+int Configuration::SpawnHelpers{1};
 String Configuration::SpoolDir;
 String Configuration::StatePath;
+String Configuration::StatsSegmentPath;
+bool Configuration::TimingWheel{false};
 double Configuration::TlsHandshakeTimeout{10};
 String Configuration::VarsPath;
 String Configuration::ZonesDir;
@@ -87,6 +100,16 @@ void Configuration::SetApiBindPort(const String& val, bool suppress_events, cons
 	HandleUserWrite("ApiBindPort", &Configuration::ApiBindPort, val, m_ReadOnly);
 }
 
+bool Configuration::GetAsyncLogging() const
+{
+	return Configuration::AsyncLogging;
+}
+
+void Configuration::SetAsyncLogging(bool val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("AsyncLogging", &Configuration::AsyncLogging, val, m_ReadOnly);
+}
+
 bool Configuration::GetAttachDebugger() const
 {
 	return Configuration::AttachDebugger;
@@ -128,6 +151,26 @@ void Configuration::SetConfigDir(const String& val, bool suppress_events, const
 	HandleUserWrite("ConfigDir", &Configuration::ConfigDir, val, m_ReadOnly);
 }
 
+int Configuration::GetCoroutineStackPoolSize() const
+{
+	return Configuration::CoroutineStackPoolSize;
+}
+
+void Configuration::SetCoroutineStackPoolSize(int val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("CoroutineStackPoolSize", &Configuration::CoroutineStackPoolSize, val, m_ReadOnly);
+}
+
+Dictionary::Ptr Configuration::GetCpuAffinity() const
+{
+	return Configuration::CpuAffinity;
+}
+
+void Configuration::SetCpuAffinity(const Dictionary::Ptr& val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("CpuAffinity", &Configuration::CpuAffinity, val, m_ReadOnly);
+}
+
 String Configuration::GetDataDir() const
 {
 	return Configuration::DataDir;
@@ -168,6 +211,16 @@ void Configuration::SetInitRunDir(const String& val, bool suppress_events, const
 	HandleUserWrite("InitRunDir", &Configuration::InitRunDir, val, m_ReadOnly);
 }
 
+bool Configuration::GetInternCheckResults() const
+{
+	return Configuration::InternCheckResults;
+}
+
+void Configuration::SetInternCheckResults(bool val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("InternCheckResults", &Configuration::InternCheckResults, val, m_ReadOnly);
+}
+
 String Configuration::GetLogDir() const
 {
 	return Configuration::LogDir;
@@ -178,6 +231,16 @@ void Configuration::SetLogDir(const String& val, bool suppress_events, const Val
 	HandleUserWrite("LogDir", &Configuration::LogDir, val, m_ReadOnly);
 }
 
+int Configuration::GetMaxProcessOutputSize() const
+{
+	return Configuration::MaxProcessOutputSize;
+}
+
+void Configuration::SetMaxProcessOutputSize(int val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("MaxProcessOutputSize", &Configuration::MaxProcessOutputSize, val, m_ReadOnly);
+}
+
 String Configuration::GetModAttrPath() const
 {
 	return Configuration::ModAttrPath;
@@ -228,6 +291,36 @@ void Configuration::SetPrefixDir(const String& val, bool suppress_events, const
 	HandleUserWrite("PrefixDir", &Configuration::PrefixDir, val, m_ReadOnly);
 }
 
+bool Configuration::GetProfileFunctions() const
+{
+	return Configuration::ProfileFunctions;
+}
+
+void Configuration::SetProfileFunctions(bool val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("ProfileFunctions", &Configuration::ProfileFunctions, val, m_ReadOnly);
+}
+
+bool Configuration::GetProfileObjectLocks() const
+{
+	return Configuration::ProfileObjectLocks;
+}
+
+void Configuration::SetProfileObjectLocks(bool val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("ProfileObjectLocks", &Configuration::ProfileObjectLocks, val, m_ReadOnly);
+}
+
+bool Configuration::GetProfileSubsystems() const
+{
+	return Configuration::ProfileSubsystems;
+}
+
+void Configuration::SetProfileSubsystems(bool val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("ProfileSubsystems", &Configuration::ProfileSubsystems, val, m_ReadOnly);
+}
+
 String Configuration::GetProgramData() const
 {
 	return Configuration::ProgramData;
@@ -288,6 +381,36 @@ void Configuration::SetRunAsUser(const String& val, bool suppress_events, const
 	HandleUserWrite("RunAsUser", &Configuration::RunAsUser, val, m_ReadOnly);
 }
 
+bool Configuration::GetScriptBytecode() const
+{
+	return Configuration::ScriptBytecode;
+}
+
+void Configuration::SetScriptBytecode(bool val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("ScriptBytecode", &Configuration::ScriptBytecode, val, m_ReadOnly);
+}
+
+bool Configuration::GetShardedIoEngine() const
+{
+	return Configuration::ShardedIoEngine;
+}
+
+void Configuration::SetShardedIoEngine(bool val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("ShardedIoEngine", &Configuration::ShardedIoEngine, val, m_ReadOnly);
+}
+
+int Configuration::GetSpawnHelpers() const
+{
+	return Configuration::SpawnHelpers;
+}
+
+void Configuration::SetSpawnHelpers(int val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("SpawnHelpers", &Configuration::SpawnHelpers, val, m_ReadOnly);
+}
+
 String Configuration::GetSpoolDir() const
 {
 	return Configuration::SpoolDir;
@@ -308,6 +431,26 @@ void Configuration::SetStatePath(const String& val, bool suppress_events, const
 	HandleUserWrite("StatePath", &Configuration::StatePath, val, m_ReadOnly);
 }
 
+String Configuration::GetStatsSegmentPath() const
+{
+	return Configuration::StatsSegmentPath;
+}
+
+void Configuration::SetStatsSegmentPath(const String& val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("StatsSegmentPath", &Configuration::StatsSegmentPath, val, m_ReadOnly);
+}
+
+bool Configuration::GetTimingWheel() const
+{
+	return Configuration::TimingWheel;
+}
+
+void Configuration::SetTimingWheel(bool val, bool suppress_events, const Value& cookie)
+{
+	HandleUserWrite("TimingWheel", &Configuration::TimingWheel, val, m_ReadOnly);
+}
+
 double Configuration::GetTlsHandshakeTimeout() const
 {
 	return Configuration::TlsHandshakeTimeout;
@@ -25,6 +25,9 @@ public:
 	String GetApiBindPort() const override;
 	void SetApiBindPort(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
+	bool GetAsyncLogging() const override;
+	void SetAsyncLogging(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+
 	bool GetAttachDebugger() const override;
 	void SetAttachDebugger(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
 
@@ -37,6 +40,12 @@ public:
 	String GetConfigDir() const override;
 	void SetConfigDir(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
+	int GetCoroutineStackPoolSize() const override;
+	void SetCoroutineStackPoolSize(int value, bool suppress_events = false, const Value& cookie = Empty) override;
+
+	Dictionary::Ptr GetCpuAffinity() const override;
+	void SetCpuAffinity(const Dictionary::Ptr& value, bool suppress_events = false, const Value& cookie = Empty) override;
+
 	String GetDataDir() const override;
 	void SetDataDir(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
@@ -49,9 +58,15 @@ public:
 	String GetInitRunDir() const override;
 	void SetInitRunDir(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
+	bool GetInternCheckResults() const override;
+	void SetInternCheckResults(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+
 	String GetLogDir() const override;
 	void SetLogDir(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
+	int GetMaxProcessOutputSize() const override;
+	void SetMaxProcessOutputSize(int value, bool suppress_events = false, const Value& cookie = Empty) override;
+
 	String GetModAttrPath() const override;
 	void SetModAttrPath(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
@@ -67,6 +82,15 @@ public:
 	String GetPrefixDir() const override;
 	void SetPrefixDir(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
+	bool GetProfileFunctions() const override;
+	void SetProfileFunctions(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+
+	bool GetProfileObjectLocks() const override;
+	void SetProfileObjectLocks(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+
+	bool GetProfileSubsystems() const override;
+	void SetProfileSubsystems(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+
 	String GetProgramData() const override;
 	void SetProgramData(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
@@ -85,12 +109,27 @@ public:
 	String GetRunAsUser() const override;
 	void SetRunAsUser(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
+	bool GetScriptBytecode() const override;
+	void SetScriptBytecode(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+
+	bool GetShardedIoEngine() const override;
+	void SetShardedIoEngine(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+
+	int GetSpawnHelpers() const override;
+	void SetSpawnHelpers(int value, bool suppress_events = false, const Value& cookie = Empty) override;
+
 	String GetSpoolDir() const override;
 	void SetSpoolDir(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
 	String GetStatePath() const override;
 	void SetStatePath(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
+	String GetStatsSegmentPath() const override;
+	void SetStatsSegmentPath(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
+
+	bool GetTimingWheel() const override;
+	void SetTimingWheel(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+
 	double GetTlsHandshakeTimeout() const override;
 	void SetTlsHandshakeTimeout(double value, bool suppress_events = false, const Value& cookie = Empty) override;
 
@@ -115,29 +154,42 @@ public:
 
 	static String ApiBindHost;
 	static String ApiBindPort;
+	static bool AsyncLogging;
 	static bool AttachDebugger;
 	static String CacheDir;
 	static int Concurrency;
 	static bool ConcurrencyWasModified;
 	static String ConfigDir;
+	static int CoroutineStackPoolSize;
+	static Dictionary::Ptr CpuAffinity;
 	static String DataDir;
 	static String EventEngine;
 	static String IncludeConfDir;
 	static String InitRunDir;
+	static bool InternCheckResults;
 	static String LogDir;
+	static int MaxProcessOutputSize;
 	static String ModAttrPath;
 	static String ObjectsPath;
 	static String PidPath;
 	static String PkgDataDir;
 	static String PrefixDir;
+	static bool ProfileFunctions;
+	static bool ProfileObjectLocks;
+	static bool ProfileSubsystems;
 	static String ProgramData;
 	static int RLimitFiles;
 	static int RLimitProcesses;
 	static int RLimitStack;
 	static String RunAsGroup;
 	static String RunAsUser;
+	static bool ScriptBytecode;
+	static bool ShardedIoEngine;
+	static int SpawnHelpers;
 	static String SpoolDir;
 	static String StatePath;
+	static String StatsSegmentPath;
+	static bool TimingWheel;
 	static double TlsHandshakeTimeout;
 	static String VarsPath;
 	static String ZonesDir;
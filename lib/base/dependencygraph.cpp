@@ -1,47 +1,121 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "base/dependencygraph.hpp"
+#include <algorithm>
+#include <cstdint>
 
 using namespace icinga;
 
-std::mutex DependencyGraph::m_Mutex;
-std::map<Object *, std::map<Object *, int> > DependencyGraph::m_Dependencies;
+constexpr size_t DependencyGraph::ShardCount;
+std::array<DependencyGraph::Shard, DependencyGraph::ShardCount> DependencyGraph::m_Shards;
 
-void DependencyGraph::AddDependency(Object *parent, Object *child)
+size_t DependencyGraph::GetShardIndex(Object *child)
 {
-	std::unique_lock<std::mutex> lock(m_Mutex);
-	m_Dependencies[child][parent]++;
+	/* The lowest bits are the same for all objects due to their alignment. */
+	return (reinterpret_cast<uintptr_t>(child) >> 4u) % ShardCount;
 }
 
-void DependencyGraph::RemoveDependency(Object *parent, Object *child)
+void DependencyGraph::AddDependencyUnlocked(Shard& shard, Object *parent, Object *child)
 {
-	std::unique_lock<std::mutex> lock(m_Mutex);
+	shard.Dependencies[child][parent]++;
+}
 
-	auto& refs = m_Dependencies[child];
-	auto it = refs.find(parent);
+void DependencyGraph::RemoveDependencyUnlocked(Shard& shard, Object *parent, Object *child)
+{
+	auto refs (shard.Dependencies.find(child));
 
-	if (it == refs.end())
+	if (refs == shard.Dependencies.end())
+		return;
+
+	auto it = refs->second.find(parent);
+
+	if (it == refs->second.end())
 		return;
 
 	it->second--;
 
 	if (it->second == 0)
-		refs.erase(it);
+		refs->second.erase(it);
+
+	if (refs->second.empty())
+		shard.Dependencies.erase(refs);
+}
+
+/**
+ * Calls func(shard, child) for all children, locking every involved shard only once.
+ */
+template<class F>
+void DependencyGraph::ForEachShard(const std::vector<Object *>& children, const F& func)
+{
+	std::vector<std::pair<size_t, Object *>> sorted;
+
+	sorted.reserve(children.size());
+
+	for (auto child : children)
+		sorted.emplace_back(GetShardIndex(child), child);
+
+	std::sort(sorted.begin(), sorted.end());
+
+	for (auto begin (sorted.begin()); begin != sorted.end();) {
+		auto& shard (m_Shards[begin->first]);
+		std::unique_lock<std::mutex> lock (shard.Mutex);
+		auto end (begin);
+
+		for (; end != sorted.end() && end->first == begin->first; ++end)
+			func(shard, end->second);
+
+		begin = end;
+	}
+}
+
+void DependencyGraph::AddDependency(Object *parent, Object *child)
+{
+	auto& shard (m_Shards[GetShardIndex(child)]);
+	std::unique_lock<std::mutex> lock (shard.Mutex);
 
-	if (refs.empty())
-		m_Dependencies.erase(child);
+	AddDependencyUnlocked(shard, parent, child);
+}
+
+/**
+ * Does the same as AddDependency() for each child, but faster for many children.
+ */
+void DependencyGraph::AddDependencies(Object *parent, const std::vector<Object *>& children)
+{
+	ForEachShard(children, [parent](Shard& shard, Object *child) {
+		AddDependencyUnlocked(shard, parent, child);
+	});
+}
+
+void DependencyGraph::RemoveDependency(Object *parent, Object *child)
+{
+	auto& shard (m_Shards[GetShardIndex(child)]);
+	std::unique_lock<std::mutex> lock (shard.Mutex);
+
+	RemoveDependencyUnlocked(shard, parent, child);
+}
+
+/**
+ * Does the same as RemoveDependency() for each child, but faster for many children.
+ */
+void DependencyGraph::RemoveDependencies(Object *parent, const std::vector<Object *>& children)
+{
+	ForEachShard(children, [parent](Shard& shard, Object *child) {
+		RemoveDependencyUnlocked(shard, parent, child);
+	});
 }
 
 std::vector<Object::Ptr> DependencyGraph::GetParents(const Object::Ptr& child)
 {
 	std::vector<Object::Ptr> objects;
 
-	std::unique_lock<std::mutex> lock(m_Mutex);
-	auto it = m_Dependencies.find(child.get());
+	auto& shard (m_Shards[GetShardIndex(child.get())]);
+	std::unique_lock<std::mutex> lock (shard.Mutex);
+	auto it = shard.Dependencies.find(child.get());
+
+	if (it != shard.Dependencies.end()) {
+		objects.reserve(it->second.size());
 
-	if (it != m_Dependencies.end()) {
-		typedef std::pair<Object *, int> kv_pair;
-		for (const kv_pair& kv : it->second) {
+		for (auto& kv : it->second) {
 			objects.emplace_back(kv.first);
 		}
 	}
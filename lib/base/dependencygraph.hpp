@@ -5,28 +5,49 @@
 
 #include "base/i2-base.hpp"
 #include "base/object.hpp"
-#include <map>
+#include <array>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace icinga {
 
 /**
  * A graph that tracks dependencies between objects.
  *
+ * The children are spread over independently locked shards, so updates of unrelated objects don't contend.
+ *
  * @ingroup base
  */
 class DependencyGraph
 {
 public:
 	static void AddDependency(Object *parent, Object *child);
+	static void AddDependencies(Object *parent, const std::vector<Object *>& children);
 	static void RemoveDependency(Object *parent, Object *child);
+	static void RemoveDependencies(Object *parent, const std::vector<Object *>& children);
 	static std::vector<Object::Ptr> GetParents(const Object::Ptr& child);
 
 private:
 	DependencyGraph();
 
-	static std::mutex m_Mutex;
-	static std::map<Object *, std::map<Object *, int> > m_Dependencies;
+	struct Shard
+	{
+		std::mutex Mutex;
+		std::unordered_map<Object * /* child */, std::unordered_map<Object * /* parent */, int /* references */>> Dependencies;
+	};
+
+	static constexpr size_t ShardCount = 64;
+
+	static std::array<Shard, ShardCount> m_Shards;
+
+	static size_t GetShardIndex(Object *child);
+
+	static void AddDependencyUnlocked(Shard& shard, Object *parent, Object *child);
+	static void RemoveDependencyUnlocked(Shard& shard, Object *parent, Object *child);
+
+	template<class F>
+	static void ForEachShard(const std::vector<Object *>& children, const F& func);
 };
 
 }
@@ -5,29 +5,179 @@
 #include "base/debug.hpp"
 #include "base/primitivetype.hpp"
 #include "base/configwriter.hpp"
+#include <algorithm>
 #include <sstream>
 
 using namespace icinga;
 
-template class std::map<String, Value>;
-
 REGISTER_PRIMITIVE_TYPE(Dictionary, Object, Dictionary::GetPrototype());
 
 Dictionary::Dictionary(const DictionaryData& other)
 {
-	for (const auto& kv : other)
-		m_Data.insert(kv);
+	InitializeFromSorted(Block(other.begin(), other.end()));
 }
 
 Dictionary::Dictionary(DictionaryData&& other)
 {
-	for (auto& kv : other)
-		m_Data.insert(std::move(kv));
+	InitializeFromSorted(std::move(other));
 }
 
 Dictionary::Dictionary(std::initializer_list<Dictionary::Pair> init)
-	: m_Data(init)
-{ }
+{
+	InitializeFromSorted(Block(init));
+}
+
+/**
+ * Sorts the given pairs and takes them over as the dictionary's data.
+ * For duplicate keys only the first pair is kept.
+ *
+ * @param data The pairs.
+ */
+void Dictionary::InitializeFromSorted(Block&& data)
+{
+	auto less ([](const Pair& a, const Pair& b) { return a.first < b.first; });
+
+	if (!std::is_sorted(data.begin(), data.end(), less)) {
+		std::stable_sort(data.begin(), data.end(), less);
+	}
+
+	data.erase(std::unique(data.begin(), data.end(), [](const Pair& a, const Pair& b) {
+		return a.first == b.first;
+	}), data.end());
+
+	m_Length = data.size();
+
+	if (data.empty()) {
+		return;
+	}
+
+	if (data.size() <= MaxBlockSize) {
+		m_Data.emplace_back(std::move(data));
+		return;
+	}
+
+	/* Leave some room in every block for later insertions. */
+	const size_t chunk = MaxBlockSize / 2u;
+
+	m_Data.reserve((data.size() + chunk - 1u) / chunk);
+
+	for (size_t i = 0; i < data.size(); i += chunk) {
+		auto first (data.begin() + i);
+		auto last (data.begin() + std::min(i + chunk, data.size()));
+
+		m_Data.emplace_back(std::make_move_iterator(first), std::make_move_iterator(last));
+	}
+}
+
+/**
+ * Finds the block which contains (or would contain) the specified key.
+ *
+ * Note: Caller must hold m_DataMutex and m_Data must not be empty.
+ *
+ * @param key The key.
+ * @returns The block's index.
+ */
+size_t Dictionary::FindBlock(const String& key) const
+{
+	if (m_Data.size() == 1u) {
+		return 0;
+	}
+
+	auto it (std::upper_bound(m_Data.begin() + 1, m_Data.end(), key, [](const String& k, const Block& b) {
+		return k < b.front().first;
+	}));
+
+	return it - m_Data.begin() - 1;
+}
+
+/**
+ * Looks up a value.
+ *
+ * Note: Caller must hold m_DataMutex.
+ *
+ * @param key The key.
+ * @returns nullptr if the key was not found.
+ */
+const Value *Dictionary::FindUnlocked(const String& key) const
+{
+	if (m_Data.empty()) {
+		return nullptr;
+	}
+
+	auto& block (m_Data[FindBlock(key)]);
+
+	auto it (std::lower_bound(block.begin(), block.end(), key, [](const Pair& kv, const String& k) {
+		return kv.first < k;
+	}));
+
+	return it == block.end() || it->first != key ? nullptr : &it->second;
+}
+
+/**
+ * Sets a value, splitting the affected block if it becomes too large.
+ *
+ * Note: Caller must hold m_DataMutex exclusively.
+ *
+ * @param key The key.
+ * @param value The value.
+ */
+void Dictionary::SetUnlocked(const String& key, Value&& value)
+{
+	if (m_Data.empty()) {
+		m_Data.emplace_back();
+	}
+
+	size_t blockIndex = FindBlock(key);
+	auto& block (m_Data[blockIndex]);
+
+	auto it (std::lower_bound(block.begin(), block.end(), key, [](const Pair& kv, const String& k) {
+		return kv.first < k;
+	}));
+
+	if (it != block.end() && it->first == key) {
+		it->second = std::move(value);
+		return;
+	}
+
+	block.emplace(it, key, std::move(value));
+	m_Length++;
+
+	if (block.size() > MaxBlockSize) {
+		auto middle (block.begin() + block.size() / 2u);
+		Block upper (std::make_move_iterator(middle), std::make_move_iterator(block.end()));
+
+		block.erase(middle, block.end());
+		m_Data.emplace(m_Data.begin() + blockIndex + 1, std::move(upper));
+	}
+}
+
+/**
+ * Removes a pair.
+ *
+ * Note: Caller must hold m_DataMutex exclusively.
+ *
+ * @param block The pair's block.
+ * @param index The pair's index within its block.
+ * @returns An iterator to the following pair.
+ */
+Dictionary::Iterator Dictionary::RemoveUnlocked(size_t block, size_t index)
+{
+	auto& data (m_Data[block]);
+
+	data.erase(data.begin() + index);
+	m_Length--;
+
+	if (data.empty()) {
+		m_Data.erase(m_Data.begin() + block);
+		return Iterator(&m_Data, block, 0);
+	}
+
+	if (index >= data.size()) {
+		return Iterator(&m_Data, block + 1u, 0);
+	}
+
+	return Iterator(&m_Data, block, index);
+}
 
 /**
  * Retrieves a value from a dictionary.
@@ -39,12 +189,12 @@ Value Dictionary::Get(const String& key) const
 {
 	std::shared_lock<std::shared_timed_mutex> lock (m_DataMutex);
 
-	auto it = m_Data.find(key);
+	auto value (FindUnlocked(key));
 
-	if (it == m_Data.end())
+	if (!value)
 		return Empty;
 
-	return it->second;
+	return *value;
 }
 
 /**
@@ -58,12 +208,12 @@ bool Dictionary::Get(const String& key, Value *result) const
 {
 	std::shared_lock<std::shared_timed_mutex> lock (m_DataMutex);
 
-	auto it = m_Data.find(key);
+	auto value (FindUnlocked(key));
 
-	if (it == m_Data.end())
+	if (!value)
 		return false;
 
-	*result = it->second;
+	*result = *value;
 	return true;
 }
 
@@ -76,9 +226,8 @@ bool Dictionary::Get(const String& key, Value *result) const
 const Value * Dictionary::GetRef(const String& key) const
 {
 	std::shared_lock<std::shared_timed_mutex> lock (m_DataMutex);
-	auto it (m_Data.find(key));
 
-	return it == m_Data.end() ? nullptr : &it->second;
+	return FindUnlocked(key);
 }
 
 /**
@@ -96,7 +245,7 @@ void Dictionary::Set(const String& key, Value value, bool overrideFrozen)
 	if (m_Frozen && !overrideFrozen)
 		BOOST_THROW_EXCEPTION(std::invalid_argument("Value in dictionary must not be modified."));
 
-	m_Data[key] = std::move(value);
+	SetUnlocked(key, std::move(value));
 }
 
 /**
@@ -108,7 +257,7 @@ size_t Dictionary::GetLength() const
 {
 	std::shared_lock<std::shared_timed_mutex> lock (m_DataMutex);
 
-	return m_Data.size();
+	return m_Length;
 }
 
 /**
@@ -121,7 +270,7 @@ bool Dictionary::Contains(const String& key) const
 {
 	std::shared_lock<std::shared_timed_mutex> lock (m_DataMutex);
 
-	return (m_Data.find(key) != m_Data.end());
+	return FindUnlocked(key);
 }
 
 /**
@@ -135,7 +284,7 @@ Dictionary::Iterator Dictionary::Begin()
 {
 	ASSERT(OwnsLock());
 
-	return m_Data.begin();
+	return Iterator(&m_Data, 0, 0);
 }
 
 /**
@@ -149,15 +298,16 @@ Dictionary::Iterator Dictionary::End()
 {
 	ASSERT(OwnsLock());
 
-	return m_Data.end();
+	return Iterator(&m_Data, m_Data.size(), 0);
 }
 
 /**
  * Removes the item specified by the iterator from the dictionary.
  *
  * @param it The iterator.
+ * @returns An iterator to the item following the removed one.
  */
-void Dictionary::Remove(Dictionary::Iterator it)
+Dictionary::Iterator Dictionary::Remove(Dictionary::Iterator it)
 {
 	ASSERT(OwnsLock());
 	std::unique_lock<std::shared_timed_mutex> lock (m_DataMutex);
@@ -165,7 +315,7 @@ void Dictionary::Remove(Dictionary::Iterator it)
 	if (m_Frozen)
 		BOOST_THROW_EXCEPTION(std::invalid_argument("Dictionary must not be modified."));
 
-	m_Data.erase(it);
+	return RemoveUnlocked(it.m_Block, it.m_Index);
 }
 
 /**
@@ -181,13 +331,20 @@ void Dictionary::Remove(const String& key)
 	if (m_Frozen)
 		BOOST_THROW_EXCEPTION(std::invalid_argument("Dictionary must not be modified."));
 
-	Dictionary::Iterator it;
-	it = m_Data.find(key);
+	if (m_Data.empty())
+		return;
+
+	size_t block = FindBlock(key);
+	auto& data (m_Data[block]);
+
+	auto it (std::lower_bound(data.begin(), data.end(), key, [](const Pair& kv, const String& k) {
+		return kv.first < k;
+	}));
 
-	if (it == m_Data.end())
+	if (it == data.end() || it->first != key)
 		return;
 
-	m_Data.erase(it);
+	RemoveUnlocked(block, it - data.begin());
 }
 
 /**
@@ -202,14 +359,17 @@ void Dictionary::Clear()
 		BOOST_THROW_EXCEPTION(std::invalid_argument("Dictionary must not be modified."));
 
 	m_Data.clear();
+	m_Length = 0;
 }
 
 void Dictionary::CopyTo(const Dictionary::Ptr& dest) const
 {
 	std::shared_lock<std::shared_timed_mutex> lock (m_DataMutex);
 
-	for (const Dictionary::Pair& kv : m_Data) {
-		dest->Set(kv.first, kv.second);
+	for (auto& block : m_Data) {
+		for (const Dictionary::Pair& kv : block) {
+			dest->Set(kv.first, kv.second);
+		}
 	}
 }
 
@@ -238,10 +398,12 @@ Object::Ptr Dictionary::Clone() const
 	{
 		std::shared_lock<std::shared_timed_mutex> lock (m_DataMutex);
 
-		dict.reserve(GetLength());
+		dict.reserve(m_Length);
 
-		for (const Dictionary::Pair& kv : m_Data) {
-			dict.emplace_back(kv.first, kv.second.Clone());
+		for (auto& block : m_Data) {
+			for (const Dictionary::Pair& kv : block) {
+				dict.emplace_back(kv.first, kv.second.Clone());
+			}
 		}
 	}
 
@@ -259,9 +421,12 @@ std::vector<String> Dictionary::GetKeys() const
 	std::shared_lock<std::shared_timed_mutex> lock (m_DataMutex);
 
 	std::vector<String> keys;
+	keys.reserve(m_Length);
 
-	for (const Dictionary::Pair& kv : m_Data) {
-		keys.push_back(kv.first);
+	for (auto& block : m_Data) {
+		for (const Dictionary::Pair& kv : block) {
+			keys.push_back(kv.first);
+		}
 	}
 
 	return keys;
@@ -280,6 +445,12 @@ void Dictionary::Freeze()
 	m_Frozen = true;
 }
 
+bool Dictionary::IsFrozen() const
+{
+	ObjectLock olock(this);
+	return m_Frozen;
+}
+
 Value Dictionary::GetFieldByName(const String& field, bool, const DebugInfo& debugInfo) const
 {
 	Value value;
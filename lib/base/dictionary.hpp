@@ -6,7 +6,9 @@
 #include "base/i2-base.hpp"
 #include "base/object.hpp"
 #include "base/value.hpp"
+#include <boost/container/small_vector.hpp>
 #include <boost/range/iterator.hpp>
+#include <iterator>
 #include <map>
 #include <shared_mutex>
 #include <vector>
@@ -19,21 +21,109 @@ typedef std::vector<std::pair<String, Value> > DictionaryData;
 /**
  * A container that holds key-value pairs.
  *
+ * The pairs are kept sorted by key in contiguous blocks. Small dictionaries (the vast
+ * majority) consist of a single block, i.e. a sorted vector. Once a block grows beyond
+ * MaxBlockSize pairs it's split in two, so large dictionaries don't pay for moving all
+ * pairs on every insertion.
+ *
  * @ingroup base
  */
 class Dictionary final : public Object
 {
+private:
+	typedef std::vector<std::pair<String, Value> > Block;
+	typedef boost::container::small_vector<Block, 1> Blocks;
+
 public:
 	DECLARE_OBJECT(Dictionary);
 
+	typedef size_t SizeType;
+
+	typedef std::pair<String, Value> Pair;
+
 	/**
 	 * An iterator that can be used to iterate over dictionary elements.
+	 *
+	 * Unlike std::map's iterators, it's invalidated by adding or removing keys.
 	 */
-	typedef std::map<String, Value>::iterator Iterator;
-
-	typedef std::map<String, Value>::size_type SizeType;
-
-	typedef std::map<String, Value>::value_type Pair;
+	class Iterator
+	{
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef Pair value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef Pair* pointer;
+		typedef Pair& reference;
+
+		Iterator() = default;
+
+		inline Pair& operator*() const
+		{
+			return (*m_Blocks)[m_Block][m_Index];
+		}
+
+		inline Pair* operator->() const
+		{
+			return &**this;
+		}
+
+		inline Iterator& operator++()
+		{
+			if (++m_Index >= (*m_Blocks)[m_Block].size()) {
+				m_Block++;
+				m_Index = 0;
+			}
+
+			return *this;
+		}
+
+		inline Iterator operator++(int)
+		{
+			Iterator it (*this);
+			++*this;
+			return it;
+		}
+
+		inline Iterator& operator--()
+		{
+			if (m_Index == 0) {
+				m_Block--;
+				m_Index = (*m_Blocks)[m_Block].size() - 1u;
+			} else {
+				m_Index--;
+			}
+
+			return *this;
+		}
+
+		inline Iterator operator--(int)
+		{
+			Iterator it (*this);
+			--*this;
+			return it;
+		}
+
+		inline bool operator==(const Iterator& other) const
+		{
+			return m_Block == other.m_Block && m_Index == other.m_Index;
+		}
+
+		inline bool operator!=(const Iterator& other) const
+		{
+			return !(*this == other);
+		}
+
+	private:
+		friend class Dictionary;
+
+		Blocks *m_Blocks{nullptr};
+		size_t m_Block{0};
+		size_t m_Index{0};
+
+		inline Iterator(Blocks *blocks, size_t block, size_t index)
+			: m_Blocks(blocks), m_Block(block), m_Index(index)
+		{ }
+	};
 
 	Dictionary() = default;
 	Dictionary(const DictionaryData& other);
@@ -53,7 +143,7 @@ public:
 
 	void Remove(const String& key);
 
-	void Remove(Iterator it);
+	Iterator Remove(Iterator it);
 
 	void Clear();
 
@@ -69,6 +159,7 @@ public:
 	String ToString() const override;
 
 	void Freeze();
+	bool IsFrozen() const;
 
 	Value GetFieldByName(const String& field, bool sandboxed, const DebugInfo& debugInfo) const override;
 	void SetFieldByName(const String& field, const Value& value, bool overrideFrozen, const DebugInfo& debugInfo) override;
@@ -76,9 +167,19 @@ public:
 	bool GetOwnField(const String& field, Value *result) const override;
 
 private:
-	std::map<String, Value> m_Data; /**< The data for the dictionary. */
+	static constexpr size_t MaxBlockSize = 64;
+
+	Blocks m_Data; /**< The data for the dictionary. */
+	size_t m_Length{0};
 	mutable std::shared_timed_mutex m_DataMutex;
 	bool m_Frozen{false};
+
+	void InitializeFromSorted(Block&& data);
+
+	size_t FindBlock(const String& key) const;
+	const Value *FindUnlocked(const String& key) const;
+	void SetUnlocked(const String& key, Value&& value);
+	Iterator RemoveUnlocked(size_t block, size_t index);
 };
 
 Dictionary::Iterator begin(const Dictionary::Ptr& x);
@@ -86,6 +187,4 @@ Dictionary::Iterator end(const Dictionary::Ptr& x);
 
 }
 
-extern template class std::map<icinga::String, icinga::Value>;
-
 #endif /* DICTIONARY_H */
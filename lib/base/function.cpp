@@ -3,6 +3,7 @@
 #include "base/function.hpp"
 #include "base/function-ti.cpp"
 #include "base/array.hpp"
+#include "base/functionprofiler.hpp"
 #include "base/scriptframe.hpp"
 
 using namespace icinga;
@@ -21,12 +22,14 @@ Function::Function(const String& name, Callback function, const std::vector<Stri
 
 Value Function::Invoke(const std::vector<Value>& arguments)
 {
+	FunctionProfilerScope profile (this);
 	ScriptFrame frame(false);
 	return m_Callback(arguments);
 }
 
 Value Function::InvokeThis(const Value& otherThis, const std::vector<Value>& arguments)
 {
+	FunctionProfilerScope profile (this);
 	ScriptFrame frame(false, otherThis);
 	return m_Callback(arguments);
 }
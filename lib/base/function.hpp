@@ -5,14 +5,18 @@
 
 #include "base/i2-base.hpp"
 #include "base/function-ti.hpp"
+#include "base/debuginfo.hpp"
 #include "base/value.hpp"
 #include "base/functionwrapper.hpp"
 #include "base/scriptglobal.hpp"
+#include <atomic>
 #include <vector>
 
 namespace icinga
 {
 
+struct FunctionProfile;
+
 /**
  * A script function that can be used to execute a script task.
  *
@@ -44,15 +48,32 @@ public:
 		return GetDeprecated();
 	}
 
+	/**
+	 * Sets where the function was defined, i.e. for functions written in the DSL.
+	 */
+	void SetDebugInfo(const DebugInfo& di)
+	{
+		m_DebugInfo = di;
+	}
+
+	const DebugInfo& GetDebugInfo() const
+	{
+		return m_DebugInfo;
+	}
+
 	static Object::Ptr GetPrototype();
 
 	Object::Ptr Clone() const override;
 
 private:
 	Callback m_Callback;
+	DebugInfo m_DebugInfo;
+	mutable std::atomic<FunctionProfile *> m_Profile{nullptr};
 
 	Function(const String& name, Callback function, const std::vector<String>& args,
 		bool side_effect_free, bool deprecated);
+
+	friend class FunctionProfiler;
 };
 
 /* Ensure that the priority is lower than the basic namespace initialization in scriptframe.cpp. */
@@ -0,0 +1,162 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/functionprofiler.hpp"
+#include "base/function.hpp"
+#include "base/statsfunction.hpp"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+using namespace icinga;
+
+REGISTER_STATSFUNCTION(FunctionProfiler, &FunctionProfiler::StatsFunc);
+
+static Array::Ptr GetFunctionProfile()
+{
+	return FunctionProfiler::GetReport();
+}
+
+static void ResetFunctionProfile()
+{
+	FunctionProfiler::Reset();
+}
+
+REGISTER_SAFE_FUNCTION(Internal, function_profile, &GetFunctionProfile, "");
+REGISTER_FUNCTION(Internal, reset_function_profile, &ResetFunctionProfile, "");
+
+typedef std::tuple<String /* name */, String /* path */, int /* line */, int /* column */> FunctionProfileKey;
+
+/* The profiles are never freed, the functions keep pointers to them. */
+static std::mutex l_ProfilesMutex;
+static std::map<FunctionProfileKey, std::unique_ptr<FunctionProfile>> l_Profiles;
+
+struct FunctionProfilerFrame
+{
+	std::chrono::steady_clock::time_point Start;
+	uint_fast64_t ChildNanoseconds;
+};
+
+static thread_local std::vector<FunctionProfilerFrame> l_Stack;
+
+/**
+ * @returns The profile shared by all functions with the same name and location as the given one.
+ */
+FunctionProfile *FunctionProfiler::GetProfile(const Function *function)
+{
+	FunctionProfile *profile = function->m_Profile.load(std::memory_order_acquire);
+
+	if (profile)
+		return profile;
+
+	const DebugInfo& di (function->GetDebugInfo());
+	FunctionProfileKey key (function->GetName(), di.Path, di.FirstLine, di.FirstColumn);
+
+	std::unique_lock<std::mutex> lock (l_ProfilesMutex);
+	auto& entry (l_Profiles[key]);
+
+	if (!entry) {
+		entry.reset(new FunctionProfile());
+		entry->Name = function->GetName();
+		entry->Location = di;
+	}
+
+	function->m_Profile.store(entry.get(), std::memory_order_release);
+
+	return entry.get();
+}
+
+void FunctionProfiler::Begin()
+{
+	l_Stack.push_back({ std::chrono::steady_clock::now(), 0 });
+}
+
+void FunctionProfiler::End(FunctionProfile *profile)
+{
+	FunctionProfilerFrame frame (l_Stack.back());
+	l_Stack.pop_back();
+
+	auto duration (static_cast<uint_fast64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - frame.Start).count()));
+
+	if (!l_Stack.empty())
+		l_Stack.back().ChildNanoseconds += duration;
+
+	profile->Calls.fetch_add(1, std::memory_order_relaxed);
+	profile->TotalNanoseconds.fetch_add(duration, std::memory_order_relaxed);
+	profile->SelfNanoseconds.fetch_add(duration - std::min(duration, frame.ChildNanoseconds), std::memory_order_relaxed);
+}
+
+/**
+ * @param limit The maximum number of functions to report, 0 for all.
+ * @returns The called functions, sorted by their self time.
+ */
+Array::Ptr FunctionProfiler::GetReport(size_t limit)
+{
+	std::vector<const FunctionProfile *> profiles;
+
+	{
+		std::unique_lock<std::mutex> lock (l_ProfilesMutex);
+
+		for (auto& kv : l_Profiles) {
+			if (kv.second->Calls.load())
+				profiles.emplace_back(kv.second.get());
+		}
+	}
+
+	std::sort(profiles.begin(), profiles.end(), [](const FunctionProfile *a, const FunctionProfile *b) {
+		return a->SelfNanoseconds.load() > b->SelfNanoseconds.load();
+	});
+
+	if (limit && profiles.size() > limit)
+		profiles.resize(limit);
+
+	ArrayData report;
+
+	for (auto profile : profiles) {
+		auto calls (profile->Calls.load());
+		double total = profile->TotalNanoseconds.load() / 1e9;
+
+		Dictionary::Ptr entry = new Dictionary({
+			{ "name", profile->Name },
+			{ "calls", static_cast<double>(calls) },
+			{ "total", total },
+			{ "self", profile->SelfNanoseconds.load() / 1e9 },
+			{ "avg", calls ? total / calls : 0.0 }
+		});
+
+		if (!profile->Location.Path.IsEmpty()) {
+			std::ostringstream msgbuf;
+			msgbuf << profile->Location;
+			entry->Set("location", msgbuf.str());
+		}
+
+		report.emplace_back(std::move(entry));
+	}
+
+	return new Array(std::move(report));
+}
+
+/**
+ * Starts counting from zero again.
+ */
+void FunctionProfiler::Reset()
+{
+	std::unique_lock<std::mutex> lock (l_ProfilesMutex);
+
+	for (auto& kv : l_Profiles) {
+		kv.second->Calls.store(0);
+		kv.second->TotalNanoseconds.store(0);
+		kv.second->SelfNanoseconds.store(0);
+	}
+}
+
+void FunctionProfiler::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr&)
+{
+	if (IsEnabled())
+		status->Set("function_profile", GetReport(25));
+}
@@ -0,0 +1,92 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef FUNCTIONPROFILER_H
+#define FUNCTIONPROFILER_H
+
+#include "base/i2-base.hpp"
+#include "base/array.hpp"
+#include "base/configuration.hpp"
+#include "base/debuginfo.hpp"
+#include "base/dictionary.hpp"
+#include <atomic>
+#include <cstdint>
+
+namespace icinga
+{
+
+class Function;
+
+/**
+ * The calls of all functions with the same name and location, e.g. a lambda in a template.
+ *
+ * @ingroup base
+ */
+struct FunctionProfile
+{
+	String Name;
+	DebugInfo Location;
+
+	std::atomic<uint_fast64_t> Calls{0};
+	std::atomic<uint_fast64_t> TotalNanoseconds{0};
+	std::atomic<uint_fast64_t> SelfNanoseconds{0};
+};
+
+/**
+ * Counts the calls of script functions and measures their total time and their self time,
+ * i.e. excluding the functions they call (see the ProfileFunctions constant).
+ *
+ * @ingroup base
+ */
+class FunctionProfiler
+{
+public:
+	static inline bool IsEnabled()
+	{
+		return Configuration::ProfileFunctions;
+	}
+
+	static Array::Ptr GetReport(size_t limit = 0);
+	static void Reset();
+
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+
+private:
+	static FunctionProfile *GetProfile(const Function *function);
+
+	static void Begin();
+	static void End(FunctionProfile *profile);
+
+	friend class FunctionProfilerScope;
+};
+
+/**
+ * Measures a function call until it's destroyed. Does nothing unless the profiler is enabled.
+ *
+ * @ingroup base
+ */
+class FunctionProfilerScope
+{
+public:
+	inline FunctionProfilerScope(const Function *function)
+		: m_Profile(FunctionProfiler::IsEnabled() ? FunctionProfiler::GetProfile(function) : nullptr)
+	{
+		if (m_Profile)
+			FunctionProfiler::Begin();
+	}
+
+	FunctionProfilerScope(const FunctionProfilerScope&) = delete;
+	FunctionProfilerScope& operator=(const FunctionProfilerScope&) = delete;
+
+	inline ~FunctionProfilerScope()
+	{
+		if (m_Profile)
+			FunctionProfiler::End(m_Profile);
+	}
+
+private:
+	FunctionProfile *m_Profile;
+};
+
+}
+
+#endif /* FUNCTIONPROFILER_H */
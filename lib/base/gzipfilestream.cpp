@@ -0,0 +1,101 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/gzipfilestream.hpp"
+#include "base/exception.hpp"
+#include "base/objectlock.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+using namespace icinga;
+
+/**
+ * Opens the file.
+ *
+ * @param path The file's path.
+ * @param mode As for gzopen(), e.g. "rb" or "wb1" (compression level 1).
+ */
+GzipFileStream::GzipFileStream(const String& path, const char *mode)
+	: m_Path(path), m_Writing(strchr(mode, 'w') || strchr(mode, 'a'))
+{
+	errno = 0;
+	m_File = gzopen(path.CStr(), mode);
+
+	if (!m_File) {
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("gzopen")
+			<< boost::errinfo_errno(errno)
+			<< boost::errinfo_file_name(path));
+	}
+
+	(void)gzbuffer(m_File, 128 * 1024);
+}
+
+GzipFileStream::~GzipFileStream()
+{
+	if (m_File)
+		(void)gzclose(m_File);
+}
+
+size_t GzipFileStream::Read(void *buffer, size_t size)
+{
+	ObjectLock olock(this);
+
+	if (!m_File)
+		return 0;
+
+	int rc = gzread(m_File, buffer, size);
+
+	if (rc < 0)
+		BOOST_THROW_EXCEPTION(std::runtime_error("Failed to read gzip file '" + m_Path + "'"));
+
+	return rc;
+}
+
+void GzipFileStream::Write(const void *buffer, size_t size)
+{
+	ObjectLock olock(this);
+
+	if (!m_File || (size && gzwrite(m_File, buffer, size) <= 0))
+		BOOST_THROW_EXCEPTION(std::runtime_error("Failed to write gzip file '" + m_Path + "'"));
+}
+
+/**
+ * Skips to the given offset into the uncompressed data (by decompressing what's before).
+ */
+void GzipFileStream::Seek(uint_fast64_t offset)
+{
+	ObjectLock olock(this);
+
+	if (!m_File || gzseek(m_File, offset, SEEK_SET) < 0)
+		BOOST_THROW_EXCEPTION(std::runtime_error("Failed to seek in gzip file '" + m_Path + "'"));
+}
+
+/**
+ * Closes the file. When writing, throws if not everything could be written.
+ * (When reading, a truncated file has already been reported as EOF.)
+ */
+void GzipFileStream::Close()
+{
+	Stream::Close();
+
+	if (!m_File)
+		return;
+
+	int rc = gzclose(m_File);
+	m_File = nullptr;
+
+	if (rc != Z_OK && m_Writing)
+		BOOST_THROW_EXCEPTION(std::runtime_error("Failed to close gzip file '" + m_Path + "'"));
+}
+
+bool GzipFileStream::IsDataAvailable() const
+{
+	return !IsEof();
+}
+
+bool GzipFileStream::IsEof() const
+{
+	return !m_File || gzeof(m_File);
+}
@@ -0,0 +1,45 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef GZIPFILESTREAM_H
+#define GZIPFILESTREAM_H
+
+#include "base/i2-base.hpp"
+#include "base/stream.hpp"
+#include "base/string.hpp"
+#include <cstdint>
+
+struct gzFile_s;
+
+namespace icinga {
+
+/**
+ * A gzip compressed file. Files opened for reading don't have to be compressed, these are read as they are.
+ *
+ * @ingroup base
+ */
+class GzipFileStream final : public Stream
+{
+public:
+	DECLARE_PTR_TYPEDEFS(GzipFileStream);
+
+	GzipFileStream(const String& path, const char *mode);
+	~GzipFileStream() override;
+
+	size_t Read(void *buffer, size_t size) override;
+	void Write(const void *buffer, size_t size) override;
+	void Seek(uint_fast64_t offset);
+
+	void Close() override;
+
+	bool IsDataAvailable() const override;
+	bool IsEof() const override;
+
+private:
+	String m_Path;
+	bool m_Writing;
+	gzFile_s *m_File;
+};
+
+}
+
+#endif /* GZIPFILESTREAM_H */
@@ -0,0 +1,131 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/histogram.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace icinga;
+
+Histogram::Histogram()
+{
+	Reset();
+}
+
+/**
+ * Adds a value to the histogram. Negative values are counted as zero.
+ *
+ * @param seconds The duration in seconds
+ */
+void Histogram::Record(double seconds)
+{
+	uint_fast64_t us = 0;
+
+	if (seconds > 0)
+		us = seconds < 1e15 ? static_cast<uint_fast64_t>(seconds * 1e6) : UINT64_C(1) << 60;
+
+	m_Buckets[GetBucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+	m_Count.fetch_add(1, std::memory_order_relaxed);
+	m_SumMicroseconds.fetch_add(us, std::memory_order_relaxed);
+
+	auto max (m_MaxMicroseconds.load(std::memory_order_relaxed));
+
+	while (us > max && !m_MaxMicroseconds.compare_exchange_weak(max, us, std::memory_order_relaxed))
+		;
+}
+
+void Histogram::Reset()
+{
+	for (auto& bucket : m_Buckets)
+		bucket.store(0, std::memory_order_relaxed);
+
+	m_Count.store(0, std::memory_order_relaxed);
+	m_SumMicroseconds.store(0, std::memory_order_relaxed);
+	m_MaxMicroseconds.store(0, std::memory_order_relaxed);
+}
+
+uint_fast64_t Histogram::GetCount() const
+{
+	return m_Count.load(std::memory_order_relaxed);
+}
+
+/**
+ * @returns The sum of all recorded values in seconds
+ */
+double Histogram::GetSum() const
+{
+	return m_SumMicroseconds.load(std::memory_order_relaxed) / 1e6;
+}
+
+/**
+ * @returns The largest recorded value in seconds
+ */
+double Histogram::GetMax() const
+{
+	return m_MaxMicroseconds.load(std::memory_order_relaxed) / 1e6;
+}
+
+/**
+ * Estimates the value below which the given share of all recorded values fall.
+ *
+ * @param percentile Between 0 and 100, e.g. 99.9
+ * @returns The value in seconds, 0 if nothing has been recorded yet
+ */
+double Histogram::GetPercentile(double percentile) const
+{
+	uint_fast64_t total = 0;
+
+	for (auto& bucket : m_Buckets)
+		total += bucket.load(std::memory_order_relaxed);
+
+	if (!total)
+		return 0;
+
+	auto rank (static_cast<uint_fast64_t>(std::ceil(total * std::min(std::max(percentile, 0.0), 100.0) / 100.0)));
+
+	if (rank < 1)
+		rank = 1;
+
+	uint_fast64_t seen = 0;
+
+	for (size_t i = 0; i < BucketCount; i++) {
+		seen += m_Buckets[i].load(std::memory_order_relaxed);
+
+		if (seen >= rank)
+			return std::min(GetBucketValue(i), m_MaxMicroseconds.load(std::memory_order_relaxed)) / 1e6;
+	}
+
+	return GetMax();
+}
+
+size_t Histogram::GetBucketIndex(uint_fast64_t value)
+{
+	if (value < SubBuckets)
+		return value;
+
+	int magnitude = SubBucketBits;
+
+	while (magnitude < MaxMagnitude && value >> (magnitude + 1))
+		magnitude++;
+
+	if (value >> (magnitude + 1))
+		return BucketCount - 1;
+
+	auto sub ((value >> (magnitude - SubBucketBits)) - SubBuckets);
+
+	return SubBuckets + (magnitude - SubBucketBits) * SubBuckets + sub;
+}
+
+/**
+ * @returns The middle of the bucket's value range
+ */
+uint_fast64_t Histogram::GetBucketValue(size_t index)
+{
+	if (index < SubBuckets)
+		return index;
+
+	auto shift ((index - SubBuckets) / SubBuckets);
+	auto sub ((index - SubBuckets) % SubBuckets);
+	auto lower ((SubBuckets + sub) << shift);
+
+	return lower + ((UINT64_C(1) << shift) >> 1);
+}
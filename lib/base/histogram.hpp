@@ -0,0 +1,54 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "base/i2-base.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace icinga
+{
+
+/**
+ * A lock-free histogram of durations with a bounded relative error (HDR style).
+ * Values are tracked in microseconds using 32 linear sub-buckets per power of two,
+ * i.e. percentiles are off by at most ~3%. Values beyond ~50 days are clamped.
+ *
+ * @ingroup base
+ */
+class Histogram final
+{
+public:
+	Histogram();
+
+	Histogram(const Histogram&) = delete;
+	Histogram& operator=(const Histogram&) = delete;
+
+	void Record(double seconds);
+	void Reset();
+
+	uint_fast64_t GetCount() const;
+	double GetSum() const;
+	double GetMax() const;
+	double GetPercentile(double percentile) const;
+
+private:
+	static constexpr int SubBucketBits = 5;
+	static constexpr uint_fast64_t SubBuckets = 1u << SubBucketBits;
+	static constexpr int MaxMagnitude = 41;
+	static constexpr size_t BucketCount = SubBuckets + (MaxMagnitude - SubBucketBits + 1) * SubBuckets;
+
+	std::array<std::atomic<uint_fast64_t>, BucketCount> m_Buckets;
+	std::atomic<uint_fast64_t> m_Count;
+	std::atomic<uint_fast64_t> m_SumMicroseconds;
+	std::atomic<uint_fast64_t> m_MaxMicroseconds;
+
+	static size_t GetBucketIndex(uint_fast64_t value);
+	static uint_fast64_t GetBucketValue(size_t index);
+};
+
+}
+
+#endif /* HISTOGRAM_H */
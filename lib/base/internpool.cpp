@@ -0,0 +1,123 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/internpool.hpp"
+#include "base/memoryusage.hpp"
+#include "base/object-packer.hpp"
+#include "base/objectlock.hpp"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace icinga;
+
+/**
+ * A part of the pool with its own lock, so concurrent check results rarely wait for each other.
+ */
+struct InternPoolShard
+{
+	std::mutex Mutex;
+	std::unordered_map<std::string, Array::Ptr> Arrays;
+	size_t Bytes{0};
+	size_t SweepAt{1024};
+};
+
+static const size_t l_InternPoolShardCount = 16;
+static InternPoolShard l_InternPoolShards[l_InternPoolShardCount];
+static std::atomic<uint_fast64_t> l_InternPoolHits (0);
+
+REGISTER_MEMORY_USAGE_REPORTER("interned", [](std::vector<MemoryUsageEntry>& entries) {
+	uint_fast64_t arrays = 0;
+	uint_fast64_t bytes = 0;
+
+	for (auto& shard : l_InternPoolShards) {
+		std::unique_lock<std::mutex> lock (shard.Mutex);
+
+		arrays += shard.Arrays.size();
+		bytes += shard.Bytes;
+	}
+
+	entries.push_back({ "arrays", arrays, bytes });
+});
+
+/**
+ * Drops the arrays nobody but the pool refers to anymore.
+ */
+static void SweepShard(InternPoolShard& shard)
+{
+	for (auto it (shard.Arrays.begin()); it != shard.Arrays.end();) {
+		/* The pool hands out references only under the lock, so nobody can pick it up meanwhile. */
+		if (it->second->GetReferenceCount() == 1u) {
+			shard.Bytes -= it->first.size();
+			it = shard.Arrays.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	shard.SweepAt = std::max<size_t>(shard.Arrays.size() * 2u, 1024);
+}
+
+/**
+ * @param arr An array which won't be modified anymore.
+ * @returns An equal array from the pool, or arr itself (frozen) if it's the first of its kind.
+ *          Arrays containing objects (other than strings, numbers, ...) aren't interned.
+ */
+Array::Ptr InternPool::Intern(const Array::Ptr& arr)
+{
+	if (!arr)
+		return arr;
+
+	{
+		ObjectLock olock(arr);
+
+		for (const Value& item : arr) {
+			if (item.IsObject())
+				return arr;
+		}
+	}
+
+	std::string key;
+	PackObject(arr, key);
+
+	auto& shard (l_InternPoolShards[std::hash<std::string>()(key) % l_InternPoolShardCount]);
+	std::unique_lock<std::mutex> lock (shard.Mutex);
+
+	auto it (shard.Arrays.find(key));
+
+	if (it != shard.Arrays.end()) {
+		l_InternPoolHits.fetch_add(1, std::memory_order_relaxed);
+		return it->second;
+	}
+
+	if (shard.Arrays.size() >= shard.SweepAt)
+		SweepShard(shard);
+
+	arr->Freeze();
+
+	shard.Bytes += key.size();
+	shard.Arrays.emplace(std::move(key), arr);
+
+	return arr;
+}
+
+/**
+ * Interns the value if it's an array (see above).
+ */
+Value InternPool::Intern(const Value& value)
+{
+	if (value.IsObjectType<Array>())
+		return Intern(static_cast<Array::Ptr>(value));
+
+	return value;
+}
+
+/**
+ * @returns How often an array has been replaced by an equal one from the pool.
+ */
+uint_fast64_t InternPool::GetHits()
+{
+	return l_InternPoolHits.load();
+}
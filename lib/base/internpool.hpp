@@ -0,0 +1,35 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef INTERNPOOL_H
+#define INTERNPOOL_H
+
+#include "base/i2-base.hpp"
+#include "base/array.hpp"
+#include "base/value.hpp"
+#include <cstdint>
+
+namespace icinga
+{
+
+/**
+ * Shares equal arrays of scalars between their users at runtime, e.g. the command lines and
+ * the performance data of the check results of thousands of checkables running the same check.
+ *
+ * Arrays are looked up by their content and frozen once they're in the pool. The pool only
+ * holds them while also someone else does: entries it holds the last reference to are
+ * dropped whenever a shard has doubled in size since it was swept last.
+ *
+ * @ingroup base
+ */
+class InternPool
+{
+public:
+	static Array::Ptr Intern(const Array::Ptr& arr);
+	static Value Intern(const Value& value);
+
+	static uint_fast64_t GetHits();
+};
+
+}
+
+#endif /* INTERNPOOL_H */
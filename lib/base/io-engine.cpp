@@ -5,72 +5,219 @@
 #include "base/io-engine.hpp"
 #include "base/lazy-init.hpp"
 #include "base/logger.hpp"
+#include "base/profiler.hpp"
+#include "base/threadaffinity.hpp"
+#include <algorithm>
+#include <chrono>
 #include <exception>
+#include <iterator>
 #include <memory>
 #include <thread>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/post.hpp>
+#include <boost/coroutine/protected_stack_allocator.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/date_time/posix_time/ptime.hpp>
 #include <boost/system/error_code.hpp>
 
 using namespace icinga;
 
-CpuBoundWork::CpuBoundWork(boost::asio::yield_context yc)
-	: m_Done(false)
-{
-	auto& ioEngine (IoEngine::Get());
-
-	for (;;) {
-		auto availableSlots (ioEngine.m_CpuBoundSemaphore.fetch_sub(1));
+/* The names of the spans waiting for a CPU-bound work slot, by priority. */
+static const String l_CpuBoundSpanNames[] = { "low", "normal", "high" };
 
-		if (availableSlots < 1) {
-			ioEngine.m_CpuBoundSemaphore.fetch_add(1);
-			IoEngine::YieldCurrentCoroutine(yc);
-			continue;
-		}
+CpuBoundWork::CpuBoundWork(boost::asio::yield_context yc, CpuBoundPriority priority)
+	: m_Priority(priority), m_Done(false)
+{
+	ProfilerScope span ("cpu_bound_wait", l_CpuBoundSpanNames[(size_t)priority]);
 
-		break;
-	}
+	IoEngine::Get().AcquireCpuBoundSlot(yc, priority);
 }
 
 CpuBoundWork::~CpuBoundWork()
 {
 	if (!m_Done) {
-		IoEngine::Get().m_CpuBoundSemaphore.fetch_add(1);
+		IoEngine::Get().ReleaseCpuBoundSlot(m_Priority);
 	}
 }
 
 void CpuBoundWork::Done()
 {
 	if (!m_Done) {
-		IoEngine::Get().m_CpuBoundSemaphore.fetch_add(1);
+		IoEngine::Get().ReleaseCpuBoundSlot(m_Priority);
 
 		m_Done = true;
 	}
 }
 
-IoBoundWorkSlot::IoBoundWorkSlot(boost::asio::yield_context yc)
-	: yc(yc)
+IoBoundWorkSlot::IoBoundWorkSlot(boost::asio::yield_context yc, CpuBoundPriority priority)
+	: yc(yc), m_Priority(priority)
 {
-	IoEngine::Get().m_CpuBoundSemaphore.fetch_add(1);
+	IoEngine::Get().ReleaseCpuBoundSlot(priority);
 }
 
 IoBoundWorkSlot::~IoBoundWorkSlot()
 {
-	auto& ioEngine (IoEngine::Get());
+	ProfilerScope span ("cpu_bound_wait", l_CpuBoundSpanNames[(size_t)m_Priority]);
 
-	for (;;) {
-		auto availableSlots (ioEngine.m_CpuBoundSemaphore.fetch_sub(1));
+	IoEngine::Get().AcquireCpuBoundSlot(yc, m_Priority);
+}
 
-		if (availableSlots < 1) {
-			ioEngine.m_CpuBoundSemaphore.fetch_add(1);
-			IoEngine::YieldCurrentCoroutine(yc);
-			continue;
+static std::mutex l_StackPoolMutex;
+static std::vector<boost::coroutines::stack_context> l_StackPool;
+static std::atomic<size_t> l_LiveStacks (0);
+
+void PooledStackAllocator::allocate(boost::coroutines::stack_context& sctx, std::size_t size)
+{
+	{
+		std::unique_lock<std::mutex> lock (l_StackPoolMutex);
+
+		for (auto stack (l_StackPool.rbegin()); stack != l_StackPool.rend(); ++stack) {
+			if (stack->size >= size) {
+				sctx = *stack;
+				l_StackPool.erase(std::next(stack).base());
+				l_LiveStacks.fetch_add(1);
+				return;
+			}
 		}
+	}
 
-		break;
+	boost::coroutines::protected_stack_allocator().allocate(sctx, size);
+	l_LiveStacks.fetch_add(1);
+}
+
+void PooledStackAllocator::deallocate(boost::coroutines::stack_context& sctx)
+{
+	l_LiveStacks.fetch_sub(1);
+
+	{
+		std::unique_lock<std::mutex> lock (l_StackPoolMutex);
+
+		if (l_StackPool.size() < (size_t)std::max(Configuration::CoroutineStackPoolSize, 0)) {
+			l_StackPool.push_back(sctx);
+			return;
+		}
 	}
+
+	boost::coroutines::protected_stack_allocator().deallocate(sctx);
+}
+
+size_t PooledStackAllocator::GetLiveStacks()
+{
+	return l_LiveStacks.load();
+}
+
+size_t PooledStackAllocator::GetPooledStacks()
+{
+	std::unique_lock<std::mutex> lock (l_StackPoolMutex);
+
+	return l_StackPool.size();
+}
+
+/* Weighted round-robin order in which waiting priority classes get free slots.
+ * No class starves, but higher ones get more of the slots under contention.
+ */
+static const CpuBoundPriority l_CpuBoundSchedule[] = {
+	CpuBoundPriority::High, CpuBoundPriority::Normal, CpuBoundPriority::High, CpuBoundPriority::Low,
+	CpuBoundPriority::High, CpuBoundPriority::Normal, CpuBoundPriority::High
+};
+
+/**
+ * Takes a slot for CPU-bound work, waits for one in FIFO order (per priority class) if necessary.
+ *
+ * The waiting coroutine is suspended until a releasing one hands its slot over directly.
+ */
+void IoEngine::AcquireCpuBoundSlot(boost::asio::yield_context& yc, CpuBoundPriority priority)
+{
+	namespace ch = std::chrono;
+
+	auto& cls (m_CpuBoundClasses[(size_t)priority]);
+	std::unique_lock<std::mutex> lock (m_CpuBoundMutex);
+
+	bool queueEmpty = true;
+
+	for (auto& c : m_CpuBoundClasses) {
+		if (!c.Waiters.empty()) {
+			queueEmpty = false;
+			break;
+		}
+	}
+
+	if (m_CpuBoundFree > 0 && queueEmpty) {
+		--m_CpuBoundFree;
+		lock.unlock();
+	} else {
+		auto start (ch::steady_clock::now());
+
+		boost::asio::async_completion<boost::asio::yield_context, void(boost::system::error_code)> completion (yc);
+		auto handler (completion.completion_handler);
+
+		cls.Waiters.emplace_back([handler]() {
+			auto executor (boost::asio::get_associated_executor(handler));
+
+			boost::asio::post(executor, [handler]() mutable { handler(boost::system::error_code()); });
+		});
+
+		cls.Waiting.fetch_add(1);
+		lock.unlock();
+
+		completion.result.get();
+
+		cls.Waiting.fetch_sub(1);
+		cls.WaitTime.fetch_add(ch::duration_cast<ch::microseconds>(ch::steady_clock::now() - start).count());
+	}
+
+	cls.Acquired.fetch_add(1);
+	cls.InUse.fetch_add(1);
+}
+
+/**
+ * Returns a slot for CPU-bound work or hands it over to the next waiter.
+ */
+void IoEngine::ReleaseCpuBoundSlot(CpuBoundPriority priority)
+{
+	std::function<void()> wake;
+
+	m_CpuBoundClasses[(size_t)priority].InUse.fetch_sub(1);
+
+	{
+		std::unique_lock<std::mutex> lock (m_CpuBoundMutex);
+		auto scheduleLength (sizeof(l_CpuBoundSchedule) / sizeof(l_CpuBoundSchedule[0]));
+
+		for (size_t i = 0; i < scheduleLength; ++i) {
+			auto turn ((m_CpuBoundTurn + i) % scheduleLength);
+			auto& waiters (m_CpuBoundClasses[(size_t)l_CpuBoundSchedule[turn]].Waiters);
+
+			if (!waiters.empty()) {
+				wake = std::move(waiters.front());
+				waiters.pop_front();
+				m_CpuBoundTurn = (turn + 1u) % scheduleLength;
+				break;
+			}
+		}
+
+		if (!wake) {
+			++m_CpuBoundFree;
+			return;
+		}
+	}
+
+	wake();
+}
+
+std::array<CpuBoundWorkStatus, 3> IoEngine::GetCpuBoundWorkStatus() const
+{
+	std::array<CpuBoundWorkStatus, 3> status;
+
+	for (size_t i = 0; i < status.size(); ++i) {
+		auto& cls (m_CpuBoundClasses[i]);
+
+		status[i] = { cls.Acquired.load(), cls.InUse.load(), cls.Waiting.load(), cls.WaitTime.load() / 1e6 };
+	}
+
+	return status;
 }
 
 LazyInit<std::unique_ptr<IoEngine>> IoEngine::m_Instance ([]() { return std::unique_ptr<IoEngine>(new IoEngine()); });
@@ -85,14 +232,77 @@ boost::asio::io_context& IoEngine::GetIoContext()
 	return m_IoContext;
 }
 
-IoEngine::IoEngine() : m_IoContext(), m_KeepAlive(boost::asio::make_work_guard(m_IoContext)), m_Threads(decltype(m_Threads)::size_type(Configuration::Concurrency * 2u)), m_AlreadyExpiredTimer(m_IoContext)
+/**
+ * Picks the io_context for a new long-living object, e.g. a connection.
+ *
+ * In sharded mode the shards are assigned round-robin and all I/O of the object
+ * should happen on the returned io_context. Work for other shards has to be
+ * handed over explicitly via boost::asio::post(). Otherwise this is the shared
+ * io_context.
+ *
+ * @return The io_context to use
+ */
+boost::asio::io_context& IoEngine::GetShardIoContext()
+{
+	if (m_Shards.empty()) {
+		return m_IoContext;
+	}
+
+	auto& shard (*m_Shards[m_NextShard.fetch_add(1) % m_Shards.size()]);
+
+	shard.Assigned.fetch_add(1);
+
+	return shard.IoContext;
+}
+
+std::vector<IoShardStatus> IoEngine::GetShardStatus() const
+{
+	std::vector<IoShardStatus> status;
+
+	status.reserve(m_Shards.size());
+
+	for (auto& shard : m_Shards) {
+		status.push_back({ shard->Assigned.load(), shard->Latency.load() });
+	}
+
+	return status;
+}
+
+IoEngine::Shard::Shard()
+	: KeepAlive(boost::asio::make_work_guard(IoContext)), ProbeTimer(IoContext), Assigned(0), Latency(0)
+{
+}
+
+IoEngine::IoEngine() : m_IoContext(), m_KeepAlive(boost::asio::make_work_guard(m_IoContext)), m_NextShard(0), m_AlreadyExpiredTimer(m_IoContext),
+	m_CpuBoundFree(Configuration::Concurrency * 3u / 2u), m_CpuBoundTurn(0)
 {
+	auto threads (Configuration::Concurrency * 2u);
+
 	m_AlreadyExpiredTimer.expires_at(boost::posix_time::neg_infin);
-	m_CpuBoundSemaphore.store(Configuration::Concurrency * 3u / 2u);
+
+	/* In sharded mode half of the threads run one io_context each,
+	 * the others keep running the shared one for everything not pinned to a shard.
+	 */
+	if (Configuration::ShardedIoEngine && threads > 1u) {
+		m_Shards.resize(threads / 2u);
+		threads -= m_Shards.size();
+	}
+
+	m_Threads.resize(threads);
 
 	for (auto& thread : m_Threads) {
 		thread = std::thread(&IoEngine::RunEventLoop, this);
 	}
+
+	for (auto& shard : m_Shards) {
+		shard.reset(new Shard());
+
+		auto& io (shard->IoContext);
+
+		shard->Thread = std::thread([&io]() { RunEventLoop(io); });
+
+		SpawnCoroutine(io, [&shard = *shard](boost::asio::yield_context yc) { ProbeShard(shard, yc); });
+	}
 }
 
 IoEngine::~IoEngine()
@@ -103,16 +313,33 @@ IoEngine::~IoEngine()
 		});
 	}
 
+	for (auto& shard : m_Shards) {
+		boost::asio::post(shard->IoContext, []() {
+			throw TerminateIoThread();
+		});
+	}
+
 	for (auto& thread : m_Threads) {
 		thread.join();
 	}
+
+	for (auto& shard : m_Shards) {
+		shard->Thread.join();
+	}
 }
 
 void IoEngine::RunEventLoop()
 {
+	RunEventLoop(m_IoContext);
+}
+
+void IoEngine::RunEventLoop(boost::asio::io_context& io)
+{
+	ThreadAffinity::Register(ThreadRoleIo);
+
 	for (;;) {
 		try {
-			m_IoContext.run();
+			io.run();
 
 			break;
 		} catch (const TerminateIoThread&) {
@@ -124,6 +351,29 @@ void IoEngine::RunEventLoop()
 	}
 }
 
+/**
+ * Measures how late a shard runs a timer handler that is due every five seconds.
+ */
+void IoEngine::ProbeShard(Shard& shard, boost::asio::yield_context yc)
+{
+	namespace pt = boost::posix_time;
+
+	for (;;) {
+		boost::system::error_code ec;
+
+		shard.ProbeTimer.expires_from_now(pt::seconds(5));
+		shard.ProbeTimer.async_wait(yc[ec]);
+
+		if (ec) {
+			break;
+		}
+
+		auto delay (pt::microsec_clock::universal_time() - shard.ProbeTimer.expires_at());
+
+		shard.Latency.store(delay.total_microseconds() / 1e6);
+	}
+}
+
 AsioConditionVariable::AsioConditionVariable(boost::asio::io_context& io, bool init)
 	: m_Timer(io)
 {
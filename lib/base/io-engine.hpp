@@ -7,9 +7,14 @@
 #include "base/lazy-init.hpp"
 #include "base/logger.hpp"
 #include "base/shared-object.hpp"
+#include <array>
 #include <atomic>
+#include <cstdint>
+#include <deque>
 #include <exception>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -17,11 +22,44 @@
 #include <boost/exception/all.hpp>
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/dispatch.hpp>
 #include <boost/asio/spawn.hpp>
+#include <boost/coroutine/stack_context.hpp>
+#include <boost/version.hpp>
 
 namespace icinga
 {
 
+/**
+ * Priority class of CPU-bound work done in an I/O thread
+ *
+ * @ingroup base
+ */
+enum class CpuBoundPriority : uint_fast8_t
+{
+	Low = 0,
+	Normal = 1,
+	High = 2
+};
+
+/**
+ * Usage of the CPU-bound work slots by one priority class
+ *
+ * @ingroup base
+ */
+struct CpuBoundWorkStatus
+{
+	/* Number of times a slot has been taken */
+	uint_fast64_t Acquired;
+	/* Slots currently taken */
+	uint_fast32_t InUse;
+	/* Coroutines currently waiting for a slot */
+	uint_fast32_t Waiting;
+	/* Total time spent waiting for a slot in seconds */
+	double WaitTime;
+};
+
 /**
  * Scope lock for CPU-bound work done in an I/O thread
  *
@@ -30,7 +68,7 @@ namespace icinga
 class CpuBoundWork
 {
 public:
-	CpuBoundWork(boost::asio::yield_context yc);
+	CpuBoundWork(boost::asio::yield_context yc, CpuBoundPriority priority = CpuBoundPriority::Normal);
 	CpuBoundWork(const CpuBoundWork&) = delete;
 	CpuBoundWork(CpuBoundWork&&) = delete;
 	CpuBoundWork& operator=(const CpuBoundWork&) = delete;
@@ -40,6 +78,7 @@ public:
 	void Done();
 
 private:
+	CpuBoundPriority m_Priority;
 	bool m_Done;
 };
 
@@ -51,7 +90,7 @@ private:
 class IoBoundWorkSlot
 {
 public:
-	IoBoundWorkSlot(boost::asio::yield_context yc);
+	IoBoundWorkSlot(boost::asio::yield_context yc, CpuBoundPriority priority = CpuBoundPriority::Normal);
 	IoBoundWorkSlot(const IoBoundWorkSlot&) = delete;
 	IoBoundWorkSlot(IoBoundWorkSlot&&) = delete;
 	IoBoundWorkSlot& operator=(const IoBoundWorkSlot&) = delete;
@@ -60,6 +99,38 @@ public:
 
 private:
 	boost::asio::yield_context yc;
+	CpuBoundPriority m_Priority;
+};
+
+/**
+ * Load information about one I/O engine shard
+ *
+ * @ingroup base
+ */
+struct IoShardStatus
+{
+	/* Number of objects (e.g. connections) pinned to the shard so far */
+	uint_fast64_t Assigned;
+	/* Delay of the last scheduled probe handler in seconds */
+	double Latency;
+};
+
+/**
+ * Coroutine stack allocator which keeps released stacks for reuse
+ *
+ * Stacks are allocated with a guard page. Up to Configuration::CoroutineStackPoolSize
+ * of them are kept instead of being unmapped and mapped again for the next coroutine.
+ *
+ * @ingroup base
+ */
+class PooledStackAllocator
+{
+public:
+	void allocate(boost::coroutines::stack_context& sctx, std::size_t size);
+	void deallocate(boost::coroutines::stack_context& sctx);
+
+	static size_t GetLiveStacks();
+	static size_t GetPooledStacks();
 };
 
 /**
@@ -82,6 +153,10 @@ public:
 	static IoEngine& Get();
 
 	boost::asio::io_context& GetIoContext();
+	boost::asio::io_context& GetShardIoContext();
+
+	std::vector<IoShardStatus> GetShardStatus() const;
+	std::array<CpuBoundWorkStatus, 3> GetCpuBoundWorkStatus() const;
 
 	static inline size_t GetCoroutineStackSize() {
 #ifdef _WIN32
@@ -98,24 +173,28 @@ public:
 
 	template <typename Handler, typename Function>
 	static void SpawnCoroutine(Handler& h, Function f) {
+		auto body ([f](boost::asio::yield_context yc) {
+
+			try {
+				f(yc);
+			} catch (const boost::coroutines::detail::forced_unwind &) {
+				// Required for proper stack unwinding when coroutines are destroyed.
+				// https://github.com/boostorg/coroutine/issues/39
+				throw;
+			} catch (const std::exception& ex) {
+				Log(LogCritical, "IoEngine") << "Exception in coroutine: " << DiagnosticInformation(ex);
+			} catch (...) {
+				Log(LogCritical, "IoEngine", "Exception in coroutine!");
+			}
+		});
 
-		boost::asio::spawn(h,
-			[f](boost::asio::yield_context yc) {
-
-				try {
-					f(yc);
-				} catch (const boost::coroutines::detail::forced_unwind &) {
-					// Required for proper stack unwinding when coroutines are destroyed.
-					// https://github.com/boostorg/coroutine/issues/39
-					throw;
-				} catch (const std::exception& ex) {
-					Log(LogCritical, "IoEngine") << "Exception in coroutine: " << DiagnosticInformation(ex);
-				} catch (...) {
-					Log(LogCritical, "IoEngine", "Exception in coroutine!");
-				}
-			},
+#if BOOST_VERSION < 108000
+		SpawnPooledCoroutine(boost::asio::bind_executor(h, &NoopSpawnHandler), std::move(body));
+#else /* BOOST_VERSION */
+		boost::asio::spawn(h, std::move(body),
 			boost::coroutines::attributes(GetCoroutineStackSize()) // Set a pre-defined stack size.
 		);
+#endif /* BOOST_VERSION */
 	}
 
 	static inline
@@ -125,17 +204,101 @@ public:
 	}
 
 private:
+	/**
+	 * An io_context run by a single thread, used in sharded mode
+	 */
+	struct Shard
+	{
+		Shard();
+
+		boost::asio::io_context IoContext;
+		boost::asio::executor_work_guard<boost::asio::io_context::executor_type> KeepAlive;
+		boost::asio::deadline_timer ProbeTimer;
+		std::thread Thread;
+		std::atomic<uint_fast64_t> Assigned;
+		std::atomic<double> Latency;
+	};
+
+	/**
+	 * Slot usage counters of one CpuBoundPriority
+	 */
+	struct CpuBoundClass
+	{
+		std::deque<std::function<void()>> Waiters;
+		std::atomic<uint_fast64_t> Acquired {0};
+		std::atomic<uint_fast64_t> WaitTime {0};
+		std::atomic<uint_fast32_t> InUse {0};
+		std::atomic<uint_fast32_t> Waiting {0};
+	};
+
 	IoEngine();
 
+	static void NoopSpawnHandler()
+	{
+	}
+
+	/**
+	 * Does the same as boost::asio::spawn(), but takes the coroutine's stack from PooledStackAllocator.
+	 */
+	template <typename Handler, typename Function>
+	static void SpawnPooledCoroutine(Handler handler, Function function)
+	{
+		typedef boost::asio::basic_yield_context<Handler> YieldContext;
+		typedef typename YieldContext::callee_type Callee;
+		typedef typename YieldContext::caller_type Caller;
+
+		struct Data
+		{
+			boost::asio::detail::weak_ptr<Callee> Coroutine;
+			Handler Hand;
+			Function Func;
+		};
+
+		std::shared_ptr<Data> data (new Data{{}, std::move(handler), std::move(function)});
+		auto executor (boost::asio::get_associated_executor(data->Hand));
+
+		boost::asio::dispatch(executor, [data]() {
+			boost::asio::detail::shared_ptr<Callee> coroutine (new Callee(
+				[data](Caller& ca) {
+					auto keepAlive (data);
+
+#if !defined(BOOST_COROUTINES_UNIDIRECT) && !defined(BOOST_COROUTINES_V2)
+					ca(); // Yield until the coroutine pointer has been initialised.
+#endif /* !BOOST_COROUTINES_UNIDIRECT && !BOOST_COROUTINES_V2 */
+
+					const YieldContext yc (keepAlive->Coroutine, ca, keepAlive->Hand);
+
+					keepAlive->Func(yc);
+				},
+				boost::coroutines::attributes(GetCoroutineStackSize()), // Set a pre-defined stack size.
+				PooledStackAllocator()
+			));
+
+			data->Coroutine = coroutine;
+			(*coroutine)();
+		});
+	}
+
+	void AcquireCpuBoundSlot(boost::asio::yield_context& yc, CpuBoundPriority priority);
+	void ReleaseCpuBoundSlot(CpuBoundPriority priority);
+
 	void RunEventLoop();
+	static void RunEventLoop(boost::asio::io_context& io);
+	static void ProbeShard(Shard& shard, boost::asio::yield_context yc);
 
 	static LazyInit<std::unique_ptr<IoEngine>> m_Instance;
 
 	boost::asio::io_context m_IoContext;
 	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_KeepAlive;
 	std::vector<std::thread> m_Threads;
+	std::vector<std::unique_ptr<Shard>> m_Shards;
+	std::atomic<size_t> m_NextShard;
 	boost::asio::deadline_timer m_AlreadyExpiredTimer;
-	std::atomic_int_fast32_t m_CpuBoundSemaphore;
+
+	std::mutex m_CpuBoundMutex;
+	int_fast32_t m_CpuBoundFree;
+	size_t m_CpuBoundTurn;
+	std::array<CpuBoundClass, 3> m_CpuBoundClasses;
 };
 
 class TerminateIoThread : public std::exception
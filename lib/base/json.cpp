@@ -7,10 +7,15 @@
 #include "base/array.hpp"
 #include "base/objectlock.hpp"
 #include "base/convert.hpp"
+#include "base/memoryusage.hpp"
 #include "base/utility.hpp"
+#include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <cmath>
 #include <boost/exception_ptr.hpp>
 #include <cstdint>
+#include <cstring>
 #include <json.hpp>
 #include <stack>
 #include <utility>
@@ -18,6 +23,15 @@
 
 using namespace icinga;
 
+/**
+ * Builds the Value tree for JsonDecode().
+ *
+ * The members of all currently open objects and arrays are collected in one vector
+ * which is re-used during the whole parse. Every object or array starts with a
+ * placeholder item which preserves its parent object's current key. Only once an object
+ * or array is complete, its Dictionary or Array is created from exactly the needed
+ * amount of items.
+ */
 class JsonSax : public nlohmann::json_sax<nlohmann::json>
 {
 public:
@@ -39,12 +53,44 @@ public:
 
 private:
 	Value m_Root;
-	std::stack<std::pair<Dictionary*, Array*>> m_CurrentSubtree;
+	std::vector<std::pair<String, Value>> m_Items;
+	std::vector<size_t> m_CurrentSubtree; /**< Where the items of the open objects/arrays begin in m_Items */
 	String m_CurrentKey;
 
+	/* What this parse has decoded, added to the totals once it's done. */
+	MemoryUsageEntry m_Dictionaries {"dictionaries", 0, 0};
+	MemoryUsageEntry m_Arrays {"arrays", 0, 0};
+	MemoryUsageEntry m_Strings {"strings", 0, 0};
+
 	void FillCurrentTarget(Value value);
 };
 
+/**
+ * The totals of all values JsonDecode() and MsgPackDecode() have created so far (not only the
+ * ones still alive), so the rate of e.g. the API and cluster messages' allocations can be seen.
+ */
+struct JsonDecodedTotals
+{
+	std::atomic<uint_fast64_t> Items {0};
+	std::atomic<uint_fast64_t> Bytes {0};
+
+	void Add(const MemoryUsageEntry& entry)
+	{
+		if (entry.Items) {
+			Items.fetch_add(entry.Items, std::memory_order_relaxed);
+			Bytes.fetch_add(entry.Bytes, std::memory_order_relaxed);
+		}
+	}
+};
+
+static JsonDecodedTotals l_DecodedDictionaries, l_DecodedArrays, l_DecodedStrings;
+
+REGISTER_MEMORY_USAGE_REPORTER("json_decoded", [](std::vector<MemoryUsageEntry>& entries) {
+	entries.push_back({ "dictionaries", l_DecodedDictionaries.Items.load(), l_DecodedDictionaries.Bytes.load() });
+	entries.push_back({ "arrays", l_DecodedArrays.Items.load(), l_DecodedArrays.Bytes.load() });
+	entries.push_back({ "strings", l_DecodedStrings.Items.load(), l_DecodedStrings.Bytes.load() });
+});
+
 const char l_Null[] = "null";
 const char l_False[] = "false";
 const char l_True[] = "true";
@@ -68,7 +114,7 @@ public:
 	String GetResult();
 
 private:
-	std::vector<char> m_Result;
+	std::string m_Result;
 	String m_CurrentKey;
 	std::stack<std::bitset<2>> m_CurrentSubtree;
 
@@ -208,11 +254,197 @@ String icinga::JsonEncode(const Value& value, bool pretty_print)
 
 Value icinga::JsonDecode(const String& data)
 {
-	String sanitized (Utility::ValidateUTF8(data));
+	return JsonDecode(data.CStr(), data.GetLength());
+}
+
+Value icinga::JsonDecode(const char *data, size_t length)
+{
+	JsonSax stateMachine;
+
+	/* Only copy (potentially huge) messages if they actually need to be sanitized. */
+	if (Utility::IsValidUTF8(data, length)) {
+		nlohmann::json::sax_parse(data, data + length, &stateMachine);
+	} else {
+		String sanitized (Utility::ValidateUTF8(String(data, data + length)));
+
+		nlohmann::json::sax_parse(sanitized.Begin(), sanitized.End(), &stateMachine);
+	}
+
+	return stateMachine.GetResult();
+}
+
+/**
+ * Appends the lowest bytes bytes of value to out, most significant first.
+ */
+static inline
+void AppendBigEndian(std::string& out, uint_fast64_t value, unsigned bytes)
+{
+	while (bytes--) {
+		out += (char)(unsigned char)(value >> (bytes * 8u));
+	}
+}
+
+static inline
+void MsgPackEncodeLength(std::string& out, size_t length, unsigned char fixType, size_t fixMax, unsigned char type8)
+{
+	if (length <= fixMax) {
+		out += (char)(unsigned char)(fixType | length);
+	} else if (type8 && length <= 0xffu) {
+		out += (char)type8;
+		AppendBigEndian(out, length, 1);
+	} else if (length <= 0xffffu) {
+		out += (char)(unsigned char)(type8 ? type8 + 1u : fixType == 0x90 ? 0xdc : 0xde);
+		AppendBigEndian(out, length, 2);
+	} else {
+		out += (char)(unsigned char)(type8 ? type8 + 2u : fixType == 0x90 ? 0xdd : 0xdf);
+		AppendBigEndian(out, length, 4);
+	}
+}
+
+static void MsgPackEncodeValue(std::string& out, const Value& value);
+
+static inline
+void MsgPackEncodeString(std::string& out, const String& value)
+{
+	String str (Utility::ValidateUTF8(value));
+
+	MsgPackEncodeLength(out, str.GetLength(), 0xa0, 31, 0xd9);
+	out.append(str.Begin(), str.End());
+}
+
+static void MsgPackEncodeValue(std::string& out, const Value& value)
+{
+	switch (value.GetType()) {
+		case ValueNumber: {
+			double number = value.Get<double>();
+
+			/* Integers are way more common than fractions, e.g. timestamps without sub-seconds, states, etc. */
+			if (number == std::trunc(number) && number >= -9.2e18 && number <= 9.2e18) {
+				auto integer ((int_fast64_t)number);
+
+				if (integer >= 0 && integer <= 0x7f) {
+					out += (char)integer;
+				} else if (integer < 0 && integer >= -32) {
+					out += (char)(unsigned char)(0xe0 | (integer + 32));
+				} else if (integer >= INT32_MIN && integer <= INT32_MAX) {
+					out += (char)(unsigned char)0xd2;
+					AppendBigEndian(out, (uint_fast32_t)(int32_t)integer, 4);
+				} else {
+					out += (char)(unsigned char)0xd3;
+					AppendBigEndian(out, (uint_fast64_t)integer, 8);
+				}
+			} else {
+				static_assert(sizeof(number) == sizeof(uint64_t), "double must be 64 bits wide");
+
+				uint64_t bits;
+				memcpy(&bits, &number, sizeof(bits));
+
+				out += (char)(unsigned char)0xcb;
+				AppendBigEndian(out, bits, 8);
+			}
+
+			break;
+		}
+
+		case ValueBoolean:
+			out += (char)(unsigned char)(value.ToBool() ? 0xc3 : 0xc2);
+			break;
+
+		case ValueString:
+			MsgPackEncodeString(out, value.Get<String>());
+			break;
+
+		case ValueObject: {
+			const Object::Ptr& obj = value.Get<Object::Ptr>();
+
+			{
+				Namespace::Ptr ns = dynamic_pointer_cast<Namespace>(obj);
+				if (ns) {
+					ObjectLock olock(ns);
+
+					MsgPackEncodeLength(out, ns->GetLength(), 0x80, 15, 0);
+
+					for (const Namespace::Pair& kv : ns) {
+						MsgPackEncodeString(out, kv.first);
+						MsgPackEncodeValue(out, kv.second.Val);
+					}
+
+					break;
+				}
+			}
+
+			{
+				Dictionary::Ptr dict = dynamic_pointer_cast<Dictionary>(obj);
+				if (dict) {
+					ObjectLock olock(dict);
+
+					MsgPackEncodeLength(out, dict->GetLength(), 0x80, 15, 0);
+
+					for (const Dictionary::Pair& kv : dict) {
+						MsgPackEncodeString(out, kv.first);
+						MsgPackEncodeValue(out, kv.second);
+					}
+
+					break;
+				}
+			}
+
+			{
+				Array::Ptr arr = dynamic_pointer_cast<Array>(obj);
+				if (arr) {
+					ObjectLock olock(arr);
+
+					MsgPackEncodeLength(out, arr->GetLength(), 0x90, 15, 0);
+
+					for (const Value& item : arr) {
+						MsgPackEncodeValue(out, item);
+					}
+
+					break;
+				}
+			}
+
+			// Same as JsonEncode()
+			MsgPackEncodeString(out, obj->ToString());
+			break;
+		}
+
+		case ValueEmpty:
+			out += (char)(unsigned char)0xc0;
+			break;
+
+		default:
+			VERIFY(!"Invalid variant type.");
+	}
+}
+
+/**
+ * Encodes a value as MessagePack. The result is decoded by MsgPackDecode() to the same value JsonDecode()
+ * produces from the JsonEncode() result.
+ *
+ * @param value The value.
+ *
+ * @return The MessagePack encoded value.
+ */
+String icinga::MsgPackEncode(const Value& value)
+{
+	std::string out;
+
+	MsgPackEncodeValue(out, value);
+
+	return String(std::move(out));
+}
+
+Value icinga::MsgPackDecode(const String& data)
+{
+	return MsgPackDecode(data.CStr(), data.GetLength());
+}
 
+Value icinga::MsgPackDecode(const char *data, size_t length)
+{
 	JsonSax stateMachine;
 
-	nlohmann::json::sax_parse(sanitized.Begin(), sanitized.End(), &stateMachine);
+	nlohmann::json::sax_parse(data, data + length, &stateMachine, nlohmann::json::input_format_t::msgpack);
 
 	return stateMachine.GetResult();
 }
@@ -260,6 +492,9 @@ bool JsonSax::number_float(JsonSax::number_float_t val, const JsonSax::string_t&
 inline
 bool JsonSax::string(JsonSax::string_t& val)
 {
+	++m_Strings.Items;
+	m_Strings.Bytes += val.size();
+
 	FillCurrentTarget(String(std::move(val)));
 
 	return true;
@@ -268,6 +503,9 @@ bool JsonSax::string(JsonSax::string_t& val)
 inline
 bool JsonSax::binary(JsonSax::binary_t& val)
 {
+	++m_Strings.Items;
+	m_Strings.Bytes += val.size();
+
 	FillCurrentTarget(String(val.begin(), val.end()));
 
 	return true;
@@ -276,11 +514,10 @@ bool JsonSax::binary(JsonSax::binary_t& val)
 inline
 bool JsonSax::start_object(std::size_t)
 {
-	auto object (new Dictionary());
+	m_CurrentSubtree.emplace_back(m_Items.size());
 
-	FillCurrentTarget(object);
-
-	m_CurrentSubtree.push({object, nullptr});
+	/* Our parent object's current key must survive our own keys. */
+	m_Items.emplace_back(std::move(m_CurrentKey), Empty);
 
 	return true;
 }
@@ -288,6 +525,8 @@ bool JsonSax::start_object(std::size_t)
 inline
 bool JsonSax::key(JsonSax::string_t& val)
 {
+	m_Dictionaries.Bytes += val.size();
+
 	m_CurrentKey = String(std::move(val));
 
 	return true;
@@ -296,8 +535,39 @@ bool JsonSax::key(JsonSax::string_t& val)
 inline
 bool JsonSax::end_object()
 {
-	m_CurrentSubtree.pop();
-	m_CurrentKey = String();
+	auto begin (m_Items.begin() + m_CurrentSubtree.back());
+	auto end (m_Items.end());
+
+	m_CurrentSubtree.pop_back();
+
+	auto less ([](const std::pair<String, Value>& a, const std::pair<String, Value>& b) {
+		return a.first < b.first;
+	});
+
+	/* JsonEncode() emits sorted keys, so this is the usual case for our own messages. */
+	if (!std::is_sorted(begin + 1, end, less)) {
+		std::stable_sort(begin + 1, end, less);
+	}
+
+	DictionaryData data;
+	data.reserve(end - begin - 1);
+
+	for (auto it (begin + 1); it != end; ++it) {
+		/* The last of duplicate keys wins, just like with consecutive Dictionary#Set() calls. */
+		if (!data.empty() && data.back().first == it->first) {
+			data.back().second = std::move(it->second);
+		} else {
+			data.emplace_back(std::move(*it));
+		}
+	}
+
+	++m_Dictionaries.Items;
+	m_Dictionaries.Bytes += sizeof(Dictionary) + data.size() * sizeof(DictionaryData::value_type);
+
+	m_CurrentKey = std::move(begin->first);
+	m_Items.erase(begin, end);
+
+	FillCurrentTarget(new Dictionary(std::move(data)));
 
 	return true;
 }
@@ -305,11 +575,10 @@ bool JsonSax::end_object()
 inline
 bool JsonSax::start_array(std::size_t)
 {
-	auto array (new Array());
-
-	FillCurrentTarget(array);
+	m_CurrentSubtree.emplace_back(m_Items.size());
 
-	m_CurrentSubtree.push({nullptr, array});
+	/* Our parent object's current key must survive the keys of objects inside us. */
+	m_Items.emplace_back(std::move(m_CurrentKey), Empty);
 
 	return true;
 }
@@ -317,7 +586,25 @@ bool JsonSax::start_array(std::size_t)
 inline
 bool JsonSax::end_array()
 {
-	m_CurrentSubtree.pop();
+	auto begin (m_Items.begin() + m_CurrentSubtree.back());
+	auto end (m_Items.end());
+
+	m_CurrentSubtree.pop_back();
+
+	ArrayData data;
+	data.reserve(end - begin - 1);
+
+	for (auto it (begin + 1); it != end; ++it) {
+		data.emplace_back(std::move(it->second));
+	}
+
+	++m_Arrays.Items;
+	m_Arrays.Bytes += sizeof(Array) + data.size() * sizeof(ArrayData::value_type);
+
+	m_CurrentKey = std::move(begin->first);
+	m_Items.erase(begin, end);
+
+	FillCurrentTarget(new Array(std::move(data)));
 
 	return true;
 }
@@ -331,6 +618,10 @@ bool JsonSax::parse_error(std::size_t, const std::string&, const nlohmann::detai
 inline
 Value JsonSax::GetResult()
 {
+	l_DecodedDictionaries.Add(m_Dictionaries);
+	l_DecodedArrays.Add(m_Arrays);
+	l_DecodedStrings.Add(m_Strings);
+
 	return m_Root;
 }
 
@@ -338,15 +629,9 @@ inline
 void JsonSax::FillCurrentTarget(Value value)
 {
 	if (m_CurrentSubtree.empty()) {
-		m_Root = value;
+		m_Root = std::move(value);
 	} else {
-		auto& node (m_CurrentSubtree.top());
-
-		if (node.first) {
-			node.first->Set(m_CurrentKey, value);
-		} else {
-			node.second->Add(value);
-		}
+		m_Items.emplace_back(std::move(m_CurrentKey), std::move(value));
 	}
 }
 
@@ -450,14 +735,14 @@ template<bool prettyPrint>
 inline
 String JsonEncoder<prettyPrint>::GetResult()
 {
-	return String(m_Result.begin(), m_Result.end());
+	return String(std::move(m_Result));
 }
 
 template<bool prettyPrint>
 inline
 void JsonEncoder<prettyPrint>::AppendChar(char c)
 {
-	m_Result.emplace_back(c);
+	m_Result.push_back(c);
 }
 
 template<bool prettyPrint>
@@ -13,6 +13,11 @@ class Value;
 
 String JsonEncode(const Value& value, bool pretty_print = false);
 Value JsonDecode(const String& data);
+Value JsonDecode(const char *data, size_t length);
+
+String MsgPackEncode(const Value& value);
+Value MsgPackDecode(const String& data);
+Value MsgPackDecode(const char *data, size_t length);
 
 }
 
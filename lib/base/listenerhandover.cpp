@@ -0,0 +1,266 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/listenerhandover.hpp"
+#include "base/logger.hpp"
+#include "base/utility.hpp"
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#ifndef _WIN32
+#	include <netinet/in.h>
+#	include <sys/uio.h>
+#	include <unistd.h>
+#endif /* _WIN32 */
+
+using namespace icinga;
+
+#ifndef _WIN32
+/* The most sockets passed at once. */
+static const size_t l_MaxListeners = 64;
+
+/* Umbrella process' end and workers' end. */
+static int l_Channel[2] = { -1, -1 };
+
+/* In the umbrella process the listening sockets of the current worker,
+ * in a worker the ones inherited from the umbrella process which haven't been taken over (yet). */
+static std::vector<int> l_Listeners;
+
+/* The listening sockets of this worker. */
+static std::vector<int> l_Registered;
+
+static std::mutex l_Mutex;
+
+static bool IsSameAddress(const sockaddr_storage& local, const sockaddr *address, socklen_t length)
+{
+	if (local.ss_family != address->sa_family)
+		return false;
+
+	switch (address->sa_family) {
+		case AF_INET: {
+			if (length < sizeof(sockaddr_in))
+				return false;
+
+			auto& a (reinterpret_cast<const sockaddr_in&>(local));
+			auto& b (*reinterpret_cast<const sockaddr_in *>(address));
+
+			return a.sin_port == b.sin_port && a.sin_addr.s_addr == b.sin_addr.s_addr;
+		}
+		case AF_INET6: {
+			if (length < sizeof(sockaddr_in6))
+				return false;
+
+			auto& a (reinterpret_cast<const sockaddr_in6&>(local));
+			auto& b (*reinterpret_cast<const sockaddr_in6 *>(address));
+
+			return a.sin6_port == b.sin6_port && a.sin6_scope_id == b.sin6_scope_id
+				&& !memcmp(&a.sin6_addr, &b.sin6_addr, sizeof(a.sin6_addr));
+		}
+		default:
+			return false;
+	}
+}
+#endif /* _WIN32 */
+
+/**
+ * Creates the UNIX socket the workers send their listening sockets over. Called by the umbrella process.
+ */
+void ListenerHandover::InitializeUmbrella()
+{
+#ifndef _WIN32
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, l_Channel) < 0) {
+		Log(LogWarning, "ListenerHandover")
+			<< "socketpair() failed with error code " << errno << ", \"" << Utility::FormatErrorNumber(errno)
+			<< "\". Listening sockets won't be kept open across reloads.";
+
+		l_Channel[0] = -1;
+		l_Channel[1] = -1;
+		return;
+	}
+
+	Utility::SetCloExec(l_Channel[0]);
+	Utility::SetCloExec(l_Channel[1]);
+#endif /* _WIN32 */
+}
+
+/**
+ * Called by a worker right after it has been forked from the umbrella process.
+ */
+void ListenerHandover::InitializeWorker()
+{
+#ifndef _WIN32
+	if (l_Channel[0] >= 0) {
+		(void)close(l_Channel[0]);
+		l_Channel[0] = -1;
+	}
+#endif /* _WIN32 */
+}
+
+/**
+ * Takes the listening sockets the current worker sent (if it did meanwhile) instead of the ones kept so far.
+ * Called by the umbrella process periodically and before it forks a new worker.
+ */
+void ListenerHandover::ReceiveListeners()
+{
+#ifndef _WIN32
+	if (l_Channel[0] < 0)
+		return;
+
+	for (;;) {
+		char byte = 0;
+		iovec iov { &byte, 1 };
+
+		union {
+			cmsghdr Align;
+			char Buffer[CMSG_SPACE(sizeof(int) * l_MaxListeners)];
+		} control;
+
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.Buffer;
+		msg.msg_controllen = sizeof(control.Buffer);
+
+		if (recvmsg(l_Channel[0], &msg, MSG_DONTWAIT) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		std::vector<int> listeners;
+
+		for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+
+			size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+			for (size_t i = 0; i < count; i++) {
+				int fd;
+
+				memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+				Utility::SetCloExec(fd);
+
+				listeners.push_back(fd);
+			}
+		}
+
+		for (int fd : l_Listeners)
+			(void)close(fd);
+
+		l_Listeners = std::move(listeners);
+
+		Log(LogNotice, "ListenerHandover")
+			<< "Keeping " << l_Listeners.size() << " listening socket(s) of the worker open for the next reload.";
+	}
+#endif /* _WIN32 */
+}
+
+#ifndef _WIN32
+/**
+ * Takes over an inherited listening socket bound to the given address.
+ *
+ * @returns The socket, which the caller owns from now on, or -1 if there's none.
+ */
+int ListenerHandover::Adopt(const sockaddr *address, socklen_t length)
+{
+	std::unique_lock<std::mutex> lock (l_Mutex);
+
+	for (auto it (l_Listeners.begin()); it != l_Listeners.end(); ++it) {
+		sockaddr_storage local;
+		socklen_t localLength = sizeof(local);
+
+		if (getsockname(*it, reinterpret_cast<sockaddr *>(&local), &localLength) < 0)
+			continue;
+
+		if (IsSameAddress(local, address, length)) {
+			int fd = *it;
+
+			l_Listeners.erase(it);
+			Utility::SetCloExec(fd);
+
+			return fd;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Registers a listening socket of this worker to be kept open for the next one, see Publish().
+ */
+void ListenerHandover::Register(int fd)
+{
+	std::unique_lock<std::mutex> lock (l_Mutex);
+
+	l_Registered.push_back(fd);
+}
+#endif /* _WIN32 */
+
+/**
+ * Closes the inherited listening sockets which haven't been taken over (as their listeners don't exist anymore)
+ * and sends the registered ones to the umbrella process. Called by a worker once it has started.
+ */
+void ListenerHandover::Publish()
+{
+#ifndef _WIN32
+	std::unique_lock<std::mutex> lock (l_Mutex);
+
+	for (int fd : l_Listeners)
+		(void)close(fd);
+
+	l_Listeners.clear();
+
+	if (l_Channel[1] < 0)
+		return;
+
+	std::vector<int> listeners (l_Registered);
+
+	if (listeners.size() > l_MaxListeners) {
+		Log(LogWarning, "ListenerHandover")
+			<< "Only the first " << l_MaxListeners << " of " << listeners.size() << " listening sockets will be kept open across reloads.";
+
+		listeners.resize(l_MaxListeners);
+	}
+
+	char byte = 0;
+	iovec iov { &byte, 1 };
+
+	union {
+		cmsghdr Align;
+		char Buffer[CMSG_SPACE(sizeof(int) * l_MaxListeners)];
+	} control;
+
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	/* Without any sockets the umbrella process just closes the ones it kept so far. */
+	if (!listeners.empty()) {
+		msg.msg_control = control.Buffer;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * listeners.size());
+
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * listeners.size());
+
+		memcpy(CMSG_DATA(cmsg), listeners.data(), sizeof(int) * listeners.size());
+	}
+
+	while (sendmsg(l_Channel[1], &msg, 0) < 0) {
+		if (errno != EINTR) {
+			Log(LogWarning, "ListenerHandover")
+				<< "sendmsg() failed with error code " << errno << ", \"" << Utility::FormatErrorNumber(errno)
+				<< "\". Listening sockets won't be kept open for the next reload.";
+			break;
+		}
+	}
+#endif /* _WIN32 */
+}
@@ -0,0 +1,47 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef LISTENERHANDOVER_H
+#define LISTENERHANDOVER_H
+
+#include "base/i2-base.hpp"
+
+#ifndef _WIN32
+#	include <sys/socket.h>
+#endif /* _WIN32 */
+
+namespace icinga
+{
+
+/**
+ * Keeps the listening sockets open across reloads.
+ *
+ * Each worker sends its listening sockets to the umbrella process via a UNIX socket (SCM_RIGHTS)
+ * once it's started. The umbrella process keeps them, so the next worker (forked from it) inherits them
+ * and takes them over instead of binding new ones. Connections attempted while the old worker is already
+ * gone and the new one isn't listening yet wait in the sockets' backlog instead of being refused.
+ *
+ * Does nothing on Windows and without an umbrella process.
+ *
+ * @ingroup base
+ */
+class ListenerHandover
+{
+public:
+	static void InitializeUmbrella();
+	static void InitializeWorker();
+	static void ReceiveListeners();
+
+#ifndef _WIN32
+	static int Adopt(const sockaddr *address, socklen_t length);
+	static void Register(int fd);
+#endif /* _WIN32 */
+
+	static void Publish();
+
+private:
+	ListenerHandover();
+};
+
+}
+
+#endif /* LISTENERHANDOVER_H */
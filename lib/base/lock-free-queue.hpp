@@ -0,0 +1,149 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef LOCK_FREE_QUEUE_H
+#define LOCK_FREE_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace icinga
+{
+
+/**
+ * A bounded multi-producer multi-consumer FIFO queue which doesn't use any locks.
+ *
+ * Every slot carries a sequence number which tells producers and consumers whether
+ * the slot is ready to be written to or read from (see D. Vyukov's bounded MPMC queue).
+ * The capacity is rounded up to the next power of two.
+ *
+ * @ingroup base
+ */
+template<typename T>
+class LockFreeQueue
+{
+public:
+	explicit LockFreeQueue(size_t capacity)
+	{
+		size_t size = 2;
+
+		while (size < capacity) {
+			size <<= 1u;
+		}
+
+		m_Mask = size - 1u;
+		m_Slots.reset(new Slot[size]);
+
+		for (size_t i = 0; i < size; ++i) {
+			m_Slots[i].Sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	LockFreeQueue(const LockFreeQueue&) = delete;
+	LockFreeQueue(LockFreeQueue&&) = delete;
+	LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+	LockFreeQueue& operator=(LockFreeQueue&&) = delete;
+
+	/**
+	 * Appends an item to the queue.
+	 *
+	 * @returns false if the queue is full (item is left untouched), true otherwise
+	 */
+	bool TryPush(T& item)
+	{
+		Slot* slot;
+		size_t pos = m_Tail.load(std::memory_order_relaxed);
+
+		for (;;) {
+			slot = &m_Slots[pos & m_Mask];
+
+			size_t seq = slot->Sequence.load(std::memory_order_acquire);
+			auto diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+
+			if (diff == 0) {
+				if (m_Tail.compare_exchange_weak(pos, pos + 1u, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = m_Tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		slot->Item = std::move(item);
+		slot->Sequence.store(pos + 1u, std::memory_order_release);
+
+		return true;
+	}
+
+	/**
+	 * Removes the oldest item from the queue.
+	 *
+	 * @returns false if the queue is empty, true otherwise
+	 */
+	bool TryPop(T& item)
+	{
+		Slot* slot;
+		size_t pos = m_Head.load(std::memory_order_relaxed);
+
+		for (;;) {
+			slot = &m_Slots[pos & m_Mask];
+
+			size_t seq = slot->Sequence.load(std::memory_order_acquire);
+			auto diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1u);
+
+			if (diff == 0) {
+				if (m_Head.compare_exchange_weak(pos, pos + 1u, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = m_Head.load(std::memory_order_relaxed);
+			}
+		}
+
+		item = std::move(slot->Item);
+		slot->Item = T();
+		slot->Sequence.store(pos + m_Mask + 1u, std::memory_order_release);
+
+		return true;
+	}
+
+	/**
+	 * Returns the number of items in the queue. The result is only an estimate
+	 * while other threads are pushing or popping concurrently.
+	 */
+	size_t GetLength() const
+	{
+		size_t tail = m_Tail.load(std::memory_order_relaxed);
+		size_t head = m_Head.load(std::memory_order_relaxed);
+
+		return tail > head ? tail - head : 0;
+	}
+
+	size_t GetCapacity() const
+	{
+		return m_Mask + 1u;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<size_t> Sequence;
+		T Item;
+	};
+
+	std::unique_ptr<Slot[]> m_Slots;
+	size_t m_Mask;
+
+	/* Keep producers and consumers on different cache lines. */
+	alignas(64) std::atomic<size_t> m_Tail {0};
+	alignas(64) std::atomic<size_t> m_Head {0};
+};
+
+}
+
+#endif /* LOCK_FREE_QUEUE_H */
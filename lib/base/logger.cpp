@@ -9,12 +9,17 @@
 #include "base/objectlock.hpp"
 #include "base/context.hpp"
 #include "base/scriptglobal.hpp"
+#include "base/lock-free-queue.hpp"
 #ifdef _WIN32
 #include "base/windowseventloglogger.hpp"
 #endif /* _WIN32 */
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <thread>
 #include <utility>
+#include <vector>
 
 using namespace icinga;
 
@@ -39,6 +44,16 @@ LogSeverity Logger::m_ConsoleLogSeverity = LogInformation;
 std::mutex Logger::m_UpdateMinLogSeverityMutex;
 Atomic<LogSeverity> Logger::m_MinLogSeverity (LogDebug);
 
+/* State of the asynchronous logging mode, see Logger::EnableAsyncLogging(). */
+static const size_t l_AsyncLogQueueSize = 16384;
+static const size_t l_AsyncLogBatchSize = 256;
+static std::atomic<LockFreeQueue<LogEntry>*> l_AsyncLogQueue (nullptr);
+static std::atomic<uint_fast64_t> l_AsyncLogPending (0);
+static std::atomic<uint_fast64_t> l_AsyncLogDropped (0);
+static std::atomic<bool> l_AsyncLogWriterSleeping (false);
+static std::mutex l_AsyncLogMutex;
+static std::condition_variable l_AsyncLogCV;
+
 INITIALIZE_ONCE([]() {
 	ScriptGlobal::Set("System.LogDebug", LogDebug);
 	ScriptGlobal::Set("System.LogNotice", LogNotice);
@@ -164,6 +179,171 @@ bool Logger::IsConsoleLogEnabled()
 	return m_ConsoleLogEnabled;
 }
 
+/**
+ * Passes log entries to all active loggers, taking each logger's lock only once per batch.
+ */
+static void ProcessLogEntries(const LogEntry *entries, size_t count)
+{
+	for (const Logger::Ptr& logger : Logger::GetLoggers()) {
+		ObjectLock llock(logger);
+
+		if (!logger->IsActive())
+			continue;
+
+		auto minSeverity (logger->GetMinSeverity());
+
+		for (auto entry (entries); entry < entries + count; ++entry) {
+			if (entry->Severity >= minSeverity)
+				logger->ProcessLogEntry(*entry);
+		}
+
+#ifdef I2_DEBUG /* I2_DEBUG */
+		/* Always flush, don't depend on the timer. Enable this for development sprints on Linux/macOS only. Windows crashes. */
+		//logger->Flush();
+#endif /* I2_DEBUG */
+	}
+}
+
+/**
+ * Body of the asynchronous log writer thread: pops entries off the queue and hands them to the loggers in batches.
+ */
+static void AsyncLogWriterThreadProc(LockFreeQueue<LogEntry> *queue)
+{
+	Utility::SetThreadName("Log Writer");
+
+	std::vector<LogEntry> batch (l_AsyncLogBatchSize);
+	uint_fast64_t reportedDrops = 0;
+	double lastDropReport = 0;
+
+	for (;;) {
+		size_t count = 0;
+
+		while (count < batch.size() && queue->TryPop(batch[count])) {
+			++count;
+		}
+
+		if (count) {
+			ProcessLogEntries(batch.data(), count);
+
+			for (size_t i = 0; i < count; ++i) {
+				batch[i] = LogEntry();
+			}
+
+			l_AsyncLogPending.fetch_sub(count);
+		}
+
+		auto dropped (l_AsyncLogDropped.load());
+
+		if (dropped != reportedDrops) {
+			double now = Utility::GetTime();
+
+			if (now - lastDropReport >= 10) {
+				Log(LogWarning, "Logger")
+					<< "Dropped " << (dropped - reportedDrops) << " log entries because the asynchronous log queue was full "
+					<< "(" << dropped << " in total).";
+
+				reportedDrops = dropped;
+				lastDropReport = now;
+			}
+		}
+
+		if (count == batch.size()) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock (l_AsyncLogMutex);
+
+		l_AsyncLogWriterSleeping.store(true);
+
+		/* Pairs with the fence in PushAsyncLogEntry(): either we see the new entry or the producer sees us sleeping. */
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (!queue->GetLength()) {
+			l_AsyncLogCV.wait_for(lock, std::chrono::milliseconds(500));
+		}
+
+		l_AsyncLogWriterSleeping.store(false);
+	}
+}
+
+/**
+ * Hands a log entry over to the asynchronous log writer thread.
+ *
+ * @param entry The log entry, moved from unless the queue is full.
+ */
+static void PushAsyncLogEntry(LockFreeQueue<LogEntry> *queue, LogEntry& entry)
+{
+	l_AsyncLogPending.fetch_add(1);
+
+	if (!queue->TryPush(entry)) {
+		l_AsyncLogPending.fetch_sub(1);
+		l_AsyncLogDropped.fetch_add(1);
+		return;
+	}
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (l_AsyncLogWriterSleeping.load()) {
+		std::unique_lock<std::mutex> lock (l_AsyncLogMutex);
+		l_AsyncLogCV.notify_one();
+	}
+}
+
+/**
+ * Makes Log write to the configured loggers through a bounded lock-free queue and a dedicated writer thread
+ * instead of synchronously. Entries which don't fit into the queue are dropped and counted. Console output
+ * stays synchronous. This can't be undone.
+ */
+void Logger::EnableAsyncLogging()
+{
+	std::unique_lock<std::mutex> lock (l_AsyncLogMutex);
+
+	if (l_AsyncLogQueue.load()) {
+		return;
+	}
+
+	/* Never freed, the writer thread runs until the process exits. */
+	auto queue (new LockFreeQueue<LogEntry>(l_AsyncLogQueueSize));
+
+	std::thread(&AsyncLogWriterThreadProc, queue).detach();
+
+	l_AsyncLogQueue.store(queue, std::memory_order_release);
+}
+
+bool Logger::IsAsyncLoggingEnabled()
+{
+	return l_AsyncLogQueue.load(std::memory_order_acquire);
+}
+
+/**
+ * Waits (up to 10 seconds) for the asynchronous log writer thread to process all queued entries.
+ */
+void Logger::DrainAsyncLogQueue()
+{
+	if (!IsAsyncLoggingEnabled()) {
+		return;
+	}
+
+	auto deadline (std::chrono::steady_clock::now() + std::chrono::seconds(10));
+
+	while (l_AsyncLogPending.load() && std::chrono::steady_clock::now() < deadline) {
+		{
+			std::unique_lock<std::mutex> lock (l_AsyncLogMutex);
+			l_AsyncLogCV.notify_one();
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+/**
+ * Returns the number of log entries dropped so far because the asynchronous log queue was full.
+ */
+uint_fast64_t Logger::GetAsyncLogDroppedEntries()
+{
+	return l_AsyncLogDropped.load();
+}
+
 void Logger::SetConsoleLogSeverity(LogSeverity logSeverity)
 {
 	m_ConsoleLogSeverity = logSeverity;
@@ -286,21 +466,6 @@ Log::~Log()
 		}
 	}
 
-	for (const Logger::Ptr& logger : Logger::GetLoggers()) {
-		ObjectLock llock(logger);
-
-		if (!logger->IsActive())
-			continue;
-
-		if (entry.Severity >= logger->GetMinSeverity())
-			logger->ProcessLogEntry(entry);
-
-#ifdef I2_DEBUG /* I2_DEBUG */
-		/* Always flush, don't depend on the timer. Enable this for development sprints on Linux/macOS only. Windows crashes. */
-		//logger->Flush();
-#endif /* I2_DEBUG */
-	}
-
 	if (Logger::IsConsoleLogEnabled() && entry.Severity >= Logger::GetConsoleLogSeverity()) {
 		StreamLogger::ProcessLogEntry(std::cout, entry);
 
@@ -314,6 +479,14 @@ Log::~Log()
 		WindowsEventLogLogger::WriteToWindowsEventLog(entry);
 	}
 #endif /* _WIN32 */
+
+	auto queue (l_AsyncLogQueue.load(std::memory_order_acquire));
+
+	if (queue) {
+		PushAsyncLogEntry(queue, entry);
+	} else {
+		ProcessLogEntries(&entry, 1);
+	}
 }
 
 Log& Log::operator<<(const char *val)
@@ -6,6 +6,7 @@
 #include "base/atomic.hpp"
 #include "base/i2-base.hpp"
 #include "base/logger-ti.hpp"
+#include <cstdint>
 #include <set>
 #include <sstream>
 
@@ -77,6 +78,11 @@ public:
 	static void EnableTimestamp();
 	static bool IsTimestampEnabled();
 
+	static void EnableAsyncLogging();
+	static bool IsAsyncLoggingEnabled();
+	static void DrainAsyncLogQueue();
+	static uint_fast64_t GetAsyncLogDroppedEntries();
+
 	static void SetConsoleLogSeverity(LogSeverity logSeverity);
 	static LogSeverity GetConsoleLogSeverity();
 
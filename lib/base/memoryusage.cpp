@@ -0,0 +1,125 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/memoryusage.hpp"
+#include "base/configtype.hpp"
+#include "base/perfdatavalue.hpp"
+#include "base/statsfunction.hpp"
+#include "base/type.hpp"
+#include <mutex>
+#include <utility>
+
+using namespace icinga;
+
+REGISTER_STATSFUNCTION(Memory, &MemoryUsage::StatsFunc);
+
+static std::mutex l_ReportersMutex;
+static std::vector<std::pair<String, MemoryUsage::Reporter>> l_Reporters;
+
+/* The config objects per type, the values of their attributes aren't included. */
+REGISTER_MEMORY_USAGE_REPORTER("types", [](std::vector<MemoryUsageEntry>& entries) {
+	for (const Type::Ptr& type : Type::GetAllTypes()) {
+		auto *ctype = dynamic_cast<ConfigType *>(type.get());
+
+		if (!ctype)
+			continue;
+
+		uint_fast64_t count = ctype->GetObjectCount();
+
+		if (count)
+			entries.push_back({ type->GetName(), count, count * type->GetInstanceSize() });
+	}
+});
+
+/**
+ * Registers a reporter which adds the entries of a category each time the memory usage is collected.
+ *
+ * @param category The category, e.g. "work_queues". Several reporters may share one.
+ * @param reporter The reporter, called from any thread.
+ */
+void MemoryUsage::RegisterReporter(const String& category, const Reporter& reporter)
+{
+	std::unique_lock<std::mutex> lock (l_ReportersMutex);
+	l_Reporters.emplace_back(category, reporter);
+}
+
+/**
+ * @returns The entries of all reporters per category.
+ */
+std::map<String, std::vector<MemoryUsageEntry>> MemoryUsage::Collect()
+{
+	decltype(l_Reporters) reporters;
+
+	{
+		std::unique_lock<std::mutex> lock (l_ReportersMutex);
+		reporters = l_Reporters;
+	}
+
+	std::map<String, std::vector<MemoryUsageEntry>> categories;
+
+	for (auto& reporter : reporters) {
+		reporter.second(categories[reporter.first]);
+	}
+
+	return categories;
+}
+
+void MemoryUsage::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr&)
+{
+	/* The perfdata of all stats functions is part of every "icinga" check result, so it's only
+	 * added if requested via icinga_memory_perfdata (see AddPerfdata()). */
+	Dictionary::Ptr memory = new Dictionary();
+
+	for (auto& category : Collect()) {
+		/* Entries of the same name (e.g. unnamed work queues) are summed up. */
+		std::map<String, std::pair<uint_fast64_t, uint_fast64_t>> byName;
+		uint_fast64_t items = 0;
+		uint_fast64_t bytes = 0;
+
+		for (auto& entry : category.second) {
+			auto& sum (byName[entry.Name]);
+			sum.first += entry.Items;
+			sum.second += entry.Bytes;
+
+			items += entry.Items;
+			bytes += entry.Bytes;
+		}
+
+		Dictionary::Ptr entries = new Dictionary();
+
+		for (auto& kv : byName) {
+			entries->Set(kv.first, new Dictionary({
+				{ "items", kv.second.first },
+				{ "bytes", kv.second.second }
+			}));
+		}
+
+		memory->Set(category.first, new Dictionary({
+			{ "items", items },
+			{ "bytes", bytes },
+			{ "entries", entries }
+		}));
+	}
+
+	status->Set("memory", memory);
+}
+
+/**
+ * Adds the items and the bytes of every category, e.g. memory_types_items and memory_types_bytes.
+ *
+ * @param perfdata The perfdata of an "icinga" check result.
+ */
+void MemoryUsage::AddPerfdata(const Array::Ptr& perfdata)
+{
+	for (auto& category : Collect()) {
+		uint_fast64_t items = 0;
+		uint_fast64_t bytes = 0;
+
+		for (auto& entry : category.second) {
+			items += entry.Items;
+			bytes += entry.Bytes;
+		}
+
+		perfdata->Add(new PerfdataValue("memory_" + category.first + "_items", items));
+		perfdata->Add(new PerfdataValue("memory_" + category.first + "_bytes", bytes, false, "bytes"));
+	}
+}
@@ -0,0 +1,60 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef MEMORYUSAGE_H
+#define MEMORYUSAGE_H
+
+#include "base/i2-base.hpp"
+#include "base/array.hpp"
+#include "base/dictionary.hpp"
+#include "base/initialize.hpp"
+#include "base/string.hpp"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace icinga
+{
+
+/**
+ * The number of items of something and the approximate memory they use.
+ *
+ * @ingroup base
+ */
+struct MemoryUsageEntry
+{
+	String Name;
+	uint_fast64_t Items;
+	uint_fast64_t Bytes;
+};
+
+/**
+ * Collects approximate memory usage figures, e.g. the objects per type or the items of the feature queues,
+ * from reporters registered per category (see REGISTER_MEMORY_USAGE_REPORTER).
+ *
+ * The figures are estimations: the byte counts are derived from the items' own sizes and don't include
+ * the values they refer to. They're meant to spot which part grows, not to explain the RSS exactly.
+ *
+ * @ingroup base
+ */
+class MemoryUsage
+{
+public:
+	typedef std::function<void (std::vector<MemoryUsageEntry>& entries)> Reporter;
+
+	static void RegisterReporter(const String& category, const Reporter& reporter);
+
+	static std::map<String, std::vector<MemoryUsageEntry>> Collect();
+
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+	static void AddPerfdata(const Array::Ptr& perfdata);
+};
+
+#define REGISTER_MEMORY_USAGE_REPORTER(category, reporter) \
+	INITIALIZE_ONCE([]() { \
+		icinga::MemoryUsage::RegisterReporter(category, reporter); \
+	})
+
+}
+
+#endif /* MEMORYUSAGE_H */
@@ -0,0 +1,210 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/metrics.hpp"
+#include "base/exception.hpp"
+#include "base/logger.hpp"
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+using namespace icinga;
+
+void MetricsWriter::AddCounter(const String& name, const String& help, double value, const Labels& labels)
+{
+	AddSample(GetFamily(name, help, "counter"), name, labels, value);
+}
+
+void MetricsWriter::AddGauge(const String& name, const String& help, double value, const Labels& labels)
+{
+	AddSample(GetFamily(name, help, "gauge"), name, labels, value);
+}
+
+/**
+ * Adds a histogram's percentiles as quantiles of a summary. The values are in seconds.
+ */
+void MetricsWriter::AddSummary(const String& name, const String& help, const Histogram& histogram, const Labels& labels)
+{
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+	Family& family (GetFamily(name, help, "summary"));
+
+	for (double quantile : quantiles) {
+		Labels quantileLabels (labels);
+		std::ostringstream msgbuf;
+
+		msgbuf << quantile;
+		quantileLabels.emplace_back("quantile", msgbuf.str());
+
+		AddSample(family, name, quantileLabels, histogram.GetPercentile(quantile * 100));
+	}
+
+	AddSample(family, name + "_sum", labels, histogram.GetSum());
+	AddSample(family, name + "_count", labels, histogram.GetCount());
+}
+
+String MetricsWriter::Format() const
+{
+	std::string out;
+
+	for (auto& family : m_Families) {
+		out += "# HELP ";
+		out += family.first.GetData();
+		out += ' ';
+		FormatEscaped(out, family.second.Help, false);
+		out += "\n# TYPE ";
+		out += family.first.GetData();
+		out += ' ';
+		out += family.second.Type.GetData();
+		out += '\n';
+		out += family.second.Samples;
+	}
+
+	return std::move(out);
+}
+
+/**
+ * Calls the visitor for each sample in the order of Format() with the sample's name and labels
+ * as formatted (e.g. "requests_total{method="GET"}") and its value.
+ */
+void MetricsWriter::VisitSamples(const SampleVisitor& visitor) const
+{
+	for (auto& family : m_Families) {
+		for (auto& ref : family.second.Refs) {
+			visitor(family.second.Samples.data() + ref.Begin, ref.End - ref.Begin, ref.Value);
+		}
+	}
+}
+
+MetricsWriter::Family& MetricsWriter::GetFamily(const String& name, const String& help, const String& type)
+{
+	auto pos (m_FamilyIndices.find(name));
+
+	if (pos != m_FamilyIndices.end()) {
+		auto& family (m_Families[pos->second].second);
+
+		if (family.Type != type)
+			BOOST_THROW_EXCEPTION(std::invalid_argument("Metric '" + name + "' has already been added as " + family.Type + "."));
+
+		return family;
+	}
+
+	m_FamilyIndices.emplace(name, m_Families.size());
+	m_Families.emplace_back(name, Family{help, type, std::string(), {}});
+
+	return m_Families.back().second;
+}
+
+void MetricsWriter::AddSample(Family& family, const String& name, const Labels& labels, double value)
+{
+	std::string& out (family.Samples);
+	size_t begin = out.size();
+
+	out += name.GetData();
+
+	if (!labels.empty()) {
+		bool first = true;
+
+		out += '{';
+
+		for (auto& label : labels) {
+			if (!first)
+				out += ',';
+
+			first = false;
+
+			out += label.first.GetData();
+			out += "=\"";
+			FormatEscaped(out, label.second, true);
+			out += '"';
+		}
+
+		out += '}';
+	}
+
+	family.Refs.push_back({ begin, out.size(), value });
+
+	out += ' ';
+	FormatValue(out, value);
+	out += '\n';
+}
+
+void MetricsWriter::FormatValue(std::string& out, double value)
+{
+	if (std::isnan(value)) {
+		out += "NaN";
+	} else if (std::isinf(value)) {
+		out += value > 0 ? "+Inf" : "-Inf";
+	} else {
+		std::ostringstream msgbuf;
+
+		/* counters are printed with all their digits, everything else doesn't need more than 15 of them */
+		if (std::trunc(value) == value && std::fabs(value) < 1e18)
+			msgbuf << std::fixed << std::setprecision(0) << value;
+		else
+			msgbuf << std::setprecision(15) << value;
+
+		out += msgbuf.str();
+	}
+}
+
+/**
+ * Escapes backslashes and newlines (HELP texts) and additionally double quotes (label values).
+ */
+void MetricsWriter::FormatEscaped(std::string& out, const String& text, bool quotes)
+{
+	for (char ch : text) {
+		switch (ch) {
+			case '\\':
+				out += "\\\\";
+				break;
+			case '\n':
+				out += "\\n";
+				break;
+			case '"':
+				out += quotes ? "\\\"" : "\"";
+				break;
+			default:
+				out += ch;
+		}
+	}
+}
+
+void MetricsRegistry::Register(const Callback& callback)
+{
+	GetCallbacks().emplace_back(callback);
+}
+
+/**
+ * Runs all registered callbacks and returns their metrics in the text exposition format.
+ */
+String MetricsRegistry::Collect()
+{
+	MetricsWriter writer;
+
+	Collect(writer);
+
+	return writer.Format();
+}
+
+/**
+ * Runs all registered callbacks with the given writer.
+ */
+void MetricsRegistry::Collect(MetricsWriter& writer)
+{
+	for (auto& callback : GetCallbacks()) {
+		try {
+			callback(writer);
+		} catch (const std::exception& ex) {
+			Log(LogWarning, "MetricsRegistry")
+				<< "Error while collecting metrics: " << DiagnosticInformation(ex, false);
+		}
+	}
+}
+
+/* Callbacks are only registered during initialization, i.e. before metrics are collected concurrently. */
+std::vector<MetricsRegistry::Callback>& MetricsRegistry::GetCallbacks()
+{
+	static std::vector<Callback> callbacks;
+
+	return callbacks;
+}
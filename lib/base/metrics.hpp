@@ -0,0 +1,91 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "base/i2-base.hpp"
+#include "base/histogram.hpp"
+#include "base/initialize.hpp"
+#include "base/string.hpp"
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace icinga
+{
+
+/**
+ * Formats metrics in the Prometheus text exposition format, which OpenMetrics parsers accept as well.
+ * Samples of the same metric are grouped below its HELP and TYPE lines, no matter in which order they are added.
+ *
+ * @ingroup base
+ */
+class MetricsWriter
+{
+public:
+	typedef std::vector<std::pair<String, String>> Labels;
+
+	void AddCounter(const String& name, const String& help, double value, const Labels& labels = {});
+	void AddGauge(const String& name, const String& help, double value, const Labels& labels = {});
+	void AddSummary(const String& name, const String& help, const Histogram& histogram, const Labels& labels = {});
+
+	String Format() const;
+
+	typedef std::function<void (const char *key, size_t length, double value)> SampleVisitor;
+	void VisitSamples(const SampleVisitor& visitor) const;
+
+private:
+	struct SampleRef
+	{
+		size_t Begin;
+		size_t End;
+		double Value;
+	};
+
+	struct Family
+	{
+		String Help;
+		String Type;
+		std::string Samples;
+		std::vector<SampleRef> Refs;
+	};
+
+	std::vector<std::pair<String, Family>> m_Families;
+	std::map<String, size_t> m_FamilyIndices;
+
+	Family& GetFamily(const String& name, const String& help, const String& type);
+
+	static void AddSample(Family& family, const String& name, const Labels& labels, double value);
+	static void FormatValue(std::string& out, double value);
+	static void FormatEscaped(std::string& out, const String& text, bool quotes);
+};
+
+/**
+ * Collects metrics from all registered callbacks. The callbacks read counters directly
+ * and are expected to be cheap, i.e. not to iterate over large numbers of objects.
+ *
+ * @ingroup base
+ */
+class MetricsRegistry
+{
+public:
+	typedef std::function<void (MetricsWriter& writer)> Callback;
+
+	static void Register(const Callback& callback);
+	static String Collect();
+	static void Collect(MetricsWriter& writer);
+
+private:
+	MetricsRegistry();
+
+	static std::vector<Callback>& GetCallbacks();
+};
+
+#define REGISTER_METRICS(callback) \
+	INITIALIZE_ONCE([]() { MetricsRegistry::Register(callback); })
+
+}
+
+#endif /* METRICS_H */
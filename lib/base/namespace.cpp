@@ -45,6 +45,23 @@ bool Namespace::Get(const String& field, Value *value) const
 	return true;
 }
 
+/**
+ * Like Get(), but only succeeds for constants, i.e. for values which can't be replaced anymore.
+ */
+bool Namespace::GetConst(const String& field, Value *value) const
+{
+	auto lock(ReadLockUnlessFrozen());
+
+	auto nsVal = m_Data.find(field);
+
+	if (nsVal == m_Data.end() || !nsVal->second.Const) {
+		return false;
+	}
+
+	*value = nsVal->second.Val;
+	return true;
+}
+
 void Namespace::Set(const String& field, const Value& value, bool isConst, const DebugInfo& debugInfo)
 {
 	ObjectLock olock(this);
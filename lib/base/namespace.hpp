@@ -69,6 +69,7 @@ public:
 
 	Value Get(const String& field) const;
 	bool Get(const String& field, Value *value) const;
+	bool GetConst(const String& field, Value *value) const;
 	void Set(const String& field, const Value& value, bool isConst = false, const DebugInfo& debugInfo = DebugInfo());
 	bool Contains(const String& field) const;
 	void Remove(const String& field);
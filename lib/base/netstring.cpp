@@ -3,9 +3,14 @@
 #include "base/netstring.hpp"
 #include "base/debug.hpp"
 #include "base/tlsstream.hpp"
+#include <algorithm>
+#include <array>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 #include <memory>
 #include <sstream>
+#include <string>
 #include <utility>
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/read.hpp>
@@ -322,6 +327,32 @@ size_t NetString::WriteStringToStream(const Shared<AsioTlsStream>::Ptr& stream,
 	return msg.GetLength();
 }
 
+/**
+ * Writes data directly into the TLS layer using the netstring format, without copying it.
+ * Anything still in the write buffer of the buffered stream above must have been flushed before.
+ *
+ * @param stream The stream.
+ * @param str The String that is to be written.
+ *
+ * @return The amount of bytes written.
+ */
+size_t NetString::WriteStringToStream(UnbufferedAsioTlsStream& stream, const String& str, boost::asio::yield_context yc)
+{
+	namespace asio = boost::asio;
+
+	std::string header (std::to_string(str.GetLength()) + ":");
+
+	std::array<asio::const_buffer, 3> buffers {{
+		asio::const_buffer(header.data(), header.size()),
+		asio::const_buffer(str.CStr(), str.GetLength()),
+		asio::const_buffer(",", 1)
+	}};
+
+	asio::async_write(stream, buffers, yc);
+
+	return header.size() + str.GetLength() + 1u;
+}
+
 /**
  * Writes data into a stream using the netstring format.
  *
@@ -332,3 +363,183 @@ void NetString::WriteStringToStream(std::ostream& stream, const String& str)
 {
 	stream << str.GetLength() << ":" << str << ",";
 }
+
+/**
+ * Appends data to a buffer using the netstring format, e.g. for writing multiple strings at once.
+ *
+ * @param buffer The buffer.
+ * @param str The String that is to be appended.
+ *
+ * @return The amount of bytes appended.
+ */
+size_t NetString::WriteStringToBuffer(std::string& buffer, const String& str)
+{
+	auto oldSize (buffer.size());
+
+	buffer += std::to_string(str.GetLength());
+	buffer += ':';
+	buffer.append(str.CStr(), str.GetLength());
+	buffer += ',';
+
+	return buffer.size() - oldSize;
+}
+
+NetStringReader::NetStringReader(size_t blockSize)
+	: m_Capacity(0), m_BlockSize(blockSize), m_Begin(0), m_End(0), m_Needed(0),
+	m_Limit(std::numeric_limits<size_t>::max())
+{
+}
+
+/**
+ * Reads the next netstring from the stream.
+ *
+ * @param stream The stream to read from. Nothing else may read from it meanwhile.
+ * @param yc Yield Context for ASIO
+ * @param maxMessageLength The maximum length of the payload, -1 for none.
+ *
+ * @returns The payload, valid until the next call.
+ * @exception invalid_argument The input stream is invalid.
+ */
+boost::string_view NetStringReader::Read(const Shared<AsioTlsStream>::Ptr& stream, boost::asio::yield_context yc, ssize_t maxMessageLength)
+{
+	boost::string_view message;
+
+	while (!Parse(message, maxMessageLength)) {
+		auto buffer (Prepare());
+
+		/* Once the stream's own (small) buffer is drained, the TLS layer decrypts right into ours. */
+		if (stream->in_avail()) {
+			Commit(stream->async_read_some(buffer, yc));
+		} else {
+			Commit(stream->next_layer().async_read_some(buffer, yc));
+		}
+	}
+
+	return message;
+}
+
+/**
+ * Takes the next netstring from the data committed so far, if it's complete.
+ *
+ * @param[out] message The payload, valid until the next call of Prepare().
+ * @param maxMessageLength The maximum length of the payload, -1 for none.
+ *
+ * @returns Whether a netstring was complete.
+ * @exception invalid_argument The input stream is invalid.
+ */
+bool NetStringReader::Parse(boost::string_view& message, ssize_t maxMessageLength)
+{
+	const char *data = m_Buffer.get() + m_Begin;
+	size_t available = m_End - m_Begin;
+	size_t headerLength = 0;
+	size_t len = 0;
+
+	for (;; ++headerLength) {
+		if (headerLength == available) {
+			return false;
+		}
+
+		char byte = data[headerLength];
+
+		if (isdigit(byte)) {
+			if (headerLength == 9) {
+				BOOST_THROW_EXCEPTION(std::invalid_argument("Length specifier must not exceed 9 characters"));
+			}
+
+			if (headerLength == 1 && data[0] == '0') {
+				BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid NetString (leading zero)"));
+			}
+
+			len = len * 10u + size_t(byte - '0');
+		} else if (byte == ':') {
+			if (!headerLength) {
+				BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid NetString (no length specifier)"));
+			}
+
+			break;
+		} else {
+			BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid NetString (missing :)"));
+		}
+	}
+
+	if (maxMessageLength >= 0 && len > (size_t)maxMessageLength) {
+		std::stringstream errorMessage;
+		errorMessage << "Max data length exceeded: " << (maxMessageLength / 1024) << " KB";
+
+		BOOST_THROW_EXCEPTION(std::invalid_argument(errorMessage.str()));
+	}
+
+	/* The length specifier, ':', the payload and ','. */
+	m_Needed = headerLength + 1u + len + 1u;
+	m_Limit = maxMessageLength >= 0 ? 9u + 1u + maxMessageLength + 1u : std::numeric_limits<size_t>::max();
+
+	if (available < m_Needed) {
+		return false;
+	}
+
+	if (data[m_Needed - 1u] != ',') {
+		BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid NetString (missing ,)"));
+	}
+
+	message = boost::string_view(data + headerLength + 1u, len);
+
+	m_Begin += m_Needed;
+	m_Needed = 0;
+
+	return true;
+}
+
+/**
+ * Makes room for reading more data, which invalidates the messages returned by Parse() so far.
+ *
+ * @returns The free part of the buffer, see Commit().
+ */
+boost::asio::mutable_buffer NetStringReader::Prepare()
+{
+	if (m_Begin == m_End) {
+		m_Begin = 0;
+		m_End = 0;
+
+		/* Don't keep the memory an exceptionally large message required. */
+		if (m_Capacity > m_BlockSize * 16u) {
+			m_Buffer.reset();
+			m_Capacity = 0;
+		}
+	} else if (m_Begin && (m_Begin + m_Needed > m_Capacity || m_Capacity - m_End < m_BlockSize / 2u)) {
+		memmove(m_Buffer.get(), m_Buffer.get() + m_Begin, m_End - m_Begin);
+
+		m_End -= m_Begin;
+		m_Begin = 0;
+	}
+
+	if (m_Begin + m_Needed > m_Capacity || m_End == m_Capacity) {
+		size_t capacity = std::max(std::max(m_Needed, m_End - m_Begin + 1u),
+			std::min(std::max(m_Capacity * 2u, m_BlockSize), m_Limit));
+
+		std::unique_ptr<char[]> buffer (new char[capacity]);
+
+		if (m_End > m_Begin) {
+			memcpy(buffer.get(), m_Buffer.get() + m_Begin, m_End - m_Begin);
+		}
+
+		m_Buffer = std::move(buffer);
+		m_Capacity = capacity;
+		m_End -= m_Begin;
+		m_Begin = 0;
+	}
+
+	return boost::asio::mutable_buffer(m_Buffer.get() + m_End, m_Capacity - m_End);
+}
+
+/**
+ * Adds the given number of bytes written to the beginning of the buffer Prepare() returned.
+ */
+void NetStringReader::Commit(size_t bytes)
+{
+	m_End += bytes;
+}
+
+size_t NetStringReader::GetCapacity() const
+{
+	return m_Capacity;
+}
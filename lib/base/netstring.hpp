@@ -7,7 +7,10 @@
 #include "base/stream.hpp"
 #include "base/tlsstream.hpp"
 #include <memory>
+#include <string>
+#include <boost/asio/buffer.hpp>
 #include <boost/asio/spawn.hpp>
+#include <boost/utility/string_view.hpp>
 
 namespace icinga
 {
@@ -32,12 +35,49 @@ public:
 	static size_t WriteStringToStream(const Stream::Ptr& stream, const String& message);
 	static size_t WriteStringToStream(const Shared<AsioTlsStream>::Ptr& stream, const String& message);
 	static size_t WriteStringToStream(const Shared<AsioTlsStream>::Ptr& stream, const String& message, boost::asio::yield_context yc);
+	static size_t WriteStringToStream(UnbufferedAsioTlsStream& stream, const String& message, boost::asio::yield_context yc);
 	static void WriteStringToStream(std::ostream& stream, const String& message);
+	static size_t WriteStringToBuffer(std::string& buffer, const String& message);
 
 private:
 	NetString();
 };
 
+/**
+ * Reads netstrings from one connection into a buffer which is reused for all of them.
+ *
+ * The stream is read in large blocks and the messages are framed in place, so they're handed out
+ * as views into the buffer which stay valid until the next Read(). The buffer grows geometrically
+ * (but not beyond what the maximum message length requires) if a message doesn't fit.
+ *
+ * @ingroup base
+ */
+class NetStringReader
+{
+public:
+	NetStringReader(size_t blockSize = 64 * 1024);
+
+	NetStringReader(const NetStringReader&) = delete;
+	NetStringReader& operator=(const NetStringReader&) = delete;
+
+	boost::string_view Read(const Shared<AsioTlsStream>::Ptr& stream, boost::asio::yield_context yc, ssize_t maxMessageLength = -1);
+
+	bool Parse(boost::string_view& message, ssize_t maxMessageLength = -1);
+	boost::asio::mutable_buffer Prepare();
+	void Commit(size_t bytes);
+
+	size_t GetCapacity() const;
+
+private:
+	std::unique_ptr<char[]> m_Buffer;
+	size_t m_Capacity;
+	size_t m_BlockSize;
+	size_t m_Begin; /**< Of the next message */
+	size_t m_End; /**< Of the data read so far */
+	size_t m_Needed; /**< The whole next message's length, once its length specifier is complete */
+	size_t m_Limit; /**< The largest m_Needed the maximum message length allows */
+};
+
 }
 
 #endif /* NETSTRING_H */
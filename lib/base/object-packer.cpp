@@ -4,10 +4,16 @@
 #include "base/debug.hpp"
 #include "base/dictionary.hpp"
 #include "base/array.hpp"
+#include "base/exception.hpp"
 #include "base/objectlock.hpp"
+#include "base/tlsutility.hpp"
 #include <algorithm>
+#include <stdexcept>
 #include <climits>
 #include <cstdint>
+#include <cstring>
+#include <openssl/sha.h>
+#include <set>
 #include <string>
 #include <utility>
 
@@ -29,7 +35,90 @@ static const EndiannessDetector l_EndiannessDetector;
 // Assumption: The compiler will optimize (away) if/else statements using this.
 #define MACHINE_LITTLE_ENDIAN (l_EndiannessDetector.buf[0])
 
-static void PackAny(const Value& value, std::string& builder);
+/**
+ * Feeds what PackObject() would return directly into SHA1, through a small buffer, instead of building a string
+ */
+class SHA1Builder
+{
+public:
+	SHA1Builder()
+	{
+		if (!SHA1_Init(&m_Context)) {
+			BOOST_THROW_EXCEPTION(openssl_error()
+				<< boost::errinfo_api_function("SHA1_Init")
+				<< errinfo_openssl_error(ERR_peek_error()));
+		}
+	}
+
+	SHA1Builder& operator+=(char c)
+	{
+		if (m_Length == sizeof(m_Buffer)) {
+			Flush();
+		}
+
+		m_Buffer[m_Length++] = c;
+		return *this;
+	}
+
+	SHA1Builder& operator+=(const std::string& s)
+	{
+		append(s.data(), s.size());
+		return *this;
+	}
+
+	void append(const char* data, size_t length)
+	{
+		if (m_Length + length > sizeof(m_Buffer)) {
+			Flush();
+
+			if (length > sizeof(m_Buffer)) {
+				Update(data, length);
+				return;
+			}
+		}
+
+		memcpy(m_Buffer + m_Length, data, length);
+		m_Length += length;
+	}
+
+	String GetResult()
+	{
+		unsigned char digest[SHA_DIGEST_LENGTH];
+
+		Flush();
+
+		if (!SHA1_Final(digest, &m_Context)) {
+			BOOST_THROW_EXCEPTION(openssl_error()
+				<< boost::errinfo_api_function("SHA1_Final")
+				<< errinfo_openssl_error(ERR_peek_error()));
+		}
+
+		return BinaryToHex(digest, SHA_DIGEST_LENGTH);
+	}
+
+private:
+	SHA_CTX m_Context;
+	char m_Buffer[4096];
+	size_t m_Length = 0;
+
+	void Flush()
+	{
+		Update(m_Buffer, m_Length);
+		m_Length = 0;
+	}
+
+	void Update(const char* data, size_t length)
+	{
+		if (length && !SHA1_Update(&m_Context, data, length)) {
+			BOOST_THROW_EXCEPTION(openssl_error()
+				<< boost::errinfo_api_function("SHA1_Update")
+				<< errinfo_openssl_error(ERR_peek_error()));
+		}
+	}
+};
+
+template<class Builder>
+static void PackAny(const Value& value, Builder& builder);
 
 /**
  * std::swap() seems not to work
@@ -72,7 +161,8 @@ static inline char UIntToByte(unsigned i)
 /**
  * Append the given int as big-endian 64-bit unsigned int
  */
-static inline void PackUInt64BE(uint_least64_t i, std::string& builder)
+template<class Builder>
+static inline void PackUInt64BE(uint_least64_t i, Builder& builder)
 {
 	char buf[8] = {
 		UIntToByte(i >> 56u),
@@ -109,7 +199,8 @@ union Double2BytesConverter
 /**
  * Append the given double as big-endian IEEE 754 binary64
  */
-static inline void PackFloat64BE(double f, std::string& builder)
+template<class Builder>
+static inline void PackFloat64BE(double f, Builder& builder)
 {
 	Double2BytesConverter converter;
 
@@ -128,7 +219,8 @@ static inline void PackFloat64BE(double f, std::string& builder)
 /**
  * Append the given string's length (BE uint64) and the string itself
  */
-static inline void PackString(const String& string, std::string& builder)
+template<class Builder>
+static inline void PackString(const String& string, Builder& builder)
 {
 	PackUInt64BE(string.GetLength(), builder);
 	builder += string.GetData();
@@ -137,7 +229,8 @@ static inline void PackString(const String& string, std::string& builder)
 /**
  * Append the given array
  */
-static inline void PackArray(const Array::Ptr& arr, std::string& builder)
+template<class Builder>
+static inline void PackArray(const Array::Ptr& arr, Builder& builder)
 {
 	ObjectLock olock(arr);
 
@@ -152,7 +245,8 @@ static inline void PackArray(const Array::Ptr& arr, std::string& builder)
 /**
  * Append the given dictionary
  */
-static inline void PackDictionary(const Dictionary::Ptr& dict, std::string& builder)
+template<class Builder>
+static inline void PackDictionary(const Dictionary::Ptr& dict, Builder& builder)
 {
 	ObjectLock olock(dict);
 
@@ -165,10 +259,37 @@ static inline void PackDictionary(const Dictionary::Ptr& dict, std::string& buil
 	}
 }
 
+/**
+ * Append the given dictionary, but only the keys (not) in the given set
+ */
+template<class Builder>
+static inline void PackDictionary(const Dictionary::Ptr& dict, const std::set<String>& keys, bool whitelist, Builder& builder)
+{
+	ObjectLock olock(dict);
+	uint_least64_t length = 0;
+
+	for (const Dictionary::Pair& kv : dict) {
+		if ((keys.find(kv.first) != keys.end()) == whitelist) {
+			++length;
+		}
+	}
+
+	builder += '\6';
+	PackUInt64BE(length, builder);
+
+	for (const Dictionary::Pair& kv : dict) {
+		if ((keys.find(kv.first) != keys.end()) == whitelist) {
+			PackString(kv.first, builder);
+			PackAny(kv.second, builder);
+		}
+	}
+}
+
 /**
  * Append any JSON-encodable value
  */
-static void PackAny(const Value& value, std::string& builder)
+template<class Builder>
+static void PackAny(const Value& value, Builder& builder)
 {
 	switch (value.GetType()) {
 		case ValueString:
@@ -244,3 +365,171 @@ String icinga::PackObject(const Value& value)
 
 	return std::move(builder);
 }
+
+/**
+ * Calculate SHA1(PackObject(value)) without building the packed string
+ *
+ * @return The digest, hex-encoded
+ */
+String icinga::PackObjectSHA1(const Value& value)
+{
+	SHA1Builder builder;
+	PackAny(value, builder);
+
+	return builder.GetResult();
+}
+
+/**
+ * Calculate SHA1(PackObject(value)) without building the packed string
+ *
+ * If value is a dictionary and keys isn't empty, its keys in keys are left out (or only those are packed if whitelist).
+ *
+ * @return The digest, hex-encoded
+ */
+String icinga::PackObjectSHA1(const Value& value, const std::set<String>& keys, bool whitelist)
+{
+	SHA1Builder builder;
+
+	if (!keys.empty() && value.IsObjectType<Dictionary>()) {
+		PackDictionary(Dictionary::Ptr(value), keys, whitelist, builder);
+	} else {
+		PackAny(value, builder);
+	}
+
+	return builder.GetResult();
+}
+
+/**
+ * Append what PackObject() would return to the given buffer
+ */
+void icinga::PackObject(const Value& value, std::string& output)
+{
+	PackAny(value, output);
+}
+
+/**
+ * Append the given int as big-endian 64-bit unsigned int, i.e. the way PackObject() encodes lengths
+ */
+void icinga::PackUInt64(uint_least64_t i, std::string& output)
+{
+	PackUInt64BE(i, output);
+}
+
+static inline void RequireBytes(const char *begin, const char *end, uint_least64_t length)
+{
+	if (uint_least64_t(end - begin) < length) {
+		BOOST_THROW_EXCEPTION(std::invalid_argument("Packed object is truncated."));
+	}
+}
+
+/**
+ * Read a big-endian 64-bit unsigned int as appended by PackUInt64() and advance begin past it
+ */
+uint_least64_t icinga::UnpackUInt64(const char*& begin, const char *end)
+{
+	RequireBytes(begin, end, 8);
+
+	uint_least64_t i = 0;
+
+	for (int n = 0; n < 8; n++) {
+		i = (i << 8u) | static_cast<unsigned char>(begin[n]);
+	}
+
+	begin += 8;
+	return i;
+}
+
+static inline double UnpackFloat64BE(const char*& begin, const char *end)
+{
+	RequireBytes(begin, end, 8);
+
+	Double2BytesConverter converter;
+	memcpy(converter.buf, begin, 8);
+
+	if (MACHINE_LITTLE_ENDIAN) {
+		SwapBytes(converter.buf[0], converter.buf[7]);
+		SwapBytes(converter.buf[1], converter.buf[6]);
+		SwapBytes(converter.buf[2], converter.buf[5]);
+		SwapBytes(converter.buf[3], converter.buf[4]);
+	}
+
+	begin += 8;
+	return converter.f;
+}
+
+static inline String UnpackString(const char*& begin, const char *end)
+{
+	uint_least64_t length = UnpackUInt64(begin, end);
+	RequireBytes(begin, end, length);
+
+	String result (begin, begin + length);
+	begin += length;
+	return result;
+}
+
+/**
+ * Read a value as appended by PackObject() and advance begin past it
+ *
+ * Dictionaries and arrays are rebuilt, all numbers are read as doubles.
+ *
+ * @throws std::invalid_argument If the input is truncated or not a packed value.
+ */
+Value icinga::UnpackObject(const char*& begin, const char *end)
+{
+	RequireBytes(begin, end, 1);
+
+	switch (*begin++) {
+		case '\0':
+			return Empty;
+
+		case '\1':
+			return false;
+
+		case '\2':
+			return true;
+
+		case '\3':
+			return UnpackFloat64BE(begin, end);
+
+		case '\4':
+			return UnpackString(begin, end);
+
+		case '\5':
+			{
+				uint_least64_t length = UnpackUInt64(begin, end);
+
+				/* Every element takes at least one byte. */
+				RequireBytes(begin, end, length);
+
+				ArrayData result;
+				result.reserve(length);
+
+				for (uint_least64_t i = 0; i < length; i++) {
+					result.emplace_back(UnpackObject(begin, end));
+				}
+
+				return new Array(std::move(result));
+			}
+
+		case '\6':
+			{
+				uint_least64_t length = UnpackUInt64(begin, end);
+
+				/* Every key-value pair takes at least nine bytes. */
+				RequireBytes(begin, end, length);
+
+				DictionaryData result;
+				result.reserve(length);
+
+				for (uint_least64_t i = 0; i < length; i++) {
+					String key = UnpackString(begin, end);
+					result.emplace_back(std::move(key), UnpackObject(begin, end));
+				}
+
+				return new Dictionary(std::move(result));
+			}
+
+		default:
+			BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid type tag in packed object."));
+	}
+}
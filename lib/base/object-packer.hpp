@@ -4,6 +4,9 @@
 #define OBJECT_PACKER
 
 #include "base/i2-base.hpp"
+#include <cstdint>
+#include <set>
+#include <string>
 
 namespace icinga
 {
@@ -12,6 +15,13 @@ class String;
 class Value;
 
 String PackObject(const Value& value);
+String PackObjectSHA1(const Value& value);
+String PackObjectSHA1(const Value& value, const std::set<String>& keys, bool whitelist = false);
+
+void PackObject(const Value& value, std::string& output);
+void PackUInt64(uint_least64_t i, std::string& output);
+Value UnpackObject(const char*& begin, const char *end);
+uint_least64_t UnpackUInt64(const char*& begin, const char *end);
 
 }
 
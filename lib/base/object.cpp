@@ -22,12 +22,16 @@ static std::map<String, int> l_ObjectCounts;
 static Timer::Ptr l_ObjectCountTimer;
 #endif /* I2_LEAK_DEBUG */
 
+/* The number of objects created by the current thread, see Object::GetCreatedCount() */
+static thread_local uint_fast64_t l_CreatedCount = 0;
+
 /**
  * Constructor for the Object class.
  */
 Object::Object()
 {
 	m_References.store(0);
+	++l_CreatedCount;
 
 #ifdef I2_DEBUG
 	m_LockOwner.store(decltype(m_LockOwner.load())());
@@ -41,6 +45,25 @@ Object::~Object()
 {
 }
 
+/**
+ * Retrieves the number of objects the current thread created so far, e.g. to count the
+ * allocations of an operation.
+ *
+ * @returns The number of objects.
+ */
+uint_fast64_t Object::GetCreatedCount()
+{
+	return l_CreatedCount;
+}
+
+/**
+ * @returns The number of intrusive pointers to this object, e.g. 1 if a cache holds the only one.
+ */
+uint_fast64_t Object::GetReferenceCount() const
+{
+	return m_References.load();
+}
+
 /**
  * Returns a string representation for the object.
  */
@@ -77,6 +100,30 @@ Value Object::GetField(int id) const
 		BOOST_THROW_EXCEPTION(std::runtime_error("Invalid field ID."));
 }
 
+/**
+ * Calls the visitor for every field with any of the given attributes (all fields for 0) in the order of their IDs,
+ * as e.g. Serialize() needs them. The class compiler generates overrides which don't look up every field's info.
+ *
+ * @param attributeTypes The attributes, e.g. FAState.
+ * @param visitor Called with each field's name and value.
+ */
+void Object::VisitFields(int attributeTypes, const FieldVisitor& visitor) const
+{
+	Type::Ptr type = GetReflectionType();
+
+	if (!type)
+		return;
+
+	for (int i = 0; i < type->GetFieldCount(); i++) {
+		Field field = type->GetFieldInfo(i);
+
+		if (attributeTypes != 0 && (field.Attributes & attributeTypes) == 0)
+			continue;
+
+		visitor(field.Name, GetField(i));
+	}
+}
+
 bool Object::HasOwnField(const String& field) const
 {
 	Type::Ptr type = GetReflectionType();
@@ -239,29 +286,6 @@ INITIALIZE_ONCE([]() {
 });
 #endif /* I2_LEAK_DEBUG */
 
-void icinga::intrusive_ptr_add_ref(Object *object)
-{
-#ifdef I2_LEAK_DEBUG
-	if (object->m_References.fetch_add(1) == 0u)
-		TypeAddObject(object);
-#else /* I2_LEAK_DEBUG */
-	object->m_References.fetch_add(1);
-#endif /* I2_LEAK_DEBUG */
-}
-
-void icinga::intrusive_ptr_release(Object *object)
-{
-	auto previous (object->m_References.fetch_sub(1));
-
-	if (previous == 1u) {
-#ifdef I2_LEAK_DEBUG
-		TypeRemoveObject(object);
-#endif /* I2_LEAK_DEBUG */
-
-		delete object;
-	}
-}
-
 void icinga::DefaultObjectFactoryCheckArgs(const std::vector<Value>& args)
 {
 	if (!args.empty())
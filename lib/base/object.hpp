@@ -9,6 +9,7 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -27,6 +28,9 @@ class String;
 struct DebugInfo;
 class ValidationUtils;
 
+inline void intrusive_ptr_add_ref(Object *object);
+inline void intrusive_ptr_release(Object *object);
+
 extern Value Empty;
 
 #define DECLARE_PTR_TYPEDEFS(klass) \
@@ -177,12 +181,18 @@ public:
 	virtual void NotifyField(int id, const Value& cookie = Empty);
 	virtual Object::Ptr NavigateField(int id) const;
 
+	typedef std::function<void (const char *name, const Value& value)> FieldVisitor;
+	virtual void VisitFields(int attributeTypes, const FieldVisitor& visitor) const;
+
 #ifdef I2_DEBUG
 	bool OwnsLock() const;
 #endif /* I2_DEBUG */
 
 	static Object::Ptr GetPrototype();
 
+	static uint_fast64_t GetCreatedCount();
+	uint_fast64_t GetReferenceCount() const;
+
 	virtual Object::Ptr Clone() const;
 
 	static intrusive_ptr<Type> TypeInstance;
@@ -210,8 +220,33 @@ Value GetPrototypeField(const Value& context, const String& field, bool not_foun
 void TypeAddObject(Object *object);
 void TypeRemoveObject(Object *object);
 
-void intrusive_ptr_add_ref(Object *object);
-void intrusive_ptr_release(Object *object);
+/* Inline, pointer copies are everywhere. Like std::shared_ptr, a new reference doesn't need to
+ * synchronize with anything, only the deletion has to see all changes done via other references. */
+
+inline void intrusive_ptr_add_ref(Object *object)
+{
+#ifdef I2_LEAK_DEBUG
+	if (object->m_References.fetch_add(1, std::memory_order_relaxed) == 0u)
+		TypeAddObject(object);
+#else /* I2_LEAK_DEBUG */
+	object->m_References.fetch_add(1, std::memory_order_relaxed);
+#endif /* I2_LEAK_DEBUG */
+}
+
+inline void intrusive_ptr_release(Object *object)
+{
+	auto previous (object->m_References.fetch_sub(1, std::memory_order_release));
+
+	if (previous == 1u) {
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+#ifdef I2_LEAK_DEBUG
+		TypeRemoveObject(object);
+#endif /* I2_LEAK_DEBUG */
+
+		delete object;
+	}
+}
 
 template<typename T>
 class ObjectImpl
@@ -1,6 +1,10 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "base/objectlock.hpp"
+#include "base/objectlockprofiler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <thread>
 
 using namespace icinga;
@@ -8,6 +12,17 @@ using namespace icinga;
 #define I2MUTEX_UNLOCKED 0
 #define I2MUTEX_LOCKED 1
 
+/* Like glibc's adaptive mutexes, spin up to about twice as long as recently needed before blocking. */
+static std::atomic<int> l_Spins (10);
+static const int l_MaxSpins = 100;
+
+static inline void CpuRelax()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_ia32_pause();
+#endif /* defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) */
+}
+
 ObjectLock::~ObjectLock()
 {
 	Unlock();
@@ -29,7 +44,8 @@ void ObjectLock::Lock()
 {
 	ASSERT(!m_Locked && m_Object);
 
-	m_Object->m_Mutex.lock();
+	if (!m_Object->m_Mutex.try_lock())
+		LockContended();
 
 	m_Locked = true;
 
@@ -40,6 +56,43 @@ void ObjectLock::Lock()
 #endif /* I2_DEBUG */
 }
 
+/**
+ * Waits for the lock held by another thread. Most ObjectLocks are held only briefly,
+ * so spinning a bit is cheaper than blocking in the kernel and being woken up again.
+ */
+void ObjectLock::LockContended()
+{
+	bool profile = ObjectLockProfiler::IsEnabled();
+	std::chrono::steady_clock::time_point start;
+
+	if (profile)
+		start = std::chrono::steady_clock::now();
+
+	int estimate = l_Spins.load(std::memory_order_relaxed);
+	int maxSpins = std::min(l_MaxSpins, estimate * 2 + 10);
+	int spins = 0;
+
+	for (;;) {
+		if (spins >= maxSpins) {
+			m_Object->m_Mutex.lock();
+			break;
+		}
+
+		CpuRelax();
+		spins++;
+
+		if (m_Object->m_Mutex.try_lock())
+			break;
+	}
+
+	l_Spins.store(estimate + (spins - estimate) / 8, std::memory_order_relaxed);
+
+	if (profile) {
+		ObjectLockProfiler::Record(m_Object, static_cast<uint_fast64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count()));
+	}
+}
+
 void ObjectLock::Unlock()
 {
 #ifdef I2_DEBUG
@@ -28,6 +28,8 @@ public:
 private:
 	const Object *m_Object{nullptr};
 	bool m_Locked{false};
+
+	void LockContended();
 };
 
 }
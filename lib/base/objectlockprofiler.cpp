@@ -0,0 +1,175 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/objectlockprofiler.hpp"
+#include "base/function.hpp"
+#include "base/statsfunction.hpp"
+#include "base/type.hpp"
+#include <boost/stacktrace.hpp>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <mutex>
+#include <vector>
+
+using namespace icinga;
+
+REGISTER_STATSFUNCTION(ObjectLockProfiler, &ObjectLockProfiler::StatsFunc);
+
+static Array::Ptr GetObjectLockProfile()
+{
+	return ObjectLockProfiler::GetReport();
+}
+
+static void ResetObjectLockProfile()
+{
+	ObjectLockProfiler::Reset();
+}
+
+REGISTER_SAFE_FUNCTION(Internal, object_lock_profile, &GetObjectLockProfile, "");
+REGISTER_FUNCTION(Internal, reset_object_lock_profile, &ResetObjectLockProfile, "");
+
+/* The return addresses of the innermost frames which waited for a lock, incl. ObjectLock's own ones. */
+typedef std::array<const void *, 6> ObjectLockSite;
+
+struct ObjectLockProfile
+{
+	uint_fast64_t Contentions{0};
+	uint_fast64_t TotalNanoseconds{0};
+	uint_fast64_t MaxNanoseconds{0};
+	std::map<ObjectLockSite, uint_fast64_t> Sites;
+};
+
+static std::mutex l_ProfilesMutex;
+static std::map<Type *, ObjectLockProfile> l_Profiles;
+
+/**
+ * Called after the given object's lock has been taken by a thread which had to wait for it.
+ */
+void ObjectLockProfiler::Record(const Object *object, uint_fast64_t nanoseconds)
+{
+	Type::Ptr type = object->GetReflectionType();
+
+	boost::stacktrace::stacktrace trace (0, ObjectLockSite().size());
+	ObjectLockSite site {};
+
+	for (size_t i = 0; i < trace.size() && i < site.size(); i++)
+		site[i] = trace[i].address();
+
+	std::unique_lock<std::mutex> lock (l_ProfilesMutex);
+	auto& profile (l_Profiles[type.get()]);
+
+	profile.Contentions++;
+	profile.TotalNanoseconds += nanoseconds;
+	profile.MaxNanoseconds = std::max(profile.MaxNanoseconds, nanoseconds);
+	profile.Sites[site]++;
+}
+
+/**
+ * @returns The name of the innermost function which isn't part of ObjectLock itself.
+ */
+static String GetSiteName(const ObjectLockSite& site)
+{
+	String fallback;
+
+	for (auto address : site) {
+		if (!address)
+			break;
+
+		String name = boost::stacktrace::frame(address).name();
+
+		if (name.IsEmpty())
+			continue;
+
+		if (fallback.IsEmpty())
+			fallback = name;
+
+		if (name.Find("ObjectLock") == String::NPos)
+			return name;
+	}
+
+	return fallback.IsEmpty() ? "<unknown>" : fallback;
+}
+
+/**
+ * @param limit The maximum number of types to report, 0 for all.
+ * @returns The contended types, sorted by the total time spent waiting for their objects' locks.
+ */
+Array::Ptr ObjectLockProfiler::GetReport(size_t limit)
+{
+	std::vector<std::pair<Type *, ObjectLockProfile>> profiles;
+
+	{
+		std::unique_lock<std::mutex> lock (l_ProfilesMutex);
+
+		for (auto& kv : l_Profiles) {
+			if (kv.second.Contentions)
+				profiles.emplace_back(kv);
+		}
+	}
+
+	std::sort(profiles.begin(), profiles.end(), [](const std::pair<Type *, ObjectLockProfile>& a, const std::pair<Type *, ObjectLockProfile>& b) {
+		return a.second.TotalNanoseconds > b.second.TotalNanoseconds;
+	});
+
+	if (limit && profiles.size() > limit)
+		profiles.resize(limit);
+
+	ArrayData report;
+
+	for (auto& kv : profiles) {
+		auto& profile (kv.second);
+
+		/* Different addresses within the same function are reported together. */
+		std::map<String, uint_fast64_t> sitesByName;
+
+		for (auto& site : profile.Sites)
+			sitesByName[GetSiteName(site.first)] += site.second;
+
+		std::vector<std::pair<String, uint_fast64_t>> sortedSites (sitesByName.begin(), sitesByName.end());
+
+		std::sort(sortedSites.begin(), sortedSites.end(), [](const std::pair<String, uint_fast64_t>& a, const std::pair<String, uint_fast64_t>& b) {
+			return a.second > b.second;
+		});
+
+		if (sortedSites.size() > 5)
+			sortedSites.resize(5);
+
+		ArrayData sites;
+
+		for (auto& site : sortedSites) {
+			sites.emplace_back(new Dictionary({
+				{ "site", site.first },
+				{ "contentions", static_cast<double>(site.second) }
+			}));
+		}
+
+		double total = profile.TotalNanoseconds / 1e9;
+
+		report.emplace_back(new Dictionary({
+			{ "type", kv.first->GetName() },
+			{ "contentions", static_cast<double>(profile.Contentions) },
+			{ "wait_total", total },
+			{ "wait_max", profile.MaxNanoseconds / 1e9 },
+			{ "wait_avg", total / profile.Contentions },
+			{ "sites", new Array(std::move(sites)) }
+		}));
+	}
+
+	return new Array(std::move(report));
+}
+
+/**
+ * Starts counting from zero again.
+ */
+void ObjectLockProfiler::Reset()
+{
+	std::unique_lock<std::mutex> lock (l_ProfilesMutex);
+
+	l_Profiles.clear();
+}
+
+void ObjectLockProfiler::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr&)
+{
+	if (IsEnabled())
+		status->Set("object_lock_profile", GetReport(25));
+}
@@ -0,0 +1,45 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef OBJECTLOCKPROFILER_H
+#define OBJECTLOCKPROFILER_H
+
+#include "base/i2-base.hpp"
+#include "base/array.hpp"
+#include "base/configuration.hpp"
+#include "base/dictionary.hpp"
+#include <cstdint>
+
+namespace icinga
+{
+
+class Object;
+
+/**
+ * Samples the contended ObjectLocks per type of the locked object:
+ * how often and how long threads had to wait and where they waited
+ * (see the ProfileObjectLocks constant).
+ *
+ * @ingroup base
+ */
+class ObjectLockProfiler
+{
+public:
+	static inline bool IsEnabled()
+	{
+		return Configuration::ProfileObjectLocks;
+	}
+
+	static Array::Ptr GetReport(size_t limit = 0);
+	static void Reset();
+
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+
+private:
+	static void Record(const Object *object, uint_fast64_t nanoseconds);
+
+	friend struct ObjectLock;
+};
+
+}
+
+#endif /* OBJECTLOCKPROFILER_H */
@@ -11,8 +11,15 @@
 #include "base/utility.hpp"
 #include "base/scriptglobal.hpp"
 #include "base/json.hpp"
+#include "base/configuration.hpp"
+#include "base/shardedringbuffer.hpp"
+#include "base/threadaffinity.hpp"
 #include <boost/algorithm/string/join.hpp>
 #include <boost/thread/once.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
 #include <thread>
 #include <iostream>
 
@@ -21,6 +28,11 @@
 #	include <poll.h>
 #	include <signal.h>
 #	include <string.h>
+#	include <sys/resource.h>
+#	include <sys/wait.h>
+#	ifdef __linux__
+#		include <sys/epoll.h>
+#	endif /* __linux__ */
 
 #	ifndef __APPLE__
 extern char **environ;
@@ -37,14 +49,48 @@ using namespace icinga;
 static std::mutex l_ProcessMutex[IOTHREADS];
 static std::map<Process::ProcessHandle, Process::Ptr> l_Processes[IOTHREADS];
 #ifdef _WIN32
-static HANDLE l_Events[IOTHREADS];
+/* The I/O threads' completion ports, the reads of their processes' output complete there. */
+static HANDLE l_CompletionPorts[IOTHREADS];
+static double l_NextTimeoutCheck[IOTHREADS];
+
+#define MAX_POOLED_JOBS 256
+
+/* Job objects without any processes left, reused for new processes. */
+static std::mutex l_JobPoolMutex;
+static std::vector<HANDLE> l_JobPool;
 #else /* _WIN32 */
 static int l_EventFDs[IOTHREADS][2];
 static std::map<Process::ConsoleHandle, Process::ProcessHandle> l_FDs[IOTHREADS];
 
-static std::mutex l_ProcessControlMutex;
+#ifdef __linux__
+/* Used instead of poll() if available, together with the earliest deadline of an I/O thread's processes. */
+static int l_EpollFDs[IOTHREADS];
+static double l_NextTimeoutCheck[IOTHREADS];
+#endif /* __linux__ */
+
+/**
+ * A forked helper process which spawns child processes on our behalf.
+ * Children are reaped and signalled through the helper which spawned them.
+ */
+struct SpawnHelper
+{
+	std::mutex Mutex;
+	int FD = -1;
+	pid_t PID = -1;
+};
+
+#define MAX_SPAWN_HELPERS 32
+
+static SpawnHelper l_SpawnHelpers[MAX_SPAWN_HELPERS];
+static std::atomic<int> l_SpawnHelperCount (0);
+static std::atomic<unsigned int> l_NextSpawnHelper (0);
+
+/* Only used inside a spawn helper process: its end of the control socket. */
 static int l_ProcessControlFD = -1;
-static pid_t l_ProcessControlPID;
+
+/* Spawns (and their latency in microseconds) per second. */
+static ShardedRingBuffer l_SpawnCountStatistics (15 * 60);
+static ShardedRingBuffer l_SpawnLatencyStatistics (15 * 60);
 #endif /* _WIN32 */
 static boost::once_flag l_ProcessOnceFlag = BOOST_ONCE_INIT;
 static boost::once_flag l_SpawnHelperOnceFlag = BOOST_ONCE_INIT;
@@ -53,23 +99,16 @@ Process::Process(Process::Arguments arguments, Dictionary::Ptr extraEnvironment)
 	: m_Arguments(std::move(arguments)), m_ExtraEnvironment(std::move(extraEnvironment)),
 	  m_Timeout(600)
 #ifdef _WIN32
-	, m_ReadPending(false), m_ReadFailed(false), m_Overlapped()
+	, m_Job(nullptr), m_ReadPending(false), m_ReadFailed(false), m_ReadBytes(0), m_Overlapped()
 #else /* _WIN32 */
-	, m_SentSigterm(false)
-#endif /* _WIN32 */
-	, m_AdjustPriority(false), m_ResultAvailable(false)
-{
-#ifdef _WIN32
-	m_Overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	, m_SentSigterm(false), m_SpawnHelper(0)
 #endif /* _WIN32 */
-}
+	, m_AdjustPriority(false), m_MaxOutputSize(std::max(Configuration::MaxProcessOutputSize, 0)), m_DiscardedOutput(0),
+	  m_ResultAvailable(false)
+{ }
 
 Process::~Process()
-{
-#ifdef _WIN32
-	CloseHandle(m_Overlapped.hEvent);
-#endif /* _WIN32 */
-}
+{ }
 
 #ifndef _WIN32
 static Value ProcessSpawnImpl(struct msghdr *msgh, const Dictionary::Ptr& request)
@@ -137,7 +176,13 @@ static Value ProcessSpawnImpl(struct msghdr *msgh, const Dictionary::Ptr& reques
 
 	extraEnvironment.reset();
 
+#ifdef HAVE_VFORK
+	/* We are single-threaded and block all signals, so the child may safely borrow our
+	 * address space until execve(). This avoids copying our page tables for every spawn. */
+	pid_t pid = vfork();
+#else /* HAVE_VFORK */
 	pid_t pid = fork();
+#endif /* HAVE_VFORK */
 
 	int errorCode = 0;
 
@@ -243,11 +288,22 @@ static Value ProcessWaitPIDImpl(struct msghdr *msgh, const Dictionary::Ptr& requ
 	pid_t pid = request->Get("pid");
 
 	int status;
-	int rc = waitpid(pid, &status, 0);
+	struct rusage usage = {};
+	int rc = wait4(pid, &status, 0, &usage);
+
+#ifdef __APPLE__
+	/* Bytes rather than KiB there. */
+	usage.ru_maxrss /= 1024;
+#endif /* __APPLE__ */
 
 	Dictionary::Ptr response = new Dictionary({
 		{ "status", status },
-		{ "rc", rc }
+		{ "rc", rc },
+		{ "utime", usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 },
+		{ "stime", usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6 },
+		{ "maxrss", static_cast<double>(usage.ru_maxrss) },
+		{ "inblock", static_cast<double>(usage.ru_inblock) },
+		{ "oublock", static_cast<double>(usage.ru_oublock) }
 	});
 
 	return response;
@@ -339,22 +395,33 @@ static void ProcessHandler()
 	_exit(0);
 }
 
-static void StartSpawnProcessHelper()
+static void StartSpawnProcessHelper(SpawnHelper& helper)
 {
-	if (l_ProcessControlFD != -1) {
-		(void)close(l_ProcessControlFD);
+	if (helper.FD != -1) {
+		(void)close(helper.FD);
+		helper.FD = -1;
 
 		int status;
-		(void)waitpid(l_ProcessControlPID, &status, 0);
+		(void)waitpid(helper.PID, &status, 0);
 	}
 
+	/* Neither the spawned children nor other helpers may talk to a helper. */
 	int controlFDs[2];
+#ifdef SOCK_CLOEXEC
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, controlFDs) < 0) {
+#else /* SOCK_CLOEXEC */
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, controlFDs) < 0) {
+#endif /* SOCK_CLOEXEC */
 		BOOST_THROW_EXCEPTION(posix_error()
 			<< boost::errinfo_api_function("socketpair")
 			<< boost::errinfo_errno(errno));
 	}
 
+#ifndef SOCK_CLOEXEC
+	Utility::SetCloExec(controlFDs[0]);
+	Utility::SetCloExec(controlFDs[1]);
+#endif /* SOCK_CLOEXEC */
+
 	pid_t pid = fork();
 
 	if (pid < 0) {
@@ -366,6 +433,11 @@ static void StartSpawnProcessHelper()
 	if (pid == 0) {
 		(void)close(controlFDs[1]);
 
+		for (auto& other : l_SpawnHelpers) {
+			if (other.FD != -1)
+				(void)close(other.FD);
+		}
+
 		l_ProcessControlFD = controlFDs[0];
 
 		ProcessHandler();
@@ -375,11 +447,11 @@ static void StartSpawnProcessHelper()
 
 	(void)close(controlFDs[0]);
 
-	l_ProcessControlFD = controlFDs[1];
-	l_ProcessControlPID = pid;
+	helper.FD = controlFDs[1];
+	helper.PID = pid;
 }
 
-static pid_t ProcessSpawn(const std::vector<String>& arguments, const Dictionary::Ptr& extraEnvironment, bool adjustPriority, int fds[3])
+static pid_t ProcessSpawn(const std::vector<String>& arguments, const Dictionary::Ptr& extraEnvironment, bool adjustPriority, int fds[3], int& helperIndex)
 {
 	Dictionary::Ptr request = new Dictionary({
 		{ "command", "spawn" },
@@ -391,7 +463,12 @@ static pid_t ProcessSpawn(const std::vector<String>& arguments, const Dictionary
 	String jrequest = JsonEncode(request);
 	size_t length = jrequest.GetLength();
 
-	std::unique_lock<std::mutex> lock(l_ProcessControlMutex);
+	auto start (std::chrono::steady_clock::now());
+
+	helperIndex = l_NextSpawnHelper.fetch_add(1) % l_SpawnHelperCount.load();
+
+	auto& helper (l_SpawnHelpers[helperIndex]);
+	std::unique_lock<std::mutex> lock(helper.Mutex);
 
 	struct msghdr msg;
 	memset(&msg, 0, sizeof(msg));
@@ -417,18 +494,28 @@ static pid_t ProcessSpawn(const std::vector<String>& arguments, const Dictionary
 	msg.msg_controllen = cmsg->cmsg_len;
 
 	do {
-		while (sendmsg(l_ProcessControlFD, &msg, 0) < 0) {
-			StartSpawnProcessHelper();
+		while (sendmsg(helper.FD, &msg, 0) < 0) {
+			StartSpawnProcessHelper(helper);
 		}
-	} while (send(l_ProcessControlFD, jrequest.CStr(), jrequest.GetLength(), 0) < 0);
+	} while (send(helper.FD, jrequest.CStr(), jrequest.GetLength(), 0) < 0);
 
 	char buf[4096];
 
-	ssize_t rc = recv(l_ProcessControlFD, buf, sizeof(buf), 0);
+	ssize_t rc = recv(helper.FD, buf, sizeof(buf), 0);
+
+	lock.unlock();
 
 	if (rc <= 0)
 		return -1;
 
+	{
+		auto now (Utility::GetTime());
+		auto latency (std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+
+		l_SpawnCountStatistics.InsertValue(now, 1);
+		l_SpawnLatencyStatistics.InsertValue(now, latency.count());
+	}
+
 	String jresponse = String(buf, buf + rc);
 
 	Dictionary::Ptr response = JsonDecode(jresponse);
@@ -439,7 +526,7 @@ static pid_t ProcessSpawn(const std::vector<String>& arguments, const Dictionary
 	return response->Get("rc");
 }
 
-static int ProcessKill(pid_t pid, int signum)
+static int ProcessKill(int helperIndex, pid_t pid, int signum)
 {
 	Dictionary::Ptr request = new Dictionary({
 		{ "command", "kill" },
@@ -450,17 +537,18 @@ static int ProcessKill(pid_t pid, int signum)
 	String jrequest = JsonEncode(request);
 	size_t length = jrequest.GetLength();
 
-	std::unique_lock<std::mutex> lock(l_ProcessControlMutex);
+	auto& helper (l_SpawnHelpers[helperIndex]);
+	std::unique_lock<std::mutex> lock(helper.Mutex);
 
 	do {
-		while (send(l_ProcessControlFD, &length, sizeof(length), 0) < 0) {
-			StartSpawnProcessHelper();
+		while (send(helper.FD, &length, sizeof(length), 0) < 0) {
+			StartSpawnProcessHelper(helper);
 		}
-	} while (send(l_ProcessControlFD, jrequest.CStr(), jrequest.GetLength(), 0) < 0);
+	} while (send(helper.FD, jrequest.CStr(), jrequest.GetLength(), 0) < 0);
 
 	char buf[4096];
 
-	ssize_t rc = recv(l_ProcessControlFD, buf, sizeof(buf), 0);
+	ssize_t rc = recv(helper.FD, buf, sizeof(buf), 0);
 
 	if (rc <= 0)
 		return -1;
@@ -471,7 +559,7 @@ static int ProcessKill(pid_t pid, int signum)
 	return response->Get("errno");
 }
 
-static int ProcessWaitPID(pid_t pid, int *status)
+static int ProcessWaitPID(int helperIndex, pid_t pid, int *status, ProcessUsage *usage = nullptr)
 {
 	Dictionary::Ptr request = new Dictionary({
 		{ "command", "waitpid" },
@@ -481,17 +569,18 @@ static int ProcessWaitPID(pid_t pid, int *status)
 	String jrequest = JsonEncode(request);
 	size_t length = jrequest.GetLength();
 
-	std::unique_lock<std::mutex> lock(l_ProcessControlMutex);
+	auto& helper (l_SpawnHelpers[helperIndex]);
+	std::unique_lock<std::mutex> lock(helper.Mutex);
 
 	do {
-		while (send(l_ProcessControlFD, &length, sizeof(length), 0) < 0) {
-			StartSpawnProcessHelper();
+		while (send(helper.FD, &length, sizeof(length), 0) < 0) {
+			StartSpawnProcessHelper(helper);
 		}
-	} while (send(l_ProcessControlFD, jrequest.CStr(), jrequest.GetLength(), 0) < 0);
+	} while (send(helper.FD, jrequest.CStr(), jrequest.GetLength(), 0) < 0);
 
 	char buf[4096];
 
-	ssize_t rc = recv(l_ProcessControlFD, buf, sizeof(buf), 0);
+	ssize_t rc = recv(helper.FD, buf, sizeof(buf), 0);
 
 	if (rc <= 0)
 		return -1;
@@ -500,21 +589,114 @@ static int ProcessWaitPID(pid_t pid, int *status)
 
 	Dictionary::Ptr response = JsonDecode(jresponse);
 	*status = response->Get("status");
+
+	if (usage) {
+		usage->UserTime = response->Get("utime");
+		usage->SystemTime = response->Get("stime");
+		usage->MaxRss = response->Get("maxrss");
+		usage->InBlocks = response->Get("inblock");
+		usage->OutBlocks = response->Get("oublock");
+	}
+
 	return response->Get("rc");
 }
 
+/**
+ * Starts the spawn helper processes (Configuration::SpawnHelpers, at least one) which aren't running yet.
+ */
 void Process::InitializeSpawnHelper()
 {
-	if (l_ProcessControlFD == -1)
-		StartSpawnProcessHelper();
+	int count = std::max(1, std::min(Configuration::SpawnHelpers, MAX_SPAWN_HELPERS));
+
+	for (int i = 0; i < count; i++) {
+		auto& helper (l_SpawnHelpers[i]);
+		std::unique_lock<std::mutex> lock(helper.Mutex);
+
+		if (helper.FD == -1)
+			StartSpawnProcessHelper(helper);
+	}
+
+	/* Only ever grows, requests for children of other helpers must still reach them. */
+	if (count > l_SpawnHelperCount.load())
+		l_SpawnHelperCount.store(count);
+}
+
+int Process::GetSpawnHelperCount()
+{
+	return l_SpawnHelperCount.load();
+}
+
+/**
+ * Returns the number of processes spawned within the last timespan seconds.
+ */
+int Process::GetSpawnStatistics(long timespan)
+{
+	return l_SpawnCountStatistics.UpdateAndGetValues(Utility::GetTime(), timespan);
+}
+
+/**
+ * Returns the average time (in seconds) a spawn request took within the last timespan seconds,
+ * including waiting for a free spawn helper.
+ */
+double Process::GetAvgSpawnLatency(long timespan)
+{
+	auto now (Utility::GetTime());
+	int count = l_SpawnCountStatistics.UpdateAndGetValues(now, timespan);
+
+	if (count <= 0)
+		return 0;
+
+	return l_SpawnLatencyStatistics.UpdateAndGetValues(now, timespan) / 1000000.0 / count;
+}
+
+/**
+ * Spawns a process through a spawn helper for callers which talk to the process themselves,
+ * i.e. which don't want to wait for it to finish like Run() does.
+ *
+ * @param fds The new process' stdin, stdout and stderr. Left open, the caller's copies must be closed by the caller.
+ * @param spawnHelper Receives the spawn helper which has to be used for Kill() and WaitPID().
+ * @returns The PID or -1 (errno is set then)
+ */
+pid_t Process::Spawn(const Arguments& arguments, const Dictionary::Ptr& extraEnvironment, int fds[3], int& spawnHelper)
+{
+	boost::call_once(l_SpawnHelperOnceFlag, &Process::InitializeSpawnHelper);
+
+	return ProcessSpawn(arguments, extraEnvironment, false, fds, spawnHelper);
+}
+
+/**
+ * Sends a signal to a process spawned by Spawn().
+ *
+ * @returns 0 or an errno value
+ */
+int Process::Kill(int spawnHelper, pid_t pid, int signum)
+{
+	return ProcessKill(spawnHelper, pid, signum);
+}
+
+/**
+ * Waits for a process spawned by Spawn() to terminate, like wait4(2).
+ *
+ * @param usage If given, receives the resources used by the process.
+ */
+int Process::WaitPID(int spawnHelper, pid_t pid, int *status, ProcessUsage *usage)
+{
+	return ProcessWaitPID(spawnHelper, pid, status, usage);
 }
 #endif /* _WIN32 */
 
 static void InitializeProcess()
 {
 #ifdef _WIN32
-	for (auto& event : l_Events) {
-		event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	for (int tid = 0; tid < IOTHREADS; tid++) {
+		l_NextTimeoutCheck[tid] = std::numeric_limits<double>::infinity();
+		l_CompletionPorts[tid] = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+
+		if (!l_CompletionPorts[tid]) {
+			BOOST_THROW_EXCEPTION(win32_error()
+				<< boost::errinfo_api_function("CreateIoCompletionPort")
+				<< errinfo_win32_error(GetLastError()));
+		}
 	}
 #else /* _WIN32 */
 	for (auto& eventFD : l_EventFDs) {
@@ -539,6 +721,25 @@ static void InitializeProcess()
 		}
 #	endif /* HAVE_PIPE2 */
 	}
+
+#	ifdef __linux__
+	for (int tid = 0; tid < IOTHREADS; tid++) {
+		l_NextTimeoutCheck[tid] = std::numeric_limits<double>::infinity();
+		l_EpollFDs[tid] = epoll_create1(EPOLL_CLOEXEC);
+
+		if (l_EpollFDs[tid] == -1)
+			continue;
+
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = l_EventFDs[tid][0];
+
+		if (epoll_ctl(l_EpollFDs[tid], EPOLL_CTL_ADD, l_EventFDs[tid][0], &event) < 0) {
+			(void)close(l_EpollFDs[tid]);
+			l_EpollFDs[tid] = -1;
+		}
+	}
+#	endif /* __linux__ */
 #endif /* _WIN32 */
 }
 
@@ -606,14 +807,34 @@ bool Process::GetAdjustPriority() const
 	return m_AdjustPriority;
 }
 
+/**
+ * Sets the number of output bytes to keep, 0 for all. Defaults to Configuration::MaxProcessOutputSize.
+ */
+void Process::SetMaxOutputSize(size_t size)
+{
+	m_MaxOutputSize = size;
+}
+
+size_t Process::GetMaxOutputSize() const
+{
+	return m_MaxOutputSize;
+}
+
 void Process::IOThreadProc(int tid)
 {
+	ThreadAffinity::Register(ThreadRoleProcesses);
+
 #ifdef _WIN32
-	HANDLE *handles = nullptr;
-	HANDLE *fhandles = nullptr;
+	CompletionPortThreadProc(tid);
 #else /* _WIN32 */
+#	ifdef __linux__
+	if (l_EpollFDs[tid] != -1) {
+		EpollThreadProc(tid);
+		return;
+	}
+#	endif /* __linux__ */
+
 	pollfd *pfds = nullptr;
-#endif /* _WIN32 */
 	int count = 0;
 	double now;
 
@@ -628,43 +849,19 @@ void Process::IOThreadProc(int tid)
 			std::unique_lock<std::mutex> lock(l_ProcessMutex[tid]);
 
 			count = 1 + l_Processes[tid].size();
-#ifdef _WIN32
-			handles = reinterpret_cast<HANDLE *>(realloc(handles, sizeof(HANDLE) * count));
-			fhandles = reinterpret_cast<HANDLE *>(realloc(fhandles, sizeof(HANDLE) * count));
-
-			fhandles[0] = l_Events[tid];
-
-#else /* _WIN32 */
 			pfds = reinterpret_cast<pollfd *>(realloc(pfds, sizeof(pollfd) * count));
 
 			pfds[0].fd = l_EventFDs[tid][0];
 			pfds[0].events = POLLIN;
 			pfds[0].revents = 0;
-#endif /* _WIN32 */
 
 			int i = 1;
 			typedef std::pair<ProcessHandle, Process::Ptr> kv_pair;
 			for (const kv_pair& kv : l_Processes[tid]) {
 				const Process::Ptr& process = kv.second;
-#ifdef _WIN32
-				handles[i] = kv.first;
-
-				if (!process->m_ReadPending) {
-					process->m_ReadPending = true;
-
-					BOOL res = ReadFile(process->m_FD, process->m_ReadBuffer, sizeof(process->m_ReadBuffer), 0, &process->m_Overlapped);
-					if (res || GetLastError() != ERROR_IO_PENDING) {
-						process->m_ReadFailed = !res;
-						SetEvent(process->m_Overlapped.hEvent);
-					}
-				}
-
-				fhandles[i] = process->m_Overlapped.hEvent;
-#else /* _WIN32 */
 				pfds[i].fd = process->m_FD;
 				pfds[i].events = POLLIN;
 				pfds[i].revents = 0;
-#endif /* _WIN32 */
 
 				if (process->m_Timeout != 0) {
 					double delta = process->GetNextTimeout() - (now - process->m_Result.ExecutionStart);
@@ -682,42 +879,29 @@ void Process::IOThreadProc(int tid)
 
 		timeout *= 1000;
 
-#ifdef _WIN32
-		DWORD rc = WaitForMultipleObjects(count, fhandles, FALSE, timeout == -1 ? INFINITE : static_cast<DWORD>(timeout));
-#else /* _WIN32 */
 		int rc = poll(pfds, count, timeout);
 
 		if (rc < 0)
 			continue;
-#endif /* _WIN32 */
 
 		now = Utility::GetTime();
 
 		{
 			std::unique_lock<std::mutex> lock(l_ProcessMutex[tid]);
 
-#ifdef _WIN32
-			if (rc == WAIT_OBJECT_0)
-				ResetEvent(l_Events[tid]);
-#else /* _WIN32 */
 			if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
 				char buffer[512];
 				if (read(l_EventFDs[tid][0], buffer, sizeof(buffer)) < 0)
 					Log(LogCritical, "base", "Read from event FD failed.");
 			}
-#endif /* _WIN32 */
 
 			for (int i = 1; i < count; i++) {
-#ifdef _WIN32
-				auto it = l_Processes[tid].find(handles[i]);
-#else /* _WIN32 */
 				auto it2 = l_FDs[tid].find(pfds[i].fd);
 
 				if (it2 == l_FDs[tid].end())
 					continue; /* This should never happen. */
 
 				auto it = l_Processes[tid].find(it2->second);
-#endif /* _WIN32 */
 
 				if (it == l_Processes[tid].end())
 					continue; /* This should never happen. */
@@ -731,26 +915,214 @@ void Process::IOThreadProc(int tid)
 						is_timeout = true;
 				}
 
-#ifdef _WIN32
-				if (rc == WAIT_OBJECT_0 + i || is_timeout) {
-#else /* _WIN32 */
 				if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR) || is_timeout) {
-#endif /* _WIN32 */
 					if (!it->second->DoEvents()) {
-#ifdef _WIN32
-						CloseHandle(it->first);
-						CloseHandle(it->second->m_FD);
-#else /* _WIN32 */
 						l_FDs[tid].erase(it->second->m_FD);
 						(void)close(it->second->m_FD);
-#endif /* _WIN32 */
 						l_Processes[tid].erase(it);
 					}
 				}
 			}
 		}
 	}
+#endif /* _WIN32 */
+}
+
+#ifdef _WIN32
+/**
+ * IOThreadProc() variant for Windows: the output pipes are associated with the I/O thread's completion port
+ * (by Run()) and read asynchronously, so the thread sleeps until reads have completed or the earliest deadline
+ * of its processes has passed. Unlike WaitForMultipleObjects() this isn't limited to 64 handles.
+ */
+void Process::CompletionPortThreadProc(int tid)
+{
+	const HANDLE port = l_CompletionPorts[tid];
+	OVERLAPPED_ENTRY entries[128];
+
+	Utility::SetThreadName("ProcessIO");
+
+	for (;;) {
+		DWORD timeout = INFINITE;
+
+		{
+			std::unique_lock<std::mutex> lock(l_ProcessMutex[tid]);
+
+			if (l_NextTimeoutCheck[tid] != std::numeric_limits<double>::infinity()) {
+				timeout = std::max(0.01, l_NextTimeoutCheck[tid] - Utility::GetTime()) * 1000;
+			}
+		}
+
+		ULONG count = 0;
+
+		if (!GetQueuedCompletionStatusEx(port, entries, sizeof(entries) / sizeof(entries[0]), &count, timeout, FALSE))
+			count = 0;
+
+		double now = Utility::GetTime();
+
+		std::unique_lock<std::mutex> lock(l_ProcessMutex[tid]);
+
+		for (ULONG i = 0; i < count; i++) {
+			auto& entry (entries[i]);
+
+			if (!entry.lpOverlapped)
+				continue; /* Woken up by Run(). */
+
+			auto it = l_Processes[tid].find(reinterpret_cast<ProcessHandle>(entry.lpCompletionKey));
+
+			if (it == l_Processes[tid].end())
+				continue; /* This should never happen. */
+
+			const Process::Ptr& process = it->second;
+
+			/* Internal is the NTSTATUS of the read, EOF is reported as STATUS_PIPE_BROKEN. */
+			process->m_ReadPending = false;
+			process->m_ReadFailed = entry.lpOverlapped->Internal != 0;
+			process->m_ReadBytes = entry.dwNumberOfBytesTransferred;
+
+			if (process->DoEvents()) {
+				process->ReadOutputAsync();
+			} else {
+				CloseHandle(process->m_FD);
+				CloseHandle(process->m_Process);
+				l_Processes[tid].erase(it);
+			}
+		}
+
+		if (now < l_NextTimeoutCheck[tid])
+			continue;
+
+		double next = std::numeric_limits<double>::infinity();
+
+		for (auto& kv : l_Processes[tid]) {
+			const Process::Ptr& process = kv.second;
+
+			if (process->m_Timeout != 0) {
+				double deadline = process->m_Result.ExecutionStart + process->GetNextTimeout();
+
+				/* The pipe must not be closed while it's being read, so the read is cancelled
+				 * and its completion lets DoEvents() kill the process. */
+				if (deadline < now) {
+					if (process->m_ReadPending)
+						CancelIoEx(process->m_FD, &process->m_Overlapped);
+
+					continue;
+				}
+
+				next = std::min(next, deadline);
+			}
+		}
+
+		l_NextTimeoutCheck[tid] = next;
+	}
+}
+
+/**
+ * Starts reading the output, the I/O thread's completion port gets notified once that's done.
+ */
+void Process::ReadOutputAsync()
+{
+	m_ReadPending = true;
+	m_Overlapped = OVERLAPPED();
+
+	if (!ReadFile(m_FD, m_ReadBuffer, sizeof(m_ReadBuffer), nullptr, &m_Overlapped) && GetLastError() != ERROR_IO_PENDING) {
+		/* Let the I/O thread handle that like a read of nothing, i.e. EOF. */
+		PostQueuedCompletionStatus(l_CompletionPorts[GetTID()], 0, reinterpret_cast<ULONG_PTR>(m_Process), &m_Overlapped);
+	}
+}
+#endif /* _WIN32 */
+
+#ifdef __linux__
+/**
+ * IOThreadProc() variant for Linux: the output FDs are registered with epoll once (by Run())
+ * instead of rebuilding a pollfd array on every iteration, and the processes are only scanned
+ * for timeouts once the earliest deadline has passed.
+ */
+void Process::EpollThreadProc(int tid)
+{
+	const int epfd = l_EpollFDs[tid];
+	epoll_event events[128];
+
+	auto removeProcess ([tid, epfd](std::map<ProcessHandle, Process::Ptr>::iterator it) {
+		const Process::Ptr& process = it->second;
+
+		(void)epoll_ctl(epfd, EPOLL_CTL_DEL, process->m_FD, nullptr);
+		l_FDs[tid].erase(process->m_FD);
+		(void)close(process->m_FD);
+
+		return l_Processes[tid].erase(it);
+	});
+
+	Utility::SetThreadName("ProcessIO");
+
+	for (;;) {
+		int timeout = -1;
+
+		{
+			std::unique_lock<std::mutex> lock(l_ProcessMutex[tid]);
+
+			if (l_NextTimeoutCheck[tid] != std::numeric_limits<double>::infinity()) {
+				timeout = std::max(0.01, l_NextTimeoutCheck[tid] - Utility::GetTime()) * 1000;
+			}
+		}
+
+		int rc = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), timeout);
+
+		if (rc < 0)
+			continue;
+
+		double now = Utility::GetTime();
+
+		std::unique_lock<std::mutex> lock(l_ProcessMutex[tid]);
+
+		for (int i = 0; i < rc; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == l_EventFDs[tid][0]) {
+				char buffer[512];
+				if (read(l_EventFDs[tid][0], buffer, sizeof(buffer)) < 0 && errno != EAGAIN && errno != EINTR)
+					Log(LogCritical, "base", "Read from event FD failed.");
+
+				continue;
+			}
+
+			auto it2 = l_FDs[tid].find(fd);
+
+			if (it2 == l_FDs[tid].end())
+				continue; /* This should never happen. */
+
+			auto it = l_Processes[tid].find(it2->second);
+
+			if (it == l_Processes[tid].end())
+				continue; /* This should never happen. */
+
+			if (!it->second->DoEvents())
+				removeProcess(it);
+		}
+
+		if (now < l_NextTimeoutCheck[tid])
+			continue;
+
+		double next = std::numeric_limits<double>::infinity();
+
+		for (auto it = l_Processes[tid].begin(); it != l_Processes[tid].end();) {
+			const Process::Ptr& process = it->second;
+
+			if (process->m_Timeout != 0) {
+				if (process->m_Result.ExecutionStart + process->GetNextTimeout() < now && !process->DoEvents()) {
+					it = removeProcess(it);
+					continue;
+				}
+
+				next = std::min(next, process->m_Result.ExecutionStart + process->GetNextTimeout());
+			}
+
+			++it;
+		}
+
+		l_NextTimeoutCheck[tid] = next;
+	}
 }
+#endif /* __linux__ */
 
 String Process::PrettyPrintArguments(const Process::Arguments& arguments)
 {
@@ -792,6 +1164,44 @@ static BOOL CreatePipeOverlapped(HANDLE *outReadPipe, HANDLE *outWritePipe,
 
 	return TRUE;
 }
+
+/**
+ * @returns A job object without any processes, from the pool if possible, or nullptr.
+ */
+static HANDLE AcquireJob()
+{
+	{
+		std::unique_lock<std::mutex> lock(l_JobPoolMutex);
+
+		if (!l_JobPool.empty()) {
+			HANDLE job = l_JobPool.back();
+			l_JobPool.pop_back();
+			return job;
+		}
+	}
+
+	return CreateJobObject(nullptr, nullptr);
+}
+
+/**
+ * Puts a job object back into the pool if all of its processes (not only the one started by Run()) have exited,
+ * otherwise closes it, so the remaining ones aren't killed by the timeout of a later process.
+ */
+static void ReleaseJob(HANDLE job)
+{
+	JOBOBJECT_BASIC_ACCOUNTING_INFORMATION info;
+
+	if (QueryInformationJobObject(job, JobObjectBasicAccountingInformation, &info, sizeof(info), nullptr) && !info.ActiveProcesses) {
+		std::unique_lock<std::mutex> lock(l_JobPoolMutex);
+
+		if (l_JobPool.size() < MAX_POOLED_JOBS) {
+			l_JobPool.push_back(job);
+			return;
+		}
+	}
+
+	CloseHandle(job);
+}
 #endif /* _WIN32 */
 
 void Process::Run(const std::function<void(const ProcessResult&)>& callback)
@@ -803,6 +1213,9 @@ void Process::Run(const std::function<void(const ProcessResult&)>& callback)
 
 	m_Result.ExecutionStart = Utility::GetTime();
 
+	/* Most plugins print less than that, so collecting the output usually needs only one allocation. */
+	m_Output.GetData().reserve(1024);
+
 #ifdef _WIN32
 	SECURITY_ATTRIBUTES sa = {};
 	sa.nLength = sizeof(sa);
@@ -919,8 +1332,9 @@ void Process::Run(const std::function<void(const ProcessResult&)>& callback)
 
 	envp[offset] = '\0';
 
+	/* Suspended until it's in its job object, so the processes it starts are in there, too. */
 	if (!CreateProcess(nullptr, args, nullptr, nullptr, TRUE,
-		0 /*EXTENDED_STARTUPINFO_PRESENT*/, envp, nullptr, &si.StartupInfo, &pi)) {
+		CREATE_SUSPENDED /*| EXTENDED_STARTUPINFO_PRESENT*/, envp, nullptr, &si.StartupInfo, &pi)) {
 		DWORD error = GetLastError();
 		CloseHandle(outWritePipe);
 		CloseHandle(outWritePipeDup);
@@ -954,6 +1368,15 @@ void Process::Run(const std::function<void(const ProcessResult&)>& callback)
 
 	CloseHandle(outWritePipe);
 	CloseHandle(outWritePipeDup);
+
+	m_Job = AcquireJob();
+
+	if (m_Job && !AssignProcessToJobObject(m_Job, pi.hProcess)) {
+		CloseHandle(m_Job);
+		m_Job = nullptr;
+	}
+
+	ResumeThread(pi.hThread);
 	CloseHandle(pi.hThread);
 
 	m_Process = pi.hProcess;
@@ -992,12 +1415,14 @@ void Process::Run(const std::function<void(const ProcessResult&)>& callback)
 	fds[1] = outfds[1];
 	fds[2] = outfds[1];
 
-	m_Process = ProcessSpawn(m_Arguments, m_ExtraEnvironment, m_AdjustPriority, fds);
+	m_Process = ProcessSpawn(m_Arguments, m_ExtraEnvironment, m_AdjustPriority, fds, m_SpawnHelper);
 	m_PID = m_Process;
 
 	if (m_PID == -1) {
-		m_OutputStream << "Fork failed with error code " << errno << " (" << Utility::FormatErrorNumber(errno) << ")";
-		Log(LogCritical, "Process", m_OutputStream.str());
+		int error = errno;
+
+		m_Output = "Fork failed with error code " + Convert::ToString(error) + " (" + Utility::FormatErrorNumber(error) + ")";
+		Log(LogCritical, "Process", m_Output.GetData());
 	}
 
 	Log(LogNotice, "Process")
@@ -1014,17 +1439,79 @@ void Process::Run(const std::function<void(const ProcessResult&)>& callback)
 
 	int tid = GetTID();
 
+#ifdef __linux__
+	if (l_EpollFDs[tid] != -1) {
+		bool wakeUp = false;
+
+		{
+			std::unique_lock<std::mutex> lock(l_ProcessMutex[tid]);
+
+			epoll_event event = {};
+			event.events = EPOLLIN;
+			event.data.fd = m_FD;
+
+			if (epoll_ctl(l_EpollFDs[tid], EPOLL_CTL_ADD, m_FD, &event) < 0) {
+				BOOST_THROW_EXCEPTION(posix_error()
+					<< boost::errinfo_api_function("epoll_ctl")
+					<< boost::errinfo_errno(errno));
+			}
+
+			l_Processes[tid][m_Process] = this;
+			l_FDs[tid][m_FD] = m_Process;
+
+			/* The I/O thread only needs to re-arm its timeout if we're due earlier than everything else. */
+			if (m_Timeout != 0) {
+				double deadline = m_Result.ExecutionStart + GetNextTimeout();
+
+				if (deadline < l_NextTimeoutCheck[tid]) {
+					l_NextTimeoutCheck[tid] = deadline;
+					wakeUp = true;
+				}
+			}
+		}
+
+		if (wakeUp && write(l_EventFDs[tid][1], "T", 1) < 0 && errno != EINTR && errno != EAGAIN)
+			Log(LogCritical, "base", "Write to event FD failed.");
+
+		return;
+	}
+#endif /* __linux__ */
+
+#ifdef _WIN32
+	bool wakeUp = false;
+
 	{
 		std::unique_lock<std::mutex> lock(l_ProcessMutex[tid]);
+
+		if (!CreateIoCompletionPort(m_FD, l_CompletionPorts[tid], reinterpret_cast<ULONG_PTR>(m_Process), 0)) {
+			BOOST_THROW_EXCEPTION(win32_error()
+				<< boost::errinfo_api_function("CreateIoCompletionPort")
+				<< errinfo_win32_error(GetLastError()));
+		}
+
 		l_Processes[tid][m_Process] = this;
-#ifndef _WIN32
-		l_FDs[tid][m_FD] = m_Process;
-#endif /* _WIN32 */
+		ReadOutputAsync();
+
+		/* The I/O thread only needs to re-arm its timeout if we're due earlier than everything else. */
+		if (m_Timeout != 0) {
+			double deadline = m_Result.ExecutionStart + GetNextTimeout();
+
+			if (deadline < l_NextTimeoutCheck[tid]) {
+				l_NextTimeoutCheck[tid] = deadline;
+				wakeUp = true;
+			}
+		}
 	}
 
-#ifdef _WIN32
-	SetEvent(l_Events[tid]);
+	if (wakeUp)
+		PostQueuedCompletionStatus(l_CompletionPorts[tid], 0, 0, nullptr);
 #else /* _WIN32 */
+	{
+		std::unique_lock<std::mutex> lock(l_ProcessMutex[tid]);
+		l_Processes[tid][m_Process] = this;
+		l_FDs[tid][m_FD] = m_Process;
+	}
+
 	if (write(l_EventFDs[tid][1], "T", 1) < 0 && errno != EINTR && errno != EAGAIN)
 		Log(LogCritical, "base", "Write to event FD failed.");
 #endif /* _WIN32 */
@@ -1056,9 +1543,9 @@ bool Process::DoEvents()
 					<< "Terminating process " << m_PID << " (" << PrettyPrintArguments(m_Arguments)
 					<< ") after timeout of " << timeout << " seconds";
 
-				m_OutputStream << "<Timeout exceeded.>";
+				m_Output += "<Timeout exceeded.>";
 
-				int error = ProcessKill(m_Process, SIGTERM);
+				int error = ProcessKill(m_SpawnHelper, m_Process, SIGTERM);
 				if (error) {
 					Log(LogWarning, "Process")
 						<< "Couldn't terminate the process " << m_PID << " (" << PrettyPrintArguments(m_Arguments)
@@ -1079,10 +1566,13 @@ bool Process::DoEvents()
 				<< ") after timeout of " << timeout << " seconds";
 
 #ifdef _WIN32
-			m_OutputStream << "<Timeout exceeded.>";
-			TerminateProcess(m_Process, 3);
+			m_Output += "<Timeout exceeded.>";
+
+			/* Also kills the processes it has started. */
+			if (!m_Job || !TerminateJobObject(m_Job, 3))
+				TerminateProcess(m_Process, 3);
 #else /* _WIN32 */
-			int error = ProcessKill(-m_Process, SIGKILL);
+			int error = ProcessKill(m_SpawnHelper, -m_Process, SIGKILL);
 			if (error) {
 				Log(LogWarning, "Process")
 					<< "Couldn't kill the process group " << m_PID << " (" << PrettyPrintArguments(m_Arguments)
@@ -1097,15 +1587,12 @@ bool Process::DoEvents()
 
 	if (!is_timeout) {
 #ifdef _WIN32
-		m_ReadPending = false;
-
-		DWORD rc;
-		if (!m_ReadFailed && GetOverlappedResult(m_FD, &m_Overlapped, &rc, TRUE) && rc > 0) {
-			m_OutputStream.write(m_ReadBuffer, rc);
+		if (!m_ReadFailed && m_ReadBytes > 0) {
+			AppendOutput(m_ReadBuffer, m_ReadBytes);
 			return true;
 		}
 #else /* _WIN32 */
-		char buffer[512];
+		char buffer[4096];
 		for (;;) {
 			int rc = read(m_FD, buffer, sizeof(buffer));
 
@@ -1113,7 +1600,7 @@ bool Process::DoEvents()
 				return true;
 
 			if (rc > 0) {
-				m_OutputStream.write(buffer, rc);
+				AppendOutput(buffer, rc);
 				continue;
 			}
 
@@ -1122,7 +1609,15 @@ bool Process::DoEvents()
 #endif /* _WIN32 */
 	}
 
-	String output = m_OutputStream.str();
+	if (m_DiscardedOutput) {
+		Log(LogWarning, "Process")
+			<< "Discarded " << m_DiscardedOutput << " bytes of output of PID " << m_PID << " (" << PrettyPrintArguments(m_Arguments)
+			<< ") beyond the limit of " << m_MaxOutputSize << " bytes";
+
+		m_Output += "<Output truncated after " + Convert::ToString(m_MaxOutputSize) + " bytes.>";
+	}
+
+	String output = std::move(m_Output);
 
 #ifdef _WIN32
 	WaitForSingleObject(m_Process, INFINITE);
@@ -1130,13 +1625,20 @@ bool Process::DoEvents()
 	DWORD exitcode;
 	GetExitCodeProcess(m_Process, &exitcode);
 
+	if (m_Job) {
+		ReleaseJob(m_Job);
+		m_Job = nullptr;
+	}
+
 	Log(LogNotice, "Process")
 		<< "PID " << m_PID << " (" << PrettyPrintArguments(m_Arguments) << ") terminated with exit code " << exitcode;
 #else /* _WIN32 */
 	int status, exitcode;
+	ProcessUsage usage;
+
 	if (could_not_kill || m_PID == -1) {
 		exitcode = 128;
-	} else if (ProcessWaitPID(m_Process, &status) != m_Process) {
+	} else if (ProcessWaitPID(m_SpawnHelper, m_Process, &status, &usage) != m_Process) {
 		exitcode = 128;
 
 		Log(LogWarning, "Process")
@@ -1182,6 +1684,9 @@ bool Process::DoEvents()
 		m_Result.ExecutionEnd = Utility::GetTime();
 		m_Result.ExitStatus = exitcode;
 		m_Result.Output = output;
+#ifndef _WIN32
+		m_Result.Usage = usage;
+#endif /* _WIN32 */
 		m_ResultAvailable = true;
 	}
 	m_ResultCondition.notify_all();
@@ -1198,6 +1703,26 @@ bool Process::DoEvents()
 	return false;
 }
 
+/**
+ * Collects the given output of the process up to its limit. Anything beyond that
+ * is still read (so that the process doesn't block), but only counted.
+ */
+void Process::AppendOutput(const char *data, size_t length)
+{
+	auto& output (m_Output.GetData());
+
+	if (m_MaxOutputSize) {
+		size_t room = m_MaxOutputSize > output.size() ? m_MaxOutputSize - output.size() : 0;
+
+		if (length > room) {
+			m_DiscardedOutput += length - room;
+			length = room;
+		}
+	}
+
+	output.append(data, length);
+}
+
 pid_t Process::GetPID() const
 {
 	return m_PID;
@@ -16,6 +16,21 @@
 namespace icinga
 {
 
+/**
+ * The resources used by a process and its waited-for children, see getrusage(2).
+ * Only available on Linux/Unix, zero otherwise.
+ *
+ * @ingroup base
+ */
+struct ProcessUsage
+{
+	double UserTime{0}; /* seconds */
+	double SystemTime{0}; /* seconds */
+	int_fast64_t MaxRss{0}; /* KiB */
+	int_fast64_t InBlocks{0};
+	int_fast64_t OutBlocks{0};
+};
+
 /**
  * The result of a Process task.
  *
@@ -28,6 +43,7 @@ struct ProcessResult
 	double ExecutionEnd;
 	int_fast64_t ExitStatus;
 	String Output;
+	ProcessUsage Usage;
 };
 
 /**
@@ -62,6 +78,9 @@ public:
 	void SetAdjustPriority(bool adjust);
 	bool GetAdjustPriority() const;
 
+	void SetMaxOutputSize(size_t size);
+	size_t GetMaxOutputSize() const;
+
 	void Run(const std::function<void (const ProcessResult&)>& callback = std::function<void (const ProcessResult&)>());
 
 	const ProcessResult& WaitForResult();
@@ -76,6 +95,13 @@ public:
 
 #ifndef _WIN32
 	static void InitializeSpawnHelper();
+	static int GetSpawnHelperCount();
+	static int GetSpawnStatistics(long timespan);
+	static double GetAvgSpawnLatency(long timespan);
+
+	static pid_t Spawn(const Arguments& arguments, const Dictionary::Ptr& extraEnvironment, int fds[3], int& spawnHelper);
+	static int Kill(int spawnHelper, pid_t pid, int signum);
+	static int WaitPID(int spawnHelper, pid_t pid, int *status, ProcessUsage *usage = nullptr);
 #endif /* _WIN32 */
 
 private:
@@ -85,6 +111,7 @@ private:
 	double m_Timeout;
 #ifndef _WIN32
 	bool m_SentSigterm;
+	int m_SpawnHelper;
 #endif /* _WIN32 */
 
 	bool m_AdjustPriority;
@@ -94,13 +121,17 @@ private:
 	ConsoleHandle m_FD;
 
 #ifdef _WIN32
+	HANDLE m_Job;
 	bool m_ReadPending;
 	bool m_ReadFailed;
+	DWORD m_ReadBytes;
 	OVERLAPPED m_Overlapped;
-	char m_ReadBuffer[1024];
+	char m_ReadBuffer[4096];
 #endif /* _WIN32 */
 
-	std::ostringstream m_OutputStream;
+	String m_Output;
+	size_t m_MaxOutputSize;
+	size_t m_DiscardedOutput;
 	std::function<void (const ProcessResult&)> m_Callback;
 	ProcessResult m_Result;
 	bool m_ResultAvailable;
@@ -108,7 +139,15 @@ private:
 	std::condition_variable m_ResultCondition;
 
 	static void IOThreadProc(int tid);
+#ifdef _WIN32
+	static void CompletionPortThreadProc(int tid);
+	void ReadOutputAsync();
+#endif /* _WIN32 */
+#ifdef __linux__
+	static void EpollThreadProc(int tid);
+#endif /* __linux__ */
 	bool DoEvents();
+	void AppendOutput(const char *data, size_t length);
 	int GetTID() const;
 	double GetNextTimeout() const;
 };
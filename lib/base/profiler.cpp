@@ -0,0 +1,179 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/profiler.hpp"
+#include "base/function.hpp"
+#include "base/statsfunction.hpp"
+#include <boost/stacktrace.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using namespace icinga;
+
+REGISTER_STATSFUNCTION(Profiler, &Profiler::StatsFunc);
+
+static Dictionary::Ptr GetSubsystemProfile()
+{
+	return Profiler::GetReport();
+}
+
+static void ResetSubsystemProfile()
+{
+	Profiler::Reset();
+}
+
+REGISTER_SAFE_FUNCTION(Internal, subsystem_profile, &GetSubsystemProfile, "");
+REGISTER_FUNCTION(Internal, reset_subsystem_profile, &ResetSubsystemProfile, "");
+
+/* The probes are never freed, running scopes keep pointers to them. */
+static boost::shared_mutex l_ProbesMutex;
+static std::map<std::pair<String, String>, std::unique_ptr<ProfilerProbe>> l_Probes;
+
+ProfilerProbe *Profiler::GetProbe(const char *subsystem, const String& name)
+{
+	std::pair<String, String> key (subsystem, name);
+
+	{
+		boost::shared_lock<boost::shared_mutex> lock (l_ProbesMutex);
+		auto it (l_Probes.find(key));
+
+		if (it != l_Probes.end())
+			return it->second.get();
+	}
+
+	boost::unique_lock<boost::shared_mutex> lock (l_ProbesMutex);
+	auto& probe (l_Probes[key]);
+
+	if (!probe) {
+		probe.reset(new ProfilerProbe());
+		probe->Subsystem = key.first;
+		probe->Name = key.second;
+	}
+
+	return probe.get();
+}
+
+void Profiler::Record(ProfilerProbe *probe, uint_fast64_t nanoseconds)
+{
+	probe->Calls.fetch_add(1, std::memory_order_relaxed);
+	probe->TotalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+	auto max (probe->MaxNanoseconds.load(std::memory_order_relaxed));
+
+	while (nanoseconds > max && !probe->MaxNanoseconds.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed))
+		;
+}
+
+/**
+ * @returns The return addresses of the innermost frames of the caller.
+ */
+ProfilerSite Profiler::GetSite()
+{
+	boost::stacktrace::stacktrace trace (0, ProfilerSite().size());
+	ProfilerSite site {};
+
+	for (size_t i = 0; i < trace.size() && i < site.size(); i++)
+		site[i] = trace[i].address();
+
+	return site;
+}
+
+/**
+ * @returns The name of the innermost function of the site which doesn't contain the given string.
+ */
+String Profiler::GetSiteName(const ProfilerSite& site, const char *skip)
+{
+	String fallback;
+
+	for (auto address : site) {
+		if (!address)
+			break;
+
+		String name = boost::stacktrace::frame(address).name();
+
+		if (name.IsEmpty())
+			continue;
+
+		if (fallback.IsEmpty())
+			fallback = name;
+
+		if (name.Find(skip) == String::NPos && name.Find("Profiler::GetSite") == String::NPos)
+			return name;
+	}
+
+	return fallback.IsEmpty() ? "<unknown>" : fallback;
+}
+
+/**
+ * @param limit The maximum number of spans to report per subsystem, 0 for all.
+ * @returns The spans per subsystem, sorted by their total time.
+ */
+Dictionary::Ptr Profiler::GetReport(size_t limit)
+{
+	std::map<String, std::vector<const ProfilerProbe *>> subsystems;
+
+	{
+		boost::shared_lock<boost::shared_mutex> lock (l_ProbesMutex);
+
+		for (auto& kv : l_Probes) {
+			if (kv.second->Calls.load())
+				subsystems[kv.second->Subsystem].emplace_back(kv.second.get());
+		}
+	}
+
+	Dictionary::Ptr report = new Dictionary();
+
+	for (auto& subsystem : subsystems) {
+		auto& probes (subsystem.second);
+
+		std::sort(probes.begin(), probes.end(), [](const ProfilerProbe *a, const ProfilerProbe *b) {
+			return a->TotalNanoseconds.load() > b->TotalNanoseconds.load();
+		});
+
+		if (limit && probes.size() > limit)
+			probes.resize(limit);
+
+		ArrayData spans;
+
+		for (auto probe : probes) {
+			auto calls (probe->Calls.load());
+			double total = probe->TotalNanoseconds.load() / 1e9;
+
+			spans.emplace_back(new Dictionary({
+				{ "name", probe->Name },
+				{ "calls", static_cast<double>(calls) },
+				{ "total", total },
+				{ "avg", calls ? total / calls : 0.0 },
+				{ "max", probe->MaxNanoseconds.load() / 1e9 }
+			}));
+		}
+
+		report->Set(subsystem.first, new Array(std::move(spans)));
+	}
+
+	return report;
+}
+
+/**
+ * Starts counting from zero again.
+ */
+void Profiler::Reset()
+{
+	boost::shared_lock<boost::shared_mutex> lock (l_ProbesMutex);
+
+	for (auto& kv : l_Probes) {
+		kv.second->Calls.store(0);
+		kv.second->TotalNanoseconds.store(0);
+		kv.second->MaxNanoseconds.store(0);
+	}
+}
+
+void Profiler::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr&)
+{
+	if (IsEnabled())
+		status->Set("subsystem_profile", GetReport(25));
+}
@@ -0,0 +1,137 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "base/i2-base.hpp"
+#include "base/array.hpp"
+#include "base/configuration.hpp"
+#include "base/dictionary.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#ifdef HAVE_SYS_SDT_H
+#	include <sys/sdt.h>
+#endif /* HAVE_SYS_SDT_H */
+
+namespace icinga
+{
+
+/**
+ * The spans of one subsystem with the same name, e.g. the tasks of a WorkQueue.
+ *
+ * @ingroup base
+ */
+struct ProfilerProbe
+{
+	String Subsystem;
+	String Name;
+
+	std::atomic<uint_fast64_t> Calls{0};
+	std::atomic<uint_fast64_t> TotalNanoseconds{0};
+	std::atomic<uint_fast64_t> MaxNanoseconds{0};
+};
+
+/* The return addresses of the innermost frames of e.g. the creation of a Timer. */
+typedef std::array<const void *, 4> ProfilerSite;
+
+/**
+ * Aggregates the time spent in the hot paths of the subsystems (see the ProfileSubsystems constant).
+ *
+ * Builds on Linux with <sys/sdt.h> also fire the USDT probes icinga2:span__begin and icinga2:span__end
+ * (with the subsystem, the name and, for the latter, the nanoseconds) for e.g. bpftrace, no matter
+ * whether the constant is set.
+ *
+ * @ingroup base
+ */
+class Profiler
+{
+public:
+	static inline bool IsEnabled()
+	{
+		return Configuration::ProfileSubsystems;
+	}
+
+	/**
+	 * @returns Whether the names of the spans are needed, i.e. worth building.
+	 */
+	static inline bool IsActive()
+	{
+#ifdef HAVE_SYS_SDT_H
+		return true;
+#else /* HAVE_SYS_SDT_H */
+		return IsEnabled();
+#endif /* HAVE_SYS_SDT_H */
+	}
+
+	static ProfilerSite GetSite();
+	static String GetSiteName(const ProfilerSite& site, const char *skip);
+
+	static Dictionary::Ptr GetReport(size_t limit = 0);
+	static void Reset();
+
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+
+private:
+	static ProfilerProbe *GetProbe(const char *subsystem, const String& name);
+	static void Record(ProfilerProbe *probe, uint_fast64_t nanoseconds);
+
+	friend class ProfilerScope;
+};
+
+/**
+ * Measures a span until it's destroyed. Does nothing unless the profiler is enabled or a USDT probe is attached.
+ * The name must outlive the scope.
+ *
+ * @ingroup base
+ */
+class ProfilerScope
+{
+public:
+	inline ProfilerScope(const char *subsystem, const String& name)
+		: m_Subsystem(subsystem), m_Name(name.CStr()),
+		m_Probe(Profiler::IsEnabled() ? Profiler::GetProbe(subsystem, name) : nullptr)
+	{
+#ifdef HAVE_SYS_SDT_H
+		DTRACE_PROBE2(icinga2, span__begin, m_Subsystem, m_Name);
+
+		m_Start = std::chrono::steady_clock::now();
+#else /* HAVE_SYS_SDT_H */
+		if (m_Probe)
+			m_Start = std::chrono::steady_clock::now();
+#endif /* HAVE_SYS_SDT_H */
+	}
+
+	ProfilerScope(const ProfilerScope&) = delete;
+	ProfilerScope& operator=(const ProfilerScope&) = delete;
+
+	inline ~ProfilerScope()
+	{
+#ifndef HAVE_SYS_SDT_H
+		if (!m_Probe)
+			return;
+#endif /* HAVE_SYS_SDT_H */
+
+		auto nanoseconds (static_cast<uint_fast64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - m_Start).count()));
+
+#ifdef HAVE_SYS_SDT_H
+		DTRACE_PROBE3(icinga2, span__end, m_Subsystem, m_Name, nanoseconds);
+#endif /* HAVE_SYS_SDT_H */
+
+		if (m_Probe)
+			Profiler::Record(m_Probe, nanoseconds);
+	}
+
+private:
+	const char *m_Subsystem;
+	const char *m_Name;
+	ProfilerProbe *m_Probe;
+	std::chrono::steady_clock::time_point m_Start;
+};
+
+}
+
+#endif /* PROFILER_H */
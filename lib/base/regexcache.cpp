@@ -0,0 +1,58 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/regexcache.hpp"
+#include <boost/regex.hpp>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+using namespace icinga;
+
+typedef std::list<std::pair<String, std::shared_ptr<const boost::regex>>> RegexList;
+
+static std::mutex l_RegexCacheMutex;
+/* Most recently used first */
+static RegexList l_Regexes;
+static std::unordered_map<String, RegexList::iterator> l_RegexIndex;
+
+/**
+ * @returns The compiled pattern, which may be used by multiple threads
+ * @throws boost::regex_error If the pattern is invalid (which isn't cached)
+ */
+std::shared_ptr<const boost::regex> RegexCache::Get(const String& pattern)
+{
+	{
+		std::unique_lock<std::mutex> lock (l_RegexCacheMutex);
+		auto pos (l_RegexIndex.find(pattern));
+
+		if (pos != l_RegexIndex.end()) {
+			l_Regexes.splice(l_Regexes.begin(), l_Regexes, pos->second);
+			return pos->second->second;
+		}
+	}
+
+	/* Don't block other lookups while compiling. */
+	auto regex (std::make_shared<const boost::regex>(pattern.GetData()));
+
+	std::unique_lock<std::mutex> lock (l_RegexCacheMutex);
+
+	if (l_RegexIndex.find(pattern) == l_RegexIndex.end()) {
+		l_Regexes.emplace_front(pattern, regex);
+		l_RegexIndex.emplace(pattern, l_Regexes.begin());
+
+		if (l_Regexes.size() > Capacity) {
+			l_RegexIndex.erase(l_Regexes.back().first);
+			l_Regexes.pop_back();
+		}
+	}
+
+	return regex;
+}
+
+size_t RegexCache::GetSize()
+{
+	std::unique_lock<std::mutex> lock (l_RegexCacheMutex);
+
+	return l_Regexes.size();
+}
@@ -0,0 +1,34 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef REGEXCACHE_H
+#define REGEXCACHE_H
+
+#include "base/i2-base.hpp"
+#include "base/string.hpp"
+#include <boost/regex_fwd.hpp>
+#include <memory>
+
+namespace icinga
+{
+
+/**
+ * The most recently used regular expressions of regex(), compiled.
+ * The same few patterns are usually matched against all hosts or services.
+ *
+ * @ingroup base
+ */
+class RegexCache
+{
+public:
+	static const size_t Capacity = 1024;
+
+	static std::shared_ptr<const boost::regex> Get(const String& pattern);
+	static size_t GetSize();
+
+private:
+	RegexCache();
+};
+
+}
+
+#endif /* REGEXCACHE_H */
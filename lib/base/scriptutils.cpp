@@ -14,6 +14,8 @@
 #include "base/dependencygraph.hpp"
 #include "base/initialize.hpp"
 #include "base/namespace.hpp"
+#include "base/regexcache.hpp"
+#include "base/wildcardpattern.hpp"
 #include "config/configitem.hpp"
 #include <boost/regex.hpp>
 #include <algorithm>
@@ -111,7 +113,7 @@ bool ScriptUtils::Regex(const std::vector<Value>& args)
 	else
 		mode = MatchAll;
 
-	boost::regex expr(pattern.GetData());
+	auto expr (RegexCache::Get(pattern));
 
 	Array::Ptr texts;
 
@@ -128,7 +130,7 @@ bool ScriptUtils::Regex(const std::vector<Value>& args)
 			bool res = false;
 			try {
 				boost::smatch what;
-				res = boost::regex_search(text.GetData(), what, expr);
+				res = boost::regex_search(text.GetData(), what, *expr);
 			} catch (boost::exception&) {
 				res = false; /* exception means something went terribly wrong */
 			}
@@ -144,7 +146,7 @@ bool ScriptUtils::Regex(const std::vector<Value>& args)
 	} else {
 		String text = argTexts;
 		boost::smatch what;
-		return boost::regex_search(text.GetData(), what, expr);
+		return boost::regex_search(text.GetData(), what, *expr);
 	}
 }
 
@@ -177,8 +179,10 @@ bool ScriptUtils::Match(const std::vector<Value>& args)
 		if (texts->GetLength() == 0)
 			return false;
 
+		WildcardPattern compiledPattern (pattern);
+
 		for (const String& text : texts) {
-			bool res = Utility::Match(pattern, text);
+			bool res = compiledPattern.Match(text);
 
 			if (mode == MatchAny && res)
 				return true;
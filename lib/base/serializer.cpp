@@ -161,26 +161,20 @@ static Object::Ptr SerializeObject(const Object::Ptr& input, int attributeTypes,
 
 	ObjectLock olock(input);
 
-	for (int i = 0; i < type->GetFieldCount(); i++) {
-		Field field = type->GetFieldInfo(i);
+	input->VisitFields(attributeTypes, [attributeTypes, &stack, dryRun, &fields](const char *name, const Value& value) {
+		if (strcmp(name, "type") == 0)
+			return;
 
-		if (attributeTypes != 0 && (field.Attributes & attributeTypes) == 0)
-			continue;
-
-		if (strcmp(field.Name, "type") == 0)
-			continue;
-
-		Value value = input->GetField(i);
-		stack.Push(field.Name, value);
+		stack.Push(name, value);
 
 		auto serialized (SerializeInternal(value, attributeTypes, stack, dryRun));
 
 		if (!dryRun) {
-			fields.emplace_back(field.Name, std::move(serialized));
+			fields.emplace_back(name, std::move(serialized));
 		}
 
 		stack.Pop();
-	}
+	});
 
 	if (!dryRun) {
 		fields.emplace_back("type", type->GetName());
@@ -0,0 +1,124 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/shardedringbuffer.hpp"
+#include <algorithm>
+#include <thread>
+
+using namespace icinga;
+
+/* More shards than that hardly reduce the contention any further, but cost memory. */
+static const size_t l_MaxShards = 8;
+
+static std::atomic<size_t> l_NextShard (0);
+
+static size_t GetShardCount()
+{
+	static const size_t shards = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), l_MaxShards);
+
+	return shards;
+}
+
+/**
+ * @returns The shard of the current thread, the threads are spread round-robin.
+ */
+static size_t GetShard()
+{
+	static thread_local size_t shard = l_NextShard.fetch_add(1) % GetShardCount();
+
+	return shard;
+}
+
+static inline uint64_t MakeSlot(uint32_t second, uint32_t value)
+{
+	return (static_cast<uint64_t>(second) << 32u) | value;
+}
+
+ShardedRingBuffer::ShardedRingBuffer(ShardedRingBuffer::SizeType slots)
+	: m_Length(std::max<SizeType>(slots, 1)),
+	m_Stride((m_Length + 7u) / 8u * 8u), m_Slots(new std::atomic<uint64_t>[m_Stride * GetShardCount()])
+{
+	for (SizeType i = 0; i < m_Stride * GetShardCount(); i++)
+		m_Slots[i].store(0, std::memory_order_relaxed);
+}
+
+ShardedRingBuffer::SizeType ShardedRingBuffer::GetLength() const
+{
+	return m_Length;
+}
+
+void ShardedRingBuffer::InsertValue(ShardedRingBuffer::SizeType tv, int num)
+{
+	auto second (static_cast<uint32_t>(tv));
+	auto& slot (m_Slots[GetShard() * m_Stride + tv % m_Length]);
+	uint64_t expected = slot.load(std::memory_order_relaxed);
+
+	for (;;) {
+		auto slotSecond (static_cast<uint32_t>(expected >> 32u));
+		uint64_t desired;
+
+		if (slotSecond == second)
+			desired = MakeSlot(second, static_cast<uint32_t>(expected) + static_cast<uint32_t>(num));
+		else if (slotSecond < second)
+			desired = MakeSlot(second, static_cast<uint32_t>(num));
+		else
+			break; /* Too old for the ring. */
+
+		if (slot.compare_exchange_weak(expected, desired, std::memory_order_relaxed))
+			break;
+	}
+
+	UpdateTimes(tv);
+}
+
+void ShardedRingBuffer::UpdateTimes(ShardedRingBuffer::SizeType tv)
+{
+	SizeType first = 0;
+
+	if (m_FirstTime.load(std::memory_order_relaxed) == 0)
+		m_FirstTime.compare_exchange_strong(first, tv, std::memory_order_relaxed);
+
+	SizeType latest = m_LatestTime.load(std::memory_order_relaxed);
+
+	while (tv > latest && !m_LatestTime.compare_exchange_weak(latest, tv, std::memory_order_relaxed))
+		;
+}
+
+/**
+ * @returns The sum of all shards' counters of the given number of seconds up to the given one.
+ */
+int ShardedRingBuffer::SumValues(ShardedRingBuffer::SizeType tv, ShardedRingBuffer::SizeType span) const
+{
+	int sum = 0;
+
+	for (size_t shard = 0; shard < GetShardCount(); shard++) {
+		for (SizeType i = 0; i < span && i <= tv; i++) {
+			SizeType second = tv - i;
+			uint64_t slot = m_Slots[shard * m_Stride + second % m_Length].load(std::memory_order_relaxed);
+
+			if (static_cast<uint32_t>(slot >> 32u) == static_cast<uint32_t>(second))
+				sum += static_cast<int32_t>(static_cast<uint32_t>(slot));
+		}
+	}
+
+	return sum;
+}
+
+int ShardedRingBuffer::UpdateAndGetValues(ShardedRingBuffer::SizeType tv, ShardedRingBuffer::SizeType span)
+{
+	UpdateTimes(tv);
+
+	return SumValues(std::max(tv, m_LatestTime.load(std::memory_order_relaxed)), std::min(span, m_Length));
+}
+
+double ShardedRingBuffer::CalculateRate(ShardedRingBuffer::SizeType tv, ShardedRingBuffer::SizeType span)
+{
+	UpdateTimes(tv);
+
+	SizeType latest = std::max(tv, m_LatestTime.load(std::memory_order_relaxed));
+	SizeType first = m_FirstTime.load(std::memory_order_relaxed);
+
+	/* Like RingBuffer: the seconds since the first value, at most the whole ring. */
+	SizeType seconds = first && first <= latest ? std::min(latest - first + 1, m_Length) : 1;
+
+	return SumValues(latest, std::min(span, m_Length)) / static_cast<double>(std::min(span, seconds));
+}
@@ -0,0 +1,52 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef SHARDEDRINGBUFFER_H
+#define SHARDEDRINGBUFFER_H
+
+#include "base/i2-base.hpp"
+#include "base/ringbuffer.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace icinga
+{
+
+/**
+ * A RingBuffer for counters incremented by many threads at once, e.g. per check result.
+ *
+ * Every thread increments its own shard of slots without any lock. Each slot holds the second it belongs to
+ * next to the counter, so it's reset by the first increment of a new second instead of by walking the ring.
+ * The shards are only merged by UpdateAndGetValues() and CalculateRate().
+ *
+ * @ingroup base
+ */
+class ShardedRingBuffer final
+{
+public:
+	typedef RingBuffer::SizeType SizeType;
+
+	ShardedRingBuffer(SizeType slots);
+
+	ShardedRingBuffer(const ShardedRingBuffer&) = delete;
+	ShardedRingBuffer& operator=(const ShardedRingBuffer&) = delete;
+
+	SizeType GetLength() const;
+	void InsertValue(SizeType tv, int num);
+	int UpdateAndGetValues(SizeType tv, SizeType span);
+	double CalculateRate(SizeType tv, SizeType span);
+
+private:
+	SizeType m_Length;
+	SizeType m_Stride; /**< Slots per shard, rounded up to whole cache lines */
+	std::unique_ptr<std::atomic<uint64_t>[]> m_Slots; /**< The second (upper 32 bits) and the counter (lower 32 bits) */
+	std::atomic<SizeType> m_FirstTime{0};
+	std::atomic<SizeType> m_LatestTime{0};
+
+	void UpdateTimes(SizeType tv);
+	int SumValues(SizeType tv, SizeType span) const;
+};
+
+}
+
+#endif /* SHARDEDRINGBUFFER_H */
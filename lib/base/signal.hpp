@@ -0,0 +1,304 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef SIGNAL_H
+#define SIGNAL_H
+
+#include "base/i2-base.hpp"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace icinga
+{
+
+/**
+ * The part of a connected slot a SignalConnection needs to know about.
+ *
+ * @ingroup base
+ */
+struct SignalSlotBase
+{
+	std::atomic<bool> Connected{true};
+
+	virtual ~SignalSlotBase() = default;
+};
+
+/**
+ * The part of a signal a SignalConnection needs to know about.
+ *
+ * @ingroup base
+ */
+class SignalStateBase
+{
+public:
+	virtual ~SignalStateBase() = default;
+
+	virtual void Disconnect(const SignalSlotBase *slot) = 0;
+};
+
+/**
+ * A slot connected to a Signal. The lowercase member functions match those of boost::signals2::connection.
+ *
+ * @ingroup base
+ */
+class SignalConnection
+{
+public:
+	SignalConnection() = default;
+
+	inline SignalConnection(std::weak_ptr<SignalStateBase> state, std::weak_ptr<SignalSlotBase> slot)
+		: m_State(std::move(state)), m_Slot(std::move(slot))
+	{ }
+
+	/**
+	 * Disconnects the slot. It won't be called by emissions starting afterwards,
+	 * but it may still be running in another thread.
+	 */
+	inline void disconnect()
+	{
+		auto slot (m_Slot.lock());
+
+		if (!slot)
+			return;
+
+		slot->Connected.store(false);
+
+		auto state (m_State.lock());
+
+		if (state)
+			state->Disconnect(slot.get());
+
+		m_Slot.reset();
+	}
+
+	inline bool connected() const
+	{
+		auto slot (m_Slot.lock());
+
+		return slot && slot->Connected.load();
+	}
+
+private:
+	std::weak_ptr<SignalStateBase> m_State;
+	std::weak_ptr<SignalSlotBase> m_Slot;
+};
+
+/**
+ * Disconnects the slot once it goes out of scope.
+ *
+ * @ingroup base
+ */
+class ScopedSignalConnection
+{
+public:
+	inline ScopedSignalConnection(SignalConnection connection)
+		: m_Connection(std::move(connection))
+	{ }
+
+	ScopedSignalConnection(const ScopedSignalConnection&) = delete;
+	ScopedSignalConnection& operator=(const ScopedSignalConnection&) = delete;
+
+	inline ~ScopedSignalConnection()
+	{
+		m_Connection.disconnect();
+	}
+
+	inline void disconnect()
+	{
+		m_Connection.disconnect();
+	}
+
+private:
+	SignalConnection m_Connection;
+};
+
+template<typename Signature>
+class Signal;
+
+/**
+ * A replacement for boost::signals2::signal for signals emitted very often, e.g. for every check result.
+ *
+ * The connected slots are kept in an immutable list which is replaced (copy-on-write) by connect() and
+ * disconnect(). Emitting just counts itself and loads the current list, i.e. it neither locks nor copies
+ * anything. Replaced lists (and with them the callbacks of disconnected slots) are released as soon as no
+ * emission is running anymore, as emissions in other threads may still iterate over them until then.
+ *
+ * @ingroup base
+ */
+template<typename... Args>
+class Signal<void (Args...)>
+{
+public:
+	typedef std::function<void (Args...)> SlotFunction;
+
+	Signal()
+		: m_State(std::make_shared<State>())
+	{ }
+
+	Signal(const Signal&) = delete;
+	Signal& operator=(const Signal&) = delete;
+
+	template<typename F>
+	SignalConnection connect(F&& callback)
+	{
+		auto slot (std::make_shared<Slot>());
+		slot->Callback = SlotFunction(std::forward<F>(callback));
+
+		m_State->Connect(slot);
+
+		return SignalConnection(m_State, slot);
+	}
+
+	void operator()(Args... args) const
+	{
+		typename State::Emission emission (*m_State);
+		auto slots (m_State->Slots.load());
+
+		if (!slots)
+			return;
+
+		for (auto& slot : *slots) {
+			if (slot->Connected.load(std::memory_order_relaxed))
+				slot->Callback(args...);
+		}
+	}
+
+	bool empty() const
+	{
+		auto slots (m_State->Slots.load(std::memory_order_acquire));
+
+		return !slots || slots->empty();
+	}
+
+private:
+	struct Slot : SignalSlotBase
+	{
+		SlotFunction Callback;
+	};
+
+	typedef std::vector<std::shared_ptr<Slot>> SlotList;
+
+	class State : public SignalStateBase
+	{
+	public:
+		/**
+		 * Keeps the lists loaded during its lifetime from being released.
+		 */
+		class Emission
+		{
+		public:
+			inline Emission(State& state)
+				: m_State(state)
+			{
+				m_State.m_Emitting.fetch_add(1);
+			}
+
+			Emission(const Emission&) = delete;
+			Emission& operator=(const Emission&) = delete;
+
+			inline ~Emission()
+			{
+				if (m_State.m_Emitting.fetch_sub(1) == 1 && m_State.m_HasRetired.load()) {
+					std::unique_lock<std::mutex> lock (m_State.m_Mutex, std::try_to_lock);
+
+					/* Otherwise connect() or disconnect() is running and will release them. */
+					if (lock) {
+						auto retired (m_State.TakeReleasable());
+						lock.unlock();
+					}
+				}
+			}
+
+		private:
+			State& m_State;
+		};
+
+		std::atomic<const SlotList *> Slots{nullptr};
+
+		void Connect(const std::shared_ptr<Slot>& slot)
+		{
+			std::vector<std::unique_ptr<const SlotList>> retired;
+			std::unique_lock<std::mutex> lock (m_Mutex);
+
+			auto slots (CopySlots());
+			slots->emplace_back(slot);
+
+			Publish(std::move(slots));
+			retired = TakeReleasable();
+		}
+
+		void Disconnect(const SignalSlotBase *slot) override
+		{
+			std::vector<std::unique_ptr<const SlotList>> retired;
+			std::unique_lock<std::mutex> lock (m_Mutex);
+
+			auto slots (CopySlots());
+
+			slots->erase(std::remove_if(slots->begin(), slots->end(), [slot](const std::shared_ptr<Slot>& s) {
+				return s.get() == slot;
+			}), slots->end());
+
+			Publish(std::move(slots));
+			retired = TakeReleasable();
+		}
+
+	private:
+		std::mutex m_Mutex;
+
+		std::unique_ptr<const SlotList> m_Current;
+		std::vector<std::unique_ptr<const SlotList>> m_Retired;
+		std::atomic<bool> m_HasRetired{false};
+
+		/* Number of running emissions, which may still iterate over m_Retired. */
+		std::atomic<size_t> m_Emitting{0};
+
+		std::unique_ptr<SlotList> CopySlots() const
+		{
+			auto slots (Slots.load(std::memory_order_relaxed));
+
+			return std::make_unique<SlotList>(slots ? *slots : SlotList());
+		}
+
+		void Publish(std::unique_ptr<SlotList> slots)
+		{
+			Slots.store(slots.get());
+
+			if (m_Current) {
+				m_Retired.emplace_back(std::move(m_Current));
+				m_HasRetired.store(true);
+			}
+
+			m_Current = std::move(slots);
+		}
+
+		/**
+		 * Takes the replaced lists if no emission can still use them. The caller releases them without
+		 * holding m_Mutex, so that callbacks' captures may connect to or disconnect from this signal.
+		 *
+		 * Emissions count themselves before loading Slots. So if none is counted after a list has been
+		 * replaced, all following ones will load one of its successors.
+		 */
+		std::vector<std::unique_ptr<const SlotList>> TakeReleasable()
+		{
+			std::vector<std::unique_ptr<const SlotList>> retired;
+
+			if (m_Emitting.load() == 0) {
+				retired.swap(m_Retired);
+				m_HasRetired.store(false);
+			}
+
+			return retired;
+		}
+	};
+
+	/* Shared with the connections, so they may outlive the signal. */
+	std::shared_ptr<State> m_State;
+};
+
+}
+
+#endif /* SIGNAL_H */
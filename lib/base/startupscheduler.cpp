@@ -0,0 +1,280 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/startupscheduler.hpp"
+#include "base/application.hpp"
+#include "base/defer.hpp"
+#include "base/logger.hpp"
+#include "base/perfdatavalue.hpp"
+#include "base/scriptglobal.hpp"
+#include "base/statsfunction.hpp"
+#include "base/utility.hpp"
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using namespace icinga;
+
+REGISTER_STATSFUNCTION(StartupScheduler, &StartupScheduler::StatsFunc);
+
+struct StartupTaskState
+{
+	int Priority{0};
+	int MaxConcurrent{0};
+	size_t Running{0};
+	size_t Waiting{0};
+	size_t Completed{0};
+	double WaitTime{0};
+	double RunTime{0};
+	String Phase;
+};
+
+struct StartupTaskWaiter
+{
+	String Name;
+	int Priority;
+	double Since;
+	std::function<void()> Admit;
+};
+
+static std::mutex l_Mutex;
+static std::map<String, StartupTaskState> l_Tasks;
+
+/* Ordered by priority (descending), then by arrival. */
+static std::list<StartupTaskWaiter> l_Waiters;
+
+static size_t l_Running = 0;
+static std::vector<std::pair<String, double>> l_Phases;
+
+/* Once the startup has finished, e.g. the reconnects of features aren't throttled anymore. */
+static bool l_Finished = false;
+
+/**
+ * @returns How many tasks may run at once, 0 means unlimited.
+ */
+static int GetConcurrency()
+{
+	Value defaultConcurrency = 0;
+	Value concurrency = ScriptGlobal::Get("StartupConcurrency", &defaultConcurrency);
+
+	return concurrency.IsNumber() ? static_cast<int>(concurrency) : 0;
+}
+
+/**
+ * @returns The task with the priority and the budget overridden by the StartupTasks constant.
+ */
+static StartupTask ApplyOverrides(StartupTask task)
+{
+	Value tasks = ScriptGlobal::Get("StartupTasks", &Empty);
+
+	if (!tasks.IsObjectType<Dictionary>())
+		return task;
+
+	Value settings = static_cast<Dictionary::Ptr>(tasks)->Get(task.Name);
+
+	if (!settings.IsObjectType<Dictionary>())
+		return task;
+
+	Dictionary::Ptr dict = settings;
+	Value value;
+
+	if (dict->Get("priority", &value) && value.IsNumber())
+		task.Priority = value;
+
+	if (dict->Get("max_concurrent", &value) && value.IsNumber())
+		task.MaxConcurrent = value;
+
+	return task;
+}
+
+/* must hold l_Mutex */
+static void MarkPhaseLocked(const String& phase)
+{
+	for (auto& reached : l_Phases) {
+		if (reached.first == phase)
+			return;
+	}
+
+	double elapsed = Utility::GetTime() - Application::GetStartTime();
+
+	l_Phases.emplace_back(phase, elapsed);
+
+	Log(LogInformation, "StartupScheduler")
+		<< "Startup phase '" << phase << "' reached after " << Utility::FormatDuration(elapsed) << ".";
+}
+
+/* must hold l_Mutex */
+static void AdmitWaiting()
+{
+	int concurrency = GetConcurrency();
+	double now = Utility::GetTime();
+
+	for (auto it (l_Waiters.begin()); it != l_Waiters.end();) {
+		if (!l_Finished && concurrency > 0 && l_Running >= static_cast<size_t>(concurrency))
+			break;
+
+		auto& state (l_Tasks[it->Name]);
+
+		/* A task of a lower priority may run instead, as long as it doesn't exceed its budget either. */
+		if (!l_Finished && state.MaxConcurrent > 0 && state.Running >= static_cast<size_t>(state.MaxConcurrent)) {
+			++it;
+			continue;
+		}
+
+		state.Waiting--;
+		state.Running++;
+		state.WaitTime += now - it->Since;
+		l_Running++;
+
+		it->Admit();
+		it = l_Waiters.erase(it);
+	}
+}
+
+void StartupScheduler::Enqueue(const StartupTask& task, std::function<void()> admit)
+{
+	StartupTask effective = ApplyOverrides(task);
+
+	std::unique_lock<std::mutex> lock (l_Mutex);
+
+	auto& state (l_Tasks[effective.Name]);
+
+	state.Priority = effective.Priority;
+	state.MaxConcurrent = effective.MaxConcurrent;
+	state.Phase = effective.Phase;
+	state.Waiting++;
+
+	auto pos (l_Waiters.begin());
+
+	while (pos != l_Waiters.end() && pos->Priority >= effective.Priority)
+		++pos;
+
+	l_Waiters.insert(pos, StartupTaskWaiter{effective.Name, effective.Priority, Utility::GetTime(), std::move(admit)});
+
+	AdmitWaiting();
+}
+
+void StartupScheduler::Release(const String& name, double runTime)
+{
+	std::unique_lock<std::mutex> lock (l_Mutex);
+
+	auto& state (l_Tasks[name]);
+
+	state.Running--;
+	state.Completed++;
+	state.RunTime += runTime;
+	l_Running--;
+
+	if (!state.Running && !state.Waiting && !state.Phase.IsEmpty())
+		MarkPhaseLocked(state.Phase);
+
+	AdmitWaiting();
+}
+
+StartupScheduler::Slot::Slot(const StartupTask& task)
+	: m_Name(task.Name)
+{
+	Enqueue(task, [this]() {
+		m_Admitted = true;
+		m_CV.notify_all();
+	});
+
+	{
+		std::unique_lock<std::mutex> lock (l_Mutex);
+		m_CV.wait(lock, [this]() { return m_Admitted; });
+	}
+
+	m_Start = Utility::GetTime();
+}
+
+StartupScheduler::Slot::~Slot()
+{
+	Release(m_Name, Utility::GetTime() - m_Start);
+}
+
+/**
+ * Runs the callback on the thread pool once the task may run, without blocking the caller.
+ */
+void StartupScheduler::Run(const StartupTask& task, std::function<void()> callback)
+{
+	String name = task.Name;
+
+	Enqueue(task, [name, callback]() {
+		Utility::QueueAsyncCallback([name, callback]() {
+			double start = Utility::GetTime();
+			Defer release ([&name, start]() { Release(name, Utility::GetTime() - start); });
+
+			callback();
+		});
+	});
+}
+
+/**
+ * Logs the time since the start of the application the first time the given phase is reached.
+ */
+void StartupScheduler::MarkPhase(const String& phase)
+{
+	std::unique_lock<std::mutex> lock (l_Mutex);
+
+	MarkPhaseLocked(phase);
+}
+
+/**
+ * Marks the "startup finished" phase, from then on all tasks run right away.
+ */
+void StartupScheduler::Finish()
+{
+	std::unique_lock<std::mutex> lock (l_Mutex);
+
+	MarkPhaseLocked("startup finished");
+
+	l_Finished = true;
+
+	AdmitWaiting();
+}
+
+Dictionary::Ptr StartupScheduler::GetStats()
+{
+	Dictionary::Ptr phases = new Dictionary();
+	Dictionary::Ptr tasks = new Dictionary();
+
+	std::unique_lock<std::mutex> lock (l_Mutex);
+
+	for (auto& phase : l_Phases)
+		phases->Set(phase.first, phase.second);
+
+	for (auto& task : l_Tasks) {
+		auto& state (task.second);
+
+		tasks->Set(task.first, new Dictionary({
+			{ "priority", state.Priority },
+			{ "max_concurrent", state.MaxConcurrent },
+			{ "running", state.Running },
+			{ "waiting", state.Waiting },
+			{ "completed", state.Completed },
+			{ "wait_time", state.WaitTime },
+			{ "run_time", state.RunTime }
+		}));
+	}
+
+	return new Dictionary({
+		{ "finished", l_Finished },
+		{ "concurrency", GetConcurrency() },
+		{ "running", l_Running },
+		{ "waiting", l_Waiters.size() },
+		{ "phases", phases },
+		{ "tasks", tasks }
+	});
+}
+
+void StartupScheduler::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
+{
+	Dictionary::Ptr stats = GetStats();
+
+	status->Set("startup", stats);
+
+	perfdata->Add(new PerfdataValue("startup_tasks_running", stats->Get("running")));
+	perfdata->Add(new PerfdataValue("startup_tasks_waiting", stats->Get("waiting")));
+}
@@ -0,0 +1,77 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef STARTUPSCHEDULER_H
+#define STARTUPSCHEDULER_H
+
+#include "base/i2-base.hpp"
+#include "base/array.hpp"
+#include "base/dictionary.hpp"
+#include "base/string.hpp"
+#include <condition_variable>
+#include <functional>
+
+namespace icinga
+{
+
+/**
+ * A kind of heavy work done after (re)connecting, e.g. the initial config dump of a feature.
+ *
+ * The defaults may be overridden per name via the StartupTasks constant,
+ * e.g. `const StartupTasks = { icingadb = { priority = 50, max_concurrent = 1 } }`.
+ *
+ * @ingroup base
+ */
+struct StartupTask
+{
+	String Name;
+	int Priority; /**< Waiting tasks with a higher one run first */
+	int MaxConcurrent; /**< How many tasks of this name may run at once, 0 means unlimited */
+	String Phase; /**< Reached once no task of this name is running or waiting anymore for the first time */
+};
+
+/**
+ * Admits the startup tasks of all features in the order of their priorities, so that at most
+ * StartupConcurrency of them compete for the CPU and the locks at once, and records the startup phases.
+ * After Finish() the tasks, e.g. of reconnects, run right away.
+ *
+ * @ingroup base
+ */
+class StartupScheduler
+{
+public:
+	/**
+	 * Blocks until the task may run and lets the next one run once destroyed.
+	 */
+	class Slot
+	{
+	public:
+		Slot(const StartupTask& task);
+		~Slot();
+
+		Slot(const Slot&) = delete;
+		Slot& operator=(const Slot&) = delete;
+
+	private:
+		String m_Name;
+		double m_Start;
+		bool m_Admitted{false};
+		std::condition_variable m_CV;
+	};
+
+	static void Run(const StartupTask& task, std::function<void()> callback);
+	static void MarkPhase(const String& phase);
+	static void Finish();
+
+	static Dictionary::Ptr GetStats();
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+
+private:
+	StartupScheduler();
+
+	static void Enqueue(const StartupTask& task, std::function<void()> admit);
+	static void Release(const String& name, double runTime);
+};
+
+}
+
+#endif /* STARTUPSCHEDULER_H */
@@ -0,0 +1,162 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/statssegment.hpp"
+#include "base/exception.hpp"
+#include "base/logger.hpp"
+#include "base/metrics.hpp"
+#include "base/utility.hpp"
+#include <boost/interprocess/file_mapping.hpp>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace icinga;
+
+static_assert(sizeof(StatsSegmentRecord) == 128, "The records' layout is part of the stats segment's format.");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Readers in other processes must be able to read the sequence.");
+
+std::unique_ptr<StatsSegment> StatsSegment::m_Instance;
+Timer::Ptr StatsSegment::m_Timer;
+
+/**
+ * Creates the file (replacing an existing one atomically, so that readers which still have the latter
+ * mapped notice that it isn't updated anymore) and maps it.
+ */
+StatsSegment::StatsSegment(const String& path)
+	: m_Path(path)
+{
+#ifndef _WIN32
+	String tempPath = path + ".tmp";
+#else /* _WIN32 */
+	/* A mapped file can't be renamed on Windows. */
+	String tempPath = path;
+#endif /* _WIN32 */
+	size_t size = sizeof(StatsSegmentHeader) + Capacity * sizeof(StatsSegmentRecord);
+
+	{
+		std::ofstream fp (tempPath.CStr(), std::ofstream::binary | std::ofstream::trunc);
+		std::vector<char> zeros (size);
+
+		fp.write(zeros.data(), zeros.size());
+		fp.close();
+
+		if (fp.fail()) {
+			BOOST_THROW_EXCEPTION(std::runtime_error("Can't create stats segment file '" + tempPath + "'."));
+		}
+	}
+
+	boost::interprocess::file_mapping mapping (tempPath.CStr(), boost::interprocess::read_write);
+	m_Region = boost::interprocess::mapped_region(mapping, boost::interprocess::read_write, 0, size);
+
+	auto header (new(m_Region.get_address()) StatsSegmentHeader());
+
+	memcpy(header->Magic, "I2STATS", sizeof(header->Magic));
+	header->Version = Version;
+	header->HeaderSize = sizeof(StatsSegmentHeader);
+	header->RecordSize = sizeof(StatsSegmentRecord);
+	header->Capacity = Capacity;
+	header->Sequence.store(0);
+	header->Count = 0;
+	header->Dropped = 0;
+	header->Pid = Utility::GetPid();
+	header->Timestamp = Utility::GetTime();
+
+#ifndef _WIN32
+	Utility::RenameFile(tempPath, path);
+#endif /* _WIN32 */
+}
+
+StatsSegment::~StatsSegment()
+{
+	m_Region = boost::interprocess::mapped_region();
+
+	try {
+		Utility::Remove(m_Path);
+	} catch (const std::exception& ex) {
+		Log(LogWarning, "StatsSegment")
+			<< "Can't remove stats segment file '" << m_Path << "': " << DiagnosticInformation(ex, false);
+	}
+}
+
+/**
+ * Replaces the published samples with the given ones. Samples whose key doesn't fit into a record
+ * and the ones beyond the capacity are counted as dropped.
+ */
+void StatsSegment::Update(const MetricsWriter& writer)
+{
+	auto header (GetHeader());
+	auto records (GetRecords());
+	uint64_t sequence = header->Sequence.load(std::memory_order_relaxed);
+	uint32_t count = 0;
+	uint32_t dropped = 0;
+
+	header->Sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	writer.VisitSamples([records, &count, &dropped](const char *key, size_t length, double value) {
+		if (count >= Capacity || length >= sizeof(StatsSegmentRecord::Key)) {
+			dropped++;
+			return;
+		}
+
+		auto& record (records[count++]);
+
+		memcpy(record.Key, key, length);
+		memset(record.Key + length, 0, sizeof(record.Key) - length);
+		record.Value = value;
+	});
+
+	header->Count = count;
+	header->Dropped = dropped;
+	header->Timestamp = Utility::GetTime();
+
+	header->Sequence.store(sequence + 2, std::memory_order_release);
+}
+
+/**
+ * Creates the stats segment and updates it periodically until Stop() is called.
+ */
+void StatsSegment::Start(const String& path, double interval)
+{
+	m_Instance.reset(new StatsSegment(path));
+
+	auto update ([]() {
+		MetricsWriter writer;
+
+		MetricsRegistry::Collect(writer);
+		m_Instance->Update(writer);
+	});
+
+	update();
+
+	m_Timer = Timer::Create();
+	m_Timer->SetInterval(interval);
+	m_Timer->OnTimerExpired.connect([update](const Timer * const&) { update(); });
+	m_Timer->Start();
+
+	Log(LogInformation, "StatsSegment")
+		<< "Publishing metrics in '" << path << "'.";
+}
+
+/**
+ * Stops updating the stats segment and removes its file.
+ */
+void StatsSegment::Stop()
+{
+	if (m_Timer) {
+		m_Timer->Stop(true);
+		m_Timer.reset();
+	}
+
+	m_Instance.reset();
+}
+
+StatsSegmentHeader *StatsSegment::GetHeader() const
+{
+	return static_cast<StatsSegmentHeader *>(m_Region.get_address());
+}
+
+StatsSegmentRecord *StatsSegment::GetRecords() const
+{
+	return reinterpret_cast<StatsSegmentRecord *>(static_cast<char *>(m_Region.get_address()) + sizeof(StatsSegmentHeader));
+}
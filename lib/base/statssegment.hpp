@@ -0,0 +1,89 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef STATSSEGMENT_H
+#define STATSSEGMENT_H
+
+#include "base/i2-base.hpp"
+#include "base/string.hpp"
+#include "base/timer.hpp"
+#include <boost/interprocess/mapped_region.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace icinga
+{
+
+class MetricsWriter;
+
+/**
+ * The beginning of a stats segment file, see StatsSegment.
+ *
+ * @ingroup base
+ */
+struct StatsSegmentHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	uint32_t HeaderSize;
+	uint32_t RecordSize;
+	uint32_t Capacity;
+	/* Odd while the records are being updated. */
+	std::atomic<uint64_t> Sequence;
+	uint32_t Count;
+	uint32_t Dropped;
+	uint64_t Pid;
+	double Timestamp;
+};
+
+/**
+ * A metric sample, e.g. "icinga_checks_1min{type="service"}" and its value.
+ *
+ * @ingroup base
+ */
+struct StatsSegmentRecord
+{
+	char Key[120];
+	double Value;
+};
+
+/**
+ * Publishes the samples of all registered metrics (see MetricsRegistry) in a memory-mapped file,
+ * so that local agents can read them without an API request or any lock (see the StatsSegmentPath constant).
+ *
+ * The file consists of a StatsSegmentHeader and Capacity StatsSegmentRecords of which the first Count are valid.
+ * Readers copy the records and retry if the Sequence was odd or changed in between.
+ *
+ * @ingroup base
+ */
+class StatsSegment
+{
+public:
+	static constexpr uint32_t Version = 1;
+	static constexpr uint32_t Capacity = 4096;
+
+	StatsSegment(const String& path);
+	~StatsSegment();
+
+	StatsSegment(const StatsSegment&) = delete;
+	StatsSegment& operator=(const StatsSegment&) = delete;
+
+	void Update(const MetricsWriter& writer);
+
+	static void Start(const String& path, double interval = 1);
+	static void Stop();
+
+private:
+	String m_Path;
+	boost::interprocess::mapped_region m_Region;
+
+	StatsSegmentHeader *GetHeader() const;
+	StatsSegmentRecord *GetRecords() const;
+
+	static std::unique_ptr<StatsSegment> m_Instance;
+	static Timer::Ptr m_Timer;
+};
+
+}
+
+#endif /* STATSSEGMENT_H */
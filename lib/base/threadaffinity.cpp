@@ -0,0 +1,243 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/threadaffinity.hpp"
+#include "base/array.hpp"
+#include "base/configuration.hpp"
+#include "base/convert.hpp"
+#include "base/exception.hpp"
+#include "base/logger.hpp"
+#include "base/utility.hpp"
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef __linux__
+#	include <sched.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif /* __linux__ */
+
+using namespace icinga;
+
+static const char * const l_ThreadRoleNames[] = {
+	"io", "tasks", "processes", "work_queues"
+};
+
+static std::mutex l_ThreadsMutex;
+/* The registered threads by their TID. */
+static std::map<long, ThreadRole> l_Threads;
+/* Set once the configuration is complete and mustn't change anymore. */
+static std::atomic<bool> l_Applied (false);
+
+#ifdef __linux__
+/**
+ * Removes the thread from l_Threads once it exits, so that its TID isn't pinned if it's reused.
+ */
+struct ThreadAffinityRegistration
+{
+	long Tid = 0;
+
+	~ThreadAffinityRegistration()
+	{
+		if (Tid) {
+			std::unique_lock<std::mutex> lock (l_ThreadsMutex);
+			l_Threads.erase(Tid);
+		}
+	}
+};
+
+static thread_local ThreadAffinityRegistration l_Registration;
+
+/**
+ * @returns The CPUs of the given NUMA node, e.g. "0-7,16-23".
+ */
+static String GetNumaNodeCpus(const String& node)
+{
+	std::ifstream fp ("/sys/devices/system/node/" + node + "/cpulist");
+	std::string cpus;
+
+	if (!std::getline(fp, cpus))
+		BOOST_THROW_EXCEPTION(std::invalid_argument("NUMA node '" + node + "' doesn't exist."));
+
+	return String(std::move(cpus)).Trim();
+}
+
+/**
+ * @returns The CPUs set for the role in the CpuAffinity constant, empty for any.
+ */
+static std::vector<int> GetRoleCpus(ThreadRole role)
+{
+	Dictionary::Ptr affinity = Configuration::CpuAffinity;
+
+	if (!affinity)
+		return {};
+
+	String cpus = affinity->Get(l_ThreadRoleNames[role]);
+
+	if (cpus.IsEmpty())
+		return {};
+
+	/* E.g. "node1" for all CPUs of the second NUMA node. */
+	if (cpus.SubStr(0, 4) == "node")
+		cpus = GetNumaNodeCpus(cpus);
+
+	return ThreadAffinity::ParseCpuList(cpus);
+}
+
+static void PinThread(long tid, ThreadRole role)
+{
+	std::vector<int> cpus;
+
+	try {
+		cpus = GetRoleCpus(role);
+	} catch (const std::exception& ex) {
+		Log(LogWarning, "ThreadAffinity")
+			<< "Invalid CPUs for '" << l_ThreadRoleNames[role] << "' threads: " << DiagnosticInformation(ex, false);
+		return;
+	}
+
+	if (cpus.empty())
+		return;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	for (int cpu : cpus) {
+		if (cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+	}
+
+	if (sched_setaffinity(tid, sizeof(set), &set) < 0) {
+		Log(LogWarning, "ThreadAffinity")
+			<< "Can't pin thread " << tid << " to the CPUs for '" << l_ThreadRoleNames[role]
+			<< "' threads: " << Utility::FormatErrorNumber(errno);
+	}
+}
+#endif /* __linux__ */
+
+/**
+ * Registers the calling thread in the given role. Call this once it has started.
+ */
+void ThreadAffinity::Register(ThreadRole role)
+{
+#ifdef __linux__
+	if (l_Registration.Tid)
+		return;
+
+	l_Registration.Tid = syscall(SYS_gettid);
+
+	{
+		std::unique_lock<std::mutex> lock (l_ThreadsMutex);
+		l_Threads[l_Registration.Tid] = role;
+	}
+
+	if (l_Applied.load())
+		PinThread(l_Registration.Tid, role);
+#endif /* __linux__ */
+}
+
+/**
+ * Pins all registered threads and the ones registering from now on.
+ * Call this once the configuration has been loaded.
+ */
+void ThreadAffinity::ApplyAll()
+{
+#ifdef __linux__
+	std::unique_lock<std::mutex> lock (l_ThreadsMutex);
+
+	l_Applied.store(true);
+
+	for (auto& thread : l_Threads)
+		PinThread(thread.first, thread.second);
+#endif /* __linux__ */
+}
+
+/**
+ * Parses a list of CPUs like "0-3,8,10-11" (the format of Linux' cpulist files).
+ */
+std::vector<int> ThreadAffinity::ParseCpuList(const String& cpus)
+{
+	std::vector<int> result;
+
+	for (const String& range : cpus.Split(",")) {
+		String first, last;
+		size_t dash = range.Find("-");
+
+		if (dash == String::NPos) {
+			first = range.Trim();
+			last = first;
+		} else {
+			first = range.SubStr(0, dash).Trim();
+			last = range.SubStr(dash + 1).Trim();
+		}
+
+		if (first.IsEmpty() || last.IsEmpty() || first.FindFirstNotOf("0123456789") != String::NPos
+			|| last.FindFirstNotOf("0123456789") != String::NPos || first.GetLength() > 4 || last.GetLength() > 4) {
+			BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid CPU list '" + cpus + "'."));
+		}
+
+		int from = Convert::ToLong(first);
+		int to = Convert::ToLong(last);
+
+		if (from > to)
+			BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid CPU list '" + cpus + "'."));
+
+		for (int cpu = from; cpu <= to; cpu++)
+			result.push_back(cpu);
+	}
+
+	return result;
+}
+
+/**
+ * @returns The NUMA nodes with their CPUs and the number of threads and configured CPUs per role.
+ */
+Dictionary::Ptr ThreadAffinity::GetReport()
+{
+	ArrayData nodes;
+
+#ifdef __linux__
+	Utility::Glob("/sys/devices/system/node/node*", [&nodes](const String& path) {
+		String node = Utility::BaseName(path);
+
+		if (node.GetLength() <= 4 || node.SubStr(4).FindFirstNotOf("0123456789") != String::NPos)
+			return;
+
+		try {
+			nodes.emplace_back(new Dictionary({
+				{ "node", Convert::ToLong(node.SubStr(4)) },
+				{ "cpus", GetNumaNodeCpus(node) }
+			}));
+		} catch (const std::exception&) {
+		}
+	}, GlobDirectory);
+#endif /* __linux__ */
+
+	size_t counts[ThreadRoleWorkQueues + 1] = {};
+
+	{
+		std::unique_lock<std::mutex> lock (l_ThreadsMutex);
+
+		for (auto& thread : l_Threads)
+			counts[thread.second]++;
+	}
+
+	Dictionary::Ptr affinity = l_Applied.load() ? Configuration::CpuAffinity : nullptr;
+	DictionaryData roles;
+
+	for (int role = 0; role <= ThreadRoleWorkQueues; role++) {
+		String cpus = affinity ? affinity->Get(l_ThreadRoleNames[role]) : Empty;
+
+		roles.emplace_back(l_ThreadRoleNames[role], new Dictionary({
+			{ "threads", counts[role] },
+			{ "cpus", cpus }
+		}));
+	}
+
+	return new Dictionary({
+		{ "numa_nodes", new Array(std::move(nodes)) },
+		{ "threads", new Dictionary(std::move(roles)) }
+	});
+}
@@ -0,0 +1,51 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef THREADAFFINITY_H
+#define THREADAFFINITY_H
+
+#include "base/i2-base.hpp"
+#include "base/dictionary.hpp"
+#include "base/string.hpp"
+#include <vector>
+
+namespace icinga
+{
+
+/**
+ * The kinds of threads which can be pinned to CPUs, see the CpuAffinity constant.
+ *
+ * @ingroup base
+ */
+enum ThreadRole
+{
+	ThreadRoleIo, /**< The IoEngine's threads */
+	ThreadRoleTasks, /**< The global ThreadPool's threads */
+	ThreadRoleProcesses, /**< The threads reading the output of processes */
+	ThreadRoleWorkQueues /**< The WorkQueues' threads, e.g. of features */
+};
+
+/**
+ * Pins threads to the CPUs configured for their role (Linux only).
+ *
+ * Threads register themselves once they've started. The configuration applies to them
+ * as soon as it's complete, see ApplyAll(). As Linux allocates memory on the NUMA node of the CPU
+ * which touches it first, buffers the pinned threads allocate are local to their node, too.
+ *
+ * @ingroup base
+ */
+class ThreadAffinity
+{
+public:
+	static void Register(ThreadRole role);
+	static void ApplyAll();
+
+	static std::vector<int> ParseCpuList(const String& cpus);
+	static Dictionary::Ptr GetReport();
+
+private:
+	ThreadAffinity();
+};
+
+}
+
+#endif /* THREADAFFINITY_H */
@@ -7,6 +7,7 @@
 #include "base/configuration.hpp"
 #include "base/exception.hpp"
 #include "base/logger.hpp"
+#include "base/threadaffinity.hpp"
 #include <cstddef>
 #include <exception>
 #include <functional>
@@ -60,6 +61,8 @@ public:
 
 			boost::asio::post(*m_Pool, [this, callback]() {
 				m_Pending.fetch_sub(1);
+				/* The pool starts its threads itself, they register with their first task. */
+				ThreadAffinity::Register(ThreadRoleTasks);
 
 				try {
 					callback();
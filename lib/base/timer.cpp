@@ -9,10 +9,15 @@
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/key_extractors.hpp>
 #include <chrono>
+#include <cmath>
 #include <condition_variable>
+#include <cstdint>
+#include <list>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 using namespace icinga;
 
@@ -43,6 +48,179 @@ private:
 	Timer *m_Timer;
 };
 
+/**
+ * A hierarchical timing wheel (see Varghese and Lauck) as an alternative to the
+ * ordered TimerSet.
+ *
+ * Time is divided into ticks of 10ms. Timers due within the next 256 ticks are kept
+ * in the slot of their tick in the first level, later ones in one of the coarser levels
+ * from where they're moved down level by level as their time approaches. Inserting and
+ * removing a timer is O(1) and all timers due in the same tick are expired in one batch.
+ *
+ * All methods must be called with l_TimerMutex held.
+ */
+class TimingWheel
+{
+public:
+	/* Same as the tolerance the ordered TimerSet uses to decide whether a timer is due. */
+	static constexpr double TickLength = 0.01;
+
+	void Insert(Timer *timer)
+	{
+		Erase(timer);
+
+		uint_fast64_t tick = GetTick(timer->m_Next);
+
+		if (tick <= m_CurrentTick)
+			tick = m_CurrentTick + 1u;
+
+		uint_fast64_t delta = tick - m_CurrentTick;
+		size_t level = 0;
+
+		while (level < Levels - 1u && delta >= (uint_fast64_t(1) << (SlotBits * (level + 1u))))
+			level++;
+
+		/* Anything beyond the range of the last level is parked in its furthest slot and re-sorted when that slot is cascaded. */
+		if (level == Levels - 1u && delta >= (uint_fast64_t(1) << (SlotBits * Levels)))
+			tick = m_CurrentTick + (uint_fast64_t(1) << (SlotBits * Levels)) - 1u;
+
+		auto slot ((tick >> (SlotBits * level)) & SlotMask);
+		auto& list (m_Slots[level][slot]);
+
+		m_Positions.emplace(timer, std::make_pair(&list, list.insert(list.end(), timer)));
+	}
+
+	void Erase(Timer *timer)
+	{
+		auto pos (m_Positions.find(timer));
+
+		if (pos == m_Positions.end())
+			return;
+
+		pos->second.first->erase(pos->second.second);
+		m_Positions.erase(pos);
+	}
+
+	bool Empty() const
+	{
+		return m_Positions.empty();
+	}
+
+	std::vector<Timer *> GetTimers() const
+	{
+		std::vector<Timer *> timers;
+		timers.reserve(m_Positions.size());
+
+		for (auto& kv : m_Positions) {
+			timers.push_back(kv.first);
+		}
+
+		return timers;
+	}
+
+	/**
+	 * Returns when the thread has to wake up next, i.e. the start of the next tick
+	 * which has timers or which has to cascade timers from a coarser level.
+	 */
+	double GetNextWakeup() const
+	{
+		for (uint_fast64_t tick = m_CurrentTick + 1u;; tick++) {
+			if ((tick & SlotMask) == 0u || !m_Slots[0][tick & SlotMask].empty())
+				return tick * TickLength;
+		}
+	}
+
+	/**
+	 * Advances the wheel up to the given time and removes all timers which are due.
+	 *
+	 * @param now The current time
+	 * @param expired Receives the due timers
+	 */
+	void Advance(double now, std::vector<Timer *>& expired)
+	{
+		uint_fast64_t nowTick = GetTick(now);
+
+		if (nowTick <= m_CurrentTick)
+			return;
+
+		/* After a long pause (e.g. suspend) re-sorting everything is cheaper than walking all ticks. */
+		if (nowTick - m_CurrentTick > (uint_fast64_t(1) << (SlotBits * 2u))) {
+			auto timers (GetTimers());
+
+			m_Positions.clear();
+
+			for (auto& level : m_Slots) {
+				for (auto& slot : level) {
+					slot.clear();
+				}
+			}
+
+			m_CurrentTick = nowTick;
+
+			for (Timer *timer : timers) {
+				if (GetTick(timer->m_Next) <= nowTick)
+					expired.push_back(timer);
+				else
+					Insert(timer);
+			}
+
+			return;
+		}
+
+		while (m_CurrentTick < nowTick) {
+			m_CurrentTick++;
+
+			for (size_t level = 1; level < Levels; level++) {
+				if ((m_CurrentTick & ((uint_fast64_t(1) << (SlotBits * level)) - 1u)) != 0u)
+					break;
+
+				Cascade(level, (m_CurrentTick >> (SlotBits * level)) & SlotMask);
+			}
+
+			auto& slot (m_Slots[0][m_CurrentTick & SlotMask]);
+
+			for (Timer *timer : slot) {
+				m_Positions.erase(timer);
+				expired.push_back(timer);
+			}
+
+			slot.clear();
+		}
+	}
+
+	void Reset(double now)
+	{
+		m_CurrentTick = GetTick(now);
+	}
+
+private:
+	static constexpr size_t Levels = 4;
+	static constexpr size_t SlotBits = 8;
+	static constexpr size_t SlotMask = (1u << SlotBits) - 1u;
+
+	typedef std::list<Timer *> Slot;
+
+	Slot m_Slots[Levels][SlotMask + 1u];
+	std::unordered_map<Timer *, std::pair<Slot *, Slot::iterator>> m_Positions;
+	uint_fast64_t m_CurrentTick{0};
+
+	static uint_fast64_t GetTick(double ts)
+	{
+		return ts > 0 ? uint_fast64_t(std::floor(ts / TickLength)) : 0u;
+	}
+
+	void Cascade(size_t level, size_t slot)
+	{
+		Slot timers;
+		timers.swap(m_Slots[level][slot]);
+
+		for (Timer *timer : timers) {
+			m_Positions.erase(timer);
+			Insert(timer);
+		}
+	}
+};
+
 }
 
 typedef boost::multi_index_container<
@@ -58,6 +236,8 @@ static std::condition_variable l_TimerCV;
 static std::thread l_TimerThread;
 static bool l_StopTimerThread;
 static TimerSet l_Timers;
+static TimingWheel l_TimerWheel;
+static bool l_UseTimingWheel = false;
 static int l_AliveTimers = 0;
 
 static Defer l_ShutdownTimersCleanlyOnExit (&Timer::Uninitialize);
@@ -68,6 +248,8 @@ Timer::Ptr Timer::Create()
 
 	t->m_Self = t;
 
+	t->m_CreationSite = Profiler::GetSite();
+
 	return t;
 }
 
@@ -123,6 +305,12 @@ void Timer::UninitializeThread()
  */
 void Timer::Call()
 {
+	/* Only Call() itself touches the name and it never runs concurrently for the same timer. */
+	if (Profiler::IsActive() && m_ProfilerName.IsEmpty())
+		m_ProfilerName = Profiler::GetSiteName(m_CreationSite, "Timer::Create");
+
+	ProfilerScope span ("timer", m_ProfilerName);
+
 	try {
 		OnTimerExpired(this);
 	} catch (...) {
@@ -187,7 +375,11 @@ void Timer::Stop(bool wait)
 	}
 
 	m_Started = false;
-	l_Timers.erase(this);
+
+	if (l_UseTimingWheel)
+		l_TimerWheel.Erase(this);
+	else
+		l_Timers.erase(this);
 
 	/* Notify the worker thread that we've disabled a timer. */
 	l_TimerCV.notify_all();
@@ -232,8 +424,12 @@ void Timer::InternalRescheduleUnlocked(bool completed, double next)
 
 	if (m_Started && !m_Running) {
 		/* Remove and re-add the timer to update the index. */
-		l_Timers.erase(this);
-		l_Timers.insert(this);
+		if (l_UseTimingWheel) {
+			l_TimerWheel.Insert(this);
+		} else {
+			l_Timers.erase(this);
+			l_Timers.insert(this);
+		}
 
 		/* Notify the worker that we've rescheduled a timer. */
 		l_TimerCV.notify_all();
@@ -268,7 +464,7 @@ void Timer::AdjustTimers(double adjustment)
 
 	std::vector<Timer *> timers;
 
-	for (Timer *timer : idx) {
+	for (Timer *timer : l_UseTimingWheel ? l_TimerWheel.GetTimers() : std::vector<Timer *>(idx.begin(), idx.end())) {
 		/* Don't schedule the next call if this is not a periodic timer. */
 		if (timer->m_Interval <= 0) {
 			continue;
@@ -282,14 +478,52 @@ void Timer::AdjustTimers(double adjustment)
 	}
 
 	for (Timer *timer : timers) {
-		l_Timers.erase(timer);
-		l_Timers.insert(timer);
+		if (l_UseTimingWheel) {
+			l_TimerWheel.Insert(timer);
+		} else {
+			l_Timers.erase(timer);
+			l_Timers.insert(timer);
+		}
 	}
 
 	/* Notify the worker that we've rescheduled some timers. */
 	l_TimerCV.notify_all();
 }
 
+/**
+ * Switches between the ordered timer set (default) and the hierarchical timing wheel.
+ * Already scheduled timers are moved over.
+ *
+ * @param enabled Whether to use the timing wheel
+ */
+void Timer::SetTimingWheel(bool enabled)
+{
+	std::unique_lock<std::mutex> lock(l_TimerMutex);
+
+	if (enabled == l_UseTimingWheel)
+		return;
+
+	if (enabled) {
+		l_TimerWheel.Reset(Utility::GetTime());
+
+		for (auto& holder : l_Timers) {
+			l_TimerWheel.Insert(holder.GetObject());
+		}
+
+		l_Timers.clear();
+	} else {
+		for (Timer *timer : l_TimerWheel.GetTimers()) {
+			l_TimerWheel.Erase(timer);
+			l_Timers.insert(timer);
+		}
+	}
+
+	l_UseTimingWheel = enabled;
+
+	/* Notify the worker that the timers have moved. */
+	l_TimerCV.notify_all();
+}
+
 /**
  * Worker thread proc for Timer objects.
  */
@@ -302,18 +536,61 @@ void Timer::TimerThreadProc()
 	Utility::SetThreadName("Timer Thread");
 
 	std::unique_lock<std::mutex> lock (l_TimerMutex);
+	std::vector<Timer *> expired;
+	std::vector<Timer::Ptr> due;
 
 	for (;;) {
 		typedef boost::multi_index::nth_index<TimerSet, 1>::type NextTimerView;
 		NextTimerView& idx = boost::get<1>(l_Timers);
 
 		/* Wait until there is at least one timer. */
-		while (idx.empty() && !l_StopTimerThread)
+		while ((l_UseTimingWheel ? l_TimerWheel.Empty() : idx.empty()) && !l_StopTimerThread)
 			l_TimerCV.wait(lock);
 
 		if (l_StopTimerThread)
 			break;
 
+		if (l_UseTimingWheel) {
+			ch::time_point<ch::system_clock, ch::duration<double>> next (ch::duration<double>(l_TimerWheel.GetNextWakeup()));
+
+			if (next > ch::system_clock::now()) {
+				/* Wait for the next tick with timers in it. */
+				l_TimerCV.wait_until(lock, next);
+
+				continue;
+			}
+
+			l_TimerWheel.Advance(Utility::GetTime(), expired);
+
+			for (Timer *timer : expired) {
+				/* See below, the same caveats apply. */
+				auto keepAlive (timer->m_Self.lock());
+
+				if (keepAlive) {
+					timer->m_Running = true;
+					due.emplace_back(std::move(keepAlive));
+				}
+			}
+
+			expired.clear();
+
+			if (due.empty())
+				continue;
+
+			lock.unlock();
+
+			/* Asynchronously call all timers of the batch. */
+			for (auto& timer : due) {
+				Utility::QueueAsyncCallback([timer=std::move(timer)]() { timer->Call(); });
+			}
+
+			due.clear();
+
+			lock.lock();
+
+			continue;
+		}
+
 		auto it = idx.begin();
 
 		// timer->~Timer() may be called at any moment (if the last
@@ -4,12 +4,15 @@
 #define TIMER_H
 
 #include "base/i2-base.hpp"
+#include "base/profiler.hpp"
+#include "base/string.hpp"
 #include <boost/signals2.hpp>
 #include <memory>
 
 namespace icinga {
 
 class TimerHolder;
+class TimingWheel;
 
 /**
  * A timer that periodically triggers an event.
@@ -34,6 +37,7 @@ public:
 	double GetInterval() const;
 
 	static void AdjustTimers(double adjustment);
+	static void SetTimingWheel(bool enabled);
 
 	void Start();
 	void Stop(bool wait = false);
@@ -49,6 +53,8 @@ private:
 	bool m_Started{false}; /**< Whether the timer is enabled. */
 	bool m_Running{false}; /**< Whether the timer proc is currently running. */
 	std::weak_ptr<Timer> m_Self;
+	ProfilerSite m_CreationSite {}; /**< Where the timer was created, to tell its owner. */
+	String m_ProfilerName;
 
 	Timer() = default;
 	void Call();
@@ -58,6 +64,7 @@ private:
 	static void TimerThreadProc();
 
 	friend class TimerHolder;
+	friend class TimingWheel;
 };
 
 }
@@ -7,6 +7,7 @@
 #include "base/logger.hpp"
 #include "base/configuration.hpp"
 #include "base/convert.hpp"
+#include "base/tlsutility.hpp"
 #include <boost/asio/ssl/context.hpp>
 #include <boost/asio/ssl/verify_context.hpp>
 #include <boost/asio/ssl/verify_mode.hpp>
@@ -20,11 +21,31 @@ using namespace icinga;
 
 bool UnbufferedAsioTlsStream::IsVerifyOK() const
 {
+	auto ssl (const_cast<UnbufferedAsioTlsStream*>(this)->native_handle());
+
+	/* The verify callback isn't called for resumed sessions, use the result stored in the session. */
+	if (SSL_session_reused(ssl) && SSL_get_verify_result(ssl) != X509_V_OK) {
+		return false;
+	}
+
 	return m_VerifyOK;
 }
 
 String UnbufferedAsioTlsStream::GetVerifyError() const
 {
+	auto ssl (const_cast<UnbufferedAsioTlsStream*>(this)->native_handle());
+
+	if (SSL_session_reused(ssl)) {
+		long err = SSL_get_verify_result(ssl);
+
+		if (err != X509_V_OK) {
+			std::ostringstream msgbuf;
+
+			msgbuf << "code " << err << ": " << X509_verify_cert_error_string(err);
+			return msgbuf.str();
+		}
+	}
+
 	return m_VerifyError;
 }
 
@@ -66,6 +87,7 @@ void UnbufferedAsioTlsStream::BeforeHandshake(handshake_type type)
 			serverName += ":" + environmentName;
 
 		SSL_set_tlsext_host_name(native_handle(), serverName.CStr());
+		ResumeSslClientSession(native_handle(), serverName);
 	}
 #endif /* SSL_CTRL_SET_TLSEXT_HOSTNAME */
 }
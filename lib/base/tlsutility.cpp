@@ -1,6 +1,7 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "base/tlsutility.hpp"
+#include "base/atomic-file.hpp"
 #include "base/convert.hpp"
 #include "base/logger.hpp"
 #include "base/context.hpp"
@@ -14,6 +15,8 @@
 #include <openssl/ssl.h>
 #include <openssl/ssl3.h>
 #include <fstream>
+#include <map>
+#include <mutex>
 
 namespace icinga
 {
@@ -349,6 +352,146 @@ void SetTlsProtocolminToSSLContext(const Shared<boost::asio::ssl::context>::Ptr&
 #endif /* OPENSSL_VERSION_NUMBER >= 0x10100000L */
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+/* Key name, HMAC secret and AES key */
+static const size_t l_TicketKeyLength = 80;
+#else /* OPENSSL_VERSION_NUMBER >= 0x10100000L */
+static const size_t l_TicketKeyLength = 48;
+#endif /* OPENSSL_VERSION_NUMBER >= 0x10100000L */
+
+static const size_t l_MaxSslClientSessions = 4096;
+
+static std::mutex l_SslClientSessionsMutex;
+static std::map<String, std::shared_ptr<SSL_SESSION>> l_SslClientSessions;
+
+/**
+ * Remembers sessions for outgoing connections (per SNI name) to resume them on reconnect.
+ *
+ * This is also called for TLS 1.3 tickets which arrive after the handshake.
+ */
+static int OnNewSslSession(SSL* ssl, SSL_SESSION* session)
+{
+	if (SSL_is_server(ssl) || SSL_get_verify_result(ssl) != X509_V_OK) {
+		return 0;
+	}
+
+	const char *serverName = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+
+	if (!serverName) {
+		return 0;
+	}
+
+	std::unique_lock<std::mutex> lock (l_SslClientSessionsMutex);
+
+	if (l_SslClientSessions.size() >= l_MaxSslClientSessions && l_SslClientSessions.find(serverName) == l_SslClientSessions.end()) {
+		return 0;
+	}
+
+	l_SslClientSessions[serverName] = std::shared_ptr<SSL_SESSION>(session, SSL_SESSION_free);
+
+	return 1;
+}
+
+/**
+ * Enables TLS session resumption via session tickets and a server-side session cache.
+ *
+ * The ticket key is stored in the specified file, so tickets stay valid across restarts.
+ *
+ * @param context The ssl context.
+ * @param ticketKeyPath The file to load the ticket key from or to store it into.
+ * @param timeout The lifetime of sessions in seconds, 0 disables resumption.
+ * @param rotateTicketKey Whether to replace an existing ticket key and to forget all client sessions.
+ */
+void SetupSslSessionResumption(const Shared<boost::asio::ssl::context>::Ptr& context, const String& ticketKeyPath, double timeout, bool rotateTicketKey)
+{
+	SSL_CTX *sslContext = context->native_handle();
+
+	if (rotateTicketKey) {
+		ClearSslClientSessions();
+	}
+
+	if (timeout <= 0) {
+		SSL_CTX_set_session_cache_mode(sslContext, SSL_SESS_CACHE_OFF);
+		SSL_CTX_set_options(sslContext, SSL_OP_NO_TICKET);
+		return;
+	}
+
+	String ticketKey;
+
+	if (!rotateTicketKey) {
+		std::ifstream fp (ticketKeyPath.CStr(), std::ios::in | std::ios::binary);
+		char buf[l_TicketKeyLength];
+
+		if (fp.read(buf, sizeof(buf)) && fp.gcount() == (std::streamsize)sizeof(buf)) {
+			ticketKey = String(buf, buf + sizeof(buf));
+		}
+	}
+
+	if (ticketKey.IsEmpty()) {
+		unsigned char buf[l_TicketKeyLength];
+
+		if (!RAND_bytes(buf, sizeof(buf))) {
+			BOOST_THROW_EXCEPTION(openssl_error()
+				<< boost::errinfo_api_function("RAND_bytes")
+				<< errinfo_openssl_error(ERR_peek_error()));
+		}
+
+		ticketKey = String(buf, buf + sizeof(buf));
+
+		AtomicFile::Write(ticketKeyPath, 0600, ticketKey);
+	}
+
+	if (SSL_CTX_set_tlsext_ticket_keys(sslContext, const_cast<char*>(ticketKey.CStr()), ticketKey.GetLength()) != 1) {
+		BOOST_THROW_EXCEPTION(openssl_error()
+			<< boost::errinfo_api_function("SSL_CTX_set_tlsext_ticket_keys")
+			<< errinfo_openssl_error(ERR_peek_error()));
+	}
+
+	SSL_CTX_set_session_cache_mode(sslContext, SSL_SESS_CACHE_BOTH);
+	SSL_CTX_sess_set_cache_size(sslContext, 20 * 1024);
+	SSL_CTX_set_timeout(sslContext, (long)timeout);
+	SSL_CTX_sess_set_new_cb(sslContext, &OnNewSslSession);
+}
+
+/**
+ * Offers the last session with the specified server for resumption
+ * if the connection's SSL context has resumption enabled.
+ *
+ * @param ssl The connection.
+ * @param serverName The SNI name of the server.
+ */
+void ResumeSslClientSession(SSL* ssl, const String& serverName)
+{
+	if (!(SSL_CTX_get_session_cache_mode(SSL_get_SSL_CTX(ssl)) & SSL_SESS_CACHE_CLIENT)) {
+		return;
+	}
+
+	std::shared_ptr<SSL_SESSION> session;
+
+	{
+		std::unique_lock<std::mutex> lock (l_SslClientSessionsMutex);
+		auto pos (l_SslClientSessions.find(serverName));
+
+		if (pos == l_SslClientSessions.end()) {
+			return;
+		}
+
+		session = pos->second;
+	}
+
+	SSL_set_session(ssl, session.get());
+}
+
+/**
+ * Forgets all sessions of outgoing connections, e.g. after our own certificate changed.
+ */
+void ClearSslClientSessions()
+{
+	std::unique_lock<std::mutex> lock (l_SslClientSessionsMutex);
+
+	l_SslClientSessions.clear();
+}
+
 /**
  * Loads a CRL and appends its certificates to the specified Boost SSL context.
  *
@@ -973,7 +1116,7 @@ String BinaryToHex(const unsigned char* data, size_t length) {
 	static const char hexdigits[] = "0123456789abcdef";
 
 	String output(2*length, 0);
-	for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
+	for (size_t i = 0; i < length; i++) {
 		output[2 * i] = hexdigits[data[i] >> 4];
 		output[2 * i + 1] = hexdigits[data[i] & 0xf];
 	}
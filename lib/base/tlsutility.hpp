@@ -47,6 +47,9 @@ void AddCRLToSSLContext(const Shared<boost::asio::ssl::context>::Ptr& context, c
 void AddCRLToSSLContext(X509_STORE *x509_store, const String& crlPath);
 void SetCipherListToSSLContext(const Shared<boost::asio::ssl::context>::Ptr& context, const String& cipherList);
 void SetTlsProtocolminToSSLContext(const Shared<boost::asio::ssl::context>::Ptr& context, const String& tlsProtocolmin);
+void SetupSslSessionResumption(const Shared<boost::asio::ssl::context>::Ptr& context, const String& ticketKeyPath, double timeout, bool rotateTicketKey);
+void ResumeSslClientSession(SSL* ssl, const String& serverName);
+void ClearSslClientSessions();
 int ResolveTlsProtocolVersion(const std::string& version);
 
 Shared<boost::asio::ssl::context>::Ptr SetupSslContext(String certPath, String keyPath,
@@ -155,6 +155,15 @@ int Type::GetActivationPriority() const
 	return 0;
 }
 
+/**
+ * @returns The memory used by an instance of this type including its separately allocated fields
+ *          (see the "cold" field attribute), but not the values it refers to; 0 if unknown.
+ */
+size_t Type::GetInstanceSize() const
+{
+	return 0;
+}
+
 void Type::RegisterAttributeHandler(int fieldId, const AttributeHandler& callback)
 {
 	throw std::runtime_error("Invalid field ID.");
@@ -10,9 +10,10 @@
 #include "base/utility.hpp"
 #include "base/json.hpp"
 #include "base/objectlock.hpp"
+#include "base/wildcardpattern.hpp"
 #include <algorithm>
 #include <cstdint>
-#include <mmatch.h>
+#include <cstring>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/system/error_code.hpp>
@@ -29,9 +30,14 @@
 #include <stdlib.h>
 #include <future>
 #include <set>
+#include <unordered_map>
 #include <utf8.h>
 #include <vector>
 
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif /* __SSE2__ */
+
 #ifdef __FreeBSD__
 #	include <pthread_np.h>
 #endif /* __FreeBSD__ */
@@ -149,7 +155,19 @@ String Utility::GetSymbolName(const void *addr)
  */
 bool Utility::Match(const String& pattern, const String& text)
 {
-	return (match(pattern.CStr(), text.CStr()) == 0);
+	/* The same patterns are usually matched against many texts, e.g. by API filters and permissions. */
+	static thread_local std::unordered_map<String, WildcardPattern> patterns;
+
+	auto compiled (patterns.find(pattern));
+
+	if (compiled == patterns.end()) {
+		if (patterns.size() >= 256)
+			patterns.clear();
+
+		compiled = patterns.emplace(pattern, WildcardPattern(pattern)).first;
+	}
+
+	return compiled->second.Match(text);
 }
 
 static bool ParseIp(const String& ip, char addr[16], int *proto)
@@ -553,6 +571,7 @@ bool Utility::Glob(const String& pathSpec, const std::function<void (const Strin
 bool Utility::GlobRecursive(const String& path, const String& pattern, const std::function<void (const String&)>& callback, int type)
 {
 	std::vector<String> files, dirs, alldirs;
+	WildcardPattern compiledPattern (pattern);
 
 #ifdef _WIN32
 	HANDLE handle;
@@ -583,7 +602,7 @@ bool Utility::GlobRecursive(const String& path, const String& pattern, const std
 		if (wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
 			alldirs.push_back(cpath);
 
-		if (!Utility::Match(pattern, wfd.cFileName))
+		if (!compiledPattern.Match(wfd.cFileName, strlen(wfd.cFileName)))
 			continue;
 
 		if (!(wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && (type & GlobFile))
@@ -639,7 +658,7 @@ bool Utility::GlobRecursive(const String& path, const String& pattern, const std
 		if (S_ISDIR(statbuf.st_mode))
 			alldirs.push_back(cpath);
 
-		if (!Utility::Match(pattern, pent->d_name))
+		if (!compiledPattern.Match(pent->d_name, strlen(pent->d_name)))
 			continue;
 
 		if (S_ISDIR(statbuf.st_mode) && (type & GlobDirectory))
@@ -1769,8 +1788,72 @@ String Utility::GetPlatformArchitecture()
 
 const char l_Utf8Replacement[] = "\xEF\xBF\xBD";
 
+/**
+ * Skips ASCII characters, 16 (SSE2) or 8 at once.
+ *
+ * @returns The first non-ASCII character or end.
+ */
+static const char *SkipASCII(const char *begin, const char *end)
+{
+#ifdef __SSE2__
+	while (end - begin >= 16) {
+		int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(begin)));
+
+		if (mask) {
+			return begin + __builtin_ctz(mask);
+		}
+
+		begin += 16;
+	}
+#endif /* __SSE2__ */
+
+	while (end - begin >= 8) {
+		uint64_t word;
+		memcpy(&word, begin, 8);
+
+		if (word & 0x8080808080808080u) {
+			break;
+		}
+
+		begin += 8;
+	}
+
+	while (begin < end && !(static_cast<unsigned char>(*begin) & 0x80u)) {
+		++begin;
+	}
+
+	return begin;
+}
+
+bool Utility::IsValidUTF8(const String& input)
+{
+	return IsValidUTF8(input.CStr(), input.GetLength());
+}
+
+bool Utility::IsValidUTF8(const char *input, size_t length)
+{
+	const char *current = input;
+	const char *end = current + length;
+
+	for (;;) {
+		current = SkipASCII(current, end);
+
+		if (current == end) {
+			return true;
+		}
+
+		if (utf8::internal::validate_next(current, end) != utf8::internal::UTF8_OK) {
+			return false;
+		}
+	}
+}
+
 String Utility::ValidateUTF8(const String& input)
 {
+	if (IsValidUTF8(input)) {
+		return input;
+	}
+
 	std::string output;
 	output.reserve(input.GetLength());
 
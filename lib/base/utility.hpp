@@ -130,6 +130,8 @@ public:
 	static String GetPlatformVersion();
 	static String GetPlatformArchitecture();
 
+	static bool IsValidUTF8(const String& input);
+	static bool IsValidUTF8(const char *input, size_t length);
 	static String ValidateUTF8(const String& input);
 
 #ifdef _WIN32
@@ -13,26 +13,25 @@ using namespace icinga;
 
 Value::operator double() const
 {
-	const double *value = boost::get<double>(&m_Value);
+	if (IsNumber())
+		return Get<double>();
 
-	if (value)
-		return *value;
-
-	const bool *fvalue = boost::get<bool>(&m_Value);
-
-	if (fvalue)
-		return *fvalue;
+	if (IsBoolean())
+		return Get<bool>();
 
 	if (IsEmpty())
 		return 0;
 
 	try {
-		return boost::lexical_cast<double>(m_Value);
+		if (IsString())
+			return boost::lexical_cast<double>(Get<String>());
 	} catch (const std::exception&) {
-		std::ostringstream msgbuf;
-		msgbuf << "Can't convert '" << *this << "' to a floating point number.";
-		BOOST_THROW_EXCEPTION(std::invalid_argument(msgbuf.str()));
+		/* Handled below. */
 	}
+
+	std::ostringstream msgbuf;
+	msgbuf << "Can't convert '" << *this << "' to a floating point number.";
+	BOOST_THROW_EXCEPTION(std::invalid_argument(msgbuf.str()));
 }
 
 Value::operator String() const
@@ -43,16 +42,16 @@ Value::operator String() const
 		case ValueEmpty:
 			return String();
 		case ValueNumber:
-			return Convert::ToString(boost::get<double>(m_Value));
+			return Convert::ToString(Get<double>());
 		case ValueBoolean:
-			if (boost::get<bool>(m_Value))
+			if (Get<bool>())
 				return "true";
 			else
 				return "false";
 		case ValueString:
-			return boost::get<String>(m_Value);
+			return Get<String>();
 		case ValueObject:
-			object = boost::get<Object::Ptr>(m_Value).get();
+			object = Get<Object::Ptr>().get();
 			return object->ToString();
 		default:
 			BOOST_THROW_EXCEPTION(std::runtime_error("Unknown value type."));
@@ -207,6 +206,21 @@ Value icinga::operator+(const String& lhs, const Value& rhs)
 
 Value icinga::operator+(const Value& lhs, const Value& rhs)
 {
+	/* The most common cases first, without any conversions. */
+	if (lhs.IsNumber() && rhs.IsNumber())
+		return lhs.Get<double>() + rhs.Get<double>();
+
+	if (lhs.IsString() && rhs.IsString()) {
+		auto& l (lhs.Get<String>().GetData());
+		auto& r (rhs.Get<String>().GetData());
+		std::string result;
+
+		result.reserve(l.size() + r.size());
+		result.append(l).append(r);
+
+		return String(std::move(result));
+	}
+
 	if ((lhs.IsEmpty() || lhs.IsNumber()) && !lhs.IsString() && (rhs.IsEmpty() || rhs.IsNumber()) && !rhs.IsString() && !(lhs.IsEmpty() && rhs.IsEmpty()))
 		return static_cast<double>(lhs) + static_cast<double>(rhs);
 	if ((lhs.IsString() || lhs.IsEmpty() || lhs.IsNumber()) && (rhs.IsString() || rhs.IsEmpty() || rhs.IsNumber()) && (!(lhs.IsEmpty() && rhs.IsEmpty()) || lhs.IsString() || rhs.IsString()))
@@ -256,6 +270,9 @@ Value icinga::operator+(int lhs, const Value& rhs)
 
 Value icinga::operator-(const Value& lhs, const Value& rhs)
 {
+	if (lhs.IsNumber() && rhs.IsNumber())
+		return lhs.Get<double>() - rhs.Get<double>();
+
 	if ((lhs.IsNumber() || lhs.IsEmpty()) && !lhs.IsString() && (rhs.IsNumber() || rhs.IsEmpty()) && !rhs.IsString() && !(lhs.IsEmpty() && rhs.IsEmpty()))
 		return static_cast<double>(lhs) - static_cast<double>(rhs);
 	else if (lhs.IsObjectType<DateTime>() && rhs.IsNumber())
@@ -550,8 +567,10 @@ Value icinga::operator>>(int lhs, const Value& rhs)
 
 bool icinga::operator<(const Value& lhs, const Value& rhs)
 {
-	if (lhs.IsString() && rhs.IsString())
-		return static_cast<String>(lhs) < static_cast<String>(rhs);
+	if (lhs.IsNumber() && rhs.IsNumber())
+		return lhs.Get<double>() < rhs.Get<double>();
+	else if (lhs.IsString() && rhs.IsString())
+		return lhs.Get<String>() < rhs.Get<String>();
 	else if ((lhs.IsNumber() || lhs.IsEmpty()) && (rhs.IsNumber() || rhs.IsEmpty()) && !(lhs.IsEmpty() && rhs.IsEmpty()))
 		return static_cast<double>(lhs) < static_cast<double>(rhs);
 	else if ((lhs.IsObjectType<DateTime>() || lhs.IsEmpty()) && (rhs.IsObjectType<DateTime>() || rhs.IsEmpty()) && !(lhs.IsEmpty() && rhs.IsEmpty()))
@@ -603,8 +622,10 @@ bool icinga::operator<(int lhs, const Value& rhs)
 
 bool icinga::operator>(const Value& lhs, const Value& rhs)
 {
-	if (lhs.IsString() && rhs.IsString())
-		return static_cast<String>(lhs) > static_cast<String>(rhs);
+	if (lhs.IsNumber() && rhs.IsNumber())
+		return lhs.Get<double>() > rhs.Get<double>();
+	else if (lhs.IsString() && rhs.IsString())
+		return lhs.Get<String>() > rhs.Get<String>();
 	else if ((lhs.IsNumber() || lhs.IsEmpty()) && (rhs.IsNumber() || rhs.IsEmpty()) && !(lhs.IsEmpty() && rhs.IsEmpty()))
 		return static_cast<double>(lhs) > static_cast<double>(rhs);
 	else if ((lhs.IsObjectType<DateTime>() || lhs.IsEmpty()) && (rhs.IsObjectType<DateTime>() || rhs.IsEmpty()) && !(lhs.IsEmpty() && rhs.IsEmpty()))
@@ -656,8 +677,10 @@ bool icinga::operator>(int lhs, const Value& rhs)
 
 bool icinga::operator<=(const Value& lhs, const Value& rhs)
 {
-	if (lhs.IsString() && rhs.IsString())
-		return static_cast<String>(lhs) <= static_cast<String>(rhs);
+	if (lhs.IsNumber() && rhs.IsNumber())
+		return lhs.Get<double>() <= rhs.Get<double>();
+	else if (lhs.IsString() && rhs.IsString())
+		return lhs.Get<String>() <= rhs.Get<String>();
 	else if ((lhs.IsNumber() || lhs.IsEmpty()) && (rhs.IsNumber() || rhs.IsEmpty()) && !(lhs.IsEmpty() && rhs.IsEmpty()))
 		return static_cast<double>(lhs) <= static_cast<double>(rhs);
 	else if ((lhs.IsObjectType<DateTime>() || lhs.IsEmpty()) && (rhs.IsObjectType<DateTime>() || rhs.IsEmpty()) && !(lhs.IsEmpty() && rhs.IsEmpty()))
@@ -688,8 +711,10 @@ bool icinga::operator<=(int lhs, const Value& rhs)
 
 bool icinga::operator>=(const Value& lhs, const Value& rhs)
 {
-	if (lhs.IsString() && rhs.IsString())
-		return static_cast<String>(lhs) >= static_cast<String>(rhs);
+	if (lhs.IsNumber() && rhs.IsNumber())
+		return lhs.Get<double>() >= rhs.Get<double>();
+	else if (lhs.IsString() && rhs.IsString())
+		return lhs.Get<String>() >= rhs.Get<String>();
 	else if ((lhs.IsNumber() || lhs.IsEmpty()) && (rhs.IsNumber() || rhs.IsEmpty()) && !(lhs.IsEmpty() && rhs.IsEmpty()))
 		return static_cast<double>(lhs) >= static_cast<double>(rhs);
 	else if ((lhs.IsObjectType<DateTime>() || lhs.IsEmpty()) && (rhs.IsObjectType<DateTime>() || rhs.IsEmpty()) && !(lhs.IsEmpty() && rhs.IsEmpty()))
@@ -7,41 +7,55 @@
 
 using namespace icinga;
 
+#ifndef ICINGA2_COMPACT_VALUE
 template class boost::variant<boost::blank, double, bool, String, Object::Ptr>;
 template const double& Value::Get<double>() const;
 template const bool& Value::Get<bool>() const;
 template const String& Value::Get<String>() const;
 template const Object::Ptr& Value::Get<Object::Ptr>() const;
+#else /* ICINGA2_COMPACT_VALUE */
+static_assert(sizeof(void *) > 8 || sizeof(Value) <= 16, "Compact values must not be larger than 16 bytes");
+#endif /* ICINGA2_COMPACT_VALUE */
 
 Value icinga::Empty;
 
 Value::Value(std::nullptr_t)
+	: Value()
 { }
 
 Value::Value(int value)
-	: m_Value(double(value))
+	: Value(double(value))
 { }
 
 Value::Value(unsigned int value)
-	: m_Value(double(value))
+	: Value(double(value))
 { }
 
 Value::Value(long value)
-	: m_Value(double(value))
+	: Value(double(value))
 { }
 
 Value::Value(unsigned long value)
-	: m_Value(double(value))
+	: Value(double(value))
 { }
 
 Value::Value(long long value)
-	: m_Value(double(value))
+	: Value(double(value))
 { }
 
 Value::Value(unsigned long long value)
-	: m_Value(double(value))
+	: Value(double(value))
 { }
 
+Value::Value(const char *value)
+	: Value(String(value))
+{ }
+
+Value::Value(Object *value)
+	: Value(Object::Ptr(value))
+{ }
+
+#ifndef ICINGA2_COMPACT_VALUE
 Value::Value(double value)
 	: m_Value(value)
 { }
@@ -55,18 +69,14 @@ Value::Value(const String& value)
 { }
 
 Value::Value(String&& value)
-	: m_Value(value)
-{ }
-
-Value::Value(const char *value)
-	: m_Value(String(value))
+	: m_Value(std::move(value))
 { }
 
 Value::Value(const Value& other)
 	: m_Value(other.m_Value)
 { }
 
-Value::Value(Value&& other)
+Value::Value(Value&& other) noexcept
 {
 #if BOOST_VERSION >= 105400
 	m_Value = std::move(other.m_Value);
@@ -75,10 +85,6 @@ Value::Value(Value&& other)
 #endif /* BOOST_VERSION */
 }
 
-Value::Value(Object *value)
-	: Value(Object::Ptr(value))
-{ }
-
 Value::Value(const intrusive_ptr<Object>& value)
 {
 	if (value)
@@ -91,7 +97,7 @@ Value& Value::operator=(const Value& other)
 	return *this;
 }
 
-Value& Value::operator=(Value&& other)
+Value& Value::operator=(Value&& other) noexcept
 {
 #if BOOST_VERSION >= 105400
 	m_Value = std::move(other.m_Value);
@@ -102,6 +108,191 @@ Value& Value::operator=(Value&& other)
 	return *this;
 }
 
+/**
+ * Returns the type of the value.
+ *
+ * @returns The type.
+ */
+ValueType Value::GetType() const
+{
+	return static_cast<ValueType>(m_Value.which());
+}
+
+void Value::Swap(Value& other)
+{
+	m_Value.swap(other.m_Value);
+}
+
+/**
+ * Appends to the string this value holds in place, e.g. to build a string step by step without copying it.
+ */
+void Value::AppendString(const String& value)
+{
+	boost::get<String>(m_Value) += value;
+}
+#else /* ICINGA2_COMPACT_VALUE */
+Value::Value(double value)
+	: m_Number(value), m_Type(ValueNumber)
+{ }
+
+Value::Value(bool value)
+	: m_Boolean(value), m_Type(ValueBoolean)
+{ }
+
+Value::Value(const String& value)
+	: m_String(new String(value)), m_Type(ValueString)
+{ }
+
+Value::Value(String&& value)
+	: m_String(new String(std::move(value))), m_Type(ValueString)
+{ }
+
+Value::Value(const Value& other)
+{
+	CopyFrom(other);
+}
+
+Value::Value(Value&& other) noexcept
+{
+	MoveFrom(other);
+}
+
+Value::Value(const intrusive_ptr<Object>& value)
+{
+	if (value) {
+		new (&m_Object) Object::Ptr(value);
+		m_Type = ValueObject;
+	}
+}
+
+Value::~Value()
+{
+	Destroy();
+}
+
+Value& Value::operator=(const Value& other)
+{
+	if (this != &other) {
+		Value copy (other);
+		Destroy();
+		MoveFrom(copy);
+	}
+
+	return *this;
+}
+
+Value& Value::operator=(Value&& other) noexcept
+{
+	if (this != &other) {
+		/* other might be owned by our content. */
+		Value value (std::move(other));
+		Destroy();
+		MoveFrom(value);
+	}
+
+	return *this;
+}
+
+/**
+ * Returns the type of the value.
+ *
+ * @returns The type.
+ */
+ValueType Value::GetType() const
+{
+	return m_Type;
+}
+
+void Value::Swap(Value& other)
+{
+	Value value (std::move(other));
+	other.MoveFrom(*this);
+	MoveFrom(value);
+}
+
+/**
+ * Appends to the string this value holds in place, e.g. to build a string step by step without copying it.
+ */
+void Value::AppendString(const String& value)
+{
+	if (m_Type != ValueString)
+		BOOST_THROW_EXCEPTION(boost::bad_get());
+
+	*m_String += value;
+}
+
+/**
+ * Copies other's content into this value which must be empty.
+ */
+void Value::CopyFrom(const Value& other)
+{
+	switch (other.m_Type) {
+		case ValueNumber:
+			m_Number = other.m_Number;
+			break;
+		case ValueBoolean:
+			m_Boolean = other.m_Boolean;
+			break;
+		case ValueString:
+			m_String = new String(*other.m_String);
+			break;
+		case ValueObject:
+			new (&m_Object) Object::Ptr(other.m_Object);
+			break;
+		default:
+			break;
+	}
+
+	m_Type = other.m_Type;
+}
+
+/**
+ * Moves other's content into this value which must be empty. Leaves other empty.
+ */
+void Value::MoveFrom(Value& other) noexcept
+{
+	switch (other.m_Type) {
+		case ValueNumber:
+			m_Number = other.m_Number;
+			break;
+		case ValueBoolean:
+			m_Boolean = other.m_Boolean;
+			break;
+		case ValueString:
+			m_String = other.m_String;
+			break;
+		case ValueObject:
+			new (&m_Object) Object::Ptr(std::move(other.m_Object));
+			other.m_Object.~intrusive_ptr();
+			break;
+		default:
+			break;
+	}
+
+	m_Type = other.m_Type;
+	other.m_Type = ValueEmpty;
+}
+
+/**
+ * Releases the content of this value, leaving it empty.
+ */
+void Value::Destroy() noexcept
+{
+	switch (m_Type) {
+		case ValueString:
+			delete m_String;
+			break;
+		case ValueObject:
+			m_Object.~intrusive_ptr();
+			break;
+		default:
+			break;
+	}
+
+	m_Type = ValueEmpty;
+}
+#endif /* ICINGA2_COMPACT_VALUE */
+
 /**
  * Checks whether the variant is empty.
  *
@@ -109,7 +300,7 @@ Value& Value::operator=(Value&& other)
  */
 bool Value::IsEmpty() const
 {
-	return (GetType() == ValueEmpty || (IsString() && boost::get<String>(m_Value).IsEmpty()));
+	return (GetType() == ValueEmpty || (IsString() && Get<String>().IsEmpty()));
 }
 
 /**
@@ -162,32 +353,17 @@ bool Value::IsObject() const
 	return  (GetType() == ValueObject);
 }
 
-/**
- * Returns the type of the value.
- *
- * @returns The type.
- */
-ValueType Value::GetType() const
-{
-	return static_cast<ValueType>(m_Value.which());
-}
-
-void Value::Swap(Value& other)
-{
-	m_Value.swap(other.m_Value);
-}
-
 bool Value::ToBool() const
 {
 	switch (GetType()) {
 		case ValueNumber:
-			return static_cast<bool>(boost::get<double>(m_Value));
+			return static_cast<bool>(Get<double>());
 
 		case ValueBoolean:
-			return boost::get<bool>(m_Value);
+			return Get<bool>();
 
 		case ValueString:
-			return !boost::get<String>(m_Value).IsEmpty();
+			return !Get<String>().IsEmpty();
 
 		case ValueObject:
 			if (IsObjectType<Dictionary>()) {
@@ -222,7 +398,7 @@ String Value::GetTypeName() const
 		case ValueString:
 			return "String";
 		case ValueObject:
-			t = boost::get<Object::Ptr>(m_Value)->GetReflectionType();
+			t = Get<Object::Ptr>()->GetReflectionType();
 			if (!t) {
 				if (IsObjectType<Array>())
 					return "Array";
@@ -249,7 +425,7 @@ Type::Ptr Value::GetReflectionType() const
 		case ValueString:
 			return Type::GetByName("String");
 		case ValueObject:
-			return boost::get<Object::Ptr>(m_Value)->GetReflectionType();
+			return Get<Object::Ptr>()->GetReflectionType();
 		default:
 			return nullptr;
 	}
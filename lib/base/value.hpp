@@ -5,7 +5,9 @@
 
 #include "base/object.hpp"
 #include "base/string.hpp"
+#ifndef ICINGA2_COMPACT_VALUE
 #include <boost/variant/variant.hpp>
+#endif /* ICINGA2_COMPACT_VALUE */
 #include <boost/variant/get.hpp>
 #include <boost/throw_exception.hpp>
 
@@ -31,12 +33,22 @@ enum ValueType
 /**
  * A type that can hold an arbitrary value.
  *
+ * If built with ICINGA2_COMPACT_VALUE, a value consists of a type tag and a union
+ * instead of a boost::variant. Strings are allocated separately then, which makes
+ * all other values 16 bytes large (instead of 40).
+ *
  * @ingroup base
  */
 class Value
 {
 public:
+#ifndef ICINGA2_COMPACT_VALUE
 	Value() = default;
+#else /* ICINGA2_COMPACT_VALUE */
+	inline Value() noexcept
+		: m_Number(0)
+	{ }
+#endif /* ICINGA2_COMPACT_VALUE */
 	Value(std::nullptr_t);
 	Value(int value);
 	Value(unsigned int value);
@@ -50,10 +62,14 @@ public:
 	Value(String&& value);
 	Value(const char *value);
 	Value(const Value& other);
-	Value(Value&& other);
+	Value(Value&& other) noexcept;
 	Value(Object *value);
 	Value(const intrusive_ptr<Object>& value);
 
+#ifdef ICINGA2_COMPACT_VALUE
+	~Value();
+#endif /* ICINGA2_COMPACT_VALUE */
+
 	template<typename T>
 	Value(const intrusive_ptr<T>& value)
 		: Value(static_pointer_cast<Object>(value))
@@ -67,7 +83,7 @@ public:
 	operator String() const;
 
 	Value& operator=(const Value& other);
-	Value& operator=(Value&& other);
+	Value& operator=(Value&& other) noexcept;
 
 	bool operator==(bool rhs) const;
 	bool operator!=(bool rhs) const;
@@ -127,6 +143,7 @@ public:
 	ValueType GetType() const;
 
 	void Swap(Value& other);
+	void AppendString(const String& value);
 
 	String GetTypeName() const;
 
@@ -134,6 +151,7 @@ public:
 
 	Value Clone() const;
 
+#ifndef ICINGA2_COMPACT_VALUE
 	template<typename T>
 	const T& Get() const
 	{
@@ -142,12 +160,67 @@ public:
 
 private:
 	boost::variant<boost::blank, double, bool, String, Object::Ptr> m_Value;
+#else /* ICINGA2_COMPACT_VALUE */
+	template<typename T>
+	const T& Get() const
+	{
+		return GetAs(static_cast<const T *>(nullptr));
+	}
+
+private:
+	union {
+		double m_Number;
+		bool m_Boolean;
+		String *m_String;
+		Object::Ptr m_Object;
+	};
+
+	ValueType m_Type{ValueEmpty};
+
+	inline const double& GetAs(const double *) const
+	{
+		if (m_Type != ValueNumber)
+			BOOST_THROW_EXCEPTION(boost::bad_get());
+
+		return m_Number;
+	}
+
+	inline const bool& GetAs(const bool *) const
+	{
+		if (m_Type != ValueBoolean)
+			BOOST_THROW_EXCEPTION(boost::bad_get());
+
+		return m_Boolean;
+	}
+
+	inline const String& GetAs(const String *) const
+	{
+		if (m_Type != ValueString)
+			BOOST_THROW_EXCEPTION(boost::bad_get());
+
+		return *m_String;
+	}
+
+	inline const Object::Ptr& GetAs(const Object::Ptr *) const
+	{
+		if (m_Type != ValueObject)
+			BOOST_THROW_EXCEPTION(boost::bad_get());
+
+		return m_Object;
+	}
+
+	void CopyFrom(const Value& other);
+	void MoveFrom(Value& other) noexcept;
+	void Destroy() noexcept;
+#endif /* ICINGA2_COMPACT_VALUE */
 };
 
+#ifndef ICINGA2_COMPACT_VALUE
 extern template const double& Value::Get<double>() const;
 extern template const bool& Value::Get<bool>() const;
 extern template const String& Value::Get<String>() const;
 extern template const Object::Ptr& Value::Get<Object::Ptr>() const;
+#endif /* ICINGA2_COMPACT_VALUE */
 
 extern Value Empty;
 
@@ -246,6 +319,8 @@ std::istream& operator>>(std::istream& stream, Value& value);
 
 }
 
+#ifndef ICINGA2_COMPACT_VALUE
 extern template class boost::variant<boost::blank, double, bool, icinga::String, icinga::Object::Ptr>;
+#endif /* ICINGA2_COMPACT_VALUE */
 
 #endif /* VALUE_H */
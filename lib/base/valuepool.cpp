@@ -0,0 +1,176 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/valuepool.hpp"
+#include "base/array.hpp"
+#include "base/dictionary.hpp"
+#include "base/object-packer.hpp"
+#include "base/objectlock.hpp"
+#include <utility>
+#include <vector>
+
+using namespace icinga;
+
+/**
+ * @param value The value.
+ * @returns An equal value shared with previous calls, the value itself if there's none (yet).
+ */
+Value ValuePool::Share(const Value& value)
+{
+	Value result (value);
+	ShareInternal(result);
+	return result;
+}
+
+/**
+ * Shares the elements of a dictionary, but not the dictionary itself, so it may still be modified.
+ *
+ * @param dict The dictionary, e.g. an object's custom variables.
+ */
+void ValuePool::ShareElements(const Dictionary::Ptr& dict)
+{
+	if (!dict || dict->IsFrozen())
+		return;
+
+	std::vector<std::pair<String, Value>> replaced;
+
+	{
+		ObjectLock olock(dict);
+
+		for (const Dictionary::Pair& kv : dict) {
+			Value value (kv.second);
+			ShareInternal(value);
+
+			if (value.IsObject() && value.Get<Object::Ptr>() != kv.second.Get<Object::Ptr>())
+				replaced.emplace_back(kv.first, std::move(value));
+		}
+	}
+
+	for (auto& kv : replaced) {
+		dict->Set(kv.first, std::move(kv.second));
+	}
+}
+
+/**
+ * @returns How often a value has been replaced by an equal one.
+ */
+size_t ValuePool::GetSharedCount() const
+{
+	return m_SharedCount;
+}
+
+/**
+ * Shares the elements of a dictionary or array first, then the value itself.
+ *
+ * @param value The value, replaced by the shared one.
+ * @returns Whether the value may be shared, i.e. it consists of dictionaries, arrays and scalars only.
+ */
+bool ValuePool::ShareInternal(Value& value)
+{
+	if (!value.IsObject())
+		return true;
+
+	const Object::Ptr& obj (value.Get<Object::Ptr>());
+	bool shareable = true;
+
+	if (auto dict = dynamic_pointer_cast<Dictionary>(obj)) {
+		if (dict->IsFrozen())
+			return false;
+
+		std::vector<std::pair<String, Value>> replaced;
+
+		{
+			ObjectLock olock(dict);
+
+			for (const Dictionary::Pair& kv : dict) {
+				Value element (kv.second);
+
+				if (!ShareInternal(element))
+					shareable = false;
+
+				if (element.IsObject() && element.Get<Object::Ptr>() != kv.second.Get<Object::Ptr>())
+					replaced.emplace_back(kv.first, std::move(element));
+			}
+		}
+
+		for (auto& kv : replaced) {
+			dict->Set(kv.first, std::move(kv.second));
+		}
+	} else if (auto arr = dynamic_pointer_cast<Array>(obj)) {
+		if (arr->IsFrozen())
+			return false;
+
+		ObjectLock olock(arr);
+
+		for (Array::SizeType i = 0; i < arr->GetLength(); i++) {
+			Value element (arr->Get(i));
+			Object::Ptr previous (element.IsObject() ? element.Get<Object::Ptr>() : nullptr);
+
+			if (!ShareInternal(element))
+				shareable = false;
+
+			if (element.IsObject() && element.Get<Object::Ptr>() != previous)
+				arr->Set(i, std::move(element));
+		}
+	} else {
+		return false;
+	}
+
+	if (!shareable)
+		return false;
+
+	/* PackObject() output is the same for equal values, e.g. dictionary keys are sorted. */
+	std::string key;
+	PackObject(value, key);
+
+	auto it (m_Values.find(key));
+
+	if (it == m_Values.end()) {
+		m_Values.emplace(std::move(key), value);
+		return true;
+	}
+
+	if (it->second.Get<Object::Ptr>() == obj)
+		return true;
+
+	/* Frozen once it's actually shared, values used only once may still be modified. */
+	DeepFreeze(it->second);
+	value = it->second;
+	m_SharedCount++;
+
+	return true;
+}
+
+void ValuePool::DeepFreeze(const Value& value)
+{
+	if (value.IsObjectType<Dictionary>()) {
+		Dictionary::Ptr dict = value;
+
+		if (dict->IsFrozen())
+			return;
+
+		{
+			ObjectLock olock(dict);
+
+			for (const Dictionary::Pair& kv : dict) {
+				DeepFreeze(kv.second);
+			}
+		}
+
+		dict->Freeze();
+	} else if (value.IsObjectType<Array>()) {
+		Array::Ptr arr = value;
+
+		if (arr->IsFrozen())
+			return;
+
+		{
+			ObjectLock olock(arr);
+
+			for (const Value& element : arr) {
+				DeepFreeze(element);
+			}
+		}
+
+		arr->Freeze();
+	}
+}
@@ -0,0 +1,44 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef VALUEPOOL_H
+#define VALUEPOOL_H
+
+#include "base/i2-base.hpp"
+#include "base/dictionary.hpp"
+#include "base/value.hpp"
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+namespace icinga
+{
+
+/**
+ * Replaces structurally equal dictionaries and arrays by the same instance, e.g. the custom
+ * variables thousands of hosts inherit from the same templates. Shared instances are frozen
+ * (deeply), so they have to be copied before modifying them (see ConfigObject::ModifyAttribute()).
+ *
+ * Only values consisting of dictionaries, arrays and scalars are shared. Values which are
+ * frozen already are left as they are.
+ *
+ * @ingroup base
+ */
+class ValuePool
+{
+public:
+	Value Share(const Value& value);
+	void ShareElements(const Dictionary::Ptr& dict);
+
+	size_t GetSharedCount() const;
+
+private:
+	std::unordered_map<std::string, Value> m_Values;
+	size_t m_SharedCount{0};
+
+	bool ShareInternal(Value& value);
+	static void DeepFreeze(const Value& value);
+};
+
+}
+
+#endif /* VALUEPOOL_H */
@@ -0,0 +1,136 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/wildcardpattern.hpp"
+
+using namespace icinga;
+
+/* Like tolower(3) in the "C" locale Icinga runs with. */
+static inline char ToLower(char ch)
+{
+	return ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch;
+}
+
+WildcardPattern::WildcardPattern(const String& pattern)
+{
+	const char *p = pattern.CStr();
+	bool star = false;
+
+	m_Segments.emplace_back();
+
+	for (; *p; p++) {
+		if (*p == '*') {
+			if (!star)
+				m_Segments.emplace_back();
+
+			star = true;
+			continue;
+		}
+
+		star = false;
+
+		auto& segment (m_Segments.back());
+
+		if (*p == '?') {
+			segment.AnyChar.resize(segment.Chars.size());
+			segment.AnyChar.push_back(true);
+			segment.Chars += '?';
+			continue;
+		}
+
+		if (*p == '\\' && (p[1] == '*' || p[1] == '?'))
+			p++;
+
+		segment.Chars += ToLower(*p);
+
+		if (!segment.AnyChar.empty())
+			segment.AnyChar.push_back(false);
+	}
+}
+
+bool WildcardPattern::Match(const String& text) const
+{
+	return Match(text.CStr(), text.GetLength());
+}
+
+bool WildcardPattern::Match(const char *text, size_t length) const
+{
+	auto& front (m_Segments.front());
+
+	if (m_Segments.size() == 1)
+		return length == front.Chars.size() && MatchAt(front, text);
+
+	auto& back (m_Segments.back());
+
+	if (length < front.Chars.size() + back.Chars.size())
+		return false;
+
+	const char *begin = text + front.Chars.size();
+	const char *end = text + length - back.Chars.size();
+
+	if (!MatchAt(front, text) || !MatchAt(back, end))
+		return false;
+
+	for (auto segment (m_Segments.begin() + 1); segment != m_Segments.end() - 1; segment++) {
+		begin = Find(*segment, begin, end);
+
+		if (!begin)
+			return false;
+
+		begin += segment->Chars.size();
+	}
+
+	return true;
+}
+
+/**
+ * Whether the pattern matches only itself (ignoring case).
+ */
+bool WildcardPattern::IsLiteral() const
+{
+	return m_Segments.size() == 1 && m_Segments.front().AnyChar.empty();
+}
+
+/**
+ * @returns Whether the segment matches the beginning of the text, which has to be long enough.
+ */
+bool WildcardPattern::MatchAt(const Segment& segment, const char *text)
+{
+	auto& chars (segment.Chars);
+
+	for (size_t i = 0; i < chars.size(); i++) {
+		if (ToLower(text[i]) != chars[i] && (segment.AnyChar.empty() || !segment.AnyChar[i]))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * @returns The first position in [begin, end) where the segment matches or nullptr.
+ */
+const char *WildcardPattern::Find(const Segment& segment, const char *begin, const char *end)
+{
+	auto size (segment.Chars.size());
+
+	if (static_cast<size_t>(end - begin) < size)
+		return nullptr;
+
+	const char *last = end - size;
+
+	if (segment.AnyChar.empty() || !segment.AnyChar[0]) {
+		/* Check the first character before the whole segment. */
+		char first = segment.Chars[0];
+
+		for (; begin <= last; begin++) {
+			if (ToLower(*begin) == first && MatchAt(segment, begin))
+				return begin;
+		}
+	} else {
+		for (; begin <= last; begin++) {
+			if (MatchAt(segment, begin))
+				return begin;
+		}
+	}
+
+	return nullptr;
+}
@@ -0,0 +1,48 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef WILDCARDPATTERN_H
+#define WILDCARDPATTERN_H
+
+#include "base/i2-base.hpp"
+#include "base/string.hpp"
+#include <string>
+#include <vector>
+
+namespace icinga
+{
+
+/**
+ * A wildcard pattern as understood by Utility::Match(), parsed once to match many texts:
+ * case-insensitive, "*" matches any number and "?" exactly one character, "\*" and "\?" match themselves.
+ *
+ * The pattern is split at its "*"s. The first and the last part have to match
+ * at the beginning and at the end of the text, the others are searched for in between.
+ *
+ * @ingroup base
+ */
+class WildcardPattern
+{
+public:
+	WildcardPattern(const String& pattern);
+
+	bool Match(const String& text) const;
+	bool Match(const char *text, size_t length) const;
+
+	bool IsLiteral() const;
+
+private:
+	struct Segment
+	{
+		std::string Chars; /* lower case */
+		std::vector<bool> AnyChar; /* the "?"s, empty if there are none */
+	};
+
+	std::vector<Segment> m_Segments;
+
+	static bool MatchAt(const Segment& segment, const char *text);
+	static const char *Find(const Segment& segment, const char *begin, const char *end);
+};
+
+}
+
+#endif /* WILDCARDPATTERN_H */
@@ -6,18 +6,49 @@
 #include "base/convert.hpp"
 #include "base/application.hpp"
 #include "base/exception.hpp"
+#include "base/memoryusage.hpp"
+#include "base/profiler.hpp"
+#include "base/threadaffinity.hpp"
 #include <boost/thread/tss.hpp>
+#include <algorithm>
+#include <chrono>
 #include <math.h>
+#include <set>
 
 using namespace icinga;
 
 std::atomic<int> WorkQueue::m_NextID(1);
 boost::thread_specific_ptr<WorkQueue *> l_ThreadWorkQueue;
 
-WorkQueue::WorkQueue(size_t maxItems, int threadCount, LogSeverity statsLogLevel)
-	: m_ID(m_NextID++), m_ThreadCount(threadCount), m_MaxItems(maxItems),
+static std::mutex l_WorkQueuesMutex;
+static std::set<WorkQueue *> l_WorkQueues;
+
+/* The queued tasks, the heap memory of their functions' bound arguments isn't included. */
+REGISTER_MEMORY_USAGE_REPORTER("work_queues", [](std::vector<MemoryUsageEntry>& entries) {
+	std::unique_lock<std::mutex> lock (l_WorkQueuesMutex);
+
+	for (WorkQueue *queue : l_WorkQueues) {
+		uint_fast64_t length = queue->GetLength();
+
+		if (length) {
+			String name = queue->GetName();
+			entries.push_back({ name.IsEmpty() ? "unnamed" : name, length, length * sizeof(Task) });
+		}
+	}
+});
+
+WorkQueue::WorkQueue(size_t maxItems, int threadCount, LogSeverity statsLogLevel, bool lockFree)
+	: m_ID(m_NextID++), m_ThreadCount(threadCount), m_LockFree(lockFree), m_MaxItems(maxItems),
 	m_TaskStats(15 * 60), m_StatsLogLevel(statsLogLevel)
 {
+	if (m_LockFree) {
+		size_t ringSize = m_MaxItems == 0 ? m_LockFreeRingSize : std::min(m_MaxItems, m_LockFreeRingSize);
+
+		for (auto& level : m_LockFreeLevels) {
+			level.Ring.reset(new LockFreeQueue<Task>(ringSize));
+		}
+	}
+
 	/* Initialize logger. */
 	m_StatusTimerTimeout = Utility::GetTime();
 
@@ -25,10 +56,18 @@ WorkQueue::WorkQueue(size_t maxItems, int threadCount, LogSeverity statsLogLevel
 	m_StatusTimer->SetInterval(10);
 	m_StatusTimer->OnTimerExpired.connect([this](const Timer * const&) { StatusTimerHandler(); });
 	m_StatusTimer->Start();
+
+	std::unique_lock<std::mutex> lock (l_WorkQueuesMutex);
+	l_WorkQueues.insert(this);
 }
 
 WorkQueue::~WorkQueue()
 {
+	{
+		std::unique_lock<std::mutex> lock (l_WorkQueuesMutex);
+		l_WorkQueues.erase(this);
+	}
+
 	m_StatusTimer->Stop(true);
 
 	Join(true);
@@ -55,17 +94,13 @@ std::unique_lock<std::mutex> WorkQueue::AcquireLock()
  */
 void WorkQueue::EnqueueUnlocked(std::unique_lock<std::mutex>& lock, std::function<void ()>&& function, WorkQueuePriority priority)
 {
-	if (!m_Spawned) {
-		Log(LogNotice, "WorkQueue")
-			<< "Spawning WorkQueue threads for '" << m_Name << "'";
-
-		for (int i = 0; i < m_ThreadCount; i++) {
-			m_Threads.create_thread([this]() { WorkerThreadProc(); });
-		}
-
-		m_Spawned = true;
+	if (m_LockFree) {
+		EnqueueLockFree(lock, std::move(function), priority);
+		return;
 	}
 
+	SpawnWorkersUnlocked();
+
 	bool wq_thread = IsWorkerThread();
 
 	if (!wq_thread) {
@@ -95,10 +130,138 @@ void WorkQueue::Enqueue(std::function<void ()>&& function, WorkQueuePriority pri
 		return;
 	}
 
+	if (m_LockFree) {
+		std::unique_lock<std::mutex> lock (m_Mutex, std::defer_lock);
+		EnqueueLockFree(lock, std::move(function), priority);
+		return;
+	}
+
 	auto lock = AcquireLock();
 	EnqueueUnlocked(lock, std::move(function), priority);
 }
 
+/**
+ * Starts the worker threads unless they are already running.
+ *
+ * The caller must hold the WorkQueue's mutex.
+ */
+void WorkQueue::SpawnWorkersUnlocked()
+{
+	if (m_Spawned)
+		return;
+
+	Log(LogNotice, "WorkQueue")
+		<< "Spawning WorkQueue threads for '" << m_Name << "'";
+
+	for (int i = 0; i < m_ThreadCount; i++) {
+		if (m_LockFree)
+			m_Threads.create_thread([this]() { WorkerThreadProcLockFree(); });
+		else
+			m_Threads.create_thread([this]() { WorkerThreadProc(); });
+	}
+
+	m_Spawned = true;
+}
+
+WorkQueue::LockFreeLevel& WorkQueue::GetLockFreeLevel(WorkQueuePriority priority)
+{
+	switch (priority) {
+		case PriorityLow:
+			return m_LockFreeLevels[0];
+		case PriorityNormal:
+			return m_LockFreeLevels[1];
+		case PriorityHigh:
+			return m_LockFreeLevels[2];
+		default:
+			return m_LockFreeLevels[3];
+	}
+}
+
+/**
+ * Enqueues a task into the ring of its priority level. The mutex is only acquired
+ * (unless the caller already holds it) if the workers have to be started or woken up,
+ * if the caller has to wait for free space or if the ring is full.
+ *
+ * Tasks of the same priority are run in the order they were enqueued in as long as
+ * there is only one worker thread. Once a ring is full, its tasks spill into an overflow
+ * list which becomes the target of all further tasks of that priority until it's drained.
+ *
+ * @param lock A possibly not yet owned lock of the WorkQueue's mutex
+ */
+void WorkQueue::EnqueueLockFree(std::unique_lock<std::mutex>& lock, TaskFunction&& function, WorkQueuePriority priority)
+{
+	if (!m_Spawned) {
+		if (!lock.owns_lock())
+			lock.lock();
+
+		SpawnWorkersUnlocked();
+	}
+
+	if (m_MaxItems != 0 && m_LockFreePending.load() >= m_MaxItems && !IsWorkerThread()) {
+		if (!lock.owns_lock())
+			lock.lock();
+
+		m_FullWaiters++;
+
+		/* Workers only signal m_CVFull if they notice a waiter, so re-check periodically
+		 * in case we've registered ourselves just after a worker looked.
+		 */
+		while (m_LockFreePending.load() >= m_MaxItems)
+			m_CVFull.wait_for(lock, std::chrono::milliseconds(10));
+
+		m_FullWaiters--;
+	}
+
+	Task task (std::move(function), priority, -1);
+	auto& level (GetLockFreeLevel(priority));
+
+	/* Count the task before a worker can take it, otherwise the worker's decrement could come first and wrap around. */
+	m_LockFreePending++;
+
+	if (level.OverflowCount.load() > 0 || !level.Ring->TryPush(task)) {
+		if (!lock.owns_lock())
+			lock.lock();
+
+		level.Overflow.emplace_back(std::move(task));
+		level.OverflowCount++;
+	}
+
+	if (m_IdleWorkers.load() > 0) {
+		/* Synchronize with the worker going to sleep so the notification can't get lost. */
+		if (!lock.owns_lock())
+			lock.lock();
+
+		m_CVEmpty.notify_one();
+	}
+}
+
+/**
+ * Takes the oldest task with the highest priority out of the lock-free rings.
+ *
+ * @returns true if a task was found, false otherwise
+ */
+bool WorkQueue::DequeueLockFree(Task& task)
+{
+	for (auto level (m_LockFreeLevels.rbegin()); level != m_LockFreeLevels.rend(); ++level) {
+		if (level->Ring->TryPop(task))
+			return true;
+
+		if (level->OverflowCount.load() > 0) {
+			std::unique_lock<std::mutex> lock (m_Mutex);
+
+			if (!level->Overflow.empty()) {
+				task = std::move(level->Overflow.front());
+				level->Overflow.pop_front();
+				level->OverflowCount--;
+
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
 /**
  * Waits until all currently enqueued tasks have completed. This only works reliably
  * when no other thread is enqueuing new tasks when this method is called.
@@ -109,7 +272,7 @@ void WorkQueue::Join(bool stop)
 {
 	std::unique_lock<std::mutex> lock(m_Mutex);
 
-	while (m_Processing || !m_Tasks.empty())
+	while (m_Processing || (m_LockFree ? m_LockFreePending.load() : m_Tasks.size()))
 		m_CVStarved.wait(lock);
 
 	if (stop) {
@@ -141,6 +304,14 @@ bool WorkQueue::IsWorkerThread() const
 	return *pwq == this;
 }
 
+/**
+ * Checks whether this work queue keeps its tasks in lock-free rings.
+ */
+bool WorkQueue::IsLockFree() const
+{
+	return m_LockFree;
+}
+
 void WorkQueue::SetExceptionCallback(const ExceptionCallback& callback)
 {
 	m_ExceptionCallback = callback;
@@ -184,6 +355,9 @@ void WorkQueue::ReportExceptions(const String& facility, bool verbose) const
 
 size_t WorkQueue::GetLength() const
 {
+	if (m_LockFree)
+		return m_LockFreePending.load();
+
 	std::unique_lock<std::mutex> lock(m_Mutex);
 
 	return m_Tasks.size();
@@ -195,7 +369,7 @@ void WorkQueue::StatusTimerHandler()
 
 	ASSERT(!m_Name.IsEmpty());
 
-	size_t pending = m_Tasks.size();
+	size_t pending = m_LockFree ? m_LockFreePending.load() : m_Tasks.size();
 
 	double now = Utility::GetTime();
 	double gradient = (pending - m_PendingTasks) / (now - m_PendingTasksTimestamp);
@@ -232,6 +406,8 @@ void WorkQueue::StatusTimerHandler()
 
 void WorkQueue::RunTaskFunction(const TaskFunction& func)
 {
+	ProfilerScope span ("work_queue", m_Name);
+
 	try {
 		func();
 	} catch (const std::exception&) {
@@ -254,6 +430,7 @@ void WorkQueue::WorkerThreadProc()
 	std::ostringstream idbuf;
 	idbuf << "WQ #" << m_ID;
 	Utility::SetThreadName(idbuf.str());
+	ThreadAffinity::Register(ThreadRoleWorkQueues);
 
 	l_ThreadWorkQueue.reset(new WorkQueue *(this));
 
@@ -292,6 +469,57 @@ void WorkQueue::WorkerThreadProc()
 	}
 }
 
+void WorkQueue::WorkerThreadProcLockFree()
+{
+	std::ostringstream idbuf;
+	idbuf << "WQ #" << m_ID;
+	Utility::SetThreadName(idbuf.str());
+	ThreadAffinity::Register(ThreadRoleWorkQueues);
+
+	l_ThreadWorkQueue.reset(new WorkQueue *(this));
+
+	for (;;) {
+		Task task;
+
+		if (!DequeueLockFree(task)) {
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			m_IdleWorkers++;
+
+			while (!m_LockFreePending.load() && !m_Stopped)
+				m_CVEmpty.wait(lock);
+
+			m_IdleWorkers--;
+
+			if (m_Stopped)
+				break;
+
+			continue;
+		}
+
+		/* Count the task as being processed before it's no longer pending, so Join() can't miss it. */
+		m_Processing++;
+		m_LockFreePending--;
+
+		if (m_FullWaiters.load() > 0) {
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_CVFull.notify_all();
+		}
+
+		RunTaskFunction(task.Function);
+
+		/* clear the task so whatever other resources it holds are released _before_ we signal Join() */
+		task = Task();
+
+		IncreaseTaskCount();
+
+		if (--m_Processing == 0 && !m_LockFreePending.load()) {
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_CVStarved.notify_all();
+		}
+	}
+}
+
 void WorkQueue::IncreaseTaskCount()
 {
 	m_TaskStats.InsertValue(Utility::GetTime(), 1);
@@ -302,6 +530,158 @@ size_t WorkQueue::GetTaskCount(RingBuffer::SizeType span)
 	return m_TaskStats.UpdateAndGetValues(Utility::GetTime(), span);
 }
 
+/**
+ * Returns the number of steals of all ParallelForStealing() runs so far.
+ */
+size_t WorkQueue::GetParallelForSteals() const
+{
+	return m_ParallelForSteals.load();
+}
+
+void WorkQueue::ReportParallelForSteals(const ParallelForState& state)
+{
+	m_ParallelForSteals += state.GetSteals();
+
+	Log(LogNotice, "WorkQueue")
+		<< "#" << m_ID << " (" << m_Name << ") "
+		<< "ParallelFor processed " << state.GetItems() << " items with " << state.GetSteals() << " steals.";
+}
+
+ParallelForState::ParallelForState(size_t items, size_t shares)
+	: m_Shares(new Share[shares]), m_ShareCount(shares), m_Items(items), m_ActiveShares(shares)
+{
+	size_t offset = 0;
+
+	for (size_t i = 0; i < shares; i++) {
+		size_t count = items / shares;
+		if (i < items % shares)
+			count++;
+
+		m_Shares[i].Begin = offset;
+		m_Shares[i].End = offset + count;
+
+		offset += count;
+	}
+
+	ASSERT(offset == items);
+}
+
+/**
+ * Takes the next chunk of items from the given share, stealing from other shares once it's empty.
+ *
+ * @param share The share of the calling worker
+ * @param begin Receives the index of the first item of the chunk
+ * @param end Receives the index after the last item of the chunk
+ *
+ * @returns false if there are no items left at all, true otherwise
+ */
+bool ParallelForState::GetChunk(size_t share, size_t& begin, size_t& end)
+{
+	auto& own (m_Shares[share]);
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock (own.Mutex);
+
+			size_t remaining = own.End - own.Begin;
+
+			if (remaining > 0) {
+				/* The chunks get smaller as the share drains, so that there's still
+				 * something left to steal once others run out of work.
+				 */
+				size_t count = std::max<size_t>(remaining / (2 * m_ShareCount), 1);
+
+				begin = own.Begin;
+				end = begin + count;
+				own.Begin = end;
+
+				return true;
+			}
+		}
+
+		if (!Steal(share))
+			return false;
+	}
+}
+
+/**
+ * Moves the back half of the largest other share into the given (empty) share.
+ *
+ * @returns false if all other shares are empty, true otherwise
+ */
+bool ParallelForState::Steal(size_t share)
+{
+	for (;;) {
+		size_t victim = m_ShareCount;
+		size_t victimRemaining = 0;
+
+		for (size_t i = 0; i < m_ShareCount; i++) {
+			if (i == share)
+				continue;
+
+			std::unique_lock<std::mutex> lock (m_Shares[i].Mutex);
+			size_t remaining = m_Shares[i].End - m_Shares[i].Begin;
+
+			if (remaining > victimRemaining) {
+				victim = i;
+				victimRemaining = remaining;
+			}
+		}
+
+		if (victim == m_ShareCount)
+			return false;
+
+		size_t begin, end;
+
+		{
+			auto& other (m_Shares[victim]);
+			std::unique_lock<std::mutex> lock (other.Mutex);
+
+			size_t remaining = other.End - other.Begin;
+
+			/* The victim has made progress in the meantime, look again. */
+			if (remaining == 0)
+				continue;
+
+			end = other.End;
+			begin = end - (remaining + 1) / 2;
+			other.End = begin;
+		}
+
+		{
+			auto& own (m_Shares[share]);
+			std::unique_lock<std::mutex> lock (own.Mutex);
+
+			own.Begin = begin;
+			own.End = end;
+		}
+
+		m_Steals++;
+
+		return true;
+	}
+}
+
+/**
+ * Marks the share of a worker as done.
+ *
+ * @returns true if this was the last worker still running, false otherwise
+ */
+bool ParallelForState::FinishShare()
+{
+	return --m_ActiveShares == 0;
+}
+
+size_t ParallelForState::GetItems() const
+{
+	return m_Items;
+}
+
+size_t ParallelForState::GetSteals() const
+{
+	return m_Steals.load();
+}
+
 bool icinga::operator<(const Task& a, const Task& b)
 {
 	if (a.Priority < b.Priority)
@@ -5,11 +5,15 @@
 
 #include "base/i2-base.hpp"
 #include "base/timer.hpp"
-#include "base/ringbuffer.hpp"
+#include "base/shardedringbuffer.hpp"
 #include "base/logger.hpp"
+#include "base/lock-free-queue.hpp"
 #include <boost/thread/thread.hpp>
 #include <boost/exception_ptr.hpp>
+#include <algorithm>
+#include <array>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <deque>
@@ -43,9 +47,52 @@ struct Task
 
 bool operator<(const Task& a, const Task& b);
 
+/**
+ * Shared bookkeeping of a work-stealing WorkQueue::ParallelForStealing() run.
+ *
+ * Every worker owns a contiguous share of the item indices. It takes chunks from the
+ * front of its share which get smaller as the share drains. Once its share is empty,
+ * it steals the back half of the largest share left.
+ *
+ * @ingroup base
+ */
+class ParallelForState
+{
+public:
+	ParallelForState(size_t items, size_t shares);
+
+	bool GetChunk(size_t share, size_t& begin, size_t& end);
+	bool FinishShare();
+
+	size_t GetItems() const;
+	size_t GetSteals() const;
+
+private:
+	struct Share
+	{
+		std::mutex Mutex;
+		size_t Begin{0};
+		size_t End{0};
+	};
+
+	std::unique_ptr<Share[]> m_Shares;
+	size_t m_ShareCount;
+	size_t m_Items;
+	std::atomic<size_t> m_ActiveShares;
+	std::atomic<size_t> m_Steals{0};
+
+	bool Steal(size_t share);
+};
+
 /**
  * A workqueue.
  *
+ * By default all tasks are kept in a priority queue guarded by a mutex. When
+ * constructed with lockFree set to true, tasks are kept in one bounded lock-free
+ * ring per priority level instead, so that producers and workers don't contend
+ * on the mutex. The mutex is only taken to put idle workers to sleep, to wake them
+ * up and to spill tasks into a per-priority overflow list once a ring is full.
+ *
  * @ingroup base
  */
 class WorkQueue
@@ -53,7 +100,7 @@ class WorkQueue
 public:
 	typedef std::function<void (boost::exception_ptr)> ExceptionCallback;
 
-	WorkQueue(size_t maxItems = 0, int threadCount = 1, LogSeverity statsLogLevel = LogInformation);
+	WorkQueue(size_t maxItems = 0, int threadCount = 1, LogSeverity statsLogLevel = LogInformation, bool lockFree = false);
 	~WorkQueue();
 
 	void SetName(const String& name);
@@ -105,10 +152,50 @@ public:
 		ASSERT(offset == items.size());
 	}
 
+	/**
+	 * Like ParallelFor(), but balances items with very uneven costs across the worker threads
+	 * by letting idle workers steal from busy ones instead of splitting the items statically.
+	 *
+	 * The items must stay valid until the WorkQueue has been joined.
+	 */
+	template<typename VectorType, typename FuncType>
+	void ParallelForStealing(const VectorType& items, const FuncType& func)
+	{
+		size_t totalCount = items.size();
+
+		if (totalCount == 0)
+			return;
+
+		size_t shares = std::min<size_t>(std::max(m_ThreadCount, 1), totalCount);
+		auto state (std::make_shared<ParallelForState>(totalCount, shares));
+
+		auto lock = AcquireLock();
+
+		for (size_t i = 0; i < shares; i++) {
+			EnqueueUnlocked(lock, [&items, func, state, i, this]() {
+				size_t j, begin, end;
+				TaskFunction f = [&func, &items, &j]() {
+					func(items[j]);
+				};
+
+				while (state->GetChunk(i, begin, end)) {
+					for (j = begin; j < end; j++) {
+						RunTaskFunction(f);
+					}
+				}
+
+				if (state->FinishShare())
+					ReportParallelForSteals(*state);
+			});
+		}
+	}
+
 	bool IsWorkerThread() const;
+	bool IsLockFree() const;
 
 	size_t GetLength() const;
 	size_t GetTaskCount(RingBuffer::SizeType span);
+	size_t GetParallelForSteals() const;
 
 	void SetExceptionCallback(const ExceptionCallback& callback);
 
@@ -120,11 +207,22 @@ protected:
 	void IncreaseTaskCount();
 
 private:
+	struct LockFreeLevel
+	{
+		std::unique_ptr<LockFreeQueue<Task>> Ring;
+		std::deque<Task> Overflow;
+		std::atomic<size_t> OverflowCount{0};
+	};
+
+	/* Upper bound for the size of a single per-priority ring in lock-free mode. */
+	static constexpr size_t m_LockFreeRingSize = 16384;
+
 	int m_ID;
 	String m_Name;
 	static std::atomic<int> m_NextID;
 	int m_ThreadCount;
-	bool m_Spawned{false};
+	std::atomic<bool> m_Spawned{false};
+	bool m_LockFree;
 
 	mutable std::mutex m_Mutex;
 	std::condition_variable m_CVEmpty;
@@ -133,8 +231,12 @@ private:
 	boost::thread_group m_Threads;
 	size_t m_MaxItems;
 	bool m_Stopped{false};
-	int m_Processing{0};
+	std::atomic<int> m_Processing{0};
 	std::priority_queue<Task, std::deque<Task> > m_Tasks;
+	std::array<LockFreeLevel, 4> m_LockFreeLevels;
+	std::atomic<size_t> m_LockFreePending{0};
+	std::atomic<int> m_IdleWorkers{0};
+	std::atomic<int> m_FullWaiters{0};
 	int m_NextTaskID{0};
 	ExceptionCallback m_ExceptionCallback;
 	std::vector<boost::exception_ptr> m_Exceptions;
@@ -142,14 +244,22 @@ private:
 	double m_StatusTimerTimeout;
 	LogSeverity m_StatsLogLevel;
 
-	RingBuffer m_TaskStats;
+	ShardedRingBuffer m_TaskStats;
 	size_t m_PendingTasks{0};
 	double m_PendingTasksTimestamp{0};
+	std::atomic<size_t> m_ParallelForSteals{0};
+
+	void SpawnWorkersUnlocked();
+	void EnqueueLockFree(std::unique_lock<std::mutex>& lock, TaskFunction&& function, WorkQueuePriority priority);
+	bool DequeueLockFree(Task& task);
+	LockFreeLevel& GetLockFreeLevel(WorkQueuePriority priority);
 
 	void WorkerThreadProc();
+	void WorkerThreadProcLockFree();
 	void StatusTimerHandler();
 
 	void RunTaskFunction(const TaskFunction& func);
+	void ReportParallelForSteals(const ParallelForState& state);
 };
 
 }
@@ -2,6 +2,7 @@
 
 #include "checker/checkercomponent.hpp"
 #include "checker/checkercomponent-ti.cpp"
+#include "icinga/checkcommand.hpp"
 #include "icinga/icingaapplication.hpp"
 #include "icinga/cib.hpp"
 #include "remote/apilistener.hpp"
@@ -14,13 +15,24 @@
 #include "base/exception.hpp"
 #include "base/convert.hpp"
 #include "base/statsfunction.hpp"
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <map>
+#include <stdlib.h>
 
 using namespace icinga;
 
 REGISTER_TYPE(CheckerComponent);
 
 REGISTER_STATSFUNCTION(CheckerComponent, &CheckerComponent::StatsFunc);
+REGISTER_METRICS(&CheckerComponent::MetricsFunc);
+
+/* Thresholds of the adaptive concurrency control */
+static const double l_MaxTimeoutRate = 0.05;
+static const double l_MaxLoadPerCpu = 1.25;
+static const double l_MaxExecutionTimeIncrease = 2;
+static const double l_ConcurrencyDecreaseFactor = 0.75;
 
 void CheckerComponent::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
 {
@@ -30,21 +42,63 @@ void CheckerComponent::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr
 		unsigned long idle = checker->GetIdleCheckables();
 		unsigned long pending = checker->GetPendingCheckables();
 
-		nodes.emplace_back(checker->GetName(), new Dictionary({
+		Dictionary::Ptr stats = new Dictionary({
 			{ "idle", idle },
 			{ "pending", pending }
-		}));
+		});
+
+		if (checker->GetLoadSmoothingWindow() > 0) {
+			ArrayData plannedChecks;
+
+			for (unsigned checks : Checkable::GetPlannedChecks(60))
+				plannedChecks.emplace_back(checks);
+
+			stats->Set("load_smoothing_window", checker->GetLoadSmoothingWindow());
+			stats->Set("planned_checks", new Array(std::move(plannedChecks)));
+		}
 
 		String perfdata_prefix = "checkercomponent_" + checker->GetName() + "_";
 		perfdata->Add(new PerfdataValue(perfdata_prefix + "idle", Convert::ToDouble(idle)));
 		perfdata->Add(new PerfdataValue(perfdata_prefix + "pending", Convert::ToDouble(pending)));
+
+		if (checker->GetAdaptiveConcurrency()) {
+			Dictionary::Ptr concurrency = checker->GetAdaptiveConcurrencyStats();
+
+			stats->Set("adaptive_concurrency", concurrency);
+			perfdata->Add(new PerfdataValue(perfdata_prefix + "concurrency_limit", concurrency->Get("limit")));
+		}
+
+		if (checker->GetOverloadLatencyTarget() > 0) {
+			Dictionary::Ptr overload = checker->GetOverloadStats();
+
+			stats->Set("overload", overload);
+			perfdata->Add(new PerfdataValue(perfdata_prefix + "backlog", overload->Get("backlog"), false, "seconds"));
+		}
+
+		nodes.emplace_back(checker->GetName(), stats);
 	}
 
 	status->Set("checkercomponent", new Dictionary(std::move(nodes)));
 }
 
+void CheckerComponent::MetricsFunc(MetricsWriter& writer)
+{
+	for (const CheckerComponent::Ptr& checker : ConfigType::GetObjectsByType<CheckerComponent>()) {
+		MetricsWriter::Labels labels { { "checker", checker->GetName() } };
+
+		writer.AddGauge("icinga_checker_idle_checkables", "Checkables waiting for their next check", checker->GetIdleCheckables(), labels);
+		writer.AddGauge("icinga_checker_pending_checkables", "Checkables whose check is being executed", checker->GetPendingCheckables(), labels);
+	}
+}
+
 void CheckerComponent::OnConfigLoaded()
 {
+	for (int i = 0; i < GetSchedulerThreads(); i++)
+		m_Shards.emplace_back(new Shard());
+
+	/* Before the checkables plan their first checks in Checkable::Start() */
+	Checkable::SetLoadSmoothingWindow(GetLoadSmoothingWindow());
+
 	ConfigObject::OnActiveChanged.connect([this](const ConfigObject::Ptr& object, const Value&) {
 		ObjectHandler(object);
 	});
@@ -55,6 +109,25 @@ void CheckerComponent::OnConfigLoaded()
 	Checkable::OnNextCheckChanged.connect([this](const Checkable::Ptr& checkable, const Value&) {
 		NextCheckChangedHandler(checkable);
 	});
+
+	Checkable::OnNewCheckResult.connect([this](const Checkable::Ptr& checkable, const CheckResult::Ptr& cr, const MessageOrigin::Ptr& origin) {
+		CheckResultHandler(checkable, cr, origin);
+	});
+
+	TimePeriod::OnSegmentsChanged.connect([this](const TimePeriod::Ptr& tp, const Value&) {
+		SegmentsChangedHandler(tp);
+	});
+
+	/* Parked checks depend on them. */
+	Checkable::OnCheckPeriodRawChanged.connect([this](const Checkable::Ptr& checkable, const Value&) {
+		ParkingChangedHandler(checkable);
+	});
+	Checkable::OnCheckIntervalChanged.connect([this](const Checkable::Ptr& checkable, const Value&) {
+		ParkingChangedHandler(checkable);
+	});
+	Checkable::OnRetryIntervalChanged.connect([this](const Checkable::Ptr& checkable, const Value&) {
+		ParkingChangedHandler(checkable);
+	});
 }
 
 void CheckerComponent::Start(bool runtimeCreated)
@@ -64,8 +137,15 @@ void CheckerComponent::Start(bool runtimeCreated)
 	Log(LogInformation, "CheckerComponent")
 		<< "'" << GetName() << "' started.";
 
+	/* Set before the shard threads start, they'd consider a limit of 0 otherwise. */
+	m_ConcurrencyLimit.store(IcingaApplication::GetInstance()->GetMaxConcurrentChecks());
+	m_ConcurrencyReason = "initial";
+
+	for (auto& shard : m_Shards) {
+		Shard& ref (*shard);
 
-	m_Thread = std::thread([this]() { CheckThreadProc(); });
+		shard->Thread = std::thread([this, &ref]() { CheckThreadProc(ref); });
+	}
 
 	m_ResultTimer = Timer::Create();
 	m_ResultTimer->SetInterval(5);
@@ -75,14 +155,18 @@ void CheckerComponent::Start(bool runtimeCreated)
 
 void CheckerComponent::Stop(bool runtimeRemoved)
 {
-	{
-		std::unique_lock<std::mutex> lock(m_Mutex);
-		m_Stopped = true;
-		m_CV.notify_all();
+	for (auto& shard : m_Shards) {
+		std::unique_lock<std::mutex> lock(shard->Mutex);
+		shard->Stopped = true;
+		shard->CV.notify_all();
 	}
 
 	m_ResultTimer->Stop(true);
-	m_Thread.join();
+
+	for (auto& shard : m_Shards)
+		shard->Thread.join();
+
+	Checkable::SetLoadSmoothingWindow(0);
 
 	Log(LogInformation, "CheckerComponent")
 		<< "'" << GetName() << "' stopped.";
@@ -90,27 +174,58 @@ void CheckerComponent::Stop(bool runtimeRemoved)
 	ObjectImpl<CheckerComponent>::Stop(runtimeRemoved);
 }
 
-void CheckerComponent::CheckThreadProc()
+void CheckerComponent::ValidateSchedulerThreads(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<CheckerComponent>::ValidateSchedulerThreads(lvalue, utils);
+
+	if (lvalue() < 1 || lvalue() > 64)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "scheduler_threads" }, "Value must be between 1 and 64."));
+}
+
+void CheckerComponent::ValidateLoadSmoothingWindow(const Lazy<double>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<CheckerComponent>::ValidateLoadSmoothingWindow(lvalue, utils);
+
+	if (lvalue() < 0)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "load_smoothing_window" }, "Value must not be negative."));
+}
+
+void CheckerComponent::ValidateOverloadLatencyTarget(const Lazy<double>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<CheckerComponent>::ValidateOverloadLatencyTarget(lvalue, utils);
+
+	if (lvalue() < 0)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "overload_latency_target" }, "Value must not be negative."));
+}
+
+/**
+ * Each scheduler thread only handles the checkables of its own shard. As all of them
+ * share MaxConcurrentChecks, a check slot is reserved atomically before a check starts.
+ */
+void CheckerComponent::CheckThreadProc(Shard& shard)
 {
 	Utility::SetThreadName("Check Scheduler");
 	IcingaApplication::Ptr icingaApp = IcingaApplication::GetInstance();
 
-	std::unique_lock<std::mutex> lock(m_Mutex);
+	std::unique_lock<std::mutex> lock(shard.Mutex);
 
 	for (;;) {
 		typedef boost::multi_index::nth_index<CheckableSet, 1>::type CheckTimeView;
-		CheckTimeView& idx = boost::get<1>(m_IdleCheckables);
+		CheckTimeView& idx = boost::get<1>(shard.IdleCheckables);
 
-		while (idx.begin() == idx.end() && !m_Stopped)
-			m_CV.wait(lock);
+		while (idx.begin() == idx.end() && !shard.Stopped)
+			shard.CV.wait(lock);
 
-		if (m_Stopped)
+		if (shard.Stopped)
 			break;
 
 		auto it = idx.begin();
 		CheckableScheduleInfo csi = *it;
 
-		double wait = csi.NextCheck - Utility::GetTime();
+		double now = Utility::GetTime();
+		double wait = csi.NextCheck - now;
+
+		UpdateOverload(shard, -wait);
 
 //#ifdef I2_DEBUG
 //		Log(LogDebug, "CheckerComponent")
@@ -118,23 +233,29 @@ void CheckerComponent::CheckThreadProc()
 //			<< " vs. max concurrent checks " << icingaApp->GetMaxConcurrentChecks() << ".";
 //#endif /* I2_DEBUG */
 
-		if (Checkable::GetPendingChecks() >= icingaApp->GetMaxConcurrentChecks())
+		if (wait <= 0 && !Checkable::TryAquirePendingCheckSlot(GetEffectiveMaxConcurrentChecks(icingaApp))) {
+			m_ConcurrencySaturated.store(true);
 			wait = 0.5;
+		}
 
 		if (wait > 0) {
 			/* Wait for the next check. */
-			m_CV.wait_for(lock, std::chrono::duration<double>(wait));
+			shard.CV.wait_for(lock, std::chrono::duration<double>(wait));
 
 			continue;
 		}
 
+		if (shard.Overloaded)
+			csi = GetFirstDueByPriority(shard, now);
+
 		Checkable::Ptr checkable = csi.Object;
 
-		m_IdleCheckables.erase(checkable);
+		shard.IdleCheckables.erase(checkable);
 
 		bool forced = checkable->GetForceNextCheck();
 		bool check = true;
 		bool notifyNextCheck = false;
+		TimePeriod::Ptr parkPeriod;
 
 		if (!forced) {
 			if (!checkable->IsReachable(DependencyCheckExecution)) {
@@ -169,19 +290,25 @@ void CheckerComponent::CheckThreadProc()
 
 				check = false;
 				notifyNextCheck = true;
+				parkPeriod = tp;
 			}
 		}
 
 		/* reschedule the checkable if checks are disabled */
 		if (!check) {
-			m_IdleCheckables.insert(GetCheckableScheduleInfo(checkable));
+			shard.IdleCheckables.insert(GetCheckableScheduleInfo(checkable));
 			lock.unlock();
 
+			Checkable::DecreasePendingChecks();
+
 			Log(LogDebug, "CheckerComponent")
 				<< "Checks for checkable '" << checkable->GetName() << "' are disabled. Rescheduling check.";
 
 			checkable->UpdateNextCheck();
 
+			if (parkPeriod)
+				ParkCheckable(checkable, parkPeriod);
+
 			if (notifyNextCheck) {
 				// Trigger update event for Icinga DB
 				Checkable::OnNextCheckUpdated(checkable);
@@ -201,7 +328,7 @@ void CheckerComponent::CheckThreadProc()
 			<< csi.Object->GetName() << "', Next Check: "
 			<< Utility::FormatDateTime("%Y-%m-%d %H:%M:%S %z", csi.NextCheck) << "(" << csi.NextCheck << ").";
 
-		m_PendingCheckables.insert(csi);
+		shard.PendingCheckables.insert(csi);
 
 		lock.unlock();
 
@@ -213,8 +340,6 @@ void CheckerComponent::CheckThreadProc()
 		Log(LogDebug, "CheckerComponent")
 			<< "Executing check for '" << checkable->GetName() << "'";
 
-		Checkable::IncreasePendingChecks();
-
 		/*
 		 * Explicitly use CheckerComponent::Ptr to keep the reference counted while the
 		 * callback is active and making it crash safe
@@ -252,20 +377,21 @@ void CheckerComponent::ExecuteCheckHelper(const Checkable::Ptr& checkable)
 	Checkable::DecreasePendingChecks();
 
 	{
-		std::unique_lock<std::mutex> lock(m_Mutex);
+		Shard& shard (GetShard(checkable));
+		std::unique_lock<std::mutex> lock(shard.Mutex);
 
 		/* remove the object from the list of pending objects; if it's not in the
 		 * list this was a manual (i.e. forced) check and we must not re-add the
 		 * object to the list because it's already there. */
-		auto it = m_PendingCheckables.find(checkable);
+		auto it = shard.PendingCheckables.find(checkable);
 
-		if (it != m_PendingCheckables.end()) {
-			m_PendingCheckables.erase(it);
+		if (it != shard.PendingCheckables.end()) {
+			shard.PendingCheckables.erase(it);
 
 			if (checkable->IsActive())
-				m_IdleCheckables.insert(GetCheckableScheduleInfo(checkable));
+				shard.IdleCheckables.insert(GetCheckableScheduleInfo(checkable));
 
-			m_CV.notify_all();
+			shard.CV.notify_all();
 		}
 	}
 
@@ -273,17 +399,219 @@ void CheckerComponent::ExecuteCheckHelper(const Checkable::Ptr& checkable)
 		<< "Check finished for object '" << checkable->GetName() << "'";
 }
 
-void CheckerComponent::ResultTimerHandler()
+/**
+ * @returns MaxConcurrentChecks, or less if reduced by the adaptive concurrency control
+ */
+int CheckerComponent::GetEffectiveMaxConcurrentChecks(const IcingaApplication::Ptr& icingaApp)
 {
-	std::ostringstream msgbuf;
+	int maxChecks = icingaApp->GetMaxConcurrentChecks();
 
-	{
-		std::unique_lock<std::mutex> lock(m_Mutex);
+	if (GetAdaptiveConcurrency())
+		maxChecks = std::min(maxChecks, m_ConcurrencyLimit.load());
+
+	return maxChecks;
+}
+
+void CheckerComponent::CheckResultHandler(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr, const MessageOrigin::Ptr& origin)
+{
+	if (!GetAdaptiveConcurrency() || !cr->GetActive() || (origin && !origin->IsLocal()))
+		return;
+
+	auto command (checkable->GetCheckCommand());
+
+	if (!command)
+		return;
+
+	auto timeout (checkable->GetCheckTimeout());
+	double executionTime = cr->CalculateExecutionTime();
+
+	/* Processes are killed once their timeout is exceeded. */
+	bool timedOut = executionTime >= (timeout.IsEmpty() ? command->GetTimeout() : (double)timeout);
+
+	std::unique_lock<std::mutex> lock(m_ConcurrencyMutex);
+
+	m_WindowChecks++;
+	m_WindowExecutionTime += executionTime;
+
+	if (timedOut)
+		m_WindowTimeouts++;
+}
+
+/**
+ * Adjusts the concurrency limit based on the check results since the previous call
+ * (additive increase, multiplicative decrease). The limit is decreased if too many checks
+ * time out, if the CPUs are overloaded or if the checks take much longer than usual.
+ * It's increased while the checker is running into it without any of these symptoms.
+ */
+void CheckerComponent::AdjustConcurrencyLimit()
+{
+	int maxChecks = IcingaApplication::GetInstance()->GetMaxConcurrentChecks();
+	int minChecks = std::max(1, maxChecks / 16);
+	double loadPerCpu = -1;
+
+#ifndef _WIN32
+	double loadAvg[1];
+
+	if (getloadavg(loadAvg, 1) == 1)
+		loadPerCpu = loadAvg[0] / std::max(1u, std::thread::hardware_concurrency());
+#endif /* _WIN32 */
+
+	std::unique_lock<std::mutex> lock(m_ConcurrencyMutex);
+
+	auto checks (m_WindowChecks);
+	double avgExecutionTime = checks ? m_WindowExecutionTime / checks : 0;
+	double timeoutRate = checks ? (double)m_WindowTimeouts / checks : 0;
+
+	m_WindowChecks = 0;
+	m_WindowTimeouts = 0;
+	m_WindowExecutionTime = 0;
+
+	int limit = m_ConcurrencyLimit.load();
+	int oldLimit = limit;
+	bool slow = checks && m_BaselineExecutionTime > 0 && avgExecutionTime > m_BaselineExecutionTime * l_MaxExecutionTimeIncrease;
+
+	if (timeoutRate > l_MaxTimeoutRate) {
+		limit = limit * l_ConcurrencyDecreaseFactor;
+		m_ConcurrencyReason = "timeout rate";
+	} else if (loadPerCpu > l_MaxLoadPerCpu) {
+		limit = limit * l_ConcurrencyDecreaseFactor;
+		m_ConcurrencyReason = "load average";
+	} else if (slow) {
+		limit = limit * l_ConcurrencyDecreaseFactor;
+		m_ConcurrencyReason = "execution time";
+	} else if (m_ConcurrencySaturated.exchange(false)) {
+		limit += std::max(1, maxChecks / 32);
+		m_ConcurrencyReason = "saturated";
+	} else {
+		m_ConcurrencyReason = "steady";
+	}
+
+	/* Follow decreases of the usual execution time at once, but increases only slowly. */
+	if (checks) {
+		if (m_BaselineExecutionTime <= 0 || avgExecutionTime < m_BaselineExecutionTime)
+			m_BaselineExecutionTime = avgExecutionTime;
+		else
+			m_BaselineExecutionTime += (avgExecutionTime - m_BaselineExecutionTime) * (slow ? 0.01 : 0.05);
+	}
+
+	limit = std::min(maxChecks, std::max(minChecks, limit));
+
+	m_ConcurrencyLimit.store(limit);
+	m_AvgExecutionTime = avgExecutionTime;
+	m_TimeoutRate = timeoutRate;
+	m_LoadPerCpu = loadPerCpu;
+
+	if (limit < oldLimit) {
+		Log(LogInformation, "CheckerComponent")
+			<< "Reducing concurrent checks from " << oldLimit << " to " << limit << " due to " << m_ConcurrencyReason << ".";
+	}
+}
 
-		msgbuf << "Pending checkables: " << m_PendingCheckables.size() << "; Idle checkables: " << m_IdleCheckables.size() << "; Checks/s: "
-			<< (CIB::GetActiveHostChecksStatistics(60) + CIB::GetActiveServiceChecksStatistics(60)) / 60.0;
+Dictionary::Ptr CheckerComponent::GetAdaptiveConcurrencyStats()
+{
+	std::unique_lock<std::mutex> lock(m_ConcurrencyMutex);
+
+	return new Dictionary({
+		{ "limit", m_ConcurrencyLimit.load() },
+		{ "reason", m_ConcurrencyReason },
+		{ "avg_execution_time", m_AvgExecutionTime },
+		{ "baseline_execution_time", m_BaselineExecutionTime },
+		{ "timeout_rate", m_TimeoutRate },
+		{ "load_per_cpu", m_LoadPerCpu }
+	});
+}
+
+/**
+ * Enters the overload mode of the shard once its earliest due check is late by more than
+ * overload_latency_target and leaves it once that one is late by less than half of it.
+ *
+ * @param backlog How late the earliest due check is (negative if none is due yet).
+ */
+void CheckerComponent::UpdateOverload(Shard& shard, double backlog)
+{
+	double target = GetOverloadLatencyTarget();
+
+	if (target <= 0) {
+		shard.Overloaded = false;
+	} else if (!shard.Overloaded && backlog > target) {
+		shard.Overloaded = true;
+
+		Log(LogInformation, "CheckerComponent")
+			<< "Checks are running " << Utility::FormatDuration(backlog) << " late. Running the ones with the highest priority first.";
+	} else if (shard.Overloaded && backlog < target / 2) {
+		shard.Overloaded = false;
+
+		Log(LogInformation, "CheckerComponent", "Checks have caught up. Running them in order again.");
+	}
+}
+
+/**
+ * @returns The earliest due check of the highest priority class which has any due check.
+ */
+CheckableScheduleInfo CheckerComponent::GetFirstDueByPriority(Shard& shard, double now)
+{
+	auto& idx (boost::get<2>(shard.IdleCheckables));
+
+	/* The first checkable of each class is the earliest one of it. */
+	for (auto it (idx.begin()); it != idx.end(); it = idx.upper_bound(boost::make_tuple(it->Priority))) {
+		if (it->NextCheck <= now)
+			return *it;
 	}
 
+	return *boost::get<1>(shard.IdleCheckables).begin();
+}
+
+/**
+ * @returns Whether any shard is overloaded and how late the earliest due check of each delayed priority class is.
+ */
+Dictionary::Ptr CheckerComponent::GetOverloadStats()
+{
+	double now = Utility::GetTime();
+	bool overloaded = false;
+	std::map<int, double> delays;
+
+	for (auto& shard : m_Shards) {
+		std::unique_lock<std::mutex> lock(shard->Mutex);
+
+		overloaded = overloaded || shard->Overloaded;
+
+		auto& idx (boost::get<2>(shard->IdleCheckables));
+
+		for (auto it (idx.begin()); it != idx.end(); it = idx.upper_bound(boost::make_tuple(it->Priority))) {
+			if (it->NextCheck < now) {
+				auto& delay (delays[it->Priority]);
+
+				delay = std::max(delay, now - it->NextCheck);
+			}
+		}
+	}
+
+	Dictionary::Ptr delayedClasses = new Dictionary();
+	double backlog = 0;
+
+	for (auto& kv : delays) {
+		delayedClasses->Set(Convert::ToString(kv.first), kv.second);
+		backlog = std::max(backlog, kv.second);
+	}
+
+	return new Dictionary({
+		{ "latency_target", GetOverloadLatencyTarget() },
+		{ "overloaded", overloaded },
+		{ "backlog", backlog },
+		{ "delayed_classes", delayedClasses }
+	});
+}
+
+void CheckerComponent::ResultTimerHandler()
+{
+	if (GetAdaptiveConcurrency())
+		AdjustConcurrencyLimit();
+
+	std::ostringstream msgbuf;
+
+	msgbuf << "Pending checkables: " << GetPendingCheckables() << "; Idle checkables: " << GetIdleCheckables() << "; Checks/s: "
+		<< (CIB::GetActiveHostChecksStatistics(60) + CIB::GetActiveServiceChecksStatistics(60)) / 60.0;
+
 	Log(LogNotice, "CheckerComponent", msgbuf.str());
 }
 
@@ -297,21 +625,29 @@ void CheckerComponent::ObjectHandler(const ConfigObject::Ptr& object)
 	Zone::Ptr zone = Zone::GetByName(checkable->GetZoneName());
 	bool same_zone = (!zone || Zone::GetLocalZone() == zone);
 
+	bool scheduled = false;
+
 	{
-		std::unique_lock<std::mutex> lock(m_Mutex);
+		Shard& shard (GetShard(checkable));
+		std::unique_lock<std::mutex> lock(shard.Mutex);
 
 		if (object->IsActive() && !object->IsPaused() && same_zone) {
-			if (m_PendingCheckables.find(checkable) != m_PendingCheckables.end())
+			if (shard.PendingCheckables.find(checkable) != shard.PendingCheckables.end())
 				return;
 
-			m_IdleCheckables.insert(GetCheckableScheduleInfo(checkable));
+			shard.IdleCheckables.insert(GetCheckableScheduleInfo(checkable));
+			scheduled = true;
 		} else {
-			m_IdleCheckables.erase(checkable);
-			m_PendingCheckables.erase(checkable);
+			shard.IdleCheckables.erase(checkable);
+			shard.PendingCheckables.erase(checkable);
 		}
 
-		m_CV.notify_all();
+		shard.CV.notify_all();
 	}
+
+	/* The postponed next check is restored from the state file, but not which segment it was parked for. */
+	if (scheduled && checkable->GetCheckPeriod())
+		ReparkCheckable(checkable);
 }
 
 CheckableScheduleInfo CheckerComponent::GetCheckableScheduleInfo(const Checkable::Ptr& checkable)
@@ -319,16 +655,225 @@ CheckableScheduleInfo CheckerComponent::GetCheckableScheduleInfo(const Checkable
 	CheckableScheduleInfo csi;
 	csi.Object = checkable;
 	csi.NextCheck = checkable->GetNextCheck();
+	csi.Priority = checkable->GetCheckPriority();
 	return csi;
 }
 
+/**
+ * Distributes the checkables evenly across the shards.
+ */
+CheckerComponent::Shard& CheckerComponent::GetShard(const Checkable::Ptr& checkable)
+{
+	auto hash (reinterpret_cast<uintptr_t>(checkable.get()));
+
+	/* Objects are aligned, so the lowest bits of their addresses don't vary. */
+	hash ^= (hash >> 7u) ^ (hash >> 17u);
+
+	return *m_Shards[hash % m_Shards.size()];
+}
+
+/**
+ * @returns The first of nextCheck plus whole intervals which is inside the next segment of tp,
+ * or nextCheck itself if that one is inside tp already or tp doesn't know any next segment.
+ */
+static double ShiftIntoNextSegment(const TimePeriod::Ptr& tp, double nextCheck, double interval)
+{
+	if (tp->IsInside(nextCheck))
+		return nextCheck;
+
+	double segmentStart = tp->FindNextTransition(nextCheck);
+
+	if (segmentStart < 0) {
+		/* Segments are only known up to there, but it's "inside" after that. */
+		Value validEnd = tp->GetValidEnd();
+
+		if (validEnd.IsEmpty() || static_cast<double>(validEnd) <= nextCheck)
+			return nextCheck;
+
+		segmentStart = validEnd;
+	}
+
+	/* Segments don't include their begin. */
+	return nextCheck + (std::floor((segmentStart - nextCheck) / interval) + 1) * interval;
+}
+
+/**
+ * @returns The interval Checkable::UpdateNextCheck() schedules the checks of the checkable with.
+ */
+static double GetScheduleInterval(const Checkable::Ptr& checkable)
+{
+	double interval;
+
+	if (checkable->GetStateType() == StateTypeSoft && checkable->GetLastCheckResult())
+		interval = checkable->GetRetryInterval();
+	else
+		interval = checkable->GetCheckInterval();
+
+	return std::max(interval, 1.0);
+}
+
+/**
+ * Moves the next check of a checkable outside its check period into the next segment of that period,
+ * so that it isn't woken up at every interval until then. It keeps its usual offset within the interval.
+ */
+void CheckerComponent::ParkCheckable(const Checkable::Ptr& checkable, const TimePeriod::Ptr& tp)
+{
+	double nextCheck = checkable->GetNextCheck();
+	double parked = ShiftIntoNextSegment(tp, nextCheck, GetScheduleInterval(checkable));
+
+	if (parked == nextCheck)
+		return;
+
+	Log(LogDebug, "CheckerComponent")
+		<< "Postponing checks for object '" << checkable->GetName() << "' until "
+		<< Utility::FormatDateTime("%Y-%m-%d %H:%M:%S %z", parked) << " as it's not in check period '" << tp->GetName() << "'.";
+
+	checkable->SetNextCheck(parked);
+
+	std::unique_lock<std::mutex> lock(m_ParkedMutex);
+	m_ParkedCheckables[tp][checkable] = parked;
+}
+
+/**
+ * Moves the next check of a checkable which is more than an interval ahead, i.e. parked by ParkCheckable(),
+ * according to its current check period and interval. The check is back at its usual time, unless
+ * that's still not inside the check period.
+ */
+void CheckerComponent::ReparkCheckable(const Checkable::Ptr& checkable)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_ParkedMutex);
+
+		for (auto it (m_ParkedCheckables.begin()); it != m_ParkedCheckables.end();) {
+			it->second.erase(checkable);
+
+			if (it->second.empty())
+				it = m_ParkedCheckables.erase(it);
+			else
+				++it;
+		}
+	}
+
+	double now = Utility::GetTime();
+	double interval = GetScheduleInterval(checkable);
+	double parked = checkable->GetNextCheck();
+
+	if (!checkable->IsActive() || parked <= now + interval)
+		return;
+
+	/* The next check as if it hadn't been parked */
+	double nextCheck = parked - std::floor((parked - now) / interval) * interval;
+	TimePeriod::Ptr tp = checkable->GetCheckPeriod();
+	double reparked = tp ? ShiftIntoNextSegment(tp, nextCheck, interval) : nextCheck;
+
+	if (reparked != parked) {
+		Log(LogDebug, "CheckerComponent")
+			<< "Moving the postponed check of object '" << checkable->GetName() << "' to "
+			<< Utility::FormatDateTime("%Y-%m-%d %H:%M:%S %z", reparked) << ".";
+
+		checkable->SetNextCheck(reparked);
+	}
+
+	if (reparked != nextCheck) {
+		std::unique_lock<std::mutex> lock(m_ParkedMutex);
+		m_ParkedCheckables[tp][checkable] = reparked;
+	}
+}
+
+/**
+ * Re-parks a parked checkable after its check period or interval changed.
+ */
+void CheckerComponent::ParkingChangedHandler(const Checkable::Ptr& checkable)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_ParkedMutex);
+
+		if (std::none_of(m_ParkedCheckables.begin(), m_ParkedCheckables.end(),
+			[&checkable](const decltype(m_ParkedCheckables)::value_type& kv) { return kv.second.find(checkable) != kv.second.end(); }))
+			return;
+	}
+
+	ReparkCheckable(checkable);
+}
+
+void CheckerComponent::SegmentsChangedHandler(const TimePeriod::Ptr& tp)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_ParkedMutex);
+
+		if (m_ParkedCheckables.find(tp) == m_ParkedCheckables.end())
+			return;
+	}
+
+	/* The time period is locked while its segments are changed. */
+	CheckerComponent::Ptr checkComponent(this);
+
+	Utility::QueueAsyncCallback([this, checkComponent, tp]() { RescheduleParkedCheckables(tp); });
+}
+
+/**
+ * Moves the parked checks of the given time period's checkables according to its changed segments.
+ */
+void CheckerComponent::RescheduleParkedCheckables(const TimePeriod::Ptr& tp)
+{
+	std::map<Checkable::Ptr, double> parked;
+
+	{
+		std::unique_lock<std::mutex> lock(m_ParkedMutex);
+		auto it (m_ParkedCheckables.find(tp));
+
+		if (it == m_ParkedCheckables.end())
+			return;
+
+		parked = std::move(it->second);
+		m_ParkedCheckables.erase(it);
+	}
+
+	double now = Utility::GetTime();
+	std::map<Checkable::Ptr, double> stillParked;
+
+	for (auto& kv : parked) {
+		auto& checkable (kv.first);
+
+		/* Not parked anymore if it has been checked or rescheduled meanwhile. */
+		if (kv.second <= now || !checkable->IsActive() || checkable->GetNextCheck() != kv.second)
+			continue;
+
+		if (checkable->GetCheckPeriod() != tp) {
+			ReparkCheckable(checkable);
+			continue;
+		}
+
+		double interval = GetScheduleInterval(checkable);
+
+		/* The next check as if it hadn't been parked */
+		double nextCheck = kv.second - std::floor((kv.second - now) / interval) * interval;
+		double reparked = ShiftIntoNextSegment(tp, nextCheck, interval);
+
+		if (reparked != kv.second)
+			checkable->SetNextCheck(reparked);
+
+		if (reparked != nextCheck)
+			stillParked.emplace(checkable, reparked);
+	}
+
+	if (stillParked.empty())
+		return;
+
+	std::unique_lock<std::mutex> lock(m_ParkedMutex);
+
+	/* Those parked meanwhile are more recent. */
+	m_ParkedCheckables[tp].insert(stillParked.begin(), stillParked.end());
+}
+
 void CheckerComponent::NextCheckChangedHandler(const Checkable::Ptr& checkable)
 {
-	std::unique_lock<std::mutex> lock(m_Mutex);
+	Shard& shard (GetShard(checkable));
+	std::unique_lock<std::mutex> lock(shard.Mutex);
 
 	/* remove and re-insert the object from the set in order to force an index update */
 	typedef boost::multi_index::nth_index<CheckableSet, 0>::type CheckableView;
-	CheckableView& idx = boost::get<0>(m_IdleCheckables);
+	CheckableView& idx = boost::get<0>(shard.IdleCheckables);
 
 	auto it = idx.find(checkable);
 
@@ -340,19 +885,31 @@ void CheckerComponent::NextCheckChangedHandler(const Checkable::Ptr& checkable)
 	CheckableScheduleInfo csi = GetCheckableScheduleInfo(checkable);
 	idx.insert(csi);
 
-	m_CV.notify_all();
+	shard.CV.notify_all();
 }
 
 unsigned long CheckerComponent::GetIdleCheckables()
 {
-	std::unique_lock<std::mutex> lock(m_Mutex);
+	unsigned long count = 0;
 
-	return m_IdleCheckables.size();
+	for (auto& shard : m_Shards) {
+		std::unique_lock<std::mutex> lock(shard->Mutex);
+
+		count += shard->IdleCheckables.size();
+	}
+
+	return count;
 }
 
 unsigned long CheckerComponent::GetPendingCheckables()
 {
-	std::unique_lock<std::mutex> lock(m_Mutex);
+	unsigned long count = 0;
+
+	for (auto& shard : m_Shards) {
+		std::unique_lock<std::mutex> lock(shard->Mutex);
+
+		count += shard->PendingCheckables.size();
+	}
 
-	return m_PendingCheckables.size();
+	return count;
 }
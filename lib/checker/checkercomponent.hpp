@@ -5,15 +5,23 @@
 
 #include "checker/checkercomponent-ti.hpp"
 #include "icinga/service.hpp"
+#include "icinga/icingaapplication.hpp"
 #include "base/configobject.hpp"
 #include "base/timer.hpp"
 #include "base/utility.hpp"
+#include "base/metrics.hpp"
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/key_extractors.hpp>
+#include <boost/multi_index/composite_key.hpp>
+#include <atomic>
 #include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 namespace icinga
 {
@@ -25,6 +33,7 @@ struct CheckableScheduleInfo
 {
 	Checkable::Ptr Object;
 	double NextCheck;
+	int Priority;
 };
 
 /**
@@ -43,6 +52,17 @@ struct CheckableNextCheckExtractor
 	}
 };
 
+/**
+ * Orders by priority (highest first), then by next check.
+ *
+ * @ingroup checker
+ */
+typedef boost::multi_index::composite_key<
+	CheckableScheduleInfo,
+	boost::multi_index::member<CheckableScheduleInfo, int, &CheckableScheduleInfo::Priority>,
+	boost::multi_index::member<CheckableScheduleInfo, double, &CheckableScheduleInfo::NextCheck>
+> CheckablePriorityKey;
+
 /**
  * @ingroup checker
  */
@@ -56,7 +76,8 @@ public:
 		CheckableScheduleInfo,
 		boost::multi_index::indexed_by<
 			boost::multi_index::ordered_unique<boost::multi_index::member<CheckableScheduleInfo, Checkable::Ptr, &CheckableScheduleInfo::Object> >,
-			boost::multi_index::ordered_non_unique<CheckableNextCheckExtractor>
+			boost::multi_index::ordered_non_unique<CheckableNextCheckExtractor>,
+			boost::multi_index::ordered_non_unique<CheckablePriorityKey, boost::multi_index::composite_key_compare<std::greater<int>, std::less<double>>>
 		>
 	> CheckableSet;
 
@@ -65,25 +86,67 @@ public:
 	void Stop(bool runtimeRemoved) override;
 
 	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+	static void MetricsFunc(MetricsWriter& writer);
 	unsigned long GetIdleCheckables();
 	unsigned long GetPendingCheckables();
+	Dictionary::Ptr GetAdaptiveConcurrencyStats();
+	Dictionary::Ptr GetOverloadStats();
 
-private:
-	std::mutex m_Mutex;
-	std::condition_variable m_CV;
-	bool m_Stopped{false};
-	std::thread m_Thread;
+	void ValidateSchedulerThreads(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
+	void ValidateLoadSmoothingWindow(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
+	void ValidateOverloadLatencyTarget(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
 
-	CheckableSet m_IdleCheckables;
-	CheckableSet m_PendingCheckables;
+private:
+	/**
+	 * A partition of the checkables with its own schedule and scheduler thread.
+	 */
+	struct Shard
+	{
+		std::mutex Mutex;
+		std::condition_variable CV;
+		bool Stopped{false};
+		std::thread Thread;
+
+		CheckableSet IdleCheckables;
+		CheckableSet PendingCheckables;
+
+		/* Whether the due checks are late by more than overload_latency_target, see UpdateOverload() */
+		bool Overloaded{false};
+	};
+
+	std::vector<std::unique_ptr<Shard>> m_Shards;
+
+	/* Adaptive concurrency control, see AdjustConcurrencyLimit() */
+	std::atomic<int> m_ConcurrencyLimit{0};
+	std::atomic<bool> m_ConcurrencySaturated{false};
+	std::mutex m_ConcurrencyMutex;
+	String m_ConcurrencyReason;
+	double m_BaselineExecutionTime{0};
+	double m_AvgExecutionTime{0};
+	double m_TimeoutRate{0};
+	double m_LoadPerCpu{-1};
+	unsigned long m_WindowChecks{0};
+	unsigned long m_WindowTimeouts{0};
+	double m_WindowExecutionTime{0};
 
 	Timer::Ptr m_ResultTimer;
 
-	void CheckThreadProc();
+	/* Checkables whose next check has been moved into the next segment of their check period, see ParkCheckable() */
+	std::mutex m_ParkedMutex;
+	std::map<TimePeriod::Ptr, std::map<Checkable::Ptr, double>> m_ParkedCheckables;
+
+	void CheckThreadProc(Shard& shard);
 	void ResultTimerHandler();
 
 	void ExecuteCheckHelper(const Checkable::Ptr& checkable);
 
+	int GetEffectiveMaxConcurrentChecks(const IcingaApplication::Ptr& icingaApp);
+	void CheckResultHandler(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr, const MessageOrigin::Ptr& origin);
+	void AdjustConcurrencyLimit();
+
+	void UpdateOverload(Shard& shard, double backlog);
+	static CheckableScheduleInfo GetFirstDueByPriority(Shard& shard, double now);
+
 	void AdjustCheckTimer();
 
 	void ObjectHandler(const ConfigObject::Ptr& object);
@@ -91,6 +154,14 @@ private:
 
 	void RescheduleCheckTimer();
 
+	void ParkCheckable(const Checkable::Ptr& checkable, const TimePeriod::Ptr& tp);
+	void ReparkCheckable(const Checkable::Ptr& checkable);
+	void ParkingChangedHandler(const Checkable::Ptr& checkable);
+	void SegmentsChangedHandler(const TimePeriod::Ptr& tp);
+	void RescheduleParkedCheckables(const TimePeriod::Ptr& tp);
+
+	Shard& GetShard(const Checkable::Ptr& checkable);
+
 	static CheckableScheduleInfo GetCheckableScheduleInfo(const Checkable::Ptr& checkable);
 };
 
@@ -0,0 +1,464 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "checker/passiveresultlistener.hpp"
+#include "checker/passiveresultlistener-ti.cpp"
+#include "icinga/host.hpp"
+#include "icinga/service.hpp"
+#include "icinga/pluginutility.hpp"
+#include "remote/filterutility.hpp"
+#include "config/expression.hpp"
+#include "base/configtype.hpp"
+#include "base/convert.hpp"
+#include "base/exception.hpp"
+#include "base/io-engine.hpp"
+#include "base/logger.hpp"
+#include "base/perfdatavalue.hpp"
+#include "base/scriptframe.hpp"
+#include "base/statsfunction.hpp"
+#include "base/tlsutility.hpp"
+#include "base/utility.hpp"
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/post.hpp>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+#ifndef _WIN32
+#	include <unistd.h>
+#endif /* _WIN32 */
+
+using namespace icinga;
+
+REGISTER_TYPE(PassiveResultListener);
+
+REGISTER_STATSFUNCTION(PassiveResultListener, &PassiveResultListener::StatsFunc);
+REGISTER_METRICS(&PassiveResultListener::MetricsFunc);
+
+/* Larger than any UDP datagram. */
+static const size_t l_MaxDatagramSize = 64 * 1024;
+
+/* Datagrams received at once are processed by one task. */
+static const size_t l_MaxBatchSize = 256;
+
+/* Further datagrams are dropped while that many batches are waiting to be processed. */
+static const size_t l_MaxPendingBatches = 1024;
+
+/* Further datagrams are dropped while the HMACs of that many are remembered, see IsReplayed(). */
+static const size_t l_MaxSeenDigests = 1024 * 1024;
+
+void PassiveResultListener::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
+{
+	DictionaryData nodes;
+
+	for (const PassiveResultListener::Ptr& listener : ConfigType::GetObjectsByType<PassiveResultListener>()) {
+		double results = listener->m_Results.load();
+		double invalidResults = listener->m_InvalidResults.load();
+		double rejectedDatagrams = listener->m_RejectedDatagrams.load();
+		double droppedDatagrams = listener->m_DroppedDatagrams.load();
+		double replayedDatagrams = listener->m_ReplayedDatagrams.load();
+
+		nodes.emplace_back(listener->GetName(), new Dictionary({
+			{ "results", results },
+			{ "invalid_results", invalidResults },
+			{ "rejected_datagrams", rejectedDatagrams },
+			{ "dropped_datagrams", droppedDatagrams },
+			{ "replayed_datagrams", replayedDatagrams }
+		}));
+
+		String perfdata_prefix = "passiveresultlistener_" + listener->GetName() + "_";
+		perfdata->Add(new PerfdataValue(perfdata_prefix + "results", results, true));
+		perfdata->Add(new PerfdataValue(perfdata_prefix + "invalid_results", invalidResults, true));
+		perfdata->Add(new PerfdataValue(perfdata_prefix + "rejected_datagrams", rejectedDatagrams, true));
+		perfdata->Add(new PerfdataValue(perfdata_prefix + "dropped_datagrams", droppedDatagrams, true));
+		perfdata->Add(new PerfdataValue(perfdata_prefix + "replayed_datagrams", replayedDatagrams, true));
+	}
+
+	status->Set("passiveresultlistener", new Dictionary(std::move(nodes)));
+}
+
+void PassiveResultListener::MetricsFunc(MetricsWriter& writer)
+{
+	for (const PassiveResultListener::Ptr& listener : ConfigType::GetObjectsByType<PassiveResultListener>()) {
+		MetricsWriter::Labels labels { { "listener", listener->GetName() } };
+
+		writer.AddCounter("icinga_passive_results_total", "Passive check results processed", listener->m_Results.load(), labels);
+		writer.AddCounter("icinga_passive_results_invalid_total", "Passive check results for unknown or inaccessible objects or malformed", listener->m_InvalidResults.load(), labels);
+		writer.AddCounter("icinga_passive_datagrams_rejected_total", "Datagrams which failed authentication", listener->m_RejectedDatagrams.load(), labels);
+		writer.AddCounter("icinga_passive_datagrams_dropped_total", "Datagrams dropped due to the processing falling behind", listener->m_DroppedDatagrams.load(), labels);
+		writer.AddCounter("icinga_passive_datagrams_replayed_total", "Datagrams rejected due to having been accepted before", listener->m_ReplayedDatagrams.load(), labels);
+	}
+}
+
+void PassiveResultListener::Start(bool runtimeCreated)
+{
+	namespace asio = boost::asio;
+
+	ObjectImpl<PassiveResultListener>::Start(runtimeCreated);
+
+	m_ResultQueue.SetName("PassiveResultListener, " + GetName());
+
+	auto& io (IoEngine::Get().GetIoContext());
+	m_Strand = Shared<asio::io_context::strand>::Make(io);
+
+	String socketPath = GetSocketPath();
+
+	try {
+		if (!socketPath.IsEmpty()) {
+#ifndef _WIN32
+			using Socket = asio::local::datagram_protocol::socket;
+
+			(void)unlink(socketPath.CStr());
+
+			auto socket (Shared<Socket>::Make(io, asio::local::datagram_protocol::endpoint(socketPath.GetData())));
+			socket->set_option(asio::socket_base::receive_buffer_size(4 * 1024 * 1024));
+			socket->non_blocking(true);
+
+			m_UnixSocket = socket;
+
+			IoEngine::SpawnCoroutine(*m_Strand, [this, socket](asio::yield_context yc) { ReceiveLoop<Socket>(yc, socket); });
+
+			Log(LogInformation, "PassiveResultListener")
+				<< "'" << GetName() << "' started, listening on '" << socketPath << "'.";
+#else /* _WIN32 */
+			Log(LogCritical, "PassiveResultListener")
+				<< "'" << GetName() << "': UNIX sockets (socket_path) aren't supported on Windows.";
+#endif /* _WIN32 */
+			return;
+		}
+
+		using Socket = asio::ip::udp::socket;
+
+		asio::ip::udp::resolver resolver (io);
+		auto endpoint (*resolver.resolve(GetBindHost().GetData(), GetBindPort().GetData()).begin());
+
+		auto socket (Shared<Socket>::Make(io, endpoint.endpoint().protocol()));
+		socket->set_option(asio::socket_base::reuse_address(true));
+		socket->set_option(asio::socket_base::receive_buffer_size(4 * 1024 * 1024));
+		socket->bind(endpoint.endpoint());
+		socket->non_blocking(true);
+
+		m_UdpSocket = socket;
+
+		IoEngine::SpawnCoroutine(*m_Strand, [this, socket](asio::yield_context yc) { ReceiveLoop<Socket>(yc, socket); });
+
+		Log(LogInformation, "PassiveResultListener")
+			<< "'" << GetName() << "' started, listening on '[" << endpoint.endpoint().address() << "]:"
+			<< endpoint.endpoint().port() << "'.";
+	} catch (const std::exception& ex) {
+		Log(LogCritical, "PassiveResultListener")
+			<< "'" << GetName() << "' cannot listen on '" << (socketPath.IsEmpty() ? "[" + GetBindHost() + "]:" + GetBindPort() : socketPath)
+			<< "': " << DiagnosticInformation(ex, false);
+	}
+}
+
+void PassiveResultListener::Stop(bool runtimeRemoved)
+{
+	auto udpSocket (m_UdpSocket);
+#ifndef _WIN32
+	auto unixSocket (m_UnixSocket);
+#endif /* _WIN32 */
+
+	/* Closing the sockets lets the receiving coroutines return. */
+	if (m_Strand) {
+		boost::asio::post(*m_Strand, [udpSocket
+#ifndef _WIN32
+			, unixSocket
+#endif /* _WIN32 */
+		]() {
+			boost::system::error_code ec;
+
+			if (udpSocket)
+				udpSocket->close(ec);
+
+#ifndef _WIN32
+			if (unixSocket)
+				unixSocket->close(ec);
+#endif /* _WIN32 */
+		});
+	}
+
+#ifndef _WIN32
+	if (unixSocket)
+		(void)unlink(GetSocketPath().CStr());
+#endif /* _WIN32 */
+
+	m_ResultQueue.Join();
+
+	Log(LogInformation, "PassiveResultListener")
+		<< "'" << GetName() << "' stopped.";
+
+	ObjectImpl<PassiveResultListener>::Stop(runtimeRemoved);
+}
+
+template<class Socket>
+void PassiveResultListener::ReceiveLoop(boost::asio::yield_context yc, const typename Shared<Socket>::Ptr& socket)
+{
+	PassiveResultListener::Ptr keepAlive (this);
+	std::vector<char> buffer (l_MaxDatagramSize);
+
+	for (;;) {
+		boost::system::error_code ec;
+		size_t length = socket->async_receive(boost::asio::buffer(buffer), yc[ec]);
+
+		if (ec) {
+			if (ec == boost::asio::error::operation_aborted || !socket->is_open())
+				break;
+
+			/* E.g. an ICMP error due to a previous datagram of ours, there aren't any. */
+			continue;
+		}
+
+		/* Everything else which has arrived meanwhile is processed in one go, too. */
+		auto batch (std::make_shared<std::vector<String>>());
+		batch->emplace_back(buffer.data(), buffer.data() + length);
+
+		while (batch->size() < l_MaxBatchSize) {
+			length = socket->receive(boost::asio::buffer(buffer), 0, ec);
+
+			if (ec)
+				break;
+
+			batch->emplace_back(buffer.data(), buffer.data() + length);
+		}
+
+		if (m_ResultQueue.GetLength() >= l_MaxPendingBatches) {
+			m_DroppedDatagrams.fetch_add(batch->size());
+			continue;
+		}
+
+		m_ResultQueue.Enqueue([this, keepAlive, batch]() {
+			for (auto& datagram : *batch)
+				ProcessDatagram(datagram.CStr(), datagram.GetLength());
+		});
+	}
+}
+
+/**
+ * Splits a line into its tab-separated fields, unescaping "\t", "\n" and "\\".
+ */
+static std::vector<String> SplitFields(const char *begin, const char *end)
+{
+	std::vector<String> fields (1);
+
+	for (const char *p = begin; p < end; p++) {
+		if (*p == '\t') {
+			fields.emplace_back();
+			continue;
+		}
+
+		if (*p == '\\' && p + 1 < end) {
+			switch (p[1]) {
+				case 't':
+					fields.back() += '\t';
+					p++;
+					continue;
+				case 'n':
+					fields.back() += '\n';
+					p++;
+					continue;
+				case '\\':
+					fields.back() += '\\';
+					p++;
+					continue;
+			}
+		}
+
+		fields.back() += *p;
+	}
+
+	return fields;
+}
+
+/**
+ * Authenticates a datagram and processes its check results.
+ */
+void PassiveResultListener::ProcessDatagram(const char *data, size_t length)
+{
+	const char *end = data + length;
+	const char *eol = std::find(data, end, '\n');
+
+	String headerLine (data, eol);
+	std::vector<String> header;
+	boost::algorithm::split(header, headerLine, boost::is_any_of(" "));
+
+	if (eol == end || header.size() != 4 || header[0] != "PR1") {
+		m_RejectedDatagrams.fetch_add(1);
+		return;
+	}
+
+	/* The HMAC covers everything after "PR1 <hmac> ". */
+	const char *payload = data + header[0].GetLength() + 1 + header[1].GetLength() + 1;
+
+	ApiUser::Ptr user = ApiUser::GetByName(header[2]);
+	std::unique_ptr<Expression> filter;
+
+	if (!user || user->GetPassword().IsEmpty() || !FilterUtility::HasPermission(user, "actions/process-check-result", &filter)) {
+		m_RejectedDatagrams.fetch_add(1);
+		return;
+	}
+
+	String password = user->GetPassword();
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digestLength = 0;
+
+	if (!HMAC(EVP_sha256(), password.CStr(), password.GetLength(), reinterpret_cast<const unsigned char *>(payload),
+		end - payload, digest, &digestLength)
+		|| !Utility::ComparePasswords(header[1].ToLower(), BinaryToHex(digest, digestLength))) {
+		m_RejectedDatagrams.fetch_add(1);
+		return;
+	}
+
+	/* Otherwise the datagram could be replayed at any time. */
+	double timestamp;
+
+	try {
+		timestamp = Convert::ToDouble(header[3]);
+	} catch (const std::exception&) {
+		timestamp = NAN;
+	}
+
+	if (!(std::fabs(Utility::GetTime() - timestamp) <= GetMaxClockSkew())) {
+		m_RejectedDatagrams.fetch_add(1);
+		return;
+	}
+
+	/* ... or within the clock skew. */
+	if (digestLength != std::tuple_size<Digest>::value || IsReplayed(digest))
+		return;
+
+	for (const char *line = eol + 1; line < end;) {
+		const char *next = std::find(line, end, '\n');
+
+		if (next > line) {
+			bool ok;
+
+			try {
+				ok = ProcessResult(filter.get(), SplitFields(line, next));
+			} catch (const std::exception& ex) {
+				Log(LogDebug, "PassiveResultListener")
+					<< "Error while processing a check result: " << DiagnosticInformation(ex);
+
+				ok = false;
+			}
+
+			(ok ? m_Results : m_InvalidResults).fetch_add(1);
+		}
+
+		line = next + 1;
+	}
+}
+
+size_t PassiveResultListener::DigestHash::operator()(const Digest& digest) const
+{
+	/* HMACs are uniformly distributed. */
+	size_t hash;
+	std::memcpy(&hash, digest.data(), sizeof(hash));
+
+	return hash;
+}
+
+/**
+ * Remembers the HMAC of an authenticated datagram until its timestamp is outside max_clock_skew.
+ *
+ * @param digest The HMAC-SHA256 of the datagram.
+ *
+ * @returns Whether the datagram was accepted before or can't be remembered.
+ */
+bool PassiveResultListener::IsReplayed(const unsigned char *digest)
+{
+	Digest key;
+	std::copy(digest, digest + key.size(), key.begin());
+
+	double now = Utility::GetTime();
+
+	std::unique_lock<std::mutex> lock (m_SeenMutex);
+
+	while (!m_SeenExpiry.empty() && m_SeenExpiry.front().first < now) {
+		m_SeenDigests.erase(m_SeenExpiry.front().second);
+		m_SeenExpiry.pop_front();
+	}
+
+	if (m_SeenDigests.find(key) != m_SeenDigests.end()) {
+		m_ReplayedDatagrams.fetch_add(1);
+		return true;
+	}
+
+	if (m_SeenDigests.size() >= l_MaxSeenDigests) {
+		m_DroppedDatagrams.fetch_add(1);
+		return true;
+	}
+
+	m_SeenDigests.emplace(key);
+
+	/* The timestamp is at most max_clock_skew ahead, and the expiry times have to be in order. */
+	m_SeenExpiry.emplace_back(now + GetMaxClockSkew() * 2, key);
+
+	return false;
+}
+
+/**
+ * Processes a check result, like the process-check-result API action.
+ *
+ * @param filter The user's permission filter, if any.
+ * @param fields Host name, service name (empty for a host), exit status, plugin output and optionally performance data.
+ *
+ * @returns Whether the check result was valid.
+ */
+bool PassiveResultListener::ProcessResult(Expression *filter, const std::vector<String>& fields)
+{
+	if (fields.size() < 4 || fields.size() > 5)
+		return false;
+
+	Checkable::Ptr checkable;
+
+	if (fields[1].IsEmpty())
+		checkable = Host::GetByName(fields[0]);
+	else
+		checkable = Service::GetByNamePair(fields[0], fields[1]);
+
+	if (!checkable || !checkable->GetEnablePassiveChecks())
+		return false;
+
+	if (filter) {
+		ScriptFrame frame (false, new Namespace());
+
+		if (!FilterUtility::EvaluateFilter(frame, filter, checkable))
+			return false;
+	}
+
+	if (!checkable->IsReachable(DependencyCheckExecution))
+		return true;
+
+	int exitStatus = Convert::ToLong(fields[2]);
+	ServiceState state;
+
+	if (fields[1].IsEmpty()) {
+		if (exitStatus == 0)
+			state = ServiceOK;
+		else if (exitStatus == 1)
+			state = ServiceCritical;
+		else
+			return false;
+	} else {
+		state = PluginUtility::ExitStatusToState(exitStatus);
+	}
+
+	CheckResult::Ptr cr = new CheckResult();
+	cr->SetOutput(fields[3]);
+	cr->SetState(state);
+
+	if (fields.size() > 4 && !fields[4].IsEmpty())
+		cr->SetPerformanceData(PluginUtility::SplitPerfdata(fields[4]));
+
+	/* Mark this check result as passive. */
+	cr->SetActive(false);
+
+	checkable->ProcessCheckResult(cr);
+
+	return true;
+}
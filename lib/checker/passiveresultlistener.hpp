@@ -0,0 +1,91 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef PASSIVERESULTLISTENER_H
+#define PASSIVERESULTLISTENER_H
+
+#include "checker/passiveresultlistener-ti.hpp"
+#include "remote/apiuser.hpp"
+#include "base/metrics.hpp"
+#include "base/shared.hpp"
+#include "base/workqueue.hpp"
+#include <boost/asio/io_context_strand.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/asio/spawn.hpp>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace icinga
+{
+
+class Expression;
+
+/**
+ * Accepts passive check results in authenticated UDP or UNIX datagrams.
+ *
+ * Each datagram starts with a header line "PR1 <hmac> <user> <timestamp>", followed by one line per check result:
+ * "<host>\t<service>\t<exit_status>\t<plugin_output>[\t<performance_data>]". The HMAC-SHA256 (hex) is taken over
+ * everything after "PR1 <hmac> " with the password of the ApiUser, which needs the "actions/process-check-result"
+ * permission. The datagrams are received on the I/O engine and processed in batches by a lock-free work queue.
+ * A datagram is only accepted once, its timestamp must be within max_clock_skew.
+ *
+ * @ingroup checker
+ */
+class PassiveResultListener final : public ObjectImpl<PassiveResultListener>
+{
+public:
+	DECLARE_OBJECT(PassiveResultListener);
+	DECLARE_OBJECTNAME(PassiveResultListener);
+
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+	static void MetricsFunc(MetricsWriter& writer);
+
+	void ProcessDatagram(const char *data, size_t length);
+
+protected:
+	void Start(bool runtimeCreated) override;
+	void Stop(bool runtimeRemoved) override;
+
+private:
+	Shared<boost::asio::io_context::strand>::Ptr m_Strand;
+	Shared<boost::asio::ip::udp::socket>::Ptr m_UdpSocket;
+#ifndef _WIN32
+	Shared<boost::asio::local::datagram_protocol::socket>::Ptr m_UnixSocket;
+#endif /* _WIN32 */
+
+	WorkQueue m_ResultQueue {0, 4, LogInformation, true};
+
+	std::atomic<uint_fast64_t> m_Results {0};
+	std::atomic<uint_fast64_t> m_InvalidResults {0};
+	std::atomic<uint_fast64_t> m_RejectedDatagrams {0};
+	std::atomic<uint_fast64_t> m_DroppedDatagrams {0};
+	std::atomic<uint_fast64_t> m_ReplayedDatagrams {0};
+
+	/* The HMACs of the datagrams accepted while their timestamp is within max_clock_skew, see IsReplayed() */
+	typedef std::array<unsigned char, 32> Digest;
+
+	struct DigestHash
+	{
+		size_t operator()(const Digest& digest) const;
+	};
+
+	std::mutex m_SeenMutex;
+	std::unordered_set<Digest, DigestHash> m_SeenDigests;
+	std::deque<std::pair<double, Digest>> m_SeenExpiry;
+
+	template<class Socket>
+	void ReceiveLoop(boost::asio::yield_context yc, const typename Shared<Socket>::Ptr& socket);
+
+	bool IsReplayed(const unsigned char *digest);
+
+	static bool ProcessResult(Expression *filter, const std::vector<String>& fields);
+};
+
+}
+
+#endif /* PASSIVERESULTLISTENER_H */
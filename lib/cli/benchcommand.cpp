@@ -0,0 +1,501 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "cli/benchcommand.hpp"
+#include "cli/daemonutility.hpp"
+#include "icinga/checkable.hpp"
+#include "icinga/checklatency.hpp"
+#include "icinga/downtime.hpp"
+#include "icinga/host.hpp"
+#include "icinga/service.hpp"
+#include "remote/configobjectutility.hpp"
+#include "config/configitem.hpp"
+#include "base/application.hpp"
+#include "base/configtype.hpp"
+#include "base/configuration.hpp"
+#include "base/convert.hpp"
+#include "base/exception.hpp"
+#include "base/histogram.hpp"
+#include "base/json.hpp"
+#include "base/logger.hpp"
+#include "base/memoryusage.hpp"
+#include "base/timer.hpp"
+#include "base/utility.hpp"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+using namespace icinga;
+namespace po = boost::program_options;
+
+REGISTER_CLICOMMAND("bench", BenchCommand);
+
+/**
+ * What "icinga2 bench" generates and for how long it runs.
+ */
+struct BenchOptions
+{
+	int Hosts;
+	int Services;
+	int Fanout;
+	bool Notifications;
+	double Downtimes;
+	int Perfdata;
+	String CheckCommand;
+	double CheckInterval;
+	double SleepTime;
+	double Duration;
+};
+
+/**
+ * The queue length of a backlog at the start and the end of the run and the longest one seen in between.
+ */
+struct BacklogSample
+{
+	uint_fast64_t Start{0};
+	uint_fast64_t End{0};
+	uint_fast64_t Max{0};
+};
+
+/* The memory usage categories whose items are queued work (see REGISTER_MEMORY_USAGE_REPORTER). */
+static const std::set<String> l_BacklogCategories { "work_queues", "jsonrpc_queues", "events_inboxes", "icingadb" };
+
+static std::atomic<uint_fast64_t> l_CheckResults (0);
+static std::atomic<uint_fast64_t> l_StateChanges (0);
+static std::atomic<uint_fast64_t> l_Notifications (0);
+static Histogram l_CheckResultLatency;
+
+static std::mutex l_BacklogMutex;
+static std::map<String, BacklogSample> l_Backlog;
+
+static Timer::Ptr l_SampleTimer;
+static Timer::Ptr l_StopTimer;
+static Dictionary::Ptr l_Result;
+
+String BenchCommand::GetDescription() const
+{
+	return "Runs Icinga 2 with generated hosts and services for a while and reports how it performed.";
+}
+
+String BenchCommand::GetShortDescription() const
+{
+	return "runs a synthetic load benchmark";
+}
+
+void BenchCommand::InitParameters(boost::program_options::options_description& visibleDesc,
+	boost::program_options::options_description& hiddenDesc) const
+{
+	visibleDesc.add_options()
+		("hosts", po::value<int>()->default_value(1000), "number of hosts to generate")
+		("services", po::value<int>()->default_value(10), "number of services per host")
+		("fanout", po::value<int>()->default_value(0), "number of child hosts depending on each host (0 disables dependencies)")
+		("notifications", "notify a user about every host and service (with a command which does nothing)")
+		("downtimes", po::value<double>()->default_value(0), "percentage of hosts which are in a downtime together with their services")
+		("perfdata", po::value<int>()->default_value(4), "number of performance data values per check result of the dummy check command")
+		("check-command", po::value<std::string>()->default_value("random"), "check command of all hosts and services: random, dummy or sleep")
+		("check-interval", po::value<double>()->default_value(10), "check and retry interval in seconds")
+		("sleep-time", po::value<double>()->default_value(0.1), "seconds the sleep check command takes")
+		("duration", po::value<double>()->default_value(60), "seconds to run the checks for")
+		("config,c", po::value<std::vector<std::string> >(), "parse an additional configuration file, e.g. of a feature to include in the benchmark")
+		("data-dir", po::value<std::string>(), "empty directory to keep the state and the configuration generated for the run in, replaced by later runs (default: <CacheDir>/bench)")
+		("output,o", po::value<std::string>(), "write the results to the specified file instead of the last line of stdout")
+	;
+}
+
+std::vector<String> BenchCommand::GetArgumentSuggestions(const String& argument, const String& word) const
+{
+	if (argument == "config" || argument == "output")
+		return GetBashCompletionSuggestions("file", word);
+	else if (argument == "data-dir")
+		return GetBashCompletionSuggestions("directory", word);
+	else
+		return CLICommand::GetArgumentSuggestions(argument, word);
+}
+
+/**
+ * @returns The attributes every generated host and service shares.
+ */
+static String GetCheckableAttributes(const BenchOptions& options)
+{
+	std::ostringstream msgbuf;
+	msgbuf << "\tcheck_command = \"" << options.CheckCommand << "\"\n"
+		<< "\tcheck_interval = " << options.CheckInterval << "\n"
+		<< "\tretry_interval = " << options.CheckInterval << "\n"
+		/* State changes of random checks become hard at once, so they're notified. */
+		<< "\tmax_check_attempts = 1\n"
+		<< "\tvars.sleep_time = " << options.SleepTime << "\n"
+		<< "\tvars.dummy_text = \"Benchmark check result";
+
+	for (int i = 0; i < options.Perfdata; i++)
+		msgbuf << (i ? " " : " | ") << "bench_" << i << "=" << i << ".5s;10;20;0;30";
+
+	msgbuf << "\"\n";
+
+	return msgbuf.str();
+}
+
+/**
+ * Writes the config of the generated objects. Hosts form a tree via dependencies if options.Fanout > 0:
+ * host i depends on host (i - 1) / fanout.
+ */
+static void WriteBenchConfig(const String& path, const BenchOptions& options)
+{
+	std::ofstream fp (path.CStr(), std::ofstream::out | std::ofstream::trunc);
+	fp.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+	String attributes = GetCheckableAttributes(options);
+
+	fp << "/* Generated by \"icinga2 bench\". */\n\n"
+		<< "include <itl>\n\n"
+		<< "object CheckerComponent \"bench-checker\" { }\n\n"
+		<< "template Host \"bench-host\" {\n" << attributes << "}\n\n";
+
+	if (options.Services > 0) {
+		fp << "apply Service \"bench-service-\" for (i in range(" << options.Services << ")) {\n" << attributes
+			<< "\tassign where \"bench-host\" in host.templates\n}\n\n";
+	}
+
+	if (options.Fanout > 0) {
+		fp << "apply Dependency \"bench-parent\" to Host {\n"
+			<< "\tparent_host_name = host.vars.bench_parent\n"
+			<< "\tassign where host.vars.bench_parent\n}\n\n";
+	}
+
+	if (options.Notifications) {
+		fp << "object NotificationComponent \"bench-notification\" { }\n\n"
+			<< "object NotificationCommand \"bench-notification\" {\n"
+			<< "\texecute = function(notification, user, cr, itype, author, comment, resolvedMacros, useResolvedMacros) { }\n}\n\n"
+			<< "object User \"bench\" { }\n\n";
+
+		for (const char *type : { "Host", "Service" }) {
+			fp << "apply Notification \"bench\" to " << type << " {\n"
+				<< "\tcommand = \"bench-notification\"\n"
+				<< "\tusers = [ \"bench\" ]\n"
+				<< "\tassign where \"bench-host\" in host.templates\n}\n\n";
+		}
+	}
+
+	for (int i = 0; i < options.Hosts; i++) {
+		fp << "object Host \"bench-host-" << i << "\" {\n\timport \"bench-host\"\n";
+
+		if (options.Fanout > 0 && i > 0)
+			fp << "\tvars.bench_parent = \"bench-host-" << (i - 1) / options.Fanout << "\"\n";
+
+		fp << "}\n";
+	}
+
+	fp.close();
+}
+
+/**
+ * Puts the share of hosts given by options.Downtimes into a fixed downtime lasting longer than the run.
+ */
+static void AddDowntimes(const BenchOptions& options)
+{
+	if (options.Downtimes <= 0)
+		return;
+
+	double now = Utility::GetTime();
+	double end = now + options.Duration + 3600;
+
+	for (int i = 0; i < options.Hosts; i++) {
+		if (i % 100 >= options.Downtimes)
+			continue;
+
+		Host::Ptr host = Host::GetByName("bench-host-" + Convert::ToString(i));
+
+		if (!host)
+			continue;
+
+		Downtime::AddDowntime(host, "icinga2 bench", "Benchmark downtime", now, end, true, nullptr, 0);
+
+		for (const Service::Ptr& service : host->GetServices())
+			Downtime::AddDowntime(service, "icinga2 bench", "Benchmark downtime", now, end, true, nullptr, 0);
+	}
+}
+
+/**
+ * Records the current length of all backlogs. Queues which are empty aren't reported at all.
+ *
+ * @param first Whether this is the sample at the start of the run.
+ */
+static void SampleBacklog(bool first)
+{
+	auto usage (MemoryUsage::Collect());
+
+	std::unique_lock<std::mutex> lock (l_BacklogMutex);
+
+	for (auto& kv : l_Backlog)
+		kv.second.End = 0;
+
+	for (auto& category : usage) {
+		if (l_BacklogCategories.find(category.first) == l_BacklogCategories.end())
+			continue;
+
+		for (auto& entry : category.second) {
+			BacklogSample& sample (l_Backlog[category.first + "/" + entry.Name]);
+
+			if (first)
+				sample.Start += entry.Items;
+
+			sample.End += entry.Items;
+		}
+	}
+
+	for (auto& kv : l_Backlog)
+		kv.second.Max = std::max(kv.second.Max, kv.second.End);
+}
+
+static Dictionary::Ptr GetHistogramResult(const Histogram& histogram)
+{
+	auto count (histogram.GetCount());
+
+	return new Dictionary({
+		{ "count", static_cast<double>(count) },
+		{ "avg", count ? histogram.GetSum() / count : 0 },
+		{ "p50", histogram.GetPercentile(50) },
+		{ "p90", histogram.GetPercentile(90) },
+		{ "p99", histogram.GetPercentile(99) },
+		{ "p999", histogram.GetPercentile(99.9) },
+		{ "max", histogram.GetMax() }
+	});
+}
+
+static Dictionary::Ptr CollectResults(const BenchOptions& options, double duration)
+{
+	/* The histograms of the check life cycle stages, "processing" is Checkable::ProcessCheckResult(). */
+	Dictionary::Ptr status = new Dictionary();
+	CheckLatency::StatsFunc(status, new Array());
+
+	Dictionary::Ptr backlog = new Dictionary();
+
+	{
+		std::unique_lock<std::mutex> lock (l_BacklogMutex);
+
+		for (auto& kv : l_Backlog) {
+			backlog->Set(kv.first, new Dictionary({
+				{ "start", static_cast<double>(kv.second.Start) },
+				{ "end", static_cast<double>(kv.second.End) },
+				{ "max", static_cast<double>(kv.second.Max) },
+				{ "growth_per_second", (static_cast<double>(kv.second.End) - kv.second.Start) / duration }
+			}));
+		}
+	}
+
+	uint_fast64_t checkResults = l_CheckResults.load();
+
+	return new Dictionary({
+		{ "options", new Dictionary({
+			{ "hosts", options.Hosts },
+			{ "services", options.Services },
+			{ "fanout", options.Fanout },
+			{ "notifications", options.Notifications },
+			{ "downtimes", options.Downtimes },
+			{ "perfdata", options.Perfdata },
+			{ "check_command", options.CheckCommand },
+			{ "check_interval", options.CheckInterval },
+			{ "sleep_time", options.SleepTime },
+			{ "duration", options.Duration }
+		}) },
+		{ "duration", duration },
+		{ "check_results", static_cast<double>(checkResults) },
+		{ "check_results_per_second", checkResults / duration },
+		{ "state_changes", static_cast<double>(l_StateChanges.load()) },
+		{ "notifications", static_cast<double>(l_Notifications.load()) },
+		{ "latency", GetHistogramResult(l_CheckResultLatency) },
+		{ "check_latency", status->Get("check_latency") },
+		{ "backlog", backlog }
+	});
+}
+
+/**
+ * The entry point for the "bench" CLI command.
+ *
+ * @returns An exit status.
+ */
+int BenchCommand::Run(const po::variables_map& vm, const std::vector<std::string>& ap) const
+{
+	BenchOptions options;
+	options.Hosts = vm["hosts"].as<int>();
+	options.Services = vm["services"].as<int>();
+	options.Fanout = vm["fanout"].as<int>();
+	options.Notifications = vm.count("notifications");
+	options.Downtimes = vm["downtimes"].as<double>();
+	options.Perfdata = vm["perfdata"].as<int>();
+	options.CheckCommand = vm["check-command"].as<std::string>();
+	options.CheckInterval = vm["check-interval"].as<double>();
+	options.SleepTime = vm["sleep-time"].as<double>();
+	options.Duration = vm["duration"].as<double>();
+
+	if (options.Hosts < 1 || options.Services < 0 || options.Fanout < 0 || options.Perfdata < 0
+		|| options.Downtimes < 0 || options.Downtimes > 100 || options.CheckInterval <= 0 || options.SleepTime < 0 || options.Duration <= 0) {
+		Log(LogCritical, "cli", "Invalid benchmark options: the numbers must not be negative, there must be at least one host,"
+			" the downtime percentage must not exceed 100 and the intervals must be greater than 0.");
+		return EXIT_FAILURE;
+	}
+
+	if (options.CheckCommand != "random" && options.CheckCommand != "dummy" && options.CheckCommand != "sleep") {
+		Log(LogCritical, "cli")
+			<< "Invalid check command '" << options.CheckCommand << "', expected random, dummy or sleep.";
+		return EXIT_FAILURE;
+	}
+
+	/* Neither the state nor the objects created at runtime (downtimes) must end up in the paths of an actual setup. */
+	String dataDir = vm.count("data-dir") ? String(vm["data-dir"].as<std::string>()) : Configuration::CacheDir + "/bench";
+
+	/* Only directories of earlier runs are replaced, they're marked by this file. */
+	String markerPath = dataDir + "/.icinga2-bench";
+
+	try {
+		if (Utility::PathExists(dataDir)) {
+			if (Utility::PathExists(markerPath)) {
+				Utility::RemoveDirRecursive(dataDir);
+			} else {
+				bool empty = true;
+
+				Utility::Glob(dataDir + "/*", [&empty](const String&) { empty = false; }, GlobFile | GlobDirectory);
+				Utility::Glob(dataDir + "/.*", [&empty](const String& path) {
+					String name = Utility::BaseName(path);
+
+					if (name != "." && name != "..")
+						empty = false;
+				}, GlobFile | GlobDirectory);
+
+				if (!empty) {
+					Log(LogCritical, "cli")
+						<< "The benchmark directory '" << dataDir << "' isn't empty and wasn't created by an earlier benchmark, not using it.";
+					return EXIT_FAILURE;
+				}
+			}
+		}
+
+		Utility::MkDirP(dataDir + "/zones.d", 0750);
+
+		std::ofstream marker (markerPath.CStr());
+
+		if (!marker)
+			BOOST_THROW_EXCEPTION(std::runtime_error("Cannot create '" + markerPath + "'."));
+	} catch (const std::exception& ex) {
+		Log(LogCritical, "cli")
+			<< "Cannot prepare the benchmark directory '" << dataDir << "': " << DiagnosticInformation(ex, false);
+		return EXIT_FAILURE;
+	}
+
+	Configuration::DataDir = dataDir;
+	Configuration::ZonesDir = dataDir + "/zones.d";
+	Configuration::StatePath = dataDir + "/icinga2.state";
+	Configuration::ModAttrPath = dataDir + "/modified-attributes.conf";
+	Configuration::VarsPath = dataDir + "/icinga2.vars";
+
+	String configPath = dataDir + "/bench.conf";
+
+	try {
+		WriteBenchConfig(configPath, options);
+	} catch (const std::exception& ex) {
+		Log(LogCritical, "cli")
+			<< "Cannot write the benchmark configuration to '" << configPath << "': " << DiagnosticInformation(ex, false);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<std::string> configs { configPath.GetData() };
+
+	if (vm.count("config")) {
+		for (auto& config : vm["config"].as<std::vector<std::string> >())
+			configs.emplace_back(config);
+	}
+
+	Log(LogInformation, "cli")
+		<< "Loading the benchmark configuration with " << options.Hosts << " hosts and "
+		<< options.Hosts * options.Services << " services.";
+
+	{
+		std::vector<ConfigItem::Ptr> newItems;
+
+		if (!DaemonUtility::LoadConfigFiles(configs, newItems, String(), Configuration::VarsPath)) {
+			Log(LogCritical, "cli", "Config validation failed.");
+			return EXIT_FAILURE;
+		}
+
+		if (!ConfigItem::ActivateItems(newItems, false, true, true)) {
+			Log(LogCritical, "cli", "Error activating configuration.");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ConfigObjectUtility::CreateStorage();
+
+	AddDowntimes(options);
+
+	auto newCheckResult (Checkable::OnNewCheckResult.connect([](const Checkable::Ptr&, const CheckResult::Ptr& cr, const MessageOrigin::Ptr&) {
+		l_CheckResults.fetch_add(1, std::memory_order_relaxed);
+		l_CheckResultLatency.Record(cr->CalculateLatency());
+	}));
+
+	auto stateChange (Checkable::OnStateChange.connect([](const Checkable::Ptr&, const CheckResult::Ptr&, StateType, const MessageOrigin::Ptr&) {
+		l_StateChanges.fetch_add(1, std::memory_order_relaxed);
+	}));
+
+	auto notificationSent (Checkable::OnNotificationSentToAllUsers.connect([](auto&&...) {
+		l_Notifications.fetch_add(1, std::memory_order_relaxed);
+	}));
+
+	double start = Utility::GetTime();
+
+	SampleBacklog(true);
+
+	l_SampleTimer = Timer::Create();
+	l_SampleTimer->SetInterval(1);
+	l_SampleTimer->OnTimerExpired.connect([](const Timer * const&) { SampleBacklog(false); });
+	l_SampleTimer->Start();
+
+	l_StopTimer = Timer::Create();
+	l_StopTimer->SetInterval(options.Duration);
+	l_StopTimer->OnTimerExpired.connect([options, start](const Timer * const&) {
+		l_SampleTimer->Stop();
+		l_StopTimer->Stop();
+
+		SampleBacklog(false);
+
+		l_Result = CollectResults(options, Utility::GetTime() - start);
+
+		Application::RequestShutdown();
+	});
+	l_StopTimer->Start();
+
+	Log(LogInformation, "cli")
+		<< "Running the benchmark for " << options.Duration << " seconds.";
+
+	int rc = Application::GetInstance()->Run();
+
+	newCheckResult.disconnect();
+	stateChange.disconnect();
+	notificationSent.disconnect();
+
+	if (!l_Result)
+		return rc == EXIT_SUCCESS ? EXIT_FAILURE : rc;
+
+	String result = JsonEncode(l_Result);
+
+	if (vm.count("output")) {
+		String output = vm["output"].as<std::string>();
+
+		try {
+			std::ofstream fp (output.CStr(), std::ofstream::out | std::ofstream::trunc);
+			fp.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+			fp << result << "\n";
+			fp.close();
+		} catch (const std::exception& ex) {
+			Log(LogCritical, "cli")
+				<< "Cannot write the benchmark results to '" << output << "': " << DiagnosticInformation(ex, false);
+			return EXIT_FAILURE;
+		}
+	} else {
+		std::cout << result << std::endl;
+	}
+
+	return rc;
+}
@@ -8,8 +8,11 @@
 #include "config/configcompiler.hpp"
 #include "config/configcompilercontext.hpp"
 #include "config/configitembuilder.hpp"
+#include "config/configprofiler.hpp"
 #include "base/atomic.hpp"
+#include "base/configtype.hpp"
 #include "base/defer.hpp"
+#include "base/listenerhandover.hpp"
 #include "base/logger.hpp"
 #include "base/application.hpp"
 #include "base/process.hpp"
@@ -18,6 +21,7 @@
 #include "base/exception.hpp"
 #include "base/convert.hpp"
 #include "base/scriptglobal.hpp"
+#include "base/startupscheduler.hpp"
 #include "base/context.hpp"
 #include "config.h"
 #include <cstdint>
@@ -178,17 +182,25 @@ void DaemonCommand::InitParameters(boost::program_options::options_description&
 		("no-config,z", "start without a configuration file")
 		("validate,C", "exit after validating the configuration")
 		("dump-objects", "write icinga2.debug cache file for icinga2 object list")
+		("config-snapshot", "restore the objects from the config snapshot if the configuration didn't change, write the snapshot otherwise (and with -C)")
+		("incremental-reload", "apply changes limited to object definitions on reload without restarting")
+		("profile", po::value<std::string>(), "write the time spent on files, templates, apply rules and commit phases while loading the config to the specified file")
+		("profile-stacks", po::value<std::string>(), "write the same measurements as folded stacks (e.g. for flamegraph.pl) to the specified file")
 		("errorlog,e", po::value<std::string>(), "log fatal errors to the specified log file (only works in combination with --daemonize or --close-stdio)")
 #ifndef _WIN32
 		("daemonize,d", "detach from the controlling terminal")
 		("close-stdio", "do not log to stdout (or stderr) after startup")
 #endif /* _WIN32 */
 	;
+
+	hiddenDesc.add_options()
+		("config-snapshot-path", po::value<std::string>(), "like --config-snapshot, but with the specified snapshot file (used to validate config package stages)")
+	;
 }
 
 std::vector<String> DaemonCommand::GetArgumentSuggestions(const String& argument, const String& word) const
 {
-	if (argument == "config" || argument == "errorlog")
+	if (argument == "config" || argument == "errorlog" || argument == "profile" || argument == "profile-stacks")
 		return GetBashCompletionSuggestions("file", word);
 	else
 		return CLICommand::GetArgumentSuggestions(argument, word);
@@ -218,9 +230,52 @@ static double GetDebugWorkerDelay()
 
 	return 0.0;
 }
+
+/**
+ * Logs the memory used per object of every config type, e.g. to check the effect of "hot" and "cold" fields.
+ */
+static void LogObjectSizes()
+{
+	for (const Type::Ptr& type : Type::GetAllTypes()) {
+		auto *ctype = dynamic_cast<ConfigType *>(type.get());
+
+		if (!ctype || type->GetInstanceSize() == 0)
+			continue;
+
+		int count = ctype->GetObjectCount();
+
+		if (!count)
+			continue;
+
+		Log(LogDebug, "cli")
+			<< "Type '" << type->GetName() << "': " << type->GetInstanceSize() << " bytes per object, "
+			<< count << " objects.";
+	}
+}
 #endif /* I2_DEBUG */
 
 static String l_ObjectsPath;
+static String l_SnapshotPath;
+static bool l_IncrementalReload = false;
+static String l_ProfilePath;
+static String l_ProfileStacksPath;
+
+/**
+ * Writes the measurements of the config profiler (if enabled) after loading the config.
+ */
+static void WriteConfigProfile()
+{
+	try {
+		if (!l_ProfilePath.IsEmpty())
+			ConfigProfiler::WriteReport(l_ProfilePath);
+
+		if (!l_ProfileStacksPath.IsEmpty())
+			ConfigProfiler::WriteFoldedStacks(l_ProfileStacksPath);
+	} catch (const std::exception& ex) {
+		Log(LogWarning, "cli")
+			<< "Could not write config profile: " << DiagnosticInformation(ex, false);
+	}
+}
 
 /**
  * Do the actual work (config loading, ...)
@@ -252,12 +307,26 @@ int RunWorker(const std::vector<std::string>& configs, bool closeConsoleLog = fa
 	{
 		std::vector<ConfigItem::Ptr> newItems;
 
-		if (!DaemonUtility::LoadConfigFiles(configs, newItems, l_ObjectsPath, Configuration::VarsPath)) {
+		if (l_IncrementalReload)
+			ConfigCompiler::SetRecordCompiledFiles(true);
+
+		bool loaded = DaemonUtility::LoadConfigFiles(configs, newItems, l_ObjectsPath, Configuration::VarsPath, l_SnapshotPath, true);
+
+		/* Objects created via the API later on aren't part of the config files. */
+		ConfigCompiler::SetRecordCompiledFiles(false);
+
+		WriteConfigProfile();
+
+		if (!loaded) {
 			Log(LogCritical, "cli", "Config validation failed. Re-run with 'icinga2 daemon -C' after fixing the config.");
 			NotifyStatus("Config validation failed.");
 			return EXIT_FAILURE;
 		}
 
+#ifdef I2_DEBUG
+		LogObjectSizes();
+#endif /* I2_DEBUG */
+
 #ifndef _WIN32
 		Log(LogNotice, "cli")
 			<< "Notifying umbrella process (PID " << l_UmbrellaPid << ") about the config loading success";
@@ -296,6 +365,8 @@ int RunWorker(const std::vector<std::string>& configs, bool closeConsoleLog = fa
 			return EXIT_FAILURE;
 		}
 
+		StartupScheduler::MarkPhase("state restored");
+
 		NotifyStatus("Activating config objects...");
 
 		// activate config only after daemonization: it starts threads and that is not compatible with fork()
@@ -306,6 +377,11 @@ int RunWorker(const std::vector<std::string>& configs, bool closeConsoleLog = fa
 
 			return EXIT_FAILURE;
 		}
+
+		StartupScheduler::MarkPhase("objects activated");
+
+		if (l_IncrementalReload)
+			DaemonUtility::EnableIncrementalReload(configs);
 	}
 
 	/* Create the internal API object storage. Do this here too with setups without API. */
@@ -322,6 +398,11 @@ int RunWorker(const std::vector<std::string>& configs, bool closeConsoleLog = fa
 
 	ApiListener::UpdateObjectAuthority();
 
+	/* Let the umbrella process keep our listening sockets open for the next worker. */
+	ListenerHandover::Publish();
+
+	StartupScheduler::Finish();
+
 	NotifyStatus("Startup finished.");
 
 	return Application::GetInstance()->Run();
@@ -354,6 +435,12 @@ static Atomic<int> l_TermSignal (-1);
 // Whether someone requested to re-load config (and we didn't handle that request, yet)
 static Atomic<bool> l_RequestedReload (false);
 
+// The PID of the seamless worker doing the actual work
+static Atomic<pid_t> l_CurrentWorkerPid (-1);
+
+// Whether someone requested to re-load config in the current worker (and we didn't forward that request, yet)
+static Atomic<bool> l_RequestedIncrementalReload (false);
+
 // Whether someone requested to re-open logs (and we didn't handle that request, yet)
 static Atomic<bool> l_RequestedReopenLogs (false);
 
@@ -390,8 +477,13 @@ static void UmbrellaSignalHandler(int num, siginfo_t *info, void*)
 			l_TermSignal.store(num);
 			break;
 		case SIGHUP:
-			// Someone requested to re-load config
-			l_RequestedReload.store(true);
+			if (l_IncrementalReload && info->si_pid != l_CurrentWorkerPid.load()) {
+				// Someone requested to re-load config, let the current worker try it first
+				l_RequestedIncrementalReload.store(true);
+			} else {
+				// Someone (or the current worker, as it couldn't do it itself) requested to re-load config
+				l_RequestedReload.store(true);
+			}
 			break;
 		default:
 			// Programming error (or someone has broken the userspace)
@@ -422,6 +514,12 @@ static void WorkerSignalHandler(int num, siginfo_t *info, void*)
 				Application::RequestShutdown();
 			}
 			break;
+		case SIGHUP:
+			if (info->si_pid == 0 || info->si_pid == l_UmbrellaPid) {
+				// The umbrella process forwarded a reload request (only with --incremental-reload)
+				Application::RequestRestart();
+			}
+			break;
 		default:
 			// Programming error (or someone has broken the userspace)
 			VERIFY(!"Caught unexpected signal");
@@ -468,6 +566,9 @@ static pid_t StartUnixWorker(const std::vector<std::string>& configs, bool close
 		exit(EXIT_FAILURE);
 	}
 
+	/* Pass the current worker's listening sockets on to the new one. */
+	ListenerHandover::ReceiveListeners();
+
 	/* Block the signal handlers we'd like to change in the child process until we changed them.
 	 * Block SIGUSR2 handler until we've set l_CurrentlyStartingUnixWorkerPid.
 	 */
@@ -492,6 +593,8 @@ static pid_t StartUnixWorker(const std::vector<std::string>& configs, bool close
 			return -1;
 
 		case 0:
+			ListenerHandover::InitializeWorker();
+
 			try {
 				{
 					struct sigaction sa;
@@ -502,7 +605,7 @@ static pid_t StartUnixWorker(const std::vector<std::string>& configs, bool close
 					(void)sigaction(SIGUSR1, &sa, nullptr);
 				}
 
-				{
+				if (!l_IncrementalReload) {
 					struct sigaction sa;
 					memset(&sa, 0, sizeof(sa));
 
@@ -522,6 +625,9 @@ static pid_t StartUnixWorker(const std::vector<std::string>& configs, bool close
 					(void)sigaction(SIGUSR2, &sa, nullptr);
 					(void)sigaction(SIGINT, &sa, nullptr);
 					(void)sigaction(SIGTERM, &sa, nullptr);
+
+					if (l_IncrementalReload)
+						(void)sigaction(SIGHUP, &sa, nullptr);
 				}
 
 				(void)sigprocmask(SIG_UNBLOCK, &l_UnixWorkerSignals, nullptr);
@@ -647,12 +753,34 @@ int DaemonCommand::Run(const po::variables_map& vm, const std::vector<std::strin
 		l_ObjectsPath = Configuration::ObjectsPath;
 	}
 
+	if (vm.count("config-snapshot-path"))
+		l_SnapshotPath = vm["config-snapshot-path"].as<std::string>();
+	else if (vm.count("config-snapshot"))
+		l_SnapshotPath = Configuration::CacheDir + "/config-snapshot";
+
+	if (vm.count("incremental-reload"))
+		l_IncrementalReload = true;
+
+	if (vm.count("profile"))
+		l_ProfilePath = vm["profile"].as<std::string>();
+
+	if (vm.count("profile-stacks"))
+		l_ProfileStacksPath = vm["profile-stacks"].as<std::string>();
+
+	if (!l_ProfilePath.IsEmpty() || !l_ProfileStacksPath.IsEmpty())
+		ConfigProfiler::Enable();
+
 	if (vm.count("validate")) {
 		Log(LogInformation, "cli", "Loading configuration file(s).");
 
 		std::vector<ConfigItem::Ptr> newItems;
 
-		if (!DaemonUtility::LoadConfigFiles(configs, newItems, l_ObjectsPath, Configuration::VarsPath)) {
+		/* Always validate the configuration, the snapshot is only written. */
+		bool loaded = DaemonUtility::LoadConfigFiles(configs, newItems, l_ObjectsPath, Configuration::VarsPath, l_SnapshotPath);
+
+		WriteConfigProfile();
+
+		if (!loaded) {
 			Log(LogCritical, "cli", "Config validation failed. Re-run with 'icinga2 daemon -C' after fixing the config.");
 			return EXIT_FAILURE;
 		}
@@ -722,6 +850,8 @@ int DaemonCommand::Run(const po::variables_map& vm, const std::vector<std::strin
 	l_UmbrellaPid = getpid();
 	Application::SetUmbrellaProcess(l_UmbrellaPid);
 
+	ListenerHandover::InitializeUmbrella();
+
 	{
 		struct sigaction sa;
 		memset(&sa, 0, sizeof(sa));
@@ -749,6 +879,8 @@ int DaemonCommand::Run(const po::variables_map& vm, const std::vector<std::strin
 		return EXIT_FAILURE;
 	}
 
+	l_CurrentWorkerPid.store(currentWorker);
+
 	if (closeConsoleLog) {
 		// After disabling the console log, any further errors will go to the configured log only.
 		// Let's try to make this clear and say good bye.
@@ -843,6 +975,7 @@ int DaemonCommand::Run(const po::variables_map& vm, const std::vector<std::strin
 					NotifyStatus("Shut down old instance.");
 
 					currentWorker = nextWorker;
+					l_CurrentWorkerPid.store(currentWorker);
 			}
 
 #ifdef HAVE_SYSTEMD
@@ -851,6 +984,15 @@ int DaemonCommand::Run(const po::variables_map& vm, const std::vector<std::strin
 
 		}
 
+		if (l_RequestedIncrementalReload.exchange(false)) {
+			Log(LogNotice, "cli")
+				<< "Got signal " << SIGHUP << ", forwarding to seamless worker (PID " << currentWorker << ")";
+
+			(void)kill(currentWorker, SIGHUP);
+		}
+
+		ListenerHandover::ReceiveListeners();
+
 		if (l_RequestedReopenLogs.exchange(false)) {
 			Log(LogNotice, "cli")
 				<< "Got signal " << SIGUSR1 << ", forwarding to seamless worker (PID " << currentWorker << ")";
@@ -6,12 +6,33 @@
 #include "base/utility.hpp"
 #include "base/logger.hpp"
 #include "base/application.hpp"
+#include "base/atomic-directory.hpp"
 #include "base/scriptglobal.hpp"
+#include "base/serializer.hpp"
+#include "base/json.hpp"
+#include "base/objectlock.hpp"
+#include "base/tlsutility.hpp"
+#include "base/configtype.hpp"
+#include "base/dependencygraph.hpp"
 #include "config/configcompiler.hpp"
 #include "config/configcompilercontext.hpp"
 #include "config/configitembuilder.hpp"
+#include "config/applyrule.hpp"
 #include "icinga/dependency.hpp"
+#include "remote/apilistener.hpp"
+#include "remote/configobjectslock.hpp"
+#include "remote/configobjectutility.hpp"
+#include "remote/configpackageutility.hpp"
+#include <boost/algorithm/string/predicate.hpp>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <mutex>
 #include <set>
+#include <sstream>
+#include <tuple>
 
 using namespace icinga;
 
@@ -45,11 +66,14 @@ static bool IncludeZoneDirRecursive(const String& path, const String& package, b
 	/* register this zone path for cluster config sync */
 	ConfigCompiler::RegisterZoneDir("_etc", path, zoneName);
 
-	std::vector<std::unique_ptr<Expression> > expressions;
-	Utility::GlobRecursive(path, "*.conf", [&expressions, zoneName, package](const String& file) {
-		ConfigCompiler::CollectIncludes(expressions, file, zoneName, package);
+	std::vector<String> files;
+	Utility::GlobRecursive(path, "*.conf", [&files](const String& file) {
+		files.emplace_back(file);
 	}, GlobFile);
 
+	std::vector<std::unique_ptr<Expression> > expressions;
+	ConfigCompiler::CollectIncludes(expressions, files, zoneName, package);
+
 	DictExpression expr(std::move(expressions));
 	if (!ExecuteExpression(&expr))
 		success = false;
@@ -80,11 +104,14 @@ static bool IncludeNonLocalZone(const String& zonePath, const String& package, b
 		return true;
 	}
 
-	std::vector<std::unique_ptr<Expression> > expressions;
-	Utility::GlobRecursive(zonePath, "*.conf", [&expressions, zoneName, package](const String& file) {
-		ConfigCompiler::CollectIncludes(expressions, file, zoneName, package);
+	std::vector<String> files;
+	Utility::GlobRecursive(zonePath, "*.conf", [&files](const String& file) {
+		files.emplace_back(file);
 	}, GlobFile);
 
+	std::vector<std::unique_ptr<Expression> > expressions;
+	ConfigCompiler::CollectIncludes(expressions, files, zoneName, package);
+
 	DictExpression expr(std::move(expressions));
 	if (!ExecuteExpression(&expr))
 		success = false;
@@ -188,6 +215,9 @@ bool DaemonUtility::ValidateConfigFiles(const std::vector<std::string>& configs,
 
 		Log(LogNotice, "DaemonUtility")
 			<< "Overriding zones var directory with '" << zonesVarDir << "' for cluster config sync staging.";
+	} else {
+		/* In case the last config sync was interrupted while replacing the directory. */
+		AtomicDirectory::Recover(zonesVarDir);
 	}
 
 
@@ -236,12 +266,59 @@ bool DaemonUtility::ValidateConfigFiles(const std::vector<std::string>& configs,
 	return true;
 }
 
+/**
+ * Identifies the configuration which was just evaluated for the config snapshot: the content
+ * of all compiled files, the global variables which aren't functions or namespaces and the
+ * version which wrote the snapshot.
+ *
+ * The active.conf files of config packages and the ActiveStageOverride variable only determine
+ * the ActiveStages variable, which is part of the fingerprint. So the snapshot written while
+ * validating a stage (see ConfigPackageUtility::AsyncTryActivateStage()) is used once it's active.
+ *
+ * @returns The SHA256 hash of the above.
+ */
+static String GetConfigFingerprint()
+{
+	std::ostringstream msgbuf;
+	msgbuf << Application::GetAppVersion() << "\n";
+
+	String packageDir = ConfigPackageUtility::GetPackageDir() + "/";
+
+	for (auto& file : ConfigCompiler::GetCompiledFiles()) {
+		if (boost::algorithm::starts_with(file.first, packageDir) && Utility::BaseName(file.first) == "active.conf")
+			continue;
+
+		msgbuf << file.first << "\t" << file.second.Hash << "\n";
+	}
+
+	Namespace::Ptr globals = ScriptGlobal::GetGlobals();
+
+	ObjectLock olock(globals);
+	for (const Namespace::Pair& kv : globals) {
+		const Value& value = kv.second.Val;
+
+		if (value.IsObject() && !value.IsObjectType<Array>() && !value.IsObjectType<Dictionary>())
+			continue;
+
+		if (kv.first == "ActiveStageOverride")
+			continue;
+
+		msgbuf << kv.first << "\t" << JsonEncode(Serialize(value, 0)) << "\n";
+	}
+
+	return SHA256(msgbuf.str());
+}
+
 bool DaemonUtility::LoadConfigFiles(const std::vector<std::string>& configs,
 	std::vector<ConfigItem::Ptr>& newItems,
-	const String& objectsFile, const String& varsfile)
+	const String& objectsFile, const String& varsfile,
+	const String& snapshotFile, bool useSnapshot)
 {
 	ActivationScope ascope;
 
+	if (!snapshotFile.IsEmpty())
+		ConfigCompiler::SetRecordCompiledFiles(true);
+
 	if (!DaemonUtility::ValidateConfigFiles(configs, objectsFile)) {
 		ConfigCompilerContext::GetInstance()->CancelObjectsFile();
 		return false;
@@ -252,6 +329,14 @@ bool DaemonUtility::LoadConfigFiles(const std::vector<std::string>& configs,
 	// as Freeze() disables locking as it's not necessary on a read-only data structure anymore.
 	ScriptGlobal::GetGlobals()->Freeze();
 
+	if (!snapshotFile.IsEmpty()) {
+		String fingerprint = GetConfigFingerprint();
+
+		/* Objects are either restored from the snapshot or the snapshot is (re-)written while committing them. */
+		if (!useSnapshot || !ConfigItem::LoadSnapshot(snapshotFile, fingerprint, ascope.GetContext()))
+			ConfigCompilerContext::GetInstance()->OpenSnapshotFile(snapshotFile, fingerprint);
+	}
+
 	WorkQueue upq(25000, Configuration::Concurrency);
 	upq.SetName("DaemonUtility::LoadConfigFiles");
 	bool result = ConfigItem::CommitItems(ascope.GetContext(), upq, newItems);
@@ -269,6 +354,7 @@ bool DaemonUtility::LoadConfigFiles(const std::vector<std::string>& configs,
 
 	if (!result) {
 		ConfigCompilerContext::GetInstance()->CancelObjectsFile();
+		ConfigCompilerContext::GetInstance()->CancelSnapshotFile();
 		return false;
 	}
 
@@ -280,6 +366,541 @@ bool DaemonUtility::LoadConfigFiles(const std::vector<std::string>& configs,
 	}
 
 	ConfigCompilerContext::GetInstance()->FinishObjectsFile();
+	ConfigCompilerContext::GetInstance()->FinishSnapshotFile();
+
+	return true;
+}
+
+typedef std::tuple<String, int, int> ReloadLocation;
+typedef std::pair<String /* type */, String /* name */> ReloadObjectName;
+
+/**
+ * An object definition of a file which may be reloaded incrementally.
+ */
+struct ReloadDefinition
+{
+	String Source;
+	std::vector<ReloadObjectName> Objects; /* the objects the definition created */
+};
+
+/**
+ * A file which may be reloaded incrementally.
+ */
+struct ReloadFile
+{
+	String Hash;
+	String Zone;
+	String Package;
+	bool ObjectsOnly;
+	std::vector<ReloadDefinition> Objects;
+};
+
+static std::mutex l_ReloadMutex;
+static std::map<String, ReloadFile> l_ReloadFiles;
+static std::map<String, std::set<String>> l_ReloadDirs;
+
+static inline ReloadLocation GetReloadLocation(const DebugInfo& di)
+{
+	return ReloadLocation(di.Path, di.FirstLine, di.FirstColumn);
+}
+
+static inline ReloadObjectName GetReloadObjectName(const ConfigObject::Ptr& object)
+{
+	return ReloadObjectName(object->GetReflectionType()->GetName(), object->GetName());
+}
+
+static std::set<String> ListDirectory(const String& dir)
+{
+	std::set<String> entries;
+
+	Utility::Glob(dir + "/*", [&entries](const String& path) {
+		entries.emplace(Utility::BaseName(path));
+	}, GlobFile | GlobDirectory);
+
+	return entries;
+}
+
+/**
+ * Remembers the files compiled while the configuration was loaded, the objects their definitions
+ * created and the directories they're in, and lets restart requests try ReloadConfigFiles() first.
+ *
+ * @param configs The config files passed to LoadConfigFiles().
+ */
+void DaemonUtility::EnableIncrementalReload(const std::vector<std::string>& configs)
+{
+	std::unique_lock<std::mutex> lock (l_ReloadMutex);
+
+	std::map<ReloadLocation, std::vector<ReloadObjectName>> objectsByLocation;
+
+	for (const Type::Ptr& type : Type::GetAllTypes()) {
+		auto *ctype = dynamic_cast<ConfigType *>(type.get());
+
+		if (!ctype)
+			continue;
+
+		for (const ConfigObject::Ptr& object : ctype->GetObjects())
+			objectsByLocation[GetReloadLocation(object->GetDebugInfo())].emplace_back(GetReloadObjectName(object));
+	}
+
+	std::vector<String> roots { Configuration::ZonesDir, Configuration::DataDir + "/api/zones", Configuration::DataDir + "/api/packages" };
+
+	for (const String& config : configs)
+		roots.emplace_back(Utility::DirName(config));
+
+	l_ReloadFiles.clear();
+	l_ReloadDirs.clear();
+
+	for (auto& compiled : ConfigCompiler::GetCompiledFiles()) {
+		/* Objects created via the API are managed by ConfigObjectUtility. */
+		if (compiled.second.Package == "_api")
+			continue;
+
+		ReloadFile& file = l_ReloadFiles[compiled.first];
+		file.Hash = compiled.second.Hash;
+		file.Zone = compiled.second.Zone;
+		file.Package = compiled.second.Package;
+		file.ObjectsOnly = compiled.second.ObjectsOnly;
+
+		for (auto& definition : compiled.second.Objects)
+			file.Objects.push_back({ definition.Source, objectsByLocation[GetReloadLocation(definition.Location)] });
+
+		/* New and removed files are detected by the listings of their directory and its parents. */
+		for (String dir = Utility::DirName(compiled.first); l_ReloadDirs.find(dir) == l_ReloadDirs.end(); dir = Utility::DirName(dir)) {
+			bool inside = false, root = false;
+
+			for (auto& rootDir : roots) {
+				if (dir == rootDir)
+					inside = root = true;
+				else if (dir.GetLength() > rootDir.GetLength() && dir.SubStr(0, rootDir.GetLength() + 1) == rootDir + "/")
+					inside = true;
+			}
+
+			if (!inside)
+				break;
+
+			l_ReloadDirs[dir] = ListDirectory(dir);
+
+			if (root)
+				break;
+		}
+	}
+
+	Log(LogNotice, "cli")
+		<< "Watching " << l_ReloadFiles.size() << " config files in " << l_ReloadDirs.size() << " directories for incremental reloads.";
+
+	Application::SetReloadHandler(&DaemonUtility::ReloadConfigFiles);
+}
+
+/**
+ * Collects the objects which would be deleted along with the given one. Only objects created by
+ * apply rules for the object itself may be deleted implicitly (they're re-created with it),
+ * any other object depending on it prevents the incremental reload.
+ *
+ * @param object The object to delete.
+ * @param deleted The objects which are deleted explicitly.
+ * @param applyRules The locations of all apply rules.
+ * @param dependents Receives the implicitly deleted objects.
+ * @returns Whether the object may be deleted.
+ */
+static bool CollectDependents(const ConfigObject::Ptr& object, const std::set<ReloadObjectName>& deleted,
+	const std::set<ReloadLocation>& applyRules, std::vector<ConfigObject::Ptr>& dependents)
+{
+	String prefix = object->GetName() + "!";
+
+	for (const Object::Ptr& parent : DependencyGraph::GetParents(object)) {
+		ConfigObject::Ptr dependent = dynamic_pointer_cast<ConfigObject>(parent);
+
+		if (!dependent || deleted.find(GetReloadObjectName(dependent)) != deleted.end())
+			continue;
+
+		if (applyRules.find(GetReloadLocation(dependent->GetDebugInfo())) == applyRules.end()
+			|| dependent->GetName().SubStr(0, prefix.GetLength()) != prefix) {
+			Log(LogInformation, "cli")
+				<< "Object '" << dependent->GetName() << "' of type '" << dependent->GetReflectionType()->GetName()
+				<< "' depends on the changed object '" << object->GetName() << "', doing a full reload.";
+			return false;
+		}
+
+		if (std::find(dependents.begin(), dependents.end(), dependent) != dependents.end())
+			continue;
+
+		dependents.push_back(dependent);
+
+		if (!CollectDependents(dependent, deleted, applyRules, dependents))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * An object definition which was removed from or changed in its file by an incremental reload.
+ */
+struct RemovedDefinition
+{
+	String Path;
+	String Zone;
+	String Package;
+	ReloadDefinition Definition;
+};
+
+/**
+ * Deactivates and unregisters the items of a failed incremental reload along with their objects.
+ *
+ * @param context The activation context the items were evaluated in.
+ * @param newItems The items committed so far.
+ */
+static void DropReloadItems(const ActivationContext::Ptr& context, const std::vector<ConfigItem::Ptr>& newItems)
+{
+	std::vector<ConfigItem::Ptr> items = ConfigItem::GetContextItems(context);
+
+	for (auto& item : newItems) {
+		if (std::find(items.begin(), items.end(), item) == items.end())
+			items.push_back(item);
+	}
+
+	for (auto& item : items) {
+		ConfigObject::Ptr object = item->GetObject();
+
+		try {
+			if (object && object->IsActive())
+				object->Deactivate(true);
+		} catch (const std::exception&) {
+			/* Unregister anyway. */
+		}
+
+		item->Unregister();
+	}
+}
+
+/**
+ * Evaluates object definitions, commits and activates their items and carries the runtime state of the
+ * objects they replace over. Nothing is left behind if that fails.
+ *
+ * @param evaluate Evaluates the definitions.
+ * @param states The runtime state of the replaced objects.
+ * @param newItems Receives the activated items.
+ * @returns Whether the items were activated.
+ */
+static bool CommitReloadItems(const std::function<void (ScriptFrame&)>& evaluate,
+	const std::map<ReloadObjectName, Dictionary::Ptr>& states, std::vector<ConfigItem::Ptr>& newItems)
+{
+	ActivationScope ascope;
+
+	try {
+		ScriptFrame frame(true);
+		evaluate(frame);
+
+		WorkQueue upq (25000, Configuration::Concurrency);
+		upq.SetName("DaemonUtility::ReloadConfigFiles");
+
+		if (!ConfigItem::CommitItems(ascope.GetContext(), upq, newItems, true)) {
+			for (const boost::exception_ptr& ex : upq.GetExceptions()) {
+				Log(LogCritical, "config", DiagnosticInformation(ex, false));
+			}
+
+			BOOST_THROW_EXCEPTION(std::runtime_error("Can't commit the objects."));
+		}
+
+		Dependency::AssertNoCycles();
+
+		for (auto& item : newItems) {
+			ConfigObject::Ptr object = item->GetObject();
+
+			if (!object)
+				continue;
+
+			auto state (states.find(GetReloadObjectName(object)));
+
+			if (state != states.end()) {
+				Deserialize(object, state->second, false, FAState);
+				object->OnStateLoaded();
+				object->SetStateLoaded(true);
+			}
+		}
+
+		if (!ConfigItem::ActivateItems(newItems, true))
+			BOOST_THROW_EXCEPTION(std::runtime_error("Can't activate the objects."));
+	} catch (const std::exception& ex) {
+		Log(LogCritical, "cli")
+			<< "Can't load the object definitions for an incremental reload: " << DiagnosticInformation(ex, false);
+
+		DropReloadItems(ascope.GetContext(), newItems);
+		newItems.clear();
+		return false;
+	}
+
+	ApiListener::UpdateObjectAuthority();
+
+	return true;
+}
+
+/**
+ * Commits the removed object definitions again after an incremental reload failed, so that the previous
+ * objects are back until the full reload succeeds. Definitions whose objects still exist stay as they are.
+ *
+ * @param removed The definitions removed by the reload.
+ * @param states The runtime state of the deleted objects.
+ */
+static void RestoreDefinitions(const std::vector<RemovedDefinition>& removed, const std::map<ReloadObjectName, Dictionary::Ptr>& states)
+{
+	size_t restored = 0;
+	std::vector<ConfigItem::Ptr> newItems;
+
+	bool committed = CommitReloadItems([&removed, &restored](ScriptFrame& frame) {
+		for (auto& definition : removed) {
+			auto& names (definition.Definition.Objects);
+
+			if (std::any_of(names.begin(), names.end(), [](const ReloadObjectName& name) { return ConfigObject::GetObject(name.first, name.second); }))
+				continue;
+
+			ConfigCompiler::CompileText(definition.Path, definition.Definition.Source, definition.Zone, definition.Package)->Evaluate(frame);
+			restored++;
+		}
+	}, states, newItems);
+
+	if (committed) {
+		Log(LogInformation, "cli")
+			<< "Restored " << restored << " object definitions (" << newItems.size() << " objects) after the failed incremental reload.";
+	} else {
+		Log(LogCritical, "cli", "Can't restore the object definitions removed by the failed incremental reload, their objects are missing until the full reload succeeds.");
+	}
+}
+
+/**
+ * Applies the changes of the config files watched since EnableIncrementalReload() to the running
+ * objects, if the changes are limited to object definitions: objects whose definition was removed
+ * or changed are deleted and the new definitions are committed and activated like objects created
+ * via the API, their runtime state is carried over.
+ *
+ * @returns Whether the changes were applied, false if a full reload is needed.
+ */
+bool DaemonUtility::ReloadConfigFiles()
+{
+	std::unique_lock<std::mutex> lock (l_ReloadMutex);
+
+	/* Like for a full reload, API config changes have to wait. */
+	ConfigObjectsExclusiveLock objectsLock;
+
+	struct ChangedFile
+	{
+		String Path;
+		ReloadFile File;
+		std::unique_ptr<Expression> Expr;
+		std::vector<size_t> Added;
+	};
+
+	std::vector<ChangedFile> changedFiles;
+	std::set<ReloadObjectName> deleted;
+	std::vector<RemovedDefinition> removed;
+
+	try {
+		for (auto& dir : l_ReloadDirs) {
+			if (ListDirectory(dir.first) != dir.second) {
+				Log(LogInformation, "cli")
+					<< "Files were added to or removed from '" << dir.first << "', doing a full reload.";
+				return false;
+			}
+		}
+
+		for (auto& reloadFile : l_ReloadFiles) {
+			std::ifstream stream (reloadFile.first.CStr(), std::ifstream::in);
+
+			if (!stream) {
+				Log(LogInformation, "cli")
+					<< "Can't read config file '" << reloadFile.first << "', doing a full reload.";
+				return false;
+			}
+
+			std::string content ((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+			String text (std::move(content));
+			String hash = SHA256(text);
+
+			if (hash == reloadFile.second.Hash)
+				continue;
+
+			if (!reloadFile.second.ObjectsOnly) {
+				Log(LogInformation, "cli")
+					<< "Config file '" << reloadFile.first << "' changed and doesn't only define objects, doing a full reload.";
+				return false;
+			}
+
+			ChangedFile changed;
+			changed.Path = reloadFile.first;
+			changed.File.Hash = hash;
+			changed.File.Zone = reloadFile.second.Zone;
+			changed.File.Package = reloadFile.second.Package;
+			changed.File.ObjectsOnly = true;
+			changed.Expr = ConfigCompiler::CompileText(reloadFile.first, text, reloadFile.second.Zone, reloadFile.second.Package);
+
+			std::vector<ObjectDefinition> definitions;
+
+			if (!ConfigCompiler::GetObjectDefinitions(text, changed.Expr.get(), definitions)) {
+				Log(LogInformation, "cli")
+					<< "Config file '" << reloadFile.first << "' doesn't only define objects anymore, doing a full reload.";
+				return false;
+			}
+
+			/* Unchanged definitions keep their objects, no matter whether they moved. */
+			std::map<String, std::vector<size_t>> unchanged;
+			auto& old (reloadFile.second.Objects);
+
+			for (auto i (old.size()); i > 0u; i--)
+				unchanged[old[i - 1u].Source].push_back(i - 1u);
+
+			std::vector<bool> kept (old.size(), false);
+
+			for (decltype(definitions.size()) i = 0; i < definitions.size(); i++) {
+				auto& candidates (unchanged[definitions[i].Source]);
+
+				if (candidates.empty()) {
+					changed.File.Objects.push_back({ definitions[i].Source, {} });
+					changed.Added.push_back(i);
+				} else {
+					changed.File.Objects.push_back(old[candidates.back()]);
+					kept[candidates.back()] = true;
+					candidates.pop_back();
+				}
+			}
+
+			for (decltype(old.size()) i = 0; i < old.size(); i++) {
+				if (kept[i])
+					continue;
+
+				removed.push_back({ reloadFile.first, reloadFile.second.Zone, reloadFile.second.Package, old[i] });
+
+				for (auto& name : old[i].Objects)
+					deleted.emplace(name);
+			}
+
+			changedFiles.emplace_back(std::move(changed));
+		}
+	} catch (const std::exception& ex) {
+		Log(LogInformation, "cli")
+			<< "Can't reload the changed config files incrementally, doing a full reload: " << DiagnosticInformation(ex, false);
+		return false;
+	}
+
+	if (changedFiles.empty()) {
+		Log(LogInformation, "cli", "No config files changed.");
+		return true;
+	}
+
+	std::set<ReloadLocation> applyRules;
+
+	ApplyRule::ForEachRule([&applyRules](const ApplyRule::Ptr& rule, Type*) {
+		applyRules.emplace(GetReloadLocation(rule->GetDebugInfo()));
+	});
+
+	std::vector<ConfigObject::Ptr> objects, dependents;
+
+	for (auto& name : deleted) {
+		ConfigObject::Ptr object = ConfigObject::GetObject(name.first, name.second);
+
+		if (!object)
+			continue;
+
+		if (dynamic_pointer_cast<Application>(object)) {
+			Log(LogInformation, "cli")
+				<< "The application object '" << object->GetName() << "' changed, doing a full reload.";
+			return false;
+		}
+
+		Dictionary::Ptr originalAttributes = object->GetOriginalAttributes();
+
+		if (originalAttributes && originalAttributes->GetLength() > 0) {
+			Log(LogInformation, "cli")
+				<< "Object '" << object->GetName() << "' of type '" << name.first << "' has modified attributes, doing a full reload.";
+			return false;
+		}
+
+		if (!CollectDependents(object, deleted, applyRules, dependents))
+			return false;
+
+		objects.push_back(object);
+	}
+
+	std::map<ReloadObjectName, Dictionary::Ptr> states;
+
+	for (auto& list : { &objects, &dependents }) {
+		for (auto& object : *list) {
+			Dictionary::Ptr state = Serialize(object, FAState);
+
+			if (state)
+				states.emplace(GetReloadObjectName(object), state);
+		}
+	}
+
+	/* The new definitions may reuse the names of the deleted objects, so they can't be committed first.
+	 * If anything fails, the removed definitions are committed again and the previous objects are back. */
+	Array::Ptr errors = new Array();
+
+	for (auto& object : objects) {
+		if (!object->IsActive())
+			continue;
+
+		if (!ConfigObjectUtility::DeleteObjectHelper(object, true, errors, nullptr)) {
+			Log(LogCritical, "cli")
+				<< "Can't delete object '" << object->GetName() << "' for an incremental reload, doing a full reload: " << errors->Join("; ");
+
+			RestoreDefinitions(removed, states);
+			return false;
+		}
+	}
+
+	std::vector<ConfigItem::Ptr> newItems;
+
+	bool committed = CommitReloadItems([&changedFiles](ScriptFrame& frame) {
+		for (auto& changed : changedFiles) {
+			auto& statements (dynamic_cast<DictExpression&>(*changed.Expr).GetExpressions());
+
+			for (auto i : changed.Added)
+				statements[i]->Evaluate(frame);
+		}
+	}, states, newItems);
+
+	if (!committed) {
+		Log(LogCritical, "cli", "Can't apply the changed object definitions incrementally, restoring the previous objects and doing a full reload.");
+
+		RestoreDefinitions(removed, states);
+		return false;
+	}
+
+	std::map<ReloadLocation, std::vector<ReloadObjectName>> objectsByLocation;
+
+	for (auto& item : newItems) {
+		ConfigObject::Ptr object = item->GetObject();
+
+		if (object)
+			objectsByLocation[GetReloadLocation(item->GetDebugInfo())].emplace_back(GetReloadObjectName(object));
+	}
+
+	size_t addedDefinitions = 0;
+
+	for (auto& changed : changedFiles) {
+		auto& statements (dynamic_cast<DictExpression&>(*changed.Expr).GetExpressions());
+
+		for (auto i : changed.Added) {
+			auto& definition (changed.File.Objects[i]);
+			definition.Objects = objectsByLocation[GetReloadLocation(statements[i]->GetDebugInfo())];
+			addedDefinitions++;
+		}
+
+		l_ReloadFiles[changed.Path] = std::move(changed.File);
+	}
+
+	/* The cluster config sync reads the files of zones.d etc. from the API zones directory. */
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (listener)
+		listener->UpdateLocalZoneDirs();
+
+	Application::SetLastReloadFailed(0);
+
+	Log(LogInformation, "cli")
+		<< "Reloaded " << changedFiles.size() << " changed config files incrementally: Removed " << removed.size()
+		<< " and added " << addedDefinitions << " object definitions (" << objects.size() + dependents.size()
+		<< " objects deleted, " << newItems.size() << " objects created).";
 
 	return true;
 }
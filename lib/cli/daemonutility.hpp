@@ -19,7 +19,11 @@ class DaemonUtility
 public:
 	static bool ValidateConfigFiles(const std::vector<std::string>& configs, const String& objectsFile = String());
 	static bool LoadConfigFiles(const std::vector<std::string>& configs, std::vector<ConfigItem::Ptr>& newItems,
-		const String& objectsFile = String(), const String& varsfile = String());
+		const String& objectsFile = String(), const String& varsfile = String(),
+		const String& snapshotFile = String(), bool useSnapshot = false);
+
+	static void EnableIncrementalReload(const std::vector<std::string>& configs);
+	static bool ReloadConfigFiles();
 };
 
 }
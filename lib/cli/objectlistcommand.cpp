@@ -2,6 +2,7 @@
 
 #include "cli/objectlistcommand.hpp"
 #include "cli/objectlistutility.hpp"
+#include "config/configcompilercontext.hpp"
 #include "base/logger.hpp"
 #include "base/application.hpp"
 #include "base/convert.hpp"
@@ -11,8 +12,10 @@
 #include "base/netstring.hpp"
 #include "base/stdiostream.hpp"
 #include "base/debug.hpp"
+#include "base/exception.hpp"
 #include "base/objectlock.hpp"
 #include "base/console.hpp"
+#include "base/utility.hpp"
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <fstream>
@@ -57,6 +60,116 @@ static time_t GetCtime(const String& path)
 	return rc ? 0 : statbuf.st_ctime;
 }
 
+static bool GetSize(const String& path, uint_fast64_t& size)
+{
+#ifdef _WIN32
+	struct _stat64 statbuf;
+	int rc = _stat64(path.CStr(), &statbuf);
+#else /* _WIN32 */
+	struct stat statbuf;
+	int rc = stat(path.CStr(), &statbuf);
+#endif /* _WIN32 */
+
+	if (rc)
+		return false;
+
+	size = statbuf.st_size;
+	return true;
+}
+
+/**
+ * Looks up the objects matching the filters in the index written next to the objects file.
+ *
+ * @param offsets Where the matching objects start in the objects file.
+ * @returns false if there's no index or it doesn't belong to the objects file.
+ */
+static bool GetIndexedObjects(const String& objectfile, const String& name_filter, const String& type_filter,
+	std::vector<uint_fast64_t>& offsets)
+{
+	String indexfile = ConfigCompilerContext::GetObjectsIndexPath(objectfile);
+	uint_fast64_t objectsSize;
+
+	if (!Utility::PathExists(indexfile) || !GetSize(objectfile, objectsSize))
+		return false;
+
+	std::fstream fp;
+	fp.open(indexfile.CStr(), std::ios_base::in);
+
+	StdioStream::Ptr sfp = new StdioStream(&fp, false);
+	bool header = true;
+
+	String message;
+	StreamReadContext src;
+
+	try {
+		for (;;) {
+			StreamReadStatus srs = NetString::ReadStringFromStream(sfp, &message, src);
+
+			if (srs == StatusEof)
+				break;
+
+			if (srs != StatusNewItem)
+				continue;
+
+			if (header) {
+				Dictionary::Ptr info = JsonDecode(message);
+
+				if (static_cast<uint_fast64_t>(info->Get("objects_size")) != objectsSize)
+					return false;
+
+				header = false;
+				continue;
+			}
+
+			/* [ type, name, internal name, offset ], see ConfigCompilerContext::WriteObjectsIndex() */
+			Array::Ptr entry = JsonDecode(message);
+
+			String type = entry->Get(0);
+			String name = entry->Get(1);
+			String internal_name = entry->Get(2);
+
+			if (!name_filter.IsEmpty() && !Utility::Match(name_filter, name) && !Utility::Match(name_filter, internal_name))
+				continue;
+			if (!type_filter.IsEmpty() && !Utility::Match(type_filter, type))
+				continue;
+
+			offsets.push_back(static_cast<uint_fast64_t>(entry->Get(3)));
+		}
+	} catch (const std::exception& ex) {
+		Log(LogWarning, "cli")
+			<< "Ignoring the objects index file '" << indexfile << "': " << DiagnosticInformation(ex, false);
+		offsets.clear();
+		return false;
+	}
+
+	return !header;
+}
+
+/**
+ * Reads the netstring starting at the given offset.
+ */
+static bool ReadObjectAt(std::istream& fp, uint_fast64_t offset, String& message)
+{
+	fp.seekg(offset);
+
+	size_t len = 0;
+	char ch;
+
+	while (fp.get(ch) && ch >= '0' && ch <= '9')
+		len = len * 10 + (ch - '0');
+
+	if (!fp || ch != ':')
+		return false;
+
+	std::string buffer (len, '\0');
+
+	if (!fp.read(&buffer[0], len) || !fp.get(ch) || ch != ',')
+		return false;
+
+	message = std::move(buffer);
+	return true;
+}
+
 /**
  * The entry point for the "object list" CLI command.
  *
@@ -73,10 +186,6 @@ int ObjectListCommand::Run(const boost::program_options::variables_map& vm, cons
 		return 1;
 	}
 
-	std::fstream fp;
-	fp.open(objectfile.CStr(), std::ios_base::in);
-
-	StdioStream::Ptr sfp = new StdioStream(&fp, false);
 	unsigned long objects_count = 0;
 	std::map<String, int> type_count;
 
@@ -88,24 +197,49 @@ int ObjectListCommand::Run(const boost::program_options::variables_map& vm, cons
 		type_filter = vm["type"].as<std::string>();
 
 	bool first = true;
+	std::vector<uint_fast64_t> offsets;
 
-	String message;
-	StreamReadContext src;
-	for (;;) {
-		StreamReadStatus srs = NetString::ReadStringFromStream(sfp, &message, src);
+	/* Without filters all objects are decoded anyway. */
+	if ((!name_filter.IsEmpty() || !type_filter.IsEmpty()) && GetIndexedObjects(objectfile, name_filter, type_filter, offsets)) {
+		std::ifstream fp;
+		fp.open(objectfile.CStr(), std::ios_base::in | std::ios_base::binary);
 
-		if (srs == StatusEof)
-			break;
+		String message;
 
-		if (srs != StatusNewItem)
-			continue;
+		for (auto offset : offsets) {
+			if (!ReadObjectAt(fp, offset, message)) {
+				Log(LogCritical, "cli")
+					<< "Objects file '" << objectfile << "' doesn't match its index. Consider running 'icinga2 daemon -C --dump-objects' again.";
+				return 1;
+			}
 
-		ObjectListUtility::PrintObject(std::cout, first, message, type_count, name_filter, type_filter);
-		objects_count++;
-	}
+			ObjectListUtility::PrintObject(std::cout, first, message, type_count, name_filter, type_filter);
+			objects_count++;
+		}
+	} else {
+		std::fstream fp;
+		fp.open(objectfile.CStr(), std::ios_base::in);
+
+		StdioStream::Ptr sfp = new StdioStream(&fp, false);
+
+		String message;
+		StreamReadContext src;
+		for (;;) {
+			StreamReadStatus srs = NetString::ReadStringFromStream(sfp, &message, src);
+
+			if (srs == StatusEof)
+				break;
 
-	sfp->Close();
-	fp.close();
+			if (srs != StatusNewItem)
+				continue;
+
+			ObjectListUtility::PrintObject(std::cout, first, message, type_count, name_filter, type_filter);
+			objects_count++;
+		}
+
+		sfp->Close();
+		fp.close();
+	}
 
 	if (vm.count("count")) {
 		if (!first)
@@ -17,6 +17,7 @@
 #include "base/application.hpp"
 #include "base/utility.hpp"
 #include "base/statsfunction.hpp"
+#include "base/perfdatavalue.hpp"
 #include <boost/algorithm/string.hpp>
 
 using namespace icinga;
@@ -25,12 +26,35 @@ REGISTER_TYPE(CompatLogger);
 
 REGISTER_STATSFUNCTION(CompatLogger, &CompatLogger::StatsFunc);
 
-void CompatLogger::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr&)
+/* At most this many flush thresholds worth of lines are buffered, the rest is dropped. */
+static const size_t l_MaxBufferedBlocks = 64;
+
+void CompatLogger::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
 {
 	DictionaryData nodes;
 
 	for (const CompatLogger::Ptr& compat_logger : ConfigType::GetObjectsByType<CompatLogger>()) {
-		nodes.emplace_back(compat_logger->GetName(), 1); // add more stats
+		size_t bufferedBytes;
+
+		{
+			std::unique_lock<std::mutex> lock (compat_logger->m_BufferMutex);
+			bufferedBytes = compat_logger->m_Buffer.size();
+		}
+
+		double writtenBytes = compat_logger->m_WrittenBytes;
+		double droppedLines = compat_logger->m_DroppedLines;
+
+		nodes.emplace_back(compat_logger->GetName(), new Dictionary({
+			{ "buffered_bytes", bufferedBytes },
+			{ "written_bytes", writtenBytes },
+			{ "dropped_lines", droppedLines }
+		}));
+
+		String prefix = "compatlogger_" + compat_logger->GetName();
+
+		perfdata->Add(new PerfdataValue(prefix + "_buffered_bytes", bufferedBytes));
+		perfdata->Add(new PerfdataValue(prefix + "_written_bytes", writtenBytes, true));
+		perfdata->Add(new PerfdataValue(prefix + "_dropped_lines", droppedLines, true));
 	}
 
 	status->Set("compatlogger", new Dictionary(std::move(nodes)));
@@ -69,11 +93,24 @@ void CompatLogger::Start(bool runtimeCreated)
 		ExternalCommandHandler(command, arguments);
 	});
 
+	m_WorkQueue.SetName("CompatLogger, " + GetName());
+	m_WorkQueue.SetExceptionCallback([this](boost::exception_ptr exp) {
+		Log(LogCritical, "CompatLogger")
+			<< "'" << GetName() << "': Exception while writing the compat log: " << DiagnosticInformation(exp);
+	});
+
+	/* All file operations run on the work queue, the event handlers only buffer their lines. */
+	m_WorkQueue.Enqueue([this]() { ReopenFile(false); });
+
+	m_FlushTimer = Timer::Create();
+	m_FlushTimer->OnTimerExpired.connect([this](const Timer * const&) { FlushTimerHandler(); });
+	m_FlushTimer->SetInterval(GetFlushInterval());
+	m_FlushTimer->Start();
+
 	m_RotationTimer = Timer::Create();
 	m_RotationTimer->OnTimerExpired.connect([this](const Timer * const&) { RotationTimerHandler(); });
 	m_RotationTimer->Start();
 
-	ReopenFile(false);
 	ScheduleNextRotation();
 }
 
@@ -82,8 +119,16 @@ void CompatLogger::Start(bool runtimeCreated)
  */
 void CompatLogger::Stop(bool runtimeRemoved)
 {
+	m_FlushTimer->Stop(true);
 	m_RotationTimer->Stop(true);
 
+	/* Write what is still buffered. */
+	m_WorkQueue.Enqueue([this]() {
+		Flush();
+		m_OutputFile.close();
+	}, PriorityLow);
+	m_WorkQueue.Join();
+
 	Log(LogInformation, "CompatLogger")
 		<< "'" << GetName() << "' stopped.";
 
@@ -147,11 +192,7 @@ void CompatLogger::CheckResultHandler(const Checkable::Ptr& checkable, const Che
 
 	}
 
-	{
-		ObjectLock olock(this);
-		WriteLine(msgbuf.str());
-		Flush();
-	}
+	WriteLine(msgbuf.str());
 }
 
 /**
@@ -183,11 +224,7 @@ void CompatLogger::TriggerDowntimeHandler(const Downtime::Ptr& downtime)
 			<< "";
 	}
 
-	{
-		ObjectLock oLock(this);
-		WriteLine(msgbuf.str());
-		Flush();
-	}
+	WriteLine(msgbuf.str());
 }
 
 /**
@@ -230,11 +267,7 @@ void CompatLogger::RemoveDowntimeHandler(const Downtime::Ptr& downtime)
 			<< "";
 	}
 
-	{
-		ObjectLock oLock(this);
-		WriteLine(msgbuf.str());
-		Flush();
-	}
+	WriteLine(msgbuf.str());
 }
 
 /**
@@ -294,11 +327,7 @@ void CompatLogger::NotificationSentHandler(const Notification::Ptr& notification
 			<< "";
 	}
 
-	{
-		ObjectLock oLock(this);
-		WriteLine(msgbuf.str());
-		Flush();
-	}
+	WriteLine(msgbuf.str());
 }
 
 /**
@@ -338,11 +367,7 @@ void CompatLogger::FlappingChangedHandler(const Checkable::Ptr& checkable)
 			<< "";
 	}
 
-	{
-		ObjectLock oLock(this);
-		WriteLine(msgbuf.str());
-		Flush();
-	}
+	WriteLine(msgbuf.str());
 }
 
 void CompatLogger::EnableFlappingChangedHandler(const Checkable::Ptr& checkable)
@@ -374,11 +399,7 @@ void CompatLogger::EnableFlappingChangedHandler(const Checkable::Ptr& checkable)
 			<< "";
 	}
 
-	{
-		ObjectLock oLock(this);
-		WriteLine(msgbuf.str());
-		Flush();
-	}
+	WriteLine(msgbuf.str());
 }
 
 void CompatLogger::ExternalCommandHandler(const String& command, const std::vector<String>& arguments)
@@ -389,11 +410,7 @@ void CompatLogger::ExternalCommandHandler(const String& command, const std::vect
 		<< boost::algorithm::join(arguments, ";")
 		<< "";
 
-	{
-		ObjectLock oLock(this);
-		WriteLine(msgbuf.str());
-		Flush();
-	}
+	WriteLine(msgbuf.str());
 }
 
 void CompatLogger::EventCommandHandler(const Checkable::Ptr& checkable)
@@ -425,11 +442,7 @@ void CompatLogger::EventCommandHandler(const Checkable::Ptr& checkable)
 			<< event_command_name;
 	}
 
-	{
-		ObjectLock oLock(this);
-		WriteLine(msgbuf.str());
-		Flush();
-	}
+	WriteLine(msgbuf.str());
 }
 
 String CompatLogger::GetHostStateString(const Host::Ptr& host)
@@ -440,32 +453,84 @@ String CompatLogger::GetHostStateString(const Host::Ptr& host)
 	return Host::StateToString(host->GetState());
 }
 
+void CompatLogger::AppendLine(std::string& buffer, const String& line)
+{
+	buffer.append("[" + Convert::ToString((long)Utility::GetTime()) + "] ");
+	buffer.append(line.GetData());
+	buffer.append(1, '\n');
+}
+
+/**
+ * Buffers a line for the work queue, which writes all buffered lines as one block.
+ * The timestamp is taken now, not when the line is written.
+ *
+ * @threadsafety Always.
+ */
 void CompatLogger::WriteLine(const String& line)
 {
-	ASSERT(OwnsLock());
+	auto threshold (static_cast<size_t>(GetFlushThreshold()));
+	bool flush;
 
-	if (!m_OutputFile.good())
-		return;
+	{
+		std::unique_lock<std::mutex> lock (m_BufferMutex);
+
+		/* Don't let a stuck disk eat up the memory. */
+		if (m_Buffer.size() >= threshold * l_MaxBufferedBlocks) {
+			m_DroppedLines++;
+			return;
+		}
+
+		AppendLine(m_Buffer, line);
 
-	m_OutputFile << "[" << (long)Utility::GetTime() << "] " << line << "\n";
+		flush = m_Buffer.size() >= threshold;
+	}
+
+	if (flush && !m_FlushPending.exchange(true))
+		m_WorkQueue.Enqueue([this]() { Flush(); });
+}
+
+void CompatLogger::FlushTimerHandler()
+{
+	if (!m_FlushPending.exchange(true))
+		m_WorkQueue.Enqueue([this]() { Flush(); });
 }
 
 void CompatLogger::Flush()
 {
-	ASSERT(OwnsLock());
+	ASSERT(m_WorkQueue.IsWorkerThread());
+
+	/* Lines buffered from now on need another flush. */
+	m_FlushPending = false;
+
+	std::string buffer;
+
+	{
+		std::unique_lock<std::mutex> lock (m_BufferMutex);
+		buffer.swap(m_Buffer);
+	}
+
+	WriteBlock(buffer);
+}
+
+void CompatLogger::WriteBlock(const std::string& block)
+{
+	ASSERT(m_WorkQueue.IsWorkerThread());
 
-	if (!m_OutputFile.good())
+	if (block.empty() || !m_OutputFile.good())
 		return;
 
-	m_OutputFile << std::flush;
+	m_OutputFile.write(block.c_str(), block.size());
+	m_OutputFile.flush();
+
+	m_WrittenBytes += block.size();
 }
 
-/**
- * @threadsafety Always.
- */
 void CompatLogger::ReopenFile(bool rotate)
 {
-	ObjectLock olock(this);
+	ASSERT(m_WorkQueue.IsWorkerThread());
+
+	/* Lines buffered before the rotation belong to the old file. */
+	Flush();
 
 	String tempFile = GetLogDir() + "/icinga.log";
 
@@ -491,8 +556,10 @@ void CompatLogger::ReopenFile(bool rotate)
 		return;
 	}
 
-	WriteLine("LOG ROTATION: " + GetRotationMethod());
-	WriteLine("LOG VERSION: 2.0");
+	std::string header;
+
+	AppendLine(header, "LOG ROTATION: " + GetRotationMethod());
+	AppendLine(header, "LOG VERSION: 2.0");
 
 	for (const Host::Ptr& host : ConfigType::GetObjectsByType<Host>()) {
 		String output;
@@ -509,7 +576,7 @@ void CompatLogger::ReopenFile(bool rotate)
 			<< host->GetCheckAttempt() << ";"
 			<< output << "";
 
-		WriteLine(msgbuf.str());
+		AppendLine(header, msgbuf.str());
 	}
 
 	for (const Service::Ptr& service : ConfigType::GetObjectsByType<Service>()) {
@@ -530,10 +597,10 @@ void CompatLogger::ReopenFile(bool rotate)
 			<< service->GetCheckAttempt() << ";"
 			<< output << "";
 
-		WriteLine(msgbuf.str());
+		AppendLine(header, msgbuf.str());
 	}
 
-	Flush();
+	WriteBlock(header);
 }
 
 void CompatLogger::ScheduleNextRotation()
@@ -592,13 +659,7 @@ void CompatLogger::ScheduleNextRotation()
  */
 void CompatLogger::RotationTimerHandler()
 {
-	try {
-		ReopenFile(true);
-	} catch (...) {
-		ScheduleNextRotation();
-
-		throw;
-	}
+	m_WorkQueue.Enqueue([this]() { ReopenFile(true); });
 
 	ScheduleNextRotation();
 }
@@ -612,3 +673,11 @@ void CompatLogger::ValidateRotationMethod(const Lazy<String>& lvalue, const Vali
 		BOOST_THROW_EXCEPTION(ValidationError(this, { "rotation_method" }, "Rotation method '" + lvalue() + "' is invalid."));
 	}
 }
+
+void CompatLogger::ValidateFlushThreshold(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<CompatLogger>::ValidateFlushThreshold(lvalue, utils);
+
+	if (lvalue() < 1)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "flush_threshold" }, "Flush threshold must be at least 1 byte."));
+}
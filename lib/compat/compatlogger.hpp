@@ -5,8 +5,13 @@
 
 #include "compat/compatlogger-ti.hpp"
 #include "icinga/service.hpp"
+#include "base/atomic.hpp"
 #include "base/timer.hpp"
+#include "base/workqueue.hpp"
+#include <cstdint>
 #include <fstream>
+#include <mutex>
+#include <string>
 
 namespace icinga
 {
@@ -25,6 +30,7 @@ public:
 	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
 
 	void ValidateRotationMethod(const Lazy<String>& lvalue, const ValidationUtils& utils) override;
+	void ValidateFlushThreshold(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
 
 protected:
 	void Start(bool runtimeCreated) override;
@@ -32,7 +38,11 @@ protected:
 
 private:
 	void WriteLine(const String& line);
+	void FlushTimerHandler();
 	void Flush();
+	void WriteBlock(const std::string& block);
+
+	static void AppendLine(std::string& buffer, const String& line);
 
 	void CheckResultHandler(const Checkable::Ptr& service, const CheckResult::Ptr& cr);
 	void NotificationSentHandler(const Notification::Ptr& notification, const Checkable::Ptr& service,
@@ -47,6 +57,17 @@ private:
 
 	static String GetHostStateString(const Host::Ptr& host);
 
+	WorkQueue m_WorkQueue{10000000, 1};
+
+	/* Lines not yet written by the work queue */
+	std::mutex m_BufferMutex;
+	std::string m_Buffer;
+
+	Atomic<bool> m_FlushPending{false};
+	Atomic<uint_fast64_t> m_WrittenBytes{0};
+	Atomic<uint_fast64_t> m_DroppedLines{0};
+
+	Timer::Ptr m_FlushTimer;
 	Timer::Ptr m_RotationTimer;
 	void RotationTimerHandler();
 	void ScheduleNextRotation();
@@ -8,9 +8,15 @@
 #include "base/exception.hpp"
 #include "base/application.hpp"
 #include "base/statsfunction.hpp"
+#include <boost/algorithm/string/trim.hpp>
+#include <memory>
+#include <unordered_map>
 
 using namespace icinga;
 
+/* Large reads, so a busy pipe is drained in batches of hundreds of commands. */
+static const size_t l_CommandPipeReadSize = 64 * 1024;
+
 REGISTER_TYPE(ExternalCommandListener);
 
 REGISTER_STATSFUNCTION(ExternalCommandListener, &ExternalCommandListener::StatsFunc);
@@ -39,6 +45,8 @@ void ExternalCommandListener::Start(bool runtimeCreated)
 	Log(LogWarning, "ExternalCommandListener")
 		<< "This feature is DEPRECATED and may be removed in future releases. Check the roadmap at https://github.com/Icinga/icinga2/milestones";
 #ifndef _WIN32
+	m_CommandQueue.SetName("ExternalCommandListener, " + GetName());
+
 	String path = GetCommandPath();
 	m_CommandThread = std::thread([this, path]() { CommandPipeThread(path); });
 	m_CommandThread.detach();
@@ -97,18 +105,17 @@ void ExternalCommandListener::CommandPipeThread(const String& commandPath)
 			return;
 		}
 
-		FIFO::Ptr fifo = new FIFO();
 		Socket::Ptr sock = new Socket(fd);
-		StreamReadContext src;
+		std::unique_ptr<char[]> buffer (new char[l_CommandPipeReadSize]);
+		std::string pending;
 
 		for (;;) {
 			sock->Poll(true, false);
 
-			char buffer[8192];
 			size_t rc;
 
 			try {
-				rc = sock->Read(buffer, sizeof(buffer));
+				rc = sock->Read(buffer.get(), l_CommandPipeReadSize);
 			} catch (const std::exception& ex) {
 				/* We have read all data. */
 				if (errno == EAGAIN)
@@ -123,28 +130,124 @@ void ExternalCommandListener::CommandPipeThread(const String& commandPath)
 			if (rc == 0)
 				continue;
 
-			fifo->Write(buffer, rc);
+			pending.append(buffer.get(), rc);
+
+			std::vector<String> commands;
+			size_t begin = 0;
 
 			for (;;) {
-				String command;
-				StreamReadStatus srs = fifo->ReadLine(&command, src);
+				size_t end = pending.find('\n', begin);
 
-				if (srs != StatusNewItem)
+				if (end == std::string::npos)
 					break;
 
-				try {
-					Log(LogInformation, "ExternalCommandListener")
-						<< "Executing external command: " << command;
-
-					ExternalCommandProcessor::Execute(command);
-				} catch (const std::exception& ex) {
-					Log(LogWarning, "ExternalCommandListener")
-						<< "External command failed: " << DiagnosticInformation(ex, false);
-					Log(LogNotice, "ExternalCommandListener")
-						<< "External command failed: " << DiagnosticInformation(ex, true);
-				}
+				String command (pending.begin() + begin, pending.begin() + end);
+				boost::algorithm::trim_right(command);
+
+				if (!command.IsEmpty())
+					commands.emplace_back(std::move(command));
+
+				begin = end + 1u;
 			}
+
+			pending.erase(0, begin);
+
+			ExecuteCommands(commands);
+		}
+	}
+}
+
+/**
+ * @returns The host of a PROCESS_HOST_CHECK_RESULT or PROCESS_SERVICE_CHECK_RESULT command, empty for all other commands.
+ */
+static String GetCheckResultHost(const String& command)
+{
+	size_t nameBegin = command.FindFirstOf(']');
+
+	if (nameBegin == String::NPos)
+		return String();
+
+	nameBegin += 2u;
+
+	size_t nameEnd = command.FindFirstOf(';', nameBegin);
+
+	if (nameEnd == String::NPos)
+		return String();
+
+	String name = command.SubStr(nameBegin, nameEnd - nameBegin);
+
+	if (name != "PROCESS_SERVICE_CHECK_RESULT" && name != "PROCESS_HOST_CHECK_RESULT")
+		return String();
+
+	size_t hostEnd = command.FindFirstOf(';', nameEnd + 1u);
+
+	return command.SubStr(nameEnd + 1u, hostEnd == String::NPos ? String::NPos : hostEnd - nameEnd - 1u);
+}
+
+static void ExecuteCommand(const String& command)
+{
+	try {
+		Log(LogInformation, "ExternalCommandListener")
+			<< "Executing external command: " << command;
+
+		ExternalCommandProcessor::Execute(command);
+	} catch (const std::exception& ex) {
+		Log(LogWarning, "ExternalCommandListener")
+			<< "External command failed: " << DiagnosticInformation(ex, false);
+		Log(LogNotice, "ExternalCommandListener")
+			<< "External command failed: " << DiagnosticInformation(ex, true);
+	}
+}
+
+/**
+ * Executes the commands read at once. Check results are run in parallel, though the ones for the
+ * same host (and thus its services) keep their order. All other commands may affect any object or
+ * the whole process, so they're run on their own once all commands before them have finished.
+ *
+ * @param commands The commands in the order they were read.
+ */
+void ExternalCommandListener::ExecuteCommands(const std::vector<String>& commands)
+{
+	std::unordered_map<String, size_t> groupsByHost;
+	std::vector<std::vector<const String *>> groups;
+
+	auto runGroups ([this, &groupsByHost, &groups]() {
+		if (groups.empty())
+			return;
+
+		if (groups.size() == 1u) {
+			for (auto command : groups.front())
+				ExecuteCommand(*command);
+		} else {
+			m_CommandQueue.ParallelForStealing(groups, [](const std::vector<const String *>& group) {
+				for (auto command : group)
+					ExecuteCommand(*command);
+			});
+
+			m_CommandQueue.Join();
 		}
+
+		groupsByHost.clear();
+		groups.clear();
+	});
+
+	for (auto& command : commands) {
+		String host = GetCheckResultHost(command);
+
+		if (host.IsEmpty()) {
+			runGroups();
+			ExecuteCommand(command);
+			continue;
+		}
+
+		auto group (groupsByHost.emplace(std::move(host), groups.size()));
+
+		if (group.second)
+			groups.emplace_back();
+
+		groups[group.first->second].emplace_back(&command);
 	}
+
+	runGroups();
 }
 #endif /* _WIN32 */
@@ -7,8 +7,10 @@
 #include "base/objectlock.hpp"
 #include "base/timer.hpp"
 #include "base/utility.hpp"
+#include "base/workqueue.hpp"
 #include <thread>
 #include <iostream>
+#include <vector>
 
 namespace icinga
 {
@@ -31,8 +33,10 @@ protected:
 private:
 #ifndef _WIN32
 	std::thread m_CommandThread;
+	WorkQueue m_CommandQueue {0, 4};
 
 	void CommandPipeThread(const String& commandPath);
+	void ExecuteCommands(const std::vector<String>& commands);
 #endif /* _WIN32 */
 };
 
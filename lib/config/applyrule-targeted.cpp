@@ -3,6 +3,9 @@
 #include "base/string.hpp"
 #include "config/applyrule.hpp"
 #include "config/expression.hpp"
+#include "config/vmops.hpp"
+#include "base/array.hpp"
+#include "base/objectlock.hpp"
 #include <utility>
 #include <vector>
 
@@ -50,13 +53,105 @@ const std::set<ApplyRule::Ptr>& ApplyRule::GetTargetedServiceRules(const Type::P
 	return noRules;
 }
 
+/**
+ * @returns All ApplyRules targeting only services of specific hosts including the given host. (See AddTargetedRule().)
+ */
+const std::set<ApplyRule::Ptr>& ApplyRule::GetTargetedServicesOfHostRules(const Type::Ptr& sourceType, const String& host)
+{
+	auto perSourceType (m_Rules.find(sourceType.get()));
+
+	if (perSourceType != m_Rules.end()) {
+		auto perHost (perSourceType->second.Targeted.find(host));
+
+		if (perHost != perSourceType->second.Targeted.end()) {
+			return perHost->second.ForAllServices;
+		}
+	}
+
+	static const std::set<ApplyRule::Ptr> noRules;
+	return noRules;
+}
+
+/**
+ * Adds all ApplyRules for the given host which can only match hosts with specific custom vars, the host's
+ * custom vars among them, to the given set. (See AddTargetedRule().) These still have to be evaluated.
+ */
+void ApplyRule::GetTargetedHostVarRules(const Type::Ptr& sourceType, const Object::Ptr& host, std::set<ApplyRule::Ptr>& rules)
+{
+	auto perSourceType (m_Rules.find(sourceType.get()));
+
+	if (perSourceType != m_Rules.end()) {
+		GetTargetedHostVarRules(perSourceType->second.TargetedByHostVar, host, rules);
+	}
+}
+
+/**
+ * Adds all ApplyRules for services of the given host which can only match services of hosts with specific
+ * custom vars, the host's custom vars among them, to the given set. (See AddTargetedRule().)
+ * These still have to be evaluated.
+ */
+void ApplyRule::GetTargetedServiceHostVarRules(const Type::Ptr& sourceType, const Object::Ptr& host, std::set<ApplyRule::Ptr>& rules)
+{
+	auto perSourceType (m_Rules.find(sourceType.get()));
+
+	if (perSourceType != m_Rules.end()) {
+		GetTargetedHostVarRules(perSourceType->second.TargetedServicesByHostVar, host, rules);
+	}
+}
+
+void ApplyRule::GetTargetedHostVarRules(const std::unordered_map<String, PerHostVar>& perVars, const Object::Ptr& host, std::set<ApplyRule::Ptr>& rules)
+{
+	if (perVars.empty()) {
+		return;
+	}
+
+	/* The same lookups as the ones of host.vars.V */
+	Value vars = VMOps::GetField(host, "vars");
+
+	for (auto& perVar : perVars) {
+		Value value = VMOps::GetField(vars, perVar.first);
+
+		if (value.IsString()) {
+			auto perValue (perVar.second.Equal.find(value.Get<String>()));
+
+			if (perValue != perVar.second.Equal.end()) {
+				rules.insert(perValue->second.begin(), perValue->second.end());
+			}
+		}
+
+		if (perVar.second.AllIn.empty()) {
+			continue;
+		}
+
+		if (value.IsObjectType<Array>()) {
+			Array::Ptr arr = value;
+			ObjectLock olock (arr);
+
+			for (auto& element : arr) {
+				if (element.IsString()) {
+					auto perElement (perVar.second.In.find(element.Get<String>()));
+
+					if (perElement != perVar.second.In.end()) {
+						rules.insert(perElement->second.begin(), perElement->second.end());
+					}
+				}
+			}
+		} else if (!value.IsEmpty()) {
+			/* The 'in' operator fails for anything but arrays, let the rules report that. */
+			rules.insert(perVar.second.AllIn.begin(), perVar.second.AllIn.end());
+		}
+	}
+}
+
 /**
  * If the given ApplyRule targets only specific parent objects, add it to the respective "index".
  *
  * - The above means for apply T "N" to Host: assign where host.name == "H" [ || host.name == "h" ... ]
  * - For apply T "N" to Service it means: assign where host.name == "H" && service.name == "S" [ || host.name == "h" && service.name == "s" ... ]
+ * - Or, for apply T "N" to Service, all services of specific hosts: assign where host.name == "H" [ || host.name == "h" ... ]
+ * - Otherwise, for both: assign where host.vars.V == "v" [ || "w" in host.vars.W ... ] (see GetTargetHostVars())
  *
- * The order of operands of || && == doesn't matter.
+ * The order of operands of || && == doesn't matter (except for custom vars).
  *
  * @returns Whether the rule has been added to the "index".
  */
@@ -72,6 +167,8 @@ bool ApplyRule::AddTargetedRule(const ApplyRule::Ptr& rule, const String& target
 
 			return true;
 		}
+
+		return AddTargetedHostVarRule(rule, rules.TargetedByHostVar);
 	} else if (targetType == "Service") {
 		std::vector<std::pair<const String *, const String *>> services;
 
@@ -82,11 +179,50 @@ bool ApplyRule::AddTargetedRule(const ApplyRule::Ptr& rule, const String& target
 
 			return true;
 		}
+
+		std::vector<const String *> hosts;
+
+		if (GetTargetHosts(rule->m_Filter.get(), hosts)) {
+			for (auto host : hosts) {
+				rules.Targeted[*host].ForAllServices.emplace(rule);
+			}
+
+			return true;
+		}
+
+		return AddTargetedHostVarRule(rule, rules.TargetedServicesByHostVar);
 	}
 
 	return false;
 }
 
+/**
+ * If the given ApplyRule can only match objects of hosts with specific custom vars, add it to the given "index".
+ *
+ * @returns Whether the rule has been added to the "index".
+ */
+bool ApplyRule::AddTargetedHostVarRule(const ApplyRule::Ptr& rule, std::unordered_map<String, PerHostVar>& rules)
+{
+	std::vector<HostVarPredicate> predicates;
+
+	if (!GetTargetHostVars(rule->m_Filter.get(), predicates)) {
+		return false;
+	}
+
+	for (auto& predicate : predicates) {
+		auto& perVar (rules[*predicate.Var]);
+
+		if (predicate.In) {
+			perVar.In[*predicate.Value].emplace(rule);
+			perVar.AllIn.emplace(rule);
+		} else {
+			perVar.Equal[*predicate.Value].emplace(rule);
+		}
+	}
+
+	return true;
+}
+
 /**
  * If the given assign filter is like the following, extract the host names ("H", "h", ...) into the vector:
  *
@@ -97,18 +233,32 @@ bool ApplyRule::AddTargetedRule(const ApplyRule::Ptr& rule, const String& target
  * @returns Whether the given assign filter is like above.
  */
 bool ApplyRule::GetTargetHosts(Expression* assignFilter, std::vector<const String *>& hosts, const Dictionary::Ptr& constants)
+{
+	return GetTargetObjects(assignFilter, "host", hosts, constants);
+}
+
+/**
+ * If the given assign filter is like the following, extract the object names ("N", "n", ...) into the vector:
+ *
+ * $lcType$.name == "N" [ || $lcType$.name == "n" ... ]
+ *
+ * The order of operands of || == doesn't matter.
+ *
+ * @returns Whether the given assign filter is like above.
+ */
+bool ApplyRule::GetTargetObjects(Expression* assignFilter, const char * lcType, std::vector<const String *>& names, const Dictionary::Ptr& constants)
 {
 	auto lor (dynamic_cast<LogicalOrExpression*>(assignFilter));
 
 	if (lor) {
-		return GetTargetHosts(lor->GetOperand1().get(), hosts, constants)
-			&& GetTargetHosts(lor->GetOperand2().get(), hosts, constants);
+		return GetTargetObjects(lor->GetOperand1().get(), lcType, names, constants)
+			&& GetTargetObjects(lor->GetOperand2().get(), lcType, names, constants);
 	}
 
-	auto name (GetComparedName(assignFilter, "host", constants));
+	auto name (GetComparedName(assignFilter, lcType, constants));
 
 	if (name) {
-		hosts.emplace_back(name);
+		names.emplace_back(name);
 		return true;
 	}
 
@@ -143,6 +293,70 @@ bool ApplyRule::GetTargetServices(Expression* assignFilter, std::vector<std::pai
 	return false;
 }
 
+/**
+ * If the given assign filter can only be true for hosts with specific custom vars, extract these predicates into the vector:
+ *
+ * host.vars.V == "v" [ || "w" in host.vars.W ... ] [ && ... ]
+ *
+ * I.e. only the left operand of && needs to be like that. The order of operands of == doesn't matter.
+ *
+ * All such predicates raise no errors and are false for hosts not matching any of them, so the filter doesn't need
+ * to be evaluated for them. (Except if W isn't an array, also see GetTargetedHostVarRules().) Empty strings are
+ * not supported as missing custom vars compare equal to them.
+ *
+ * @returns Whether the given assign filter is like above.
+ */
+bool ApplyRule::GetTargetHostVars(Expression* assignFilter, std::vector<HostVarPredicate>& predicates, const Dictionary::Ptr& constants)
+{
+	auto lor (dynamic_cast<LogicalOrExpression*>(assignFilter));
+
+	if (lor) {
+		return GetTargetHostVars(lor->GetOperand1().get(), predicates, constants)
+			&& GetTargetHostVars(lor->GetOperand2().get(), predicates, constants);
+	}
+
+	auto land (dynamic_cast<LogicalAndExpression*>(assignFilter));
+
+	if (land) {
+		/* If the left operand is false, the right one isn't evaluated at all. */
+		return GetTargetHostVars(land->GetOperand1().get(), predicates, constants);
+	}
+
+	const String *var = nullptr, *value = nullptr;
+	bool in = false;
+
+	if (auto eq = dynamic_cast<EqualExpression*>(assignFilter)) {
+		auto op1 (eq->GetOperand1().get());
+		auto op2 (eq->GetOperand2().get());
+
+		var = GetHostVarName(op1, constants);
+
+		if (var) {
+			value = GetConstString(op2, constants);
+		} else {
+			var = GetHostVarName(op2, constants);
+
+			if (var) {
+				value = GetConstString(op1, constants);
+			}
+		}
+	} else if (auto ine = dynamic_cast<InExpression*>(assignFilter)) {
+		var = GetHostVarName(ine->GetOperand2().get(), constants);
+
+		if (var) {
+			value = GetConstString(ine->GetOperand1().get(), constants);
+			in = true;
+		}
+	}
+
+	if (!value || value->IsEmpty()) {
+		return false;
+	}
+
+	predicates.push_back({ var, value, in });
+	return true;
+}
+
 /**
  * If the given filter is like the following, extract the host+service names ("H"+"S"):
  *
@@ -215,6 +429,14 @@ const String * ApplyRule::GetComparedName(Expression* assignFilter, const char *
  * @returns Whether the given expression is like $lcType$.name.
  */
 bool ApplyRule::IsNameIndexer(Expression* exp, const char * lcType, const Dictionary::Ptr& constants)
+{
+	return IsAttributeIndexer(exp, lcType, "name", constants);
+}
+
+/**
+ * @returns Whether the given expression is like $lcType$.$attribute$.
+ */
+bool ApplyRule::IsAttributeIndexer(Expression* exp, const char * lcType, const char * attribute, const Dictionary::Ptr& constants)
 {
 	auto ixr (dynamic_cast<IndexerExpression*>(exp));
 
@@ -230,7 +452,21 @@ bool ApplyRule::IsNameIndexer(Expression* exp, const char * lcType, const Dictio
 
 	auto val (GetConstString(ixr->GetOperand2().get(), constants));
 
-	return val && *val == "name";
+	return val && *val == attribute;
+}
+
+/**
+ * @returns If the given expression is like host.vars.V, the address of V. nullptr on failure.
+ */
+const String * ApplyRule::GetHostVarName(Expression* exp, const Dictionary::Ptr& constants)
+{
+	auto ixr (dynamic_cast<IndexerExpression*>(exp));
+
+	if (!ixr || !IsAttributeIndexer(ixr->GetOperand1().get(), "host", "vars", constants)) {
+		return nullptr;
+	}
+
+	return GetConstString(ixr->GetOperand2().get(), constants);
 }
 
 /**
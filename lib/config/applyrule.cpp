@@ -1,6 +1,7 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "config/applyrule.hpp"
+#include "config/bytecode.hpp"
 #include "base/logger.hpp"
 #include <set>
 #include <unordered_set>
@@ -15,7 +16,11 @@ ApplyRule::ApplyRule(String name, Expression::Ptr expression,
 	bool ignoreOnError, DebugInfo di, Dictionary::Ptr scope)
 	: m_Name(std::move(name)), m_Expression(std::move(expression)), m_Filter(std::move(filter)), m_Package(std::move(package)), m_FKVar(std::move(fkvar)),
 	m_FVVar(std::move(fvvar)), m_FTerm(std::move(fterm)), m_IgnoreOnError(ignoreOnError), m_DebugInfo(std::move(di)), m_Scope(std::move(scope)), m_HasMatches(false)
-{ }
+{
+	/* m_Filter stays the tree for the target analysis of AddTargetedRule() */
+	if (m_Filter)
+		m_CompiledFilter = new BytecodeExpression(m_Filter);
+}
 
 String ApplyRule::GetName() const
 {
@@ -81,7 +86,7 @@ void ApplyRule::AddRule(const String& sourceType, const String& targetType, cons
 
 bool ApplyRule::EvaluateFilter(ScriptFrame& frame) const
 {
-	return Convert::ToBool(m_Filter->Evaluate(frame));
+	return Convert::ToBool(m_CompiledFilter->Evaluate(frame));
 }
 
 void ApplyRule::RegisterType(const String& sourceType, const std::vector<String>& targetTypes)
@@ -150,12 +155,17 @@ const std::vector<ApplyRule::Ptr>& ApplyRule::GetRules(const Type::Ptr& sourceTy
 	return noRules;
 }
 
-void ApplyRule::CheckMatches(bool silent)
+/**
+ * Calls the callback once for every apply rule, including the targeted ones.
+ *
+ * @param callback Receives the rule and its source type.
+ */
+void ApplyRule::ForEachRule(const std::function<void(const ApplyRule::Ptr&, Type*)>& callback)
 {
 	for (auto& perSourceType : m_Rules) {
 		for (auto& perTargetType : perSourceType.second.Regular) {
 			for (auto& rule : perTargetType.second) {
-				CheckMatches(rule, perSourceType.first, silent);
+				callback(rule, perSourceType.first);
 			}
 		}
 
@@ -171,14 +181,39 @@ void ApplyRule::CheckMatches(bool silent)
 					targeted.emplace(rule.get());
 				}
 			}
+
+			for (auto& rule : perHost.second.ForAllServices) {
+				targeted.emplace(rule.get());
+			}
+		}
+
+		for (auto perVars : { &perSourceType.second.TargetedByHostVar, &perSourceType.second.TargetedServicesByHostVar }) {
+			for (auto& perVar : *perVars) {
+				for (auto& perValue : perVar.second.Equal) {
+					for (auto& rule : perValue.second) {
+						targeted.emplace(rule.get());
+					}
+				}
+
+				for (auto& rule : perVar.second.AllIn) {
+					targeted.emplace(rule.get());
+				}
+			}
 		}
 
 		for (auto rule : targeted) {
-			CheckMatches(rule, perSourceType.first, silent);
+			callback(rule, perSourceType.first);
 		}
 	}
 }
 
+void ApplyRule::CheckMatches(bool silent)
+{
+	ForEachRule([silent](const ApplyRule::Ptr& rule, Type* sourceType) {
+		CheckMatches(rule, sourceType, silent);
+	});
+}
+
 void ApplyRule::CheckMatches(const ApplyRule::Ptr& rule, Type* sourceType, bool silent)
 {
 	if (!rule->HasMatches() && !silent) {
@@ -8,6 +8,7 @@
 #include "base/debuginfo.hpp"
 #include "base/shared-object.hpp"
 #include "base/type.hpp"
+#include <functional>
 #include <unordered_map>
 #include <atomic>
 
@@ -26,12 +27,30 @@ public:
 	{
 		std::set<ApplyRule::Ptr> ForHost;
 		std::unordered_map<String /* service */, std::set<ApplyRule::Ptr>> ForServices;
+		std::set<ApplyRule::Ptr> ForAllServices;
+	};
+
+	struct PerHostVar
+	{
+		std::unordered_map<String /* value */, std::set<ApplyRule::Ptr>> Equal;
+		std::unordered_map<String /* element */, std::set<ApplyRule::Ptr>> In;
+		std::set<ApplyRule::Ptr> AllIn;
 	};
 
 	struct PerSourceType
 	{
 		std::unordered_map<Type* /* target type */, std::vector<ApplyRule::Ptr>> Regular;
 		std::unordered_map<String /* host */, PerHost> Targeted;
+		std::unordered_map<String /* custom var */, PerHostVar> TargetedByHostVar;
+		std::unordered_map<String /* custom var */, PerHostVar> TargetedServicesByHostVar;
+	};
+
+	/* host.vars.$Var$ == "$Value$" or, if In is set, "$Value$" in host.vars.$Var$ */
+	struct HostVarPredicate
+	{
+		const String *Var;
+		const String *Value;
+		bool In;
 	};
 
 	/*
@@ -45,6 +64,22 @@ public:
 	 * which target only specific services on specific hosts,
 	 * e.g. via assign where host.name == "H" && service.name == "S".
 	 *
+	 * m_Rules[T::TypeInstance.get()].Targeted["H"].ForAllServices
+	 * contains all apply rules like apply T "x" to Service { ... }
+	 * which target only services of specific hosts incl. "H",
+	 * e.g. via assign where host.name == "H" || host.name == "h".
+	 *
+	 * m_Rules[T::TypeInstance.get()].TargetedByHostVar["V"].Equal["v"]
+	 * contains all apply rules like apply T "x" to Host { ... }
+	 * which can only match hosts with a custom var "V" of "v", e.g. via
+	 * assign where host.vars.V == "v" || "w" in host.vars.W.
+	 * (The second one is also in ...TargetedByHostVar["W"].In["w"].)
+	 * ...TargetedByHostVar["W"].AllIn contains all rules of all ...In[].
+	 *
+	 * m_Rules[T::TypeInstance.get()].TargetedServicesByHostVar
+	 * is the same for apply rules like apply T "x" to Service { ... }
+	 * which can only match services of hosts with specific custom vars.
+	 *
 	 * m_Rules[T::TypeInstance.get()].Regular[C::TypeInstance.get()]
 	 * contains all other apply rules like apply T "x" to C { ... }.
 	 */
@@ -82,14 +117,21 @@ public:
 	static const std::vector<ApplyRule::Ptr>& GetRules(const Type::Ptr& sourceType, const Type::Ptr& targetType);
 	static const std::set<ApplyRule::Ptr>& GetTargetedHostRules(const Type::Ptr& sourceType, const String& host);
 	static const std::set<ApplyRule::Ptr>& GetTargetedServiceRules(const Type::Ptr& sourceType, const String& host, const String& service);
+	static const std::set<ApplyRule::Ptr>& GetTargetedServicesOfHostRules(const Type::Ptr& sourceType, const String& host);
+	static void GetTargetedHostVarRules(const Type::Ptr& sourceType, const Object::Ptr& host, std::set<ApplyRule::Ptr>& rules);
+	static void GetTargetedServiceHostVarRules(const Type::Ptr& sourceType, const Object::Ptr& host, std::set<ApplyRule::Ptr>& rules);
 	static bool GetTargetHosts(Expression* assignFilter, std::vector<const String *>& hosts, const Dictionary::Ptr& constants = nullptr);
+	static bool GetTargetObjects(Expression* assignFilter, const char * lcType, std::vector<const String *>& names, const Dictionary::Ptr& constants = nullptr);
 	static bool GetTargetServices(Expression* assignFilter, std::vector<std::pair<const String *, const String *>>& services, const Dictionary::Ptr& constants = nullptr);
+	static bool GetTargetHostVars(Expression* assignFilter, std::vector<HostVarPredicate>& predicates, const Dictionary::Ptr& constants = nullptr);
 
 	static void RegisterType(const String& sourceType, const std::vector<String>& targetTypes);
 	static bool IsValidSourceType(const String& sourceType);
 	static bool IsValidTargetType(const String& sourceType, const String& targetType);
 	static const std::vector<String>& GetTargetTypes(const String& sourceType);
 
+	static void ForEachRule(const std::function<void(const ApplyRule::Ptr&, Type*)>& callback);
+
 	static void CheckMatches(bool silent);
 	static void CheckMatches(const ApplyRule::Ptr& rule, Type* sourceType, bool silent);
 
@@ -97,6 +139,7 @@ private:
 	String m_Name;
 	Expression::Ptr m_Expression;
 	Expression::Ptr m_Filter;
+	Expression::Ptr m_CompiledFilter;
 	String m_Package;
 	String m_FKVar;
 	String m_FVVar;
@@ -110,9 +153,13 @@ private:
 	static RuleMap m_Rules;
 
 	static bool AddTargetedRule(const ApplyRule::Ptr& rule, const String& targetType, PerSourceType& rules);
+	static bool AddTargetedHostVarRule(const ApplyRule::Ptr& rule, std::unordered_map<String, PerHostVar>& rules);
+	static void GetTargetedHostVarRules(const std::unordered_map<String, PerHostVar>& perVars, const Object::Ptr& host, std::set<ApplyRule::Ptr>& rules);
 	static std::pair<const String *, const String *> GetTargetService(Expression* assignFilter, const Dictionary::Ptr& constants);
 	static const String * GetComparedName(Expression* assignFilter, const char * lcType, const Dictionary::Ptr& constants);
 	static bool IsNameIndexer(Expression* exp, const char * lcType, const Dictionary::Ptr& constants);
+	static bool IsAttributeIndexer(Expression* exp, const char * lcType, const char * attribute, const Dictionary::Ptr& constants);
+	static const String * GetHostVarName(Expression* exp, const Dictionary::Ptr& constants);
 	static const String * GetConstString(Expression* exp, const Dictionary::Ptr& constants);
 	static const Value * GetConst(Expression* exp, const Dictionary::Ptr& constants);
 
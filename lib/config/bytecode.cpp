@@ -0,0 +1,661 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "config/bytecode.hpp"
+#include "config/vmops.hpp"
+#include "base/configuration.hpp"
+#include "base/function.hpp"
+#include "base/json.hpp"
+#include "base/namespace.hpp"
+#include "base/regexcache.hpp"
+#include "base/scriptglobal.hpp"
+#include <boost/container/small_vector.hpp>
+#include <boost/exception/errinfo_nested_exception.hpp>
+#include <boost/regex.hpp>
+#include <algorithm>
+#include <iterator>
+
+using namespace icinga;
+
+namespace icinga
+{
+
+/**
+ * Translates an expression tree into the program of a BytecodeExpression.
+ *
+ * @ingroup config
+ */
+class BytecodeCompiler
+{
+public:
+	BytecodeCompiler(BytecodeExpression& target)
+		: m_Target(target)
+	{ }
+
+	void Compile(const Expression *expr);
+
+private:
+	BytecodeExpression& m_Target;
+	size_t m_StackSize{0};
+
+	size_t Emit(BytecodeOp op, const Expression *node, uint32_t arg = 0, FieldIdCache *cache = nullptr);
+	void EmitConstant(const Value& value, const Expression *node);
+	void PatchJump(size_t jump);
+
+	void Push(size_t count = 1);
+	void Pop(size_t count = 1);
+
+	template<typename T>
+	bool CompileBinary(const Expression *expr, BytecodeOp op);
+};
+
+}
+
+/**
+ * @returns The compiled regex or nullptr if it's invalid, regex() reports that at runtime.
+ */
+static std::shared_ptr<const boost::regex> CompileRegex(const String& pattern)
+{
+	try {
+		return RegexCache::Get(pattern);
+	} catch (const std::exception&) {
+		return nullptr;
+	}
+}
+
+size_t BytecodeCompiler::Emit(BytecodeOp op, const Expression *node, uint32_t arg, FieldIdCache *cache)
+{
+	m_Target.m_Program.push_back({ op, arg, node, cache });
+	return m_Target.m_Program.size() - 1;
+}
+
+void BytecodeCompiler::EmitConstant(const Value& value, const Expression *node)
+{
+	m_Target.m_Constants.push_back(value);
+	Emit(BytecodePushConstant, node, m_Target.m_Constants.size() - 1);
+	Push();
+}
+
+/* Lets the jump continue with the next instruction to be emitted. */
+void BytecodeCompiler::PatchJump(size_t jump)
+{
+	m_Target.m_Program[jump].Arg = m_Target.m_Program.size();
+}
+
+void BytecodeCompiler::Push(size_t count)
+{
+	m_StackSize += count;
+	m_Target.m_MaxStackSize = std::max(m_Target.m_MaxStackSize, m_StackSize);
+}
+
+void BytecodeCompiler::Pop(size_t count)
+{
+	ASSERT(m_StackSize >= count);
+	m_StackSize -= count;
+}
+
+template<typename T>
+bool BytecodeCompiler::CompileBinary(const Expression *expr, BytecodeOp op)
+{
+	auto binary (dynamic_cast<const T *>(expr));
+
+	if (!binary)
+		return false;
+
+	Compile(binary->GetOperand1().get());
+	Compile(binary->GetOperand2().get());
+	Emit(op, expr);
+	Pop();
+
+	return true;
+}
+
+/**
+ * Appends the instructions which leave the value of the expression on the stack.
+ */
+void BytecodeCompiler::Compile(const Expression *expr)
+{
+	if (auto literal = dynamic_cast<const LiteralExpression *>(expr)) {
+		EmitConstant(literal->GetValue(), expr);
+		return;
+	}
+
+	if (auto scope = dynamic_cast<const GetScopeExpression *>(expr)) {
+		Emit(BytecodePushScope, expr, scope->m_ScopeSpec);
+		Push();
+		return;
+	}
+
+	if (dynamic_cast<const VariableExpression *>(expr)) {
+		Emit(BytecodeLoadVariable, expr);
+		Push();
+		return;
+	}
+
+	if (auto indexer = dynamic_cast<const IndexerExpression *>(expr)) {
+		Compile(indexer->m_Operand1.get());
+
+		if (indexer->m_ConstantIndex) {
+			auto index (static_cast<const LiteralExpression *>(indexer->m_Operand2.get()));
+
+			m_Target.m_FieldNames.emplace_back(index->GetValue());
+			Emit(BytecodeGetConstantField, expr, m_Target.m_FieldNames.size() - 1, &indexer->m_FieldIdCache);
+		} else {
+			Compile(indexer->m_Operand2.get());
+			Emit(BytecodeGetField, expr);
+			Pop();
+		}
+
+		return;
+	}
+
+	if (auto negate = dynamic_cast<const NegateExpression *>(expr)) {
+		Compile(negate->m_Operand.get());
+		Emit(BytecodeNegate, expr);
+		return;
+	}
+
+	if (auto negate = dynamic_cast<const LogicalNegateExpression *>(expr)) {
+		Compile(negate->m_Operand.get());
+		Emit(BytecodeLogicalNegate, expr);
+		return;
+	}
+
+	if (CompileBinary<EqualExpression>(expr, BytecodeEqual) ||
+		CompileBinary<NotEqualExpression>(expr, BytecodeNotEqual) ||
+		CompileBinary<LessThanExpression>(expr, BytecodeLessThan) ||
+		CompileBinary<GreaterThanExpression>(expr, BytecodeGreaterThan) ||
+		CompileBinary<LessThanOrEqualExpression>(expr, BytecodeLessThanOrEqual) ||
+		CompileBinary<GreaterThanOrEqualExpression>(expr, BytecodeGreaterThanOrEqual) ||
+		CompileBinary<AddExpression>(expr, BytecodeAdd) ||
+		CompileBinary<SubtractExpression>(expr, BytecodeSubtract) ||
+		CompileBinary<MultiplyExpression>(expr, BytecodeMultiply) ||
+		CompileBinary<DivideExpression>(expr, BytecodeDivide) ||
+		CompileBinary<ModuloExpression>(expr, BytecodeModulo) ||
+		CompileBinary<XorExpression>(expr, BytecodeXor) ||
+		CompileBinary<BinaryAndExpression>(expr, BytecodeBinaryAnd) ||
+		CompileBinary<BinaryOrExpression>(expr, BytecodeBinaryOr) ||
+		CompileBinary<ShiftLeftExpression>(expr, BytecodeShiftLeft) ||
+		CompileBinary<ShiftRightExpression>(expr, BytecodeShiftRight))
+		return;
+
+	/* Like the tree interpreter, evaluate the right side first and skip the left side if the right one is empty. */
+	auto in (dynamic_cast<const InExpression *>(expr));
+	auto notIn (dynamic_cast<const NotInExpression *>(expr));
+
+	if (in || notIn) {
+		auto binary (static_cast<const BinaryExpression *>(expr));
+
+		Compile(binary->GetOperand2().get());
+		size_t jump = Emit(in ? BytecodePrepareIn : BytecodePrepareNotIn, expr);
+		Compile(binary->GetOperand1().get());
+		Emit(in ? BytecodeIn : BytecodeNotIn, expr);
+		Pop();
+		PatchJump(jump);
+
+		return;
+	}
+
+	auto logicalAnd (dynamic_cast<const LogicalAndExpression *>(expr));
+	auto logicalOr (dynamic_cast<const LogicalOrExpression *>(expr));
+
+	if (logicalAnd || logicalOr) {
+		auto binary (static_cast<const BinaryExpression *>(expr));
+
+		Compile(binary->GetOperand1().get());
+		size_t jump = Emit(logicalAnd ? BytecodeJumpIfFalseOrPop : BytecodeJumpIfTrueOrPop, expr);
+		Pop();
+		Compile(binary->GetOperand2().get());
+		PatchJump(jump);
+
+		return;
+	}
+
+	if (auto conditional = dynamic_cast<const ConditionalExpression *>(expr)) {
+		Compile(conditional->m_Condition.get());
+		size_t jumpFalse = Emit(BytecodeJumpIfFalse, expr);
+		Pop();
+
+		Compile(conditional->m_TrueBranch.get());
+		size_t jumpEnd = Emit(BytecodeJump, expr);
+		Pop();
+
+		PatchJump(jumpFalse);
+
+		if (conditional->m_FalseBranch)
+			Compile(conditional->m_FalseBranch.get());
+		else
+			EmitConstant(Empty, expr);
+
+		PatchJump(jumpEnd);
+
+		return;
+	}
+
+	if (auto array = dynamic_cast<const ArrayExpression *>(expr)) {
+		for (const auto& element : array->m_Expressions)
+			Compile(element.get());
+
+		Emit(BytecodeMakeArray, expr, array->m_Expressions.size());
+		Pop(array->m_Expressions.size());
+		Push();
+
+		return;
+	}
+
+	/* Other dictionaries change 'this', leave them to the tree interpreter. */
+	auto dict (dynamic_cast<const DictExpression *>(expr));
+
+	if (dict && dict->m_Inline) {
+		if (dict->m_Expressions.empty()) {
+			EmitConstant(Empty, expr);
+			return;
+		}
+
+		for (size_t i = 0; i < dict->m_Expressions.size(); i++) {
+			if (i > 0) {
+				Emit(BytecodePop, expr);
+				Pop();
+			}
+
+			Compile(dict->m_Expressions[i].get());
+		}
+
+		return;
+	}
+
+	if (auto call = dynamic_cast<const FunctionCallExpression *>(expr)) {
+		Emit(BytecodeResolveCall, expr);
+		Push(2);
+
+		for (const auto& arg : call->m_Args)
+			Compile(arg.get());
+
+		/* match("pattern", text) and regex("pattern", text) as in most filters: parse the pattern only once. */
+		auto function (dynamic_cast<const VariableExpression *>(call->m_FName.get()));
+		auto pattern (call->m_Args.size() == 2 ? dynamic_cast<const LiteralExpression *>(call->m_Args[0].get()) : nullptr);
+		std::shared_ptr<const boost::regex> regex;
+
+		if (function && pattern && pattern->GetValue().IsString()) {
+			if (function->GetVariable() == "match") {
+				m_Target.m_Patterns.emplace_back(pattern->GetValue().Get<String>());
+				Emit(BytecodeCallMatch, expr, m_Target.m_Patterns.size() - 1);
+			} else if (function->GetVariable() == "regex" && (regex = CompileRegex(pattern->GetValue().Get<String>()))) {
+				m_Target.m_Regexes.emplace_back(std::move(regex));
+				Emit(BytecodeCallRegex, expr, m_Target.m_Regexes.size() - 1);
+			} else {
+				Emit(BytecodeCall, expr, call->m_Args.size());
+			}
+		} else {
+			Emit(BytecodeCall, expr, call->m_Args.size());
+		}
+
+		Pop(call->m_Args.size() + 2);
+		Push();
+
+		return;
+	}
+
+	if (auto ret = dynamic_cast<const ReturnExpression *>(expr)) {
+		Compile(ret->m_Operand.get());
+		Emit(BytecodeReturn, expr);
+		return;
+	}
+
+	Emit(BytecodeEvaluate, expr);
+	Push();
+}
+
+BytecodeExpression::BytecodeExpression(Expression::Ptr source)
+	: m_Source(std::move(source))
+{
+	BytecodeCompiler(*this).Compile(m_Source.get());
+}
+
+const Expression::Ptr& BytecodeExpression::GetSource() const
+{
+	return m_Source;
+}
+
+/**
+ * Whether the program does more than letting the tree interpreter evaluate the whole expression.
+ */
+bool BytecodeExpression::IsCompiled() const
+{
+	return m_Program.size() != 1 || m_Program[0].Op != BytecodeEvaluate;
+}
+
+bool BytecodeExpression::GetReference(ScriptFrame& frame, bool init_dict, Value *parent, String *index, DebugHint **dhint) const
+{
+	return m_Source->GetReference(frame, init_dict, parent, index, dhint);
+}
+
+const DebugInfo& BytecodeExpression::GetDebugInfo() const
+{
+	return m_Source->GetDebugInfo();
+}
+
+ExpressionResult BytecodeExpression::DoEvaluate(ScriptFrame& frame, DebugHint *dhint) const
+{
+	if (dhint || !Configuration::ScriptBytecode || !IsCompiled())
+		return m_Source->DoEvaluate(frame, dhint);
+
+	return Run(frame);
+}
+
+/**
+ * @returns The given function of the System namespace, which can't be replaced.
+ */
+static Object *GetSystemFunction(const String& name)
+{
+	Namespace::Ptr system = ScriptGlobal::Get("System", &Empty);
+	Value value;
+
+	if (!system || !system->Get(name, &value) || !value.IsObjectType<Function>())
+		return nullptr;
+
+	return value.Get<Object::Ptr>().get();
+}
+
+/**
+ * @returns Whether the stack holds this, the given function and two arguments of which the second one is a string.
+ */
+template<typename Stack>
+static bool IsCallWithString(const Stack& stack, Object *function)
+{
+	const Value& vfunc (stack.end()[-3]);
+
+	return stack.back().IsString() && vfunc.IsObject() && vfunc.template Get<Object::Ptr>().get() == function;
+}
+
+template<typename Stack>
+static void CallFunction(ScriptFrame& frame, Stack& stack, size_t count, const Expression *node)
+{
+	std::vector<Value> arguments (std::make_move_iterator(stack.end() - count), std::make_move_iterator(stack.end()));
+	stack.erase(stack.end() - count, stack.end());
+
+	Value vfunc = std::move(stack.back());
+	stack.pop_back();
+
+	if (vfunc.IsObjectType<Type>())
+		stack.back() = VMOps::ConstructorCall(vfunc, arguments, node->GetDebugInfo());
+	else
+		stack.back() = VMOps::FunctionCall(frame, stack.back(), vfunc, arguments);
+}
+
+#define BYTECODE_BINARY_OP(op)						\
+	do {								\
+		Value right = std::move(stack.back());			\
+		stack.pop_back();					\
+		stack.back() = stack.back() op right;			\
+	} while (0)
+
+ExpressionResult BytecodeExpression::Run(ScriptFrame& frame) const
+{
+	boost::container::small_vector<Value, 8> stack;
+	stack.reserve(m_MaxStackSize);
+
+	const BytecodeInstruction *instr = nullptr;
+
+	try {
+		size_t pc = 0;
+
+		while (pc < m_Program.size()) {
+			instr = &m_Program[pc++];
+
+			switch (instr->Op) {
+				case BytecodePushConstant:
+					stack.emplace_back(m_Constants[instr->Arg]);
+					break;
+
+				case BytecodePushScope:
+					if (instr->Arg == ScopeLocal)
+						stack.emplace_back(frame.Locals);
+					else if (instr->Arg == ScopeThis)
+						stack.emplace_back(frame.Self);
+					else
+						stack.emplace_back(ScriptGlobal::GetGlobals());
+
+					break;
+
+				case BytecodeLoadVariable:
+					stack.emplace_back(instr->Node->DoEvaluate(frame, nullptr).GetValue());
+					break;
+
+				case BytecodeEvaluate: {
+					ExpressionResult result = instr->Node->Evaluate(frame);
+
+					if (result.GetCode() != ResultOK)
+						return result;
+
+					stack.emplace_back(result.GetValue());
+					break;
+				}
+
+				case BytecodeGetField: {
+					Value index = std::move(stack.back());
+					stack.pop_back();
+
+					stack.back() = VMOps::GetField(stack.back(), index, frame.Sandboxed, instr->Node->GetDebugInfo());
+					break;
+				}
+
+				case BytecodeGetConstantField:
+					stack.back() = VMOps::GetField(stack.back(), m_FieldNames[instr->Arg], *instr->Cache, frame.Sandboxed, instr->Node->GetDebugInfo());
+					break;
+
+				case BytecodeNegate:
+					stack.back() = ~(long)stack.back();
+					break;
+
+				case BytecodeLogicalNegate:
+					stack.back() = !stack.back().ToBool();
+					break;
+
+				case BytecodeAdd:
+					/* Like AddExpression, append to the left string on the stack in place. */
+					if (stack.back().IsString() && stack[stack.size() - 2].IsString()) {
+						Value right = std::move(stack.back());
+						stack.pop_back();
+						stack.back().AppendString(right.Get<String>());
+					} else {
+						BYTECODE_BINARY_OP(+);
+					}
+					break;
+				case BytecodeSubtract:
+					BYTECODE_BINARY_OP(-);
+					break;
+				case BytecodeMultiply:
+					BYTECODE_BINARY_OP(*);
+					break;
+				case BytecodeDivide:
+					BYTECODE_BINARY_OP(/);
+					break;
+				case BytecodeModulo:
+					BYTECODE_BINARY_OP(%);
+					break;
+				case BytecodeXor:
+					BYTECODE_BINARY_OP(^);
+					break;
+				case BytecodeBinaryAnd:
+					BYTECODE_BINARY_OP(&);
+					break;
+				case BytecodeBinaryOr:
+					BYTECODE_BINARY_OP(|);
+					break;
+				case BytecodeShiftLeft:
+					BYTECODE_BINARY_OP(<<);
+					break;
+				case BytecodeShiftRight:
+					BYTECODE_BINARY_OP(>>);
+					break;
+				case BytecodeEqual:
+					BYTECODE_BINARY_OP(==);
+					break;
+				case BytecodeNotEqual:
+					BYTECODE_BINARY_OP(!=);
+					break;
+				case BytecodeLessThan:
+					BYTECODE_BINARY_OP(<);
+					break;
+				case BytecodeGreaterThan:
+					BYTECODE_BINARY_OP(>);
+					break;
+				case BytecodeLessThanOrEqual:
+					BYTECODE_BINARY_OP(<=);
+					break;
+				case BytecodeGreaterThanOrEqual:
+					BYTECODE_BINARY_OP(>=);
+					break;
+
+				case BytecodePrepareIn:
+				case BytecodePrepareNotIn:
+					if (stack.back().IsEmpty()) {
+						stack.back() = (instr->Op == BytecodePrepareNotIn);
+						pc = instr->Arg;
+					} else if (!stack.back().IsObjectType<Array>()) {
+						BOOST_THROW_EXCEPTION(ScriptError("Invalid right side argument for 'in' operator: " + JsonEncode(stack.back()), instr->Node->GetDebugInfo()));
+					}
+
+					break;
+
+				case BytecodeIn:
+				case BytecodeNotIn: {
+					Value value = std::move(stack.back());
+					stack.pop_back();
+
+					Array::Ptr arr = stack.back();
+					bool contains = arr->Contains(value);
+
+					stack.back() = (instr->Op == BytecodeIn) ? contains : !contains;
+					break;
+				}
+
+				case BytecodeJump:
+					pc = instr->Arg;
+					break;
+
+				case BytecodeJumpIfFalse: {
+					bool condition = stack.back().ToBool();
+					stack.pop_back();
+
+					if (!condition)
+						pc = instr->Arg;
+
+					break;
+				}
+
+				case BytecodeJumpIfFalseOrPop:
+					if (!stack.back().ToBool())
+						pc = instr->Arg;
+					else
+						stack.pop_back();
+
+					break;
+
+				case BytecodeJumpIfTrueOrPop:
+					if (stack.back().ToBool())
+						pc = instr->Arg;
+					else
+						stack.pop_back();
+
+					break;
+
+				case BytecodePop:
+					stack.pop_back();
+					break;
+
+				case BytecodeMakeArray: {
+					ArrayData result (std::make_move_iterator(stack.end() - instr->Arg), std::make_move_iterator(stack.end()));
+					stack.erase(stack.end() - instr->Arg, stack.end());
+
+					stack.emplace_back(new Array(std::move(result)));
+					break;
+				}
+
+				case BytecodeResolveCall: {
+					auto call (static_cast<const FunctionCallExpression *>(instr->Node));
+
+					Value self, vfunc;
+					String index;
+
+					if (call->m_FName->GetReference(frame, false, &self, &index))
+						vfunc = VMOps::GetField(self, index, frame.Sandboxed, instr->Node->GetDebugInfo());
+					else {
+						ExpressionResult vfuncres = call->m_FName->Evaluate(frame);
+
+						if (vfuncres.GetCode() != ResultOK)
+							return vfuncres;
+
+						vfunc = vfuncres.GetValue();
+					}
+
+					if (!vfunc.IsObjectType<Type>()) {
+						if (!vfunc.IsObjectType<Function>())
+							BOOST_THROW_EXCEPTION(ScriptError("Argument is not a callable object.", instr->Node->GetDebugInfo()));
+
+						Function::Ptr func = vfunc;
+
+						if (!func->IsSideEffectFree() && frame.Sandboxed)
+							BOOST_THROW_EXCEPTION(ScriptError("Function is not marked as safe for sandbox mode.", instr->Node->GetDebugInfo()));
+					}
+
+					stack.emplace_back(std::move(self));
+					stack.emplace_back(std::move(vfunc));
+					break;
+				}
+
+				case BytecodeCall:
+					CallFunction(frame, stack, instr->Arg, instr->Node);
+					break;
+
+				case BytecodeCallMatch: {
+					static Object * const match = GetSystemFunction("match");
+
+					if (!IsCallWithString(stack, match)) {
+						CallFunction(frame, stack, 2, instr->Node);
+						break;
+					}
+
+					bool result = m_Patterns[instr->Arg].Match(stack.back().Get<String>());
+
+					stack.erase(stack.end() - 3, stack.end());
+					stack.back() = result;
+					break;
+				}
+
+				case BytecodeCallRegex: {
+					static Object * const regex = GetSystemFunction("regex");
+
+					if (!IsCallWithString(stack, regex)) {
+						CallFunction(frame, stack, 2, instr->Node);
+						break;
+					}
+
+					bool result = boost::regex_search(stack.back().Get<String>().GetData(), *m_Regexes[instr->Arg]);
+
+					stack.erase(stack.end() - 3, stack.end());
+					stack.back() = result;
+					break;
+				}
+
+				case BytecodeReturn:
+					return ExpressionResult(std::move(stack.back()), ResultReturn);
+
+				default:
+					VERIFY(!"Invalid opcode.");
+			}
+		}
+	} catch (ScriptError& ex) {
+		if (instr)
+			ScriptBreakpoint(frame, &ex, instr->Node->GetDebugInfo());
+
+		throw;
+	} catch (const std::exception& ex) {
+		BOOST_THROW_EXCEPTION(ScriptError("Error while evaluating expression: " + String(ex.what()), instr ? instr->Node->GetDebugInfo() : GetDebugInfo())
+			<< boost::errinfo_nested_exception(boost::current_exception()));
+	}
+
+	ASSERT(stack.size() == 1);
+
+	return std::move(stack.back());
+}
@@ -0,0 +1,117 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "config/i2-config.hpp"
+#include "config/expression.hpp"
+#include "base/wildcardpattern.hpp"
+#include <boost/regex_fwd.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace icinga
+{
+
+/**
+ * @ingroup config
+ */
+enum BytecodeOp : uint8_t
+{
+	BytecodePushConstant,
+	BytecodePushScope,
+	BytecodeLoadVariable,
+	BytecodeEvaluate,
+	BytecodeGetField,
+	BytecodeGetConstantField,
+	BytecodeNegate,
+	BytecodeLogicalNegate,
+	BytecodeAdd,
+	BytecodeSubtract,
+	BytecodeMultiply,
+	BytecodeDivide,
+	BytecodeModulo,
+	BytecodeXor,
+	BytecodeBinaryAnd,
+	BytecodeBinaryOr,
+	BytecodeShiftLeft,
+	BytecodeShiftRight,
+	BytecodeEqual,
+	BytecodeNotEqual,
+	BytecodeLessThan,
+	BytecodeGreaterThan,
+	BytecodeLessThanOrEqual,
+	BytecodeGreaterThanOrEqual,
+	BytecodePrepareIn,
+	BytecodePrepareNotIn,
+	BytecodeIn,
+	BytecodeNotIn,
+	BytecodeJump,
+	BytecodeJumpIfFalse,
+	BytecodeJumpIfFalseOrPop,
+	BytecodeJumpIfTrueOrPop,
+	BytecodePop,
+	BytecodeMakeArray,
+	BytecodeResolveCall,
+	BytecodeCall,
+	BytecodeCallMatch,
+	BytecodeCallRegex,
+	BytecodeReturn
+};
+
+/**
+ * One instruction of a BytecodeExpression's program. Node is the expression it was
+ * compiled from, it provides the debug info for errors.
+ *
+ * @ingroup config
+ */
+struct BytecodeInstruction
+{
+	BytecodeOp Op;
+	uint32_t Arg; /* constant, field name, pattern or regex index, scope, jump target or number of values */
+	const Expression *Node;
+	FieldIdCache *Cache;
+};
+
+/**
+ * Evaluates an expression tree as a program for a stack machine instead of walking the tree,
+ * which saves the virtual call, the ExpressionResult and the exception handling per node.
+ *
+ * Nodes without their own instructions (e.g. assignments, loops and object definitions) are
+ * evaluated by the tree interpreter as part of the program. The tree interpreter evaluates
+ * the whole expression if debug hints are requested or Configuration::ScriptBytecode is false.
+ *
+ * @ingroup config
+ */
+class BytecodeExpression final : public Expression
+{
+public:
+	BytecodeExpression(Expression::Ptr source);
+
+	const Expression::Ptr& GetSource() const;
+	bool IsCompiled() const;
+
+	bool GetReference(ScriptFrame& frame, bool init_dict, Value *parent, String *index, DebugHint **dhint) const override;
+	const DebugInfo& GetDebugInfo() const override;
+
+protected:
+	ExpressionResult DoEvaluate(ScriptFrame& frame, DebugHint *dhint) const override;
+
+private:
+	Expression::Ptr m_Source;
+	std::vector<BytecodeInstruction> m_Program;
+	std::vector<Value> m_Constants;
+	std::vector<String> m_FieldNames;
+	std::vector<WildcardPattern> m_Patterns;
+	std::vector<std::shared_ptr<const boost::regex>> m_Regexes;
+	size_t m_MaxStackSize{0};
+
+	ExpressionResult Run(ScriptFrame& frame) const;
+
+	friend class BytecodeCompiler;
+};
+
+}
+
+#endif /* BYTECODE_H */
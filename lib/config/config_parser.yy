@@ -5,6 +5,7 @@
 
 #include "config/i2-config.hpp"
 #include "config/configcompiler.hpp"
+#include "config/constantfolder.hpp"
 #include "config/expression.hpp"
 #include "config/applyrule.hpp"
 #include "config/objectrule.hpp"
@@ -396,9 +397,21 @@ object:
 			BOOST_THROW_EXCEPTION(ScriptError("object rule 'ignore where' cannot be used without 'assign where'", DebugInfoRange(@2, @4)));
 		}
 
+		if (filter) {
+			std::set<String> locals { "host", "service", "user" };
+
+			for (auto& closedVar : *$5)
+				locals.insert(closedVar.first);
+
+			ConstantFolder::FoldFilter(filter, std::move(locals), context->GetImports().empty());
+		}
+
+		std::unique_ptr<Expression> body ($9);
+		ConstantFolder::FoldBody(body);
+
 		$$ = new ObjectExpression(abstract, std::unique_ptr<Expression>($3), std::unique_ptr<Expression>($4),
 			std::move(filter), context->GetZone(), context->GetPackage(), std::move(*$5), $6, $7,
-			std::unique_ptr<Expression>($9), DebugInfoRange(@2, @7));
+			std::move(body), DebugInfoRange(@2, @7));
 		delete $5;
 	}
 	;
@@ -1221,7 +1234,23 @@ apply:
 		std::unique_ptr<Expression> fterm{context->m_FTerm.top()};
 		context->m_FTerm.pop();
 
-		$$ = new ApplyExpression(std::move(type), std::move(target), std::unique_ptr<Expression>($4), std::move(filter), context->GetPackage(), std::move(fkvar), std::move(fvvar), std::move(fterm), std::move(*$7), $8, std::unique_ptr<Expression>($10), DebugInfoRange(@2, @8));
+		std::set<String> locals { "host", "service" };
+
+		if (!fkvar.IsEmpty())
+			locals.insert(fkvar);
+
+		if (!fvvar.IsEmpty())
+			locals.insert(fvvar);
+
+		for (auto& closedVar : *$7)
+			locals.insert(closedVar.first);
+
+		ConstantFolder::FoldFilter(filter, std::move(locals), context->GetImports().empty());
+
+		std::unique_ptr<Expression> body ($10);
+		ConstantFolder::FoldBody(body);
+
+		$$ = new ApplyExpression(std::move(type), std::move(target), std::unique_ptr<Expression>($4), std::move(filter), context->GetPackage(), std::move(fkvar), std::move(fvvar), std::move(fterm), std::move(*$7), $8, std::move(body), DebugInfoRange(@2, @8));
 		delete $7;
 	}
 	;
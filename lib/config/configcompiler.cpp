@@ -2,18 +2,32 @@
 
 #include "config/configcompiler.hpp"
 #include "config/configitem.hpp"
+#include "config/configprofiler.hpp"
 #include "base/logger.hpp"
 #include "base/utility.hpp"
 #include "base/loader.hpp"
 #include "base/context.hpp"
 #include "base/exception.hpp"
+#include "base/configuration.hpp"
+#include "base/workqueue.hpp"
+#include "base/tlsutility.hpp"
+#include <algorithm>
 #include <fstream>
+#include <iterator>
+#include <sstream>
+#include <numeric>
 
 using namespace icinga;
 
 std::vector<String> ConfigCompiler::m_IncludeSearchDirs;
 std::mutex ConfigCompiler::m_ZoneDirsMutex;
 std::map<String, std::vector<ZoneFragment> > ConfigCompiler::m_ZoneDirs;
+std::atomic<bool> ConfigCompiler::m_RecordCompiledFiles (false);
+std::mutex ConfigCompiler::m_CompiledFilesMutex;
+std::map<String, CompiledFile> ConfigCompiler::m_CompiledFiles;
+
+/* Whether this thread compiles a file for CollectIncludes() in parallel with others */
+static thread_local bool l_CompilingInParallel = false;
 
 /**
  * Constructor for the ConfigCompiler class.
@@ -104,6 +118,42 @@ void ConfigCompiler::CollectIncludes(std::vector<std::unique_ptr<Expression> >&
 	}
 }
 
+/**
+ * Compiles the files in parallel. Their expressions are appended in the order of the files,
+ * so evaluating them behaves just like compiling them one after another.
+ *
+ * Files included by one of these files are compiled by the same thread, one after another.
+ */
+void ConfigCompiler::CollectIncludes(std::vector<std::unique_ptr<Expression> >& expressions,
+	const std::vector<String>& files, const String& zone, const String& package)
+{
+	if (files.size() < 2 || Configuration::Concurrency < 2 || l_CompilingInParallel) {
+		for (const String& file : files)
+			CollectIncludes(expressions, file, zone, package);
+
+		return;
+	}
+
+	std::vector<std::vector<std::unique_ptr<Expression> > > results (files.size());
+	std::vector<size_t> indices (files.size());
+	std::iota(indices.begin(), indices.end(), 0);
+
+	WorkQueue upq (25000, Configuration::Concurrency, LogNotice);
+	upq.SetName("ConfigCompiler::CollectIncludes");
+
+	upq.ParallelForStealing(indices, [&files, &results, &zone, &package](size_t i) {
+		l_CompilingInParallel = true;
+		CollectIncludes(results[i], files[i], zone, package);
+	});
+
+	upq.Join();
+
+	for (auto& result : results) {
+		for (auto& expression : result)
+			expressions.emplace_back(std::move(expression));
+	}
+}
+
 /**
  * Handles an include directive.
  *
@@ -136,7 +186,8 @@ std::unique_ptr<Expression> ConfigCompiler::HandleInclude(const String& relative
 	}
 
 	std::vector<std::unique_ptr<Expression> > expressions;
-	auto funcCallback = [&expressions, zone, package](const String& file) { CollectIncludes(expressions, file, zone, package); };
+	std::vector<String> files;
+	auto funcCallback = [&files](const String& file) { files.emplace_back(file); };
 
 	if (!Utility::Glob(includePath, funcCallback, GlobFile) && includePath.FindFirstOf("*?") == String::NPos) {
 		std::ostringstream msgbuf;
@@ -144,6 +195,8 @@ std::unique_ptr<Expression> ConfigCompiler::HandleInclude(const String& relative
 		BOOST_THROW_EXCEPTION(ScriptError(msgbuf.str(), debuginfo));
 	}
 
+	CollectIncludes(expressions, files, zone, package);
+
 	std::unique_ptr<DictExpression> expr{new DictExpression(std::move(expressions))};
 	expr->MakeInline();
 	return std::move(expr);
@@ -167,11 +220,14 @@ std::unique_ptr<Expression> ConfigCompiler::HandleIncludeRecursive(const String&
 	else
 		ppath = relativeBase + "/" + path;
 
-	std::vector<std::unique_ptr<Expression> > expressions;
-	Utility::GlobRecursive(ppath, pattern, [&expressions, zone, package](const String& file) {
-		CollectIncludes(expressions, file, zone, package);
+	std::vector<String> files;
+	Utility::GlobRecursive(ppath, pattern, [&files](const String& file) {
+		files.emplace_back(file);
 	}, GlobFile);
 
+	std::vector<std::unique_ptr<Expression> > expressions;
+	CollectIncludes(expressions, files, zone, package);
+
 	std::unique_ptr<DictExpression> dict{new DictExpression(std::move(expressions))};
 	dict->MakeInline();
 	return std::move(dict);
@@ -190,9 +246,12 @@ void ConfigCompiler::HandleIncludeZone(const String& relativeBase, const String&
 
 	RegisterZoneDir(tag, ppath, zoneName);
 
-	Utility::GlobRecursive(ppath, pattern, [&expressions, zoneName, package](const String& file) {
-		CollectIncludes(expressions, file, zoneName, package);
+	std::vector<String> files;
+	Utility::GlobRecursive(ppath, pattern, [&files](const String& file) {
+		files.emplace_back(file);
 	}, GlobFile);
+
+	CollectIncludes(expressions, files, zoneName, package);
 }
 
 /**
@@ -272,6 +331,29 @@ std::unique_ptr<Expression> ConfigCompiler::CompileFile(const String& path, cons
 	Log(LogNotice, "ConfigCompiler")
 		<< "Compiling config file: " << path;
 
+	ConfigProfilerScope profile ("parse", [&path]() { return path; });
+
+	if (m_RecordCompiledFiles.load()) {
+		/* Hash exactly what's compiled, the file may change while we're busy. */
+		std::string content ((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+		String text (std::move(content));
+
+		std::unique_ptr<Expression> expr = CompileText(path, text, zone, package);
+
+		CompiledFile file;
+		file.Hash = SHA256(text);
+		file.Zone = zone;
+		file.Package = package;
+		file.ObjectsOnly = GetObjectDefinitions(text, expr.get(), file.Objects);
+
+		{
+			std::unique_lock<std::mutex> lock(m_CompiledFilesMutex);
+			m_CompiledFiles[path] = std::move(file);
+		}
+
+		return expr;
+	}
+
 	return CompileStream(path, &stream, zone, package);
 }
 
@@ -289,6 +371,75 @@ std::unique_ptr<Expression> ConfigCompiler::CompileText(const String& path, cons
 	return CompileStream(path, &stream, zone, package);
 }
 
+/**
+ * Enables or disables recording the files compiled by CompileFile()
+ * along with the SHA256 hash of their content.
+ *
+ * @param record Whether to record the compiled files.
+ */
+void ConfigCompiler::SetRecordCompiledFiles(bool record)
+{
+	m_RecordCompiledFiles.store(record);
+}
+
+/**
+ * Retrieves the files compiled while recording was enabled.
+ *
+ * @returns The files by path.
+ */
+std::map<String, CompiledFile> ConfigCompiler::GetCompiledFiles()
+{
+	std::unique_lock<std::mutex> lock(m_CompiledFilesMutex);
+	return m_CompiledFiles;
+}
+
+/**
+ * Collects the object definitions of a compiled file, i.e. "object" statements
+ * which aren't templates and don't have an "assign where" filter.
+ *
+ * @param text The content of the file.
+ * @param expr The compiled file.
+ * @param objects Receives the object definitions in order.
+ * @returns Whether the file defines nothing but objects.
+ */
+bool ConfigCompiler::GetObjectDefinitions(const String& text, const Expression *expr, std::vector<ObjectDefinition>& objects)
+{
+	objects.clear();
+
+	auto dict (dynamic_cast<const DictExpression *>(expr));
+
+	if (!dict)
+		return false;
+
+	for (auto& statement : dict->GetExpressions()) {
+		auto object (dynamic_cast<const ObjectExpression *>(statement.get()));
+
+		if (!object || object->IsAbstract() || object->GetFilter()) {
+			objects.clear();
+			return false;
+		}
+
+		objects.push_back({ String(), object->GetDebugInfo() });
+	}
+
+	/* The body isn't part of the location, so a definition reaches up to the next one. */
+	std::vector<String> lines = text.Split("\n");
+
+	for (decltype(objects.size()) i = 0; i < objects.size(); i++) {
+		int first = objects[i].Location.FirstLine;
+		int last = i + 1 < objects.size() ? std::max(first, objects[i + 1].Location.FirstLine - 1) : static_cast<int>(lines.size());
+
+		std::ostringstream msgbuf;
+
+		for (int line = first; line <= last && line <= static_cast<int>(lines.size()); line++)
+			msgbuf << lines[line - 1] << "\n";
+
+		objects[i].Source = msgbuf.str();
+	}
+
+	return true;
+}
+
 /**
  * Adds a directory to the list of include search dirs.
  *
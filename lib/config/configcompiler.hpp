@@ -10,9 +10,12 @@
 #include "base/initialize.hpp"
 #include "base/singleton.hpp"
 #include "base/string.hpp"
+#include <atomic>
 #include <future>
 #include <iostream>
+#include <map>
 #include <stack>
+#include <vector>
 
 typedef union YYSTYPE YYSTYPE;
 typedef void *yyscan_t;
@@ -61,6 +64,31 @@ struct ZoneFragment
 	String Path;
 };
 
+/**
+ * An object definition on the top level of a file.
+ *
+ * @ingroup config
+ */
+struct ObjectDefinition
+{
+	String Source; /**< The lines from the definition up to the next one */
+	DebugInfo Location;
+};
+
+/**
+ * A file compiled by ConfigCompiler::CompileFile() while recording was enabled.
+ *
+ * @ingroup config
+ */
+struct CompiledFile
+{
+	String Hash; /**< SHA256 hash of the content */
+	String Zone;
+	String Package;
+	bool ObjectsOnly; /**< Whether the file defines nothing but objects */
+	std::vector<ObjectDefinition> Objects; /**< The object definitions if ObjectsOnly is true */
+};
+
 /**
  * The configuration compiler can be used to compile a configuration file
  * into a number of configuration items.
@@ -85,6 +113,10 @@ public:
 
 	static void AddIncludeSearchDir(const String& dir);
 
+	static void SetRecordCompiledFiles(bool record);
+	static std::map<String, CompiledFile> GetCompiledFiles();
+	static bool GetObjectDefinitions(const String& text, const Expression *expr, std::vector<ObjectDefinition>& objects);
+
 	const char *GetPath() const;
 
 	void SetZone(const String& zone);
@@ -98,6 +130,8 @@ public:
 
 	static void CollectIncludes(std::vector<std::unique_ptr<Expression> >& expressions,
 		const String& file, const String& zone, const String& package);
+	static void CollectIncludes(std::vector<std::unique_ptr<Expression> >& expressions,
+		const std::vector<String>& files, const String& zone, const String& package);
 
 	static std::unique_ptr<Expression> HandleInclude(const String& relativeBase, const String& path, bool search,
 		const String& zone, const String& package, const DebugInfo& debuginfo = DebugInfo());
@@ -129,6 +163,10 @@ private:
 	static std::mutex m_ZoneDirsMutex;
 	static std::map<String, std::vector<ZoneFragment> > m_ZoneDirs;
 
+	static std::atomic<bool> m_RecordCompiledFiles;
+	static std::mutex m_CompiledFilesMutex;
+	static std::map<String, CompiledFile> m_CompiledFiles;
+
 	void InitializeScanner();
 	void DestroyScanner();
 
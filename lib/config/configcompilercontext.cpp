@@ -7,6 +7,8 @@
 #include "base/exception.hpp"
 #include "base/application.hpp"
 #include "base/utility.hpp"
+#include "base/logger.hpp"
+#include "base/convert.hpp"
 
 using namespace icinga;
 
@@ -17,6 +19,10 @@ ConfigCompilerContext *ConfigCompilerContext::GetInstance()
 
 void ConfigCompilerContext::OpenObjectsFile(const String& filename)
 {
+	m_ObjectsPath = filename;
+	m_ObjectsSize = 0;
+	m_ObjectsIndex.clear();
+
 	try {
 		m_ObjectsFP = std::make_unique<AtomicFile>(filename, 0600);
 	} catch (const std::exception& ex) {
@@ -31,10 +37,16 @@ void ConfigCompilerContext::WriteObject(const Dictionary::Ptr& object)
 		return;
 
 	String json = JsonEncode(object);
+	Dictionary::Ptr properties = object->Get("properties");
 
 	{
 		std::unique_lock<std::mutex> lock(m_Mutex);
 		NetString::WriteStringToStream(*m_ObjectsFP, json);
+
+		m_ObjectsIndex.push_back({ object->Get("type"), object->Get("name"), properties ? properties->Get("__name") : Empty, m_ObjectsSize });
+
+		/* <length>:<json>, */
+		m_ObjectsSize += Convert::ToString(json.GetLength()).GetLength() + json.GetLength() + 2;
 	}
 }
 
@@ -44,6 +56,7 @@ void ConfigCompilerContext::CancelObjectsFile()
 		return;
 
 	m_ObjectsFP.reset(nullptr);
+	m_ObjectsIndex.clear();
 }
 
 void ConfigCompilerContext::FinishObjectsFile()
@@ -51,6 +64,126 @@ void ConfigCompilerContext::FinishObjectsFile()
 	if (!m_ObjectsFP)
 		return;
 
+	/* An index left over from a previous run must never be used with the new objects file. */
+	String indexPath = GetObjectsIndexPath(m_ObjectsPath);
+
+	if (Utility::PathExists(indexPath))
+		Utility::Remove(indexPath);
+
 	m_ObjectsFP->Commit();
 	m_ObjectsFP.reset(nullptr);
+
+	WriteObjectsIndex();
+}
+
+/**
+ * @returns The index of the objects file which "icinga2 object list" uses to decode only the objects it prints.
+ */
+String ConfigCompilerContext::GetObjectsIndexPath(const String& objectsPath)
+{
+	return objectsPath + ".index";
+}
+
+/**
+ * Writes the type, name and offset of every object in the objects file (as netstrings of JSON arrays)
+ * after a header with the size of the objects file, which tells whether the index belongs to it.
+ */
+void ConfigCompilerContext::WriteObjectsIndex()
+{
+	try {
+		AtomicFile fp (GetObjectsIndexPath(m_ObjectsPath), 0600);
+
+		NetString::WriteStringToStream(fp, JsonEncode(new Dictionary({
+			{ "objects_size", m_ObjectsSize }
+		})));
+
+		for (auto& entry : m_ObjectsIndex) {
+			NetString::WriteStringToStream(fp, JsonEncode(new Array({
+				entry.Type, entry.Name, entry.InternalName, entry.Offset
+			})));
+		}
+
+		fp.Commit();
+	} catch (const std::exception& ex) {
+		Log(LogWarning, "cli")
+			<< "Could not write objects index file: " << DiagnosticInformation(ex, false);
+	}
+
+	m_ObjectsIndex.clear();
+}
+
+/**
+ * Starts writing a snapshot of the committed config items, see ConfigItem::LoadSnapshot().
+ *
+ * @param filename The snapshot file.
+ * @param fingerprint Identifies the configuration the items are committed from.
+ */
+void ConfigCompilerContext::OpenSnapshotFile(const String& filename, const String& fingerprint)
+{
+	try {
+		m_SnapshotFP = std::make_unique<AtomicFile>(filename, 0600);
+	} catch (const std::exception& ex) {
+		Log(LogWarning, "cli", "Could not create temporary config snapshot file: " + DiagnosticInformation(ex, false));
+		return;
+	}
+
+	m_SnapshotDiscardReason = String();
+
+	String json = JsonEncode(new Dictionary({
+		{ "fingerprint", fingerprint }
+	}));
+
+	NetString::WriteStringToStream(*m_SnapshotFP, json);
+}
+
+void ConfigCompilerContext::WriteSnapshotItem(const Dictionary::Ptr& item)
+{
+	if (!m_SnapshotFP)
+		return;
+
+	String json = JsonEncode(item);
+
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		NetString::WriteStringToStream(*m_SnapshotFP, json);
+	}
+}
+
+/**
+ * Marks the snapshot as unusable, e.g. because an object can't be restored from it.
+ * The snapshot file isn't written then.
+ *
+ * @param reason Why the snapshot can't be written.
+ */
+void ConfigCompilerContext::DiscardSnapshotFile(const String& reason)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	if (m_SnapshotDiscardReason.IsEmpty())
+		m_SnapshotDiscardReason = reason;
+}
+
+void ConfigCompilerContext::CancelSnapshotFile()
+{
+	if (!m_SnapshotFP)
+		return;
+
+	m_SnapshotFP.reset(nullptr);
+}
+
+void ConfigCompilerContext::FinishSnapshotFile()
+{
+	if (!m_SnapshotFP)
+		return;
+
+	if (!m_SnapshotDiscardReason.IsEmpty()) {
+		Log(LogWarning, "cli")
+			<< "Not writing the config snapshot: " << m_SnapshotDiscardReason;
+
+		m_SnapshotFP.reset(nullptr);
+		return;
+	}
+
+	m_SnapshotFP->Commit();
+	m_SnapshotFP.reset(nullptr);
 }
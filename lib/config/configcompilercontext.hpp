@@ -6,9 +6,11 @@
 #include "config/i2-config.hpp"
 #include "base/atomic-file.hpp"
 #include "base/dictionary.hpp"
+#include <cstdint>
 #include <fstream>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 namespace icinga
 {
@@ -29,12 +31,43 @@ public:
 		return (bool)m_ObjectsFP;
 	}
 
+	void OpenSnapshotFile(const String& filename, const String& fingerprint);
+	void WriteSnapshotItem(const Dictionary::Ptr& item);
+	void DiscardSnapshotFile(const String& reason);
+	void CancelSnapshotFile();
+	void FinishSnapshotFile();
+
+	inline bool IsSnapshotOpen() const noexcept
+	{
+		return (bool)m_SnapshotFP;
+	}
+
+	static String GetObjectsIndexPath(const String& objectsPath);
+
 	static ConfigCompilerContext *GetInstance();
 
 private:
+	/**
+	 * Where an object has been written to the objects file, see WriteObjectsIndex().
+	 */
+	struct ObjectsIndexEntry
+	{
+		String Type;
+		String Name;
+		String InternalName;
+		uint_fast64_t Offset;
+	};
+
+	String m_ObjectsPath;
 	std::unique_ptr<AtomicFile> m_ObjectsFP;
+	uint_fast64_t m_ObjectsSize{0};
+	std::vector<ObjectsIndexEntry> m_ObjectsIndex;
+	std::unique_ptr<AtomicFile> m_SnapshotFP;
+	String m_SnapshotDiscardReason;
 
 	mutable std::mutex m_Mutex;
+
+	void WriteObjectsIndex();
 };
 
 }
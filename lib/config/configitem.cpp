@@ -5,6 +5,7 @@
 #include "config/applyrule.hpp"
 #include "config/objectrule.hpp"
 #include "config/configcompiler.hpp"
+#include "config/configprofiler.hpp"
 #include "base/application.hpp"
 #include "base/configtype.hpp"
 #include "base/objectlock.hpp"
@@ -20,8 +21,12 @@
 #include "base/exception.hpp"
 #include "base/function.hpp"
 #include "base/utility.hpp"
+#include "base/valuepool.hpp"
 #include <boost/algorithm/string/join.hpp>
 #include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <map>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
@@ -186,25 +191,31 @@ ConfigObject::Ptr ConfigItem::Commit(bool discard)
 
 	DebugHint debugHints;
 
-	ScriptFrame frame(true, dobj);
-	if (m_Scope)
-		m_Scope->CopyTo(frame.Locals);
-	try {
-		m_Expression->Evaluate(frame, &debugHints);
-	} catch (const std::exception& ex) {
-		if (m_IgnoreOnError) {
-			Log(LogNotice, "ConfigObject")
-				<< "Ignoring config object '" << m_Name << "' of type '" << type->GetName() << "' due to errors: " << DiagnosticInformation(ex);
+	if (m_Restored) {
+		RestoreProperties(dobj);
+		m_Properties.reset();
+	} else {
+		ScriptFrame frame(true, dobj);
+		if (m_Scope)
+			m_Scope->CopyTo(frame.Locals);
+		try {
+			ConfigProfilerScope profile ("commit", [&type]() { return "evaluate " + type->GetName(); });
+			m_Expression->Evaluate(frame, &debugHints);
+		} catch (const std::exception& ex) {
+			if (m_IgnoreOnError) {
+				Log(LogNotice, "ConfigObject")
+					<< "Ignoring config object '" << m_Name << "' of type '" << type->GetName() << "' due to errors: " << DiagnosticInformation(ex);
+
+				{
+					std::unique_lock<std::mutex> lock(m_Mutex);
+					m_IgnoredItems.push_back(m_DebugInfo.Path);
+				}
 
-			{
-				std::unique_lock<std::mutex> lock(m_Mutex);
-				m_IgnoredItems.push_back(m_DebugInfo.Path);
+				return nullptr;
 			}
 
-			return nullptr;
+			throw;
 		}
-
-		throw;
 	}
 
 	if (discard)
@@ -240,27 +251,38 @@ ConfigObject::Ptr ConfigItem::Commit(bool discard)
 
 	Dictionary::Ptr dhint = debugHints.ToDictionary();
 
-	try {
-		DefaultValidationUtils utils;
-		dobj->Validate(FAConfig, utils);
-	} catch (ValidationError& ex) {
-		if (m_IgnoreOnError) {
-			Log(LogNotice, "ConfigObject")
-				<< "Ignoring config object '" << m_Name << "' of type '" << type->GetName() << "' due to errors: " << DiagnosticInformation(ex);
+	/* The snapshot holds the properties as evaluated, OnConfigLoaded() may still change them. */
+	Dictionary::Ptr snapshotProperties;
+
+	if (!m_Restored && ConfigCompilerContext::GetInstance()->IsSnapshotOpen())
+		snapshotProperties = GetSnapshotProperties(dobj);
+
+	/* Restored objects were validated when the snapshot was written. */
+	if (!m_Restored) {
+		try {
+			ConfigProfilerScope profile ("commit", [&type]() { return "validate " + type->GetName(); });
+			DefaultValidationUtils utils;
+			dobj->Validate(FAConfig, utils);
+		} catch (ValidationError& ex) {
+			if (m_IgnoreOnError) {
+				Log(LogNotice, "ConfigObject")
+					<< "Ignoring config object '" << m_Name << "' of type '" << type->GetName() << "' due to errors: " << DiagnosticInformation(ex);
+
+				{
+					std::unique_lock<std::mutex> lock(m_Mutex);
+					m_IgnoredItems.push_back(m_DebugInfo.Path);
+				}
 
-			{
-				std::unique_lock<std::mutex> lock(m_Mutex);
-				m_IgnoredItems.push_back(m_DebugInfo.Path);
+				return nullptr;
 			}
 
-			return nullptr;
+			ex.SetDebugHint(dhint);
+			throw;
 		}
-
-		ex.SetDebugHint(dhint);
-		throw;
 	}
 
 	try {
+		ConfigProfilerScope profile ("commit", [&type]() { return "OnConfigLoaded " + type->GetName(); });
 		dobj->OnConfigLoaded();
 	} catch (const std::exception& ex) {
 		if (m_IgnoreOnError) {
@@ -278,6 +300,9 @@ ConfigObject::Ptr ConfigItem::Commit(bool discard)
 		throw;
 	}
 
+	if (snapshotProperties)
+		WriteSnapshotItem(snapshotProperties);
+
 	Value serializedObject;
 
 	try {
@@ -317,6 +342,101 @@ ConfigObject::Ptr ConfigItem::Commit(bool discard)
 	return dobj;
 }
 
+/**
+ * Sets the object's attributes to the properties restored from the config snapshot.
+ *
+ * @param dobj The object.
+ */
+void ConfigItem::RestoreProperties(const ConfigObject::Ptr& dobj) const
+{
+	Type::Ptr type = dobj->GetReflectionType();
+
+	ObjectLock olock(m_Properties);
+	for (const Dictionary::Pair& kv : m_Properties) {
+		int fid = type->GetFieldId(kv.first);
+
+		if (fid < 0)
+			continue;
+
+		/* Skip unchanged values, e.g. of attributes which are backed by global variables. */
+		if (!kv.second.IsObject() && dobj->GetField(fid) == kv.second)
+			continue;
+
+		dobj->SetField(fid, kv.second, true);
+	}
+}
+
+/**
+ * Checks whether a value survives being written to and read from the config snapshot.
+ */
+static bool IsSnapshotSafe(const Value& value)
+{
+	if (!value.IsObject())
+		return true;
+
+	Object::Ptr object = value;
+
+	if (auto array = dynamic_pointer_cast<Array>(object)) {
+		ObjectLock olock(array);
+		return std::all_of(array->Begin(), array->End(), &IsSnapshotSafe);
+	}
+
+	if (auto dict = dynamic_pointer_cast<Dictionary>(object)) {
+		ObjectLock olock(dict);
+		return std::all_of(dict->Begin(), dict->End(), [](const Dictionary::Pair& kv) { return IsSnapshotSafe(kv.second); });
+	}
+
+	/* Functions, namespaces, ... can't be serialized. */
+	return false;
+}
+
+/**
+ * Serializes the object's config attributes for the config snapshot.
+ *
+ * @param dobj The object.
+ * @returns The properties, or nullptr if an attribute can't be serialized.
+ */
+Dictionary::Ptr ConfigItem::GetSnapshotProperties(const ConfigObject::Ptr& dobj) const
+{
+	Type::Ptr type = dobj->GetReflectionType();
+
+	for (int fid = 0; fid < type->GetFieldCount(); fid++) {
+		Field field = type->GetFieldInfo(fid);
+
+		if (!(field.Attributes & FAConfig))
+			continue;
+
+		if (!IsSnapshotSafe(dobj->GetField(fid))) {
+			std::ostringstream msgbuf;
+			msgbuf << "Attribute '" << field.Name << "' of object '" << dobj->GetName() << "' of type '"
+				<< type->GetName() << "' can't be serialized (" << m_DebugInfo << ").";
+			ConfigCompilerContext::GetInstance()->DiscardSnapshotFile(msgbuf.str());
+			return nullptr;
+		}
+	}
+
+	return Serialize(dobj, FAConfig);
+}
+
+void ConfigItem::WriteSnapshotItem(const Dictionary::Ptr& properties) const
+{
+	ConfigCompilerContext::GetInstance()->WriteSnapshotItem(new Dictionary({
+		{ "type", m_Type->GetName() },
+		{ "name", m_Name },
+		{ "zone", m_Zone },
+		{ "package", m_Package },
+		{ "ignore_on_error", m_IgnoreOnError },
+		{ "properties", properties },
+		{ "debug_info", new Array({
+			m_DebugInfo.Path,
+			m_DebugInfo.FirstLine,
+			m_DebugInfo.FirstColumn,
+			m_DebugInfo.LastLine,
+			m_DebugInfo.LastColumn,
+		}) }
+	}));
+}
+
 /**
  * Registers the configuration item.
  */
@@ -348,6 +468,11 @@ void ConfigItem::Register()
 		if (m_DefaultTmpl)
 			m_DefaultTemplates[m_Type][m_Name] = this;
 	}
+
+	lock.unlock();
+
+	if (m_Filter)
+		ObjectRule::AddRule(this);
 }
 
 /**
@@ -360,6 +485,9 @@ void ConfigItem::Unregister()
 		m_Object.reset();
 	}
 
+	if (m_Filter)
+		ObjectRule::RemoveRule(this);
+
 	std::unique_lock<std::mutex> lock(m_Mutex);
 	m_UnnamedItems.erase(std::remove(m_UnnamedItems.begin(), m_UnnamedItems.end(), this), m_UnnamedItems.end());
 	m_Items[m_Type].erase(m_Name);
@@ -478,7 +606,7 @@ bool ConfigItem::CommitNewItems(const ActivationContext::Ptr& context, WorkQueue
 				auto items (itemsByType.find(type.get()));
 
 				if (items != itemsByType.end()) {
-					upq.ParallelFor(items->second, [&committed_items, &newItems, &newItemsMutex](const ItemPair& ip) {
+					upq.ParallelForStealing(items->second, [&committed_items, &newItems, &newItemsMutex](const ItemPair& ip) {
 						const ConfigItem::Ptr& item = ip.first;
 
 						if (!item->Commit(ip.second)) {
@@ -545,13 +673,14 @@ bool ConfigItem::CommitNewItems(const ActivationContext::Ptr& context, WorkQueue
 				auto items (itemsByType.find(type.get()));
 
 				if (items != itemsByType.end()) {
-					upq.ParallelFor(items->second, [&notified_items](const ItemPair& ip) {
+					upq.ParallelForStealing(items->second, [&notified_items](const ItemPair& ip) {
 						const ConfigItem::Ptr& item = ip.first;
 
 						if (!item->m_Object)
 							return;
 
 						try {
+							ConfigProfilerScope profile ("commit", [&item]() { return "OnAllConfigLoaded " + item->m_Type->GetName(); });
 							item->m_Object->OnAllConfigLoaded();
 							notified_items++;
 						} catch (const std::exception& ex) {
@@ -590,13 +719,20 @@ bool ConfigItem::CommitNewItems(const ActivationContext::Ptr& context, WorkQueue
 				auto items (itemsByType.find(loadDep));
 
 				if (items != itemsByType.end()) {
-					upq.ParallelFor(items->second, [&type, &notified_items](const ItemPair& ip) {
+					upq.ParallelForStealing(items->second, [&type, &notified_items](const ItemPair& ip) {
 						const ConfigItem::Ptr& item = ip.first;
 
 						if (!item->m_Object)
 							return;
 
+						/* The children of restored objects were restored as well. */
+						if (item->m_Restored)
+							return;
+
 						ActivationScope ascope(item->m_ActivationContext);
+						ConfigProfilerScope profile ("commit", [&type, &item]() {
+							return "CreateChildObjects " + type->GetName() + " for " + item->m_Type->GetName();
+						});
 						item->m_Object->CreateChildObjects(type);
 						notified_items++;
 					});
@@ -623,6 +759,39 @@ bool ConfigItem::CommitNewItems(const ActivationContext::Ptr& context, WorkQueue
 	return true;
 }
 
+/**
+ * Makes the new objects share equal custom variable values, e.g. the ones thousands of hosts inherit from the same
+ * templates. The shared values are frozen, the objects' vars dictionaries themselves aren't.
+ */
+static void ShareCustomVars(const std::vector<ConfigItem::Ptr>& items, bool silent)
+{
+	ConfigProfilerScope profile ("commit", []() { return String("share custom variables"); });
+
+	ValuePool pool;
+
+	for (const ConfigItem::Ptr& item : items) {
+		ConfigObject::Ptr object = item->GetObject();
+
+		if (!object)
+			continue;
+
+		int fid = object->GetReflectionType()->GetFieldId("vars");
+
+		if (fid == -1)
+			continue;
+
+		Value vars = object->GetField(fid);
+
+		if (vars.IsObjectType<Dictionary>())
+			pool.ShareElements(vars);
+	}
+
+	if (!silent && pool.GetSharedCount() > 0) {
+		Log(LogNotice, "ConfigItem")
+			<< "Shared " << pool.GetSharedCount() << " custom variable values between objects.";
+	}
+}
+
 bool ConfigItem::CommitItems(const ActivationContext::Ptr& context, WorkQueue& upq, std::vector<ConfigItem::Ptr>& newItems, bool silent)
 {
 	if (!silent)
@@ -638,7 +807,12 @@ bool ConfigItem::CommitItems(const ActivationContext::Ptr& context, WorkQueue& u
 		return false;
 	}
 
-	ApplyRule::CheckMatches(silent);
+	/* Apply rules aren't evaluated for restored objects, their matches were checked when the snapshot was written. */
+	bool restored = std::any_of(newItems.begin(), newItems.end(), [](const ConfigItem::Ptr& item) { return item->m_Restored; });
+
+	ApplyRule::CheckMatches(silent || restored);
+
+	ShareCustomVars(newItems, silent);
 
 	if (!silent) {
 		/* log stats for external parsers */
@@ -678,7 +852,15 @@ bool ConfigItem::ActivateItems(const std::vector<ConfigItem::Ptr>& newItems, boo
 
 	if (withModAttrs) {
 		/* restore modified attributes */
-		if (Utility::PathExists(Configuration::ModAttrPath)) {
+		String journal = Configuration::ModAttrPath + ".journal";
+
+		if (Utility::PathExists(journal)) {
+			try {
+				ConfigObject::RestoreModifiedAttributesJournal(journal);
+			} catch (const std::exception& ex) {
+				Log(LogCritical, "config", DiagnosticInformation(ex));
+			}
+		} else if (Utility::PathExists(Configuration::ModAttrPath)) {
 			std::unique_ptr<Expression> expression = ConfigCompiler::CompileFile(Configuration::ModAttrPath);
 
 			if (expression) {
@@ -729,28 +911,34 @@ bool ConfigItem::ActivateItems(const std::vector<ConfigItem::Ptr>& newItems, boo
 		}
 	}
 
-	for (const Type::Ptr& type : types) {
-		for (const ConfigItem::Ptr& item : newItems) {
-			if (!item->m_Object)
-				continue;
-
-			ConfigObject::Ptr object = item->m_Object;
-			Type::Ptr objectType = object->GetReflectionType();
+	std::unordered_map<Type *, std::vector<ConfigObject::Ptr>> objectsByType;
 
-			if (objectType != type)
-				continue;
+	for (const ConfigItem::Ptr& item : newItems) {
+		if (item->m_Object)
+			objectsByType[item->m_Object->GetReflectionType().get()].emplace_back(item->m_Object);
+	}
 
+	for (const std::vector<Type::Ptr>& wave : GetActivationWaves(types)) {
+		/* On startup the objects of all types in a wave are activated in parallel. */
+		if (mainConfigActivation) {
+			if (!ActivateWave(wave, objectsByType, runtimeCreated, cookie))
+				return false;
+		} else {
+			for (const Type::Ptr& type : wave) {
+				for (const ConfigObject::Ptr& object : objectsByType[type.get()]) {
 #ifdef I2_DEBUG
-			Log(LogDebug, "ConfigItem")
-				<< "Activating object '" << object->GetName() << "' of type '"
-				<< objectType->GetName() << "' with priority "
-				<< objectType->GetActivationPriority();
+					Log(LogDebug, "ConfigItem")
+						<< "Activating object '" << object->GetName() << "' of type '"
+						<< type->GetName() << "' with priority "
+						<< type->GetActivationPriority();
 #endif /* I2_DEBUG */
 
-			object->Activate(runtimeCreated, cookie);
+					object->Activate(runtimeCreated, cookie);
+				}
+			}
 		}
 
-		if (mainConfigActivation && type == lastLoggerType) {
+		if (mainConfigActivation && std::find(wave.begin(), wave.end(), lastLoggerType) != wave.end()) {
 			/* Disable early logging configuration once the last logger type was activated. */
 			Logger::DisableEarlyLogging();
 		}
@@ -762,6 +950,120 @@ bool ConfigItem::ActivateItems(const std::vector<ConfigItem::Ptr>& newItems, boo
 	return true;
 }
 
+/**
+ * Groups types (sorted by their activation priority) into waves which are activated one after another.
+ * Types of the same priority are part of the same wave unless one depends on the other (see
+ * Type::GetLoadDependencies()), which puts it into one of the following waves.
+ *
+ * @param types The types, sorted by their activation priority.
+ * @returns The waves.
+ */
+std::vector<std::vector<Type::Ptr>> ConfigItem::GetActivationWaves(const std::vector<Type::Ptr>& types)
+{
+	std::vector<std::vector<Type::Ptr>> waves;
+
+	for (auto level (types.begin()); level != types.end();) {
+		auto levelEnd (std::find_if(level, types.end(), [&level](const Type::Ptr& type) {
+			return type->GetActivationPriority() != (*level)->GetActivationPriority();
+		}));
+
+		std::vector<Type::Ptr> remaining (level, levelEnd);
+
+		while (!remaining.empty()) {
+			std::vector<Type::Ptr> wave, rest;
+
+			for (const Type::Ptr& type : remaining) {
+				auto& deps (type->GetLoadDependencies());
+
+				bool blocked = std::any_of(remaining.begin(), remaining.end(), [&deps, &type](const Type::Ptr& other) {
+					return other != type && deps.find(other.get()) != deps.end();
+				});
+
+				(blocked ? rest : wave).emplace_back(type);
+			}
+
+			/* Dependency cycles can't be resolved, activate them together. */
+			if (wave.empty())
+				wave.swap(rest);
+
+			waves.emplace_back(std::move(wave));
+			remaining.swap(rest);
+		}
+
+		level = levelEnd;
+	}
+
+	return waves;
+}
+
+struct ActivationTiming
+{
+	std::atomic<uint_fast64_t> Nanoseconds{0};
+};
+
+/**
+ * Activates the objects of all types of a wave in parallel and logs how long each type took.
+ *
+ * @returns Whether no object failed to activate.
+ */
+bool ConfigItem::ActivateWave(const std::vector<Type::Ptr>& wave, std::unordered_map<Type *, std::vector<ConfigObject::Ptr>>& objectsByType,
+	bool runtimeCreated, const Value& cookie)
+{
+	std::map<Type *, ActivationTiming> timings;
+
+	for (const Type::Ptr& type : wave) {
+		if (!objectsByType[type.get()].empty())
+			timings[type.get()];
+	}
+
+	if (timings.empty())
+		return true;
+
+	auto start (std::chrono::steady_clock::now());
+
+	WorkQueue upq(25000, Configuration::Concurrency);
+	upq.SetName("ConfigItem::ActivateItems");
+
+	for (auto& kv : timings) {
+		Type *type = kv.first;
+		ActivationTiming *timing = &kv.second;
+
+		upq.ParallelForStealing(objectsByType[type], [type, timing, runtimeCreated, &cookie](const ConfigObject::Ptr& object) {
+#ifdef I2_DEBUG
+			Log(LogDebug, "ConfigItem")
+				<< "Activating object '" << object->GetName() << "' of type '"
+				<< type->GetName() << "' with priority "
+				<< type->GetActivationPriority();
+#endif /* I2_DEBUG */
+
+			auto objectStart (std::chrono::steady_clock::now());
+
+			object->Activate(runtimeCreated, cookie);
+
+			timing->Nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - objectStart).count());
+		});
+	}
+
+	upq.Join();
+
+	if (upq.HasExceptions()) {
+		upq.ReportExceptions("ConfigItem");
+		return false;
+	}
+
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (auto& kv : timings) {
+		Log(LogInformation, "ConfigItem")
+			<< "Activated " << objectsByType[kv.first].size() << " objects of type '" << kv.first->GetName()
+			<< "' in " << std::fixed << std::setprecision(3) << kv.second.Nanoseconds.load() / 1e9
+			<< "s (summed up over all threads, wave of " << timings.size() << " types took " << wall << "s).";
+	}
+
+	return true;
+}
+
 bool ConfigItem::RunWithActivationContext(const Function::Ptr& function)
 {
 	ActivationScope scope;
@@ -805,6 +1107,34 @@ std::vector<ConfigItem::Ptr> ConfigItem::GetItems(const Type::Ptr& type)
 	return items;
 }
 
+/**
+ * Retrieves the items registered in an activation context. Committed items of types
+ * with composed names, e.g. services, aren't registered anymore.
+ *
+ * @param context The activation context.
+ * @returns The items.
+ */
+std::vector<ConfigItem::Ptr> ConfigItem::GetContextItems(const ActivationContext::Ptr& context)
+{
+	std::vector<ConfigItem::Ptr> items;
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	for (const TypeMap::value_type& kv : m_Items) {
+		for (const ItemMap::value_type& kv2 : kv.second) {
+			if (kv2.second->m_ActivationContext == context)
+				items.push_back(kv2.second);
+		}
+	}
+
+	for (const ConfigItem::Ptr& item : m_UnnamedItems) {
+		if (item->m_ActivationContext == context)
+			items.push_back(item);
+	}
+
+	return items;
+}
+
 std::vector<ConfigItem::Ptr> ConfigItem::GetDefaultTemplates(const Type::Ptr& type)
 {
 	std::vector<ConfigItem::Ptr> items;
@@ -841,3 +1171,130 @@ void ConfigItem::RemoveIgnoredItems(const String& allowedConfigPath)
 
 	m_IgnoredItems.clear();
 }
+
+/**
+ * Replaces the objects of the activation context, i.e. those defined by the
+ * configuration which was just evaluated, with the ones committed when the
+ * snapshot was written. Templates stay as they are.
+ *
+ * @param filename The snapshot file, see ConfigCompilerContext::OpenSnapshotFile().
+ * @param fingerprint Identifies the evaluated configuration, must match the snapshot's.
+ * @param context The activation context.
+ * @returns Whether the objects were replaced.
+ */
+bool ConfigItem::LoadSnapshot(const String& filename, const String& fingerprint, const ActivationContext::Ptr& context)
+{
+	if (!Utility::PathExists(filename))
+		return false;
+
+	std::vector<ConfigItem::Ptr> items;
+
+	try {
+		std::fstream fp;
+		fp.open(filename.CStr(), std::ios_base::in);
+
+		StdioStream::Ptr sfp = new StdioStream(&fp, false);
+
+		String message;
+		StreamReadContext src;
+
+		if (NetString::ReadStringFromStream(sfp, &message, src) != StatusNewItem)
+			return false;
+
+		Dictionary::Ptr header = JsonDecode(message);
+
+		if (header->Get("fingerprint") != fingerprint) {
+			Log(LogInformation, "ConfigItem")
+				<< "The configuration changed since the config snapshot '" << filename << "' was written, not using it.";
+			return false;
+		}
+
+		for (;;) {
+			StreamReadStatus srs = NetString::ReadStringFromStream(sfp, &message, src);
+
+			if (srs == StatusEof)
+				break;
+
+			if (srs != StatusNewItem)
+				continue;
+
+			Dictionary::Ptr record = JsonDecode(message);
+
+			String typeName = record->Get("type");
+			Type::Ptr type = Type::GetByName(typeName);
+
+			if (!type)
+				BOOST_THROW_EXCEPTION(std::runtime_error("Unknown type '" + typeName + "'"));
+
+			Array::Ptr di = record->Get("debug_info");
+
+			DebugInfo debugInfo;
+			debugInfo.Path = di->Get(0);
+			debugInfo.FirstLine = di->Get(1);
+			debugInfo.FirstColumn = di->Get(2);
+			debugInfo.LastLine = di->Get(3);
+			debugInfo.LastColumn = di->Get(4);
+
+			ConfigItem::Ptr item = new ConfigItem(type, record->Get("name"), false, new DictExpression(), nullptr,
+				false, record->Get("ignore_on_error").ToBool(), debugInfo, nullptr, record->Get("zone"), record->Get("package"));
+
+			item->m_Properties = record->Get("properties");
+			item->m_Restored = true;
+
+			items.emplace_back(std::move(item));
+		}
+
+		sfp->Close();
+	} catch (const std::exception& ex) {
+		Log(LogWarning, "ConfigItem")
+			<< "Could not read config snapshot '" << filename << "': " << DiagnosticInformation(ex, false);
+		return false;
+	}
+
+	std::vector<ConfigItem::Ptr> replaced;
+
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+
+		for (auto& kv : m_Items) {
+			for (auto& item : kv.second) {
+				if (!item.second->m_Abstract && !item.second->m_Object && item.second->m_ActivationContext == context)
+					replaced.emplace_back(item.second);
+			}
+		}
+
+		/* Unregister() would also drop named items (e.g. templates) which happen to have the same name. */
+		m_UnnamedItems.erase(std::remove_if(m_UnnamedItems.begin(), m_UnnamedItems.end(), [&context](const ConfigItem::Ptr& item) {
+			return !item->m_Object && item->m_ActivationContext == context;
+		}), m_UnnamedItems.end());
+	}
+
+	/* The filters of e.g. groups ("assign where") can't be serialized. The evaluated configuration
+	 * is the one of the snapshot, so they're taken over from the items which are replaced. */
+	std::map<std::pair<Type *, String>, ConfigItem::Ptr> filtered;
+
+	for (const ConfigItem::Ptr& item : replaced) {
+		if (item->m_Filter)
+			filtered.emplace(std::make_pair(item->m_Type.get(), item->m_Name), item);
+	}
+
+	for (const ConfigItem::Ptr& item : items) {
+		auto it (filtered.find(std::make_pair(item->m_Type.get(), item->m_Name)));
+
+		if (it != filtered.end()) {
+			item->m_Filter = it->second->m_Filter;
+			item->m_Scope = it->second->m_Scope;
+		}
+	}
+
+	for (const ConfigItem::Ptr& item : replaced)
+		item->Unregister();
+
+	for (const ConfigItem::Ptr& item : items)
+		item->Register();
+
+	Log(LogInformation, "ConfigItem")
+		<< "Restoring " << items.size() << " objects from the config snapshot '" << filename << "'.";
+
+	return true;
+}
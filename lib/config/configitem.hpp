@@ -8,6 +8,8 @@
 #include "config/activationcontext.hpp"
 #include "base/configobject.hpp"
 #include "base/workqueue.hpp"
+#include <unordered_map>
+#include <vector>
 
 namespace icinga
 {
@@ -59,10 +61,13 @@ public:
 	static bool RunWithActivationContext(const Function::Ptr& function);
 
 	static std::vector<ConfigItem::Ptr> GetItems(const Type::Ptr& type);
+	static std::vector<ConfigItem::Ptr> GetContextItems(const ActivationContext::Ptr& context);
 	static std::vector<ConfigItem::Ptr> GetDefaultTemplates(const Type::Ptr& type);
 
 	static void RemoveIgnoredItems(const String& allowedConfigPath);
 
+	static bool LoadSnapshot(const String& filename, const String& fingerprint, const ActivationContext::Ptr& context);
+
 private:
 	Type::Ptr m_Type; /**< The object type. */
 	String m_Name; /**< The name. */
@@ -77,6 +82,8 @@ private:
 	String m_Zone; /**< The zone. */
 	String m_Package;
 	ActivationContext::Ptr m_ActivationContext;
+	Dictionary::Ptr m_Properties; /**< The object's properties if it's restored from a config snapshot. */
+	bool m_Restored{false};
 
 	ConfigObject::Ptr m_Object;
 
@@ -97,8 +104,15 @@ private:
 		const String& name);
 
 	ConfigObject::Ptr Commit(bool discard = true);
+	void RestoreProperties(const ConfigObject::Ptr& dobj) const;
+	Dictionary::Ptr GetSnapshotProperties(const ConfigObject::Ptr& dobj) const;
+	void WriteSnapshotItem(const Dictionary::Ptr& properties) const;
 
 	static bool CommitNewItems(const ActivationContext::Ptr& context, WorkQueue& upq, std::vector<ConfigItem::Ptr>& newItems);
+
+	static std::vector<std::vector<Type::Ptr>> GetActivationWaves(const std::vector<Type::Ptr>& types);
+	static bool ActivateWave(const std::vector<Type::Ptr>& wave, std::unordered_map<Type *, std::vector<ConfigObject::Ptr>>& objectsByType,
+		bool runtimeCreated, const Value& cookie);
 };
 
 }
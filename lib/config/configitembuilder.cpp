@@ -1,6 +1,7 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "config/configitembuilder.hpp"
+#include "config/bytecode.hpp"
 #include "base/configtype.hpp"
 #include <sstream>
 
@@ -50,7 +51,8 @@ void ConfigItemBuilder::AddExpression(Expression *expr)
 
 void ConfigItemBuilder::SetFilter(const Expression::Ptr& filter)
 {
-	m_Filter = filter;
+	/* Group assign filters are evaluated for every host, service or user. */
+	m_Filter = filter ? new BytecodeExpression(filter) : nullptr;
 }
 
 void ConfigItemBuilder::SetDefaultTemplate(bool defaultTmpl)
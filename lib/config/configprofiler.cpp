@@ -0,0 +1,259 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "config/configprofiler.hpp"
+#include "base/atomic-file.hpp"
+#include "base/logger.hpp"
+#include "base/object.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+using namespace icinga;
+
+std::atomic<bool> ConfigProfiler::m_Enabled (false);
+
+struct ProfileEntry
+{
+	uint_fast64_t Count{0};
+	double Total{0};
+	double Self{0};
+	uint_fast64_t Objects{0};
+};
+
+struct ProfileFrame
+{
+	String Category;
+	String Name;
+	String Label;
+	std::chrono::steady_clock::time_point Start;
+	uint_fast64_t Objects;
+	double ChildTime;
+};
+
+typedef std::map<std::pair<String /* category */, String /* name */>, ProfileEntry> ProfileEntries;
+
+/**
+ * The measurements of one thread. Only the thread itself modifies them,
+ * the mutex protects them against the report being written meanwhile.
+ */
+struct ThreadProfile
+{
+	std::vector<ProfileFrame> Stack;
+
+	std::mutex Mutex;
+	ProfileEntries Entries;
+	std::map<String /* folded stack */, double /* self time */> Stacks;
+};
+
+static std::mutex l_ProfilesMutex;
+static std::vector<std::shared_ptr<ThreadProfile>> l_Profiles;
+static thread_local std::shared_ptr<ThreadProfile> l_ThreadProfile;
+
+static ThreadProfile& GetThreadProfile()
+{
+	if (!l_ThreadProfile) {
+		l_ThreadProfile = std::make_shared<ThreadProfile>();
+
+		std::unique_lock<std::mutex> lock (l_ProfilesMutex);
+		l_Profiles.emplace_back(l_ThreadProfile);
+	}
+
+	return *l_ThreadProfile;
+}
+
+/**
+ * Starts recording. Only operations started afterwards are measured.
+ */
+void ConfigProfiler::Enable()
+{
+	m_Enabled.store(true);
+}
+
+/**
+ * Formats the name of a template or apply rule for the report.
+ *
+ * @param type The type of the object(s) it defines.
+ * @param name The name of the template or rule.
+ * @param di Where it's defined.
+ * @returns The name.
+ */
+String ConfigProfiler::GetDefinitionName(const String& type, const String& name, const DebugInfo& di)
+{
+	std::ostringstream msgbuf;
+	msgbuf << type << " '" << name << "' (" << di << ")";
+	return msgbuf.str();
+}
+
+void ConfigProfiler::Begin(const char *category, String name)
+{
+	ThreadProfile& profile (GetThreadProfile());
+
+	/* Folded stacks use ';' as separator and end with a space followed by the value. */
+	String label = String(category) + " " + name;
+	std::replace(label.Begin(), label.End(), ';', ',');
+
+	profile.Stack.push_back({ category, std::move(name), std::move(label), std::chrono::steady_clock::now(), Object::GetCreatedCount(), 0 });
+}
+
+void ConfigProfiler::End()
+{
+	ThreadProfile& profile (GetThreadProfile());
+
+	ProfileFrame frame (std::move(profile.Stack.back()));
+	profile.Stack.pop_back();
+
+	double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - frame.Start).count();
+	double self = duration - frame.ChildTime;
+	uint_fast64_t objects = Object::GetCreatedCount() - frame.Objects;
+
+	String stack;
+
+	for (auto& parent : profile.Stack) {
+		stack += parent.Label + ";";
+	}
+
+	stack += frame.Label;
+
+	if (!profile.Stack.empty())
+		profile.Stack.back().ChildTime += duration;
+
+	std::unique_lock<std::mutex> lock (profile.Mutex);
+
+	ProfileEntry& entry (profile.Entries[std::make_pair(std::move(frame.Category), std::move(frame.Name))]);
+	entry.Count++;
+	entry.Total += duration;
+	entry.Self += self;
+	entry.Objects += objects;
+
+	profile.Stacks[stack] += self;
+}
+
+/**
+ * Sums up the measurements of all threads.
+ */
+static ProfileEntries GetEntries()
+{
+	ProfileEntries entries;
+	std::unique_lock<std::mutex> lock (l_ProfilesMutex);
+
+	for (auto& profile : l_Profiles) {
+		std::unique_lock<std::mutex> profileLock (profile->Mutex);
+
+		for (auto& kv : profile->Entries) {
+			ProfileEntry& entry (entries[kv.first]);
+			entry.Count += kv.second.Count;
+			entry.Total += kv.second.Total;
+			entry.Self += kv.second.Self;
+			entry.Objects += kv.second.Objects;
+		}
+	}
+
+	return entries;
+}
+
+/**
+ * @returns The self time in seconds per category and name, summed up over all threads.
+ */
+std::map<std::pair<String, String>, double> ConfigProfiler::GetSelfTimes()
+{
+	std::map<std::pair<String, String>, double> times;
+
+	for (auto& kv : GetEntries()) {
+		times.emplace(kv.first, kv.second.Self);
+	}
+
+	return times;
+}
+
+/**
+ * Writes the measurements of all threads per category, sorted by the total time.
+ *
+ * @param filename The report file.
+ */
+void ConfigProfiler::WriteReport(const String& filename)
+{
+	ProfileEntries entries (GetEntries());
+
+	std::map<String, std::vector<ProfileEntries::const_iterator>> categories;
+
+	for (auto it (entries.begin()); it != entries.end(); ++it) {
+		categories[it->first.first].emplace_back(it);
+	}
+
+	static const std::vector<std::pair<String, String>> titles {
+		{ "parse", "Parsed files" },
+		{ "import", "Template imports" },
+		{ "apply", "Apply rules" },
+		{ "commit", "Commit phases" }
+	};
+
+	AtomicFile fp (filename, 0644);
+
+	fp << "Config profile. Times are in milliseconds and summed up over all threads, objects are the number of objects created.\n";
+
+	for (auto& title : titles) {
+		auto category (categories.find(title.first));
+
+		if (category == categories.end())
+			continue;
+
+		auto& items (category->second);
+
+		std::sort(items.begin(), items.end(), [](const ProfileEntries::const_iterator& a, const ProfileEntries::const_iterator& b) {
+			return a->second.Total > b->second.Total;
+		});
+
+		fp << "\n" << title.second << ":\n"
+			<< std::setw(12) << "total" << std::setw(12) << "self" << std::setw(10) << "count" << std::setw(12) << "objects" << "  name\n";
+
+		for (auto& item : items) {
+			fp << std::fixed << std::setprecision(1)
+				<< std::setw(12) << item->second.Total * 1000 << std::setw(12) << item->second.Self * 1000
+				<< std::setw(10) << item->second.Count << std::setw(12) << item->second.Objects
+				<< "  " << item->first.second << "\n";
+		}
+	}
+
+	fp.Commit();
+
+	Log(LogInformation, "ConfigProfiler")
+		<< "Wrote config profile to '" << filename << "'.";
+}
+
+/**
+ * Writes the self time of every stack of nested scopes in microseconds as input for flame graph tools.
+ *
+ * @param filename The folded stacks file.
+ */
+void ConfigProfiler::WriteFoldedStacks(const String& filename)
+{
+	std::map<String, double> stacks;
+
+	{
+		std::unique_lock<std::mutex> lock (l_ProfilesMutex);
+
+		for (auto& profile : l_Profiles) {
+			std::unique_lock<std::mutex> profileLock (profile->Mutex);
+
+			for (auto& kv : profile->Stacks) {
+				stacks[kv.first] += kv.second;
+			}
+		}
+	}
+
+	AtomicFile fp (filename, 0644);
+
+	for (auto& kv : stacks) {
+		fp << kv.first << " " << static_cast<uint_fast64_t>(kv.second * 1000000) << "\n";
+	}
+
+	fp.Commit();
+
+	Log(LogInformation, "ConfigProfiler")
+		<< "Wrote config profile stacks to '" << filename << "'.";
+}
@@ -0,0 +1,83 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef CONFIGPROFILER_H
+#define CONFIGPROFILER_H
+
+#include "config/i2-config.hpp"
+#include "base/debuginfo.hpp"
+#include "base/string.hpp"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <utility>
+
+namespace icinga
+{
+
+/**
+ * Records how long parsing files, evaluating apply rules, importing templates and the
+ * phases of committing config items take (see "icinga2 daemon --profile").
+ *
+ * @ingroup config
+ */
+class ConfigProfiler
+{
+public:
+	static void Enable();
+
+	static inline bool IsEnabled()
+	{
+		return m_Enabled.load(std::memory_order_relaxed);
+	}
+
+	static String GetDefinitionName(const String& type, const String& name, const DebugInfo& di);
+
+	static std::map<std::pair<String, String>, double> GetSelfTimes();
+
+	static void WriteReport(const String& filename);
+	static void WriteFoldedStacks(const String& filename);
+
+private:
+	static std::atomic<bool> m_Enabled;
+
+	static void Begin(const char *category, String name);
+	static void End();
+
+	friend class ConfigProfilerScope;
+};
+
+/**
+ * Measures the time and the number of objects created until it's destroyed. The name
+ * is only retrieved from the callback if the profiler is enabled.
+ *
+ * Scopes nest per thread, a scope's self time excludes the time of the scopes inside it.
+ *
+ * @ingroup config
+ */
+class ConfigProfilerScope
+{
+public:
+	template<typename F>
+	inline ConfigProfilerScope(const char *category, const F& getName)
+		: m_Active(ConfigProfiler::IsEnabled())
+	{
+		if (m_Active)
+			ConfigProfiler::Begin(category, getName());
+	}
+
+	ConfigProfilerScope(const ConfigProfilerScope&) = delete;
+	ConfigProfilerScope& operator=(const ConfigProfilerScope&) = delete;
+
+	inline ~ConfigProfilerScope()
+	{
+		if (m_Active)
+			ConfigProfiler::End();
+	}
+
+private:
+	bool m_Active;
+};
+
+}
+
+#endif /* CONFIGPROFILER_H */
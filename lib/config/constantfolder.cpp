@@ -0,0 +1,273 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "config/constantfolder.hpp"
+#include "base/scriptframe.hpp"
+#include "base/scriptglobal.hpp"
+#include <algorithm>
+
+using namespace icinga;
+
+template<typename... T>
+static inline bool IsAnyOf(const Expression *expr)
+{
+	return (... || dynamic_cast<const T *>(expr));
+}
+
+ConstantFolder::ConstantFolder(std::set<String> locals, bool resolveGlobals)
+	: m_Locals(std::move(locals)), m_ResolveGlobals(resolveGlobals)
+{ }
+
+/**
+ * Folds an assign/ignore filter.
+ *
+ * @param filter The filter.
+ * @param locals All local variables the filter is evaluated with (closed variables, "host", ...).
+ * @param resolveGlobals Whether variables may be resolved to global constants, i.e. whether no further namespaces were imported.
+ */
+void ConstantFolder::FoldFilter(std::unique_ptr<Expression>& filter, std::set<String> locals, bool resolveGlobals)
+{
+	ConstantFolder folder (std::move(locals), resolveGlobals);
+	folder.Fold(filter);
+}
+
+/**
+ * Folds the body of an object, template or apply rule. Variables aren't resolved here as the local variables
+ * of a body also depend on the templates it imports.
+ *
+ * @param body The body.
+ */
+void ConstantFolder::FoldBody(std::unique_ptr<Expression>& body)
+{
+	ConstantFolder folder ({}, false);
+	folder.Fold(body);
+}
+
+void ConstantFolder::Fold(std::unique_ptr<Expression>& expr)
+{
+	Expression *raw = expr.get();
+
+	if (!raw || IsAnyOf<LiteralExpression, GetScopeExpression>(raw))
+		return;
+
+	if (auto var = dynamic_cast<VariableExpression *>(raw)) {
+		Value value;
+
+		if (ResolveGlobal(*var, &value))
+			expr = MakeLiteral(value);
+
+		return;
+	}
+
+	if (IsAnyOf<NegateExpression, LogicalNegateExpression>(raw)) {
+		auto& operand (static_cast<UnaryExpression *>(raw)->m_Operand);
+
+		Fold(operand);
+
+		if (IsLiteral(operand))
+			Evaluate(expr);
+
+		return;
+	}
+
+	if (IsAnyOf<LogicalAndExpression, LogicalOrExpression>(raw)) {
+		FoldLogical(expr, dynamic_cast<LogicalOrExpression *>(raw));
+		return;
+	}
+
+	if (IsAnyOf<AddExpression, SubtractExpression, MultiplyExpression, DivideExpression, ModuloExpression,
+		XorExpression, BinaryAndExpression, BinaryOrExpression, ShiftLeftExpression, ShiftRightExpression,
+		EqualExpression, NotEqualExpression, LessThanExpression, GreaterThanExpression,
+		LessThanOrEqualExpression, GreaterThanOrEqualExpression, InExpression, NotInExpression>(raw)) {
+		auto binary (static_cast<BinaryExpression *>(raw));
+
+		Fold(binary->m_Operand1);
+		Fold(binary->m_Operand2);
+
+		if (IsLiteral(binary->m_Operand1) && IsLiteral(binary->m_Operand2))
+			Evaluate(expr);
+
+		return;
+	}
+
+	if (dynamic_cast<IndexerExpression *>(raw)) {
+		auto binary (static_cast<BinaryExpression *>(raw));
+
+		Fold(binary->m_Operand1);
+		Fold(binary->m_Operand2);
+		return;
+	}
+
+	if (dynamic_cast<SetExpression *>(raw)) {
+		auto binary (static_cast<BinaryExpression *>(raw));
+
+		/* The target isn't folded, it's a reference. */
+		AddAssignedName(binary->m_Operand1.get());
+		Fold(binary->m_Operand2);
+		return;
+	}
+
+	if (dynamic_cast<ConditionalExpression *>(raw)) {
+		FoldConditional(expr);
+		return;
+	}
+
+	if (auto dict = dynamic_cast<DictExpression *>(raw)) {
+		FoldDict(*dict);
+		return;
+	}
+
+	if (auto array = dynamic_cast<ArrayExpression *>(raw)) {
+		for (auto& element : array->m_Expressions)
+			Fold(element);
+
+		return;
+	}
+
+	if (auto call = dynamic_cast<FunctionCallExpression *>(raw)) {
+		/* The function is looked up by reference, so only the arguments are folded. */
+		for (auto& arg : call->m_Args)
+			Fold(arg);
+
+		return;
+	}
+
+	/* Everything else (loops, imports, functions, ...) isn't looked into. As these
+	 * may set local variables, globals aren't resolved from now on. */
+	m_ResolveGlobals = false;
+}
+
+/**
+ * Reduces x && y and x || y with a literal x to the operand they evaluate to.
+ */
+void ConstantFolder::FoldLogical(std::unique_ptr<Expression>& expr, bool isOr)
+{
+	auto binary (static_cast<BinaryExpression *>(expr.get()));
+
+	Fold(binary->m_Operand1);
+
+	if (!IsLiteral(binary->m_Operand1)) {
+		Fold(binary->m_Operand2);
+		return;
+	}
+
+	/* false && y and true || y evaluate to their left operand, true && y and false || y to y. */
+	bool operand1 = static_cast<LiteralExpression *>(binary->m_Operand1.get())->GetValue().ToBool();
+	std::unique_ptr<Expression> result (std::move(operand1 == isOr ? binary->m_Operand1 : binary->m_Operand2));
+
+	expr = std::move(result);
+
+	if (operand1 != isOr)
+		Fold(expr);
+}
+
+/**
+ * Replaces if/else and ?: with a literal condition by the branch it evaluates.
+ */
+void ConstantFolder::FoldConditional(std::unique_ptr<Expression>& expr)
+{
+	auto conditional (static_cast<ConditionalExpression *>(expr.get()));
+
+	Fold(conditional->m_Condition);
+
+	if (!IsLiteral(conditional->m_Condition)) {
+		Fold(conditional->m_TrueBranch);
+		Fold(conditional->m_FalseBranch);
+		return;
+	}
+
+	bool condition = static_cast<LiteralExpression *>(conditional->m_Condition.get())->GetValue().ToBool();
+	std::unique_ptr<Expression> branch (std::move(condition ? conditional->m_TrueBranch : conditional->m_FalseBranch));
+
+	if (branch) {
+		expr = std::move(branch);
+		Fold(expr);
+	} else {
+		expr = MakeLiteral();
+	}
+}
+
+void ConstantFolder::FoldDict(DictExpression& dict)
+{
+	auto& statements (dict.m_Expressions);
+
+	for (auto& statement : statements)
+		Fold(statement);
+
+	if (statements.empty())
+		return;
+
+	/* Literals have no effect, unless they're the result of the block. */
+	statements.erase(std::remove_if(statements.begin(), statements.end() - 1, &ConstantFolder::IsLiteral), statements.end() - 1);
+}
+
+/**
+ * Remembers the name of a variable which is assigned, it must not be resolved to a global constant anymore.
+ */
+void ConstantFolder::AddAssignedName(const Expression *target)
+{
+	if (auto var = dynamic_cast<const VariableExpression *>(target)) {
+		m_Locals.insert(var->m_Variable);
+		return;
+	}
+
+	auto indexer (dynamic_cast<const IndexerExpression *>(target));
+
+	if (!indexer || !dynamic_cast<const GetScopeExpression *>(indexer->GetOperand1().get()))
+		return;
+
+	auto index (dynamic_cast<const LiteralExpression *>(indexer->GetOperand2().get()));
+
+	if (index)
+		m_Locals.insert(static_cast<String>(index->GetValue()));
+	else
+		m_ResolveGlobals = false;
+}
+
+/**
+ * Looks up a variable the same way VariableExpression does, but only succeeds for constants of the
+ * global scope which can't be shadowed by a local variable or by an imported namespace.
+ */
+bool ConstantFolder::ResolveGlobal(const VariableExpression& var, Value *value) const
+{
+	if (!m_ResolveGlobals || m_Locals.find(var.m_Variable) != m_Locals.end())
+		return false;
+
+	try {
+		ScriptFrame frame (false);
+
+		for (auto& import : var.m_Imports) {
+			Object::Ptr obj = import->DoEvaluate(frame, nullptr).GetValue();
+
+			if (obj->HasOwnField(var.m_Variable))
+				return false;
+		}
+	} catch (const std::exception&) {
+		return false;
+	}
+
+	return ScriptGlobal::GetGlobals()->GetConst(var.m_Variable, value) && !value->IsObject();
+}
+
+bool ConstantFolder::IsLiteral(const std::unique_ptr<Expression>& expr)
+{
+	return dynamic_cast<LiteralExpression *>(expr.get());
+}
+
+/**
+ * Replaces an expression with literal operands by its result.
+ */
+void ConstantFolder::Evaluate(std::unique_ptr<Expression>& expr)
+{
+	Value value;
+
+	try {
+		ScriptFrame frame (false);
+		value = expr->DoEvaluate(frame, nullptr).GetValue();
+	} catch (const std::exception&) {
+		/* Keep the expression, it raises the error with its debug info if it's actually evaluated. */
+		return;
+	}
+
+	if (!value.IsObject())
+		expr = MakeLiteral(value);
+}
@@ -0,0 +1,53 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef CONSTANTFOLDER_H
+#define CONSTANTFOLDER_H
+
+#include "config/i2-config.hpp"
+#include "config/expression.hpp"
+#include <memory>
+#include <set>
+
+namespace icinga
+{
+
+/**
+ * Simplifies freshly parsed expression trees: operators whose operands are all literals are
+ * replaced by their result, && and || with a literal left operand and if/else with a literal
+ * condition are reduced to the branch which would be evaluated.
+ *
+ * Filters (assign/ignore where) are evaluated in a frame whose local variables are known in
+ * advance, so variables referring to constants of the global scope are resolved as well.
+ *
+ * Only results which aren't objects are folded, i.e. arrays and dictionaries are still built
+ * for every evaluation as they could be modified later. Expressions which fail are kept, so
+ * the error is raised when (and if) they're evaluated.
+ *
+ * @ingroup config
+ */
+class ConstantFolder
+{
+public:
+	static void FoldFilter(std::unique_ptr<Expression>& filter, std::set<String> locals, bool resolveGlobals = true);
+	static void FoldBody(std::unique_ptr<Expression>& body);
+
+private:
+	std::set<String> m_Locals;
+	bool m_ResolveGlobals;
+
+	ConstantFolder(std::set<String> locals, bool resolveGlobals);
+
+	void Fold(std::unique_ptr<Expression>& expr);
+	void FoldLogical(std::unique_ptr<Expression>& expr, bool isOr);
+	void FoldConditional(std::unique_ptr<Expression>& expr);
+	void FoldDict(DictExpression& dict);
+	void AddAssignedName(const Expression *target);
+	bool ResolveGlobal(const VariableExpression& var, Value *value) const;
+
+	static bool IsLiteral(const std::unique_ptr<Expression>& expr);
+	static void Evaluate(std::unique_ptr<Expression>& expr);
+};
+
+}
+
+#endif /* CONSTANTFOLDER_H */
@@ -4,6 +4,8 @@
 #include "config/configitem.hpp"
 #include "config/configcompiler.hpp"
 #include "config/vmops.hpp"
+#include "config/bytecode.hpp"
+#include "config/configprofiler.hpp"
 #include "base/array.hpp"
 #include "base/json.hpp"
 #include "base/object.hpp"
@@ -214,7 +216,17 @@ ExpressionResult AddExpression::DoEvaluate(ScriptFrame& frame, DebugHint *dhint)
 	ExpressionResult operand2 = m_Operand2->Evaluate(frame);
 	CHECK_RESULT(operand2);
 
-	return operand1.GetValue() + operand2.GetValue();
+	auto& left (operand1.GetValue());
+	auto& right (operand2.GetValue());
+
+	/* The left side is our own copy, so a chain like a + b + c (i.e. (a + b) + c)
+	 * appends to one string instead of copying each intermediate result once more. */
+	if (left.IsString() && right.IsString()) {
+		left.AppendString(right.Get<String>());
+		return std::move(left);
+	}
+
+	return left + right;
 }
 
 ExpressionResult SubtractExpression::DoEvaluate(ScriptFrame& frame, DebugHint *dhint) const
@@ -619,8 +631,13 @@ ExpressionResult SetExpression::DoEvaluate(ScriptFrame& frame, DebugHint *dhint)
 	ExpressionResult operand2 = m_Operand2->Evaluate(frame, dhint);
 	CHECK_RESULT(operand2);
 
+	auto indexer (dynamic_cast<IndexerExpression *>(m_Operand1.get()));
+	FieldIdCache *cache = indexer ? indexer->GetFieldIdCache() : nullptr;
+
 	if (m_Op != OpSetLiteral) {
-		Value object = VMOps::GetField(parent, index, frame.Sandboxed, m_DebugInfo);
+		Value object = cache
+			? VMOps::GetField(parent, index, *cache, frame.Sandboxed, m_DebugInfo)
+			: VMOps::GetField(parent, index, frame.Sandboxed, m_DebugInfo);
 
 		switch (m_Op) {
 			case OpSetAdd:
@@ -652,7 +669,10 @@ ExpressionResult SetExpression::DoEvaluate(ScriptFrame& frame, DebugHint *dhint)
 		}
 	}
 
-	VMOps::SetField(parent, index, operand2.GetValue(), m_OverrideFrozen, m_DebugInfo);
+	if (cache)
+		VMOps::SetField(parent, index, operand2.GetValue(), m_OverrideFrozen, *cache, m_DebugInfo);
+	else
+		VMOps::SetField(parent, index, operand2.GetValue(), m_OverrideFrozen, m_DebugInfo);
 
 	if (psdhint) {
 		psdhint->AddMessage("=", m_DebugInfo);
@@ -734,6 +754,14 @@ ExpressionResult ContinueExpression::DoEvaluate(ScriptFrame& frame, DebugHint *d
 	return ExpressionResult(Empty, ResultContinue);
 }
 
+IndexerExpression::IndexerExpression(std::unique_ptr<Expression> operand1, std::unique_ptr<Expression> operand2, const DebugInfo& debugInfo)
+	: BinaryExpression(std::move(operand1), std::move(operand2), debugInfo)
+{
+	auto lexpr = dynamic_cast<LiteralExpression *>(m_Operand2.get());
+
+	m_ConstantIndex = lexpr && lexpr->GetValue().IsString();
+}
+
 ExpressionResult IndexerExpression::DoEvaluate(ScriptFrame& frame, DebugHint *dhint) const
 {
 	ExpressionResult operand1 = m_Operand1->Evaluate(frame, dhint);
@@ -742,6 +770,9 @@ ExpressionResult IndexerExpression::DoEvaluate(ScriptFrame& frame, DebugHint *dh
 	ExpressionResult operand2 = m_Operand2->Evaluate(frame, dhint);
 	CHECK_RESULT(operand2);
 
+	if (m_ConstantIndex)
+		return VMOps::GetField(operand1.GetValue(), operand2.GetValue(), m_FieldIdCache, frame.Sandboxed, m_DebugInfo);
+
 	return VMOps::GetField(operand1.GetValue(), operand2.GetValue(), frame.Sandboxed, m_DebugInfo);
 }
 
@@ -759,6 +790,10 @@ bool IndexerExpression::GetReference(ScriptFrame& frame, bool init_dict, Value *
 		init_dict = false;
 
 	if (m_Operand1->GetReference(frame, init_dict, &vparent, &vindex, &psdhint)) {
+		/* vindex is the index of m_Operand1, e.g. "vars" for vars.x = ... */
+		auto indexer (dynamic_cast<IndexerExpression *>(m_Operand1.get()));
+		FieldIdCache *cache = indexer ? indexer->GetFieldIdCache() : nullptr;
+
 		if (init_dict) {
 			Value old_value;
 			bool has_field = true;
@@ -768,14 +803,19 @@ bool IndexerExpression::GetReference(ScriptFrame& frame, bool init_dict, Value *
 				has_field = oparent->HasOwnField(vindex);
 			}
 
-			if (has_field)
-				old_value = VMOps::GetField(vparent, vindex, frame.Sandboxed, m_Operand1->GetDebugInfo());
+			if (has_field) {
+				old_value = cache
+					? VMOps::GetField(vparent, vindex, *cache, frame.Sandboxed, m_Operand1->GetDebugInfo())
+					: VMOps::GetField(vparent, vindex, frame.Sandboxed, m_Operand1->GetDebugInfo());
+			}
 
 			if (old_value.IsEmpty() && !old_value.IsString())
 				VMOps::SetField(vparent, vindex, new Dictionary(), m_OverrideFrozen, m_Operand1->GetDebugInfo());
 		}
 
-		*parent = VMOps::GetField(vparent, vindex, frame.Sandboxed, m_DebugInfo);
+		*parent = cache
+			? VMOps::GetField(vparent, vindex, *cache, frame.Sandboxed, m_DebugInfo)
+			: VMOps::GetField(vparent, vindex, frame.Sandboxed, m_DebugInfo);
 		free_psd = true;
 	} else {
 		ExpressionResult operand1 = m_Operand1->Evaluate(frame);
@@ -870,6 +910,10 @@ ExpressionResult ImportExpression::DoEvaluate(ScriptFrame& frame, DebugHint *dhi
 	if (!item)
 		BOOST_THROW_EXCEPTION(ScriptError("Import references unknown template: '" + name + "'", m_DebugInfo));
 
+	ConfigProfilerScope profile ("import", [&type, &name, &item]() {
+		return ConfigProfiler::GetDefinitionName(type, name, item->GetDebugInfo());
+	});
+
 	Dictionary::Ptr scope = item->GetScope();
 
 	if (scope)
@@ -902,9 +946,15 @@ ExpressionResult ImportDefaultTemplatesExpression::DoEvaluate(ScriptFrame& frame
 	return Empty;
 }
 
+FunctionExpression::FunctionExpression(String name, std::vector<String> args,
+	std::map<String, std::unique_ptr<Expression> >&& closedVars, std::unique_ptr<Expression> expression, const DebugInfo& debugInfo)
+	: DebuggableExpression(debugInfo), m_Name(std::move(name)), m_Args(std::move(args)), m_ClosedVars(std::move(closedVars)),
+	m_Expression(new BytecodeExpression(expression.release()))
+{ }
+
 ExpressionResult FunctionExpression::DoEvaluate(ScriptFrame& frame, DebugHint *dhint) const
 {
-	return VMOps::NewFunction(frame, m_Name, m_Args, m_ClosedVars, m_Expression);
+	return VMOps::NewFunction(frame, m_Name, m_Args, m_ClosedVars, m_Expression, m_DebugInfo);
 }
 
 ExpressionResult ApplyExpression::DoEvaluate(ScriptFrame& frame, DebugHint *dhint) const
@@ -12,6 +12,7 @@
 #include "base/scriptframe.hpp"
 #include "base/shared-object.hpp"
 #include "base/convert.hpp"
+#include <atomic>
 #include <map>
 
 namespace icinga
@@ -120,6 +121,9 @@ enum ScopeSpecifier
 
 typedef std::map<String, String> DefinitionMap;
 
+class BytecodeCompiler;
+class ConstantFolder;
+
 /**
  * @ingroup config
  */
@@ -152,6 +156,11 @@ public:
 		return m_Value;
 	}
 
+	Value& GetValue()
+	{
+		return m_Value;
+	}
+
 	ExpressionResultCode GetCode() const
 	{
 		return m_Code;
@@ -235,6 +244,11 @@ public:
 		return m_Value;
 	}
 
+	Value& GetValue()
+	{
+		return m_Value;
+	}
+
 protected:
 	ExpressionResult DoEvaluate(ScriptFrame& frame, DebugHint *dhint) const override;
 
@@ -274,6 +288,9 @@ public:
 
 protected:
 	std::unique_ptr<Expression> m_Operand;
+
+	friend class BytecodeCompiler;
+	friend class ConstantFolder;
 };
 
 class BinaryExpression : public DebuggableExpression
@@ -296,6 +313,7 @@ public:
 protected:
 	std::unique_ptr<Expression> m_Operand1;
 	std::unique_ptr<Expression> m_Operand2;
+	friend class ConstantFolder;
 };
 
 class VariableExpression final : public DebuggableExpression
@@ -316,7 +334,7 @@ private:
 	String m_Variable;
 	std::vector<Expression::Ptr> m_Imports;
 
-	friend void BindToScope(std::unique_ptr<Expression>& expr, ScopeSpecifier scopeSpec);
+	friend void BindToScope(std::unique_ptr<Expression>& expr, ScopeSpecifier scopeSpec);	friend class ConstantFolder;
 };
 
 class DerefExpression final : public UnaryExpression
@@ -611,6 +629,9 @@ protected:
 
 private:
 	std::vector<std::unique_ptr<Expression> > m_Expressions;
+
+	friend class BytecodeCompiler;
+	friend class ConstantFolder;
 };
 
 class DictExpression final : public DebuggableExpression
@@ -635,6 +656,8 @@ private:
 	bool m_Inline{false};
 
 	friend void BindToScope(std::unique_ptr<Expression>& expr, ScopeSpecifier scopeSpec);
+	friend class BytecodeCompiler;
+	friend class ConstantFolder;
 };
 
 class SetConstExpression final : public UnaryExpression
@@ -683,6 +706,9 @@ private:
 	std::unique_ptr<Expression> m_Condition;
 	std::unique_ptr<Expression> m_TrueBranch;
 	std::unique_ptr<Expression> m_FalseBranch;
+
+	friend class BytecodeCompiler;
+	friend class ConstantFolder;
 };
 
 class WhileExpression final : public DebuggableExpression
@@ -746,24 +772,78 @@ protected:
 
 private:
 	ScopeSpecifier m_ScopeSpec;
+
+	friend class BytecodeCompiler;
+};
+
+/**
+ * Remembers which field ID a constant field name resolved to for the first type it
+ * was looked up on (-1 if it has to be resolved by name). Lookups on further objects
+ * of the same type can then skip Type#GetFieldId(). The cache is filled at most once
+ * and never changes afterwards, so it can be read without any locks.
+ *
+ * @ingroup config
+ */
+class FieldIdCache
+{
+public:
+	inline bool Get(const Type *type, int *fieldId, bool *noUserView) const
+	{
+		if (m_Type.load(std::memory_order_acquire) != type)
+			return false;
+
+		*fieldId = m_FieldId;
+		*noUserView = m_NoUserView;
+		return true;
+	}
+
+	inline bool IsFilled() const
+	{
+		return m_Filling.load(std::memory_order_relaxed);
+	}
+
+	inline void Set(const Type *type, int fieldId, bool noUserView)
+	{
+		if (m_Filling.exchange(true))
+			return;
+
+		m_FieldId = fieldId;
+		m_NoUserView = noUserView;
+		m_Type.store(type, std::memory_order_release);
+	}
+
+private:
+	std::atomic<const Type *> m_Type{nullptr};
+	std::atomic<bool> m_Filling{false};
+	int m_FieldId{-1};
+	bool m_NoUserView{false};
 };
 
 class IndexerExpression final : public BinaryExpression
 {
 public:
-	IndexerExpression(std::unique_ptr<Expression> operand1, std::unique_ptr<Expression> operand2, const DebugInfo& debugInfo = DebugInfo())
-		: BinaryExpression(std::move(operand1), std::move(operand2), debugInfo)
-	{ }
+	IndexerExpression(std::unique_ptr<Expression> operand1, std::unique_ptr<Expression> operand2, const DebugInfo& debugInfo = DebugInfo());
 
 	void SetOverrideFrozen();
 
+	/**
+	 * Retrieves the cache for the field name if it's constant, e.g. for assignments to this expression.
+	 */
+	inline FieldIdCache *GetFieldIdCache() const noexcept
+	{
+		return m_ConstantIndex ? &m_FieldIdCache : nullptr;
+	}
+
 protected:
 	bool m_OverrideFrozen{false};
+	bool m_ConstantIndex{false};
+	mutable FieldIdCache m_FieldIdCache;
 
 	ExpressionResult DoEvaluate(ScriptFrame& frame, DebugHint *dhint) const override;
 	bool GetReference(ScriptFrame& frame, bool init_dict, Value *parent, String *index, DebugHint **dhint) const override;
 
 	friend void BindToScope(std::unique_ptr<Expression>& expr, ScopeSpecifier scopeSpec);
+	friend class BytecodeCompiler;
 };
 
 void BindToScope(std::unique_ptr<Expression>& expr, ScopeSpecifier scopeSpec);
@@ -812,9 +892,7 @@ class FunctionExpression final : public DebuggableExpression
 {
 public:
 	FunctionExpression(String name, std::vector<String> args,
-		std::map<String, std::unique_ptr<Expression> >&& closedVars, std::unique_ptr<Expression> expression, const DebugInfo& debugInfo = DebugInfo())
-		: DebuggableExpression(debugInfo), m_Name(std::move(name)), m_Args(std::move(args)), m_ClosedVars(std::move(closedVars)), m_Expression(expression.release())
-	{ }
+		std::map<String, std::unique_ptr<Expression> >&& closedVars, std::unique_ptr<Expression> expression, const DebugInfo& debugInfo = DebugInfo());
 
 protected:
 	ExpressionResult DoEvaluate(ScriptFrame& frame, DebugHint *dhint) const override;
@@ -881,6 +959,16 @@ public:
 		m_IgnoreOnError(ignoreOnError), m_ClosedVars(std::move(closedVars)), m_Expression(expression.release())
 	{ }
 
+	inline bool IsAbstract() const noexcept
+	{
+		return m_Abstract;
+	}
+
+	inline const Expression::Ptr& GetFilter() const noexcept
+	{
+		return m_Filter;
+	}
+
 protected:
 	ExpressionResult DoEvaluate(ScriptFrame& frame, DebugHint *dhint) const override;
 
@@ -1,18 +1,228 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "config/objectrule.hpp"
+#include "config/applyrule.hpp"
+#include "config/bytecode.hpp"
+#include "config/configitem.hpp"
+#include "config/vmops.hpp"
+#include "base/array.hpp"
+#include "base/objectlock.hpp"
+#include <algorithm>
 #include <set>
 
 using namespace icinga;
 
-ObjectRule::TypeSet ObjectRule::m_Types;
+ObjectRule::TypeMap ObjectRule::m_Types;
+std::mutex ObjectRule::m_Mutex;
+std::unordered_map<Type*, ObjectRule::PerSourceType> ObjectRule::m_Rules;
 
-void ObjectRule::RegisterType(const String& sourceType)
+/**
+ * @param sourceType The group type, e.g. "HostGroup"
+ * @param memberType The type of the objects assign rules are evaluated for, e.g. "Host"
+ */
+void ObjectRule::RegisterType(const String& sourceType, const String& memberType)
 {
-	m_Types.insert(sourceType);
+	m_Types[sourceType] = memberType;
 }
 
 bool ObjectRule::IsValidSourceType(const String& sourceType)
 {
 	return m_Types.find(sourceType) != m_Types.end();
 }
+
+/**
+ * Makes GetCandidates() return the given group (with an assign rule) where applicable.
+ */
+void ObjectRule::AddRule(const ConfigItem::Ptr& item)
+{
+	UpdateRule(item, true);
+}
+
+void ObjectRule::RemoveRule(const ConfigItem::Ptr& item)
+{
+	UpdateRule(item, false);
+}
+
+template<class T>
+static void UpdateRuleSet(std::set<T>& rules, const T& rule, bool add)
+{
+	if (add) {
+		rules.emplace(rule);
+	} else {
+		rules.erase(rule);
+	}
+}
+
+/**
+ * Adds the given group to or removes it from the "index" the same way ApplyRule::AddTargetedRule() does.
+ * The analysis is repeated on removal, it always yields the same result for the same filter.
+ */
+void ObjectRule::UpdateRule(const ConfigItem::Ptr& item, bool add)
+{
+	auto memberType (m_Types.find(item->GetType()->GetName()));
+
+	if (memberType == m_Types.end()) {
+		return;
+	}
+
+	Expression::Ptr filter = item->GetFilter();
+	auto bytecode (dynamic_cast<BytecodeExpression*>(filter.get()));
+	Expression* source = bytecode ? bytecode->GetSource().get() : filter.get();
+
+	std::unique_lock<std::mutex> lock (m_Mutex);
+	auto& rules (m_Rules[item->GetType().get()]);
+
+	if (memberType->second == "Service") {
+		std::vector<std::pair<const String *, const String *>> services;
+
+		if (ApplyRule::GetTargetServices(source, services)) {
+			for (auto& service : services) {
+				UpdateRuleSet(rules.TargetedServices[*service.first][*service.second], item, add);
+			}
+
+			return;
+		}
+
+		std::vector<const String *> names;
+
+		if (ApplyRule::GetTargetObjects(source, "service", names)) {
+			for (auto name : names) {
+				UpdateRuleSet(rules.TargetedServiceNames[*name], item, add);
+			}
+
+			return;
+		}
+	}
+
+	if (memberType->second == "Host" || memberType->second == "Service" || memberType->second == "User") {
+		std::vector<const String *> names;
+
+		if (ApplyRule::GetTargetObjects(source, memberType->second == "User" ? "user" : "host", names)) {
+			for (auto name : names) {
+				UpdateRuleSet(rules.Targeted[*name], item, add);
+			}
+
+			return;
+		}
+	}
+
+	if (memberType->second == "Host" || memberType->second == "Service") {
+		std::vector<ApplyRule::HostVarPredicate> predicates;
+
+		if (ApplyRule::GetTargetHostVars(source, predicates)) {
+			for (auto& predicate : predicates) {
+				auto& perVar (rules.TargetedByHostVar[*predicate.Var]);
+
+				if (predicate.In) {
+					UpdateRuleSet(perVar.In[*predicate.Value], item, add);
+					UpdateRuleSet(perVar.AllIn, item, add);
+				} else {
+					UpdateRuleSet(perVar.Equal[*predicate.Value], item, add);
+				}
+			}
+
+			return;
+		}
+	}
+
+	UpdateRuleSet(rules.Regular, item, add);
+}
+
+/**
+ * Returns all groups of the given type whose assign rule may match the given object.
+ * These still have to be evaluated, in the returned order (by name, like ConfigItem::GetItems()).
+ *
+ * @param sourceType The group type
+ * @param name The host or user name
+ * @param service The service name (if the members are services)
+ * @param host The host object (if the members are hosts or services)
+ */
+std::vector<ConfigItem::Ptr> ObjectRule::GetCandidates(const Type::Ptr& sourceType, const String& name,
+	const String& service, const Object::Ptr& host)
+{
+	std::set<ConfigItem::Ptr> candidates;
+
+	{
+		std::unique_lock<std::mutex> lock (m_Mutex);
+		auto perSourceType (m_Rules.find(sourceType.get()));
+
+		if (perSourceType == m_Rules.end()) {
+			return {};
+		}
+
+		auto& rules (perSourceType->second);
+
+		candidates.insert(rules.Regular.begin(), rules.Regular.end());
+
+		auto perName (rules.Targeted.find(name));
+
+		if (perName != rules.Targeted.end()) {
+			candidates.insert(perName->second.begin(), perName->second.end());
+		}
+
+		if (!service.IsEmpty()) {
+			auto perHost (rules.TargetedServices.find(name));
+
+			if (perHost != rules.TargetedServices.end()) {
+				auto perService (perHost->second.find(service));
+
+				if (perService != perHost->second.end()) {
+					candidates.insert(perService->second.begin(), perService->second.end());
+				}
+			}
+
+			auto perServiceName (rules.TargetedServiceNames.find(service));
+
+			if (perServiceName != rules.TargetedServiceNames.end()) {
+				candidates.insert(perServiceName->second.begin(), perServiceName->second.end());
+			}
+		}
+
+		if (host && !rules.TargetedByHostVar.empty()) {
+			/* The same lookups as the ones of host.vars.V, also see ApplyRule::GetTargetedHostVarRules() */
+			Value vars = VMOps::GetField(host, "vars");
+
+			for (auto& perVar : rules.TargetedByHostVar) {
+				Value value = VMOps::GetField(vars, perVar.first);
+
+				if (value.IsString()) {
+					auto perValue (perVar.second.Equal.find(value.Get<String>()));
+
+					if (perValue != perVar.second.Equal.end()) {
+						candidates.insert(perValue->second.begin(), perValue->second.end());
+					}
+				}
+
+				if (perVar.second.AllIn.empty()) {
+					continue;
+				}
+
+				if (value.IsObjectType<Array>()) {
+					Array::Ptr arr = value;
+					ObjectLock olock (arr);
+
+					for (auto& element : arr) {
+						if (element.IsString()) {
+							auto perElement (perVar.second.In.find(element.Get<String>()));
+
+							if (perElement != perVar.second.In.end()) {
+								candidates.insert(perElement->second.begin(), perElement->second.end());
+							}
+						}
+					}
+				} else if (!value.IsEmpty()) {
+					/* The 'in' operator fails for anything but arrays, let the rules report that. */
+					candidates.insert(perVar.second.AllIn.begin(), perVar.second.AllIn.end());
+				}
+			}
+		}
+	}
+
+	std::vector<ConfigItem::Ptr> result (candidates.begin(), candidates.end());
+
+	std::sort(result.begin(), result.end(), [](const ConfigItem::Ptr& a, const ConfigItem::Ptr& b) {
+		return a->GetName() < b->GetName();
+	});
+
+	return result;
+}
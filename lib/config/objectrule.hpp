@@ -6,26 +6,81 @@
 #include "config/i2-config.hpp"
 #include "config/expression.hpp"
 #include "base/debuginfo.hpp"
+#include "base/type.hpp"
+#include <map>
+#include <mutex>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
 namespace icinga
 {
 
+class ConfigItem;
+
 /**
+ * Group assign rules, i.e. objects like object HostGroup "x" { assign where ... }
+ *
  * @ingroup config
  */
 class ObjectRule
 {
 public:
-	typedef std::set<String> TypeSet;
+	typedef std::map<String /* source type */, String /* member type */> TypeMap;
 
-	static void RegisterType(const String& sourceType);
+	static void RegisterType(const String& sourceType, const String& memberType);
 	static bool IsValidSourceType(const String& sourceType);
 
+	static void AddRule(const intrusive_ptr<ConfigItem>& item);
+	static void RemoveRule(const intrusive_ptr<ConfigItem>& item);
+
+	static std::vector<intrusive_ptr<ConfigItem>> GetCandidates(const Type::Ptr& sourceType, const String& name,
+		const String& service = String(), const Object::Ptr& host = nullptr);
+
 private:
 	ObjectRule();
 
-	static TypeSet m_Types;
+	struct PerHostVar
+	{
+		std::unordered_map<String /* value */, std::set<intrusive_ptr<ConfigItem>>> Equal;
+		std::unordered_map<String /* element */, std::set<intrusive_ptr<ConfigItem>>> In;
+		std::set<intrusive_ptr<ConfigItem>> AllIn;
+	};
+
+	/*
+	 * m_Rules[HostGroup::TypeInstance.get()].Targeted["H"]
+	 * contains all groups which can only match specific hosts incl. "H",
+	 * e.g. via assign where host.name == "H" || host.name == "h".
+	 * The same goes for users and user.name and, for services,
+	 * for all services of the hosts.
+	 *
+	 * m_Rules[ServiceGroup::TypeInstance.get()].TargetedServices["H"]["S"]
+	 * contains all groups which can only match specific services,
+	 * e.g. via assign where host.name == "H" && service.name == "S".
+	 * ...TargetedServiceNames["S"] contains the ones which can only match
+	 * services named "S" on any host, e.g. via assign where service.name == "S".
+	 *
+	 * m_Rules[T::TypeInstance.get()].TargetedByHostVar["V"]
+	 * works like ApplyRule::PerSourceType#TargetedByHostVar.
+	 *
+	 * m_Rules[T::TypeInstance.get()].Regular
+	 * contains all other groups with an assign rule.
+	 */
+	struct PerSourceType
+	{
+		std::set<intrusive_ptr<ConfigItem>> Regular;
+		std::unordered_map<String /* host or user */, std::set<intrusive_ptr<ConfigItem>>> Targeted;
+		std::unordered_map<String /* host */, std::unordered_map<String /* service */, std::set<intrusive_ptr<ConfigItem>>>> TargetedServices;
+		std::unordered_map<String /* service */, std::set<intrusive_ptr<ConfigItem>>> TargetedServiceNames;
+		std::unordered_map<String /* custom var */, PerHostVar> TargetedByHostVar;
+	};
+
+	static TypeMap m_Types;
+
+	static std::mutex m_Mutex;
+	static std::unordered_map<Type* /* source type */, PerSourceType> m_Rules;
+
+	static void UpdateRule(const intrusive_ptr<ConfigItem>& item, bool add);
 };
 
 }
@@ -17,7 +17,9 @@
 #include "base/exception.hpp"
 #include "base/convert.hpp"
 #include "base/objectlock.hpp"
+#include <boost/lexical_cast.hpp>
 #include <map>
+#include <typeinfo>
 #include <vector>
 
 namespace icinga
@@ -91,7 +93,7 @@ public:
 	}
 
 	static inline Value NewFunction(ScriptFrame& frame, const String& name, const std::vector<String>& argNames,
-		const std::map<String, std::unique_ptr<Expression> >& closedVars, const Expression::Ptr& expression)
+		const std::map<String, std::unique_ptr<Expression> >& closedVars, const Expression::Ptr& expression, const DebugInfo& debugInfo = DebugInfo())
 	{
 		auto evaluatedClosedVars = EvaluateClosedVars(frame, closedVars);
 
@@ -112,7 +114,9 @@ public:
 			return expression->Evaluate(*frame);
 		};
 
-		return new Function(name, wrapper, argNames);
+		Function::Ptr func = new Function(name, wrapper, argNames);
+		func->SetDebugInfo(debugInfo);
+		return func;
 	}
 
 	static inline Value NewApply(ScriptFrame& frame, const String& type, const String& target, const String& name, const Expression::Ptr& filter,
@@ -246,6 +250,24 @@ public:
 		return object->GetFieldByName(field, sandboxed, debugInfo);
 	}
 
+	/**
+	 * Like GetField(), but resolves (constant) field names of objects via the given cache.
+	 */
+	static inline Value GetField(const Value& context, const String& field, FieldIdCache& cache, bool sandboxed = false, const DebugInfo& debugInfo = DebugInfo())
+	{
+		if (BOOST_UNLIKELY(!context.IsObject()))
+			return GetField(context, field, sandboxed, debugInfo);
+
+		const Object::Ptr& object = context.Get<Object::Ptr>();
+		int fid;
+		bool noUserView;
+
+		if (GetCachedFieldId(object, field, cache, &fid, &noUserView) && (!sandboxed || !noUserView))
+			return object->GetField(fid);
+
+		return object->GetFieldByName(field, sandboxed, debugInfo);
+	}
+
 	static inline void SetField(const Object::Ptr& context, const String& field, const Value& value, bool overrideFrozen, const DebugInfo& debugInfo = DebugInfo())
 	{
 		if (!context)
@@ -254,7 +276,59 @@ public:
 		return context->SetFieldByName(field, value, overrideFrozen, debugInfo);
 	}
 
+	/**
+	 * Like SetField(), but resolves (constant) field names of objects via the given cache.
+	 */
+	static inline void SetField(const Object::Ptr& context, const String& field, const Value& value, bool overrideFrozen, FieldIdCache& cache, const DebugInfo& debugInfo = DebugInfo())
+	{
+		int fid;
+		bool noUserView;
+
+		if (context && GetCachedFieldId(context, field, cache, &fid, &noUserView)) {
+			try {
+				context->SetField(fid, value);
+				return;
+			} catch (const boost::bad_lexical_cast&) {
+				/* SetFieldByName() reports the error with the attribute's name and type. */
+			} catch (const std::bad_cast&) {
+			}
+		}
+
+		SetField(context, field, value, overrideFrozen, debugInfo);
+	}
+
 private:
+	/**
+	 * Retrieves the field ID of a constant field name from the cache, fills the cache if it's empty.
+	 *
+	 * @returns Whether the field can be accessed by the ID, otherwise it has to be accessed by name.
+	 */
+	static inline bool GetCachedFieldId(const Object::Ptr& object, const String& field, FieldIdCache& cache, int *fid, bool *noUserView)
+	{
+		Type::Ptr type = object->GetReflectionType();
+
+		if (BOOST_UNLIKELY(!type))
+			return false;
+
+		if (cache.Get(type.get(), fid, noUserView))
+			return *fid != -1;
+
+		if (cache.IsFilled())
+			return false;
+
+		/* These types resolve (some) names on their own, see their GetFieldByName() and SetFieldByName(). */
+		if (dynamic_cast<Dictionary *>(object.get()) || dynamic_cast<Array *>(object.get()) || dynamic_cast<Namespace *>(object.get())) {
+			cache.Set(type.get(), -1, false);
+			return false;
+		}
+
+		*fid = type->GetFieldId(field);
+		*noUserView = *fid != -1 && (type->GetFieldInfo(*fid).Attributes & FANoUserView);
+		cache.Set(type.get(), *fid, *noUserView);
+
+		return *fid != -1;
+	}
+
 	static inline Dictionary::Ptr EvaluateClosedVars(ScriptFrame& frame, const std::map<String, std::unique_ptr<Expression> >& closedVars)
 	{
 		if (closedVars.empty())
@@ -7,11 +7,16 @@
 #include "icinga/host.hpp"
 #include "icinga/service.hpp"
 #include "base/configtype.hpp"
+#include "base/configuration.hpp"
 #include "base/convert.hpp"
 #include "base/objectlock.hpp"
 #include "base/utility.hpp"
 #include "base/logger.hpp"
+#include "base/startupscheduler.hpp"
 #include "base/exception.hpp"
+#include "base/workqueue.hpp"
+#include <iomanip>
+#include <numeric>
 
 using namespace icinga;
 
@@ -287,10 +292,11 @@ void DbConnection::LogStatsHandler()
 	}
 
 	auto input = round(m_InputQueries.CalculateRate(now, 10));
+	auto merged = round(m_MergedQueries.CalculateRate(now, 10));
 
 	Log(LogInformation, GetReflectionType()->GetName())
 		<< "Pending queries: " << pending << " (Input: " << input
-		<< "/s; Output: " << output << "/s)";
+		<< "/s; Output: " << output << "/s; Merged: " << merged << "/s)";
 
 	/* Reschedule next log entry in 5 minutes. */
 	if (timeoutReached) {
@@ -303,6 +309,108 @@ void DbConnection::CleanUpExecuteQuery(const String&, const String&, double)
 	/* Default handler does nothing. */
 }
 
+/* Deleting all old rows of a big table at once may take minutes. Meanwhile everything else would wait. */
+const int DbConnection::CleanUpChunkSize = 10000;
+
+/**
+ * Starts the cleanup of the given table which deletes up to CleanUpChunkSize rows per query.
+ * The implementations enqueue the next query with PriorityLow as long as the last one deleted that many,
+ * so that the other queries in between don't wait for the whole cleanup.
+ *
+ * @returns The ID of the run or 0 if the previous one for the table is still in progress.
+ */
+uint_fast64_t DbConnection::BeginCleanUp(const String& table)
+{
+	ASSERT(m_QueryQueue.IsWorkerThread());
+
+	auto& run (m_CleanUpRuns[table]);
+
+	if (run.Id) {
+		Log(LogNotice, GetReflectionType()->GetName())
+			<< "Cleanup (" << table << "): Still in progress since " << std::fixed << std::setprecision(0)
+			<< Utility::GetTime() - run.Start << "s (" << run.Deleted << " rows deleted so far).";
+
+		return 0;
+	}
+
+	run = { ++m_LastCleanUpRun, Utility::GetTime(), 0, 0 };
+	m_CleanUpsInProgress.fetch_add(1);
+
+	return run.Id;
+}
+
+/**
+ * Records the rows deleted by the last cleanup query of the given table's run.
+ *
+ * @returns Whether the next query should be enqueued as there may be more rows to delete.
+ */
+bool DbConnection::CleanUpProgressed(const String& table, uint_fast64_t run, int deleted)
+{
+	ASSERT(m_QueryQueue.IsWorkerThread());
+
+	auto it (m_CleanUpRuns.find(table));
+
+	if (it == m_CleanUpRuns.end() || it->second.Id != run)
+		return false;
+
+	auto& progress (it->second);
+
+	if (deleted > 0) {
+		progress.Deleted += deleted;
+		m_CleanUpDeletedRows.fetch_add(deleted);
+	}
+
+	progress.Queries++;
+
+	if (deleted >= CleanUpChunkSize)
+		return true;
+
+	Log(LogNotice, GetReflectionType()->GetName())
+		<< "Cleanup (" << table << "): Deleted " << progress.Deleted << " rows with " << progress.Queries
+		<< " queries in " << std::fixed << std::setprecision(2) << Utility::GetTime() - progress.Start << "s.";
+
+	m_CleanUpRuns.erase(it);
+	m_CleanUpsInProgress.fetch_sub(1);
+
+	return false;
+}
+
+/**
+ * Ends the given table's cleanup run early, e.g. as the connection got lost.
+ */
+void DbConnection::AbortCleanUp(const String& table, uint_fast64_t run)
+{
+	ASSERT(m_QueryQueue.IsWorkerThread());
+
+	auto it (m_CleanUpRuns.find(table));
+
+	if (it != m_CleanUpRuns.end() && it->second.Id == run) {
+		m_CleanUpRuns.erase(it);
+		m_CleanUpsInProgress.fetch_sub(1);
+	}
+}
+
+/**
+ * Forgets all cleanup runs after a reconnect, the result of their last query got lost in case of doubt.
+ */
+void DbConnection::ResetCleanUps()
+{
+	ASSERT(m_QueryQueue.IsWorkerThread());
+
+	m_CleanUpRuns.clear();
+	m_CleanUpsInProgress.store(0);
+}
+
+uint_fast64_t DbConnection::GetCleanUpDeletedRows() const
+{
+	return m_CleanUpDeletedRows.load();
+}
+
+size_t DbConnection::GetCleanUpsInProgress() const
+{
+	return m_CleanUpsInProgress.load();
+}
+
 void DbConnection::SetConfigHash(const DbObject::Ptr& dbobj, const String& hash)
 {
 	SetConfigHash(dbobj->GetType(), GetObjectID(dbobj), hash);
@@ -440,7 +548,12 @@ bool DbConnection::GetStatusUpdate(const DbObject::Ptr& dbobj) const
 	return (m_StatusUpdates.find(dbobj) != m_StatusUpdates.end());
 }
 
-void DbConnection::UpdateObject(const ConfigObject::Ptr& object)
+/**
+ * Write an object's config (if changed) and status or mark it as deleted.
+ *
+ * @param configFields The object's config fields incl. config_hash if already known, nullptr otherwise
+ */
+void DbConnection::UpdateObject(const ConfigObject::Ptr& object, Dictionary::Ptr configFields)
 {
 	bool isShuttingDown = Application::IsShuttingDown();
 	bool isRestarting = Application::IsRestarting();
@@ -474,10 +587,13 @@ void DbConnection::UpdateObject(const ConfigObject::Ptr& object)
 			if (!dbActive)
 				ActivateObject(dbobj);
 
-			Dictionary::Ptr configFields = dbobj->GetConfigFields();
-			String configHash = dbobj->CalculateConfigHash(configFields);
+			if (!configFields) {
+				configFields = dbobj->GetConfigFields();
+				configFields->Set("config_hash", dbobj->CalculateConfigHash(configFields));
+			}
+
+			String configHash = configFields->Get("config_hash");
 			ASSERT(configHash.GetLength() <= 64);
-			configFields->Set("config_hash", configHash);
 
 			String cachedHash = GetConfigHash(dbobj);
 
@@ -501,6 +617,10 @@ void DbConnection::UpdateObject(const ConfigObject::Ptr& object)
 
 void DbConnection::UpdateAllObjects()
 {
+	StartupScheduler::Slot startupSlot ({ "ido", 10, 1, "ido dumped" });
+
+	std::vector<ConfigObject::Ptr> objects;
+
 	for (const Type::Ptr& type : Type::GetAllTypes()) {
 		auto *dtype = dynamic_cast<ConfigType *>(type.get());
 
@@ -508,9 +628,101 @@ void DbConnection::UpdateAllObjects()
 			continue;
 
 		for (const ConfigObject::Ptr& object : dtype->GetObjects()) {
-			m_QueryQueue.Enqueue([this, object](){ UpdateObject(object); }, PriorityHigh);
+			objects.emplace_back(object);
 		}
 	}
+
+	double start = Utility::GetTime();
+
+	m_ConfigDumpObjects.store(objects.size());
+	m_ConfigDumpedObjects.store(0);
+	m_ConfigDumpStart.store(start);
+	m_ConfigDumpEnd.store(0);
+
+	/* Building the config rows is the expensive part: do it in parallel, but write them in order as usual. */
+	std::vector<Dictionary::Ptr> configFields (objects.size());
+	std::vector<size_t> indices (objects.size());
+	std::iota(indices.begin(), indices.end(), 0);
+
+	WorkQueue upq (25000, Configuration::Concurrency, LogNotice);
+	upq.SetName("DbConnection:ConfigDump");
+
+	upq.ParallelFor(indices, [&objects, &configFields](size_t i) {
+		DbObject::Ptr dbobj = DbObject::GetOrCreateByObject(objects[i]);
+
+		if (dbobj && objects[i]->IsActive()) {
+			Dictionary::Ptr fields = dbobj->GetConfigFields();
+			fields->Set("config_hash", dbobj->CalculateConfigHash(fields));
+			configFields[i] = std::move(fields);
+		}
+	});
+
+	upq.Join();
+
+	Log(LogInformation, GetReflectionType()->GetName())
+		<< "Built the config of " << objects.size() << " objects in "
+		<< std::fixed << std::setprecision(3) << Utility::GetTime() - start << " seconds, writing it.";
+
+	for (size_t i = 0; i < objects.size(); i++) {
+		auto& object (objects[i]);
+		auto& fields (configFields[i]);
+
+		m_QueryQueue.Enqueue([this, object, fields]() {
+			UpdateObject(object, fields);
+			ConfigDumpProgressed();
+		}, PriorityHigh);
+	}
+}
+
+/**
+ * Count an object of the initial config dump as done and log the progress now and then.
+ */
+void DbConnection::ConfigDumpProgressed()
+{
+	size_t done = ++m_ConfigDumpedObjects;
+	size_t total = m_ConfigDumpObjects.load();
+	double now = Utility::GetTime();
+
+	if (done == total) {
+		m_ConfigDumpEnd.store(now);
+
+		Log(LogInformation, GetReflectionType()->GetName())
+			<< "Finished the config dump of " << total << " objects in " << std::fixed << std::setprecision(3)
+			<< now - m_ConfigDumpStart.load() << " seconds (" << std::setprecision(0) << GetConfigDumpRate() << " objects/s).";
+	} else if (done % 10000u == 0u) {
+		Log(LogInformation, GetReflectionType()->GetName())
+			<< "Config dump: " << done << " of " << total << " objects written ("
+			<< std::fixed << std::setprecision(0) << GetConfigDumpRate() << " objects/s).";
+	}
+}
+
+/**
+ * @return How much of the (last) config dump has been done in percent
+ */
+double DbConnection::GetConfigDumpProgress() const
+{
+	size_t total = m_ConfigDumpObjects.load();
+
+	if (!total)
+		return 100;
+
+	return 100.0 * m_ConfigDumpedObjects.load() / total;
+}
+
+/**
+ * @return Objects written per second by the (last) config dump
+ */
+double DbConnection::GetConfigDumpRate() const
+{
+	double start = m_ConfigDumpStart.load();
+
+	if (!start)
+		return 0;
+
+	double end = m_ConfigDumpEnd.load();
+	double duration = (end ? end : Utility::GetTime()) - start;
+
+	return duration > 0 ? m_ConfigDumpedObjects.load() / duration : 0;
 }
 
 void DbConnection::PrepareDatabase()
@@ -581,3 +793,80 @@ void DbConnection::DecreasePendingQueries(int count)
 	m_PendingQueries.fetch_sub(count);
 	m_OutputQueries.InsertValue(Utility::GetTime(), count);
 }
+
+/**
+ * Queue a query unless it's a status update of an object which already has one queued for the same table.
+ * In the latter case the queued one is updated with the new values instead,
+ * so that a falling behind database gets only the latest state of every object.
+ *
+ * @param query The query to be executed
+ *
+ * @returns What to pass to TakeStatusUpdate() once it's the query's turn, nullptr if it has been merged
+ */
+std::shared_ptr<DbQuery> DbConnection::MergeStatusUpdate(const DbQuery& query)
+{
+	if (!query.Object) {
+		return std::make_shared<DbQuery>(query);
+	}
+
+	std::pair<String, DbObject::Ptr> key (query.Table, query.Object);
+	std::unique_lock<std::mutex> lock (m_QueuedStatusUpdatesMutex);
+
+	if (!query.StatusUpdate || !query.Fields || !(query.Type & DbQueryUpdate) || (query.Type & DbQueryDelete)) {
+		/* Anything else on that row must not be overtaken by the following status updates. */
+		m_QueuedStatusUpdates.erase(key);
+		return std::make_shared<DbQuery>(query);
+	}
+
+	auto& queued (m_QueuedStatusUpdates[key]);
+
+	if (!queued) {
+		queued = std::make_shared<DbQuery>(query);
+		return queued;
+	}
+
+	Dictionary::Ptr fields = queued->Fields->ShallowClone();
+
+	{
+		ObjectLock olock (query.Fields);
+
+		for (const Dictionary::Pair& kv : query.Fields) {
+			fields->Set(kv.first, kv.second);
+		}
+	}
+
+	queued->Fields = fields;
+	queued->Type |= query.Type;
+
+	if (query.NewCheckResult) {
+		queued->NewCheckResult = query.NewCheckResult;
+	}
+
+	lock.unlock();
+
+	m_MergedQueries.InsertValue(Utility::GetTime(), 1);
+
+	return nullptr;
+}
+
+/**
+ * Get the final version of a query returned by MergeStatusUpdate() and stop merging into it.
+ *
+ * @param query What MergeStatusUpdate() returned
+ *
+ * @returns The query to execute now
+ */
+DbQuery DbConnection::TakeStatusUpdate(const std::shared_ptr<DbQuery>& query)
+{
+	std::unique_lock<std::mutex> lock (m_QueuedStatusUpdatesMutex);
+
+	if (query->Object) {
+		auto queued (m_QueuedStatusUpdates.find(std::make_pair(query->Table, query->Object)));
+
+		if (queued != m_QueuedStatusUpdates.end() && queued->second == query) {
+			m_QueuedStatusUpdates.erase(queued);
+		}
+	}
+
+	return *query;
+}
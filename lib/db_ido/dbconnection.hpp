@@ -8,9 +8,12 @@
 #include "db_ido/dbobject.hpp"
 #include "db_ido/dbquery.hpp"
 #include "base/timer.hpp"
-#include "base/ringbuffer.hpp"
+#include "base/shardedringbuffer.hpp"
 #include <boost/thread/once.hpp>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <utility>
 
 namespace icinga
 {
@@ -57,6 +60,12 @@ public:
 	int GetQueryCount(RingBuffer::SizeType span);
 	virtual int GetPendingQueryCount() const = 0;
 
+	double GetConfigDumpProgress() const;
+	double GetConfigDumpRate() const;
+
+	uint_fast64_t GetCleanUpDeletedRows() const;
+	size_t GetCleanUpsInProgress() const;
+
 	void ValidateFailoverTimeout(const Lazy<double>& lvalue, const ValidationUtils& utils) final;
 	void ValidateCategories(const Lazy<Array::Ptr>& lvalue, const ValidationUtils& utils) final;
 
@@ -73,11 +82,15 @@ protected:
 	virtual void DeactivateObject(const DbObject::Ptr& dbobj) = 0;
 
 	virtual void CleanUpExecuteQuery(const String& table, const String& time_column, double max_age);
+	uint_fast64_t BeginCleanUp(const String& table);
+	bool CleanUpProgressed(const String& table, uint_fast64_t run, int deleted);
+	void AbortCleanUp(const String& table, uint_fast64_t run);
+	void ResetCleanUps();
 	virtual void FillIDCache(const DbType::Ptr& type) = 0;
 	virtual void NewTransaction() = 0;
 	virtual void Disconnect() = 0;
 
-	void UpdateObject(const ConfigObject::Ptr& object);
+	void UpdateObject(const ConfigObject::Ptr& object, Dictionary::Ptr configFields = nullptr);
 	void UpdateAllObjects();
 
 	void PrepareDatabase();
@@ -96,7 +109,12 @@ protected:
 	void IncreasePendingQueries(int count);
 	void DecreasePendingQueries(int count);
 
-	WorkQueue m_QueryQueue{10000000, 1, LogNotice};
+	std::shared_ptr<DbQuery> MergeStatusUpdate(const DbQuery& query);
+	DbQuery TakeStatusUpdate(const std::shared_ptr<DbQuery>& query);
+
+	WorkQueue m_QueryQueue{10000000, 1, LogNotice, true};
+
+	static const int CleanUpChunkSize;
 
 private:
 	bool m_IDCacheValid{false};
@@ -111,8 +129,29 @@ private:
 
 	double m_LogStatsTimeout;
 
+	Atomic<size_t> m_ConfigDumpObjects{0};
+	Atomic<size_t> m_ConfigDumpedObjects{0};
+	Atomic<double> m_ConfigDumpStart{0};
+	Atomic<double> m_ConfigDumpEnd{0};
+
+	struct CleanUpRun
+	{
+		uint_fast64_t Id;
+		double Start;
+		uint_fast64_t Deleted;
+		uint_fast64_t Queries;
+	};
+
+	/* The cleanups of the tables in progress, only accessed by m_QueryQueue. */
+	std::map<String, CleanUpRun> m_CleanUpRuns;
+	uint_fast64_t m_LastCleanUpRun{0};
+
+	Atomic<uint_fast64_t> m_CleanUpDeletedRows{0};
+	Atomic<size_t> m_CleanUpsInProgress{0};
+
 	void CleanUpHandler();
 	void LogStatsHandler();
+	void ConfigDumpProgressed();
 
 	static Timer::Ptr m_ProgramStatusTimer;
 	static boost::once_flag m_OnceFlag;
@@ -120,12 +159,16 @@ private:
 	static void InsertRuntimeVariable(const String& key, const Value& value);
 
 	mutable std::mutex m_StatsMutex;
-	RingBuffer m_QueryStats{15 * 60};
+	ShardedRingBuffer m_QueryStats{15 * 60};
 	bool m_ActiveChangedHandler{false};
 
-	RingBuffer m_InputQueries{10};
-	RingBuffer m_OutputQueries{10};
+	ShardedRingBuffer m_InputQueries{10};
+	ShardedRingBuffer m_OutputQueries{10};
+	ShardedRingBuffer m_MergedQueries{10};
 	Atomic<uint_fast64_t> m_PendingQueries{0};
+
+	std::mutex m_QueuedStatusUpdatesMutex;
+	std::map<std::pair<String, DbObject::Ptr>, std::shared_ptr<DbQuery>> m_QueuedStatusUpdates;
 };
 
 struct database_error : virtual std::exception, virtual boost::exception { };
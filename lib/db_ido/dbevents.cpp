@@ -12,6 +12,7 @@
 #include "remote/endpoint.hpp"
 #include "icinga/notification.hpp"
 #include "icinga/checkcommand.hpp"
+#include "icinga/checkresultstage.hpp"
 #include "icinga/eventcommand.hpp"
 #include "icinga/externalcommandprocessor.hpp"
 #include "icinga/compatutility.hpp"
@@ -24,6 +25,8 @@ using namespace icinga;
 
 INITIALIZE_ONCE(&DbEvents::StaticInitialize);
 
+static CheckResultStage l_DbEventsCheckResultStage ("ido", 100000, CheckResultStageBlock);
+
 void DbEvents::StaticInitialize()
 {
 	/* Status */
@@ -107,7 +110,11 @@ void DbEvents::StaticInitialize()
 	Checkable::OnFlappingChanged.connect([](const Checkable::Ptr& checkable, const Value&) { DbEvents::AddFlappingChangedHistory(checkable); });
 	Checkable::OnEnableFlappingChanged.connect([](const Checkable::Ptr& checkable, const Value&) { DbEvents::AddEnableFlappingChangedHistory(checkable); });
 	Checkable::OnNewCheckResult.connect([](const Checkable::Ptr& checkable, const CheckResult::Ptr& cr, const MessageOrigin::Ptr&) {
-		DbEvents::AddCheckableCheckHistory(checkable, cr);
+		/* No IDO connection is active. */
+		if (DbObject::OnQuery.empty())
+			return;
+
+		l_DbEventsCheckResultStage.Enqueue([checkable, cr]() { DbEvents::AddCheckableCheckHistory(checkable, cr); });
 	});
 
 	Checkable::OnEventCommandExecuted.connect([](const Checkable::Ptr& checkable) { DbEvents::AddEventHandlerHistory(checkable); });
@@ -1362,11 +1369,30 @@ void DbEvents::AddCheckableCheckHistory(const Checkable::Ptr& checkable, const C
 	query1.Type = DbQueryInsert;
 	query1.Category = DbCatCheck;
 
+	/* This runs in a CheckResultStage, i.e. the checkable may already have processed
+	 * newer check results. Use the state right after this one where possible.
+	 */
+	Dictionary::Ptr varsAfter = cr->GetVarsAfter();
+	int state;
+
+	if (varsAfter) {
+		state = varsAfter->Get("state");
+
+		if (!service) {
+			state = Host::CalculateState(static_cast<ServiceState>(state));
+
+			if (state != HostUp && !varsAfter->Get("reachable").ToBool())
+				state = 2; /* hardcoded compat state */
+		}
+	} else {
+		state = service ? service->GetState() : GetHostState(host);
+	}
+
 	Dictionary::Ptr fields1 = new Dictionary();
 	fields1->Set("check_type", !checkable->GetEnableActiveChecks()); /* 0 .. active, 1 .. passive */
-	fields1->Set("current_check_attempt", checkable->GetCheckAttempt());
+	fields1->Set("current_check_attempt", varsAfter ? varsAfter->Get("attempt") : Value(checkable->GetCheckAttempt()));
 	fields1->Set("max_check_attempts", checkable->GetMaxCheckAttempts());
-	fields1->Set("state_type", checkable->GetStateType());
+	fields1->Set("state_type", varsAfter ? varsAfter->Get("state_type") : Value(checkable->GetStateType()));
 
 	double start = cr->GetExecutionStart();
 	double end = cr->GetExecutionEnd();
@@ -1383,20 +1409,19 @@ void DbEvents::AddCheckableCheckHistory(const Checkable::Ptr& checkable, const C
 	fields1->Set("execution_time", executionTime);
 	fields1->Set("latency", cr->CalculateLatency());
 	fields1->Set("return_code", cr->GetExitStatus());
-	fields1->Set("perfdata", PluginUtility::FormatPerfdata(cr->GetPerformanceData()));
+	fields1->Set("perfdata", cr->GetFormattedPerformanceData());
 
 	fields1->Set("output", CompatUtility::GetCheckResultOutput(cr));
 	fields1->Set("long_output", CompatUtility::GetCheckResultLongOutput(cr));
 	fields1->Set("command_line", CompatUtility::GetCommandLine(checkable->GetCheckCommand()));
 	fields1->Set("instance_id", 0); /* DbConnection class fills in real ID */
 
-	if (service) {
+	if (service)
 		fields1->Set("service_object_id", service);
-		fields1->Set("state", service->GetState());
-	} else {
+	else
 		fields1->Set("host_object_id", host);
-		fields1->Set("state", GetHostState(host));
-	}
+
+	fields1->Set("state", state);
 
 	Endpoint::Ptr endpoint = Endpoint::GetByName(IcingaApplication::GetInstance()->GetNodeName());
 
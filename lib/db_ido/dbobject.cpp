@@ -178,6 +178,16 @@ void DbObject::SendStatusUpdate()
 	});
 	query.Object = this;
 	query.StatusUpdate = true;
+
+	auto checkable (dynamic_pointer_cast<Checkable>(GetObject()));
+
+	if (checkable) {
+		CheckResult::Ptr cr = checkable->GetLastCheckResult();
+
+		if (cr && cr->GetExecutionEnd() > m_LastStatusUpdate)
+			query.NewCheckResult = cr;
+	}
+
 	OnQuery(query);
 
 	m_LastStatusUpdate = Utility::GetTime();
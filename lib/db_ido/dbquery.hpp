@@ -6,6 +6,7 @@
 #include "db_ido/i2-db_ido.hpp"
 #include "db_ido/dbvalue.hpp"
 #include "icinga/customvarobject.hpp"
+#include "icinga/checkresult.hpp"
 #include "base/dictionary.hpp"
 #include "base/configobject.hpp"
 
@@ -56,6 +57,7 @@ struct DbQuery
 	bool ConfigUpdate{false};
 	bool StatusUpdate{false};
 	WorkQueuePriority Priority{PriorityNormal};
+	CheckResult::Ptr NewCheckResult; /**< Set if this query is the first one to persist that check result */
 
 	static void StaticInitialize();
 
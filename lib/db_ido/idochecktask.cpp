@@ -154,6 +154,12 @@ void IdoCheckTask::ScriptFunc(const Checkable::Ptr& checkable, const CheckResult
 		state = ServiceOK;
 	}
 
+	double configDumpProgress = conn->GetConfigDumpProgress();
+
+	if (configDumpProgress < 100) {
+		msgbuf << " Config dump in progress: " << std::fixed << std::setprecision(1) << configDumpProgress << "% done.";
+	}
+
 	if (conn->GetEnableHa()) {
 		double failoverTs = conn->GetLastFailover();
 
@@ -190,7 +196,9 @@ void IdoCheckTask::ScriptFunc(const Checkable::Ptr& checkable, const CheckResult
 		{ new PerfdataValue("queries_1min", conn->GetQueryCount(60)) },
 		{ new PerfdataValue("queries_5mins", conn->GetQueryCount(5 * 60)) },
 		{ new PerfdataValue("queries_15mins", conn->GetQueryCount(15 * 60)) },
-		{ new PerfdataValue("pending_queries", pendingQueries, false, "", pendingQueriesWarning, pendingQueriesCritical) }
+		{ new PerfdataValue("pending_queries", pendingQueries, false, "", pendingQueriesWarning, pendingQueriesCritical) },
+		{ new PerfdataValue("config_dump_progress", configDumpProgress, false, "percent") },
+		{ new PerfdataValue("config_dump_rate", conn->GetConfigDumpRate()) }
 	}));
 
 	ReportIdoCheck(checkable, commandObj, cr, msgbuf.str(), state);
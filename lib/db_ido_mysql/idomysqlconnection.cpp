@@ -3,6 +3,7 @@
 #include "db_ido_mysql/idomysqlconnection.hpp"
 #include "db_ido_mysql/idomysqlconnection-ti.cpp"
 #include "db_ido/dbtype.hpp"
+#include "icinga/checklatency.hpp"
 #include "db_ido/dbvalue.hpp"
 #include "base/logger.hpp"
 #include "base/objectlock.hpp"
@@ -14,6 +15,7 @@
 #include "base/exception.hpp"
 #include "base/statsfunction.hpp"
 #include "base/defer.hpp"
+#include <functional>
 #include <utility>
 
 using namespace icinga;
@@ -21,6 +23,12 @@ using namespace icinga;
 REGISTER_TYPE(IdoMysqlConnection);
 REGISTER_STATSFUNCTION(IdoMysqlConnection, &IdoMysqlConnection::StatsFunc);
 
+/* Append-only tables whose rows may be inserted by the additional writer connections. */
+static const std::set<String> l_WriterTables {
+	"statehistory", "logentries", "notifications", "contactnotifications", "contactnotificationmethods",
+	"downtimehistory", "commenthistory", "flappinghistory", "acknowledgements", "eventhandlers", "externalcommands"
+};
+
 const char * IdoMysqlConnection::GetLatestSchemaVersion() const noexcept
 {
 	return "1.15.1";
@@ -44,6 +52,26 @@ void IdoMysqlConnection::OnConfigLoaded()
 	m_Mysql.reset(create_mysql_shim());
 
 	std::swap(m_Library, shimLibrary);
+
+	for (int i = 1; i < GetWriterConnections(); i++) {
+		m_Writers.emplace_back(new IdoMysqlWriter());
+
+		auto& writer (*m_Writers.back());
+
+		writer.Queue.SetName("IdoMysqlConnection, " + GetName() + ", writer " + Convert::ToString(i));
+
+		writer.Queue.SetExceptionCallback([this, &writer](boost::exception_ptr exp) {
+			Log(LogCritical, "IdoMysqlConnection", "Exception during database operation of a writer connection: Verify that your database is operational!");
+
+			Log(LogDebug, "IdoMysqlConnection")
+				<< "Exception during database operation: " << DiagnosticInformation(std::move(exp));
+
+			if (writer.Connected) {
+				m_Mysql->close(&writer.Connection);
+				writer.Connected = false;
+			}
+		});
+	}
 }
 
 void IdoMysqlConnection::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
@@ -53,13 +81,21 @@ void IdoMysqlConnection::StatsFunc(const Dictionary::Ptr& status, const Array::P
 	for (const IdoMysqlConnection::Ptr& idomysqlconnection : ConfigType::GetObjectsByType<IdoMysqlConnection>()) {
 		size_t queryQueueItems = idomysqlconnection->m_QueryQueue.GetLength();
 		double queryQueueItemRate = idomysqlconnection->m_QueryQueue.GetTaskCount(60) / 60.0;
+		size_t writerQueueItems = 0;
+
+		for (auto& writer : idomysqlconnection->m_Writers)
+			writerQueueItems += writer->Queue.GetLength();
 
 		nodes.emplace_back(idomysqlconnection->GetName(), new Dictionary({
 			{ "version", idomysqlconnection->GetSchemaVersion() },
 			{ "instance_name", idomysqlconnection->GetInstanceName() },
 			{ "connected", idomysqlconnection->GetConnected() },
 			{ "query_queue_items", queryQueueItems },
-			{ "query_queue_item_rate", queryQueueItemRate }
+			{ "query_queue_item_rate", queryQueueItemRate },
+			{ "writer_connections", idomysqlconnection->GetWriterConnections() },
+			{ "writer_queue_items", writerQueueItems },
+			{ "cleanup_in_progress", idomysqlconnection->GetCleanUpsInProgress() },
+			{ "cleanup_deleted_rows", idomysqlconnection->GetCleanUpDeletedRows() }
 		}));
 
 		perfdata->Add(new PerfdataValue("idomysqlconnection_" + idomysqlconnection->GetName() + "_queries_rate", idomysqlconnection->GetQueryCount(60) / 60.0));
@@ -68,6 +104,9 @@ void IdoMysqlConnection::StatsFunc(const Dictionary::Ptr& status, const Array::P
 		perfdata->Add(new PerfdataValue("idomysqlconnection_" + idomysqlconnection->GetName() + "_queries_15mins", idomysqlconnection->GetQueryCount(15 * 60)));
 		perfdata->Add(new PerfdataValue("idomysqlconnection_" + idomysqlconnection->GetName() + "_query_queue_items", queryQueueItems));
 		perfdata->Add(new PerfdataValue("idomysqlconnection_" + idomysqlconnection->GetName() + "_query_queue_item_rate", queryQueueItemRate));
+		perfdata->Add(new PerfdataValue("idomysqlconnection_" + idomysqlconnection->GetName() + "_writer_queue_items", writerQueueItems));
+		perfdata->Add(new PerfdataValue("idomysqlconnection_" + idomysqlconnection->GetName() + "_cleanup_in_progress", idomysqlconnection->GetCleanUpsInProgress()));
+		perfdata->Add(new PerfdataValue("idomysqlconnection_" + idomysqlconnection->GetName() + "_cleanup_deleted_rows", idomysqlconnection->GetCleanUpDeletedRows(), true));
 	}
 
 	status->Set("idomysqlconnection", new Dictionary(std::move(nodes)));
@@ -147,6 +186,9 @@ void IdoMysqlConnection::Disconnect()
 	if (!GetConnected())
 		return;
 
+	WaitForWriters();
+	DisconnectWriters();
+
 	Query("COMMIT");
 	m_Mysql->close(&m_Connection);
 
@@ -178,6 +220,7 @@ void IdoMysqlConnection::InternalNewTransaction()
 
 	IncreasePendingQueries(2);
 
+	FlushInsertBatches();
 	AsyncQuery("COMMIT");
 	AsyncQuery("BEGIN");
 
@@ -195,37 +238,13 @@ void IdoMysqlConnection::ReconnectTimerHandler()
 	m_QueryQueue.Enqueue([this]() { Reconnect(); }, PriorityImmediate);
 }
 
-void IdoMysqlConnection::Reconnect()
+/**
+ * Establish a connection to the configured database.
+ *
+ * @param connection The handle to initialize and connect
+ */
+void IdoMysqlConnection::Connect(MYSQL *connection)
 {
-	AssertOnWorkQueue();
-
-	if (!IsActive())
-		return;
-
-	CONTEXT("Reconnecting to MySQL IDO database '" << GetName() << "'");
-
-	double startTime = Utility::GetTime();
-
-	SetShouldConnect(true);
-
-	bool reconnect = false;
-
-	/* Ensure to close old connections first. */
-	if (GetConnected()) {
-		/* Check if we're really still connected */
-		if (m_Mysql->ping(&m_Connection) == 0)
-			return;
-
-		m_Mysql->close(&m_Connection);
-		SetConnected(false);
-		reconnect = true;
-	}
-
-	Log(LogDebug, "IdoMysqlConnection")
-		<< "Reconnect: Clearing ID cache.";
-
-	ClearIDCache();
-
 	String ihost, isocket_path, iuser, ipasswd, idb;
 	String isslKey, isslCert, isslCa, isslCaPath, isslCipher;
 	const char *host, *socket_path, *user , *passwd, *db;
@@ -260,7 +279,7 @@ void IdoMysqlConnection::Reconnect()
 	sslCipher = (!isslCipher.IsEmpty()) ? isslCipher.CStr() : nullptr;
 
 	/* connection */
-	if (!m_Mysql->init(&m_Connection)) {
+	if (!m_Mysql->init(connection)) {
 		Log(LogCritical, "IdoMysqlConnection")
 			<< "mysql_init() failed: out of memory";
 
@@ -270,19 +289,54 @@ void IdoMysqlConnection::Reconnect()
 	/* Read "latin1" (here, in the schema and in Icinga Web) as "bytes".
 	   Icinga 2 and Icinga Web use byte-strings everywhere and every byte-string is a valid latin1 string.
 	   This way the (actually mostly UTF-8) bytes are transferred end-to-end as-is. */
-	m_Mysql->options(&m_Connection, MYSQL_SET_CHARSET_NAME, "latin1");
+	m_Mysql->options(connection, MYSQL_SET_CHARSET_NAME, "latin1");
 
 	if (enableSsl)
-		m_Mysql->ssl_set(&m_Connection, sslKey, sslCert, sslCa, sslCaPath, sslCipher);
+		m_Mysql->ssl_set(connection, sslKey, sslCert, sslCa, sslCaPath, sslCipher);
 
-	if (!m_Mysql->real_connect(&m_Connection, host, user, passwd, db, port, socket_path, CLIENT_FOUND_ROWS | CLIENT_MULTI_STATEMENTS)) {
+	if (!m_Mysql->real_connect(connection, host, user, passwd, db, port, socket_path, CLIENT_FOUND_ROWS | CLIENT_MULTI_STATEMENTS)) {
 		Log(LogCritical, "IdoMysqlConnection")
 			<< "Connection to database '" << db << "' with user '" << user << "' on '" << host << ":" << port
-			<< "' " << (enableSsl ? "(SSL enabled) " : "") << "failed: \"" << m_Mysql->error(&m_Connection) << "\"";
+			<< "' " << (enableSsl ? "(SSL enabled) " : "") << "failed: \"" << m_Mysql->error(connection) << "\"";
+
+		BOOST_THROW_EXCEPTION(std::runtime_error(m_Mysql->error(connection)));
+	}
+}
+
+void IdoMysqlConnection::Reconnect()
+{
+	AssertOnWorkQueue();
+
+	if (!IsActive())
+		return;
+
+	CONTEXT("Reconnecting to MySQL IDO database '" << GetName() << "'");
+
+	double startTime = Utility::GetTime();
+
+	SetShouldConnect(true);
+
+	bool reconnect = false;
+
+	/* Ensure to close old connections first. */
+	if (GetConnected()) {
+		/* Check if we're really still connected */
+		if (m_Mysql->ping(&m_Connection) == 0)
+			return;
 
-		BOOST_THROW_EXCEPTION(std::runtime_error(m_Mysql->error(&m_Connection)));
+		m_Mysql->close(&m_Connection);
+		SetConnected(false);
+		reconnect = true;
 	}
 
+	Log(LogDebug, "IdoMysqlConnection")
+		<< "Reconnect: Clearing ID cache.";
+
+	ClearIDCache();
+	ResetCleanUps();
+
+	Connect(&m_Connection);
+
 	Log(LogNotice, "IdoMysqlConnection")
 		<< "Reconnect: '" << GetName() << "' is now connected to database '" << GetDatabase() << "'.";
 
@@ -486,6 +540,7 @@ void IdoMysqlConnection::FinishConnect(double startTime)
 		return;
 
 	FinishAsyncQueries();
+	WaitForWriters();
 
 	Log(LogInformation, "IdoMysqlConnection")
 		<< "Finished reconnecting to '" << GetName() << "' database '" << GetDatabase() << "' in "
@@ -497,6 +552,8 @@ void IdoMysqlConnection::FinishConnect(double startTime)
 
 void IdoMysqlConnection::ClearTablesBySession()
 {
+	WaitForWriters();
+
 	/* delete all comments and downtimes without current session token */
 	ClearTableBySession("comments");
 	ClearTableBySession("scheduleddowntime");
@@ -524,6 +581,8 @@ void IdoMysqlConnection::AsyncQuery(const String& query, const std::function<voi
 
 void IdoMysqlConnection::FinishAsyncQueries()
 {
+	FlushInsertBatches();
+
 	std::vector<IdoAsyncQuery> queries;
 	m_AsyncQueries.swap(queries);
 
@@ -640,6 +699,165 @@ void IdoMysqlConnection::FinishAsyncQueries()
 	}
 }
 
+/**
+ * Queue a row to be inserted together with the following ones into the same table.
+ * The table's pending batch is sent first if it has other columns or is full.
+ */
+void IdoMysqlConnection::AddToInsertBatch(const DbQuery& query, const String& columns, const String& values)
+{
+	/* 0 is this connection. The rows of one object always go to the same one to keep their order. */
+	size_t writer = 0;
+
+	if (!m_Writers.empty() && query.Object && l_WriterTables.find(query.Table) != l_WriterTables.end())
+		writer = std::hash<DbObject*>()(query.Object.get()) % (m_Writers.size() + 1u);
+
+	auto& batch (m_InsertBatches[std::make_pair(query.Table, writer)]);
+
+	if (!batch.Queries.empty() && (batch.Columns != columns || batch.Queries.size() >= 1000u
+		|| batch.Query.GetLength() + values.GetLength() + 3u > m_MaxPacketSize / 4u)) {
+		FlushInsertBatch(query.Table, writer, batch);
+	}
+
+	if (batch.Queries.empty()) {
+		batch.Columns = columns;
+		batch.Query = "INSERT INTO " + GetTablePrefix() + query.Table + " (" + columns + ") VALUES (" + values + ")";
+	} else {
+		batch.Query += ",(" + values + ")";
+	}
+
+	batch.Queries.emplace_back(query);
+}
+
+void IdoMysqlConnection::FlushInsertBatch(const String& table, size_t writer, IdoInsertBatch& batch)
+{
+	if (batch.Queries.empty())
+		return;
+
+	/* The rows have been counted as pending queries one by one. */
+	DecreasePendingQueries(batch.Queries.size() - 1u);
+
+	std::vector<DbQuery> queries;
+	queries.swap(batch.Queries);
+
+	if (writer) {
+		auto& w (*m_Writers[writer - 1u]);
+		String query = batch.Query;
+
+		m_WriterTables.insert(table);
+		w.Queue.Enqueue([this, &w, query, queries]() { WriterExecute(w, query, queries); }, PriorityNormal, true);
+	} else {
+		AsyncQuery(batch.Query, [this, queries](const IdoMysqlResult&) {
+			for (auto& query : queries)
+				FinishExecuteQuery(query, DbQueryInsert, false);
+		});
+	}
+
+	batch.Columns = String();
+	batch.Query = String();
+}
+
+/**
+ * Send the pending multi-row INSERTs of the given table (or of all tables)
+ * so that they don't get overtaken by other queries.
+ * For a single table this also waits for the writer connections if they've got rows of it.
+ */
+void IdoMysqlConnection::FlushInsertBatches(const String& table)
+{
+	if (table.IsEmpty()) {
+		for (auto& kv : m_InsertBatches)
+			FlushInsertBatch(kv.first.first, kv.first.second, kv.second);
+	} else {
+		for (auto batch (m_InsertBatches.lower_bound(std::make_pair(table, size_t(0))));
+			batch != m_InsertBatches.end() && batch->first.first == table; ++batch) {
+			FlushInsertBatch(table, batch->first.second, batch->second);
+		}
+
+		if (m_WriterTables.find(table) != m_WriterTables.end())
+			WaitForWriters();
+	}
+}
+
+/**
+ * Insert history rows via a writer connection (on its own work queue).
+ * Every multi-row INSERT is committed on its own.
+ */
+void IdoMysqlConnection::WriterExecute(IdoMysqlWriter& writer, const String& query, const std::vector<DbQuery>& queries)
+{
+	Defer decreaseQueries ([this]() { DecreasePendingQueries(1); });
+
+	if (!writer.Connected) {
+		Connect(&writer.Connection);
+		writer.Connected = true;
+
+		WriterQuery(writer, "SET SESSION TIME_ZONE='+00:00'");
+		WriterQuery(writer, "SET SESSION SQL_MODE='NO_AUTO_VALUE_ON_ZERO'");
+	}
+
+	WriterQuery(writer, query);
+
+	for (auto& q : queries) {
+		if (q.NewCheckResult)
+			CheckLatency::RecordPersisted("ido_mysql", q.NewCheckResult);
+	}
+}
+
+void IdoMysqlConnection::WriterQuery(IdoMysqlWriter& writer, const String& query)
+{
+	Log(LogDebug, "IdoMysqlConnection")
+		<< "Query: " << query;
+
+	IncreaseQueryCount();
+
+	if (m_Mysql->query(&writer.Connection, query.CStr()) != 0) {
+		String message = m_Mysql->error(&writer.Connection);
+
+		Log(LogCritical, "IdoMysqlConnection")
+			<< "Error \"" << message << "\" when executing query \"" << query << "\"";
+
+		BOOST_THROW_EXCEPTION(
+			database_error()
+			<< errinfo_message(message)
+			<< errinfo_database_query(query)
+		);
+	}
+}
+
+/**
+ * Barrier: Commit everything queued so far on this connection (not to lock out the writers)
+ * and wait until the writer connections have inserted all rows passed to them.
+ */
+void IdoMysqlConnection::WaitForWriters()
+{
+	FlushInsertBatches();
+
+	if (m_WriterTables.empty())
+		return;
+
+	Query("COMMIT");
+	Query("BEGIN");
+
+	for (auto& writer : m_Writers)
+		writer->Queue.Join();
+
+	m_WriterTables.clear();
+}
+
+void IdoMysqlConnection::DisconnectWriters()
+{
+	for (auto& writer : m_Writers) {
+		auto& w (*writer);
+
+		w.Queue.Enqueue([this, &w]() {
+			if (w.Connected) {
+				m_Mysql->close(&w.Connection);
+				w.Connected = false;
+			}
+		}, PriorityNormal, true);
+
+		w.Queue.Join();
+	}
+}
+
 IdoMysqlResult IdoMysqlConnection::Query(const String& query)
 {
 	AssertOnWorkQueue();
@@ -929,8 +1147,13 @@ void IdoMysqlConnection::ExecuteQuery(const DbQuery& query)
 		<< "Scheduling execute query task, type " << query.Type << ", table '" << query.Table << "'.";
 #endif /* I2_DEBUG */
 
+	auto queued (MergeStatusUpdate(query));
+
+	if (!queued)
+		return;
+
 	IncreasePendingQueries(1);
-	m_QueryQueue.Enqueue([this, query]() { InternalExecuteQuery(query, -1); }, query.Priority, true);
+	m_QueryQueue.Enqueue([this, queued]() { InternalExecuteQuery(TakeStatusUpdate(queued), -1); }, query.Priority, true);
 }
 
 void IdoMysqlConnection::ExecuteMultipleQueries(const std::vector<DbQuery>& queries)
@@ -1046,6 +1269,10 @@ void IdoMysqlConnection::InternalExecuteQuery(const DbQuery& query, int typeOver
 		return;
 	}
 
+	/* The program status tells that everything up to now has been written. */
+	if (query.Category == DbCatProgramStatus)
+		WaitForWriters();
+
 	/* check if there are missing object/insert ids and re-enqueue the query */
 	if (!CanExecuteQuery(query)) {
 
@@ -1094,6 +1321,15 @@ void IdoMysqlConnection::InternalExecuteQuery(const DbQuery& query, int typeOver
 
 	type = (typeOverride != -1) ? typeOverride : query.Type;
 
+	/* Rows nobody needs the insert ID of (i.e. history) are merged into multi-row INSERTs.
+	 * Anything else on the same table has to wait for them to keep the order.
+	 */
+	bool batch = type == DbQueryInsert && !query.NotificationInsertID
+		&& !(query.Object && (query.ConfigUpdate || query.StatusUpdate));
+
+	if (!batch)
+		FlushInsertBatches(query.Table);
+
 	bool upsert = false;
 
 	if ((type & DbQueryInsert) && (type & DbQueryUpdate)) {
@@ -1178,6 +1414,11 @@ void IdoMysqlConnection::InternalExecuteQuery(const DbQuery& query, int typeOver
 				first = false;
 		}
 
+		if (batch) {
+			AddToInsertBatch(query, colbuf.str(), valbuf.str());
+			return;
+		}
+
 		if (type == DbQueryInsert)
 			qbuf << " (" << colbuf.str() << ") VALUES (" << valbuf.str() << ")";
 	}
@@ -1213,6 +1454,9 @@ void IdoMysqlConnection::FinishExecuteQuery(const DbQuery& query, int type, bool
 
 	if (type == DbQueryInsert && query.Table == "notifications" && query.NotificationInsertID)
 		query.NotificationInsertID->SetValue(static_cast<long>(GetLastInsertID()));
+
+	if (query.NewCheckResult)
+		CheckLatency::RecordPersisted("ido_mysql", query.NewCheckResult);
 }
 
 void IdoMysqlConnection::CleanUpExecuteQuery(const String& table, const String& time_column, double max_age)
@@ -1227,26 +1471,47 @@ void IdoMysqlConnection::CleanUpExecuteQuery(const String& table, const String&
 #endif /* I2_DEBUG */
 
 	IncreasePendingQueries(1);
-	m_QueryQueue.Enqueue([this, table, time_column, max_age]() { InternalCleanUpExecuteQuery(table, time_column, max_age); }, PriorityLow, true);
+	m_QueryQueue.Enqueue([this, table, time_column, max_age]() { InternalCleanUpExecuteQuery(table, time_column, max_age, 0); }, PriorityLow, true);
 }
 
-void IdoMysqlConnection::InternalCleanUpExecuteQuery(const String& table, const String& time_column, double max_age)
+/**
+ * Deletes up to DbConnection::CleanUpChunkSize old rows of the given table and enqueues the next chunk if there may be more.
+ *
+ * @param run The cleanup run of the table (see BeginCleanUp()) or 0 to start a new one.
+ */
+void IdoMysqlConnection::InternalCleanUpExecuteQuery(const String& table, const String& time_column, double max_age, uint_fast64_t run)
 {
 	AssertOnWorkQueue();
 
-	if (IsPaused()) {
+	if (IsPaused() || !GetConnected()) {
+		if (run)
+			AbortCleanUp(table, run);
+
 		DecreasePendingQueries(1);
 		return;
 	}
 
-	if (!GetConnected()) {
-		DecreasePendingQueries(1);
-		return;
+	if (!run) {
+		run = BeginCleanUp(table);
+
+		if (!run) {
+			DecreasePendingQueries(1);
+			return;
+		}
 	}
 
+	FlushInsertBatches(table);
 	AsyncQuery("DELETE FROM " + GetTablePrefix() + table + " WHERE instance_id = " +
 		Convert::ToString(static_cast<long>(m_InstanceID)) + " AND " + time_column +
-		" < FROM_UNIXTIME(" + Convert::ToString(static_cast<long>(max_age)) + ")");
+		" < FROM_UNIXTIME(" + Convert::ToString(static_cast<long>(max_age)) + ") LIMIT " + Convert::ToString(CleanUpChunkSize),
+		[this, table, time_column, max_age, run](const IdoMysqlResult&) {
+			if (CleanUpProgressed(table, run, GetAffectedRows())) {
+				IncreasePendingQueries(1);
+				m_QueryQueue.Enqueue([this, table, time_column, max_age, run]() {
+					InternalCleanUpExecuteQuery(table, time_column, max_age, run);
+				}, PriorityLow, true);
+			}
+		});
 }
 
 void IdoMysqlConnection::FillIDCache(const DbType::Ptr& type)
@@ -1267,3 +1532,11 @@ int IdoMysqlConnection::GetPendingQueryCount() const
 {
 	return m_QueryQueue.GetLength();
 }
+
+void IdoMysqlConnection::ValidateWriterConnections(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<IdoMysqlConnection>::ValidateWriterConnections(lvalue, utils);
+
+	if (lvalue() < 1)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "writer_connections" }, "At least one writer connection is required."));
+}
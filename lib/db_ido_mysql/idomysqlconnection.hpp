@@ -10,6 +10,11 @@
 #include "base/workqueue.hpp"
 #include "base/library.hpp"
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
 
 namespace icinga
 {
@@ -24,6 +29,26 @@ struct IdoAsyncQuery
 	IdoAsyncCallback Callback;
 };
 
+/**
+ * Rows to be inserted into one table by one multi-row INSERT.
+ */
+struct IdoInsertBatch
+{
+	String Columns;
+	String Query;
+	std::vector<DbQuery> Queries;
+};
+
+/**
+ * An additional connection which only inserts history rows.
+ */
+struct IdoMysqlWriter
+{
+	MYSQL Connection;
+	bool Connected = false;
+	WorkQueue Queue{10000000, 1, LogNotice, true};
+};
+
 /**
  * An IDO MySQL database connection.
  *
@@ -42,6 +67,8 @@ public:
 
 	int GetPendingQueryCount() const override;
 
+	void ValidateWriterConnections(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
+
 protected:
 	void OnConfigLoaded() override;
 	void Resume() override;
@@ -67,8 +94,12 @@ private:
 	unsigned int m_MaxPacketSize;
 
 	std::vector<IdoAsyncQuery> m_AsyncQueries;
+	std::map<std::pair<String, size_t>, IdoInsertBatch> m_InsertBatches;
 	uint_fast32_t m_UncommittedAsyncQueries = 0;
 
+	std::vector<std::unique_ptr<IdoMysqlWriter>> m_Writers;
+	std::set<String> m_WriterTables;
+
 	Timer::Ptr m_ReconnectTimer;
 	Timer::Ptr m_TxTimer;
 
@@ -82,10 +113,20 @@ private:
 	void AsyncQuery(const String& query, const IdoAsyncCallback& callback = IdoAsyncCallback());
 	void FinishAsyncQueries();
 
+	void AddToInsertBatch(const DbQuery& query, const String& columns, const String& values);
+	void FlushInsertBatch(const String& table, size_t writer, IdoInsertBatch& batch);
+	void FlushInsertBatches(const String& table = String());
+
+	void WriterExecute(IdoMysqlWriter& writer, const String& query, const std::vector<DbQuery>& queries);
+	void WriterQuery(IdoMysqlWriter& writer, const String& query);
+	void WaitForWriters();
+	void DisconnectWriters();
+
 	bool FieldToEscapedString(const String& key, const Value& value, Value *result);
 	void InternalActivateObject(const DbObject::Ptr& dbobj);
 	void InternalDeactivateObject(const DbObject::Ptr& dbobj);
 
+	void Connect(MYSQL *connection);
 	void Reconnect();
 
 	void AssertOnWorkQueue();
@@ -98,7 +139,7 @@ private:
 	void InternalExecuteMultipleQueries(const std::vector<DbQuery>& queries);
 
 	void FinishExecuteQuery(const DbQuery& query, int type, bool upsert);
-	void InternalCleanUpExecuteQuery(const String& table, const String& time_key, double time_value);
+	void InternalCleanUpExecuteQuery(const String& table, const String& time_key, double time_value, uint_fast64_t run);
 	void InternalNewTransaction();
 
 	void ClearTableBySession(const String& table);
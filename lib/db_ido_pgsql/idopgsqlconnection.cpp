@@ -3,6 +3,7 @@
 #include "db_ido_pgsql/idopgsqlconnection.hpp"
 #include "db_ido_pgsql/idopgsqlconnection-ti.cpp"
 #include "db_ido/dbtype.hpp"
+#include "icinga/checklatency.hpp"
 #include "db_ido/dbvalue.hpp"
 #include "base/logger.hpp"
 #include "base/objectlock.hpp"
@@ -15,6 +16,9 @@
 #include "base/context.hpp"
 #include "base/statsfunction.hpp"
 #include "base/defer.hpp"
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <algorithm>
+#include <set>
 #include <utility>
 
 using namespace icinga;
@@ -23,6 +27,11 @@ REGISTER_TYPE(IdoPgsqlConnection);
 
 REGISTER_STATSFUNCTION(IdoPgsqlConnection, &IdoPgsqlConnection::StatsFunc);
 
+/* Append-only tables whose rows are loaded via COPY unless their ID is needed. */
+static const std::set<String> l_CopyTables {
+	"statehistory", "logentries", "notifications", "downtimehistory", "commenthistory", "flappinghistory"
+};
+
 const char * IdoPgsqlConnection::GetLatestSchemaVersion() const noexcept
 {
 	return "1.14.3";
@@ -66,7 +75,9 @@ void IdoPgsqlConnection::StatsFunc(const Dictionary::Ptr& status, const Array::P
 			{ "instance_name", idopgsqlconnection->GetInstanceName() },
 			{ "connected", idopgsqlconnection->GetConnected() },
 			{ "query_queue_items", queryQueueItems },
-			{ "query_queue_item_rate", queryQueueItemRate }
+			{ "query_queue_item_rate", queryQueueItemRate },
+			{ "cleanup_in_progress", idopgsqlconnection->GetCleanUpsInProgress() },
+			{ "cleanup_deleted_rows", idopgsqlconnection->GetCleanUpDeletedRows() }
 		}));
 
 		perfdata->Add(new PerfdataValue("idopgsqlconnection_" + idopgsqlconnection->GetName() + "_queries_rate", idopgsqlconnection->GetQueryCount(60) / 60.0));
@@ -75,6 +86,8 @@ void IdoPgsqlConnection::StatsFunc(const Dictionary::Ptr& status, const Array::P
 		perfdata->Add(new PerfdataValue("idopgsqlconnection_" + idopgsqlconnection->GetName() + "_queries_15mins", idopgsqlconnection->GetQueryCount(15 * 60)));
 		perfdata->Add(new PerfdataValue("idopgsqlconnection_" + idopgsqlconnection->GetName() + "_query_queue_items", queryQueueItems));
 		perfdata->Add(new PerfdataValue("idopgsqlconnection_" + idopgsqlconnection->GetName() + "_query_queue_item_rate", queryQueueItemRate));
+		perfdata->Add(new PerfdataValue("idopgsqlconnection_" + idopgsqlconnection->GetName() + "_cleanup_in_progress", idopgsqlconnection->GetCleanUpsInProgress()));
+		perfdata->Add(new PerfdataValue("idopgsqlconnection_" + idopgsqlconnection->GetName() + "_cleanup_deleted_rows", idopgsqlconnection->GetCleanUpDeletedRows(), true));
 	}
 
 	status->Set("idopgsqlconnection", new Dictionary(std::move(nodes)));
@@ -144,6 +157,8 @@ void IdoPgsqlConnection::Disconnect()
 	if (!GetConnected())
 		return;
 
+	FlushCopyBuffers();
+
 	IncreasePendingQueries(1);
 	Query("COMMIT");
 
@@ -169,6 +184,8 @@ void IdoPgsqlConnection::InternalNewTransaction()
 	if (!GetConnected())
 		return;
 
+	FlushCopyBuffers();
+
 	IncreasePendingQueries(2);
 	Query("COMMIT");
 	Query("BEGIN");
@@ -206,6 +223,7 @@ void IdoPgsqlConnection::Reconnect()
 	}
 
 	ClearIDCache();
+	ResetCleanUps();
 
 	String host = GetHost();
 	String port = GetPort();
@@ -474,13 +492,27 @@ IdoPgsqlResult IdoPgsqlConnection::Query(const String& query)
 
 	Defer decreaseQueries ([this]() { DecreasePendingQueries(1); });
 
+	/* finish all async queries to maintain the right order for queries */
+	FinishAsyncQueries();
+
 	Log(LogDebug, "IdoPgsqlConnection")
 		<< "Query: " << query;
 
 	IncreaseQueryCount();
 
-	PGresult *result = m_Pgsql->exec(m_Connection, query.CStr());
+	return HandleResult(query, m_Pgsql->exec(m_Connection, query.CStr()));
+}
 
+/**
+ * Check a query's result and take it over.
+ *
+ * @param query The query (for error messages)
+ * @param result What libpq returned for it, nullptr on failure (e.g. of sending) to throw the connection's error
+ *
+ * @return The rows returned by the query, if any
+ */
+IdoPgsqlResult IdoPgsqlConnection::HandleResult(const String& query, PGresult *result)
+{
 	if (!result) {
 		String message = m_Pgsql->errorMessage(m_Connection);
 		Log(LogCritical, "IdoPgsqlConnection")
@@ -518,6 +550,107 @@ IdoPgsqlResult IdoPgsqlConnection::Query(const String& query)
 	return IdoPgsqlResult(result, [this](PGresult* result) { m_Pgsql->clear(result); });
 }
 
+void IdoPgsqlConnection::AsyncQuery(const String& query, const IdoPgsqlAsyncCallback& callback)
+{
+	AssertOnWorkQueue();
+
+	IdoPgsqlAsyncQuery aq;
+	aq.Query = query;
+	/* The callback must not immediately execute a query, but enqueue it! */
+	aq.Callback = callback;
+	m_AsyncQueries.emplace_back(std::move(aq));
+}
+
+/**
+ * Execute the queued async queries and process their results.
+ * With libpq's pipeline mode up to 100 of them are in flight at once
+ * instead of waiting one round trip for every single one.
+ */
+void IdoPgsqlConnection::FinishAsyncQueries()
+{
+	std::vector<IdoPgsqlAsyncQuery> queries;
+	m_AsyncQueries.swap(queries);
+
+	std::vector<IdoPgsqlAsyncQuery>::size_type offset = 0;
+
+	// This will be executed if there is a problem with executing the queries,
+	// at which point this function throws an exception and the queries should
+	// not be listed as still pending in the queue.
+	Defer decreaseQueries ([this, &offset, &queries]() {
+		auto lostQueries = queries.size() - offset;
+
+		if (lostQueries > 0) {
+			DecreasePendingQueries(lostQueries);
+		}
+	});
+
+	bool pipeline = m_Pgsql->pipelineSupported();
+
+	while (offset < queries.size()) {
+		std::vector<IdoPgsqlAsyncQuery>::size_type count = 1;
+
+		if (pipeline)
+			count = std::min(queries.size() - offset, std::vector<IdoPgsqlAsyncQuery>::size_type(100));
+
+		Defer decreaseQueries ([this, &offset, &count]() {
+			offset += count;
+			DecreasePendingQueries(count);
+		});
+
+		if (pipeline) {
+			if (m_Pgsql->enterPipelineMode(m_Connection) != 1)
+				HandleResult(queries[offset].Query, nullptr);
+
+			for (auto i = offset; i < offset + count; i++) {
+				Log(LogDebug, "IdoPgsqlConnection")
+					<< "Query: " << queries[i].Query;
+
+				IncreaseQueryCount();
+
+				if (m_Pgsql->sendQueryParams(m_Connection, queries[i].Query.CStr()) != 1)
+					HandleResult(queries[i].Query, nullptr);
+			}
+
+			if (m_Pgsql->pipelineSync(m_Connection) != 1)
+				HandleResult(queries[offset].Query, nullptr);
+		}
+
+		for (auto i = offset; i < offset + count; i++) {
+			const IdoPgsqlAsyncQuery& aq = queries[i];
+			IdoPgsqlResult result;
+
+			if (pipeline) {
+				result = HandleResult(aq.Query, m_Pgsql->getResult(m_Connection));
+
+				/* Every query's results are terminated by a null pointer. */
+				while (PGresult *extra = m_Pgsql->getResult(m_Connection))
+					m_Pgsql->clear(extra);
+			} else {
+				Log(LogDebug, "IdoPgsqlConnection")
+					<< "Query: " << aq.Query;
+
+				IncreaseQueryCount();
+
+				result = HandleResult(aq.Query, m_Pgsql->exec(m_Connection, aq.Query.CStr()));
+			}
+
+			if (aq.Callback)
+				aq.Callback(result);
+		}
+
+		if (pipeline) {
+			PGresult *sync = m_Pgsql->getResult(m_Connection);
+			bool synced = sync && m_Pgsql->resultIsPipelineSync(sync);
+
+			if (sync)
+				m_Pgsql->clear(sync);
+
+			if (!synced || m_Pgsql->exitPipelineMode(m_Connection) != 1)
+				HandleResult(queries[offset].Query, nullptr);
+		}
+	}
+}
+
 DbReference IdoPgsqlConnection::GetSequenceValue(const String& table, const String& column)
 {
 	AssertOnWorkQueue();
@@ -560,6 +693,38 @@ String IdoPgsqlConnection::Escape(const String& s)
 	return result;
 }
 
+/**
+ * Escape a value for COPY's text format
+ */
+String IdoPgsqlConnection::CopyEscape(const String& s)
+{
+	String utf8s = Utility::ValidateUTF8(s);
+	std::string result;
+
+	result.reserve(utf8s.GetLength());
+
+	for (char c : utf8s) {
+		switch (c) {
+			case '\\':
+				result += "\\\\";
+				break;
+			case '\n':
+				result += "\\n";
+				break;
+			case '\r':
+				result += "\\r";
+				break;
+			case '\t':
+				result += "\\t";
+				break;
+			default:
+				result += c;
+		}
+	}
+
+	return result;
+}
+
 Dictionary::Ptr IdoPgsqlConnection::FetchRow(const IdoPgsqlResult& result, int row)
 {
 	AssertOnWorkQueue();
@@ -618,7 +783,7 @@ void IdoPgsqlConnection::InternalActivateObject(const DbObject::Ptr& dbobj)
 	} else {
 		qbuf << "UPDATE " + GetTablePrefix() + "objects SET is_active = 1 WHERE object_id = " << static_cast<long>(dbref);
 		IncreasePendingQueries(1);
-		Query(qbuf.str());
+		AsyncQuery(qbuf.str());
 	}
 }
 
@@ -645,7 +810,7 @@ void IdoPgsqlConnection::InternalDeactivateObject(const DbObject::Ptr& dbobj)
 	std::ostringstream qbuf;
 	qbuf << "UPDATE " + GetTablePrefix() + "objects SET is_active = 0 WHERE object_id = " << static_cast<long>(dbref);
 	IncreasePendingQueries(1);
-	Query(qbuf.str());
+	AsyncQuery(qbuf.str());
 
 	/* Note that we're _NOT_ clearing the db refs via SetReference/SetConfigUpdate/SetStatusUpdate
 	 * because the object is still in the database. */
@@ -653,7 +818,12 @@ void IdoPgsqlConnection::InternalDeactivateObject(const DbObject::Ptr& dbobj)
 	SetObjectActive(dbobj, false);
 }
 
-bool IdoPgsqlConnection::FieldToEscapedString(const String& key, const Value& value, Value *result)
+/**
+ * Convert a field's value into what to put into a query
+ *
+ * @param copy Format it for COPY's text format instead of as SQL literal
+ */
+bool IdoPgsqlConnection::FieldToEscapedString(const String& key, const Value& value, Value *result, bool copy)
 {
 	if (key == "instance_id") {
 		*result = static_cast<long>(m_InstanceID);
@@ -666,7 +836,7 @@ bool IdoPgsqlConnection::FieldToEscapedString(const String& key, const Value& va
 	Value rawvalue = DbValue::ExtractValue(value);
 
 	if (rawvalue.GetType() == ValueEmpty) {
-		*result = "NULL";
+		*result = copy ? "\\N" : "NULL";
 	} else if (rawvalue.IsObjectType<ConfigObject>()) {
 		DbObject::Ptr dbobjcol = DbObject::GetOrCreateByObject(rawvalue);
 
@@ -701,9 +871,14 @@ bool IdoPgsqlConnection::FieldToEscapedString(const String& key, const Value& va
 		*result = static_cast<long>(dbrefcol);
 	} else if (DbValue::IsTimestamp(value)) {
 		long ts = rawvalue;
-		std::ostringstream msgbuf;
-		msgbuf << "TO_TIMESTAMP(" << ts << ") AT TIME ZONE 'UTC'";
-		*result = Value(msgbuf.str());
+
+		if (copy) {
+			*result = boost::posix_time::to_iso_extended_string(boost::posix_time::from_time_t(ts));
+		} else {
+			std::ostringstream msgbuf;
+			msgbuf << "TO_TIMESTAMP(" << ts << ") AT TIME ZONE 'UTC'";
+			*result = Value(msgbuf.str());
+		}
 	} else if (DbValue::IsObjectInsertID(value)) {
 		auto id = static_cast<long>(rawvalue);
 
@@ -720,7 +895,7 @@ bool IdoPgsqlConnection::FieldToEscapedString(const String& key, const Value& va
 		else
 			fvalue = rawvalue;
 
-		*result = "'" + Escape(fvalue) + "'";
+		*result = copy ? CopyEscape(fvalue) : "'" + Escape(fvalue) + "'";
 	}
 
 	return true;
@@ -733,8 +908,13 @@ void IdoPgsqlConnection::ExecuteQuery(const DbQuery& query)
 
 	ASSERT(query.Category != DbCatInvalid);
 
+	auto queued (MergeStatusUpdate(query));
+
+	if (!queued)
+		return;
+
 	IncreasePendingQueries(1);
-	m_QueryQueue.Enqueue([this, query]() { InternalExecuteQuery(query, -1); }, query.Priority, true);
+	m_QueryQueue.Enqueue([this, queued]() { InternalExecuteQuery(TakeStatusUpdate(queued), -1); }, query.Priority, true);
 }
 
 void IdoPgsqlConnection::ExecuteMultipleQueries(const std::vector<DbQuery>& queries)
@@ -871,6 +1051,15 @@ void IdoPgsqlConnection::InternalExecuteQuery(const DbQuery& query, int typeOver
 
 	type = (typeOverride != -1) ? typeOverride : query.Type;
 
+	/* History rows nobody needs the ID of are loaded via COPY.
+	 * Anything else on the same table has to wait for them to keep the order.
+	 */
+	bool copy = type == DbQueryInsert && l_CopyTables.find(query.Table) != l_CopyTables.end()
+		&& !query.NotificationInsertID && !(query.Object && (query.ConfigUpdate || query.StatusUpdate));
+
+	if (!copy)
+		FlushCopyBuffers(query.Table);
+
 	bool upsert = false;
 
 	if ((type & DbQueryInsert) && (type & DbQueryUpdate)) {
@@ -893,7 +1082,7 @@ void IdoPgsqlConnection::InternalExecuteQuery(const DbQuery& query, int typeOver
 		std::ostringstream qdel;
 		qdel << "DELETE FROM " << GetTablePrefix() << query.Table << where.str();
 		IncreasePendingQueries(1);
-		Query(qdel.str());
+		AsyncQuery(qdel.str());
 
 		type = DbQueryInsert;
 	}
@@ -923,7 +1112,7 @@ void IdoPgsqlConnection::InternalExecuteQuery(const DbQuery& query, int typeOver
 		Value value;
 		bool first = true;
 		for (const Dictionary::Pair& kv : query.Fields) {
-			if (!FieldToEscapedString(kv.first, kv.second, &value)) {
+			if (!FieldToEscapedString(kv.first, kv.second, &value, copy)) {
 				m_QueryQueue.Enqueue([this, query]() { InternalExecuteQuery(query, -1); }, query.Priority);
 				return;
 			}
@@ -931,7 +1120,7 @@ void IdoPgsqlConnection::InternalExecuteQuery(const DbQuery& query, int typeOver
 			if (type == DbQueryInsert) {
 				if (!first) {
 					colbuf << ", ";
-					valbuf << ", ";
+					valbuf << (copy ? "\t" : ", ");
 				}
 
 				colbuf << kv.first;
@@ -947,6 +1136,11 @@ void IdoPgsqlConnection::InternalExecuteQuery(const DbQuery& query, int typeOver
 				first = false;
 		}
 
+		if (copy) {
+			AddToCopyBuffer(query, colbuf.str(), valbuf.str());
+			return;
+		}
+
 		if (type == DbQueryInsert)
 			qbuf << " (" << colbuf.str() << ") VALUES (" << valbuf.str() << ")";
 	}
@@ -954,33 +1148,51 @@ void IdoPgsqlConnection::InternalExecuteQuery(const DbQuery& query, int typeOver
 	if (type != DbQueryInsert)
 		qbuf << where.str();
 
-	Query(qbuf.str());
-
-	if (upsert && GetAffectedRows() == 0) {
-		IncreasePendingQueries(1);
-		InternalExecuteQuery(query, DbQueryDelete | DbQueryInsert);
+	/* Only queries whose new row's ID is needed right now have to wait for their result. */
+	bool needsId = type == DbQueryInsert && ((query.Object && query.ConfigUpdate)
+		|| (query.Table == "notifications" && query.NotificationInsertID));
 
+	if (!needsId) {
+		AsyncQuery(qbuf.str(), [this, query, type, upsert](const IdoPgsqlResult&) { FinishExecuteQuery(query, type, upsert); });
 		return;
 	}
 
-	if (type == DbQueryInsert && query.Object) {
-		if (query.ConfigUpdate) {
-			String idField = query.IdColumn;
+	Query(qbuf.str());
 
-			if (idField.IsEmpty())
-				idField = query.Table.SubStr(0, query.Table.GetLength() - 1) + "_id";
+	if (query.Object && query.ConfigUpdate) {
+		String idField = query.IdColumn;
 
-			SetInsertID(query.Object, GetSequenceValue(GetTablePrefix() + query.Table, idField));
+		if (idField.IsEmpty())
+			idField = query.Table.SubStr(0, query.Table.GetLength() - 1) + "_id";
 
-			SetConfigUpdate(query.Object, true);
-		} else if (query.StatusUpdate)
-			SetStatusUpdate(query.Object, true);
+		SetInsertID(query.Object, GetSequenceValue(GetTablePrefix() + query.Table, idField));
+
+		SetConfigUpdate(query.Object, true);
 	}
 
-	if (type == DbQueryInsert && query.Table == "notifications" && query.NotificationInsertID) {
+	if (query.Table == "notifications" && query.NotificationInsertID) {
 		DbReference seqval = GetSequenceValue(GetTablePrefix() + query.Table, "notification_id");
 		query.NotificationInsertID->SetValue(static_cast<long>(seqval));
 	}
+
+	if (query.NewCheckResult)
+		CheckLatency::RecordPersisted("ido_pgsql", query.NewCheckResult);
+}
+
+void IdoPgsqlConnection::FinishExecuteQuery(const DbQuery& query, int type, bool upsert)
+{
+	if (upsert && GetAffectedRows() == 0) {
+		IncreasePendingQueries(1);
+		m_QueryQueue.Enqueue([this, query]() { InternalExecuteQuery(query, DbQueryDelete | DbQueryInsert); }, query.Priority);
+
+		return;
+	}
+
+	if (type == DbQueryInsert && query.Object && query.StatusUpdate)
+		SetStatusUpdate(query.Object, true);
+
+	if (query.NewCheckResult)
+		CheckLatency::RecordPersisted("ido_pgsql", query.NewCheckResult);
 }
 
 void IdoPgsqlConnection::CleanUpExecuteQuery(const String& table, const String& time_column, double max_age)
@@ -989,21 +1201,158 @@ void IdoPgsqlConnection::CleanUpExecuteQuery(const String& table, const String&
 		return;
 
 	IncreasePendingQueries(1);
-	m_QueryQueue.Enqueue([this, table, time_column, max_age]() { InternalCleanUpExecuteQuery(table, time_column, max_age); }, PriorityLow, true);
+	m_QueryQueue.Enqueue([this, table, time_column, max_age]() { InternalCleanUpExecuteQuery(table, time_column, max_age, 0); }, PriorityLow, true);
 }
 
-void IdoPgsqlConnection::InternalCleanUpExecuteQuery(const String& table, const String& time_column, double max_age)
+/**
+ * Deletes up to DbConnection::CleanUpChunkSize old rows of the given table and enqueues the next chunk if there may be more.
+ * PostgreSQL's DELETE has no LIMIT, so the rows are selected by their physical location (ctid) first.
+ *
+ * @param run The cleanup run of the table (see BeginCleanUp()) or 0 to start a new one.
+ */
+void IdoPgsqlConnection::InternalCleanUpExecuteQuery(const String& table, const String& time_column, double max_age, uint_fast64_t run)
 {
 	AssertOnWorkQueue();
 
 	if (!GetConnected()) {
+		if (run)
+			AbortCleanUp(table, run);
+
 		DecreasePendingQueries(1);
 		return;
 	}
 
-	Query("DELETE FROM " + GetTablePrefix() + table + " WHERE instance_id = " +
+	if (!run) {
+		run = BeginCleanUp(table);
+
+		if (!run) {
+			DecreasePendingQueries(1);
+			return;
+		}
+	}
+
+	FlushCopyBuffers(table);
+
+	String fullTable = GetTablePrefix() + table;
+
+	AsyncQuery("DELETE FROM " + fullTable + " WHERE ctid = ANY(ARRAY(SELECT ctid FROM " + fullTable + " WHERE instance_id = " +
 		Convert::ToString(static_cast<long>(m_InstanceID)) + " AND " + time_column +
-		" < TO_TIMESTAMP(" + Convert::ToString(static_cast<long>(max_age)) + ") AT TIME ZONE 'UTC'");
+		" < TO_TIMESTAMP(" + Convert::ToString(static_cast<long>(max_age)) + ") AT TIME ZONE 'UTC' LIMIT " +
+		Convert::ToString(CleanUpChunkSize) + "))",
+		[this, table, time_column, max_age, run](const IdoPgsqlResult&) {
+			if (CleanUpProgressed(table, run, GetAffectedRows())) {
+				IncreasePendingQueries(1);
+				m_QueryQueue.Enqueue([this, table, time_column, max_age, run]() {
+					InternalCleanUpExecuteQuery(table, time_column, max_age, run);
+				}, PriorityLow, true);
+			}
+		});
+}
+
+/**
+ * Queue a row to be loaded together with the following ones into the same table.
+ * The table's pending rows are sent first if they have other columns, and all of them if they're many.
+ */
+void IdoPgsqlConnection::AddToCopyBuffer(const DbQuery& query, const String& columns, const String& row)
+{
+	auto& buffer (m_CopyBuffers[query.Table]);
+
+	if (!buffer.Queries.empty() && buffer.Columns != columns)
+		FlushCopyBuffer(query.Table, buffer);
+
+	if (buffer.Queries.empty())
+		buffer.Columns = columns;
+
+	buffer.Rows.append(row.GetData());
+	buffer.Rows.append(1, '\n');
+	buffer.Queries.emplace_back(query);
+
+	if (buffer.Queries.size() >= 10000u || buffer.Rows.size() >= 4u * 1024u * 1024u)
+		FlushCopyBuffer(query.Table, buffer);
+}
+
+void IdoPgsqlConnection::FlushCopyBuffer(const String& table, IdoPgsqlCopyBuffer& buffer)
+{
+	if (buffer.Queries.empty())
+		return;
+
+	std::vector<DbQuery> queries;
+	std::string rows;
+
+	/* The queries queued before the rows have to be executed before them. */
+	FinishAsyncQueries();
+
+	queries.swap(buffer.Queries);
+	rows.swap(buffer.Rows);
+
+	String query = "COPY " + GetTablePrefix() + table + " (" + buffer.Columns + ") FROM STDIN";
+
+	/* The rows have been counted as pending queries one by one. */
+	Defer decreaseQueries ([this, &queries]() { DecreasePendingQueries(queries.size()); });
+
+	Log(LogDebug, "IdoPgsqlConnection")
+		<< "Query: " << query << " (" << queries.size() << " rows)";
+
+	IncreaseQueryCount();
+
+	auto fail ([this, &query](PGresult* result) {
+		String message = result ? m_Pgsql->resultErrorMessage(result) : m_Pgsql->errorMessage(m_Connection);
+
+		if (result)
+			m_Pgsql->clear(result);
+
+		Log(LogCritical, "IdoPgsqlConnection")
+			<< "Error \"" << message << "\" when executing query \"" << query << "\"";
+
+		BOOST_THROW_EXCEPTION(
+			database_error()
+			<< errinfo_message(message)
+			<< errinfo_database_query(query)
+		);
+	});
+
+	PGresult *result = m_Pgsql->exec(m_Connection, query.CStr());
+
+	if (!result || m_Pgsql->resultStatus(result) != PGRES_COPY_IN)
+		fail(result);
+
+	m_Pgsql->clear(result);
+
+	if (m_Pgsql->putCopyData(m_Connection, rows.c_str(), rows.size()) != 1 || m_Pgsql->putCopyEnd(m_Connection, nullptr) != 1)
+		fail(nullptr);
+
+	result = m_Pgsql->getResult(m_Connection);
+
+	/* The COPY's results have to be consumed completely before the next query. */
+	for (PGresult *extra; (extra = m_Pgsql->getResult(m_Connection));)
+		m_Pgsql->clear(extra);
+
+	if (!result || m_Pgsql->resultStatus(result) != PGRES_COMMAND_OK)
+		fail(result);
+
+	m_Pgsql->clear(result);
+
+	for (auto& q : queries) {
+		if (q.NewCheckResult)
+			CheckLatency::RecordPersisted("ido_pgsql", q.NewCheckResult);
+	}
+}
+
+/**
+ * Send the pending COPY rows of the given table (or of all tables)
+ * so that they don't get overtaken by other queries.
+ */
+void IdoPgsqlConnection::FlushCopyBuffers(const String& table)
+{
+	if (table.IsEmpty()) {
+		for (auto& kv : m_CopyBuffers)
+			FlushCopyBuffer(kv.first, kv.second);
+	} else {
+		auto buffer (m_CopyBuffers.find(table));
+
+		if (buffer != m_CopyBuffers.end())
+			FlushCopyBuffer(buffer->first, buffer->second);
+	}
 }
 
 void IdoPgsqlConnection::FillIDCache(const DbType::Ptr& type)
@@ -9,12 +9,34 @@
 #include "base/timer.hpp"
 #include "base/workqueue.hpp"
 #include "base/library.hpp"
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
 
 namespace icinga
 {
 
 typedef std::shared_ptr<PGresult> IdoPgsqlResult;
 
+typedef std::function<void (const IdoPgsqlResult&)> IdoPgsqlAsyncCallback;
+
+struct IdoPgsqlAsyncQuery
+{
+	String Query;
+	IdoPgsqlAsyncCallback Callback;
+};
+
+/**
+ * Rows to be loaded into one table by one COPY.
+ */
+struct IdoPgsqlCopyBuffer
+{
+	String Columns;
+	std::string Rows;
+	std::vector<DbQuery> Queries;
+};
+
 /**
  * An IDO pgSQL database connection.
  *
@@ -58,16 +80,25 @@ private:
 	PGconn *m_Connection;
 	int m_AffectedRows;
 
+	std::vector<IdoPgsqlAsyncQuery> m_AsyncQueries;
+
 	Timer::Ptr m_ReconnectTimer;
 	Timer::Ptr m_TxTimer;
 
+	std::map<String, IdoPgsqlCopyBuffer> m_CopyBuffers;
+
 	IdoPgsqlResult Query(const String& query);
 	DbReference GetSequenceValue(const String& table, const String& column);
 	int GetAffectedRows();
 	String Escape(const String& s);
+	static String CopyEscape(const String& s);
 	Dictionary::Ptr FetchRow(const IdoPgsqlResult& result, int row);
 
-	bool FieldToEscapedString(const String& key, const Value& value, Value *result);
+	void AsyncQuery(const String& query, const IdoPgsqlAsyncCallback& callback = IdoPgsqlAsyncCallback());
+	void FinishAsyncQueries();
+	IdoPgsqlResult HandleResult(const String& query, PGresult *result);
+
+	bool FieldToEscapedString(const String& key, const Value& value, Value *result, bool copy = false);
 	void InternalActivateObject(const DbObject::Ptr& dbobj);
 	void InternalDeactivateObject(const DbObject::Ptr& dbobj);
 
@@ -84,7 +115,12 @@ private:
 
 	void InternalExecuteQuery(const DbQuery& query, int typeOverride = -1);
 	void InternalExecuteMultipleQueries(const std::vector<DbQuery>& queries);
-	void InternalCleanUpExecuteQuery(const String& table, const String& time_key, double time_value);
+	void FinishExecuteQuery(const DbQuery& query, int type, bool upsert);
+	void InternalCleanUpExecuteQuery(const String& table, const String& time_key, double time_value, uint_fast64_t run);
+
+	void AddToCopyBuffer(const DbQuery& query, const String& columns, const String& row);
+	void FlushCopyBuffer(const String& table, IdoPgsqlCopyBuffer& buffer);
+	void FlushCopyBuffers(const String& table = String());
 
 	void ClearTableBySession(const String& table);
 	void ClearTablesBySession();
@@ -30,9 +30,9 @@ REGISTER_APIACTION(send_custom_notification, "Service;Host", &ApiActions::SendCu
 REGISTER_APIACTION(delay_notification, "Service;Host", &ApiActions::DelayNotification);
 REGISTER_APIACTION(acknowledge_problem, "Service;Host", &ApiActions::AcknowledgeProblem);
 REGISTER_APIACTION(remove_acknowledgement, "Service;Host", &ApiActions::RemoveAcknowledgement);
-REGISTER_APIACTION(add_comment, "Service;Host", &ApiActions::AddComment);
+REGISTER_BATCH_APIACTION(add_comment, "Service;Host", &ApiActions::AddComment, &ApiActions::AddComments);
 REGISTER_APIACTION(remove_comment, "Service;Host;Comment", &ApiActions::RemoveComment);
-REGISTER_APIACTION(schedule_downtime, "Service;Host", &ApiActions::ScheduleDowntime);
+REGISTER_BATCH_APIACTION(schedule_downtime, "Service;Host", &ApiActions::ScheduleDowntime, &ApiActions::ScheduleDowntimes);
 REGISTER_APIACTION(remove_downtime, "Service;Host;Downtime", &ApiActions::RemoveDowntime);
 REGISTER_APIACTION(shutdown_process, "", &ApiActions::ShutdownProcess);
 REGISTER_APIACTION(restart_process, "", &ApiActions::RestartProcess);
@@ -296,13 +296,19 @@ Dictionary::Ptr ApiActions::RemoveAcknowledgement(const ConfigObject::Ptr& objec
 Dictionary::Ptr ApiActions::AddComment(const ConfigObject::Ptr& object,
 	const Dictionary::Ptr& params)
 {
-	Checkable::Ptr checkable = static_pointer_cast<Checkable>(object);
-
-	if (!checkable)
-		return ApiActions::CreateResult(404, "Cannot add comment for non-existent object");
+	return AddComments({ object }, params)[0];
+}
 
+/**
+ * Adds the comments of all given objects in one transaction.
+ *
+ * @returns One result per object.
+ */
+ArrayData ApiActions::AddComments(const std::vector<ConfigObject::Ptr>& objects,
+	const Dictionary::Ptr& params)
+{
 	if (!params->Contains("author") || !params->Contains("comment"))
-		return ApiActions::CreateResult(400, "Comments require author and comment.");
+		return ArrayData(objects.size(), ApiActions::CreateResult(400, "Comments require author and comment."));
 
 	double timestamp = 0.0;
 
@@ -313,23 +319,51 @@ Dictionary::Ptr ApiActions::AddComment(const ConfigObject::Ptr& object,
 	ConfigObjectsSharedLock lock (std::try_to_lock);
 
 	if (!lock) {
-		return ApiActions::CreateResult(503, "Icinga is reloading.");
+		return ArrayData(objects.size(), ApiActions::CreateResult(503, "Icinga is reloading."));
 	}
 
-	String commentName = Comment::AddComment(checkable, CommentUser,
-		HttpUtility::GetLastParameter(params, "author"),
-		HttpUtility::GetLastParameter(params, "comment"), false, timestamp);
+	String author = HttpUtility::GetLastParameter(params, "author");
+	String text = HttpUtility::GetLastParameter(params, "comment");
 
-	Comment::Ptr comment = Comment::GetByName(commentName);
+	std::vector<NewConfigObject> comments;
+	comments.reserve(objects.size());
 
-	Dictionary::Ptr additional = new Dictionary({
-		{ "name", commentName },
-		{ "legacy_id", comment->GetLegacyId() }
-	});
+	for (auto& object : objects) {
+		Checkable::Ptr checkable = static_pointer_cast<Checkable>(object);
+
+		if (checkable)
+			comments.emplace_back(Comment::PrepareComment(checkable, CommentUser, author, text, false, timestamp));
+	}
+
+	std::vector<Comment::Ptr> created;
+
+	if (!comments.empty())
+		created = Comment::AddComments(comments);
+
+	ArrayData results;
+	results.reserve(objects.size());
+
+	auto comment (created.begin());
+
+	for (auto& object : objects) {
+		if (!object) {
+			results.emplace_back(ApiActions::CreateResult(404, "Cannot add comment for non-existent object"));
+			continue;
+		}
+
+		Dictionary::Ptr additional = new Dictionary({
+			{ "name", (*comment)->GetName() },
+			{ "legacy_id", (*comment)->GetLegacyId() }
+		});
 
-	return ApiActions::CreateResult(200, "Successfully added comment '"
-		+ commentName + "' for object '" + checkable->GetName()
-		+ "'.", additional);
+		results.emplace_back(ApiActions::CreateResult(200, "Successfully added comment '"
+			+ (*comment)->GetName() + "' for object '" + object->GetName()
+			+ "'.", additional));
+
+		++comment;
+	}
+
+	return results;
 }
 
 Dictionary::Ptr ApiActions::RemoveComment(const ConfigObject::Ptr& object,
@@ -369,15 +403,36 @@ Dictionary::Ptr ApiActions::RemoveComment(const ConfigObject::Ptr& object,
 Dictionary::Ptr ApiActions::ScheduleDowntime(const ConfigObject::Ptr& object,
 	const Dictionary::Ptr& params)
 {
-	Checkable::Ptr checkable = static_pointer_cast<Checkable>(object);
+	return ScheduleDowntimes({ object }, params)[0];
+}
 
-	if (!checkable)
-		return ApiActions::CreateResult(404, "Can't schedule downtime for non-existent object.");
+/**
+ * A downtime planned by ScheduleDowntimes() and the ones scheduled along with it.
+ */
+struct PlannedDowntime
+{
+	size_t Index;
+	bool WithServices{false};
+	std::vector<size_t> Services;
+	std::vector<PlannedDowntime> Children;
+};
+
+/**
+ * Schedules the downtimes of all given objects, incl. the ones of their services and children, in one transaction.
+ *
+ * @returns One result per object.
+ */
+ArrayData ApiActions::ScheduleDowntimes(const std::vector<ConfigObject::Ptr>& objects,
+	const Dictionary::Ptr& params)
+{
+	auto fail ([&objects](int code, const String& status) {
+		return ArrayData(objects.size(), ApiActions::CreateResult(code, status));
+	});
 
 	if (!params->Contains("start_time") || !params->Contains("end_time") ||
 		!params->Contains("author") || !params->Contains("comment")) {
 
-		return ApiActions::CreateResult(400, "Options 'start_time', 'end_time', 'author' and 'comment' are required");
+		return fail(400, "Options 'start_time', 'end_time', 'author' and 'comment' are required");
 	}
 
 	bool fixed = true;
@@ -385,21 +440,16 @@ Dictionary::Ptr ApiActions::ScheduleDowntime(const ConfigObject::Ptr& object,
 		fixed = HttpUtility::GetLastParameter(params, "fixed");
 
 	if (!fixed && !params->Contains("duration"))
-		return ApiActions::CreateResult(400, "Option 'duration' is required for flexible downtime");
+		return fail(400, "Option 'duration' is required for flexible downtime");
 
 	double duration = 0.0;
 	if (params->Contains("duration"))
 		duration = HttpUtility::GetLastParameter(params, "duration");
 
-	Downtime::Ptr trigger;
 	String triggerName = HttpUtility::GetLastParameter(params, "trigger_name");
 
-	if (!triggerName.IsEmpty()) {
-		trigger = Downtime::GetByName(triggerName);
-
-		if (!trigger) {
-			return ApiActions::CreateResult(404, "Won't schedule downtime with non-existent trigger downtime.");
-		}
+	if (!triggerName.IsEmpty() && !Downtime::GetByName(triggerName)) {
+		return fail(404, "Won't schedule downtime with non-existent trigger downtime.");
 	}
 
 	String author = HttpUtility::GetLastParameter(params, "author");
@@ -407,133 +457,175 @@ Dictionary::Ptr ApiActions::ScheduleDowntime(const ConfigObject::Ptr& object,
 	double startTime = HttpUtility::GetLastParameter(params, "start_time");
 	double endTime = HttpUtility::GetLastParameter(params, "end_time");
 
-	Host::Ptr host;
-	Service::Ptr service;
-	tie(host, service) = GetHostService(checkable);
-
 	DowntimeChildOptions childOptions = DowntimeNoChildren;
 	if (params->Contains("child_options")) {
 		try {
 			childOptions = Downtime::ChildOptionsFromValue(HttpUtility::GetLastParameter(params, "child_options"));
 		} catch (const std::exception&) {
-			return ApiActions::CreateResult(400, "Option 'child_options' provided an invalid value.");
+			return fail(400, "Option 'child_options' provided an invalid value.");
 		}
 	}
 
+	/* Schedule downtime for all services for the host type. */
+	bool allServices = false;
+
+	if (params->Contains("all_services"))
+		allServices = HttpUtility::GetLastParameter(params, "all_services");
+
 	ConfigObjectsSharedLock lock (std::try_to_lock);
 
 	if (!lock) {
-		return ApiActions::CreateResult(503, "Icinga is reloading.");
+		return fail(503, "Icinga is reloading.");
 	}
 
-	Downtime::Ptr downtime = Downtime::AddDowntime(checkable, author, comment, startTime, endTime,
-		fixed, trigger, duration);
-	String downtimeName = downtime->GetName();
+	std::vector<NewConfigObject> downtimes;
+	std::vector<PlannedDowntime> planned;
+	planned.reserve(objects.size());
 
-	Dictionary::Ptr additional = new Dictionary({
-		{ "name", downtimeName },
-		{ "legacy_id", downtime->GetLegacyId() }
+	auto plan ([&](const Checkable::Ptr& checkable, const String& trigger, const String& parent) {
+		downtimes.emplace_back(Downtime::PrepareDowntime(checkable, author, comment, startTime, endTime,
+			fixed, trigger, duration, String(), String(), parent));
+
+		PlannedDowntime downtime;
+		downtime.Index = downtimes.size() - 1u;
+		return downtime;
 	});
 
-	/* Schedule downtime for all services for the host type. */
-	bool allServices = false;
+	for (auto& object : objects) {
+		Checkable::Ptr checkable = static_pointer_cast<Checkable>(object);
 
-	if (params->Contains("all_services"))
-		allServices = HttpUtility::GetLastParameter(params, "all_services");
+		if (!checkable)
+			continue;
+
+		Host::Ptr host;
+		Service::Ptr service;
+		tie(host, service) = GetHostService(checkable);
+
+		PlannedDowntime downtime = plan(checkable, triggerName, String());
+		String downtimeName = downtimes[downtime.Index].Name;
+
+		if (allServices && !service) {
+			downtime.WithServices = true;
+
+			for (const Service::Ptr& hostService : host->GetServices()) {
+				Log(LogNotice, "ApiActions")
+					<< "Creating downtime for service " << hostService->GetName() << " on host " << host->GetName();
+
+				downtime.Services.emplace_back(plan(hostService, triggerName, downtimeName).Index);
+			}
+		}
 
-	if (allServices && !service) {
-		ArrayData serviceDowntimes;
+		/* Schedule downtime for all child objects. */
+		if (childOptions != DowntimeNoChildren) {
+			/* 'DowntimeTriggeredChildren' schedules child downtimes triggered by the parent downtime.
+			 * 'DowntimeNonTriggeredChildren' schedules non-triggered downtimes for all children.
+			 */
+			String childTrigger = childOptions == DowntimeTriggeredChildren ? downtimeName : triggerName;
 
-		for (const Service::Ptr& hostService : host->GetServices()) {
 			Log(LogNotice, "ApiActions")
-				<< "Creating downtime for service " << hostService->GetName() << " on host " << host->GetName();
+				<< "Processing child options " << childOptions << " for downtime " << downtimeName;
+
+			std::set<Checkable::Ptr> allChildren = checkable->GetAllChildren();
+			for (const Checkable::Ptr& child : allChildren) {
+				Host::Ptr childHost;
+				Service::Ptr childService;
+				tie(childHost, childService) = GetHostService(child);
+
+				if (allServices && childService &&
+						allChildren.find(static_pointer_cast<Checkable>(childHost)) != allChildren.end()) {
+					/* When scheduling downtimes for all service and all children, the current child is a service, and its
+					 * host is also a child, skip it here. The downtime for this service will be scheduled below together
+					 * with the downtimes of all services for that host. Scheduling it below ensures that the relation
+					 * from the child service downtime to the child host downtime is set properly. */
+					continue;
+				}
+
+				Log(LogNotice, "ApiActions")
+					<< "Scheduling downtime for child object " << child->GetName();
+
+				PlannedDowntime childDowntime = plan(child, childTrigger, String());
+				String childDowntimeName = downtimes[childDowntime.Index].Name;
+
+				/* For a host, also schedule all service downtimes if requested. */
+				if (allServices && !childService) {
+					childDowntime.WithServices = true;
+
+					for (const Service::Ptr& childService : childHost->GetServices()) {
+						Log(LogNotice, "ApiActions")
+							<< "Creating downtime for service " << childService->GetName() << " on child host " << childHost->GetName();
 
-			Downtime::Ptr serviceDowntime = Downtime::AddDowntime(hostService, author, comment, startTime, endTime,
-				fixed, trigger, duration, String(), String(), downtimeName);
-			String serviceDowntimeName = serviceDowntime->GetName();
+						childDowntime.Services.emplace_back(plan(childService, childTrigger, childDowntimeName).Index);
+					}
+				}
 
-			serviceDowntimes.push_back(new Dictionary({
-				{ "name", serviceDowntimeName },
-				{ "legacy_id", serviceDowntime->GetLegacyId() }
-			}));
+				downtime.Children.emplace_back(std::move(childDowntime));
+			}
 		}
 
-		additional->Set("service_downtimes", new Array(std::move(serviceDowntimes)));
+		planned.emplace_back(std::move(downtime));
 	}
 
-	/* Schedule downtime for all child objects. */
-	if (childOptions != DowntimeNoChildren) {
-		/* 'DowntimeTriggeredChildren' schedules child downtimes triggered by the parent downtime.
-		 * 'DowntimeNonTriggeredChildren' schedules non-triggered downtimes for all children.
-		 */
-		if (childOptions == DowntimeTriggeredChildren) {
-			trigger = downtime;
-		}
+	std::vector<Downtime::Ptr> created;
 
-		Log(LogNotice, "ApiActions")
-			<< "Processing child options " << childOptions << " for downtime " << downtimeName;
+	if (!downtimes.empty())
+		created = Downtime::AddDowntimes(downtimes);
 
-		ArrayData childDowntimes;
+	auto describe ([&created](size_t index) -> Dictionary::Ptr {
+		return new Dictionary({
+			{ "name", created[index]->GetName() },
+			{ "legacy_id", created[index]->GetLegacyId() }
+		});
+	});
 
-		std::set<Checkable::Ptr> allChildren = checkable->GetAllChildren();
-		for (const Checkable::Ptr& child : allChildren) {
-			Host::Ptr childHost;
-			Service::Ptr childService;
-			tie(childHost, childService) = GetHostService(child);
+	auto describeWithServices ([&describe](const PlannedDowntime& downtime) {
+		Dictionary::Ptr additional = describe(downtime.Index);
 
-			if (allServices && childService &&
-					allChildren.find(static_pointer_cast<Checkable>(childHost)) != allChildren.end()) {
-				/* When scheduling downtimes for all service and all children, the current child is a service, and its
-				 * host is also a child, skip it here. The downtime for this service will be scheduled below together
-				 * with the downtimes of all services for that host. Scheduling it below ensures that the relation
-				 * from the child service downtime to the child host downtime is set properly. */
-				continue;
+		if (downtime.WithServices) {
+			ArrayData serviceDowntimes;
+
+			for (auto index : downtime.Services) {
+				serviceDowntimes.emplace_back(describe(index));
 			}
 
-			Log(LogNotice, "ApiActions")
-				<< "Scheduling downtime for child object " << child->GetName();
+			additional->Set("service_downtimes", new Array(std::move(serviceDowntimes)));
+		}
 
-			Downtime::Ptr childDowntime = Downtime::AddDowntime(child, author, comment, startTime, endTime,
-				fixed, trigger, duration);
-			String childDowntimeName = childDowntime->GetName();
+		return additional;
+	});
 
-			Log(LogNotice, "ApiActions")
-				<< "Add child downtime '" << childDowntimeName << "'.";
+	ArrayData results;
+	results.reserve(objects.size());
 
-			Dictionary::Ptr childAdditional = new Dictionary({
-				{ "name", childDowntimeName },
-				{ "legacy_id", childDowntime->GetLegacyId() }
-			});
+	auto downtime (planned.begin());
 
-			/* For a host, also schedule all service downtimes if requested. */
-			if (allServices && !childService) {
-				ArrayData childServiceDowntimes;
+	for (auto& object : objects) {
+		if (!object) {
+			results.emplace_back(ApiActions::CreateResult(404, "Can't schedule downtime for non-existent object."));
+			continue;
+		}
 
-				for (const Service::Ptr& childService : childHost->GetServices()) {
-					Log(LogNotice, "ApiActions")
-						<< "Creating downtime for service " << childService->GetName() << " on child host " << childHost->GetName();
+		Dictionary::Ptr additional = describeWithServices(*downtime);
 
-					Downtime::Ptr serviceDowntime = Downtime::AddDowntime(childService, author, comment, startTime, endTime,
-						fixed, trigger, duration, String(), String(), childDowntimeName);
-					String serviceDowntimeName = serviceDowntime->GetName();
+		if (childOptions != DowntimeNoChildren) {
+			ArrayData childDowntimes;
 
-					childServiceDowntimes.push_back(new Dictionary({
-						{ "name", serviceDowntimeName },
-						{ "legacy_id", serviceDowntime->GetLegacyId() }
-					}));
-				}
+			for (auto& childDowntime : downtime->Children) {
+				Log(LogNotice, "ApiActions")
+					<< "Add child downtime '" << created[childDowntime.Index]->GetName() << "'.";
 
-				childAdditional->Set("service_downtimes", new Array(std::move(childServiceDowntimes)));
+				childDowntimes.emplace_back(describeWithServices(childDowntime));
 			}
 
-			childDowntimes.push_back(childAdditional);
+			additional->Set("child_downtimes", new Array(std::move(childDowntimes)));
 		}
 
-		additional->Set("child_downtimes", new Array(std::move(childDowntimes)));
+		results.emplace_back(ApiActions::CreateResult(200, "Successfully scheduled downtime '" +
+			created[downtime->Index]->GetName() + "' for object '" + object->GetName() + "'.", additional));
+
+		++downtime;
 	}
 
-	return ApiActions::CreateResult(200, "Successfully scheduled downtime '" +
-		downtimeName + "' for object '" + checkable->GetName() + "'.", additional);
+	return results;
 }
 
 Dictionary::Ptr ApiActions::RemoveDowntime(const ConfigObject::Ptr& object,
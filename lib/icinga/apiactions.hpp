@@ -4,9 +4,11 @@
 #define APIACTIONS_H
 
 #include "icinga/i2-icinga.hpp"
+#include "base/array.hpp"
 #include "base/configobject.hpp"
 #include "base/dictionary.hpp"
 #include "remote/apiuser.hpp"
+#include <vector>
 
 namespace icinga
 {
@@ -24,8 +26,10 @@ public:
 	static Dictionary::Ptr AcknowledgeProblem(const ConfigObject::Ptr& object, const Dictionary::Ptr& params);
 	static Dictionary::Ptr RemoveAcknowledgement(const ConfigObject::Ptr& object, const Dictionary::Ptr& params);
 	static Dictionary::Ptr AddComment(const ConfigObject::Ptr& object, const Dictionary::Ptr& params);
+	static ArrayData AddComments(const std::vector<ConfigObject::Ptr>& objects, const Dictionary::Ptr& params);
 	static Dictionary::Ptr RemoveComment(const ConfigObject::Ptr& object, const Dictionary::Ptr& params);
 	static Dictionary::Ptr ScheduleDowntime(const ConfigObject::Ptr& object, const Dictionary::Ptr& params);
+	static ArrayData ScheduleDowntimes(const std::vector<ConfigObject::Ptr>& objects, const Dictionary::Ptr& params);
 	static Dictionary::Ptr RemoveDowntime(const ConfigObject::Ptr& object, const Dictionary::Ptr& params);
 	static Dictionary::Ptr ShutdownProcess(const ConfigObject::Ptr& object, const Dictionary::Ptr& params);
 	static Dictionary::Ptr RestartProcess(const ConfigObject::Ptr& object, const Dictionary::Ptr& params);
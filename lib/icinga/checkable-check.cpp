@@ -5,23 +5,30 @@
 #include "icinga/host.hpp"
 #include "icinga/checkcommand.hpp"
 #include "icinga/icingaapplication.hpp"
+#include "icinga/checklatency.hpp"
 #include "icinga/cib.hpp"
 #include "icinga/clusterevents.hpp"
 #include "remote/messageorigin.hpp"
 #include "remote/apilistener.hpp"
+#include "base/configuration.hpp"
+#include "base/internpool.hpp"
 #include "base/objectlock.hpp"
 #include "base/logger.hpp"
 #include "base/convert.hpp"
 #include "base/utility.hpp"
 #include "base/context.hpp"
+#include "base/defer.hpp"
+#include <atomic>
+#include <cmath>
+#include <cstdint>
 
 using namespace icinga;
 
-boost::signals2::signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, const MessageOrigin::Ptr&)> Checkable::OnNewCheckResult;
-boost::signals2::signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, StateType, const MessageOrigin::Ptr&)> Checkable::OnStateChange;
-boost::signals2::signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, std::set<Checkable::Ptr>, const MessageOrigin::Ptr&)> Checkable::OnReachabilityChanged;
+Signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, const MessageOrigin::Ptr&)> Checkable::OnNewCheckResult;
+Signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, StateType, const MessageOrigin::Ptr&)> Checkable::OnStateChange;
+Signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, std::set<Checkable::Ptr>, const MessageOrigin::Ptr&)> Checkable::OnReachabilityChanged;
 boost::signals2::signal<void (const Checkable::Ptr&, NotificationType, const CheckResult::Ptr&, const String&, const String&, const MessageOrigin::Ptr&)> Checkable::OnNotificationsRequested;
-boost::signals2::signal<void (const Checkable::Ptr&)> Checkable::OnNextCheckUpdated;
+Signal<void (const Checkable::Ptr&)> Checkable::OnNextCheckUpdated;
 
 Atomic<uint_fast64_t> Checkable::CurrentConcurrentChecks (0);
 
@@ -29,6 +36,19 @@ std::mutex Checkable::m_StatsMutex;
 int Checkable::m_PendingChecks = 0;
 std::condition_variable Checkable::m_PendingChecksCV;
 
+/**
+ * Number of checks planned for one second, see Checkable::SmoothNextCheck().
+ */
+struct PlannedChecksSlot
+{
+	int64_t Second = -1;
+	unsigned Checks = 0;
+};
+
+static std::atomic<double> l_LoadSmoothingWindow (0);
+static std::mutex l_PlannedChecksMutex;
+static std::vector<PlannedChecksSlot> l_PlannedChecks;
+
 CheckCommand::Ptr Checkable::GetCheckCommand() const
 {
 	return dynamic_pointer_cast<CheckCommand>(NavigateCheckCommandRaw());
@@ -67,7 +87,7 @@ void Checkable::UpdateNextCheck(const MessageOrigin::Ptr& origin)
 	if (adj != 0.0)
 		adj = std::min(0.5 + fmod(GetSchedulingOffset(), interval * 5) / 100.0, adj);
 
-	double nextCheck = now - adj + interval;
+	double nextCheck = SmoothNextCheck(GetNextCheck(), now - adj + interval, interval);
 	double lastCheck = GetLastCheck();
 
 	Log(LogDebug, "Checkable")
@@ -120,6 +140,16 @@ Checkable::ProcessingResult Checkable::ProcessCheckResult(const CheckResult::Ptr
 	if (cr->GetExecutionEnd() == 0)
 		cr->SetExecutionEnd(now);
 
+	if (cr->GetActive() && (!origin || origin->IsLocal()))
+		CheckLatency::Record(CheckLatencyExecution, cr->CalculateExecutionTime());
+
+	Defer recordProcessing ([&cr, now]() {
+		double duration = Utility::GetTime() - now;
+
+		CheckLatency::Record(CheckLatencyProcessing, duration);
+		CheckLatency::Trace(cr, "Processed check result in " + Convert::ToString(duration) + "s.");
+	});
+
 	if (!origin || origin->IsLocal())
 		cr->SetSchedulingSource(IcingaApplication::GetInstance()->GetNodeName());
 
@@ -141,7 +171,9 @@ Checkable::ProcessingResult Checkable::ProcessCheckResult(const CheckResult::Ptr
 		if (listener) {
 			/* send message back to its origin */
 			Dictionary::Ptr message = ClusterEvents::MakeCheckResultMessage(this, cr);
-			listener->SyncSendMessage(command_endpoint, message);
+
+			if (!ClusterEvents::SendBatched(command_endpoint, "event::CheckResults", message->Get("params")))
+				listener->SyncSendMessage(command_endpoint, message);
 		}
 
 		return Result::Ok;
@@ -151,11 +183,22 @@ Checkable::ProcessingResult Checkable::ProcessCheckResult(const CheckResult::Ptr
 	if (!IsActive())
 		return Result::CheckableInactive;
 
+	/* Checkables running the same check command mostly produce equal command lines (e.g. for
+	 * remote checks) and often equal performance data, last_check_result keeps them around. */
+	if (Configuration::InternCheckResults) {
+		cr->SetCommand(InternPool::Intern(cr->GetCommand()), true);
+		cr->SetPerformanceData(InternPool::Intern(cr->GetPerformanceData()), true);
+	}
+
 	bool reachable = IsReachable();
 	bool notification_reachable = IsReachable(DependencyNotification);
 
 	ObjectLock olock(this);
 
+	/* The state fields below are set one by one, but the change counter is bumped
+	 * and the state journal is updated for all of them at once. */
+	FieldUpdateBatch batch (this);
+
 	CheckResult::Ptr old_cr = GetLastCheckResult();
 	ServiceState old_state = GetStateRaw();
 	StateType old_stateType = GetStateType();
@@ -377,6 +420,7 @@ Checkable::ProcessingResult Checkable::ProcessCheckResult(const CheckResult::Ptr
 		SetNextCheck(Utility::GetTime() + offset, false, origin);
 	}
 
+	batch.Commit();
 	olock.Unlock();
 
 #ifdef I2_DEBUG /* I2_DEBUG */
@@ -583,6 +627,9 @@ void Checkable::ExecuteCheck()
 	cr->SetScheduleStart(scheduled_start);
 	cr->SetExecutionStart(before_check);
 
+	CheckLatency::Record(CheckLatencyScheduling, before_check - scheduled_start);
+	CheckLatency::StartTrace(GetName(), cr);
+
 	Endpoint::Ptr endpoint = GetCommandEndpoint();
 	bool local = !endpoint || endpoint == Endpoint::GetLocalEndpoint();
 
@@ -622,7 +669,7 @@ void Checkable::ExecuteCheck()
 
 			ApiListener::Ptr listener = ApiListener::GetInstance();
 
-			if (listener)
+			if (listener && !ClusterEvents::SendBatched(endpoint, "event::ExecuteCommands", params))
 				listener->SyncSendMessage(endpoint, message);
 
 			/* Re-schedule the check so we don't run it again until after we've received
@@ -661,6 +708,44 @@ void Checkable::ExecuteCheck()
 	}
 }
 
+/* A checkable usually runs its check command and an event command, but notifications add one command line per user. */
+static const size_t l_CommandLineCacheSize = 8;
+
+/**
+ * Looks up a command line resolved by PluginUtility::ExecuteCommand().
+ *
+ * @param key The modified attributes counters of the command and all objects its macros were resolved from.
+ * @returns Whether a command line has been cached for the key.
+ */
+bool Checkable::GetCachedCommandLine(const std::vector<uint_fast64_t>& key, Value& commandLine, Dictionary::Ptr& env)
+{
+	std::unique_lock<std::mutex> lock (m_CommandLineCacheMutex);
+
+	for (auto& entry : m_CommandLineCache) {
+		if (entry.Key == key) {
+			commandLine = entry.CommandLine;
+			env = entry.Env;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Caches a resolved command line, the oldest one is dropped if there are too many.
+ * Entries whose key is out of date are never matched again and end up being dropped that way.
+ */
+void Checkable::SetCachedCommandLine(std::vector<uint_fast64_t> key, const Value& commandLine, const Dictionary::Ptr& env)
+{
+	std::unique_lock<std::mutex> lock (m_CommandLineCacheMutex);
+
+	if (m_CommandLineCache.size() >= l_CommandLineCacheSize)
+		m_CommandLineCache.erase(m_CommandLineCache.begin());
+
+	m_CommandLineCache.push_back({ std::move(key), commandLine, env });
+}
+
 void Checkable::UpdateStatistics(const CheckResult::Ptr& cr, CheckableType type)
 {
 	time_t ts = cr->GetScheduleEnd();
@@ -707,3 +792,130 @@ void Checkable::AquirePendingCheckSlot(int maxPendingChecks)
 
 	m_PendingChecks++;
 }
+
+/**
+ * Reserves a pending check slot unless maxPendingChecks slots are already in use.
+ *
+ * @returns Whether a slot has been reserved
+ */
+bool Checkable::TryAquirePendingCheckSlot(int maxPendingChecks)
+{
+	std::unique_lock<std::mutex> lock(m_StatsMutex);
+
+	if (m_PendingChecks >= maxPendingChecks)
+		return false;
+
+	m_PendingChecks++;
+	return true;
+}
+
+/**
+ * Enables (window > 0) or disables (window = 0) check load smoothing.
+ *
+ * @param window Maximum number of seconds a planned check may be moved by
+ */
+void Checkable::SetLoadSmoothingWindow(double window)
+{
+	std::unique_lock<std::mutex> lock(l_PlannedChecksMutex);
+
+	/* Cover the longest interval which is still smoothed, see SmoothNextCheck(). */
+	l_PlannedChecks.assign(window > 0 ? 3600 : 0, PlannedChecksSlot());
+	l_LoadSmoothingWindow.store(window);
+}
+
+double Checkable::GetLoadSmoothingWindow()
+{
+	return l_LoadSmoothingWindow.load();
+}
+
+/**
+ * @returns The number of checks planned for each of the next seconds
+ */
+std::vector<unsigned> Checkable::GetPlannedChecks(size_t seconds)
+{
+	std::unique_lock<std::mutex> lock(l_PlannedChecksMutex);
+	std::vector<unsigned> result;
+
+	if (l_PlannedChecks.empty())
+		return result;
+
+	auto now ((int64_t)Utility::GetTime());
+
+	seconds = std::min(seconds, l_PlannedChecks.size());
+	result.reserve(seconds);
+
+	for (size_t i = 0; i < seconds; i++) {
+		auto& slot (l_PlannedChecks[(now + i) % l_PlannedChecks.size()]);
+
+		result.emplace_back(slot.Second == now + (int64_t)i ? slot.Checks : 0u);
+	}
+
+	return result;
+}
+
+/**
+ * Moves a planned check into the least busy second within the load smoothing window
+ * (bounded by a quarter of the interval) to flatten bursts of checks with the same interval.
+ *
+ * @param oldNextCheck The previously planned check which is going to be replaced
+ * @param nextCheck The newly planned check
+ * @param interval The check interval
+ *
+ * @returns The adjusted next check (unchanged if load smoothing is disabled)
+ */
+double Checkable::SmoothNextCheck(double oldNextCheck, double nextCheck, double interval)
+{
+	double window = std::min(l_LoadSmoothingWindow.load(), interval / 4);
+
+	if (window < 1)
+		return nextCheck;
+
+	std::unique_lock<std::mutex> lock(l_PlannedChecksMutex);
+
+	auto size ((int64_t)l_PlannedChecks.size());
+	auto now ((int64_t)Utility::GetTime());
+	auto planned ((int64_t)std::floor(nextCheck));
+
+	if (!size || planned + (int64_t)window >= now + size)
+		return nextCheck;
+
+	auto getSlot ([size](int64_t second) -> PlannedChecksSlot& {
+		auto& slot (l_PlannedChecks[second % size]);
+
+		if (slot.Second != second) {
+			slot.Second = second;
+			slot.Checks = 0;
+		}
+
+		return slot;
+	});
+
+	if (oldNextCheck > now && oldNextCheck < now + size) {
+		auto& slot (getSlot((int64_t)std::floor(oldNextCheck)));
+
+		if (slot.Checks)
+			slot.Checks--;
+	}
+
+	int64_t best = planned;
+	unsigned bestChecks = getSlot(planned).Checks;
+
+	/* Prefer the nearest second among the least busy ones. */
+	for (int64_t distance = 1; distance <= (int64_t)window && bestChecks; distance++) {
+		for (int64_t second : { planned - distance, planned + distance }) {
+			if (second <= now)
+				continue;
+
+			unsigned checks = getSlot(second).Checks;
+
+			if (checks < bestChecks) {
+				best = second;
+				bestChecks = checks;
+			}
+		}
+	}
+
+	getSlot(best).Checks++;
+
+	return nextCheck + (best - planned);
+}
@@ -1,22 +1,37 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "icinga/service.hpp"
+#include "icinga/cib.hpp"
 #include "icinga/dependency.hpp"
+#include "icinga/checkablegraph.hpp"
 #include "base/logger.hpp"
 #include <unordered_map>
+#include <unordered_set>
 
 using namespace icinga;
 
+Atomic<uint_fast64_t> Checkable::ReachabilityCacheHits (0);
+Atomic<uint_fast64_t> Checkable::ReachabilityCacheMisses (0);
+Atomic<uint_fast64_t> Checkable::ReachabilityCacheInvalidations (0);
+
 void Checkable::AddDependency(const Dependency::Ptr& dep)
 {
-	std::unique_lock<std::mutex> lock(m_DependencyMutex);
-	m_Dependencies.insert(dep);
+	{
+		std::unique_lock<std::mutex> lock(m_DependencyMutex);
+		m_Dependencies.insert(dep);
+	}
+
+	InvalidateReachability();
 }
 
 void Checkable::RemoveDependency(const Dependency::Ptr& dep)
 {
-	std::unique_lock<std::mutex> lock(m_DependencyMutex);
-	m_Dependencies.erase(dep);
+	{
+		std::unique_lock<std::mutex> lock(m_DependencyMutex);
+		m_Dependencies.erase(dep);
+	}
+
+	InvalidateReachability();
 }
 
 std::vector<Dependency::Ptr> Checkable::GetDependencies() const
@@ -27,14 +42,22 @@ std::vector<Dependency::Ptr> Checkable::GetDependencies() const
 
 void Checkable::AddReverseDependency(const Dependency::Ptr& dep)
 {
-	std::unique_lock<std::mutex> lock(m_DependencyMutex);
-	m_ReverseDependencies.insert(dep);
+	{
+		std::unique_lock<std::mutex> lock(m_DependencyMutex);
+		m_ReverseDependencies.insert(dep);
+	}
+
+	CheckableGraph::Invalidate();
 }
 
 void Checkable::RemoveReverseDependency(const Dependency::Ptr& dep)
 {
-	std::unique_lock<std::mutex> lock(m_DependencyMutex);
-	m_ReverseDependencies.erase(dep);
+	{
+		std::unique_lock<std::mutex> lock(m_DependencyMutex);
+		m_ReverseDependencies.erase(dep);
+	}
+
+	CheckableGraph::Invalidate();
 }
 
 std::vector<Dependency::Ptr> Checkable::GetReverseDependencies() const
@@ -44,6 +67,67 @@ std::vector<Dependency::Ptr> Checkable::GetReverseDependencies() const
 }
 
 bool Checkable::IsReachable(DependencyType dt, Dependency::Ptr *failedDependency, int rstack) const
+{
+	bool cacheable = true;
+
+	return IsReachableCached(dt, failedDependency, rstack, cacheable);
+}
+
+/**
+ * Like IsReachable(), but answers from and updates the reachability cache.
+ *
+ * @param cacheable Set to false if the result depends on something the cache
+ *                  isn't invalidated for, e.g. the time periods of dependencies
+ */
+bool Checkable::IsReachableCached(DependencyType dt, Dependency::Ptr *failedDependency, int rstack, bool& cacheable) const
+{
+	uint_fast64_t version;
+
+	{
+		std::unique_lock<std::mutex> lock (m_ReachabilityMutex);
+		auto& entry (m_ReachabilityCache[dt]);
+
+		if (entry.Valid) {
+			if (failedDependency)
+				*failedDependency = entry.FailedDependency;
+
+			lock.unlock();
+			ReachabilityCacheHits.fetch_add(1);
+
+			return entry.Reachable;
+		}
+
+		version = m_ReachabilityVersion;
+	}
+
+	ReachabilityCacheMisses.fetch_add(1);
+
+	Dependency::Ptr failed;
+	bool ownCacheable = true;
+	bool reachable = IsReachableUncached(dt, &failed, rstack, ownCacheable);
+
+	if (failedDependency)
+		*failedDependency = failed;
+
+	if (ownCacheable) {
+		std::unique_lock<std::mutex> lock (m_ReachabilityMutex);
+
+		/* Don't store the result if something has changed while we've computed it. */
+		if (m_ReachabilityVersion == version) {
+			auto& entry (m_ReachabilityCache[dt]);
+
+			entry.Valid = true;
+			entry.Reachable = reachable;
+			entry.FailedDependency = failed;
+		}
+	} else {
+		cacheable = false;
+	}
+
+	return reachable;
+}
+
+bool Checkable::IsReachableUncached(DependencyType dt, Dependency::Ptr *failedDependency, int rstack, bool& cacheable) const
 {
 	/* Anything greater than 256 causes recursion bus errors. */
 	int limit = 256;
@@ -52,11 +136,12 @@ bool Checkable::IsReachable(DependencyType dt, Dependency::Ptr *failedDependency
 		Log(LogWarning, "Checkable")
 			<< "Too many nested dependencies (>" << limit << ") for checkable '" << GetName() << "': Dependency failed.";
 
+		cacheable = false;
 		return false;
 	}
 
 	for (const Checkable::Ptr& checkable : GetParents()) {
-		if (!checkable->IsReachable(dt, failedDependency, rstack + 1))
+		if (!checkable->IsReachableCached(dt, failedDependency, rstack + 1, cacheable))
 			return false;
 	}
 
@@ -80,6 +165,10 @@ bool Checkable::IsReachable(DependencyType dt, Dependency::Ptr *failedDependency
 	for (const Dependency::Ptr& dep : deps) {
 		std::string redundancy_group = dep->GetRedundancyGroup();
 
+		/* Time passing isn't a reason to invalidate the cache. */
+		if (dep->GetPeriod())
+			cacheable = false;
+
 		if (!dep->IsAvailable(dt)) {
 			if (redundancy_group.empty()) {
 				Log(LogDebug, "Checkable")
@@ -117,6 +206,103 @@ bool Checkable::IsReachable(DependencyType dt, Dependency::Ptr *failedDependency
 	return true;
 }
 
+/**
+ * Resets the cached reachability of this checkable and everything depending on it,
+ * i.e. its children (recursively) and for hosts their services.
+ *
+ * Must be called after anything IsReachable() depends on has changed.
+ */
+void Checkable::InvalidateReachability()
+{
+	std::vector<Checkable::Ptr> pending ({ this });
+	std::unordered_set<Checkable*> seen;
+
+	while (!pending.empty()) {
+		Checkable::Ptr checkable = std::move(pending.back());
+		pending.pop_back();
+
+		if (!seen.emplace(checkable.get()).second)
+			continue;
+
+		{
+			std::unique_lock<std::mutex> lock (checkable->m_ReachabilityMutex);
+
+			checkable->m_ReachabilityVersion++;
+
+			for (auto& entry : checkable->m_ReachabilityCache) {
+				entry.Valid = false;
+				entry.FailedDependency = nullptr;
+			}
+		}
+
+		ReachabilityCacheInvalidations.fetch_add(1);
+
+		/* The statistics count unreachable, handled and problem checkables. */
+		CIB::InvalidateStatistics(checkable.get());
+
+		for (auto& child : checkable->GetChildren())
+			pending.emplace_back(child);
+
+		auto host (dynamic_cast<Host*>(checkable.get()));
+
+		if (host) {
+			for (auto& service : host->GetServices())
+				pending.emplace_back(service);
+		}
+	}
+}
+
+/* Dependencies only look at the state, the state type and whether there is a check result at all. */
+
+void Checkable::SetStateRaw(const ServiceState& value, bool suppress_events, const Value& cookie)
+{
+	bool changed = value != GetStateRaw();
+
+	ObjectImpl<Checkable>::SetStateRaw(value, suppress_events, cookie);
+
+	if (changed) {
+		InvalidateStateSnapshot();
+		InvalidateReachability();
+	}
+}
+
+void Checkable::SetStateType(const StateType& value, bool suppress_events, const Value& cookie)
+{
+	bool changed = value != GetStateType();
+
+	ObjectImpl<Checkable>::SetStateType(value, suppress_events, cookie);
+
+	if (changed) {
+		InvalidateStateSnapshot();
+		InvalidateReachability();
+	}
+}
+
+void Checkable::SetLastCheckResult(const CheckResult::Ptr& value, bool suppress_events, const Value& cookie)
+{
+	CheckResult::Ptr oldValue = GetLastCheckResult();
+	bool changed = !value != !oldValue;
+
+	ObjectImpl<Checkable>::SetLastCheckResult(value, suppress_events, cookie);
+
+	if (value != oldValue)
+		InvalidateStateSnapshot();
+
+	if (changed) {
+		InvalidateReachability();
+	} else if (value && IsStateOK(value->GetState()) != IsStateOK(oldValue->GetState())) {
+		/* GetProblem() looks at the check result's state, the state of services' hosts affects GetHandled(). */
+		CIB::InvalidateStatistics(this);
+
+		auto host (dynamic_cast<Host*>(this));
+
+		if (host) {
+			for (auto& service : host->GetServices())
+				CIB::InvalidateStatistics(service.get());
+		}
+	}
+}
+
 std::set<Checkable::Ptr> Checkable::GetParents() const
 {
 	std::set<Checkable::Ptr> parents;
@@ -147,30 +333,17 @@ std::set<Checkable::Ptr> Checkable::GetChildren() const
 
 std::set<Checkable::Ptr> Checkable::GetAllChildren() const
 {
-	std::set<Checkable::Ptr> children = GetChildren();
+	std::set<Checkable::Ptr> children;
 
-	GetAllChildrenInternal(children, 0);
+	VisitAllChildren([&children](const Checkable::Ptr& child) { children.insert(child); });
 
 	return children;
 }
 
-void Checkable::GetAllChildrenInternal(std::set<Checkable::Ptr>& children, int level) const
+/**
+ * Calls visitor for every direct or indirect child exactly once. Cheaper than GetAllChildren().
+ */
+void Checkable::VisitAllChildren(const std::function<void (const Checkable::Ptr&)>& visitor) const
 {
-	if (level > 32)
-		return;
-
-	std::set<Checkable::Ptr> localChildren;
-
-	for (const Checkable::Ptr& checkable : children) {
-		std::set<Checkable::Ptr> cChildren = checkable->GetChildren();
-
-		if (!cChildren.empty()) {
-			GetAllChildrenInternal(cChildren, level + 1);
-			localChildren.insert(cChildren.begin(), cChildren.end());
-		}
-
-		localChildren.insert(checkable);
-	}
-
-	children.insert(localChildren.begin(), localChildren.end());
+	CheckableGraph::VisitAllChildren(const_cast<Checkable*>(this), visitor);
 }
@@ -1,11 +1,13 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "icinga/service.hpp"
+#include "icinga/cib.hpp"
 #include "base/configtype.hpp"
 #include "base/objectlock.hpp"
 #include "base/logger.hpp"
 #include "base/utility.hpp"
 #include "base/convert.hpp"
+#include <limits>
 
 using namespace icinga;
 
@@ -25,23 +27,36 @@ void Checkable::TriggerDowntimes(double triggerTime)
 
 bool Checkable::IsInDowntime() const
 {
-	for (const Downtime::Ptr& downtime : GetDowntimes()) {
-		if (downtime->IsInEffect())
-			return true;
-	}
-
-	return false;
+	return GetDowntimeDepth() > 0;
 }
 
+/**
+ * Counts the downtimes in effect. The result is kept until the next start or end of one of them
+ * (or until one is added, removed or modified), so checkables with lots of downtimes don't
+ * evaluate all of them for every state change and notification.
+ *
+ * @returns The number of downtimes in effect.
+ */
 int Checkable::GetDowntimeDepth() const
 {
+	double now = Utility::GetTime();
+
+	std::unique_lock<std::mutex> lock(m_DowntimeMutex);
+
+	if (now < m_DowntimeDepthValidUntil)
+		return m_DowntimeDepth;
+
 	int downtime_depth = 0;
+	double nextTransition = std::numeric_limits<double>::infinity();
 
-	for (const Downtime::Ptr& downtime : GetDowntimes()) {
-		if (downtime->IsInEffect())
+	for (const Downtime::Ptr& downtime : m_Downtimes) {
+		if (downtime->IsInEffect(now, &nextTransition))
 			downtime_depth++;
 	}
 
+	m_DowntimeDepth = downtime_depth;
+	m_DowntimeDepthValidUntil = nextTransition;
+
 	return downtime_depth;
 }
 
@@ -55,10 +70,30 @@ void Checkable::RegisterDowntime(const Downtime::Ptr& downtime)
 {
 	std::unique_lock<std::mutex> lock(m_DowntimeMutex);
 	m_Downtimes.insert(downtime);
+	m_DowntimeDepthValidUntil = 0;
+	lock.unlock();
+
+	CIB::InvalidateStatistics(this);
 }
 
 void Checkable::UnregisterDowntime(const Downtime::Ptr& downtime)
 {
 	std::unique_lock<std::mutex> lock(m_DowntimeMutex);
 	m_Downtimes.erase(downtime);
+	m_DowntimeDepthValidUntil = 0;
+	lock.unlock();
+
+	CIB::InvalidateStatistics(this);
+}
+
+/**
+ * Makes GetDowntimeDepth() count the downtimes again, e.g. after one has been triggered.
+ */
+void Checkable::InvalidateDowntimeDepth()
+{
+	std::unique_lock<std::mutex> lock(m_DowntimeMutex);
+	m_DowntimeDepthValidUntil = 0;
+	lock.unlock();
+
+	CIB::InvalidateStatistics(this);
 }
@@ -10,7 +10,7 @@
 
 using namespace icinga;
 
-boost::signals2::signal<void (const Checkable::Ptr&)> Checkable::OnEventCommandExecuted;
+Signal<void (const Checkable::Ptr&)> Checkable::OnEventCommandExecuted;
 
 EventCommand::Ptr Checkable::GetEventCommand() const
 {
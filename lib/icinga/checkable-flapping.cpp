@@ -1,6 +1,7 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "icinga/checkable.hpp"
+#include "icinga/cib.hpp"
 #include "icinga/icingaapplication.hpp"
 #include "base/utility.hpp"
 
@@ -97,6 +98,30 @@ bool Checkable::IsFlapping() const
 		return GetFlapping();
 }
 
+void Checkable::SetFlapping(const bool& value, bool suppress_events, const Value& cookie)
+{
+	bool changed = value != GetFlapping();
+
+	ObjectImpl<Checkable>::SetFlapping(value, suppress_events, cookie);
+
+	if (changed) {
+		InvalidateStateSnapshot();
+		CIB::InvalidateStatistics(this);
+	}
+}
+
+void Checkable::SetEnableFlapping(const bool& value, bool suppress_events, const Value& cookie)
+{
+	bool changed = value != GetEnableFlapping();
+
+	ObjectImpl<Checkable>::SetEnableFlapping(value, suppress_events, cookie);
+
+	if (changed) {
+		InvalidateStateSnapshot();
+		CIB::InvalidateStatistics(this);
+	}
+}
+
 int Checkable::ServiceStateToFlappingFilter(ServiceState state)
 {
 	switch (state) {
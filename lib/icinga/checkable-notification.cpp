@@ -244,11 +244,11 @@ void Checkable::FireSuppressedNotifications()
  */
 void Checkable::FireSuppressedNotificationsTimer(const Timer * const&)
 {
-	for (auto& host : ConfigType::GetObjectsByType<Host>()) {
+	for (Host *host : ConfigType::GetObjectSnapshot<Host>()) {
 		host->FireSuppressedNotifications();
 	}
 
-	for (auto& service : ConfigType::GetObjectsByType<Service>()) {
+	for (Service *service : ConfigType::GetObjectSnapshot<Service>()) {
 		service->FireSuppressedNotifications();
 	}
 }
@@ -2,8 +2,11 @@
 
 #include "icinga/checkable.hpp"
 #include "icinga/checkable-ti.cpp"
+#include "icinga/cib.hpp"
 #include "icinga/host.hpp"
 #include "icinga/service.hpp"
+#include "icinga/checkablegraph.hpp"
+#include "icinga/icingaapplication.hpp"
 #include "base/objectlock.hpp"
 #include "base/utility.hpp"
 #include "base/exception.hpp"
@@ -26,7 +29,7 @@ const std::map<String, int> Checkable::m_FlappingStateFilterMap ({
 
 boost::signals2::signal<void (const Checkable::Ptr&, const String&, const String&, AcknowledgementType, bool, bool, double, double, const MessageOrigin::Ptr&)> Checkable::OnAcknowledgementSet;
 boost::signals2::signal<void (const Checkable::Ptr&, const String&, double, const MessageOrigin::Ptr&)> Checkable::OnAcknowledgementCleared;
-boost::signals2::signal<void (const Checkable::Ptr&, double)> Checkable::OnFlappingChange;
+Signal<void (const Checkable::Ptr&, double)> Checkable::OnFlappingChange;
 
 static Timer::Ptr l_CheckablesFireSuppressedNotifications;
 static Timer::Ptr l_CleanDeadlinedExecutions;
@@ -93,11 +96,14 @@ void Checkable::Start(bool runtimeCreated)
 	if (GetNextCheck() < now + 60) {
 		double delta = std::min(GetCheckInterval(), 60.0);
 		delta *= (double)std::rand() / RAND_MAX;
-		SetNextCheck(now + delta);
+		SetNextCheck(SmoothNextCheck(GetNextCheck(), now + delta, GetCheckInterval()));
 	}
 
 	ObjectImpl<Checkable>::Start(runtimeCreated);
 
+	CheckableGraph::Register(this);
+	CIB::InvalidateStatistics(this);
+
 	static boost::once_flag once = BOOST_ONCE_INIT;
 
 	boost::call_once(once, []() {
@@ -113,6 +119,15 @@ void Checkable::Start(bool runtimeCreated)
 	});
 }
 
+void Checkable::Stop(bool runtimeRemoved)
+{
+	CheckableGraph::Unregister(this);
+
+	ObjectImpl<Checkable>::Stop(runtimeRemoved);
+
+	CIB::InvalidateStatistics(this);
+}
+
 void Checkable::AddGroup(const String& name)
 {
 	std::unique_lock<std::mutex> lock(m_CheckableMutex);
@@ -150,11 +165,120 @@ AcknowledgementType Checkable::GetAcknowledgement()
 	return avalue;
 }
 
+void Checkable::SetAcknowledgementRaw(const int& value, bool suppress_events, const Value& cookie)
+{
+	bool changed = value != GetAcknowledgementRaw();
+
+	ObjectImpl<Checkable>::SetAcknowledgementRaw(value, suppress_events, cookie);
+
+	if (changed) {
+		InvalidateStateSnapshot();
+		CIB::InvalidateStatistics(this);
+	}
+}
+
+void Checkable::SetAcknowledgementExpiry(const Timestamp& value, bool suppress_events, const Value& cookie)
+{
+	bool changed = value != GetAcknowledgementExpiry();
+
+	ObjectImpl<Checkable>::SetAcknowledgementExpiry(value, suppress_events, cookie);
+
+	if (changed) {
+		InvalidateStateSnapshot();
+		CIB::InvalidateStatistics(this);
+	}
+}
+
 bool Checkable::IsAcknowledged() const
 {
 	return const_cast<Checkable *>(this)->GetAcknowledgement() != AcknowledgementNone;
 }
 
+/**
+ * Returns the state fields as they were after one of the changes of this checkable, without locking it.
+ *
+ * The snapshot is taken again only if the checkable changed since then. While a batch of field updates
+ * (see ProcessCheckResult()) is in progress or if the checkable changes while it's being taken, the
+ * previous snapshot is returned. Readers keep a snapshot as long as they need it, it's freed afterwards.
+ */
+Shared<CheckableStateSnapshot>::Ptr Checkable::GetStateSnapshot() const
+{
+	auto snapshot (m_StateSnapshot.load());
+
+	if (snapshot && snapshot->ChangeCounter == GetChangeCounter() && snapshot->Generation == m_StateSnapshotGeneration.load())
+		return snapshot;
+
+	for (int attempt = 0; attempt < 3 && !HasFieldUpdateBatch(); attempt++) {
+		auto fresh (TakeStateSnapshot());
+
+		if (!HasFieldUpdateBatch() && fresh->ChangeCounter == GetChangeCounter() && fresh->Generation == m_StateSnapshotGeneration.load()) {
+			m_StateSnapshot.store(fresh);
+			return fresh;
+		}
+	}
+
+	if (snapshot)
+		return snapshot;
+
+	/* There's none yet, so wait for the current writer. */
+	ObjectLock olock (this);
+
+	snapshot = TakeStateSnapshot();
+	m_StateSnapshot.store(snapshot);
+
+	return snapshot;
+}
+
+Shared<CheckableStateSnapshot>::Ptr Checkable::TakeStateSnapshot() const
+{
+	auto snapshot (Shared<CheckableStateSnapshot>::Make());
+
+	snapshot->ChangeCounter = GetChangeCounter();
+	snapshot->Generation = m_StateSnapshotGeneration.load();
+
+	snapshot->Active = IsActive();
+	snapshot->StateRaw = GetStateRaw();
+	snapshot->Type = GetStateType();
+	snapshot->LastHardStateRaw = GetLastHardStateRaw();
+	snapshot->CheckAttempt = GetCheckAttempt();
+	snapshot->LastCheckResult = GetLastCheckResult();
+	snapshot->Problem = snapshot->LastCheckResult && !IsStateOK(snapshot->LastCheckResult->GetState());
+	snapshot->LastStateChange = GetLastStateChange();
+	snapshot->LastHardStateChange = GetLastHardStateChange();
+	snapshot->Acknowledgement = static_cast<AcknowledgementType>(GetAcknowledgementRaw());
+	snapshot->AcknowledgementExpiry = GetAcknowledgementExpiry();
+	snapshot->EnableFlapping = GetEnableFlapping();
+	snapshot->Flapping = GetFlapping();
+
+	return snapshot;
+}
+
+/**
+ * Makes GetStateSnapshot() take a new snapshot after a state field changed without bumping the change counter.
+ */
+void Checkable::InvalidateStateSnapshot()
+{
+	m_StateSnapshotGeneration.fetch_add(1);
+}
+
+bool CheckableStateSnapshot::HasBeenChecked() const
+{
+	return LastCheckResult != nullptr;
+}
+
+/**
+ * Like Checkable::IsAcknowledged(), but doesn't clear an expired acknowledgement.
+ */
+bool CheckableStateSnapshot::IsAcknowledged() const
+{
+	return Acknowledgement != AcknowledgementNone && (AcknowledgementExpiry == 0 || AcknowledgementExpiry >= Utility::GetTime());
+}
+
+bool CheckableStateSnapshot::IsFlapping() const
+{
+	return EnableFlapping && IcingaApplication::GetInstance()->GetEnableFlapping() && Flapping;
+}
+
 void Checkable::AcknowledgeProblem(const String& author, const String& comment, AcknowledgementType type, bool notify, bool persistent, double changeTime, double expiry, const MessageOrigin::Ptr& origin)
 {
 	SetAcknowledgementRaw(type);
@@ -296,7 +420,7 @@ void Checkable::CleanDeadlinedExecutions(const Timer * const&)
 	Dictionary::Ptr executions;
 	Dictionary::Ptr execution;
 
-	for (auto& host : ConfigType::GetObjectsByType<Host>()) {
+	for (Host *host : ConfigType::GetObjectSnapshot<Host>()) {
 		executions = host->GetExecutions();
 		if (executions) {
 			for (const String& key : executions->GetKeys()) {
@@ -308,7 +432,7 @@ void Checkable::CleanDeadlinedExecutions(const Timer * const&)
 		}
 	}
 
-	for (auto& service : ConfigType::GetObjectsByType<Service>()) {
+	for (Service *service : ConfigType::GetObjectSnapshot<Service>()) {
 		executions = service->GetExecutions();
 		if (executions) {
 			for (const String& key : executions->GetKeys()) {
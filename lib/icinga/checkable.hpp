@@ -4,8 +4,10 @@
 #define CHECKABLE_H
 
 #include "base/atomic.hpp"
+#include "base/shared.hpp"
 #include "base/timer.hpp"
 #include "base/process.hpp"
+#include "base/signal.hpp"
 #include "icinga/i2-icinga.hpp"
 #include "icinga/checkable-ti.hpp"
 #include "icinga/timeperiod.hpp"
@@ -14,10 +16,12 @@
 #include "icinga/downtime.hpp"
 #include "remote/endpoint.hpp"
 #include "remote/messageorigin.hpp"
+#include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <functional>
 #include <limits>
+#include <vector>
 
 namespace icinga
 {
@@ -58,6 +62,35 @@ class CheckCommand;
 class EventCommand;
 class Dependency;
 
+/**
+ * The state fields of a checkable as of one of its changes, see Checkable::GetStateSnapshot().
+ *
+ * @ingroup icinga
+ */
+struct CheckableStateSnapshot
+{
+	uint_fast64_t ChangeCounter;
+	uint_fast64_t Generation;
+
+	bool Active;
+	ServiceState StateRaw;
+	StateType Type;
+	ServiceState LastHardStateRaw;
+	int CheckAttempt;
+	CheckResult::Ptr LastCheckResult;
+	bool Problem;
+	double LastStateChange;
+	double LastHardStateChange;
+	AcknowledgementType Acknowledgement;
+	double AcknowledgementExpiry;
+	bool EnableFlapping;
+	bool Flapping;
+
+	bool HasBeenChecked() const;
+	bool IsAcknowledged() const;
+	bool IsFlapping() const;
+};
+
 /**
  * An Icinga service.
  *
@@ -77,13 +110,25 @@ public:
 	std::set<Checkable::Ptr> GetParents() const;
 	std::set<Checkable::Ptr> GetChildren() const;
 	std::set<Checkable::Ptr> GetAllChildren() const;
+	void VisitAllChildren(const std::function<void (const Checkable::Ptr&)>& visitor) const;
 
 	void AddGroup(const String& name);
 
 	bool IsReachable(DependencyType dt = DependencyState, intrusive_ptr<Dependency> *failedDependency = nullptr, int rstack = 0) const;
+	void InvalidateReachability();
+
+	void SetStateRaw(const ServiceState& value, bool suppress_events = false, const Value& cookie = Empty) override;
+	void SetStateType(const StateType& value, bool suppress_events = false, const Value& cookie = Empty) override;
+	void SetLastCheckResult(const CheckResult::Ptr& value, bool suppress_events = false, const Value& cookie = Empty) override;
+
+	void SetAcknowledgementRaw(const int& value, bool suppress_events = false, const Value& cookie = Empty) override;
+	void SetAcknowledgementExpiry(const Timestamp& value, bool suppress_events = false, const Value& cookie = Empty) override;
+	void SetEnableFlapping(const bool& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
 	AcknowledgementType GetAcknowledgement();
 
+	Shared<CheckableStateSnapshot>::Ptr GetStateSnapshot() const;
+
 	void AcknowledgeProblem(const String& author, const String& comment, AcknowledgementType type, bool notify = true, bool persistent = false, double changeTime = Utility::GetTime(), double expiry = 0, const MessageOrigin::Ptr& origin = nullptr);
 	void ClearAcknowledgement(const String& removedBy, double changeTime = Utility::GetTime(), const MessageOrigin::Ptr& origin = nullptr);
 
@@ -123,9 +168,9 @@ public:
 
 	Endpoint::Ptr GetCommandEndpoint() const;
 
-	static boost::signals2::signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, const MessageOrigin::Ptr&)> OnNewCheckResult;
-	static boost::signals2::signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, StateType, const MessageOrigin::Ptr&)> OnStateChange;
-	static boost::signals2::signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, std::set<Checkable::Ptr>, const MessageOrigin::Ptr&)> OnReachabilityChanged;
+	static Signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, const MessageOrigin::Ptr&)> OnNewCheckResult;
+	static Signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, StateType, const MessageOrigin::Ptr&)> OnStateChange;
+	static Signal<void (const Checkable::Ptr&, const CheckResult::Ptr&, std::set<Checkable::Ptr>, const MessageOrigin::Ptr&)> OnReachabilityChanged;
 	static boost::signals2::signal<void (const Checkable::Ptr&, NotificationType, const CheckResult::Ptr&,
 		const String&, const String&, const MessageOrigin::Ptr&)> OnNotificationsRequested;
 	static boost::signals2::signal<void (const Notification::Ptr&, const Checkable::Ptr&, const User::Ptr&,
@@ -137,12 +182,16 @@ public:
 	static boost::signals2::signal<void (const Checkable::Ptr&, const String&, const String&, AcknowledgementType,
 		bool, bool, double, double, const MessageOrigin::Ptr&)> OnAcknowledgementSet;
 	static boost::signals2::signal<void (const Checkable::Ptr&, const String&, double, const MessageOrigin::Ptr&)> OnAcknowledgementCleared;
-	static boost::signals2::signal<void (const Checkable::Ptr&, double)> OnFlappingChange;
-	static boost::signals2::signal<void (const Checkable::Ptr&)> OnNextCheckUpdated;
-	static boost::signals2::signal<void (const Checkable::Ptr&)> OnEventCommandExecuted;
+	static Signal<void (const Checkable::Ptr&, double)> OnFlappingChange;
+	static Signal<void (const Checkable::Ptr&)> OnNextCheckUpdated;
+	static Signal<void (const Checkable::Ptr&)> OnEventCommandExecuted;
 
 	static Atomic<uint_fast64_t> CurrentConcurrentChecks;
 
+	static Atomic<uint_fast64_t> ReachabilityCacheHits;
+	static Atomic<uint_fast64_t> ReachabilityCacheMisses;
+	static Atomic<uint_fast64_t> ReachabilityCacheInvalidations;
+
 	/* Downtimes */
 	int GetDowntimeDepth() const final;
 
@@ -154,6 +203,7 @@ public:
 	std::set<Downtime::Ptr> GetDowntimes() const;
 	void RegisterDowntime(const Downtime::Ptr& downtime);
 	void UnregisterDowntime(const Downtime::Ptr& downtime);
+	void InvalidateDowntimeDepth();
 
 	/* Comments */
 	void RemoveAllComments();
@@ -205,14 +255,25 @@ public:
 	static void DecreasePendingChecks();
 	static int GetPendingChecks();
 	static void AquirePendingCheckSlot(int maxPendingChecks);
+	static bool TryAquirePendingCheckSlot(int maxPendingChecks);
+
+	static void SetLoadSmoothingWindow(double window);
+	static double GetLoadSmoothingWindow();
+	static std::vector<unsigned> GetPlannedChecks(size_t seconds);
+
+	bool GetCachedCommandLine(const std::vector<uint_fast64_t>& key, Value& commandLine, Dictionary::Ptr& env);
+	void SetCachedCommandLine(std::vector<uint_fast64_t> key, const Value& commandLine, const Dictionary::Ptr& env);
 
 	static Object::Ptr GetPrototype();
 
 protected:
 	void Start(bool runtimeCreated) override;
+	void Stop(bool runtimeRemoved) override;
 	void OnConfigLoaded() override;
 	void OnAllConfigLoaded() override;
 
+	void SetFlapping(const bool& value, bool suppress_events = false, const Value& cookie = Empty) override;
+
 private:
 	mutable std::mutex m_CheckableMutex;
 	bool m_CheckRunning{false};
@@ -222,9 +283,13 @@ private:
 	static int m_PendingChecks;
 	static std::condition_variable m_PendingChecksCV;
 
+	static double SmoothNextCheck(double oldNextCheck, double nextCheck, double interval);
+
 	/* Downtimes */
 	std::set<Downtime::Ptr> m_Downtimes;
 	mutable std::mutex m_DowntimeMutex;
+	mutable int m_DowntimeDepth{0}; /**< Protected by m_DowntimeMutex */
+	mutable double m_DowntimeDepthValidUntil{0}; /**< The next start or end of a downtime, protected by m_DowntimeMutex */
 
 	static void NotifyFixedDowntimeStart(const Downtime::Ptr& downtime);
 	static void NotifyFlexibleDowntimeStart(const Downtime::Ptr& downtime);
@@ -248,7 +313,49 @@ private:
 	std::set<intrusive_ptr<Dependency> > m_Dependencies;
 	std::set<intrusive_ptr<Dependency> > m_ReverseDependencies;
 
-	void GetAllChildrenInternal(std::set<Checkable::Ptr>& children, int level = 0) const;
+	struct ReachabilityCacheEntry
+	{
+		bool Valid{false};
+		bool Reachable{true};
+		intrusive_ptr<Dependency> FailedDependency;
+	};
+
+	/* Reachability per DependencyType, reset by InvalidateReachability() */
+	mutable std::mutex m_ReachabilityMutex;
+	mutable ReachabilityCacheEntry m_ReachabilityCache[DependencyNotification + 1];
+	uint_fast64_t m_ReachabilityVersion{0};
+
+	bool IsReachableCached(DependencyType dt, intrusive_ptr<Dependency> *failedDependency, int rstack, bool& cacheable) const;
+	bool IsReachableUncached(DependencyType dt, intrusive_ptr<Dependency> *failedDependency, int rstack, bool& cacheable) const;
+
+	friend class CheckableGraph;
+	friend class CIB;
+
+	/* Dense index of this checkable in the CheckableGraph while it's active */
+	uint_fast32_t m_CheckableGraphIndex{std::numeric_limits<uint_fast32_t>::max()};
+
+	struct CommandLineCacheEntry
+	{
+		std::vector<uint_fast64_t> Key;
+		Value CommandLine;
+		Dictionary::Ptr Env;
+	};
+
+	/* Resolved command lines, see PluginUtility::ExecuteCommand() */
+	std::mutex m_CommandLineCacheMutex;
+	std::vector<CommandLineCacheEntry> m_CommandLineCache;
+
+	/* Host and service statistics, see CIB */
+	std::atomic<bool> m_StatsDirty{false};
+	uint_fast32_t m_StatsFlags{0}; /**< Protected by the CIB statistics mutex */
+	double m_StatsRecheckAt{0}; /**< Protected by the CIB statistics mutex */
+
+	/* The latest snapshot of the state fields, see GetStateSnapshot() */
+	mutable Locked<Shared<CheckableStateSnapshot>::Ptr> m_StateSnapshot;
+	std::atomic<uint_fast64_t> m_StateSnapshotGeneration{0};
+
+	Shared<CheckableStateSnapshot>::Ptr TakeStateSnapshot() const;
+	void InvalidateStateSnapshot();
 
 	/* Flapping */
 	static const std::map<String, int> m_FlappingStateFilterMap;
@@ -0,0 +1,181 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "icinga/checkablegraph.hpp"
+#include "icinga/dependency.hpp"
+#include <limits>
+#include <unordered_set>
+
+using namespace icinga;
+
+static const uint_fast32_t l_NoIndex = std::numeric_limits<uint_fast32_t>::max();
+
+std::mutex CheckableGraph::m_Mutex;
+std::vector<Checkable::Ptr> CheckableGraph::m_Nodes;
+std::vector<uint_fast32_t> CheckableGraph::m_FreeIndices;
+std::shared_ptr<CheckableGraph::Snapshot> CheckableGraph::m_Snapshot;
+
+/**
+ * Assigns the checkable a dense index. Called when it's activated.
+ */
+void CheckableGraph::Register(const Checkable::Ptr& checkable)
+{
+	std::unique_lock<std::mutex> lock (m_Mutex);
+
+	if (checkable->m_CheckableGraphIndex != l_NoIndex)
+		return;
+
+	if (m_FreeIndices.empty()) {
+		checkable->m_CheckableGraphIndex = m_Nodes.size();
+		m_Nodes.emplace_back(checkable);
+	} else {
+		checkable->m_CheckableGraphIndex = m_FreeIndices.back();
+		m_FreeIndices.pop_back();
+		m_Nodes[checkable->m_CheckableGraphIndex] = checkable;
+	}
+
+	m_Snapshot = nullptr;
+}
+
+/**
+ * Releases the checkable's index for reuse. Called when it's deactivated.
+ */
+void CheckableGraph::Unregister(const Checkable::Ptr& checkable)
+{
+	std::unique_lock<std::mutex> lock (m_Mutex);
+
+	auto index (checkable->m_CheckableGraphIndex);
+
+	if (index == l_NoIndex)
+		return;
+
+	m_Nodes[index] = nullptr;
+	m_FreeIndices.emplace_back(index);
+	checkable->m_CheckableGraphIndex = l_NoIndex;
+
+	m_Snapshot = nullptr;
+}
+
+/**
+ * Makes the next traversal rebuild the edges. Must be called whenever a dependency is added to or removed from a parent.
+ */
+void CheckableGraph::Invalidate()
+{
+	std::unique_lock<std::mutex> lock (m_Mutex);
+
+	m_Snapshot = nullptr;
+}
+
+/**
+ * Must be called with m_Mutex held.
+ */
+std::shared_ptr<CheckableGraph::Snapshot> CheckableGraph::BuildSnapshot()
+{
+	auto snapshot (std::make_shared<Snapshot>());
+
+	snapshot->Nodes = m_Nodes;
+	snapshot->Offsets.reserve(m_Nodes.size() + 1u);
+
+	for (auto& node : m_Nodes) {
+		snapshot->Offsets.emplace_back(snapshot->Targets.size());
+
+		if (!node)
+			continue;
+
+		for (auto& dep : node->GetReverseDependencies()) {
+			Checkable::Ptr child = dep->GetChild();
+
+			/* Not yet (or no longer) active children are left out. */
+			if (child && child != node && child->m_CheckableGraphIndex != l_NoIndex)
+				snapshot->Targets.emplace_back(child->m_CheckableGraphIndex);
+		}
+	}
+
+	snapshot->Offsets.emplace_back(snapshot->Targets.size());
+
+	return snapshot;
+}
+
+/**
+ * Calls visitor once for every direct or indirect child of root, in breadth-first order.
+ * root itself isn't visited.
+ */
+void CheckableGraph::VisitAllChildren(const Checkable::Ptr& root, const Visitor& visitor)
+{
+	/* Reused across calls, the bits of visited nodes are reset after each traversal. */
+	static thread_local std::vector<uint_least64_t> visited;
+	static thread_local std::vector<uint_fast32_t> queue;
+
+	std::shared_ptr<Snapshot> snapshot;
+	uint_fast32_t rootIndex;
+
+	{
+		std::unique_lock<std::mutex> lock (m_Mutex);
+
+		rootIndex = root->m_CheckableGraphIndex;
+
+		if (rootIndex != l_NoIndex) {
+			if (!m_Snapshot)
+				m_Snapshot = BuildSnapshot();
+
+			snapshot = m_Snapshot;
+		}
+	}
+
+	/* Inactive checkables, e.g. during config validation, take the slow path. */
+	if (!snapshot) {
+		VisitAllChildrenSlow(root, visitor);
+		return;
+	}
+
+	visited.resize((snapshot->Nodes.size() + 63u) / 64u);
+	queue.clear();
+
+	visited[rootIndex / 64u] |= uint_least64_t(1) << (rootIndex % 64u);
+	queue.emplace_back(rootIndex);
+
+	for (size_t i = 0; i < queue.size(); i++) {
+		auto node (queue[i]);
+		auto end (snapshot->Offsets[node + 1u]);
+
+		for (auto edge (snapshot->Offsets[node]); edge < end; edge++) {
+			auto child (snapshot->Targets[edge]);
+			auto& word (visited[child / 64u]);
+			auto bit (uint_least64_t(1) << (child % 64u));
+
+			if (!(word & bit)) {
+				word |= bit;
+				queue.emplace_back(child);
+			}
+		}
+	}
+
+	std::vector<Checkable::Ptr> children;
+	children.reserve(queue.size() - 1u);
+
+	for (auto node : queue) {
+		visited[node / 64u] = 0;
+
+		if (node != rootIndex)
+			children.emplace_back(snapshot->Nodes[node]);
+	}
+
+	/* The buffers above are free again, so the visitor may start traversals on its own. */
+	for (auto& child : children)
+		visitor(child);
+}
+
+void CheckableGraph::VisitAllChildrenSlow(const Checkable::Ptr& root, const Visitor& visitor)
+{
+	std::unordered_set<Checkable*> seen ({ root.get() });
+	std::vector<Checkable::Ptr> queue ({ root });
+
+	for (size_t i = 0; i < queue.size(); i++) {
+		for (auto& child : queue[i]->GetChildren()) {
+			if (seen.emplace(child.get()).second)
+				queue.emplace_back(child);
+		}
+	}
+
+	for (size_t i = 1; i < queue.size(); i++)
+		visitor(queue[i]);
+}
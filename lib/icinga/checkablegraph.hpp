@@ -0,0 +1,59 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef CHECKABLEGRAPH_H
+#define CHECKABLEGRAPH_H
+
+#include "icinga/i2-icinga.hpp"
+#include "icinga/checkable.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace icinga
+{
+
+/**
+ * A dense representation of the parent -> child edges of all active checkables.
+ *
+ * Every checkable gets a small integer index when it's activated. The edges are kept
+ * in compressed sparse row arrays which are rebuilt on the next traversal after
+ * a checkable or a dependency has been added or removed. Traversals mark visited
+ * checkables in a per-thread bitset which is reused across calls.
+ *
+ * @ingroup icinga
+ */
+class CheckableGraph final
+{
+public:
+	typedef std::function<void (const Checkable::Ptr&)> Visitor;
+
+	static void Register(const Checkable::Ptr& checkable);
+	static void Unregister(const Checkable::Ptr& checkable);
+	static void Invalidate();
+
+	static void VisitAllChildren(const Checkable::Ptr& root, const Visitor& visitor);
+
+private:
+	struct Snapshot
+	{
+		std::vector<Checkable::Ptr> Nodes;
+		std::vector<uint_fast32_t> Offsets; /**< Nodes.size() + 1 entries, the children of i are Targets[Offsets[i]..Offsets[i+1]) */
+		std::vector<uint_fast32_t> Targets;
+	};
+
+	static std::mutex m_Mutex;
+	static std::vector<Checkable::Ptr> m_Nodes;
+	static std::vector<uint_fast32_t> m_FreeIndices;
+	static std::shared_ptr<Snapshot> m_Snapshot;
+
+	CheckableGraph();
+
+	static std::shared_ptr<Snapshot> BuildSnapshot();
+	static void VisitAllChildrenSlow(const Checkable::Ptr& root, const Visitor& visitor);
+};
+
+}
+
+#endif /* CHECKABLEGRAPH_H */
@@ -0,0 +1,143 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "icinga/checklatency.hpp"
+#include "base/convert.hpp"
+#include "base/logger.hpp"
+#include "base/perfdatavalue.hpp"
+#include "base/scriptglobal.hpp"
+#include "base/statsfunction.hpp"
+#include "base/utility.hpp"
+#include <cstdlib>
+
+using namespace icinga;
+
+REGISTER_STATSFUNCTION(CheckLatency, &CheckLatency::StatsFunc);
+REGISTER_METRICS(&CheckLatency::MetricsFunc);
+
+Histogram CheckLatency::m_Stages[CheckLatencyProcessing + 1];
+std::mutex CheckLatency::m_FeaturesMutex;
+std::map<String, std::unique_ptr<Histogram>> CheckLatency::m_Features;
+
+static const char * const l_CheckLatencyStageNames[] = {
+	"scheduling", "spawn", "execution", "processing"
+};
+
+void CheckLatency::Record(CheckLatencyStage stage, double seconds)
+{
+	m_Stages[stage].Record(seconds);
+}
+
+/**
+ * Records the time from the end of the check until a feature has written its result.
+ *
+ * @param feature The feature's name, e.g. "icingadb"
+ * @param cr The persisted check result
+ */
+void CheckLatency::RecordPersisted(const String& feature, const CheckResult::Ptr& cr)
+{
+	double latency = Utility::GetTime() - cr->GetExecutionEnd();
+	Histogram* histogram;
+
+	{
+		std::unique_lock<std::mutex> lock (m_FeaturesMutex);
+		auto& entry (m_Features[feature]);
+
+		if (!entry)
+			entry.reset(new Histogram());
+
+		histogram = entry.get();
+	}
+
+	histogram->Record(latency);
+
+	Trace(cr, "Persisted by " + feature + " " + Convert::ToString(latency) + "s after the check had finished.");
+}
+
+/**
+ * Assigns a trace ID to the check result with the probability CheckTraceSampleRate.
+ *
+ * @param checkable The name of the checkable which is about to execute the check
+ * @param cr The new check result
+ */
+void CheckLatency::StartTrace(const String& checkable, const CheckResult::Ptr& cr)
+{
+	double rate = ScriptGlobal::Get("CheckTraceSampleRate", &Empty);
+
+	if (rate <= 0 || (rate < 1 && std::rand() >= rate * RAND_MAX))
+		return;
+
+	cr->SetTraceId(Utility::NewUniqueID());
+
+	Trace(cr, "Executing check for '" + checkable + "', "
+		+ Convert::ToString(cr->GetExecutionStart() - cr->GetScheduleStart()) + "s after it was due.");
+}
+
+/**
+ * Logs a stage of a sampled check result. Does nothing for other ones.
+ */
+void CheckLatency::Trace(const CheckResult::Ptr& cr, const String& message)
+{
+	String id = cr->GetTraceId();
+
+	if (!id.IsEmpty()) {
+		Log(LogInformation, "CheckLatency")
+			<< "Trace " << id << ": " << message;
+	}
+}
+
+void CheckLatency::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
+{
+	Dictionary::Ptr histograms = new Dictionary();
+
+	for (int stage = 0; stage <= CheckLatencyProcessing; stage++)
+		AddHistogram(l_CheckLatencyStageNames[stage], m_Stages[stage], histograms, perfdata);
+
+	{
+		std::unique_lock<std::mutex> lock (m_FeaturesMutex);
+
+		for (auto& kv : m_Features)
+			AddHistogram("persist_" + kv.first, *kv.second, histograms, perfdata);
+	}
+
+	status->Set("check_latency", histograms);
+}
+
+void CheckLatency::MetricsFunc(MetricsWriter& writer)
+{
+	for (int stage = 0; stage <= CheckLatencyProcessing; stage++) {
+		writer.AddSummary("icinga_check_latency_seconds", "Duration of the stages of the check life cycle",
+			m_Stages[stage], { { "stage", l_CheckLatencyStageNames[stage] } });
+	}
+
+	std::unique_lock<std::mutex> lock (m_FeaturesMutex);
+
+	for (auto& kv : m_Features) {
+		writer.AddSummary("icinga_check_persist_latency_seconds", "Time from the end of a check until a feature has persisted its result",
+			*kv.second, { { "feature", kv.first } });
+	}
+}
+
+void CheckLatency::AddHistogram(const String& name, const Histogram& histogram,
+	const Dictionary::Ptr& status, const Array::Ptr& perfdata)
+{
+	auto count (histogram.GetCount());
+	double p50 = histogram.GetPercentile(50);
+	double p99 = histogram.GetPercentile(99);
+	double p999 = histogram.GetPercentile(99.9);
+	double max = histogram.GetMax();
+
+	status->Set(name, new Dictionary({
+		{ "count", static_cast<double>(count) },
+		{ "avg", count ? histogram.GetSum() / count : 0 },
+		{ "p50", p50 },
+		{ "p99", p99 },
+		{ "p999", p999 },
+		{ "max", max }
+	}));
+
+	String prefix = "check_latency_" + name + "_";
+
+	perfdata->Add(new PerfdataValue(prefix + "p50", p50, false, "s"));
+	perfdata->Add(new PerfdataValue(prefix + "p99", p99, false, "s"));
+	perfdata->Add(new PerfdataValue(prefix + "p999", p999, false, "s"));
+}
@@ -0,0 +1,64 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef CHECKLATENCY_H
+#define CHECKLATENCY_H
+
+#include "icinga/i2-icinga.hpp"
+#include "icinga/checkresult.hpp"
+#include "base/histogram.hpp"
+#include "base/dictionary.hpp"
+#include "base/array.hpp"
+#include "base/metrics.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace icinga
+{
+
+/**
+ * The stages of a check's life cycle which are tracked by CheckLatency.
+ *
+ * @ingroup icinga
+ */
+enum CheckLatencyStage
+{
+	CheckLatencyScheduling, /**< From the planned next check until the check was started */
+	CheckLatencySpawn, /**< Spawning the plugin process */
+	CheckLatencyExecution, /**< The plugin's runtime */
+	CheckLatencyProcessing /**< Checkable::ProcessCheckResult() */
+};
+
+/**
+ * Latency histograms of the check life cycle and of the time it takes until features
+ * have persisted a check result. Optionally, a sample of check results gets a trace ID
+ * and every stage of them is logged (see CheckTraceSampleRate).
+ *
+ * @ingroup icinga
+ */
+class CheckLatency
+{
+public:
+	static void Record(CheckLatencyStage stage, double seconds);
+	static void RecordPersisted(const String& feature, const CheckResult::Ptr& cr);
+
+	static void StartTrace(const String& checkable, const CheckResult::Ptr& cr);
+	static void Trace(const CheckResult::Ptr& cr, const String& message);
+
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+	static void MetricsFunc(MetricsWriter& writer);
+
+private:
+	CheckLatency();
+
+	static Histogram m_Stages[CheckLatencyProcessing + 1];
+	static std::mutex m_FeaturesMutex;
+	static std::map<String, std::unique_ptr<Histogram>> m_Features;
+
+	static void AddHistogram(const String& name, const Histogram& histogram,
+		const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+};
+
+}
+
+#endif /* CHECKLATENCY_H */
@@ -2,6 +2,9 @@
 
 #include "icinga/checkresult.hpp"
 #include "icinga/checkresult-ti.cpp"
+#include "icinga/pluginutility.hpp"
+#include "base/objectlock.hpp"
+#include "base/perfdatavalue.hpp"
 #include "base/scriptglobal.hpp"
 
 using namespace icinga;
@@ -32,3 +35,84 @@ double CheckResult::CalculateLatency() const
 
 	return latency;
 }
+
+/**
+ * Returns the performance data with all strings parsed into PerfdataValue objects.
+ * Strings which can't be parsed are kept as they are. The result is computed once
+ * per performance_data array and shared by all callers, so it's frozen.
+ *
+ * @returns The parsed performance data, nullptr if there is none
+ */
+Array::Ptr CheckResult::GetParsedPerformanceData() const
+{
+	Array::Ptr perfdata = GetPerformanceData();
+
+	if (!perfdata)
+		return nullptr;
+
+	ObjectLock olock(this);
+
+	if (m_ParsedPerformanceDataSource != perfdata) {
+		ArrayData parsed;
+
+		{
+			ObjectLock perfdataLock (perfdata);
+
+			parsed.reserve(perfdata->GetLength());
+
+			for (const Value& val : perfdata) {
+				if (val.IsObjectType<PerfdataValue>() || !val.IsString()) {
+					parsed.emplace_back(val);
+					continue;
+				}
+
+				try {
+					parsed.emplace_back(PerfdataValue::Parse(val));
+				} catch (const std::exception&) {
+					parsed.emplace_back(val);
+				}
+			}
+		}
+
+		Array::Ptr result = new Array(std::move(parsed));
+		result->Freeze();
+
+		m_ParsedPerformanceDataSource = perfdata;
+		m_ParsedPerformanceData = result;
+	}
+
+	return m_ParsedPerformanceData;
+}
+
+/**
+ * Returns the performance data (or the parsed one) formatted as by PluginUtility::FormatPerfdata().
+ * Like the parsed performance data, the string is computed once per array and shared by all features
+ * writing the same check result, e.g. IDO and IcingaDB.
+ *
+ * @param parsed Whether to format GetParsedPerformanceData() instead, i.e. the normalized performance data
+ */
+String CheckResult::GetFormattedPerformanceData(bool parsed) const
+{
+	Array::Ptr perfdata = parsed ? GetParsedPerformanceData() : GetPerformanceData();
+
+	if (!perfdata)
+		return "";
+
+	auto& cache (parsed ? m_FormattedParsedPerformanceData : m_FormattedPerformanceData);
+
+	{
+		ObjectLock olock(this);
+
+		if (cache.first == perfdata)
+			return cache.second;
+	}
+
+	String formatted = PluginUtility::FormatPerfdata(perfdata);
+
+	ObjectLock olock(this);
+
+	cache.first = perfdata;
+	cache.second = formatted;
+
+	return formatted;
+}
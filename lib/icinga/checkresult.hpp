@@ -5,6 +5,7 @@
 
 #include "icinga/i2-icinga.hpp"
 #include "icinga/checkresult-ti.hpp"
+#include <utility>
 
 namespace icinga
 {
@@ -21,6 +22,17 @@ public:
 
 	double CalculateExecutionTime() const;
 	double CalculateLatency() const;
+
+	Array::Ptr GetParsedPerformanceData() const override;
+	String GetFormattedPerformanceData(bool parsed = false) const;
+
+private:
+	mutable Array::Ptr m_ParsedPerformanceDataSource;
+	mutable Array::Ptr m_ParsedPerformanceData;
+
+	/* The performance data array the string was formatted from, see GetFormattedPerformanceData(). */
+	mutable std::pair<Array::Ptr, String> m_FormattedPerformanceData;
+	mutable std::pair<Array::Ptr, String> m_FormattedParsedPerformanceData;
 };
 
 }
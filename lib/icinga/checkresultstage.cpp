@@ -0,0 +1,195 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "icinga/checkresultstage.hpp"
+#include "base/convert.hpp"
+#include "base/exception.hpp"
+#include "base/logger.hpp"
+#include "base/perfdatavalue.hpp"
+#include "base/statsfunction.hpp"
+#include "base/utility.hpp"
+#include <algorithm>
+#include <functional>
+
+using namespace icinga;
+
+REGISTER_STATSFUNCTION(CheckResultStage, &CheckResultStage::StatsFunc);
+REGISTER_METRICS(&CheckResultStage::MetricsFunc);
+
+CheckResultStage::CheckResultStage(String name, size_t maxItems, CheckResultStageOverflow overflow, size_t partitions)
+	: m_Name(std::move(name)), m_MaxItems(maxItems), m_Overflow(overflow), m_Partitions(std::max(partitions, (size_t)1u))
+{
+	std::unique_lock<std::mutex> lock (GetRegistryMutex());
+	GetRegistry().push_back(this);
+}
+
+/**
+ * Runs the task asynchronously. If the backlog is full, the task is either
+ * discarded or the caller has to wait, depending on the stage's overflow policy.
+ *
+ * @returns false if the task was discarded.
+ */
+bool CheckResultStage::Enqueue(std::function<void()>&& task)
+{
+	return EnqueuePartition(0, std::move(task));
+}
+
+/**
+ * Like Enqueue(std::function<void()>&&), but runs the task in the partition of the checkable.
+ * So the tasks of one checkable run in order and those of different checkables may run in parallel.
+ *
+ * @returns false if the task was discarded.
+ */
+bool CheckResultStage::Enqueue(const Checkable::Ptr& checkable, std::function<void()>&& task)
+{
+	if (m_Partitions < 2u)
+		return EnqueuePartition(0, std::move(task));
+
+	/* The name rather than the address, objects of the same size class are spaced evenly in memory. */
+	return EnqueuePartition(std::hash<String>()(checkable->GetName()) % m_Partitions, std::move(task));
+}
+
+bool CheckResultStage::EnqueuePartition(size_t partition, std::function<void()>&& task)
+{
+	auto& queue (GetQueue(partition));
+
+	if (m_Overflow == CheckResultStageDrop && queue.GetLength() >= GetPartitionMaxItems()) {
+		m_Dropped.fetch_add(1);
+
+		double now = Utility::GetTime();
+		double lastWarning = m_LastDropWarning.load();
+
+		if (now - lastWarning >= 60 && m_LastDropWarning.compare_exchange_strong(lastWarning, now)) {
+			Log(LogWarning, "CheckResultStage")
+				<< "Backlog of check result stage '" << m_Name << "' is full (" << m_MaxItems
+				<< " tasks), discarding new tasks. " << m_Dropped.load() << " tasks have been discarded so far.";
+		}
+
+		return false;
+	}
+
+	queue.Enqueue(std::move(task));
+	return true;
+}
+
+String CheckResultStage::GetName() const
+{
+	return m_Name;
+}
+
+size_t CheckResultStage::GetBacklog()
+{
+	size_t backlog = 0;
+
+	for (size_t i = 0; i < m_Partitions; i++)
+		backlog += GetQueue(i).GetLength();
+
+	return backlog;
+}
+
+uint_fast64_t CheckResultStage::GetDropped() const
+{
+	return m_Dropped.load();
+}
+
+WorkQueue& CheckResultStage::GetQueue(size_t partition)
+{
+	std::call_once(m_QueuesOnce, [this]() {
+		for (size_t i = 0; i < m_Partitions; i++) {
+			/* With the drop policy the WorkQueue must not block before we've checked its length. */
+			std::unique_ptr<WorkQueue> queue (new WorkQueue(m_Overflow == CheckResultStageBlock ? GetPartitionMaxItems() : 0, 1, LogNotice));
+
+			if (m_Partitions > 1u)
+				queue->SetName("CheckResultStage, " + m_Name + ", partition " + Convert::ToString(i));
+			else
+				queue->SetName("CheckResultStage, " + m_Name);
+
+			queue->SetExceptionCallback([this](boost::exception_ptr exp) {
+				Log(LogCritical, "CheckResultStage")
+					<< "Exception in check result stage '" << m_Name << "': " << DiagnosticInformation(exp, false);
+			});
+
+			m_Queues.emplace_back(std::move(queue));
+		}
+
+		m_Used.store(true);
+	});
+
+	return *m_Queues.at(partition);
+}
+
+/**
+ * @returns Each partition's share of the backlog limit.
+ */
+size_t CheckResultStage::GetPartitionMaxItems() const
+{
+	return std::max(m_MaxItems / m_Partitions, (size_t)1u);
+}
+
+/**
+ * @returns The tasks per second all partitions together ran during the last minute.
+ */
+double CheckResultStage::GetTaskRate()
+{
+	double tasks = 0;
+
+	for (size_t i = 0; i < m_Partitions; i++)
+		tasks += GetQueue(i).GetTaskCount(60);
+
+	return tasks / 60.0;
+}
+
+void CheckResultStage::MetricsFunc(MetricsWriter& writer)
+{
+	std::unique_lock<std::mutex> lock (GetRegistryMutex());
+
+	for (auto stage : GetRegistry()) {
+		if (!stage->m_Used.load())
+			continue;
+
+		MetricsWriter::Labels labels { { "stage", stage->GetName() } };
+
+		writer.AddGauge("icinga_check_result_stage_backlog", "Check results waiting to be processed by a feature", stage->GetBacklog(), labels);
+		writer.AddCounter("icinga_check_result_stage_dropped_total", "Check results a feature discarded as its backlog was full", stage->GetDropped(), labels);
+	}
+}
+
+void CheckResultStage::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
+{
+	Dictionary::Ptr stages = new Dictionary();
+	std::unique_lock<std::mutex> lock (GetRegistryMutex());
+
+	for (auto stage : GetRegistry()) {
+		/* Skip stages of features which aren't enabled. */
+		if (!stage->m_Used.load())
+			continue;
+
+		auto backlog (stage->GetBacklog());
+		auto dropped (stage->GetDropped());
+
+		stages->Set(stage->GetName(), new Dictionary({
+			{ "backlog", static_cast<double>(backlog) },
+			{ "max_backlog", static_cast<double>(stage->m_MaxItems) },
+			{ "overflow", stage->m_Overflow == CheckResultStageBlock ? "block" : "drop" },
+			{ "dropped", static_cast<double>(dropped) },
+			{ "partitions", static_cast<double>(stage->m_Partitions) },
+			{ "task_rate", stage->GetTaskRate() }
+		}));
+
+		perfdata->Add(new PerfdataValue("check_result_stage_" + stage->GetName() + "_backlog", backlog));
+		perfdata->Add(new PerfdataValue("check_result_stage_" + stage->GetName() + "_dropped", dropped, true));
+	}
+
+	status->Set("check_result_stages", stages);
+}
+
+std::mutex& CheckResultStage::GetRegistryMutex()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+std::vector<CheckResultStage*>& CheckResultStage::GetRegistry()
+{
+	static std::vector<CheckResultStage*> registry;
+	return registry;
+}
@@ -0,0 +1,85 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef CHECKRESULTSTAGE_H
+#define CHECKRESULTSTAGE_H
+
+#include "icinga/i2-icinga.hpp"
+#include "icinga/checkable.hpp"
+#include "base/workqueue.hpp"
+#include "base/dictionary.hpp"
+#include "base/array.hpp"
+#include "base/metrics.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace icinga
+{
+
+/**
+ * What CheckResultStage#Enqueue() does if the stage's backlog is full.
+ *
+ * @ingroup icinga
+ */
+enum CheckResultStageOverflow
+{
+	CheckResultStageBlock, /**< Wait until there is room again, i.e. slow down check result processing */
+	CheckResultStageDrop /**< Discard the task and count it */
+};
+
+/**
+ * A bounded queue which runs the check result handlers of one feature away from
+ * Checkable::ProcessCheckResult(). Tasks of the same stage run in the order they
+ * have been enqueued in, so per-checkable ordering is preserved.
+ *
+ * A stage may be split into partitions, each with its own worker thread and an equal
+ * share of the backlog. Tasks enqueued for a checkable always go to the same partition,
+ * so they still run in order while different checkables are handled in parallel.
+ *
+ * Stages are meant to be static objects; the worker threads are started on first use.
+ *
+ * @ingroup icinga
+ */
+class CheckResultStage final
+{
+public:
+	CheckResultStage(String name, size_t maxItems, CheckResultStageOverflow overflow, size_t partitions = 1);
+
+	CheckResultStage(const CheckResultStage&) = delete;
+	CheckResultStage& operator=(const CheckResultStage&) = delete;
+
+	bool Enqueue(std::function<void()>&& task);
+	bool Enqueue(const Checkable::Ptr& checkable, std::function<void()>&& task);
+
+	String GetName() const;
+	size_t GetBacklog();
+	uint_fast64_t GetDropped() const;
+
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+	static void MetricsFunc(MetricsWriter& writer);
+
+private:
+	String m_Name;
+	size_t m_MaxItems;
+	CheckResultStageOverflow m_Overflow;
+	size_t m_Partitions;
+
+	std::once_flag m_QueuesOnce;
+	std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+	std::atomic<bool> m_Used{false};
+	std::atomic<uint_fast64_t> m_Dropped{0};
+	std::atomic<double> m_LastDropWarning{0};
+
+	bool EnqueuePartition(size_t partition, std::function<void()>&& task);
+	WorkQueue& GetQueue(size_t partition);
+	size_t GetPartitionMaxItems() const;
+	double GetTaskRate();
+
+	static std::mutex& GetRegistryMutex();
+	static std::vector<CheckResultStage*>& GetRegistry();
+};
+
+}
+
+#endif /* CHECKRESULTSTAGE_H */
@@ -4,19 +4,29 @@
 #include "icinga/host.hpp"
 #include "icinga/service.hpp"
 #include "icinga/clusterevents.hpp"
+#include "icinga/icingaapplication.hpp"
 #include "base/application.hpp"
+#include "base/initialize.hpp"
+#include "base/logger.hpp"
 #include "base/objectlock.hpp"
+#include "base/process.hpp"
 #include "base/utility.hpp"
 #include "base/perfdatavalue.hpp"
 #include "base/configtype.hpp"
 #include "base/statsfunction.hpp"
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <queue>
+#include <vector>
 
 using namespace icinga;
 
-RingBuffer CIB::m_ActiveHostChecksStatistics(15 * 60);
-RingBuffer CIB::m_ActiveServiceChecksStatistics(15 * 60);
-RingBuffer CIB::m_PassiveHostChecksStatistics(15 * 60);
-RingBuffer CIB::m_PassiveServiceChecksStatistics(15 * 60);
+ShardedRingBuffer CIB::m_ActiveHostChecksStatistics(15 * 60);
+ShardedRingBuffer CIB::m_ActiveServiceChecksStatistics(15 * 60);
+ShardedRingBuffer CIB::m_PassiveHostChecksStatistics(15 * 60);
+ShardedRingBuffer CIB::m_PassiveServiceChecksStatistics(15 * 60);
 
 void CIB::UpdateActiveHostChecksStatistics(long tv, int num)
 {
@@ -66,10 +76,8 @@ CheckableCheckStatistics CIB::CalculateHostCheckStats()
 	int count_execution_time = 0;
 	bool checkresult = false;
 
-	for (const Host::Ptr& host : ConfigType::GetObjectsByType<Host>()) {
-		ObjectLock olock(host);
-
-		CheckResult::Ptr cr = host->GetLastCheckResult();
+	for (Host *host : ConfigType::GetObjectSnapshot<Host>()) {
+		CheckResult::Ptr cr = host->GetStateSnapshot()->LastCheckResult;
 
 		if (!cr)
 			continue;
@@ -127,10 +135,8 @@ CheckableCheckStatistics CIB::CalculateServiceCheckStats()
 	int count_execution_time = 0;
 	bool checkresult = false;
 
-	for (const Service::Ptr& service : ConfigType::GetObjectsByType<Service>()) {
-		ObjectLock olock(service);
-
-		CheckResult::Ptr cr = service->GetLastCheckResult();
+	for (Service *service : ConfigType::GetObjectSnapshot<Service>()) {
+		CheckResult::Ptr cr = service->GetStateSnapshot()->LastCheckResult;
 
 		if (!cr)
 			continue;
@@ -180,13 +186,310 @@ CheckableCheckStatistics CIB::CalculateServiceCheckStats()
 	return ccs;
 }
 
+/* Properties of a checkable counted by the host and service statistics, bits of Checkable#m_StatsFlags */
+enum StatisticsIndex
+{
+	StatsOK, /**< Hosts: up and reachable */
+	StatsWarning, /**< Hosts: down and reachable */
+	StatsCritical,
+	StatsUnknown,
+	StatsPending,
+	StatsUnreachable,
+	StatsFlapping,
+	StatsInDowntime,
+	StatsAcknowledged,
+	StatsHandled,
+	StatsProblem,
+	StatsCount
+};
+
+typedef std::array<int, StatsCount> StatisticsCounters;
+
+struct StatisticsRecheck
+{
+	double Time;
+	Checkable::Ptr Object;
+
+	bool operator>(const StatisticsRecheck& other) const
+	{
+		return Time > other.Time;
+	}
+};
+
+/* Checkables whose flags have to be updated, see CIB::InvalidateStatistics() */
+static std::mutex l_StatisticsDirtyMutex;
+static std::vector<Checkable::Ptr> l_StatisticsDirty;
+
+/* Protects the counters, the rechecks and Checkable#m_StatsFlags and Checkable#m_StatsRecheckAt */
+static std::mutex l_StatisticsMutex;
+static StatisticsCounters l_HostCounters {};
+static StatisticsCounters l_ServiceCounters {};
+
+/* Downtimes starting or ending and acknowledgements expiring, the earliest first */
+static std::priority_queue<StatisticsRecheck, std::vector<StatisticsRecheck>, std::greater<StatisticsRecheck>> l_StatisticsRechecks;
+
+INITIALIZE_ONCE([]() {
+	/* IsFlapping() also looks at the global setting. */
+	IcingaApplication::OnEnableFlappingChanged.connect([](const IcingaApplication::Ptr&, const Value&) {
+		for (Host *host : ConfigType::GetObjectSnapshot<Host>())
+			CIB::InvalidateStatistics(host);
+
+		for (Service *service : ConfigType::GetObjectSnapshot<Service>())
+			CIB::InvalidateStatistics(service);
+	});
+});
+
+/**
+ * Makes the next CalculateHostStats() or CalculateServiceStats() count the checkable again.
+ * Has to be called whenever anything the statistics look at changes.
+ *
+ * @param checkable The host or service
+ */
+void CIB::InvalidateStatistics(Checkable *checkable)
+{
+	if (checkable->m_StatsDirty.exchange(true))
+		return;
+
+	std::unique_lock<std::mutex> lock (l_StatisticsDirtyMutex);
+	l_StatisticsDirty.emplace_back(checkable);
+}
+
+static uint_fast32_t GetStatisticsFlags(const Checkable::Ptr& checkable, const CheckableStateSnapshot& state)
+{
+	if (!state.Active)
+		return 0;
+
+	uint_fast32_t flags = 0;
+	auto host (dynamic_cast<Host*>(checkable.get()));
+
+	if (host) {
+		if (host->IsReachable()) {
+			if (Host::CalculateState(state.StateRaw) == HostUp)
+				flags |= 1u << StatsOK;
+			if (Host::CalculateState(state.StateRaw) == HostDown)
+				flags |= 1u << StatsWarning;
+		} else
+			flags |= 1u << StatsUnreachable;
+	} else {
+		auto service (static_cast<Service*>(checkable.get()));
+
+		switch (state.StateRaw) {
+			case ServiceOK:
+				flags |= 1u << StatsOK;
+				break;
+			case ServiceWarning:
+				flags |= 1u << StatsWarning;
+				break;
+			case ServiceCritical:
+				flags |= 1u << StatsCritical;
+				break;
+			case ServiceUnknown:
+				flags |= 1u << StatsUnknown;
+				break;
+		}
+
+		if (!service->IsReachable())
+			flags |= 1u << StatsUnreachable;
+	}
+
+	if (!state.HasBeenChecked())
+		flags |= 1u << StatsPending;
+
+	if (state.IsFlapping())
+		flags |= 1u << StatsFlapping;
+	if (checkable->IsInDowntime())
+		flags |= 1u << StatsInDowntime;
+	if (state.IsAcknowledged())
+		flags |= 1u << StatsAcknowledged;
+
+	if (checkable->GetHandled())
+		flags |= 1u << StatsHandled;
+	if (state.Problem)
+		flags |= 1u << StatsProblem;
+
+	return flags;
+}
+
+/**
+ * Re-counts the checkables which have changed since the last call and those
+ * whose downtimes or acknowledgements have started or ended in the meantime.
+ *
+ * Has to be called with l_StatisticsMutex held.
+ */
+void CIB::UpdateStatistics()
+{
+	double now = Utility::GetTime();
+	std::vector<Checkable::Ptr> dirty;
+
+	{
+		std::unique_lock<std::mutex> lock (l_StatisticsDirtyMutex);
+		dirty.swap(l_StatisticsDirty);
+	}
+
+	while (!l_StatisticsRechecks.empty() && l_StatisticsRechecks.top().Time <= now) {
+		auto& recheck (l_StatisticsRechecks.top());
+
+		/* Otherwise the recheck has been superseded by an earlier one. */
+		if (recheck.Object->m_StatsRecheckAt == recheck.Time) {
+			recheck.Object->m_StatsRecheckAt = 0;
+			dirty.emplace_back(recheck.Object);
+		}
+
+		l_StatisticsRechecks.pop();
+	}
+
+	for (auto& checkable : dirty) {
+		/* Changes from now on mark the checkable dirty again. */
+		checkable->m_StatsDirty.store(false);
+
+		uint_fast32_t flags;
+		double recheckAt = std::numeric_limits<double>::infinity();
+
+		{
+			auto state (checkable->GetStateSnapshot());
+
+			flags = GetStatisticsFlags(checkable, *state);
+
+			if (flags) {
+				{
+					std::unique_lock<std::mutex> lock (checkable->m_DowntimeMutex);
+					recheckAt = checkable->m_DowntimeDepthValidUntil;
+				}
+
+				double ackExpiry = state->AcknowledgementExpiry;
+
+				if ((flags & (1u << StatsAcknowledged)) && ackExpiry != 0 && ackExpiry < recheckAt)
+					recheckAt = ackExpiry;
+			}
+		}
+
+		uint_fast32_t changed = flags ^ checkable->m_StatsFlags;
+
+		if (changed) {
+			auto& counters (dynamic_cast<Host*>(checkable.get()) ? l_HostCounters : l_ServiceCounters);
+
+			for (int i = 0; i < StatsCount; i++) {
+				if (changed & (1u << i))
+					counters[i] += (flags & (1u << i)) ? 1 : -1;
+			}
+
+			checkable->m_StatsFlags = flags;
+		}
+
+		if (std::isfinite(recheckAt) && (checkable->m_StatsRecheckAt <= now || recheckAt < checkable->m_StatsRecheckAt)) {
+			checkable->m_StatsRecheckAt = recheckAt;
+			l_StatisticsRechecks.push({ recheckAt, checkable });
+		}
+	}
+}
+
+/**
+ * Counts the services by their state etc. Only the services which have changed
+ * since the last call are looked at, see InvalidateStatistics().
+ */
 ServiceStatistics CIB::CalculateServiceStats()
+{
+	ServiceStatistics ss;
+
+	{
+		std::unique_lock<std::mutex> lock (l_StatisticsMutex);
+
+		UpdateStatistics();
+
+		ss.services_ok = l_ServiceCounters[StatsOK];
+		ss.services_warning = l_ServiceCounters[StatsWarning];
+		ss.services_critical = l_ServiceCounters[StatsCritical];
+		ss.services_unknown = l_ServiceCounters[StatsUnknown];
+		ss.services_pending = l_ServiceCounters[StatsPending];
+		ss.services_unreachable = l_ServiceCounters[StatsUnreachable];
+		ss.services_flapping = l_ServiceCounters[StatsFlapping];
+		ss.services_in_downtime = l_ServiceCounters[StatsInDowntime];
+		ss.services_acknowledged = l_ServiceCounters[StatsAcknowledged];
+		ss.services_handled = l_ServiceCounters[StatsHandled];
+		ss.services_problem = l_ServiceCounters[StatsProblem];
+	}
+
+#ifdef I2_DEBUG
+	/* Concurrent changes may make this differ for a moment. */
+	ServiceStatistics scanned = ScanServiceStats();
+
+	if (memcmp(&ss, &scanned, sizeof(ss))) {
+		Log(LogWarning, "CIB")
+			<< "Incrementally counted service statistics differ from a full scan: ok " << ss.services_ok << "/" << scanned.services_ok
+			<< ", warning " << ss.services_warning << "/" << scanned.services_warning
+			<< ", critical " << ss.services_critical << "/" << scanned.services_critical
+			<< ", unknown " << ss.services_unknown << "/" << scanned.services_unknown
+			<< ", pending " << ss.services_pending << "/" << scanned.services_pending
+			<< ", unreachable " << ss.services_unreachable << "/" << scanned.services_unreachable
+			<< ", flapping " << ss.services_flapping << "/" << scanned.services_flapping
+			<< ", in downtime " << ss.services_in_downtime << "/" << scanned.services_in_downtime
+			<< ", acknowledged " << ss.services_acknowledged << "/" << scanned.services_acknowledged
+			<< ", handled " << ss.services_handled << "/" << scanned.services_handled
+			<< ", problem " << ss.services_problem << "/" << scanned.services_problem;
+	}
+#endif /* I2_DEBUG */
+
+	return ss;
+}
+
+/**
+ * Counts the hosts by their state etc. Only the hosts which have changed
+ * since the last call are looked at, see InvalidateStatistics().
+ */
+HostStatistics CIB::CalculateHostStats()
+{
+	HostStatistics hs;
+
+	{
+		std::unique_lock<std::mutex> lock (l_StatisticsMutex);
+
+		UpdateStatistics();
+
+		hs.hosts_up = l_HostCounters[StatsOK];
+		hs.hosts_down = l_HostCounters[StatsWarning];
+		hs.hosts_pending = l_HostCounters[StatsPending];
+		hs.hosts_unreachable = l_HostCounters[StatsUnreachable];
+		hs.hosts_flapping = l_HostCounters[StatsFlapping];
+		hs.hosts_in_downtime = l_HostCounters[StatsInDowntime];
+		hs.hosts_acknowledged = l_HostCounters[StatsAcknowledged];
+		hs.hosts_handled = l_HostCounters[StatsHandled];
+		hs.hosts_problem = l_HostCounters[StatsProblem];
+	}
+
+#ifdef I2_DEBUG
+	/* Concurrent changes may make this differ for a moment. */
+	HostStatistics scanned = ScanHostStats();
+
+	if (memcmp(&hs, &scanned, sizeof(hs))) {
+		Log(LogWarning, "CIB")
+			<< "Incrementally counted host statistics differ from a full scan: up " << hs.hosts_up << "/" << scanned.hosts_up
+			<< ", down " << hs.hosts_down << "/" << scanned.hosts_down
+			<< ", pending " << hs.hosts_pending << "/" << scanned.hosts_pending
+			<< ", unreachable " << hs.hosts_unreachable << "/" << scanned.hosts_unreachable
+			<< ", flapping " << hs.hosts_flapping << "/" << scanned.hosts_flapping
+			<< ", in downtime " << hs.hosts_in_downtime << "/" << scanned.hosts_in_downtime
+			<< ", acknowledged " << hs.hosts_acknowledged << "/" << scanned.hosts_acknowledged
+			<< ", handled " << hs.hosts_handled << "/" << scanned.hosts_handled
+			<< ", problem " << hs.hosts_problem << "/" << scanned.hosts_problem;
+	}
+#endif /* I2_DEBUG */
+
+	return hs;
+}
+
+/**
+ * Counts the active services from scratch, see CalculateServiceStats().
+ */
+ServiceStatistics CIB::ScanServiceStats()
 {
 	ServiceStatistics ss = {};
 
-	for (const Service::Ptr& service : ConfigType::GetObjectsByType<Service>()) {
+	for (Service *service : ConfigType::GetObjectSnapshot<Service>()) {
 		ObjectLock olock(service);
 
+		if (!service->IsActive())
+			continue;
+
 		if (service->GetState() == ServiceOK)
 			ss.services_ok++;
 		if (service->GetState() == ServiceWarning)
@@ -220,13 +523,19 @@ ServiceStatistics CIB::CalculateServiceStats()
 	return ss;
 }
 
-HostStatistics CIB::CalculateHostStats()
+/**
+ * Counts the active hosts from scratch, see CalculateHostStats().
+ */
+HostStatistics CIB::ScanHostStats()
 {
 	HostStatistics hs = {};
 
-	for (const Host::Ptr& host : ConfigType::GetObjectsByType<Host>()) {
+	for (Host *host : ConfigType::GetObjectSnapshot<Host>()) {
 		ObjectLock olock(host);
 
+		if (!host->IsActive())
+			continue;
+
 		if (host->IsReachable()) {
 			if (host->GetState() == HostUp)
 				hs.hosts_up++;
@@ -276,6 +585,34 @@ std::pair<Dictionary::Ptr, Array::Ptr> CIB::GetFeatureStats()
 }
 
 REGISTER_STATSFUNCTION(CIB, &CIB::StatsFunc);
+REGISTER_METRICS(&CIB::MetricsFunc);
+
+void CIB::MetricsFunc(MetricsWriter& writer)
+{
+	writer.AddGauge("icinga_uptime_seconds", "Time since Icinga was started", Utility::GetTime() - Application::GetStartTime());
+	writer.AddGauge("icinga_build_info", "Version of Icinga", 1, { { "version", Application::GetAppVersion() } });
+
+	writer.AddGauge("icinga_checks_1min", "Check results processed during the last minute",
+		GetActiveHostChecksStatistics(60), { { "type", "host" }, { "mode", "active" } });
+	writer.AddGauge("icinga_checks_1min", "Check results processed during the last minute",
+		GetPassiveHostChecksStatistics(60), { { "type", "host" }, { "mode", "passive" } });
+	writer.AddGauge("icinga_checks_1min", "Check results processed during the last minute",
+		GetActiveServiceChecksStatistics(60), { { "type", "service" }, { "mode", "active" } });
+	writer.AddGauge("icinga_checks_1min", "Check results processed during the last minute",
+		GetPassiveServiceChecksStatistics(60), { { "type", "service" }, { "mode", "passive" } });
+
+	writer.AddGauge("icinga_remote_check_queue_items", "Check requests from other endpoints waiting to be executed", ClusterEvents::GetCheckRequestQueueSize());
+	writer.AddGauge("icinga_thread_pool_pending_callbacks", "Tasks waiting for the global thread pool", Application::GetTP().GetPending());
+	writer.AddGauge("icinga_concurrent_checks", "Checks currently being executed", Checkable::CurrentConcurrentChecks.load());
+
+	writer.AddCounter("icinga_reachability_cache_hits_total", "Reachability lookups answered from the cache", Checkable::ReachabilityCacheHits.load());
+	writer.AddCounter("icinga_reachability_cache_misses_total", "Reachability lookups which had to walk the dependency graph", Checkable::ReachabilityCacheMisses.load());
+
+#ifndef _WIN32
+	writer.AddGauge("icinga_spawn_helpers", "Process spawn helpers", Process::GetSpawnHelperCount());
+	writer.AddGauge("icinga_process_spawns_1min", "Processes spawned during the last minute", Process::GetSpawnStatistics(60));
+#endif /* _WIN32 */
+}
 
 void CIB::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata) {
 	double interval = Utility::GetTime() - Application::GetStartTime();
@@ -306,6 +643,17 @@ void CIB::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata) {
 	status->Set("current_pending_callbacks", Application::GetTP().GetPending());
 	status->Set("current_concurrent_checks", Checkable::CurrentConcurrentChecks.load());
 
+	status->Set("reachability_cache_hits", Checkable::ReachabilityCacheHits.load());
+	status->Set("reachability_cache_misses", Checkable::ReachabilityCacheMisses.load());
+	status->Set("reachability_cache_invalidations", Checkable::ReachabilityCacheInvalidations.load());
+
+#ifndef _WIN32
+	// Process spawn helper related stats
+	status->Set("spawn_helpers", Process::GetSpawnHelperCount());
+	status->Set("process_spawns_1min", Process::GetSpawnStatistics(60));
+	status->Set("avg_spawn_latency", Process::GetAvgSpawnLatency(60));
+#endif /* _WIN32 */
+
 	CheckableCheckStatistics scs = CalculateServiceCheckStats();
 
 	status->Set("min_latency", scs.min_latency);
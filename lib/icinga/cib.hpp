@@ -4,13 +4,16 @@
 #define CIB_H
 
 #include "icinga/i2-icinga.hpp"
-#include "base/ringbuffer.hpp"
+#include "base/shardedringbuffer.hpp"
 #include "base/dictionary.hpp"
 #include "base/array.hpp"
+#include "base/metrics.hpp"
 
 namespace icinga
 {
 
+class Checkable;
+
 struct CheckableCheckStatistics {
 	double min_latency;
 	double max_latency;
@@ -72,18 +75,26 @@ public:
 	static HostStatistics CalculateHostStats();
 	static ServiceStatistics CalculateServiceStats();
 
+	static HostStatistics ScanHostStats();
+	static ServiceStatistics ScanServiceStats();
+
+	static void InvalidateStatistics(Checkable *checkable);
+
 	static std::pair<Dictionary::Ptr, Array::Ptr> GetFeatureStats();
 
 	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+	static void MetricsFunc(MetricsWriter& writer);
 
 private:
 	CIB();
 
+	static void UpdateStatistics();
+
 	static std::mutex m_Mutex;
-	static RingBuffer m_ActiveHostChecksStatistics;
-	static RingBuffer m_PassiveHostChecksStatistics;
-	static RingBuffer m_ActiveServiceChecksStatistics;
-	static RingBuffer m_PassiveServiceChecksStatistics;
+	static ShardedRingBuffer m_ActiveHostChecksStatistics;
+	static ShardedRingBuffer m_PassiveHostChecksStatistics;
+	static ShardedRingBuffer m_ActiveServiceChecksStatistics;
+	static ShardedRingBuffer m_PassiveServiceChecksStatistics;
 };
 
 }
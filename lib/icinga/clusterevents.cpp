@@ -2,6 +2,7 @@
 
 #include "icinga/clusterevents.hpp"
 #include "icinga/service.hpp"
+#include "icinga/checklatency.hpp"
 #include "remote/apilistener.hpp"
 #include "remote/endpoint.hpp"
 #include "remote/messageorigin.hpp"
@@ -10,20 +11,43 @@
 #include "remote/eventqueue.hpp"
 #include "base/application.hpp"
 #include "base/configtype.hpp"
+#include "base/convert.hpp"
 #include "base/utility.hpp"
 #include "base/perfdatavalue.hpp"
 #include "base/exception.hpp"
 #include "base/initialize.hpp"
 #include "base/serializer.hpp"
 #include "base/json.hpp"
+#include <boost/thread/once.hpp>
+#include <algorithm>
 #include <fstream>
+#include <iterator>
+#include <map>
+#include <vector>
 
 using namespace icinga;
 
 INITIALIZE_ONCE(&ClusterEvents::StaticInitialize);
 
+std::mutex ClusterEvents::m_NextChecksMutex;
+std::set<Checkable::Ptr> ClusterEvents::m_NextChecks;
+std::atomic<bool> ClusterEvents::m_BatchNextChecks (false);
+Timer::Ptr ClusterEvents::m_NextChecksTimer;
+std::mutex ClusterEvents::m_BatchesMutex;
+std::map<std::pair<Endpoint::Ptr, String>, ArrayData> ClusterEvents::m_Batches;
+Timer::Ptr ClusterEvents::m_BatchesTimer;
+std::mutex ClusterEvents::m_CheckResultsMutex;
+ClusterEvents::CheckResultList ClusterEvents::m_CheckResults;
+std::map<Checkable::Ptr, ClusterEvents::CheckResultList::iterator> ClusterEvents::m_CheckResultsByCheckable;
+Timer::Ptr ClusterEvents::m_CheckResultsTimer;
+
+/* Send a batch right away instead of waiting for the timer once it has this many entries. */
+static const size_t l_MaxBatchSize = 100;
+
 REGISTER_APIFUNCTION(CheckResult, event, &ClusterEvents::CheckResultAPIHandler);
+REGISTER_APIFUNCTION(CheckResults, event, &ClusterEvents::CheckResultsAPIHandler);
 REGISTER_APIFUNCTION(SetNextCheck, event, &ClusterEvents::NextCheckChangedAPIHandler);
+REGISTER_APIFUNCTION(SetNextChecks, event, &ClusterEvents::NextChecksChangedAPIHandler);
 REGISTER_APIFUNCTION(SetLastCheckStarted, event, &ClusterEvents::LastCheckStartedChangedAPIHandler);
 REGISTER_APIFUNCTION(SetStateBeforeSuppression, event, &ClusterEvents::StateBeforeSuppressionChangedAPIHandler);
 REGISTER_APIFUNCTION(SetSuppressedNotifications, event, &ClusterEvents::SuppressedNotificationsChangedAPIHandler);
@@ -36,6 +60,7 @@ REGISTER_APIFUNCTION(SetForceNextNotification, event, &ClusterEvents::ForceNextN
 REGISTER_APIFUNCTION(SetAcknowledgement, event, &ClusterEvents::AcknowledgementSetAPIHandler);
 REGISTER_APIFUNCTION(ClearAcknowledgement, event, &ClusterEvents::AcknowledgementClearedAPIHandler);
 REGISTER_APIFUNCTION(ExecuteCommand, event, &ClusterEvents::ExecuteCommandAPIHandler);
+REGISTER_APIFUNCTION(ExecuteCommands, event, &ClusterEvents::ExecuteCommandsAPIHandler);
 REGISTER_APIFUNCTION(SendNotifications, event, &ClusterEvents::SendNotificationsAPIHandler);
 REGISTER_APIFUNCTION(NotificationSentUser, event, &ClusterEvents::NotificationSentUserAPIHandler);
 REGISTER_APIFUNCTION(NotificationSentToAllUsers, event, &ClusterEvents::NotificationSentToAllUsersAPIHandler);
@@ -65,6 +90,8 @@ void ClusterEvents::StaticInitialize()
 
 	Comment::OnRemovalInfoChanged.connect(&ClusterEvents::SetRemovalInfoHandler);
 	Downtime::OnRemovalInfoChanged.connect(&ClusterEvents::SetRemovalInfoHandler);
+
+	ApiListener::OnStopping.connect([]() { FlushCheckResults(true); });
 }
 
 Dictionary::Ptr ClusterEvents::MakeCheckResultMessage(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr)
@@ -102,9 +129,202 @@ void ClusterEvents::CheckResultHandler(const Checkable::Ptr& checkable, const Ch
 		return;
 
 	Dictionary::Ptr message = MakeCheckResultMessage(checkable, cr);
+
+	if (!origin && BatchCheckResult(checkable, message))
+		return;
+
 	listener->RelayMessage(origin, checkable, message, true);
 }
 
+static void RelayCheckResults(const ApiListener::Ptr& listener, const Zone::Ptr& zone, ArrayData results)
+{
+	Dictionary::Ptr message = new Dictionary({
+		{ "jsonrpc", "2.0" },
+		{ "method", "event::CheckResults" },
+		{ "params", new Dictionary({
+			{ "batch", new Array(std::move(results)) }
+		}) }
+	});
+
+	/* The zone as secobj, see FlushNextChecks(). */
+	listener->RelayMessage(nullptr, zone, message, true);
+}
+
+/**
+ * Queues a check result of this agent or satellite for its parent zone to be sent with others
+ * by FlushCheckResults() every ApiListener#check_result_batch_window seconds.
+ *
+ * @returns false if batching is disabled or there's no parent zone, the caller has to relay the message itself then.
+ */
+bool ClusterEvents::BatchCheckResult(const Checkable::Ptr& checkable, const Dictionary::Ptr& message)
+{
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+	double window = listener->GetCheckResultBatchWindow();
+
+	if (window <= 0)
+		return false;
+
+	Zone::Ptr localZone = Zone::GetLocalZone();
+
+	if (!localZone || !localZone->GetParent())
+		return false;
+
+	static boost::once_flag once = BOOST_ONCE_INIT;
+
+	boost::call_once(once, [window]() {
+		m_CheckResultsTimer = Timer::Create();
+		m_CheckResultsTimer->SetInterval(window);
+		m_CheckResultsTimer->OnTimerExpired.connect([](const Timer * const&) { FlushCheckResults(false); });
+		m_CheckResultsTimer->Start();
+	});
+
+	/* The window may have been changed since, e.g. by a reload. */
+	if (m_CheckResultsTimer->GetInterval() != window) {
+		m_CheckResultsTimer->SetInterval(window);
+		m_CheckResultsTimer->Reschedule();
+	}
+
+	std::unique_lock<std::mutex> lock (m_CheckResultsMutex);
+
+	if (listener->GetCheckResultLatestOnly()) {
+		auto it (m_CheckResultsByCheckable.find(checkable));
+
+		/* The newer result replaces the queued one, but keeps its position. */
+		if (it != m_CheckResultsByCheckable.end()) {
+			it->second->second = message;
+			return true;
+		}
+
+		m_CheckResults.emplace_back(checkable, message);
+		m_CheckResultsByCheckable.emplace(checkable, std::prev(m_CheckResults.end()));
+	} else {
+		m_CheckResults.emplace_back(checkable, message);
+	}
+
+	return true;
+}
+
+/**
+ * @returns Whether all connected endpoints have ApiCapabilities::BatchedExecuteCommands. While no endpoint
+ *          of the parent zone is connected, the messages go into the replay log, so all of its endpoints
+ *          have to have had the capability when they were connected last.
+ */
+bool ClusterEvents::CanBatchCheckResults(const Zone::Ptr& parentZone)
+{
+	auto canBatch ([](const Endpoint::Ptr& endpoint) {
+		return (endpoint->GetCapabilities() & (uint_fast64_t)ApiCapabilities::BatchedExecuteCommands) != 0;
+	});
+
+	for (const Endpoint::Ptr& endpoint : ConfigType::GetObjectsByType<Endpoint>()) {
+		if (endpoint->GetConnected() && !canBatch(endpoint))
+			return false;
+	}
+
+	if (!parentZone)
+		return true;
+
+	std::set<Endpoint::Ptr> parentEndpoints = parentZone->GetEndpoints();
+
+	for (auto& endpoint : parentEndpoints) {
+		if (endpoint->GetConnected())
+			return true;
+	}
+
+	return std::all_of(parentEndpoints.begin(), parentEndpoints.end(), canBatch);
+}
+
+/**
+ * Relays the check results queued by BatchCheckResult() in their order, as 'event::CheckResults' messages
+ * of up to 100 entries per zone. Falls back to one 'event::CheckResult' message per result
+ * unless CanBatchCheckResults().
+ *
+ * While no endpoint of the parent zone is connected the messages end up in the replay log as usual.
+ * With ApiListener#check_result_latest_only the results are kept in memory instead, up to
+ * ApiListener#check_result_buffer_size checkables, so that only the latest one per checkable is replayed.
+ *
+ * @param all Whether to relay the results kept in memory as well, e.g. on shutdown.
+ */
+void ClusterEvents::FlushCheckResults(bool all)
+{
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (!listener)
+		return;
+
+	Zone::Ptr localZone = Zone::GetLocalZone();
+	Zone::Ptr parentZone = localZone ? localZone->GetParent() : nullptr;
+	bool parentConnected = false;
+
+	if (parentZone) {
+		for (const Endpoint::Ptr& endpoint : parentZone->GetEndpoints()) {
+			if (endpoint->GetConnected()) {
+				parentConnected = true;
+				break;
+			}
+		}
+	}
+
+	bool batch = CanBatchCheckResults(parentZone);
+	bool hold = !all && !parentConnected && listener->GetCheckResultLatestOnly();
+	auto bufferSize (static_cast<size_t>(std::max(listener->GetCheckResultBufferSize(), 0)));
+	std::vector<std::pair<Checkable::Ptr, Dictionary::Ptr>> results;
+
+	{
+		std::unique_lock<std::mutex> lock (m_CheckResultsMutex);
+
+		size_t count = m_CheckResults.size();
+
+		/* Only the oldest ones which don't fit into the buffer anymore. */
+		if (hold)
+			count = count > bufferSize ? count - bufferSize : 0;
+
+		results.reserve(count);
+
+		for (size_t i = 0; i < count; i++) {
+			auto it (m_CheckResultsByCheckable.find(m_CheckResults.front().first));
+
+			if (it != m_CheckResultsByCheckable.end() && it->second == m_CheckResults.begin())
+				m_CheckResultsByCheckable.erase(it);
+
+			results.emplace_back(std::move(m_CheckResults.front()));
+			m_CheckResults.pop_front();
+		}
+	}
+
+	if (results.empty())
+		return;
+
+	if (!batch) {
+		for (auto& result : results)
+			listener->RelayMessage(nullptr, result.first, result.second, true);
+
+		return;
+	}
+
+	std::map<Zone::Ptr, ArrayData> resultsByZone;
+
+	for (auto& result : results) {
+		Zone::Ptr zone = static_pointer_cast<Zone>(result.first->GetZone());
+
+		if (!zone)
+			zone = localZone;
+
+		ArrayData& zoneResults (resultsByZone[zone]);
+
+		zoneResults.emplace_back(result.second->Get("params"));
+
+		if (zoneResults.size() >= l_MaxBatchSize) {
+			RelayCheckResults(listener, zone, std::move(zoneResults));
+			zoneResults.clear();
+		}
+	}
+
+	for (auto& zoneResults : resultsByZone) {
+		if (!zoneResults.second.empty())
+			RelayCheckResults(listener, zoneResults.first, std::move(zoneResults.second));
+	}
+}
+
 Value ClusterEvents::CheckResultAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
 {
 	Endpoint::Ptr endpoint = origin->FromClient->GetEndpoint();
@@ -175,6 +395,9 @@ Value ClusterEvents::CheckResultAPIHandler(const MessageOrigin::Ptr& origin, con
 		return Empty;
 	}
 
+	CheckLatency::Trace(cr, "Received check result for '" + checkable->GetName() + "' from endpoint '" + endpoint->GetName() + "' "
+		+ Convert::ToString(Utility::GetTime() - cr->GetExecutionEnd()) + "s after the check had finished.");
+
 	if (!checkable->IsPaused() && Zone::GetLocalZone() == checkable->GetZone() && endpoint == checkable->GetCommandEndpoint())
 		checkable->ProcessCheckResult(cr);
 	else
@@ -183,13 +406,28 @@ Value ClusterEvents::CheckResultAPIHandler(const MessageOrigin::Ptr& origin, con
 	return Empty;
 }
 
-void ClusterEvents::NextCheckChangedHandler(const Checkable::Ptr& checkable, const MessageOrigin::Ptr& origin)
+/**
+ * Processes the params of multiple 'event::CheckResult' messages, see SendBatched().
+ */
+Value ClusterEvents::CheckResultsAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
 {
-	ApiListener::Ptr listener = ApiListener::GetInstance();
+	Array::Ptr batch = params->Get("batch");
 
-	if (!listener)
-		return;
+	if (!batch)
+		return Empty;
 
+	ObjectLock olock(batch);
+
+	for (const Value& item : batch) {
+		if (item.IsObjectType<Dictionary>())
+			CheckResultAPIHandler(origin, item);
+	}
+
+	return Empty;
+}
+
+static Dictionary::Ptr GetNextCheckParams(const Checkable::Ptr& checkable)
+{
 	Host::Ptr host;
 	Service::Ptr service;
 	tie(host, service) = GetHostService(checkable);
@@ -200,28 +438,191 @@ void ClusterEvents::NextCheckChangedHandler(const Checkable::Ptr& checkable, con
 		params->Set("service", service->GetShortName());
 	params->Set("next_check", checkable->GetNextCheck());
 
+	return params;
+}
+
+void ClusterEvents::NextCheckChangedHandler(const Checkable::Ptr& checkable, const MessageOrigin::Ptr& origin)
+{
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (!listener)
+		return;
+
+	static boost::once_flag once = BOOST_ONCE_INIT;
+
+	boost::call_once(once, []() {
+		m_NextChecksTimer = Timer::Create();
+		m_NextChecksTimer->SetInterval(0.5);
+		m_NextChecksTimer->OnTimerExpired.connect([](const Timer * const&) { FlushNextChecks(); });
+		m_NextChecksTimer->Start();
+	});
+
+	/* Changes received from other endpoints aren't batched, they must not be relayed back to their origin. */
+	if (!origin && m_BatchNextChecks.load()) {
+		std::unique_lock<std::mutex> lock (m_NextChecksMutex);
+		m_NextChecks.emplace(checkable);
+		return;
+	}
+
 	Dictionary::Ptr message = new Dictionary();
 	message->Set("jsonrpc", "2.0");
 	message->Set("method", "event::SetNextCheck");
-	message->Set("params", params);
+	message->Set("params", GetNextCheckParams(checkable));
 
 	listener->RelayMessage(origin, checkable, message, true);
 }
 
-Value ClusterEvents::NextCheckChangedAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
+/**
+ * Sends the next checks changed since the last call, one 'event::SetNextChecks' message per zone.
+ * Falls back to one 'event::SetNextCheck' message per checkable while any connected endpoint
+ * lacks ApiCapabilities::BatchedNextChecks.
+ */
+void ClusterEvents::FlushNextChecks()
 {
-	Endpoint::Ptr endpoint = origin->FromClient->GetEndpoint();
+	ApiListener::Ptr listener = ApiListener::GetInstance();
 
-	if (!endpoint) {
-		Log(LogNotice, "ClusterEvents")
-			<< "Discarding 'next check changed' message from '" << origin->FromClient->GetIdentity() << "': Invalid endpoint origin (client not allowed).";
-		return Empty;
+	if (!listener)
+		return;
+
+	bool batch = true;
+
+	for (const Endpoint::Ptr& endpoint : ConfigType::GetObjectsByType<Endpoint>()) {
+		if (endpoint->GetConnected() && !(endpoint->GetCapabilities() & (uint_fast64_t)ApiCapabilities::BatchedNextChecks)) {
+			batch = false;
+			break;
+		}
 	}
 
+	m_BatchNextChecks.store(batch);
+
+	std::set<Checkable::Ptr> checkables;
+
+	{
+		std::unique_lock<std::mutex> lock (m_NextChecksMutex);
+		checkables.swap(m_NextChecks);
+	}
+
+	std::map<Zone::Ptr, ArrayData> nextChecksByZone;
+
+	for (const Checkable::Ptr& checkable : checkables) {
+		Dictionary::Ptr params = GetNextCheckParams(checkable);
+
+		if (!batch) {
+			Dictionary::Ptr message = new Dictionary({
+				{ "jsonrpc", "2.0" },
+				{ "method", "event::SetNextCheck" },
+				{ "params", params }
+			});
+
+			listener->RelayMessage(nullptr, checkable, message, true);
+			continue;
+		}
+
+		Zone::Ptr zone = static_pointer_cast<Zone>(checkable->GetZone());
+
+		if (!zone)
+			zone = Zone::GetLocalZone();
+
+		nextChecksByZone[zone].emplace_back(params);
+	}
+
+	/* The zone as secobj relays the message to the same endpoints as the checkables
+	 * and lets ReplayLog() skip it for zones not allowed to access them.
+	 */
+	for (auto& nextChecks : nextChecksByZone) {
+		Dictionary::Ptr message = new Dictionary({
+			{ "jsonrpc", "2.0" },
+			{ "method", "event::SetNextChecks" },
+			{ "params", new Dictionary({
+				{ "next_checks", new Array(std::move(nextChecks.second)) }
+			}) }
+		});
+
+		listener->RelayMessage(nullptr, nextChecks.first, message, true);
+	}
+}
+
+/**
+ * Queues the params of a message for a single endpoint, e.g. of an 'event::ExecuteCommand', to be sent
+ * with others within 0.1 seconds as the given method, e.g. 'event::ExecuteCommands',
+ * if the endpoint has ApiCapabilities::BatchedExecuteCommands.
+ *
+ * @returns false if the endpoint lacks that capability, the caller has to send the message itself then.
+ */
+bool ClusterEvents::SendBatched(const Endpoint::Ptr& endpoint, const String& method, const Dictionary::Ptr& params)
+{
+	if (!(endpoint->GetCapabilities() & (uint_fast64_t)ApiCapabilities::BatchedExecuteCommands))
+		return false;
+
+	static boost::once_flag once = BOOST_ONCE_INIT;
+
+	boost::call_once(once, []() {
+		m_BatchesTimer = Timer::Create();
+		m_BatchesTimer->SetInterval(0.1);
+		m_BatchesTimer->OnTimerExpired.connect([](const Timer * const&) { FlushBatches(); });
+		m_BatchesTimer->Start();
+	});
+
+	ArrayData full;
+
+	{
+		std::unique_lock<std::mutex> lock (m_BatchesMutex);
+		auto& batch (m_Batches[{ endpoint, method }]);
+
+		batch.emplace_back(params);
+
+		if (batch.size() < l_MaxBatchSize)
+			return true;
+
+		full.swap(batch);
+	}
+
+	SendBatch(endpoint, method, std::move(full));
+	return true;
+}
+
+void ClusterEvents::SendBatch(const Endpoint::Ptr& endpoint, const String& method, ArrayData batch)
+{
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (!listener)
+		return;
+
+	Dictionary::Ptr message = new Dictionary({
+		{ "jsonrpc", "2.0" },
+		{ "method", method },
+		{ "params", new Dictionary({
+			{ "batch", new Array(std::move(batch)) }
+		}) }
+	});
+
+	listener->SyncSendMessage(endpoint, message);
+}
+
+/**
+ * Sends the messages queued by SendBatched() since the last call.
+ */
+void ClusterEvents::FlushBatches()
+{
+	std::map<std::pair<Endpoint::Ptr, String>, ArrayData> batches;
+
+	{
+		std::unique_lock<std::mutex> lock (m_BatchesMutex);
+		batches.swap(m_Batches);
+	}
+
+	for (auto& batch : batches) {
+		if (!batch.second.empty())
+			SendBatch(batch.first.first, batch.first.second, std::move(batch.second));
+	}
+}
+
+static void ApplyNextCheck(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
+{
 	Host::Ptr host = Host::GetByName(params->Get("host"));
 
 	if (!host)
-		return Empty;
+		return;
 
 	Checkable::Ptr checkable;
 
@@ -231,21 +632,59 @@ Value ClusterEvents::NextCheckChangedAPIHandler(const MessageOrigin::Ptr& origin
 		checkable = host;
 
 	if (!checkable)
-		return Empty;
+		return;
 
 	if (origin->FromZone && !origin->FromZone->CanAccessObject(checkable)) {
 		Log(LogNotice, "ClusterEvents")
 			<< "Discarding 'next check changed' message for checkable '" << checkable->GetName()
 			<< "' from '" << origin->FromClient->GetIdentity() << "': Unauthorized access.";
-		return Empty;
+		return;
 	}
 
 	double nextCheck = params->Get("next_check");
 
 	if (nextCheck < Application::GetStartTime() + 60)
-		return Empty;
+		return;
 
 	checkable->SetNextCheck(params->Get("next_check"), false, origin);
+}
+
+Value ClusterEvents::NextCheckChangedAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
+{
+	Endpoint::Ptr endpoint = origin->FromClient->GetEndpoint();
+
+	if (!endpoint) {
+		Log(LogNotice, "ClusterEvents")
+			<< "Discarding 'next check changed' message from '" << origin->FromClient->GetIdentity() << "': Invalid endpoint origin (client not allowed).";
+		return Empty;
+	}
+
+	ApplyNextCheck(origin, params);
+
+	return Empty;
+}
+
+Value ClusterEvents::NextChecksChangedAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
+{
+	Endpoint::Ptr endpoint = origin->FromClient->GetEndpoint();
+
+	if (!endpoint) {
+		Log(LogNotice, "ClusterEvents")
+			<< "Discarding 'next checks changed' message from '" << origin->FromClient->GetIdentity() << "': Invalid endpoint origin (client not allowed).";
+		return Empty;
+	}
+
+	Array::Ptr nextChecks = params->Get("next_checks");
+
+	if (!nextChecks)
+		return Empty;
+
+	ObjectLock olock(nextChecks);
+
+	for (const Value& nextCheck : nextChecks) {
+		if (nextCheck.IsObjectType<Dictionary>())
+			ApplyNextCheck(origin, nextCheck);
+	}
 
 	return Empty;
 }
@@ -1067,6 +1506,26 @@ Value ClusterEvents::ExecuteCommandAPIHandler(const MessageOrigin::Ptr& origin,
 	return Empty;
 }
 
+/**
+ * Processes the params of multiple 'event::ExecuteCommand' messages, see SendBatched().
+ */
+Value ClusterEvents::ExecuteCommandsAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
+{
+	Array::Ptr batch = params->Get("batch");
+
+	if (!batch)
+		return Empty;
+
+	ObjectLock olock(batch);
+
+	for (const Value& item : batch) {
+		if (item.IsObjectType<Dictionary>())
+			ExecuteCommandAPIHandler(origin, item);
+	}
+
+	return Empty;
+}
+
 void ClusterEvents::SendNotificationsHandler(const Checkable::Ptr& checkable, NotificationType type,
 	const CheckResult::Ptr& cr, const String& author, const String& text, const MessageOrigin::Ptr& origin)
 {
@@ -8,6 +8,14 @@
 #include "icinga/checkcommand.hpp"
 #include "icinga/eventcommand.hpp"
 #include "icinga/notificationcommand.hpp"
+#include "remote/endpoint.hpp"
+#include "remote/zone.hpp"
+#include <atomic>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
 
 namespace icinga
 {
@@ -22,9 +30,11 @@ public:
 
 	static void CheckResultHandler(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr, const MessageOrigin::Ptr& origin);
 	static Value CheckResultAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
+	static Value CheckResultsAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 
 	static void NextCheckChangedHandler(const Checkable::Ptr& checkable, const MessageOrigin::Ptr& origin);
 	static Value NextCheckChangedAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
+	static Value NextChecksChangedAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 
 	static void LastCheckStartedChangedHandler(const Checkable::Ptr& checkable, const MessageOrigin::Ptr& origin);
 	static Value LastCheckStartedChangedAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
@@ -61,6 +71,7 @@ public:
 	static Value AcknowledgementClearedAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 
 	static Value ExecuteCommandAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
+	static Value ExecuteCommandsAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 
 	static Dictionary::Ptr MakeCheckResultMessage(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
 
@@ -81,6 +92,10 @@ public:
 	static void SetRemovalInfoHandler(const ConfigObject::Ptr& obj, const String& removedBy, double removeTime, const MessageOrigin::Ptr& origin);
 	static Value SetRemovalInfoAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 
+	static bool SendBatched(const Endpoint::Ptr& endpoint, const String& method, const Dictionary::Ptr& params);
+	static void FlushCheckResults(bool all);
+	static bool CanBatchCheckResults(const Zone::Ptr& parentZone);
+
 	static int GetCheckRequestQueueSize();
 	static void LogRemoteCheckQueueInformation();
 
@@ -92,6 +107,29 @@ private:
 	static int m_ChecksDroppedDuringInterval;
 	static Timer::Ptr m_LogTimer;
 
+	static std::mutex m_NextChecksMutex;
+	static std::set<Checkable::Ptr> m_NextChecks;
+	static std::atomic<bool> m_BatchNextChecks;
+	static Timer::Ptr m_NextChecksTimer;
+
+	static void FlushNextChecks();
+
+	static std::mutex m_BatchesMutex;
+	static std::map<std::pair<Endpoint::Ptr, String>, ArrayData> m_Batches;
+	static Timer::Ptr m_BatchesTimer;
+
+	static void SendBatch(const Endpoint::Ptr& endpoint, const String& method, ArrayData batch);
+	static void FlushBatches();
+
+	typedef std::list<std::pair<Checkable::Ptr, Dictionary::Ptr>> CheckResultList;
+
+	static std::mutex m_CheckResultsMutex;
+	static CheckResultList m_CheckResults;
+	static std::map<Checkable::Ptr, CheckResultList::iterator> m_CheckResultsByCheckable;
+	static Timer::Ptr m_CheckResultsTimer;
+
+	static bool BatchCheckResult(const Checkable::Ptr& checkable, const Dictionary::Ptr& message);
+
 	static void RemoteCheckThreadProc();
 	static void EnqueueCheck(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 	static void ExecuteCheckFromQueue(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
@@ -0,0 +1,80 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "icinga/commandusage.hpp"
+#include "base/statsfunction.hpp"
+#include "base/type.hpp"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <utility>
+
+using namespace icinga;
+
+REGISTER_STATSFUNCTION(CommandUsage, &CommandUsage::StatsFunc);
+
+struct CommandUsageTotals
+{
+	uint_fast64_t Executions{0};
+	ProcessUsage Usage;
+};
+
+static std::mutex l_CommandUsageMutex;
+/* By command type and name. */
+static std::map<std::pair<String, String>, CommandUsageTotals> l_CommandUsage;
+
+/**
+ * Adds the resources used by a finished process of the given command. Does nothing
+ * for results which aren't from a process, e.g. if resolving the command line failed.
+ */
+void CommandUsage::Record(const Command::Ptr& command, const ProcessResult& pr)
+{
+	if (pr.PID <= 0)
+		return;
+
+	std::pair<String, String> key (command->GetReflectionType()->GetName(), command->GetName());
+
+	std::unique_lock<std::mutex> lock (l_CommandUsageMutex);
+	auto& totals (l_CommandUsage[std::move(key)]);
+
+	totals.Executions++;
+	totals.Usage.UserTime += pr.Usage.UserTime;
+	totals.Usage.SystemTime += pr.Usage.SystemTime;
+	totals.Usage.MaxRss = std::max(totals.Usage.MaxRss, pr.Usage.MaxRss);
+	totals.Usage.InBlocks += pr.Usage.InBlocks;
+	totals.Usage.OutBlocks += pr.Usage.OutBlocks;
+}
+
+Dictionary::Ptr CommandUsage::ToDictionary(const ProcessUsage& usage)
+{
+	return new Dictionary({
+		{ "user_time", usage.UserTime },
+		{ "system_time", usage.SystemTime },
+		{ "max_rss", usage.MaxRss },
+		{ "in_blocks", usage.InBlocks },
+		{ "out_blocks", usage.OutBlocks }
+	});
+}
+
+void CommandUsage::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr&)
+{
+	std::map<String, Dictionary::Ptr> types;
+
+	std::unique_lock<std::mutex> lock (l_CommandUsageMutex);
+
+	for (auto& kv : l_CommandUsage) {
+		auto& commands (types[kv.first.first]);
+
+		if (!commands)
+			commands = new Dictionary();
+
+		Dictionary::Ptr usage = ToDictionary(kv.second.Usage);
+		usage->Set("executions", kv.second.Executions);
+
+		commands->Set(kv.first.second, usage);
+	}
+
+	lock.unlock();
+
+	for (auto& kv : types)
+		status->Set(kv.first, kv.second);
+}
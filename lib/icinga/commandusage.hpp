@@ -0,0 +1,36 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef COMMANDUSAGE_H
+#define COMMANDUSAGE_H
+
+#include "icinga/i2-icinga.hpp"
+#include "icinga/command.hpp"
+#include "base/array.hpp"
+#include "base/dictionary.hpp"
+#include "base/process.hpp"
+
+namespace icinga
+{
+
+/**
+ * The resources used by the processes of check, event and notification commands,
+ * summed up per command since the start of the Icinga instance.
+ *
+ * @ingroup icinga
+ */
+class CommandUsage
+{
+public:
+	static void Record(const Command::Ptr& command, const ProcessResult& pr);
+
+	static Dictionary::Ptr ToDictionary(const ProcessUsage& usage);
+
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+
+private:
+	CommandUsage();
+};
+
+}
+
+#endif /* COMMANDUSAGE_H */
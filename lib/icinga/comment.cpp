@@ -132,6 +132,15 @@ int Comment::GetNextCommentID()
 
 String Comment::AddComment(const Checkable::Ptr& checkable, CommentType entryType, const String& author,
 	const String& text, bool persistent, double expireTime, bool sticky, const String& id, const MessageOrigin::Ptr& origin)
+{
+	return AddComments({ PrepareComment(checkable, entryType, author, text, persistent, expireTime, sticky, id) })[0]->GetName();
+}
+
+/**
+ * Builds the config of a comment to be created by AddComments().
+ */
+NewConfigObject Comment::PrepareComment(const Checkable::Ptr& checkable, CommentType entryType, const String& author,
+	const String& text, bool persistent, double expireTime, bool sticky, const String& id)
 {
 	String fullName;
 
@@ -165,9 +174,19 @@ String Comment::AddComment(const Checkable::Ptr& checkable, CommentType entryTyp
 
 	String config = ConfigObjectUtility::CreateObjectConfig(Comment::TypeInstance, fullName, true, nullptr, attrs);
 
+	return NewConfigObject{ Comment::TypeInstance, fullName, config };
+}
+
+/**
+ * Creates all of the given comments (see PrepareComment()) in one transaction.
+ *
+ * @returns The created comments in the given order.
+ */
+std::vector<Comment::Ptr> Comment::AddComments(const std::vector<NewConfigObject>& comments)
+{
 	Array::Ptr errors = new Array();
 
-	if (!ConfigObjectUtility::CreateObject(Comment::TypeInstance, fullName, config, errors, nullptr)) {
+	if (!ConfigObjectUtility::CreateObjects(comments, errors, nullptr)) {
 		ObjectLock olock(errors);
 		for (const String& error : errors) {
 			Log(LogCritical, "Comment", error);
@@ -176,15 +195,22 @@ String Comment::AddComment(const Checkable::Ptr& checkable, CommentType entryTyp
 		BOOST_THROW_EXCEPTION(std::runtime_error("Could not create comment."));
 	}
 
-	Comment::Ptr comment = Comment::GetByName(fullName);
+	std::vector<Comment::Ptr> result;
+	result.reserve(comments.size());
 
-	if (!comment)
-		BOOST_THROW_EXCEPTION(std::runtime_error("Could not create comment."));
+	for (auto& newComment : comments) {
+		Comment::Ptr comment = Comment::GetByName(newComment.Name);
 
-	Log(LogNotice, "Comment")
-		<< "Added comment '" << comment->GetName() << "'.";
+		if (!comment)
+			BOOST_THROW_EXCEPTION(std::runtime_error("Could not create comment."));
+
+		Log(LogNotice, "Comment")
+			<< "Added comment '" << comment->GetName() << "'.";
 
-	return fullName;
+		result.emplace_back(std::move(comment));
+	}
+
+	return result;
 }
 
 void Comment::RemoveComment(const String& id, bool removedManually, const String& removedBy,
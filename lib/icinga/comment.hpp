@@ -6,7 +6,9 @@
 #include "icinga/i2-icinga.hpp"
 #include "icinga/comment-ti.hpp"
 #include "icinga/checkable-ti.hpp"
+#include "remote/configobjectutility.hpp"
 #include "remote/messageorigin.hpp"
+#include <vector>
 
 namespace icinga
 {
@@ -38,6 +40,12 @@ public:
 		const String& author, const String& text, bool persistent, double expireTime, bool sticky = false,
 		const String& id = String(), const MessageOrigin::Ptr& origin = nullptr);
 
+	static NewConfigObject PrepareComment(const intrusive_ptr<Checkable>& checkable, CommentType entryType,
+		const String& author, const String& text, bool persistent, double expireTime, bool sticky = false,
+		const String& id = String());
+
+	static std::vector<Comment::Ptr> AddComments(const std::vector<NewConfigObject>& comments);
+
 	static void RemoveComment(const String& id, bool removedManually = false, const String& removedBy = "",
 		const MessageOrigin::Ptr& origin = nullptr);
 
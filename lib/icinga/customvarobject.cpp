@@ -3,6 +3,8 @@
 #include "icinga/customvarobject.hpp"
 #include "icinga/customvarobject-ti.cpp"
 #include "icinga/macroprocessor.hpp"
+#include "remote/filterutility.hpp"
+#include "base/initialize.hpp"
 #include "base/logger.hpp"
 #include "base/function.hpp"
 #include "base/exception.hpp"
@@ -12,6 +14,12 @@ using namespace icinga;
 
 REGISTER_TYPE(CustomVarObject);
 
+INITIALIZE_ONCE([]() {
+	CustomVarObject::OnVarsChanged.connect([](const CustomVarObject::Ptr&, const Value&) {
+		FilterIndex::Invalidate();
+	});
+});
+
 void CustomVarObject::ValidateVars(const Lazy<Dictionary::Ptr>& lvalue, const ValidationUtils& utils)
 {
 	MacroProcessor::ValidateCustomVars(this, lvalue());
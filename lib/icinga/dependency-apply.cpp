@@ -4,6 +4,7 @@
 #include "icinga/service.hpp"
 #include "config/configitembuilder.hpp"
 #include "config/applyrule.hpp"
+#include "config/configprofiler.hpp"
 #include "base/initialize.hpp"
 #include "base/configtype.hpp"
 #include "base/logger.hpp"
@@ -68,6 +69,10 @@ bool Dependency::EvaluateApplyRule(const Checkable::Ptr& checkable, const ApplyR
 
 	CONTEXT("Evaluating 'apply' rule (" << di << ")");
 
+	ConfigProfilerScope profile ("apply", [&rule, &di]() {
+		return ConfigProfiler::GetDefinitionName("Dependency", rule.GetName(), di);
+	});
+
 	Host::Ptr host;
 	Service::Ptr service;
 	tie(host, service) = GetHostService(checkable);
@@ -143,6 +148,14 @@ void Dependency::EvaluateApplyRules(const Host::Ptr& host)
 		if (EvaluateApplyRule(host, *rule, true))
 			rule->AddMatch();
 	}
+
+	std::set<ApplyRule::Ptr> varRules;
+	ApplyRule::GetTargetedHostVarRules(Dependency::TypeInstance, host, varRules);
+
+	for (auto& rule : varRules) {
+		if (EvaluateApplyRule(host, *rule))
+			rule->AddMatch();
+	}
 }
 
 void Dependency::EvaluateApplyRules(const Service::Ptr& service)
@@ -158,4 +171,17 @@ void Dependency::EvaluateApplyRules(const Service::Ptr& service)
 		if (EvaluateApplyRule(service, *rule, true))
 			rule->AddMatch();
 	}
+
+	for (auto& rule : ApplyRule::GetTargetedServicesOfHostRules(Dependency::TypeInstance, service->GetHost()->GetName())) {
+		if (EvaluateApplyRule(service, *rule, true))
+			rule->AddMatch();
+	}
+
+	std::set<ApplyRule::Ptr> varRules;
+	ApplyRule::GetTargetedServiceHostVarRules(Dependency::TypeInstance, service->GetHost(), varRules);
+
+	for (auto& rule : varRules) {
+		if (EvaluateApplyRule(service, *rule))
+			rule->AddMatch();
+	}
 }
@@ -176,7 +176,8 @@ void Dependency::OnAllConfigLoaded()
 	if (!m_Child)
 		BOOST_THROW_EXCEPTION(ScriptError("Dependency '" + GetName() + "' references a child host/service which doesn't exist.", GetDebugInfo()));
 
-	Host::Ptr parentHost = Host::GetByName(GetParentHostName());
+	/* E.g. apply Dependency ... to Service defaults the parent host to the child's one. */
+	Host::Ptr parentHost = GetParentHostName() == GetChildHostName() ? childHost : Host::GetByName(GetParentHostName());
 
 	if (parentHost) {
 		if (GetParentServiceName().IsEmpty())
@@ -323,3 +324,48 @@ void Dependency::SetChild(intrusive_ptr<Checkable> child)
 {
 	m_Child = child;
 }
+
+/* All of the following attributes are evaluated by IsAvailable() and may change at runtime, e.g. via the API. */
+
+void Dependency::SetRedundancyGroup(const String& value, bool suppress_events, const Value& cookie)
+{
+	ObjectImpl<Dependency>::SetRedundancyGroup(value, suppress_events, cookie);
+	InvalidateChildReachability();
+}
+
+void Dependency::SetPeriodRaw(const String& value, bool suppress_events, const Value& cookie)
+{
+	ObjectImpl<Dependency>::SetPeriodRaw(value, suppress_events, cookie);
+	InvalidateChildReachability();
+}
+
+void Dependency::SetStateFilter(int value, bool suppress_events, const Value& cookie)
+{
+	ObjectImpl<Dependency>::SetStateFilter(value, suppress_events, cookie);
+	InvalidateChildReachability();
+}
+
+void Dependency::SetIgnoreSoftStates(bool value, bool suppress_events, const Value& cookie)
+{
+	ObjectImpl<Dependency>::SetIgnoreSoftStates(value, suppress_events, cookie);
+	InvalidateChildReachability();
+}
+
+void Dependency::SetDisableChecks(bool value, bool suppress_events, const Value& cookie)
+{
+	ObjectImpl<Dependency>::SetDisableChecks(value, suppress_events, cookie);
+	InvalidateChildReachability();
+}
+
+void Dependency::SetDisableNotifications(bool value, bool suppress_events, const Value& cookie)
+{
+	ObjectImpl<Dependency>::SetDisableNotifications(value, suppress_events, cookie);
+	InvalidateChildReachability();
+}
+
+void Dependency::InvalidateChildReachability()
+{
+	/* m_Child is only set once the config has been loaded. */
+	if (m_Child)
+		m_Child->InvalidateReachability();
+}
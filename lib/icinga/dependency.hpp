@@ -42,6 +42,13 @@ public:
 	void SetParent(intrusive_ptr<Checkable> parent);
 	void SetChild(intrusive_ptr<Checkable> child);
 
+	void SetRedundancyGroup(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
+	void SetPeriodRaw(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
+	void SetStateFilter(int value, bool suppress_events = false, const Value& cookie = Empty) override;
+	void SetIgnoreSoftStates(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+	void SetDisableChecks(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+	void SetDisableNotifications(bool value, bool suppress_events = false, const Value& cookie = Empty) override;
+
 protected:
 	void OnConfigLoaded() override;
 	void OnAllConfigLoaded() override;
@@ -53,6 +60,8 @@ private:
 
 	static bool m_AssertNoCyclesForIndividualDeps;
 
+	void InvalidateChildReachability();
+
 	static bool EvaluateApplyRuleInstance(const Checkable::Ptr& checkable, const String& name, ScriptFrame& frame, const ApplyRule& rule, bool skipFilter);
 	static bool EvaluateApplyRule(const Checkable::Ptr& checkable, const ApplyRule& rule, bool skipFilter = false);
 };
@@ -9,8 +9,15 @@
 #include "base/utility.hpp"
 #include "base/timer.hpp"
 #include <boost/thread/once.hpp>
+#include <algorithm>
 #include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <set>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 using namespace icinga;
 
@@ -20,6 +27,17 @@ static std::map<int, Downtime::Ptr> l_LegacyDowntimesCache;
 static Timer::Ptr l_DowntimesOrphanedTimer;
 static Timer::Ptr l_DowntimesStartTimer;
 
+typedef std::pair<double /* start time */, String /* name */> DowntimeStartQueueEntry;
+
+/* Fixed downtimes which haven't been triggered yet, so that DowntimesStartTimerHandler() only looks at the due ones.
+ * Entries aren't removed when downtimes go away or change, they're checked when they're due instead. */
+static std::mutex l_DowntimeStartQueueMutex;
+static std::priority_queue<DowntimeStartQueueEntry, std::vector<DowntimeStartQueueEntry>, std::greater<>> l_DowntimeStartQueue;
+
+/* Downtimes by their config owner (the ScheduledDowntime which created them), see DowntimesOrphanedTimerHandler(). */
+static std::mutex l_DowntimesByConfigOwnerMutex;
+static std::unordered_map<String, std::set<Downtime::Ptr>> l_DowntimesByConfigOwner;
+
 boost::signals2::signal<void (const Downtime::Ptr&)> Downtime::OnDowntimeAdded;
 boost::signals2::signal<void (const Downtime::Ptr&)> Downtime::OnDowntimeRemoved;
 boost::signals2::signal<void (const Downtime::Ptr&)> Downtime::OnDowntimeStarted;
@@ -35,6 +53,25 @@ void Downtime::StaticInitialize()
 	ScriptGlobal::Set("Icinga.DowntimeNoChildren", "DowntimeNoChildren");
 	ScriptGlobal::Set("Icinga.DowntimeTriggeredChildren", "DowntimeTriggeredChildren");
 	ScriptGlobal::Set("Icinga.DowntimeNonTriggeredChildren", "DowntimeNonTriggeredChildren");
+
+	Downtime::OnStartTimeChanged.connect([](const Downtime::Ptr& downtime, const Value&) {
+		if (downtime->IsActive())
+			downtime->QueueStart();
+	});
+
+	/* Checkable::GetDowntimeDepth() is only recomputed at the next start or end of a downtime, otherwise. */
+	auto invalidateDowntimeDepth ([](const Downtime::Ptr& downtime, const Value&) {
+		Checkable::Ptr checkable = downtime->GetCheckable();
+
+		if (checkable)
+			checkable->InvalidateDowntimeDepth();
+	});
+
+	Downtime::OnStartTimeChanged.connect(invalidateDowntimeDepth);
+	Downtime::OnEndTimeChanged.connect(invalidateDowntimeDepth);
+	Downtime::OnTriggerTimeChanged.connect(invalidateDowntimeDepth);
+	Downtime::OnFixedChanged.connect(invalidateDowntimeDepth);
+	Downtime::OnDurationChanged.connect(invalidateDowntimeDepth);
 }
 
 String DowntimeNameComposer::MakeName(const String& shortName, const Object::Ptr& context) const
@@ -122,6 +159,15 @@ void Downtime::Start(bool runtimeCreated)
 	if (parent)
 		parent->RegisterChild(this);
 
+	String configOwner = GetConfigOwner();
+
+	if (!configOwner.IsEmpty()) {
+		std::unique_lock<std::mutex> lock (l_DowntimesByConfigOwnerMutex);
+		l_DowntimesByConfigOwner[configOwner].emplace(this);
+	}
+
+	QueueStart();
+
 	if (runtimeCreated)
 		OnDowntimeAdded(this);
 
@@ -161,6 +207,20 @@ void Downtime::Stop(bool runtimeRemoved)
 	if (parent)
 		parent->UnregisterChild(this);
 
+	String configOwner = GetConfigOwner();
+
+	if (!configOwner.IsEmpty()) {
+		std::unique_lock<std::mutex> lock (l_DowntimesByConfigOwnerMutex);
+		auto downtimes (l_DowntimesByConfigOwner.find(configOwner));
+
+		if (downtimes != l_DowntimesByConfigOwner.end()) {
+			downtimes->second.erase(this);
+
+			if (downtimes->second.empty())
+				l_DowntimesByConfigOwner.erase(downtimes);
+		}
+	}
+
 	if (runtimeRemoved)
 		OnDowntimeRemoved(this);
 
@@ -189,11 +249,35 @@ Checkable::Ptr Downtime::GetCheckable() const
 
 bool Downtime::IsInEffect() const
 {
-	double now = Utility::GetTime();
+	double nextTransition = std::numeric_limits<double>::infinity();
 
+	return IsInEffect(Utility::GetTime(), &nextTransition);
+}
+
+/**
+ * @param now The current time.
+ * @param nextTransition Lowered to the time the result changes at if it's earlier, left as is if the result
+ *                       only changes once the downtime is modified (e.g. triggered).
+ * @returns Whether the downtime is in effect at now.
+ */
+bool Downtime::IsInEffect(double now, double *nextTransition) const
+{
 	if (GetFixed()) {
 		/* fixed downtimes are in effect during the entire [start..end) interval */
-		return (now >= GetStartTime() && now < GetEndTime());
+		double startTime = GetStartTime();
+		double endTime = GetEndTime();
+
+		if (now < startTime) {
+			*nextTransition = std::min(*nextTransition, startTime);
+			return false;
+		}
+
+		if (now < endTime) {
+			*nextTransition = std::min(*nextTransition, endTime);
+			return true;
+		}
+
+		return false;
 	}
 
 	double triggerTime = GetTriggerTime();
@@ -202,7 +286,14 @@ bool Downtime::IsInEffect() const
 		/* flexible downtime has not been triggered yet */
 		return false;
 
-	return (now < triggerTime + GetDuration());
+	double endTime = triggerTime + GetDuration();
+
+	if (now < endTime) {
+		*nextTransition = std::min(*nextTransition, endTime);
+		return true;
+	}
+
+	return false;
 }
 
 bool Downtime::IsTriggered() const
@@ -254,19 +345,29 @@ Downtime::Ptr Downtime::AddDowntime(const Checkable::Ptr& checkable, const Strin
 	const Downtime::Ptr& parentDowntime, double duration,
 	const String& scheduledDowntime, const String& scheduledBy, const String& parent,
 	const String& id, const MessageOrigin::Ptr& origin)
+{
+	return AddDowntimes({ PrepareDowntime(checkable, author, comment, startTime, endTime, fixed,
+		parentDowntime ? parentDowntime->GetName() : String(), duration, scheduledDowntime, scheduledBy, parent, id) })[0];
+}
+
+/**
+ * Builds the config of a downtime to be created by AddDowntimes().
+ *
+ * @param triggeredBy The name of the downtime triggering this one, it may be created by the same AddDowntimes() call.
+ */
+NewConfigObject Downtime::PrepareDowntime(const Checkable::Ptr& checkable, const String& author,
+	const String& comment, double startTime, double endTime, bool fixed,
+	const String& triggeredBy, double duration,
+	const String& scheduledDowntime, const String& scheduledBy, const String& parent,
+	const String& id)
 {
 	String fullName;
-	String triggeredBy;
 
 	if (id.IsEmpty())
 		fullName = checkable->GetName() + "!" + Utility::NewUniqueID();
 	else
 		fullName = id;
 
-	if (parentDowntime) {
-		triggeredBy = parentDowntime->GetName();
-	}
-
 	Dictionary::Ptr attrs = new Dictionary();
 
 	attrs->Set("author", author);
@@ -326,9 +427,20 @@ Downtime::Ptr Downtime::AddDowntime(const Checkable::Ptr& checkable, const Strin
 
 	String config = ConfigObjectUtility::CreateObjectConfig(Downtime::TypeInstance, fullName, true, nullptr, attrs);
 
+	return NewConfigObject{ Downtime::TypeInstance, fullName, config };
+}
+
+/**
+ * Creates all of the given downtimes (see PrepareDowntime()) in one transaction,
+ * so that e.g. the cluster and Icinga DB receive them at once.
+ *
+ * @returns The created downtimes in the given order.
+ */
+std::vector<Downtime::Ptr> Downtime::AddDowntimes(const std::vector<NewConfigObject>& downtimes)
+{
 	Array::Ptr errors = new Array();
 
-	if (!ConfigObjectUtility::CreateObject(Downtime::TypeInstance, fullName, config, errors, nullptr)) {
+	if (!ConfigObjectUtility::CreateObjects(downtimes, errors, nullptr)) {
 		ObjectLock olock(errors);
 		for (const String& error : errors) {
 			Log(LogCritical, "Downtime", error);
@@ -337,26 +449,40 @@ Downtime::Ptr Downtime::AddDowntime(const Checkable::Ptr& checkable, const Strin
 		BOOST_THROW_EXCEPTION(std::runtime_error("Could not create downtime."));
 	}
 
-	if (parentDowntime) {
-		Array::Ptr triggers = parentDowntime->GetTriggers();
+	std::vector<Downtime::Ptr> result;
+	result.reserve(downtimes.size());
 
-		ObjectLock olock(triggers);
-		if (!triggers->Contains(fullName))
-			triggers->Add(fullName);
-	}
+	for (auto& newDowntime : downtimes) {
+		Downtime::Ptr downtime = Downtime::GetByName(newDowntime.Name);
 
-	Downtime::Ptr downtime = Downtime::GetByName(fullName);
+		if (!downtime)
+			BOOST_THROW_EXCEPTION(std::runtime_error("Could not create downtime object."));
 
-	if (!downtime)
-		BOOST_THROW_EXCEPTION(std::runtime_error("Could not create downtime object."));
+		Downtime::Ptr parentDowntime = Downtime::GetByName(downtime->GetTriggeredBy());
 
-	Log(LogInformation, "Downtime")
-		<< "Added downtime '" << downtime->GetName()
-		<< "' between '" << Utility::FormatDateTime("%Y-%m-%d %H:%M:%S", startTime)
-		<< "' and '" << Utility::FormatDateTime("%Y-%m-%d %H:%M:%S", endTime) << "', author: '"
-		<< author << "', " << (fixed ? "fixed" : "flexible with " + Convert::ToString(duration) + "s duration");
+		if (parentDowntime) {
+			Array::Ptr triggers = parentDowntime->GetTriggers();
+
+			ObjectLock olock(triggers);
+			if (!triggers->Contains(downtime->GetName()))
+				triggers->Add(downtime->GetName());
+		}
+
+		Log(downtimes.size() == 1u ? LogInformation : LogNotice, "Downtime")
+			<< "Added downtime '" << downtime->GetName()
+			<< "' between '" << Utility::FormatDateTime("%Y-%m-%d %H:%M:%S", downtime->GetStartTime())
+			<< "' and '" << Utility::FormatDateTime("%Y-%m-%d %H:%M:%S", downtime->GetEndTime()) << "', author: '"
+			<< downtime->GetAuthor() << "', " << (downtime->GetFixed() ? "fixed" : "flexible with " + Convert::ToString(downtime->GetDuration()) + "s duration");
+
+		result.emplace_back(std::move(downtime));
+	}
+
+	if (downtimes.size() > 1u) {
+		Log(LogInformation, "Downtime")
+			<< "Added " << downtimes.size() << " downtimes.";
+	}
 
-	return downtime;
+	return result;
 }
 
 void Downtime::RemoveDowntime(const String& id, bool includeChildren, bool cancelled, bool expired,
@@ -488,6 +614,7 @@ void Downtime::TriggerDowntime(double triggerTime)
 
 	if (GetTriggerTime() == 0) {
 		SetTriggerTime(triggerTime);
+		checkable->InvalidateDowntimeDepth();
 	}
 
 	{
@@ -536,13 +663,41 @@ Downtime::Ptr Downtime::GetDowntimeFromLegacyID(int id)
 	return it->second;
 }
 
+/**
+ * Makes DowntimesStartTimerHandler() look at this downtime once its start time has come, if it's a fixed one
+ * which hasn't been triggered yet. Flexible downtimes are triggered on-demand.
+ */
+void Downtime::QueueStart()
+{
+	if (!GetFixed() || GetTriggerTime() > 0)
+		return;
+
+	std::unique_lock<std::mutex> lock (l_DowntimeStartQueueMutex);
+	l_DowntimeStartQueue.emplace(GetStartTime(), GetName());
+}
+
 void Downtime::DowntimesStartTimerHandler()
 {
-	/* Start fixed downtimes. Flexible downtimes will be triggered on-demand. */
-	for (const Downtime::Ptr& downtime : ConfigType::GetObjectsByType<Downtime>()) {
-		if (downtime->IsActive() &&
-			downtime->CanBeTriggered() &&
-			downtime->GetFixed()) {
+	double now = Utility::GetTime();
+	std::vector<DowntimeStartQueueEntry> due;
+
+	{
+		std::unique_lock<std::mutex> lock (l_DowntimeStartQueueMutex);
+
+		while (!l_DowntimeStartQueue.empty() && l_DowntimeStartQueue.top().first <= now) {
+			due.emplace_back(l_DowntimeStartQueue.top());
+			l_DowntimeStartQueue.pop();
+		}
+	}
+
+	for (auto& entry : due) {
+		Downtime::Ptr downtime = Downtime::GetByName(entry.second);
+
+		/* Removed, or its start time has changed which queued it again. */
+		if (!downtime || !downtime->IsActive() || downtime->GetStartTime() != entry.first)
+			continue;
+
+		if (downtime->CanBeTriggered() && downtime->GetFixed()) {
 			/* Send notifications. */
 			OnDowntimeStarted(downtime);
 
@@ -554,7 +709,19 @@ void Downtime::DowntimesStartTimerHandler()
 
 void Downtime::DowntimesOrphanedTimerHandler()
 {
-	for (const Downtime::Ptr& downtime : ConfigType::GetObjectsByType<Downtime>()) {
+	std::vector<Downtime::Ptr> orphaned;
+
+	{
+		std::unique_lock<std::mutex> lock (l_DowntimesByConfigOwnerMutex);
+
+		/* Downtimes can only become orphaned by their ScheduledDowntime going away. */
+		for (auto& kv : l_DowntimesByConfigOwner) {
+			if (!GetObject<ScheduledDowntime>(kv.first))
+				orphaned.insert(orphaned.end(), kv.second.begin(), kv.second.end());
+		}
+	}
+
+	for (const Downtime::Ptr& downtime : orphaned) {
 		/* Only remove downtimes which are activated after daemon start. */
 		if (downtime->IsActive() && !downtime->HasValidConfigOwner())
 			RemoveDowntime(downtime->GetName(), false, false, true);
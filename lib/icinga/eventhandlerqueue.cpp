@@ -0,0 +1,184 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "icinga/eventhandlerqueue.hpp"
+#include "icinga/icingaapplication.hpp"
+#include "base/logger.hpp"
+#include "base/perfdatavalue.hpp"
+#include "base/statsfunction.hpp"
+#include "base/utility.hpp"
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using namespace icinga;
+
+REGISTER_STATSFUNCTION(EventHandlerQueue, &EventHandlerQueue::StatsFunc);
+
+struct QueuedEventHandler
+{
+	EventCommand::Ptr Command;
+	std::function<void()> Execute;
+};
+
+/* The most event handler executions waiting for a free slot. */
+static const size_t l_MaxQueuedEventHandlers = 10000;
+
+static std::mutex l_EventHandlersMutex;
+
+/* Checkables in the order their (first) waiting execution has been queued. */
+static std::list<Checkable::Ptr> l_EventHandlerOrder;
+static std::map<Checkable::Ptr, QueuedEventHandler> l_QueuedEventHandlers;
+
+static int l_RunningEventHandlers = 0;
+static std::map<EventCommand::Ptr, int> l_RunningEventHandlersByCommand;
+
+static uint_fast64_t l_EventHandlersDelayed = 0;
+static uint_fast64_t l_EventHandlersSuperseded = 0;
+static uint_fast64_t l_EventHandlersDropped = 0;
+
+/**
+ * @returns Whether one more execution of the given command is allowed to run now.
+ */
+static bool HasFreeSlot(const EventCommand::Ptr& command, int maxTotal)
+{
+	if (maxTotal > 0 && l_RunningEventHandlers >= maxTotal)
+		return false;
+
+	int maxCommand = command->GetMaxConcurrent();
+
+	if (maxCommand > 0) {
+		auto it (l_RunningEventHandlersByCommand.find(command));
+
+		if (it != l_RunningEventHandlersByCommand.end() && it->second >= maxCommand)
+			return false;
+	}
+
+	return true;
+}
+
+static void TakeSlot(const EventCommand::Ptr& command)
+{
+	l_RunningEventHandlers++;
+	l_RunningEventHandlersByCommand[command]++;
+}
+
+/**
+ * Runs execute now if both limits allow it or else once they do, see Release().
+ *
+ * @param checkable The checkable the event handler is executed for
+ * @param command The event command to execute
+ * @param execute Executes the command, Release() has to be called once the execution has finished
+ */
+void EventHandlerQueue::Enqueue(const Checkable::Ptr& checkable, const EventCommand::Ptr& command, std::function<void()> execute)
+{
+	int maxTotal = IcingaApplication::GetInstance()->GetMaxConcurrentEventHandlers();
+
+	{
+		std::unique_lock<std::mutex> lock (l_EventHandlersMutex);
+		auto queued (l_QueuedEventHandlers.find(checkable));
+
+		if (queued != l_QueuedEventHandlers.end()) {
+			/* Only the latest state change is worth handling. */
+			queued->second = QueuedEventHandler{command, std::move(execute)};
+			l_EventHandlersSuperseded++;
+			return;
+		}
+
+		if (!HasFreeSlot(command, maxTotal)) {
+			if (l_QueuedEventHandlers.size() >= l_MaxQueuedEventHandlers) {
+				l_EventHandlersDropped++;
+				lock.unlock();
+
+				Log(LogWarning, "EventHandlerQueue")
+					<< "Dropping event handler '" << command->GetName() << "' for checkable '" << checkable->GetName()
+					<< "' as " << l_MaxQueuedEventHandlers << " event handlers are already waiting.";
+				return;
+			}
+
+			l_EventHandlerOrder.emplace_back(checkable);
+			l_QueuedEventHandlers.emplace(checkable, QueuedEventHandler{command, std::move(execute)});
+			l_EventHandlersDelayed++;
+			return;
+		}
+
+		TakeSlot(command);
+	}
+
+	execute();
+}
+
+/**
+ * Frees the slot of a finished execution of the given command and starts the waiting ones which fit now.
+ */
+void EventHandlerQueue::Release(const EventCommand::Ptr& command)
+{
+	int maxTotal = IcingaApplication::GetInstance()->GetMaxConcurrentEventHandlers();
+	std::vector<std::function<void()>> executions;
+
+	{
+		std::unique_lock<std::mutex> lock (l_EventHandlersMutex);
+
+		l_RunningEventHandlers--;
+
+		auto running (l_RunningEventHandlersByCommand.find(command));
+
+		if (running != l_RunningEventHandlersByCommand.end() && --running->second <= 0)
+			l_RunningEventHandlersByCommand.erase(running);
+
+		for (auto it (l_EventHandlerOrder.begin()); it != l_EventHandlerOrder.end() && (maxTotal <= 0 || l_RunningEventHandlers < maxTotal);) {
+			auto queued (l_QueuedEventHandlers.find(*it));
+
+			/* Waiting for its own command's limit */
+			if (!HasFreeSlot(queued->second.Command, maxTotal)) {
+				++it;
+				continue;
+			}
+
+			TakeSlot(queued->second.Command);
+			executions.emplace_back(std::move(queued->second.Execute));
+
+			l_QueuedEventHandlers.erase(queued);
+			it = l_EventHandlerOrder.erase(it);
+		}
+	}
+
+	/* Don't spawn processes in the thread which has reported the finished one. */
+	for (auto& execute : executions)
+		Utility::QueueAsyncCallback(std::move(execute));
+}
+
+void EventHandlerQueue::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
+{
+	std::unique_lock<std::mutex> lock (l_EventHandlersMutex);
+
+	Dictionary::Ptr running = new Dictionary();
+
+	for (auto& kv : l_RunningEventHandlersByCommand)
+		running->Set(kv.first->GetName(), kv.second);
+
+	int runningTotal = l_RunningEventHandlers;
+	size_t queued = l_QueuedEventHandlers.size();
+	uint_fast64_t delayed = l_EventHandlersDelayed;
+	uint_fast64_t superseded = l_EventHandlersSuperseded;
+	uint_fast64_t dropped = l_EventHandlersDropped;
+
+	lock.unlock();
+
+	status->Set("event_handlers", new Dictionary({
+		{ "max_concurrent", IcingaApplication::GetInstance()->GetMaxConcurrentEventHandlers() },
+		{ "running", runningTotal },
+		{ "running_by_command", running },
+		{ "queued", queued },
+		{ "delayed", delayed },
+		{ "superseded", superseded },
+		{ "dropped", dropped }
+	}));
+
+	perfdata->Add(new PerfdataValue("event_handlers_running", runningTotal));
+	perfdata->Add(new PerfdataValue("event_handlers_queued", queued));
+	perfdata->Add(new PerfdataValue("event_handlers_superseded", superseded, true));
+	perfdata->Add(new PerfdataValue("event_handlers_dropped", dropped, true));
+}
@@ -0,0 +1,37 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef EVENTHANDLERQUEUE_H
+#define EVENTHANDLERQUEUE_H
+
+#include "icinga/i2-icinga.hpp"
+#include "icinga/checkable.hpp"
+#include "icinga/eventcommand.hpp"
+#include "base/array.hpp"
+#include "base/dictionary.hpp"
+#include <functional>
+
+namespace icinga
+{
+
+/**
+ * Limits the event handler processes run at once, in total (MaxConcurrentEventHandlers)
+ * and per EventCommand (max_concurrent). The ones exceeding a limit wait in a bounded queue
+ * which holds at most one execution per checkable, a later one replaces the waiting one.
+ *
+ * @ingroup icinga
+ */
+class EventHandlerQueue
+{
+public:
+	static void Enqueue(const Checkable::Ptr& checkable, const EventCommand::Ptr& command, std::function<void()> execute);
+	static void Release(const EventCommand::Ptr& command);
+
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+
+private:
+	EventHandlerQueue();
+};
+
+}
+
+#endif /* EVENTHANDLERQUEUE_H */
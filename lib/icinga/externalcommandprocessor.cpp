@@ -41,20 +41,36 @@ void ExternalCommandProcessor::Execute(const String& line)
 		BOOST_THROW_EXCEPTION(std::invalid_argument("Missing timestamp in command: " + line));
 
 	String timestamp = line.SubStr(1, pos - 1);
-	String args = line.SubStr(pos + 2, String::NPos);
 
 	double ts = Convert::ToDouble(timestamp);
 
 	if (ts == 0)
 		BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid timestamp in command: " + line));
 
-	std::vector<String> argv = args.Split(";");
+	/* Split "COMMAND;arg1;arg2..." directly into the command and its arguments. */
+	String command;
+	std::vector<String> arguments;
+	String::SizeType begin = std::min(pos + 2, line.GetLength());
+	bool first = true;
+
+	for (;;) {
+		String::SizeType end = line.FindFirstOf(';', begin);
+		String field = line.SubStr(begin, end == String::NPos ? String::NPos : end - begin);
+
+		if (first) {
+			command = std::move(field);
+			first = false;
+		} else {
+			arguments.emplace_back(std::move(field));
+		}
 
-	if (argv.empty())
-		BOOST_THROW_EXCEPTION(std::invalid_argument("Missing arguments in command: " + line));
+		if (end == String::NPos)
+			break;
 
-	std::vector<String> argvExtra(argv.begin() + 1, argv.end());
-	Execute(ts, argv[0], argvExtra);
+		begin = end + 1;
+	}
+
+	Execute(ts, command, arguments);
 }
 
 void ExternalCommandProcessor::Execute(double time, const String& command, const std::vector<String>& arguments)
@@ -68,8 +84,7 @@ void ExternalCommandProcessor::Execute(double time, const String& command, const
 	});
 
 	{
-		std::unique_lock<std::mutex> lock(GetMutex());
-
+		/* The commands are only registered once (above), so they can be looked up without the lock. */
 		auto it = GetCommands().find(command);
 
 		if (it == GetCommands().end())
@@ -1048,19 +1063,19 @@ void ExternalCommandProcessor::ScheduleAndPropagateHostDowntime(double, const st
 		Convert::ToBool(is_fixed), triggeredBy, Convert::ToDouble(arguments[5]));
 
 	/* Schedule downtime for all child hosts */
-	for (const Checkable::Ptr& child : host->GetAllChildren()) {
+	host->VisitAllChildren([&](const Checkable::Ptr& child) {
 		Host::Ptr host;
 		Service::Ptr service;
 		tie(host, service) = GetHostService(child);
 
 		/* ignore all service children */
 		if (service)
-			continue;
+			return;
 
 		(void) Downtime::AddDowntime(child, arguments[6], arguments[7],
 			Convert::ToDouble(arguments[1]), Convert::ToDouble(arguments[2]),
 			Convert::ToBool(is_fixed), triggeredBy, Convert::ToDouble(arguments[5]));
-	}
+	});
 }
 
 void ExternalCommandProcessor::ScheduleAndPropagateTriggeredHostDowntime(double, const std::vector<String>& arguments)
@@ -1086,19 +1101,19 @@ void ExternalCommandProcessor::ScheduleAndPropagateTriggeredHostDowntime(double,
 		Convert::ToBool(is_fixed), triggeredBy, Convert::ToDouble(arguments[5]));
 
 	/* Schedule downtime for all child hosts and explicitely trigger them through the parent host's downtime */
-	for (const Checkable::Ptr& child : host->GetAllChildren()) {
+	host->VisitAllChildren([&](const Checkable::Ptr& child) {
 		Host::Ptr host;
 		Service::Ptr service;
 		tie(host, service) = GetHostService(child);
 
 		/* ignore all service children */
 		if (service)
-			continue;
+			return;
 
 		(void) Downtime::AddDowntime(child, arguments[6], arguments[7],
 			Convert::ToDouble(arguments[1]), Convert::ToDouble(arguments[2]),
 			Convert::ToBool(is_fixed), parentDowntime, Convert::ToDouble(arguments[5]));
-	}
+	});
 }
 
 void ExternalCommandProcessor::DelHostDowntime(double, const std::vector<String>& arguments)
@@ -2301,8 +2316,8 @@ std::mutex& ExternalCommandProcessor::GetMutex()
 	return mtx;
 }
 
-std::map<String, ExternalCommandInfo>& ExternalCommandProcessor::GetCommands()
+std::unordered_map<String, ExternalCommandInfo>& ExternalCommandProcessor::GetCommands()
 {
-	static std::map<String, ExternalCommandInfo> commands;
+	static std::unordered_map<String, ExternalCommandInfo> commands;
 	return commands;
 }
@@ -7,6 +7,7 @@
 #include "icinga/command.hpp"
 #include "base/string.hpp"
 #include <boost/signals2.hpp>
+#include <unordered_map>
 #include <vector>
 
 namespace icinga
@@ -160,7 +161,7 @@ private:
 	static void RegisterCommands();
 
 	static std::mutex& GetMutex();
-	static std::map<String, ExternalCommandInfo>& GetCommands();
+	static std::unordered_map<String, ExternalCommandInfo>& GetCommands();
 
 };
 
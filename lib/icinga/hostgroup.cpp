@@ -15,7 +15,7 @@ using namespace icinga;
 REGISTER_TYPE(HostGroup);
 
 INITIALIZE_ONCE([]() {
-	ObjectRule::RegisterType("HostGroup");
+	ObjectRule::RegisterType("HostGroup", "Host");
 });
 
 bool HostGroup::EvaluateObjectRule(const Host::Ptr& host, const ConfigItem::Ptr& group)
@@ -47,11 +47,9 @@ void HostGroup::EvaluateObjectRules(const Host::Ptr& host)
 {
 	CONTEXT("Evaluating group memberships for host '" << host->GetName() << "'");
 
-	for (const ConfigItem::Ptr& group : ConfigItem::GetItems(HostGroup::TypeInstance))
+	/* Only the groups whose assign rule may match at all */
+	for (const ConfigItem::Ptr& group : ObjectRule::GetCandidates(HostGroup::TypeInstance, host->GetName(), String(), host))
 	{
-		if (!group->GetFilter())
-			continue;
-
 		EvaluateObjectRule(host, group);
 	}
 }
@@ -5,8 +5,6 @@
 #include "icinga/cib.hpp"
 #include "icinga/macroprocessor.hpp"
 #include "config/configcompiler.hpp"
-#include "base/atomic-file.hpp"
-#include "base/configwriter.hpp"
 #include "base/configtype.hpp"
 #include "base/exception.hpp"
 #include "base/logger.hpp"
@@ -18,12 +16,16 @@
 #include "base/scriptglobal.hpp"
 #include "base/initialize.hpp"
 #include "base/statsfunction.hpp"
+#include "base/statssegment.hpp"
+#include "base/threadaffinity.hpp"
 #include "base/loader.hpp"
+#include <algorithm>
 #include <fstream>
 
 using namespace icinga;
 
 static Timer::Ptr l_RetentionTimer;
+static int l_RetentionJournalDumps = 0;
 
 REGISTER_TYPE(IcingaApplication);
 /* Ensure that the priority is lower than the basic System namespace initialization in scriptframe.cpp. */
@@ -50,6 +52,9 @@ void IcingaApplication::StaticInitialize()
 
 	ScriptGlobal::Set("ReloadTimeout", 300);
 	ScriptGlobal::Set("MaxConcurrentChecks", 512);
+	ScriptGlobal::Set("MaxConcurrentEventHandlers", 128);
+	ScriptGlobal::Set("CheckTraceSampleRate", 0);
+	ScriptGlobal::Set("StartupConcurrency", 4);
 
 	Namespace::Ptr systemNS = ScriptGlobal::Get("System");
 	/* Ensure that the System namespace is already initialized. Otherwise this is a programming error. */
@@ -92,6 +97,7 @@ void IcingaApplication::StatsFunc(const Dictionary::Ptr& status, const Array::Pt
 	}
 
 	status->Set("icingaapplication", new Dictionary(std::move(nodes)));
+	status->Set("thread_affinity", ThreadAffinity::GetReport());
 }
 
 /**
@@ -105,10 +111,21 @@ int IcingaApplication::Main()
 
 	/* periodically dump the program state */
 	l_RetentionTimer = Timer::Create();
-	l_RetentionTimer->SetInterval(300);
-	l_RetentionTimer->OnTimerExpired.connect([this](const Timer * const&) { DumpProgramState(); });
+	l_RetentionTimer->SetInterval(GetRetentionInterval());
+	l_RetentionTimer->OnTimerExpired.connect([this](const Timer * const&) { DumpProgramState(false); });
 	l_RetentionTimer->Start();
 
+	ThreadAffinity::ApplyAll();
+
+	if (!Configuration::StatsSegmentPath.IsEmpty()) {
+		try {
+			StatsSegment::Start(Configuration::StatsSegmentPath);
+		} catch (const std::exception& ex) {
+			Log(LogCritical, "IcingaApplication")
+				<< "Failed to create the stats segment '" << Configuration::StatsSegmentPath << "': " << DiagnosticInformation(ex, false);
+		}
+	}
+
 	RunEventLoop();
 
 	Log(LogInformation, "IcingaApplication", "Icinga has shut down.");
@@ -123,72 +140,56 @@ void IcingaApplication::OnShutdown()
 		l_RetentionTimer->Stop();
 	}
 
-	DumpProgramState();
+	StatsSegment::Stop();
+
+	DumpProgramState(true);
 }
 
-static void PersistModAttrHelper(AtomicFile& fp, ConfigObject::Ptr& previousObject, const ConfigObject::Ptr& object, const String& attr, const Value& value)
+/**
+ * Writes the state and the modified attributes of all objects, or only of those which changed since the last dump
+ * to the journals if the latest full dump (snapshot) is younger than retention_snapshot_interval.
+ *
+ * @param snapshot Whether to write a full dump anyway.
+ */
+void IcingaApplication::DumpProgramState(bool snapshot)
 {
-	if (object != previousObject) {
-		if (previousObject) {
-			ConfigWriter::EmitRaw(fp, "\tobj.version = ");
-			ConfigWriter::EmitValue(fp, 0, previousObject->GetVersion());
-			ConfigWriter::EmitRaw(fp, "\n}\n\n");
-		}
-
-		ConfigWriter::EmitRaw(fp, "var obj = ");
+	int journalDumps = std::max(static_cast<int>(GetRetentionSnapshotInterval() / GetRetentionInterval() + 0.5), 1) - 1;
 
-		Array::Ptr args1 = new Array({
-			object->GetReflectionType()->GetName(),
-			object->GetName()
-		});
-		ConfigWriter::EmitFunctionCall(fp, "get_object", args1);
+	if (!snapshot && l_RetentionJournalDumps < journalDumps) {
+		try {
+			snapshot = !ConfigObject::DumpDirtyObjects(Configuration::StatePath);
+		} catch (const std::exception& ex) {
+			Log(LogWarning, "IcingaApplication")
+				<< "Failed to append to the state journal, writing the full state file instead: " << DiagnosticInformation(ex, false);
 
-		ConfigWriter::EmitRaw(fp, "\nif (obj) {\n");
+			snapshot = true;
+		}
+	} else {
+		snapshot = true;
 	}
 
-	ConfigWriter::EmitRaw(fp, "\tobj.");
-
-	Array::Ptr args2 = new Array({
-		attr,
-		value
-	});
-	ConfigWriter::EmitFunctionCall(fp, "modify_attribute", args2);
-
-	ConfigWriter::EmitRaw(fp, "\n");
-
-	previousObject = object;
-}
+	if (snapshot) {
+		ConfigObject::DumpObjects(Configuration::StatePath);
+		l_RetentionJournalDumps = 0;
+	} else {
+		l_RetentionJournalDumps++;
+	}
 
-void IcingaApplication::DumpProgramState()
-{
-	ConfigObject::DumpObjects(Configuration::StatePath);
-	DumpModifiedAttributes();
+	DumpModifiedAttributes(snapshot);
 }
 
-void IcingaApplication::DumpModifiedAttributes()
+/**
+ * Appends the modified attributes which changed since the last dump to their journal, or rewrites it.
+ *
+ * @param compact Whether to rewrite the journal.
+ */
+void IcingaApplication::DumpModifiedAttributes(bool compact)
 {
-	String path = Configuration::ModAttrPath;
-
-	try {
-		Utility::Glob(path + ".tmp.*", &Utility::Remove, GlobFile);
-	} catch (const std::exception& ex) {
-		Log(LogWarning, "IcingaApplication") << DiagnosticInformation(ex);
-	}
-
-	AtomicFile fp (path, 0644);
-
-	ConfigObject::Ptr previousObject;
-	ConfigObject::DumpModifiedAttributes([&fp, &previousObject](const ConfigObject::Ptr& object, const String& attr, const Value& value) {
-		PersistModAttrHelper(fp, previousObject, object, attr, value);
-	});
+	ConfigObject::DumpModifiedAttributesJournal(Configuration::ModAttrPath + ".journal", compact);
 
-	if (previousObject) {
-		ConfigWriter::EmitRaw(fp, "\tobj.version = ");
-		ConfigWriter::EmitValue(fp, 0, previousObject->GetVersion());
-		ConfigWriter::EmitRaw(fp, "\n}\n");
-	}
-
-	fp.Commit();
+	/* The journal replaces the config file written by older versions. */
+	if (Utility::PathExists(Configuration::ModAttrPath))
+		Utility::Remove(Configuration::ModAttrPath);
 }
 
 IcingaApplication::Ptr IcingaApplication::GetInstance()
@@ -305,6 +306,11 @@ int IcingaApplication::GetMaxConcurrentChecks() const
 	return ScriptGlobal::Get("MaxConcurrentChecks");
 }
 
+int IcingaApplication::GetMaxConcurrentEventHandlers() const
+{
+	return ScriptGlobal::Get("MaxConcurrentEventHandlers", &Empty);
+}
+
 String IcingaApplication::GetEnvironment() const
 {
 	return Application::GetAppEnvironment();
@@ -319,3 +325,19 @@ void IcingaApplication::ValidateVars(const Lazy<Dictionary::Ptr>& lvalue, const
 {
 	MacroProcessor::ValidateCustomVars(this, lvalue());
 }
+
+void IcingaApplication::ValidateRetentionInterval(const Lazy<double>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<IcingaApplication>::ValidateRetentionInterval(lvalue, utils);
+
+	if (lvalue() <= 0)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "retention_interval" }, "Interval must be greater than 0."));
+}
+
+void IcingaApplication::ValidateRetentionSnapshotInterval(const Lazy<double>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<IcingaApplication>::ValidateRetentionSnapshotInterval(lvalue, utils);
+
+	if (lvalue() <= 0)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "retention_snapshot_interval" }, "Interval must be greater than 0."));
+}
@@ -34,15 +34,18 @@ public:
 	String GetNodeName() const;
 
 	int GetMaxConcurrentChecks() const;
+	int GetMaxConcurrentEventHandlers() const;
 
 	String GetEnvironment() const override;
 	void SetEnvironment(const String& value, bool suppress_events = false, const Value& cookie = Empty) override;
 
 	void ValidateVars(const Lazy<Dictionary::Ptr>& lvalue, const ValidationUtils& utils) override;
+	void ValidateRetentionInterval(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
+	void ValidateRetentionSnapshotInterval(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
 
 private:
-	void DumpProgramState();
-	void DumpModifiedAttributes();
+	void DumpProgramState(bool snapshot);
+	void DumpModifiedAttributes(bool compact);
 
 	void OnShutdown() override;
 };
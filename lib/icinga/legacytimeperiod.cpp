@@ -169,6 +169,19 @@ boost::gregorian::date LegacyTimePeriod::GetEndOfMonthDay(int year, int month)
  */
 void LegacyTimePeriod::ParseTimeSpec(const String& timespec, tm *begin, tm *end, const tm *reference)
 {
+	EvaluateTimeSpec(CompileTimeSpec(timespec), begin, end, reference);
+}
+
+/**
+ * Parses a day as accepted by ParseTimeSpec(). Throws for invalid specifications.
+ *
+ * @param timespec Day, for example "2021-10-20", "sunday", ...
+ * @return The day which can be evaluated for any reference time with EvaluateTimeSpec()
+ */
+LegacyTimeSpec LegacyTimePeriod::CompileTimeSpec(const String& timespec)
+{
+	LegacyTimeSpec spec { LegacyTimeSpecDate, 0, -1, 0, -1, false };
+
 	/* YYYY-MM-DD */
 	if (timespec.GetLength() == 10 && timespec[4] == '-' && timespec[7] == '-') {
 		int year = Convert::ToLong(timespec.SubStr(0, 4));
@@ -180,29 +193,11 @@ void LegacyTimePeriod::ParseTimeSpec(const String& timespec, tm *begin, tm *end,
 		if (day < 1 || day > 31)
 			BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid day in time specification: " + timespec));
 
-		if (begin) {
-			*begin = *reference;
-			begin->tm_year = year - 1900;
-			begin->tm_mon = month - 1;
-			begin->tm_mday = day;
-			begin->tm_hour = 0;
-			begin->tm_min = 0;
-			begin->tm_sec = 0;
-			begin->tm_isdst = -1;
-		}
+		spec.Year = year;
+		spec.Month = month - 1;
+		spec.Day = day;
 
-		if (end) {
-			*end = *reference;
-			end->tm_year = year - 1900;
-			end->tm_mon = month - 1;
-			end->tm_mday = day;
-			end->tm_hour = 24;
-			end->tm_min = 0;
-			end->tm_sec = 0;
-			end->tm_isdst = -1;
-		}
-
-		return;
+		return spec;
 	}
 
 	std::vector<String> tokens = timespec.Split(" ");
@@ -210,114 +205,161 @@ void LegacyTimePeriod::ParseTimeSpec(const String& timespec, tm *begin, tm *end,
 	int mon = -1;
 
 	if (tokens.size() > 1 && (tokens[0] == "day" || (mon = MonthFromString(tokens[0])) != -1)) {
-		if (mon == -1)
-			mon = reference->tm_mon;
+		spec.Type = LegacyTimeSpecMonthDay;
+		spec.Month = mon;
+		spec.Day = Convert::ToLong(tokens[1]);
 
-		int mday = Convert::ToLong(tokens[1]);
+		return spec;
+	}
 
-		if (begin) {
-			*begin = *reference;
-			begin->tm_mon = mon;
-			begin->tm_mday = mday;
-			begin->tm_hour = 0;
-			begin->tm_min = 0;
-			begin->tm_sec = 0;
-			begin->tm_isdst = -1;
+	int wday;
 
-			/* day -X: Negative days are relative to the next month. */
-			if (mday < 0) {
-				boost::gregorian::date d(GetEndOfMonthDay(reference->tm_year + 1900, mon + 1)); //TODO: Refactor this mess into full Boost.DateTime
+	if (tokens.size() >= 1 && (wday = WeekdayFromString(tokens[0])) != -1) {
+		spec.Type = LegacyTimeSpecWeekday;
+		spec.Weekday = wday;
 
-				//Depending on the number, we need to substract specific days (counting starts at 0).
-				d = d - boost::gregorian::days(mday * -1 - 1);
+		if (tokens.size() > 2) {
+			spec.Month = MonthFromString(tokens[2]);
 
-				*begin = boost::gregorian::to_tm(d);
+			if (spec.Month == -1)
+				BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid month in time specification: " + timespec));
+		}
+
+		if (tokens.size() > 1) {
+			spec.Day = Convert::ToLong(tokens[1]);
+			spec.HasDay = true;
+		}
+
+		return spec;
+	}
+
+	BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid time specification: " + timespec));
+}
+
+/**
+ * Same as ParseTimeSpec(), but for an already parsed day.
+ */
+void LegacyTimePeriod::EvaluateTimeSpec(const LegacyTimeSpec& spec, tm *begin, tm *end, const tm *reference)
+{
+	switch (spec.Type) {
+		case LegacyTimeSpecDate:
+			if (begin) {
+				*begin = *reference;
+				begin->tm_year = spec.Year - 1900;
+				begin->tm_mon = spec.Month;
+				begin->tm_mday = spec.Day;
 				begin->tm_hour = 0;
 				begin->tm_min = 0;
 				begin->tm_sec = 0;
+				begin->tm_isdst = -1;
 			}
-		}
 
-		if (end) {
-			*end = *reference;
-			end->tm_mon = mon;
-			end->tm_mday = mday;
-			end->tm_hour = 24;
-			end->tm_min = 0;
-			end->tm_sec = 0;
-			end->tm_isdst = -1;
+			if (end) {
+				*end = *reference;
+				end->tm_year = spec.Year - 1900;
+				end->tm_mon = spec.Month;
+				end->tm_mday = spec.Day;
+				end->tm_hour = 24;
+				end->tm_min = 0;
+				end->tm_sec = 0;
+				end->tm_isdst = -1;
+			}
+
+			return;
+
+		case LegacyTimeSpecMonthDay: {
+			int mon = spec.Month == -1 ? reference->tm_mon : spec.Month;
+			int mday = spec.Day;
 
-			/* day -X: Negative days are relative to the next month. */
-			if (mday < 0) {
-				boost::gregorian::date d(GetEndOfMonthDay(reference->tm_year + 1900, mon + 1)); //TODO: Refactor this mess into full Boost.DateTime
+			if (begin) {
+				*begin = *reference;
+				begin->tm_mon = mon;
+				begin->tm_mday = mday;
+				begin->tm_hour = 0;
+				begin->tm_min = 0;
+				begin->tm_sec = 0;
+				begin->tm_isdst = -1;
 
-				//Depending on the number, we need to substract specific days (counting starts at 0).
-				d = d - boost::gregorian::days(mday * -1 - 1);
+				/* day -X: Negative days are relative to the next month. */
+				if (mday < 0) {
+					boost::gregorian::date d(GetEndOfMonthDay(reference->tm_year + 1900, mon + 1)); //TODO: Refactor this mess into full Boost.DateTime
 
-				// End date is one day in the future, starting 00:00:00
-				d = d + boost::gregorian::days(1);
+					//Depending on the number, we need to substract specific days (counting starts at 0).
+					d = d - boost::gregorian::days(mday * -1 - 1);
 
-				*end = boost::gregorian::to_tm(d);
-				end->tm_hour = 0;
+					*begin = boost::gregorian::to_tm(d);
+					begin->tm_hour = 0;
+					begin->tm_min = 0;
+					begin->tm_sec = 0;
+				}
+			}
+
+			if (end) {
+				*end = *reference;
+				end->tm_mon = mon;
+				end->tm_mday = mday;
+				end->tm_hour = 24;
 				end->tm_min = 0;
 				end->tm_sec = 0;
-			}
-		}
+				end->tm_isdst = -1;
 
-		return;
-	}
+				/* day -X: Negative days are relative to the next month. */
+				if (mday < 0) {
+					boost::gregorian::date d(GetEndOfMonthDay(reference->tm_year + 1900, mon + 1)); //TODO: Refactor this mess into full Boost.DateTime
 
-	int wday;
+					//Depending on the number, we need to substract specific days (counting starts at 0).
+					d = d - boost::gregorian::days(mday * -1 - 1);
 
-	if (tokens.size() >= 1 && (wday = WeekdayFromString(tokens[0])) != -1) {
-		tm myref = *reference;
-		myref.tm_isdst = -1;
-
-		if (tokens.size() > 2) {
-			mon = MonthFromString(tokens[2]);
+					// End date is one day in the future, starting 00:00:00
+					d = d + boost::gregorian::days(1);
 
-			if (mon == -1)
-				BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid month in time specification: " + timespec));
+					*end = boost::gregorian::to_tm(d);
+					end->tm_hour = 0;
+					end->tm_min = 0;
+					end->tm_sec = 0;
+				}
+			}
 
-			myref.tm_mon = mon;
+			return;
 		}
 
-		int n = 0;
+		case LegacyTimeSpecWeekday: {
+			tm myref = *reference;
+			myref.tm_isdst = -1;
 
-		if (tokens.size() > 1)
-			n = Convert::ToLong(tokens[1]);
+			if (spec.Month != -1)
+				myref.tm_mon = spec.Month;
 
-		if (begin) {
-			*begin = myref;
+			if (begin) {
+				*begin = myref;
 
-			if (tokens.size() > 1)
-				FindNthWeekday(wday, n, begin);
-			else
-				begin->tm_mday += (7 - begin->tm_wday + wday) % 7;
+				if (spec.HasDay)
+					FindNthWeekday(spec.Weekday, spec.Day, begin);
+				else
+					begin->tm_mday += (7 - begin->tm_wday + spec.Weekday) % 7;
 
-			begin->tm_hour = 0;
-			begin->tm_min = 0;
-			begin->tm_sec = 0;
-		}
+				begin->tm_hour = 0;
+				begin->tm_min = 0;
+				begin->tm_sec = 0;
+			}
 
-		if (end) {
-			*end = myref;
+			if (end) {
+				*end = myref;
 
-			if (tokens.size() > 1)
-				FindNthWeekday(wday, n, end);
-			else
-				end->tm_mday += (7 - end->tm_wday + wday) % 7;
+				if (spec.HasDay)
+					FindNthWeekday(spec.Weekday, spec.Day, end);
+				else
+					end->tm_mday += (7 - end->tm_wday + spec.Weekday) % 7;
 
-			end->tm_hour = 0;
-			end->tm_min = 0;
-			end->tm_sec = 0;
-			end->tm_mday++;
-		}
+				end->tm_hour = 0;
+				end->tm_min = 0;
+				end->tm_sec = 0;
+				end->tm_mday++;
+			}
 
-		return;
+			return;
+		}
 	}
-
-	BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid time specification: " + timespec));
 }
 
 /**
@@ -337,19 +379,32 @@ void LegacyTimePeriod::ParseTimeSpec(const String& timespec, tm *begin, tm *end,
  */
 void LegacyTimePeriod::ParseTimeRange(const String& timerange, tm *begin, tm *end, int *stride, const tm *reference)
 {
-	String def = timerange;
+	LegacyDayDefinition def = CompileDayDefinition(timerange);
+
+	EvaluateTimeSpec(def.Begin, begin, nullptr, reference);
+	EvaluateTimeSpec(def.End, nullptr, end, reference);
+	*stride = def.Stride;
+}
+
+/**
+ * Parses a range of days as accepted by ParseTimeRange(). Throws for invalid ranges.
+ */
+LegacyDayDefinition LegacyTimePeriod::CompileDayDefinition(const String& daydef)
+{
+	LegacyDayDefinition result;
+	String def = daydef;
 
 	/* Figure out the stride. */
 	size_t pos = def.FindFirstOf('/');
 
 	if (pos != String::NPos) {
 		String strStride = def.SubStr(pos + 1).Trim();
-		*stride = Convert::ToLong(strStride);
+		result.Stride = Convert::ToLong(strStride);
 
 		/* Remove the stride parameter from the definition. */
 		def = def.SubStr(0, pos);
 	} else {
-		*stride = 1; /* User didn't specify anything, assume default. */
+		result.Stride = 1; /* User didn't specify anything, assume default. */
 	}
 
 	/* Figure out whether the user has specified two dates. */
@@ -360,7 +415,7 @@ void LegacyTimePeriod::ParseTimeRange(const String& timerange, tm *begin, tm *en
 
 		String second = def.SubStr(pos + 1).Trim();
 
-		ParseTimeSpec(first, begin, nullptr, reference);
+		result.Begin = CompileTimeSpec(first);
 
 		/* If the second definition starts with a number we need
 		 * to add the first word from the first definition, e.g.:
@@ -381,10 +436,13 @@ void LegacyTimePeriod::ParseTimeRange(const String& timerange, tm *begin, tm *en
 			second = first.SubStr(0, xpos + 1) + second;
 		}
 
-		ParseTimeSpec(second, nullptr, end, reference);
+		result.End = CompileTimeSpec(second);
 	} else {
-		ParseTimeSpec(def, begin, end, reference);
+		result.Begin = CompileTimeSpec(def);
+		result.End = result.Begin;
 	}
+
+	return result;
 }
 
 bool LegacyTimePeriod::IsInDayDefinition(const String& daydef, const tm *reference)
@@ -401,6 +459,16 @@ bool LegacyTimePeriod::IsInDayDefinition(const String& daydef, const tm *referen
 	return IsInTimeRange(&begin, &end, stride, reference);
 }
 
+bool LegacyTimePeriod::IsInDayDefinition(const LegacyDayDefinition& daydef, const tm *reference)
+{
+	tm begin, end;
+
+	EvaluateTimeSpec(daydef.Begin, &begin, nullptr, reference);
+	EvaluateTimeSpec(daydef.End, nullptr, &end, reference);
+
+	return IsInTimeRange(&begin, &end, daydef.Stride, reference);
+}
+
 static inline
 void ProcessTimeRaw(const String& in, const tm *reference, tm *out)
 {
@@ -471,6 +539,73 @@ void LegacyTimePeriod::ProcessTimeRanges(const String& timeranges, const tm *ref
 	}
 }
 
+/**
+ * Parses a list of timeranges as accepted by ProcessTimeRanges(). Throws for invalid ranges.
+ */
+std::vector<LegacyTimeRange> LegacyTimePeriod::CompileTimeRanges(const String& timeranges)
+{
+	std::vector<LegacyTimeRange> result;
+
+	/* Any reference will do, only the time of day fields are used. */
+	tm reference = {};
+
+	for (const String& range : timeranges.Split(",")) {
+		tm begin, end;
+
+		ProcessTimeRangeRaw(range, &reference, &begin, &end);
+
+		result.push_back({ begin.tm_hour, begin.tm_min, begin.tm_sec, end.tm_hour, end.tm_min, end.tm_sec });
+	}
+
+	return result;
+}
+
+/**
+ * Same as ProcessTimeRanges(), but for already parsed time ranges.
+ */
+void LegacyTimePeriod::ProcessTimeRanges(const std::vector<LegacyTimeRange>& timeranges, const tm *reference, const Array::Ptr& result)
+{
+	for (auto& range : timeranges) {
+		tm begin = *reference;
+		begin.tm_hour = range.BeginHour;
+		begin.tm_min = range.BeginMinute;
+		begin.tm_sec = range.BeginSecond;
+
+		tm end = *reference;
+		end.tm_hour = range.EndHour;
+		end.tm_min = range.EndMinute;
+		end.tm_sec = range.EndSecond;
+
+		long tsbegin = mktime(&begin);
+		long tsend = mktime(&end);
+
+		if (tsbegin >= tsend)
+			continue;
+
+		result->Add(new Dictionary({
+			{ "begin", tsbegin },
+			{ "end", tsend }
+		}));
+	}
+}
+
+/**
+ * Parses all day and time range definitions of a time period's ranges attribute. Throws for invalid definitions.
+ */
+LegacyTimeRanges::ConstPtr LegacyTimePeriod::CompileRanges(const Dictionary::Ptr& ranges)
+{
+	auto result (std::make_shared<LegacyTimeRanges>());
+
+	result->Source = ranges;
+
+	ObjectLock olock(ranges);
+	for (const Dictionary::Pair& kv : ranges) {
+		result->Days.emplace_back(CompileDayDefinition(kv.first), CompileTimeRanges(kv.second));
+	}
+
+	return result;
+}
+
 Dictionary::Ptr LegacyTimePeriod::FindRunningSegment(const String& daydef, const String& timeranges, const tm *reference)
 {
 	tm begin, end, iter;
@@ -586,6 +721,14 @@ Array::Ptr LegacyTimePeriod::ScriptFunc(const TimePeriod::Ptr& tp, double begin,
 	Dictionary::Ptr ranges = tp->GetRanges();
 
 	if (ranges) {
+		/* The ranges are parsed only once, usually during config validation. */
+		LegacyTimeRanges::ConstPtr compiled = tp->GetCompiledRanges();
+
+		if (!compiled || compiled->Source != ranges) {
+			compiled = CompileRanges(ranges);
+			tp->SetCompiledRanges(compiled);
+		}
+
 		tm tm_begin = Utility::LocalTime(begin);
 
 		// Always evaluate time periods for full days as their ranges are given per day.
@@ -617,22 +760,11 @@ Array::Ptr LegacyTimePeriod::ScriptFunc(const TimePeriod::Ptr& tp, double begin,
 				<< "Checking reference time " << mktime_const(&reference);
 #endif /* I2_DEBUG */
 
-			ObjectLock olock(ranges);
-			for (const Dictionary::Pair& kv : ranges) {
-				if (!IsInDayDefinition(kv.first, &reference)) {
-#ifdef I2_DEBUG
-					Log(LogDebug, "LegacyTimePeriod")
-						<< "Not in day definition '" << kv.first << "'.";
-#endif /* I2_DEBUG */
+			for (auto& day : compiled->Days) {
+				if (!IsInDayDefinition(day.first, &reference))
 					continue;
-				}
-
-#ifdef I2_DEBUG
-				Log(LogDebug, "LegacyTimePeriod")
-					<< "In day definition '" << kv.first << "'.";
-#endif /* I2_DEBUG */
 
-				ProcessTimeRanges(kv.second, &reference, segments);
+				ProcessTimeRanges(day.second, &reference, segments);
 			}
 		}
 	}
@@ -7,10 +7,74 @@
 #include "icinga/timeperiod.hpp"
 #include "base/dictionary.hpp"
 #include <boost/date_time/gregorian/gregorian.hpp>
+#include <memory>
+#include <utility>
+#include <vector>
 
 namespace icinga
 {
 
+/**
+ * @ingroup icinga
+ */
+enum LegacyTimeSpecType
+{
+	LegacyTimeSpecDate, /**< YYYY-MM-DD */
+	LegacyTimeSpecMonthDay, /**< day N, january N, ... */
+	LegacyTimeSpecWeekday /**< monday, monday N, monday N january, ... */
+};
+
+/**
+ * A parsed day as accepted by LegacyTimePeriod::ParseTimeSpec().
+ *
+ * @ingroup icinga
+ */
+struct LegacyTimeSpec
+{
+	LegacyTimeSpecType Type;
+	int Year; /**< Only for LegacyTimeSpecDate */
+	int Month; /**< 0 - 11, -1 for the month of the reference time */
+	int Day; /**< Day of the month or n-th weekday */
+	int Weekday; /**< Only for LegacyTimeSpecWeekday */
+	bool HasDay; /**< Whether a weekday is restricted to its n-th occurrence */
+};
+
+/**
+ * A parsed day range as accepted by LegacyTimePeriod::ParseTimeRange().
+ *
+ * @ingroup icinga
+ */
+struct LegacyDayDefinition
+{
+	LegacyTimeSpec Begin;
+	LegacyTimeSpec End;
+	int Stride;
+};
+
+/**
+ * A parsed time range as accepted by LegacyTimePeriod::ProcessTimeRange().
+ *
+ * @ingroup icinga
+ */
+struct LegacyTimeRange
+{
+	int BeginHour, BeginMinute, BeginSecond;
+	int EndHour, EndMinute, EndSecond; /**< EndHour is 24 or more if the range ends on the next day */
+};
+
+/**
+ * The parsed ranges attribute of a time period.
+ *
+ * @ingroup icinga
+ */
+struct LegacyTimeRanges
+{
+	typedef std::shared_ptr<const LegacyTimeRanges> ConstPtr;
+
+	Dictionary::Ptr Source;
+	std::vector<std::pair<LegacyDayDefinition, std::vector<LegacyTimeRange>>> Days;
+};
+
 /**
  * Implements Icinga 1.x time periods.
  *
@@ -34,6 +98,15 @@ public:
 	static Dictionary::Ptr FindNextSegment(const String& daydef, const String& timeranges, const tm *reference);
 	static Dictionary::Ptr FindRunningSegment(const String& daydef, const String& timeranges, const tm *reference);
 
+	static LegacyTimeSpec CompileTimeSpec(const String& timespec);
+	static LegacyDayDefinition CompileDayDefinition(const String& daydef);
+	static std::vector<LegacyTimeRange> CompileTimeRanges(const String& timeranges);
+	static LegacyTimeRanges::ConstPtr CompileRanges(const Dictionary::Ptr& ranges);
+
+	static void EvaluateTimeSpec(const LegacyTimeSpec& spec, tm *begin, tm *end, const tm *reference);
+	static bool IsInDayDefinition(const LegacyDayDefinition& daydef, const tm *reference);
+	static void ProcessTimeRanges(const std::vector<LegacyTimeRange>& timeranges, const tm *reference, const Array::Ptr& result);
+
 private:
 	LegacyTimePeriod();
 
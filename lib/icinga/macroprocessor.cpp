@@ -19,6 +19,29 @@ using namespace icinga;
 
 thread_local Dictionary::Ptr MacroResolver::OverrideMacros;
 
+thread_local MacroProcessor::StabilityTracker *MacroProcessor::m_StabilityTracker = nullptr;
+
+MacroProcessor::StabilityTracker::StabilityTracker()
+	: m_Previous(MacroProcessor::m_StabilityTracker)
+{
+	MacroProcessor::m_StabilityTracker = this;
+}
+
+MacroProcessor::StabilityTracker::~StabilityTracker()
+{
+	MacroProcessor::m_StabilityTracker = m_Previous;
+}
+
+/**
+ * Tells all trackers of the current thread that a macro has been resolved to a value which may change without
+ * the objects' attributes being modified.
+ */
+void MacroProcessor::MarkVolatile()
+{
+	for (auto tracker (m_StabilityTracker); tracker; tracker = tracker->m_Previous)
+		tracker->m_Stable = false;
+}
+
 Value MacroProcessor::ResolveMacros(const Value& str, const ResolverList& resolvers,
 	const CheckResult::Ptr& cr, String *missingMacro,
 	const MacroProcessor::EscapeCallback& escapeFn, const Dictionary::Ptr& resolvedMacros,
@@ -85,20 +108,15 @@ static MacroProcessor::ResolverList GetDefaultResolvers()
 	};
 }
 
-bool MacroProcessor::ResolveMacro(const String& macro, const ResolverList& resolvers,
+bool MacroProcessor::ResolveMacro(const MacroToken& macro, const ResolverList& resolvers,
 	const CheckResult::Ptr& cr, Value *result, bool *recursive_macro)
 {
-	CONTEXT("Resolving macro '" << macro << "'");
+	CONTEXT("Resolving macro '" << macro.Text << "'");
 
 	*recursive_macro = false;
 
-	std::vector<String> tokens = macro.Split(".");
-
-	String objName;
-	if (tokens.size() > 1) {
-		objName = tokens[0];
-		tokens.erase(tokens.begin());
-	}
+	const std::vector<String>& tokens = macro.Path;
+	const String& objName = macro.ObjName;
 
 	const auto defaultResolvers (GetDefaultResolvers());
 
@@ -124,8 +142,8 @@ bool MacroProcessor::ResolveMacro(const String& macro, const ResolverList& resol
 					}
 				}
 
-				if (vars && vars->Contains(macro)) {
-					*result = vars->Get(macro);
+				if (vars && vars->Contains(macro.Text)) {
+					*result = vars->Get(macro.Text);
 					*recursive_macro = true;
 					return true;
 				}
@@ -133,11 +151,15 @@ bool MacroProcessor::ResolveMacro(const String& macro, const ResolverList& resol
 
 			auto *mresolver = dynamic_cast<MacroResolver *>(resolver.Obj.get());
 
-			if (mresolver && mresolver->ResolveMacro(boost::algorithm::join(tokens, "."), cr, result))
+			if (mresolver && mresolver->ResolveMacro(macro.JoinedPath, cr, result)) {
+				/* These are runtime values like the state or the time. */
+				MarkVolatile();
 				return true;
+			}
 
 			Value ref = resolver.Obj;
 			bool valid = true;
+			bool stable = true;
 
 			for (const String& token : tokens) {
 				if (ref.IsObjectType<Dictionary>()) {
@@ -170,6 +192,9 @@ bool MacroProcessor::ResolveMacro(const String& macro, const ResolverList& resol
 
 					Field fieldInfo = type->GetFieldInfo(field);
 
+					if (!(fieldInfo.Attributes & FAConfig) || !dynamic_cast<ConfigObject *>(object.get()))
+						stable = false;
+
 					if (strcmp(fieldInfo.TypeName, "Timestamp") == 0)
 						ref = static_cast<long>(ref);
 				}
@@ -182,6 +207,9 @@ bool MacroProcessor::ResolveMacro(const String& macro, const ResolverList& resol
 					tokens[0] == "notes")
 					*recursive_macro = true;
 
+				if (!stable)
+					MarkVolatile();
+
 				*result = ref;
 				return true;
 			}
@@ -195,6 +223,9 @@ Value MacroProcessor::EvaluateFunction(const Function::Ptr& func, const Resolver
 	const CheckResult::Ptr& cr, const MacroProcessor::EscapeCallback& escapeFn,
 	const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros, int recursionLevel)
 {
+	/* There's no telling what a function depends on. */
+	MarkVolatile();
+
 	Dictionary::Ptr resolvers_this = new Dictionary();
 	const auto defaultResolvers (GetDefaultResolvers());
 
@@ -229,6 +260,77 @@ Value MacroProcessor::EvaluateFunction(const Function::Ptr& func, const Resolver
 	return func->InvokeThis(resolvers_this);
 }
 
+std::shared_mutex MacroProcessor::m_MacroTemplatesMutex;
+std::unordered_map<String, std::shared_ptr<const MacroProcessor::MacroTemplate>> MacroProcessor::m_MacroTemplates;
+
+/* The templates are dropped once there are more, e.g. due to custom vars with macros which differ for every object. */
+static const size_t l_MacroTemplatesLimit = 65536;
+
+/**
+ * Splits a macro string into literal text and macros.
+ *
+ * @throws std::runtime_error If a macro isn't closed.
+ */
+std::shared_ptr<const MacroProcessor::MacroTemplate> MacroProcessor::ParseMacroTemplate(const String& str)
+{
+	auto macroTemplate (std::make_shared<MacroTemplate>());
+	size_t offset = 0, pos_first, pos_second;
+
+	while ((pos_first = str.FindFirstOf("$", offset)) != String::NPos) {
+		pos_second = str.FindFirstOf("$", pos_first + 1);
+
+		if (pos_second == String::NPos)
+			BOOST_THROW_EXCEPTION(std::runtime_error("Closing $ not found in macro format string."));
+
+		if (pos_first > offset)
+			macroTemplate->push_back({ false, str.SubStr(offset, pos_first - offset), "", {}, "" });
+
+		MacroToken macro { true, str.SubStr(pos_first + 1, pos_second - pos_first - 1), "", {}, "" };
+		macro.Path = macro.Text.Split(".");
+
+		if (macro.Path.size() > 1) {
+			macro.ObjName = macro.Path[0];
+			macro.Path.erase(macro.Path.begin());
+		}
+
+		macro.JoinedPath = boost::algorithm::join(macro.Path, ".");
+		macroTemplate->emplace_back(std::move(macro));
+
+		offset = pos_second + 1;
+	}
+
+	if (offset < str.GetLength())
+		macroTemplate->push_back({ false, str.SubStr(offset), "", {}, "" });
+
+	return macroTemplate;
+}
+
+/**
+ * Returns the parsed form of a macro string. Command lines, arguments etc. are the same strings for all objects
+ * using a command, so they're only parsed once.
+ */
+std::shared_ptr<const MacroProcessor::MacroTemplate> MacroProcessor::GetMacroTemplate(const String& str)
+{
+	{
+		std::shared_lock<std::shared_mutex> lock (m_MacroTemplatesMutex);
+		auto it (m_MacroTemplates.find(str));
+
+		if (it != m_MacroTemplates.end())
+			return it->second;
+	}
+
+	auto macroTemplate (ParseMacroTemplate(str));
+
+	std::unique_lock<std::shared_mutex> lock (m_MacroTemplatesMutex);
+
+	if (m_MacroTemplates.size() >= l_MacroTemplatesLimit)
+		m_MacroTemplates.clear();
+
+	m_MacroTemplates.emplace(str, macroTemplate);
+
+	return macroTemplate;
+}
+
 Value MacroProcessor::InternalResolveMacros(const String& str, const ResolverList& resolvers,
 	const CheckResult::Ptr& cr, String *missingMacro,
 	const MacroProcessor::EscapeCallback& escapeFn, const Dictionary::Ptr& resolvedMacros,
@@ -239,38 +341,39 @@ Value MacroProcessor::InternalResolveMacros(const String& str, const ResolverLis
 	if (recursionLevel > 15)
 		BOOST_THROW_EXCEPTION(std::runtime_error("Infinite recursion detected while resolving macros"));
 
-	size_t offset, pos_first, pos_second;
-	offset = 0;
+	if (str.FindFirstOf("$") == String::NPos)
+		return str;
 
-	Dictionary::Ptr resolvers_this;
+	auto macroTemplate (GetMacroTemplate(str));
 
-	String result = str;
-	while ((pos_first = result.FindFirstOf("$", offset)) != String::NPos) {
-		pos_second = result.FindFirstOf("$", pos_first + 1);
+	/* we're done if this is the only macro and there are no other non-macro parts in the string */
+	bool onlyMacro = macroTemplate->size() == 1;
 
-		if (pos_second == String::NPos)
-			BOOST_THROW_EXCEPTION(std::runtime_error("Closing $ not found in macro format string."));
+	String result;
 
-		String name = result.SubStr(pos_first + 1, pos_second - pos_first - 1);
+	for (const MacroToken& token : *macroTemplate) {
+		if (!token.IsMacro) {
+			result += token.Text;
+			continue;
+		}
+
+		const String& name = token.Text;
 
 		Value resolved_macro;
-		bool recursive_macro;
+		bool recursive_macro = false;
 		bool found;
 
-		if (useResolvedMacros) {
-			recursive_macro = false;
+		/* $$ is an escape sequence for $. */
+		if (name.IsEmpty()) {
+			resolved_macro = "$";
+			found = true;
+		} else if (useResolvedMacros) {
 			found = resolvedMacros->Contains(name);
 
 			if (found)
 				resolved_macro = resolvedMacros->Get(name);
 		} else
-			found = ResolveMacro(name, resolvers, cr, &resolved_macro, &recursive_macro);
-
-		/* $$ is an escape sequence for $. */
-		if (name.IsEmpty()) {
-			resolved_macro = "$";
-			found = true;
-		}
+			found = ResolveMacro(token, resolvers, cr, &resolved_macro, &recursive_macro);
 
 		if (resolved_macro.IsObjectType<Function>()) {
 			resolved_macro = EvaluateFunction(resolved_macro, resolvers, cr, escapeFn,
@@ -315,24 +418,15 @@ Value MacroProcessor::InternalResolveMacros(const String& str, const ResolverLis
 		if (escapeFn)
 			resolved_macro = escapeFn(resolved_macro);
 
-		/* we're done if this is the only macro and there are no other non-macro parts in the string */
-		if (pos_first == 0 && pos_second == str.GetLength() - 1)
+		if (onlyMacro)
 			return resolved_macro;
-		else if (resolved_macro.IsObjectType<Array>())
-				BOOST_THROW_EXCEPTION(std::invalid_argument("Mixing both strings and non-strings in macros is not allowed."));
 
-		if (resolved_macro.IsObjectType<Array>()) {
-			/* don't allow mixing strings and arrays in macro strings */
-			if (pos_first != 0 || pos_second != str.GetLength() - 1)
-				BOOST_THROW_EXCEPTION(std::invalid_argument("Mixing both strings and non-strings in macros is not allowed."));
-
-			return resolved_macro;
-		}
+		/* don't allow mixing strings and arrays in macro strings */
+		if (resolved_macro.IsObjectType<Array>())
+			BOOST_THROW_EXCEPTION(std::invalid_argument("Mixing both strings and non-strings in macros is not allowed."));
 
 		String resolved_macro_str = resolved_macro;
-
-		result.Replace(pos_first, pos_second - pos_first + 1, resolved_macro_str);
-		offset = pos_first + resolved_macro_str.GetLength();
+		result += resolved_macro_str;
 	}
 
 	return result;
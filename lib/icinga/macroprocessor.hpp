@@ -6,6 +6,9 @@
 #include "icinga/i2-icinga.hpp"
 #include "icinga/checkable.hpp"
 #include "base/value.hpp"
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 
@@ -37,6 +40,31 @@ public:
 	typedef std::function<Value (const Value&)> EscapeCallback;
 	typedef std::vector<ResolverSpec> ResolverList;
 
+	/**
+	 * Records whether all macros the current thread resolves while it exists only refer to config
+	 * attributes and custom variables, i.e. neither to runtime values (e.g. $host.state$) nor to functions.
+	 */
+	class StabilityTracker
+	{
+	public:
+		StabilityTracker();
+		~StabilityTracker();
+
+		StabilityTracker(const StabilityTracker&) = delete;
+		StabilityTracker& operator=(const StabilityTracker&) = delete;
+
+		inline bool IsStable() const
+		{
+			return m_Stable;
+		}
+
+	private:
+		bool m_Stable{true};
+		StabilityTracker *m_Previous;
+
+		friend class MacroProcessor;
+	};
+
 	static Value ResolveMacros(const Value& str, const ResolverList& resolvers,
 		const CheckResult::Ptr& cr = nullptr, String *missingMacro = nullptr,
 		const EscapeCallback& escapeFn = EscapeCallback(),
@@ -51,9 +79,34 @@ public:
 	static void ValidateCustomVars(const ConfigObject::Ptr& object, const Dictionary::Ptr& value);
 
 private:
+	/**
+	 * A part of a macro string: either literal text or a macro whose name is already split into the
+	 * resolver (e.g. "host" for $host.vars.os$, empty for $address$) and the path below it.
+	 */
+	struct MacroToken
+	{
+		bool IsMacro;
+		String Text; /**< The literal text or the full macro name. */
+		String ObjName;
+		std::vector<String> Path;
+		String JoinedPath;
+	};
+
+	typedef std::vector<MacroToken> MacroTemplate;
+
 	MacroProcessor();
 
-	static bool ResolveMacro(const String& macro, const ResolverList& resolvers,
+	static thread_local StabilityTracker *m_StabilityTracker;
+
+	static void MarkVolatile();
+
+	static std::shared_mutex m_MacroTemplatesMutex;
+	static std::unordered_map<String, std::shared_ptr<const MacroTemplate>> m_MacroTemplates;
+
+	static std::shared_ptr<const MacroTemplate> GetMacroTemplate(const String& str);
+	static std::shared_ptr<const MacroTemplate> ParseMacroTemplate(const String& str);
+
+	static bool ResolveMacro(const MacroToken& macro, const ResolverList& resolvers,
 		const CheckResult::Ptr& cr, Value *result, bool *recursive_macro);
 	static Value InternalResolveMacros(const String& str,
 		const ResolverList& resolvers, const CheckResult::Ptr& cr,
@@ -4,6 +4,7 @@
 #include "icinga/service.hpp"
 #include "config/configitembuilder.hpp"
 #include "config/applyrule.hpp"
+#include "config/configprofiler.hpp"
 #include "base/initialize.hpp"
 #include "base/configtype.hpp"
 #include "base/logger.hpp"
@@ -67,6 +68,10 @@ bool Notification::EvaluateApplyRule(const Checkable::Ptr& checkable, const Appl
 
 	CONTEXT("Evaluating 'apply' rule (" << di << ")");
 
+	ConfigProfilerScope profile ("apply", [&rule, &di]() {
+		return ConfigProfiler::GetDefinitionName("Notification", rule.GetName(), di);
+	});
+
 	Host::Ptr host;
 	Service::Ptr service;
 	tie(host, service) = GetHostService(checkable);
@@ -143,6 +148,14 @@ void Notification::EvaluateApplyRules(const Host::Ptr& host)
 		if (EvaluateApplyRule(host, *rule, true))
 			rule->AddMatch();
 	}
+
+	std::set<ApplyRule::Ptr> varRules;
+	ApplyRule::GetTargetedHostVarRules(Notification::TypeInstance, host, varRules);
+
+	for (auto& rule : varRules) {
+		if (EvaluateApplyRule(host, *rule))
+			rule->AddMatch();
+	}
 }
 
 void Notification::EvaluateApplyRules(const Service::Ptr& service)
@@ -158,4 +171,17 @@ void Notification::EvaluateApplyRules(const Service::Ptr& service)
 		if (EvaluateApplyRule(service, *rule, true))
 			rule->AddMatch();
 	}
+
+	for (auto& rule : ApplyRule::GetTargetedServicesOfHostRules(Notification::TypeInstance, service->GetHost()->GetName())) {
+		if (EvaluateApplyRule(service, *rule, true))
+			rule->AddMatch();
+	}
+
+	std::set<ApplyRule::Ptr> varRules;
+	ApplyRule::GetTargetedServiceHostVarRules(Notification::TypeInstance, service->GetHost(), varRules);
+
+	for (auto& rule : varRules) {
+		if (EvaluateApplyRule(service, *rule))
+			rule->AddMatch();
+	}
 }
@@ -13,6 +13,7 @@
 #include "base/initialize.hpp"
 #include "base/scriptglobal.hpp"
 #include <algorithm>
+#include <atomic>
 
 using namespace icinga;
 
@@ -22,6 +23,8 @@ INITIALIZE_ONCE(&Notification::StaticInitialize);
 std::map<String, int> Notification::m_StateFilterMap;
 std::map<String, int> Notification::m_TypeFilterMap;
 
+static std::atomic<uint_fast64_t> l_RecipientsGeneration (0);
+
 boost::signals2::signal<void (const Notification::Ptr&, const MessageOrigin::Ptr&)> Notification::OnNextNotificationChanged;
 boost::signals2::signal<void (const Notification::Ptr&, const String&, uint_fast8_t, const MessageOrigin::Ptr&)> Notification::OnLastNotifiedStatePerUserUpdated;
 boost::signals2::signal<void (const Notification::Ptr&, const MessageOrigin::Ptr&)> Notification::OnLastNotifiedStatePerUserCleared;
@@ -208,6 +211,52 @@ std::set<UserGroup::Ptr> Notification::GetUserGroups() const
 	return result;
 }
 
+/**
+ * Marks the recipients cached by GetRecipients() as outdated, e.g. once a user group's members have changed.
+ */
+void Notification::InvalidateRecipients()
+{
+	l_RecipientsGeneration.fetch_add(1);
+}
+
+/**
+ * The users and the members of the user groups, cached until the users or user_groups attributes are replaced
+ * or InvalidateRecipients() is called.
+ */
+std::shared_ptr<const std::vector<User::Ptr>> Notification::GetRecipients()
+{
+	auto generation (l_RecipientsGeneration.load());
+	Array::Ptr usersRaw = GetUsersRaw();
+	Array::Ptr userGroupsRaw = GetUserGroupsRaw();
+
+	{
+		std::unique_lock<std::mutex> lock (m_RecipientsMutex);
+
+		if (m_Recipients && m_RecipientsGeneration == generation
+			&& m_RecipientsUsersSource == usersRaw && m_RecipientsUserGroupsSource == userGroupsRaw)
+			return m_Recipients;
+	}
+
+	std::set<User::Ptr> allUsers = GetUsers();
+
+	for (const UserGroup::Ptr& ug : GetUserGroups()) {
+		std::set<User::Ptr> members = ug->GetMembers();
+		std::copy(members.begin(), members.end(), std::inserter(allUsers, allUsers.begin()));
+	}
+
+	auto recipients (std::make_shared<const std::vector<User::Ptr>>(allUsers.begin(), allUsers.end()));
+
+	std::unique_lock<std::mutex> lock (m_RecipientsMutex);
+
+	/* The generation from before, so that changes meanwhile are picked up next time. */
+	m_Recipients = recipients;
+	m_RecipientsGeneration = generation;
+	m_RecipientsUsersSource = usersRaw;
+	m_RecipientsUserGroupsSource = userGroupsRaw;
+
+	return recipients;
+}
+
 TimePeriod::Ptr Notification::GetPeriod() const
 {
 	return TimePeriod::GetByName(GetPeriodRaw());
@@ -399,20 +448,12 @@ void Notification::BeginExecuteNotification(NotificationType type, const CheckRe
 			SetLastProblemNotification(now);
 	}
 
-	std::set<User::Ptr> allUsers;
-
-	std::set<User::Ptr> users = GetUsers();
-	std::copy(users.begin(), users.end(), std::inserter(allUsers, allUsers.begin()));
-
-	for (const UserGroup::Ptr& ug : GetUserGroups()) {
-		std::set<User::Ptr> members = ug->GetMembers();
-		std::copy(members.begin(), members.end(), std::inserter(allUsers, allUsers.begin()));
-	}
+	auto allUsers (GetRecipients());
 
 	std::set<User::Ptr> allNotifiedUsers;
 	Array::Ptr notifiedProblemUsers = GetNotifiedProblemUsers();
 
-	for (const User::Ptr& user : allUsers) {
+	for (const User::Ptr& user : *allUsers) {
 		String userName = user->GetName();
 
 		if (!user->GetEnableNotifications()) {
@@ -518,12 +559,14 @@ bool Notification::CheckNotificationUserFilters(NotificationType type, const Use
 
 		unsigned long ftype = type;
 
-		Log(LogDebug, "Notification")
-			<< "User '" << userName << "' notification '" << notificationName
-			<< "', Type '" << NotificationTypeToString(type)
-			<< "', TypeFilter: " << NotificationFilterToString(user->GetTypeFilter(), GetTypeFilterMap())
-			<< " (FType=" << ftype << ", TypeFilter=" << GetTypeFilter() << ")";
-
+		/* Formatting the filters for every recipient would outweigh the filtering itself. */
+		if (LogDebug >= Logger::GetMinLogSeverity()) {
+			Log(LogDebug, "Notification")
+				<< "User '" << userName << "' notification '" << notificationName
+				<< "', Type '" << NotificationTypeToString(type)
+				<< "', TypeFilter: " << NotificationFilterToString(user->GetTypeFilter(), GetTypeFilterMap())
+				<< " (FType=" << ftype << ", TypeFilter=" << GetTypeFilter() << ")";
+		}
 
 		if (!(ftype & user->GetTypeFilter())) {
 			Log(LogNotice, "Notification")
@@ -552,11 +595,13 @@ bool Notification::CheckNotificationUserFilters(NotificationType type, const Use
 				stateStr = NotificationHostStateToString(host->GetState());
 			}
 
-			Log(LogDebug, "Notification")
-				<< "User '" << userName << "' notification '" << notificationName
-				<< "', State '" << stateStr << "', StateFilter: "
-				<< NotificationFilterToString(user->GetStateFilter(), GetStateFilterMap())
-				<< " (FState=" << fstate << ", StateFilter=" << user->GetStateFilter() << ")";
+			if (LogDebug >= Logger::GetMinLogSeverity()) {
+				Log(LogDebug, "Notification")
+					<< "User '" << userName << "' notification '" << notificationName
+					<< "', State '" << stateStr << "', StateFilter: "
+					<< NotificationFilterToString(user->GetStateFilter(), GetStateFilterMap())
+					<< " (FState=" << fstate << ", StateFilter=" << user->GetStateFilter() << ")";
+			}
 
 			if (!(fstate & user->GetStateFilter())) {
 				Log(LogNotice, "Notification")
@@ -14,6 +14,9 @@
 #include "remote/messageorigin.hpp"
 #include "base/array.hpp"
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace icinga
 {
@@ -74,6 +77,9 @@ public:
 	TimePeriod::Ptr GetPeriod() const;
 	std::set<User::Ptr> GetUsers() const;
 	std::set<UserGroup::Ptr> GetUserGroups() const;
+	std::shared_ptr<const std::vector<User::Ptr>> GetRecipients();
+
+	static void InvalidateRecipients();
 
 	void UpdateNotificationNumber();
 	void ResetNotificationNumber();
@@ -116,6 +122,13 @@ public:
 private:
 	ObjectImpl<Checkable>::Ptr m_Checkable;
 
+	/* See GetRecipients() */
+	std::mutex m_RecipientsMutex;
+	std::shared_ptr<const std::vector<User::Ptr>> m_Recipients;
+	uint_fast64_t m_RecipientsGeneration{0};
+	Array::Ptr m_RecipientsUsersSource;
+	Array::Ptr m_RecipientsUserGroupsSource;
+
 	bool CheckNotificationUserFilters(NotificationType type, const User::Ptr& user, bool force, bool reminder);
 
 	void ExecuteNotificationHelper(NotificationType type, const User::Ptr& user, const CheckResult::Ptr& cr, bool force, const String& author = "", const String& text = "");
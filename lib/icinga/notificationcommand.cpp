@@ -2,6 +2,7 @@
 
 #include "icinga/notificationcommand.hpp"
 #include "icinga/notificationcommand-ti.cpp"
+#include "base/exception.hpp"
 
 using namespace icinga;
 
@@ -25,3 +26,11 @@ Dictionary::Ptr NotificationCommand::Execute(const Notification::Ptr& notificati
 		useResolvedMacros,
 	});
 }
+
+void NotificationCommand::ValidateAggregationWindow(const Lazy<double>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<NotificationCommand>::ValidateAggregationWindow(lvalue, utils);
+
+	if (lvalue() < 0)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "aggregation_window" }, "Value must not be negative."));
+}
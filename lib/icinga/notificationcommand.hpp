@@ -29,6 +29,8 @@ public:
 		const String& author, const String& comment,
 		const Dictionary::Ptr& resolvedMacros = nullptr,
 		bool useResolvedMacros = false);
+
+	void ValidateAggregationWindow(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
 };
 
 }
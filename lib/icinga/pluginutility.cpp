@@ -1,6 +1,10 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "icinga/pluginutility.hpp"
+#include "icinga/checkcommand.hpp"
+#include "icinga/checklatency.hpp"
+#include "icinga/commandusage.hpp"
+#include "icinga/icingaapplication.hpp"
 #include "icinga/macroprocessor.hpp"
 #include "base/logger.hpp"
 #include "base/utility.hpp"
@@ -9,20 +13,214 @@
 #include "base/process.hpp"
 #include "base/objectlock.hpp"
 #include "base/exception.hpp"
+#include "base/json.hpp"
 #include <boost/algorithm/string/trim.hpp>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 using namespace icinga;
 
+/**
+ * A check command execution shared by all callers with the same command line and environment.
+ */
+struct CoalescedExecution
+{
+	std::vector<std::function<void(const ProcessResult&)>> Callbacks;
+	bool Finished = false;
+	ProcessResult Result;
+	double Expires = 0;
+};
+
+static std::mutex l_CoalescedExecutionsMutex;
+static std::unordered_map<String, std::shared_ptr<CoalescedExecution>> l_CoalescedExecutions;
+static double l_NextCoalescedExecutionsCleanup = 0;
+
+/**
+ * Runs the process unless the same command is already running (or has finished less
+ * than ttl seconds ago). In that case the callback gets the result of that execution.
+ */
+static void ExecuteCoalesced(const Command::Ptr& commandObj, const Process::Ptr& process, const String& key, double ttl,
+	const std::function<void(const ProcessResult&)>& callback)
+{
+	std::shared_ptr<CoalescedExecution> execution;
+
+	{
+		std::unique_lock<std::mutex> lock (l_CoalescedExecutionsMutex);
+		double now = Utility::GetTime();
+
+		if (now >= l_NextCoalescedExecutionsCleanup) {
+			for (auto it (l_CoalescedExecutions.begin()); it != l_CoalescedExecutions.end();) {
+				if (it->second->Finished && it->second->Expires <= now)
+					it = l_CoalescedExecutions.erase(it);
+				else
+					++it;
+			}
+
+			l_NextCoalescedExecutionsCleanup = now + 60;
+		}
+
+		auto& entry (l_CoalescedExecutions[key]);
+
+		if (entry && entry->Finished && entry->Expires <= now)
+			entry = nullptr;
+
+		if (entry) {
+			if (entry->Finished) {
+				ProcessResult pr = entry->Result;
+
+				lock.unlock();
+
+				Log(LogDebug, "PluginUtility")
+					<< "Reusing the result of command " << key << " from " << pr.ExecutionEnd << ".";
+
+				Utility::QueueAsyncCallback([callback, pr]() { callback(pr); });
+			} else {
+				Log(LogDebug, "PluginUtility")
+					<< "Attaching to the running command " << key << ".";
+
+				entry->Callbacks.emplace_back(callback);
+			}
+
+			return;
+		}
+
+		entry = std::make_shared<CoalescedExecution>();
+		execution = entry;
+	}
+
+	double spawnStart = Utility::GetTime();
+
+	process->Run([commandObj, key, ttl, execution, callback](const ProcessResult& pr) {
+		std::vector<std::function<void(const ProcessResult&)>> callbacks;
+
+		CommandUsage::Record(commandObj, pr);
+
+		{
+			std::unique_lock<std::mutex> lock (l_CoalescedExecutionsMutex);
+
+			callbacks.swap(execution->Callbacks);
+
+			if (ttl > 0) {
+				execution->Finished = true;
+				execution->Result = pr;
+				execution->Expires = Utility::GetTime() + ttl;
+			} else {
+				auto it (l_CoalescedExecutions.find(key));
+
+				if (it != l_CoalescedExecutions.end() && it->second == execution)
+					l_CoalescedExecutions.erase(it);
+			}
+		}
+
+		/* Don't process all results sharing this one in the I/O thread. */
+		for (auto& cb : callbacks)
+			Utility::QueueAsyncCallback([cb, pr]() { cb(pr); });
+
+		callback(pr);
+	});
+
+	CheckLatency::Record(CheckLatencySpawn, Utility::GetTime() - spawnStart);
+}
+
+/**
+ * Builds the key of a cached command line: the modified attributes counters of the command and of all
+ * objects its macros may be resolved from. These are unique across objects, so the key changes whenever
+ * one of the objects is replaced (e.g. by a reload) or one of their attributes is modified.
+ *
+ * @returns false if the command line can't be cached as some macros aren't resolved from config objects
+ */
+static bool GetCommandLineCacheKey(const Command::Ptr& commandObj, const MacroProcessor::ResolverList& resolvers,
+	std::vector<uint_fast64_t>& key)
+{
+	key.push_back(commandObj->GetModifiedAttributesCounter());
+
+	/* The custom variables of the IcingaApplication, see MacroProcessor::ResolveMacro(). */
+	key.push_back(IcingaApplication::GetInstance()->GetModifiedAttributesCounter());
+
+	for (auto& resolver : resolvers) {
+		auto object (dynamic_cast<ConfigObject *>(resolver.Obj.get()));
+
+		/* e.g. the macros of the "execute-command" API action */
+		if (!object) {
+			key.clear();
+			return false;
+		}
+
+		key.push_back(object->GetModifiedAttributesCounter());
+	}
+
+	return true;
+}
+
 void PluginUtility::ExecuteCommand(const Command::Ptr& commandObj, const Checkable::Ptr& checkable,
 	const CheckResult::Ptr& cr, const MacroProcessor::ResolverList& macroResolvers,
 	const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros, int timeout,
 	const std::function<void(const Value& commandLine, const ProcessResult&)>& callback)
+{
+	Value command;
+	Dictionary::Ptr envMacros;
+	std::vector<uint_fast64_t> cacheKey;
+	bool cached = false;
+
+	/* Resolving only the macros (or using those resolved by another endpoint) bypasses the cache. */
+	if (checkable && !resolvedMacros && commandObj->GetCacheCommandLine()
+		&& GetCommandLineCacheKey(commandObj, macroResolvers, cacheKey))
+		cached = checkable->GetCachedCommandLine(cacheKey, command, envMacros);
+
+	if (!cached) {
+		MacroProcessor::StabilityTracker tracker;
+
+		if (!ResolveCommand(commandObj, cr, macroResolvers, resolvedMacros, useResolvedMacros, command, envMacros, callback))
+			return;
+
+		/* The cached command line and environment are shared by all executions, neither is modified. */
+		if (!cacheKey.empty() && tracker.IsStable())
+			checkable->SetCachedCommandLine(std::move(cacheKey), command, envMacros);
+	}
+
+	Process::Ptr process = new Process(Process::PrepareCommand(command), envMacros);
+
+	process->SetTimeout(timeout);
+	process->SetAdjustPriority(true);
+
+	auto checkCommand (dynamic_pointer_cast<CheckCommand>(commandObj));
+
+	if (checkCommand && checkCommand->GetCoalesce()) {
+		String key = JsonEncode(new Array({ command, envMacros, timeout }));
+
+		ExecuteCoalesced(commandObj, process, key, checkCommand->GetCoalesceTtl(),
+			[callback, command](const ProcessResult& pr) { callback(command, pr); });
+		return;
+	}
+
+	double spawnStart = Utility::GetTime();
+
+	process->Run([commandObj, callback, command](const ProcessResult& pr) {
+		CommandUsage::Record(commandObj, pr);
+		callback(command, pr);
+	});
+
+	if (checkCommand)
+		CheckLatency::Record(CheckLatencySpawn, Utility::GetTime() - spawnStart);
+}
+
+/**
+ * Resolves the command line and the environment variables of a command.
+ *
+ * @returns false if the command shall not be executed, i.e. if resolving failed
+ *          (callback has been called with an error result then) or if only the
+ *          macros have been resolved into resolvedMacros
+ */
+bool PluginUtility::ResolveCommand(const Command::Ptr& commandObj, const CheckResult::Ptr& cr,
+	const MacroProcessor::ResolverList& macroResolvers, const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros,
+	Value& command, Dictionary::Ptr& envMacros,
+	const std::function<void(const Value& commandLine, const ProcessResult&)>& callback)
 {
 	Value raw_command = commandObj->GetCommandLine();
 	Dictionary::Ptr raw_arguments = commandObj->GetArguments();
 
-	Value command;
-
 	try {
 		command = MacroProcessor::ResolveArguments(raw_command, raw_arguments,
 			macroResolvers, cr, resolvedMacros, useResolvedMacros);
@@ -41,10 +239,10 @@ void PluginUtility::ExecuteCommand(const Command::Ptr& commandObj, const Checkab
 			callback(Empty, pr);
 		}
 
-		return;
+		return false;
 	}
 
-	Dictionary::Ptr envMacros = new Dictionary();
+	envMacros = new Dictionary();
 
 	Dictionary::Ptr env = commandObj->GetEnv();
 
@@ -71,15 +269,7 @@ void PluginUtility::ExecuteCommand(const Command::Ptr& commandObj, const Checkab
 		}
 	}
 
-	if (resolvedMacros && !useResolvedMacros)
-		return;
-
-	Process::Ptr process = new Process(Process::PrepareCommand(command), envMacros);
-
-	process->SetTimeout(timeout);
-	process->SetAdjustPriority(true);
-
-	process->Run([callback, command](const ProcessResult& pr) { callback(command, pr); });
+	return !(resolvedMacros && !useResolvedMacros);
 }
 
 ServiceState PluginUtility::ExitStatusToState(int exitStatus)
@@ -26,6 +26,10 @@ public:
 		const CheckResult::Ptr& cr, const MacroProcessor::ResolverList& macroResolvers,
 		const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros, int timeout,
 		const std::function<void(const Value& commandLine, const ProcessResult&)>& callback = std::function<void(const Value& commandLine, const ProcessResult&)>());
+	static bool ResolveCommand(const Command::Ptr& commandObj, const CheckResult::Ptr& cr,
+		const MacroProcessor::ResolverList& macroResolvers, const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros,
+		Value& command, Dictionary::Ptr& envMacros,
+		const std::function<void(const Value& commandLine, const ProcessResult&)>& callback);
 
 	static ServiceState ExitStatusToState(int exitStatus);
 	static std::pair<String, String> ParseCheckOutput(const String& output);
@@ -4,6 +4,7 @@
 #include "icinga/service.hpp"
 #include "config/configitembuilder.hpp"
 #include "config/applyrule.hpp"
+#include "config/configprofiler.hpp"
 #include "base/initialize.hpp"
 #include "base/configtype.hpp"
 #include "base/logger.hpp"
@@ -66,6 +67,10 @@ bool ScheduledDowntime::EvaluateApplyRule(const Checkable::Ptr& checkable, const
 
 	CONTEXT("Evaluating 'apply' rule (" << di << ")");
 
+	ConfigProfilerScope profile ("apply", [&rule, &di]() {
+		return ConfigProfiler::GetDefinitionName("ScheduledDowntime", rule.GetName(), di);
+	});
+
 	Host::Ptr host;
 	Service::Ptr service;
 	tie(host, service) = GetHostService(checkable);
@@ -141,6 +146,14 @@ void ScheduledDowntime::EvaluateApplyRules(const Host::Ptr& host)
 		if (EvaluateApplyRule(host, *rule, true))
 			rule->AddMatch();
 	}
+
+	std::set<ApplyRule::Ptr> varRules;
+	ApplyRule::GetTargetedHostVarRules(ScheduledDowntime::TypeInstance, host, varRules);
+
+	for (auto& rule : varRules) {
+		if (EvaluateApplyRule(host, *rule))
+			rule->AddMatch();
+	}
 }
 
 void ScheduledDowntime::EvaluateApplyRules(const Service::Ptr& service)
@@ -156,4 +169,17 @@ void ScheduledDowntime::EvaluateApplyRules(const Service::Ptr& service)
 		if (EvaluateApplyRule(service, *rule, true))
 			rule->AddMatch();
 	}
+
+	for (auto& rule : ApplyRule::GetTargetedServicesOfHostRules(ScheduledDowntime::TypeInstance, service->GetHost()->GetName())) {
+		if (EvaluateApplyRule(service, *rule, true))
+			rule->AddMatch();
+	}
+
+	std::set<ApplyRule::Ptr> varRules;
+	ApplyRule::GetTargetedServiceHostVarRules(ScheduledDowntime::TypeInstance, service->GetHost(), varRules);
+
+	for (auto& rule : varRules) {
+		if (EvaluateApplyRule(service, *rule))
+			rule->AddMatch();
+	}
 }
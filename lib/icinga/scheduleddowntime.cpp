@@ -16,7 +16,12 @@
 #include "base/logger.hpp"
 #include "base/exception.hpp"
 #include <boost/thread/once.hpp>
+#include <functional>
+#include <mutex>
+#include <queue>
 #include <set>
+#include <utility>
+#include <vector>
 
 using namespace icinga;
 
@@ -24,6 +29,12 @@ REGISTER_TYPE(ScheduledDowntime);
 
 static Timer::Ptr l_Timer;
 
+typedef std::pair<double /* due */, String /* name */> ScheduledDowntimeQueueEntry;
+
+/* When TimerProc() has to look at a scheduled downtime again. Outdated entries (see QueueRun()) are skipped. */
+static std::mutex l_QueueMutex;
+static std::priority_queue<ScheduledDowntimeQueueEntry, std::vector<ScheduledDowntimeQueueEntry>, std::greater<>> l_Queue;
+
 String ScheduledDowntimeNameComposer::MakeName(const String& shortName, const Object::Ptr& context) const
 {
 	ScheduledDowntime::Ptr downtime = dynamic_pointer_cast<ScheduledDowntime>(context);
@@ -82,15 +93,88 @@ void ScheduledDowntime::Start(bool runtimeCreated)
 		l_Timer->SetInterval(60);
 		l_Timer->OnTimerExpired.connect([](const Timer * const&) { TimerProc(); });
 		l_Timer->Start();
+
+		/* Replace a downtime which has been removed before it started. */
+		Downtime::OnDowntimeRemoved.connect([](const Downtime::Ptr& downtime) {
+			auto sd (GetObject<ScheduledDowntime>(downtime->GetScheduledBy()));
+
+			if (sd && sd->IsActive())
+				sd->QueueRun(Utility::GetTime());
+		});
 	});
 
+	QueueRun(Utility::GetTime());
+
 	if (!IsPaused())
 		Utility::QueueAsyncCallback([this]() { CreateNextDowntime(); });
 }
 
+void ScheduledDowntime::Resume()
+{
+	ObjectImpl<ScheduledDowntime>::Resume();
+
+	QueueRun(Utility::GetTime());
+}
+
+/**
+ * Makes TimerProc() look at this scheduled downtime at the given time. Earlier runs queued before are dropped.
+ */
+void ScheduledDowntime::QueueRun(double due)
+{
+	std::unique_lock<std::mutex> lock (l_QueueMutex);
+
+	m_NextRun = due;
+	l_Queue.emplace(due, GetName());
+}
+
+/**
+ * @returns When a new downtime will have to be created, i.e. when the one which hasn't started yet starts.
+ *          If there's none (e.g. as no segment has been found), it's tried again in a minute.
+ */
+double ScheduledDowntime::GetNextRun()
+{
+	double now = Utility::GetTime();
+	double next = 0;
+	auto downtimeOptionsHash (HashDowntimeOptions());
+
+	for (const Downtime::Ptr& downtime : GetCheckable()->GetDowntimes()) {
+		if (downtime->GetScheduledBy() != GetName())
+			continue;
+
+		auto configOwnerHash (downtime->GetConfigOwnerHash());
+		if (!configOwnerHash.IsEmpty() && configOwnerHash != downtimeOptionsHash)
+			continue;
+
+		double start = downtime->GetStartTime();
+
+		if (start >= now && (next == 0 || start < next))
+			next = start;
+	}
+
+	return next > 0 ? next : now + 60;
+}
+
 void ScheduledDowntime::TimerProc()
 {
-	for (const ScheduledDowntime::Ptr& sd : ConfigType::GetObjectsByType<ScheduledDowntime>()) {
+	double now = Utility::GetTime();
+	std::vector<ScheduledDowntime::Ptr> due;
+
+	{
+		std::unique_lock<std::mutex> lock (l_QueueMutex);
+
+		while (!l_Queue.empty() && l_Queue.top().first <= now) {
+			auto entry (l_Queue.top());
+			l_Queue.pop();
+
+			auto sd (GetObject<ScheduledDowntime>(entry.second));
+
+			if (sd && sd->m_NextRun == entry.first)
+				due.emplace_back(std::move(sd));
+		}
+	}
+
+	/* Paused ones are queued again once they're resumed. */
+	for (const ScheduledDowntime::Ptr& sd : due) {
 		if (sd->IsActive() && !sd->IsPaused()) {
 			try {
 				sd->CreateNextDowntime();
@@ -108,6 +192,18 @@ void ScheduledDowntime::TimerProc()
 					<< "Exception occurred during removal of obsolete downtime for scheduled downtime '"
 					<< sd->GetName() << "': " << DiagnosticInformation(ex, false);
 			}
+
+			double next = now + 60;
+
+			try {
+				next = sd->GetNextRun();
+			} catch (const std::exception& ex) {
+				Log(LogCritical, "ScheduledDowntime")
+					<< "Exception occurred while determining the next run for scheduled downtime '"
+					<< sd->GetName() << "': " << DiagnosticInformation(ex, false);
+			}
+
+			sd->QueueRun(next);
 		}
 	}
 }
@@ -297,7 +393,7 @@ void ScheduledDowntime::CreateNextDowntime()
 		Log(LogNotice, "ScheduledDowntime")
 				<< "Processing child options " << childOptions << " for downtime " << downtimeName;
 
-		for (const Checkable::Ptr& child : GetCheckable()->GetAllChildren()) {
+		GetCheckable()->VisitAllChildren([this, &segment, &trigger](const Checkable::Ptr& child) {
 			Log(LogNotice, "ScheduledDowntime")
 				<< "Scheduling downtime for child object " << child->GetName();
 
@@ -306,7 +402,7 @@ void ScheduledDowntime::CreateNextDowntime()
 
 			Log(LogNotice, "ScheduledDowntime")
 				<< "Add child downtime '" << childDowntime->GetName() << "'.";
-		}
+		});
 	}
 }
 
@@ -40,10 +40,16 @@ public:
 protected:
 	void OnAllConfigLoaded() override;
 	void Start(bool runtimeCreated) override;
+	void Resume() override;
 
 private:
+	double m_NextRun{0};
+
 	static void TimerProc();
 
+	void QueueRun(double due);
+	double GetNextRun();
+
 	std::pair<double, double> FindRunningSegment(double minEnd = 0);
 	std::pair<double, double> FindNextSegment();
 	void CreateNextDowntime();
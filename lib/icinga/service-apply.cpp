@@ -3,6 +3,7 @@
 #include "icinga/service.hpp"
 #include "config/configitembuilder.hpp"
 #include "config/applyrule.hpp"
+#include "config/configprofiler.hpp"
 #include "base/initialize.hpp"
 #include "base/configtype.hpp"
 #include "base/logger.hpp"
@@ -61,6 +62,10 @@ bool Service::EvaluateApplyRule(const Host::Ptr& host, const ApplyRule& rule, bo
 
 	CONTEXT("Evaluating 'apply' rule (" << di << ")");
 
+	ConfigProfilerScope profile ("apply", [&rule, &di]() {
+		return ConfigProfiler::GetDefinitionName("Service", rule.GetName(), di);
+	});
+
 	ScriptFrame frame(true);
 	if (rule.GetScope())
 		rule.GetScope()->CopyTo(frame.Locals);
@@ -130,4 +135,12 @@ void Service::EvaluateApplyRules(const Host::Ptr& host)
 		if (EvaluateApplyRule(host, *rule, true))
 			rule->AddMatch();
 	}
+
+	std::set<ApplyRule::Ptr> varRules;
+	ApplyRule::GetTargetedHostVarRules(Service::TypeInstance, host, varRules);
+
+	for (auto& rule : varRules) {
+		if (EvaluateApplyRule(host, *rule))
+			rule->AddMatch();
+	}
 }
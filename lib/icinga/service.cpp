@@ -262,7 +262,7 @@ bool Service::ResolveMacro(const String& macro, const CheckResult::Ptr& cr, Valu
 			*result = cr->GetOutput();
 			return true;
 		} else if (macro == "perfdata") {
-			*result = PluginUtility::FormatPerfdata(cr->GetPerformanceData());
+			*result = cr->GetFormattedPerformanceData();
 			return true;
 		} else if (macro == "check_source") {
 			*result = cr->GetCheckSource();
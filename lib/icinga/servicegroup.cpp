@@ -15,7 +15,7 @@ using namespace icinga;
 REGISTER_TYPE(ServiceGroup);
 
 INITIALIZE_ONCE([]() {
-	ObjectRule::RegisterType("ServiceGroup");
+	ObjectRule::RegisterType("ServiceGroup", "Service");
 });
 
 bool ServiceGroup::EvaluateObjectRule(const Service::Ptr& service, const ConfigItem::Ptr& group)
@@ -50,11 +50,10 @@ void ServiceGroup::EvaluateObjectRules(const Service::Ptr& service)
 {
 	CONTEXT("Evaluating group membership for service '" << service->GetName() << "'");
 
-	for (const ConfigItem::Ptr& group : ConfigItem::GetItems(ServiceGroup::TypeInstance))
+	/* Only the groups whose assign rule may match at all */
+	for (const ConfigItem::Ptr& group : ObjectRule::GetCandidates(ServiceGroup::TypeInstance,
+		service->GetHostName(), service->GetShortName(), service->GetHost()))
 	{
-		if (!group->GetFilter())
-			continue;
-
 		EvaluateObjectRule(service, group);
 	}
 }
@@ -10,6 +10,7 @@
 #include "base/timer.hpp"
 #include "base/utility.hpp"
 #include <boost/thread/once.hpp>
+#include <algorithm>
 
 using namespace icinga;
 
@@ -38,60 +39,98 @@ void TimePeriod::Start(bool runtimeCreated)
 #endif /* _DEBUG */
 }
 
-void TimePeriod::AddSegment(double begin, double end)
+/**
+ * Rebuilds the sorted segments if the segments attribute has been replaced, e.g. from the state file.
+ */
+void TimePeriod::SyncSegments() const
 {
 	ASSERT(OwnsLock());
 
-	Log(LogDebug, "TimePeriod")
-		<< "Adding segment '" << Utility::FormatDateTime("%c", begin) << "' <-> '"
-		<< Utility::FormatDateTime("%c", end) << "' to TimePeriod '" << GetName() << "'";
+	Array::Ptr segments = GetSegments();
 
-	if (GetValidBegin().IsEmpty() || begin < GetValidBegin())
-		SetValidBegin(begin);
+	if (segments == m_SortedSegmentsSource)
+		return;
 
-	if (GetValidEnd().IsEmpty() || end > GetValidEnd())
-		SetValidEnd(end);
+	m_SortedSegments.clear();
+	m_SortedSegmentsSource = segments;
 
-	Array::Ptr segments = GetSegments();
+	if (!segments)
+		return;
 
-	if (segments) {
-		/* Try to merge the new segment into an existing segment. */
+	{
 		ObjectLock dlock(segments);
 		for (const Dictionary::Ptr& segment : segments) {
-			if (segment->Get("begin") <= begin && segment->Get("end") >= end)
-				return; /* New segment is fully contained in this segment. */
+			double begin = segment->Get("begin");
+			double end = segment->Get("end");
 
-			if (segment->Get("begin") >= begin && segment->Get("end") <= end) {
-				segment->Set("begin", begin);
-				segment->Set("end", end); /* Extend an existing segment to both sides */
-				return;
-			}
+			if (begin <= end)
+				m_SortedSegments.emplace_back(begin, end);
+		}
+	}
 
-			if (segment->Get("end") >= begin && segment->Get("end") <= end) {
-				segment->Set("end", end); /* Extend an existing segment to right. */
-				return;
-			}
+	std::sort(m_SortedSegments.begin(), m_SortedSegments.end());
 
-			if (segment->Get("begin") >= begin && segment->Get("begin") <= end) {
-				segment->Set("begin", begin); /* Extend an existing segment to left. */
-				return;
-			}
+	/* Merge overlapping segments. */
+	size_t count = 0;
 
-		}
+	for (auto& segment : m_SortedSegments) {
+		if (count && segment.first <= m_SortedSegments[count - 1u].second)
+			m_SortedSegments[count - 1u].second = std::max(m_SortedSegments[count - 1u].second, segment.second);
+		else
+			m_SortedSegments[count++] = segment;
 	}
 
-	/* Create new segment if we weren't able to merge this into an existing segment. */
-	Dictionary::Ptr segment = new Dictionary({
-		{ "begin", begin },
-		{ "end", end }
-	});
+	m_SortedSegments.resize(count);
+}
+
+/**
+ * Replaces the segments attribute with the sorted segments.
+ */
+void TimePeriod::PublishSegments()
+{
+	ASSERT(OwnsLock());
+
+	ArrayData segments;
+	segments.reserve(m_SortedSegments.size());
 
-	if (!segments) {
-		segments = new Array();
-		SetSegments(segments);
+	for (auto& segment : m_SortedSegments) {
+		segments.emplace_back(new Dictionary({
+			{ "begin", segment.first },
+			{ "end", segment.second }
+		}));
 	}
 
-	segments->Add(segment);
+	m_SortedSegmentsSource = new Array(std::move(segments));
+	SetSegments(m_SortedSegmentsSource);
+}
+
+void TimePeriod::AddSegment(double begin, double end)
+{
+	ASSERT(OwnsLock());
+
+	Log(LogDebug, "TimePeriod")
+		<< "Adding segment '" << Utility::FormatDateTime("%c", begin) << "' <-> '"
+		<< Utility::FormatDateTime("%c", end) << "' to TimePeriod '" << GetName() << "'";
+
+	if (GetValidBegin().IsEmpty() || begin < GetValidBegin())
+		SetValidBegin(begin);
+
+	if (GetValidEnd().IsEmpty() || end > GetValidEnd())
+		SetValidEnd(end);
+
+	SyncSegments();
+
+	/* Merge the new segment with all existing segments it overlaps or touches. */
+	auto first (std::lower_bound(m_SortedSegments.begin(), m_SortedSegments.end(), begin,
+		[](const std::pair<double, double>& segment, double begin) { return segment.second < begin; }));
+	auto last (first);
+
+	for (; last != m_SortedSegments.end() && last->first <= end; ++last) {
+		begin = std::min(begin, last->first);
+		end = std::max(end, last->second);
+	}
+
+	m_SortedSegments.insert(m_SortedSegments.erase(first, last), { begin, end });
 }
 
 void TimePeriod::AddSegment(const Dictionary::Ptr& segment)
@@ -113,57 +152,24 @@ void TimePeriod::RemoveSegment(double begin, double end)
 	if (GetValidEnd().IsEmpty() || end > GetValidEnd())
 		SetValidEnd(end);
 
-	Array::Ptr segments = GetSegments();
-
-	if (!segments)
-		return;
-
-	Array::Ptr newSegments = new Array();
+	SyncSegments();
 
-	/* Try to split or adjust an existing segment. */
-	ObjectLock dlock(segments);
-	for (const Dictionary::Ptr& segment : segments) {
-		/* Fully contained in the specified range? */
-		if (segment->Get("begin") >= begin && segment->Get("end") <= end)
-			// Don't add the old segment, because the segment is fully contained into our range
-			continue;
+	/* Cut the specified range out of all segments overlapping with it. */
+	auto first (std::upper_bound(m_SortedSegments.begin(), m_SortedSegments.end(), begin,
+		[](double begin, const std::pair<double, double>& segment) { return begin < segment.second; }));
+	auto last (first);
 
-		/* Not overlapping at all? */
-		if (segment->Get("end") < begin || segment->Get("begin") > end) {
-			newSegments->Add(segment);
-			continue;
-		}
+	std::vector<std::pair<double, double>> remainders;
 
-		/* Cut between */
-		if (segment->Get("begin") < begin && segment->Get("end") > end) {
-			newSegments->Add(new Dictionary({
-				{ "begin", segment->Get("begin") },
-				{ "end", begin }
-			}));
-
-			newSegments->Add(new Dictionary({
-				{ "begin", end },
-				{ "end", segment->Get("end") }
-			}));
-			// Don't add the old segment, because we have now two new segments and a gap between
-			continue;
-		}
+	for (; last != m_SortedSegments.end() && last->first < end; ++last) {
+		if (last->first < begin)
+			remainders.emplace_back(last->first, begin);
 
-		/* Adjust the begin/end timestamps so as to not overlap with the specified range. */
-		if (segment->Get("begin") > begin && segment->Get("begin") < end)
-			segment->Set("begin", end);
-
-		if (segment->Get("end") > begin && segment->Get("end") < end)
-			segment->Set("end", begin);
-
-		newSegments->Add(segment);
+		if (last->second > end)
+			remainders.emplace_back(end, last->second);
 	}
 
-	SetSegments(newSegments);
-
-#ifdef _DEBUG
-	Dump();
-#endif /* _DEBUG */
+	m_SortedSegments.insert(m_SortedSegments.erase(first, last), remainders.begin(), remainders.end());
 }
 
 void TimePeriod::RemoveSegment(const Dictionary::Ptr& segment)
@@ -184,21 +190,13 @@ void TimePeriod::PurgeSegments(double end)
 
 	SetValidBegin(end);
 
-	Array::Ptr segments = GetSegments();
-
-	if (!segments)
-		return;
-
-	Array::Ptr newSegments = new Array();
+	SyncSegments();
 
 	/* Remove old segments. */
-	ObjectLock dlock(segments);
-	for (const Dictionary::Ptr& segment : segments) {
-		if (segment->Get("end") >= end)
-			newSegments->Add(segment);
-	}
+	m_SortedSegments.erase(m_SortedSegments.begin(), std::lower_bound(m_SortedSegments.begin(), m_SortedSegments.end(), end,
+		[](const std::pair<double, double>& segment, double end) { return segment.second < end; }));
 
-	SetSegments(newSegments);
+	PublishSegments();
 }
 
 void TimePeriod::Merge(const TimePeriod::Ptr& timeperiod, bool include)
@@ -207,22 +205,28 @@ void TimePeriod::Merge(const TimePeriod::Ptr& timeperiod, bool include)
 		<< "Merge TimePeriod '" << GetName() << "' with '" << timeperiod->GetName() << "' "
 		<< "Method: " << (include ? "include" : "exclude");
 
-	Array::Ptr segments = timeperiod->GetSegments();
+	std::vector<std::pair<double, double>> segments;
 
-	if (segments) {
-		ObjectLock dlock(segments);
-		ObjectLock ilock(this);
-		for (const Dictionary::Ptr& segment : segments) {
-			include ? AddSegment(segment) : RemoveSegment(segment);
-		}
+	{
+		ObjectLock olock(timeperiod);
+		timeperiod->SyncSegments();
+		segments = timeperiod->m_SortedSegments;
+	}
+
+	ObjectLock olock(this);
+	for (auto& segment : segments) {
+		include ? AddSegment(segment.first, segment.second) : RemoveSegment(segment.first, segment.second);
 	}
+
+	PublishSegments();
 }
 
 void TimePeriod::UpdateRegion(double begin, double end, bool clearExisting)
 {
 	if (clearExisting) {
 		ObjectLock olock(this);
-		SetSegments(new Array());
+		m_SortedSegments.clear();
+		PublishSegments();
 	} else {
 		if (begin < GetValidEnd())
 			begin = GetValidEnd();
@@ -243,6 +247,8 @@ void TimePeriod::UpdateRegion(double begin, double end, bool clearExisting)
 				AddSegment(segment);
 			}
 		}
+
+		PublishSegments();
 	}
 
 	bool preferInclude = GetPreferIncludes();
@@ -286,39 +292,28 @@ bool TimePeriod::IsInside(double ts) const
 	if (GetValidBegin().IsEmpty() || ts < GetValidBegin() || GetValidEnd().IsEmpty() || ts > GetValidEnd())
 		return true; /* Assume that all invalid regions are "inside". */
 
-	Array::Ptr segments = GetSegments();
+	SyncSegments();
 
-	if (segments) {
-		ObjectLock dlock(segments);
-		for (const Dictionary::Ptr& segment : segments) {
-			if (ts > segment->Get("begin") && ts < segment->Get("end"))
-				return true;
-		}
-	}
+	/* The first segment which ends after ts is the only one which may contain it. */
+	auto it (std::upper_bound(m_SortedSegments.begin(), m_SortedSegments.end(), ts,
+		[](double ts, const std::pair<double, double>& segment) { return ts < segment.second; }));
 
-	return false;
+	return it != m_SortedSegments.end() && ts > it->first;
 }
 
 double TimePeriod::FindNextTransition(double begin)
 {
 	ObjectLock olock(this);
 
-	Array::Ptr segments = GetSegments();
+	SyncSegments();
 
-	double closestTransition = -1;
+	auto it (std::upper_bound(m_SortedSegments.begin(), m_SortedSegments.end(), begin,
+		[](double begin, const std::pair<double, double>& segment) { return begin < segment.second; }));
 
-	if (segments) {
-		ObjectLock dlock(segments);
-		for (const Dictionary::Ptr& segment : segments) {
-			if (segment->Get("begin") > begin && (segment->Get("begin") < closestTransition || closestTransition == -1))
-				closestTransition = segment->Get("begin");
-
-			if (segment->Get("end") > begin && (segment->Get("end") < closestTransition || closestTransition == -1))
-				closestTransition = segment->Get("end");
-		}
-	}
+	if (it == m_SortedSegments.end())
+		return -1;
 
-	return closestTransition;
+	return it->first > begin ? it->first : it->second;
 }
 
 void TimePeriod::UpdateTimerHandler()
@@ -375,25 +370,38 @@ void TimePeriod::ValidateRanges(const Lazy<Dictionary::Ptr>& lvalue, const Valid
 	if (!lvalue())
 		return;
 
-	/* create a fake time environment to validate the definitions */
-	time_t refts = Utility::GetTime();
-	tm reference = Utility::LocalTime(refts);
-	Array::Ptr segments = new Array();
+	auto compiled (std::make_shared<LegacyTimeRanges>());
+	compiled->Source = lvalue();
 
 	ObjectLock olock(lvalue());
 	for (const Dictionary::Pair& kv : lvalue()) {
+		LegacyDayDefinition daydef;
+
 		try {
-			tm begin_tm, end_tm;
-			int stride;
-			LegacyTimePeriod::ParseTimeRange(kv.first, &begin_tm, &end_tm, &stride, &reference);
+			daydef = LegacyTimePeriod::CompileDayDefinition(kv.first);
 		} catch (const std::exception& ex) {
 			BOOST_THROW_EXCEPTION(ValidationError(this, { "ranges" }, "Invalid time specification '" + kv.first + "': " + ex.what()));
 		}
 
 		try {
-			LegacyTimePeriod::ProcessTimeRanges(kv.second, &reference, segments);
+			compiled->Days.emplace_back(daydef, LegacyTimePeriod::CompileTimeRanges(kv.second));
 		} catch (const std::exception& ex) {
 			BOOST_THROW_EXCEPTION(ValidationError(this, { "ranges" }, "Invalid time range definition '" + kv.second + "': " + ex.what()));
 		}
 	}
+
+	/* Saves LegacyTimePeriod::ScriptFunc() from parsing them again. */
+	SetCompiledRanges(compiled);
+}
+
+std::shared_ptr<const LegacyTimeRanges> TimePeriod::GetCompiledRanges() const
+{
+	std::unique_lock<std::mutex> lock (m_CompiledRangesMutex);
+	return m_CompiledRanges;
+}
+
+void TimePeriod::SetCompiledRanges(const std::shared_ptr<const LegacyTimeRanges>& ranges)
+{
+	std::unique_lock<std::mutex> lock (m_CompiledRangesMutex);
+	m_CompiledRanges = ranges;
 }
@@ -5,10 +5,16 @@
 
 #include "icinga/i2-icinga.hpp"
 #include "icinga/timeperiod-ti.hpp"
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 namespace icinga
 {
 
+struct LegacyTimeRanges;
+
 /**
  * A time period.
  *
@@ -31,7 +37,20 @@ public:
 
 	void ValidateRanges(const Lazy<Dictionary::Ptr>& lvalue, const ValidationUtils& utils) override;
 
+	std::shared_ptr<const LegacyTimeRanges> GetCompiledRanges() const;
+	void SetCompiledRanges(const std::shared_ptr<const LegacyTimeRanges>& ranges);
+
 private:
+	mutable std::mutex m_CompiledRangesMutex;
+	std::shared_ptr<const LegacyTimeRanges> m_CompiledRanges;
+
+	/* Sorted, non-overlapping copy of the segments attribute, protected by the object lock */
+	mutable std::vector<std::pair<double, double>> m_SortedSegments;
+	mutable Array::Ptr m_SortedSegmentsSource;
+
+	void SyncSegments() const;
+	void PublishSegments();
+
 	void AddSegment(double s, double end);
 	void AddSegment(const Dictionary::Ptr& segment);
 	void RemoveSegment(double begin, double end);
@@ -24,6 +24,9 @@ void User::OnAllConfigLoaded()
 {
 	ObjectImpl<User>::OnAllConfigLoaded();
 
+	/* Notifications may refer to this user by name. */
+	Notification::InvalidateRecipients();
+
 	UserGroup::EvaluateObjectRules(this);
 
 	Array::Ptr groups = GetGroups();
@@ -46,6 +49,8 @@ void User::Stop(bool runtimeRemoved)
 {
 	ObjectImpl<User>::Stop(runtimeRemoved);
 
+	Notification::InvalidateRecipients();
+
 	Array::Ptr groups = GetGroups();
 
 	if (groups) {
@@ -16,7 +16,7 @@ using namespace icinga;
 REGISTER_TYPE(UserGroup);
 
 INITIALIZE_ONCE([]() {
-	ObjectRule::RegisterType("UserGroup");
+	ObjectRule::RegisterType("UserGroup", "User");
 });
 
 bool UserGroup::EvaluateObjectRule(const User::Ptr& user, const ConfigItem::Ptr& group)
@@ -48,11 +48,9 @@ void UserGroup::EvaluateObjectRules(const User::Ptr& user)
 {
 	CONTEXT("Evaluating group membership for user '" << user->GetName() << "'");
 
-	for (const ConfigItem::Ptr& group : ConfigItem::GetItems(UserGroup::TypeInstance))
+	/* Only the groups whose assign rule may match at all */
+	for (const ConfigItem::Ptr& group : ObjectRule::GetCandidates(UserGroup::TypeInstance, user->GetName()))
 	{
-		if (!group->GetFilter())
-			continue;
-
 		EvaluateObjectRule(user, group);
 	}
 }
@@ -67,14 +65,30 @@ void UserGroup::AddMember(const User::Ptr& user)
 {
 	user->AddGroup(GetName());
 
-	std::unique_lock<std::mutex> lock(m_UserGroupMutex);
-	m_Members.insert(user);
+	{
+		std::unique_lock<std::mutex> lock(m_UserGroupMutex);
+		m_Members.insert(user);
+	}
+
+	Notification::InvalidateRecipients();
 }
 
 void UserGroup::RemoveMember(const User::Ptr& user)
 {
-	std::unique_lock<std::mutex> lock(m_UserGroupMutex);
-	m_Members.erase(user);
+	{
+		std::unique_lock<std::mutex> lock(m_UserGroupMutex);
+		m_Members.erase(user);
+	}
+
+	Notification::InvalidateRecipients();
+}
+
+void UserGroup::Stop(bool runtimeRemoved)
+{
+	ObjectImpl<UserGroup>::Stop(runtimeRemoved);
+
+	/* Notifications don't find the group by its name anymore. */
+	Notification::InvalidateRecipients();
 }
 
 std::set<Notification::Ptr> UserGroup::GetNotifications() const
@@ -36,6 +36,9 @@ public:
 
 	static void EvaluateObjectRules(const User::Ptr& user);
 
+protected:
+	void Stop(bool runtimeRemoved) override;
+
 private:
 	mutable std::mutex m_UserGroupMutex;
 	std::set<User::Ptr> m_Members;
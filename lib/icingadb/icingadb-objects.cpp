@@ -8,6 +8,7 @@
 #include "base/json.hpp"
 #include "base/logger.hpp"
 #include "base/serializer.hpp"
+#include "base/startupscheduler.hpp"
 #include "base/shared.hpp"
 #include "base/tlsutility.hpp"
 #include "base/initialize.hpp"
@@ -25,15 +26,22 @@
 #include "icinga/servicegroup.hpp"
 #include "icinga/usergroup.hpp"
 #include "icinga/checkcommand.hpp"
+#include "icinga/checklatency.hpp"
+#include "icinga/checkresultstage.hpp"
 #include "icinga/eventcommand.hpp"
 #include "icinga/notificationcommand.hpp"
 #include "icinga/timeperiod.hpp"
 #include "icinga/pluginutility.hpp"
 #include "remote/zone.hpp"
+#include <boost/algorithm/string/predicate.hpp>
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <deque>
+#include <fstream>
 #include <iterator>
 #include <map>
 #include <memory>
@@ -50,6 +58,12 @@ std::unordered_set<Type*> IcingaDB::m_IndexedTypes;
 
 INITIALIZE_ONCE(&IcingaDB::ConfigStaticInitialize);
 
+/* Partitioned by checkable: QueueStateUpdate() serializes and writes the state right away without state_coalesce_window. */
+static CheckResultStage l_IcingaDBCheckResultStage ("icingadb", 100000, CheckResultStageBlock, 4);
+
+/* Maximum number of objects sent in one transaction by SendConfigUpdates(). */
+static const size_t l_ConfigUpdatesBatchSize = 500;
+
 std::vector<Type::Ptr> IcingaDB::GetTypes()
 {
 	// The initial config sync will queue the types in the following order.
@@ -105,6 +119,9 @@ void IcingaDB::ConfigStaticInitialize()
 	ConfigObject::OnVersionChanged.connect([](const ConfigObject::Ptr& object, const Value&) {
 		IcingaDB::VersionChangedHandler(object);
 	});
+	ConfigObject::OnBatchActivated.connect([](const std::vector<ConfigObject::Ptr>& objects, const Value&) {
+		IcingaDB::BatchActivatedHandler(objects);
+	});
 
 	/* downtime start */
 	Downtime::OnDowntimeTriggered.connect(&IcingaDB::DowntimeStartedHandler);
@@ -124,8 +141,10 @@ void IcingaDB::ConfigStaticInitialize()
 
 	Checkable::OnFlappingChange.connect(&IcingaDB::FlappingChangeHandler);
 
-	Checkable::OnNewCheckResult.connect([](const Checkable::Ptr& checkable, const CheckResult::Ptr&, const MessageOrigin::Ptr&) {
-		IcingaDB::NewCheckResultHandler(checkable);
+	Checkable::OnNewCheckResult.connect([](const Checkable::Ptr& checkable, const CheckResult::Ptr& cr, const MessageOrigin::Ptr&) {
+		/* The volatile state is always taken from the checkable, so it doesn't matter how late this runs. */
+		if (!ConfigType::GetObjectsByType<IcingaDB>().empty())
+			l_IcingaDBCheckResultStage.Enqueue(checkable, [checkable, cr]() { IcingaDB::NewCheckResultHandler(checkable, cr); });
 	});
 
 	Checkable::OnNextCheckUpdated.connect([](const Checkable::Ptr& checkable) {
@@ -173,6 +192,8 @@ void IcingaDB::ConfigStaticInitialize()
 
 void IcingaDB::UpdateAllConfigObjects()
 {
+	StartupScheduler::Slot startupSlot ({ "icingadb", 20, 1, "icingadb dumped" });
+
 	m_Rcon->Sync();
 	m_Rcon->FireAndForgetQuery({"XADD", "icinga:schema", "MAXLEN", "1", "*", "version", "5"}, Prio::Heartbeat);
 
@@ -219,45 +240,73 @@ void IcingaDB::UpdateAllConfigObjects()
 		m_DumpedGlobals.IconImage.Reset();
 	});
 
-	upq.ParallelFor(types, false, [this](const Type::Ptr& type) {
+	std::atomic<size_t> unchanged (0);
+	Dictionary::Ptr dumpTypes = new Dictionary();
+
+	upq.ParallelFor(types, false, [this, &unchanged, &dumpTypes](const Type::Ptr& type) {
 		String lcType = type->GetName().ToLower();
 		ConfigType *ctype = dynamic_cast<ConfigType *>(type.get());
 		if (!ctype)
 			return;
 
+		double typeStart = Utility::GetTime();
 		auto& rcon (m_Rcons.at(ctype));
+		auto objectChunks (ChunkObjects(ctype->GetObjects(), 500));
+
+		// Types with several chunks are spread across the dump connections, too.
+		std::vector<RedisConnection::Ptr> rcons {rcon};
 
-		std::vector<String> keys = GetTypeOverwriteKeys(lcType);
-		DeleteKeys(rcon, keys, Prio::Config);
+		if (objectChunks.size() > 1u) {
+			rcons.insert(rcons.end(), m_DumpRcons.begin(), m_DumpRcons.end());
+		}
+
+		std::atomic<size_t> nextRcon (0);
+
+		auto pickRcon ([&rcons, &nextRcon]() -> const RedisConnection::Ptr& {
+			return rcons[nextRcon.fetch_add(1) % rcons.size()];
+		});
+
+		// States change all the time anyway, so they're overwritten. The other keys are just updated where necessary.
+		std::vector<String> overwriteKeys, updateKeys;
+
+		for (auto& key : GetTypeOverwriteKeys(lcType)) {
+			(boost::algorithm::ends_with(key.GetData(), ":state") ? overwriteKeys : updateKeys).emplace_back(key);
+		}
+
+		DeleteKeys(rcon, overwriteKeys, Prio::Config);
+
+		if (rcons.size() > 1u) {
+			// Otherwise the DEL could overtake the other connections' HMSETs.
+			rcon->Sync();
+		}
 
 		WorkQueue upqObjectType(25000, Configuration::Concurrency, LogNotice);
 		upqObjectType.SetName("IcingaDB:ConfigDump:" + lcType);
 
-		std::map<String, String> redisCheckSums;
 		String configCheckSum = m_PrefixConfigCheckSum + lcType;
+		std::map<String, std::map<String, String>> redisContent {{configCheckSum, {}}};
 
-		upqObjectType.Enqueue([&rcon, &configCheckSum, &redisCheckSums]() {
-			String cursor = "0";
-
-			do {
-				Array::Ptr res = rcon->GetResultOfQuery({
-					"HSCAN", configCheckSum, cursor, "COUNT", "1000"
-				}, Prio::Config);
-
-				AddKvsToMap(res->Get(1), redisCheckSums);
+		for (auto& key : updateKeys) {
+			redisContent[key];
+		}
 
-				cursor = res->Get(0);
-			} while (cursor != "0");
-		});
+		for (auto& kv : redisContent) {
+			upqObjectType.Enqueue([&rcon, &kv]() { ScanHash(rcon, kv.first, kv.second); });
+		}
 
-		auto objectChunks (ChunkObjects(ctype->GetObjects(), 500));
 		String configObject = m_PrefixConfigObject + lcType;
 
 		// Skimmed away attributes and checksums HMSETs' keys and values by Redis key.
 		std::map<String, std::vector<std::vector<String>>> ourContentRaw {{configCheckSum, {}}, {configObject, {}}};
 		std::mutex ourContentMutex;
+		std::atomic<size_t> dumpedObjects (0);
 
-		upqObjectType.ParallelFor(objectChunks, [&](decltype(objectChunks)::const_reference chunk) {
+		for (auto& key : updateKeys) {
+			ourContentRaw[key];
+		}
+
+		upqObjectType.ParallelForStealing(objectChunks, [&](decltype(objectChunks)::const_reference chunk) {
+			auto& chunkRcon (pickRcon());
 			std::map<String, std::vector<String>> hMSets;
 			// Two values are appended per object: Object ID (Hash encoded) and Object State (IcingaDB::SerializeState() -> JSON encoded)
 			std::vector<String> states = {"HMSET", m_PrefixConfigObject + lcType + ":state"};
@@ -323,7 +372,7 @@ void IcingaDB::UpdateAllConfigObjects()
 
 					if (transaction.size() > 1) {
 						transaction.push_back({"EXEC"});
-						rcon->FireAndForgetQueries(std::move(transaction), Prio::Config);
+						chunkRcon->FireAndForgetQueries(std::move(transaction), Prio::Config);
 						transaction = {{"MULTI"}};
 					}
 				}
@@ -339,7 +388,7 @@ void IcingaDB::UpdateAllConfigObjects()
 					if (zAdds->size() >= 102u) {
 						std::vector<String> header (zAdds->begin(), zAdds->begin() + 2u);
 
-						rcon->FireAndForgetQuery(std::move(*zAdds), Prio::CheckResult);
+						chunkRcon->FireAndForgetQuery(std::move(*zAdds), Prio::CheckResult);
 
 						*zAdds = std::move(header);
 					}
@@ -362,15 +411,17 @@ void IcingaDB::UpdateAllConfigObjects()
 
 			if (transaction.size() > 1) {
 				transaction.push_back({"EXEC"});
-				rcon->FireAndForgetQueries(std::move(transaction), Prio::Config);
+				chunkRcon->FireAndForgetQueries(std::move(transaction), Prio::Config);
 			}
 
 			for (auto zAdds : {&hostZAdds, &serviceZAdds}) {
 				if (zAdds->size() > 2u) {
-					rcon->FireAndForgetQuery(std::move(*zAdds), Prio::CheckResult);
+					chunkRcon->FireAndForgetQuery(std::move(*zAdds), Prio::CheckResult);
 				}
 			}
 
+			dumpedObjects += bulkCounter;
+
 			Log(LogNotice, "IcingaDB")
 					<< "Dumped " << bulkCounter << " objects of type " << lcType;
 		});
@@ -406,6 +457,7 @@ void IcingaDB::UpdateAllConfigObjects()
 		upqObjectType.Join();
 		ourContentRaw.clear();
 
+		auto& redisCheckSums (redisContent[configCheckSum]);
 		auto& ourCheckSums (ourContent[configCheckSum]);
 		auto& ourObjects (ourContent[configObject]);
 		std::vector<String> setChecksum, setObject, delChecksum, delObject;
@@ -431,7 +483,7 @@ void IcingaDB::UpdateAllConfigObjects()
 			setChecksum.clear();
 			setObject.clear();
 
-			rcon->FireAndForgetQueries(std::move(transaction), Prio::Config, {affectedConfig});
+			pickRcon()->FireAndForgetQueries(std::move(transaction), Prio::Config, {affectedConfig});
 		});
 
 		auto flushDels ([&]() {
@@ -450,7 +502,7 @@ void IcingaDB::UpdateAllConfigObjects()
 			delChecksum.clear();
 			delObject.clear();
 
-			rcon->FireAndForgetQueries(std::move(transaction), Prio::Config, {affectedConfig});
+			pickRcon()->FireAndForgetQueries(std::move(transaction), Prio::Config, {affectedConfig});
 		});
 
 		auto setOne ([&]() {
@@ -495,6 +547,8 @@ void IcingaDB::UpdateAllConfigObjects()
 			} else {
 				if (redisCurrent->second != ourCurrent->second) {
 					setOne();
+				} else {
+					++unchanged;
 				}
 
 				++redisCurrent;
@@ -510,14 +564,45 @@ void IcingaDB::UpdateAllConfigObjects()
 			flushSets();
 		}
 
+		for (auto& key : updateKeys) {
+			UpdateHash(pickRcon(), key, ourContent[key], redisContent[key]);
+		}
+
+		// The type is done once everything has arrived, no matter via which connection.
+		for (auto& conn : rcons) {
+			if (conn != rcon) {
+				conn->Sync();
+			}
+		}
+
 		for (auto& key : GetTypeDumpSignalKeys(type)) {
 			rcon->FireAndForgetQuery({"XADD", "icinga:dump", "*", "key", key, "state", "done"}, Prio::Config);
 		}
 		rcon->Sync();
+
+		double took = Utility::GetTime() - typeStart;
+		size_t objects = dumpedObjects.load();
+
+		dumpTypes->Set(lcType, new Dictionary({
+			{ "objects", objects },
+			{ "connections", rcons.size() },
+			{ "duration", took },
+			{ "objects_per_second", took > 0 ? objects / took : 0.0 }
+		}));
+
+		Log(objects ? LogInformation : LogNotice, "IcingaDB")
+			<< "Dumped " << objects << " objects of type " << lcType << " via " << rcons.size()
+			<< " connection(s) in " << Utility::FormatDuration(took) << " ("
+			<< (took > 0 ? std::round(objects / took) : 0.0) << "/s)";
 	});
 
 	upq.Join();
 
+	{
+		std::unique_lock<std::mutex> lock (m_LastDumpTypesMutex);
+		m_LastDumpTypes = dumpTypes;
+	}
+
 	if (upq.HasExceptions()) {
 		for (boost::exception_ptr exc : upq.GetExceptions()) {
 			try {
@@ -547,9 +632,11 @@ void IcingaDB::UpdateAllConfigObjects()
 
 	SetLastdumpTook(took);
 	SetLastdumpEnd(endTime);
+	SetLastdumpUnchanged(unchanged.load());
 
 	Log(LogInformation, "IcingaDB")
-		<< "Initial config/status dump finished in " << took << " seconds.";
+		<< "Initial config/status dump finished in " << took << " seconds, "
+		<< unchanged.load() << " objects were unchanged in Redis and not written.";
 }
 
 std::vector<std::vector<intrusive_ptr<ConfigObject>>> IcingaDB::ChunkObjects(std::vector<intrusive_ptr<ConfigObject>> objects, size_t chunkSize) {
@@ -581,6 +668,99 @@ void IcingaDB::DeleteKeys(const RedisConnection::Ptr& conn, const std::vector<St
 	conn->FireAndForgetQuery(std::move(query), priority);
 }
 
+/**
+ * Read a whole Redis hash without blocking Redis for too long
+ *
+ * @param conn Redis connection
+ * @param key The hash
+ * @param fields Receives the fields and values of the hash
+ */
+void IcingaDB::ScanHash(const RedisConnection::Ptr& conn, const String& key, std::map<String, String>& fields)
+{
+	String cursor = "0";
+
+	do {
+		// The response [cursor, [key, value, key, value, ...]] arrives as cursor, key, value, key, value, ...
+		size_t leaves = 0;
+		String field;
+
+		conn->StreamResultOfQuery({
+			"HSCAN", key, cursor, "COUNT", "1000"
+		}, [&cursor, &fields, &leaves, &field](RedisConnection::Reply& leaf) {
+			if (!leaves++) {
+				cursor = std::move(leaf);
+			} else if (leaves % 2u) {
+				fields.emplace(std::move(field), std::move(leaf));
+			} else {
+				field = std::move(leaf);
+			}
+		}, Prio::Config);
+	} while (cursor != "0");
+}
+
+/**
+ * Make a Redis hash look like ours by writing only what differs
+ *
+ * @param conn Redis connection
+ * @param key The hash
+ * @param ours The desired fields and values
+ * @param theirs The fields and values currently in Redis as read by ScanHash()
+ */
+void IcingaDB::UpdateHash(const RedisConnection::Ptr& conn, const String& key,
+	const std::map<String, String>& ours, const std::map<String, String>& theirs)
+{
+	std::vector<String> hMSet, hDel;
+
+	auto flush ([&conn, &key](std::vector<String>& query, const char* command, size_t affected) {
+		query.insert(query.begin(), {command, key});
+		conn->FireAndForgetQuery(std::move(query), Prio::Config, {affected});
+		query.clear();
+	});
+
+	auto set ([&](const std::pair<const String, String>& field) {
+		hMSet.emplace_back(field.first);
+		hMSet.emplace_back(field.second);
+
+		if (hMSet.size() == 200u) {
+			flush(hMSet, "HMSET", 100u);
+		}
+	});
+
+	auto del ([&](const String& field) {
+		hDel.emplace_back(field);
+
+		if (hDel.size() == 100u) {
+			flush(hDel, "HDEL", 100u);
+		}
+	});
+
+	auto ourCurrent (ours.begin());
+	auto theirCurrent (theirs.begin());
+
+	while (ourCurrent != ours.end() || theirCurrent != theirs.end()) {
+		if (theirCurrent == theirs.end() || (ourCurrent != ours.end() && ourCurrent->first < theirCurrent->first)) {
+			set(*ourCurrent++);
+		} else if (ourCurrent == ours.end() || theirCurrent->first < ourCurrent->first) {
+			del((theirCurrent++)->first);
+		} else {
+			if (ourCurrent->second != theirCurrent->second) {
+				set(*ourCurrent);
+			}
+
+			++ourCurrent;
+			++theirCurrent;
+		}
+	}
+
+	if (!hMSet.empty()) {
+		flush(hMSet, "HMSET", hMSet.size() / 2u);
+	}
+
+	if (!hDel.empty()) {
+		flush(hDel, "HDEL", hDel.size());
+	}
+}
+
 std::vector<String> IcingaDB::GetTypeOverwriteKeys(const String& type)
 {
 	std::vector<String> keys = {
@@ -1112,6 +1292,89 @@ void IcingaDB::InsertObjectDependencies(const ConfigObject::Ptr& object, const S
 	}
 }
 
+/**
+ * @returns Whether two states serialized by SerializeState() are the same, their attributes are all scalars.
+ */
+static bool StateAttrsEqual(const Dictionary::Ptr& lhs, const Dictionary::Ptr& rhs)
+{
+	if (lhs->GetLength() != rhs->GetLength())
+		return false;
+
+	ObjectLock lhsLock (lhs);
+	ObjectLock rhsLock (rhs);
+
+	auto rhsCurrent (rhs->Begin());
+
+	for (auto& kv : lhs) {
+		/* Value::operator==() considers e.g. true and 1 equal, but they're encoded differently. */
+		if (kv.first != rhsCurrent->first || kv.second.GetType() != rhsCurrent->second.GetType() || kv.second != rhsCurrent->second)
+			return false;
+
+		++rhsCurrent;
+	}
+
+	return true;
+}
+
+/**
+ * Serialize the state of a checkable along with its checksum and JSON encoding
+ *
+ * A check result causes several state updates of its checkable, e.g. the volatile state once it has been processed,
+ * the runtime update of a state change and the next update. If the state is the same as during the last one or two
+ * seconds, the checksum and the JSON encoding of that state are reused. The state is always serialized again, as it
+ * also depends on other objects and the time, e.g. downtimes, reachability and acknowledgement expiry.
+ *
+ * @param checkable The checkable to serialize the state of
+ *
+ * @returns The prepared state, shared and not to be modified
+ */
+Shared<IcingaDB::PreparedState>::Ptr IcingaDB::GetPreparedState(const Checkable::Ptr& checkable)
+{
+	Dictionary::Ptr attrs = SerializeState(checkable);
+	attrs->Freeze();
+
+	{
+		std::unique_lock<std::mutex> lock (m_PreparedStatesMutex);
+
+		for (auto states : {&m_PreparedStates, &m_PreviousPreparedStates}) {
+			auto pos (states->find(checkable.get()));
+
+			if (pos != states->end() && StateAttrsEqual(pos->second->Attrs, attrs)) {
+				m_PreparedStatesReused.fetch_add(1);
+				return pos->second;
+			}
+		}
+	}
+
+	auto prepared (Shared<PreparedState>::Make());
+
+	prepared->Owner = checkable;
+	prepared->Attrs = attrs;
+	prepared->Checksum = HashValue(attrs);
+	prepared->Json = JsonEncode(attrs);
+
+	std::unique_lock<std::mutex> lock (m_PreparedStatesMutex);
+
+	m_PreparedStates[checkable.get()] = prepared;
+
+	return prepared;
+}
+
+/**
+ * Drop the states prepared by GetPreparedState() more than one to two seconds ago, called every second
+ */
+void IcingaDB::RotatePreparedStates()
+{
+	decltype(m_PreviousPreparedStates) expired;
+
+	{
+		std::unique_lock<std::mutex> lock (m_PreparedStatesMutex);
+
+		std::swap(expired, m_PreviousPreparedStates);
+		std::swap(m_PreviousPreparedStates, m_PreparedStates);
+	}
+}
+
 /**
  * Update the state information of a checkable in Redis.
  *
@@ -1136,15 +1399,16 @@ void IcingaDB::UpdateState(const Checkable::Ptr& checkable, StateUpdate mode)
 	String objectType = GetLowerCaseTypeNameDB(checkable);
 	String objectKey = GetObjectIdentifier(checkable);
 
-	Dictionary::Ptr stateAttrs = SerializeState(checkable);
+	auto prepared (GetPreparedState(checkable));
+	auto& stateAttrs (prepared->Attrs);
+	auto& checksum (prepared->Checksum);
 
 	String redisStateKey = m_PrefixConfigObject + objectType + ":state";
 	String redisChecksumKey = m_PrefixConfigCheckSum + objectType + ":state";
-	String checksum = HashValue(stateAttrs);
 
 	if (mode & StateUpdate::Volatile) {
 		m_Rcon->FireAndForgetQueries({
-			{"HSET", redisStateKey, objectKey, JsonEncode(stateAttrs)},
+			{"HSET", redisStateKey, objectKey, prepared->Json},
 			{"HSET", redisChecksumKey, objectKey, JsonEncode(new Dictionary({{"checksum", checksum}}))},
 		}, Prio::RuntimeStateSync);
 	}
@@ -1164,58 +1428,195 @@ void IcingaDB::UpdateState(const Checkable::Ptr& checkable, StateUpdate mode)
 			streamadd.emplace_back(IcingaToStreamValue(kv.second));
 		}
 
-		m_Rcon->FireAndForgetQuery(std::move(streamadd), Prio::RuntimeStateStream, {0, 1});
+		if (m_StateUpdatesTimer) {
+			std::unique_lock<std::mutex> lock (m_PendingRuntimeStateStreamMutex);
+			m_PendingRuntimeStateStream.emplace_back(std::move(streamadd));
+		} else {
+			m_Rcon->FireAndForgetQuery(std::move(streamadd), Prio::RuntimeStateStream, {0, 1});
+			RecordRuntimeStateStreamBatch(1);
+		}
 	}
 }
 
-// Used to update a single object, used for runtime updates
-void IcingaDB::SendConfigUpdate(const ConfigObject::Ptr& object, bool runtimeUpdate)
+/**
+ * Update the volatile state and the next update of checkable in Redis, within state_coalesce_window
+ *
+ * Multiple calls for the same checkable within that window result in a single write of the then current state.
+ *
+ * @param checkable State of this checkable is updated in Redis
+ * @param cr If not null, recorded as persisted once the state is written
+ */
+void IcingaDB::QueueStateUpdate(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr)
 {
-	if (!m_Rcon || !m_Rcon->IsConnected())
-		return;
+	m_StateUpdatesQueued.fetch_add(1);
 
-	String typeName = GetLowerCaseTypeNameDB(object);
+	if (!m_StateUpdatesTimer) {
+		std::vector<CheckResult::Ptr> crs;
 
-	std::map<String, std::vector<String>> hMSets;
-	std::vector<Dictionary::Ptr> runtimeUpdates;
+		if (cr) {
+			crs.emplace_back(cr);
+		}
 
-	CreateConfigUpdate(object, typeName, hMSets, runtimeUpdates, runtimeUpdate);
-	Checkable::Ptr checkable = dynamic_pointer_cast<Checkable>(object);
-	if (checkable) {
-		UpdateState(checkable, runtimeUpdate ? StateUpdate::Full : StateUpdate::Volatile);
+		WriteStateUpdate(checkable, crs);
+		return;
 	}
 
-	std::vector<std::vector<String> > transaction = {{"MULTI"}};
+	std::unique_lock<std::mutex> lock (m_PendingStateUpdatesMutex);
+	auto& crs (m_PendingStateUpdates[checkable]);
 
-	for (auto& kv : hMSets) {
-		if (!kv.second.empty()) {
-			kv.second.insert(kv.second.begin(), {"HMSET", kv.first});
-			transaction.emplace_back(std::move(kv.second));
-		}
+	if (cr) {
+		crs.emplace_back(cr);
 	}
+}
+
+void IcingaDB::WriteStateUpdate(const Checkable::Ptr& checkable, const std::vector<CheckResult::Ptr>& crs)
+{
+	m_StateUpdatesWritten.fetch_add(1);
 
-	for (auto& objectAttributes : runtimeUpdates) {
-		std::vector<String> xAdd({"XADD", "icinga:runtime", "MAXLEN", "~", "1000000", "*"});
-		ObjectLock olock(objectAttributes);
+	UpdateState(checkable, StateUpdate::Volatile);
+	SendNextUpdate(checkable);
 
-		for (const Dictionary::Pair& kv : objectAttributes) {
-			String value = IcingaToStreamValue(kv.second);
-			if (!value.IsEmpty()) {
-				xAdd.emplace_back(kv.first);
-				xAdd.emplace_back(value);
+	if (!crs.empty() && m_Rcon && m_Rcon->IsConnected()) {
+		/* Runs once the state update queued above has been written to Redis. */
+		m_Rcon->EnqueueCallback([crs](boost::asio::yield_context&) {
+			for (auto& cr : crs) {
+				CheckLatency::RecordPersisted("icingadb", cr);
 			}
+		}, Prio::RuntimeStateSync);
+	}
+}
+
+/**
+ * Write the state updates merged by QueueStateUpdate()
+ *
+ * Every checkable occurs only once per call, so they're written in parallel. The call returns
+ * once all of them have been written, so the updates of the same checkable keep their order.
+ */
+void IcingaDB::FlushStateUpdates()
+{
+	std::vector<std::pair<Checkable::Ptr, std::vector<CheckResult::Ptr>>> pending;
+
+	{
+		std::unique_lock<std::mutex> lock (m_PendingStateUpdatesMutex);
+
+		pending.reserve(m_PendingStateUpdates.size());
+
+		for (auto& kv : m_PendingStateUpdates) {
+			pending.emplace_back(kv.first, std::move(kv.second));
 		}
 
-		transaction.emplace_back(std::move(xAdd));
+		m_PendingStateUpdates.clear();
+	}
+
+	if (pending.size() > 1u) {
+		m_StateUpdatesQueue.ParallelForStealing(pending, [this](decltype(pending)::const_reference update) {
+			WriteStateUpdate(update.first, update.second);
+		});
+
+		m_StateUpdatesQueue.Join();
+	} else {
+		for (auto& update : pending) {
+			WriteStateUpdate(update.first, update.second);
+		}
 	}
 
-	if (transaction.size() > 1) {
-		transaction.push_back({"EXEC"});
-		m_Rcon->FireAndForgetQueries(std::move(transaction), Prio::Config, {1});
+	FlushRuntimeStateStream();
+}
+
+/**
+ * Write the icinga:runtime:state entries buffered by UpdateState() within state_coalesce_window
+ *
+ * Every entry is kept, but all of them are sent as one pipeline in the order they were buffered.
+ */
+void IcingaDB::FlushRuntimeStateStream()
+{
+	std::vector<RedisConnection::Query> pending;
+
+	{
+		std::unique_lock<std::mutex> lock (m_PendingRuntimeStateStreamMutex);
+		std::swap(pending, m_PendingRuntimeStateStream);
 	}
 
-	if (checkable) {
-		SendNextUpdate(checkable);
+	if (pending.empty() || !m_Rcon || !m_Rcon->IsConnected())
+		return;
+
+	auto size (pending.size());
+
+	m_Rcon->FireAndForgetQueries(std::move(pending), Prio::RuntimeStateStream, {0, size});
+	RecordRuntimeStateStreamBatch(size);
+}
+
+void IcingaDB::RecordRuntimeStateStreamBatch(uint_fast64_t size)
+{
+	m_RuntimeStateStreamBatches.fetch_add(1);
+	m_RuntimeStateStreamEntries.fetch_add(size);
+	m_RuntimeStateStreamLastBatch.store(size);
+}
+
+// Used to update a single object, used for runtime updates
+void IcingaDB::SendConfigUpdate(const ConfigObject::Ptr& object, bool runtimeUpdate)
+{
+	SendConfigUpdates({ object }, runtimeUpdate);
+}
+
+/**
+ * Sends the config of the given objects, at most l_ConfigUpdatesBatchSize of them per transaction.
+ */
+void IcingaDB::SendConfigUpdates(const std::vector<ConfigObject::Ptr>& objects, bool runtimeUpdate)
+{
+	if (!m_Rcon || !m_Rcon->IsConnected())
+		return;
+
+	for (decltype(objects.size()) offset = 0; offset < objects.size(); offset += l_ConfigUpdatesBatchSize) {
+		auto end (std::min(objects.size(), offset + l_ConfigUpdatesBatchSize));
+
+		std::map<String, std::vector<String>> hMSets;
+		std::vector<Dictionary::Ptr> runtimeUpdates;
+		std::vector<Checkable::Ptr> checkables;
+
+		for (auto i (offset); i < end; i++) {
+			auto& object (objects[i]);
+
+			CreateConfigUpdate(object, GetLowerCaseTypeNameDB(object), hMSets, runtimeUpdates, runtimeUpdate);
+			Checkable::Ptr checkable = dynamic_pointer_cast<Checkable>(object);
+			if (checkable) {
+				UpdateState(checkable, runtimeUpdate ? StateUpdate::Full : StateUpdate::Volatile);
+				checkables.emplace_back(std::move(checkable));
+			}
+		}
+
+		std::vector<std::vector<String> > transaction = {{"MULTI"}};
+
+		for (auto& kv : hMSets) {
+			if (!kv.second.empty()) {
+				kv.second.insert(kv.second.begin(), {"HMSET", kv.first});
+				transaction.emplace_back(std::move(kv.second));
+			}
+		}
+
+		for (auto& objectAttributes : runtimeUpdates) {
+			std::vector<String> xAdd({"XADD", "icinga:runtime", "MAXLEN", "~", "1000000", "*"});
+			ObjectLock olock(objectAttributes);
+
+			for (const Dictionary::Pair& kv : objectAttributes) {
+				String value = IcingaToStreamValue(kv.second);
+				if (!value.IsEmpty()) {
+					xAdd.emplace_back(kv.first);
+					xAdd.emplace_back(value);
+				}
+			}
+
+			transaction.emplace_back(std::move(xAdd));
+		}
+
+		if (transaction.size() > 1) {
+			transaction.push_back({"EXEC"});
+			m_Rcon->FireAndForgetQueries(std::move(transaction), Prio::Config, {end - offset});
+		}
+
+		for (auto& checkable : checkables) {
+			SendNextUpdate(checkable);
+		}
 	}
 }
 
@@ -2369,10 +2770,27 @@ void IcingaDB::ForwardHistoryEntries()
 		}
 	});
 
+	const auto spillThreshold (GetHistorySpillThreshold());
+
+	// Bulks taken from RAM to be spilled, but which couldn't be written to disk
+	std::deque<std::vector<RedisConnection::Query>> unspillable;
+
 	for (;;) {
 		logPeriodically();
 
-		auto haystack (m_HistoryBulker.ConsumeMany());
+		std::vector<RedisConnection::Query> haystack;
+
+		// Where to continue reading the spill file once haystack (taken from there) has been written to Redis
+		std::streamoff spillNext = -1;
+
+		if (!UnspillHistory(haystack, spillNext)) {
+			if (unspillable.empty()) {
+				haystack = m_HistoryBulker.ConsumeMany();
+			} else {
+				haystack = std::move(unspillable.front());
+				unspillable.pop_front();
+			}
+		}
 
 		if (haystack.empty()) {
 			if (!GetActive()) {
@@ -2394,6 +2812,38 @@ void IcingaDB::ForwardHistoryEntries()
 			}
 		});
 
+		/* Moves pending bulks to disk. If haystack isn't from there, it goes first to preserve the order
+		 * and is from then on treated as if it was read from the spill file.
+		 */
+		auto spill ([this, &haystack, &spillNext, &unspillable](size_t keep) {
+			uintmax_t spilled = 0;
+
+			if (spillNext < 0 && !m_HistorySpillPending) {
+				if (!SpillHistory(haystack, spillNext)) {
+					return;
+				}
+
+				spilled += haystack.size();
+			}
+
+			while (m_HistoryBulker.Size() > keep && (!keep || m_HistoryBulker.Size() >= m_HistoryBulker.GetBulkSize())) {
+				auto bulk (m_HistoryBulker.ConsumeMany());
+				std::streamoff end;
+
+				if (!SpillHistory(bulk, end)) {
+					unspillable.emplace_back(std::move(bulk));
+					break;
+				}
+
+				spilled += bulk.size();
+			}
+
+			if (spilled) {
+				Log(LogInformation, "IcingaDB")
+					<< "history: Spilled " << spilled << " queries to '" << m_HistorySpillPath << "'.";
+			}
+		});
+
 		for (;;) {
 			logPeriodically();
 
@@ -2411,18 +2861,152 @@ void IcingaDB::ForwardHistoryEntries()
 			}
 
 			if (!GetActive()) {
-				Log(LogCritical, "IcingaDB") << "history: " << haystack.size() << " queries failed (attempt #" << attempts
-					<< ") while we're about to shut down. Giving up and discarding additional "
-					<< m_HistoryBulker.Size() << " queued history queries.";
+				if (spillThreshold > 0 && !m_HistorySpillBroken) {
+					// Nothing's lost if we can replay everything on the next start.
+					spill(0);
+				}
+
+				if (spillNext < 0 || m_HistoryBulker.Size() || !unspillable.empty()) {
+					size_t discarded = m_HistoryBulker.Size();
+
+					for (auto& bulk : unspillable) {
+						discarded += bulk.size();
+					}
+
+					Log(LogCritical, "IcingaDB") << "history: " << haystack.size() << " queries failed (attempt #" << attempts
+						<< ") while we're about to shut down. Giving up and discarding additional "
+						<< discarded << " queued history queries.";
+				} else {
+					Log(LogInformation, "IcingaDB")
+						<< "history: Pending queries will be replayed from '" << m_HistorySpillPath << "' on the next start.";
+				}
 
 				return;
 			}
 
+			if (spillThreshold > 0 && !m_HistorySpillBroken && m_HistoryBulker.Size() > (size_t)spillThreshold) {
+				spill(spillThreshold);
+			}
+
 			Utility::Sleep(2);
 		}
+
+		if (spillNext >= 0) {
+			m_HistorySpillReadPos = spillNext;
+		}
 	}
 }
 
+/**
+ * Appends a bulk of history queries to the spill file.
+ *
+ * @param bulk The queries
+ * @param end Set to the file offset right after them
+ *
+ * @return Whether they have been written. If not, spilling is disabled.
+ */
+bool IcingaDB::SpillHistory(const std::vector<RedisConnection::Query>& bulk, std::streamoff& end)
+{
+	ArrayData queries;
+	queries.reserve(bulk.size());
+
+	for (auto& query : bulk) {
+		queries.emplace_back(Array::FromVector(query));
+	}
+
+	std::ofstream fp (m_HistorySpillPath.CStr(), std::ofstream::out | std::ofstream::app | std::ofstream::binary);
+	fp << JsonEncode(new Array(std::move(queries))) << '\n';
+	fp.flush();
+	end = fp.tellp();
+
+	if (!fp || end < 0) {
+		Log(LogCritical, "IcingaDB")
+			<< "history: Can't spill queries to '" << m_HistorySpillPath << "': " << Utility::FormatErrorNumber(errno)
+			<< ". Keeping them in memory.";
+
+		m_HistorySpillBroken = true;
+		return false;
+	}
+
+	m_HistorySpillPending = true;
+	m_HistorySpilledQueries += bulk.size();
+
+	return true;
+}
+
+/**
+ * Reads the next bulk of history queries not yet replayed from the spill file
+ * and removes the file once everything has been replayed.
+ *
+ * @param bulk Set to the queries
+ * @param next Set to the file offset to continue from once they've been written to Redis
+ *
+ * @return Whether there was such a bulk
+ */
+bool IcingaDB::UnspillHistory(std::vector<RedisConnection::Query>& bulk, std::streamoff& next)
+{
+	while (m_HistorySpillPending) {
+		std::ifstream fp (m_HistorySpillPath.CStr(), std::ifstream::in | std::ifstream::binary);
+		std::string line;
+
+		fp.seekg(m_HistorySpillReadPos);
+
+		// An incomplete last line is what's left of a crash while spilling.
+		if (!std::getline(fp, line) || fp.eof()) {
+			fp.close();
+
+			try {
+				Utility::Remove(m_HistorySpillPath);
+			} catch (const std::exception& ex) {
+				Log(LogWarning, "IcingaDB")
+					<< "history: Can't remove replayed '" << m_HistorySpillPath << "', truncating it: " << DiagnosticInformation(ex, false);
+
+				// The next spill has to start at offset 0.
+				std::ofstream truncate (m_HistorySpillPath.CStr(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+			}
+
+			m_HistorySpillPending = false;
+			m_HistorySpillReadPos = 0;
+			break;
+		}
+
+		next = fp.tellg();
+		bulk.clear();
+
+		try {
+			Array::Ptr queries = JsonDecode(line);
+
+			if (!queries) {
+				BOOST_THROW_EXCEPTION(std::invalid_argument("Not an array of queries"));
+			}
+
+			ObjectLock oLock (queries);
+
+			for (Array::Ptr query : queries) {
+				if (!query) {
+					BOOST_THROW_EXCEPTION(std::invalid_argument("Not an array of queries"));
+				}
+
+				ObjectLock qLock (query);
+				bulk.emplace_back(query->Begin(), query->End());
+			}
+		} catch (const std::exception& ex) {
+			Log(LogCritical, "IcingaDB")
+				<< "history: Skipping unreadable bulk in '" << m_HistorySpillPath << "': " << DiagnosticInformation(ex, false);
+
+			bulk.clear();
+		}
+
+		if (!bulk.empty()) {
+			return true;
+		}
+
+		m_HistorySpillReadPos = next;
+	}
+
+	return false;
+}
+
 void IcingaDB::SendNotificationUsersChanged(const Notification::Ptr& notification, const Array::Ptr& oldValues, const Array::Ptr& newValues) {
 	if (!m_Rcon || !m_Rcon->IsConnected() || oldValues == newValues) {
 		return;
@@ -2582,6 +3166,9 @@ Dictionary::Ptr IcingaDB::SerializeState(const Checkable::Ptr& checkable)
 
 	String id = GetObjectIdentifier(checkable);
 
+	/* The state fields below belong together, so they're taken from a consistent snapshot. */
+	auto state (checkable->GetStateSnapshot());
+
 	/*
 	 * As there is a 1:1 relationship between host and host state, the host ID ('host_id')
 	 * is also used as the host state ID ('id'). These are duplicated to 1) avoid having
@@ -2591,31 +3178,29 @@ Dictionary::Ptr IcingaDB::SerializeState(const Checkable::Ptr& checkable)
 	 */
 	attrs->Set("id", id);
 	attrs->Set("environment_id", m_EnvironmentId);
-	attrs->Set("state_type", checkable->HasBeenChecked() ? checkable->GetStateType() : StateTypeHard);
+	attrs->Set("state_type", state->HasBeenChecked() ? state->Type : StateTypeHard);
 
 	// TODO: last_hard/soft_state should be "previous".
 	if (service) {
 		attrs->Set("service_id", id);
-		auto state = service->HasBeenChecked() ? service->GetState() : 99;
-		attrs->Set("soft_state", state);
-		attrs->Set("hard_state", service->HasBeenChecked() ? service->GetLastHardState() : 99);
+		attrs->Set("soft_state", state->HasBeenChecked() ? state->StateRaw : 99);
+		attrs->Set("hard_state", state->HasBeenChecked() ? state->LastHardStateRaw : 99);
 		attrs->Set("severity", service->GetSeverity());
 		attrs->Set("host_id", GetObjectIdentifier(host));
 	} else {
 		attrs->Set("host_id", id);
-		auto state = host->HasBeenChecked() ? host->GetState() : 99;
-		attrs->Set("soft_state", state);
-		attrs->Set("hard_state", host->HasBeenChecked() ? host->GetLastHardState() : 99);
+		attrs->Set("soft_state", state->HasBeenChecked() ? Host::CalculateState(state->StateRaw) : 99);
+		attrs->Set("hard_state", state->HasBeenChecked() ? Host::CalculateState(state->LastHardStateRaw) : 99);
 		attrs->Set("severity", host->GetSeverity());
 	}
 
 	attrs->Set("previous_soft_state", GetPreviousState(checkable, service, StateTypeSoft));
 	attrs->Set("previous_hard_state", GetPreviousState(checkable, service, StateTypeHard));
-	attrs->Set("check_attempt", checkable->GetCheckAttempt());
+	attrs->Set("check_attempt", state->CheckAttempt);
 
-	attrs->Set("is_active", checkable->IsActive());
+	attrs->Set("is_active", state->Active);
 
-	CheckResult::Ptr cr = checkable->GetLastCheckResult();
+	CheckResult::Ptr cr = state->LastCheckResult;
 
 	if (cr) {
 		String rawOutput = cr->GetOutput();
@@ -2632,11 +3217,11 @@ Dictionary::Ptr IcingaDB::SerializeState(const Checkable::Ptr& checkable)
 			}
 		}
 
-		String perfData = PluginUtility::FormatPerfdata(cr->GetPerformanceData());
+		String perfData = cr->GetFormattedPerformanceData();
 		if (!perfData.IsEmpty())
 			attrs->Set("performance_data", perfData);
 
-		String normedPerfData = PluginUtility::FormatPerfdata(cr->GetPerformanceData(), true);
+		String normedPerfData = cr->GetFormattedPerformanceData(true);
 		if (!normedPerfData.IsEmpty())
 			attrs->Set("normalized_performance_data", normedPerfData);
 
@@ -2648,13 +3233,13 @@ Dictionary::Ptr IcingaDB::SerializeState(const Checkable::Ptr& checkable)
 		attrs->Set("scheduling_source", cr->GetSchedulingSource());
 	}
 
-	attrs->Set("is_problem", checkable->GetProblem());
+	attrs->Set("is_problem", state->Problem);
 	attrs->Set("is_handled", checkable->GetHandled());
 	attrs->Set("is_reachable", checkable->IsReachable());
-	attrs->Set("is_flapping", checkable->IsFlapping());
+	attrs->Set("is_flapping", state->IsFlapping());
 
-	attrs->Set("is_acknowledged", checkable->GetAcknowledgement());
-	if (checkable->IsAcknowledged()) {
+	attrs->Set("is_acknowledged", state->IsAcknowledged() ? state->Acknowledgement : AcknowledgementNone);
+	if (state->IsAcknowledged()) {
 		Timestamp entry = 0;
 		Comment::Ptr AckComment;
 		for (const Comment::Ptr& c : checkable->GetComments()) {
@@ -2685,11 +3270,11 @@ Dictionary::Ptr IcingaDB::SerializeState(const Checkable::Ptr& checkable)
 	else
 		attrs->Set("check_timeout", TimestampToMilliseconds(checkable->GetCheckTimeout()));
 
-	long long lastCheck = TimestampToMilliseconds(checkable->GetLastCheck());
+	long long lastCheck = TimestampToMilliseconds(cr ? cr->GetScheduleEnd() : -1);
 	if (lastCheck > 0)
 		attrs->Set("last_update", lastCheck);
 
-	attrs->Set("last_state_change", TimestampToMilliseconds(checkable->GetLastStateChange()));
+	attrs->Set("last_state_change", TimestampToMilliseconds(state->LastStateChange));
 	attrs->Set("next_check", TimestampToMilliseconds(checkable->GetNextCheck()));
 	attrs->Set("next_update", TimestampToMilliseconds(checkable->GetNextUpdate()));
 
@@ -2764,6 +3349,10 @@ void IcingaDB::VersionChangedHandler(const ConfigObject::Ptr& object)
 	}
 
 	if (object->IsActive()) {
+		// Sent with the rest of the batch by BatchActivatedHandler()
+		if (object->GetExtension("ConfigObjectBatch"))
+			return;
+
 		// Create or update the object config
 		for (const IcingaDB::Ptr& rw : ConfigType::GetObjectsByType<IcingaDB>()) {
 			if (rw)
@@ -2779,6 +3368,28 @@ void IcingaDB::VersionChangedHandler(const ConfigObject::Ptr& object)
 	}
 }
 
+/**
+ * Sends the objects of a runtime transaction, e.g. thousands of downtimes, in a few transactions.
+ */
+void IcingaDB::BatchActivatedHandler(const std::vector<ConfigObject::Ptr>& objects)
+{
+	std::vector<ConfigObject::Ptr> indexed;
+	indexed.reserve(objects.size());
+
+	for (auto& object : objects) {
+		if (m_IndexedTypes.find(object->GetReflectionType().get()) != m_IndexedTypes.end() && object->IsActive())
+			indexed.emplace_back(object);
+	}
+
+	if (indexed.empty())
+		return;
+
+	for (const IcingaDB::Ptr& rw : ConfigType::GetObjectsByType<IcingaDB>()) {
+		if (rw)
+			rw->SendConfigUpdates(indexed, true);
+	}
+}
+
 void IcingaDB::DowntimeStartedHandler(const Downtime::Ptr& downtime)
 {
 	for (auto& rw : ConfigType::GetObjectsByType<IcingaDB>()) {
@@ -2831,19 +3442,17 @@ void IcingaDB::FlappingChangeHandler(const Checkable::Ptr& checkable, double cha
 	}
 }
 
-void IcingaDB::NewCheckResultHandler(const Checkable::Ptr& checkable)
+void IcingaDB::NewCheckResultHandler(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr)
 {
 	for (auto& rw : ConfigType::GetObjectsByType<IcingaDB>()) {
-		rw->UpdateState(checkable, StateUpdate::Volatile);
-		rw->SendNextUpdate(checkable);
+		rw->QueueStateUpdate(checkable, cr);
 	}
 }
 
 void IcingaDB::NextCheckUpdatedHandler(const Checkable::Ptr& checkable)
 {
 	for (auto& rw : ConfigType::GetObjectsByType<IcingaDB>()) {
-		rw->UpdateState(checkable, StateUpdate::Volatile);
-		rw->SendNextUpdate(checkable);
+		rw->QueueStateUpdate(checkable, nullptr);
 	}
 }
 
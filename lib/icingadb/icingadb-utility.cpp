@@ -145,7 +145,7 @@ Dictionary::Ptr IcingaDB::SerializeVars(const Dictionary::Ptr& vars)
 
 	for (auto& kv : vars) {
 		res->Set(
-			SHA1(PackObject((Array::Ptr)new Array({m_EnvironmentId, kv.first, kv.second}))),
+			PackObjectSHA1((Array::Ptr)new Array({m_EnvironmentId, kv.first, kv.second})),
 			(Dictionary::Ptr)new Dictionary({
 				{"environment_id", m_EnvironmentId},
 				{"name_checksum", SHA1(kv.first)},
@@ -191,52 +191,21 @@ String IcingaDB::HashValue(const Value& value)
 	return HashValue(value, propertiesBlacklistEmpty);
 }
 
+/**
+ * Calculate SHA1(PackObject(value)) with the properties in propertiesBlacklist removed (or all others if propertiesWhitelist)
+ *
+ * Config objects are hashed as serialized with FAConfig. The packed value is fed into SHA1 piece by piece, so neither
+ * the packed string nor a filtered copy of the value are built.
+ */
 String IcingaDB::HashValue(const Value& value, const std::set<String>& propertiesBlacklist, bool propertiesWhitelist)
 {
-	Value temp;
-	bool mutabl;
-
 	Type::Ptr type = value.GetReflectionType();
 
 	if (ConfigObject::TypeInstance->IsAssignableFrom(type)) {
-		temp = Serialize(value, FAConfig);
-		mutabl = true;
-	} else {
-		temp = value;
-		mutabl = false;
-	}
-
-	if (propertiesBlacklist.size() && temp.IsObject()) {
-		Dictionary::Ptr dict = dynamic_pointer_cast<Dictionary>((Object::Ptr)temp);
-
-		if (dict) {
-			if (!mutabl)
-				dict = dict->ShallowClone();
-
-			ObjectLock olock(dict);
-
-			if (propertiesWhitelist) {
-				auto current = dict->Begin();
-				auto propertiesBlacklistEnd = propertiesBlacklist.end();
-
-				while (current != dict->End()) {
-					if (propertiesBlacklist.find(current->first) == propertiesBlacklistEnd) {
-						dict->Remove(current++);
-					} else {
-						++current;
-					}
-				}
-			} else {
-				for (auto& property : propertiesBlacklist)
-					dict->Remove(property);
-			}
-
-			if (!mutabl)
-				temp = dict;
-		}
+		return PackObjectSHA1(Serialize(value, FAConfig), propertiesBlacklist, propertiesWhitelist);
 	}
 
-	return SHA1(PackObject(temp));
+	return PackObjectSHA1(value, propertiesBlacklist, propertiesWhitelist);
 }
 
 String IcingaDB::GetLowerCaseTypeNameDB(const ConfigObject::Ptr& obj)
@@ -5,6 +5,7 @@
 #include "icingadb/redisconnection.hpp"
 #include "remote/apilistener.hpp"
 #include "remote/eventqueue.hpp"
+#include "base/configtype.hpp"
 #include "base/configuration.hpp"
 #include "base/json.hpp"
 #include "base/perfdatavalue.hpp"
@@ -29,6 +30,9 @@ std::mutex IcingaDB::m_EnvironmentIdInitMutex;
 
 REGISTER_TYPE(IcingaDB);
 
+REGISTER_STATSFUNCTION(IcingaDB, &IcingaDB::StatsFunc);
+REGISTER_MEMORY_USAGE_REPORTER("icingadb", &IcingaDB::MemoryUsageReporter);
+
 IcingaDB::IcingaDB()
 	: m_Rcon(nullptr)
 {
@@ -40,6 +44,88 @@ IcingaDB::IcingaDB()
 	m_PrefixConfigCheckSum = "icinga:checksum:";
 }
 
+static Dictionary::Ptr SerializeHistogram(const Histogram& histogram)
+{
+	auto count (histogram.GetCount());
+
+	return new Dictionary({
+		{ "count", static_cast<double>(count) },
+		{ "avg", count ? histogram.GetSum() / count : 0 },
+		{ "p50", histogram.GetPercentile(50) },
+		{ "p99", histogram.GetPercentile(99) },
+		{ "p999", histogram.GetPercentile(99.9) },
+		{ "max", histogram.GetMax() }
+	});
+}
+
+/**
+ * Reports the history queries waiting for the next bulk and the queries not yet sent to Redis.
+ */
+void IcingaDB::MemoryUsageReporter(std::vector<MemoryUsageEntry>& entries)
+{
+	for (const IcingaDB::Ptr& icingadb : ConfigType::GetObjectsByType<IcingaDB>()) {
+		uint_fast64_t history = icingadb->m_HistoryBulker.Size();
+		entries.push_back({ icingadb->GetName() + " history", history, history * sizeof(RedisConnection::Query) });
+
+		auto rcon (icingadb->GetConnection());
+
+		if (rcon) {
+			uint_fast64_t pending = rcon->GetPendingQueryCount();
+			entries.push_back({ icingadb->GetName() + " pending", pending, pending * sizeof(RedisConnection::Query) });
+		}
+	}
+}
+
+void IcingaDB::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr&)
+{
+	DictionaryData nodes;
+
+	for (const IcingaDB::Ptr& icingadb : ConfigType::GetObjectsByType<IcingaDB>()) {
+		Dictionary::Ptr lastDumpTypes;
+
+		{
+			std::unique_lock<std::mutex> lock (icingadb->m_LastDumpTypesMutex);
+			lastDumpTypes = icingadb->m_LastDumpTypes;
+		}
+
+		if (!lastDumpTypes) {
+			lastDumpTypes = new Dictionary();
+		}
+
+		auto rcon (icingadb->GetConnection());
+		Dictionary::Ptr queryLatencies = new Dictionary();
+
+		if (rcon) {
+			for (auto prio (0u); prio <= (unsigned)RedisConnection::QueryPriority::CheckResult; ++prio) {
+				auto priority ((RedisConnection::QueryPriority)prio);
+				auto latencies (rcon->GetQueryLatencies(priority));
+
+				queryLatencies->Set(RedisConnection::GetQueryPriorityName(priority), new Dictionary({
+					{ "queued", SerializeHistogram(latencies->Queued) },
+					{ "reply", SerializeHistogram(latencies->Reply) },
+					{ "serialise", SerializeHistogram(latencies->Serialise) }
+				}));
+			}
+		}
+
+		nodes.emplace_back(icingadb->GetName(), new Dictionary({
+			{ "connected", rcon && rcon->IsConnected() },
+			{ "dump_connections", icingadb->GetDumpConnections() },
+			{ "last_dump_types", lastDumpTypes },
+			{ "query_latencies", queryLatencies },
+			{ "runtime_state_stream", new Dictionary({
+				{ "batches", static_cast<double>(icingadb->m_RuntimeStateStreamBatches.load()) },
+				{ "entries", static_cast<double>(icingadb->m_RuntimeStateStreamEntries.load()) },
+				{ "last_batch_size", static_cast<double>(icingadb->m_RuntimeStateStreamLastBatch.load()) },
+				{ "avg_batch_size", icingadb->GetRuntimeStateStreamBatchSize() }
+			}) },
+			{ "prepared_states_reused", static_cast<double>(icingadb->m_PreparedStatesReused.load()) }
+		}));
+	}
+
+	status->Set("icingadb", new Dictionary(std::move(nodes)));
+}
+
 void IcingaDB::Validate(int types, const ValidationUtils& utils)
 {
 	ObjectImpl<IcingaDB>::Validate(types, utils);
@@ -76,17 +162,14 @@ void IcingaDB::Start(bool runtimeCreated)
 	m_ConfigDumpDone = false;
 
 	m_WorkQueue.SetExceptionCallback([this](boost::exception_ptr exp) { ExceptionHandler(std::move(exp)); });
+	m_StateUpdatesQueue.SetExceptionCallback([this](boost::exception_ptr exp) { ExceptionHandler(std::move(exp)); });
 
 	m_Rcon = new RedisConnection(GetHost(), GetPort(), GetPath(), GetPassword(), GetDbIndex(),
 		GetEnableTls(), GetInsecureNoverify(), GetCertPath(), GetKeyPath(), GetCaPath(), GetCrlPath(),
 		GetTlsProtocolmin(), GetCipherList(), GetConnectTimeout(), GetDebugInfo());
 	m_RconLocked.store(m_Rcon);
 
-	for (const Type::Ptr& type : GetTypes()) {
-		auto ctype (dynamic_cast<ConfigType*>(type.get()));
-		if (!ctype)
-			continue;
-
+	auto newChildRcon ([this]() {
 		RedisConnection::Ptr con = new RedisConnection(GetHost(), GetPort(), GetPath(), GetPassword(), GetDbIndex(),
 			GetEnableTls(), GetInsecureNoverify(), GetCertPath(), GetKeyPath(), GetCaPath(), GetCrlPath(),
 			GetTlsProtocolmin(), GetCipherList(), GetConnectTimeout(), GetDebugInfo(), m_Rcon);
@@ -101,10 +184,24 @@ void IcingaDB::Start(bool runtimeCreated)
 			}
 		});
 
-		m_Rcons[ctype] = std::move(con);
+		return con;
+	});
+
+	for (const Type::Ptr& type : GetTypes()) {
+		auto ctype (dynamic_cast<ConfigType*>(type.get()));
+		if (!ctype)
+			continue;
+
+		m_Rcons[ctype] = newChildRcon();
+	}
+
+	m_DumpRcons.clear();
+
+	for (auto i (GetDumpConnections()); i > 0; --i) {
+		m_DumpRcons.emplace_back(newChildRcon());
 	}
 
-	m_PendingRcons = m_Rcons.size();
+	m_PendingRcons = m_Rcons.size() + m_DumpRcons.size();
 
 	m_Rcon->SetConnectedCallback([this](boost::asio::yield_context& yc) {
 		m_Rcon->SetConnectedCallback(nullptr);
@@ -112,6 +209,10 @@ void IcingaDB::Start(bool runtimeCreated)
 		for (auto& kv : m_Rcons) {
 			kv.second->Start();
 		}
+
+		for (auto& con : m_DumpRcons) {
+			con->Start();
+		}
 	});
 	m_Rcon->Start();
 
@@ -120,11 +221,29 @@ void IcingaDB::Start(bool runtimeCreated)
 	m_StatsTimer->OnTimerExpired.connect([this](const Timer * const&) { PublishStatsTimerHandler(); });
 	m_StatsTimer->Start();
 
+	if (GetStateCoalesceWindow() > 0) {
+		m_StateUpdatesTimer = Timer::Create();
+		m_StateUpdatesTimer->SetInterval(GetStateCoalesceWindow());
+		m_StateUpdatesTimer->OnTimerExpired.connect([this](const Timer * const&) { FlushStateUpdates(); });
+		m_StateUpdatesTimer->Start();
+	}
+
 	m_WorkQueue.SetName("IcingaDB");
+	m_StateUpdatesQueue.SetName("IcingaDB, " + GetName() + ", state updates");
 
 	m_Rcon->SuppressQueryKind(Prio::CheckResult);
 	m_Rcon->SuppressQueryKind(Prio::RuntimeStateSync);
 
+	m_HistorySpillPath = Configuration::DataDir + "/icingadb-" + GetName() + "-history.spill";
+	m_HistorySpillPending = Utility::PathExists(m_HistorySpillPath);
+	m_HistorySpillBroken = false;
+	m_HistorySpillReadPos = 0;
+
+	if (m_HistorySpillPending) {
+		Log(LogInformation, "IcingaDB")
+			<< "Replaying history spilled to '" << m_HistorySpillPath << "' before the current one.";
+	}
+
 	Ptr keepAlive (this);
 
 	m_HistoryThread = std::async(std::launch::async, [this, keepAlive]() { ForwardHistoryEntries(); });
@@ -158,6 +277,7 @@ void IcingaDB::OnConnectedHandler()
 
 void IcingaDB::PublishStatsTimerHandler(void)
 {
+	RotatePreparedStates();
 	PublishStats();
 }
 
@@ -197,6 +317,11 @@ void IcingaDB::Stop(bool runtimeRemoved)
 
 	m_StatsTimer->Stop(true);
 
+	if (m_StateUpdatesTimer) {
+		m_StateUpdatesTimer->Stop(true);
+		FlushStateUpdates();
+	}
+
 	Log(LogInformation, "IcingaDB")
 		<< "'" << GetName() << "' stopped.";
 
@@ -223,6 +348,65 @@ void IcingaDB::ValidateConnectTimeout(const Lazy<double>& lvalue, const Validati
 	}
 }
 
+void IcingaDB::ValidateStateCoalesceWindow(const Lazy<double>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<IcingaDB>::ValidateStateCoalesceWindow(lvalue, utils);
+
+	if (lvalue() < 0) {
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "state_coalesce_window" }, "Value must not be negative."));
+	}
+}
+
+void IcingaDB::ValidateHistorySpillThreshold(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<IcingaDB>::ValidateHistorySpillThreshold(lvalue, utils);
+
+	if (lvalue() < 0) {
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "history_spill_threshold" }, "Value must not be negative."));
+	}
+}
+
+void IcingaDB::ValidateDumpConnections(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<IcingaDB>::ValidateDumpConnections(lvalue, utils);
+
+	if (lvalue() < 0) {
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "dump_connections" }, "Value must not be negative."));
+	}
+}
+
+/**
+ * Share of the queued volatile state updates which didn't need a write of their own
+ *
+ * @return 0 (nothing merged) up to almost 1
+ */
+double IcingaDB::GetStateUpdatesMergeRatio() const
+{
+	auto queued (m_StateUpdatesQueued.load());
+
+	return queued ? 1.0 - (double)m_StateUpdatesWritten.load() / queued : 0;
+}
+
+/**
+ * Average number of icinga:runtime:state entries written per pipeline
+ *
+ * @return 0 (nothing written yet), 1 (no batching) or more
+ */
+double IcingaDB::GetRuntimeStateStreamBatchSize() const
+{
+	auto batches (m_RuntimeStateStreamBatches.load());
+
+	return batches ? (double)m_RuntimeStateStreamEntries.load() / batches : 0;
+}
+
+/**
+ * History queries written to the spill file since start
+ */
+uint_fast64_t IcingaDB::GetHistorySpilledQueries() const
+{
+	return m_HistorySpilledQueries.load();
+}
+
 void IcingaDB::AssertOnWorkQueue()
 {
 	ASSERT(m_WorkQueue.IsWorkerThread());
@@ -7,6 +7,8 @@
 #include "icingadb/redisconnection.hpp"
 #include "base/atomic.hpp"
 #include "base/bulker.hpp"
+#include "base/memoryusage.hpp"
+#include "base/shared.hpp"
 #include "base/timer.hpp"
 #include "base/workqueue.hpp"
 #include "icinga/customvarobject.hpp"
@@ -17,12 +19,15 @@
 #include <atomic>
 #include <chrono>
 #include <future>
+#include <ios>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
+#include <vector>
 
 namespace icinga
 {
@@ -39,6 +44,8 @@ public:
 	IcingaDB();
 
 	static void ConfigStaticInitialize();
+	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+	static void MemoryUsageReporter(std::vector<MemoryUsageEntry>& entries);
 
 	void Validate(int types, const ValidationUtils& utils) override;
 	virtual void Start(bool runtimeCreated) override;
@@ -51,6 +58,10 @@ public:
 		return m_RconLocked.load();
 	}
 
+	double GetStateUpdatesMergeRatio() const;
+	double GetRuntimeStateStreamBatchSize() const;
+	uint_fast64_t GetHistorySpilledQueries() const;
+
 	template<class T>
 	static void AddKvsToMap(const Array::Ptr& kvs, T& map)
 	{
@@ -70,8 +81,14 @@ public:
 protected:
 	void ValidateTlsProtocolmin(const Lazy<String>& lvalue, const ValidationUtils& utils) override;
 	void ValidateConnectTimeout(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
+	void ValidateStateCoalesceWindow(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
+	void ValidateHistorySpillThreshold(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
+	void ValidateDumpConnections(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
 
 private:
+	/* Measures the state serialization, see test/microbench-icingadb.cpp. */
+	friend class IcingaDBMicrobench;
+
 	class DumpedGlobals
 	{
 	public:
@@ -90,6 +107,15 @@ private:
 		Full        = Volatile | RuntimeOnly,
 	};
 
+	/* The state of a checkable as serialized by SerializeState() and what's derived from it, see GetPreparedState(). */
+	struct PreparedState
+	{
+		Checkable::Ptr Owner;
+		Dictionary::Ptr Attrs;
+		String Checksum;
+		String Json;
+	};
+
 	void OnConnectedHandler();
 
 	void PublishStatsTimerHandler();
@@ -99,12 +125,23 @@ private:
 	void UpdateAllConfigObjects();
 	std::vector<std::vector<intrusive_ptr<ConfigObject>>> ChunkObjects(std::vector<intrusive_ptr<ConfigObject>> objects, size_t chunkSize);
 	void DeleteKeys(const RedisConnection::Ptr& conn, const std::vector<String>& keys, RedisConnection::QueryPriority priority);
+	static void ScanHash(const RedisConnection::Ptr& conn, const String& key, std::map<String, String>& fields);
+	static void UpdateHash(const RedisConnection::Ptr& conn, const String& key,
+			const std::map<String, String>& ours, const std::map<String, String>& theirs);
 	std::vector<String> GetTypeOverwriteKeys(const String& type);
 	std::vector<String> GetTypeDumpSignalKeys(const Type::Ptr& type);
 	void InsertObjectDependencies(const ConfigObject::Ptr& object, const String typeName, std::map<String, std::vector<String>>& hMSets,
 			std::vector<Dictionary::Ptr>& runtimeUpdates, bool runtimeUpdate);
+	Shared<PreparedState>::Ptr GetPreparedState(const Checkable::Ptr& checkable);
+	void RotatePreparedStates();
 	void UpdateState(const Checkable::Ptr& checkable, StateUpdate mode);
+	void QueueStateUpdate(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
+	void WriteStateUpdate(const Checkable::Ptr& checkable, const std::vector<CheckResult::Ptr>& crs);
+	void FlushStateUpdates();
+	void FlushRuntimeStateStream();
+	void RecordRuntimeStateStreamBatch(uint_fast64_t size);
 	void SendConfigUpdate(const ConfigObject::Ptr& object, bool runtimeUpdate);
+	void SendConfigUpdates(const std::vector<ConfigObject::Ptr>& objects, bool runtimeUpdate);
 	void CreateConfigUpdate(const ConfigObject::Ptr& object, const String type, std::map<String, std::vector<String>>& hMSets,
 			std::vector<Dictionary::Ptr>& runtimeUpdates, bool runtimeUpdate);
 	void SendConfigDelete(const ConfigObject::Ptr& object);
@@ -138,6 +175,8 @@ private:
 	void SendCustomVarsChanged(const ConfigObject::Ptr& object, const Dictionary::Ptr& oldValues, const Dictionary::Ptr& newValues);
 
 	void ForwardHistoryEntries();
+	bool SpillHistory(const std::vector<RedisConnection::Query>& bulk, std::streamoff& end);
+	bool UnspillHistory(std::vector<RedisConnection::Query>& bulk, std::streamoff& next);
 
 	std::vector<String> UpdateObjectAttrs(const ConfigObject::Ptr& object, int fieldType, const String& typeNameOverride);
 	Dictionary::Ptr SerializeState(const Checkable::Ptr& checkable);
@@ -167,6 +206,7 @@ private:
 	static void ReachabilityChangeHandler(const std::set<Checkable::Ptr>& children);
 	static void StateChangeHandler(const ConfigObject::Ptr& object, const CheckResult::Ptr& cr, StateType type);
 	static void VersionChangedHandler(const ConfigObject::Ptr& object);
+	static void BatchActivatedHandler(const std::vector<ConfigObject::Ptr>& objects);
 	static void DowntimeStartedHandler(const Downtime::Ptr& downtime);
 	static void DowntimeRemovedHandler(const Downtime::Ptr& downtime);
 
@@ -178,7 +218,7 @@ private:
 	static void CommentAddedHandler(const Comment::Ptr& comment);
 	static void CommentRemovedHandler(const Comment::Ptr& comment);
 	static void FlappingChangeHandler(const Checkable::Ptr& checkable, double changeTime);
-	static void NewCheckResultHandler(const Checkable::Ptr& checkable);
+	static void NewCheckResultHandler(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
 	static void NextCheckUpdatedHandler(const Checkable::Ptr& checkable);
 	static void HostProblemChangedHandler(const Service::Ptr& service);
 	static void AcknowledgementSetHandler(const Checkable::Ptr& checkable, const String& author, const String& comment, AcknowledgementType type, bool persistent, double changeTime, double expiry);
@@ -205,23 +245,58 @@ private:
 	static void PersistEnvironmentId();
 
 	Timer::Ptr m_StatsTimer;
-	WorkQueue m_WorkQueue{0, 1, LogNotice};
+	WorkQueue m_WorkQueue{0, 1, LogNotice, true};
+
+	// Checkables with a pending volatile state update and the check results to record as persisted once it's written
+	Timer::Ptr m_StateUpdatesTimer;
+	std::mutex m_PendingStateUpdatesMutex;
+	std::map<Checkable::Ptr, std::vector<CheckResult::Ptr>> m_PendingStateUpdates;
+	std::atomic<uint_fast64_t> m_StateUpdatesQueued{0};
+	std::atomic<uint_fast64_t> m_StateUpdatesWritten{0};
+	WorkQueue m_StateUpdatesQueue{0, 4, LogNotice};
+
+	// States serialized by GetPreparedState() within the last one to two seconds, by checkable
+	std::mutex m_PreparedStatesMutex;
+	std::unordered_map<Checkable*, Shared<PreparedState>::Ptr> m_PreparedStates;
+	std::unordered_map<Checkable*, Shared<PreparedState>::Ptr> m_PreviousPreparedStates;
+	std::atomic<uint_fast64_t> m_PreparedStatesReused{0};
+
+	// icinga:runtime:state entries written as one pipeline per state_coalesce_window
+	std::mutex m_PendingRuntimeStateStreamMutex;
+	std::vector<RedisConnection::Query> m_PendingRuntimeStateStream;
+	std::atomic<uint_fast64_t> m_RuntimeStateStreamBatches{0};
+	std::atomic<uint_fast64_t> m_RuntimeStateStreamEntries{0};
+	std::atomic<uint_fast64_t> m_RuntimeStateStreamLastBatch{0};
 
 	std::future<void> m_HistoryThread;
 	Bulker<RedisConnection::Query> m_HistoryBulker {4096, std::chrono::milliseconds(250)};
 
+	// Append-only file of history bulks which didn't fit into RAM while Redis was unreachable,
+	// one JSON line per bulk. Only touched by the history thread.
+	String m_HistorySpillPath;
+	bool m_HistorySpillPending = false;
+	bool m_HistorySpillBroken = false;
+	std::streamoff m_HistorySpillReadPos = 0;
+	std::atomic<uint_fast64_t> m_HistorySpilledQueries{0};
+
 	String m_PrefixConfigObject;
 	String m_PrefixConfigCheckSum;
 
 	bool m_ConfigDumpInProgress;
 	bool m_ConfigDumpDone;
 
+	// Per type throughput of the last config dump
+	std::mutex m_LastDumpTypesMutex;
+	Dictionary::Ptr m_LastDumpTypes;
+
 	RedisConnection::Ptr m_Rcon;
 	// m_RconLocked containes a copy of the value in m_Rcon where all accesses are guarded by a mutex to allow safe
 	// concurrent access like from the icingadb check command. It's a copy to still allow fast access without additional
 	// syncronization to m_Rcon within the IcingaDB feature itself.
 	Locked<RedisConnection::Ptr> m_RconLocked;
 	std::unordered_map<ConfigType*, RedisConnection::Ptr> m_Rcons;
+	// Shared by the types large enough to be dumped across several connections
+	std::vector<RedisConnection::Ptr> m_DumpRcons;
 	std::atomic_size_t m_PendingRcons;
 
 	struct {
@@ -372,8 +372,13 @@ void IcingadbCheckTask::ScriptFunc(const Checkable::Ptr& checkable, const CheckR
 
 	if (dumpTook) {
 		perfdata->Add(new PerfdataValue("icinga2_last_full_dump_duration", dumpTook, false, "seconds", Empty, Empty, 0));
+		perfdata->Add(new PerfdataValue("icinga2_last_full_dump_unchanged_objects", conn->GetLastdumpUnchanged(), false, "", Empty, Empty, 0));
 	}
 
+	perfdata->Add(new PerfdataValue("icinga2_state_updates_merge_ratio", conn->GetStateUpdatesMergeRatio(), false, "", Empty, Empty, 0, 1));
+	perfdata->Add(new PerfdataValue("icinga2_runtime_state_stream_batch_size", conn->GetRuntimeStateStreamBatchSize(), false, "", Empty, Empty, 0));
+	perfdata->Add(new PerfdataValue("icinga2_history_spilled_queries", conn->GetHistorySpilledQueries(), true));
+
 	if (dumpWhen && dumpTook) {
 		i2okmsgs << "\n* Last full dump: " << Utility::FormatDuration(dumpAgo)
 			<< " ago, took " << Utility::FormatDuration(dumpTook);
@@ -460,6 +465,29 @@ void IcingadbCheckTask::ScriptFunc(const Checkable::Ptr& checkable, const CheckR
 	perfdata->Add(new PerfdataValue("icinga2_redis_queries_15mins", redis->GetQueryCount(15 * 60), false, "", Empty, Empty, 0));
 
 	perfdata->Add(new PerfdataValue("icinga2_redis_pending_queries", redis->GetPendingQueryCount(), false, "", Empty, Empty, 0));
+	perfdata->Add(new PerfdataValue("icinga2_redis_pipeline_depth", redis->GetPipelineDepth(), false, "", Empty, Empty, 0));
+	perfdata->Add(new PerfdataValue("icinga2_redis_in_flight_queries", redis->GetInFlightQueries(), false, "", Empty, Empty, 0));
+	perfdata->Add(new PerfdataValue("icinga2_redis_bytes_per_write", redis->GetBytesPerWrite(), false, "bytes", Empty, Empty, 0));
+
+	for (auto prio (0u); prio <= (unsigned)RedisConnection::QueryPriority::CheckResult; ++prio) {
+		auto priority ((RedisConnection::QueryPriority)prio);
+		auto latencies (redis->GetQueryLatencies(priority));
+		String prefix = String("icinga2_redis_") + RedisConnection::GetQueryPriorityName(priority) + "_";
+
+		struct {
+			const char * Name;
+			const Histogram& Latencies;
+		} const stages[] = {
+			{"queued", latencies->Queued},
+			{"reply", latencies->Reply},
+			{"serialise", latencies->Serialise}
+		};
+
+		for (auto& stage : stages) {
+			perfdata->Add(new PerfdataValue(prefix + stage.Name + "_p50", stage.Latencies.GetPercentile(50), false, "seconds", Empty, Empty, 0));
+			perfdata->Add(new PerfdataValue(prefix + stage.Name + "_p99", stage.Latencies.GetPercentile(99), false, "seconds", Empty, Empty, 0));
+		}
+	}
 
 	struct {
 		const char * Name;
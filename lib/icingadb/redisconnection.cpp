@@ -17,6 +17,7 @@
 #include <boost/date_time/posix_time/posix_time_duration.hpp>
 #include <boost/utility/string_view.hpp>
 #include <boost/variant/get.hpp>
+#include <algorithm>
 #include <exception>
 #include <future>
 #include <iterator>
@@ -45,11 +46,15 @@ RedisConnection::RedisConnection(boost::asio::io_context& io, String host, int p
 	  m_DbIndex(db), m_CertPath(std::move(certPath)), m_KeyPath(std::move(keyPath)), m_Insecure(insecure),
 	  m_CaPath(std::move(caPath)), m_CrlPath(std::move(crlPath)), m_TlsProtocolmin(std::move(tlsProtocolmin)),
 	  m_CipherList(std::move(cipherList)), m_ConnectTimeout(connectTimeout), m_DebugInfo(std::move(di)), m_Connecting(false), m_Connected(false),
-	  m_Started(false), m_Strand(io), m_QueuedWrites(io), m_QueuedReads(io), m_LogStatsTimer(io), m_Parent(parent)
+	  m_Started(false), m_Strand(io), m_QueuedWrites(io), m_QueuedReads(io), m_PipelineDepth(1024), m_RepliesReceived(io), m_LogStatsTimer(io), m_Parent(parent)
 {
 	if (useTls && m_Path.IsEmpty()) {
 		UpdateTLSContext();
 	}
+
+	if (!m_Parent) {
+		m_Latencies.reset(new QueryLatenciesByPriority());
+	}
 }
 
 void RedisConnection::UpdateTLSContext()
@@ -124,7 +129,7 @@ void RedisConnection::FireAndForgetQuery(RedisConnection::Query query, RedisConn
 	auto ctime (Utility::GetTime());
 
 	asio::post(m_Strand, [this, item, priority, ctime, affects]() {
-		m_Queues.Writes[priority].emplace(WriteQueueItem{item, nullptr, nullptr, nullptr, nullptr, ctime, affects});
+		m_Queues.Writes[priority].emplace(WriteQueueItem{item, nullptr, nullptr, nullptr, nullptr, nullptr, ctime, affects});
 		m_QueuedWrites.Set();
 		IncreasePendingQueries(1);
 	});
@@ -149,7 +154,7 @@ void RedisConnection::FireAndForgetQueries(RedisConnection::Queries queries, Red
 	auto ctime (Utility::GetTime());
 
 	asio::post(m_Strand, [this, item, priority, ctime, affects]() {
-		m_Queues.Writes[priority].emplace(WriteQueueItem{nullptr, item, nullptr, nullptr, nullptr, ctime, affects});
+		m_Queues.Writes[priority].emplace(WriteQueueItem{nullptr, item, nullptr, nullptr, nullptr, nullptr, ctime, affects});
 		m_QueuedWrites.Set();
 		IncreasePendingQueries(item->size());
 	});
@@ -176,7 +181,7 @@ RedisConnection::Reply RedisConnection::GetResultOfQuery(RedisConnection::Query
 	auto ctime (Utility::GetTime());
 
 	asio::post(m_Strand, [this, item, priority, ctime, affects]() {
-		m_Queues.Writes[priority].emplace(WriteQueueItem{nullptr, nullptr, item, nullptr, nullptr, ctime, affects});
+		m_Queues.Writes[priority].emplace(WriteQueueItem{nullptr, nullptr, item, nullptr, nullptr, nullptr, ctime, affects});
 		m_QueuedWrites.Set();
 		IncreasePendingQueries(1);
 	});
@@ -209,7 +214,7 @@ RedisConnection::Replies RedisConnection::GetResultsOfQueries(RedisConnection::Q
 	auto ctime (Utility::GetTime());
 
 	asio::post(m_Strand, [this, item, priority, ctime, affects]() {
-		m_Queues.Writes[priority].emplace(WriteQueueItem{nullptr, nullptr, nullptr, item, nullptr, ctime, affects});
+		m_Queues.Writes[priority].emplace(WriteQueueItem{nullptr, nullptr, nullptr, item, nullptr, nullptr, ctime, affects});
 		m_QueuedWrites.Set();
 		IncreasePendingQueries(item->first.size());
 	});
@@ -219,12 +224,48 @@ RedisConnection::Replies RedisConnection::GetResultsOfQueries(RedisConnection::Q
 	return future.get();
 }
 
+/**
+ * Queue a Redis query for sending, wait for the response and pass its non-array values one by one to onLeaf
+ *
+ * Unlike GetResultOfQuery() this doesn't build the whole (possibly huge) response in memory.
+ * onLeaf is called from a Boost.Asio coroutine and should therefore not perform blocking operations.
+ *
+ * @param query Redis query
+ * @param onLeaf Called with every non-array value of the response, e.g. twice per field with HGETALL
+ * @param priority The query's priority
+ */
+void RedisConnection::StreamResultOfQuery(RedisConnection::Query query, RedisConnection::LeafHandler onLeaf,
+	RedisConnection::QueryPriority priority, QueryAffects affects)
+{
+	if (LogDebug >= Logger::GetMinLogSeverity()) {
+		Log msg (LogDebug, "IcingaDB", "Executing query:");
+		LogQuery(query, msg);
+	}
+
+	std::promise<void> promise;
+	auto future (promise.get_future());
+	auto item (Shared<std::pair<Query, std::pair<LeafHandler, std::promise<void>>>>::Make(
+		std::move(query), std::make_pair(std::move(onLeaf), std::move(promise))
+	));
+	auto ctime (Utility::GetTime());
+
+	asio::post(m_Strand, [this, item, priority, ctime, affects]() {
+		m_Queues.Writes[priority].emplace(WriteQueueItem{nullptr, nullptr, nullptr, nullptr, item, nullptr, ctime, affects});
+		m_QueuedWrites.Set();
+		IncreasePendingQueries(1);
+	});
+
+	item = nullptr;
+	future.wait();
+	future.get();
+}
+
 void RedisConnection::EnqueueCallback(const std::function<void(boost::asio::yield_context&)>& callback, RedisConnection::QueryPriority priority)
 {
 	auto ctime (Utility::GetTime());
 
 	asio::post(m_Strand, [this, callback, priority, ctime]() {
-		m_Queues.Writes[priority].emplace(WriteQueueItem{nullptr, nullptr, nullptr, nullptr, callback, ctime});
+		m_Queues.Writes[priority].emplace(WriteQueueItem{nullptr, nullptr, nullptr, nullptr, nullptr, callback, ctime});
 		m_QueuedWrites.Set();
 	});
 }
@@ -306,6 +347,8 @@ void RedisConnection::Connect(asio::yield_context& yc)
 		while (!m_Queues.FutureResponseActions.empty()) {
 			IoEngine::YieldCurrentCoroutine(yc);
 		}
+
+		ResetPipeline();
 	});
 
 	for (;;) {
@@ -409,6 +452,7 @@ void RedisConnection::ReadLoop(asio::yield_context& yc)
 				case ResponseAction::Ignore:
 					try {
 						for (auto i (item.Amount); i; --i) {
+							Defer replyRead ([this, &item]() { OnReplyRead(); RecordReplyLatency(item); });
 							ReadOne(yc);
 						}
 					} catch (const boost::coroutines::detail::forced_unwind&) {
@@ -432,6 +476,7 @@ void RedisConnection::ReadLoop(asio::yield_context& yc)
 						m_Queues.ReplyPromises.pop();
 
 						Reply reply;
+						Defer replyRead ([this, &item]() { OnReplyRead(); RecordReplyLatency(item); });
 
 						try {
 							reply = ReadOne(yc);
@@ -456,6 +501,8 @@ void RedisConnection::ReadLoop(asio::yield_context& yc)
 						replies.reserve(item.Amount);
 
 						for (auto i (item.Amount); i; --i) {
+							Defer replyRead ([this, &item]() { OnReplyRead(); RecordReplyLatency(item); });
+
 							try {
 								replies.emplace_back(ReadOne(yc));
 							} catch (const boost::coroutines::detail::forced_unwind&) {
@@ -473,9 +520,50 @@ void RedisConnection::ReadLoop(asio::yield_context& yc)
 							// due to promise.set_exception() was already called
 						}
 					}
+
+					break;
+				case ResponseAction::DeliverStreamed:
+					for (auto i (item.Amount); i; --i) {
+						auto requestor (std::move(m_Queues.StreamedReplyPromises.front()));
+						m_Queues.StreamedReplyPromises.pop();
+
+						Defer replyRead ([this, &item]() { OnReplyRead(); RecordReplyLatency(item); });
+						std::exception_ptr handlerError;
+
+						// The rest of the response has to be read even if the requestor gave up on it.
+						LeafHandler onLeaf ([&requestor, &handlerError](Reply& leaf) {
+							if (!handlerError) {
+								try {
+									requestor.first(leaf);
+								} catch (...) {
+									handlerError = std::current_exception();
+								}
+							}
+						});
+
+						try {
+							StreamOne(onLeaf, yc);
+						} catch (const boost::coroutines::detail::forced_unwind&) {
+							throw;
+						} catch (...) {
+							requestor.second.set_exception(std::current_exception());
+
+							continue;
+						}
+
+						if (handlerError) {
+							requestor.second.set_exception(handlerError);
+						} else {
+							requestor.second.set_value();
+						}
+					}
 			}
 		}
 
+		// Everything written so far has been answered (or failed), even replies skipped after an error.
+		m_RepliesRead = m_QueriesWritten;
+		OnReplyRead();
+
 		m_QueuedReads.Clear();
 	}
 }
@@ -489,6 +577,8 @@ void RedisConnection::WriteLoop(asio::yield_context& yc)
 		m_QueuedWrites.Wait(yc);
 
 	WriteFirstOfHighestPrio:
+		WaitForPipelineSlot(yc);
+
 		for (auto& queue : m_Queues.Writes) {
 			if (m_SuppressedQueryKinds.find(queue.first) != m_SuppressedQueryKinds.end() || queue.second.empty()) {
 				continue;
@@ -497,11 +587,12 @@ void RedisConnection::WriteLoop(asio::yield_context& yc)
 			auto next (std::move(queue.second.front()));
 			queue.second.pop();
 
-			WriteItem(yc, std::move(next));
+			WriteItem(yc, std::move(next), queue.first);
 
 			goto WriteFirstOfHighestPrio;
 		}
 
+		FlushWrites(yc);
 		m_QueuedWrites.Clear();
 	}
 }
@@ -545,9 +636,20 @@ void RedisConnection::LogStats(asio::yield_context& yc)
  * Send next and schedule receiving the response
  *
  * @param next Redis queries
+ * @param priority The queue next has been taken from
  */
-void RedisConnection::WriteItem(boost::asio::yield_context& yc, RedisConnection::WriteQueueItem next)
+void RedisConnection::WriteItem(boost::asio::yield_context& yc, RedisConnection::WriteQueueItem next, QueryPriority priority)
 {
+	auto latencies (GetQueryLatencies(priority));
+
+	m_WritingPriority = priority;
+	m_WritingTime = Utility::GetTime();
+	m_SerialiseTime = 0;
+
+	if (latencies && !next.Callback) {
+		latencies->Queued.Record(m_WritingTime - next.CTime);
+	}
+
 	if (next.FireAndForgetQuery) {
 		auto& item (*next.FireAndForgetQuery);
 		DecreasePendingQueries(1);
@@ -570,11 +672,7 @@ void RedisConnection::WriteItem(boost::asio::yield_context& yc, RedisConnection:
 			return;
 		}
 
-		if (m_Queues.FutureResponseActions.empty() || m_Queues.FutureResponseActions.back().Action != ResponseAction::Ignore) {
-			m_Queues.FutureResponseActions.emplace(FutureResponseAction{1, ResponseAction::Ignore});
-		} else {
-			++m_Queues.FutureResponseActions.back().Amount;
-		}
+		QueueResponseAction(1, ResponseAction::Ignore);
 
 		m_QueuedReads.Set();
 	}
@@ -606,11 +704,7 @@ void RedisConnection::WriteItem(boost::asio::yield_context& yc, RedisConnection:
 			return;
 		}
 
-		if (m_Queues.FutureResponseActions.empty() || m_Queues.FutureResponseActions.back().Action != ResponseAction::Ignore) {
-			m_Queues.FutureResponseActions.emplace(FutureResponseAction{item.size(), ResponseAction::Ignore});
-		} else {
-			m_Queues.FutureResponseActions.back().Amount += item.size();
-		}
+		QueueResponseAction(item.size(), ResponseAction::Ignore);
 
 		m_QueuedReads.Set();
 	}
@@ -631,11 +725,7 @@ void RedisConnection::WriteItem(boost::asio::yield_context& yc, RedisConnection:
 
 		m_Queues.ReplyPromises.emplace(std::move(item.second));
 
-		if (m_Queues.FutureResponseActions.empty() || m_Queues.FutureResponseActions.back().Action != ResponseAction::Deliver) {
-			m_Queues.FutureResponseActions.emplace(FutureResponseAction{1, ResponseAction::Deliver});
-		} else {
-			++m_Queues.FutureResponseActions.back().Amount;
-		}
+		QueueResponseAction(1, ResponseAction::Deliver);
 
 		m_QueuedReads.Set();
 	}
@@ -657,18 +747,118 @@ void RedisConnection::WriteItem(boost::asio::yield_context& yc, RedisConnection:
 		}
 
 		m_Queues.RepliesPromises.emplace(std::move(item.second));
-		m_Queues.FutureResponseActions.emplace(FutureResponseAction{item.first.size(), ResponseAction::DeliverBulk});
+		QueueResponseAction(item.first.size(), ResponseAction::DeliverBulk);
+
+		m_QueuedReads.Set();
+	}
+
+	if (next.StreamResultOfQuery) {
+		auto& item (*next.StreamResultOfQuery);
+		DecreasePendingQueries(1);
+
+		try {
+			WriteOne(item.first, yc);
+		} catch (const boost::coroutines::detail::forced_unwind&) {
+			throw;
+		} catch (...) {
+			item.second.second.set_exception(std::current_exception());
+
+			return;
+		}
+
+		m_Queues.StreamedReplyPromises.emplace(std::move(item.second));
+
+		QueueResponseAction(1, ResponseAction::DeliverStreamed);
 
 		m_QueuedReads.Set();
 	}
 
 	if (next.Callback) {
+		// The callback may wait for the responses to the queries written so far.
+		FlushWrites(yc);
 		next.Callback(yc);
+	} else if (latencies) {
+		latencies->Serialise.Record(m_SerialiseTime);
 	}
 
 	RecordAffected(next.Affects, Utility::GetTime());
 }
 
+/**
+ * Schedule receiving the responses to the queries WriteItem() is writing
+ *
+ * @param amount How many responses
+ * @param action What to do with them
+ */
+void RedisConnection::QueueResponseAction(size_t amount, ResponseAction action)
+{
+	auto& actions (m_Queues.FutureResponseActions);
+
+	// Each bulk has a promise of its own, the others can be merged while being of the same kind.
+	if (action != ResponseAction::DeliverBulk && !actions.empty()
+		&& actions.back().Action == action && actions.back().Priority == m_WritingPriority) {
+		actions.back().Amount += amount;
+	} else {
+		actions.emplace(FutureResponseAction{amount, action, m_WritingPriority, m_WritingTime});
+	}
+}
+
+/**
+ * Record how long it took to get a reply to one of the queries action is about
+ */
+void RedisConnection::RecordReplyLatency(const FutureResponseAction& action)
+{
+	auto latencies (GetQueryLatencies(action.Priority));
+
+	if (latencies) {
+		latencies->Reply.Record(Utility::GetTime() - action.WTime);
+	}
+}
+
+/**
+ * Get a name for the given priority suitable for stats
+ */
+const char* RedisConnection::GetQueryPriorityName(QueryPriority priority)
+{
+	switch (priority) {
+		case QueryPriority::Heartbeat:
+			return "heartbeat";
+		case QueryPriority::RuntimeStateStream:
+			return "runtime_state_stream";
+		case QueryPriority::Config:
+			return "config";
+		case QueryPriority::RuntimeStateSync:
+			return "runtime_state_sync";
+		case QueryPriority::History:
+			return "history";
+		case QueryPriority::CheckResult:
+			return "check_result";
+		default:
+			return "sync_connection";
+	}
+}
+
+/**
+ * Get the latency distributions of the queries of the given priority
+ * sent via this connection and (if it's the parent) its children
+ *
+ * @return nullptr for internal priorities, such as SyncConnection
+ */
+RedisConnection::QueryLatencies* RedisConnection::GetQueryLatencies(QueryPriority priority)
+{
+	auto root (this);
+
+	while (root->m_Parent) {
+		root = root->m_Parent.get();
+	}
+
+	if (priority > QueryPriority::CheckResult) {
+		return nullptr;
+	}
+
+	return &(*root->m_Latencies)[(size_t)priority];
+}
+
 /**
  * Receive the response to a Redis query
  *
@@ -687,6 +877,24 @@ RedisConnection::Reply RedisConnection::ReadOne(boost::asio::yield_context& yc)
 	}
 }
 
+/**
+ * Receive the response to a Redis query piece by piece
+ *
+ * @param onLeaf Called with every non-array value of the response
+ */
+void RedisConnection::StreamOne(RedisConnection::LeafHandler& onLeaf, boost::asio::yield_context& yc)
+{
+	if (m_Path.IsEmpty()) {
+		if (m_TLSContext) {
+			StreamOne(m_TlsConn, onLeaf, yc);
+		} else {
+			StreamOne(m_TcpConn, onLeaf, yc);
+		}
+	} else {
+		StreamOne(m_UnixConn, onLeaf, yc);
+	}
+}
+
 /**
  * Send query
  *
@@ -705,6 +913,213 @@ void RedisConnection::WriteOne(RedisConnection::Query& query, asio::yield_contex
 	}
 }
 
+/**
+ * Append a Redis protocol value to buffer
+ *
+ * @param buffer Output buffer
+ * @param query Redis protocol value
+ */
+void RedisConnection::AppendRESP(std::string& buffer, const Query& query)
+{
+	AppendRESPLength(buffer, '*', query.size());
+
+	for (auto& arg : query) {
+		AppendRESPLength(buffer, '$', arg.GetLength());
+		buffer += arg.GetData();
+		buffer += "\r\n";
+	}
+}
+
+/**
+ * Append an array or bulk string header to buffer
+ *
+ * @param buffer Output buffer
+ * @param type '*' or '$'
+ * @param length Amount of array items or string bytes
+ */
+void RedisConnection::AppendRESPLength(std::string& buffer, char type, size_t length)
+{
+	char digits[24];
+	char* end = digits + sizeof(digits);
+	char* begin = end;
+
+	do {
+		*--begin = '0' + length % 10u;
+		length /= 10u;
+	} while (length);
+
+	buffer += type;
+	buffer.append(begin, end);
+	buffer += "\r\n";
+}
+
+/**
+ * Append a Redis query to buffer, moving large arguments there instead of copying them
+ *
+ * @param buffer Output buffer
+ * @param query Redis query, large arguments are moved out of it if referenceArgs
+ * @param referenceArgs Whether to add large arguments to the buffer as they are
+ */
+void RedisConnection::BufferRESP(RedisConnection::WriteBuffer& buffer, RedisConnection::Query& query, bool referenceArgs)
+{
+	// Below this size, copying is cheaper than an additional buffer to write.
+	static constexpr String::SizeType minReferencedArg = 512;
+
+	AppendRESPLength(buffer.Data, '*', query.size());
+
+	for (auto& arg : query) {
+		AppendRESPLength(buffer.Data, '$', arg.GetLength());
+
+		if (referenceArgs && arg.GetLength() >= minReferencedArg) {
+			buffer.ArgOffsets.emplace_back(buffer.Data.size());
+			buffer.ArgsSize += arg.GetLength();
+			buffer.Args.emplace_back(std::move(arg));
+		} else {
+			buffer.Data += arg.GetData();
+		}
+
+		buffer.Data += "\r\n";
+	}
+
+	++buffer.Queries;
+}
+
+/**
+ * Forget the buffered queries, but keep the memory allocated
+ */
+void RedisConnection::WriteBuffer::Clear()
+{
+	Data.clear();
+	Args.clear();
+	ArgOffsets.clear();
+	ArgsSize = 0;
+	Queries = 0;
+	Sequence.clear();
+}
+
+/**
+ * Get the buffered queries as a buffer sequence to be written at once
+ *
+ * @return Buffers referring to Data and Args, valid until the next modification
+ */
+const std::vector<boost::asio::const_buffer>& RedisConnection::WriteBuffer::GetSequence()
+{
+	size_t pos = 0;
+
+	Sequence.clear();
+	Sequence.reserve(Args.size() * 2u + 1u);
+
+	for (size_t i = 0; i < Args.size(); ++i) {
+		auto offset (ArgOffsets[i]);
+		auto& arg (Args[i].GetData());
+
+		Sequence.emplace_back(Data.data() + pos, offset - pos);
+		Sequence.emplace_back(arg.data(), arg.size());
+		pos = offset;
+	}
+
+	Sequence.emplace_back(Data.data() + pos, Data.size() - pos);
+
+	return Sequence;
+}
+
+/**
+ * Write all queries buffered by WriteOne()
+ */
+void RedisConnection::FlushWrites(asio::yield_context& yc)
+{
+	if (m_Path.IsEmpty()) {
+		if (m_TLSContext) {
+			FlushWrites(m_TlsConn, yc);
+		} else {
+			FlushWrites(m_TcpConn, yc);
+		}
+	} else {
+		FlushWrites(m_UnixConn, yc);
+	}
+}
+
+/**
+ * Wait until less than the current pipelining depth of queries await their responses
+ *
+ * The depth is only enforced between write queue items, not within a single one.
+ */
+void RedisConnection::WaitForPipelineSlot(asio::yield_context& yc)
+{
+	if (m_InFlightQueries.load() + m_WriteBuffer.Queries < m_PipelineDepth.load()) {
+		return;
+	}
+
+	FlushWrites(yc);
+
+	while (m_Connected.load() && m_InFlightQueries.load() >= m_PipelineDepth.load()) {
+		m_RepliesReceived.Clear();
+		m_RepliesReceived.Wait(yc);
+	}
+}
+
+/**
+ * Account a response read by ReadLoop() and adjust the pipelining depth once a whole write has been answered
+ *
+ * Additive increase while the latency of a write stays close to the lowest one seen, multiplicative decrease otherwise.
+ */
+void RedisConnection::OnReplyRead()
+{
+	static constexpr size_t minDepth = 128, maxDepth = 65536;
+
+	if (m_RepliesRead < m_QueriesWritten) {
+		++m_RepliesRead;
+	}
+
+	if (!m_WrittenBatches.empty() && m_WrittenBatches.front().first <= m_RepliesRead) {
+		double latency = 0;
+		auto now (Utility::GetTime());
+
+		while (!m_WrittenBatches.empty() && m_WrittenBatches.front().first <= m_RepliesRead) {
+			latency = now - m_WrittenBatches.front().second;
+			m_WrittenBatches.pop();
+		}
+
+		// Let the minimum slowly recover from outliers and a changed environment.
+		m_MinReplyLatency = m_MinReplyLatency > 0 ? std::min(latency, m_MinReplyLatency * 1.01) : latency;
+
+		auto depth (m_PipelineDepth.load());
+
+		if (latency <= m_MinReplyLatency * 2) {
+			depth = std::min(depth + 64, maxDepth);
+		} else {
+			depth = std::max(depth / 4 * 3, minDepth);
+		}
+
+		m_PipelineDepth.store(depth);
+	}
+
+	m_InFlightQueries.store(m_QueriesWritten - m_RepliesRead);
+	m_RepliesReceived.Set();
+}
+
+/**
+ * Forget about the queries of a lost connection, all of them have been failed by ReadLoop()
+ */
+void RedisConnection::ResetPipeline()
+{
+	m_WriteBuffer.Clear();
+	m_RepliesRead = m_QueriesWritten;
+	m_WrittenBatches = decltype(m_WrittenBatches)();
+	m_InFlightQueries.store(0);
+	m_RepliesReceived.Set();
+}
+
+/**
+ * Average amount of bytes written to Redis at once
+ */
+double RedisConnection::GetBytesPerWrite()
+{
+	auto writes (m_Writes.load());
+
+	return writes ? (double)m_BytesWritten.load() / writes : 0;
+}
+
 /**
  * Specify a callback that is run each time a connection is successfully established
  *
@@ -6,9 +6,11 @@
 #include "base/array.hpp"
 #include "base/atomic.hpp"
 #include "base/convert.hpp"
+#include "base/defer.hpp"
+#include "base/histogram.hpp"
 #include "base/io-engine.hpp"
 #include "base/object.hpp"
-#include "base/ringbuffer.hpp"
+#include "base/shardedringbuffer.hpp"
 #include "base/shared.hpp"
 #include "base/string.hpp"
 #include "base/tlsstream.hpp"
@@ -28,16 +30,22 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/regex.hpp>
 #include <boost/utility/string_view.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <functional>
 #include <future>
 #include <map>
 #include <memory>
 #include <queue>
 #include <set>
 #include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -57,6 +65,7 @@ namespace icinga
 		typedef std::vector<Query> Queries;
 		typedef Value Reply;
 		typedef std::vector<Reply> Replies;
+		typedef std::function<void(Reply& leaf)> LeafHandler;
 
 		/**
 		 * Redis query priorities, highest first.
@@ -74,6 +83,18 @@ namespace icinga
 			SyncConnection = 255
 		};
 
+		/**
+		 * Latency distributions of one kind of queries.
+		 *
+		 * @ingroup icingadb
+		 */
+		struct QueryLatencies
+		{
+			Histogram Queued; // from being enqueued until being written
+			Histogram Reply; // from being written until the reply has been read
+			Histogram Serialise; // RESP encoding of a queue item
+		};
+
 		struct QueryAffects
 		{
 			size_t Config;
@@ -99,6 +120,7 @@ namespace icinga
 
 		Reply GetResultOfQuery(Query query, QueryPriority priority, QueryAffects affects = {});
 		Replies GetResultsOfQueries(Queries queries, QueryPriority priority, QueryAffects affects = {});
+		void StreamResultOfQuery(Query query, LeafHandler onLeaf, QueryPriority priority, QueryAffects affects = {});
 
 		void EnqueueCallback(const std::function<void(boost::asio::yield_context&)>& callback, QueryPriority priority);
 		void Sync();
@@ -136,6 +158,21 @@ namespace icinga
 			return m_WrittenHistory.UpdateAndGetValues(tv, span);
 		}
 
+		inline size_t GetPipelineDepth()
+		{
+			return m_PipelineDepth.load();
+		}
+
+		inline size_t GetInFlightQueries()
+		{
+			return m_InFlightQueries.load();
+		}
+
+		double GetBytesPerWrite();
+
+		QueryLatencies* GetQueryLatencies(QueryPriority priority);
+		static const char* GetQueryPriorityName(QueryPriority priority);
+
 	private:
 		/**
 		 * What to do with the responses to Redis queries.
@@ -146,7 +183,8 @@ namespace icinga
 		{
 			Ignore, // discard
 			Deliver, // submit to the requestor
-			DeliverBulk // submit multiple responses to the requestor at once
+			DeliverBulk, // submit multiple responses to the requestor at once
+			DeliverStreamed // submit the non-array values a response consists of one by one to the requestor
 		};
 
 		/**
@@ -158,6 +196,36 @@ namespace icinga
 		{
 			size_t Amount;
 			ResponseAction Action;
+			QueryPriority Priority;
+			double WTime;
+		};
+
+		/**
+		 * Queries to be written to Redis at once.
+		 *
+		 * Large arguments aren't copied, but written from where they are.
+		 *
+		 * @ingroup icingadb
+		 */
+		struct WriteBuffer
+		{
+			// RESP framing and small arguments
+			std::string Data;
+			// Large arguments, Args[i] is written before Data[ArgOffsets[i]]
+			std::vector<String> Args;
+			std::vector<size_t> ArgOffsets;
+			size_t ArgsSize = 0;
+			size_t Queries = 0;
+			// Refers to all of the above
+			std::vector<boost::asio::const_buffer> Sequence;
+
+			inline size_t GetSize() const
+			{
+				return Data.size() + ArgsSize;
+			}
+
+			void Clear();
+			const std::vector<boost::asio::const_buffer>& GetSequence();
 		};
 
 		/**
@@ -171,6 +239,7 @@ namespace icinga
 			Shared<Queries>::Ptr FireAndForgetQueries;
 			Shared<std::pair<Query, std::promise<Reply>>>::Ptr GetResultOfQuery;
 			Shared<std::pair<Queries, std::promise<Replies>>>::Ptr GetResultsOfQueries;
+			Shared<std::pair<Query, std::pair<LeafHandler, std::promise<void>>>>::Ptr StreamResultOfQuery;
 			std::function<void(boost::asio::yield_context&)> Callback;
 
 			double CTime;
@@ -188,12 +257,28 @@ namespace icinga
 		template<class AsyncReadStream>
 		static Value ReadRESP(AsyncReadStream& stream, boost::asio::yield_context& yc);
 
+		template<class AsyncReadStream, class OnLeaf>
+		static void StreamRESP(AsyncReadStream& stream, OnLeaf& onLeaf, boost::asio::yield_context& yc);
+
+		template<class AsyncReadStream>
+		static Value ReadRESPScalar(AsyncReadStream& stream, char type, boost::asio::yield_context& yc);
+
+		template<class AsyncReadStream>
+		static intmax_t ReadRESPInt(AsyncReadStream& stream, boost::asio::yield_context& yc);
+
 		template<class AsyncReadStream>
 		static std::vector<char> ReadLine(AsyncReadStream& stream, boost::asio::yield_context& yc, size_t hint = 0);
 
+		template<class AsyncReadStream>
+		static void ReadBuffered(AsyncReadStream& stream, boost::asio::mutable_buffer buf, boost::asio::yield_context& yc);
+
 		template<class AsyncWriteStream>
 		static void WriteRESP(AsyncWriteStream& stream, const Query& query, boost::asio::yield_context& yc);
 
+		static void AppendRESP(std::string& buffer, const Query& query);
+		static void AppendRESPLength(std::string& buffer, char type, size_t length);
+		static void BufferRESP(WriteBuffer& buffer, Query& query, bool referenceArgs);
+
 		static boost::regex m_ErrAuth;
 
 		RedisConnection(boost::asio::io_context& io, String host, int port, String path, String password,
@@ -204,16 +289,30 @@ namespace icinga
 		void ReadLoop(boost::asio::yield_context& yc);
 		void WriteLoop(boost::asio::yield_context& yc);
 		void LogStats(boost::asio::yield_context& yc);
-		void WriteItem(boost::asio::yield_context& yc, WriteQueueItem item);
+		void WriteItem(boost::asio::yield_context& yc, WriteQueueItem item, QueryPriority priority);
+		void QueueResponseAction(size_t amount, ResponseAction action);
+		void RecordReplyLatency(const FutureResponseAction& action);
 		Reply ReadOne(boost::asio::yield_context& yc);
+		void StreamOne(LeafHandler& onLeaf, boost::asio::yield_context& yc);
 		void WriteOne(Query& query, boost::asio::yield_context& yc);
 
 		template<class StreamPtr>
 		Reply ReadOne(StreamPtr& stream, boost::asio::yield_context& yc);
 
+		template<class StreamPtr>
+		void StreamOne(StreamPtr& stream, LeafHandler& onLeaf, boost::asio::yield_context& yc);
+
 		template<class StreamPtr>
 		void WriteOne(StreamPtr& stream, Query& query, boost::asio::yield_context& yc);
 
+		void FlushWrites(boost::asio::yield_context& yc);
+		void WaitForPipelineSlot(boost::asio::yield_context& yc);
+		void OnReplyRead();
+		void ResetPipeline();
+
+		template<class StreamPtr>
+		void FlushWrites(StreamPtr& stream, boost::asio::yield_context& yc);
+
 		void IncreasePendingQueries(int count);
 		void DecreasePendingQueries(int count);
 		void RecordAffected(QueryAffects affected, double when);
@@ -253,6 +352,8 @@ namespace icinga
 			std::queue<std::promise<Reply>> ReplyPromises;
 			// Requestors, each waiting for multiple responses at once
 			std::queue<std::promise<Replies>> RepliesPromises;
+			// Requestors, each processing a single response piece by piece
+			std::queue<std::pair<LeafHandler, std::promise<void>>> StreamedReplyPromises;
 			// Metadata about all of the above
 			std::queue<FutureResponseAction> FutureResponseActions;
 		} m_Queues;
@@ -263,14 +364,36 @@ namespace icinga
 		// Indicate that there's something to send/receive
 		AsioConditionVariable m_QueuedWrites, m_QueuedReads;
 
+		// Pipelining: queries are coalesced into m_WriteBuffer and written at once.
+		// At most m_PipelineDepth of them are in flight, adjusted based on the reply latency.
+		WriteBuffer m_WriteBuffer, m_SpareWriteBuffer;
+		uint_fast64_t m_QueriesWritten{0};
+		uint_fast64_t m_RepliesRead{0};
+		// Sequence number of the last query of a write and when it has been written
+		std::queue<std::pair<uint_fast64_t, double>> m_WrittenBatches;
+		double m_MinReplyLatency{0};
+		std::atomic<size_t> m_PipelineDepth;
+		std::atomic<size_t> m_InFlightQueries{0};
+		std::atomic<uint_fast64_t> m_Writes{0};
+		std::atomic<uint_fast64_t> m_BytesWritten{0};
+		AsioConditionVariable m_RepliesReceived;
+
+		// Only the parent has them, its children record their queries there.
+		typedef std::array<QueryLatencies, (size_t)QueryPriority::CheckResult + 1u> QueryLatenciesByPriority;
+		std::unique_ptr<QueryLatenciesByPriority> m_Latencies;
+		// The item WriteItem() is writing
+		QueryPriority m_WritingPriority{QueryPriority::SyncConnection};
+		double m_WritingTime{0};
+		double m_SerialiseTime{0};
+
 		std::function<void(boost::asio::yield_context& yc)> m_ConnectedCallback;
 
 		// Stats
-		RingBuffer m_InputQueries{10};
-		RingBuffer m_OutputQueries{15 * 60};
-		RingBuffer m_WrittenConfig{15 * 60};
-		RingBuffer m_WrittenState{15 * 60};
-		RingBuffer m_WrittenHistory{15 * 60};
+		ShardedRingBuffer m_InputQueries{10};
+		ShardedRingBuffer m_OutputQueries{15 * 60};
+		ShardedRingBuffer m_WrittenConfig{15 * 60};
+		ShardedRingBuffer m_WrittenState{15 * 60};
+		ShardedRingBuffer m_WrittenHistory{15 * 60};
 		int m_PendingQueries{0};
 		boost::asio::deadline_timer m_LogStatsTimer;
 		Ptr m_Parent;
@@ -406,6 +529,43 @@ RedisConnection::Reply RedisConnection::ReadOne(StreamPtr& stream, boost::asio::
 	}
 }
 
+/**
+ * Read a response from stream and pass its non-array values one by one to onLeaf
+ *
+ * @param stream Redis server connection
+ * @param onLeaf Called with every non-array value
+ */
+template<class StreamPtr>
+void RedisConnection::StreamOne(StreamPtr& stream, LeafHandler& onLeaf, boost::asio::yield_context& yc)
+{
+	namespace asio = boost::asio;
+
+	if (!stream) {
+		throw RedisDisconnected();
+	}
+
+	auto strm (stream);
+
+	try {
+		StreamRESP(*strm, onLeaf, yc);
+	} catch (const boost::coroutines::detail::forced_unwind&) {
+		throw;
+	} catch (...) {
+		if (m_Connecting.exchange(false)) {
+			m_Connected.store(false);
+			stream = nullptr;
+
+			if (!m_Connecting.exchange(true)) {
+				Ptr keepAlive (this);
+
+				IoEngine::SpawnCoroutine(m_Strand, [this, keepAlive](asio::yield_context yc) { Connect(yc); });
+			}
+		}
+
+		throw;
+	}
+}
+
 /**
  * Write a Redis query to stream
  *
@@ -414,21 +574,66 @@ RedisConnection::Reply RedisConnection::ReadOne(StreamPtr& stream, boost::asio::
  */
 template<class StreamPtr>
 void RedisConnection::WriteOne(StreamPtr& stream, RedisConnection::Query& query, boost::asio::yield_context& yc)
+{
+	if (!stream) {
+		throw RedisDisconnected();
+	}
+
+	auto start (std::chrono::steady_clock::now());
+
+	// TLS would turn every single buffer into a record of its own, so copy everything.
+	BufferRESP(m_WriteBuffer, query, !std::is_same<StreamPtr, Shared<AsioTlsStream>::Ptr>::value);
+
+	m_SerialiseTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (m_WriteBuffer.GetSize() >= 256u * 1024u) {
+		FlushWrites(stream, yc);
+	}
+}
+
+/**
+ * Write all queries buffered by WriteOne() at once
+ *
+ * @param stream Redis server connection
+ */
+template<class StreamPtr>
+void RedisConnection::FlushWrites(StreamPtr& stream, boost::asio::yield_context& yc)
 {
 	namespace asio = boost::asio;
 
+	if (!m_WriteBuffer.Queries) {
+		return;
+	}
+
+	// Swap the buffer out as it must not change while being written, but re-use its memory afterwards.
+	WriteBuffer buffer (std::move(m_WriteBuffer));
+	auto queries (buffer.Queries);
+	auto bytes (buffer.GetSize());
+
+	m_WriteBuffer = std::move(m_SpareWriteBuffer);
+	m_WriteBuffer.Clear();
+
+	Defer recycle ([this, &buffer]() {
+		buffer.Clear();
+		m_SpareWriteBuffer = std::move(buffer);
+	});
+
 	if (!stream) {
-		throw RedisDisconnected();
+		return;
 	}
 
 	auto strm (stream);
 
 	try {
-		WriteRESP(*strm, query, yc);
+		// Bypass the small buffer of the buffered stream for the already coalesced queries.
 		strm->async_flush(yc);
+		asio::async_write(strm->next_layer(), buffer.GetSequence(), yc);
 	} catch (const boost::coroutines::detail::forced_unwind&) {
 		throw;
-	} catch (...) {
+	} catch (const std::exception& ex) {
+		Log(LogCritical, "IcingaDB")
+			<< "Error during sending " << queries << " queries: " << ex.what();
+
 		if (m_Connecting.exchange(false)) {
 			m_Connected.store(false);
 			stream = nullptr;
@@ -440,8 +645,14 @@ void RedisConnection::WriteOne(StreamPtr& stream, RedisConnection::Query& query,
 			}
 		}
 
-		throw;
+		return;
 	}
+
+	m_QueriesWritten += queries;
+	m_InFlightQueries.store(m_QueriesWritten - m_RepliesRead);
+	m_WrittenBatches.emplace(m_QueriesWritten, Utility::GetTime());
+	m_Writes.fetch_add(1);
+	m_BytesWritten.fetch_add(bytes);
 }
 
 /**
@@ -534,11 +745,66 @@ Timeout::Ptr RedisConnection::MakeTimeout(StreamPtr& stream)
 template<class AsyncReadStream>
 Value RedisConnection::ReadRESP(AsyncReadStream& stream, boost::asio::yield_context& yc)
 {
-	namespace asio = boost::asio;
+	char type = 0;
+	ReadBuffered(stream, boost::asio::mutable_buffer(&type, 1), yc);
+
+	if (type != '*') {
+		return ReadRESPScalar(stream, type, yc);
+	}
 
+	auto i (ReadRESPInt(stream, yc));
+
+	if (i < 0) {
+		return Empty;
+	}
+
+	Array::Ptr arr = new Array();
+
+	arr->Reserve(i);
+
+	for (; i; --i) {
+		arr->Add(ReadRESP(stream, yc));
+	}
+
+	return arr;
+}
+
+/**
+ * Read a Redis protocol value from stream, but pass the non-array values it consists of one by one to onLeaf
+ *
+ * Unlike ReadRESP() this doesn't materialise (nested) arrays, i.e. an array of arrays of strings is reported as strings.
+ *
+ * @param stream Redis server connection
+ * @param onLeaf Called with every non-array value
+ */
+template<class AsyncReadStream, class OnLeaf>
+void RedisConnection::StreamRESP(AsyncReadStream& stream, OnLeaf& onLeaf, boost::asio::yield_context& yc)
+{
 	char type = 0;
-	asio::async_read(stream, asio::mutable_buffer(&type, 1), yc);
+	ReadBuffered(stream, boost::asio::mutable_buffer(&type, 1), yc);
+
+	if (type != '*') {
+		Value leaf (ReadRESPScalar(stream, type, yc));
+		onLeaf(leaf);
+		return;
+	}
 
+	for (auto i (ReadRESPInt(stream, yc)); i > 0; --i) {
+		StreamRESP(stream, onLeaf, yc);
+	}
+}
+
+/**
+ * Read a Redis protocol value other than an array from stream
+ *
+ * @param stream Redis server connection
+ * @param type The value's type, already read
+ *
+ * @return The value
+ */
+template<class AsyncReadStream>
+Value RedisConnection::ReadRESPScalar(AsyncReadStream& stream, char type, boost::asio::yield_context& yc)
+{
 	switch (type) {
 		case '+':
 			{
@@ -551,74 +817,51 @@ Value RedisConnection::ReadRESP(AsyncReadStream& stream, boost::asio::yield_cont
 				return new RedisError(String(buf.begin(), buf.end()));
 			}
 		case ':':
-			{
-				auto buf (ReadLine(stream, yc, 21));
-				intmax_t i = 0;
-
-				try {
-					i = boost::lexical_cast<intmax_t>(boost::string_view(buf.data(), buf.size()));
-				} catch (...) {
-					throw BadRedisInt(std::move(buf));
-				}
-
-				return (double)i;
-			}
+			return (double)ReadRESPInt(stream, yc);
 		case '$':
 			{
-				auto buf (ReadLine(stream, yc, 21));
-				intmax_t i = 0;
-
-				try {
-					i = boost::lexical_cast<intmax_t>(boost::string_view(buf.data(), buf.size()));
-				} catch (...) {
-					throw BadRedisInt(std::move(buf));
-				}
+				auto i (ReadRESPInt(stream, yc));
 
 				if (i < 0) {
 					return Value();
 				}
 
-				buf.clear();
-				buf.insert(buf.end(), i, 0);
-				asio::async_read(stream, asio::mutable_buffer(buf.data(), buf.size()), yc);
+				// Read the string directly into its final location, followed by \r\n
+				std::string str ((size_t)i, '\0');
+				char crlf[2];
 
-				{
-					char crlf[2];
-					asio::async_read(stream, asio::mutable_buffer(crlf, 2), yc);
-				}
+				ReadBuffered(stream, boost::asio::mutable_buffer(&str[0], str.size()), yc);
+				ReadBuffered(stream, boost::asio::mutable_buffer(crlf, 2), yc);
 
-				return String(buf.begin(), buf.end());
-			}
-		case '*':
-			{
-				auto buf (ReadLine(stream, yc, 21));
-				intmax_t i = 0;
-
-				try {
-					i = boost::lexical_cast<intmax_t>(boost::string_view(buf.data(), buf.size()));
-				} catch (...) {
-					throw BadRedisInt(std::move(buf));
-				}
-
-				if (i < 0) {
-					return Empty;
-				}
-
-				Array::Ptr arr = new Array();
-
-				arr->Reserve(i);
-
-				for (; i; --i) {
-					arr->Add(ReadRESP(stream, yc));
-				}
-
-				return arr;
+				return String(std::move(str));
 			}
 		default:
 			throw BadRedisType(type);
 	}
 }
 
+/**
+ * Read an integer terminated by \r\n from stream
+ *
+ * @param stream Redis server connection
+ *
+ * @return The integer
+ */
+template<class AsyncReadStream>
+intmax_t RedisConnection::ReadRESPInt(AsyncReadStream& stream, boost::asio::yield_context& yc)
+{
+	auto buf (ReadLine(stream, yc, 21));
+	intmax_t i = 0;
+
+	try {
+		i = boost::lexical_cast<intmax_t>(boost::string_view(buf.data(), buf.size()));
+	} catch (...) {
+		throw BadRedisInt(std::move(buf));
+	}
+
+	return i;
+}
+
 /**
  * Read from stream until \r\n
  *
@@ -630,19 +873,17 @@ Value RedisConnection::ReadRESP(AsyncReadStream& stream, boost::asio::yield_cont
 template<class AsyncReadStream>
 std::vector<char> RedisConnection::ReadLine(AsyncReadStream& stream, boost::asio::yield_context& yc, size_t hint)
 {
-	namespace asio = boost::asio;
-
 	std::vector<char> line;
 	line.reserve(hint);
 
 	char next = 0;
-	asio::mutable_buffer buf (&next, 1);
+	boost::asio::mutable_buffer buf (&next, 1);
 
 	for (;;) {
-		asio::async_read(stream, buf, yc);
+		ReadBuffered(stream, buf, yc);
 
 		if (next == '\r') {
-			asio::async_read(stream, buf, yc);
+			ReadBuffered(stream, buf, yc);
 			return line;
 		}
 
@@ -650,6 +891,30 @@ std::vector<char> RedisConnection::ReadLine(AsyncReadStream& stream, boost::asio
 	}
 }
 
+/**
+ * Read exactly buf.size() bytes from stream
+ *
+ * Takes what's already buffered synchronously and only suspends the coroutine for the rest, if any.
+ *
+ * @param stream Redis server connection
+ * @param buf Where to read into
+ */
+template<class AsyncReadStream>
+void RedisConnection::ReadBuffered(AsyncReadStream& stream, boost::asio::mutable_buffer buf, boost::asio::yield_context& yc)
+{
+	// buffered_stream#read_some() doesn't touch the socket while there's something buffered.
+	while (buf.size() && stream.in_avail()) {
+		buf += stream.read_some(buf);
+	}
+
+	if (buf.size() >= 16u * 1024u) {
+		// Nothing is buffered anymore, so don't copy large chunks through the buffer.
+		boost::asio::async_read(stream.next_layer(), buf, yc);
+	} else if (buf.size()) {
+		boost::asio::async_read(stream, buf, yc);
+	}
+}
+
 /**
  * Write a Redis protocol value to stream
  *
@@ -661,16 +926,11 @@ void RedisConnection::WriteRESP(AsyncWriteStream& stream, const Query& query, bo
 {
 	namespace asio = boost::asio;
 
-	asio::streambuf writeBuffer;
-	std::ostream msg(&writeBuffer);
+	std::string buffer;
 
-	msg << "*" << query.size() << "\r\n";
-
-	for (auto& arg : query) {
-		msg << "$" << arg.GetLength() << "\r\n" << arg << "\r\n";
-	}
+	AppendRESP(buffer, query);
 
-	asio::async_write(stream, writeBuffer, yc);
+	asio::async_write(stream, asio::buffer(buffer), yc);
 }
 
 }
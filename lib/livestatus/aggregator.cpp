@@ -9,6 +9,12 @@ void Aggregator::SetFilter(const Filter::Ptr& filter)
 	m_Filter = filter;
 }
 
+void Aggregator::Compile(const Table::Ptr& table)
+{
+	if (m_Filter)
+		m_Filter->Compile(table);
+}
+
 Filter::Ptr Aggregator::GetFilter() const
 {
 	return m_Filter;
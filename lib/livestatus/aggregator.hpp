@@ -28,7 +28,10 @@ public:
 
 	virtual void Apply(const Table::Ptr& table, const Value& row, AggregatorState **state) = 0;
 	virtual double GetResultAndFreeState(AggregatorState *state) const = 0;
+	/* Adds a partial state of the same kind to *state and frees it */
+	virtual void MergeState(AggregatorState **state, AggregatorState *other) const = 0;
 	void SetFilter(const Filter::Ptr& filter);
+	void Compile(const Table::Ptr& table);
 
 protected:
 	Aggregator() = default;
@@ -13,3 +13,20 @@ bool AndFilter::Apply(const Table::Ptr& table, const Value& row)
 
 	return true;
 }
+
+bool AndFilter::GetCandidateRows(const Table::Ptr& table, std::vector<Value>& rows)
+{
+	bool found = false;
+
+	/* any indexed sub filter narrows the rows down, take the one with the fewest */
+	for (const Filter::Ptr& filter : m_Filters) {
+		std::vector<Value> candidates;
+
+		if (filter->GetCandidateRows(table, candidates) && (!found || candidates.size() < rows.size())) {
+			rows = std::move(candidates);
+			found = true;
+		}
+	}
+
+	return found;
+}
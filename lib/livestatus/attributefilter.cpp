@@ -14,17 +14,92 @@ AttributeFilter::AttributeFilter(String column, String op, String operand)
 	: m_Column(std::move(column)), m_Operator(std::move(op)), m_Operand(std::move(operand))
 { }
 
+bool AttributeFilter::GetCandidateRows(const Table::Ptr& table, std::vector<Value>& rows)
+{
+	return table->LookupRows(m_Column, m_Operator, m_Operand, rows);
+}
+
+void AttributeFilter::Compile(const Table::Ptr& table)
+{
+	Plan plan = CreatePlan(table);
+
+	/* an unknown column is reported by Apply() just like before */
+	if (plan.ResolvedColumn)
+		m_Plan = std::move(plan);
+}
+
+AttributeFilter::Plan AttributeFilter::CreatePlan(const Table::Ptr& table) const
+{
+	Plan plan;
+
+	try {
+		plan.ResolvedColumn = &table->GetColumn(m_Column);
+		plan.CompiledTable = table.get();
+	} catch (const std::invalid_argument&) {
+		return plan;
+	}
+
+	if (m_Operator == "=")
+		plan.Operator = AttributeFilterEqual;
+	else if (m_Operator == "~")
+		plan.Operator = AttributeFilterRegex;
+	else if (m_Operator == "=~")
+		plan.Operator = AttributeFilterEqualNoCase;
+	else if (m_Operator == "~~")
+		plan.Operator = AttributeFilterRegexNoCase;
+	else if (m_Operator == "<")
+		plan.Operator = AttributeFilterLess;
+	else if (m_Operator == ">")
+		plan.Operator = AttributeFilterGreater;
+	else if (m_Operator == "<=")
+		plan.Operator = AttributeFilterLessOrEqual;
+	else if (m_Operator == ">=")
+		plan.Operator = AttributeFilterGreaterOrEqual;
+
+	try {
+		plan.NumericOperand = Convert::ToDouble(m_Operand);
+		plan.HasNumericOperand = true;
+	} catch (const std::exception&) {
+		/* only an error if a numeric column is compared */
+	}
+
+	if (plan.Operator == AttributeFilterRegex || plan.Operator == AttributeFilterRegexNoCase) {
+		try {
+			if (plan.Operator == AttributeFilterRegex)
+				plan.Regex = std::make_shared<boost::regex>(m_Operand.GetData());
+			else
+				plan.Regex = std::make_shared<boost::regex>(m_Operand.GetData(), boost::regex::icase);
+		} catch (boost::exception&) {
+			/* logged for every row by Evaluate() */
+		}
+	}
+
+	return plan;
+}
+
 bool AttributeFilter::Apply(const Table::Ptr& table, const Value& row)
 {
-	Column column = table->GetColumn(m_Column);
+	if (table.get() == m_Plan.CompiledTable)
+		return Evaluate(m_Plan, *m_Plan.ResolvedColumn, row);
 
+	/* not compiled for this table */
+	Plan plan = CreatePlan(table);
+
+	if (!plan.ResolvedColumn)
+		return Evaluate(plan, table->GetColumn(m_Column), row);
+
+	return Evaluate(plan, *plan.ResolvedColumn, row);
+}
+
+bool AttributeFilter::Evaluate(const Plan& plan, const Column& column, const Value& row) const
+{
 	Value value = column.ExtractValue(row);
 
 	if (value.IsObjectType<Array>()) {
 		Array::Ptr array = value;
 
-		if (m_Operator == ">=" || m_Operator == "<") {
-			bool negate = (m_Operator == "<");
+		if (plan.Operator == AttributeFilterGreaterOrEqual || plan.Operator == AttributeFilterLess) {
+			bool negate = (plan.Operator == AttributeFilterLess);
 
 			ObjectLock olock(array);
 			for (const String& item : array) {
@@ -33,36 +108,47 @@ bool AttributeFilter::Apply(const Table::Ptr& table, const Value& row)
 			}
 
 			return negate; /* Item not found in list. */
-		} else if (m_Operator == "=") {
+		} else if (plan.Operator == AttributeFilterEqual) {
 			return (array->GetLength() == 0);
 		} else {
 			BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid operator for column '" + m_Column + "': " + m_Operator + " (expected '>=' or '=')."));
 		}
-	} else {
-		if (m_Operator == "=") {
+	}
+
+	auto numericOperand ([this, &plan]() {
+		return plan.HasNumericOperand ? plan.NumericOperand : Convert::ToDouble(m_Operand);
+	});
+
+	switch (plan.Operator) {
+		case AttributeFilterEqual:
 			if (value.GetType() == ValueNumber || value.GetType() == ValueBoolean)
-				return (static_cast<double>(value) == Convert::ToDouble(m_Operand));
+				return (static_cast<double>(value) == numericOperand());
 			else
 				return (static_cast<String>(value) == m_Operand);
-		} else if (m_Operator == "~") {
-			bool ret;
-			try {
-				boost::regex expr(m_Operand.GetData());
-				String operand = value;
-				boost::smatch what;
-				ret = boost::regex_search(operand.GetData(), what, expr);
-			} catch (boost::exception&) {
+		case AttributeFilterRegex:
+		case AttributeFilterRegexNoCase: {
+			bool ret = false;
+			bool error = !plan.Regex;
+
+			if (plan.Regex) {
+				try {
+					String operand = value;
+					boost::smatch what;
+					ret = boost::regex_search(operand.GetData(), what, *plan.Regex);
+				} catch (boost::exception&) {
+					error = true;
+				}
+			}
+
+			if (error) {
 				Log(LogWarning, "AttributeFilter")
 					<< "Regex '" << m_Operand << " " << m_Operator << " " << value << "' error.";
 				ret = false;
 			}
 
-			//Log(LogDebug, "LivestatusListener/AttributeFilter")
-			//    << "Attribute filter '" << m_Operand + " " << m_Operator << " "
-			//    << value << "' " << (ret ? "matches" : "doesn't match") << ".";
-
 			return ret;
-		} else if (m_Operator == "=~") {
+		}
+		case AttributeFilterEqualNoCase: {
 			bool ret;
 			try {
 				String operand = value;
@@ -74,48 +160,28 @@ bool AttributeFilter::Apply(const Table::Ptr& table, const Value& row)
 			}
 
 			return ret;
-		} else if (m_Operator == "~~") {
-			bool ret;
-			try {
-				boost::regex expr(m_Operand.GetData(), boost::regex::icase);
-				String operand = value;
-				boost::smatch what;
-				ret = boost::regex_search(operand.GetData(), what, expr);
-			} catch (boost::exception&) {
-				Log(LogWarning, "AttributeFilter")
-					<< "Regex '" << m_Operand << " " << m_Operator << " " << value << "' error.";
-				ret = false;
-			}
-
-			//Log(LogDebug, "LivestatusListener/AttributeFilter")
-			//    << "Attribute filter '" << m_Operand << " " << m_Operator << " "
-			//    << value << "' " << (ret ? "matches" : "doesn't match") << ".";
-
-			return ret;
-		} else if (m_Operator == "<") {
+		}
+		case AttributeFilterLess:
 			if (value.GetType() == ValueNumber)
-				return (static_cast<double>(value) < Convert::ToDouble(m_Operand));
+				return (static_cast<double>(value) < numericOperand());
 			else
 				return (static_cast<String>(value) < m_Operand);
-		} else if (m_Operator == ">") {
+		case AttributeFilterGreater:
 			if (value.GetType() == ValueNumber)
-				return (static_cast<double>(value) > Convert::ToDouble(m_Operand));
+				return (static_cast<double>(value) > numericOperand());
 			else
 				return (static_cast<String>(value) > m_Operand);
-		} else if (m_Operator == "<=") {
+		case AttributeFilterLessOrEqual:
 			if (value.GetType() == ValueNumber)
-				return (static_cast<double>(value) <= Convert::ToDouble(m_Operand));
+				return (static_cast<double>(value) <= numericOperand());
 			else
 				return (static_cast<String>(value) <= m_Operand);
-		} else if (m_Operator == ">=") {
+		case AttributeFilterGreaterOrEqual:
 			if (value.GetType() == ValueNumber)
-				return (static_cast<double>(value) >= Convert::ToDouble(m_Operand));
+				return (static_cast<double>(value) >= numericOperand());
 			else
 				return (static_cast<String>(value) >= m_Operand);
-		} else {
+		default:
 			BOOST_THROW_EXCEPTION(std::invalid_argument("Unknown operator for column '" + m_Column + "': " + m_Operator));
-		}
 	}
-
-	return false;
 }
@@ -4,12 +4,27 @@
 #define ATTRIBUTEFILTER_H
 
 #include "livestatus/filter.hpp"
+#include <boost/regex.hpp>
+#include <memory>
 
 using namespace icinga;
 
 namespace icinga
 {
 
+enum AttributeFilterOperator
+{
+	AttributeFilterUnknown,
+	AttributeFilterEqual,
+	AttributeFilterRegex,
+	AttributeFilterEqualNoCase,
+	AttributeFilterRegexNoCase,
+	AttributeFilterLess,
+	AttributeFilterGreater,
+	AttributeFilterLessOrEqual,
+	AttributeFilterGreaterOrEqual
+};
+
 /**
  * @ingroup livestatus
  */
@@ -20,12 +35,31 @@ public:
 
 	AttributeFilter(String column, String op, String operand);
 
+	void Compile(const Table::Ptr& table) override;
 	bool Apply(const Table::Ptr& table, const Value& row) override;
+	bool GetCandidateRows(const Table::Ptr& table, std::vector<Value>& rows) override;
 
 protected:
 	String m_Column;
 	String m_Operator;
 	String m_Operand;
+
+private:
+	/* Everything about this filter which doesn't depend on the row. */
+	struct Plan
+	{
+		const Table *CompiledTable{nullptr};
+		const Column *ResolvedColumn{nullptr};
+		AttributeFilterOperator Operator{AttributeFilterUnknown};
+		bool HasNumericOperand{false};
+		double NumericOperand{0};
+		std::shared_ptr<boost::regex> Regex;
+	};
+
+	Plan m_Plan;
+
+	Plan CreatePlan(const Table::Ptr& table) const;
+	bool Evaluate(const Plan& plan, const Column& column, const Value& row) const;
 };
 
 }
@@ -18,7 +18,7 @@ AvgAggregatorState *AvgAggregator::EnsureState(AggregatorState **state)
 
 void AvgAggregator::Apply(const Table::Ptr& table, const Value& row, AggregatorState **state)
 {
-	Column column = table->GetColumn(m_AvgAttr);
+	const Column& column = table->GetColumn(m_AvgAttr);
 
 	Value value = column.ExtractValue(row);
 
@@ -36,3 +36,17 @@ double AvgAggregator::GetResultAndFreeState(AggregatorState *state) const
 
 	return result;
 }
+
+void AvgAggregator::MergeState(AggregatorState **state, AggregatorState *other) const
+{
+	if (!other)
+		return;
+
+	AvgAggregatorState *pstate = EnsureState(state);
+	auto *pother = static_cast<AvgAggregatorState *>(other);
+
+	pstate->Avg += pother->Avg;
+	pstate->AvgCount += pother->AvgCount;
+
+	delete pother;
+}
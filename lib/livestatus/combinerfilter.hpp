@@ -20,6 +20,8 @@ public:
 
 	void AddSubFilter(const Filter::Ptr& filter);
 
+	void Compile(const Table::Ptr& table) override;
+
 protected:
 	std::vector<Filter::Ptr> m_Filters;
 
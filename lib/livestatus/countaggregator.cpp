@@ -28,3 +28,16 @@ double CountAggregator::GetResultAndFreeState(AggregatorState *state) const
 
 	return result;
 }
+
+void CountAggregator::MergeState(AggregatorState **state, AggregatorState *other) const
+{
+	if (!other)
+		return;
+
+	CountAggregatorState *pstate = EnsureState(state);
+	auto *pother = static_cast<CountAggregatorState *>(other);
+
+	pstate->Count += pother->Count;
+
+	delete pother;
+}
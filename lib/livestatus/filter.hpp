@@ -19,6 +19,22 @@ public:
 
 	virtual bool Apply(const Table::Ptr& table, const Value& row) = 0;
 
+	/**
+	 * Resolves everything which doesn't depend on the row once before the table's rows are filtered.
+	 */
+	virtual void Compile(const Table::Ptr& table)
+	{ }
+
+	/**
+	 * Collects a superset of the rows this filter matches, if the table can look them up.
+	 *
+	 * @returns false if a full table scan is needed.
+	 */
+	virtual bool GetCandidateRows(const Table::Ptr& table, std::vector<Value>& rows)
+	{
+		return false;
+	}
+
 protected:
 	Filter() = default;
 };
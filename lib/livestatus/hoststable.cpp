@@ -186,6 +186,30 @@ void HostsTable::FetchRows(const AddRowFunction& addRowFn)
 	}
 }
 
+bool HostsTable::FetchRowsByIndex(const String& column, const String& op, const String& operand, std::vector<Value>& rows)
+{
+	if ((column == "name" || column == "host_name") && op == "=") {
+		Host::Ptr host = Host::GetByName(operand);
+
+		if (host)
+			rows.emplace_back(host);
+
+		return true;
+	} else if (column == "groups" && op == ">=") {
+		HostGroup::Ptr hg = HostGroup::GetByName(operand);
+
+		if (hg) {
+			for (const Host::Ptr& host : hg->GetMembers()) {
+				rows.emplace_back(host);
+			}
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
 Object::Ptr HostsTable::HostGroupAccessor(const Value& row, LivestatusGroupByType groupByType, const Object::Ptr& groupByObject)
 {
 	/* return the current group by value set from within FetchRows()
@@ -396,7 +420,7 @@ Value HostsTable::PerfDataAccessor(const Value& row)
 	if (!cr)
 		return Empty;
 
-	return PluginUtility::FormatPerfdata(cr->GetPerformanceData());
+	return cr->GetFormattedPerformanceData();
 }
 
 Value HostsTable::IconImageAccessor(const Value& row)
@@ -496,8 +520,9 @@ Value HostsTable::AcknowledgementTypeAccessor(const Value& row)
 	if (!host)
 		return Empty;
 
-	ObjectLock olock(host);
-	return host->GetAcknowledgement();
+	auto state (host->GetStateSnapshot());
+
+	return state->IsAcknowledged() ? state->Acknowledgement : AcknowledgementNone;
 }
 
 Value HostsTable::CheckTypeAccessor(const Value& row)
@@ -647,8 +672,7 @@ Value HostsTable::AcknowledgedAccessor(const Value& row)
 	if (!host)
 		return Empty;
 
-	ObjectLock olock(host);
-	return host->IsAcknowledged();
+	return host->GetStateSnapshot()->IsAcknowledged();
 }
 
 Value HostsTable::StateAccessor(const Value& row)
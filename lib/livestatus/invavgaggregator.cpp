@@ -18,7 +18,7 @@ InvAvgAggregatorState *InvAvgAggregator::EnsureState(AggregatorState **state)
 
 void InvAvgAggregator::Apply(const Table::Ptr& table, const Value& row, AggregatorState **state)
 {
-	Column column = table->GetColumn(m_InvAvgAttr);
+	const Column& column = table->GetColumn(m_InvAvgAttr);
 
 	Value value = column.ExtractValue(row);
 
@@ -36,3 +36,17 @@ double InvAvgAggregator::GetResultAndFreeState(AggregatorState *state) const
 
 	return result;
 }
+
+void InvAvgAggregator::MergeState(AggregatorState **state, AggregatorState *other) const
+{
+	if (!other)
+		return;
+
+	InvAvgAggregatorState *pstate = EnsureState(state);
+	auto *pother = static_cast<InvAvgAggregatorState *>(other);
+
+	pstate->InvAvg += pother->InvAvg;
+	pstate->InvAvgCount += pother->InvAvgCount;
+
+	delete pother;
+}
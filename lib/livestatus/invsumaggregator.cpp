@@ -18,7 +18,7 @@ InvSumAggregatorState *InvSumAggregator::EnsureState(AggregatorState **state)
 
 void InvSumAggregator::Apply(const Table::Ptr& table, const Value& row, AggregatorState **state)
 {
-	Column column = table->GetColumn(m_InvSumAttr);
+	const Column& column = table->GetColumn(m_InvSumAttr);
 
 	Value value = column.ExtractValue(row);
 
@@ -35,3 +35,16 @@ double InvSumAggregator::GetResultAndFreeState(AggregatorState *state) const
 
 	return result;
 }
+
+void InvSumAggregator::MergeState(AggregatorState **state, AggregatorState *other) const
+{
+	if (!other)
+		return;
+
+	InvSumAggregatorState *pstate = EnsureState(state);
+	auto *pother = static_cast<InvSumAggregatorState *>(other);
+
+	pstate->InvSum += pother->InvSum;
+
+	delete pother;
+}
@@ -8,13 +8,23 @@
 #include "base/configtype.hpp"
 #include "base/logger.hpp"
 #include "base/exception.hpp"
-#include "base/tcpsocket.hpp"
-#include "base/unixsocket.hpp"
-#include "base/networkstream.hpp"
+#include "base/fifo.hpp"
+#include "base/defer.hpp"
 #include "base/application.hpp"
 #include "base/function.hpp"
 #include "base/statsfunction.hpp"
 #include "base/convert.hpp"
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <climits>
+
+#ifndef _WIN32
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif /* _WIN32 */
 
 using namespace icinga;
 
@@ -46,36 +56,74 @@ void LivestatusListener::StatsFunc(const Dictionary::Ptr& status, const Array::P
  */
 void LivestatusListener::Start(bool runtimeCreated)
 {
+	namespace asio = boost::asio;
+
 	ObjectImpl<LivestatusListener>::Start(runtimeCreated);
 
 	Log(LogInformation, "LivestatusListener")
 		<< "'" << GetName() << "' started.";
 
+	auto& io (IoEngine::Get().GetIoContext());
+
 	if (GetSocketType() == "tcp") {
-		TcpSocket::Ptr socket = new TcpSocket();
+		using asio::ip::tcp;
+
+		auto acceptor (Shared<tcp::acceptor>::Make(io));
 
 		try {
-			socket->Bind(GetBindHost(), GetBindPort(), AF_UNSPEC);
-		} catch (std::exception&) {
+			tcp::resolver resolver (io);
+			tcp::resolver::query query (GetBindHost(), GetBindPort(), tcp::resolver::query::passive);
+
+			auto result (resolver.resolve(query));
+			auto current (result.begin());
+
+			for (;;) {
+				try {
+					acceptor->open(current->endpoint().protocol());
+					acceptor->set_option(tcp::acceptor::reuse_address(true));
+					acceptor->bind(current->endpoint());
+
+					break;
+				} catch (const std::exception&) {
+					if (++current == result.end()) {
+						throw;
+					}
+
+					if (acceptor->is_open()) {
+						acceptor->close();
+					}
+				}
+			}
+
+			acceptor->listen(INT_MAX);
+		} catch (const std::exception&) {
 			Log(LogCritical, "LivestatusListener")
 				<< "Cannot bind TCP socket on host '" << GetBindHost() << "' port '" << GetBindPort() << "'.";
 			return;
 		}
 
-		m_Listener = socket;
+		m_TcpAcceptor = acceptor;
 
-		m_Thread = std::thread([this]() { ServerThreadProc(); });
+		IoEngine::SpawnCoroutine(io, [this, acceptor](asio::yield_context yc) {
+			ListenerCoroutineProc<tcp::acceptor>(yc, acceptor);
+		});
 
 		Log(LogInformation, "LivestatusListener")
 			<< "Created TCP socket listening on host '" << GetBindHost() << "' port '" << GetBindPort() << "'.";
 	}
 	else if (GetSocketType() == "unix") {
 #ifndef _WIN32
-		UnixSocket::Ptr socket = new UnixSocket();
+		using asio::local::stream_protocol;
+
+		auto acceptor (Shared<stream_protocol::acceptor>::Make(io));
 
 		try {
-			socket->Bind(GetSocketPath());
-		} catch (std::exception&) {
+			unlink(GetSocketPath().CStr());
+
+			acceptor->open();
+			acceptor->bind(stream_protocol::endpoint(GetSocketPath().GetData()));
+			acceptor->listen(INT_MAX);
+		} catch (const std::exception&) {
 			Log(LogCritical, "LivestatusListener")
 				<< "Cannot bind UNIX socket to '" << GetSocketPath() << "'.";
 			return;
@@ -90,9 +138,11 @@ void LivestatusListener::Start(bool runtimeCreated)
 			return;
 		}
 
-		m_Listener = socket;
+		m_UnixAcceptor = acceptor;
 
-		m_Thread = std::thread([this]() { ServerThreadProc(); });
+		IoEngine::SpawnCoroutine(io, [this, acceptor](asio::yield_context yc) {
+			ListenerCoroutineProc<stream_protocol::acceptor>(yc, acceptor);
+		});
 
 		Log(LogInformation, "LivestatusListener")
 			<< "Created UNIX socket in '" << GetSocketPath() << "'.";
@@ -111,10 +161,28 @@ void LivestatusListener::Stop(bool runtimeRemoved)
 	Log(LogInformation, "LivestatusListener")
 		<< "'" << GetName() << "' stopped.";
 
-	m_Listener->Close();
+	auto& io (IoEngine::Get().GetIoContext());
+
+	/* the acceptors belong to the I/O threads, the pending accepts get aborted there */
+	if (m_TcpAcceptor) {
+		auto acceptor (std::move(m_TcpAcceptor));
+
+		boost::asio::post(io, [acceptor]() {
+			boost::system::error_code ec;
+			acceptor->close(ec);
+		});
+	}
+
+#ifndef _WIN32
+	if (m_UnixAcceptor) {
+		auto acceptor (std::move(m_UnixAcceptor));
 
-	if (m_Thread.joinable())
-		m_Thread.join();
+		boost::asio::post(io, [acceptor]() {
+			boost::system::error_code ec;
+			acceptor->close(ec);
+		});
+	}
+#endif /* _WIN32 */
 }
 
 int LivestatusListener::GetClientsConnected()
@@ -131,59 +199,96 @@ int LivestatusListener::GetConnections()
 	return l_Connections;
 }
 
-void LivestatusListener::ServerThreadProc()
+template<class Acceptor>
+void LivestatusListener::ListenerCoroutineProc(boost::asio::yield_context yc, const typename Shared<Acceptor>::Ptr& acceptor)
 {
-	m_Listener->Listen();
+	namespace asio = boost::asio;
+	typedef typename Acceptor::protocol_type::socket Socket;
 
-	try {
-		for (;;) {
-			timeval tv = { 0, 500000 };
+	auto& ioEngine (IoEngine::Get());
 
-			if (m_Listener->Poll(true, false, &tv)) {
-				Socket::Ptr client = m_Listener->Accept();
-				Log(LogNotice, "LivestatusListener", "Client connected");
-				Utility::QueueAsyncCallback([this, client]() { ClientHandler(client); }, LowLatencyScheduler);
-			}
+	for (;;) {
+		boost::system::error_code ec;
 
-			if (!IsActive())
-				break;
+		/* Pin the connection to one shard for its lifetime. */
+		auto& shardIo (ioEngine.GetShardIoContext());
+		auto client (Shared<Socket>::Make(shardIo));
+
+		acceptor->async_accept(*client, yc[ec]);
+
+		if (ec == asio::error::operation_aborted || !acceptor->is_open() || !IsActive())
+			break;
+
+		if (ec) {
+			Log(LogCritical, "LivestatusListener")
+				<< "Cannot accept new connection: " << ec.message();
+			continue;
 		}
-	} catch (std::exception&) {
-		Log(LogCritical, "LivestatusListener", "Cannot accept new connection.");
-	}
 
-	m_Listener->Close();
+		Log(LogNotice, "LivestatusListener", "Client connected");
+
+		LivestatusListener::Ptr keepAlive (this);
+
+		IoEngine::SpawnCoroutine(shardIo, [this, keepAlive, client](asio::yield_context yc) {
+			ClientCoroutineProc<Socket>(yc, client);
+		});
+	}
 }
 
-void LivestatusListener::ClientHandler(const Socket::Ptr& client)
+/**
+ * Serves one client's queries one after another for as long as it keeps the connection alive.
+ * Queries sent ahead (pipelined) wait in the read buffer.
+ */
+template<class Socket>
+void LivestatusListener::ClientCoroutineProc(boost::asio::yield_context yc, const typename Shared<Socket>::Ptr& client)
 {
+	namespace asio = boost::asio;
+
 	{
 		std::unique_lock<std::mutex> lock(l_ComponentMutex);
 		l_ClientsConnected++;
 		l_Connections++;
 	}
 
-	Stream::Ptr stream = new NetworkStream(client);
+	Defer disconnected ([client]() {
+		{
+			std::unique_lock<std::mutex> lock(l_ComponentMutex);
+			l_ClientsConnected--;
+		}
 
-	StreamReadContext context;
+		boost::system::error_code ec;
+		client->shutdown(Socket::shutdown_both, ec);
+		client->close(ec);
+	});
 
-	for (;;) {
-		String line;
+	asio::streambuf buf;
+	bool eof = false;
 
+	while (!eof) {
 		std::vector<String> lines;
 
+		/* a query ends with an empty line (or the end of the connection) */
 		for (;;) {
-			StreamReadStatus srs = stream->ReadLine(&line, context);
+			boost::system::error_code ec;
+			size_t length = asio::async_read_until(*client, buf, '\n', yc[ec]);
+
+			if (ec) {
+				eof = true;
+				length = buf.size();
+			}
 
-			if (srs == StatusEof)
+			auto begin (asio::buffers_begin(buf.data()));
+			String line (std::string(begin, begin + length));
+
+			buf.consume(length);
+			boost::algorithm::trim_right(line);
+
+			if (line.IsEmpty())
 				break;
 
-			if (srs != StatusNewItem)
-				continue;
+			lines.emplace_back(std::move(line));
 
-			if (line.GetLength() > 0)
-				lines.push_back(line);
-			else
+			if (eof)
 				break;
 		}
 
@@ -191,17 +296,37 @@ void LivestatusListener::ClientHandler(const Socket::Ptr& client)
 			break;
 
 		LivestatusQuery::Ptr query = new LivestatusQuery(lines, GetCompatLogPath());
-		if (!query->Execute(stream))
-			break;
-	}
+		FIFO::Ptr response = new FIFO();
+		bool keepAlive;
 
-	{
-		std::unique_lock<std::mutex> lock(l_ComponentMutex);
-		l_ClientsConnected--;
+		{
+			CpuBoundWork handleQuery (yc);
+
+			keepAlive = query->Execute(response);
+		}
+
+		std::vector<char> chunk (64 * 1024);
+
+		for (;;) {
+			size_t count = response->Read(chunk.data(), chunk.size());
+
+			if (!count)
+				break;
+
+			boost::system::error_code ec;
+			asio::async_write(*client, asio::buffer(chunk.data(), count), yc[ec]);
+
+			if (ec) {
+				Log(LogCritical, "LivestatusQuery", "Cannot write query response to socket.");
+				return;
+			}
+		}
+
+		if (!keepAlive)
+			break;
 	}
 }
 
-
 void LivestatusListener::ValidateSocketType(const Lazy<String>& lvalue, const ValidationUtils& utils)
 {
 	ObjectImpl<LivestatusListener>::ValidateSocketType(lvalue, utils);
@@ -10,47 +10,276 @@
 #include "base/utility.hpp"
 #include "base/convert.hpp"
 #include "base/logger.hpp"
+#include "base/configuration.hpp"
+#include "base/exception.hpp"
+#include "base/objectlock.hpp"
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
 #include <fstream>
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <vector>
 
 using namespace icinga;
 
+/**
+ * What's known about a log file's content, so that it has to be read only once.
+ */
+struct LivestatusLogFile
+{
+	/* Up to which offset (the end of the last complete line) the file has been indexed */
+	std::streamoff Size{0};
+	time_t Mtime{0};
+	bool Valid{true};
+	time_t Start{0};
+	time_t End{0};
+	/* Non-empty lines so far */
+	unsigned long Lines{0};
+	/* Time, offset and line number of (at least) every 10000th non-empty line */
+	std::vector<std::tuple<time_t, std::streamoff, unsigned long>> Checkpoints;
+};
+
+static std::mutex l_LogFilesMutex;
+static std::map<String, LivestatusLogFile> l_LogFiles;
+static bool l_LogFilesLoaded = false;
+static bool l_LogFilesChanged = false;
+
+static String GetLogIndexPath()
+{
+	return Configuration::CacheDir + "/livestatus-logindex.json";
+}
+
+/* The current log file changes all the time, only rotated ones are worth to be persisted. */
+static bool IsCurrentLogFile(const String& path)
+{
+	return Utility::BaseName(path) == "icinga.log";
+}
+
+static void LoadLogIndex()
+{
+	l_LogFilesLoaded = true;
+
+	String path = GetLogIndexPath();
+
+	if (!Utility::PathExists(path))
+		return;
+
+	try {
+		Dictionary::Ptr files = Utility::LoadJsonFile(path);
+
+		if (!files)
+			return;
+
+		ObjectLock olock (files);
+
+		for (const Dictionary::Pair& kv : files) {
+			Dictionary::Ptr file = kv.second;
+			LivestatusLogFile& entry = l_LogFiles[kv.first];
+
+			entry.Size = Convert::ToLong(file->Get("size"));
+			entry.Mtime = Convert::ToLong(file->Get("mtime"));
+			entry.Valid = Convert::ToBool(file->Get("valid"));
+			entry.Start = Convert::ToLong(file->Get("start"));
+			entry.End = Convert::ToLong(file->Get("end"));
+			entry.Lines = Convert::ToLong(file->Get("lines"));
+
+			Array::Ptr checkpoints = file->Get("checkpoints");
+			ObjectLock checkpointsLock (checkpoints);
+
+			for (const Array::Ptr& checkpoint : checkpoints) {
+				entry.Checkpoints.emplace_back(Convert::ToLong(checkpoint->Get(0)),
+					Convert::ToLong(checkpoint->Get(1)), Convert::ToLong(checkpoint->Get(2)));
+			}
+		}
+	} catch (const std::exception& ex) {
+		l_LogFiles.clear();
+
+		Log(LogWarning, "LivestatusLogUtility")
+			<< "Ignoring invalid log index '" << path << "': " << DiagnosticInformation(ex, false);
+	}
+}
+
+static void SaveLogIndex()
+{
+	Dictionary::Ptr files = new Dictionary();
+
+	for (auto& kv : l_LogFiles) {
+		if (IsCurrentLogFile(kv.first))
+			continue;
+
+		auto& entry (kv.second);
+		ArrayData checkpoints;
+
+		for (auto& checkpoint : entry.Checkpoints) {
+			checkpoints.emplace_back(new Array({
+				static_cast<double>(std::get<0>(checkpoint)),
+				static_cast<double>(std::get<1>(checkpoint)),
+				static_cast<double>(std::get<2>(checkpoint))
+			}));
+		}
+
+		files->Set(kv.first, new Dictionary({
+			{ "size", static_cast<double>(entry.Size) },
+			{ "mtime", static_cast<double>(entry.Mtime) },
+			{ "valid", entry.Valid },
+			{ "start", static_cast<double>(entry.Start) },
+			{ "end", static_cast<double>(entry.End) },
+			{ "lines", static_cast<double>(entry.Lines) },
+			{ "checkpoints", new Array(std::move(checkpoints)) }
+		}));
+	}
+
+	try {
+		Utility::SaveJsonFile(GetLogIndexPath(), 0600, files);
+	} catch (const std::exception& ex) {
+		Log(LogWarning, "LivestatusLogUtility")
+			<< "Can't save log index '" << GetLogIndexPath() << "': " << DiagnosticInformation(ex, false);
+	}
+}
+
+/**
+ * Index a log file from where the last run stopped.
+ */
+static void IndexLogFile(const String& path, LivestatusLogFile& entry)
+{
+	std::ifstream fp;
+	fp.open(path.CStr(), std::ifstream::in | std::ifstream::binary);
+
+	if (!fp)
+		BOOST_THROW_EXCEPTION(std::runtime_error("Could not open log file: " + path));
+
+	fp.seekg(entry.Size);
+
+	std::streamoff offset = entry.Size;
+	std::string line;
+
+	while (entry.Valid && std::getline(fp, line)) {
+		/* the last line isn't complete yet */
+		if (fp.eof())
+			break;
+
+		if (!line.empty()) {
+			/* read the timestamp: [123456789] */
+			if (line.size() >= 12 && line[0] == '[' && line[11] == ']') {
+				time_t ts = atoi(line.substr(1, 10).c_str());
+
+				if (!entry.Lines)
+					entry.Start = ts;
+
+				if (ts > entry.End)
+					entry.End = ts;
+
+				if (entry.Checkpoints.empty() || entry.Lines - std::get<2>(entry.Checkpoints.back()) >= 10000u)
+					entry.Checkpoints.emplace_back(ts, offset, entry.Lines);
+			} else if (!entry.Lines) {
+				/* not a log file, e.g. a directory */
+				entry.Valid = false;
+				break;
+			}
+
+			entry.Lines++;
+		}
+
+		offset += line.size() + 1;
+	}
+
+	entry.Size = offset;
+}
+
+/**
+ * Find all log files and their first timestamp. A persistent index remembers what they contain,
+ * so that only new (and growing) files have to be read.
+ */
 void LivestatusLogUtility::CreateLogIndex(const String& path, std::map<time_t, String>& index)
 {
-	Utility::Glob(path + "/icinga.log", [&index](const String& newPath) { CreateLogIndexFileHandler(newPath, index); }, GlobFile);
-	Utility::Glob(path + "/archives/*.log", [&index](const String& newPath) { CreateLogIndexFileHandler(newPath, index); }, GlobFile);
+	std::vector<String> paths;
+
+	/* archives first, a just rotated one may take over the index of the former icinga.log */
+	Utility::Glob(path + "/archives/*.log", [&paths](const String& newPath) { paths.emplace_back(newPath); }, GlobFile);
+	Utility::Glob(path + "/icinga.log", [&paths](const String& newPath) { paths.emplace_back(newPath); }, GlobFile);
+
+	std::unique_lock<std::mutex> lock (l_LogFilesMutex);
+
+	if (!l_LogFilesLoaded)
+		LoadLogIndex();
+
+	for (auto& newPath : paths) {
+		CreateLogIndexFileHandler(newPath, index);
+	}
+
+	/* forget deleted files */
+	std::set<String> found (paths.begin(), paths.end());
+
+	for (auto file (l_LogFiles.begin()); file != l_LogFiles.end();) {
+		if (file->first.GetLength() > path.GetLength() && file->first.SubStr(0, path.GetLength() + 1) == path + "/"
+			&& found.find(file->first) == found.end()) {
+			l_LogFilesChanged = l_LogFilesChanged || !IsCurrentLogFile(file->first);
+			file = l_LogFiles.erase(file);
+		} else {
+			++file;
+		}
+	}
+
+	if (l_LogFilesChanged) {
+		l_LogFilesChanged = false;
+		SaveLogIndex();
+	}
 }
 
+/**
+ * Bring the index of a log file up to date (the caller holds l_LogFilesMutex).
+ */
 void LivestatusLogUtility::CreateLogIndexFileHandler(const String& path, std::map<time_t, String>& index)
 {
-	std::ifstream stream;
-	stream.open(path.CStr(), std::ifstream::in);
+	boost::system::error_code ec;
+	auto size = static_cast<std::streamoff>(boost::filesystem::file_size(path.CStr(), ec));
 
-	if (!stream)
+	if (ec)
 		BOOST_THROW_EXCEPTION(std::runtime_error("Could not open log file: " + path));
 
-	/* read the first bytes to get the timestamp: [123456789] */
-	char buffer[12];
+	time_t mtime = boost::filesystem::last_write_time(path.CStr(), ec);
 
-	stream.read(buffer, 12);
+	auto file (l_LogFiles.find(path));
 
-	if (buffer[0] != '[' || buffer[11] != ']') {
-		/* this can happen for directories too, silently ignore them */
-		return;
+	if (file == l_LogFiles.end() && !IsCurrentLogFile(path)) {
+		/* a just rotated log file is the former current one */
+		for (auto& kv : l_LogFiles) {
+			if (IsCurrentLogFile(kv.first) && kv.second.Size == size && kv.second.Valid
+				&& Utility::DirName(Utility::DirName(path)) == Utility::DirName(kv.first)) {
+				file = l_LogFiles.emplace(path, kv.second).first;
+				file->second.Mtime = mtime;
+				l_LogFilesChanged = true;
+				break;
+			}
+		}
 	}
 
-	/* extract timestamp */
-	buffer[11] = 0;
-	time_t ts_start = atoi(buffer+1);
+	if (file == l_LogFiles.end())
+		file = l_LogFiles.emplace(path, LivestatusLogFile()).first;
 
-	stream.close();
+	auto& entry (file->second);
 
-	Log(LogDebug, "LivestatusLogUtility")
-		<< "Indexing log file: '" << path << "' with timestamp start: '" << ts_start << "'.";
+	if (size < entry.Size) {
+		/* truncated or replaced */
+		entry = LivestatusLogFile();
+	}
+
+	if (size != entry.Size || mtime != entry.Mtime) {
+		Log(LogDebug, "LivestatusLogUtility")
+			<< "Indexing log file: '" << path << "' from offset " << entry.Size << ".";
+
+		IndexLogFile(path, entry);
+		entry.Mtime = mtime;
 
-	index[ts_start] = path;
+		if (!IsCurrentLogFile(path))
+			l_LogFilesChanged = true;
+	}
+
+	if (entry.Valid && entry.Lines)
+		index[entry.Start] = path;
 }
 
 void LivestatusLogUtility::CreateLogCache(std::map<time_t, String> index, HistoryTable *table,
@@ -61,23 +290,49 @@ void LivestatusLogUtility::CreateLogCache(std::map<time_t, String> index, Histor
 	/* m_LogFileIndex map tells which log files are involved ordered by their start timestamp */
 	unsigned long line_count = 0;
 	for (const auto& kv : index) {
-		unsigned int ts = kv.first;
+		String log_file = kv.second;
+		LivestatusLogFile entry;
+
+		{
+			std::unique_lock<std::mutex> lock (l_LogFilesMutex);
+			auto file (l_LogFiles.find(log_file));
+
+			if (file != l_LogFiles.end())
+				entry = file->second;
+		}
 
 		/* skip log files not in range (performance optimization) */
-		if (ts < from || ts > until)
+		if (entry.End < from || kv.first > until)
 			continue;
 
-		String log_file = index[ts];
+		/* seek to the last checkpoint before the range and stop at the first one after it */
+		std::streamoff offset = 0, stop = -1;
 		int lineno = 0;
 
+		for (auto& checkpoint : entry.Checkpoints) {
+			if (std::get<0>(checkpoint) <= from) {
+				offset = std::get<1>(checkpoint);
+				lineno = std::get<2>(checkpoint);
+			} else if (std::get<0>(checkpoint) > until) {
+				stop = std::get<1>(checkpoint);
+				break;
+			}
+		}
+
 		std::ifstream fp;
 		fp.exceptions(std::ifstream::badbit);
-		fp.open(log_file.CStr(), std::ifstream::in);
+		fp.open(log_file.CStr(), std::ifstream::in | std::ifstream::binary);
+		fp.seekg(offset);
 
-		while (fp.good()) {
+		while (fp.good() && (stop < 0 || offset < stop)) {
 			std::string line;
 			std::getline(fp, line);
 
+			offset += line.size() + 1;
+
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+
 			if (line.empty())
 				continue; /* Ignore empty lines */
 
@@ -469,53 +469,98 @@ void LivestatusQuery::ExecuteGetHelper(const Stream::Ptr& stream)
 		for (const String& columnName : columns)
 			column_objs.emplace_back(columnName, table->GetColumn(columnName));
 
-		ArrayData header;
+		if (m_ColumnHeaders && !objects.empty()) {
+			ArrayData header;
 
-		for (const LivestatusRowValue& object : objects) {
-			ArrayData row;
+			for (const ColumnPair& cv : column_objs)
+				header.push_back(cv.first);
 
-			row.reserve(column_objs.size());
+			AppendResultRow(result, new Array(std::move(header)), first_row);
+			m_ColumnHeaders = false;
+		}
 
-			for (const ColumnPair& cv : column_objs) {
-				if (m_ColumnHeaders)
-					header.push_back(cv.first);
+		FlushResponseChunk(stream, result, true);
 
-				row.push_back(cv.second.ExtractValue(object.Row, object.GroupByType, object.GroupByObject));
-			}
+		/* every chunk is serialized on its own and sent in order afterwards */
+		std::vector<std::string> chunkResults (Table::GetChunkCount(objects.size()));
+		Table::ParallelForChunks(objects.size(), [this, &stream, &objects, &column_objs, &chunkResults, first_row](size_t chunk, size_t begin, size_t end) {
+			std::ostringstream chunkResult;
+			bool chunk_first_row = (chunk == 0) && first_row;
+
+			for (size_t i = begin; i < end; i++) {
+				const LivestatusRowValue& object = objects[i];
+				ArrayData row;
+
+				row.reserve(column_objs.size());
 
-			if (m_ColumnHeaders) {
-				AppendResultRow(result, new Array(std::move(header)), first_row);
-				m_ColumnHeaders = false;
+				for (const ColumnPair& cv : column_objs)
+					row.push_back(cv.second.ExtractValue(object.Row, object.GroupByType, object.GroupByObject));
+
+				AppendResultRow(chunkResult, new Array(std::move(row)), chunk_first_row);
+
+				/* not running in parallel, so the rows can be sent right away */
+				if (chunkResults.size() == 1)
+					FlushResponseChunk(stream, chunkResult);
 			}
 
-			AppendResultRow(result, new Array(std::move(row)), first_row);
-		}
+			chunkResults[chunk] = chunkResult.str();
+		});
+
+		for (std::string& chunkResult : chunkResults)
+			SendResponseChunk(stream, std::move(chunkResult));
 	} else {
-		std::map<std::vector<Value>, std::vector<AggregatorState *> > allStats;
+		typedef std::map<std::vector<Value>, std::vector<AggregatorState *> > StatsMap;
 
-		/* add aggregated stats */
-		for (const LivestatusRowValue& object : objects) {
-			std::vector<Value> statsKey;
+		std::vector<Column> statsColumns;
+		statsColumns.reserve(m_Columns.size());
 
-			for (const String& columnName : m_Columns) {
-				Column column = table->GetColumn(columnName);
-				statsKey.emplace_back(column.ExtractValue(object.Row, object.GroupByType, object.GroupByObject));
-			}
+		for (const String& columnName : m_Columns)
+			statsColumns.emplace_back(table->GetColumn(columnName));
 
-			auto it = allStats.find(statsKey);
+		for (const Aggregator::Ptr& aggregator : m_Aggregators)
+			aggregator->Compile(table);
 
-			if (it == allStats.end()) {
-				std::vector<AggregatorState *> newStats(m_Aggregators.size(), nullptr);
-				it = allStats.insert(std::make_pair(statsKey, newStats)).first;
+		/* every chunk aggregates into its own partial states which get merged in order afterwards */
+		std::vector<StatsMap> chunkStats (Table::GetChunkCount(objects.size()));
+		Table::ParallelForChunks(objects.size(), [this, &table, &objects, &statsColumns, &chunkStats](size_t chunk, size_t begin, size_t end) {
+			StatsMap& stats = chunkStats[chunk];
+
+			for (size_t i = begin; i < end; i++) {
+				const LivestatusRowValue& object = objects[i];
+				std::vector<Value> statsKey;
+
+				for (const Column& column : statsColumns)
+					statsKey.emplace_back(column.ExtractValue(object.Row, object.GroupByType, object.GroupByObject));
+
+				auto it = stats.find(statsKey);
+
+				if (it == stats.end()) {
+					std::vector<AggregatorState *> newStats(m_Aggregators.size(), nullptr);
+					it = stats.insert(std::make_pair(statsKey, newStats)).first;
+				}
+
+				int index = 0;
+
+				for (const Aggregator::Ptr& aggregator : m_Aggregators) {
+					aggregator->Apply(table, object.Row, &it->second[index]);
+					index++;
+				}
 			}
+		});
+
+		StatsMap allStats (std::move(chunkStats[0]));
 
-			auto& stats = it->second;
+		for (size_t chunk = 1; chunk < chunkStats.size(); chunk++) {
+			for (auto& kv : chunkStats[chunk]) {
+				auto it = allStats.find(kv.first);
 
-			int index = 0;
+				if (it == allStats.end()) {
+					allStats.insert(std::move(kv));
+					continue;
+				}
 
-			for (const Aggregator::Ptr& aggregator : m_Aggregators) {
-				aggregator->Apply(table, object.Row, &stats[index]);
-				index++;
+				for (size_t i = 0; i < m_Aggregators.size(); i++)
+					m_Aggregators[i]->MergeState(&it->second[i], kv.second[i]);
 			}
 		}
 
@@ -549,6 +594,7 @@ void LivestatusQuery::ExecuteGetHelper(const Stream::Ptr& stream)
 				row.push_back(m_Aggregators[i]->GetResultAndFreeState(stats[i]));
 
 			AppendResultRow(result, new Array(std::move(row)), first_row);
+			FlushResponseChunk(stream, result);
 		}
 
 		/* add a bogus zero value if aggregated is empty*/
@@ -567,7 +613,8 @@ void LivestatusQuery::ExecuteGetHelper(const Stream::Ptr& stream)
 
 	EndResultSet(result);
 
-	SendResponse(stream, LivestatusErrorOK, result.str());
+	FlushResponseChunk(stream, result, true);
+	FinishChunkedResponse(stream);
 }
 
 void LivestatusQuery::ExecuteCommandHelper(const Stream::Ptr& stream)
@@ -594,7 +641,7 @@ void LivestatusQuery::ExecuteErrorHelper(const Stream::Ptr& stream)
 void LivestatusQuery::SendResponse(const Stream::Ptr& stream, int code, const String& data)
 {
 	if (m_ResponseHeader == "fixed16")
-		PrintFixed16(stream, code, data);
+		PrintFixed16(stream, code, data.GetLength());
 
 	if (m_ResponseHeader == "fixed16" || code == LivestatusErrorOK) {
 		try {
@@ -605,12 +652,12 @@ void LivestatusQuery::SendResponse(const Stream::Ptr& stream, int code, const St
 	}
 }
 
-void LivestatusQuery::PrintFixed16(const Stream::Ptr& stream, int code, const String& data)
+void LivestatusQuery::PrintFixed16(const Stream::Ptr& stream, int code, size_t length)
 {
 	ASSERT(code >= 100 && code <= 999);
 
 	String sCode = Convert::ToString(code);
-	String sLength = Convert::ToString(static_cast<long>(data.GetLength()));
+	String sLength = Convert::ToString(static_cast<long>(length));
 
 	String header = sCode + String(16 - 3 - sLength.GetLength() - 1, ' ') + sLength + m_Separators[0];
 
@@ -621,6 +668,64 @@ void LivestatusQuery::PrintFixed16(const Stream::Ptr& stream, int code, const St
 	}
 }
 
+/**
+ * Sends a successful response's next chunk right away, or keeps it until
+ * FinishChunkedResponse() if the fixed16 header needs the total length first.
+ */
+void LivestatusQuery::SendResponseChunk(const Stream::Ptr& stream, std::string chunk)
+{
+	if (chunk.empty())
+		return;
+
+	if (m_ResponseHeader == "fixed16") {
+		m_ResponseLength += chunk.size();
+		m_ResponseChunks.emplace_back(std::move(chunk));
+		return;
+	}
+
+	if (m_ResponseFailed)
+		return;
+
+	try {
+		stream->Write(chunk.c_str(), chunk.size());
+	} catch (const std::exception&) {
+		Log(LogCritical, "LivestatusQuery", "Cannot write query response to socket.");
+		m_ResponseFailed = true;
+	}
+}
+
+/**
+ * Moves what has been written into fp into the response once it's big enough.
+ */
+void LivestatusQuery::FlushResponseChunk(const Stream::Ptr& stream, std::ostringstream& fp, bool force)
+{
+	if (!force && fp.tellp() < 64 * 1024)
+		return;
+
+	SendResponseChunk(stream, fp.str());
+	fp.str("");
+}
+
+void LivestatusQuery::FinishChunkedResponse(const Stream::Ptr& stream)
+{
+	if (m_ResponseHeader != "fixed16")
+		return;
+
+	PrintFixed16(stream, LivestatusErrorOK, m_ResponseLength);
+
+	for (const std::string& chunk : m_ResponseChunks) {
+		try {
+			stream->Write(chunk.c_str(), chunk.size());
+		} catch (const std::exception&) {
+			Log(LogCritical, "LivestatusQuery", "Cannot write query response to socket.");
+			break;
+		}
+	}
+
+	m_ResponseChunks.clear();
+	m_ResponseLength = 0;
+}
+
 bool LivestatusQuery::Execute(const Stream::Ptr& stream)
 {
 	try {
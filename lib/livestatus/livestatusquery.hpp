@@ -10,6 +10,8 @@
 #include "base/stream.hpp"
 #include "base/scriptframe.hpp"
 #include <deque>
+#include <sstream>
+#include <vector>
 
 using namespace icinga;
 
@@ -68,6 +70,11 @@ private:
 	unsigned long m_LogTimeUntil;
 	String m_CompatLogPath;
 
+	/* Response chunks kept back until the fixed16 header with their total length is sent. */
+	std::vector<std::string> m_ResponseChunks;
+	size_t m_ResponseLength{0};
+	bool m_ResponseFailed{false};
+
 	void BeginResultSet(std::ostream& fp) const;
 	void EndResultSet(std::ostream& fp) const;
 	void AppendResultRow(std::ostream& fp, const Array::Ptr& row, bool& first_row) const;
@@ -80,7 +87,11 @@ private:
 	void ExecuteErrorHelper(const Stream::Ptr& stream);
 
 	void SendResponse(const Stream::Ptr& stream, int code, const String& data);
-	void PrintFixed16(const Stream::Ptr& stream, int code, const String& data);
+	void PrintFixed16(const Stream::Ptr& stream, int code, size_t length);
+
+	void SendResponseChunk(const Stream::Ptr& stream, std::string chunk);
+	void FlushResponseChunk(const Stream::Ptr& stream, std::ostringstream& fp, bool force = false);
+	void FinishChunkedResponse(const Stream::Ptr& stream);
 
 	static Filter::Ptr ParseFilter(const String& params, unsigned long& from, unsigned long& until);
 };
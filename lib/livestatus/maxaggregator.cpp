@@ -18,7 +18,7 @@ MaxAggregatorState *MaxAggregator::EnsureState(AggregatorState **state)
 
 void MaxAggregator::Apply(const Table::Ptr& table, const Value& row, AggregatorState **state)
 {
-	Column column = table->GetColumn(m_MaxAttr);
+	const Column& column = table->GetColumn(m_MaxAttr);
 
 	Value value = column.ExtractValue(row);
 
@@ -36,3 +36,17 @@ double MaxAggregator::GetResultAndFreeState(AggregatorState *state) const
 
 	return result;
 }
+
+void MaxAggregator::MergeState(AggregatorState **state, AggregatorState *other) const
+{
+	if (!other)
+		return;
+
+	MaxAggregatorState *pstate = EnsureState(state);
+	auto *pother = static_cast<MaxAggregatorState *>(other);
+
+	if (pother->Max > pstate->Max)
+		pstate->Max = pother->Max;
+
+	delete pother;
+}
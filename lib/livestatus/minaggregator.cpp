@@ -18,7 +18,7 @@ MinAggregatorState *MinAggregator::EnsureState(AggregatorState **state)
 
 void MinAggregator::Apply(const Table::Ptr& table, const Value& row, AggregatorState **state)
 {
-	Column column = table->GetColumn(m_MinAttr);
+	const Column& column = table->GetColumn(m_MinAttr);
 
 	Value value = column.ExtractValue(row);
 
@@ -43,3 +43,17 @@ double MinAggregator::GetResultAndFreeState(AggregatorState *state) const
 
 	return result;
 }
+
+void MinAggregator::MergeState(AggregatorState **state, AggregatorState *other) const
+{
+	if (!other)
+		return;
+
+	MinAggregatorState *pstate = EnsureState(state);
+	auto *pother = static_cast<MinAggregatorState *>(other);
+
+	if (pother->Min < pstate->Min)
+		pstate->Min = pother->Min;
+
+	delete pother;
+}
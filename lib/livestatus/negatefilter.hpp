@@ -20,6 +20,7 @@ public:
 
 	NegateFilter(Filter::Ptr inner);
 
+	void Compile(const Table::Ptr& table) override;
 	bool Apply(const Table::Ptr& table, const Value& row) override;
 
 private:
@@ -1,6 +1,7 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "livestatus/orfilter.hpp"
+#include <set>
 
 using namespace icinga;
 
@@ -16,3 +17,28 @@ bool OrFilter::Apply(const Table::Ptr& table, const Value& row)
 
 	return false;
 }
+
+bool OrFilter::GetCandidateRows(const Table::Ptr& table, std::vector<Value>& rows)
+{
+	if (m_Filters.empty())
+		return false;
+
+	std::set<Object::Ptr> seen;
+
+	/* only the union of all sub filters' rows covers the result */
+	for (const Filter::Ptr& filter : m_Filters) {
+		std::vector<Value> candidates;
+
+		if (!filter->GetCandidateRows(table, candidates))
+			return false;
+
+		for (const Value& row : candidates) {
+			Object::Ptr object = row;
+
+			if (seen.insert(object).second)
+				rows.push_back(row);
+		}
+	}
+
+	return true;
+}
@@ -182,6 +182,45 @@ void ServicesTable::FetchRows(const AddRowFunction& addRowFn)
 	}
 }
 
+bool ServicesTable::FetchRowsByIndex(const String& column, const String& op, const String& operand, std::vector<Value>& rows)
+{
+	if (column == "host_name" && op == "=") {
+		Host::Ptr host = Host::GetByName(operand);
+
+		if (host) {
+			for (const Service::Ptr& service : host->GetServices()) {
+				rows.emplace_back(service);
+			}
+		}
+
+		return true;
+	} else if (column == "groups" && op == ">=") {
+		ServiceGroup::Ptr sg = ServiceGroup::GetByName(operand);
+
+		if (sg) {
+			for (const Service::Ptr& service : sg->GetMembers()) {
+				rows.emplace_back(service);
+			}
+		}
+
+		return true;
+	} else if (column == "host_groups" && op == ">=") {
+		HostGroup::Ptr hg = HostGroup::GetByName(operand);
+
+		if (hg) {
+			for (const Host::Ptr& host : hg->GetMembers()) {
+				for (const Service::Ptr& service : host->GetServices()) {
+					rows.emplace_back(service);
+				}
+			}
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
 Object::Ptr ServicesTable::HostAccessor(const Value& row, const Column::ObjectAccessor& parentObjectAccessor)
 {
 	Value service;
@@ -333,7 +372,7 @@ Value ServicesTable::PerfDataAccessor(const Value& row)
 	if (!cr)
 		return Empty;
 
-	return PluginUtility::FormatPerfdata(cr->GetPerformanceData());
+	return cr->GetFormattedPerformanceData();
 }
 
 Value ServicesTable::CheckPeriodAccessor(const Value& row)
@@ -548,8 +587,7 @@ Value ServicesTable::AcknowledgedAccessor(const Value& row)
 	if (!service)
 		return Empty;
 
-	ObjectLock olock(service);
-	return service->IsAcknowledged();
+	return service->GetStateSnapshot()->IsAcknowledged();
 }
 
 Value ServicesTable::AcknowledgementTypeAccessor(const Value& row)
@@ -559,8 +597,9 @@ Value ServicesTable::AcknowledgementTypeAccessor(const Value& row)
 	if (!service)
 		return Empty;
 
-	ObjectLock olock(service);
-	return service->GetAcknowledgement();
+	auto state (service->GetStateSnapshot());
+
+	return state->IsAcknowledged() ? state->Acknowledgement : AcknowledgementNone;
 }
 
 Value ServicesTable::NoMoreNotificationsAccessor(const Value& row)
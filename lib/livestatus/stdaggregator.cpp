@@ -19,7 +19,7 @@ StdAggregatorState *StdAggregator::EnsureState(AggregatorState **state)
 
 void StdAggregator::Apply(const Table::Ptr& table, const Value& row, AggregatorState **state)
 {
-	Column column = table->GetColumn(m_StdAttr);
+	const Column& column = table->GetColumn(m_StdAttr);
 
 	Value value = column.ExtractValue(row);
 
@@ -38,3 +38,18 @@ double StdAggregator::GetResultAndFreeState(AggregatorState *state) const
 
 	return result;
 }
+
+void StdAggregator::MergeState(AggregatorState **state, AggregatorState *other) const
+{
+	if (!other)
+		return;
+
+	StdAggregatorState *pstate = EnsureState(state);
+	auto *pother = static_cast<StdAggregatorState *>(other);
+
+	pstate->StdSum += pother->StdSum;
+	pstate->StdQSum += pother->StdQSum;
+	pstate->StdCount += pother->StdCount;
+
+	delete pother;
+}
@@ -18,7 +18,7 @@ SumAggregatorState *SumAggregator::EnsureState(AggregatorState **state)
 
 void SumAggregator::Apply(const Table::Ptr& table, const Value& row, AggregatorState **state)
 {
-	Column column = table->GetColumn(m_SumAttr);
+	const Column& column = table->GetColumn(m_SumAttr);
 
 	Value value = column.ExtractValue(row);
 
@@ -35,3 +35,16 @@ double SumAggregator::GetResultAndFreeState(AggregatorState *state) const
 
 	return result;
 }
+
+void SumAggregator::MergeState(AggregatorState **state, AggregatorState *other) const
+{
+	if (!other)
+		return;
+
+	SumAggregatorState *pstate = EnsureState(state);
+	auto *pother = static_cast<SumAggregatorState *>(other);
+
+	pstate->Sum += pother->Sum;
+
+	delete pother;
+}
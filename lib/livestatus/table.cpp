@@ -19,10 +19,16 @@
 #include "livestatus/filter.hpp"
 #include "base/array.hpp"
 #include "base/dictionary.hpp"
+#include "base/logger.hpp"
+#include "base/configuration.hpp"
+#include "base/workqueue.hpp"
 #include <boost/algorithm/string/case_conv.hpp>
 
 using namespace icinga;
 
+/* Below this many rows spreading them over threads costs more than it saves. */
+static const size_t l_ParallelRows = 10000;
+
 Table::Table(LivestatusGroupByType type)
 	: m_GroupByType(type), m_GroupByObject(Empty)
 { }
@@ -79,7 +85,7 @@ void Table::AddColumn(const String& name, const Column& column)
 		ret.first->second = column;
 }
 
-Column Table::GetColumn(const String& name) const
+const Column& Table::GetColumn(const String& name) const
 {
 	String dname = name;
 	String prefix = GetPrefix() + "_";
@@ -109,14 +115,128 @@ std::vector<String> Table::GetColumnNames() const
 std::vector<LivestatusRowValue> Table::FilterRows(const Filter::Ptr& filter, int limit)
 {
 	std::vector<LivestatusRowValue> rs;
+	std::vector<Value> candidates;
+
+	if (filter)
+		filter->Compile(this);
+
+	/* the filter is still applied to every candidate, the index only has to narrow the rows down */
+	if (filter && filter->GetCandidateRows(this, candidates)) {
+		Log(LogDebug, "Table")
+			<< "Filtering table '" << GetName() << "' by index lookup: " << candidates.size() << " candidate rows.";
+
+		for (const Value& row : candidates) {
+			if (!FilteredAddRow(rs, filter, limit, row, LivestatusGroupByNone, nullptr))
+				break;
+		}
+
+		return rs;
+	}
+
+	Log(LogDebug, "Table")
+		<< "Filtering table '" << GetName() << "' by full scan.";
 
-	FetchRows([this, filter, limit, &rs](const Value& row, LivestatusGroupByType groupByType, const Object::Ptr& groupByObject) {
-		return FilteredAddRow(rs, filter, limit, row, groupByType, groupByObject);
+	/* a limit stops at the first matching rows, everything else gets filtered in parallel */
+	if (!filter || limit != -1) {
+		FetchRows([this, filter, limit, &rs](const Value& row, LivestatusGroupByType groupByType, const Object::Ptr& groupByObject) {
+			return FilteredAddRow(rs, filter, limit, row, groupByType, groupByObject);
+		});
+
+		return rs;
+	}
+
+	std::vector<LivestatusRowValue> all;
+
+	FetchRows([&all](const Value& row, LivestatusGroupByType groupByType, const Object::Ptr& groupByObject) {
+		LivestatusRowValue rval;
+		rval.Row = row;
+		rval.GroupByType = groupByType;
+		rval.GroupByObject = groupByObject;
+
+		all.emplace_back(std::move(rval));
+		return true;
+	});
+
+	std::vector<char> matches (all.size(), 0);
+
+	ParallelForChunks(all.size(), [this, &filter, &all, &matches](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			matches[i] = filter->Apply(this, all[i].Row);
+		}
 	});
 
+	for (size_t i = 0; i < all.size(); i++) {
+		if (matches[i])
+			rs.emplace_back(std::move(all[i]));
+	}
+
 	return rs;
 }
 
+/**
+ * @returns The number of chunks ParallelForChunks() splits this many rows into.
+ */
+size_t Table::GetChunkCount(size_t count)
+{
+	return count < l_ParallelRows ? 1 : std::max<size_t>(Configuration::Concurrency, 1);
+}
+
+/**
+ * Splits [0, count) into GetChunkCount() consecutive chunks and runs func for each of them,
+ * in parallel if there are enough rows. Exceptions are rethrown in the calling thread.
+ */
+void Table::ParallelForChunks(size_t count, const std::function<void (size_t chunk, size_t begin, size_t end)>& func)
+{
+	size_t chunks = GetChunkCount(count);
+
+	if (chunks == 1) {
+		func(0, 0, count);
+		return;
+	}
+
+	std::vector<size_t> ids;
+
+	for (size_t i = 0; i < chunks; i++) {
+		ids.push_back(i);
+	}
+
+	WorkQueue wq (0, static_cast<int>(chunks), LogNotice);
+
+	wq.ParallelFor(ids, false, [count, chunks, &func](size_t chunk) {
+		func(chunk, count * chunk / chunks, count * (chunk + 1) / chunks);
+	});
+
+	wq.Join();
+
+	if (wq.HasExceptions())
+		boost::rethrow_exception(wq.GetExceptions().front());
+}
+
+/**
+ * Find all rows which may match "column op operand" without scanning the whole table.
+ *
+ * @returns false if there's no index for this column and operator.
+ */
+bool Table::LookupRows(const String& column, const String& op, const String& operand, std::vector<Value>& rows)
+{
+	/* rows of joined tables carry their group, these aren't indexed */
+	if (GetGroupByType() != LivestatusGroupByNone)
+		return false;
+
+	String dname = column;
+	String prefix = GetPrefix() + "_";
+
+	if (dname.Find(prefix) == 0)
+		dname = dname.SubStr(prefix.GetLength());
+
+	return FetchRowsByIndex(dname, op, operand, rows);
+}
+
+bool Table::FetchRowsByIndex(const String&, const String&, const String&, std::vector<Value>&)
+{
+	return false;
+}
+
 bool Table::FilteredAddRow(std::vector<LivestatusRowValue>& rs, const Filter::Ptr& filter, int limit, const Value& row, LivestatusGroupByType groupByType, const Object::Ptr& groupByObject)
 {
 	if (limit != -1 && static_cast<int>(rs.size()) == limit)
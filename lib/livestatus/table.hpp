@@ -39,9 +39,13 @@ public:
 	virtual String GetPrefix() const = 0;
 
 	std::vector<LivestatusRowValue> FilterRows(const intrusive_ptr<Filter>& filter, int limit = -1);
+	bool LookupRows(const String& column, const String& op, const String& operand, std::vector<Value>& rows);
+
+	static size_t GetChunkCount(size_t count);
+	static void ParallelForChunks(size_t count, const std::function<void (size_t chunk, size_t begin, size_t end)>& func);
 
 	void AddColumn(const String& name, const Column& column);
-	Column GetColumn(const String& name) const;
+	const Column& GetColumn(const String& name) const;
 	std::vector<String> GetColumnNames() const;
 
 	LivestatusGroupByType GetGroupByType() const;
@@ -50,6 +54,7 @@ protected:
 	Table(LivestatusGroupByType type = LivestatusGroupByNone);
 
 	virtual void FetchRows(const AddRowFunction& addRowFn) = 0;
+	virtual bool FetchRowsByIndex(const String& column, const String& op, const String& operand, std::vector<Value>& rows);
 
 	static Value ZeroAccessor(const Value&);
 	static Value OneAccessor(const Value&);
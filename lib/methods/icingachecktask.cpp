@@ -13,6 +13,7 @@
 #include "base/utility.hpp"
 #include "base/perfdatavalue.hpp"
 #include "base/function.hpp"
+#include "base/memoryusage.hpp"
 #include "base/configtype.hpp"
 
 using namespace icinga;
@@ -46,6 +47,9 @@ void IcingaCheckTask::ScriptFunc(const Checkable::Ptr& checkable, const CheckRes
 	String icingaMinVersion = MacroProcessor::ResolveMacros("$icinga_min_version$", resolvers, checkable->GetLastCheckResult(),
 		&missingIcingaMinVersion, MacroProcessor::EscapeCallback(), resolvedMacros, useResolvedMacros);
 
+	bool memoryPerfdata = MacroProcessor::ResolveMacros("$icinga_memory_perfdata$", resolvers, checkable->GetLastCheckResult(),
+		nullptr, MacroProcessor::EscapeCallback(), resolvedMacros, useResolvedMacros).ToBool();
+
 	if (resolvedMacros && !useResolvedMacros)
 		return;
 
@@ -81,6 +85,10 @@ void IcingaCheckTask::ScriptFunc(const Checkable::Ptr& checkable, const CheckRes
 	perfdata->Add(new PerfdataValue("current_concurrent_checks", Checkable::CurrentConcurrentChecks.load()));
 	perfdata->Add(new PerfdataValue("remote_check_queue", ClusterEvents::GetCheckRequestQueueSize()));
 
+	perfdata->Add(new PerfdataValue("reachability_cache_hits", Checkable::ReachabilityCacheHits.load(), true));
+	perfdata->Add(new PerfdataValue("reachability_cache_misses", Checkable::ReachabilityCacheMisses.load(), true));
+	perfdata->Add(new PerfdataValue("reachability_cache_invalidations", Checkable::ReachabilityCacheInvalidations.load(), true));
+
 	CheckableCheckStatistics scs = CIB::CalculateServiceCheckStats();
 
 	perfdata->Add(new PerfdataValue("min_latency", scs.min_latency));
@@ -149,6 +157,9 @@ void IcingaCheckTask::ScriptFunc(const Checkable::Ptr& checkable, const CheckRes
 	perfdata->Add(new PerfdataValue("sum_bytes_sent_per_second", bytesSentPerSecond));
 	perfdata->Add(new PerfdataValue("sum_bytes_received_per_second", bytesReceivedPerSecond));
 
+	if (memoryPerfdata)
+		MemoryUsage::AddPerfdata(perfdata);
+
 	cr->SetPerformanceData(perfdata);
 	ServiceState state = ServiceOK;
 
@@ -27,12 +27,101 @@
 #include <boost/beast/http.hpp>
 #include <boost/system/system_error.hpp>
 #include <exception>
+#include <map>
+#include <mutex>
 #include <set>
+#include <utility>
+#include <vector>
 
 using namespace icinga;
 
 REGISTER_FUNCTION_NONCONST(Internal, IfwApiCheck, &IfwApiCheckTask::ScriptFunc, "checkable:cr:resolvedMacros:useResolvedMacros");
 
+/**
+ * A TLS connection to an IfW API, kept open between checks.
+ */
+struct IfwApiConnection
+{
+	Shared<boost::asio::ssl::context>::Ptr SslContext;
+	Shared<AsioTlsStream>::Ptr Stream;
+	double IdleSince = 0;
+};
+
+/* The IfW API may close idle connections by itself, a reused one is replaced if it turns out to be closed. */
+static const double l_IfwApiIdleTimeout = 30;
+static const size_t l_IfwApiMaxIdleConnections = 16;
+
+/* Idle connections by host, port and TLS parameters, the most recently used one last. */
+static std::map<String, std::vector<IfwApiConnection>> l_IfwApiIdleConnections;
+static std::mutex l_IfwApiIdleConnectionsMutex;
+
+static void PruneIdleIfwApiConnections(double now)
+{
+	for (auto it (l_IfwApiIdleConnections.begin()); it != l_IfwApiIdleConnections.end();) {
+		auto& idle (it->second);
+		auto expired (idle.begin());
+
+		while (expired != idle.end() && now - expired->IdleSince >= l_IfwApiIdleTimeout) {
+			++expired;
+		}
+
+		idle.erase(idle.begin(), expired);
+
+		if (idle.empty()) {
+			it = l_IfwApiIdleConnections.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+/**
+ * Takes an idle connection to the given target out of the pool.
+ *
+ * @returns Whether there was one.
+ */
+static bool TakeIdleIfwApiConnection(const String& target, IfwApiConnection& connection)
+{
+	std::unique_lock<std::mutex> lock (l_IfwApiIdleConnectionsMutex);
+
+	PruneIdleIfwApiConnections(Utility::GetTime());
+
+	auto it (l_IfwApiIdleConnections.find(target));
+
+	if (it == l_IfwApiIdleConnections.end()) {
+		return false;
+	}
+
+	connection = std::move(it->second.back());
+	it->second.pop_back();
+
+	if (it->second.empty()) {
+		l_IfwApiIdleConnections.erase(it);
+	}
+
+	return true;
+}
+
+/**
+ * Gives a connection the response of which has been read completely back to the pool.
+ */
+static void PutIdleIfwApiConnection(const String& target, IfwApiConnection connection)
+{
+	connection.IdleSince = Utility::GetTime();
+
+	std::unique_lock<std::mutex> lock (l_IfwApiIdleConnectionsMutex);
+
+	PruneIdleIfwApiConnections(connection.IdleSince);
+
+	auto& idle (l_IfwApiIdleConnections[target]);
+
+	if (idle.size() >= l_IfwApiMaxIdleConnections) {
+		idle.erase(idle.begin());
+	}
+
+	idle.emplace_back(std::move(connection));
+}
+
 static void ReportIfwCheckResult(
 	const Checkable::Ptr& checkable, const Value& cmdLine, const CheckResult::Ptr& cr,
 	const String& output, double start, double end, int exitcode = 3, const Array::Ptr& perfdata = nullptr
@@ -82,11 +171,16 @@ static void ReportIfwCheckResult(
 	ReportIfwCheckResult(checkable, cmdLine, cr, output, start, end);
 }
 
-static const char* GetUnderstandableError(const std::exception& ex)
+static bool IsTimeout(const std::exception& ex)
 {
 	auto se (dynamic_cast<const boost::system::system_error*>(&ex));
 
-	if (se && se->code() == boost::asio::error::operation_aborted) {
+	return se && se->code() == boost::asio::error::operation_aborted;
+}
+
+static const char* GetUnderstandableError(const std::exception& ex)
+{
+	if (IsTimeout(ex)) {
 		return "Timeout exceeded";
 	}
 
@@ -96,7 +190,8 @@ static const char* GetUnderstandableError(const std::exception& ex)
 static void DoIfwNetIo(
 	boost::asio::yield_context yc, const Checkable::Ptr& checkable, const Array::Ptr& cmdLine,
 	const CheckResult::Ptr& cr, const String& psCommand, const String& psHost, const String& san, const String& psPort,
-	AsioTlsStream& conn, boost::beast::http::request<boost::beast::http::string_body>& req, double start
+	const String& target, IfwApiConnection& conn, boost::beast::http::request<boost::beast::http::string_body>& req,
+	double start
 )
 {
 	namespace http = boost::beast::http;
@@ -104,77 +199,104 @@ static void DoIfwNetIo(
 	boost::beast::flat_buffer buf;
 	http::response<http::string_body> resp;
 
-	try {
-		Connect(conn.lowest_layer(), psHost, psPort, yc);
-	} catch (const std::exception& ex) {
-		ReportIfwCheckResult(
-			yc, checkable, cmdLine, cr,
-			"Can't connect to IfW API on host '" + psHost + "' port '" + psPort + "': " + GetUnderstandableError(ex),
-			start
-		);
-		return;
-	}
+	// A connection taken from the pool may have been closed by the peer meanwhile, retry with a new one then.
+	bool reused = (bool)conn.Stream;
 
-	auto& sslConn (conn.next_layer());
+	for (;;) {
+		if (!conn.Stream) {
+			conn.Stream = Shared<AsioTlsStream>::Make(IoEngine::Get().GetIoContext(), *conn.SslContext, san);
 
-	try {
-		sslConn.async_handshake(conn.next_layer().client, yc);
-	} catch (const std::exception& ex) {
-		ReportIfwCheckResult(
-			yc, checkable, cmdLine, cr,
-			"TLS handshake with IfW API on host '" + psHost + "' (SNI: '" + san
-				+ "') port '" + psPort + "' failed: " + GetUnderstandableError(ex),
-			start
-		);
-		return;
-	}
+			try {
+				Connect(conn.Stream->lowest_layer(), psHost, psPort, yc);
+			} catch (const std::exception& ex) {
+				ReportIfwCheckResult(
+					yc, checkable, cmdLine, cr,
+					"Can't connect to IfW API on host '" + psHost + "' port '" + psPort + "': " + GetUnderstandableError(ex),
+					start
+				);
+				return;
+			}
 
-	if (!sslConn.IsVerifyOK()) {
-		auto cert (sslConn.GetPeerCertificate());
-		Value cn;
+			auto& sslConn (conn.Stream->next_layer());
+
+			try {
+				sslConn.async_handshake(sslConn.client, yc);
+			} catch (const std::exception& ex) {
+				ReportIfwCheckResult(
+					yc, checkable, cmdLine, cr,
+					"TLS handshake with IfW API on host '" + psHost + "' (SNI: '" + san
+						+ "') port '" + psPort + "' failed: " + GetUnderstandableError(ex),
+					start
+				);
+				return;
+			}
+
+			if (!sslConn.IsVerifyOK()) {
+				auto cert (sslConn.GetPeerCertificate());
+				Value cn;
+
+				try {
+					cn = GetCertificateCN(cert);
+				} catch (const std::exception&) {
+				}
+
+				ReportIfwCheckResult(
+					yc, checkable, cmdLine, cr,
+					"Certificate validation failed for IfW API on host '" + psHost + "' (SNI: '" + san + "'; CN: "
+						+ (cn.IsString() ? "'" + cn + "'" : "N/A") + ") port '" + psPort + "': " + sslConn.GetVerifyError(),
+					start
+				);
+				return;
+			}
+		}
 
 		try {
-			cn = GetCertificateCN(cert);
-		} catch (const std::exception&) {
+			http::async_write(*conn.Stream, req, yc);
+			conn.Stream->async_flush(yc);
+		} catch (const std::exception& ex) {
+			if (reused && !IsTimeout(ex)) {
+				reused = false;
+				conn.Stream = nullptr;
+				continue;
+			}
+
+			ReportIfwCheckResult(
+				yc, checkable, cmdLine, cr,
+				"Can't send HTTP request to IfW API on host '" + psHost + "' port '" + psPort + "': " + GetUnderstandableError(ex),
+				start
+			);
+			return;
 		}
 
-		ReportIfwCheckResult(
-			yc, checkable, cmdLine, cr,
-			"Certificate validation failed for IfW API on host '" + psHost + "' (SNI: '" + san + "'; CN: "
-				+ (cn.IsString() ? "'" + cn + "'" : "N/A") + ") port '" + psPort + "': " + sslConn.GetVerifyError(),
-			start
-		);
-		return;
-	}
+		try {
+			http::async_read(*conn.Stream, buf, resp, yc);
+		} catch (const std::exception& ex) {
+			if (reused && !IsTimeout(ex)) {
+				reused = false;
+				conn.Stream = nullptr;
+				buf.consume(buf.size());
+				resp = http::response<http::string_body>();
+				continue;
+			}
 
-	try {
-		http::async_write(conn, req, yc);
-		conn.async_flush(yc);
-	} catch (const std::exception& ex) {
-		ReportIfwCheckResult(
-			yc, checkable, cmdLine, cr,
-			"Can't send HTTP request to IfW API on host '" + psHost + "' port '" + psPort + "': " + GetUnderstandableError(ex),
-			start
-		);
-		return;
-	}
+			ReportIfwCheckResult(
+				yc, checkable, cmdLine, cr,
+				"Can't read HTTP response from IfW API on host '" + psHost + "' port '" + psPort + "': " + GetUnderstandableError(ex),
+				start
+			);
+			return;
+		}
 
-	try {
-		http::async_read(conn, buf, resp, yc);
-	} catch (const std::exception& ex) {
-		ReportIfwCheckResult(
-			yc, checkable, cmdLine, cr,
-			"Can't read HTTP response from IfW API on host '" + psHost + "' port '" + psPort + "': " + GetUnderstandableError(ex),
-			start
-		);
-		return;
+		break;
 	}
 
 	double end = Utility::GetTime();
 
-	{
+	if (!resp.need_eof() && !buf.size()) {
+		PutIdleIfwApiConnection(target, std::move(conn));
+	} else {
 		boost::system::error_code ec;
-		sslConn.async_shutdown(yc[ec]);
+		conn.Stream->next_layer().async_shutdown(yc[ec]);
 	}
 
 	CpuBoundWork cbw (yc);
@@ -462,6 +584,7 @@ void IfwApiCheckTask::ScriptFunc(const Checkable::Ptr& checkable, const CheckRes
 	req->set(field::content_type, "application/json");
 	req->set(field::host, expectedSan + ":" + psPort);
 	req->set(field::user_agent, userAgent);
+	req->keep_alive(true);
 	req->body() = body;
 	req->content_length(req->body().size());
 
@@ -497,35 +620,41 @@ void IfwApiCheckTask::ScriptFunc(const Checkable::Ptr& checkable, const CheckRes
 
 	auto& io (IoEngine::Get().GetIoContext());
 	auto strand (Shared<asio::io_context::strand>::Make(io));
-	Shared<asio::ssl::context>::Ptr ctx;
+	auto target (psHost + "\n" + psPort + "\n" + expectedSan + "\n" + cert + "\n" + key + "\n" + ca + "\n" + crl);
+	IfwApiConnection conn;
 	double start = Utility::GetTime();
 
-	try {
-		ctx = SetupSslContext(cert, key, ca, crl, DEFAULT_TLS_CIPHERS, DEFAULT_TLS_PROTOCOLMIN, DebugInfo());
-	} catch (const std::exception& ex) {
-		ReportIfwCheckResult(checkable, cmdLine, cr, ex.what(), start, Utility::GetTime());
-		return;
+	if (!TakeIdleIfwApiConnection(target, conn)) {
+		try {
+			conn.SslContext = SetupSslContext(cert, key, ca, crl, DEFAULT_TLS_CIPHERS, DEFAULT_TLS_PROTOCOLMIN, DebugInfo());
+		} catch (const std::exception& ex) {
+			ReportIfwCheckResult(checkable, cmdLine, cr, ex.what(), start, Utility::GetTime());
+			return;
+		}
 	}
 
-	auto conn (Shared<AsioTlsStream>::Make(io, *ctx, expectedSan));
-
 	IoEngine::SpawnCoroutine(
 		*strand,
-		[strand, checkable, cmdLine, cr, psCommand, psHost, expectedSan, psPort, conn, req, start, checkTimeout](asio::yield_context yc) {
+		[strand, checkable, cmdLine, cr, psCommand, psHost, expectedSan, psPort, target, conn, req, start, checkTimeout](asio::yield_context yc) {
+			IfwApiConnection connection (conn);
+
 			Timeout::Ptr timeout = new Timeout(strand->context(), *strand, boost::posix_time::microseconds(int64_t(checkTimeout * 1e6)),
-				[&conn, &checkable](boost::asio::yield_context yc) {
+				[&connection, &checkable](boost::asio::yield_context yc) {
 					Log(LogNotice, "IfwApiCheckTask")
 						<< "Timeout while checking " << checkable->GetReflectionType()->GetName()
 						<< " '" << checkable->GetName() << "', cancelling attempt";
 
-					boost::system::error_code ec;
-					conn->lowest_layer().cancel(ec);
+					// Already back in the pool otherwise
+					if (connection.Stream) {
+						boost::system::error_code ec;
+						connection.Stream->lowest_layer().cancel(ec);
+					}
 				}
 			);
 
 			Defer cancelTimeout ([&timeout]() { timeout->Cancel(); });
 
-			DoIfwNetIo(yc, checkable, cmdLine, cr, psCommand, psHost, expectedSan, psPort, *conn, *req, start);
+			DoIfwNetIo(yc, checkable, cmdLine, cr, psCommand, psHost, expectedSan, psPort, target, connection, *req, start);
 		}
 	);
 }
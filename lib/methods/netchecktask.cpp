@@ -0,0 +1,1040 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef _WIN32
+#	include <sys/socket.h>
+#	include <netinet/in.h>
+#endif /* _WIN32 */
+#include "methods/netchecktask.hpp"
+#include "methods/pluginchecktask.hpp"
+#include "icinga/checkresult-ti.hpp"
+#include "icinga/pluginutility.hpp"
+#include "base/application.hpp"
+#include "base/base64.hpp"
+#include "base/convert.hpp"
+#include "base/defer.hpp"
+#include "base/function.hpp"
+#include "base/io-engine.hpp"
+#include "base/logger.hpp"
+#include "base/objectlock.hpp"
+#include "base/shared.hpp"
+#include "base/tcpsocket.hpp"
+#include "base/tlsstream.hpp"
+#include "base/tlsutility.hpp"
+#include "base/utility.hpp"
+#include "remote/apilistener.hpp"
+#include <boost/asio.hpp>
+#include <boost/asio/ip/icmp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/system/system_error.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+using namespace icinga;
+
+REGISTER_FUNCTION_NONCONST(Internal, NativeTcpCheck, &NetCheckTask::TcpScriptFunc, "checkable:cr:resolvedMacros:useResolvedMacros");
+REGISTER_FUNCTION_NONCONST(Internal, NativeHttpCheck, &NetCheckTask::HttpScriptFunc, "checkable:cr:resolvedMacros:useResolvedMacros");
+REGISTER_FUNCTION_NONCONST(Internal, NativePingCheck, &NetCheckTask::PingScriptFunc, "checkable:cr:resolvedMacros:useResolvedMacros");
+
+typedef std::function<Value(const char*)> NetCheckMacroResolver;
+
+struct NativeTcpCheckParams
+{
+	String Address;
+	String Port;
+	String Send;
+	String Quit;
+	std::vector<String> Expect;
+	bool ExpectAll;
+	ServiceState RefuseState;
+	ServiceState MismatchState;
+	Value WarnTime;
+	Value CritTime;
+	double Timeout;
+	size_t MaxBytes;
+};
+
+struct NativeHttpCheckParams
+{
+	String Address;
+	String Port;
+	String VHost;
+	String Uri;
+	String AuthPair;
+	boost::beast::http::verb Method;
+	bool Ssl;
+	bool Sni;
+	std::vector<String> Expect;
+	String ExpectContent;
+	Value WarnTime;
+	Value CritTime;
+	double Timeout;
+};
+
+struct NativePingCheckParams
+{
+	String Address;
+	size_t Packets;
+	double WarnRta;
+	double CritRta;
+	double WarnPl;
+	double CritPl;
+	double Timeout;
+};
+
+/**
+ * State shared by the sending and the receiving coroutine of one native ping check.
+ * Both run on the same strand, so no locking is required.
+ */
+struct NativePingCheckState
+{
+	NativePingCheckState(boost::asio::io_context& io)
+		: Socket(io), Timer(io)
+	{
+	}
+
+	boost::asio::ip::icmp::socket Socket;
+	boost::asio::deadline_timer Timer;
+	std::vector<double> Sent;
+	std::vector<bool> Replied;
+	size_t Received = 0;
+	double RttSum = 0;
+	bool Raw = true;
+	bool V6 = false;
+	bool Done = false;
+	uint16_t Identifier = 0;
+};
+
+/* Minimum interval between two echo requests, as enforced by ping(8) for unprivileged users. */
+static const double l_NativePingInterval = 0.2;
+
+static std::atomic<uint16_t> l_NativePingIdentifier (Utility::Random());
+
+static void ReportNetCheckResult(
+	const Checkable::Ptr& checkable, const Value& cmdLine, const CheckResult::Ptr& cr,
+	const String& output, double start, double end, int exitcode = 3, const Array::Ptr& perfdata = nullptr
+)
+{
+	if (Checkable::ExecuteCommandProcessFinishedHandler) {
+		ProcessResult pr;
+		pr.PID = -1;
+		pr.Output = perfdata ? output + " |" + String(perfdata->Join(" ")) : output;
+		pr.ExecutionStart = start;
+		pr.ExecutionEnd = end;
+		pr.ExitStatus = exitcode;
+
+		Checkable::ExecuteCommandProcessFinishedHandler(cmdLine, pr);
+	} else {
+		auto splittedPerfdata (perfdata);
+
+		if (perfdata) {
+			splittedPerfdata = new Array();
+			ObjectLock oLock (perfdata);
+
+			for (String pv : perfdata) {
+				PluginUtility::SplitPerfdata(pv)->CopyTo(splittedPerfdata);
+			}
+		}
+
+		cr->SetOutput(output);
+		cr->SetPerformanceData(splittedPerfdata);
+		cr->SetState((ServiceState)exitcode);
+		cr->SetExitStatus(exitcode);
+		cr->SetExecutionStart(start);
+		cr->SetExecutionEnd(end);
+		cr->SetCommand(cmdLine);
+
+		checkable->ProcessCheckResult(cr);
+	}
+}
+
+static void ReportNetCheckResult(
+	boost::asio::yield_context yc, const Checkable::Ptr& checkable, const Value& cmdLine, const CheckResult::Ptr& cr,
+	const String& output, double start, double end, int exitcode = 3, const Array::Ptr& perfdata = nullptr
+)
+{
+	CpuBoundWork cbw (yc);
+
+	ReportNetCheckResult(checkable, cmdLine, cr, output, start, end, exitcode, perfdata);
+}
+
+/**
+ * Formats a performance data value with six decimal places as the Monitoring Plugins' fperfdata() does.
+ */
+static String FormatNetCheckPerfdata(const String& label, double value, const char* unit,
+	const Value& warn, const Value& crit, const Value& min, const Value& max)
+{
+	std::ostringstream msgbuf;
+
+	msgbuf << std::fixed << std::setprecision(6) << label << "=" << value << unit << ";";
+
+	if (!warn.IsEmpty())
+		msgbuf << Convert::ToDouble(warn);
+
+	msgbuf << ";";
+
+	if (!crit.IsEmpty())
+		msgbuf << Convert::ToDouble(crit);
+
+	msgbuf << ";";
+
+	if (!min.IsEmpty())
+		msgbuf << Convert::ToDouble(min);
+
+	if (!max.IsEmpty())
+		msgbuf << ";" << Convert::ToDouble(max);
+
+	return msgbuf.str();
+}
+
+static String FormatNetCheckDuration(double seconds)
+{
+	std::ostringstream msgbuf;
+
+	msgbuf << std::fixed << std::setprecision(3) << seconds;
+
+	return msgbuf.str();
+}
+
+static const char *NetCheckStateToString(int state)
+{
+	switch (state) {
+		case ServiceOK:
+			return "OK";
+		case ServiceWarning:
+			return "WARNING";
+		case ServiceCritical:
+			return "CRITICAL";
+		default:
+			return "UNKNOWN";
+	}
+}
+
+static ServiceState NetCheckParseState(const String& state, ServiceState defaultState)
+{
+	if (state == "ok")
+		return ServiceOK;
+	else if (state == "warn")
+		return ServiceWarning;
+	else if (state == "crit")
+		return ServiceCritical;
+
+	return defaultState;
+}
+
+static std::vector<String> NetCheckToStringList(const Value& value)
+{
+	std::vector<String> result;
+
+	if (value.IsObjectType<Array>()) {
+		Array::Ptr arr = value;
+		ObjectLock oLock (arr);
+
+		for (const Value& item : arr) {
+			if (!item.IsEmpty())
+				result.emplace_back(item);
+		}
+	} else if (!value.IsEmpty()) {
+		result.emplace_back(value);
+	}
+
+	return result;
+}
+
+static bool IsNetCheckResolveError(const boost::system::error_code& ec)
+{
+	return ec.category() == boost::asio::error::get_netdb_category()
+		|| ec.category() == boost::asio::error::get_addrinfo_category();
+}
+
+/**
+ * Delegates to PluginCheckTask if the command endpoint which is going to execute
+ * the check doesn't implement the native check tasks, yet.
+ *
+ * @returns Whether the check has been delegated
+ */
+static bool DelegateNetCheck(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr,
+	const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros)
+{
+	if (resolvedMacros && !useResolvedMacros) {
+		auto commandEndpoint (checkable->GetCommandEndpoint());
+
+		if (commandEndpoint && !(commandEndpoint->GetCapabilities() & (uint_fast64_t)ApiCapabilities::NativeNetCheckCommands)) {
+			/* Assume the native check command template has been imported into a check command
+			 * which can also work based on "plugin-check-command", e.g. "tcp".
+			 */
+			PluginCheckTask::ScriptFunc(checkable, cr, resolvedMacros, useResolvedMacros);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static NetCheckMacroResolver GetNetCheckMacroResolver(const Checkable::Ptr& checkable, const CheckCommand::Ptr& command,
+	const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros)
+{
+	Host::Ptr host;
+	Service::Ptr service;
+	tie(host, service) = GetHostService(checkable);
+
+	MacroProcessor::ResolverList resolvers;
+
+	if (MacroResolver::OverrideMacros)
+		resolvers.emplace_back("override", MacroResolver::OverrideMacros);
+
+	if (service)
+		resolvers.emplace_back("service", service);
+	resolvers.emplace_back("host", host);
+	resolvers.emplace_back("command", command);
+
+	auto lcr (checkable->GetLastCheckResult());
+
+	return [resolvers, lcr, resolvedMacros, useResolvedMacros](const char* macros) -> Value {
+		/* All custom variables are optional, don't warn about undefined ones. */
+		String missingMacro;
+
+		return MacroProcessor::ResolveMacros(
+			macros, resolvers, lcr, &missingMacro, MacroProcessor::EscapeCallback(), resolvedMacros, useResolvedMacros
+		);
+	};
+}
+
+/**
+ * @returns The timeout of the check command (or the checkable's override),
+ *          reduced to the plugin-style timeout custom variable if any
+ */
+static double GetNetCheckTimeout(const Checkable::Ptr& checkable, const CheckCommand::Ptr& command, const Value& pluginTimeout)
+{
+	double checkTimeout = command->GetTimeout();
+	auto checkableTimeout (checkable->GetCheckTimeout());
+
+	if (!checkableTimeout.IsEmpty())
+		checkTimeout = checkableTimeout;
+
+	if (!pluginTimeout.IsEmpty()) {
+		double timeout = Convert::ToDouble(pluginTimeout);
+
+		if (timeout > 0 && timeout < checkTimeout)
+			checkTimeout = timeout;
+	}
+
+	return checkTimeout;
+}
+
+static ServiceState GetNetCheckTimeState(double elapsed, const Value& warn, const Value& crit)
+{
+	if (!crit.IsEmpty() && elapsed > Convert::ToDouble(crit))
+		return ServiceCritical;
+
+	if (!warn.IsEmpty() && elapsed > Convert::ToDouble(warn))
+		return ServiceWarning;
+
+	return ServiceOK;
+}
+
+static void DoNativeTcpCheck(
+	boost::asio::yield_context yc, const Checkable::Ptr& checkable, const Value& cmdLine, const CheckResult::Ptr& cr,
+	boost::asio::ip::tcp::socket& socket, const NativeTcpCheckParams& params, const bool& timedOut, double start
+)
+{
+	namespace asio = boost::asio;
+
+	auto reportError ([&](const boost::system::error_code& ec) {
+		double end = Utility::GetTime();
+
+		if (timedOut) {
+			ReportNetCheckResult(yc, checkable, cmdLine, cr,
+				"CRITICAL - Socket timeout after " + Convert::ToString(params.Timeout) + " seconds", start, end, ServiceCritical);
+		} else if (IsNetCheckResolveError(ec)) {
+			ReportNetCheckResult(yc, checkable, cmdLine, cr,
+				"Invalid hostname, address or socket: " + params.Address, start, end, ServiceUnknown);
+		} else if (ec == asio::error::connection_refused) {
+			ReportNetCheckResult(yc, checkable, cmdLine, cr,
+				"connect to address " + params.Address + " and port " + params.Port + ": Connection refused",
+				start, end, params.RefuseState);
+		} else {
+			ReportNetCheckResult(yc, checkable, cmdLine, cr,
+				"connect to address " + params.Address + " and port " + params.Port + ": " + ec.message(),
+				start, end, ServiceCritical);
+		}
+	});
+
+	try {
+		Connect(socket, params.Address, params.Port, yc);
+	} catch (const boost::system::system_error& ex) {
+		reportError(ex.code());
+		return;
+	}
+
+	boost::system::error_code ec;
+
+	if (!params.Send.IsEmpty()) {
+		asio::async_write(socket, asio::buffer(params.Send.CStr(), params.Send.GetLength()), yc[ec]);
+
+		if (ec) {
+			reportError(ec);
+			return;
+		}
+	}
+
+	std::string response;
+	bool matched = true;
+
+	if (!params.Expect.empty()) {
+		auto isMatched ([&params, &response]() {
+			auto found ([&response](const String& expect) { return response.find(expect.GetData()) != std::string::npos; });
+
+			return params.ExpectAll
+				? std::all_of(params.Expect.begin(), params.Expect.end(), found)
+				: std::any_of(params.Expect.begin(), params.Expect.end(), found);
+		});
+
+		char buf[4096];
+
+		matched = false;
+
+		while (response.size() < params.MaxBytes) {
+			size_t bytesRead = socket.async_read_some(
+				asio::buffer(buf, std::min(sizeof(buf), params.MaxBytes - response.size())), yc[ec]
+			);
+
+			if (ec == asio::error::eof)
+				break;
+
+			if (ec) {
+				reportError(ec);
+				return;
+			}
+
+			response.append(buf, bytesRead);
+
+			if (isMatched()) {
+				matched = true;
+				break;
+			}
+		}
+	}
+
+	if (!params.Quit.IsEmpty())
+		asio::async_write(socket, asio::buffer(params.Quit.CStr(), params.Quit.GetLength()), yc[ec]);
+
+	socket.shutdown(socket.shutdown_both, ec);
+
+	double end = Utility::GetTime();
+	double elapsed = end - start;
+
+	CpuBoundWork cbw (yc);
+
+	Array::Ptr perfdata = new Array({
+		FormatNetCheckPerfdata("time", elapsed, "s", params.WarnTime, params.CritTime, 0, params.Timeout)
+	});
+
+	if (!matched) {
+		String output = String("TCP ") + NetCheckStateToString(params.MismatchState) + " - ";
+
+		if (response.empty())
+			output += "No data received from host";
+		else
+			output += "Unexpected response from host/socket: " + String(std::move(response));
+
+		ReportNetCheckResult(checkable, cmdLine, cr, output, start, end, params.MismatchState, perfdata);
+		return;
+	}
+
+	ServiceState state = GetNetCheckTimeState(elapsed, params.WarnTime, params.CritTime);
+
+	ReportNetCheckResult(checkable, cmdLine, cr,
+		String("TCP ") + NetCheckStateToString(state) + " - " + FormatNetCheckDuration(elapsed)
+			+ " second response time on " + params.Address + " port " + params.Port,
+		start, end, state, perfdata);
+}
+
+static void NativeHttpCheckHandshake(AsioTcpStream&, boost::asio::yield_context)
+{
+}
+
+static void NativeHttpCheckHandshake(AsioTlsStream& conn, boost::asio::yield_context yc)
+{
+	auto& sslConn (conn.next_layer());
+
+	sslConn.async_handshake(sslConn.client, yc);
+}
+
+template<class Stream>
+static void DoNativeHttpCheck(
+	boost::asio::yield_context yc, const Checkable::Ptr& checkable, const Value& cmdLine, const CheckResult::Ptr& cr,
+	Stream& conn, const NativeHttpCheckParams& params, const bool& timedOut, double start
+)
+{
+	namespace http = boost::beast::http;
+	using http::field;
+
+	static const auto userAgent ("Icinga/" + Application::GetAppVersion());
+
+	String url = (params.Ssl ? "https://" : "http://") + params.VHost + ":" + params.Port + params.Uri;
+
+	auto reportError ([&](const boost::system::error_code& ec) {
+		double end = Utility::GetTime();
+
+		if (timedOut) {
+			ReportNetCheckResult(yc, checkable, cmdLine, cr,
+				"CRITICAL - Socket timeout after " + Convert::ToString(params.Timeout) + " seconds", start, end, ServiceCritical);
+		} else if (IsNetCheckResolveError(ec)) {
+			ReportNetCheckResult(yc, checkable, cmdLine, cr,
+				"Name or service not known: " + params.Address, start, end, ServiceUnknown);
+		} else {
+			ReportNetCheckResult(yc, checkable, cmdLine, cr,
+				"HTTP CRITICAL - Unable to open TCP socket to " + params.Address + " port " + params.Port + ": " + ec.message(),
+				start, end, ServiceCritical);
+		}
+	});
+
+	http::request<http::empty_body> req;
+
+	req.method(params.Method);
+	req.target(params.Uri.GetData());
+	req.set(field::host, params.VHost.GetData());
+	req.set(field::user_agent, userAgent.GetData());
+	req.set(field::connection, "close");
+
+	if (!params.AuthPair.IsEmpty())
+		req.set(field::authorization, ("Basic " + Base64::Encode(params.AuthPair)).GetData());
+
+	boost::beast::flat_buffer buf;
+	http::response_parser<http::string_body> parser;
+
+	if (params.Method == http::verb::head)
+		parser.skip(true);
+
+	size_t pageLength;
+
+	try {
+		Connect(conn.lowest_layer(), params.Address, params.Port, yc);
+		NativeHttpCheckHandshake(conn, yc);
+
+		http::async_write(conn, req, yc);
+		conn.async_flush(yc);
+
+		pageLength = http::async_read(conn, buf, parser, yc);
+	} catch (const boost::system::system_error& ex) {
+		reportError(ex.code());
+		return;
+	}
+
+	double end = Utility::GetTime();
+	double elapsed = end - start;
+
+	{
+		boost::system::error_code ec;
+		conn.lowest_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+	}
+
+	CpuBoundWork cbw (yc);
+
+	auto& resp (parser.get());
+	unsigned int status = resp.result_int();
+
+	std::ostringstream msgbuf;
+	msgbuf << "HTTP/" << resp.version() / 10 << "." << resp.version() % 10 << " " << status;
+
+	if (!resp.reason().empty())
+		msgbuf << " " << resp.reason();
+
+	String statusLine = msgbuf.str();
+
+	Array::Ptr perfdata = new Array({
+		FormatNetCheckPerfdata("time", elapsed, "s", params.WarnTime, params.CritTime, 0, params.Timeout),
+		"size=" + Convert::ToString(pageLength) + "B;;;0"
+	});
+
+	if (!params.Expect.empty()) {
+		bool found = std::any_of(params.Expect.begin(), params.Expect.end(), [&statusLine](const String& expect) {
+			return statusLine.Find(expect) != String::NPos;
+		});
+
+		if (!found) {
+			ReportNetCheckResult(checkable, cmdLine, cr,
+				"HTTP CRITICAL - Invalid HTTP response received from host on port " + params.Port + ": " + statusLine,
+				start, end, ServiceCritical, perfdata);
+			return;
+		}
+	}
+
+	ServiceState state = ServiceOK;
+
+	if (status < 100 || status >= 600) {
+		ReportNetCheckResult(checkable, cmdLine, cr,
+			"HTTP CRITICAL: Invalid Status (" + statusLine + ")", start, end, ServiceCritical, perfdata);
+		return;
+	} else if (params.Expect.empty()) {
+		if (status >= 500)
+			state = ServiceCritical;
+		else if (status >= 400)
+			state = ServiceWarning;
+	}
+
+	String details;
+
+	if (!params.ExpectContent.IsEmpty() && resp.body().find(params.ExpectContent.GetData()) == std::string::npos) {
+		state = ServiceCritical;
+		details = " - string '" + params.ExpectContent + "' not found on '" + url + "'";
+	}
+
+	state = std::max(state, GetNetCheckTimeState(elapsed, params.WarnTime, params.CritTime));
+
+	ReportNetCheckResult(checkable, cmdLine, cr,
+		String("HTTP ") + NetCheckStateToString(state) + ": " + statusLine + details + " - "
+			+ Convert::ToString(pageLength) + " bytes in " + FormatNetCheckDuration(elapsed) + " second response time",
+		start, end, state, perfdata);
+}
+
+static uint16_t GetNativePingChecksum(const unsigned char *data, size_t length)
+{
+	uint32_t sum = 0;
+
+	for (size_t i = 0; i + 1u < length; i += 2u)
+		sum += (data[i] << 8u) | data[i + 1u];
+
+	if (length & 1u)
+		sum += data[length - 1u] << 8u;
+
+	while (sum >> 16u)
+		sum = (sum & 0xffffu) + (sum >> 16u);
+
+	return ~sum;
+}
+
+static void ReceiveNativePingReplies(boost::asio::yield_context yc, const Shared<NativePingCheckState>::Ptr& state)
+{
+	namespace asio = boost::asio;
+
+	unsigned char buf[1500];
+	asio::ip::icmp::endpoint sender;
+	const unsigned char replyType = state->V6 ? 129 : 0;
+
+	while (!state->Done) {
+		boost::system::error_code ec;
+		size_t length = state->Socket.async_receive_from(asio::buffer(buf), sender, yc[ec]);
+
+		if (ec)
+			break;
+
+		double now = Utility::GetTime();
+
+		/* Raw IPv4 sockets deliver the IP header, too. */
+		size_t offset = state->Raw && !state->V6 ? (buf[0] & 0x0fu) * 4u : 0;
+
+		if (length < offset + 8u || buf[offset] != replyType || buf[offset + 1u] != 0)
+			continue;
+
+		/* Datagram ICMP sockets rewrite the identifier and only receive their own replies. */
+		if (state->Raw && ((buf[offset + 4u] << 8u) | buf[offset + 5u]) != state->Identifier)
+			continue;
+
+		size_t sequence = (buf[offset + 6u] << 8u) | buf[offset + 7u];
+
+		if (sequence >= state->Sent.size() || state->Replied[sequence])
+			continue;
+
+		state->Replied[sequence] = true;
+		state->RttSum += now - state->Sent[sequence];
+
+		if (++state->Received == state->Replied.size()) {
+			state->Timer.cancel(ec);
+			break;
+		}
+	}
+}
+
+static void DoNativePingCheck(
+	boost::asio::yield_context yc, boost::asio::io_context::strand& strand, const Checkable::Ptr& checkable,
+	const Value& cmdLine, const CheckResult::Ptr& cr, const Shared<NativePingCheckState>::Ptr& state,
+	const NativePingCheckParams& params, const bool& timedOut, double start
+)
+{
+	namespace asio = boost::asio;
+	using asio::ip::icmp;
+
+	icmp::endpoint target;
+
+	try {
+		asio::ip::tcp::resolver resolver (strand.context());
+		auto result (resolver.async_resolve(params.Address.GetData(), "", yc));
+
+		target = icmp::endpoint(result.begin()->endpoint().address(), 0);
+	} catch (const std::exception&) {
+		ReportNetCheckResult(yc, checkable, cmdLine, cr,
+			timedOut ? "CRITICAL - Plugin timed out after " + Convert::ToString(params.Timeout) + " seconds"
+				: "check_ping: Invalid hostname/address - " + params.Address,
+			start, Utility::GetTime(), timedOut ? ServiceCritical : ServiceUnknown);
+		return;
+	}
+
+	auto protocol (target.protocol());
+
+	state->V6 = protocol == icmp::v6();
+
+	try {
+#ifdef __linux__
+		/* Prefer unprivileged ICMP sockets (see net.ipv4.ping_group_range), fall back to raw ones. */
+		int fd = socket(protocol.family(), SOCK_DGRAM | SOCK_CLOEXEC, protocol.protocol());
+
+		if (fd >= 0) {
+			state->Socket.assign(protocol, fd);
+			state->Raw = false;
+		} else
+#endif /* __linux__ */
+		{
+			state->Socket.open(protocol);
+		}
+	} catch (const std::exception& ex) {
+		ReportNetCheckResult(yc, checkable, cmdLine, cr,
+			String("PING UNKNOWN - Cannot open ICMP socket: ") + ex.what(), start, Utility::GetTime(), ServiceUnknown);
+		return;
+	}
+
+	state->Identifier = l_NativePingIdentifier.fetch_add(1);
+	state->Replied.resize(params.Packets);
+
+	IoEngine::SpawnCoroutine(strand, [state](asio::yield_context yc) {
+		ReceiveNativePingReplies(yc, state);
+	});
+
+	unsigned char packet[64] = {};
+
+	packet[0] = state->V6 ? 128 : 8;
+	packet[4] = state->Identifier >> 8u;
+	packet[5] = state->Identifier & 0xffu;
+
+	boost::system::error_code ec;
+
+	for (size_t sequence = 0; sequence < params.Packets && !timedOut; ++sequence) {
+		packet[2] = packet[3] = 0;
+		packet[6] = sequence >> 8u;
+		packet[7] = sequence & 0xffu;
+
+		/* The kernel calculates ICMPv6 checksums itself. */
+		if (!state->V6) {
+			uint16_t checksum = GetNativePingChecksum(packet, sizeof(packet));
+
+			packet[2] = checksum >> 8u;
+			packet[3] = checksum & 0xffu;
+		}
+
+		state->Sent.emplace_back(Utility::GetTime());
+		state->Socket.async_send_to(asio::buffer(packet), target, yc[ec]);
+
+		if (ec)
+			break;
+
+		if (sequence + 1u < params.Packets) {
+			state->Timer.expires_from_now(boost::posix_time::microseconds(int64_t(l_NativePingInterval * 1e6)));
+			state->Timer.async_wait(yc[ec]);
+		}
+	}
+
+	/* Replies slower than twice the critical RTA count as lost. */
+	if (!ec && !timedOut && state->Received < state->Replied.size()) {
+		double linger = std::max(1.0, params.CritRta * 2 / 1000);
+
+		state->Timer.expires_from_now(boost::posix_time::microseconds(int64_t(linger * 1e6)));
+		state->Timer.async_wait(yc[ec]);
+	}
+
+	state->Done = true;
+	state->Socket.cancel(ec);
+
+	double end = Utility::GetTime();
+
+	if (state->Sent.empty()) {
+		ReportNetCheckResult(yc, checkable, cmdLine, cr,
+			timedOut ? "CRITICAL - Plugin timed out after " + Convert::ToString(params.Timeout) + " seconds"
+				: "PING UNKNOWN - Cannot send echo request to " + params.Address + ": " + ec.message(),
+			start, end, timedOut ? ServiceCritical : ServiceUnknown);
+		return;
+	}
+
+	CpuBoundWork cbw (yc);
+
+	auto loss (unsigned((params.Packets - state->Received) * 100 / params.Packets));
+	Array::Ptr perfdata = new Array();
+	ServiceState exitState = ServiceOK;
+	std::ostringstream msgbuf;
+
+	if (state->Received) {
+		double rta = state->RttSum / state->Received * 1000;
+
+		perfdata->Add(FormatNetCheckPerfdata("rta", rta, "ms", params.WarnRta, params.CritRta, 0, Empty));
+
+		if (loss >= params.CritPl || rta >= params.CritRta)
+			exitState = ServiceCritical;
+		else if (loss >= params.WarnPl || rta >= params.WarnRta)
+			exitState = ServiceWarning;
+
+		msgbuf << "PING " << NetCheckStateToString(exitState) << " - Packet loss = " << loss << "%, RTA = "
+			<< std::fixed << std::setprecision(2) << rta << " ms";
+	} else {
+		exitState = ServiceCritical;
+
+		msgbuf << "PING CRITICAL - Packet loss = 100%";
+	}
+
+	perfdata->Add("pl=" + Convert::ToString(loss) + "%;" + Convert::ToString(params.WarnPl)
+		+ ";" + Convert::ToString(params.CritPl) + ";0");
+
+	ReportNetCheckResult(checkable, cmdLine, cr, msgbuf.str(), start, end, exitState, perfdata);
+}
+
+void NetCheckTask::TcpScriptFunc(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr,
+	const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros)
+{
+	namespace asio = boost::asio;
+
+	REQUIRE_NOT_NULL(checkable);
+	REQUIRE_NOT_NULL(cr);
+
+	if (DelegateNetCheck(checkable, cr, resolvedMacros, useResolvedMacros))
+		return;
+
+	CheckCommand::Ptr command = CheckCommand::ExecuteOverride ? CheckCommand::ExecuteOverride : checkable->GetCheckCommand();
+	auto resolveMacros (GetNetCheckMacroResolver(checkable, command, resolvedMacros, useResolvedMacros));
+
+	NativeTcpCheckParams params;
+	params.Address = resolveMacros("$tcp_address$");
+	params.Port = resolveMacros("$tcp_port$");
+	params.Send = resolveMacros("$tcp_send$");
+	params.Quit = resolveMacros("$tcp_quit$");
+	params.Expect = NetCheckToStringList(resolveMacros("$tcp_expect$"));
+	params.ExpectAll = resolveMacros("$tcp_all$").ToBool();
+	params.RefuseState = NetCheckParseState(resolveMacros("$tcp_refuse$"), ServiceCritical);
+	params.MismatchState = NetCheckParseState(resolveMacros("$tcp_mismatch$"), ServiceWarning);
+	params.WarnTime = resolveMacros("$tcp_wtime$");
+	params.CritTime = resolveMacros("$tcp_ctime$");
+	params.Timeout = GetNetCheckTimeout(checkable, command, resolveMacros("$tcp_timeout$"));
+
+	Value maxBytes = resolveMacros("$tcp_maxbytes$");
+	params.MaxBytes = maxBytes.IsEmpty() ? 4096 : std::max<long>(1, Convert::ToLong(maxBytes));
+
+	if (resolvedMacros && !useResolvedMacros)
+		return;
+
+	double start = Utility::GetTime();
+	Value cmdLine = command->GetName();
+
+	if (params.Address.IsEmpty())
+		params.Address = "localhost";
+
+	if (params.Port.IsEmpty()) {
+		ReportNetCheckResult(checkable, cmdLine, cr, "TCP UNKNOWN - No port specified (tcp_port)", start, start);
+		return;
+	}
+
+	auto& io (IoEngine::Get().GetIoContext());
+	auto strand (Shared<asio::io_context::strand>::Make(io));
+	auto socket (Shared<asio::ip::tcp::socket>::Make(io));
+
+	IoEngine::SpawnCoroutine(
+		*strand,
+		[strand, checkable, cmdLine, cr, socket, params, start](asio::yield_context yc) {
+			bool timedOut = false;
+
+			Timeout::Ptr timeout = new Timeout(strand->context(), *strand, boost::posix_time::microseconds(int64_t(params.Timeout * 1e6)),
+				[&socket, &timedOut](boost::asio::yield_context yc) {
+					boost::system::error_code ec;
+
+					timedOut = true;
+					socket->cancel(ec);
+				}
+			);
+
+			Defer cancelTimeout ([&timeout]() { timeout->Cancel(); });
+
+			DoNativeTcpCheck(yc, checkable, cmdLine, cr, *socket, params, timedOut, start);
+		}
+	);
+}
+
+void NetCheckTask::HttpScriptFunc(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr,
+	const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros)
+{
+	namespace asio = boost::asio;
+	namespace http = boost::beast::http;
+
+	REQUIRE_NOT_NULL(checkable);
+	REQUIRE_NOT_NULL(cr);
+
+	if (DelegateNetCheck(checkable, cr, resolvedMacros, useResolvedMacros))
+		return;
+
+	CheckCommand::Ptr command = CheckCommand::ExecuteOverride ? CheckCommand::ExecuteOverride : checkable->GetCheckCommand();
+	auto resolveMacros (GetNetCheckMacroResolver(checkable, command, resolvedMacros, useResolvedMacros));
+
+	NativeHttpCheckParams params;
+	params.Address = resolveMacros("$http_address$");
+	params.Port = resolveMacros("$http_port$");
+	params.VHost = resolveMacros("$http_vhost$");
+	params.Uri = resolveMacros("$http_uri$");
+	params.AuthPair = resolveMacros("$http_auth_pair$");
+	params.Ssl = resolveMacros("$http_ssl$").ToBool();
+	params.Sni = resolveMacros("$http_sni$").ToBool();
+	params.ExpectContent = resolveMacros("$http_string$");
+	params.WarnTime = resolveMacros("$http_warn_time$");
+	params.CritTime = resolveMacros("$http_critical_time$");
+	params.Timeout = GetNetCheckTimeout(checkable, command, resolveMacros("$http_timeout$"));
+
+	String method = resolveMacros("$http_method$");
+	String expect = resolveMacros("$http_expect$");
+
+	if (resolvedMacros && !useResolvedMacros)
+		return;
+
+	double start = Utility::GetTime();
+	Value cmdLine = command->GetName();
+
+	params.Method = method.IsEmpty() ? http::verb::get : http::string_to_verb(method.ToUpper().GetData());
+
+	if (params.Method == http::verb::unknown) {
+		ReportNetCheckResult(checkable, cmdLine, cr, "HTTP UNKNOWN - Invalid HTTP method: " + method, start, start);
+		return;
+	}
+
+	for (auto& expected : expect.Split(",")) {
+		if (!expected.IsEmpty())
+			params.Expect.emplace_back(std::move(expected));
+	}
+
+	if (params.Address.IsEmpty())
+		params.Address = params.VHost.IsEmpty() ? "localhost" : params.VHost;
+
+	if (params.VHost.IsEmpty())
+		params.VHost = params.Address;
+
+	if (params.Port.IsEmpty())
+		params.Port = params.Ssl ? "443" : "80";
+
+	if (params.Uri.IsEmpty())
+		params.Uri = "/";
+
+	auto& io (IoEngine::Get().GetIoContext());
+	auto strand (Shared<asio::io_context::strand>::Make(io));
+
+	if (params.Ssl) {
+		static auto sslContext (MakeAsioSslContext());
+
+		auto conn (Shared<AsioTlsStream>::Make(io, *sslContext, params.Sni ? params.VHost : String()));
+
+		IoEngine::SpawnCoroutine(
+			*strand,
+			[strand, checkable, cmdLine, cr, conn, params, start](asio::yield_context yc) {
+				bool timedOut = false;
+
+				Timeout::Ptr timeout = new Timeout(strand->context(), *strand, boost::posix_time::microseconds(int64_t(params.Timeout * 1e6)),
+					[&conn, &timedOut](boost::asio::yield_context yc) {
+						boost::system::error_code ec;
+
+						timedOut = true;
+						conn->lowest_layer().cancel(ec);
+					}
+				);
+
+				Defer cancelTimeout ([&timeout]() { timeout->Cancel(); });
+
+				DoNativeHttpCheck(yc, checkable, cmdLine, cr, *conn, params, timedOut, start);
+			}
+		);
+	} else {
+		auto conn (Shared<AsioTcpStream>::Make(io));
+
+		IoEngine::SpawnCoroutine(
+			*strand,
+			[strand, checkable, cmdLine, cr, conn, params, start](asio::yield_context yc) {
+				bool timedOut = false;
+
+				Timeout::Ptr timeout = new Timeout(strand->context(), *strand, boost::posix_time::microseconds(int64_t(params.Timeout * 1e6)),
+					[&conn, &timedOut](boost::asio::yield_context yc) {
+						boost::system::error_code ec;
+
+						timedOut = true;
+						conn->lowest_layer().cancel(ec);
+					}
+				);
+
+				Defer cancelTimeout ([&timeout]() { timeout->Cancel(); });
+
+				DoNativeHttpCheck(yc, checkable, cmdLine, cr, *conn, params, timedOut, start);
+			}
+		);
+	}
+}
+
+void NetCheckTask::PingScriptFunc(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr,
+	const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros)
+{
+	namespace asio = boost::asio;
+
+	REQUIRE_NOT_NULL(checkable);
+	REQUIRE_NOT_NULL(cr);
+
+	if (DelegateNetCheck(checkable, cr, resolvedMacros, useResolvedMacros))
+		return;
+
+	CheckCommand::Ptr command = CheckCommand::ExecuteOverride ? CheckCommand::ExecuteOverride : checkable->GetCheckCommand();
+	auto resolveMacros (GetNetCheckMacroResolver(checkable, command, resolvedMacros, useResolvedMacros));
+
+	auto toDouble ([](const Value& value, double defaultValue) {
+		return value.IsEmpty() ? defaultValue : Convert::ToDouble(value);
+	});
+
+	NativePingCheckParams params;
+	params.Address = resolveMacros("$ping_address$");
+	params.WarnRta = toDouble(resolveMacros("$ping_wrta$"), 100);
+	params.WarnPl = toDouble(resolveMacros("$ping_wpl$"), 5);
+	params.CritRta = toDouble(resolveMacros("$ping_crta$"), 200);
+	params.CritPl = toDouble(resolveMacros("$ping_cpl$"), 15);
+	params.Timeout = GetNetCheckTimeout(checkable, command, resolveMacros("$ping_timeout$"));
+
+	Value packets = resolveMacros("$ping_packets$");
+	params.Packets = packets.IsEmpty() ? 5 : std::min<long>(std::max<long>(1, Convert::ToLong(packets)), 65535);
+
+	if (resolvedMacros && !useResolvedMacros)
+		return;
+
+	double start = Utility::GetTime();
+	Value cmdLine = command->GetName();
+
+	if (params.Address.IsEmpty()) {
+		ReportNetCheckResult(checkable, cmdLine, cr, "PING UNKNOWN - No address specified (ping_address)", start, start);
+		return;
+	}
+
+	auto& io (IoEngine::Get().GetIoContext());
+	auto strand (Shared<asio::io_context::strand>::Make(io));
+	auto state (Shared<NativePingCheckState>::Make(io));
+
+	IoEngine::SpawnCoroutine(
+		*strand,
+		[strand, checkable, cmdLine, cr, state, params, start](asio::yield_context yc) {
+			bool timedOut = false;
+
+			Timeout::Ptr timeout = new Timeout(strand->context(), *strand, boost::posix_time::microseconds(int64_t(params.Timeout * 1e6)),
+				[&state, &timedOut](boost::asio::yield_context yc) {
+					boost::system::error_code ec;
+
+					timedOut = true;
+					state->Timer.cancel(ec);
+					state->Socket.cancel(ec);
+				}
+			);
+
+			Defer cancelTimeout ([&timeout]() { timeout->Cancel(); });
+
+			DoNativePingCheck(yc, *strand, checkable, cmdLine, cr, state, params, timedOut, start);
+		}
+	);
+}
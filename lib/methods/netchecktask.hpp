@@ -0,0 +1,36 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef NETCHECKTASK_H
+#define NETCHECKTASK_H
+
+#include "methods/i2-methods.hpp"
+#include "icinga/service.hpp"
+#include "base/dictionary.hpp"
+
+namespace icinga
+{
+
+/**
+ * Implements TCP, HTTP and ICMP echo checks directly on the I/O engine instead of
+ * spawning check_tcp, check_http or check_ping. The output and the performance data
+ * follow the format of the respective Monitoring Plugins.
+ *
+ * @ingroup methods
+ */
+class NetCheckTask
+{
+public:
+	static void TcpScriptFunc(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr,
+		const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros);
+	static void HttpScriptFunc(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr,
+		const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros);
+	static void PingScriptFunc(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr,
+		const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros);
+
+private:
+	NetCheckTask();
+};
+
+}
+
+#endif /* NETCHECKTASK_H */
@@ -3,6 +3,7 @@
 #include "methods/pluginchecktask.hpp"
 #include "icinga/pluginutility.hpp"
 #include "icinga/checkcommand.hpp"
+#include "icinga/commandusage.hpp"
 #include "icinga/macroprocessor.hpp"
 #include "base/configtype.hpp"
 #include "base/logger.hpp"
@@ -93,5 +94,10 @@ void PluginCheckTask::ProcessFinishedHandler(const Checkable::Ptr& checkable, co
 	cr->SetExecutionStart(pr.ExecutionStart);
 	cr->SetExecutionEnd(pr.ExecutionEnd);
 
+#ifndef _WIN32
+	if (pr.PID > 0)
+		cr->SetResourceUsage(CommandUsage::ToDictionary(pr.Usage));
+#endif /* _WIN32 */
+
 	checkable->ProcessCheckResult(cr);
 }
@@ -21,11 +21,11 @@ public:
 	static void ScriptFunc(const Checkable::Ptr& service, const CheckResult::Ptr& cr,
 		const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros);
 
-private:
-	PluginCheckTask();
-
 	static void ProcessFinishedHandler(const Checkable::Ptr& service,
 		const CheckResult::Ptr& cr, const Value& commandLine, const ProcessResult& pr);
+
+private:
+	PluginCheckTask();
 };
 
 }
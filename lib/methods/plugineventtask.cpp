@@ -2,6 +2,7 @@
 
 #include "methods/plugineventtask.hpp"
 #include "icinga/eventcommand.hpp"
+#include "icinga/eventhandlerqueue.hpp"
 #include "icinga/macroprocessor.hpp"
 #include "icinga/pluginutility.hpp"
 #include "base/configtype.hpp"
@@ -22,6 +23,32 @@ void PluginEventTask::ScriptFunc(const Checkable::Ptr& checkable,
 
 	EventCommand::Ptr commandObj = EventCommand::ExecuteOverride ? EventCommand::ExecuteOverride : checkable->GetEventCommand();
 
+	/* Executions for the "execute-command" API action depend on thread-local overrides,
+	 * and resolving the macros only (for a command endpoint) doesn't spawn any process. */
+	if (EventCommand::ExecuteOverride || MacroResolver::OverrideMacros || Checkable::ExecuteCommandProcessFinishedHandler
+		|| (resolvedMacros && !useResolvedMacros)) {
+		Execute(checkable, commandObj, resolvedMacros, useResolvedMacros, nullptr);
+		return;
+	}
+
+	EventHandlerQueue::Enqueue(checkable, commandObj, [checkable, resolvedMacros, useResolvedMacros, commandObj]() {
+		try {
+			Execute(checkable, commandObj, resolvedMacros, useResolvedMacros, [commandObj]() { EventHandlerQueue::Release(commandObj); });
+		} catch (...) {
+			EventHandlerQueue::Release(commandObj);
+			throw;
+		}
+	});
+}
+
+/**
+ * Executes the event command for the checkable
+ *
+ * @param finished If set, called once the command has finished (or failed to start)
+ */
+void PluginEventTask::Execute(const Checkable::Ptr& checkable, const EventCommand::Ptr& commandObj,
+	const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros, const std::function<void()>& finished)
+{
 	Host::Ptr host;
 	Service::Ptr service;
 	tie(host, service) = GetHostService(checkable);
@@ -42,7 +69,12 @@ void PluginEventTask::ScriptFunc(const Checkable::Ptr& checkable,
 	if (Checkable::ExecuteCommandProcessFinishedHandler) {
 		callback = Checkable::ExecuteCommandProcessFinishedHandler;
 	} else {
-		callback = [checkable](const Value& commandLine, const ProcessResult& pr) { ProcessFinishedHandler(checkable, commandLine, pr); };
+		callback = [checkable, finished](const Value& commandLine, const ProcessResult& pr) {
+			ProcessFinishedHandler(checkable, commandLine, pr);
+
+			if (finished)
+				finished();
+		};
 	}
 
 	PluginUtility::ExecuteCommand(commandObj, checkable, checkable->GetLastCheckResult(),
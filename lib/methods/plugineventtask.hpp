@@ -5,7 +5,9 @@
 
 #include "methods/i2-methods.hpp"
 #include "icinga/service.hpp"
+#include "icinga/eventcommand.hpp"
 #include "base/process.hpp"
+#include <functional>
 
 namespace icinga
 {
@@ -24,6 +26,8 @@ public:
 private:
 	PluginEventTask();
 
+	static void Execute(const Checkable::Ptr& checkable, const EventCommand::Ptr& commandObj,
+		const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros, const std::function<void()>& finished);
 	static void ProcessFinishedHandler(const Checkable::Ptr& checkable,
 		const Value& commandLine, const ProcessResult& pr);
 };
@@ -11,6 +11,13 @@
 #include "base/utility.hpp"
 #include "base/process.hpp"
 #include "base/convert.hpp"
+#include "base/json.hpp"
+#include "base/timer.hpp"
+#include <boost/thread/once.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
 
 #ifdef __linux__
 #	include <linux/binfmts.h>
@@ -30,6 +37,26 @@ using namespace icinga;
 
 REGISTER_FUNCTION_NONCONST(Internal, PluginNotification, &PluginNotificationTask::ScriptFunc, "notification:user:cr:itype:author:comment:resolvedMacros:useResolvedMacros");
 
+/**
+ * Notifications for the same user and command collected during the command's aggregation_window.
+ * The last one provides the macros of the combined invocation.
+ */
+struct PluginNotificationBatch
+{
+	Notification::Ptr LastNotification;
+	CheckResult::Ptr LastCR;
+	NotificationType LastType;
+	String LastAuthor;
+	String LastComment;
+	ArrayData Entries;
+	size_t EntriesLength = 0;
+	double Deadline = 0;
+};
+
+static std::mutex l_BatchesMutex;
+static std::map<std::pair<NotificationCommand::Ptr, User::Ptr>, std::unique_ptr<PluginNotificationBatch>> l_Batches;
+static Timer::Ptr l_BatchTimer;
+
 void PluginNotificationTask::ScriptFunc(const Notification::Ptr& notification,
 	const User::Ptr& user, const CheckResult::Ptr& cr, int itype,
 	const String& author, const String& comment, const Dictionary::Ptr& resolvedMacros,
@@ -42,6 +69,125 @@ void PluginNotificationTask::ScriptFunc(const Notification::Ptr& notification,
 
 	auto type = static_cast<NotificationType>(itype);
 
+	/* Macros resolved by or for another endpoint and the API's execute-command are never aggregated. */
+	if (commandObj->GetAggregationWindow() > 0 && !resolvedMacros && !useResolvedMacros
+		&& !NotificationCommand::ExecuteOverride && !Checkable::ExecuteCommandProcessFinishedHandler) {
+		AddToBatch(commandObj, notification, user, cr, type, author, comment);
+		return;
+	}
+
+	ExecuteNotification(commandObj, notification, user, cr, type, author, comment, resolvedMacros, useResolvedMacros, nullptr);
+}
+
+void PluginNotificationTask::AddToBatch(const NotificationCommand::Ptr& commandObj, const Notification::Ptr& notification,
+	const User::Ptr& user, const CheckResult::Ptr& cr, NotificationType type, const String& author, const String& comment)
+{
+	static boost::once_flag once = BOOST_ONCE_INIT;
+
+	boost::call_once(once, []() {
+		l_BatchTimer = Timer::Create();
+		l_BatchTimer->SetInterval(1);
+		l_BatchTimer->OnTimerExpired.connect([](const Timer * const&) { FlushBatches(); });
+		l_BatchTimer->Start();
+	});
+
+	Checkable::Ptr checkable = notification->GetCheckable();
+
+	Host::Ptr host;
+	Service::Ptr service;
+	tie(host, service) = GetHostService(checkable);
+
+	Dictionary::Ptr entry = new Dictionary({
+		{ "notification", notification->GetName() },
+		{ "host", host->GetName() },
+		{ "service", service ? Value(service->GetShortName()) : Empty },
+		{ "type", Notification::NotificationTypeToStringCompat(type) },
+		{ "state", service ? Service::StateToString(service->GetState()) : Host::StateToString(host->GetState()) },
+		{ "output", cr ? Value(cr->GetOutput()) : Empty },
+		{ "author", author },
+		{ "comment", comment },
+		{ "timestamp", Utility::GetTime() }
+	});
+
+	size_t entryLength = JsonEncode(entry).GetLength() + 1u;
+
+	std::unique_ptr<PluginNotificationBatch> full;
+
+	{
+		std::unique_lock<std::mutex> lock (l_BatchesMutex);
+
+		auto& batch (l_Batches[{ commandObj, user }]);
+
+#ifdef __linux__
+		/* $notification.batch$ must still fit into a single command line argument. */
+		if (batch && batch->EntriesLength + entryLength > l_MaxOutLen)
+			full = std::move(batch);
+#endif /* __linux__ */
+
+		if (!batch) {
+			batch.reset(new PluginNotificationBatch());
+			batch->Deadline = Utility::GetTime() + commandObj->GetAggregationWindow();
+		}
+
+		batch->LastNotification = notification;
+		batch->LastCR = cr;
+		batch->LastType = type;
+		batch->LastAuthor = author;
+		batch->LastComment = comment;
+		batch->Entries.emplace_back(std::move(entry));
+		batch->EntriesLength += entryLength;
+	}
+
+	if (full)
+		ExecuteBatch(commandObj, user, *full);
+}
+
+/**
+ * Executes the batches whose aggregation window has passed.
+ */
+void PluginNotificationTask::FlushBatches()
+{
+	std::vector<std::pair<std::pair<NotificationCommand::Ptr, User::Ptr>, std::unique_ptr<PluginNotificationBatch>>> due;
+
+	{
+		std::unique_lock<std::mutex> lock (l_BatchesMutex);
+		double now = Utility::GetTime();
+
+		for (auto it (l_Batches.begin()); it != l_Batches.end();) {
+			if (it->second->Deadline <= now) {
+				due.emplace_back(it->first, std::move(it->second));
+				it = l_Batches.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	for (auto& batch : due) {
+		try {
+			ExecuteBatch(batch.first.first, batch.first.second, *batch.second);
+		} catch (const std::exception& ex) {
+			Log(LogWarning, "PluginNotificationTask")
+				<< "Exception occurred during aggregated notification for user '" << batch.first.second->GetName()
+				<< "' using command '" << batch.first.first->GetName() << "': " << DiagnosticInformation(ex, false);
+		}
+	}
+}
+
+void PluginNotificationTask::ExecuteBatch(const NotificationCommand::Ptr& commandObj, const User::Ptr& user, PluginNotificationBatch& batch)
+{
+	Log(LogInformation, "PluginNotificationTask")
+		<< "Sending " << batch.Entries.size() << " aggregated notification(s) to user '" << user->GetName()
+		<< "' using command '" << commandObj->GetName() << "'.";
+
+	ExecuteNotification(commandObj, batch.LastNotification, user, batch.LastCR, batch.LastType,
+		batch.LastAuthor, batch.LastComment, nullptr, false, new Array(std::move(batch.Entries)));
+}
+
+void PluginNotificationTask::ExecuteNotification(const NotificationCommand::Ptr& commandObj, const Notification::Ptr& notification,
+	const User::Ptr& user, const CheckResult::Ptr& cr, NotificationType type, const String& author, const String& comment,
+	const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros, const Array::Ptr& batch)
+{
 	Checkable::Ptr checkable = notification->GetCheckable();
 
 	Dictionary::Ptr notificationExtra = new Dictionary({
@@ -54,6 +200,11 @@ void PluginNotificationTask::ScriptFunc(const Notification::Ptr& notification,
 #endif /* __linux__ */
 	});
 
+	if (batch) {
+		notificationExtra->Set("batch", JsonEncode(batch));
+		notificationExtra->Set("batch_size", batch->GetLength());
+	}
+
 	Host::Ptr host;
 	Service::Ptr service;
 	tie(host, service) = GetHostService(checkable);
@@ -5,12 +5,15 @@
 
 #include "methods/i2-methods.hpp"
 #include "icinga/notification.hpp"
+#include "icinga/notificationcommand.hpp"
 #include "icinga/service.hpp"
 #include "base/process.hpp"
 
 namespace icinga
 {
 
+struct PluginNotificationBatch;
+
 /**
  * Implements sending notifications based on external plugins.
  *
@@ -27,6 +30,15 @@ public:
 private:
 	PluginNotificationTask();
 
+	static void ExecuteNotification(const NotificationCommand::Ptr& commandObj, const Notification::Ptr& notification,
+		const User::Ptr& user, const CheckResult::Ptr& cr, NotificationType type, const String& author, const String& comment,
+		const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros, const Array::Ptr& batch);
+
+	static void AddToBatch(const NotificationCommand::Ptr& commandObj, const Notification::Ptr& notification,
+		const User::Ptr& user, const CheckResult::Ptr& cr, NotificationType type, const String& author, const String& comment);
+	static void FlushBatches();
+	static void ExecuteBatch(const NotificationCommand::Ptr& commandObj, const User::Ptr& user, PluginNotificationBatch& batch);
+
 	static void ProcessFinishedHandler(const Checkable::Ptr& checkable,
 		const Value& commandLine, const ProcessResult& pr);
 };
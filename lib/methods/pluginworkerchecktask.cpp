@@ -0,0 +1,492 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "methods/pluginworkerchecktask.hpp"
+#include "methods/pluginchecktask.hpp"
+#include "icinga/pluginutility.hpp"
+#include "icinga/checkcommand.hpp"
+#include "icinga/macroprocessor.hpp"
+#include "base/array.hpp"
+#include "base/convert.hpp"
+#include "base/function.hpp"
+#include "base/logger.hpp"
+#include "base/process.hpp"
+#include "base/utility.hpp"
+#ifndef _WIN32
+#	include "base/defer.hpp"
+#	include "base/exception.hpp"
+#	include "base/io-engine.hpp"
+#	include "base/json.hpp"
+#	include "base/shared-object.hpp"
+#	include <algorithm>
+#	include <boost/asio/buffers_iterator.hpp>
+#	include <boost/asio/io_context_strand.hpp>
+#	include <boost/asio/posix/stream_descriptor.hpp>
+#	include <boost/asio/read.hpp>
+#	include <boost/asio/read_until.hpp>
+#	include <boost/asio/spawn.hpp>
+#	include <boost/asio/streambuf.hpp>
+#	include <boost/asio/write.hpp>
+#	include <deque>
+#	include <map>
+#	include <memory>
+#	include <mutex>
+#	include <signal.h>
+#	include <unistd.h>
+#endif /* _WIN32 */
+
+using namespace icinga;
+
+REGISTER_FUNCTION_NONCONST(Internal, PluginWorkerCheck, &PluginWorkerCheckTask::ScriptFunc, "checkable:cr:resolvedMacros:useResolvedMacros");
+
+#ifndef _WIN32
+/* Responses (i.e. plugin output) may not exceed this. */
+static const size_t l_MaxWorkerResponseLength = 1024 * 1024;
+
+/**
+ * A long-running plugin process talking netstring-framed JSON on stdin/stdout.
+ */
+class PluginWorker final : public SharedObject
+{
+public:
+	DECLARE_PTR_TYPEDEFS(PluginWorker);
+
+	PluginWorker(pid_t pid, int spawnHelper, int stdinFD, int stdoutFD)
+		: PID(pid), Strand(IoEngine::Get().GetIoContext()), Stdin(IoEngine::Get().GetIoContext(), stdinFD),
+		Stdout(IoEngine::Get().GetIoContext(), stdoutFD), Buffer(l_MaxWorkerResponseLength + 16),
+		m_SpawnHelper(spawnHelper), m_Terminated(false)
+	{ }
+
+	/**
+	 * Kills the worker (if not done yet) and aborts pending I/O with it. Call only on Strand.
+	 */
+	void Terminate()
+	{
+		if (m_Terminated)
+			return;
+
+		m_Terminated = true;
+
+		(void)Process::Kill(m_SpawnHelper, -PID, SIGKILL);
+
+		boost::system::error_code ec;
+		Stdin.close(ec);
+		Stdout.close(ec);
+
+		pid_t pid = PID;
+		int spawnHelper = m_SpawnHelper;
+
+		Utility::QueueAsyncCallback([pid, spawnHelper]() {
+			int status;
+			(void)Process::WaitPID(spawnHelper, pid, &status);
+		});
+	}
+
+	pid_t PID;
+	boost::asio::io_context::strand Strand;
+	boost::asio::posix::stream_descriptor Stdin;
+	boost::asio::posix::stream_descriptor Stdout;
+	boost::asio::streambuf Buffer;
+
+private:
+	int m_SpawnHelper;
+	bool m_Terminated;
+};
+
+struct PluginWorkerRequest
+{
+	Value CommandLine;
+	Array::Ptr Arguments;
+	Dictionary::Ptr Environment;
+	double Timeout;
+	std::function<void(const Value& commandLine, const ProcessResult&)> Callback;
+};
+
+/**
+ * The workers of one CheckCommand and the requests waiting for one of them.
+ */
+struct PluginWorkerPool
+{
+	std::mutex Mutex;
+	Process::Arguments WorkerCommand;
+	size_t MaxWorkers;
+	size_t Workers = 0;
+	std::vector<PluginWorker::Ptr> Idle;
+	std::deque<PluginWorkerRequest> Pending;
+};
+
+static std::mutex l_PluginWorkerPoolsMutex;
+static std::map<String, std::shared_ptr<PluginWorkerPool>> l_PluginWorkerPools;
+
+static void SubmitRequest(const std::shared_ptr<PluginWorkerPool>& pool, PluginWorkerRequest request);
+
+static PluginWorker::Ptr StartWorker(const Process::Arguments& command)
+{
+	int inFDs[2], outFDs[2];
+
+	if (pipe(inFDs) < 0) {
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("pipe")
+			<< boost::errinfo_errno(errno));
+	}
+
+	if (pipe(outFDs) < 0) {
+		int error = errno;
+
+		(void)close(inFDs[0]);
+		(void)close(inFDs[1]);
+
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("pipe")
+			<< boost::errinfo_errno(error));
+	}
+
+	Utility::SetCloExec(inFDs[1]);
+	Utility::SetCloExec(outFDs[0]);
+
+	int fds[3] = { inFDs[0], outFDs[1], STDERR_FILENO };
+	int spawnHelper;
+
+	pid_t pid = Process::Spawn(command, nullptr, fds, spawnHelper);
+	int error = errno;
+
+	(void)close(inFDs[0]);
+	(void)close(outFDs[1]);
+
+	if (pid == -1) {
+		(void)close(inFDs[1]);
+		(void)close(outFDs[0]);
+
+		BOOST_THROW_EXCEPTION(posix_error()
+			<< boost::errinfo_api_function("fork")
+			<< boost::errinfo_errno(error));
+	}
+
+	Log(LogNotice, "PluginWorkerCheckTask")
+		<< "Started plugin worker " << Process::PrettyPrintArguments(command) << ": PID " << pid;
+
+	return new PluginWorker(pid, spawnHelper, inFDs[1], outFDs[0]);
+}
+
+/**
+ * Reads a netstring from the worker's stdout.
+ */
+static String ReadWorkerResponse(PluginWorker& worker, boost::asio::yield_context yc)
+{
+	namespace asio = boost::asio;
+
+	auto& buf (worker.Buffer);
+	size_t headerLength = asio::async_read_until(worker.Stdout, buf, ':', yc);
+
+	std::string header (asio::buffers_begin(buf.data()), asio::buffers_begin(buf.data()) + headerLength - 1u);
+	buf.consume(headerLength);
+
+	if (header.empty() || header.size() > 9u || header.find_first_not_of("0123456789") != std::string::npos) {
+		BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid NetString (length specifier)"));
+	}
+
+	size_t length = std::stoul(header);
+
+	if (length > l_MaxWorkerResponseLength) {
+		BOOST_THROW_EXCEPTION(std::invalid_argument("Max data length exceeded: " + Convert::ToString(l_MaxWorkerResponseLength / 1024) + " KB"));
+	}
+
+	if (buf.size() < length + 1u) {
+		asio::async_read(worker.Stdout, buf, asio::transfer_exactly(length + 1u - buf.size()), yc);
+	}
+
+	auto begin (asio::buffers_begin(buf.data()));
+	String payload (begin, begin + length);
+	char trailer = *(begin + length);
+
+	buf.consume(length + 1u);
+
+	if (trailer != ',') {
+		BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid NetString (missing ,)"));
+	}
+
+	return payload;
+}
+
+/**
+ * Hands a worker which finished a request the next pending one or puts it back into the pool.
+ */
+static void ReleaseWorker(const std::shared_ptr<PluginWorkerPool>& pool, const PluginWorker::Ptr& worker, bool reusable);
+
+static void ExecuteOnWorker(const std::shared_ptr<PluginWorkerPool>& pool, const PluginWorker::Ptr& worker, PluginWorkerRequest request)
+{
+	namespace asio = boost::asio;
+
+	IoEngine::SpawnCoroutine(worker->Strand, [pool, worker, request](asio::yield_context yc) {
+		ProcessResult pr;
+		pr.PID = worker->PID;
+		pr.ExecutionStart = Utility::GetTime();
+		pr.ExitStatus = 128;
+
+		bool reusable = false;
+		bool timedOut = false;
+
+		{
+			Timeout::Ptr timeout;
+
+			/* Like Process, a timeout of 0 means none. */
+			if (request.Timeout > 0) {
+				timeout = new Timeout(worker->Strand.context(), worker->Strand,
+					boost::posix_time::microseconds(int64_t(request.Timeout * 1e6)),
+					[&worker, &timedOut](asio::yield_context) {
+						timedOut = true;
+						worker->Terminate();
+					}
+				);
+			}
+
+			Defer cancelTimeout ([&timeout]() {
+				if (timeout) {
+					timeout->Cancel();
+				}
+			});
+
+			try {
+				String payload = JsonEncode(new Dictionary({
+					{ "arguments", request.Arguments },
+					{ "env", request.Environment },
+					{ "timeout", request.Timeout }
+				}));
+
+				String message = Convert::ToString(payload.GetLength()) + ":" + payload + ",";
+
+				asio::async_write(worker->Stdin, asio::const_buffer(message.CStr(), message.GetLength()), yc);
+
+				Dictionary::Ptr response = JsonDecode(ReadWorkerResponse(*worker, yc));
+
+				if (!response) {
+					BOOST_THROW_EXCEPTION(std::invalid_argument("Response is not a JSON object"));
+				}
+
+				pr.ExitStatus = response->Get("exit_status");
+				pr.Output = response->Get("output");
+				reusable = true;
+			} catch (const std::exception& ex) {
+				if (timedOut) {
+					Log(LogWarning, "PluginWorkerCheckTask")
+						<< "Killed plugin worker " << worker->PID << " after timeout of " << request.Timeout << " seconds";
+
+					pr.Output = "<Timeout exceeded.>";
+				} else {
+					Log(LogWarning, "PluginWorkerCheckTask")
+						<< "Plugin worker " << worker->PID << " failed: " << ex.what();
+
+					pr.Output = "<Plugin worker failed: " + String(ex.what()) + ".>";
+				}
+			}
+		}
+
+		pr.ExecutionEnd = Utility::GetTime();
+
+		ReleaseWorker(pool, worker, reusable && !timedOut);
+
+		Utility::QueueAsyncCallback([request, pr]() { request.Callback(request.CommandLine, pr); });
+	});
+}
+
+static void ReleaseWorker(const std::shared_ptr<PluginWorkerPool>& pool, const PluginWorker::Ptr& worker, bool reusable)
+{
+	PluginWorkerRequest next;
+
+	if (!reusable) {
+		worker->Terminate();
+	}
+
+	{
+		std::unique_lock<std::mutex> lock (pool->Mutex);
+
+		if (reusable && pool->Pending.empty()) {
+			pool->Idle.emplace_back(worker);
+			return;
+		}
+
+		if (!reusable) {
+			--pool->Workers;
+
+			if (pool->Pending.empty()) {
+				return;
+			}
+		}
+
+		next = std::move(pool->Pending.front());
+		pool->Pending.pop_front();
+	}
+
+	if (reusable) {
+		ExecuteOnWorker(pool, worker, std::move(next));
+	} else {
+		SubmitRequest(pool, std::move(next));
+	}
+}
+
+static void SubmitRequest(const std::shared_ptr<PluginWorkerPool>& pool, PluginWorkerRequest request)
+{
+	for (;;) {
+		PluginWorker::Ptr worker;
+
+		{
+			std::unique_lock<std::mutex> lock (pool->Mutex);
+
+			if (!pool->Idle.empty()) {
+				worker = std::move(pool->Idle.back());
+				pool->Idle.pop_back();
+			} else if (pool->Workers < pool->MaxWorkers) {
+				++pool->Workers;
+			} else {
+				pool->Pending.emplace_back(std::move(request));
+				return;
+			}
+		}
+
+		if (worker) {
+			ExecuteOnWorker(pool, worker, std::move(request));
+			return;
+		}
+
+		try {
+			worker = StartWorker(pool->WorkerCommand);
+		} catch (const std::exception& ex) {
+			Log(LogWarning, "PluginWorkerCheckTask")
+				<< "Couldn't start plugin worker " << Process::PrettyPrintArguments(pool->WorkerCommand) << ": " << DiagnosticInformation(ex, false);
+
+			ProcessResult pr;
+			pr.PID = -1;
+			pr.ExecutionStart = Utility::GetTime();
+			pr.ExecutionEnd = pr.ExecutionStart;
+			pr.ExitStatus = 128;
+			pr.Output = "<Couldn't start plugin worker: " + DiagnosticInformation(ex, false) + ">";
+
+			auto callback (request.Callback);
+			auto commandLine (request.CommandLine);
+			Utility::QueueAsyncCallback([callback, commandLine, pr]() { callback(commandLine, pr); });
+
+			/* Requests waiting for this worker would starve otherwise. */
+			std::unique_lock<std::mutex> lock (pool->Mutex);
+			--pool->Workers;
+
+			if (pool->Pending.empty()) {
+				return;
+			}
+
+			request = std::move(pool->Pending.front());
+			pool->Pending.pop_front();
+			continue;
+		}
+
+		ExecuteOnWorker(pool, worker, std::move(request));
+		return;
+	}
+}
+#endif /* _WIN32 */
+
+void PluginWorkerCheckTask::ScriptFunc(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr,
+	const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros)
+{
+#ifdef _WIN32
+	/* Process::Spawn() is POSIX-only, run the plugin as usual. */
+	PluginCheckTask::ScriptFunc(checkable, cr, resolvedMacros, useResolvedMacros);
+#else /* _WIN32 */
+	REQUIRE_NOT_NULL(checkable);
+	REQUIRE_NOT_NULL(cr);
+
+	CheckCommand::Ptr commandObj = CheckCommand::ExecuteOverride ? CheckCommand::ExecuteOverride : checkable->GetCheckCommand();
+
+	Host::Ptr host;
+	Service::Ptr service;
+	tie(host, service) = GetHostService(checkable);
+
+	MacroProcessor::ResolverList resolvers;
+
+	if (MacroResolver::OverrideMacros)
+		resolvers.emplace_back("override", MacroResolver::OverrideMacros);
+
+	if (service)
+		resolvers.emplace_back("service", service);
+	resolvers.emplace_back("host", host);
+	resolvers.emplace_back("command", commandObj);
+
+	int timeout = commandObj->GetTimeout();
+
+	if (!checkable->GetCheckTimeout().IsEmpty())
+		timeout = checkable->GetCheckTimeout();
+
+	std::function<void(const Value& commandLine, const ProcessResult&)> callback;
+
+	if (Checkable::ExecuteCommandProcessFinishedHandler) {
+		callback = Checkable::ExecuteCommandProcessFinishedHandler;
+	} else {
+		callback = [checkable, cr](const Value& commandLine, const ProcessResult& pr) {
+			PluginCheckTask::ProcessFinishedHandler(checkable, cr, commandLine, pr);
+		};
+	}
+
+	/* Both are optional, don't warn about them being missing. */
+	String missingMacro;
+
+	Value workerCommand = MacroProcessor::ResolveMacros("$plugin_worker_command$", resolvers, checkable->GetLastCheckResult(),
+		&missingMacro, MacroProcessor::EscapeCallback(), resolvedMacros, useResolvedMacros);
+	Value workerCount = MacroProcessor::ResolveMacros("$plugin_worker_count$", resolvers, checkable->GetLastCheckResult(),
+		&missingMacro, MacroProcessor::EscapeCallback(), resolvedMacros, useResolvedMacros);
+
+	Value command;
+	Dictionary::Ptr env;
+
+	bool execute = PluginUtility::ResolveCommand(commandObj, checkable->GetLastCheckResult(), resolvers,
+		resolvedMacros, useResolvedMacros, command, env, callback);
+
+	if (!resolvedMacros || useResolvedMacros) {
+		Checkable::CurrentConcurrentChecks.fetch_add(1);
+		Checkable::IncreasePendingChecks();
+	}
+
+	if (!execute)
+		return;
+
+	Process::Arguments arguments = Process::PrepareCommand(command);
+	Process::Arguments workerArguments;
+
+	if (!workerCommand.IsEmpty()) {
+		workerArguments = Process::PrepareCommand(workerCommand);
+	} else if (command.IsObjectType<Array>() && !arguments.empty()) {
+		workerArguments.emplace_back(arguments[0]);
+	} else {
+		ProcessResult pr;
+		pr.PID = -1;
+		pr.ExecutionStart = Utility::GetTime();
+		pr.ExecutionEnd = pr.ExecutionStart;
+		pr.ExitStatus = 3; /* Unknown */
+		pr.Output = "Either the command line has to be an array or 'plugin_worker_command' has to be set.";
+		callback(command, pr);
+		return;
+	}
+
+	std::shared_ptr<PluginWorkerPool> pool;
+
+	{
+		String key = commandObj->GetName() + "\n" + JsonEncode(Array::FromVector(workerArguments));
+		std::unique_lock<std::mutex> lock (l_PluginWorkerPoolsMutex);
+		auto& slot (l_PluginWorkerPools[key]);
+
+		if (!slot) {
+			slot = std::make_shared<PluginWorkerPool>();
+			slot->WorkerCommand = std::move(workerArguments);
+			slot->MaxWorkers = std::max<long>(1, workerCount.IsEmpty() ? 2 : Convert::ToLong(workerCount));
+		}
+
+		pool = slot;
+	}
+
+	PluginWorkerRequest request;
+	request.CommandLine = command;
+	request.Arguments = Array::FromVector(arguments);
+	request.Environment = env;
+	request.Timeout = timeout;
+	request.Callback = std::move(callback);
+
+	SubmitRequest(pool, std::move(request));
+#endif /* _WIN32 */
+}
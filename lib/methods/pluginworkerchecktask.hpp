@@ -0,0 +1,31 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef PLUGINWORKERCHECKTASK_H
+#define PLUGINWORKERCHECKTASK_H
+
+#include "methods/i2-methods.hpp"
+#include "icinga/service.hpp"
+#include "base/dictionary.hpp"
+
+namespace icinga
+{
+
+/**
+ * Implements service checks based on external plugins which are kept running
+ * as worker processes and receive one check request after another.
+ *
+ * @ingroup methods
+ */
+class PluginWorkerCheckTask
+{
+public:
+	static void ScriptFunc(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr,
+		const Dictionary::Ptr& resolvedMacros, bool useResolvedMacros);
+
+private:
+	PluginWorkerCheckTask();
+};
+
+}
+
+#endif /* PLUGINWORKERCHECKTASK_H */
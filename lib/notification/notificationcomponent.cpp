@@ -11,6 +11,9 @@
 #include "base/exception.hpp"
 #include "base/statsfunction.hpp"
 #include "remote/apilistener.hpp"
+#include <algorithm>
+#include <chrono>
+#include <vector>
 
 using namespace icinga;
 
@@ -44,15 +47,57 @@ void NotificationComponent::Start(bool runtimeCreated)
 		SendNotificationsHandler(checkable, type, cr, author, text);
 	});
 
-	m_NotificationTimer = Timer::Create();
-	m_NotificationTimer->SetInterval(5);
-	m_NotificationTimer->OnTimerExpired.connect([this](const Timer * const&) { NotificationTimerHandler(); });
-	m_NotificationTimer->Start();
+	ConfigObject::OnActiveChanged.connect([this](const ConfigObject::Ptr& object, const Value&) {
+		ObjectHandler(object);
+	});
+	ConfigObject::OnPausedChanged.connect([this](const ConfigObject::Ptr& object, const Value&) {
+		ObjectHandler(object);
+	});
+
+	/* Notification::OnNextNotificationChanged hides the generated signal. */
+	ObjectImpl<Notification>::OnNextNotificationChanged.connect([this](const Notification::Ptr& notification, const Value&) {
+		UpdateNotification(notification);
+	});
+	Notification::OnIntervalChanged.connect([this](const Notification::Ptr& notification, const Value&) {
+		UpdateNotification(notification);
+	});
+	Notification::OnNoMoreNotificationsChanged.connect([this](const Notification::Ptr& notification, const Value&) {
+		UpdateNotification(notification);
+	});
+	Notification::OnSuppressedNotificationsChanged.connect([this](const Notification::Ptr& notification, const Value&) {
+		if (notification->GetSuppressedNotifications())
+			AddPendingNotification(notification);
+	});
+
+	Checkable::OnEnableNotificationsChanged.connect([this](const Checkable::Ptr& checkable, const Value&) {
+		for (const Notification::Ptr& notification : checkable->GetNotifications()) {
+			UpdateNotification(notification);
+		}
+	});
+	IcingaApplication::OnEnableNotificationsChanged.connect([this](const IcingaApplication::Ptr&, const Value&) {
+		for (const Notification::Ptr& notification : ConfigType::GetObjectsByType<Notification>()) {
+			UpdateNotification(notification);
+		}
+	});
+
+	/* Notifications activated before this component are picked up here, all later ones by ObjectHandler(). */
+	for (const Notification::Ptr& notification : ConfigType::GetObjectsByType<Notification>()) {
+		ObjectHandler(notification);
+	}
+
+	m_NextPendingRun = Utility::GetTime() + 5;
+	m_Thread = std::thread([this]() { NotificationThreadProc(); });
 }
 
 void NotificationComponent::Stop(bool runtimeRemoved)
 {
-	m_NotificationTimer->Stop(true);
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Stopped = true;
+		m_CV.notify_all();
+	}
+
+	m_Thread.join();
 
 	Log(LogInformation, "NotificationComponent")
 		<< "'" << GetName() << "' stopped.";
@@ -60,6 +105,77 @@ void NotificationComponent::Stop(bool runtimeRemoved)
 	ObjectImpl<NotificationComponent>::Stop(runtimeRemoved);
 }
 
+/**
+ * Whether reminders and stashed notifications of a paused notification are left to the other HA endpoint.
+ */
+bool NotificationComponent::IsSkippedByHA(const Notification::Ptr& notification)
+{
+	/* Function already checks whether 'api' feature is enabled. */
+	return notification->IsPaused() && Endpoint::GetLocalEndpoint() && GetEnableHA();
+}
+
+void NotificationComponent::ObjectHandler(const ConfigObject::Ptr& object)
+{
+	Notification::Ptr notification = dynamic_pointer_cast<Notification>(object);
+
+	if (!notification)
+		return;
+
+	UpdateNotification(notification);
+
+	/* Stashed and suppressed notifications are evaluated at least once after (re-)activation. */
+	if (notification->IsActive())
+		AddPendingNotification(notification);
+	else {
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_PendingNotifications.erase(notification);
+	}
+}
+
+/**
+ * (Re-)schedules the next reminder check of a notification from its current state.
+ *
+ * @param notification The notification.
+ * @param notBefore Don't check it again before this timestamp.
+ */
+void NotificationComponent::UpdateNotification(const Notification::Ptr& notification, double notBefore)
+{
+	bool schedule = notification->IsActive() && !IsSkippedByHA(notification)
+		&& !(notification->GetInterval() <= 0 && notification->GetNoMoreNotifications());
+
+	if (schedule) {
+		Checkable::Ptr checkable = notification->GetCheckable();
+
+		/* Re-scheduled by the signal handlers once notifications are enabled again. */
+		schedule = checkable && checkable->GetEnableNotifications() && IcingaApplication::GetInstance()->GetEnableNotifications();
+	}
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	m_Notifications.erase(notification);
+
+	if (!schedule)
+		return;
+
+	auto& idx (boost::get<1>(m_Notifications));
+	auto it (m_Notifications.insert({ notification, std::max(notification->GetNextNotification(), notBefore) }).first);
+
+	if (boost::multi_index::project<1>(m_Notifications, it) == idx.begin())
+		m_CV.notify_all();
+}
+
+void NotificationComponent::AddPendingNotification(const Notification::Ptr& notification)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	if (m_PendingNotifications.empty()) {
+		m_NextPendingRun = std::max(m_NextPendingRun, Utility::GetTime() + 5);
+		m_CV.notify_all();
+	}
+
+	m_PendingNotifications.insert(notification);
+}
+
 static inline
 void SubtractSuppressedNotificationTypes(const Notification::Ptr& notification, int types)
 {
@@ -124,140 +240,216 @@ void FireSuppressedNotifications(const Notification::Ptr& notification)
 }
 
 /**
- * Periodically sends notifications.
- *
- * @param - Event arguments for the timer.
+ * Sends reminder notifications once they're due and periodically re-evaluates
+ * stashed and suppressed notifications.
  */
-void NotificationComponent::NotificationTimerHandler()
+void NotificationComponent::NotificationThreadProc()
 {
-	double now = Utility::GetTime();
+	Utility::SetThreadName("Notifications");
 
-	/* Function already checks whether 'api' feature is enabled. */
-	Endpoint::Ptr myEndpoint = Endpoint::GetLocalEndpoint();
+	std::unique_lock<std::mutex> lock(m_Mutex);
 
-	for (const Notification::Ptr& notification : ConfigType::GetObjectsByType<Notification>()) {
-		if (!notification->IsActive())
+	for (;;) {
+		typedef boost::multi_index::nth_index<NotificationSet, 1>::type NotificationTimeView;
+		NotificationTimeView& idx = boost::get<1>(m_Notifications);
+
+		if (m_Stopped)
+			break;
+
+		double next = -1;
+
+		if (idx.begin() != idx.end())
+			next = idx.begin()->NextNotification;
+
+		if (!m_PendingNotifications.empty() && (next < 0 || m_NextPendingRun < next))
+			next = m_NextPendingRun;
+
+		double now = Utility::GetTime();
+
+		if (next < 0) {
+			m_CV.wait(lock);
 			continue;
+		}
 
-		String notificationName = notification->GetName();
-		bool updatedObjectAuthority = ApiListener::UpdatedObjectAuthority();
+		if (next > now) {
+			m_CV.wait_for(lock, std::chrono::duration<double>(next - now));
+			continue;
+		}
 
-		/* Skip notification if paused, in a cluster setup & HA feature is enabled. */
-		if (notification->IsPaused()) {
-			if (updatedObjectAuthority) {
-				auto stashedNotifications (notification->GetStashedNotifications());
-				ObjectLock olock(stashedNotifications);
+		std::vector<Notification::Ptr> due;
 
-				if (stashedNotifications->GetLength()) {
-					Log(LogNotice, "NotificationComponent")
-						<< "Notification '" << notificationName << "': HA cluster active, this endpoint does not have the authority. Dropping all stashed notifications.";
+		while (idx.begin() != idx.end() && idx.begin()->NextNotification <= now) {
+			due.emplace_back(idx.begin()->Object);
+			idx.erase(idx.begin());
+		}
 
-					stashedNotifications->Clear();
-				}
-			}
+		std::set<Notification::Ptr> pending;
 
-			if (myEndpoint && GetEnableHA()) {
-				Log(LogNotice, "NotificationComponent")
-					<< "Reminder notification '" << notificationName << "': HA cluster active, this endpoint does not have the authority (paused=true). Skipping.";
-				continue;
+		if (m_NextPendingRun <= now) {
+			pending.swap(m_PendingNotifications);
+			m_NextPendingRun = now + 5;
+		}
+
+		lock.unlock();
+
+		auto process ([this](const Notification::Ptr& notification, bool reminderDue) {
+			try {
+				ProcessNotification(notification, reminderDue);
+			} catch (const std::exception& ex) {
+				Log(LogWarning, "NotificationComponent")
+					<< "Exception occurred while processing notification '" << notification->GetName() << "': " << DiagnosticInformation(ex, false);
 			}
+
+			if (notification->IsActive() && (notification->GetStashedNotifications()->GetLength() || notification->GetSuppressedNotifications()))
+				AddPendingNotification(notification);
+		});
+
+		for (const Notification::Ptr& notification : due) {
+			pending.erase(notification);
+
+			process(notification, true);
+
+			/* A notification isn't looked at more often than every 5 seconds, just like with the former timer. */
+			UpdateNotification(notification, now + 5);
 		}
 
-		Checkable::Ptr checkable = notification->GetCheckable();
+		for (const Notification::Ptr& notification : pending) {
+			process(notification, false);
+		}
 
-		if (!IcingaApplication::GetInstance()->GetEnableNotifications() || !checkable->GetEnableNotifications())
-			continue;
+		lock.lock();
+	}
+}
 
-		bool reachable = checkable->IsReachable(DependencyNotification);
+/**
+ * Sends stashed, previously suppressed and (if due) reminder notifications.
+ *
+ * @param notification The notification.
+ * @param reminderDue Whether next_notification has been reached.
+ */
+void NotificationComponent::ProcessNotification(const Notification::Ptr& notification, bool reminderDue)
+{
+	if (!notification->IsActive())
+		return;
 
-		if (reachable) {
-			{
-				Array::Ptr unstashedNotifications = new Array();
+	String notificationName = notification->GetName();
+	bool updatedObjectAuthority = ApiListener::UpdatedObjectAuthority();
 
-				{
-					auto stashedNotifications (notification->GetStashedNotifications());
-					ObjectLock olock(stashedNotifications);
+	/* Skip notification if paused, in a cluster setup & HA feature is enabled. */
+	if (notification->IsPaused()) {
+		if (updatedObjectAuthority) {
+			auto stashedNotifications (notification->GetStashedNotifications());
+			ObjectLock olock(stashedNotifications);
 
-					stashedNotifications->CopyTo(unstashedNotifications);
-					stashedNotifications->Clear();
-				}
+			if (stashedNotifications->GetLength()) {
+				Log(LogNotice, "NotificationComponent")
+					<< "Notification '" << notificationName << "': HA cluster active, this endpoint does not have the authority. Dropping all stashed notifications.";
 
-				ObjectLock olock(unstashedNotifications);
-
-				for (Dictionary::Ptr unstashedNotification : unstashedNotifications) {
-					if (!unstashedNotification)
-						continue;
-
-					try {
-						Log(LogNotice, "NotificationComponent")
-							<< "Attempting to send stashed notification '" << notificationName << "'.";
-
-						notification->BeginExecuteNotification(
-							(NotificationType)(int)unstashedNotification->Get("notification_type"),
-							(CheckResult::Ptr)unstashedNotification->Get("cr"),
-							(bool)unstashedNotification->Get("force"),
-							(bool)unstashedNotification->Get("reminder"),
-							(String)unstashedNotification->Get("author"),
-							(String)unstashedNotification->Get("text")
-						);
-					} catch (const std::exception& ex) {
-						Log(LogWarning, "NotificationComponent")
-							<< "Exception occurred during notification for object '"
-							<< notificationName << "': " << DiagnosticInformation(ex, false);
-					}
-				}
+				stashedNotifications->Clear();
 			}
-
-			FireSuppressedNotifications(notification);
 		}
 
-		if (notification->GetInterval() <= 0 && notification->GetNoMoreNotifications()) {
+		if (IsSkippedByHA(notification)) {
 			Log(LogNotice, "NotificationComponent")
-				<< "Reminder notification '" << notificationName << "': Notification was sent out once and interval=0 disables reminder notifications.";
-			continue;
+				<< "Reminder notification '" << notificationName << "': HA cluster active, this endpoint does not have the authority (paused=true). Skipping.";
+			return;
 		}
+	}
 
-		if (notification->GetNextNotification() > now)
-			continue;
+	Checkable::Ptr checkable = notification->GetCheckable();
 
-		{
-			ObjectLock olock(notification);
-			notification->SetNextNotification(Utility::GetTime() + notification->GetInterval());
-		}
+	if (!IcingaApplication::GetInstance()->GetEnableNotifications() || !checkable->GetEnableNotifications())
+		return;
+
+	bool reachable = checkable->IsReachable(DependencyNotification);
 
+	if (reachable) {
 		{
-			Host::Ptr host;
-			Service::Ptr service;
-			tie(host, service) = GetHostService(checkable);
+			Array::Ptr unstashedNotifications = new Array();
 
-			ObjectLock olock(checkable);
+			{
+				auto stashedNotifications (notification->GetStashedNotifications());
+				ObjectLock olock(stashedNotifications);
 
-			if (checkable->GetStateType() == StateTypeSoft)
-				continue;
+				stashedNotifications->CopyTo(unstashedNotifications);
+				stashedNotifications->Clear();
+			}
 
-			/* Don't send reminder notifications for OK/Up states. */
-			if ((service && service->GetState() == ServiceOK) || (!service && host->GetState() == HostUp))
-				continue;
+			ObjectLock olock(unstashedNotifications);
 
-			/* Don't send reminder notifications before initial ones. */
-			if (checkable->GetSuppressedNotifications() & NotificationProblem || notification->GetSuppressedNotifications() & NotificationProblem)
-				continue;
+			for (Dictionary::Ptr unstashedNotification : unstashedNotifications) {
+				if (!unstashedNotification)
+					continue;
 
-			/* Skip in runtime filters. */
-			if (!reachable || checkable->IsInDowntime() || checkable->IsAcknowledged() || checkable->IsFlapping())
-				continue;
+				try {
+					Log(LogNotice, "NotificationComponent")
+						<< "Attempting to send stashed notification '" << notificationName << "'.";
+
+					notification->BeginExecuteNotification(
+						(NotificationType)(int)unstashedNotification->Get("notification_type"),
+						(CheckResult::Ptr)unstashedNotification->Get("cr"),
+						(bool)unstashedNotification->Get("force"),
+						(bool)unstashedNotification->Get("reminder"),
+						(String)unstashedNotification->Get("author"),
+						(String)unstashedNotification->Get("text")
+					);
+				} catch (const std::exception& ex) {
+					Log(LogWarning, "NotificationComponent")
+						<< "Exception occurred during notification for object '"
+						<< notificationName << "': " << DiagnosticInformation(ex, false);
+				}
+			}
 		}
 
-		try {
-			Log(LogNotice, "NotificationComponent")
-				<< "Attempting to send reminder notification '" << notificationName << "'.";
+		FireSuppressedNotifications(notification);
+	}
 
-			notification->BeginExecuteNotification(NotificationProblem, checkable->GetLastCheckResult(), false, true);
-		} catch (const std::exception& ex) {
-			Log(LogWarning, "NotificationComponent")
-				<< "Exception occurred during notification for object '"
-				<< notificationName << "': " << DiagnosticInformation(ex, false);
-		}
+	if (notification->GetInterval() <= 0 && notification->GetNoMoreNotifications()) {
+		Log(LogNotice, "NotificationComponent")
+			<< "Reminder notification '" << notificationName << "': Notification was sent out once and interval=0 disables reminder notifications.";
+		return;
+	}
+
+	if (!reminderDue || notification->GetNextNotification() > Utility::GetTime())
+		return;
+
+	{
+		ObjectLock olock(notification);
+		notification->SetNextNotification(Utility::GetTime() + notification->GetInterval());
+	}
+
+	{
+		Host::Ptr host;
+		Service::Ptr service;
+		tie(host, service) = GetHostService(checkable);
+
+		ObjectLock olock(checkable);
+
+		if (checkable->GetStateType() == StateTypeSoft)
+			return;
+
+		/* Don't send reminder notifications for OK/Up states. */
+		if ((service && service->GetState() == ServiceOK) || (!service && host->GetState() == HostUp))
+			return;
+
+		/* Don't send reminder notifications before initial ones. */
+		if (checkable->GetSuppressedNotifications() & NotificationProblem || notification->GetSuppressedNotifications() & NotificationProblem)
+			return;
+
+		/* Skip in runtime filters. */
+		if (!reachable || checkable->IsInDowntime() || checkable->IsAcknowledged() || checkable->IsFlapping())
+			return;
+	}
+
+	try {
+		Log(LogNotice, "NotificationComponent")
+			<< "Attempting to send reminder notification '" << notificationName << "'.";
+
+		notification->BeginExecuteNotification(NotificationProblem, checkable->GetLastCheckResult(), false, true);
+	} catch (const std::exception& ex) {
+		Log(LogWarning, "NotificationComponent")
+			<< "Exception occurred during notification for object '"
+			<< notificationName << "': " << DiagnosticInformation(ex, false);
 	}
 }
 
@@ -268,4 +460,9 @@ void NotificationComponent::SendNotificationsHandler(const Checkable::Ptr& check
 	const CheckResult::Ptr& cr, const String& author, const String& text)
 {
 	checkable->SendNotifications(type, cr, author, text);
+
+	for (const Notification::Ptr& notification : checkable->GetNotifications()) {
+		if (notification->GetStashedNotifications()->GetLength())
+			AddPendingNotification(notification);
+	}
 }
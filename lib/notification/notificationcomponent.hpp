@@ -6,11 +6,26 @@
 #include "notification/notificationcomponent-ti.hpp"
 #include "icinga/service.hpp"
 #include "base/configobject.hpp"
-#include "base/timer.hpp"
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/key_extractors.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
 
 namespace icinga
 {
 
+/**
+ * @ingroup notification
+ */
+struct NotificationScheduleInfo
+{
+	Notification::Ptr Object;
+	double NextNotification;
+};
+
 /**
  * @ingroup notification
  */
@@ -20,15 +35,40 @@ public:
 	DECLARE_OBJECT(NotificationComponent);
 	DECLARE_OBJECTNAME(NotificationComponent);
 
+	typedef boost::multi_index_container<
+		NotificationScheduleInfo,
+		boost::multi_index::indexed_by<
+			boost::multi_index::ordered_unique<boost::multi_index::member<NotificationScheduleInfo, Notification::Ptr, &NotificationScheduleInfo::Object> >,
+			boost::multi_index::ordered_non_unique<boost::multi_index::member<NotificationScheduleInfo, double, &NotificationScheduleInfo::NextNotification> >
+		>
+	> NotificationSet;
+
 	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
 
 	void Start(bool runtimeCreated) override;
 	void Stop(bool runtimeRemoved) override;
 
 private:
-	Timer::Ptr m_NotificationTimer;
+	std::mutex m_Mutex;
+	std::condition_variable m_CV;
+	bool m_Stopped{false};
+	std::thread m_Thread;
+
+	/* Notifications which may need a reminder, ordered by next_notification */
+	NotificationSet m_Notifications;
+
+	/* Notifications with stashed or suppressed notifications, re-evaluated periodically */
+	std::set<Notification::Ptr> m_PendingNotifications;
+	double m_NextPendingRun{0};
+
+	void NotificationThreadProc();
+	void ProcessNotification(const Notification::Ptr& notification, bool reminderDue);
+
+	void ObjectHandler(const ConfigObject::Ptr& object);
+	void UpdateNotification(const Notification::Ptr& notification, double notBefore = 0);
+	void AddPendingNotification(const Notification::Ptr& notification);
+	bool IsSkippedByHA(const Notification::Ptr& notification);
 
-	void NotificationTimerHandler();
 	void SendNotificationsHandler(const Checkable::Ptr& checkable, NotificationType type,
 		const CheckResult::Ptr& cr, const String& author, const String& text);
 };
@@ -2,6 +2,7 @@
 
 #include "perfdata/elasticsearchwriter.hpp"
 #include "perfdata/elasticsearchwriter-ti.cpp"
+#include "perfdata/gzip.hpp"
 #include "remote/url.hpp"
 #include "icinga/compatutility.hpp"
 #include "icinga/service.hpp"
@@ -17,6 +18,8 @@
 #include "base/networkstream.hpp"
 #include "base/perfdatavalue.hpp"
 #include "base/exception.hpp"
+#include "base/objectlock.hpp"
+#include "base/convert.hpp"
 #include "base/statsfunction.hpp"
 #include <boost/algorithm/string.hpp>
 #include <boost/asio/ssl/context.hpp>
@@ -46,6 +49,9 @@ void ElasticsearchWriter::OnConfigLoaded()
 
 	m_WorkQueue.SetName("ElasticsearchWriter, " + GetName());
 
+	m_Pipeline = new WriterPipeline("ElasticsearchWriter, " + GetName(),
+		[this](const std::vector<String>& batch) { SendBatch(batch); }, GetParallelRequests());
+
 	if (!GetEnableHa()) {
 		Log(LogDebug, "ElasticsearchWriter")
 			<< "HA functionality disabled. Won't pause connection: " << GetName();
@@ -64,13 +70,44 @@ void ElasticsearchWriter::StatsFunc(const Dictionary::Ptr& status, const Array::
 		size_t workQueueItems = elasticsearchwriter->m_WorkQueue.GetLength();
 		double workQueueItemRate = elasticsearchwriter->m_WorkQueue.GetTaskCount(60) / 60.0;
 
-		nodes.emplace_back(elasticsearchwriter->GetName(), new Dictionary({
+		Dictionary::Ptr node = new Dictionary({
 			{ "work_queue_items", workQueueItems },
 			{ "work_queue_item_rate", workQueueItemRate }
-		}));
+		});
 
 		perfdata->Add(new PerfdataValue("elasticsearchwriter_" + elasticsearchwriter->GetName() + "_work_queue_items", workQueueItems));
 		perfdata->Add(new PerfdataValue("elasticsearchwriter_" + elasticsearchwriter->GetName() + "_work_queue_item_rate", workQueueItemRate));
+
+		elasticsearchwriter->m_Pipeline->ReportStats(node, perfdata, "elasticsearchwriter_" + elasticsearchwriter->GetName());
+
+		double lastRequestRawBytes = elasticsearchwriter->m_LastRequestRawBytes;
+		double lastRequestSentBytes = elasticsearchwriter->m_LastRequestSentBytes;
+		double requestRawBytes = elasticsearchwriter->m_RequestRawBytes;
+		double requestSentBytes = elasticsearchwriter->m_RequestSentBytes;
+
+		node->Set("last_request_raw_bytes", lastRequestRawBytes);
+		node->Set("last_request_sent_bytes", lastRequestSentBytes);
+		node->Set("request_raw_bytes", requestRawBytes);
+		node->Set("request_sent_bytes", requestSentBytes);
+
+		perfdata->Add(new PerfdataValue("elasticsearchwriter_" + elasticsearchwriter->GetName() + "_last_request_raw_bytes", lastRequestRawBytes));
+		perfdata->Add(new PerfdataValue("elasticsearchwriter_" + elasticsearchwriter->GetName() + "_last_request_sent_bytes", lastRequestSentBytes));
+		perfdata->Add(new PerfdataValue("elasticsearchwriter_" + elasticsearchwriter->GetName() + "_request_raw_bytes", requestRawBytes, true));
+		perfdata->Add(new PerfdataValue("elasticsearchwriter_" + elasticsearchwriter->GetName() + "_request_sent_bytes", requestSentBytes, true));
+
+		size_t flushThreshold = elasticsearchwriter->m_Pipeline->GetBatchSize();
+		double retriedDocuments = elasticsearchwriter->m_RetriedDocuments;
+		double failedDocuments = elasticsearchwriter->m_FailedDocuments;
+
+		node->Set("flush_threshold", flushThreshold);
+		node->Set("retried_documents", retriedDocuments);
+		node->Set("failed_documents", failedDocuments);
+
+		perfdata->Add(new PerfdataValue("elasticsearchwriter_" + elasticsearchwriter->GetName() + "_flush_threshold", flushThreshold));
+		perfdata->Add(new PerfdataValue("elasticsearchwriter_" + elasticsearchwriter->GetName() + "_retried_documents", retriedDocuments, true));
+		perfdata->Add(new PerfdataValue("elasticsearchwriter_" + elasticsearchwriter->GetName() + "_failed_documents", failedDocuments, true));
+
+		nodes.emplace_back(elasticsearchwriter->GetName(), node);
 	}
 
 	status->Set("elasticsearchwriter", new Dictionary(std::move(nodes)));
@@ -87,12 +124,14 @@ void ElasticsearchWriter::Resume()
 
 	m_WorkQueue.SetExceptionCallback([this](boost::exception_ptr exp) { ExceptionHandler(std::move(exp)); });
 
-	/* Setup timer for periodically flushing m_DataBuffer */
-	m_FlushTimer = Timer::Create();
-	m_FlushTimer->SetInterval(GetFlushInterval());
-	m_FlushTimer->OnTimerExpired.connect([this](const Timer * const&) { FlushTimeout(); });
-	m_FlushTimer->Start();
-	m_FlushTimer->Reschedule(0);
+	/* Documents are sent once flush_threshold of them are buffered or flush_interval expired.
+	 * Up to parallel_requests bulk requests are in flight at the same time.
+	 */
+	m_Pipeline->SetMaxItems(GetMaxBufferedItems());
+	m_Pipeline->SetBatchSize(GetFlushThreshold());
+	m_Pipeline->SetFlushInterval(GetFlushInterval());
+	m_Pipeline->SetSpillPath(GetEnableSpill() ? WriterPipeline::GetSpillPath("ElasticsearchWriter", GetName()) : "");
+	m_Pipeline->Start();
 
 	/* Register for new metrics. */
 	m_HandleCheckResults = Checkable::OnNewCheckResult.connect([this](const Checkable::Ptr& checkable,
@@ -117,13 +156,8 @@ void ElasticsearchWriter::Pause()
 	m_HandleStateChanges.disconnect();
 	m_HandleNotifications.disconnect();
 
-	m_FlushTimer->Stop(true);
 	m_WorkQueue.Join();
-
-	{
-		std::unique_lock<std::mutex> lock (m_DataBufferMutex);
-		Flush();
-	}
+	m_Pipeline->Stop();
 
 	Log(LogInformation, "ElasticsearchWriter")
 		<< "'" << GetName() << "' paused.";
@@ -155,29 +189,23 @@ void ElasticsearchWriter::AddCheckResult(const Dictionary::Ptr& fields, const Ch
 	if (!GetEnableSendPerfdata())
 		return;
 
-	Array::Ptr perfdata = cr->GetPerformanceData();
+	Array::Ptr perfdata = cr->GetParsedPerformanceData();
 
 	CheckCommand::Ptr checkCommand = checkable->GetCheckCommand();
 
 	if (perfdata) {
 		ObjectLock olock(perfdata);
 		for (const Value& val : perfdata) {
-			PerfdataValue::Ptr pdv;
-
-			if (val.IsObjectType<PerfdataValue>())
-				pdv = val;
-			else {
-				try {
-					pdv = PerfdataValue::Parse(val);
-				} catch (const std::exception&) {
-					Log(LogWarning, "ElasticsearchWriter")
-						<< "Ignoring invalid perfdata for checkable '"
-						<< checkable->GetName() << "' and command '"
-						<< checkCommand->GetName() << "' with value: " << val;
-					continue;
-				}
+			if (!val.IsObjectType<PerfdataValue>()) {
+				Log(LogWarning, "ElasticsearchWriter")
+					<< "Ignoring invalid perfdata for checkable '"
+					<< checkable->GetName() << "' and command '"
+					<< checkCommand->GetName() << "' with value: " << val;
+				continue;
 			}
 
+			PerfdataValue::Ptr pdv = val;
+
 			String escapedKey = pdv->GetLabel();
 			boost::replace_all(escapedKey, " ", "_");
 			boost::replace_all(escapedKey, ".", "_");
@@ -383,9 +411,6 @@ void ElasticsearchWriter::NotificationSentToAllUsersHandlerInternal(const Notifi
 void ElasticsearchWriter::Enqueue(const Checkable::Ptr& checkable, const String& type,
 	const Dictionary::Ptr& fields, double ts)
 {
-	/* Atomically buffer the data point. */
-	std::unique_lock<std::mutex> lock(m_DataBufferMutex);
-
 	/* Format the timestamps to dynamically select the date datatype inside the index. */
 	fields->Set("@timestamp", FormatTimestamp(ts));
 	fields->Set("timestamp", FormatTimestamp(ts));
@@ -402,52 +427,40 @@ void ElasticsearchWriter::Enqueue(const Checkable::Ptr& checkable, const String&
 	Log(LogDebug, "ElasticsearchWriter")
 		<< "Checkable '" << checkable->GetName() << "' adds to metric list: '" << fieldsBody << "'.";
 
-	m_DataBuffer.emplace_back(indexBody + fieldsBody);
-
-	/* Flush if we've buffered too much to prevent excessive memory use. */
-	if (static_cast<int>(m_DataBuffer.size()) >= GetFlushThreshold()) {
-		Log(LogDebug, "ElasticsearchWriter")
-			<< "Data buffer overflow writing " << m_DataBuffer.size() << " data points";
-		Flush();
-	}
-}
-
-void ElasticsearchWriter::FlushTimeout()
-{
-	/* Prevent new data points from being added to the array, there is a
-	 * race condition where they could disappear.
-	 */
-	std::unique_lock<std::mutex> lock(m_DataBufferMutex);
-
-	/* Flush if there are any data available. */
-	if (m_DataBuffer.size() > 0) {
-		Log(LogDebug, "ElasticsearchWriter")
-			<< "Timer expired writing " << m_DataBuffer.size() << " data points";
-		Flush();
-	}
+	m_Pipeline->Enqueue(indexBody + fieldsBody);
 }
 
-void ElasticsearchWriter::Flush()
+/**
+ * Sends a batch of documents to the bulk API.
+ *
+ * Called by the pipeline, throws so that the batch is retried later.
+ */
+void ElasticsearchWriter::SendBatch(const std::vector<String>& batch)
 {
-	/* Flush can be called from 1) Timeout 2) Threshold 3) on shutdown/reload. */
-	if (m_DataBuffer.empty())
-		return;
-
-	/* Ensure you hold a lock against m_DataBuffer so that things
-	 * don't go missing after creating the body and clearing the buffer.
-	 */
-	String body = boost::algorithm::join(m_DataBuffer, "\n");
-	m_DataBuffer.clear();
+	String body = boost::algorithm::join(batch, "\n");
 
 	/* Elasticsearch 6.x requires a new line. This is compatible to 5.x.
 	 * Tested with 6.0.0 and 5.6.4.
 	 */
 	body += "\n";
 
-	SendRequest(body);
+	double start = Utility::GetTime();
+
+	Dictionary::Ptr response = SendRequest(body);
+
+	AdaptFlushThreshold(Utility::GetTime() - start, false);
+
+	if (response)
+		HandleBulkResponse(batch, response);
 }
 
-void ElasticsearchWriter::SendRequest(const String& body)
+/**
+ * Sends a bulk request.
+ *
+ * @return The bulk response if Elasticsearch accepted the request, nullptr if it was rejected for good.
+ *         Throws if the request should be retried later.
+ */
+Dictionary::Ptr ElasticsearchWriter::SendRequest(const String& body)
 {
 	namespace beast = boost::beast;
 	namespace http = beast::http;
@@ -477,7 +490,7 @@ void ElasticsearchWriter::SendRequest(const String& body)
 	} catch (const std::exception& ex) {
 		Log(LogWarning, "ElasticsearchWriter")
 			<< "Flush failed, cannot connect to Elasticsearch: " << DiagnosticInformation(ex, false);
-		return;
+		throw;
 	}
 
 	Defer s ([&stream]() {
@@ -507,9 +520,21 @@ void ElasticsearchWriter::SendRequest(const String& body)
 	if (!username.IsEmpty() && !password.IsEmpty())
 		request.set(http::field::authorization, "Basic " + Base64::Encode(username + ":" + password));
 
-	request.body() = body;
+	/* Bulk NDJSON compresses very well, saves bandwidth and TLS overhead. */
+	if (GetEnableGzip()) {
+		request.body() = Gzip::Compress(body, GetGzipLevel());
+		request.set(http::field::content_encoding, "gzip");
+	} else {
+		request.body() = body;
+	}
+
 	request.content_length(request.body().size());
 
+	m_LastRequestRawBytes = body.GetLength();
+	m_LastRequestSentBytes = request.body().size();
+	m_RequestRawBytes += body.GetLength();
+	m_RequestSentBytes += request.body().size();
+
 	/* Don't log the request body to debug log, this is already done above. */
 	Log(LogDebug, "ElasticsearchWriter")
 		<< "Sending " << request.method_string() << " request" << ((!username.IsEmpty() && !password.IsEmpty()) ? " with basic auth" : "" )
@@ -558,7 +583,14 @@ void ElasticsearchWriter::SendRequest(const String& body)
 					<< "401 Unauthorized. The HTTP API requires authentication but no username/password has been configured.";
 			}
 
-			return;
+			return nullptr;
+		}
+
+		/* The cluster can't keep up, e.g. its write thread pool queue is full. */
+		if (response.result() == http::status::too_many_requests) {
+			AdaptFlushThreshold(0, true);
+
+			BOOST_THROW_EXCEPTION(std::runtime_error("Elasticsearch rejected the bulk request with 429 Too Many Requests"));
 		}
 
 		std::ostringstream msgbuf;
@@ -583,13 +615,127 @@ void ElasticsearchWriter::SendRequest(const String& body)
 		} catch (...) {
 			Log(LogWarning, "ElasticsearchWriter")
 				<< "Unable to parse JSON response:\n" << body;
-			return;
 		}
 
-		String error = jsonResponse->Get("error");
+		if (jsonResponse) {
+			String error = jsonResponse->Get("error");
+
+			Log(LogCritical, "ElasticsearchWriter")
+				<< "Error: '" << error << "'. " << msgbuf.str();
+		}
+
+		/* Rejected documents won't become valid by retrying them, an overloaded/unavailable cluster may recover. */
+		if (response.result_int() >= 500) {
+			BOOST_THROW_EXCEPTION(std::runtime_error(msgbuf.str()));
+		}
+
+		return nullptr;
+	}
+
+	try {
+		return JsonDecode(response.body());
+	} catch (const std::exception&) {
+		Log(LogWarning, "ElasticsearchWriter")
+			<< "Unable to parse JSON response:\n" << response.body();
+		return nullptr;
+	}
+}
+
+/**
+ * Retries the documents Elasticsearch rejected as it was overloaded (429) and counts the other rejected ones.
+ * Bulk responses list the result of each document in the order they were sent.
+ */
+void ElasticsearchWriter::HandleBulkResponse(const std::vector<String>& batch, const Dictionary::Ptr& response)
+{
+	if (!response->Get("errors").ToBool())
+		return;
+
+	Value itemsValue = response->Get("items");
+
+	if (!itemsValue.IsObjectType<Array>())
+		return;
+
+	Array::Ptr items = itemsValue;
+
+	std::vector<String> retry;
+	size_t failed = 0;
+	size_t i = 0;
+
+	ObjectLock olock (items);
+
+	for (const Value& itemValue : items) {
+		if (i >= batch.size())
+			break;
+
+		int status = 0;
+
+		if (itemValue.IsObjectType<Dictionary>()) {
+			Value result = static_cast<Dictionary::Ptr>(itemValue)->Get("index");
+
+			if (result.IsObjectType<Dictionary>())
+				status = Convert::ToLong(static_cast<Dictionary::Ptr>(result)->Get("status"));
+		}
+
+		if (status == 429)
+			retry.emplace_back(batch[i]);
+		else if (status > 299)
+			failed++;
+
+		i++;
+	}
+
+	if (failed > 0) {
+		Log(LogWarning, "ElasticsearchWriter")
+			<< "Elasticsearch rejected " << failed << " of " << batch.size() << " documents.";
 
-		Log(LogCritical, "ElasticsearchWriter")
-			<< "Error: '" << error << "'. " << msgbuf.str();
+		m_FailedDocuments += failed;
+	}
+
+	if (!retry.empty()) {
+		/* All documents rejected, let the pipeline retry the whole batch. */
+		if (retry.size() == batch.size()) {
+			AdaptFlushThreshold(0, true);
+
+			BOOST_THROW_EXCEPTION(std::runtime_error("Elasticsearch rejected all documents with 429 Too Many Requests"));
+		}
+
+		Log(LogWarning, "ElasticsearchWriter")
+			<< "Elasticsearch is overloaded and rejected " << retry.size() << " of " << batch.size() << " documents, retrying them.";
+
+		m_RetriedDocuments += retry.size();
+		AdaptFlushThreshold(0, true);
+		m_Pipeline->Requeue(std::move(retry));
+	}
+}
+
+/**
+ * Grows the bulk requests while Elasticsearch answers them quickly and halves them
+ * once it is slower than target_response_time or rejects them.
+ *
+ * The size stays between a tenth and ten times the configured flush_threshold.
+ */
+void ElasticsearchWriter::AdaptFlushThreshold(double responseTime, bool rejected)
+{
+	if (!GetEnableAdaptiveFlushThreshold())
+		return;
+
+	size_t configured = GetFlushThreshold();
+	size_t step = std::max<size_t>(configured / 10, 1);
+	size_t current = m_Pipeline->GetBatchSize();
+	size_t next = current;
+	double target = GetTargetResponseTime();
+
+	if (rejected || responseTime > target)
+		next = std::max(current / 2, step);
+	else if (responseTime < target / 2)
+		next = std::min(current + step, configured * 10);
+
+	if (next != current) {
+		Log(LogNotice, "ElasticsearchWriter")
+			<< "'" << GetName() << "': Changing bulk size from " << current << " to " << next << " documents"
+			<< (rejected ? " after a rejected request." : " after a response took " + Convert::ToString(responseTime) + " second(s).");
+
+		m_Pipeline->SetBatchSize(next);
 	}
 }
 
@@ -683,3 +829,27 @@ String ElasticsearchWriter::FormatTimestamp(double ts)
 
 	return Utility::FormatDateTime("%Y-%m-%dT%H:%M:%S", ts) + "." + Convert::ToString(milliSeconds) + Utility::FormatDateTime("%z", ts);
 }
+
+void ElasticsearchWriter::ValidateGzipLevel(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<ElasticsearchWriter>::ValidateGzipLevel(lvalue, utils);
+
+	if (lvalue() < 1 || lvalue() > 9)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "gzip_level" }, "Value must be between 1 and 9."));
+}
+
+void ElasticsearchWriter::ValidateParallelRequests(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<ElasticsearchWriter>::ValidateParallelRequests(lvalue, utils);
+
+	if (lvalue() < 1)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "parallel_requests" }, "Value must be greater than 0."));
+}
+
+void ElasticsearchWriter::ValidateTargetResponseTime(const Lazy<double>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<ElasticsearchWriter>::ValidateTargetResponseTime(lvalue, utils);
+
+	if (lvalue() <= 0)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "target_response_time" }, "Value must be greater than 0."));
+}
@@ -4,11 +4,14 @@
 #define ELASTICSEARCHWRITER_H
 
 #include "perfdata/elasticsearchwriter-ti.hpp"
+#include "perfdata/writerpipeline.hpp"
 #include "icinga/service.hpp"
+#include "base/atomic.hpp"
 #include "base/configobject.hpp"
 #include "base/workqueue.hpp"
 #include "base/timer.hpp"
 #include "base/tlsstream.hpp"
+#include <cstdint>
 
 namespace icinga
 {
@@ -23,6 +26,10 @@ public:
 
 	static String FormatTimestamp(double ts);
 
+	void ValidateGzipLevel(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
+	void ValidateParallelRequests(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
+	void ValidateTargetResponseTime(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
+
 protected:
 	void OnConfigLoaded() override;
 	void Resume() override;
@@ -31,10 +38,19 @@ protected:
 private:
 	String m_EventPrefix;
 	WorkQueue m_WorkQueue{10000000, 1};
-	boost::signals2::connection m_HandleCheckResults, m_HandleStateChanges, m_HandleNotifications;
-	Timer::Ptr m_FlushTimer;
-	std::vector<String> m_DataBuffer;
-	std::mutex m_DataBufferMutex;
+	SignalConnection m_HandleCheckResults, m_HandleStateChanges;
+	boost::signals2::connection m_HandleNotifications;
+	WriterPipeline::Ptr m_Pipeline;
+
+	/* request body sizes before and after compression */
+	Atomic<uint_fast64_t> m_LastRequestRawBytes{0};
+	Atomic<uint_fast64_t> m_LastRequestSentBytes{0};
+	Atomic<uint_fast64_t> m_RequestRawBytes{0};
+	Atomic<uint_fast64_t> m_RequestSentBytes{0};
+
+	/* documents Elasticsearch rejected as it was overloaded resp. for other reasons */
+	Atomic<uint_fast64_t> m_RetriedDocuments{0};
+	Atomic<uint_fast64_t> m_FailedDocuments{0};
 
 	void AddCheckResult(const Dictionary::Ptr& fields, const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
 
@@ -55,9 +71,10 @@ private:
 	OptionalTlsStream Connect();
 	void AssertOnWorkQueue();
 	void ExceptionHandler(boost::exception_ptr exp);
-	void FlushTimeout();
-	void Flush();
-	void SendRequest(const String& body);
+	void SendBatch(const std::vector<String>& batch);
+	Dictionary::Ptr SendRequest(const String& body);
+	void HandleBulkResponse(const std::vector<String>& batch, const Dictionary::Ptr& response);
+	void AdaptFlushThreshold(double responseTime, bool rejected);
 };
 
 }
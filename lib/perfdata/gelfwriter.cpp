@@ -40,6 +40,8 @@ void GelfWriter::OnConfigLoaded()
 
 	m_WorkQueue.SetName("GelfWriter, " + GetName());
 
+	m_Pipeline = new WriterPipeline("GelfWriter, " + GetName(), [this](const std::vector<String>& batch) { SendBatch(batch); });
+
 	if (!GetEnableHa()) {
 		Log(LogDebug, "GelfWriter")
 			<< "HA functionality disabled. Won't pause connection: " << GetName();
@@ -58,15 +60,19 @@ void GelfWriter::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perf
 		size_t workQueueItems = gelfwriter->m_WorkQueue.GetLength();
 		double workQueueItemRate = gelfwriter->m_WorkQueue.GetTaskCount(60) / 60.0;
 
-		nodes.emplace_back(gelfwriter->GetName(), new Dictionary({
+		Dictionary::Ptr node = new Dictionary({
 			{ "work_queue_items", workQueueItems },
 			{ "work_queue_item_rate", workQueueItemRate },
 			{ "connected", gelfwriter->GetConnected() },
 			{ "source", gelfwriter->GetSource() }
-		}));
+		});
 
 		perfdata->Add(new PerfdataValue("gelfwriter_" + gelfwriter->GetName() + "_work_queue_items", workQueueItems));
 		perfdata->Add(new PerfdataValue("gelfwriter_" + gelfwriter->GetName() + "_work_queue_item_rate", workQueueItemRate));
+
+		gelfwriter->m_Pipeline->ReportStats(node, perfdata, "gelfwriter_" + gelfwriter->GetName());
+
+		nodes.emplace_back(gelfwriter->GetName(), node);
 	}
 
 	status->Set("gelfwriter", new Dictionary(std::move(nodes)));
@@ -82,12 +88,11 @@ void GelfWriter::Resume()
 	/* Register exception handler for WQ tasks. */
 	m_WorkQueue.SetExceptionCallback([this](boost::exception_ptr exp) { ExceptionHandler(std::move(exp)); });
 
-	/* Timer for reconnecting */
-	m_ReconnectTimer = Timer::Create();
-	m_ReconnectTimer->SetInterval(10);
-	m_ReconnectTimer->OnTimerExpired.connect([this](const Timer * const&) { ReconnectTimerHandler(); });
-	m_ReconnectTimer->Start();
-	m_ReconnectTimer->Reschedule(0);
+	/* Messages are sent in batches at least every second, the connection is (re-)established on demand. */
+	m_Pipeline->SetMaxItems(GetMaxBufferedItems());
+	m_Pipeline->SetFlushInterval(1);
+	m_Pipeline->SetSpillPath(GetEnableSpill() ? WriterPipeline::GetSpillPath("GelfWriter", GetName()) : "");
+	m_Pipeline->Start();
 
 	/* Register event handlers. */
 	m_HandleCheckResults = Checkable::OnNewCheckResult.connect([this](const Checkable::Ptr& checkable,
@@ -112,19 +117,14 @@ void GelfWriter::Pause()
 	m_HandleNotifications.disconnect();
 	m_HandleStateChanges.disconnect();
 
-	m_ReconnectTimer->Stop(true);
-
-	m_WorkQueue.Enqueue([this]() {
-		try {
-			ReconnectInternal();
-		} catch (const std::exception&) {
-			Log(LogInformation, "GelfWriter")
-				<< "Unable to connect, not flushing buffers. Data may be lost.";
-		}
-	}, PriorityImmediate);
-
-	m_WorkQueue.Enqueue([this]() { DisconnectInternal(); }, PriorityLow);
+	/* Whatever can't be sent anymore is spilled (if enabled) or dropped by the pipeline. */
 	m_WorkQueue.Join();
+	m_Pipeline->Stop();
+
+	{
+		std::unique_lock<std::mutex> lock(m_StreamMutex);
+		DisconnectInternal();
+	}
 
 	Log(LogInformation, "GelfWriter")
 		<< "'" << GetName() << "' paused.";
@@ -142,21 +142,10 @@ void GelfWriter::ExceptionHandler(boost::exception_ptr exp)
 	Log(LogCritical, "GelfWriter") << "Exception during Graylog Gelf operation: " << DiagnosticInformation(exp, false);
 	Log(LogDebug, "GelfWriter") << "Exception during Graylog Gelf operation: " << DiagnosticInformation(exp, true);
 
+	std::unique_lock<std::mutex> lock(m_StreamMutex);
 	DisconnectInternal();
 }
 
-void GelfWriter::Reconnect()
-{
-	AssertOnWorkQueue();
-
-	if (IsPaused()) {
-		SetConnected(false);
-		return;
-	}
-
-	ReconnectInternal();
-}
-
 void GelfWriter::ReconnectInternal()
 {
 	double startTime = Utility::GetTime();
@@ -228,11 +217,6 @@ void GelfWriter::ReconnectInternal()
 		<< "Finished reconnecting to Graylog Gelf in " << std::setw(2) << Utility::GetTime() - startTime << " second(s).";
 }
 
-void GelfWriter::ReconnectTimerHandler()
-{
-	m_WorkQueue.Enqueue([this]() { Reconnect(); }, PriorityNormal);
-}
-
 void GelfWriter::Disconnect()
 {
 	AssertOnWorkQueue();
@@ -322,27 +306,21 @@ void GelfWriter::CheckResultHandlerInternal(const Checkable::Ptr& checkable, con
 	}
 
 	if (cr && GetEnableSendPerfdata()) {
-		Array::Ptr perfdata = cr->GetPerformanceData();
+		Array::Ptr perfdata = cr->GetParsedPerformanceData();
 
 		if (perfdata) {
 			ObjectLock olock(perfdata);
 			for (const Value& val : perfdata) {
-				PerfdataValue::Ptr pdv;
-
-				if (val.IsObjectType<PerfdataValue>())
-					pdv = val;
-				else {
-					try {
-						pdv = PerfdataValue::Parse(val);
-					} catch (const std::exception&) {
-						Log(LogWarning, "GelfWriter")
-							<< "Ignoring invalid perfdata for checkable '"
-							<< checkable->GetName() << "' and command '"
-							<< checkCommand->GetName() << "' with value: " << val;
-						continue;
-					}
+				if (!val.IsObjectType<PerfdataValue>()) {
+					Log(LogWarning, "GelfWriter")
+						<< "Ignoring invalid perfdata for checkable '"
+						<< checkable->GetName() << "' and command '"
+						<< checkCommand->GetName() << "' with value: " << val;
+					continue;
 				}
 
+				PerfdataValue::Ptr pdv = val;
+
 				String escaped_key = pdv->GetLabel();
 				boost::replace_all(escaped_key, " ", "_");
 				boost::replace_all(escaped_key, ".", "_");
@@ -505,20 +483,31 @@ String GelfWriter::ComposeGelfMessage(const Dictionary::Ptr& fields, const Strin
 }
 
 void GelfWriter::SendLogMessage(const Checkable::Ptr& checkable, const String& gelfMessage)
+{
+	Log(LogDebug, "GelfWriter")
+		<< "Checkable '" << checkable->GetName() << "' adds message '" << gelfMessage << "'.";
+
+	m_Pipeline->Enqueue(gelfMessage);
+}
+
+/**
+ * Writes a batch of GELF messages, each terminated by a null byte, (re-)connects if necessary.
+ *
+ * Called by the pipeline, throws so that the batch is retried later.
+ */
+void GelfWriter::SendBatch(const std::vector<String>& batch)
 {
 	std::ostringstream msgbuf;
-	msgbuf << gelfMessage;
-	msgbuf << '\0';
 
-	String log = msgbuf.str();
+	for (const String& message : batch) {
+		msgbuf << message << '\0';
+	}
 
-	if (!GetConnected())
-		return;
+	std::unique_lock<std::mutex> lock(m_StreamMutex);
 
-	try {
-		Log(LogDebug, "GelfWriter")
-			<< "Checkable '" << checkable->GetName() << "' sending message '" << log << "'.";
+	ReconnectInternal();
 
+	try {
 		if (m_Stream.first) {
 			boost::asio::write(*m_Stream.first, boost::asio::buffer(msgbuf.str()));
 			m_Stream.first->flush();
@@ -530,6 +519,8 @@ void GelfWriter::SendLogMessage(const Checkable::Ptr& checkable, const String& g
 		Log(LogCritical, "GelfWriter")
 			<< "Cannot write to TCP socket on host '" << GetHost() << "' port '" << GetPort() << "'.";
 
-		throw ex;
+		DisconnectInternal();
+
+		throw;
 	}
 }
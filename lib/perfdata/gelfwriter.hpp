@@ -4,12 +4,14 @@
 #define GELFWRITER_H
 
 #include "perfdata/gelfwriter-ti.hpp"
+#include "perfdata/writerpipeline.hpp"
 #include "icinga/service.hpp"
 #include "base/configobject.hpp"
 #include "base/tcpsocket.hpp"
 #include "base/timer.hpp"
 #include "base/workqueue.hpp"
 #include <fstream>
+#include <mutex>
 
 namespace icinga
 {
@@ -34,10 +36,12 @@ protected:
 
 private:
 	OptionalTlsStream m_Stream;
+	std::mutex m_StreamMutex;
 	WorkQueue m_WorkQueue{10000000, 1};
+	WriterPipeline::Ptr m_Pipeline;
 
-	boost::signals2::connection m_HandleCheckResults, m_HandleNotifications, m_HandleStateChanges;
-	Timer::Ptr m_ReconnectTimer;
+	SignalConnection m_HandleCheckResults, m_HandleStateChanges;
+	boost::signals2::connection m_HandleNotifications;
 
 	void CheckResultHandler(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
 	void CheckResultHandlerInternal(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
@@ -52,12 +56,10 @@ private:
 
 	String ComposeGelfMessage(const Dictionary::Ptr& fields, const String& source, double ts);
 	void SendLogMessage(const Checkable::Ptr& checkable, const String& gelfMessage);
-
-	void ReconnectTimerHandler();
+	void SendBatch(const std::vector<String>& batch);
 
 	void Disconnect();
 	void DisconnectInternal();
-	void Reconnect();
 	void ReconnectInternal();
 
 	void AssertOnWorkQueue();
@@ -37,6 +37,23 @@ void GraphiteWriter::OnConfigLoaded()
 
 	m_WorkQueue.SetName("GraphiteWriter, " + GetName());
 
+	Array::Ptr relays = GetRelays();
+
+	if (relays && relays->GetLength() > 0) {
+		ObjectLock olock(relays);
+
+		for (const String& relay : relays) {
+			String host, port;
+			ParseRelay(relay, host, port);
+
+			for (int i = 0; i < GetParallelConnections(); i++)
+				AddRelay(host, port);
+		}
+	} else {
+		for (int i = 0; i < GetParallelConnections(); i++)
+			AddRelay(GetHost(), GetPort());
+	}
+
 	if (!GetEnableHa()) {
 		Log(LogDebug, "GraphiteWriter")
 			<< "HA functionality disabled. Won't pause connection: " << GetName();
@@ -61,14 +78,36 @@ void GraphiteWriter::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr&
 		size_t workQueueItems = graphitewriter->m_WorkQueue.GetLength();
 		double workQueueItemRate = graphitewriter->m_WorkQueue.GetTaskCount(60) / 60.0;
 
-		nodes.emplace_back(graphitewriter->GetName(), new Dictionary({
+		Dictionary::Ptr node = new Dictionary({
 			{ "work_queue_items", workQueueItems },
 			{ "work_queue_item_rate", workQueueItemRate },
 			{ "connected", graphitewriter->GetConnected() }
-		}));
+		});
 
 		perfdata->Add(new PerfdataValue("graphitewriter_" + graphitewriter->GetName() + "_work_queue_items", workQueueItems));
 		perfdata->Add(new PerfdataValue("graphitewriter_" + graphitewriter->GetName() + "_work_queue_item_rate", workQueueItemRate));
+
+		if (graphitewriter->m_Relays.size() == 1) {
+			graphitewriter->m_Relays[0]->Pipeline->ReportStats(node, perfdata, "graphitewriter_" + graphitewriter->GetName());
+		} else {
+			DictionaryData relays;
+
+			for (size_t i = 0; i < graphitewriter->m_Relays.size(); i++) {
+				auto& relay (*graphitewriter->m_Relays[i]);
+				Dictionary::Ptr relayNode = new Dictionary({
+					{ "host", relay.Host },
+					{ "port", relay.Port },
+					{ "connected", relay.Connected.load() }
+				});
+
+				relay.Pipeline->ReportStats(relayNode, perfdata, "graphitewriter_" + graphitewriter->GetName() + "_" + Convert::ToString(i));
+				relays.emplace_back(Convert::ToString(i), relayNode);
+			}
+
+			node->Set("relays", new Dictionary(std::move(relays)));
+		}
+
+		nodes.emplace_back(graphitewriter->GetName(), node);
 	}
 
 	status->Set("graphitewriter", new Dictionary(std::move(nodes)));
@@ -87,12 +126,18 @@ void GraphiteWriter::Resume()
 	/* Register exception handler for WQ tasks. */
 	m_WorkQueue.SetExceptionCallback([this](boost::exception_ptr exp) { ExceptionHandler(std::move(exp)); });
 
-	/* Timer for reconnecting */
-	m_ReconnectTimer = Timer::Create();
-	m_ReconnectTimer->SetInterval(10);
-	m_ReconnectTimer->OnTimerExpired.connect([this](const Timer * const&) { ReconnectTimerHandler(); });
-	m_ReconnectTimer->Start();
-	m_ReconnectTimer->Reschedule(0);
+	/* Lines are sent in batches at least every second, connections are (re-)established on demand.
+	 * Every relay has its own buffer, so one which is unavailable doesn't hold up the others.
+	 */
+	for (size_t i = 0; i < m_Relays.size(); i++) {
+		auto& relay (*m_Relays[i]);
+		String spillName = m_Relays.size() == 1 ? GetName() : GetName() + "-" + Convert::ToString(i);
+
+		relay.Pipeline->SetMaxItems(GetMaxBufferedItems());
+		relay.Pipeline->SetFlushInterval(1);
+		relay.Pipeline->SetSpillPath(GetEnableSpill() ? WriterPipeline::GetSpillPath("GraphiteWriter", spillName) : "");
+		relay.Pipeline->Start();
+	}
 
 	/* Register event handlers. */
 	m_HandleCheckResults = Checkable::OnNewCheckResult.connect([this](const Checkable::Ptr& checkable,
@@ -107,20 +152,16 @@ void GraphiteWriter::Resume()
 void GraphiteWriter::Pause()
 {
 	m_HandleCheckResults.disconnect();
-	m_ReconnectTimer->Stop(true);
 
-	try {
-		ReconnectInternal();
-	} catch (const std::exception&) {
-		Log(LogInformation, "GraphiteWriter")
-			<< "'" << GetName() << "' paused. Unable to connect, not flushing buffers. Data may be lost on reload.";
+	/* Whatever can't be sent anymore is spilled (if enabled) or dropped by the pipeline. */
+	m_WorkQueue.Join();
 
-		ObjectImpl<GraphiteWriter>::Pause();
-		return;
-	}
+	for (auto& relay : m_Relays) {
+		relay->Pipeline->Stop();
 
-	m_WorkQueue.Join();
-	DisconnectInternal();
+		std::unique_lock<std::mutex> lock(relay->StreamMutex);
+		DisconnectInternal(*relay);
+	}
 
 	Log(LogInformation, "GraphiteWriter")
 		<< "'" << GetName() << "' paused.";
@@ -139,7 +180,7 @@ void GraphiteWriter::AssertOnWorkQueue()
 /**
  * Exception handler for the WQ.
  *
- * Closes the connection if connected.
+ * Closes the connections if connected.
  *
  * @param exp Exception pointer
  */
@@ -150,34 +191,85 @@ void GraphiteWriter::ExceptionHandler(boost::exception_ptr exp)
 	Log(LogDebug, "GraphiteWriter")
 		<< "Exception during Graphite operation: " << DiagnosticInformation(std::move(exp));
 
-	if (GetConnected()) {
-		m_Stream->close();
-
-		SetConnected(false);
+	for (auto& relay : m_Relays) {
+		std::unique_lock<std::mutex> lock(relay->StreamMutex);
+		DisconnectInternal(*relay);
 	}
 }
 
 /**
- * Reconnect method, stops when the feature is paused in HA zones.
+ * Adds a connection to a Graphite relay, including the pipeline buffering its lines.
  *
- * Called inside the WQ.
+ * @param host Relay host
+ * @param port Relay port
  */
-void GraphiteWriter::Reconnect()
+void GraphiteWriter::AddRelay(const String& host, const String& port)
 {
-	AssertOnWorkQueue();
+	std::unique_ptr<Relay> relay (new Relay());
+	Relay* rawRelay = relay.get();
 
-	if (IsPaused()) {
-		SetConnected(false);
-		return;
+	relay->Host = host;
+	relay->Port = port;
+
+	String name = "GraphiteWriter, " + GetName();
+
+	if (GetRelays() || GetParallelConnections() > 1)
+		name += ", " + host + ":" + port + " #" + Convert::ToString(m_Relays.size());
+
+	relay->Pipeline = new WriterPipeline(name, [this, rawRelay](const std::vector<String>& batch) { SendBatch(*rawRelay, batch); });
+
+	m_Relays.emplace_back(std::move(relay));
+}
+
+/**
+ * Splits a relay specification ("host", "host:port" or "[ipv6]:port") into host and port.
+ *
+ * @param relay Relay specification
+ * @param host Receives the host
+ * @param port Receives the port, 2003 if none is given
+ * @return Whether the specification is valid
+ */
+bool GraphiteWriter::ParseRelay(const String& relay, String& host, String& port)
+{
+	host = relay;
+	port = "2003";
+
+	if (relay.IsEmpty())
+		return false;
+
+	if (relay[0] == '[') {
+		size_t end = relay.Find("]");
+
+		if (end == String::NPos)
+			return false;
+
+		host = relay.SubStr(1, end - 1);
+
+		if (end + 1 < relay.GetLength()) {
+			if (relay[end + 1] != ':')
+				return false;
+
+			port = relay.SubStr(end + 2);
+		}
+	} else {
+		size_t colon = relay.Find(":");
+
+		/* more than one colon: an IPv6 address without port */
+		if (colon != String::NPos && relay.Find(":", colon + 1) == String::NPos) {
+			host = relay.SubStr(0, colon);
+			port = relay.SubStr(colon + 1);
+		}
 	}
 
-	ReconnectInternal();
+	return !host.IsEmpty() && !port.IsEmpty();
 }
 
 /**
- * Reconnect method, connects to a TCP Stream
+ * Connects to a relay unless already connected, throws on failure.
+ *
+ * Called with the relay's StreamMutex held.
  */
-void GraphiteWriter::ReconnectInternal()
+void GraphiteWriter::ReconnectInternal(Relay& relay)
 {
 	double startTime = Utility::GetTime();
 
@@ -185,69 +277,64 @@ void GraphiteWriter::ReconnectInternal()
 
 	SetShouldConnect(true);
 
-	if (GetConnected())
+	if (relay.Connected)
 		return;
 
 	Log(LogNotice, "GraphiteWriter")
-		<< "Reconnecting to Graphite on host '" << GetHost() << "' port '" << GetPort() << "'.";
+		<< "Reconnecting to Graphite on host '" << relay.Host << "' port '" << relay.Port << "'.";
 
-	m_Stream = Shared<AsioTcpStream>::Make(IoEngine::Get().GetIoContext());
+	relay.Stream = Shared<AsioTcpStream>::Make(IoEngine::Get().GetIoContext());
 
 	try {
-		icinga::Connect(m_Stream->lowest_layer(), GetHost(), GetPort());
+		icinga::Connect(relay.Stream->lowest_layer(), relay.Host, relay.Port);
 	} catch (const std::exception& ex) {
 		Log(LogWarning, "GraphiteWriter")
-			<< "Can't connect to Graphite on host '" << GetHost() << "' port '" << GetPort() << ".'";
+			<< "Can't connect to Graphite on host '" << relay.Host << "' port '" << relay.Port << ".'";
 
-		SetConnected(false);
+		relay.Connected = false;
+		UpdateConnected();
 
 		throw;
 	}
 
-	SetConnected(true);
+	relay.Connected = true;
+	UpdateConnected();
 
 	Log(LogInformation, "GraphiteWriter")
 		<< "Finished reconnecting to Graphite in " << std::setw(2) << Utility::GetTime() - startTime << " second(s).";
 }
 
 /**
- * Reconnect handler called by the timer.
+ * Disconnect a relay's stream.
  *
- * Enqueues a reconnect task into the WQ.
+ * Called with the relay's StreamMutex held.
  */
-void GraphiteWriter::ReconnectTimerHandler()
+void GraphiteWriter::DisconnectInternal(Relay& relay)
 {
-	if (IsPaused())
+	if (!relay.Connected)
 		return;
 
-	m_WorkQueue.Enqueue([this]() { Reconnect(); }, PriorityHigh);
-}
-
-/**
- * Disconnect the stream.
- *
- * Called inside the WQ.
- */
-void GraphiteWriter::Disconnect()
-{
-	AssertOnWorkQueue();
+	relay.Stream->close();
 
-	DisconnectInternal();
+	relay.Connected = false;
+	UpdateConnected();
 }
 
 /**
- * Disconnect the stream.
- *
- * Called outside the WQ.
+ * The writer counts as connected as long as at least one relay is.
  */
-void GraphiteWriter::DisconnectInternal()
+void GraphiteWriter::UpdateConnected()
 {
-	if (!GetConnected())
-		return;
+	bool connected = false;
 
-	m_Stream->close();
+	for (auto& relay : m_Relays) {
+		if (relay->Connected) {
+			connected = true;
+			break;
+		}
+	}
 
-	SetConnected(false);
+	SetConnected(connected);
 }
 
 /**
@@ -278,10 +365,6 @@ void GraphiteWriter::CheckResultHandlerInternal(const Checkable::Ptr& checkable,
 
 	CONTEXT("Processing check result for '" << checkable->GetName() << "'");
 
-	/* TODO: Deal with missing connection here. Needs refactoring
-	 * into parsing the actual performance data and then putting it
-	 * into a queue for re-inserting. */
-
 	if (!IcingaApplication::GetInstance()->GetEnablePerfdata() || !checkable->GetEnablePerfdata())
 		return;
 
@@ -341,7 +424,7 @@ void GraphiteWriter::CheckResultHandlerInternal(const Checkable::Ptr& checkable,
  */
 void GraphiteWriter::SendPerfdata(const Checkable::Ptr& checkable, const String& prefix, const CheckResult::Ptr& cr, double ts)
 {
-	Array::Ptr perfdata = cr->GetPerformanceData();
+	Array::Ptr perfdata = cr->GetParsedPerformanceData();
 
 	if (!perfdata)
 		return;
@@ -350,22 +433,16 @@ void GraphiteWriter::SendPerfdata(const Checkable::Ptr& checkable, const String&
 
 	ObjectLock olock(perfdata);
 	for (const Value& val : perfdata) {
-		PerfdataValue::Ptr pdv;
-
-		if (val.IsObjectType<PerfdataValue>())
-			pdv = val;
-		else {
-			try {
-				pdv = PerfdataValue::Parse(val);
-			} catch (const std::exception&) {
-				Log(LogWarning, "GraphiteWriter")
-					<< "Ignoring invalid perfdata for checkable '"
-					<< checkable->GetName() << "' and command '"
-					<< checkCommand->GetName() << "' with value: " << val;
-				continue;
-			}
+		if (!val.IsObjectType<PerfdataValue>()) {
+			Log(LogWarning, "GraphiteWriter")
+				<< "Ignoring invalid perfdata for checkable '"
+				<< checkable->GetName() << "' and command '"
+				<< checkCommand->GetName() << "' with value: " << val;
+			continue;
 		}
 
+		PerfdataValue::Ptr pdv = val;
+
 		String escapedKey = EscapeMetricLabel(pdv->GetLabel());
 
 		SendMetric(checkable, prefix, escapedKey + ".value", pdv->GetValue(), ts);
@@ -394,8 +471,6 @@ void GraphiteWriter::SendPerfdata(const Checkable::Ptr& checkable, const String&
  */
 void GraphiteWriter::SendMetric(const Checkable::Ptr& checkable, const String& prefix, const String& name, double value, double ts)
 {
-	namespace asio = boost::asio;
-
 	std::ostringstream msgbuf;
 	msgbuf << prefix << "." << name << " " << Convert::ToString(value) << " " << static_cast<long>(ts);
 
@@ -405,19 +480,36 @@ void GraphiteWriter::SendMetric(const Checkable::Ptr& checkable, const String& p
 	// do not send \n to debug log
 	msgbuf << "\n";
 
-	std::unique_lock<std::mutex> lock(m_StreamMutex);
+	/* All metrics of a host/service go through the same relay. */
+	m_Relays[Utility::SDBM(prefix) % m_Relays.size()]->Pipeline->Enqueue(msgbuf.str());
+}
 
-	if (!GetConnected())
-		return;
+/**
+ * Writes a batch of metric lines to a relay, (re-)connects if necessary.
+ *
+ * Called by the relay's pipeline, throws so that the batch is retried later.
+ *
+ * @param relay Relay the batch was buffered for
+ * @param batch Metric lines including their trailing newline
+ */
+void GraphiteWriter::SendBatch(Relay& relay, const std::vector<String>& batch)
+{
+	namespace asio = boost::asio;
+
+	std::unique_lock<std::mutex> lock(relay.StreamMutex);
+
+	ReconnectInternal(relay);
 
 	try {
-		asio::write(*m_Stream, asio::buffer(msgbuf.str()));
-		m_Stream->flush();
+		asio::write(*relay.Stream, asio::buffer(boost::algorithm::join(batch, "")));
+		relay.Stream->flush();
 	} catch (const std::exception& ex) {
 		Log(LogCritical, "GraphiteWriter")
-			<< "Cannot write to TCP socket on host '" << GetHost() << "' port '" << GetPort() << "'.";
+			<< "Cannot write to TCP socket on host '" << relay.Host << "' port '" << relay.Port << "'.";
 
-		throw ex;
+		DisconnectInternal(relay);
+
+		throw;
 	}
 }
 
@@ -512,3 +604,42 @@ void GraphiteWriter::ValidateServiceNameTemplate(const Lazy<String>& lvalue, con
 	if (!MacroProcessor::ValidateMacroString(lvalue()))
 		BOOST_THROW_EXCEPTION(ValidationError(this, { "service_name_template" }, "Closing $ not found in macro format string '" + lvalue() + "'."));
 }
+
+/**
+ * Validate the configuration setting 'relays'
+ *
+ * @param lvalue Array of relay specifications
+ * @param utils Helper, unused
+ */
+void GraphiteWriter::ValidateRelays(const Lazy<Array::Ptr>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<GraphiteWriter>::ValidateRelays(lvalue, utils);
+
+	Array::Ptr relays = lvalue();
+
+	if (!relays)
+		return;
+
+	ObjectLock olock(relays);
+
+	for (const String& relay : relays) {
+		String host, port;
+
+		if (!ParseRelay(relay, host, port))
+			BOOST_THROW_EXCEPTION(ValidationError(this, { "relays" }, "Invalid relay '" + relay + "', expected 'host' or 'host:port'."));
+	}
+}
+
+/**
+ * Validate the configuration setting 'parallel_connections'
+ *
+ * @param lvalue Number of connections per relay
+ * @param utils Helper, unused
+ */
+void GraphiteWriter::ValidateParallelConnections(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<GraphiteWriter>::ValidateParallelConnections(lvalue, utils);
+
+	if (lvalue() < 1)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "parallel_connections" }, "Value must be greater than 0."));
+}
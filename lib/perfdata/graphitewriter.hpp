@@ -4,13 +4,17 @@
 #define GRAPHITEWRITER_H
 
 #include "perfdata/graphitewriter-ti.hpp"
+#include "perfdata/writerpipeline.hpp"
 #include "icinga/service.hpp"
 #include "base/configobject.hpp"
 #include "base/tcpsocket.hpp"
 #include "base/timer.hpp"
 #include "base/workqueue.hpp"
+#include <atomic>
 #include <fstream>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 namespace icinga
 {
@@ -30,6 +34,8 @@ public:
 
 	void ValidateHostNameTemplate(const Lazy<String>& lvalue, const ValidationUtils& utils) override;
 	void ValidateServiceNameTemplate(const Lazy<String>& lvalue, const ValidationUtils& utils) override;
+	void ValidateRelays(const Lazy<Array::Ptr>& lvalue, const ValidationUtils& utils) override;
+	void ValidateParallelConnections(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
 
 protected:
 	void OnConfigLoaded() override;
@@ -37,27 +43,37 @@ protected:
 	void Pause() override;
 
 private:
-	Shared<AsioTcpStream>::Ptr m_Stream;
-	std::mutex m_StreamMutex;
+	/* One connection to a Graphite relay and the buffer of the lines which go there. */
+	struct Relay
+	{
+		String Host;
+		String Port;
+		Shared<AsioTcpStream>::Ptr Stream;
+		std::mutex StreamMutex;
+		std::atomic<bool> Connected{false};
+		WriterPipeline::Ptr Pipeline;
+	};
+
+	std::vector<std::unique_ptr<Relay>> m_Relays;
 	WorkQueue m_WorkQueue{10000000, 1};
 
-	boost::signals2::connection m_HandleCheckResults;
-	Timer::Ptr m_ReconnectTimer;
+	SignalConnection m_HandleCheckResults;
 
 	void CheckResultHandler(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
 	void CheckResultHandlerInternal(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
 	void SendMetric(const Checkable::Ptr& checkable, const String& prefix, const String& name, double value, double ts);
 	void SendPerfdata(const Checkable::Ptr& checkable, const String& prefix, const CheckResult::Ptr& cr, double ts);
+	void SendBatch(Relay& relay, const std::vector<String>& batch);
 	static String EscapeMetric(const String& str);
 	static String EscapeMetricLabel(const String& str);
 	static Value EscapeMacroMetric(const Value& value);
 
-	void ReconnectTimerHandler();
+	void AddRelay(const String& host, const String& port);
+	static bool ParseRelay(const String& relay, String& host, String& port);
 
-	void Disconnect();
-	void DisconnectInternal();
-	void Reconnect();
-	void ReconnectInternal();
+	void DisconnectInternal(Relay& relay);
+	void ReconnectInternal(Relay& relay);
+	void UpdateConnected();
 
 	void AssertOnWorkQueue();
 
@@ -0,0 +1,51 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "perfdata/gzip.hpp"
+#include "base/exception.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <zlib.h>
+
+using namespace icinga;
+
+/**
+ * Compresses the given data into a single gzip member.
+ *
+ * @param data Uncompressed data, e.g. line protocol or NDJSON
+ * @param level zlib compression level (1-9)
+ *
+ * @return gzip compressed data
+ */
+String Gzip::Compress(const String& data, int level)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+
+	/* 16 + MAX_WBITS: gzip header and trailer instead of zlib ones */
+	if (deflateInit2(&stream, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		BOOST_THROW_EXCEPTION(std::runtime_error("Failed to initialize gzip compression"));
+	}
+
+	std::string result;
+	result.resize(deflateBound(&stream, data.GetLength()));
+
+	stream.next_in = (Bytef*)data.CStr();
+	stream.avail_in = data.GetLength();
+	stream.next_out = (Bytef*)&result[0];
+	stream.avail_out = result.size();
+
+	/* deflateBound() guarantees that everything fits in, so one call is enough. */
+	int rc = deflate(&stream, Z_FINISH);
+	size_t length = result.size() - stream.avail_out;
+
+	(void)deflateEnd(&stream);
+
+	if (rc != Z_STREAM_END) {
+		BOOST_THROW_EXCEPTION(std::runtime_error("Failed to gzip compress data"));
+	}
+
+	result.resize(length);
+
+	return String(std::move(result));
+}
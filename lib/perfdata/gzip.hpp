@@ -0,0 +1,24 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef GZIP_H
+#define GZIP_H
+
+#include "base/string.hpp"
+
+namespace icinga
+{
+
+/**
+ * Compresses HTTP request bodies for "Content-Encoding: gzip".
+ *
+ * @ingroup perfdata
+ */
+class Gzip
+{
+public:
+	static String Compress(const String& data, int level);
+};
+
+}
+
+#endif /* GZIP_H */
@@ -2,6 +2,7 @@
 
 #include "perfdata/influxdbcommonwriter.hpp"
 #include "perfdata/influxdbcommonwriter-ti.cpp"
+#include "perfdata/gzip.hpp"
 #include "remote/url.hpp"
 #include "icinga/service.hpp"
 #include "icinga/macroprocessor.hpp"
@@ -45,6 +46,9 @@ using namespace icinga;
 
 REGISTER_TYPE(InfluxdbCommonWriter);
 
+/* Kept-alive connections which haven't been used for longer are likely closed by InfluxDB or a proxy. */
+static const double l_MaxConnectionIdleTime = 30;
+
 class InfluxdbInteger final : public Object
 {
 public:
@@ -69,6 +73,9 @@ void InfluxdbCommonWriter::OnConfigLoaded()
 
 	m_WorkQueue.SetName(GetReflectionType()->GetName() + ", " + GetName());
 
+	m_Pipeline = new WriterPipeline(GetReflectionType()->GetName() + ", " + GetName(),
+		[this](const std::vector<String>& batch) { SendBatch(batch); }, GetParallelRequests());
+
 	if (!GetEnableHa()) {
 		Log(LogDebug, GetReflectionType()->GetName())
 			<< "HA functionality disabled. Won't pause connection: " << GetName();
@@ -89,12 +96,12 @@ void InfluxdbCommonWriter::Resume()
 	/* Register exception handler for WQ tasks. */
 	m_WorkQueue.SetExceptionCallback([this](boost::exception_ptr exp) { ExceptionHandler(std::move(exp)); });
 
-	/* Setup timer for periodically flushing m_DataBuffer */
-	m_FlushTimer = Timer::Create();
-	m_FlushTimer->SetInterval(GetFlushInterval());
-	m_FlushTimer->OnTimerExpired.connect([this](const Timer * const&) { FlushTimeout(); });
-	m_FlushTimer->Start();
-	m_FlushTimer->Reschedule(0);
+	/* Data points are sent once flush_threshold of them are buffered or flush_interval expired. */
+	m_Pipeline->SetMaxItems(GetMaxBufferedItems());
+	m_Pipeline->SetBatchSize(GetFlushThreshold());
+	m_Pipeline->SetFlushInterval(GetFlushInterval());
+	m_Pipeline->SetSpillPath(GetEnableSpill() ? WriterPipeline::GetSpillPath(GetReflectionType()->GetName(), GetName()) : "");
+	m_Pipeline->Start();
 
 	/* Register for new metrics. */
 	m_HandleCheckResults = Checkable::OnNewCheckResult.connect([this](const Checkable::Ptr& checkable,
@@ -112,11 +119,11 @@ void InfluxdbCommonWriter::Pause()
 	Log(LogDebug, GetReflectionType()->GetName())
 		<< "Processing pending tasks and flushing data buffers.";
 
-	m_FlushTimer->Stop(true);
-	m_WorkQueue.Enqueue([this]() { FlushWQ(); }, PriorityLow);
-
-	/* Wait for the flush to complete, implicitly waits for all WQ tasks enqueued prior to pausing. */
+	/* Wait for all WQ tasks enqueued prior to pausing, then for the final flush. */
 	m_WorkQueue.Join();
+	m_Pipeline->Stop();
+
+	CloseIdleConnections();
 
 	Log(LogInformation, GetReflectionType()->GetName())
 		<< "'" << GetName() << "' paused.";
@@ -135,8 +142,6 @@ void InfluxdbCommonWriter::ExceptionHandler(boost::exception_ptr exp)
 
 	Log(LogDebug, GetReflectionType()->GetName())
 		<< "Exception during InfluxDB operation: " << DiagnosticInformation(std::move(exp));
-
-	//TODO: Close the connection, if we keep it open.
 }
 
 OptionalTlsStream InfluxdbCommonWriter::Connect()
@@ -255,27 +260,21 @@ void InfluxdbCommonWriter::CheckResultHandlerWQ(const Checkable::Ptr& checkable,
 
 	CheckCommand::Ptr checkCommand = checkable->GetCheckCommand();
 
-	Array::Ptr perfdata = cr->GetPerformanceData();
+	Array::Ptr perfdata = cr->GetParsedPerformanceData();
 
 	if (perfdata) {
 		ObjectLock olock(perfdata);
 		for (const Value& val : perfdata) {
-			PerfdataValue::Ptr pdv;
-
-			if (val.IsObjectType<PerfdataValue>())
-				pdv = val;
-			else {
-				try {
-					pdv = PerfdataValue::Parse(val);
-				} catch (const std::exception&) {
-					Log(LogWarning, GetReflectionType()->GetName())
-						<< "Ignoring invalid perfdata for checkable '"
-						<< checkable->GetName() << "' and command '"
-						<< checkCommand->GetName() << "' with value: " << val;
-					continue;
-				}
+			if (!val.IsObjectType<PerfdataValue>()) {
+				Log(LogWarning, GetReflectionType()->GetName())
+					<< "Ignoring invalid perfdata for checkable '"
+					<< checkable->GetName() << "' and command '"
+					<< checkCommand->GetName() << "' with value: " << val;
+				continue;
 			}
 
+			PerfdataValue::Ptr pdv = val;
+
 			Dictionary::Ptr fields = new Dictionary();
 			fields->Set("value", pdv->GetValue());
 
@@ -403,131 +402,200 @@ void InfluxdbCommonWriter::SendMetric(const Checkable::Ptr& checkable, const Dic
 	Log(LogDebug, GetReflectionType()->GetName())
 		<< "Checkable '" << checkable->GetName() << "' adds to metric list:'" << msgbuf.str() << "'.";
 
-	// Buffer the data point
-	m_DataBuffer.emplace_back(msgbuf.str());
-	m_DataBufferSize = m_DataBuffer.size();
+	m_Pipeline->Enqueue(msgbuf.str());
+}
 
-	// Flush if we've buffered too much to prevent excessive memory use
-	if (static_cast<int>(m_DataBuffer.size()) >= GetFlushThreshold()) {
-		Log(LogDebug, GetReflectionType()->GetName())
-			<< "Data buffer overflow writing " << m_DataBuffer.size() << " data points";
+/**
+ * Writes a batch of data points to InfluxDB.
+ *
+ * Called by the pipeline (possibly in parallel), throws if InfluxDB can't be reached or is unavailable
+ * so that the batch is retried later.
+ */
+void InfluxdbCommonWriter::SendBatch(const std::vector<String>& batch)
+{
+	namespace beast = boost::beast;
+	namespace http = beast::http;
+
+	Log(LogDebug, GetReflectionType()->GetName())
+		<< "Flushing " << batch.size() << " data points to InfluxDB.";
+
+	auto request (AssembleRequest(boost::algorithm::join(batch, "\n")));
+	http::response<http::string_body> response;
+
+	for (;;) {
+		bool reused = false;
+		OptionalTlsStream stream (GetConnection(reused));
 
 		try {
-			FlushWQ();
-		} catch (...) {
-			/* Do nothing. */
+			response = Transfer(stream, request);
+		} catch (const std::exception& ex) {
+			CloseConnection(stream);
+
+			/* InfluxDB may have closed an idle connection meanwhile, that's no reason to wait for a retry. */
+			if (reused) {
+				Log(LogDebug, GetReflectionType()->GetName())
+					<< "Kept-alive connection to InfluxDB failed, retrying with a new one: " << DiagnosticInformation(ex, false);
+				continue;
+			}
+
+			Log(LogWarning, GetReflectionType()->GetName())
+				<< "Cannot send data points to InfluxDB on host '" << GetHost() << "' port '" << GetPort() << "': "
+				<< DiagnosticInformation(ex, false);
+			throw;
 		}
+
+		if (response.keep_alive())
+			ReleaseConnection(std::move(stream));
+		else
+			CloseConnection(stream);
+
+		break;
 	}
-}
 
-void InfluxdbCommonWriter::FlushTimeout()
-{
-	m_WorkQueue.Enqueue([this]() { FlushTimeoutWQ(); }, PriorityHigh);
-}
+	if (response.result() != http::status::no_content) {
+		Log(LogWarning, GetReflectionType()->GetName())
+			<< "Unexpected response code: " << response.result();
 
-void InfluxdbCommonWriter::FlushTimeoutWQ()
-{
-	AssertOnWorkQueue();
+		auto& contentType (response[http::field::content_type]);
+		if (contentType != "application/json") {
+			Log(LogWarning, GetReflectionType()->GetName())
+				<< "Unexpected Content-Type: " << contentType;
+		} else {
+			Dictionary::Ptr jsonResponse;
+			auto& body (response.body());
+
+			try {
+				jsonResponse = JsonDecode(body);
+			} catch (...) {
+				Log(LogWarning, GetReflectionType()->GetName())
+					<< "Unable to parse JSON response:\n" << body;
+			}
 
-	Log(LogDebug, GetReflectionType()->GetName())
-		<< "Timer expired writing " << m_DataBuffer.size() << " data points";
+			if (jsonResponse) {
+				String error = jsonResponse->Get("error");
 
-	FlushWQ();
+				Log(LogCritical, GetReflectionType()->GetName())
+					<< "InfluxDB error message:\n" << error;
+			}
+		}
+
+		/* Rejected data points won't become valid by retrying them, an overloaded/unavailable InfluxDB may recover. */
+		if (response.result_int() >= 500) {
+			BOOST_THROW_EXCEPTION(std::runtime_error("InfluxDB responded with HTTP status " + std::to_string(response.result_int())));
+		}
+	}
 }
 
-void InfluxdbCommonWriter::FlushWQ()
+/**
+ * Sends a request and reads the response.
+ *
+ * @param stream Connection to InfluxDB
+ * @param request Request to send
+ *
+ * @return The response
+ */
+boost::beast::http::response<boost::beast::http::string_body> InfluxdbCommonWriter::Transfer(OptionalTlsStream& stream,
+	boost::beast::http::request<boost::beast::http::string_body>& request)
 {
-	AssertOnWorkQueue();
-
 	namespace beast = boost::beast;
 	namespace http = beast::http;
 
-	/* Flush can be called from 1) Timeout 2) Threshold 3) on shutdown/reload. */
-	if (m_DataBuffer.empty())
-		return;
-
-	Log(LogDebug, GetReflectionType()->GetName())
-		<< "Flushing data buffer to InfluxDB.";
+	http::parser<false, http::string_body> parser;
+	beast::flat_buffer buf;
 
-	String body = boost::algorithm::join(m_DataBuffer, "\n");
-	m_DataBuffer.clear();
-	m_DataBufferSize = 0;
+	if (stream.first) {
+		http::write(*stream.first, request);
+		stream.first->flush();
+		http::read(*stream.first, buf, parser);
+	} else {
+		http::write(*stream.second, request);
+		stream.second->flush();
+		http::read(*stream.second, buf, parser);
+	}
 
-	OptionalTlsStream stream;
+	return parser.release();
+}
 
-	try {
-		stream = Connect();
-	} catch (const std::exception& ex) {
-		Log(LogWarning, GetReflectionType()->GetName())
-			<< "Flush failed, cannot connect to InfluxDB: " << DiagnosticInformation(ex, false);
-		return;
-	}
+/**
+ * Returns an idle kept-alive connection or, if there is none, a new one.
+ *
+ * @param reused Set to whether the connection has already been used before
+ */
+OptionalTlsStream InfluxdbCommonWriter::GetConnection(bool& reused)
+{
+	std::vector<OptionalTlsStream> expired;
 
-	Defer s ([&stream]() {
-		if (stream.first) {
-			stream.first->next_layer().shutdown();
+	Defer closeExpired ([&expired]() {
+		for (auto& stream : expired) {
+			CloseConnection(stream);
 		}
 	});
 
-	auto request (AssembleRequest(std::move(body)));
+	{
+		std::unique_lock<std::mutex> lock (m_IdleConnectionsMutex);
+		double now = Utility::GetTime();
 
-	try {
-		if (stream.first) {
-			http::write(*stream.first, request);
-			stream.first->flush();
-		} else {
-			http::write(*stream.second, request);
-			stream.second->flush();
+		while (!m_IdleConnections.empty()) {
+			auto idle (std::move(m_IdleConnections.back()));
+			m_IdleConnections.pop_back();
+
+			if (now - idle.second < l_MaxConnectionIdleTime) {
+				reused = true;
+				return std::move(idle.first);
+			}
+
+			expired.emplace_back(std::move(idle.first));
 		}
-	} catch (const std::exception& ex) {
-		Log(LogWarning, GetReflectionType()->GetName())
-			<< "Cannot write to TCP socket on host '" << GetHost() << "' port '" << GetPort() << "'.";
-		throw;
 	}
 
-	http::parser<false, http::string_body> parser;
-	beast::flat_buffer buf;
+	reused = false;
 
 	try {
-		if (stream.first) {
-			http::read(*stream.first, buf, parser);
-		} else {
-			http::read(*stream.second, buf, parser);
-		}
+		return Connect();
 	} catch (const std::exception& ex) {
 		Log(LogWarning, GetReflectionType()->GetName())
-			<< "Failed to parse HTTP response from host '" << GetHost() << "' port '" << GetPort() << "': " << DiagnosticInformation(ex);
+			<< "Flush failed, cannot connect to InfluxDB: " << DiagnosticInformation(ex, false);
 		throw;
 	}
+}
 
-	auto& response (parser.get());
-
-	if (response.result() != http::status::no_content) {
-		Log(LogWarning, GetReflectionType()->GetName())
-			<< "Unexpected response code: " << response.result();
+/**
+ * Keeps a connection for the next request, unless there are already enough idle ones.
+ */
+void InfluxdbCommonWriter::ReleaseConnection(OptionalTlsStream stream)
+{
+	{
+		std::unique_lock<std::mutex> lock (m_IdleConnectionsMutex);
 
-		auto& contentType (response[http::field::content_type]);
-		if (contentType != "application/json") {
-			Log(LogWarning, GetReflectionType()->GetName())
-				<< "Unexpected Content-Type: " << contentType;
+		if (m_IdleConnections.size() < (size_t)GetParallelRequests()) {
+			m_IdleConnections.emplace_back(std::move(stream), Utility::GetTime());
 			return;
 		}
+	}
 
-		Dictionary::Ptr jsonResponse;
-		auto& body (response.body());
+	CloseConnection(stream);
+}
 
-		try {
-			jsonResponse = JsonDecode(body);
-		} catch (...) {
-			Log(LogWarning, GetReflectionType()->GetName())
-				<< "Unable to parse JSON response:\n" << body;
-			return;
-		}
+void InfluxdbCommonWriter::CloseConnection(OptionalTlsStream& stream)
+{
+	if (stream.first) {
+		stream.first->next_layer().shutdown();
+	}
+
+	stream = OptionalTlsStream();
+}
 
-		String error = jsonResponse->Get("error");
+void InfluxdbCommonWriter::CloseIdleConnections()
+{
+	std::vector<std::pair<OptionalTlsStream, double>> idle;
+
+	{
+		std::unique_lock<std::mutex> lock (m_IdleConnectionsMutex);
+		idle.swap(m_IdleConnections);
+	}
 
-		Log(LogCritical, GetReflectionType()->GetName())
-			<< "InfluxDB error message:\n" << error;
+	for (auto& connection : idle) {
+		CloseConnection(connection.first);
 	}
 }
 
@@ -536,10 +604,26 @@ boost::beast::http::request<boost::beast::http::string_body> InfluxdbCommonWrite
 	namespace http = boost::beast::http;
 
 	auto url (AssembleUrl());
-	http::request<http::string_body> request (http::verb::post, std::string(url->Format(true)), 10);
+	/* HTTP/1.1 keeps the connection open for the next flush. */
+	http::request<http::string_body> request (http::verb::post, std::string(url->Format(true)), 11);
 
 	request.set(http::field::user_agent, "Icinga/" + Application::GetAppVersion());
 	request.set(http::field::host, url->GetHost() + ":" + url->GetPort());
+	request.keep_alive(true);
+
+	size_t rawLength = body.GetLength();
+
+	/* Line protocol compresses very well, saves bandwidth and TLS overhead. */
+	if (GetEnableGzip()) {
+		body = Gzip::Compress(body, GetGzipLevel());
+		request.set(http::field::content_encoding, "gzip");
+	}
+
+	m_LastRequestRawBytes = rawLength;
+	m_LastRequestSentBytes = body.GetLength();
+	m_RequestRawBytes += rawLength;
+	m_RequestSentBytes += body.GetLength();
+
 	request.body() = std::move(body);
 	request.content_length(request.body().size());
 
@@ -593,3 +677,19 @@ void InfluxdbCommonWriter::ValidateServiceTemplate(const Lazy<Dictionary::Ptr>&
 		}
 	}
 }
+
+void InfluxdbCommonWriter::ValidateParallelRequests(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<InfluxdbCommonWriter>::ValidateParallelRequests(lvalue, utils);
+
+	if (lvalue() < 1)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "parallel_requests" }, "Value must be greater than 0."));
+}
+
+void InfluxdbCommonWriter::ValidateGzipLevel(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<InfluxdbCommonWriter>::ValidateGzipLevel(lvalue, utils);
+
+	if (lvalue() < 1 || lvalue() > 9)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "gzip_level" }, "Value must be between 1 and 9."));
+}
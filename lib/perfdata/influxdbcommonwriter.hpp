@@ -4,7 +4,9 @@
 #define INFLUXDBCOMMONWRITER_H
 
 #include "perfdata/influxdbcommonwriter-ti.hpp"
+#include "perfdata/writerpipeline.hpp"
 #include "icinga/service.hpp"
+#include "base/atomic.hpp"
 #include "base/configobject.hpp"
 #include "base/perfdatavalue.hpp"
 #include "base/tcpsocket.hpp"
@@ -15,7 +17,11 @@
 #include <boost/beast/http/message.hpp>
 #include <boost/beast/http/string_body.hpp>
 #include <atomic>
+#include <cstdint>
 #include <fstream>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 namespace icinga
 {
@@ -35,6 +41,8 @@ public:
 
 	void ValidateHostTemplate(const Lazy<Dictionary::Ptr>& lvalue, const ValidationUtils& utils) override;
 	void ValidateServiceTemplate(const Lazy<Dictionary::Ptr>& lvalue, const ValidationUtils& utils) override;
+	void ValidateParallelRequests(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
+	void ValidateGzipLevel(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
 
 protected:
 	void OnConfigLoaded() override;
@@ -47,24 +55,37 @@ protected:
 	virtual Url::Ptr AssembleUrl() = 0;
 
 private:
-	boost::signals2::connection m_HandleCheckResults;
-	Timer::Ptr m_FlushTimer;
-	WorkQueue m_WorkQueue{10000000, 1};
-	std::vector<String> m_DataBuffer;
-	std::atomic_size_t m_DataBufferSize{0};
+	SignalConnection m_HandleCheckResults;
+	WorkQueue m_WorkQueue{10000000, 1, LogInformation, true};
+	WriterPipeline::Ptr m_Pipeline;
+
+	/* kept-alive connections and since when they are idle */
+	std::mutex m_IdleConnectionsMutex;
+	std::vector<std::pair<OptionalTlsStream, double>> m_IdleConnections;
+
+	/* request body sizes before and after compression */
+	Atomic<uint_fast64_t> m_LastRequestRawBytes{0};
+	Atomic<uint_fast64_t> m_LastRequestSentBytes{0};
+	Atomic<uint_fast64_t> m_RequestRawBytes{0};
+	Atomic<uint_fast64_t> m_RequestSentBytes{0};
 
 	void CheckResultHandler(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
 	void CheckResultHandlerWQ(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
 	void SendMetric(const Checkable::Ptr& checkable, const Dictionary::Ptr& tmpl,
 		const String& label, const Dictionary::Ptr& fields, double ts);
-	void FlushTimeout();
-	void FlushTimeoutWQ();
-	void FlushWQ();
+	void SendBatch(const std::vector<String>& batch);
 
 	static String EscapeKeyOrTagValue(const String& str);
 	static String EscapeValue(const Value& value);
 
 	OptionalTlsStream Connect();
+	OptionalTlsStream GetConnection(bool& reused);
+	void ReleaseConnection(OptionalTlsStream stream);
+	static void CloseConnection(OptionalTlsStream& stream);
+	void CloseIdleConnections();
+
+	static boost::beast::http::response<boost::beast::http::string_body> Transfer(OptionalTlsStream& stream,
+		boost::beast::http::request<boost::beast::http::string_body>& request);
 
 	void AssertOnWorkQueue();
 
@@ -80,17 +101,36 @@ void InfluxdbCommonWriter::StatsFunc(const Dictionary::Ptr& status, const Array:
 	for (const typename InfluxWriter::Ptr& influxwriter : ConfigType::GetObjectsByType<InfluxWriter>()) {
 		size_t workQueueItems = influxwriter->m_WorkQueue.GetLength();
 		double workQueueItemRate = influxwriter->m_WorkQueue.GetTaskCount(60) / 60.0;
-		size_t dataBufferItems = influxwriter->m_DataBufferSize;
 
-		nodes.emplace_back(influxwriter->GetName(), new Dictionary({
+		Dictionary::Ptr node = new Dictionary({
 			{ "work_queue_items", workQueueItems },
-			{ "work_queue_item_rate", workQueueItemRate },
-			{ "data_buffer_items", dataBufferItems }
-		}));
+			{ "work_queue_item_rate", workQueueItemRate }
+		});
+
+		influxwriter->m_Pipeline->ReportStats(node, perfdata, typeName + "_" + influxwriter->GetName());
+
+		double dataBufferItems = node->Get("buffered_items");
+		node->Set("data_buffer_items", dataBufferItems);
+
+		double lastRequestRawBytes = influxwriter->m_LastRequestRawBytes;
+		double lastRequestSentBytes = influxwriter->m_LastRequestSentBytes;
+		double requestRawBytes = influxwriter->m_RequestRawBytes;
+		double requestSentBytes = influxwriter->m_RequestSentBytes;
+
+		node->Set("last_request_raw_bytes", lastRequestRawBytes);
+		node->Set("last_request_sent_bytes", lastRequestSentBytes);
+		node->Set("request_raw_bytes", requestRawBytes);
+		node->Set("request_sent_bytes", requestSentBytes);
 
 		perfdata->Add(new PerfdataValue(typeName + "_" + influxwriter->GetName() + "_work_queue_items", workQueueItems));
 		perfdata->Add(new PerfdataValue(typeName + "_" + influxwriter->GetName() + "_work_queue_item_rate", workQueueItemRate));
 		perfdata->Add(new PerfdataValue(typeName + "_" + influxwriter->GetName() + "_data_queue_items", dataBufferItems));
+		perfdata->Add(new PerfdataValue(typeName + "_" + influxwriter->GetName() + "_last_request_raw_bytes", lastRequestRawBytes));
+		perfdata->Add(new PerfdataValue(typeName + "_" + influxwriter->GetName() + "_last_request_sent_bytes", lastRequestSentBytes));
+		perfdata->Add(new PerfdataValue(typeName + "_" + influxwriter->GetName() + "_request_raw_bytes", requestRawBytes, true));
+		perfdata->Add(new PerfdataValue(typeName + "_" + influxwriter->GetName() + "_request_sent_bytes", requestSentBytes, true));
+
+		nodes.emplace_back(influxwriter->GetName(), node);
 	}
 
 	status->Set(typeName, new Dictionary(std::move(nodes)));
@@ -2,6 +2,7 @@
 
 #include "perfdata/opentsdbwriter.hpp"
 #include "perfdata/opentsdbwriter-ti.cpp"
+#include "perfdata/gzip.hpp"
 #include "icinga/service.hpp"
 #include "icinga/checkcommand.hpp"
 #include "icinga/macroprocessor.hpp"
@@ -18,9 +19,19 @@
 #include "base/stream.hpp"
 #include "base/networkstream.hpp"
 #include "base/exception.hpp"
+#include "base/json.hpp"
 #include "base/statsfunction.hpp"
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/parser.hpp>
+#include <boost/beast/http/read.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/verb.hpp>
+#include <boost/beast/http/write.hpp>
+#include <string>
 
 using namespace icinga;
 
@@ -35,6 +46,8 @@ void OpenTsdbWriter::OnConfigLoaded()
 {
 	ObjectImpl<OpenTsdbWriter>::OnConfigLoaded();
 
+	m_Pipeline = new WriterPipeline("OpenTsdbWriter, " + GetName(), [this](const std::vector<String>& batch) { SendBatch(batch); });
+
 	if (!GetEnableHa()) {
 		Log(LogDebug, "OpenTsdbWriter")
 			<< "HA functionality disabled. Won't pause connection: " << GetName();
@@ -49,15 +62,26 @@ void OpenTsdbWriter::OnConfigLoaded()
  * Feature stats interface
  *
  * @param status Key value pairs for feature stats
+ * @param perfdata Array of PerfdataValue objects
  */
-void OpenTsdbWriter::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr&)
+void OpenTsdbWriter::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
 {
 	DictionaryData nodes;
 
 	for (const OpenTsdbWriter::Ptr& opentsdbwriter : ConfigType::GetObjectsByType<OpenTsdbWriter>()) {
-		nodes.emplace_back(opentsdbwriter->GetName(), new Dictionary({
-			{ "connected", opentsdbwriter->GetConnected() }
-		}));
+		double rejectedDataPoints = opentsdbwriter->m_RejectedDataPoints;
+
+		Dictionary::Ptr node = new Dictionary({
+			{ "connected", opentsdbwriter->GetConnected() },
+			{ "rejected_data_points", rejectedDataPoints }
+		});
+
+		if (perfdata)
+			perfdata->Add(new PerfdataValue("opentsdbwriter_" + opentsdbwriter->GetName() + "_rejected_data_points", rejectedDataPoints, true));
+
+		opentsdbwriter->m_Pipeline->ReportStats(node, perfdata, "opentsdbwriter_" + opentsdbwriter->GetName());
+
+		nodes.emplace_back(opentsdbwriter->GetName(), node);
 	}
 
 	status->Set("opentsdbwriter", new Dictionary(std::move(nodes)));
@@ -75,11 +99,18 @@ void OpenTsdbWriter::Resume()
 
 	ReadConfigTemplate(m_ServiceConfigTemplate, m_HostConfigTemplate);
 
-	m_ReconnectTimer = Timer::Create();
-	m_ReconnectTimer->SetInterval(10);
-	m_ReconnectTimer->OnTimerExpired.connect([this](const Timer * const&) { ReconnectTimerHandler(); });
-	m_ReconnectTimer->Start();
-	m_ReconnectTimer->Reschedule(0);
+	/* Metrics are sent in batches at least every second, the connection is (re-)established on demand. */
+	m_Pipeline->SetMaxItems(GetMaxBufferedItems());
+	m_Pipeline->SetBatchSize(GetFlushThreshold());
+	m_Pipeline->SetFlushInterval(1);
+
+	/* telnet lines and JSON data points don't mix, so each protocol has its own spill file */
+	if (GetEnableSpill())
+		m_Pipeline->SetSpillPath(WriterPipeline::GetSpillPath("OpenTsdbWriter", IsHttp() ? GetName() + "-http" : GetName()));
+	else
+		m_Pipeline->SetSpillPath("");
+
+	m_Pipeline->Start();
 
 	m_HandleCheckResults = Service::OnNewCheckResult.connect([this](const Checkable::Ptr& checkable, const CheckResult::Ptr& cr, const MessageOrigin::Ptr&) {
 		CheckResultHandler(checkable, cr);
@@ -92,27 +123,32 @@ void OpenTsdbWriter::Resume()
 void OpenTsdbWriter::Pause()
 {
 	m_HandleCheckResults.disconnect();
-	m_ReconnectTimer->Stop(true);
+
+	/* Whatever can't be sent anymore is spilled (if enabled) or dropped by the pipeline. */
+	m_Pipeline->Stop();
 
 	Log(LogInformation, "OpentsdbWriter")
 		<< "'" << GetName() << "' paused.";
 
-	m_Stream->close();
+	{
+		std::unique_lock<std::mutex> lock(m_StreamMutex);
+
+		if (m_Stream)
+			m_Stream->close();
 
-	SetConnected(false);
+		SetConnected(false);
+	}
 
 	ObjectImpl<OpenTsdbWriter>::Pause();
 }
 
 /**
- * Reconnect handler called by the timer.
- * Handles TLS
+ * Connects to OpenTSDB unless already connected, throws on failure.
+ *
+ * Called by SendBatch() with m_StreamMutex held.
  */
-void OpenTsdbWriter::ReconnectTimerHandler()
+void OpenTsdbWriter::ReconnectInternal()
 {
-	if (IsPaused())
-		return;
-
 	SetShouldConnect(true);
 
 	if (GetConnected())
@@ -124,8 +160,9 @@ void OpenTsdbWriter::ReconnectTimerHandler()
 		<< "Reconnecting to OpenTSDB TSD on host '" << GetHost() << "' port '" << GetPort() << "'.";
 
 	/*
-	 * We're using telnet as input method. Future PRs may change this into using the HTTP API.
+	 * Either the telnet or the HTTP API, both use a plain TCP connection.
 	 * http://opentsdb.net/docs/build/html/user_guide/writing/index.html#telnet
+	 * http://opentsdb.net/docs/build/html/api_http/put.html
 	 */
 	m_Stream = Shared<AsioTcpStream>::Make(IoEngine::Get().GetIoContext());
 
@@ -137,7 +174,7 @@ void OpenTsdbWriter::ReconnectTimerHandler()
 
 		SetConnected(false);
 
-		return;
+		throw;
 	}
 
 	SetConnected(true);
@@ -309,7 +346,7 @@ void OpenTsdbWriter::CheckResultHandler(const Checkable::Ptr& checkable, const C
 void OpenTsdbWriter::SendPerfdata(const Checkable::Ptr& checkable, const String& metric,
 	const std::map<String, String>& tags, const CheckResult::Ptr& cr, double ts)
 {
-	Array::Ptr perfdata = cr->GetPerformanceData();
+	Array::Ptr perfdata = cr->GetParsedPerformanceData();
 
 	if (!perfdata)
 		return;
@@ -318,21 +355,15 @@ void OpenTsdbWriter::SendPerfdata(const Checkable::Ptr& checkable, const String&
 
 	ObjectLock olock(perfdata);
 	for (const Value& val : perfdata) {
-		PerfdataValue::Ptr pdv;
-
-		if (val.IsObjectType<PerfdataValue>())
-			pdv = val;
-		else {
-			try {
-				pdv = PerfdataValue::Parse(val);
-			} catch (const std::exception&) {
-				Log(LogWarning, "OpenTsdbWriter")
-					<< "Ignoring invalid perfdata for checkable '"
-					<< checkable->GetName() << "' and command '"
-					<< checkCommand->GetName() << "' with value: " << val;
-				continue;
-			}
+		if (!val.IsObjectType<PerfdataValue>()) {
+			Log(LogWarning, "OpenTsdbWriter")
+				<< "Ignoring invalid perfdata for checkable '"
+				<< checkable->GetName() << "' and command '"
+				<< checkCommand->GetName() << "' with value: " << val;
+			continue;
 		}
+
+		PerfdataValue::Ptr pdv = val;
 		
 		String metric_name;
 		std::map<String, String> tags_new = tags;
@@ -386,6 +417,27 @@ void OpenTsdbWriter::SendMetric(const Checkable::Ptr& checkable, const String& m
 	 * put <metric> <timestamp> <value> <tagk1=tagv1[ tagk2=tagv2 ...tagkN=tagvN]>
 	 * "tags" must include at least one tag, we use "host=HOSTNAME"
 	 */
+	if (IsHttp()) {
+		Dictionary::Ptr tagsDict = new Dictionary();
+
+		for (const Dictionary::Pair& tag : tags) {
+			tagsDict->Set(tag.first, tag.second);
+		}
+
+		String dataPoint = JsonEncode(new Dictionary({
+			{ "metric", metric },
+			{ "timestamp", static_cast<long>(ts) },
+			{ "value", value },
+			{ "tags", tagsDict }
+		}));
+
+		Log(LogDebug, "OpenTsdbWriter")
+			<< "Checkable '" << checkable->GetName() << "' adds to metric list: '" << dataPoint << "'.";
+
+		m_Pipeline->Enqueue(dataPoint);
+		return;
+	}
+
 	msgbuf << "put " << metric << " " << static_cast<long>(ts) << " " << Convert::ToString(value) << tags_string;
 
 	Log(LogDebug, "OpenTsdbWriter")
@@ -393,23 +445,152 @@ void OpenTsdbWriter::SendMetric(const Checkable::Ptr& checkable, const String& m
 
 	/* do not send \n to debug log */
 	msgbuf << "\n";
-	String put = msgbuf.str();
 
-	ObjectLock olock(this);
+	m_Pipeline->Enqueue(msgbuf.str());
+}
+
+/**
+ * Writes a batch of "put" lines to OpenTSDB, (re-)connects if necessary.
+ *
+ * Called by the pipeline, throws so that the batch is retried later.
+ *
+ * @param batch Lines including their trailing newline
+ */
+void OpenTsdbWriter::SendBatch(const std::vector<String>& batch)
+{
+	std::unique_lock<std::mutex> lock(m_StreamMutex);
 
-	if (!GetConnected())
+	if (IsHttp()) {
+		SendHttpBatch(batch);
 		return;
+	}
 
-	try {
-		Log(LogDebug, "OpenTsdbWriter")
-			<< "Checkable '" << checkable->GetName() << "' sending message '" << put << "'.";
+	ReconnectInternal();
 
-		boost::asio::write(*m_Stream, boost::asio::buffer(msgbuf.str()));
+	try {
+		boost::asio::write(*m_Stream, boost::asio::buffer(boost::algorithm::join(batch, "")));
 		m_Stream->flush();
 	} catch (const std::exception& ex) {
 		Log(LogCritical, "OpenTsdbWriter")
 			<< "Cannot write to TCP socket on host '" << GetHost() << "' port '" << GetPort() << "'.";
+
+		m_Stream->close();
+		SetConnected(false);
+
+		throw;
+	}
+}
+
+/**
+ * Posts a batch of JSON data points to /api/put, reusing the kept-alive connection.
+ *
+ * Called by SendBatch() with m_StreamMutex held. Throws if OpenTSDB can't be reached
+ * or is unavailable, so that the batch is retried later.
+ *
+ * @param batch JSON encoded data points
+ */
+void OpenTsdbWriter::SendHttpBatch(const std::vector<String>& batch)
+{
+	namespace beast = boost::beast;
+	namespace http = beast::http;
+
+	http::request<http::string_body> request (http::verb::post, "/api/put?details", 11);
+
+	request.set(http::field::user_agent, "Icinga/" + Application::GetAppVersion());
+	request.set(http::field::host, GetHost() + ":" + GetPort());
+	request.set(http::field::content_type, "application/json");
+	request.keep_alive(true);
+
+	String body = "[" + boost::algorithm::join(batch, ",") + "]";
+
+	if (GetEnableGzip()) {
+		body = Gzip::Compress(body, 6);
+		request.set(http::field::content_encoding, "gzip");
 	}
+
+	request.body() = std::move(body);
+	request.content_length(request.body().size());
+
+	http::response<http::string_body> response;
+
+	for (;;) {
+		/* A kept-alive connection may have been closed by the TSD meanwhile, that's retried once with a new one. */
+		bool reused = GetConnected();
+
+		ReconnectInternal();
+
+		try {
+			http::parser<false, http::string_body> parser;
+			beast::flat_buffer buf;
+
+			http::write(*m_Stream, request);
+			m_Stream->flush();
+			http::read(*m_Stream, buf, parser);
+
+			response = parser.release();
+		} catch (const std::exception& ex) {
+			m_Stream->close();
+			SetConnected(false);
+
+			if (reused)
+				continue;
+
+			Log(LogCritical, "OpenTsdbWriter")
+				<< "Cannot send data points to OpenTSDB on host '" << GetHost() << "' port '" << GetPort() << "': "
+				<< DiagnosticInformation(ex, false);
+
+			throw;
+		}
+
+		break;
+	}
+
+	if (!response.keep_alive()) {
+		m_Stream->close();
+		SetConnected(false);
+	}
+
+	if (response.result_int() <= 299)
+		return;
+
+	/* With ?details the response tells which data points have been rejected, e.g. because of a missing tag. */
+	Dictionary::Ptr details;
+
+	try {
+		details = JsonDecode(response.body());
+	} catch (const std::exception&) {
+	}
+
+	if (details && details->Contains("failed")) {
+		Array::Ptr errors = details->Get("errors");
+		String firstError;
+
+		if (errors && errors->GetLength() > 0) {
+			Dictionary::Ptr error = errors->Get(0);
+
+			if (error)
+				firstError = error->Get("error");
+		}
+
+		m_RejectedDataPoints += Convert::ToLong(details->Get("failed"));
+
+		Log(LogWarning, "OpenTsdbWriter")
+			<< "OpenTSDB rejected " << details->Get("failed") << " of " << batch.size() << " data points"
+			<< (firstError.IsEmpty() ? "" : ", e.g.: " + firstError);
+	} else {
+		Log(LogWarning, "OpenTsdbWriter")
+			<< "Unexpected response code " << response.result_int() << " from OpenTSDB on host '" << GetHost() << "' port '" << GetPort() << "'.";
+	}
+
+	/* Rejected data points won't become valid by retrying them, an overloaded/unavailable TSD may recover. */
+	if (response.result_int() >= 500) {
+		BOOST_THROW_EXCEPTION(std::runtime_error("OpenTSDB responded with HTTP status " + std::to_string(response.result_int())));
+	}
+}
+
+bool OpenTsdbWriter::IsHttp()
+{
+	return GetProtocol() == "http";
 }
 
 /**
@@ -531,3 +712,11 @@ void OpenTsdbWriter::ValidateServiceTemplate(const Lazy<Dictionary::Ptr>& lvalue
 		}
 	}
 }
+
+void OpenTsdbWriter::ValidateProtocol(const Lazy<String>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<OpenTsdbWriter>::ValidateProtocol(lvalue, utils);
+
+	if (lvalue() != "telnet" && lvalue() != "http")
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "protocol" }, "Protocol must be 'telnet' or 'http'."));
+}
@@ -4,11 +4,15 @@
 #define OPENTSDBWRITER_H
 
 #include "perfdata/opentsdbwriter-ti.hpp"
+#include "perfdata/writerpipeline.hpp"
 #include "icinga/service.hpp"
+#include "base/atomic.hpp"
 #include "base/configobject.hpp"
 #include "base/tcpsocket.hpp"
 #include "base/timer.hpp"
+#include <cstdint>
 #include <fstream>
+#include <mutex>
 
 namespace icinga
 {
@@ -28,6 +32,7 @@ public:
 
 	void ValidateHostTemplate(const Lazy<Dictionary::Ptr>& lvalue, const ValidationUtils& utils) override;
 	void ValidateServiceTemplate(const Lazy<Dictionary::Ptr>& lvalue, const ValidationUtils& utils) override;
+	void ValidateProtocol(const Lazy<String>& lvalue, const ValidationUtils& utils) override;
 
 protected:
 	void OnConfigLoaded() override;
@@ -36,9 +41,11 @@ protected:
 
 private:
 	Shared<AsioTcpStream>::Ptr m_Stream;
+	std::mutex m_StreamMutex;
+	WriterPipeline::Ptr m_Pipeline;
+	Atomic<uint_fast64_t> m_RejectedDataPoints{0};
 
-	boost::signals2::connection m_HandleCheckResults;
-	Timer::Ptr m_ReconnectTimer;
+	SignalConnection m_HandleCheckResults;
 
 	Dictionary::Ptr m_ServiceConfigTemplate;
 	Dictionary::Ptr m_HostConfigTemplate;
@@ -48,10 +55,13 @@ private:
 		const std::map<String, String>& tags, double value, double ts);
 	void SendPerfdata(const Checkable::Ptr& checkable, const String& metric,
 		const std::map<String, String>& tags, const CheckResult::Ptr& cr, double ts);
+	void SendBatch(const std::vector<String>& batch);
+	void SendHttpBatch(const std::vector<String>& batch);
+	bool IsHttp();
 	static String EscapeTag(const String& str);
 	static String EscapeMetric(const String& str);
 
-	void ReconnectTimerHandler();
+	void ReconnectInternal();
 
 	void ReadConfigTemplate(const Dictionary::Ptr& stemplate, 
 		const Dictionary::Ptr& htemplate);
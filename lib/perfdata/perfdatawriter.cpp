@@ -3,6 +3,8 @@
 #include "perfdata/perfdatawriter.hpp"
 #include "perfdata/perfdatawriter-ti.cpp"
 #include "icinga/service.hpp"
+#include "icinga/checklatency.hpp"
+#include "icinga/checkresultstage.hpp"
 #include "icinga/macroprocessor.hpp"
 #include "icinga/icingaapplication.hpp"
 #include "base/configtype.hpp"
@@ -14,6 +16,14 @@
 #include "base/exception.hpp"
 #include "base/application.hpp"
 #include "base/statsfunction.hpp"
+#include "base/perfdatavalue.hpp"
+
+#ifdef _WIN32
+#	include <windows.h>
+#else /* _WIN32 */
+#	include <errno.h>
+#	include <unistd.h>
+#endif /* _WIN32 */
 
 using namespace icinga;
 
@@ -21,6 +31,12 @@ REGISTER_TYPE(PerfdataWriter);
 
 REGISTER_STATSFUNCTION(PerfdataWriter, &PerfdataWriter::StatsFunc);
 
+/* Losing some perfdata lines is better than stalling check result processing on slow disks. */
+static CheckResultStage l_PerfdataWriterCheckResultStage ("perfdata", 100000, CheckResultStageDrop);
+
+/* Up to this many blocks of flush_threshold bytes are buffered per file while the disk is busy. */
+static const size_t l_MaxBufferedBlocks = 64;
+
 void PerfdataWriter::OnConfigLoaded()
 {
 	ObjectImpl<PerfdataWriter>::OnConfigLoaded();
@@ -33,14 +49,43 @@ void PerfdataWriter::OnConfigLoaded()
 	} else {
 		SetHAMode(HARunOnce);
 	}
+
+	m_WorkQueue.SetName("PerfdataWriter, " + GetName());
+	m_WorkQueue.SetExceptionCallback([this](boost::exception_ptr exp) {
+		Log(LogCritical, "PerfdataWriter")
+			<< "'" << GetName() << "': Exception while writing perfdata files: " << DiagnosticInformation(exp);
+	});
 }
 
-void PerfdataWriter::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr&)
+void PerfdataWriter::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata)
 {
 	DictionaryData nodes;
 
 	for (const PerfdataWriter::Ptr& perfdatawriter : ConfigType::GetObjectsByType<PerfdataWriter>()) {
-		nodes.emplace_back(perfdatawriter->GetName(), 1); //add more stats
+		size_t bufferedBytes;
+
+		{
+			std::unique_lock<std::mutex> lock (perfdatawriter->m_BufferMutex);
+			bufferedBytes = perfdatawriter->m_ServiceOutputFile.Buffer.size() + perfdatawriter->m_HostOutputFile.Buffer.size();
+		}
+
+		double writtenBytes = perfdatawriter->m_WrittenBytes;
+		double droppedLines = perfdatawriter->m_DroppedLines;
+		double rotations = perfdatawriter->m_Rotations;
+
+		nodes.emplace_back(perfdatawriter->GetName(), new Dictionary({
+			{ "buffered_bytes", bufferedBytes },
+			{ "written_bytes", writtenBytes },
+			{ "dropped_lines", droppedLines },
+			{ "rotations", rotations }
+		}));
+
+		String prefix = "perfdatawriter_" + perfdatawriter->GetName();
+
+		perfdata->Add(new PerfdataValue(prefix + "_buffered_bytes", bufferedBytes));
+		perfdata->Add(new PerfdataValue(prefix + "_written_bytes", writtenBytes, true));
+		perfdata->Add(new PerfdataValue(prefix + "_dropped_lines", droppedLines, true));
+		perfdata->Add(new PerfdataValue(prefix + "_rotations", rotations, true));
 	}
 
 	status->Set("perfdatawriter", new Dictionary(std::move(nodes)));
@@ -53,32 +98,37 @@ void PerfdataWriter::Resume()
 	Log(LogInformation, "PerfdataWriter")
 		<< "'" << GetName() << "' resumed.";
 
+	/* All file operations run on the work queue, so neither check result processing nor the timers wait for the disk. */
+	m_WorkQueue.Enqueue([this]() { RotateAllFiles(true); });
+
 	m_HandleCheckResults = Checkable::OnNewCheckResult.connect([this](const Checkable::Ptr& checkable,
 		const CheckResult::Ptr& cr, const MessageOrigin::Ptr&) {
 		CheckResultHandler(checkable, cr);
 	});
 
+	m_FlushTimer = Timer::Create();
+	m_FlushTimer->OnTimerExpired.connect([this](const Timer * const&) { FlushTimerHandler(); });
+	m_FlushTimer->SetInterval(GetFlushInterval());
+	m_FlushTimer->Start();
+
 	m_RotationTimer = Timer::Create();
 	m_RotationTimer->OnTimerExpired.connect([this](const Timer * const&) { RotationTimerHandler(); });
 	m_RotationTimer->SetInterval(GetRotationInterval());
 	m_RotationTimer->Start();
-
-	RotateFile(m_ServiceOutputFile, GetServiceTempPath(), GetServicePerfdataPath());
-	RotateFile(m_HostOutputFile, GetHostTempPath(), GetHostPerfdataPath());
 }
 
 void PerfdataWriter::Pause()
 {
 	m_HandleCheckResults.disconnect();
+	m_FlushTimer->Stop(true);
 	m_RotationTimer->Stop(true);
 
-#ifdef I2_DEBUG
-	//m_HostOutputFile << "\n# Pause the feature" << "\n\n";
-	//m_ServiceOutputFile << "\n# Pause the feature" << "\n\n";
-#endif /* I2_DEBUG */
-
-	/* Force a rotation closing the file stream. */
-	RotateAllFiles();
+	/* Write what is still buffered and force a rotation closing the file stream. */
+	m_WorkQueue.Enqueue([this]() {
+		FlushAllFiles();
+		RotateAllFiles(true);
+	}, PriorityLow);
+	m_WorkQueue.Join();
 
 	Log(LogInformation, "PerfdataWriter")
 		<< "'" << GetName() << "' paused.";
@@ -117,56 +167,205 @@ void PerfdataWriter::CheckResultHandler(const Checkable::Ptr& checkable, const C
 		resolvers.emplace_back("service", service);
 	resolvers.emplace_back("host", host);
 
-	if (service) {
-		String line = MacroProcessor::ResolveMacros(GetServiceFormatTemplate(), resolvers, cr, nullptr, &PerfdataWriter::EscapeMacroMetric);
+	/* The macros are resolved right away, the checkable's state may have changed by the time the stage runs. */
+	String line = MacroProcessor::ResolveMacros(service ? GetServiceFormatTemplate() : GetHostFormatTemplate(),
+		resolvers, cr, nullptr, &PerfdataWriter::EscapeMacroMetric);
 
-		{
-			std::unique_lock<std::mutex> lock(m_StreamMutex);
+	PerfdataWriter::Ptr self (this);
+	OutputFile *output = service ? &m_ServiceOutputFile : &m_HostOutputFile;
 
-			if (!m_ServiceOutputFile.good())
-				return;
+	if (!l_PerfdataWriterCheckResultStage.Enqueue([self, output, line, cr]() {
+		if (!self->IsPaused())
+			self->AppendLine(*output, line, cr);
+	}))
+		DropLine();
+}
 
-			m_ServiceOutputFile << line << "\n";
-		}
-	} else {
-		String line = MacroProcessor::ResolveMacros(GetHostFormatTemplate(), resolvers, cr, nullptr, &PerfdataWriter::EscapeMacroMetric);
+/**
+ * Counts a line which didn't make it into the buffer and warns about that once a minute.
+ */
+void PerfdataWriter::DropLine()
+{
+	auto dropped (++m_DroppedLines);
+	double now = Utility::GetTime();
+	double lastWarning = m_LastDropWarning.load();
 
-		{
-			std::unique_lock<std::mutex> lock(m_StreamMutex);
+	if (now - lastWarning >= 60 && m_LastDropWarning.compare_exchange_strong(lastWarning, now)) {
+		Log(LogWarning, "PerfdataWriter")
+			<< "'" << GetName() << "': Writing the perfdata files doesn't keep up, discarding lines. "
+			<< dropped << " lines have been discarded so far.";
+	}
+}
+
+/**
+ * Buffers a formatted line until the next block is written. Triggers that write early once flush_threshold bytes are buffered.
+ */
+void PerfdataWriter::AppendLine(OutputFile& output, const String& line, const CheckResult::Ptr& cr)
+{
+	size_t threshold = GetFlushThreshold();
+	bool flush;
 
-			if (!m_HostOutputFile.good())
-				return;
+	{
+		std::unique_lock<std::mutex> lock (m_BufferMutex);
 
-			m_HostOutputFile << line << "\n";
+		/* The disk doesn't keep up, the check result stage drops lines in that case, too. */
+		if (output.Buffer.size() >= threshold * l_MaxBufferedBlocks) {
+			lock.unlock();
+			DropLine();
+			return;
 		}
+
+		output.Buffer.append(line.GetData());
+		output.Buffer.append(1, '\n');
+		output.Results.emplace_back(cr);
+
+		flush = output.Buffer.size() >= threshold;
 	}
+
+	if (flush && !m_FlushPending.exchange(true))
+		m_WorkQueue.Enqueue([this]() { FlushAllFiles(); });
+}
+
+void PerfdataWriter::FlushTimerHandler()
+{
+	if (IsPaused())
+		return;
+
+	if (!m_FlushPending.exchange(true))
+		m_WorkQueue.Enqueue([this]() { FlushAllFiles(); });
 }
 
-void PerfdataWriter::RotateFile(std::ofstream& output, const String& temp_path, const String& perfdata_path)
+void PerfdataWriter::FlushAllFiles()
 {
+	/* Lines appended from now on need another flush. */
+	m_FlushPending = false;
+
+	FlushFile(m_ServiceOutputFile, GetServiceTempPath(), GetServicePerfdataPath());
+	FlushFile(m_HostOutputFile, GetHostTempPath(), GetHostPerfdataPath());
+}
+
+/**
+ * Writes the buffered lines as one block and rotates the file once it has grown to rotation_size.
+ */
+void PerfdataWriter::FlushFile(OutputFile& output, const String& temp_path, const String& perfdata_path)
+{
+	ASSERT(m_WorkQueue.IsWorkerThread());
+
+	std::string buffer;
+	std::vector<CheckResult::Ptr> results;
+
+	{
+		std::unique_lock<std::mutex> lock (m_BufferMutex);
+
+		buffer.swap(output.Buffer);
+		results.swap(output.Results);
+	}
+
+	if (buffer.empty())
+		return;
+
+	if (!output.Stream.is_open() || !output.Stream.good()) {
+		m_DroppedLines += results.size();
+		return;
+	}
+
+	output.Stream.write(buffer.data(), buffer.size());
+	output.Stream.flush();
+
+	if (!output.Stream.good()) {
+		Log(LogWarning, "PerfdataWriter")
+			<< "Could not write to perfdata file '" << temp_path << "'. Perfdata will be lost.";
+
+		m_DroppedLines += results.size();
+		return;
+	}
+
+	if (GetFsyncPolicy() == "flush")
+		SyncFile(output, temp_path);
+
+	output.Size += buffer.size();
+	m_WrittenBytes += buffer.size();
+
+	for (const CheckResult::Ptr& cr : results) {
+		CheckLatency::RecordPersisted("perfdata", cr);
+	}
+
+	int rotationSize = GetRotationSize();
+
+	if (rotationSize > 0 && output.Size >= static_cast<uint_fast64_t>(rotationSize))
+		RotateFile(output, temp_path, perfdata_path, false);
+}
+
+void PerfdataWriter::SyncFile(OutputFile& output, const String& temp_path)
+{
+	auto h (output.Stream->handle());
+
+#ifdef _WIN32
+	if (!FlushFileBuffers(h)) {
+		Log(LogWarning, "PerfdataWriter")
+			<< "Could not sync perfdata file '" << temp_path << "' to disk: " << Utility::FormatErrorNumber(GetLastError());
+	}
+#else /* _WIN32 */
+	if (fsync(h)) {
+		Log(LogWarning, "PerfdataWriter")
+			<< "Could not sync perfdata file '" << temp_path << "' to disk: " << Utility::FormatErrorNumber(errno);
+	}
+#endif /* _WIN32 */
+}
+
+/**
+ * Closes the current file, renames it for the collector daemon and starts a new one.
+ *
+ * @param force Also rotate if the file has already been rotated within the current second, e.g. on shutdown.
+ *              Otherwise the rotation is postponed, so both files don't end up with the same name.
+ */
+void PerfdataWriter::RotateFile(OutputFile& output, const String& temp_path, const String& perfdata_path, bool force)
+{
+	ASSERT(m_WorkQueue.IsWorkerThread());
+
+	long now = Utility::GetTime();
+
+	if (!force && now == output.LastRotation)
+		return;
+
 	Log(LogDebug, "PerfdataWriter")
 		<< "Rotating perfdata files.";
 
-	std::unique_lock<std::mutex> lock(m_StreamMutex);
+	if (output.Stream.is_open()) {
+		if (output.Stream.good()) {
+			output.Stream.flush();
+
+			if (GetFsyncPolicy() != "none")
+				SyncFile(output, temp_path);
+		}
 
-	if (output.good()) {
-		output.close();
+		try {
+			output.Stream.close();
+		} catch (const std::exception& ex) {
+			Log(LogWarning, "PerfdataWriter")
+				<< "Could not close perfdata file '" << temp_path << "': " << ex.what();
+		}
+	}
 
-		if (Utility::PathExists(temp_path)) {
-			String finalFile = perfdata_path + "." + Convert::ToString((long)Utility::GetTime());
+	/* A file left behind by a previous run is handed over, too. */
+	if (Utility::PathExists(temp_path)) {
+		String finalFile = perfdata_path + "." + Convert::ToString(now);
 
-			Log(LogDebug, "PerfdataWriter")
-				<< "Closed output file and renaming into '" << finalFile << "'.";
+		Log(LogDebug, "PerfdataWriter")
+			<< "Closed output file and renaming into '" << finalFile << "'.";
 
-			Utility::RenameFile(temp_path, finalFile);
-		}
+		Utility::RenameFile(temp_path, finalFile);
+		m_Rotations++;
 	}
 
-	output.open(temp_path.CStr());
+	output.Size = 0;
+	output.LastRotation = now;
 
-	if (!output.good()) {
+	try {
+		output.Stream.open(boost::iostreams::file_descriptor_sink(temp_path.GetData(), std::ios_base::out | std::ios_base::trunc));
+	} catch (const std::exception& ex) {
 		Log(LogWarning, "PerfdataWriter")
-			<< "Could not open perfdata file '" << temp_path << "' for writing. Perfdata will be lost.";
+			<< "Could not open perfdata file '" << temp_path << "' for writing. Perfdata will be lost: " << ex.what();
 	}
 }
 
@@ -175,13 +374,16 @@ void PerfdataWriter::RotationTimerHandler()
 	if (IsPaused())
 		return;
 
-	RotateAllFiles();
+	m_WorkQueue.Enqueue([this]() {
+		FlushAllFiles();
+		RotateAllFiles(false);
+	});
 }
 
-void PerfdataWriter::RotateAllFiles()
+void PerfdataWriter::RotateAllFiles(bool force)
 {
-	RotateFile(m_ServiceOutputFile, GetServiceTempPath(), GetServicePerfdataPath());
-	RotateFile(m_HostOutputFile, GetHostTempPath(), GetHostPerfdataPath());
+	RotateFile(m_ServiceOutputFile, GetServiceTempPath(), GetServicePerfdataPath(), force);
+	RotateFile(m_HostOutputFile, GetHostTempPath(), GetHostPerfdataPath(), force);
 }
 
 void PerfdataWriter::ValidateHostFormatTemplate(const Lazy<String>& lvalue, const ValidationUtils& utils)
@@ -199,3 +401,27 @@ void PerfdataWriter::ValidateServiceFormatTemplate(const Lazy<String>& lvalue, c
 	if (!MacroProcessor::ValidateMacroString(lvalue()))
 		BOOST_THROW_EXCEPTION(ValidationError(this, { "service_format_template" }, "Closing $ not found in macro format string '" + lvalue() + "'."));
 }
+
+void PerfdataWriter::ValidateFlushThreshold(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<PerfdataWriter>::ValidateFlushThreshold(lvalue, utils);
+
+	if (lvalue() < 1)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "flush_threshold" }, "Flush threshold must be at least 1 byte."));
+}
+
+void PerfdataWriter::ValidateRotationSize(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<PerfdataWriter>::ValidateRotationSize(lvalue, utils);
+
+	if (lvalue() < 0)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "rotation_size" }, "Rotation size must not be negative."));
+}
+
+void PerfdataWriter::ValidateFsyncPolicy(const Lazy<String>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<PerfdataWriter>::ValidateFsyncPolicy(lvalue, utils);
+
+	if (lvalue() != "none" && lvalue() != "rotation" && lvalue() != "flush")
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "fsync_policy" }, "Fsync policy must be 'none', 'rotation' or 'flush'."));
+}
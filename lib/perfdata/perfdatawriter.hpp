@@ -6,8 +6,15 @@
 #include "perfdata/perfdatawriter-ti.hpp"
 #include "icinga/service.hpp"
 #include "base/configobject.hpp"
+#include "base/atomic.hpp"
 #include "base/timer.hpp"
-#include <fstream>
+#include "base/workqueue.hpp"
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace icinga
 {
@@ -27,6 +34,9 @@ public:
 
 	void ValidateHostFormatTemplate(const Lazy<String>& lvalue, const ValidationUtils& utils) override;
 	void ValidateServiceFormatTemplate(const Lazy<String>& lvalue, const ValidationUtils& utils) override;
+	void ValidateFlushThreshold(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
+	void ValidateRotationSize(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
+	void ValidateFsyncPolicy(const Lazy<String>& lvalue, const ValidationUtils& utils) override;
 
 protected:
 	void OnConfigLoaded() override;
@@ -34,18 +44,45 @@ protected:
 	void Pause() override;
 
 private:
-	boost::signals2::connection m_HandleCheckResults;
+	/* Stream, Size and LastRotation are only used by the work queue, Buffer and Results are guarded by m_BufferMutex. */
+	struct OutputFile
+	{
+		boost::iostreams::stream<boost::iostreams::file_descriptor_sink> Stream;
+		uint_fast64_t Size{0};
+		long LastRotation{0};
+
+		std::string Buffer;
+		std::vector<CheckResult::Ptr> Results;
+	};
+
+	SignalConnection m_HandleCheckResults;
+	WorkQueue m_WorkQueue{10000000, 1};
+	Timer::Ptr m_FlushTimer;
 	Timer::Ptr m_RotationTimer;
-	std::ofstream m_ServiceOutputFile;
-	std::ofstream m_HostOutputFile;
-	std::mutex m_StreamMutex;
+
+	std::mutex m_BufferMutex;
+	OutputFile m_ServiceOutputFile;
+	OutputFile m_HostOutputFile;
+	Atomic<bool> m_FlushPending{false};
+
+	Atomic<uint_fast64_t> m_WrittenBytes{0};
+	Atomic<uint_fast64_t> m_DroppedLines{0};
+	Atomic<double> m_LastDropWarning{0};
+	Atomic<uint_fast64_t> m_Rotations{0};
 
 	void CheckResultHandler(const Checkable::Ptr& checkable, const CheckResult::Ptr& cr);
+	void AppendLine(OutputFile& output, const String& line, const CheckResult::Ptr& cr);
+	void DropLine();
 	static Value EscapeMacroMetric(const Value& value);
 
+	void FlushTimerHandler();
+	void FlushAllFiles();
+	void FlushFile(OutputFile& output, const String& temp_path, const String& perfdata_path);
+	void SyncFile(OutputFile& output, const String& temp_path);
+
 	void RotationTimerHandler();
-	void RotateAllFiles();
-	void RotateFile(std::ofstream& output, const String& temp_path, const String& perfdata_path);
+	void RotateAllFiles(bool force);
+	void RotateFile(OutputFile& output, const String& temp_path, const String& perfdata_path, bool force);
 };
 
 }
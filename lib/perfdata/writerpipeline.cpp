@@ -0,0 +1,505 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "perfdata/writerpipeline.hpp"
+#include "base/configuration.hpp"
+#include "base/defer.hpp"
+#include "base/exception.hpp"
+#include "base/json.hpp"
+#include "base/logger.hpp"
+#include "base/perfdatavalue.hpp"
+#include "base/utility.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+using namespace icinga;
+
+/* Failed batches are retried after 1, 2, 4, ... seconds, but at least every five minutes. */
+static const double l_MinRetryDelay = 1;
+static const double l_MaxRetryDelay = 300;
+
+REGISTER_METRICS(&WriterPipeline::MetricsFunc);
+
+/* How many items of the batch which this thread is sending have been put back by Requeue(). */
+static thread_local size_t l_RequeuedItems = 0;
+
+WriterPipeline::WriterPipeline(String name, SendCallback send, size_t concurrency)
+	: m_Name(std::move(name)), m_Send(std::move(send)), m_Concurrency(std::max<size_t>(concurrency, 1)),
+	m_WorkQueue(0, m_Concurrency)
+{
+	m_WorkQueue.SetName("WriterPipeline, " + m_Name);
+}
+
+void WriterPipeline::SetMaxItems(size_t maxItems)
+{
+	m_MaxItems = std::max<size_t>(maxItems, 1);
+}
+
+/**
+ * Sets how many items are sent at once. May also be changed while the pipeline is running.
+ */
+void WriterPipeline::SetBatchSize(size_t batchSize)
+{
+	m_BatchSize = std::max<size_t>(batchSize, 1);
+}
+
+size_t WriterPipeline::GetBatchSize() const
+{
+	return m_BatchSize;
+}
+
+void WriterPipeline::SetFlushInterval(double interval)
+{
+	m_FlushInterval = interval;
+}
+
+/**
+ * Sets the file the oldest items go to once the buffer is full. An empty path drops them instead.
+ */
+void WriterPipeline::SetSpillPath(const String& path)
+{
+	m_SpillPath = path;
+
+	if (!m_SpillPath.IsEmpty())
+		Utility::MkDirP(Utility::DirName(m_SpillPath), 0750);
+}
+
+void WriterPipeline::Start()
+{
+	/* items spilled before a restart are sent first */
+	if (!m_SpillPath.IsEmpty() && Utility::PathExists(m_SpillPath))
+		m_HasSpilledItems = true;
+
+	{
+		std::unique_lock<std::mutex> lock (m_Mutex);
+		m_LastFlush = Utility::GetTime();
+	}
+
+	{
+		std::unique_lock<std::mutex> lock (GetRegistryMutex());
+		GetRegistry().push_back(this);
+	}
+
+	m_FlushTimer = Timer::Create();
+	m_FlushTimer->SetInterval(1);
+	m_FlushTimer->OnTimerExpired.connect([this](const Timer * const&) { FlushTimerHandler(); });
+	m_FlushTimer->Start();
+}
+
+/**
+ * Tries to send everything which is still buffered. What can't be sent is spilled or dropped.
+ */
+void WriterPipeline::Stop()
+{
+	if (m_FlushTimer)
+		m_FlushTimer->Stop(true);
+
+	{
+		std::unique_lock<std::mutex> lock (GetRegistryMutex());
+		auto& registry (GetRegistry());
+
+		registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+	}
+
+	m_WorkQueue.Enqueue([this]() { FlushWQ(true); }, PriorityLow);
+	m_WorkQueue.Join();
+
+	std::deque<String> items;
+
+	{
+		std::unique_lock<std::mutex> lock (m_Mutex);
+		items.swap(m_Items);
+	}
+
+	if (items.empty())
+		return;
+
+	if (!m_SpillPath.IsEmpty()) {
+		Log(LogInformation, "WriterPipeline")
+			<< "'" << m_Name << "': Spilling " << items.size() << " unsent items to '" << m_SpillPath << "'.";
+
+		SpillItems(items);
+	} else {
+		Log(LogWarning, "WriterPipeline")
+			<< "'" << m_Name << "': Dropping " << items.size() << " unsent items.";
+
+		m_DroppedItems += items.size();
+	}
+}
+
+void WriterPipeline::Enqueue(String item)
+{
+	std::deque<String> spill;
+	bool flush;
+
+	{
+		std::unique_lock<std::mutex> lock (m_Mutex);
+
+		m_Items.emplace_back(std::move(item));
+
+		if (m_Items.size() > m_MaxItems) {
+			if (m_SpillPath.IsEmpty()) {
+				m_Items.pop_front();
+				m_DroppedItems++;
+			} else {
+				spill.swap(m_Items);
+			}
+		}
+
+		flush = m_Items.size() >= m_BatchSize && Utility::GetTime() >= m_NextRetry;
+	}
+
+	if (!spill.empty())
+		SpillItems(spill);
+
+	if (flush)
+		Flush();
+}
+
+/**
+ * Sends everything which is buffered, unless as many flushes as batches may be sent in parallel are already pending.
+ */
+void WriterPipeline::Flush()
+{
+	size_t tasks = m_FlushTasks.load();
+
+	do {
+		if (tasks >= m_Concurrency)
+			return;
+	} while (!m_FlushTasks.compare_exchange_weak(tasks, tasks + 1));
+
+	m_WorkQueue.Enqueue([this]() {
+		Defer done ([this]() { m_FlushTasks--; });
+
+		FlushWQ(false);
+	});
+}
+
+void WriterPipeline::FlushTimerHandler()
+{
+	double now = Utility::GetTime();
+
+	{
+		std::unique_lock<std::mutex> lock (m_Mutex);
+
+		if (now < m_NextRetry)
+			return;
+
+		/* a retry is due as soon as its delay expired, everything else waits for the flush interval */
+		if (m_RetryDelay == 0 && now - m_LastFlush < m_FlushInterval)
+			return;
+
+		if (m_Items.empty() && !m_HasSpilledItems)
+			return;
+	}
+
+	Flush();
+}
+
+void WriterPipeline::FlushWQ(bool final)
+{
+	{
+		std::unique_lock<std::mutex> lock (m_Mutex);
+
+		/* don't hammer an unavailable backend, only the last try on shutdown doesn't wait */
+		if (!final && Utility::GetTime() < m_NextRetry)
+			return;
+
+		m_LastFlush = Utility::GetTime();
+	}
+
+	for (;;) {
+		std::vector<String> batch;
+		std::streamoff spillOffset = 0;
+		bool fromSpill = false;
+
+		/* another batch sent in parallel may have failed meanwhile */
+		if (!final) {
+			std::unique_lock<std::mutex> lock (m_Mutex);
+
+			if (Utility::GetTime() < m_NextRetry)
+				break;
+		}
+
+		/* only one batch at a time is read from the spill file, so none is read twice */
+		if (m_HasSpilledItems && !m_SpillBatchPending.exchange(true)) {
+			batch = ReadSpilledItems(spillOffset);
+			fromSpill = !batch.empty();
+
+			if (!fromSpill)
+				m_SpillBatchPending = false;
+		}
+
+		if (!fromSpill) {
+			std::unique_lock<std::mutex> lock (m_Mutex);
+			auto end (m_Items.begin() + std::min(m_Items.size(), m_BatchSize.load()));
+
+			batch.assign(std::make_move_iterator(m_Items.begin()), std::make_move_iterator(end));
+			m_Items.erase(m_Items.begin(), end);
+		}
+
+		if (batch.empty())
+			break;
+
+		double start = Utility::GetTime();
+
+		l_RequeuedItems = 0;
+
+		try {
+			m_Send(batch);
+		} catch (const std::exception& ex) {
+			m_SendFailures++;
+
+			double delay;
+
+			{
+				std::unique_lock<std::mutex> lock (m_Mutex);
+
+				/* spilled items stay in the file */
+				if (!fromSpill)
+					m_Items.insert(m_Items.begin(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+
+				delay = BackOff();
+			}
+
+			if (fromSpill)
+				m_SpillBatchPending = false;
+
+			Log(LogWarning, "WriterPipeline")
+				<< "'" << m_Name << "': Sending " << batch.size() << " items failed, retrying in "
+				<< delay << " second(s): " << DiagnosticInformation(ex, false);
+
+			return;
+		}
+
+		size_t requeued = std::min(l_RequeuedItems, batch.size());
+
+		m_SendLatency = Utility::GetTime() - start;
+		m_SentItems += batch.size() - requeued;
+
+		if (fromSpill) {
+			ConsumeSpilledItems(spillOffset, batch.size());
+			m_SpillBatchPending = false;
+		}
+
+		/* Requeue() has already backed off */
+		if (requeued > 0)
+			return;
+
+		std::unique_lock<std::mutex> lock (m_Mutex);
+		m_RetryDelay = 0;
+		m_NextRetry = 0;
+	}
+}
+
+/**
+ * Puts items of the batch which is being sent back in front of the buffer, e.g. those the backend
+ * rejected because it's overloaded. The pipeline backs off like after a failed batch,
+ * but doesn't send the rest of that batch again.
+ *
+ * Must only be called by the send callback.
+ */
+void WriterPipeline::Requeue(std::vector<String> items)
+{
+	if (items.empty())
+		return;
+
+	double delay;
+
+	{
+		std::unique_lock<std::mutex> lock (m_Mutex);
+
+		m_Items.insert(m_Items.begin(), std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+		delay = BackOff();
+	}
+
+	l_RequeuedItems += items.size();
+
+	Log(LogNotice, "WriterPipeline")
+		<< "'" << m_Name << "': Retrying " << items.size() << " items in " << delay << " second(s).";
+}
+
+/**
+ * Delays the next batch exponentially longer after each failure. The caller must hold m_Mutex.
+ *
+ * @return The current delay
+ */
+double WriterPipeline::BackOff()
+{
+	/* batches sent in parallel which fail at the same time only back off once */
+	if (Utility::GetTime() >= m_NextRetry) {
+		m_RetryDelay = m_RetryDelay > 0 ? std::min(m_RetryDelay * 2, l_MaxRetryDelay) : l_MinRetryDelay;
+		m_NextRetry = Utility::GetTime() + m_RetryDelay;
+	}
+
+	return m_RetryDelay;
+}
+
+/**
+ * Appends items to the spill file (one JSON string per line) and clears them.
+ */
+void WriterPipeline::SpillItems(std::deque<String>& items)
+{
+	std::unique_lock<std::mutex> lock (m_SpillMutex);
+
+	std::ofstream fp (m_SpillPath.CStr(), std::ofstream::out | std::ofstream::app | std::ofstream::binary);
+
+	for (const String& item : items) {
+		fp << JsonEncode(item) << '\n';
+	}
+
+	fp.close();
+
+	if (fp.fail()) {
+		Log(LogWarning, "WriterPipeline")
+			<< "'" << m_Name << "': Can't write to spill file '" << m_SpillPath << "', dropping " << items.size() << " items.";
+
+		m_DroppedItems += items.size();
+	} else {
+		m_SpilledItems += items.size();
+		m_HasSpilledItems = true;
+	}
+
+	items.clear();
+}
+
+/**
+ * Reads the next batch of spilled items. Removes the spill file once everything has been read.
+ *
+ * @param offset Where the file has to continue after this batch has been sent
+ */
+std::vector<String> WriterPipeline::ReadSpilledItems(std::streamoff& offset)
+{
+	std::unique_lock<std::mutex> lock (m_SpillMutex);
+	std::vector<String> items;
+
+	std::ifstream fp (m_SpillPath.CStr(), std::ifstream::in | std::ifstream::binary);
+
+	if (fp) {
+		fp.seekg(m_SpillOffset);
+		offset = m_SpillOffset;
+
+		std::string line;
+
+		while (items.size() < m_BatchSize && std::getline(fp, line)) {
+			/* the last line isn't complete */
+			if (fp.eof())
+				break;
+
+			offset += line.size() + 1;
+
+			try {
+				String item = JsonDecode(line);
+				items.emplace_back(std::move(item));
+			} catch (const std::exception&) {
+				m_DroppedItems++;
+			}
+		}
+
+		fp.close();
+	}
+
+	if (items.empty()) {
+		try {
+			if (Utility::PathExists(m_SpillPath))
+				Utility::Remove(m_SpillPath);
+		} catch (const std::exception& ex) {
+			Log(LogWarning, "WriterPipeline")
+				<< "'" << m_Name << "': Can't remove spill file '" << m_SpillPath << "': " << DiagnosticInformation(ex, false);
+		}
+
+		m_SpillOffset = 0;
+		m_SpilledItems = 0;
+		m_HasSpilledItems = false;
+	}
+
+	return items;
+}
+
+void WriterPipeline::ConsumeSpilledItems(std::streamoff offset, size_t count)
+{
+	std::unique_lock<std::mutex> lock (m_SpillMutex);
+
+	m_SpillOffset = offset;
+	m_SpilledItems -= std::min<uint_fast64_t>(count, m_SpilledItems);
+}
+
+/**
+ * Adds the pipeline's metrics to a writer's status and perfdata.
+ */
+void WriterPipeline::ReportStats(const Dictionary::Ptr& node, const Array::Ptr& perfdata, const String& perfdataPrefix) const
+{
+	size_t bufferedItems;
+
+	{
+		std::unique_lock<std::mutex> lock (m_Mutex);
+		bufferedItems = m_Items.size();
+	}
+
+	double spilledItems = m_SpilledItems;
+	double sentItems = m_SentItems;
+	double droppedItems = m_DroppedItems;
+	double sendFailures = m_SendFailures;
+	double sendLatency = m_SendLatency;
+
+	node->Set("buffered_items", bufferedItems);
+	node->Set("spilled_items", spilledItems);
+	node->Set("sent_items", sentItems);
+	node->Set("dropped_items", droppedItems);
+	node->Set("send_failures", sendFailures);
+	node->Set("send_latency", sendLatency);
+
+	if (perfdata) {
+		perfdata->Add(new PerfdataValue(perfdataPrefix + "_buffered_items", bufferedItems));
+		perfdata->Add(new PerfdataValue(perfdataPrefix + "_spilled_items", spilledItems));
+		perfdata->Add(new PerfdataValue(perfdataPrefix + "_sent_items", sentItems, true));
+		perfdata->Add(new PerfdataValue(perfdataPrefix + "_dropped_items", droppedItems, true));
+		perfdata->Add(new PerfdataValue(perfdataPrefix + "_send_failures", sendFailures, true));
+		perfdata->Add(new PerfdataValue(perfdataPrefix + "_send_latency", sendLatency));
+	}
+}
+
+/**
+ * Returns where a writer's spill file lives, e.g. /var/lib/icinga2/perfdata-spill/graphitewriter-graphite.spill
+ */
+String WriterPipeline::GetSpillPath(const String& type, const String& name)
+{
+	return Configuration::DataDir + "/perfdata-spill/" + type.ToLower() + "-" + name + ".spill";
+}
+
+/**
+ * Adds the counters of all running pipelines to the /v1/metrics endpoint.
+ */
+void WriterPipeline::MetricsFunc(MetricsWriter& writer)
+{
+	std::unique_lock<std::mutex> registryLock (GetRegistryMutex());
+
+	for (auto pipeline : GetRegistry()) {
+		MetricsWriter::Labels labels { { "pipeline", pipeline->m_Name } };
+		size_t bufferedItems;
+
+		{
+			std::unique_lock<std::mutex> lock (pipeline->m_Mutex);
+			bufferedItems = pipeline->m_Items.size();
+		}
+
+		writer.AddGauge("icinga_writer_buffered_items", "Items of a perfdata writer waiting to be sent", bufferedItems, labels);
+		writer.AddGauge("icinga_writer_spilled_items", "Items of a perfdata writer waiting in its spill file", pipeline->m_SpilledItems.load(), labels);
+		writer.AddCounter("icinga_writer_sent_items_total", "Items a perfdata writer has sent", pipeline->m_SentItems.load(), labels);
+		writer.AddCounter("icinga_writer_dropped_items_total", "Items a perfdata writer has dropped", pipeline->m_DroppedItems.load(), labels);
+		writer.AddCounter("icinga_writer_send_failures_total", "Batches a perfdata writer failed to send", pipeline->m_SendFailures.load(), labels);
+		writer.AddGauge("icinga_writer_send_latency_seconds", "Duration of the last batch a perfdata writer has sent", pipeline->m_SendLatency.load(), labels);
+	}
+}
+
+std::mutex& WriterPipeline::GetRegistryMutex()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+std::vector<WriterPipeline*>& WriterPipeline::GetRegistry()
+{
+	static std::vector<WriterPipeline*> registry;
+	return registry;
+}
@@ -0,0 +1,110 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef WRITERPIPELINE_H
+#define WRITERPIPELINE_H
+
+#include "base/object.hpp"
+#include "base/array.hpp"
+#include "base/atomic.hpp"
+#include "base/dictionary.hpp"
+#include "base/metrics.hpp"
+#include "base/timer.hpp"
+#include "base/workqueue.hpp"
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <ios>
+#include <mutex>
+#include <vector>
+
+namespace icinga
+{
+
+/**
+ * The way from a perfdata writer to its backend: buffers the writer's items (lines, documents, ...),
+ * sends them in batches once enough have accumulated or the flush interval expired and retries
+ * failed batches with exponential backoff.
+ *
+ * Up to "concurrency" batches are sent in parallel, e.g. over multiple connections.
+ *
+ * The buffer is bounded. Once it's full, the oldest items are either dropped or, if a spill file is set,
+ * written to that file and sent from there (before everything else) as soon as the backend is back.
+ *
+ * @ingroup perfdata
+ */
+class WriterPipeline final : public Object
+{
+public:
+	DECLARE_PTR_TYPEDEFS(WriterPipeline);
+
+	/* Sends one batch, throws if it should be retried later. */
+	typedef std::function<void (const std::vector<String>& batch)> SendCallback;
+
+	WriterPipeline(String name, SendCallback send, size_t concurrency = 1);
+
+	void SetMaxItems(size_t maxItems);
+	void SetBatchSize(size_t batchSize);
+	size_t GetBatchSize() const;
+	void SetFlushInterval(double interval);
+	void SetSpillPath(const String& path);
+
+	void Start();
+	void Stop();
+
+	void Enqueue(String item);
+	void Requeue(std::vector<String> items);
+	void Flush();
+
+	void ReportStats(const Dictionary::Ptr& node, const Array::Ptr& perfdata, const String& perfdataPrefix) const;
+
+	static String GetSpillPath(const String& type, const String& name);
+
+	static void MetricsFunc(MetricsWriter& writer);
+
+private:
+	String m_Name;
+	SendCallback m_Send;
+
+	size_t m_MaxItems{100000};
+	Atomic<size_t> m_BatchSize{1024};
+	double m_FlushInterval{10};
+	String m_SpillPath;
+
+	size_t m_Concurrency;
+	WorkQueue m_WorkQueue;
+	Timer::Ptr m_FlushTimer;
+
+	mutable std::mutex m_Mutex;
+	std::deque<String> m_Items;
+	double m_LastFlush{0};
+	double m_RetryDelay{0};
+	double m_NextRetry{0};
+	Atomic<size_t> m_FlushTasks{0};
+
+	/* m_SpillMutex is taken before m_Mutex, if both are needed */
+	mutable std::mutex m_SpillMutex;
+	std::streamoff m_SpillOffset{0};
+	Atomic<uint_fast64_t> m_SpilledItems{0};
+	Atomic<bool> m_HasSpilledItems{false};
+	Atomic<bool> m_SpillBatchPending{false};
+
+	Atomic<uint_fast64_t> m_SentItems{0};
+	Atomic<uint_fast64_t> m_DroppedItems{0};
+	Atomic<uint_fast64_t> m_SendFailures{0};
+	Atomic<double> m_SendLatency{0};
+
+	void FlushTimerHandler();
+	void FlushWQ(bool final);
+	double BackOff();
+
+	static std::mutex& GetRegistryMutex();
+	static std::vector<WriterPipeline*>& GetRegistry();
+
+	void SpillItems(std::deque<String>& items);
+	std::vector<String> ReadSpilledItems(std::streamoff& offset);
+	void ConsumeSpilledItems(std::streamoff offset, size_t count);
+};
+
+}
+
+#endif /* WRITERPIPELINE_H */
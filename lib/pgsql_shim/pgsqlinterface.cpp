@@ -51,6 +51,31 @@ struct PgsqlInterfaceImpl final : public PgsqlInterface
 		return PQgetisnull(res, tup_num, field_num);
 	}
 
+	int enterPipelineMode(PGconn *conn) const override
+	{
+#ifdef LIBPQ_HAS_PIPELINING
+		return PQenterPipelineMode(conn);
+#else /* LIBPQ_HAS_PIPELINING */
+		(void)conn;
+		return 0;
+#endif /* LIBPQ_HAS_PIPELINING */
+	}
+
+	int exitPipelineMode(PGconn *conn) const override
+	{
+#ifdef LIBPQ_HAS_PIPELINING
+		return PQexitPipelineMode(conn);
+#else /* LIBPQ_HAS_PIPELINING */
+		(void)conn;
+		return 0;
+#endif /* LIBPQ_HAS_PIPELINING */
+	}
+
+	PGresult *getResult(PGconn *conn) const override
+	{
+		return PQgetResult(conn);
+	}
+
 	char *getvalue(const PGresult *res, int tup_num, int field_num) const override
 	{
 		return PQgetvalue(res, tup_num, field_num);
@@ -71,6 +96,36 @@ struct PgsqlInterfaceImpl final : public PgsqlInterface
 		return PQntuples(res);
 	}
 
+	/* Whether libpq has been built with pipeline mode (libpq 14+). */
+	bool pipelineSupported() const override
+	{
+#ifdef LIBPQ_HAS_PIPELINING
+		return true;
+#else /* LIBPQ_HAS_PIPELINING */
+		return false;
+#endif /* LIBPQ_HAS_PIPELINING */
+	}
+
+	int pipelineSync(PGconn *conn) const override
+	{
+#ifdef LIBPQ_HAS_PIPELINING
+		return PQpipelineSync(conn);
+#else /* LIBPQ_HAS_PIPELINING */
+		(void)conn;
+		return 0;
+#endif /* LIBPQ_HAS_PIPELINING */
+	}
+
+	int putCopyData(PGconn *conn, const char *buffer, int nbytes) const override
+	{
+		return PQputCopyData(conn, buffer, nbytes);
+	}
+
+	int putCopyEnd(PGconn *conn, const char *errormsg) const override
+	{
+		return PQputCopyEnd(conn, errormsg);
+	}
+
 	char *resultErrorMessage(const PGresult *res) const override
 	{
 		return PQresultErrorMessage(res);
@@ -81,6 +136,21 @@ struct PgsqlInterfaceImpl final : public PgsqlInterface
 		return PQresultStatus(res);
 	}
 
+	bool resultIsPipelineSync(const PGresult *res) const override
+	{
+#ifdef LIBPQ_HAS_PIPELINING
+		return PQresultStatus(res) == PGRES_PIPELINE_SYNC;
+#else /* LIBPQ_HAS_PIPELINING */
+		(void)res;
+		return false;
+#endif /* LIBPQ_HAS_PIPELINING */
+	}
+
+	int sendQueryParams(PGconn *conn, const char *command) const override
+	{
+		return PQsendQueryParams(conn, command, 0, nullptr, nullptr, nullptr, nullptr, 0);
+	}
+
 	int serverVersion(const PGconn *conn) const override
 	{
 		return PQserverVersion(conn);
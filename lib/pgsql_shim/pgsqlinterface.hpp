@@ -25,12 +25,21 @@ struct PgsqlInterface
 	virtual void finish(PGconn *conn) const = 0;
 	virtual char *fname(const PGresult *res, int field_num) const = 0;
 	virtual int getisnull(const PGresult *res, int tup_num, int field_num) const = 0;
+	virtual int enterPipelineMode(PGconn *conn) const = 0;
+	virtual int exitPipelineMode(PGconn *conn) const = 0;
+	virtual PGresult *getResult(PGconn *conn) const = 0;
 	virtual char *getvalue(const PGresult *res, int tup_num, int field_num) const = 0;
 	virtual int isthreadsafe() const = 0;
 	virtual int nfields(const PGresult *res) const = 0;
 	virtual int ntuples(const PGresult *res) const = 0;
+	virtual bool pipelineSupported() const = 0;
+	virtual int pipelineSync(PGconn *conn) const = 0;
+	virtual int putCopyData(PGconn *conn, const char *buffer, int nbytes) const = 0;
+	virtual int putCopyEnd(PGconn *conn, const char *errormsg) const = 0;
 	virtual char *resultErrorMessage(const PGresult *res) const = 0;
 	virtual ExecStatusType resultStatus(const PGresult *res) const = 0;
+	virtual bool resultIsPipelineSync(const PGresult *res) const = 0;
+	virtual int sendQueryParams(PGconn *conn, const char *command) const = 0;
 	virtual int serverVersion(const PGconn *conn) const = 0;
 	virtual PGconn *setdbLogin(const char *pghost, const char *pgport, const char *pgoptions, const char *pgtty, const char *dbName, const char *login, const char *pwd) const = 0;
 	virtual PGconn *connectdb(const char *conninfo) const = 0;
@@ -4,9 +4,12 @@
 #include "remote/httputility.hpp"
 #include "remote/filterutility.hpp"
 #include "remote/apiaction.hpp"
+#include "base/configuration.hpp"
 #include "base/defer.hpp"
 #include "base/exception.hpp"
 #include "base/logger.hpp"
+#include "base/workqueue.hpp"
+#include <map>
 #include <set>
 
 using namespace icinga;
@@ -15,6 +18,230 @@ thread_local ApiUser::Ptr ActionsHandler::AuthenticatedApiUser;
 
 REGISTER_URLHANDLER("/v1/actions", ActionsHandler);
 
+static Dictionary::Ptr MakeActionFailure(const std::exception& ex, bool verbose)
+{
+	Dictionary::Ptr fail = new Dictionary({
+		{ "code", 500 },
+		{ "status", "Action execution failed: '" + DiagnosticInformation(ex, false) + "'." }
+	});
+
+	/* Exception for actions. Normally we would handle this inside SendJsonError(). */
+	if (verbose)
+		fail->Set("diagnostic_information", DiagnosticInformation(ex));
+
+	return fail;
+}
+
+static Dictionary::Ptr InvokeAction(const ApiAction::Ptr& action, const ConfigObject::Ptr& obj, const Dictionary::Ptr& params, bool verbose)
+{
+	try {
+		return action->Invoke(obj, params);
+	} catch (const std::exception& ex) {
+		return MakeActionFailure(ex, verbose);
+	}
+}
+
+/**
+ * Invokes the action for all of the given objects at once, e.g. to create their downtimes in one transaction.
+ *
+ * @returns One result per object, all of them the same failure if the action failed as a whole.
+ */
+static ArrayData InvokeBatchAction(const ApiAction::Ptr& action, const std::vector<Value>& objs, const Dictionary::Ptr& params, bool verbose)
+{
+	std::vector<ConfigObject::Ptr> targets;
+	targets.reserve(objs.size());
+
+	for (const ConfigObject::Ptr& obj : objs) {
+		targets.emplace_back(obj);
+	}
+
+	try {
+		return action->InvokeBatch(targets, params);
+	} catch (const std::exception& ex) {
+		return ArrayData(objs.size(), MakeActionFailure(ex, verbose));
+	}
+}
+
+/**
+ * @returns The common status code of the given results, 200 for different success codes and 500 otherwise.
+ */
+static int GetResultsStatusCode(const ArrayData& results)
+{
+	int statusCode = 500;
+	std::set<int> okStatusCodes, nonOkStatusCodes;
+
+	for (const Dictionary::Ptr& res : results) {
+		if (!res->Contains("code")) {
+			continue;
+		}
+
+		auto code = res->Get("code");
+
+		if (code >= 200 && code <= 299) {
+			okStatusCodes.insert(code);
+		} else {
+			nonOkStatusCodes.insert(code);
+		}
+	}
+
+	size_t okSize = okStatusCodes.size();
+	size_t nonOkSize = nonOkStatusCodes.size();
+
+	if (okSize == 1u && nonOkSize == 0u) {
+		statusCode = *okStatusCodes.begin();
+	} else if (nonOkSize == 1u) {
+		statusCode = *nonOkStatusCodes.begin();
+	} else if (okSize >= 2u && nonOkSize == 0u) {
+		statusCode = 200;
+	}
+
+	return statusCode;
+}
+
+/**
+ * Runs the given action once per item of the "bulk" parameter. Each item consists of the usual parameters of
+ * the action (incl. the target object filter) which override the ones outside of "bulk".
+ *
+ * Targets are resolved and the action is invoked in parallel, but sequentially per target object
+ * in the items' order so that e.g. check results for the same object are processed in order.
+ *
+ * @returns One result per item, each with the code, (on failure) status and results of the action invocations.
+ */
+static ArrayData InvokeBulkAction(const ApiAction::Ptr& action, const String& actionName,
+	const ApiUser::Ptr& user, const Dictionary::Ptr& params, const Array::Ptr& bulk, bool verbose)
+{
+	struct BulkItem
+	{
+		Dictionary::Ptr Params;
+		std::vector<Value> Objects;
+		ArrayData Results;
+		Dictionary::Ptr Error;
+	};
+
+	const std::vector<String>& types = action->GetTypes();
+	String permission = "actions/" + actionName;
+	std::vector<BulkItem> items;
+
+	if (types.empty())
+		FilterUtility::CheckPermission(user, permission);
+
+	{
+		ObjectLock olock (bulk);
+
+		for (const Value& item : bulk) {
+			if (!item.IsObjectType<Dictionary>())
+				BOOST_THROW_EXCEPTION(std::invalid_argument("Each item of 'bulk' must be a dictionary."));
+
+			Dictionary::Ptr itemParams = params->ShallowClone();
+			itemParams->Remove("bulk");
+			static_cast<Dictionary::Ptr>(item)->CopyTo(itemParams);
+
+			items.emplace_back();
+			items.back().Params = std::move(itemParams);
+		}
+	}
+
+	std::vector<size_t> indices (items.size());
+
+	for (size_t i = 0; i < indices.size(); i++) {
+		indices[i] = i;
+	}
+
+	WorkQueue upq (25000, Configuration::Concurrency);
+	upq.SetName("ActionsHandler");
+
+	upq.ParallelFor(indices, [&items, &types, &permission, &user](size_t i) {
+		BulkItem& item = items[i];
+
+		if (types.empty()) {
+			item.Objects.emplace_back(nullptr);
+			return;
+		}
+
+		QueryDescription qd;
+		qd.Types = std::set<String>(types.begin(), types.end());
+		qd.Permission = permission;
+
+		try {
+			item.Objects = FilterUtility::GetFilterTargets(qd, item.Params, user);
+		} catch (const std::exception& ex) {
+			item.Error = new Dictionary({
+				{ "code", 404 },
+				{ "status", "No objects found." },
+				{ "diagnostic_information", DiagnosticInformation(ex) }
+			});
+			return;
+		}
+
+		if (item.Objects.empty()) {
+			item.Error = new Dictionary({
+				{ "code", 404 },
+				{ "status", "No objects found." }
+			});
+		}
+	});
+
+	upq.Join();
+
+	/* Invocations per target object (item index, object index), in the items' order. */
+	std::map<Object*, std::vector<std::pair<size_t, size_t>>> perObject;
+
+	for (size_t i = 0; i < items.size(); i++) {
+		auto& objects (items[i].Objects);
+
+		items[i].Results.resize(objects.size());
+
+		for (size_t j = 0; j < objects.size(); j++) {
+			perObject[objects[j].IsEmpty() ? nullptr : static_cast<Object::Ptr>(objects[j]).get()].emplace_back(i, j);
+		}
+	}
+
+	std::vector<std::vector<std::pair<size_t, size_t>>> invocations;
+	invocations.reserve(perObject.size());
+
+	for (auto& kv : perObject) {
+		invocations.emplace_back(std::move(kv.second));
+	}
+
+	upq.ParallelForStealing(invocations, [&items, &action, &user, verbose](const std::vector<std::pair<size_t, size_t>>& sequence) {
+		ActionsHandler::AuthenticatedApiUser = user;
+		Defer a ([]() {
+			ActionsHandler::AuthenticatedApiUser = nullptr;
+		});
+
+		for (auto& invocation : sequence) {
+			BulkItem& item = items[invocation.first];
+			ConfigObject::Ptr obj = item.Objects[invocation.second];
+
+			item.Results[invocation.second] = InvokeAction(action, obj, item.Params, verbose);
+		}
+	});
+
+	upq.Join();
+
+	ArrayData results;
+	results.reserve(items.size());
+
+	for (auto& item : items) {
+		if (item.Error) {
+			if (!verbose)
+				item.Error->Remove("diagnostic_information");
+
+			results.emplace_back(std::move(item.Error));
+			continue;
+		}
+
+		int code = GetResultsStatusCode(item.Results);
+
+		results.emplace_back(new Dictionary({
+			{ "code", code },
+			{ "results", new Array(std::move(item.Results)) }
+		}));
+	}
+
+	return results;
+}
+
 bool ActionsHandler::HandleRequest(
 	AsioTlsStream& stream,
 	const ApiUser::Ptr& user,
@@ -43,6 +270,42 @@ bool ActionsHandler::HandleRequest(
 		return true;
 	}
 
+	Value bulk;
+
+	if (params)
+		bulk = params->Get("bulk");
+
+	if (!bulk.IsEmpty()) {
+		if (!bulk.IsObjectType<Array>()) {
+			HttpUtility::SendJsonError(response, params, 400, "Parameter 'bulk' must be an array.");
+			return true;
+		}
+
+		bool verbose = HttpUtility::GetLastParameter(params, "verbose");
+
+		Log(LogNotice, "ApiActionHandler")
+			<< "Running action " << actionName << " for " << static_cast<Array::Ptr>(bulk)->GetLength() << " bulk items";
+
+		ArrayData results;
+
+		try {
+			results = InvokeBulkAction(action, actionName, user, params, bulk, verbose);
+		} catch (const std::invalid_argument& ex) {
+			HttpUtility::SendJsonError(response, params, 400, ex.what());
+			return true;
+		}
+
+		response.result(GetResultsStatusCode(results));
+
+		Dictionary::Ptr result = new Dictionary({
+			{ "results", new Array(std::move(results)) }
+		});
+
+		HttpUtility::SendJsonBody(response, params, result);
+
+		return true;
+	}
+
 	QueryDescription qd;
 
 	const std::vector<String>& types = action->GetTypes();
@@ -88,50 +351,15 @@ bool ActionsHandler::HandleRequest(
 	if (params)
 		verbose = HttpUtility::GetLastParameter(params, "verbose");
 
-	for (const ConfigObject::Ptr& obj : objs) {
-		try {
-			results.emplace_back(action->Invoke(obj, params));
-		} catch (const std::exception& ex) {
-			Dictionary::Ptr fail = new Dictionary({
-				{ "code", 500 },
-				{ "status", "Action execution failed: '" + DiagnosticInformation(ex, false) + "'." }
-			});
-
-			/* Exception for actions. Normally we would handle this inside SendJsonError(). */
-			if (verbose)
-				fail->Set("diagnostic_information", DiagnosticInformation(ex));
-
-			results.emplace_back(std::move(fail));
-		}
-	}
-
-	int statusCode = 500;
-	std::set<int> okStatusCodes, nonOkStatusCodes;
-
-	for (const Dictionary::Ptr& res : results) {
-		if (!res->Contains("code")) {
-			continue;
-		}
-
-		auto code = res->Get("code");
-
-		if (code >= 200 && code <= 299) {
-			okStatusCodes.insert(code);
-		} else {
-			nonOkStatusCodes.insert(code);
+	if (action->HasBatchCallback() && objs.size() > 1u) {
+		results = InvokeBatchAction(action, objs, params, verbose);
+	} else {
+		for (const ConfigObject::Ptr& obj : objs) {
+			results.emplace_back(InvokeAction(action, obj, params, verbose));
 		}
 	}
 
-	size_t okSize = okStatusCodes.size();
-	size_t nonOkSize = nonOkStatusCodes.size();
-
-	if (okSize == 1u && nonOkSize == 0u) {
-		statusCode = *okStatusCodes.begin();
-	} else if (nonOkSize == 1u) {
-		statusCode = *nonOkStatusCodes.begin();
-	} else if (okSize >= 2u && nonOkSize == 0u) {
-		statusCode = 200;
-	}
+	int statusCode = GetResultsStatusCode(results);
 
 	response.result(statusCode);
 
@@ -6,6 +6,7 @@
 #include "remote/i2-remote.hpp"
 #include "base/registry.hpp"
 #include "base/value.hpp"
+#include "base/array.hpp"
 #include "base/dictionary.hpp"
 #include "base/configobject.hpp"
 #include <vector>
@@ -26,10 +27,16 @@ public:
 
 	typedef std::function<Value(const ConfigObject::Ptr& target, const Dictionary::Ptr& params)> Callback;
 
-	ApiAction(std::vector<String> registerTypes, Callback function);
+	/* Invokes the action for many targets at once, returns one result per target. */
+	typedef std::function<ArrayData(const std::vector<ConfigObject::Ptr>& targets, const Dictionary::Ptr& params)> BatchCallback;
+
+	ApiAction(std::vector<String> registerTypes, Callback function, BatchCallback batchFunction = nullptr);
 
 	Value Invoke(const ConfigObject::Ptr& target, const Dictionary::Ptr& params);
 
+	bool HasBatchCallback() const;
+	ArrayData InvokeBatch(const std::vector<ConfigObject::Ptr>& targets, const Dictionary::Ptr& params);
+
 	const std::vector<String>& GetTypes() const;
 
 	static ApiAction::Ptr GetByName(const String& name);
@@ -39,6 +46,7 @@ public:
 private:
 	std::vector<String> m_Types;
 	Callback m_Callback;
+	BatchCallback m_BatchCallback;
 };
 
 /**
@@ -64,6 +72,18 @@ public:
 		ApiActionRegistry::GetInstance()->Register(registerName, action); \
 	})
 
+#define REGISTER_BATCH_APIACTION(name, types, callback, batchCallback) \
+	INITIALIZE_ONCE([]() { \
+		String registerName = #name; \
+		boost::algorithm::replace_all(registerName, "_", "-"); \
+		std::vector<String> registerTypes; \
+		String typeNames = types; \
+		if (!typeNames.IsEmpty()) \
+			registerTypes = typeNames.Split(";"); \
+		ApiAction::Ptr action = new ApiAction(registerTypes, callback, batchCallback); \
+		ApiActionRegistry::GetInstance()->Register(registerName, action); \
+	})
+
 }
 
 #endif /* APIACTION_H */
@@ -5,6 +5,8 @@
 #include "base/configtype.hpp"
 #include "base/utility.hpp"
 #include "base/convert.hpp"
+#include <cmath>
+#include <cstdint>
 
 using namespace icinga;
 
@@ -53,6 +55,18 @@ void ApiListener::UpdateObjectAuthority()
 		);
 	}
 
+	/* Rendezvous hashing only moves the objects of a joining or leaving endpoint,
+	 * but all endpoints have to agree on it. Otherwise use the old modulo scheme.
+	 */
+	bool rendezvous = true;
+
+	for (const Endpoint::Ptr& endpoint : endpoints) {
+		if (endpoint != my_endpoint && !(endpoint->GetCapabilities() & (uint_fast64_t)ApiCapabilities::RendezvousAuthority)) {
+			rendezvous = false;
+			break;
+		}
+	}
+
 	for (const Type::Ptr& type : Type::GetAllTypes()) {
 		auto *dtype = dynamic_cast<ConfigType *>(type.get());
 
@@ -67,6 +81,8 @@ void ApiListener::UpdateObjectAuthority()
 
 			if (!my_zone)
 				authority = true;
+			else if (rendezvous)
+				authority = GetAuthorityEndpoint(object->GetName(), endpoints) == my_endpoint;
 			else
 				authority = endpoints[Utility::SDBM(object->GetName()) % endpoints.size()] == my_endpoint;
 
@@ -82,3 +98,71 @@ void ApiListener::UpdateObjectAuthority()
 
 	m_UpdatedObjectAuthority.store(true);
 }
+
+/**
+ * Picks the endpoint with the highest score for the given object (weighted rendezvous hashing).
+ *
+ * @param objectName Name of the object.
+ * @param endpoints Candidate endpoints, sorted by name. Must not be empty.
+ * @returns The endpoint which should have authority for the object.
+ */
+Endpoint::Ptr ApiListener::GetAuthorityEndpoint(const String& objectName, const std::vector<Endpoint::Ptr>& endpoints)
+{
+	Endpoint::Ptr best;
+	double bestScore = -1;
+
+	for (const Endpoint::Ptr& endpoint : endpoints) {
+		double score = GetAuthorityScore(objectName, endpoint->GetName(), endpoint->GetAuthorityWeight());
+
+		if (score > bestScore) {
+			best = endpoint;
+			bestScore = score;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * Calculates the rendezvous hashing score of an object/endpoint pair.
+ * The score of each pair is independent from all other endpoints, so adding or removing
+ * an endpoint only moves the objects it wins or had won. An endpoint gets a share of
+ * weight / (sum of all weights) of all objects.
+ *
+ * The result must be the same on all endpoints, so don't use std::hash here.
+ *
+ * @param objectName Name of the object.
+ * @param endpointName Name of the endpoint.
+ * @param weight Weight of the endpoint, greater than 0.
+ * @returns The score, the endpoint with the highest one gets the object.
+ */
+double ApiListener::GetAuthorityScore(const String& objectName, const String& endpointName, double weight)
+{
+	/* FNV-1a over both names... */
+	uint64_t hash = 14695981039346656037u;
+
+	auto update ([&hash](const String& str) {
+		for (char c : str) {
+			hash ^= (unsigned char)c;
+			hash *= 1099511628211u;
+		}
+
+		hash ^= 0xffu;
+		hash *= 1099511628211u;
+	});
+
+	update(endpointName);
+	update(objectName);
+
+	/* ... with the splitmix64 finalizer, FNV-1a alone doesn't spread similar names well. */
+	hash ^= hash >> 30u;
+	hash *= 0xbf58476d1ce4e5b9u;
+	hash ^= hash >> 27u;
+	hash *= 0x94d049bb133111ebu;
+	hash ^= hash >> 31u;
+
+	/* Uniformly distributed in (0, 1), see "Weighted Distributed Hash Tables" (Schindelhauer, Schomaker). */
+	double uniform = ((hash >> 11u) + 0.5) / 9007199254740992.0;
+
+	return -weight / std::log(uniform);
+}
@@ -7,17 +7,31 @@
 #include "base/configtype.hpp"
 #include "base/json.hpp"
 #include "base/convert.hpp"
+#include "base/configuration.hpp"
+#include "base/defer.hpp"
+#include "base/workqueue.hpp"
 #include "config/vmops.hpp"
 #include <fstream>
+#include <map>
+#include <utility>
+#include <vector>
 
 using namespace icinga;
 
 REGISTER_APIFUNCTION(UpdateObject, config, &ApiListener::ConfigUpdateObjectAPIHandler);
+REGISTER_APIFUNCTION(UpdateObjects, config, &ApiListener::ConfigUpdateObjectsAPIHandler);
 REGISTER_APIFUNCTION(DeleteObject, config, &ApiListener::ConfigDeleteObjectAPIHandler);
 
+/* Number of 'config::UpdateObject' messages built in parallel and then sent during SendRuntimeConfigObjects(). */
+static const size_t l_RuntimeObjectsSyncBatchSize = 1024;
+
+/* Maximum number of objects per 'config::UpdateObjects' message. */
+static const size_t l_UpdateObjectsBatchSize = 1000;
+
 INITIALIZE_ONCE([]() {
 	ConfigObject::OnActiveChanged.connect(&ApiListener::ConfigUpdateObjectHandler);
 	ConfigObject::OnVersionChanged.connect(&ApiListener::ConfigUpdateObjectHandler);
+	ConfigObject::OnBatchActivated.connect(&ApiListener::ConfigUpdateObjectsHandler);
 });
 
 void ApiListener::ConfigUpdateObjectHandler(const ConfigObject::Ptr& object, const Value& cookie)
@@ -28,6 +42,10 @@ void ApiListener::ConfigUpdateObjectHandler(const ConfigObject::Ptr& object, con
 		return;
 
 	if (object->IsActive()) {
+		/* Synced with the rest of the batch by ConfigUpdateObjectsHandler(). */
+		if (object->GetExtension("ConfigObjectBatch"))
+			return;
+
 		/* Sync object config */
 		listener->UpdateConfigObject(object, cookie);
 	} else if (!object->IsActive() && object->GetExtension("ConfigObjectDeleted")) {
@@ -36,6 +54,16 @@ void ApiListener::ConfigUpdateObjectHandler(const ConfigObject::Ptr& object, con
 	}
 }
 
+void ApiListener::ConfigUpdateObjectsHandler(const std::vector<ConfigObject::Ptr>& objects, const Value& cookie)
+{
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (!listener)
+		return;
+
+	listener->UpdateConfigObjects(objects, cookie);
+}
+
 Value ApiListener::ConfigUpdateObjectAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
 {
 	Log(LogNotice, "ApiListener")
@@ -204,6 +232,116 @@ Value ApiListener::ConfigUpdateObjectAPIHandler(const MessageOrigin::Ptr& origin
 	return Empty;
 }
 
+/**
+ * Creates the new objects of a 'config::UpdateObjects' message in one transaction
+ * and processes the updates of existing objects one by one.
+ */
+Value ApiListener::ConfigUpdateObjectsAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
+{
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (!listener)
+		return Empty;
+
+	Array::Ptr updates = params->Get("objects");
+
+	if (!updates)
+		return Empty;
+
+	Endpoint::Ptr endpoint = origin->FromClient->GetEndpoint();
+
+	String identity = origin->FromClient->GetIdentity();
+
+	if (!endpoint) {
+		Log(LogNotice, "ApiListener")
+			<< "Discarding 'config update objects' message from '" << identity << "': Invalid endpoint origin (client not allowed).";
+		return Empty;
+	}
+
+	Zone::Ptr endpointZone = endpoint->GetZone();
+
+	if (!Zone::GetLocalZone()->IsChildOf(endpointZone)) {
+		Log(LogNotice, "ApiListener")
+			<< "Discarding 'config update objects' message"
+			<< " from '" << identity << "' (endpoint: '" << endpoint->GetName() << "', zone: '" << endpointZone->GetName() << "')"
+			<< " for " << updates->GetLength() << " objects. Sender is in a child zone.";
+		return Empty;
+	}
+
+	if (!listener->GetAcceptConfig()) {
+		Log(LogWarning, "ApiListener")
+			<< "Ignoring config update"
+			<< " from '" << identity << "' (endpoint: '" << endpoint->GetName() << "', zone: '" << endpointZone->GetName() << "')"
+			<< " for " << updates->GetLength() << " objects. '" << listener->GetName() << "' does not accept config.";
+		return Empty;
+	}
+
+	std::vector<NewConfigObject> newObjects;
+	std::vector<Dictionary::Ptr> newObjectsParams, otherParams;
+
+	{
+		ObjectLock olock (updates);
+
+		for (const Value& update : updates) {
+			if (!update.IsObjectType<Dictionary>())
+				continue;
+
+			Dictionary::Ptr updateParams = update;
+			String objZone = updateParams->Get("zone");
+			Type::Ptr ptype = Type::GetByName(updateParams->Get("type"));
+			auto *ctype = dynamic_cast<ConfigType *>(ptype.get());
+			String objName = updateParams->Get("name");
+			String config = updateParams->Get("config");
+
+			/* Anything else, incl. objects of unknown zones, as if received one by one. */
+			if (ctype && (objZone.IsEmpty() || Zone::GetByName(objZone)) && !config.IsEmpty() && !ctype->GetObject(objName)) {
+				newObjects.emplace_back(NewConfigObject{ ptype, objName, config });
+				newObjectsParams.emplace_back(std::move(updateParams));
+			} else {
+				otherParams.emplace_back(std::move(updateParams));
+			}
+		}
+	}
+
+	if (!newObjects.empty()) {
+		Log(LogNotice, "ApiListener")
+			<< "Processing config update"
+			<< " from '" << identity << "' (endpoint: '" << endpoint->GetName() << "', zone: '" << endpointZone->GetName() << "')"
+			<< " for " << newObjects.size() << " new objects.";
+
+		Array::Ptr errors = new Array();
+
+		/* IMPORTANT: Pass the origin to prevent cluster sync loops. */
+		if (ConfigObjectUtility::CreateObjects(newObjects, errors, nullptr, origin)) {
+			for (decltype(newObjects.size()) i = 0; i < newObjects.size(); i++) {
+				auto *ctype = dynamic_cast<ConfigType *>(newObjects[i].ObjectType.get());
+				ConfigObject::Ptr object = ctype->GetObject(newObjects[i].Name);
+				double objVersion = newObjectsParams[i]->Get("version");
+
+				/* Usually the config already has the version, setting it anyway would relay the object again. */
+				if (object && object->GetVersion() != objVersion)
+					object->SetVersion(objVersion, false, origin);
+			}
+		} else {
+			Log(LogWarning, "ApiListener")
+				<< "Could not create " << newObjects.size() << " objects at once, creating them one by one:";
+
+			ObjectLock olock(errors);
+			for (const String& error : errors) {
+				Log(LogWarning, "ApiListener", error);
+			}
+
+			otherParams.insert(otherParams.end(), newObjectsParams.begin(), newObjectsParams.end());
+		}
+	}
+
+	for (auto& updateParams : otherParams) {
+		ConfigUpdateObjectAPIHandler(origin, updateParams);
+	}
+
+	return Empty;
+}
+
 Value ApiListener::ConfigDeleteObjectAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
 {
 	Log(LogNotice, "ApiListener")
@@ -311,8 +449,98 @@ void ApiListener::UpdateConfigObject(const ConfigObject::Ptr& object, const Mess
 		}
 	}
 
-	if (object->GetPackage() != "_api" && object->GetVersion() == 0)
+	Dictionary::Ptr message = MakeConfigUpdateObjectMessage(object);
+
+	if (!message)
+		return;
+
+	if (client)
+		client->SendMessage(message);
+	else {
+		Zone::Ptr target = static_pointer_cast<Zone>(object->GetZone());
+
+		if (!target)
+			target = Zone::GetLocalZone();
+
+		RelayMessage(origin, target, message, false);
+	}
+}
+
+/**
+ * Sends the given objects, e.g. created by one runtime transaction, as 'config::UpdateObjects' messages
+ * per zone. Falls back to one 'config::UpdateObject' message per object while any connected endpoint
+ * lacks ApiCapabilities::BatchedConfigUpdates.
+ */
+void ApiListener::UpdateConfigObjects(const std::vector<ConfigObject::Ptr>& objects, const MessageOrigin::Ptr& origin)
+{
+	bool batch = true;
+
+	for (const Endpoint::Ptr& endpoint : ConfigType::GetObjectsByType<Endpoint>()) {
+		if (endpoint->GetConnected() && !(endpoint->GetCapabilities() & (uint_fast64_t)ApiCapabilities::BatchedConfigUpdates)) {
+			batch = false;
+			break;
+		}
+	}
+
+	if (!batch) {
+		for (auto& object : objects) {
+			UpdateConfigObject(object, origin);
+		}
+
 		return;
+	}
+
+	auto relay ([this, &origin](const Zone::Ptr& zone, ArrayData updates) {
+		Dictionary::Ptr message = new Dictionary({
+			{ "jsonrpc", "2.0" },
+			{ "method", "config::UpdateObjects" },
+			{ "params", new Dictionary({
+				{ "objects", new Array(std::move(updates)) }
+			}) }
+		});
+
+		RelayMessage(origin, zone, message, false);
+	});
+
+	std::map<Zone::Ptr, ArrayData> updatesByZone;
+
+	for (auto& object : objects) {
+		Dictionary::Ptr message = MakeConfigUpdateObjectMessage(object);
+
+		if (!message)
+			continue;
+
+		Zone::Ptr target = static_pointer_cast<Zone>(object->GetZone());
+
+		if (!target)
+			target = Zone::GetLocalZone();
+
+		auto& updates (updatesByZone[target]);
+
+		updates.emplace_back(message->Get("params"));
+
+		if (updates.size() >= l_UpdateObjectsBatchSize) {
+			relay(target, std::move(updates));
+			updates.clear();
+		}
+	}
+
+	for (auto& updates : updatesByZone) {
+		if (!updates.second.empty())
+			relay(updates.first, std::move(updates.second));
+	}
+}
+
+/**
+ * Builds the 'config::UpdateObject' message for the given object.
+ *
+ * @param object The object to send.
+ * @returns The message, nullptr if the object isn't synced.
+ */
+Dictionary::Ptr ApiListener::MakeConfigUpdateObjectMessage(const ConfigObject::Ptr& object)
+{
+	if (object->GetPackage() != "_api" && object->GetVersion() == 0)
+		return nullptr;
 
 	Dictionary::Ptr params = new Dictionary();
 
@@ -334,7 +562,7 @@ void ApiListener::UpdateConfigObject(const ConfigObject::Ptr& object, const Mess
 	if (object->GetPackage() == "_api") {
 		std::ifstream fp(ConfigObjectUtility::GetExistingObjectConfigPath(object).CStr(), std::ifstream::binary);
 		if (!fp)
-			return;
+			return nullptr;
 
 		String content((std::istreambuf_iterator<char>(fp)), std::istreambuf_iterator<char>());
 		params->Set("config", content);
@@ -370,16 +598,7 @@ void ApiListener::UpdateConfigObject(const ConfigObject::Ptr& object, const Mess
 		<< "Sent update for object '" << object->GetName() << "': " << JsonEncode(params);
 #endif /* I2_DEBUG */
 
-	if (client)
-		client->SendMessage(message);
-	else {
-		Zone::Ptr target = static_pointer_cast<Zone>(object->GetZone());
-
-		if (!target)
-			target = Zone::GetLocalZone();
-
-		RelayMessage(origin, target, message, false);
-	}
+	return message;
 }
 
 
@@ -443,6 +662,8 @@ void ApiListener::SendRuntimeConfigObjects(const JsonRpcConnection::Ptr& aclient
 	Log(LogInformation, "ApiListener")
 		<< "Syncing runtime objects to endpoint '" << endpoint->GetName() << "'.";
 
+	std::vector<ConfigObject::Ptr> objects;
+
 	for (const Type::Ptr& type : Type::GetAllTypes()) {
 		auto *dtype = dynamic_cast<ConfigType *>(type.get());
 
@@ -451,14 +672,99 @@ void ApiListener::SendRuntimeConfigObjects(const JsonRpcConnection::Ptr& aclient
 
 		for (const ConfigObject::Ptr& object : dtype->GetObjects()) {
 			/* don't sync objects for non-matching parent-child zones */
-			if (!azone->CanAccessObject(object))
-				continue;
+			if (azone->CanAccessObject(object) && (object->GetPackage() == "_api" || object->GetVersion() != 0))
+				objects.emplace_back(object);
+		}
+	}
+
+	String endpointName = endpoint->GetName();
+
+	SetRuntimeObjectsSyncProgress(endpointName, 0, objects.size());
+
+	Defer clearProgress ([this, &endpointName]() {
+		ClearRuntimeObjectsSyncProgress(endpointName);
+	});
+
+	WorkQueue upq (l_RuntimeObjectsSyncBatchSize, Configuration::Concurrency);
+	upq.SetName("ApiListener, RuntimeObjectsSync");
+
+	std::vector<size_t> batch;
+	std::vector<Dictionary::Ptr> messages;
+
+	/* Only one batch of messages exists at any time and it's only sent as fast as the client reads,
+	 * so the outgoing queue doesn't grow with the number of objects.
+	 */
+	for (size_t offset = 0; offset < objects.size(); offset += l_RuntimeObjectsSyncBatchSize) {
+		batch.clear();
+
+		for (size_t i = offset; i < objects.size() && i < offset + l_RuntimeObjectsSyncBatchSize; i++)
+			batch.emplace_back(i);
+
+		messages.assign(batch.size(), nullptr);
+
+		upq.ParallelFor(batch, [&objects, &messages, offset](size_t i) {
+			messages[i - offset] = MakeConfigUpdateObjectMessage(objects[i]);
+		});
 
-			/* send the config object to the connected client */
-			UpdateConfigObject(object, nullptr, aclient);
+		upq.Join();
+
+		if (upq.HasExceptions()) {
+			upq.ReportExceptions("ApiListener");
+			return;
+		}
+
+		for (auto& message : messages) {
+			if (message) {
+				/* don't queue all objects at once for slow clients */
+				aclient->WaitForSendCredit();
+
+				/* send the config object to the connected client */
+				aclient->SendMessage(message);
+			}
 		}
+
+		SetRuntimeObjectsSyncProgress(endpointName, offset + batch.size(), objects.size());
 	}
 
 	Log(LogInformation, "ApiListener")
-		<< "Finished syncing runtime objects to endpoint '" << endpoint->GetName() << "'.";
+		<< "Finished syncing " << objects.size() << " runtime objects to endpoint '" << endpoint->GetName() << "'.";
+}
+
+/**
+ * Updates the runtime object sync progress of an endpoint shown in the status.
+ *
+ * @param endpoint Name of the endpoint being synced.
+ * @param sent Number of objects already sent.
+ * @param total Number of objects to send.
+ */
+void ApiListener::SetRuntimeObjectsSyncProgress(const String& endpoint, size_t sent, size_t total)
+{
+	std::unique_lock<std::mutex> lock (m_RuntimeObjectsSyncProgressLock);
+
+	m_RuntimeObjectsSyncProgress[endpoint] = std::make_pair(sent, total);
+}
+
+void ApiListener::ClearRuntimeObjectsSyncProgress(const String& endpoint)
+{
+	std::unique_lock<std::mutex> lock (m_RuntimeObjectsSyncProgressLock);
+
+	m_RuntimeObjectsSyncProgress.erase(endpoint);
+}
+
+/**
+ * @returns The progress of all running runtime object syncs, by endpoint name.
+ */
+Dictionary::Ptr ApiListener::GetRuntimeObjectsSyncProgress()
+{
+	Dictionary::Ptr result = new Dictionary();
+	std::unique_lock<std::mutex> lock (m_RuntimeObjectsSyncProgressLock);
+
+	for (auto& progress : m_RuntimeObjectsSyncProgress) {
+		result->Set(progress.first, new Dictionary({
+			{ "sent", progress.second.first },
+			{ "total", progress.second.second }
+		}));
+	}
+
+	return result;
 }
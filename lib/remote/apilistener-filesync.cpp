@@ -9,6 +9,7 @@
 #include "base/logger.hpp"
 #include "base/convert.hpp"
 #include "base/application.hpp"
+#include "base/atomic-directory.hpp"
 #include "base/exception.hpp"
 #include "base/shared.hpp"
 #include "base/utility.hpp"
@@ -19,6 +20,8 @@
 using namespace icinga;
 
 REGISTER_APIFUNCTION(Update, config, &ApiListener::ConfigUpdateHandler);
+REGISTER_APIFUNCTION(UpdateManifest, config, &ApiListener::ConfigUpdateManifestHandler);
+REGISTER_APIFUNCTION(RequestFiles, config, &ApiListener::ConfigRequestFilesHandler);
 
 std::mutex ApiListener::m_ConfigSyncStageLock;
 
@@ -37,6 +40,25 @@ void ApiListener::SyncLocalZoneDirs() const
 	}
 }
 
+/**
+ * Updates the authoritative configs after the config files changed at runtime, e.g. by an incremental
+ * reload, and sends them to the connected endpoints of the child zones.
+ */
+void ApiListener::UpdateLocalZoneDirs()
+{
+	SyncLocalZoneDirs();
+
+	ApiListener::Ptr listener = this;
+
+	for (const Endpoint::Ptr& endpoint : ConfigType::GetObjectsByType<Endpoint>()) {
+		for (const JsonRpcConnection::Ptr& client : endpoint->GetClients()) {
+			Utility::QueueAsyncCallback([listener, client]() {
+				listener->SendConfigUpdate(client);
+			});
+		}
+	}
+}
+
 /**
  * Sync a zone directory where we have an authoritative copy (zones.d, packages, etc.)
  *
@@ -175,9 +197,14 @@ void ApiListener::SyncLocalZoneDir(const Zone::Ptr& zone) const
  * Loads the zone config files where this client belongs to
  * and sends the 'config::Update' JSON-RPC message.
  *
+ * Clients with ApiCapabilities::IncrementalConfigSync only receive the 'config::UpdateManifest'
+ * message with the file checksums first. They answer with 'config::RequestFiles' listing what
+ * they already have, this function is then called again with that list and only sends the rest.
+ *
  * @param aclient Connected JSON-RPC client.
+ * @param peerChecksums Checksums of the files the client already has, per zone. Empty for a new sync.
  */
-void ApiListener::SendConfigUpdate(const JsonRpcConnection::Ptr& aclient)
+void ApiListener::SendConfigUpdate(const JsonRpcConnection::Ptr& aclient, const Dictionary::Ptr& peerChecksums)
 {
 	Endpoint::Ptr endpoint = aclient->GetEndpoint();
 	ASSERT(endpoint);
@@ -189,11 +216,14 @@ void ApiListener::SendConfigUpdate(const JsonRpcConnection::Ptr& aclient)
 	if (!clientZone->IsChildOf(localZone))
 		return;
 
+	bool sendManifest = !peerChecksums && (endpoint->GetCapabilities() & (uint_fast64_t)ApiCapabilities::IncrementalConfigSync);
+
 	Dictionary::Ptr configUpdateV1 = new Dictionary();
 	Dictionary::Ptr configUpdateV2 = new Dictionary();
 	Dictionary::Ptr configUpdateChecksums = new Dictionary(); // new since 2.11
 
 	String zonesDir = GetApiZonesDir();
+	size_t skippedFiles = 0;
 
 	for (const Zone::Ptr& zone : ConfigType::GetObjectsByType<Zone>()) {
 		String zoneName = zone->GetName();
@@ -208,27 +238,228 @@ void ApiListener::SendConfigUpdate(const JsonRpcConnection::Ptr& aclient)
 			continue;
 
 		Log(LogInformation, "ApiListener")
-			<< "Syncing configuration files for " << (zone->IsGlobal() ? "global " : "")
+			<< (sendManifest ? "Syncing configuration checksums for " : "Syncing configuration files for ")
+			<< (zone->IsGlobal() ? "global " : "")
 			<< "zone '" << zoneName << "' to endpoint '" << endpoint->GetName() << "'.";
 
 		ConfigDirInformation config = LoadConfigDir(zoneDir);
 
+		configUpdateChecksums->Set(zoneName, config.Checksums); // new since 2.11
+
+		if (sendManifest)
+			continue;
+
+		Dictionary::Ptr zoneChecksums;
+
+		if (peerChecksums)
+			zoneChecksums = peerChecksums->Get(zoneName);
+
+		// Leave out the files the client reported to have with the same content.
+		if (zoneChecksums) {
+			for (const Dictionary::Ptr& update : { config.UpdateV1, config.UpdateV2 }) {
+				std::vector<String> known;
+
+				{
+					ObjectLock olock(update);
+
+					for (const Dictionary::Pair& kv : update) {
+						if (zoneChecksums->Get(kv.first) == config.Checksums->Get(kv.first))
+							known.emplace_back(kv.first);
+					}
+				}
+
+				for (const String& path : known)
+					update->Remove(path);
+
+				skippedFiles += known.size();
+			}
+		}
+
 		configUpdateV1->Set(zoneName, config.UpdateV1);
 		configUpdateV2->Set(zoneName, config.UpdateV2);
-		configUpdateChecksums->Set(zoneName, config.Checksums); // new since 2.11
 	}
 
-	Dictionary::Ptr message = new Dictionary({
-		{ "jsonrpc", "2.0" },
-		{ "method", "config::Update" },
-		{ "params", new Dictionary({
+	Dictionary::Ptr message;
+
+	if (sendManifest) {
+		message = new Dictionary({
+			{ "jsonrpc", "2.0" },
+			{ "method", "config::UpdateManifest" },
+			{ "params", new Dictionary({
+				{ "checksums", configUpdateChecksums }
+			}) }
+		});
+	} else {
+		Dictionary::Ptr params = new Dictionary({
 			{ "update", configUpdateV1 },
 			{ "update_v2", configUpdateV2 },	// Since 2.4.2.
 			{ "checksums", configUpdateChecksums } 	// Since 2.11.0.
+		});
+
+		if (peerChecksums) {
+			params->Set("incremental", true);
+
+			Log(LogInformation, "ApiListener")
+				<< "Skipped " << skippedFiles << " configuration files already present on endpoint '" << endpoint->GetName() << "'.";
+		}
+
+		message = new Dictionary({
+			{ "jsonrpc", "2.0" },
+			{ "method", "config::Update" },
+			{ "params", params }
+		});
+	}
+
+	aclient->SendMessage(message);
+}
+
+/**
+ * Registered handler when a new config::UpdateManifest message is received.
+ *
+ * Same checks as ConfigUpdateHandler(), the comparison against production runs in a separate thread.
+ *
+ * @param origin Where this message came from.
+ * @param params Message parameters including the per-zone file checksums.
+ * @returns Empty, required by the interface.
+ */
+Value ApiListener::ConfigUpdateManifestHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
+{
+	// Verify permissions and trust relationship.
+	if (!origin->FromClient->GetEndpoint() || (origin->FromZone && !Zone::GetLocalZone()->IsChildOf(origin->FromZone)))
+		return Empty;
+
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (!listener) {
+		Log(LogCritical, "ApiListener", "No instance available.");
+		return Empty;
+	}
+
+	if (!listener->GetAcceptConfig()) {
+		Log(LogWarning, "ApiListener")
+			<< "Ignoring config update manifest. '" << listener->GetName() << "' does not accept config.";
+		return Empty;
+	}
+
+	std::thread([origin, params, listener]() {
+		try {
+			listener->HandleConfigUpdateManifest(origin, params);
+		} catch (const std::exception& ex) {
+			auto msg ("Exception during config sync: " + DiagnosticInformation(ex));
+
+			Log(LogCritical, "ApiListener") << msg;
+			listener->UpdateLastFailedZonesStageValidation(msg);
+		}
+	}).detach();
+	return Empty;
+}
+
+/**
+ * Compares the received checksums with the production config. If anything differs,
+ * the checksums of all production files are sent back via 'config::RequestFiles',
+ * so the sender only transfers files we don't have yet.
+ *
+ * @param origin Where this message came from.
+ * @param params Message parameters including the per-zone file checksums.
+ */
+void ApiListener::HandleConfigUpdateManifest(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
+{
+	// Production only changes while holding this lock, see TryActivateZonesStage().
+	std::lock_guard<std::mutex> lock(m_ConfigSyncStageLock);
+
+	String fromEndpointName = origin->FromClient->GetEndpoint()->GetName();
+	Dictionary::Ptr checksums = params->Get("checksums");
+
+	if (!checksums)
+		return;
+
+	Dictionary::Ptr have = new Dictionary();
+	bool configChange = false;
+
+	ObjectLock olock(checksums);
+
+	for (const Dictionary::Pair& kv : checksums) {
+		String zoneName = kv.first;
+		Dictionary::Ptr zoneChecksums = kv.second;
+
+		// Zones which HandleConfigUpdate() will ignore anyway are not worth a comparison.
+		if (!zoneChecksums || !Zone::GetByName(zoneName) || ConfigCompiler::HasZoneConfigAuthority(zoneName))
+			continue;
+
+		ConfigDirInformation productionConfigInfo = LoadConfigDir(GetApiZonesDir() + zoneName);
+		Dictionary::Ptr productionChecksums = productionConfigInfo.Checksums;
+
+		if (productionChecksums->GetLength() != zoneChecksums->GetLength()) {
+			configChange = true;
+		} else {
+			ObjectLock xlock(zoneChecksums);
+
+			for (const Dictionary::Pair& file : zoneChecksums) {
+				if (productionChecksums->Get(file.first) != file.second) {
+					configChange = true;
+					break;
+				}
+			}
+		}
+
+		have->Set(zoneName, productionChecksums);
+	}
+
+	if (!configChange) {
+		Log(LogInformation, "ApiListener")
+			<< "Received configuration checksums from endpoint '" << fromEndpointName
+			<< "' are equal to production, skipping config update.";
+		ClearLastFailedZonesStageValidation();
+		return;
+	}
+
+	Log(LogInformation, "ApiListener")
+		<< "Received configuration checksums from endpoint '" << fromEndpointName
+		<< "' are different to production, requesting changed files.";
+
+	/* All zones are listed, not only the changed ones: The received update replaces
+	 * the whole production zones directory, see TryActivateZonesStage().
+	 */
+	origin->FromClient->SendMessage(new Dictionary({
+		{ "jsonrpc", "2.0" },
+		{ "method", "config::RequestFiles" },
+		{ "params", new Dictionary({
+			{ "have", have }
 		}) }
+	}));
+}
+
+/**
+ * Registered handler when a new config::RequestFiles message is received.
+ * Answers with a 'config::Update' message leaving out the files the client already has.
+ *
+ * @param origin Where this message came from.
+ * @param params Message parameters including the client's file checksums.
+ * @returns Empty, required by the interface.
+ */
+Value ApiListener::ConfigRequestFilesHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params)
+{
+	JsonRpcConnection::Ptr client = origin->FromClient;
+
+	// SendConfigUpdate() checks the zone relation.
+	if (!client->GetEndpoint())
+		return Empty;
+
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (!listener)
+		return Empty;
+
+	Dictionary::Ptr have = params->Get("have");
+
+	if (!have)
+		return Empty;
+
+	Utility::QueueAsyncCallback([listener, client, have]() {
+		listener->SendConfigUpdate(client, have);
 	});
 
-	aclient->SendMessage(message);
+	return Empty;
 }
 
 static bool CompareTimestampsConfigChange(const Dictionary::Ptr& productionConfig, const Dictionary::Ptr& receivedConfig,
@@ -351,6 +582,9 @@ void ApiListener::HandleConfigUpdate(const MessageOrigin::Ptr& origin, const Dic
 	if (params->Contains("checksums"))
 		checksums = params->Get("checksums");
 
+	// Answer to our 'config::RequestFiles', only holds files which differ from production.
+	bool incremental = checksums && params->Get("incremental").ToBool();
+
 	bool configChange = false;
 
 	// Keep track of the relative config paths for later validation and copying. TODO: Find a better algorithm.
@@ -417,6 +651,33 @@ void ApiListener::HandleConfigUpdate(const MessageOrigin::Ptr& origin, const Dic
 		// Load the current production config details.
 		ConfigDirInformation productionConfigInfo = LoadConfigDir(productionConfigZoneDir);
 
+		/* Incremental updates leave out the files we've reported via 'config::RequestFiles'.
+		 * Take them from production, that one didn't change in the meantime as we hold m_ConfigSyncStageLock.
+		 */
+		if (incremental && newConfigInfo.Checksums) {
+			newConfigInfo.UpdateV1 = newConfigInfo.UpdateV1 ? newConfigInfo.UpdateV1->ShallowClone() : new Dictionary();
+			newConfigInfo.UpdateV2 = newConfigInfo.UpdateV2 ? newConfigInfo.UpdateV2->ShallowClone() : new Dictionary();
+
+			ObjectLock xlock(newConfigInfo.Checksums);
+
+			for (const Dictionary::Pair& file : newConfigInfo.Checksums) {
+				String path = file.first;
+
+				if (newConfigInfo.UpdateV1->Contains(path) || newConfigInfo.UpdateV2->Contains(path))
+					continue;
+
+				if (productionConfigInfo.Checksums->Get(path) != file.second) {
+					BOOST_THROW_EXCEPTION(std::runtime_error("Incremental config update from endpoint '" + fromEndpointName
+						+ "' for zone '" + zoneName + "' lacks file '" + path + "' which isn't present in production either"));
+				}
+
+				if (productionConfigInfo.UpdateV1->Contains(path))
+					newConfigInfo.UpdateV1->Set(path, productionConfigInfo.UpdateV1->Get(path));
+				else
+					newConfigInfo.UpdateV2->Set(path, productionConfigInfo.UpdateV2->Get(path));
+			}
+		}
+
 		// Merge updateV1 and updateV2
 		Dictionary::Ptr productionConfig = MergeConfigUpdate(productionConfigInfo);
 		Dictionary::Ptr newConfig = MergeConfigUpdate(newConfigInfo);
@@ -611,11 +872,8 @@ void ApiListener::TryActivateZonesStage(const std::vector<String>& relativePaths
 		Log(LogInformation, "ApiListener")
 			<< "Config validation for stage '" << apiZonesStageDir << "' was OK, replacing into '" << apiZonesDir << "' and triggering reload.";
 
-		// Purge production before copying stage.
-		if (Utility::PathExists(apiZonesDir))
-			Utility::RemoveDirRecursive(apiZonesDir);
-
-		Utility::MkDirP(apiZonesDir, 0700);
+		/* Production is replaced as a whole, with a single sync to disk for all files. */
+		AtomicDirectory production (apiZonesDir, 0700);
 
 		// Copy all synced configuration files from stage to production.
 		for (const String& path : relativePaths) {
@@ -626,13 +884,15 @@ void ApiListener::TryActivateZonesStage(const std::vector<String>& relativePaths
 				<< "Copying file '" << path << "' from config sync staging to production zones directory.";
 
 			String stagePath = apiZonesStageDir + path;
-			String currentPath = apiZonesDir + path;
+			String currentPath = production.GetStagingPath() + "/" + path;
 
 			Utility::MkDirP(Utility::DirName(currentPath), 0700);
 
 			Utility::CopyFile(stagePath, currentPath);
 		}
 
+		production.Commit();
+
 		// Clear any failed deployment before
 		ApiListener::Ptr listener = ApiListener::GetInstance();
 
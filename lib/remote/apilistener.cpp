@@ -8,11 +8,15 @@
 #include "remote/apifunction.hpp"
 #include "remote/configpackageutility.hpp"
 #include "remote/configobjectutility.hpp"
+#include "remote/eventqueue.hpp"
 #include "base/atomic-file.hpp"
 #include "base/convert.hpp"
 #include "base/defer.hpp"
+#include "base/gzipfilestream.hpp"
 #include "base/io-engine.hpp"
+#include "base/listenerhandover.hpp"
 #include "base/netstring.hpp"
+#include "base/startupscheduler.hpp"
 #include "base/json.hpp"
 #include "base/configtype.hpp"
 #include "base/logger.hpp"
@@ -34,7 +38,9 @@
 #include <boost/regex.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/thread/locks.hpp>
+#include <algorithm>
 #include <climits>
+#include <cmath>
 #include <cstdint>
 #include <fstream>
 #include <memory>
@@ -49,9 +55,11 @@ using namespace icinga;
 REGISTER_TYPE(ApiListener);
 
 boost::signals2::signal<void(bool)> ApiListener::OnMasterChanged;
+boost::signals2::signal<void()> ApiListener::OnStopping;
 ApiListener::Ptr ApiListener::m_Instance;
 
 REGISTER_STATSFUNCTION(ApiListener, &ApiListener::StatsFunc);
+REGISTER_METRICS(&ApiListener::MetricsFunc);
 
 REGISTER_APIFUNCTION(Hello, icinga, &ApiListener::HelloAPIHandler);
 
@@ -209,6 +217,26 @@ void ApiListener::UpdateSSLContext()
 {
 	auto ctx (SetupSslContext(GetDefaultCertPath(), GetDefaultKeyPath(), GetDefaultCaPath(), GetCrlPath(), GetCipherList(), GetTlsProtocolmin(), GetDebugInfo()));
 
+	{
+		/* Keep the ticket key across restarts, but not across certificate or CRL changes,
+		 * so that no session established with an outdated certificate can be resumed.
+		 */
+		bool rotateTicketKey;
+
+		{
+			boost::shared_lock<decltype(m_SSLContextMutex)> lock (m_SSLContextMutex);
+			rotateTicketKey = (bool)m_SSLContext;
+		}
+
+		try {
+			Utility::MkDirP(GetApiDir(), 0700);
+			SetupSslSessionResumption(ctx, GetApiDir() + "tls-ticket.key", GetTlsSessionTimeout(), rotateTicketKey);
+		} catch (const std::exception& ex) {
+			Log(LogWarning, "ApiListener")
+				<< "Cannot enable TLS session resumption: " << DiagnosticInformation(ex, false);
+		}
+	}
+
 	{
 		boost::unique_lock<decltype(m_SSLContextMutex)> lock (m_SSLContextMutex);
 
@@ -361,6 +389,10 @@ void ApiListener::RenewCA()
 
 void ApiListener::Stop(bool runtimeDeleted)
 {
+	/* Lets buffered messages be relayed (or persisted in the replay log) while the listener is still active. */
+	OnStopping();
+	m_RelayQueue.Join();
+
 	m_ApiPackageIntegrityTimer->Stop(true);
 	m_CleanupCertificateRequestsTimer->Stop(true);
 	m_AuthorityTimer->Stop(true);
@@ -436,6 +468,7 @@ bool ApiListener::AddListener(const String& node, const String& service)
 
 	auto& io (IoEngine::Get().GetIoContext());
 	auto acceptor (Shared<tcp::acceptor>::Make(io));
+	bool tookOver = false;
 
 	try {
 		tcp::resolver resolver (io);
@@ -446,6 +479,17 @@ bool ApiListener::AddListener(const String& node, const String& service)
 
 		for (;;) {
 			try {
+#ifndef _WIN32
+				/* The previous worker's socket, kept open by the umbrella process during the reload. */
+				int fd = ListenerHandover::Adopt(current->endpoint().data(), current->endpoint().size());
+
+				if (fd >= 0) {
+					acceptor->assign(current->endpoint().protocol(), fd);
+					tookOver = true;
+					break;
+				}
+#endif /* _WIN32 */
+
 				acceptor->open(current->endpoint().protocol());
 
 				{
@@ -482,10 +526,15 @@ bool ApiListener::AddListener(const String& node, const String& service)
 
 	acceptor->listen(INT_MAX);
 
+#ifndef _WIN32
+	ListenerHandover::Register(acceptor->native_handle());
+#endif /* _WIN32 */
+
 	auto localEndpoint (acceptor->local_endpoint());
 
 	Log(LogInformation, "ApiListener")
-		<< "Started new listener on '[" << localEndpoint.address() << "]:" << localEndpoint.port() << "'";
+		<< (tookOver ? "Took over listener on '[" : "Started new listener on '[")
+		<< localEndpoint.address() << "]:" << localEndpoint.port() << "'";
 
 	IoEngine::SpawnCoroutine(io, [this, acceptor](asio::yield_context yc) { ListenerCoroutineProc(yc, acceptor); });
 
@@ -498,7 +547,7 @@ void ApiListener::ListenerCoroutineProc(boost::asio::yield_context yc, const Sha
 {
 	namespace asio = boost::asio;
 
-	auto& io (IoEngine::Get().GetIoContext());
+	auto& ioEngine (IoEngine::Get());
 
 	time_t lastModified = -1;
 	const String crlPath = GetCrlPath();
@@ -509,7 +558,9 @@ void ApiListener::ListenerCoroutineProc(boost::asio::yield_context yc, const Sha
 
 	for (;;) {
 		try {
-			asio::ip::tcp::socket socket (io);
+			/* Pin the connection to one shard for its lifetime. */
+			auto& shardIo (ioEngine.GetShardIoContext());
+			asio::ip::tcp::socket socket (shardIo);
 
 			server->async_accept(socket.lowest_layer(), yc);
 
@@ -526,12 +577,12 @@ void ApiListener::ListenerCoroutineProc(boost::asio::yield_context yc, const Sha
 			}
 
 			boost::shared_lock<decltype(m_SSLContextMutex)> lock (m_SSLContextMutex);
-			auto sslConn (Shared<AsioTlsStream>::Make(io, *m_SSLContext));
+			auto sslConn (Shared<AsioTlsStream>::Make(shardIo, *m_SSLContext));
 
 			lock.unlock();
 			sslConn->lowest_layer() = std::move(socket);
 
-			auto strand (Shared<asio::io_context::strand>::Make(io));
+			auto strand (Shared<asio::io_context::strand>::Make(shardIo));
 
 			IoEngine::SpawnCoroutine(*strand, [this, strand, sslConn, remoteEndpoint](asio::yield_context yc) {
 				Timeout::Ptr timeout(new Timeout(strand->context(), *strand, boost::posix_time::microseconds(int64_t(GetConnectTimeout() * 1e6)),
@@ -569,7 +620,7 @@ void ApiListener::AddConnection(const Endpoint::Ptr& endpoint)
 		return;
 	}
 
-	auto& io (IoEngine::Get().GetIoContext());
+	auto& io (IoEngine::Get().GetShardIoContext());
 	auto strand (Shared<asio::io_context::strand>::Make(io));
 
 	IoEngine::SpawnCoroutine(*strand, [this, strand, endpoint, &io](asio::yield_context yc) {
@@ -643,8 +694,15 @@ static const auto l_AppVersionInt (([]() -> unsigned long {
 		+ boost::lexical_cast<unsigned long>(match[3].str());
 })());
 
+/* Add an entry to the replay log's index after every this many bytes. */
+static const uint_fast64_t l_ReplayLogIndexInterval = 256 * 1024;
+
 static const auto l_MyCapabilities (
 	(uint_fast64_t)ApiCapabilities::ExecuteArbitraryCommand | (uint_fast64_t)ApiCapabilities::IfwApiCheckCommand
+		| (uint_fast64_t)ApiCapabilities::NativeNetCheckCommands | (uint_fast64_t)ApiCapabilities::BinaryJsonRpc
+		| (uint_fast64_t)ApiCapabilities::DeflateJsonRpc | (uint_fast64_t)ApiCapabilities::IncrementalConfigSync
+		| (uint_fast64_t)ApiCapabilities::RendezvousAuthority | (uint_fast64_t)ApiCapabilities::BatchedNextChecks
+		| (uint_fast64_t)ApiCapabilities::BatchedExecuteCommands | (uint_fast64_t)ApiCapabilities::BatchedConfigUpdates
 );
 
 /**
@@ -849,12 +907,18 @@ void ApiListener::NewClientHandlerInternal(
 			return;
 		}
 
-		JsonRpcConnection::Ptr aclient = new JsonRpcConnection(identity, verify_ok, client, role);
+		JsonRpcConnection::Ptr aclient = new JsonRpcConnection(identity, verify_ok, client, role, strand->context());
 
 		if (endpoint) {
 			endpoint->AddClient(aclient);
 
-			Utility::QueueAsyncCallback([this, aclient, endpoint]() {
+			/* Until SyncClient() runs, messages for the endpoint go to the replay log only. */
+			{
+				ObjectLock olock(endpoint);
+				endpoint->SetSyncing(true);
+			}
+
+			StartupScheduler::Run({ "cluster", 30, 2, "cluster synced" }, [this, aclient, endpoint]() {
 				SyncClient(aclient, endpoint, true);
 			});
 		} else if (!AddAnonymousClient(aclient)) {
@@ -873,7 +937,7 @@ void ApiListener::NewClientHandlerInternal(
 	} else {
 		Log(LogNotice, "ApiListener", "New HTTP client");
 
-		HttpServerConnection::Ptr aclient = new HttpServerConnection(identity, verify_ok, client);
+		HttpServerConnection::Ptr aclient = new HttpServerConnection(identity, verify_ok, client, strand->context());
 		AddHttpClient(aclient);
 		aclient->Start();
 
@@ -957,6 +1021,87 @@ void ApiListener::SyncClient(const JsonRpcConnection::Ptr& aclient, const Endpoi
 		<< "Finished syncing endpoint '" << endpoint->GetName() << "' in zone '" << eZone->GetName() << "'.";
 }
 
+static uint_fast64_t GetFileSize(const String& path)
+{
+#ifndef _WIN32
+	struct stat statbuf;
+	if (stat(path.CStr(), &statbuf) < 0)
+		return 0;
+#else /* _WIN32 */
+	struct _stat statbuf;
+	if (_stat(path.CStr(), &statbuf) < 0)
+		return 0;
+#endif /* _WIN32 */
+
+	return statbuf.st_size;
+}
+
+/**
+ * @returns The number of messages in the (possibly compressed) replay log file.
+ */
+static size_t CountReplayLogMessages(const String& path)
+{
+	size_t count = 0;
+
+	try {
+		GzipFileStream::Ptr logStream = new GzipFileStream(path, "rb");
+
+		String message;
+		StreamReadContext src;
+
+		for (;;) {
+			StreamReadStatus srs = NetString::ReadStringFromStream(logStream, &message, src);
+
+			if (srs == StatusEof)
+				break;
+
+			if (srs == StatusNewItem)
+				count++;
+		}
+	} catch (const std::exception&) {
+		/* Log files may be incomplete or corrupted. */
+	}
+
+	return count;
+}
+
+/**
+ * Replaces the rotated replay log file with a gzip compressed one. Its index still refers to the uncompressed data.
+ */
+static void CompressReplayLogFile(const String& path)
+{
+	String tmpPath = path + ".gz.tmp";
+
+	if (!Utility::PathExists(path + ".gz")) {
+		try {
+			std::ifstream fp (path.CStr(), std::ifstream::in | std::ifstream::binary);
+			GzipFileStream::Ptr logStream = new GzipFileStream(tmpPath, "wb1");
+			char buffer[64 * 1024];
+
+			while (fp.read(buffer, sizeof(buffer)), fp.gcount() > 0)
+				logStream->Write(buffer, fp.gcount());
+
+			if (fp.bad())
+				BOOST_THROW_EXCEPTION(std::runtime_error("Failed to read '" + path + "'"));
+
+			logStream->Close();
+			Utility::RenameFile(tmpPath, path + ".gz");
+		} catch (const std::exception& ex) {
+			Log(LogWarning, "ApiListener")
+				<< "Cannot compress replay log file '" << path << "': " << DiagnosticInformation(ex, false);
+
+			(void)unlink(tmpPath.CStr());
+			return;
+		}
+
+		Log(LogNotice, "ApiListener")
+			<< "Compressed replay log file: " << path;
+	}
+
+	/* During a replay this may fail on Windows, we'll try again next time. */
+	(void)unlink(path.CStr());
+}
+
 void ApiListener::ApiTimerHandler()
 {
 	double now = Utility::GetTime();
@@ -965,9 +1110,27 @@ void ApiListener::ApiTimerHandler()
 	Utility::Glob(GetApiDir() + "log/*", [&files](const String& file) { LogGlobHandler(files, file); }, GlobFile);
 	std::sort(files.begin(), files.end());
 
-	for (int ts : files) {
+	/* A file may be there both uncompressed and compressed for a while. */
+	files.erase(std::unique(files.begin(), files.end()), files.end());
+
+	/* The size of each file plus the ones of all newer files (including the current one), as limited by log_max_size. */
+	std::vector<uint_fast64_t> sizes (files.size());
+	uint_fast64_t size = GetFileSize(GetApiDir() + "log/current");
+
+	for (size_t i = files.size(); i-- > 0;) {
+		String path = GetApiDir() + "log/" + Convert::ToString(files[i]);
+
+		size += GetFileSize(path) + GetFileSize(path + ".gz");
+		sizes[i] = size;
+	}
+
+	auto localZone (GetLocalEndpoint()->GetZone());
+	std::vector<int> keptFiles;
+
+	for (size_t i = 0; i < files.size(); i++) {
+		int ts = files[i];
 		bool need = false;
-		auto localZone (GetLocalEndpoint()->GetZone());
+		std::set<String> cappedZones;
 
 		for (const Endpoint::Ptr& endpoint : ConfigType::GetObjectsByType<Endpoint>()) {
 			if (endpoint == GetLocalEndpoint())
@@ -984,17 +1147,54 @@ void ApiListener::ApiTimerHandler()
 				continue;
 
 			if (ts > endpoint->GetLocalLogPosition()) {
+				double maxSize = zone->GetLogMaxSize();
+
+				if (maxSize > 0 && sizes[i] > maxSize) {
+					cappedZones.insert(zone->GetName());
+					continue;
+				}
+
 				need = true;
 				break;
 			}
 		}
 
-		if (!need) {
-			String path = GetApiDir() + "log/" + Convert::ToString(ts);
+		if (need) {
+			keptFiles.push_back(ts);
+			continue;
+		}
+
+		String path = GetApiDir() + "log/" + Convert::ToString(ts);
+
+		if (cappedZones.empty()) {
 			Log(LogNotice, "ApiListener")
 				<< "Removing old log file: " << path;
-			(void)unlink(path.CStr());
+		} else {
+			size_t count = CountReplayLogMessages(Utility::PathExists(path) ? path : path + ".gz");
+
+			m_ReplayLogDroppedMessages.fetch_add(count);
+
+			Log(LogWarning, "ApiListener")
+				<< "Dropping " << count << " messages of the log file '" << path << "' exceeding the log_max_size of zone(s) "
+				<< Utility::NaturalJoin(std::vector<String>(cappedZones.begin(), cappedZones.end())) << ".";
 		}
+
+		(void)unlink(path.CStr());
+		(void)unlink((path + ".gz").CStr());
+		(void)unlink((path + ".idx").CStr());
+	}
+
+	/* Compressing a file takes a moment, so don't delay the following for too long after a lot of them have piled up. */
+	double compressUntil = Utility::GetTime() + 1;
+
+	for (int ts : keptFiles) {
+		if (Utility::GetTime() > compressUntil)
+			break;
+
+		String path = GetApiDir() + "log/" + Convert::ToString(ts);
+
+		if (Utility::PathExists(path))
+			CompressReplayLogFile(path);
 	}
 
 	for (const Endpoint::Ptr& endpoint : ConfigType::GetObjectsByType<Endpoint>()) {
@@ -1144,16 +1344,17 @@ void ApiListener::RelayMessage(const MessageOrigin::Ptr& origin,
 	m_RelayQueue.Enqueue([this, origin, secobj, message, log]() { SyncRelayMessage(origin, secobj, message, log); }, PriorityNormal, true);
 }
 
-void ApiListener::PersistMessage(const Dictionary::Ptr& message, const ConfigObject::Ptr& secobj)
+void ApiListener::PersistMessage(const SharedMessage::Ptr& message, const ConfigObject::Ptr& secobj)
 {
-	double ts = message->Get("ts");
+	double ts = message->GetMessage()->Get("ts");
 
 	ASSERT(ts != 0);
 
 	Dictionary::Ptr pmessage = new Dictionary();
 	pmessage->Set("timestamp", ts);
 
-	pmessage->Set("message", JsonEncode(message));
+	/* The replay log is read by older versions, too. So it's always JSON. */
+	pmessage->Set("message", *message->GetEncoded(false));
 
 	if (secobj) {
 		Dictionary::Ptr secname = new Dictionary();
@@ -1164,10 +1365,23 @@ void ApiListener::PersistMessage(const Dictionary::Ptr& message, const ConfigObj
 
 	std::unique_lock<std::mutex> lock(m_LogLock);
 	if (m_LogFile) {
-		NetString::WriteStringToStream(m_LogFile, JsonEncode(pmessage));
+		m_LogFileSize += NetString::WriteStringToStream(m_LogFile, JsonEncode(pmessage));
 		m_LogMessageCount++;
 		SetLogMessageTimestamp(ts);
 
+		if (ts > m_LogFileMaxTimestamp)
+			m_LogFileMaxTimestamp = ts;
+
+		/* Sparse index: all messages before this offset are not newer than this timestamp.
+		 * Rounded up, so that ReplayLog() never skips a message due to a lack of precision. */
+		if (m_LogIndexFile && m_LogFileSize - m_LogFileIndexedSize >= l_ReplayLogIndexInterval) {
+			String entry = Convert::ToString(static_cast<long long>(std::ceil(m_LogFileMaxTimestamp)))
+				+ " " + Convert::ToString(static_cast<long long>(m_LogFileSize)) + "\n";
+
+			m_LogIndexFile->Write(entry.CStr(), entry.GetLength());
+			m_LogFileIndexedSize = m_LogFileSize;
+		}
+
 		if (m_LogMessageCount > 50000) {
 			CloseLogFile();
 			RotateLogFile();
@@ -1177,12 +1391,17 @@ void ApiListener::PersistMessage(const Dictionary::Ptr& message, const ConfigObj
 }
 
 void ApiListener::SyncSendMessage(const Endpoint::Ptr& endpoint, const Dictionary::Ptr& message)
+{
+	SyncSendMessage(endpoint, new SharedMessage(message));
+}
+
+void ApiListener::SyncSendMessage(const Endpoint::Ptr& endpoint, const SharedMessage::Ptr& message)
 {
 	ObjectLock olock(endpoint);
 
 	if (!endpoint->GetSyncing()) {
 		Log(LogNotice, "ApiListener")
-			<< "Sending message '" << message->Get("method") << "' to '" << endpoint->GetName() << "'";
+			<< "Sending message '" << message->GetMessage()->Get("method") << "' to '" << endpoint->GetName() << "'";
 
 		double maxTs = 0;
 
@@ -1211,7 +1430,7 @@ void ApiListener::SyncSendMessage(const Endpoint::Ptr& endpoint, const Dictionar
  * @return true if the message has been relayed to all relevant endpoints,
  *         false if it hasn't and must be persisted in the replay log
  */
-bool ApiListener::RelayMessageOne(const Zone::Ptr& targetZone, const MessageOrigin::Ptr& origin, const Dictionary::Ptr& message, const Endpoint::Ptr& currentZoneMaster)
+bool ApiListener::RelayMessageOne(const Zone::Ptr& targetZone, const MessageOrigin::Ptr& origin, const SharedMessage::Ptr& message, const Endpoint::Ptr& currentZoneMaster)
 {
 	ASSERT(targetZone);
 
@@ -1314,7 +1533,7 @@ bool ApiListener::RelayMessageOne(const Zone::Ptr& targetZone, const MessageOrig
 	}
 
 	if (!skippedEndpoints.empty()) {
-		double ts = message->Get("ts");
+		double ts = message->GetMessage()->Get("ts");
 
 		for (const Endpoint::Ptr& skippedEndpoint : skippedEndpoints)
 			skippedEndpoint->SetLocalLogPosition(ts);
@@ -1349,15 +1568,18 @@ void ApiListener::SyncRelayMessage(const MessageOrigin::Ptr& origin,
 
 	Endpoint::Ptr master = GetMaster();
 
-	bool need_log = !RelayMessageOne(target_zone, origin, message, master);
+	/* Encoded at most once per encoding, for all endpoints and the replay log. */
+	SharedMessage::Ptr shared = new SharedMessage(message);
+
+	bool need_log = !RelayMessageOne(target_zone, origin, shared, master);
 
 	for (const Zone::Ptr& zone : target_zone->GetAllParentsRaw()) {
-		if (!RelayMessageOne(zone, origin, message, master))
+		if (!RelayMessageOne(zone, origin, shared, master))
 			need_log = true;
 	}
 
 	if (log && need_log)
-		PersistMessage(message, secobj);
+		PersistMessage(shared, secobj);
 }
 
 /* must hold m_LogLock */
@@ -1375,13 +1597,39 @@ void ApiListener::OpenLogFile()
 		return;
 	}
 
+	fp->seekp(0, std::ios_base::end);
+
+	auto size (fp->tellp());
+	m_LogFileSize = size > 0 ? (uint_fast64_t)size : 0;
+	m_LogFileIndexedSize = m_LogFileSize;
+
+	/* We don't know how recent the messages of an existing file are, but they're older than now. */
+	m_LogFileMaxTimestamp = m_LogFileSize ? Utility::GetTime() : 0;
+
 	m_LogFile = new StdioStream(fp.release(), true);
 	SetLogMessageTimestamp(Utility::GetTime());
+
+	/* An index pointing beyond the log file (e.g. after a crash) would point into the middle of new messages. */
+	auto indexMode (GetReplayLogOffset(path, INFINITY) > m_LogFileSize ? std::ofstream::trunc : std::ofstream::app);
+
+	std::unique_ptr<std::fstream> ifp = std::make_unique<std::fstream>((path + ".idx").CStr(), std::fstream::out | indexMode);
+
+	if (ifp->good()) {
+		m_LogIndexFile = new StdioStream(ifp.release(), true);
+	} else {
+		Log(LogWarning, "ApiListener")
+			<< "Could not open spool index file: " << path << ".idx";
+	}
 }
 
 /* must hold m_LogLock */
 void ApiListener::CloseLogFile()
 {
+	if (m_LogIndexFile) {
+		m_LogIndexFile->Close();
+		m_LogIndexFile.reset();
+	}
+
 	if (!m_LogFile)
 		return;
 
@@ -1408,6 +1656,10 @@ void ApiListener::RotateLogFile()
 
 			// We're rotating the current log file, so reset the log message counter as well.
 			m_LogMessageCount = 0;
+
+			if (Utility::PathExists(oldpath + ".idx")) {
+				Utility::RenameFile(oldpath + ".idx", newpath + ".idx");
+			}
 		} catch (const std::exception& ex) {
 			Log(LogCritical, "ApiListener")
 				<< "Cannot rotate replay log file from '" << oldpath << "' to '"
@@ -1423,6 +1675,10 @@ void ApiListener::LogGlobHandler(std::vector<int>& files, const String& file)
 	if (name == "current")
 		return;
 
+	/* Compressed by ApiTimerHandler(). */
+	if (name.GetLength() > 3 && name.SubStr(name.GetLength() - 3) == ".gz")
+		name = name.SubStr(0, name.GetLength() - 3);
+
 	int ts;
 
 	try {
@@ -1434,6 +1690,30 @@ void ApiListener::LogGlobHandler(std::vector<int>& files, const String& file)
 	files.push_back(ts);
 }
 
+/**
+ * Looks up where to start replaying a log file using its sparse index.
+ *
+ * @param path The log file
+ * @param peerTimestamp Messages up to this timestamp have already been received by the peer
+ *
+ * @return Offset of the first message possibly newer than peerTimestamp, 0 without an index
+ */
+uint_fast64_t ApiListener::GetReplayLogOffset(const String& path, double peerTimestamp)
+{
+	std::ifstream index ((path + ".idx").CStr());
+	double ts;
+	uint_fast64_t offset, result = 0;
+
+	while (index >> ts >> offset) {
+		if (ts > peerTimestamp)
+			break;
+
+		result = offset;
+	}
+
+	return result;
+}
+
 void ApiListener::ReplayLog(const JsonRpcConnection::Ptr& client)
 {
 	Endpoint::Ptr endpoint = client->GetEndpoint();
@@ -1479,6 +1759,7 @@ void ApiListener::ReplayLog(const JsonRpcConnection::Ptr& client)
 		std::vector<int> files;
 		Utility::Glob(GetApiDir() + "log/*", [&files](const String& file) { LogGlobHandler(files, file); }, GlobFile);
 		std::sort(files.begin(), files.end());
+		files.erase(std::unique(files.begin(), files.end()), files.end());
 
 		std::vector<std::pair<int, String>> allFiles;
 
@@ -1494,8 +1775,28 @@ void ApiListener::ReplayLog(const JsonRpcConnection::Ptr& client)
 			Log(LogNotice, "ApiListener")
 				<< "Replaying log: " << file.second;
 
-			auto *fp = new std::fstream(file.second.CStr(), std::fstream::in | std::fstream::binary);
-			StdioStream::Ptr logStream = new StdioStream(fp, true);
+			bool compressed = false;
+			GzipFileStream::Ptr logStream;
+
+			try {
+				/* Rotated files get compressed meanwhile, their indexes refer to the uncompressed data. */
+				try {
+					logStream = new GzipFileStream(file.second, "rb");
+				} catch (const std::exception&) {
+					logStream = new GzipFileStream(file.second + ".gz", "rb");
+					compressed = true;
+				}
+
+				auto offset (GetReplayLogOffset(file.second, peer_ts));
+
+				/* The index may be ahead of an incompletely written log file. */
+				if (offset && (compressed || GetFileSize(file.second) >= offset))
+					logStream->Seek(offset);
+			} catch (const std::exception& ex) {
+				Log(LogWarning, "ApiListener")
+					<< "Cannot replay log file '" << file.second << "': " << DiagnosticInformation(ex, false);
+				continue;
+			}
 
 			String message;
 			StreamReadContext src;
@@ -1535,6 +1836,11 @@ void ApiListener::ReplayLog(const JsonRpcConnection::Ptr& client)
 						continue;
 				}
 
+				/* The final pass holds m_LogLock, blocking it would stall relaying messages to everyone else. */
+				if (!lock.owns_lock()) {
+					client->WaitForSendCredit();
+				}
+
 				try  {
 					client->SendRawMessage(pmessage->Get("message"));
 					count++;
@@ -1608,6 +1914,52 @@ void ApiListener::StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& per
 	status->Set("api", stats.first);
 }
 
+void ApiListener::MetricsFunc(MetricsWriter& writer)
+{
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (!listener)
+		return;
+
+	size_t endpoints = 0;
+	size_t connectedEndpoints = 0;
+
+	for (const Endpoint::Ptr& endpoint : ConfigType::GetObjectsByType<Endpoint>()) {
+		if (endpoint->GetName() == listener->GetIdentity())
+			continue;
+
+		endpoints++;
+
+		if (endpoint->GetConnected())
+			connectedEndpoints++;
+	}
+
+	writer.AddGauge("icinga_api_endpoints", "Endpoints other than the local one", endpoints);
+	writer.AddGauge("icinga_api_connected_endpoints", "Endpoints with a cluster connection", connectedEndpoints);
+	writer.AddGauge("icinga_api_anonymous_clients", "Cluster connections of clients without an Endpoint object", listener->GetAnonymousClients().size());
+	writer.AddGauge("icinga_api_http_clients", "HTTP API connections", listener->GetHttpClients().size());
+	writer.AddGauge("icinga_api_sync_queue_items", "Cluster config sync tasks waiting to be processed", listener->m_SyncQueue.GetLength());
+	writer.AddGauge("icinga_api_relay_queue_items", "Cluster messages waiting to be relayed", listener->m_RelayQueue.GetLength());
+	writer.AddCounter("icinga_api_events_dropped_total", "Events not delivered to /v1/events subscribers which didn't keep up", EventsInbox::GetTotalDroppedEvents());
+	writer.AddCounter("icinga_api_replay_log_dropped_messages_total", "Replay log messages dropped due to the log_max_size of zones", listener->m_ReplayLogDroppedMessages.load());
+
+	static const char * const cpuBoundPriorities[] = { "low", "normal", "high" };
+	auto cpuBoundStatus (IoEngine::Get().GetCpuBoundWorkStatus());
+
+	for (size_t i = 0; i < cpuBoundStatus.size(); ++i) {
+		auto& cls (cpuBoundStatus[i]);
+		MetricsWriter::Labels labels { { "priority", cpuBoundPriorities[i] } };
+
+		writer.AddCounter("icinga_cpu_bound_work_acquired_total", "CPU-bound work slots taken", cls.Acquired, labels);
+		writer.AddGauge("icinga_cpu_bound_work_in_use", "CPU-bound work slots currently taken", cls.InUse, labels);
+		writer.AddGauge("icinga_cpu_bound_work_waiting", "Coroutines currently waiting for a CPU-bound work slot", cls.Waiting, labels);
+		writer.AddCounter("icinga_cpu_bound_work_wait_seconds_total", "Time spent waiting for CPU-bound work slots", cls.WaitTime, labels);
+	}
+
+	writer.AddGauge("icinga_coroutine_stacks_live", "Coroutine stacks in use", PooledStackAllocator::GetLiveStacks());
+	writer.AddGauge("icinga_coroutine_stacks_pooled", "Coroutine stacks kept for reuse", PooledStackAllocator::GetPooledStacks());
+}
+
 std::pair<Dictionary::Ptr, Dictionary::Ptr> ApiListener::GetStatus()
 {
 	Dictionary::Ptr perfdata = new Dictionary();
@@ -1685,6 +2037,47 @@ std::pair<Dictionary::Ptr, Dictionary::Ptr> ApiListener::GetStatus()
 	double workQueueItemRate = JsonRpcConnection::GetWorkQueueRate();
 	double syncQueueItemRate = m_SyncQueue.GetTaskCount(60) / 60.0;
 	double relayQueueItemRate = m_RelayQueue.GetTaskCount(60) / 60.0;
+	double messagesPerWrite = JsonRpcConnection::GetMessagesPerWrite();
+	double bytesPerWrite = JsonRpcConnection::GetBytesPerWrite();
+	double eventsDropped = EventsInbox::GetTotalDroppedEvents();
+	double eventsEncodesPerEvent = EventsFilter::GetEncodesPerEvent();
+	double replayLogDroppedMessages = m_ReplayLogDroppedMessages.load();
+
+	/* I/O engine shard stats (sharded mode only) */
+	ArrayData ioShards;
+	double ioShardsMaxLatency = 0;
+
+	for (auto& shard : IoEngine::Get().GetShardStatus()) {
+		ioShards.emplace_back(new Dictionary({
+			{ "assigned", shard.Assigned },
+			{ "latency", shard.Latency }
+		}));
+
+		if (shard.Latency > ioShardsMaxLatency)
+			ioShardsMaxLatency = shard.Latency;
+	}
+
+	size_t liveStacks = PooledStackAllocator::GetLiveStacks();
+	size_t pooledStacks = PooledStackAllocator::GetPooledStacks();
+
+	/* CPU-bound work slot usage per priority class */
+	Dictionary::Ptr cpuBoundWork = new Dictionary();
+	auto cpuBoundStatus (IoEngine::Get().GetCpuBoundWorkStatus());
+
+	static const char * const cpuBoundPriorities[] = { "low", "normal", "high" };
+
+	for (size_t i = 0; i < cpuBoundStatus.size(); ++i) {
+		auto& cls (cpuBoundStatus[i]);
+
+		cpuBoundWork->Set(cpuBoundPriorities[i], new Dictionary({
+			{ "acquired", cls.Acquired },
+			{ "in_use", cls.InUse },
+			{ "waiting", cls.Waiting },
+			{ "wait_time", cls.WaitTime }
+		}));
+
+		perfdata->Set(String("cpu_bound_work_") + cpuBoundPriorities[i] + "_waiting", cls.Waiting);
+	}
 
 	Dictionary::Ptr status = new Dictionary({
 		{ "identity", GetIdentity() },
@@ -1695,6 +2088,7 @@ std::pair<Dictionary::Ptr, Dictionary::Ptr> ApiListener::GetStatus()
 		{ "not_conn_endpoints", allNotConnectedEndpoints },
 
 		{ "zones", connectedZones },
+		{ "runtime_objects_sync", GetRuntimeObjectsSyncProgress() },
 
 		{ "json_rpc", new Dictionary({
 			{ "anonymous_clients", jsonRpcAnonymousClients },
@@ -1702,11 +2096,24 @@ std::pair<Dictionary::Ptr, Dictionary::Ptr> ApiListener::GetStatus()
 			{ "relay_queue_items", relayQueueItems },
 			{ "work_queue_item_rate", workQueueItemRate },
 			{ "sync_queue_item_rate", syncQueueItemRate },
-			{ "relay_queue_item_rate", relayQueueItemRate }
+			{ "relay_queue_item_rate", relayQueueItemRate },
+			{ "messages_per_write", messagesPerWrite },
+			{ "bytes_per_write", bytesPerWrite },
+			{ "replay_log_dropped_messages", replayLogDroppedMessages }
 		}) },
 
 		{ "http", new Dictionary({
-			{ "clients", httpClients }
+			{ "clients", httpClients },
+			{ "events_dropped", eventsDropped },
+			{ "events_encodes_per_event", eventsEncodesPerEvent }
+		}) },
+
+		{ "io_shards", new Array(std::move(ioShards)) },
+		{ "cpu_bound_work", cpuBoundWork },
+
+		{ "coroutine_stacks", new Dictionary({
+			{ "live", liveStacks },
+			{ "pooled", pooledStacks }
 		}) }
 	});
 
@@ -1717,12 +2124,21 @@ std::pair<Dictionary::Ptr, Dictionary::Ptr> ApiListener::GetStatus()
 
 	perfdata->Set("num_json_rpc_anonymous_clients", jsonRpcAnonymousClients);
 	perfdata->Set("num_http_clients", httpClients);
+	perfdata->Set("num_http_events_dropped", eventsDropped);
+	perfdata->Set("num_http_events_encodes_per_event", eventsEncodesPerEvent);
 	perfdata->Set("num_json_rpc_sync_queue_items", syncQueueItems);
 	perfdata->Set("num_json_rpc_relay_queue_items", relayQueueItems);
 
 	perfdata->Set("num_json_rpc_work_queue_item_rate", workQueueItemRate);
 	perfdata->Set("num_json_rpc_sync_queue_item_rate", syncQueueItemRate);
 	perfdata->Set("num_json_rpc_relay_queue_item_rate", relayQueueItemRate);
+	perfdata->Set("num_json_rpc_messages_per_write", messagesPerWrite);
+	perfdata->Set("num_json_rpc_bytes_per_write", bytesPerWrite);
+	perfdata->Set("num_json_rpc_replay_log_dropped_messages", replayLogDroppedMessages);
+
+	perfdata->Set("io_shards_max_latency", ioShardsMaxLatency);
+	perfdata->Set("num_coroutine_stacks_live", liveStacks);
+	perfdata->Set("num_coroutine_stacks_pooled", pooledStacks);
 
 	return std::make_pair(status, perfdata);
 }
@@ -1796,8 +2212,31 @@ Value ApiListener::HelloAPIHandler(const MessageOrigin::Ptr& origin, const Dicti
 				unsigned long nodeVersion = params->Get("version");
 
 				endpoint->SetIcingaVersion(nodeVersion);
+
+				auto previousCapabilities (endpoint->GetCapabilities());
 				endpoint->SetCapabilities((double)params->Get("capabilities"));
 
+				/* The peer decodes both encodings, so already queued JSON messages and the replay log stay valid. */
+				client->SetBinaryMessages(endpoint->GetCapabilities() & (uint_fast64_t)ApiCapabilities::BinaryJsonRpc);
+
+				{
+					auto listener (ApiListener::GetInstance());
+
+					if (listener && listener->GetCompressionLevel() > 0
+						&& (endpoint->GetCapabilities() & (uint_fast64_t)ApiCapabilities::DeflateJsonRpc)) {
+						client->EnableCompression(listener->GetCompressionLevel());
+					}
+
+					/* SyncClient() may have sent 'config::UpdateManifest' based on the capabilities of the
+					 * previous connection. A downgraded peer doesn't know it, so send the full config instead.
+					 */
+					if (listener && (previousCapabilities & ~endpoint->GetCapabilities() & (uint_fast64_t)ApiCapabilities::IncrementalConfigSync)) {
+						Utility::QueueAsyncCallback([listener, client]() {
+							listener->SendConfigUpdate(client);
+						});
+					}
+				}
+
 				if (nodeVersion == 0u) {
 					nodeVersion = 21200;
 				}
@@ -1928,6 +2367,22 @@ void ApiListener::ValidateTlsHandshakeTimeout(const Lazy<double>& lvalue, const
 		BOOST_THROW_EXCEPTION(ValidationError(this, { "tls_handshake_timeout" }, "Value must be greater than 0."));
 }
 
+void ApiListener::ValidateCompressionLevel(const Lazy<int>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<ApiListener>::ValidateCompressionLevel(lvalue, utils);
+
+	if (lvalue() < 0 || lvalue() > 9)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "compression_level" }, "Value must be between 0 and 9."));
+}
+
+void ApiListener::ValidateCheckResultBatchWindow(const Lazy<double>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<ApiListener>::ValidateCheckResultBatchWindow(lvalue, utils);
+
+	if (lvalue() < 0)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "check_result_batch_window" }, "Value must not be negative."));
+}
+
 bool ApiListener::IsHACluster()
 {
 	Zone::Ptr zone = Zone::GetLocalZone();
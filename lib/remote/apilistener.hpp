@@ -16,6 +16,7 @@
 #include "base/tcpsocket.hpp"
 #include "base/tlsstream.hpp"
 #include "base/threadpool.hpp"
+#include "base/metrics.hpp"
 #include <atomic>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
@@ -69,6 +70,14 @@ enum class ApiCapabilities : uint_fast64_t
 {
 	ExecuteArbitraryCommand = 1u << 0u,
 	IfwApiCheckCommand = 1u << 1u,
+	NativeNetCheckCommands = 1u << 2u,
+	BinaryJsonRpc = 1u << 3u,
+	DeflateJsonRpc = 1u << 4u,
+	IncrementalConfigSync = 1u << 5u,
+	RendezvousAuthority = 1u << 6u,
+	BatchedNextChecks = 1u << 7u,
+	BatchedExecuteCommands = 1u << 8u,
+	BatchedConfigUpdates = 1u << 9u,
 };
 
 /**
@@ -81,6 +90,7 @@ public:
 	DECLARE_OBJECTNAME(ApiListener);
 
 	static boost::signals2::signal<void(bool)> OnMasterChanged;
+	static boost::signals2::signal<void()> OnStopping;
 
 	ApiListener();
 
@@ -102,9 +112,11 @@ public:
 	Endpoint::Ptr GetLocalEndpoint() const;
 
 	void SyncSendMessage(const Endpoint::Ptr& endpoint, const Dictionary::Ptr& message);
+	void SyncSendMessage(const Endpoint::Ptr& endpoint, const SharedMessage::Ptr& message);
 	void RelayMessage(const MessageOrigin::Ptr& origin, const ConfigObject::Ptr& secobj, const Dictionary::Ptr& message, bool log);
 
 	static void StatsFunc(const Dictionary::Ptr& status, const Array::Ptr& perfdata);
+	static void MetricsFunc(MetricsWriter& writer);
 	std::pair<Dictionary::Ptr, Dictionary::Ptr> GetStatus();
 
 	bool AddAnonymousClient(const JsonRpcConnection::Ptr& aclient);
@@ -120,10 +132,15 @@ public:
 	/* filesync */
 	static Value ConfigUpdateHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 	void HandleConfigUpdate(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
+	static Value ConfigUpdateManifestHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
+	void HandleConfigUpdateManifest(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
+	static Value ConfigRequestFilesHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 
 	/* configsync */
 	static void ConfigUpdateObjectHandler(const ConfigObject::Ptr& object, const Value& cookie);
+	static void ConfigUpdateObjectsHandler(const std::vector<ConfigObject::Ptr>& objects, const Value& cookie);
 	static Value ConfigUpdateObjectAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
+	static Value ConfigUpdateObjectsAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 	static Value ConfigDeleteObjectAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 
 	/* API config packages */
@@ -134,6 +151,9 @@ public:
 	static Value HelloAPIHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 
 	static void UpdateObjectAuthority();
+	void UpdateLocalZoneDirs();
+	static Endpoint::Ptr GetAuthorityEndpoint(const String& objectName, const std::vector<Endpoint::Ptr>& endpoints);
+	static double GetAuthorityScore(const String& objectName, const String& endpointName, double weight);
 
 	static bool IsHACluster();
 	static String GetFromZoneName(const Zone::Ptr& fromZone);
@@ -159,6 +179,8 @@ protected:
 
 	void ValidateTlsProtocolmin(const Lazy<String>& lvalue, const ValidationUtils& utils) override;
 	void ValidateTlsHandshakeTimeout(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
+	void ValidateCompressionLevel(const Lazy<int>& lvalue, const ValidationUtils& utils) override;
+	void ValidateCheckResultBatchWindow(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
 
 private:
 	Shared<boost::asio::ssl::context>::Ptr m_SSLContext;
@@ -205,16 +227,22 @@ private:
 	std::mutex m_LogLock;
 	Stream::Ptr m_LogFile;
 	size_t m_LogMessageCount{0};
+	Stream::Ptr m_LogIndexFile;
+	uint_fast64_t m_LogFileSize{0};
+	uint_fast64_t m_LogFileIndexedSize{0};
+	double m_LogFileMaxTimestamp{0};
+	std::atomic<uint_fast64_t> m_ReplayLogDroppedMessages{0};
 
-	bool RelayMessageOne(const Zone::Ptr& zone, const MessageOrigin::Ptr& origin, const Dictionary::Ptr& message, const Endpoint::Ptr& currentZoneMaster);
+	bool RelayMessageOne(const Zone::Ptr& zone, const MessageOrigin::Ptr& origin, const SharedMessage::Ptr& message, const Endpoint::Ptr& currentZoneMaster);
 	void SyncRelayMessage(const MessageOrigin::Ptr& origin, const ConfigObject::Ptr& secobj, const Dictionary::Ptr& message, bool log);
-	void PersistMessage(const Dictionary::Ptr& message, const ConfigObject::Ptr& secobj);
+	void PersistMessage(const SharedMessage::Ptr& message, const ConfigObject::Ptr& secobj);
 
 	void OpenLogFile();
 	void RotateLogFile();
 	void CloseLogFile();
 	static void LogGlobHandler(std::vector<int>& files, const String& file);
 	void ReplayLog(const JsonRpcConnection::Ptr& client);
+	static uint_fast64_t GetReplayLogOffset(const String& path, double peerTimestamp);
 
 	static void CopyCertificateFile(const String& oldCertPath, const String& newCertPath);
 
@@ -229,7 +257,7 @@ private:
 	void RenewOwnCert();
 	void RenewCA();
 
-	void SendConfigUpdate(const JsonRpcConnection::Ptr& aclient);
+	void SendConfigUpdate(const JsonRpcConnection::Ptr& aclient, const Dictionary::Ptr& peerChecksums = nullptr);
 
 	static Dictionary::Ptr MergeConfigUpdate(const ConfigDirInformation& config);
 
@@ -247,9 +275,18 @@ private:
 	/* configsync */
 	void UpdateConfigObject(const ConfigObject::Ptr& object, const MessageOrigin::Ptr& origin,
 		const JsonRpcConnection::Ptr& client = nullptr);
+	void UpdateConfigObjects(const std::vector<ConfigObject::Ptr>& objects, const MessageOrigin::Ptr& origin);
 	void DeleteConfigObject(const ConfigObject::Ptr& object, const MessageOrigin::Ptr& origin,
 		const JsonRpcConnection::Ptr& client = nullptr);
 	void SendRuntimeConfigObjects(const JsonRpcConnection::Ptr& aclient);
+	static Dictionary::Ptr MakeConfigUpdateObjectMessage(const ConfigObject::Ptr& object);
+
+	mutable std::mutex m_RuntimeObjectsSyncProgressLock;
+	std::map<String, std::pair<size_t, size_t>> m_RuntimeObjectsSyncProgress;
+
+	void SetRuntimeObjectsSyncProgress(const String& endpoint, size_t sent, size_t total);
+	void ClearRuntimeObjectsSyncProgress(const String& endpoint);
+	Dictionary::Ptr GetRuntimeObjectsSyncProgress();
 
 	void SyncClient(const JsonRpcConnection::Ptr& aclient, const Endpoint::Ptr& endpoint, bool needSync);
 
@@ -4,6 +4,7 @@
 #include "remote/apiuser-ti.cpp"
 #include "base/configtype.hpp"
 #include "base/base64.hpp"
+#include "base/initialize.hpp"
 #include "base/tlsutility.hpp"
 #include "base/utility.hpp"
 
@@ -11,6 +12,15 @@ using namespace icinga;
 
 REGISTER_TYPE(ApiUser);
 
+/* Upper bound for the number of distinct permissions cached per user. */
+static const std::size_t l_MaxCachedPermissions = 1024;
+
+INITIALIZE_ONCE([]() {
+	ApiUser::OnPermissionsChanged.connect([](const ApiUser::Ptr& user, const Value&) {
+		user->ClearPermissionCache();
+	});
+});
+
 ApiUser::Ptr ApiUser::GetByClientCN(const String& cn)
 {
 	for (const ApiUser::Ptr& user : ConfigType::GetObjectsByType<ApiUser>()) {
@@ -52,3 +62,39 @@ ApiUser::Ptr ApiUser::GetByAuthHeader(const String& auth_header)
 
 	return user;
 }
+
+/**
+ * Looks up the result of a previous FilterUtility::HasPermission() for the given (lower case) permission.
+ *
+ * @returns Whether the permission was cached.
+ */
+bool ApiUser::GetCachedPermission(const String& permission, ApiUserPermission& result) const
+{
+	std::unique_lock<std::mutex> lock (m_PermissionCacheMutex);
+	auto it (m_PermissionCache.find(permission));
+
+	if (it == m_PermissionCache.end())
+		return false;
+
+	result = it->second;
+	return true;
+}
+
+void ApiUser::CachePermission(const String& permission, const ApiUserPermission& result) const
+{
+	std::unique_lock<std::mutex> lock (m_PermissionCacheMutex);
+
+	if (m_PermissionCache.size() >= l_MaxCachedPermissions)
+		m_PermissionCache.clear();
+
+	m_PermissionCache[permission] = result;
+}
+
+/**
+ * Drops all cached permissions, e.g. because the permissions have been changed.
+ */
+void ApiUser::ClearPermissionCache()
+{
+	std::unique_lock<std::mutex> lock (m_PermissionCacheMutex);
+	m_PermissionCache.clear();
+}
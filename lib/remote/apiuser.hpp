@@ -5,10 +5,24 @@
 
 #include "remote/i2-remote.hpp"
 #include "remote/apiuser-ti.hpp"
+#include "config/expression.hpp"
+#include <mutex>
+#include <unordered_map>
 
 namespace icinga
 {
 
+/**
+ * Result of matching a required permission against an ApiUser's permissions.
+ *
+ * @ingroup remote
+ */
+struct ApiUserPermission
+{
+	bool Found{false};
+	Expression::Ptr Filter; /* nullptr if the permission isn't restricted by filters */
+};
+
 /**
  * @ingroup remote
  */
@@ -20,6 +34,14 @@ public:
 
 	static ApiUser::Ptr GetByClientCN(const String& cn);
 	static ApiUser::Ptr GetByAuthHeader(const String& auth_header);
+
+	bool GetCachedPermission(const String& permission, ApiUserPermission& result) const;
+	void CachePermission(const String& permission, const ApiUserPermission& result) const;
+	void ClearPermissionCache();
+
+private:
+	mutable std::mutex m_PermissionCacheMutex;
+	mutable std::unordered_map<String, ApiUserPermission> m_PermissionCache;
 };
 
 }
@@ -0,0 +1,624 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "remote/bulkobjectshandler.hpp"
+#include "remote/configobjectslock.hpp"
+#include "remote/configobjectutility.hpp"
+#include "remote/httputility.hpp"
+#include "remote/filterutility.hpp"
+#include "remote/zone.hpp"
+#include "base/configtype.hpp"
+#include "base/dependencygraph.hpp"
+#include "base/exception.hpp"
+#include "base/json.hpp"
+#include "base/logger.hpp"
+#include "config/vmops.hpp"
+#include <boost/algorithm/string/join.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace icinga;
+
+REGISTER_URLHANDLER("/v1/objects/bulk", BulkObjectsHandler);
+
+/**
+ * A validated item of the "create", "update" or "delete" list of a bulk request.
+ */
+struct BulkObjectsItem
+{
+	String Operation;
+	Type::Ptr ObjectType;
+	String Name;
+	ConfigObject::Ptr Object;
+	Dictionary::Ptr Attrs;
+	Array::Ptr RestoreAttrs;
+	bool Cascade{false};
+	Dictionary::Ptr Result;
+
+	/* What an update has to restore if the request is rolled back. */
+	std::vector<std::pair<int, Value>> OldFields;
+	Dictionary::Ptr OldOriginalAttributes;
+	bool Applied{false};
+};
+
+/**
+ * An object removed by a delete of a bulk request, recorded to create it again on rollback.
+ */
+struct BulkDeletedObject
+{
+	NewConfigObject Config;
+	Dictionary::Ptr ModifiedAttributes;
+};
+
+static Array::Ptr GetBulkList(const Dictionary::Ptr& params, const String& operation)
+{
+	Value list = params->Get(operation);
+
+	if (list.IsEmpty())
+		return new Array();
+
+	if (!list.IsObjectType<Array>())
+		BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid type for '" + operation + "' specified. Array type is required."));
+
+	return list;
+}
+
+/**
+ * Validates one item of the given operation's list and resolves its type and (unless it's created) object.
+ *
+ * @returns Whether the item is valid. If not, its result contains the reason.
+ */
+static bool ValidateBulkItem(const ApiUser::Ptr& user, const Value& value, BulkObjectsItem& item, std::vector<NewConfigObject>& newObjects)
+{
+	item.Result = new Dictionary({ { "operation", item.Operation } });
+
+	auto fail ([&item](int code, const String& status) {
+		item.Result->Set("code", code);
+		item.Result->Set("status", status);
+		return false;
+	});
+
+	if (!value.IsObjectType<Dictionary>())
+		return fail(400, "Item must be a dictionary.");
+
+	Dictionary::Ptr params = value;
+	String typeName = params->Get("type");
+	item.Name = params->Get("name");
+
+	item.Result->Set("type", typeName);
+	item.Result->Set("name", item.Name);
+
+	item.ObjectType = Type::GetByName(typeName);
+
+	if (!item.ObjectType || !ConfigObject::TypeInstance->IsAssignableFrom(item.ObjectType) || !dynamic_cast<ConfigType*>(item.ObjectType.get()))
+		return fail(400, "Invalid type specified.");
+
+	if (item.Name.IsEmpty())
+		return fail(400, "Missing object name.");
+
+	Value attrsVal = params->Get("attrs");
+
+	if (!attrsVal.IsEmpty() && !attrsVal.IsObjectType<Dictionary>())
+		return fail(400, "Invalid type for 'attrs' attribute specified. Dictionary type is required.");
+
+	item.Attrs = static_cast<Dictionary::Ptr>(attrsVal);
+
+	if (item.Operation == "create") {
+		FilterUtility::CheckPermission(user, "objects/create/" + item.ObjectType->GetName());
+
+		Dictionary::Ptr attrs = item.Attrs ? item.Attrs->ShallowClone() : new Dictionary();
+
+		/* Put created objects into the local zone if not explicitly defined. See CreateObjectHandler. */
+		Zone::Ptr localZone = Zone::GetLocalZone();
+
+		if (localZone && !attrs->Contains("zone"))
+			attrs->Set("zone", localZone->GetName());
+
+		/* Sanity checks for unique groups array. */
+		if (attrs->Contains("groups")) {
+			Array::Ptr groups = attrs->Get("groups");
+
+			if (groups)
+				attrs->Set("groups", groups->Unique());
+		}
+
+		try {
+			newObjects.emplace_back(NewConfigObject{ item.ObjectType, item.Name, ConfigObjectUtility::CreateObjectConfig(item.ObjectType,
+				item.Name, params->Get("ignore_on_error"), params->Get("templates"), attrs) });
+		} catch (const std::exception& ex) {
+			item.Result->Set("errors", new Array({ DiagnosticInformation(ex, false) }));
+			return fail(500, "Object could not be created.");
+		}
+
+		return true;
+	}
+
+	QueryDescription qd;
+	qd.Types.insert(item.ObjectType->GetName());
+	qd.Permission = "objects/" + String(item.Operation == "update" ? "modify" : "delete") + "/" + item.ObjectType->GetName();
+
+	Dictionary::Ptr query = new Dictionary({
+		{ "type", item.ObjectType->GetName() },
+		{ item.ObjectType->GetName().ToLower(), item.Name }
+	});
+
+	try {
+		std::vector<Value> objs = FilterUtility::GetFilterTargets(qd, query, user);
+
+		if (objs.size() != 1u)
+			return fail(404, "No objects found.");
+
+		item.Object = static_cast<ConfigObject::Ptr>(objs[0]);
+	} catch (const std::exception&) {
+		return fail(404, "No objects found.");
+	}
+
+	if (item.Operation == "update") {
+		Value restoreAttrsVal = params->Get("restore_attrs");
+
+		if (!restoreAttrsVal.IsEmpty() && !restoreAttrsVal.IsObjectType<Array>())
+			return fail(400, "Invalid type for 'restore_attrs' attribute specified. Array type is required.");
+
+		item.RestoreAttrs = static_cast<Array::Ptr>(restoreAttrsVal);
+
+		if (!(item.Attrs || item.RestoreAttrs))
+			return fail(400, "Missing both 'attrs' and 'restore_attrs'.");
+	} else {
+		item.Cascade = params->Get("cascade");
+
+		if (item.Object->GetPackage() != "_api")
+			return fail(400, "Object cannot be deleted because it was not created using the API.");
+	}
+
+	return true;
+}
+
+/**
+ * Remembers the fields an update is going to touch, so that RevertBulkUpdate() can restore them.
+ * The field values don't have to be cloned as ModifyAttribute() and RestoreAttribute() replace them.
+ */
+static void RecordBulkUpdate(BulkObjectsItem& item)
+{
+	Type::Ptr type = item.Object->GetReflectionType();
+	std::set<int> fids;
+
+	auto record ([&item, &type, &fids](const String& attr) {
+		int fid = type->GetFieldId(attr.SubStr(0, attr.FindFirstOf(".")));
+
+		if (fid >= 0 && fids.emplace(fid).second)
+			item.OldFields.emplace_back(fid, item.Object->GetField(fid));
+	});
+
+	if (item.RestoreAttrs) {
+		ObjectLock oLock (item.RestoreAttrs);
+
+		for (const String& attr : item.RestoreAttrs) {
+			record(attr);
+		}
+	}
+
+	if (item.Attrs) {
+		ObjectLock olock (item.Attrs);
+
+		for (const Dictionary::Pair& kv : item.Attrs) {
+			record(kv.first);
+		}
+	}
+
+	Dictionary::Ptr originalAttributes = item.Object->GetOriginalAttributes();
+
+	if (originalAttributes)
+		item.OldOriginalAttributes = originalAttributes->ShallowClone();
+}
+
+static void UpdateBulkObject(BulkObjectsItem& item, bool verbose)
+{
+	String key;
+
+	RecordBulkUpdate(item);
+	item.Applied = true;
+
+	try {
+		if (item.RestoreAttrs) {
+			ObjectLock oLock (item.RestoreAttrs);
+
+			for (auto& attr : item.RestoreAttrs) {
+				key = attr;
+				item.Object->RestoreAttribute(key);
+			}
+		}
+
+		if (item.Attrs) {
+			ObjectLock olock (item.Attrs);
+
+			for (const Dictionary::Pair& kv : item.Attrs) {
+				key = kv.first;
+				item.Object->ModifyAttribute(kv.first, kv.second);
+			}
+		}
+	} catch (const std::exception& ex) {
+		item.Result->Set("code", 500);
+		item.Result->Set("status", "Attribute '" + key + "' could not be set: " + DiagnosticInformation(ex, false));
+
+		if (verbose)
+			item.Result->Set("diagnostic_information", DiagnosticInformation(ex));
+
+		return;
+	}
+
+	item.Result->Set("code", 200);
+	item.Result->Set("status", "Attributes updated.");
+}
+
+/**
+ * Restores the fields of an object (and which of them count as modified) as they were before its update.
+ * The version is bumped nevertheless, so that the cluster takes over the restored values, too.
+ */
+static void RevertBulkUpdate(const BulkObjectsItem& item)
+{
+	Type::Ptr type = item.Object->GetReflectionType();
+
+	for (auto& field : item.OldFields) {
+		item.Object->ModifyAttribute(type->GetFieldInfo(field.first).Name, field.second);
+	}
+
+	item.Object->SetOriginalAttributes(item.OldOriginalAttributes);
+}
+
+/**
+ * Collects the configs of the objects the given delete is going to remove, incl. the ones depending on them,
+ * so that they can be created again if the request is rolled back.
+ */
+static void RecordBulkDelete(const ConfigObject::Ptr& object, bool cascade, std::set<ConfigObject*>& seen,
+	std::vector<BulkDeletedObject>& deleted)
+{
+	if (!seen.emplace(object.get()).second)
+		return;
+
+	if (cascade) {
+		for (const Object::Ptr& pobj : DependencyGraph::GetParents(object)) {
+			ConfigObject::Ptr parentObj = dynamic_pointer_cast<ConfigObject>(pobj);
+
+			if (parentObj)
+				RecordBulkDelete(parentObj, cascade, seen, deleted);
+		}
+	}
+
+	/* Other objects are either created again by apply rules or can't be deleted. */
+	if (object->GetPackage() != "_api")
+		return;
+
+	std::ifstream fp (ConfigObjectUtility::GetExistingObjectConfigPath(object).CStr(), std::ifstream::binary);
+
+	if (!fp)
+		BOOST_THROW_EXCEPTION(std::runtime_error("Config file of object '" + object->GetName() + "' is not readable."));
+
+	Dictionary::Ptr modifiedAttributes = new Dictionary();
+	Dictionary::Ptr originalAttributes = object->GetOriginalAttributes();
+
+	/* See ApiListener::MakeConfigUpdateObjectMessage(). */
+	if (originalAttributes) {
+		ObjectLock olock (originalAttributes);
+
+		for (const Dictionary::Pair& kv : originalAttributes) {
+			Value value = object;
+
+			for (const String& token : kv.first.Split(".")) {
+				value = VMOps::GetField(value, token);
+			}
+
+			modifiedAttributes->Set(kv.first, value);
+		}
+	}
+
+	deleted.emplace_back(BulkDeletedObject{
+		NewConfigObject{ object->GetReflectionType(), object->GetName(),
+			String((std::istreambuf_iterator<char>(fp)), std::istreambuf_iterator<char>()) },
+		modifiedAttributes
+	});
+}
+
+static void DeleteBulkObject(BulkObjectsItem& item, bool verbose)
+{
+	Array::Ptr errors = new Array();
+	Array::Ptr diagnosticInformation = new Array();
+
+	item.Applied = true;
+
+	/* Already deleted by a previous cascading delete of this request. */
+	if (item.Object->GetExtension("ConfigObjectDeleted")) {
+		item.Result->Set("code", 200);
+		item.Result->Set("status", "Object was deleted.");
+		return;
+	}
+
+	if (ConfigObjectUtility::DeleteObject(item.Object, item.Cascade, errors, diagnosticInformation)) {
+		item.Result->Set("code", 200);
+		item.Result->Set("status", "Object was deleted.");
+	} else {
+		item.Result->Set("code", 500);
+		item.Result->Set("status", "Object could not be deleted.");
+	}
+
+	item.Result->Set("errors", errors);
+
+	if (verbose)
+		item.Result->Set("diagnostic_information", diagnosticInformation);
+}
+
+/**
+ * Undoes everything a bulk request has done so far: Creates the deleted objects again, reverts the updates
+ * and deletes the created objects.
+ *
+ * @exception runtime_error Not everything could be undone. Nevertheless, as much as possible was.
+ */
+static void RollbackBulkObjects(const std::vector<BulkObjectsItem>& items, const std::vector<BulkDeletedObject>& deleted)
+{
+	std::vector<String> failures;
+	std::vector<NewConfigObject> missing;
+	std::vector<const BulkDeletedObject*> restore;
+
+	for (auto& object : deleted) {
+		if (!dynamic_cast<ConfigType*>(object.Config.ObjectType.get())->GetObject(object.Config.Name)) {
+			missing.emplace_back(object.Config);
+			restore.emplace_back(&object);
+		}
+	}
+
+	if (!missing.empty()) {
+		Array::Ptr errors = new Array();
+
+		if (ConfigObjectUtility::CreateObjects(missing, errors, nullptr)) {
+			for (auto object : restore) {
+				ConfigObject::Ptr restored = dynamic_cast<ConfigType*>(object->Config.ObjectType.get())->GetObject(object->Config.Name);
+
+				if (!restored)
+					continue;
+
+				ObjectLock olock (object->ModifiedAttributes);
+
+				for (const Dictionary::Pair& kv : object->ModifiedAttributes) {
+					try {
+						restored->ModifyAttribute(kv.first, kv.second);
+					} catch (const std::exception& ex) {
+						failures.emplace_back("Attribute '" + kv.first + "' of object '" + object->Config.Name
+							+ "' could not be restored: " + DiagnosticInformation(ex, false));
+					}
+				}
+			}
+		} else {
+			failures.emplace_back("Deleted objects could not be created again: " + JsonEncode(errors));
+		}
+	}
+
+	for (auto item (items.rbegin()); item != items.rend(); ++item) {
+		if (item->Operation != "update" || !item->Applied || !item->Object->IsActive())
+			continue;
+
+		try {
+			RevertBulkUpdate(*item);
+		} catch (const std::exception& ex) {
+			failures.emplace_back("Object '" + item->Name + "' could not be restored: " + DiagnosticInformation(ex, false));
+		}
+	}
+
+	std::vector<ConfigObject::Ptr> created;
+
+	for (auto& item : items) {
+		if (item.Operation != "create")
+			continue;
+
+		ConfigObject::Ptr object = dynamic_cast<ConfigType*>(item.ObjectType.get())->GetObject(item.Name);
+
+		if (object)
+			created.emplace_back(std::move(object));
+	}
+
+	/* Don't cascade, that could delete objects which existed before. Instead delete the dependent ones first. */
+	for (;;) {
+		auto remaining (created.size());
+
+		created.erase(std::remove_if(created.begin(), created.end(), [](const ConfigObject::Ptr& object) {
+			return DependencyGraph::GetParents(object).empty() && ConfigObjectUtility::DeleteObject(object, false, nullptr, nullptr);
+		}), created.end());
+
+		if (created.empty() || created.size() == remaining)
+			break;
+	}
+
+	for (auto& object : created) {
+		failures.emplace_back("Created object '" + object->GetName() + "' could not be deleted again.");
+	}
+
+	if (!failures.empty())
+		BOOST_THROW_EXCEPTION(std::runtime_error(boost::algorithm::join(failures, " ")));
+}
+
+static void SendBulkResults(boost::beast::http::response<boost::beast::http::string_body>& response,
+	const Dictionary::Ptr& params, const std::vector<BulkObjectsItem>& items, int code)
+{
+	ArrayData results;
+	results.reserve(items.size());
+
+	for (auto& item : items) {
+		results.emplace_back(item.Result);
+	}
+
+	response.result(code);
+
+	HttpUtility::SendJsonBody(response, params, new Dictionary({
+		{ "results", new Array(std::move(results)) }
+	}));
+}
+
+bool BulkObjectsHandler::HandleRequest(
+	AsioTlsStream& stream,
+	const ApiUser::Ptr& user,
+	boost::beast::http::request<boost::beast::http::string_body>& request,
+	const Url::Ptr& url,
+	boost::beast::http::response<boost::beast::http::string_body>& response,
+	const Dictionary::Ptr& params,
+	boost::asio::yield_context& yc,
+	HttpServerConnection& server
+)
+{
+	namespace http = boost::beast::http;
+
+	if (url->GetPath().size() != 3)
+		return false;
+
+	if (request.method() != http::verb::post)
+		return false;
+
+	std::vector<BulkObjectsItem> items;
+	std::vector<NewConfigObject> newObjects;
+	bool valid = true;
+
+	try {
+		for (const String operation : { "create", "update", "delete" }) {
+			Array::Ptr list = GetBulkList(params, operation);
+			ObjectLock olock (list);
+
+			for (const Value& value : list) {
+				items.emplace_back();
+				items.back().Operation = operation;
+
+				if (!ValidateBulkItem(user, value, items.back(), newObjects))
+					valid = false;
+			}
+		}
+	} catch (const std::invalid_argument& ex) {
+		HttpUtility::SendJsonError(response, params, 400, ex.what());
+		return true;
+	}
+
+	/* Don't touch anything unless all items are fine. */
+	if (!valid) {
+		for (auto& item : items) {
+			if (!item.Result->Contains("code")) {
+				item.Result->Set("code", 409);
+				item.Result->Set("status", "Nothing was changed due to other items' errors.");
+			}
+		}
+
+		SendBulkResults(response, params, items, 400);
+		return true;
+	}
+
+	bool verbose = HttpUtility::GetLastParameter(params, "verbose");
+
+	ConfigObjectsSharedLock lock (std::try_to_lock);
+
+	if (!lock) {
+		HttpUtility::SendJsonError(response, params, 503, "Icinga is reloading");
+		return true;
+	}
+
+	/*
+	 * The deletes come last as they're the hardest to undo: Their objects have to be created again
+	 * from the configs recorded here. If anything fails, everything done so far is rolled back.
+	 */
+	std::vector<BulkDeletedObject> deleted;
+
+	try {
+		std::set<ConfigObject*> seen;
+
+		for (auto& item : items) {
+			if (item.Operation == "delete")
+				RecordBulkDelete(item.Object, item.Cascade, seen, deleted);
+		}
+	} catch (const std::exception& ex) {
+		HttpUtility::SendJsonError(response, params, 500, "Nothing was changed.", DiagnosticInformation(ex));
+		return true;
+	}
+
+	if (!newObjects.empty()) {
+		Array::Ptr errors = new Array();
+		Array::Ptr diagnosticInformation = new Array();
+
+		if (!ConfigObjectUtility::CreateObjects(newObjects, errors, diagnosticInformation)) {
+			for (auto& item : items) {
+				if (item.Operation == "create") {
+					item.Result->Set("code", 500);
+					item.Result->Set("status", "Objects could not be created.");
+					item.Result->Set("errors", errors);
+
+					if (verbose)
+						item.Result->Set("diagnostic_information", diagnosticInformation);
+				} else {
+					item.Result->Set("code", 409);
+					item.Result->Set("status", "Nothing was changed as the objects could not be created.");
+				}
+			}
+
+			SendBulkResults(response, params, items, 500);
+			return true;
+		}
+	}
+
+	bool success = true;
+
+	/* The items are ordered by operation, so the deletes are deferred until all updates succeeded. */
+	for (auto& item : items) {
+		if (item.Operation == "create")
+			continue;
+
+		if (item.Operation == "update")
+			UpdateBulkObject(item, verbose);
+		else
+			DeleteBulkObject(item, verbose);
+
+		if (item.Result->Get("code") != 200) {
+			success = false;
+			break;
+		}
+	}
+
+	if (!success) {
+		String rollbackError;
+
+		try {
+			RollbackBulkObjects(items, deleted);
+		} catch (const std::exception& ex) {
+			rollbackError = DiagnosticInformation(ex, false);
+
+			Log(LogCritical, "BulkObjectsHandler")
+				<< "Failed to roll back bulk request: " << rollbackError;
+		}
+
+		for (auto& item : items) {
+			if (item.Result->Contains("code") && item.Result->Get("code") != 200)
+				continue;
+
+			item.Result->Set("code", 409);
+			item.Result->Set("status", rollbackError.IsEmpty()
+				? "Nothing was changed due to other items' errors."
+				: "Rolling back due to other items' errors failed: " + rollbackError);
+		}
+
+		SendBulkResults(response, params, items, 500);
+		return true;
+	}
+
+	for (auto& item : items) {
+		if (item.Operation == "create") {
+			item.Result->Set("code", 200);
+
+			if (dynamic_cast<ConfigType*>(item.ObjectType.get())->GetObject(item.Name))
+				item.Result->Set("status", "Object was created");
+			else
+				item.Result->Set("status", "Object was not created but 'ignore_on_error' was set to true");
+		}
+	}
+
+	Log(LogNotice, "BulkObjectsHandler")
+		<< "Processed " << items.size() << " bulk items (" << newObjects.size() << " created).";
+
+	SendBulkResults(response, params, items, 200);
+
+	return true;
+}
@@ -5,7 +5,9 @@
 #include "remote/apilistener.hpp"
 #include "config/configcompiler.hpp"
 #include "config/configitem.hpp"
+#include "base/configuration.hpp"
 #include "base/configwriter.hpp"
+#include "base/convert.hpp"
 #include "base/exception.hpp"
 #include "base/dependencygraph.hpp"
 #include "base/tlsutility.hpp"
@@ -14,6 +16,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/system/error_code.hpp>
 #include <fstream>
+#include <set>
 #include <utility>
 
 using namespace icinga;
@@ -177,58 +180,166 @@ String ConfigObjectUtility::CreateObjectConfig(const Type::Ptr& type, const Stri
 
 bool ConfigObjectUtility::CreateObject(const Type::Ptr& type, const String& fullName,
 	const String& config, const Array::Ptr& errors, const Array::Ptr& diagnosticInformation, const Value& cookie)
+{
+	return CreateObjects({ NewConfigObject{ type, fullName, config } }, errors, diagnosticInformation, cookie);
+}
+
+/**
+ * Creates all of the given objects in one transaction: Their config files are written into the _api package
+ * and evaluated, and the resulting config items are committed and activated together.
+ * If any of them fails, none of them is created.
+ *
+ * @param objects The objects to create, each with its full name and config as returned by CreateObjectConfig()
+ * @param errors Output buffer for error messages
+ * @param diagnosticInformation Output buffer for detailed error information
+ * @param cookie Origin to forward to the activation in order to prevent sync loops in the same zone
+ *
+ * @return Whether all objects were created (or ignored due to ignore_on_error)
+ */
+bool ConfigObjectUtility::CreateObjects(const std::vector<NewConfigObject>& objects, const Array::Ptr& errors,
+	const Array::Ptr& diagnosticInformation, const Value& cookie)
 {
 	CreateStorage();
 
 	{
-		auto configType (dynamic_cast<ConfigType*>(type.get()));
+		std::set<std::pair<Type*, String>> names;
 
-		if (configType && configType->GetObject(fullName)) {
-			errors->Add("Object '" + fullName + "' already exists.");
-			return false;
+		for (auto& object : objects) {
+			auto configType (dynamic_cast<ConfigType*>(object.ObjectType.get()));
+
+			if ((configType && configType->GetObject(object.Name)) || !names.emplace(object.ObjectType.get(), object.Name).second) {
+				if (errors)
+					errors->Add("Object '" + object.Name + "' already exists.");
+
+				return false;
+			}
 		}
 	}
 
-	String path;
+	std::vector<String> paths;
+	paths.reserve(objects.size());
 
 	try {
-		path = ComputeNewObjectConfigPath(type, fullName);
+		for (auto& object : objects) {
+			paths.emplace_back(ComputeNewObjectConfigPath(object.ObjectType, object.Name));
+		}
 	} catch (const std::exception& ex) {
-		errors->Add("Config package broken: " + DiagnosticInformation(ex, false));
+		if (errors)
+			errors->Add("Config package broken: " + DiagnosticInformation(ex, false));
+
 		return false;
 	}
 
-	Utility::MkDirP(Utility::DirName(path), 0700);
+	std::set<String> dirs;
+
+	for (decltype(paths.size()) i = 0; i < paths.size(); i++) {
+		String dir = Utility::DirName(paths[i]);
 
-	std::ofstream fp(path.CStr(), std::ofstream::out | std::ostream::trunc);
-	fp << config;
-	fp.close();
+		/* Most objects of a batch share the type and thereby the directory. */
+		if (dirs.emplace(dir).second)
+			Utility::MkDirP(dir, 0700);
+
+		std::ofstream fp(paths[i].CStr(), std::ofstream::out | std::ostream::trunc);
+		fp << objects[i].Config;
+		fp.close();
+	}
 
-	std::unique_ptr<Expression> expr = ConfigCompiler::CompileFile(path, String(), "_api");
+	String what = objects.size() == 1u ? "config item '" + objects[0].Name + "'" : Convert::ToString(objects.size()) + " config items";
+	std::vector<ConfigItem::Ptr> newItems;
+
+	/* Let the cluster, Icinga DB etc. handle a batch at once via ConfigObject::OnBatchActivated. */
+	std::vector<ConfigObject::Ptr> batch;
+
+	/*
+	 * Don't leave a part of the objects behind, no matter at which stage the batch failed.
+	 * Objects which can't be deactivated stay, just like their config files, and are synced as usual.
+	 */
+	auto rollback ([&objects, &paths, &newItems, &batch, &cookie]() {
+		std::set<std::pair<String, String>> kept;
+
+		for (auto& item : newItems) {
+			ConfigObject::Ptr object = item->GetObject();
+
+			if (object && object->IsActive()) {
+				/* Only objects which were already synced on their own have to be deleted on the other side, too. */
+				bool synced = object->GetStartCalled() && !object->GetExtension("ConfigObjectBatch");
+
+				if (synced)
+					object->SetExtension("ConfigObjectDeleted", true);
+
+				try {
+					object->Deactivate(true, cookie);
+				} catch (const std::exception& ex) {
+					Log(LogCritical, "ConfigObjectUtility")
+						<< "Failed to deactivate object '" << object->GetName() << "' of type '"
+						<< object->GetReflectionType()->GetName() << "' during rollback: " << DiagnosticInformation(ex, false);
+				}
+
+				if (object->IsActive()) {
+					if (synced)
+						object->ClearExtension("ConfigObjectDeleted");
+
+					kept.emplace(object->GetReflectionType()->GetName(), object->GetName());
+					continue;
+				}
+			}
+
+			item->Unregister();
+		}
+
+		for (decltype(paths.size()) i = 0; i < paths.size(); i++) {
+			if (kept.find({ objects[i].ObjectType->GetName(), objects[i].Name }) == kept.end())
+				Utility::Remove(paths[i]);
+		}
+
+		std::vector<ConfigObject::Ptr> activated;
+
+		for (auto& object : batch) {
+			object->ClearExtension("ConfigObjectBatch");
+
+			if (object->IsActive())
+				activated.emplace_back(object);
+		}
+
+		batch.clear();
+
+		if (!activated.empty())
+			ConfigObject::OnBatchActivated(activated, cookie);
+	});
 
 	try {
+		std::vector<std::unique_ptr<Expression>> exprs;
+		exprs.reserve(paths.size());
+
+		for (auto& path : paths) {
+			exprs.emplace_back(ConfigCompiler::CompileFile(path, String(), "_api"));
+		}
+
 		ActivationScope ascope;
 
 		ScriptFrame frame(true);
-		expr->Evaluate(frame);
-		expr.reset();
 
-		WorkQueue upq;
-		upq.SetName("ConfigObjectUtility::CreateObject");
+		for (auto& expr : exprs) {
+			expr->Evaluate(frame);
+		}
+
+		exprs.clear();
 
-		std::vector<ConfigItem::Ptr> newItems;
+		/* Large batches are worth committing in parallel, like the whole config on startup. */
+		WorkQueue upq (25000, objects.size() > 1u ? Configuration::Concurrency : 1);
+		upq.SetName("ConfigObjectUtility::CreateObjects");
 
 		/*
 		 * Disable logging for object creation, but do so ourselves later on.
 		 * Duplicate the error handling for better logging and debugging here.
 		 */
 		if (!ConfigItem::CommitItems(ascope.GetContext(), upq, newItems, true)) {
-			if (errors) {
-				Log(LogNotice, "ConfigObjectUtility")
-					<< "Failed to commit config item '" << fullName << "'. Aborting and removing config path '" << path << "'.";
+			Log(LogNotice, "ConfigObjectUtility")
+				<< "Failed to commit " << what << ". Aborting and removing their config paths.";
 
-				Utility::Remove(path);
+			rollback();
 
+			if (errors) {
 				for (const boost::exception_ptr& ex : upq.GetExceptions()) {
 					errors->Add(DiagnosticInformation(ex, false));
 
@@ -240,18 +351,31 @@ bool ConfigObjectUtility::CreateObject(const Type::Ptr& type, const String& full
 			return false;
 		}
 
+		if (objects.size() > 1u) {
+			batch.reserve(newItems.size());
+
+			for (auto& item : newItems) {
+				ConfigObject::Ptr object = item->GetObject();
+
+				if (object) {
+					object->SetExtension("ConfigObjectBatch", true);
+					batch.emplace_back(std::move(object));
+				}
+			}
+		}
+
 		/*
-		 * Activate the config object.
+		 * Activate the config objects.
 		 * uq, items, runtimeCreated, silent, withModAttrs, cookie
 		 * IMPORTANT: Forward the cookie aka origin in order to prevent sync loops in the same zone!
 		 */
 		if (!ConfigItem::ActivateItems(newItems, true, false, false, cookie)) {
-			if (errors) {
-				Log(LogNotice, "ConfigObjectUtility")
-					<< "Failed to activate config object '" << fullName << "'. Aborting and removing config path '" << path << "'.";
+			Log(LogNotice, "ConfigObjectUtility")
+				<< "Failed to activate " << what << ". Aborting and removing their config paths.";
 
-				Utility::Remove(path);
+			rollback();
 
+			if (errors) {
 				for (const boost::exception_ptr& ex : upq.GetExceptions()) {
 					errors->Add(DiagnosticInformation(ex, false));
 
@@ -263,27 +387,49 @@ bool ConfigObjectUtility::CreateObject(const Type::Ptr& type, const String& full
 			return false;
 		}
 
+		for (auto& object : batch) {
+			object->ClearExtension("ConfigObjectBatch");
+		}
+
+		if (!batch.empty()) {
+			std::vector<ConfigObject::Ptr> activated;
+			activated.swap(batch);
+
+			ConfigObject::OnBatchActivated(activated, cookie);
+		}
+
 		/* if (type != Comment::TypeInstance && type != Downtime::TypeInstance)
 		 * Does not work since this would require libicinga, which has a dependency on libremote
 		 * Would work if these libs were static.
 		 */
-		if (type->GetName() != "Comment" && type->GetName() != "Downtime")
-			ApiListener::UpdateObjectAuthority();
+		for (auto& object : objects) {
+			if (object.ObjectType->GetName() != "Comment" && object.ObjectType->GetName() != "Downtime") {
+				ApiListener::UpdateObjectAuthority();
+				break;
+			}
+		}
+
+		for (auto& object : objects) {
+			// At this stage we should have a config object already. If not, it was ignored before.
+			auto *ctype = dynamic_cast<ConfigType *>(object.ObjectType.get());
+			ConfigObject::Ptr obj = ctype->GetObject(object.Name);
 
-		// At this stage we should have a config object already. If not, it was ignored before.
-		auto *ctype = dynamic_cast<ConfigType *>(type.get());
-		ConfigObject::Ptr obj = ctype->GetObject(fullName);
+			if (obj) {
+				Log(objects.size() == 1u ? LogInformation : LogNotice, "ConfigObjectUtility")
+					<< "Created and activated object '" << object.Name << "' of type '" << object.ObjectType->GetName() << "'.";
+			} else {
+				Log(LogNotice, "ConfigObjectUtility")
+					<< "Object '" << object.Name << "' was not created but ignored due to errors.";
+			}
+		}
 
-		if (obj) {
+		if (objects.size() > 1u) {
 			Log(LogInformation, "ConfigObjectUtility")
-				<< "Created and activated object '" << fullName << "' of type '" << type->GetName() << "'.";
-		} else {
-			Log(LogNotice, "ConfigObjectUtility")
-				<< "Object '" << fullName << "' was not created but ignored due to errors.";
+				<< "Created and activated " << objects.size() << " objects.";
 		}
 
 	} catch (const std::exception& ex) {
-		Utility::Remove(path);
+		rollback();
 
 		if (errors)
 			errors->Add(DiagnosticInformation(ex, false));
@@ -297,6 +443,10 @@ bool ConfigObjectUtility::CreateObject(const Type::Ptr& type, const String& full
 	return true;
 }
 
+/**
+ * Deletes an object (and, if cascade is set, the objects depending on it) regardless of the
+ * package it was loaded from. Only the config files of objects created via the API are removed.
+ */
 bool ConfigObjectUtility::DeleteObjectHelper(const ConfigObject::Ptr& object, bool cascade,
 	const Array::Ptr& errors, const Array::Ptr& diagnosticInformation, const Value& cookie)
 {
@@ -8,10 +8,23 @@
 #include "base/configobject.hpp"
 #include "base/dictionary.hpp"
 #include "base/type.hpp"
+#include <vector>
 
 namespace icinga
 {
 
+/**
+ * An object to be created by ConfigObjectUtility::CreateObjects().
+ *
+ * @ingroup remote
+ */
+struct NewConfigObject
+{
+	Type::Ptr ObjectType;
+	String Name;
+	String Config;
+};
+
 /**
  * Helper functions.
  *
@@ -33,13 +46,17 @@ public:
 	static bool CreateObject(const Type::Ptr& type, const String& fullName,
 		const String& config, const Array::Ptr& errors, const Array::Ptr& diagnosticInformation, const Value& cookie = Empty);
 
+	static bool CreateObjects(const std::vector<NewConfigObject>& objects, const Array::Ptr& errors,
+		const Array::Ptr& diagnosticInformation, const Value& cookie = Empty);
+
 	static bool DeleteObject(const ConfigObject::Ptr& object, bool cascade, const Array::Ptr& errors,
 		const Array::Ptr& diagnosticInformation, const Value& cookie = Empty);
 
-private:
-	static String EscapeName(const String& name);
 	static bool DeleteObjectHelper(const ConfigObject::Ptr& object, bool cascade, const Array::Ptr& errors,
 		const Array::Ptr& diagnosticInformation, const Value& cookie = Empty);
+
+private:
+	static String EscapeName(const String& name);
 };
 
 }
@@ -4,12 +4,14 @@
 #include "remote/apilistener.hpp"
 #include "base/application.hpp"
 #include "base/exception.hpp"
+#include "base/logger.hpp"
 #include "base/utility.hpp"
 #include <boost/algorithm/string.hpp>
 #include <boost/regex.hpp>
 #include <algorithm>
 #include <cctype>
 #include <fstream>
+#include <iomanip>
 
 using namespace icinga;
 
@@ -180,6 +182,17 @@ void ConfigPackageUtility::TryActivateStageCallback(const ProcessResult& pr, con
 	fpStatus << pr.ExitStatus;
 	fpStatus.close();
 
+	String timeFile = GetPackageDir() + "/" + packageName + "/" + stageName + "/validation-time";
+	std::ofstream fpTime(timeFile.CStr(), std::ofstream::out | std::ostream::binary | std::ostream::trunc);
+	fpTime << std::fixed << std::setprecision(3) << pr.ExecutionEnd - pr.ExecutionStart;
+	fpTime.close();
+
+	Log(LogInformation, "ConfigPackageUtility")
+		<< "Validation of stage '" << stageName << "' of package '" << packageName << "' took "
+		<< std::fixed << std::setprecision(3) << pr.ExecutionEnd - pr.ExecutionStart << " seconds.";
+
+	String snapshotFile = GetStageSnapshotPath(packageName, stageName);
+
 	/* validation went fine, activate stage and reload */
 	if (pr.ExitStatus == 0) {
 		if (activate) {
@@ -189,6 +202,15 @@ void ConfigPackageUtility::TryActivateStageCallback(const ProcessResult& pr, con
 				ActivateStage(packageName, stageName);
 			}
 
+			if (Utility::PathExists(snapshotFile)) {
+				try {
+					Utility::RenameFile(snapshotFile, Configuration::CacheDir + "/config-snapshot");
+				} catch (const std::exception& ex) {
+					Log(LogWarning, "ConfigPackageUtility")
+						<< "Could not replace the config snapshot: " << DiagnosticInformation(ex, false);
+				}
+			}
+
 			if (reload) {
 				/*
 				 * Cancel the deferred callback before going out of scope so that the config stages handler
@@ -206,6 +228,16 @@ void ConfigPackageUtility::TryActivateStageCallback(const ProcessResult& pr, con
 			<< "Config validation failed for package '"
 			<< packageName << "' and stage '" << stageName << "'.";
 	}
+
+	/* The stage hasn't been activated. */
+	if (Utility::PathExists(snapshotFile)) {
+		try {
+			Utility::Remove(snapshotFile);
+		} catch (const std::exception& ex) {
+			Log(LogWarning, "ConfigPackageUtility")
+				<< "Could not remove the config snapshot of the stage: " << DiagnosticInformation(ex, false);
+		}
+	}
 }
 
 void ConfigPackageUtility::AsyncTryActivateStage(const String& packageName, const String& stageName, bool activate, bool reload,
@@ -218,6 +250,8 @@ void ConfigPackageUtility::AsyncTryActivateStage(const String& packageName, cons
 		Application::GetExePath(Application::GetArgV()[0]),
 	});
 
+	bool snapshot = false;
+
 	// copy all arguments of parent process
 	for (int i = 1; i < Application::GetArgC(); i++) {
 		String argV = Application::GetArgV()[i];
@@ -225,6 +259,9 @@ void ConfigPackageUtility::AsyncTryActivateStage(const String& packageName, cons
 		if (argV == "-d" || argV == "--daemonize")
 			continue;
 
+		if (argV == "--config-snapshot")
+			snapshot = true;
+
 		args->Add(argV);
 	}
 
@@ -233,6 +270,16 @@ void ConfigPackageUtility::AsyncTryActivateStage(const String& packageName, cons
 	args->Add("--define");
 	args->Add("ActiveStageOverride=" + packageName + ":" + stageName);
 
+	/* The validated objects are written to a config snapshot, so that the restart after
+	 * activating the stage restores them instead of evaluating the whole config once more. */
+	if (snapshot) {
+		args->Add("--config-snapshot-path");
+		args->Add(GetStageSnapshotPath(packageName, stageName));
+	}
+
+	Log(LogInformation, "ConfigPackageUtility")
+		<< "Validating stage '" << stageName << "' of package '" << packageName << "'.";
+
 	Process::Ptr process = new Process(Process::PrepareCommand(args));
 	process->SetTimeout(Application::GetReloadTimeout());
 	process->Run([packageName, stageName, activate, reload, resetPackageUpdates](const ProcessResult& pr) {
@@ -240,6 +287,14 @@ void ConfigPackageUtility::AsyncTryActivateStage(const String& packageName, cons
 	});
 }
 
+/**
+ * @returns Where the validation of the stage writes the config snapshot to, see AsyncTryActivateStage().
+ */
+String ConfigPackageUtility::GetStageSnapshotPath(const String& packageName, const String& stageName)
+{
+	return Configuration::CacheDir + "/config-snapshot-" + packageName + "-" + stageName;
+}
+
 void ConfigPackageUtility::DeleteStage(const String& packageName, const String& stageName)
 {
 	String path = GetPackageDir() + "/" + packageName + "/" + stageName;
@@ -61,6 +61,7 @@ private:
 
 	static void WritePackageConfig(const String& packageName);
 	static void WriteStageConfig(const String& packageName, const String& stageName);
+	static String GetStageSnapshotPath(const String& packageName, const String& stageName);
 
 	static void TryActivateStageCallback(const ProcessResult& pr, const String& packageName, const String& stageName, bool activate,
 		bool reload, const Shared<Defer>::Ptr& resetPackageUpdates);
@@ -117,6 +117,13 @@ void Endpoint::AddMessageReceived(int bytes)
 	SetLastMessageReceived(time);
 }
 
+void Endpoint::AddCompressedMessageSent(int uncompressedBytes, int compressedBytes)
+{
+	double time = Utility::GetTime();
+	m_UncompressedBytesSent.InsertValue(time, uncompressedBytes);
+	m_CompressedBytesSent.InsertValue(time, compressedBytes);
+}
+
 double Endpoint::GetMessagesSentPerSecond() const
 {
 	return m_MessagesSent.CalculateRate(Utility::GetTime(), 60);
@@ -136,3 +143,25 @@ double Endpoint::GetBytesReceivedPerSecond() const
 {
 	return m_BytesReceived.CalculateRate(Utility::GetTime(), 60);
 }
+
+/**
+ * Uncompressed bytes per compressed byte sent within the last minute, 0 if compression isn't used.
+ */
+double Endpoint::GetCompressionRatio() const
+{
+	double now = Utility::GetTime();
+	double compressed = m_CompressedBytesSent.UpdateAndGetValues(now, 60);
+
+	if (compressed <= 0)
+		return 0;
+
+	return m_UncompressedBytesSent.UpdateAndGetValues(now, 60) / compressed;
+}
+
+void Endpoint::ValidateAuthorityWeight(const Lazy<double>& lvalue, const ValidationUtils& utils)
+{
+	ObjectImpl<Endpoint>::ValidateAuthorityWeight(lvalue, utils);
+
+	if (lvalue() <= 0)
+		BOOST_THROW_EXCEPTION(ValidationError(this, { "authority_weight" }, "Value must be greater than 0."));
+}
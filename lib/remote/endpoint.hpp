@@ -42,6 +42,7 @@ public:
 
 	void AddMessageSent(int bytes);
 	void AddMessageReceived(int bytes);
+	void AddCompressedMessageSent(int uncompressedBytes, int compressedBytes);
 
 	double GetMessagesSentPerSecond() const override;
 	double GetMessagesReceivedPerSecond() const override;
@@ -49,6 +50,10 @@ public:
 	double GetBytesSentPerSecond() const override;
 	double GetBytesReceivedPerSecond() const override;
 
+	double GetCompressionRatio() const override;
+
+	void ValidateAuthorityWeight(const Lazy<double>& lvalue, const ValidationUtils& utils) override;
+
 protected:
 	void OnAllConfigLoaded() override;
 
@@ -61,6 +66,8 @@ private:
 	mutable RingBuffer m_MessagesReceived{60};
 	mutable RingBuffer m_BytesSent{60};
 	mutable RingBuffer m_BytesReceived{60};
+	mutable RingBuffer m_UncompressedBytesSent{60};
+	mutable RingBuffer m_CompressedBytesSent{60};
 };
 
 }
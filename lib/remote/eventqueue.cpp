@@ -6,12 +6,14 @@
 #include "base/io-engine.hpp"
 #include "base/singleton.hpp"
 #include "base/logger.hpp"
+#include "base/memoryusage.hpp"
 #include "base/utility.hpp"
 #include <boost/asio/spawn.hpp>
 #include <boost/date_time/posix_time/posix_time_duration.hpp>
 #include <boost/date_time/posix_time/ptime.hpp>
 #include <boost/system/error_code.hpp>
 #include <chrono>
+#include <set>
 #include <utility>
 
 using namespace icinga;
@@ -148,10 +150,35 @@ EventQueueRegistry *EventQueueRegistry::GetInstance()
 std::mutex EventsInbox::m_FiltersMutex;
 std::map<String, EventsInbox::Filter> EventsInbox::m_Filters ({{"", EventsInbox::Filter{1, Expression::Ptr()}}});
 
+std::atomic<uint_fast64_t> EventsInbox::m_TotalDroppedEvents (0);
+
+static std::mutex l_InboxesMutex;
+static std::set<EventsInbox *> l_Inboxes;
+
+/* The events queued for /v1/events subscribers. Events are shared between
+ * the inboxes, so only the references to them are counted. */
+REGISTER_MEMORY_USAGE_REPORTER("events_inboxes", [](std::vector<MemoryUsageEntry>& entries) {
+	std::unique_lock<std::mutex> lock (l_InboxesMutex);
+	uint_fast64_t events = 0;
+
+	for (EventsInbox *inbox : l_Inboxes) {
+		events += inbox->GetLength();
+	}
+
+	entries.push_back({ "events", events, events * sizeof(SharedMessage::Ptr) });
+});
+
+std::atomic<uint_fast64_t> EventsFilter::m_Events (0);
+std::atomic<uint_fast64_t> EventsFilter::m_Encodes (0);
+
 EventsRouter EventsRouter::m_Instance;
 
-EventsInbox::EventsInbox(String filter, const String& filterSource)
-	: m_Timer(IoEngine::Get().GetIoContext())
+/**
+ * @param capacity Maximum number of queued events, 0 for no limit.
+ * @param policy What to do with new events once the capacity is reached.
+ */
+EventsInbox::EventsInbox(String filter, const String& filterSource, std::size_t capacity, EventsOverflowPolicy policy)
+	: m_Timer(IoEngine::Get().GetIoContext()), m_Capacity(capacity), m_Policy(policy)
 {
 	std::unique_lock<std::mutex> lock (m_FiltersMutex);
 	m_Filter = m_Filters.find(filter);
@@ -173,10 +200,20 @@ EventsInbox::EventsInbox(String filter, const String& filterSource)
 	} else {
 		++m_Filter->second.Refs;
 	}
+
+	lock.unlock();
+
+	std::unique_lock<std::mutex> inboxesLock (l_InboxesMutex);
+	l_Inboxes.insert(this);
 }
 
 EventsInbox::~EventsInbox()
 {
+	{
+		std::unique_lock<std::mutex> inboxesLock (l_InboxesMutex);
+		l_Inboxes.erase(this);
+	}
+
 	std::unique_lock<std::mutex> lock (m_FiltersMutex);
 
 	if (!--m_Filter->second.Refs) {
@@ -189,15 +226,29 @@ const Expression::Ptr& EventsInbox::GetFilter()
 	return m_Filter->second.Expr;
 }
 
-void EventsInbox::Push(Dictionary::Ptr event)
+void EventsInbox::Push(SharedMessage::Ptr event)
 {
 	std::unique_lock<std::mutex> lock (m_Mutex);
 
+	if (m_Capacity && m_Queue.size() >= m_Capacity) {
+		++m_DroppedEvents;
+		++m_TotalDroppedEvents;
+
+		if (m_Policy == EventsOverflowPolicy::Disconnect) {
+			/* Wake up Shift(), the subscriber checks IsOverflowed() afterwards. */
+			m_Overflowed.store(true);
+			m_Timer.expires_at(boost::posix_time::neg_infin);
+			return;
+		}
+
+		m_Queue.pop();
+	}
+
 	m_Queue.emplace(std::move(event));
 	m_Timer.expires_at(boost::posix_time::neg_infin);
 }
 
-Dictionary::Ptr EventsInbox::Shift(boost::asio::yield_context yc, double timeout)
+SharedMessage::Ptr EventsInbox::Shift(boost::asio::yield_context yc, double timeout)
 {
 	std::unique_lock<std::mutex> lock (m_Mutex, std::defer_lock);
 
@@ -234,8 +285,57 @@ Dictionary::Ptr EventsInbox::Shift(boost::asio::yield_context yc, double timeout
 	return event;
 }
 
-EventsSubscriber::EventsSubscriber(std::set<EventType> types, String filter, const String& filterSource)
-	: m_Types(std::move(types)), m_Inbox(new EventsInbox(std::move(filter), filterSource))
+/**
+ * Like Shift(), but doesn't wait for an event.
+ *
+ * @returns An already queued event, nullptr if there's none or Push() holds the lock right now.
+ */
+SharedMessage::Ptr EventsInbox::TryShift()
+{
+	std::unique_lock<std::mutex> lock (m_Mutex, std::try_to_lock);
+
+	if (!lock || m_Queue.empty()) {
+		return nullptr;
+	}
+
+	auto event (std::move(m_Queue.front()));
+	m_Queue.pop();
+	return event;
+}
+
+/**
+ * @returns Whether an event was dropped with EventsOverflowPolicy::Disconnect.
+ */
+bool EventsInbox::IsOverflowed() const
+{
+	return m_Overflowed.load();
+}
+
+uint_fast64_t EventsInbox::GetDroppedEvents() const
+{
+	return m_DroppedEvents.load();
+}
+
+/**
+ * @returns The number of queued events.
+ */
+size_t EventsInbox::GetLength()
+{
+	std::unique_lock<std::mutex> lock (m_Mutex);
+	return m_Queue.size();
+}
+
+/**
+ * @returns The number of events dropped by all inboxes since startup.
+ */
+uint_fast64_t EventsInbox::GetTotalDroppedEvents()
+{
+	return m_TotalDroppedEvents.load();
+}
+
+EventsSubscriber::EventsSubscriber(std::set<EventType> types, String filter, const String& filterSource,
+	std::size_t capacity, EventsOverflowPolicy policy)
+	: m_Types(std::move(types)), m_Inbox(new EventsInbox(std::move(filter), filterSource, capacity, policy))
 {
 	EventsRouter::GetInstance().Subscribe(m_Types, m_Inbox);
 }
@@ -260,8 +360,13 @@ EventsFilter::operator bool()
 	return !m_Inboxes.empty();
 }
 
+/**
+ * Delivers the event to all inboxes whose filter matches. All of them share one encoding of it.
+ */
 void EventsFilter::Push(Dictionary::Ptr event)
 {
+	SharedMessage::Ptr shared;
+
 	for (auto& perFilter : m_Inboxes) {
 		if (perFilter.first) {
 			ScriptFrame frame(true, new Namespace());
@@ -278,12 +383,27 @@ void EventsFilter::Push(Dictionary::Ptr event)
 			}
 		}
 
+		if (!shared) {
+			shared = new SharedMessage(event, &m_Encodes);
+			++m_Events;
+		}
+
 		for (auto& inbox : perFilter.second) {
-			inbox->Push(event);
+			inbox->Push(shared);
 		}
 	}
 }
 
+/**
+ * @returns How often events delivered to at least one inbox have been encoded on average.
+ */
+double EventsFilter::GetEncodesPerEvent()
+{
+	auto events (m_Events.load());
+
+	return events ? (double)m_Encodes.load() / events : 0;
+}
+
 EventsRouter& EventsRouter::GetInstance()
 {
 	return m_Instance;
@@ -4,10 +4,12 @@
 #define EVENTQUEUE_H
 
 #include "remote/httphandler.hpp"
+#include "remote/jsonrpc.hpp"
 #include "base/object.hpp"
 #include "config/expression.hpp"
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/spawn.hpp>
+#include <atomic>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
@@ -86,12 +88,24 @@ enum class EventType : uint_fast8_t
 	ObjectModified
 };
 
+/**
+ * What to do with a new event if an EventsInbox is full.
+ *
+ * @ingroup remote
+ */
+enum class EventsOverflowPolicy : uint_fast8_t
+{
+	DropOldest,
+	Disconnect
+};
+
 class EventsInbox : public Object
 {
 public:
 	DECLARE_PTR_TYPEDEFS(EventsInbox);
 
-	EventsInbox(String filter, const String& filterSource);
+	EventsInbox(String filter, const String& filterSource, std::size_t capacity = 0,
+		EventsOverflowPolicy policy = EventsOverflowPolicy::DropOldest);
 	EventsInbox(const EventsInbox&) = delete;
 	EventsInbox(EventsInbox&&) = delete;
 	EventsInbox& operator=(const EventsInbox&) = delete;
@@ -100,8 +114,15 @@ public:
 
 	const Expression::Ptr& GetFilter();
 
-	void Push(Dictionary::Ptr event);
-	Dictionary::Ptr Shift(boost::asio::yield_context yc, double timeout = 5);
+	void Push(SharedMessage::Ptr event);
+	SharedMessage::Ptr Shift(boost::asio::yield_context yc, double timeout = 5);
+	SharedMessage::Ptr TryShift();
+
+	bool IsOverflowed() const;
+	uint_fast64_t GetDroppedEvents() const;
+	size_t GetLength();
+
+	static uint_fast64_t GetTotalDroppedEvents();
 
 private:
 	struct Filter
@@ -112,17 +133,24 @@ private:
 
 	static std::mutex m_FiltersMutex;
 	static std::map<String, Filter> m_Filters;
+	static std::atomic<uint_fast64_t> m_TotalDroppedEvents;
 
 	std::mutex m_Mutex;
 	decltype(m_Filters.begin()) m_Filter;
-	std::queue<Dictionary::Ptr> m_Queue;
+	std::queue<SharedMessage::Ptr> m_Queue;
 	boost::asio::deadline_timer m_Timer;
+
+	std::size_t m_Capacity;
+	EventsOverflowPolicy m_Policy;
+	std::atomic<bool> m_Overflowed {false};
+	std::atomic<uint_fast64_t> m_DroppedEvents {0};
 };
 
 class EventsSubscriber
 {
 public:
-	EventsSubscriber(std::set<EventType> types, String filter, const String& filterSource);
+	EventsSubscriber(std::set<EventType> types, String filter, const String& filterSource, std::size_t capacity = 0,
+		EventsOverflowPolicy policy = EventsOverflowPolicy::DropOldest);
 	EventsSubscriber(const EventsSubscriber&) = delete;
 	EventsSubscriber(EventsSubscriber&&) = delete;
 	EventsSubscriber& operator=(const EventsSubscriber&) = delete;
@@ -145,7 +173,12 @@ public:
 
 	void Push(Dictionary::Ptr event);
 
+	static double GetEncodesPerEvent();
+
 private:
+	static std::atomic<uint_fast64_t> m_Events;
+	static std::atomic<uint_fast64_t> m_Encodes;
+
 	std::map<Expression::Ptr, std::set<EventsInbox::Ptr>> m_Inboxes;
 };
 
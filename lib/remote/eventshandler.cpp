@@ -5,13 +5,15 @@
 #include "remote/filterutility.hpp"
 #include "config/configcompiler.hpp"
 #include "config/expression.hpp"
+#include "base/convert.hpp"
 #include "base/defer.hpp"
 #include "base/io-engine.hpp"
+#include "base/logger.hpp"
 #include "base/objectlock.hpp"
 #include "base/json.hpp"
+#include "base/utility.hpp"
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/write.hpp>
-#include <boost/algorithm/string/replace.hpp>
 #include <map>
 #include <set>
 
@@ -39,6 +41,10 @@ const std::map<String, EventType> l_EventTypes ({
 
 const String l_ApiQuery ("<API query>");
 
+/* Upper bounds for the events of one write to the stream. */
+static const std::size_t l_MaxEventsBatchBytes = 64 * 1024;
+static const double l_MaxEventsBatchDelay = 0.05;
+
 bool EventsHandler::HandleRequest(
 	AsioTlsStream& stream,
 	const ApiUser::Ptr& user,
@@ -98,14 +104,43 @@ bool EventsHandler::HandleRequest(
 		}
 	}
 
-	EventsSubscriber subscriber (std::move(eventTypes), HttpUtility::GetLastParameter(params, "filter"), l_ApiQuery);
+	std::size_t bufferSize = 0;
+
+	{
+		Value bufferSizeParam = HttpUtility::GetLastParameter(params, "buffer_size");
+
+		if (!bufferSizeParam.IsEmpty()) {
+			double value = Convert::ToDouble(bufferSizeParam);
+
+			if (value < 0) {
+				HttpUtility::SendJsonError(response, params, 400, "'buffer_size' query parameter must not be negative.");
+				return true;
+			}
+
+			bufferSize = (std::size_t)value;
+		}
+	}
+
+	auto overflowPolicy (EventsOverflowPolicy::DropOldest);
+	String overflow = HttpUtility::GetLastParameter(params, "overflow");
+
+	if (overflow == "disconnect") {
+		overflowPolicy = EventsOverflowPolicy::Disconnect;
+	} else if (!overflow.IsEmpty() && overflow != "drop_oldest") {
+		HttpUtility::SendJsonError(response, params, 400, "'overflow' query parameter must be 'drop_oldest' or 'disconnect'.");
+		return true;
+	}
+
+	EventsSubscriber subscriber (std::move(eventTypes), HttpUtility::GetLastParameter(params, "filter"), l_ApiQuery,
+		bufferSize, overflowPolicy);
+	auto& inbox (subscriber.GetInbox());
 
 	server.StartStreaming();
 
 	response.result(http::status::ok);
 	response.set(http::field::content_type, "application/json");
 
-	IoBoundWorkSlot dontLockTheIoThread (yc);
+	IoBoundWorkSlot dontLockTheIoThread (yc, CpuBoundPriority::Low);
 
 	http::async_write(stream, response, yc);
 	stream.async_flush(yc);
@@ -113,20 +148,38 @@ bool EventsHandler::HandleRequest(
 	asio::const_buffer newLine ("\n", 1);
 
 	for (;;) {
-		auto event (subscriber.GetInbox()->Shift(yc));
+		auto event (inbox->Shift(yc));
 
 		if (event) {
-			String body = JsonEncode(event);
+			/* Write all events queued meanwhile before flushing them with as few TLS writes as possible,
+			 * but don't delay the first one of them for too long.
+			 */
+			double batchStart = Utility::GetTime();
+			std::size_t batchBytes = 0;
+
+			do {
+				/* Encoded only once for all subscribers. JSON without pretty printing doesn't contain newlines. */
+				auto body (event->GetEncoded());
 
-			boost::algorithm::replace_all(body, "\n", "");
+				asio::const_buffer payload (body->CStr(), body->GetLength());
 
-			asio::const_buffer payload (body.CStr(), body.GetLength());
+				asio::async_write(stream, payload, yc);
+				asio::async_write(stream, newLine, yc);
+
+				batchBytes += body->GetLength() + 1u;
+			} while (batchBytes < l_MaxEventsBatchBytes && Utility::GetTime() - batchStart < l_MaxEventsBatchDelay
+				&& (event = inbox->TryShift()));
 
-			asio::async_write(stream, payload, yc);
-			asio::async_write(stream, newLine, yc);
 			stream.async_flush(yc);
 		} else if (server.Disconnected()) {
 			return true;
 		}
+
+		if (inbox->IsOverflowed()) {
+			Log(LogWarning, "EventsHandler")
+				<< "Closing event stream of queue '" << queueName << "': The client didn't keep up, "
+				<< inbox->GetDroppedEvents() << " events dropped.";
+			return true;
+		}
 	}
 }
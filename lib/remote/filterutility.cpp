@@ -2,19 +2,42 @@
 
 #include "remote/filterutility.hpp"
 #include "remote/httputility.hpp"
-#include "config/applyrule.hpp"
 #include "config/configcompiler.hpp"
 #include "config/expression.hpp"
+#include "config/bytecode.hpp"
 #include "base/namespace.hpp"
 #include "base/json.hpp"
 #include "base/configtype.hpp"
+#include "base/initialize.hpp"
 #include "base/logger.hpp"
 #include "base/utility.hpp"
+#include "base/wildcardpattern.hpp"
 #include <boost/algorithm/string/case_conv.hpp>
+#include <algorithm>
+#include <iterator>
 #include <memory>
 
 using namespace icinga;
 
+std::mutex FilterIndex::m_Mutex;
+std::map<String, FilterIndex::Index> FilterIndex::m_Indices;
+std::atomic<uint_fast64_t> FilterIndex::m_Generation (0);
+
+/* Upper bound for the number of indices (type + attribute combinations) built from API filters. */
+static const std::size_t l_MaxFilterIndices = 256;
+
+static std::mutex l_CompiledFiltersMutex;
+static std::unordered_map<String, Expression::Ptr> l_CompiledFilters;
+
+/* Upper bound for the number of distinct filter strings kept compiled. */
+static const std::size_t l_MaxCompiledFilters = 1024;
+
+INITIALIZE_ONCE([]() {
+	ConfigObject::OnActiveChanged.connect([](const ConfigObject::Ptr&, const Value&) {
+		FilterIndex::Invalidate();
+	});
+});
+
 Type::Ptr FilterUtility::TypeFromPluralName(const String& pluralName)
 {
 	String uname = pluralName;
@@ -68,6 +91,136 @@ String ConfigObjectTargetProvider::GetPluralName(const String& type) const
 	return Type::GetByName(type)->GetPluralName();
 }
 
+/**
+ * Marks all indices as outdated. They're rebuilt on their next use.
+ */
+void FilterIndex::Invalidate()
+{
+	m_Generation.fetch_add(1);
+}
+
+/**
+ * Must be called with m_Mutex held.
+ *
+ * @returns The up-to-date index of the given type's objects by the given field (and key of that dictionary field)
+ *          or nullptr if there's no such field.
+ */
+const FilterIndex::Index *FilterIndex::GetIndex(const Type::Ptr& type, const String& field, const String& key)
+{
+	auto ctype (dynamic_cast<ConfigType*>(type.get()));
+
+	if (!ctype)
+		return nullptr;
+
+	int fid = type->GetFieldId(field);
+
+	if (fid < 0)
+		return nullptr;
+
+	String id = type->GetName() + "\n" + field + "\n" + key;
+	auto generation (m_Generation.load());
+	auto it (m_Indices.find(id));
+
+	if (it != m_Indices.end() && it->second.Generation == generation)
+		return &it->second;
+
+	if (it == m_Indices.end() && m_Indices.size() >= l_MaxFilterIndices)
+		m_Indices.clear();
+
+	Index& index = m_Indices[id];
+	index.Generation = generation;
+	index.Objects.clear();
+
+	for (const ConfigObject::Ptr& object : ctype->GetObjects()) {
+		Value value = object->GetField(fid);
+
+		if (!key.IsEmpty()) {
+			if (!value.IsObjectType<Dictionary>())
+				continue;
+
+			value = static_cast<Dictionary::Ptr>(value)->Get(key);
+		}
+
+		/* Only strings are indexed. See Value::operator==() for why that's enough for non-empty string constants. */
+		if (value.IsString())
+			index.Objects[value].emplace_back(object);
+	}
+
+	return &index;
+}
+
+/**
+ * Collects the objects of the given type whose attribute equals the given (non-empty) string.
+ *
+ * @returns Whether the attribute could be looked up.
+ */
+bool FilterIndex::Lookup(const Type::Ptr& type, const String& field, const String& key,
+	const String& value, std::vector<ConfigObject::Ptr>& objects)
+{
+	std::unique_lock<std::mutex> lock (m_Mutex);
+	auto index (GetIndex(type, field, key));
+
+	if (!index)
+		return false;
+
+	auto it (index->Objects.find(value));
+
+	if (it != index->Objects.end())
+		objects.insert(objects.end(), it->second.begin(), it->second.end());
+
+	return true;
+}
+
+/**
+ * Collects the objects of the given type whose attribute matches the given wildcard pattern.
+ *
+ * @returns Whether the attribute could be looked up.
+ */
+bool FilterIndex::Match(const Type::Ptr& type, const String& field, const String& key,
+	const String& pattern, std::vector<ConfigObject::Ptr>& objects)
+{
+	WildcardPattern compiledPattern (pattern);
+	std::unique_lock<std::mutex> lock (m_Mutex);
+	auto index (GetIndex(type, field, key));
+
+	if (!index)
+		return false;
+
+	for (auto& kv : index->Objects) {
+		if (compiledPattern.Match(kv.first))
+			objects.insert(objects.end(), kv.second.begin(), kv.second.end());
+	}
+
+	return true;
+}
+
+/**
+ * Compiles the given API filter or re-uses the result of a previous compilation of the same string.
+ *
+ * @returns The compiled filter. Safe to be evaluated concurrently.
+ */
+Expression::Ptr FilterUtility::CompileFilter(const String& filter)
+{
+	{
+		std::unique_lock<std::mutex> lock (l_CompiledFiltersMutex);
+		auto it (l_CompiledFilters.find(filter));
+
+		if (it != l_CompiledFilters.end())
+			return it->second;
+	}
+
+	Expression::Ptr expr = new BytecodeExpression(ConfigCompiler::CompileText("<API query>", filter).release());
+
+	std::unique_lock<std::mutex> lock (l_CompiledFiltersMutex);
+
+	if (l_CompiledFilters.size() >= l_MaxCompiledFilters)
+		l_CompiledFilters.clear();
+
+	l_CompiledFilters.emplace(filter, expr);
+
+	return expr;
+}
+
 bool FilterUtility::EvaluateFilter(ScriptFrame& frame, Expression *filter,
 	const Object::Ptr& target, const String& variableName)
 {
@@ -148,49 +301,62 @@ bool FilterUtility::HasPermission(const ApiUser::Ptr& user, const String& permis
 	if (permission.IsEmpty())
 		return true;
 
-	bool foundPermission = false;
 	String requiredPermission = permission.ToLower();
-
-	Array::Ptr permissions = user->GetPermissions();
-	if (permissions) {
-		ObjectLock olock(permissions);
-		for (const Value& item : permissions) {
-			String permission;
-			Function::Ptr filter;
-			if (item.IsObjectType<Dictionary>()) {
-				Dictionary::Ptr dict = item;
-				permission = dict->Get("permission");
-				filter = dict->Get("filter");
-			} else
-				permission = item;
-
-			permission = permission.ToLower();
-
-			if (!Utility::Match(permission, requiredPermission))
-				continue;
-
-			foundPermission = true;
-
-			if (filter && permissionFilter) {
-				std::vector<std::unique_ptr<Expression> > args;
-				args.emplace_back(new GetScopeExpression(ScopeThis));
-				std::unique_ptr<Expression> indexer{new IndexerExpression(std::unique_ptr<Expression>(MakeLiteral(filter)), std::unique_ptr<Expression>(MakeLiteral("call")))};
-				FunctionCallExpression *fexpr = new FunctionCallExpression(std::move(indexer), std::move(args));
-
-				if (!*permissionFilter)
-					permissionFilter->reset(fexpr);
-				else
-					*permissionFilter = std::make_unique<LogicalOrExpression>(std::move(*permissionFilter), std::unique_ptr<Expression>(fexpr));
+	ApiUserPermission result;
+
+	/* Matching and compiling the permissions only depends on the user's permissions which invalidate the cache. */
+	if (!user->GetCachedPermission(requiredPermission, result)) {
+		std::unique_ptr<Expression> filterExpr;
+
+		Array::Ptr permissions = user->GetPermissions();
+		if (permissions) {
+			ObjectLock olock(permissions);
+			for (const Value& item : permissions) {
+				String permission;
+				Function::Ptr filter;
+				if (item.IsObjectType<Dictionary>()) {
+					Dictionary::Ptr dict = item;
+					permission = dict->Get("permission");
+					filter = dict->Get("filter");
+				} else
+					permission = item;
+
+				permission = permission.ToLower();
+
+				if (!Utility::Match(permission, requiredPermission))
+					continue;
+
+				result.Found = true;
+
+				if (filter) {
+					std::vector<std::unique_ptr<Expression> > args;
+					args.emplace_back(new GetScopeExpression(ScopeThis));
+					std::unique_ptr<Expression> indexer{new IndexerExpression(std::unique_ptr<Expression>(MakeLiteral(filter)), std::unique_ptr<Expression>(MakeLiteral("call")))};
+					FunctionCallExpression *fexpr = new FunctionCallExpression(std::move(indexer), std::move(args));
+
+					if (!filterExpr)
+						filterExpr.reset(fexpr);
+					else
+						filterExpr = std::make_unique<LogicalOrExpression>(std::move(filterExpr), std::unique_ptr<Expression>(fexpr));
+				}
 			}
 		}
+
+		if (filterExpr)
+			result.Filter = new BytecodeExpression(filterExpr.release());
+
+		user->CachePermission(requiredPermission, result);
 	}
 
-	if (!foundPermission) {
+	if (!result.Found) {
 		Log(LogWarning, "FilterUtility")
 			<< "Missing permission: " << requiredPermission;
 	}
 
-	return foundPermission;
+	if (permissionFilter && result.Filter)
+		*permissionFilter = std::make_unique<OwnedExpression>(result.Filter);
+
+	return result.Found;
 }
 
 void FilterUtility::CheckPermission(const ApiUser::Ptr& user, const String& permission, std::unique_ptr<Expression>* permissionFilter)
@@ -200,6 +366,190 @@ void FilterUtility::CheckPermission(const ApiUser::Ptr& user, const String& perm
 	}
 }
 
+/**
+ * @returns If the given expression is a constant string (literal or filter_vars entry), its address. nullptr otherwise.
+ */
+static const String *GetFilterConstString(Expression *exp, const Dictionary::Ptr& filterVars)
+{
+	const Value *value = nullptr;
+	auto lit (dynamic_cast<LiteralExpression*>(exp));
+
+	if (lit) {
+		value = &lit->GetValue();
+	} else if (filterVars) {
+		auto var (dynamic_cast<VariableExpression*>(exp));
+
+		if (var)
+			value = filterVars->GetRef(var->GetVariable());
+	}
+
+	return value && value->IsString() ? &value->Get<String>() : nullptr;
+}
+
+/**
+ * If the given expression is like $lcType$.name or $lcType$.vars.K, extracts the indexable field ("name" or "vars")
+ * and, for the latter, the key K.
+ *
+ * @returns Whether the given expression is like above.
+ */
+static bool GetFilterAttribute(Expression *exp, const String& lcType, const Dictionary::Ptr& filterVars, String& field, String& key)
+{
+	auto ixr (dynamic_cast<IndexerExpression*>(exp));
+
+	if (!ixr)
+		return false;
+
+	auto index (GetFilterConstString(ixr->GetOperand2().get(), filterVars));
+
+	if (!index)
+		return false;
+
+	auto var (dynamic_cast<VariableExpression*>(ixr->GetOperand1().get()));
+
+	if (var) {
+		if (var->GetVariable() != lcType || *index != "name")
+			return false;
+
+		field = "name";
+		key = String();
+		return true;
+	}
+
+	auto vars (dynamic_cast<IndexerExpression*>(ixr->GetOperand1().get()));
+
+	if (!vars)
+		return false;
+
+	var = dynamic_cast<VariableExpression*>(vars->GetOperand1().get());
+
+	auto varsIndex (GetFilterConstString(vars->GetOperand2().get(), filterVars));
+
+	if (!var || var->GetVariable() != lcType || !varsIndex || *varsIndex != "vars")
+		return false;
+
+	field = "vars";
+	key = *index;
+	return true;
+}
+
+/**
+ * Collects the candidates of a filter which is like one of these (the order of operands of == doesn't matter):
+ *
+ * - $lcType$.name == "N"
+ * - $lcType$.vars.K == "V"
+ * - match("P", $lcType$.name)
+ *
+ * @returns Whether the given filter is like above.
+ */
+static bool GetFilterLeafCandidates(Expression *filter, const Type::Ptr& type, const String& lcType,
+	const Dictionary::Ptr& filterVars, std::vector<ConfigObject::Ptr>& candidates)
+{
+	String field, key;
+
+	auto eq (dynamic_cast<EqualExpression*>(filter));
+
+	if (eq) {
+		auto op1 (eq->GetOperand1().get());
+		auto op2 (eq->GetOperand2().get());
+
+		if (!GetFilterAttribute(op1, lcType, filterVars, field, key)) {
+			std::swap(op1, op2);
+
+			if (!GetFilterAttribute(op1, lcType, filterVars, field, key))
+				return false;
+		}
+
+		auto value (GetFilterConstString(op2, filterVars));
+
+		/* An empty string also equals a missing custom var. */
+		if (!value || value->IsEmpty())
+			return false;
+
+		return FilterIndex::Lookup(type, field, key, *value, candidates);
+	}
+
+	auto call (dynamic_cast<FunctionCallExpression*>(filter));
+
+	if (call && call->m_Args.size() == 2u) {
+		auto fname (dynamic_cast<VariableExpression*>(call->m_FName.get()));
+
+		if (!fname || fname->GetVariable() != "match" || (filterVars && filterVars->Contains("match")))
+			return false;
+
+		auto pattern (GetFilterConstString(call->m_Args.at(0).get(), filterVars));
+
+		/* match() stringifies non-string custom vars which aren't indexed, so only names are supported. */
+		if (!pattern || !GetFilterAttribute(call->m_Args.at(1).get(), lcType, filterVars, field, key) || field != "name")
+			return false;
+
+		return FilterIndex::Match(type, field, key, *pattern, candidates);
+	}
+
+	return false;
+}
+
+/**
+ * Collects a superset of the objects of the given type the given filter matches from the indices (see FilterIndex)
+ * instead of evaluating the filter for all objects of that type. Supported are leaves as in GetFilterLeafCandidates()
+ * combined with && and ||. For services also host.name and host.vars leaves are supported.
+ *
+ * @returns Whether the candidates could be narrowed down. If not, the candidates are garbage.
+ */
+static bool GetFilterCandidates(Expression *filter, const Type::Ptr& type, const String& lcType,
+	const Dictionary::Ptr& filterVars, std::set<ConfigObject::Ptr>& candidates)
+{
+	auto lor (dynamic_cast<LogicalOrExpression*>(filter));
+
+	if (lor) {
+		return GetFilterCandidates(lor->GetOperand1().get(), type, lcType, filterVars, candidates)
+			&& GetFilterCandidates(lor->GetOperand2().get(), type, lcType, filterVars, candidates);
+	}
+
+	auto land (dynamic_cast<LogicalAndExpression*>(filter));
+
+	if (land) {
+		std::set<ConfigObject::Ptr> left, right;
+		bool hasLeft = GetFilterCandidates(land->GetOperand1().get(), type, lcType, filterVars, left);
+		bool hasRight = GetFilterCandidates(land->GetOperand2().get(), type, lcType, filterVars, right);
+
+		if (hasLeft && hasRight) {
+			std::set_intersection(left.begin(), left.end(), right.begin(), right.end(), std::inserter(candidates, candidates.end()));
+		} else if (hasLeft) {
+			candidates.insert(left.begin(), left.end());
+		} else if (hasRight) {
+			candidates.insert(right.begin(), right.end());
+		} else {
+			return false;
+		}
+
+		return true;
+	}
+
+	std::vector<ConfigObject::Ptr> objects;
+
+	if (GetFilterLeafCandidates(filter, type, lcType, filterVars, objects)) {
+		candidates.insert(objects.begin(), objects.end());
+		return true;
+	}
+
+	if (type->GetName() == "Service") {
+		static const auto typeHost (Type::GetByName("Host"));
+		std::vector<ConfigObject::Ptr> hosts;
+
+		if (typeHost && GetFilterLeafCandidates(filter, typeHost, "host", filterVars, hosts)) {
+			for (auto& host : hosts) {
+				if (!FilterIndex::Lookup(type, "host_name", String(), host->GetName(), objects))
+					return false;
+			}
+
+			candidates.insert(objects.begin(), objects.end());
+			return true;
+		}
+	}
+
+	return false;
+}
+
 std::vector<Value> FilterUtility::GetFilterTargets(const QueryDescription& qd, const Dictionary::Ptr& query, const ApiUser::Ptr& user, const String& variableName)
 {
 	std::vector<Value> result;
@@ -271,72 +621,42 @@ std::vector<Value> FilterUtility::GetFilterTargets(const QueryDescription& qd, c
 
 		if (query->Contains("filter")) {
 			String filter = HttpUtility::GetLastParameter(query, "filter");
-			std::unique_ptr<Expression> ufilter = ConfigCompiler::CompileText("<API query>", filter);
+			Expression::Ptr ufilter = CompileFilter(filter);
 			Dictionary::Ptr filter_vars = query->Get("filter_vars");
+
+			if (filter_vars) {
+				ObjectLock olock (filter_vars);
+
+				for (auto& kv : filter_vars) {
+					frameNS->Set(kv.first, kv.second);
+				}
+			}
+
 			bool targeted = false;
-			std::vector<ConfigObject::Ptr> targets;
+			std::set<ConfigObject::Ptr> targets;
 
 			if (dynamic_cast<ConfigObjectTargetProvider*>(provider.get())) {
-				auto dict (dynamic_cast<DictExpression*>(ufilter.get()));
+				auto dict (dynamic_cast<DictExpression*>(static_cast<BytecodeExpression*>(ufilter.get())->GetSource().get()));
 
 				if (dict) {
 					auto& subex (dict->GetExpressions());
 
 					if (subex.size() == 1u) {
-						if (type == "Host") {
-							std::vector<const String *> targetNames;
-
-							if (ApplyRule::GetTargetHosts(subex.at(0).get(), targetNames, filter_vars)) {
-								static const auto typeHost (Type::GetByName("Host"));
-								static const auto ctypeHost (dynamic_cast<ConfigType*>(typeHost.get()));
-								targeted = true;
-
-								for (auto name : targetNames) {
-									auto target (ctypeHost->GetObject(*name));
-
-									if (target) {
-										targets.emplace_back(target);
-									}
-								}
-							}
-						} else if (type == "Service") {
-							std::vector<std::pair<const String *, const String *>> targetNames;
-
-							if (ApplyRule::GetTargetServices(subex.at(0).get(), targetNames, filter_vars)) {
-								static const auto typeService (Type::GetByName("Service"));
-								static const auto ctypeService (dynamic_cast<ConfigType*>(typeService.get()));
-								targeted = true;
-
-								for (auto name : targetNames) {
-									auto target (ctypeService->GetObject(*name.first + "!" + *name.second));
-
-									if (target) {
-										targets.emplace_back(target);
-									}
-								}
-							}
-						}
+						Type::Ptr ptype = Type::GetByName(type);
+						String lcType = variableName.IsEmpty() ? type.ToLower() : variableName;
+
+						targeted = GetFilterCandidates(subex.at(0).get(), ptype, lcType, filter_vars, targets);
 					}
 				}
 			}
 
 			if (targeted) {
 				for (auto& target : targets) {
-					if (FilterUtility::EvaluateFilter(permissionFrame, permissionFilter.get(), target, variableName)) {
-						result.emplace_back(std::move(target));
-					}
+					FilteredAddTarget(permissionFrame, permissionFilter.get(), frame, ufilter.get(), result, variableName, target);
 				}
 			} else {
-				if (filter_vars) {
-					ObjectLock olock (filter_vars);
-
-					for (auto& kv : filter_vars) {
-						frameNS->Set(kv.first, kv.second);
-					}
-				}
-
 				provider->FindTargets(type, [&permissionFrame, &permissionFilter, &frame, &ufilter, &result, variableName](const Object::Ptr& target) {
-					FilteredAddTarget(permissionFrame, permissionFilter.get(), frame, &*ufilter, result, variableName, target);
+					FilteredAddTarget(permissionFrame, permissionFilter.get(), frame, ufilter.get(), result, variableName, target);
 				});
 			}
 		} else {
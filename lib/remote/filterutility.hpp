@@ -8,7 +8,13 @@
 #include "config/expression.hpp"
 #include "base/dictionary.hpp"
 #include "base/configobject.hpp"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
 namespace icinga
 {
@@ -42,6 +48,37 @@ struct QueryDescription
 	String Permission;
 };
 
+/**
+ * Lazily built lookup tables of config objects by the string value of one of their attributes
+ * (e.g. "name" or "vars" + custom var key), used to narrow down the candidates of API filters.
+ *
+ * All tables are dropped as soon as objects are (de)activated or their custom vars change.
+ *
+ * @ingroup remote
+ */
+class FilterIndex
+{
+public:
+	static bool Lookup(const Type::Ptr& type, const String& field, const String& key,
+		const String& value, std::vector<ConfigObject::Ptr>& objects);
+	static bool Match(const Type::Ptr& type, const String& field, const String& key,
+		const String& pattern, std::vector<ConfigObject::Ptr>& objects);
+	static void Invalidate();
+
+private:
+	struct Index
+	{
+		uint_fast64_t Generation;
+		std::unordered_map<String, std::vector<ConfigObject::Ptr>> Objects;
+	};
+
+	static std::mutex m_Mutex;
+	static std::map<String, Index> m_Indices;
+	static std::atomic<uint_fast64_t> m_Generation;
+
+	static const Index *GetIndex(const Type::Ptr& type, const String& field, const String& key);
+};
+
 /**
  * Filter utilities.
  *
@@ -57,6 +94,7 @@ public:
 		const ApiUser::Ptr& user, const String& variableName = String());
 	static bool EvaluateFilter(ScriptFrame& frame, Expression *filter,
 		const Object::Ptr& target, const String& variableName = String());
+	static Expression::Ptr CompileFilter(const String& filter);
 };
 
 }
@@ -5,6 +5,7 @@
 #include "remote/httputility.hpp"
 #include "base/singleton.hpp"
 #include "base/exception.hpp"
+#include "base/profiler.hpp"
 #include <boost/algorithm/string/join.hpp>
 #include <boost/beast/http.hpp>
 
@@ -44,6 +45,8 @@ void HttpHandler::Register(const Url::Ptr& url, const HttpHandler::Ptr& handler)
 	}
 
 	handlers->Add(handler);
+
+	handler->m_RegisteredUrl = "/" + boost::algorithm::join(url->GetPath(), "/");
 }
 
 void HttpHandler::ProcessRequest(
@@ -108,6 +111,13 @@ void HttpHandler::ProcessRequest(
 	 */
 	try {
 		for (const HttpHandler::Ptr& handler : handlers) {
+			String spanName;
+
+			if (Profiler::IsActive())
+				spanName = std::string(boost::beast::http::to_string(request.method())) + " " + handler->m_RegisteredUrl;
+
+			ProfilerScope span ("http", spanName);
+
 			if (handler->HandleRequest(stream, user, request, url, response, params, yc, server)) {
 				processed = true;
 				break;
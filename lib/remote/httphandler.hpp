@@ -49,6 +49,8 @@ public:
 
 private:
 	static Dictionary::Ptr m_UrlTree;
+
+	String m_RegisteredUrl; /**< Names the spans of the profiler, unlike the requested URLs its number is bounded. */
 };
 
 /**
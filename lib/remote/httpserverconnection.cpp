@@ -6,6 +6,7 @@
 #include "remote/apilistener.hpp"
 #include "remote/apifunction.hpp"
 #include "remote/jsonrpc.hpp"
+#include "remote/metricshandler.hpp"
 #include "base/application.hpp"
 #include "base/base64.hpp"
 #include "base/convert.hpp"
@@ -18,6 +19,7 @@
 #include "base/timer.hpp"
 #include "base/tlsstream.hpp"
 #include "base/utility.hpp"
+#include <algorithm>
 #include <chrono>
 #include <limits>
 #include <memory>
@@ -35,6 +37,9 @@ using namespace icinga;
 
 auto const l_ServerHeader ("Icinga/" + Application::GetAppVersion());
 
+/* Upper bound for responses to pipelined requests which are buffered before they're flushed. */
+static const size_t l_MaxUnflushedResponses = 16;
+
 HttpServerConnection::HttpServerConnection(const String& identity, bool authenticated, const Shared<AsioTlsStream>::Ptr& stream)
 	: HttpServerConnection(identity, authenticated, stream, IoEngine::Get().GetIoContext())
 {
@@ -348,7 +353,7 @@ bool EnsureValidBody(
 		Array::Ptr permissions = authenticatedUser->GetPermissions();
 
 		if (permissions) {
-			CpuBoundWork evalPermissions (yc);
+			CpuBoundWork evalPermissions (yc, CpuBoundPriority::Low);
 
 			ObjectLock olock(permissions);
 
@@ -430,13 +435,14 @@ bool ProcessRequest(
 	boost::beast::http::response<boost::beast::http::string_body>& response,
 	HttpServerConnection& server,
 	bool& hasStartedStreaming,
+	bool flush,
 	boost::asio::yield_context& yc
 )
 {
 	namespace http = boost::beast::http;
 
 	try {
-		CpuBoundWork handlingRequest (yc);
+		CpuBoundWork handlingRequest (yc, CpuBoundPriority::Low);
 
 		HttpHandler::ProcessRequest(stream, authenticatedUser, request, response, yc, server);
 	} catch (const std::exception& ex) {
@@ -465,11 +471,32 @@ bool ProcessRequest(
 	}
 
 	http::async_write(stream, response, yc);
-	stream.async_flush(yc);
+
+	if (flush) {
+		stream.async_flush(yc);
+	}
 
 	return true;
 }
 
+/**
+ * Checks whether the client has already sent (at least) the header of another request.
+ *
+ * Pipelining clients don't wait for responses, so the response to the current request
+ * may stay in the TLS stream's buffer and be flushed together with the next ones.
+ */
+static inline
+bool HasPipelinedRequest(const boost::beast::flat_buffer& buf)
+{
+	static const char headerEnd[] = "\r\n\r\n";
+
+	auto data (buf.data());
+	auto begin (static_cast<const char*>(data.data()));
+	auto end (begin + data.size());
+
+	return std::search(begin, end, headerEnd, headerEnd + sizeof(headerEnd) - 1) != end;
+}
+
 void HttpServerConnection::ProcessMessages(boost::asio::yield_context yc)
 {
 	namespace beast = boost::beast;
@@ -483,6 +510,7 @@ void HttpServerConnection::ProcessMessages(boost::asio::yield_context yc)
 		 * and needs the full buffer.
 		 */
 		beast::flat_buffer buf;
+		size_t unflushedResponses = 0;
 
 		for (;;) {
 			m_Seen = Utility::GetTime();
@@ -520,6 +548,11 @@ void HttpServerConnection::ProcessMessages(boost::asio::yield_context yc)
 				authenticatedUser = ApiUser::GetByAuthHeader(std::string(request[http::field::authorization]));
 			}
 
+			/* Allows scrapers without credentials, if enabled. */
+			if (!authenticatedUser) {
+				authenticatedUser = MetricsHandler::GetAnonymousUser(request);
+			}
+
 			Log logMsg (LogInformation, "HttpServerConnection");
 
 			logMsg << "Request " << request.method_string() << ' ' << request.target()
@@ -550,14 +583,27 @@ void HttpServerConnection::ProcessMessages(boost::asio::yield_context yc)
 
 			m_Seen = std::numeric_limits<decltype(m_Seen)>::max();
 
-			if (!ProcessRequest(*m_Stream, request, authenticatedUser, response, *this, m_HasStartedStreaming, yc)) {
+			bool keepAlive = request.version() == 11 && request[http::field::connection] != "close";
+			bool flush = !keepAlive || ++unflushedResponses >= l_MaxUnflushedResponses || !HasPipelinedRequest(buf);
+
+			if (!ProcessRequest(*m_Stream, request, authenticatedUser, response, *this, m_HasStartedStreaming, flush, yc)) {
 				break;
 			}
 
-			if (request.version() != 11 || request[http::field::connection] == "close") {
+			if (flush) {
+				unflushedResponses = 0;
+			}
+
+			if (!keepAlive) {
 				break;
 			}
 		}
+
+		if (unflushedResponses && !m_HasStartedStreaming) {
+			/* The client may have closed its sending side right after pipelining its last request. */
+			boost::system::error_code ec;
+			m_Stream->async_flush(yc[ec]);
+		}
 	} catch (const std::exception& ex) {
 		if (!m_ShuttingDown) {
 			Log(LogWarning, "HttpServerConnection")
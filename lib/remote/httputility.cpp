@@ -2,11 +2,14 @@
 
 #include "remote/httputility.hpp"
 #include "remote/url.hpp"
+#include "base/io-engine.hpp"
 #include "base/json.hpp"
 #include "base/logger.hpp"
+#include "base/objectlock.hpp"
 #include <map>
 #include <string>
 #include <vector>
+#include <boost/asio/write.hpp>
 #include <boost/beast/http.hpp>
 
 using namespace icinga;
@@ -57,10 +60,122 @@ void HttpUtility::SendJsonBody(boost::beast::http::response<boost::beast::http::
 	namespace http = boost::beast::http;
 
 	response.set(http::field::content_type, "application/json");
-	response.body() = JsonEncode(val, params && GetLastParameter(params, "pretty"));
+	response.body() = std::move(JsonEncode(val, params && GetLastParameter(params, "pretty")).GetData());
 	response.content_length(response.body().size());
 }
 
+static const size_t l_MaxJsonResultsBuffer = 1024 * 1024;
+
+/**
+ * Sends {"results": [...]} just like SendJsonBody(), but takes the results one by one from the given
+ * function and doesn't keep much more than l_MaxJsonResultsBuffer bytes of JSON in memory. Larger responses
+ * are sent chunked (and the connection is closed afterwards). Every result is freed once encoded.
+ * Pretty-printed responses are built completely before being sent.
+ *
+ * Exceptions of nextResult are passed on. Once streaming has started, the connection is closed
+ * without finishing the response.
+ *
+ * @param nextResult Sets its argument to the next result and returns true, returns false if there are no more
+ * @param extra Further attributes of the response next to "results", e.g. a cursor for the next page
+ */
+void HttpUtility::SendJsonResults(AsioTlsStream& stream, boost::beast::http::response<boost::beast::http::string_body>& response,
+	const Dictionary::Ptr& params, const std::function<bool(Value&)>& nextResult, boost::asio::yield_context& yc,
+	HttpServerConnection& server, const Dictionary::Ptr& extra)
+{
+	namespace asio = boost::asio;
+	namespace http = boost::beast::http;
+
+	Value result;
+
+	if (params && GetLastParameter(params, "pretty")) {
+		ArrayData results;
+
+		while (nextResult(result)) {
+			results.emplace_back(std::move(result));
+		}
+
+		Dictionary::Ptr body = new Dictionary({
+			{ "results", new Array(std::move(results)) }
+		});
+
+		if (extra) {
+			extra->CopyTo(body);
+		}
+
+		SendJsonBody(response, params, body);
+
+		return;
+	}
+
+	std::string buffer ("{\"results\":[");
+	bool streaming = false;
+
+	for (bool first = true; nextResult(result); first = false) {
+		if (!first) {
+			buffer += ',';
+		}
+
+		buffer += JsonEncode(result).GetData();
+		result = Empty;
+
+		if (buffer.size() < l_MaxJsonResultsBuffer) {
+			continue;
+		}
+
+		if (!streaming) {
+			server.StartStreaming();
+			streaming = true;
+
+			response.set(http::field::content_type, "application/json");
+			response.set(http::field::connection, "close");
+			response.chunked(true);
+
+			http::response_serializer<http::string_body> serializer (response);
+
+			IoBoundWorkSlot dontLockTheIoThread (yc, CpuBoundPriority::Low);
+
+			http::async_write_header(stream, serializer, yc);
+		}
+
+		{
+			IoBoundWorkSlot dontLockTheIoThread (yc, CpuBoundPriority::Low);
+
+			asio::async_write(stream, http::make_chunk(asio::buffer(buffer)), yc);
+		}
+
+		buffer.clear();
+	}
+
+	buffer += ']';
+
+	if (extra) {
+		ObjectLock olock (extra);
+
+		for (auto& kv : extra) {
+			buffer += ',';
+			buffer += JsonEncode(kv.first).GetData();
+			buffer += ':';
+			buffer += JsonEncode(kv.second).GetData();
+		}
+	}
+
+	buffer += '}';
+
+	if (!streaming) {
+		response.set(http::field::content_type, "application/json");
+		response.body() = std::move(buffer);
+		response.content_length(response.body().size());
+
+		return;
+	}
+
+	IoBoundWorkSlot dontLockTheIoThread (yc, CpuBoundPriority::Low);
+
+	asio::async_write(stream, http::make_chunk(asio::buffer(buffer)), yc);
+	asio::async_write(stream, http::make_chunk_last(), yc);
+	stream.async_flush(yc);
+}
+
 void HttpUtility::SendJsonError(boost::beast::http::response<boost::beast::http::string_body>& response,
 	const Dictionary::Ptr& params, int code, const String& info, const String& diagnosticInformation)
 {
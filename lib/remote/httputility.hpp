@@ -4,8 +4,13 @@
 #define HTTPUTILITY_H
 
 #include "remote/url.hpp"
+#include "remote/httpserverconnection.hpp"
+#include "base/array.hpp"
 #include "base/dictionary.hpp"
+#include "base/tlsstream.hpp"
+#include <boost/asio/spawn.hpp>
 #include <boost/beast/http.hpp>
+#include <functional>
 #include <string>
 
 namespace icinga
@@ -24,6 +29,9 @@ public:
 	static Value GetLastParameter(const Dictionary::Ptr& params, const String& key);
 
 	static void SendJsonBody(boost::beast::http::response<boost::beast::http::string_body>& response, const Dictionary::Ptr& params, const Value& val);
+	static void SendJsonResults(AsioTlsStream& stream, boost::beast::http::response<boost::beast::http::string_body>& response,
+		const Dictionary::Ptr& params, const std::function<bool(Value&)>& nextResult, boost::asio::yield_context& yc,
+		HttpServerConnection& server, const Dictionary::Ptr& extra = nullptr);
 	static void SendJsonError(boost::beast::http::response<boost::beast::http::string_body>& response, const Dictionary::Ptr& params, const int code,
 		const String& verbose = String(), const String& diagnosticInformation = String());
 };
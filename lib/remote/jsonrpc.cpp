@@ -14,6 +14,29 @@
 
 using namespace icinga;
 
+/**
+ * Whether a received message is MessagePack encoded rather than JSON.
+ *
+ * Every message is a map. JSON messages start with '{' (or whitespace), while MessagePack maps
+ * start with a byte of 0x80 - 0x8f, 0xde or 0xdf. So both encodings can always be told apart.
+ */
+static inline
+bool IsBinaryMessage(const char *message, size_t length)
+{
+	if (!length)
+		return false;
+
+	auto first ((unsigned char)message[0]);
+
+	return (first >= 0x80 && first <= 0x8f) || first == 0xde || first == 0xdf;
+}
+
+static inline
+bool IsBinaryMessage(const String& message)
+{
+	return IsBinaryMessage(message.CStr(), message.GetLength());
+}
+
 #ifdef I2_DEBUG
 /**
  * Determine whether the developer wants to see raw JSON messages.
@@ -89,12 +112,52 @@ size_t JsonRpc::SendRawMessage(const Shared<AsioTlsStream>::Ptr& stream, const S
 {
 #ifdef I2_DEBUG
 	if (GetDebugJsonRpcCached())
-		std::cerr << ConsoleColorTag(Console_ForegroundBlue) << ">> " << json << ConsoleColorTag(Console_Normal) << "\n";
+		std::cerr << ConsoleColorTag(Console_ForegroundBlue) << ">> "
+			<< (IsBinaryMessage(json) ? JsonEncode(MsgPackDecode(json)) : json) << ConsoleColorTag(Console_Normal) << "\n";
+#endif /* I2_DEBUG */
+
+	return NetString::WriteStringToStream(stream, json, yc);
+}
+
+/**
+ * Sends a raw message to the connected peer, bypassing the write buffer of the TLS stream.
+ *
+ * @param stream The TLS layer below AsioTlsStream, its buffer must have been flushed
+ * @param json message
+ * @param yc Yield context required for ASIO
+ *
+ * @return bytes sent
+ */
+size_t JsonRpc::SendRawMessage(UnbufferedAsioTlsStream& stream, const String& json, boost::asio::yield_context yc)
+{
+#ifdef I2_DEBUG
+	if (GetDebugJsonRpcCached())
+		std::cerr << ConsoleColorTag(Console_ForegroundBlue) << ">> "
+			<< (IsBinaryMessage(json) ? JsonEncode(MsgPackDecode(json)) : json) << ConsoleColorTag(Console_Normal) << "\n";
 #endif /* I2_DEBUG */
 
 	return NetString::WriteStringToStream(stream, json, yc);
 }
 
+/**
+ * Appends a raw message to a buffer, for sending multiple messages at once.
+ *
+ * @param buffer Data to be sent
+ * @param json message
+ *
+ * @return bytes appended
+ */
+size_t JsonRpc::AppendRawMessage(std::string& buffer, const String& json)
+{
+#ifdef I2_DEBUG
+	if (GetDebugJsonRpcCached())
+		std::cerr << ConsoleColorTag(Console_ForegroundBlue) << ">> "
+			<< (IsBinaryMessage(json) ? JsonEncode(MsgPackDecode(json)) : json) << ConsoleColorTag(Console_Normal) << "\n";
+#endif /* I2_DEBUG */
+
+	return NetString::WriteStringToBuffer(buffer, json);
+}
+
 /**
  * Reads a message from the connected peer.
  *
@@ -110,7 +173,8 @@ String JsonRpc::ReadMessage(const Shared<AsioTlsStream>::Ptr& stream, ssize_t ma
 
 #ifdef I2_DEBUG
 	if (GetDebugJsonRpcCached())
-		std::cerr << ConsoleColorTag(Console_ForegroundBlue) << "<< " << jsonString << ConsoleColorTag(Console_Normal) << "\n";
+		std::cerr << ConsoleColorTag(Console_ForegroundBlue) << "<< "
+			<< (IsBinaryMessage(jsonString) ? JsonEncode(MsgPackDecode(jsonString)) : jsonString) << ConsoleColorTag(Console_Normal) << "\n";
 #endif /* I2_DEBUG */
 
 	return jsonString;
@@ -131,22 +195,74 @@ String JsonRpc::ReadMessage(const Shared<AsioTlsStream>::Ptr& stream, boost::asi
 
 #ifdef I2_DEBUG
 	if (GetDebugJsonRpcCached())
-		std::cerr << ConsoleColorTag(Console_ForegroundBlue) << "<< " << jsonString << ConsoleColorTag(Console_Normal) << "\n";
+		std::cerr << ConsoleColorTag(Console_ForegroundBlue) << "<< "
+			<< (IsBinaryMessage(jsonString) ? JsonEncode(MsgPackDecode(jsonString)) : jsonString) << ConsoleColorTag(Console_Normal) << "\n";
 #endif /* I2_DEBUG */
 
 	return jsonString;
 }
 
+/**
+ * Reads a message from the connected peer into the given reader's buffer.
+ *
+ * @param reader The connection's reader
+ * @param stream ASIO TLS Stream
+ * @param yc Yield Context for ASIO
+ * @param maxMessageLength maximum size of bytes read.
+ *
+ * @return A JSON or MessagePack string, valid until the next read
+ */
+boost::string_view JsonRpc::ReadMessage(NetStringReader& reader, const Shared<AsioTlsStream>::Ptr& stream,
+	boost::asio::yield_context yc, ssize_t maxMessageLength)
+{
+	boost::string_view message = reader.Read(stream, yc, maxMessageLength);
+
+#ifdef I2_DEBUG
+	if (GetDebugJsonRpcCached())
+		std::cerr << ConsoleColorTag(Console_ForegroundBlue) << "<< "
+			<< (IsBinaryMessage(message.data(), message.size()) ? JsonEncode(MsgPackDecode(message.data(), message.size())) : String(message.begin(), message.end()))
+			<< ConsoleColorTag(Console_Normal) << "\n";
+#endif /* I2_DEBUG */
+
+	return message;
+}
+
+/**
+ * Encode message for sending it via SendRawMessage()
+ *
+ * @param message Dictionary ptr
+ * @param binary Use MessagePack instead of JSON, only if the peer has ApiCapabilities::BinaryJsonRpc
+ *
+ * @return Encoded message
+ */
+String JsonRpc::EncodeMessage(const Dictionary::Ptr& message, bool binary)
+{
+	return binary ? MsgPackEncode(message) : JsonEncode(message);
+}
+
 /**
  * Decode message, enforce a Dictionary
  *
- * @param message JSON string
+ * @param message JSON or MessagePack string
  *
  * @return Dictionary ptr
  */
 Dictionary::Ptr JsonRpc::DecodeMessage(const String& message)
 {
-	Value value = JsonDecode(message);
+	return DecodeMessage(message.CStr(), message.GetLength());
+}
+
+/**
+ * Decode message, enforce a Dictionary
+ *
+ * @param message JSON or MessagePack string, e.g. a view into a NetStringReader's buffer
+ * @param length Length of the message
+ *
+ * @return Dictionary ptr
+ */
+Dictionary::Ptr JsonRpc::DecodeMessage(const char *message, size_t length)
+{
+	Value value = IsBinaryMessage(message, length) ? MsgPackDecode(message, length) : JsonDecode(message, length);
 
 	if (!value.IsObjectType<Dictionary>()) {
 		BOOST_THROW_EXCEPTION(std::invalid_argument("JSON-RPC"
@@ -155,3 +271,36 @@ Dictionary::Ptr JsonRpc::DecodeMessage(const String& message)
 
 	return value;
 }
+
+/**
+ * @param encodes Incremented on every actual encoding, e.g. for statistics
+ */
+SharedMessage::SharedMessage(Dictionary::Ptr message, std::atomic<uint_fast64_t>* encodes)
+	: m_Message(std::move(message)), m_Encodes(encodes)
+{
+}
+
+const Dictionary::Ptr& SharedMessage::GetMessage() const
+{
+	return m_Message;
+}
+
+/**
+ * Encode the message on first use
+ *
+ * @param binary Use MessagePack instead of JSON, see JsonRpc::EncodeMessage()
+ *
+ * @return Encoded message
+ */
+std::shared_ptr<const String> SharedMessage::GetEncoded(bool binary)
+{
+	std::call_once(m_EncodedOnce[binary], [this, binary]() {
+		m_Encoded[binary] = std::make_shared<const String>(JsonRpc::EncodeMessage(m_Message, binary));
+
+		if (m_Encodes) {
+			++*m_Encodes;
+		}
+	});
+
+	return m_Encoded[binary];
+}
@@ -5,10 +5,16 @@
 
 #include "base/stream.hpp"
 #include "base/dictionary.hpp"
+#include "base/netstring.hpp"
 #include "base/tlsstream.hpp"
 #include "remote/i2-remote.hpp"
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <boost/asio/spawn.hpp>
+#include <boost/utility/string_view.hpp>
 
 namespace icinga
 {
@@ -24,16 +30,47 @@ public:
 	static size_t SendMessage(const Shared<AsioTlsStream>::Ptr& stream, const Dictionary::Ptr& message);
 	static size_t SendMessage(const Shared<AsioTlsStream>::Ptr& stream, const Dictionary::Ptr& message, boost::asio::yield_context yc);
 	static size_t SendRawMessage(const Shared<AsioTlsStream>::Ptr& stream, const String& json, boost::asio::yield_context yc);
+	static size_t SendRawMessage(UnbufferedAsioTlsStream& stream, const String& json, boost::asio::yield_context yc);
+	static size_t AppendRawMessage(std::string& buffer, const String& json);
 
 	static String ReadMessage(const Shared<AsioTlsStream>::Ptr& stream, ssize_t maxMessageLength = -1);
 	static String ReadMessage(const Shared<AsioTlsStream>::Ptr& stream, boost::asio::yield_context yc, ssize_t maxMessageLength = -1);
+	static boost::string_view ReadMessage(NetStringReader& reader, const Shared<AsioTlsStream>::Ptr& stream,
+		boost::asio::yield_context yc, ssize_t maxMessageLength = -1);
 
+	static String EncodeMessage(const Dictionary::Ptr& message, bool binary = false);
 	static Dictionary::Ptr DecodeMessage(const String& message);
+	static Dictionary::Ptr DecodeMessage(const char *message, size_t length);
 
 private:
 	JsonRpc();
 };
 
+/**
+ * A message sent to multiple peers, e.g. relayed to several zones and persisted in the replay log.
+ *
+ * It's encoded on demand, but only once per encoding. All peers share the result.
+ * The message must not be modified once wrapped.
+ *
+ * @ingroup remote
+ */
+class SharedMessage final : public Object
+{
+public:
+	DECLARE_PTR_TYPEDEFS(SharedMessage);
+
+	explicit SharedMessage(Dictionary::Ptr message, std::atomic<uint_fast64_t>* encodes = nullptr);
+
+	const Dictionary::Ptr& GetMessage() const;
+	std::shared_ptr<const String> GetEncoded(bool binary = false);
+
+private:
+	Dictionary::Ptr m_Message;
+	std::atomic<uint_fast64_t>* m_Encodes;
+	std::once_flag m_EncodedOnce[2];
+	std::shared_ptr<const String> m_Encoded[2];
+};
+
 }
 
 #endif /* JSONRPC_H */
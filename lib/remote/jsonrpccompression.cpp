@@ -0,0 +1,141 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "remote/jsonrpccompression.hpp"
+#include "base/exception.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace icinga;
+
+/**
+ * Precedes every compressed message. Neither a JSON nor a MessagePack message starts with it.
+ */
+static const char l_DeflatedMessageMarker = '\0';
+
+static const size_t l_ZlibChunkSize = 16 * 1024;
+
+JsonRpcDeflater::JsonRpcDeflater(int level)
+{
+	memset(&m_Stream, 0, sizeof(m_Stream));
+
+	/* Negative window bits: raw deflate without zlib header and checksum, TLS takes care of integrity. */
+	if (deflateInit2(&m_Stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		BOOST_THROW_EXCEPTION(std::runtime_error("Failed to initialize the JSON-RPC message compression"));
+	}
+}
+
+JsonRpcDeflater::~JsonRpcDeflater()
+{
+	(void)deflateEnd(&m_Stream);
+}
+
+/**
+ * Compresses the given message.
+ *
+ * @param message JSON or MessagePack encoded message
+ *
+ * @return The message to send instead
+ */
+String JsonRpcDeflater::Deflate(const String& message)
+{
+	std::string result (1, l_DeflatedMessageMarker);
+	char buf[l_ZlibChunkSize];
+
+	m_Stream.next_in = (Bytef*)message.CStr();
+	m_Stream.avail_in = message.GetLength();
+
+	do {
+		m_Stream.next_out = (Bytef*)buf;
+		m_Stream.avail_out = sizeof(buf);
+
+		int rc = deflate(&m_Stream, Z_SYNC_FLUSH);
+
+		if (rc != Z_OK && rc != Z_BUF_ERROR) {
+			BOOST_THROW_EXCEPTION(std::runtime_error("Failed to compress JSON-RPC message"));
+		}
+
+		result.append(buf, sizeof(buf) - m_Stream.avail_out);
+	} while (m_Stream.avail_out == 0u);
+
+	return String(std::move(result));
+}
+
+JsonRpcInflater::JsonRpcInflater()
+{
+	memset(&m_Stream, 0, sizeof(m_Stream));
+
+	if (inflateInit2(&m_Stream, -MAX_WBITS) != Z_OK) {
+		BOOST_THROW_EXCEPTION(std::runtime_error("Failed to initialize the JSON-RPC message decompression"));
+	}
+}
+
+JsonRpcInflater::~JsonRpcInflater()
+{
+	(void)inflateEnd(&m_Stream);
+}
+
+/**
+ * Checks whether the given message has been compressed by a JsonRpcDeflater.
+ */
+bool JsonRpcInflater::IsDeflated(const String& message)
+{
+	return IsDeflated(message.CStr(), message.GetLength());
+}
+
+bool JsonRpcInflater::IsDeflated(const char *message, size_t length)
+{
+	return length && message[0] == l_DeflatedMessageMarker;
+}
+
+/**
+ * Decompresses the given message.
+ *
+ * @param message Message for which IsDeflated() is true
+ * @param maxMessageLength Limit for the decompressed message, -1 for none
+ *
+ * @return JSON or MessagePack encoded message
+ */
+String JsonRpcInflater::Inflate(const String& message, ssize_t maxMessageLength)
+{
+	return Inflate(message.CStr(), message.GetLength(), maxMessageLength);
+}
+
+/**
+ * Decompresses the given message, e.g. a view into a NetStringReader's buffer.
+ *
+ * @param message Message for which IsDeflated() is true
+ * @param length Length of the message
+ * @param maxMessageLength Limit for the decompressed message, -1 for none
+ *
+ * @return JSON or MessagePack encoded message
+ */
+String JsonRpcInflater::Inflate(const char *message, size_t length, ssize_t maxMessageLength)
+{
+	std::string result;
+	char buf[l_ZlibChunkSize];
+
+	m_Stream.next_in = (Bytef*)message + 1;
+	m_Stream.avail_in = length - 1u;
+
+	do {
+		m_Stream.next_out = (Bytef*)buf;
+		m_Stream.avail_out = sizeof(buf);
+
+		int rc = inflate(&m_Stream, Z_SYNC_FLUSH);
+
+		if (rc != Z_OK && rc != Z_BUF_ERROR) {
+			BOOST_THROW_EXCEPTION(std::runtime_error(std::string("Failed to decompress JSON-RPC message: ")
+				+ (m_Stream.msg ? m_Stream.msg : "unexpected end of stream")));
+		}
+
+		result.append(buf, sizeof(buf) - m_Stream.avail_out);
+
+		if (maxMessageLength >= 0 && result.size() > (size_t)maxMessageLength) {
+			BOOST_THROW_EXCEPTION(std::invalid_argument("Decompressed JSON-RPC message exceeds the maximum length of "
+				+ std::to_string(maxMessageLength) + " bytes"));
+		}
+	} while (m_Stream.avail_out == 0u);
+
+	return String(std::move(result));
+}
@@ -0,0 +1,62 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef JSONRPCCOMPRESSION_H
+#define JSONRPCCOMPRESSION_H
+
+#include "remote/i2-remote.hpp"
+#include "base/string.hpp"
+#include <sys/types.h>
+#include <zlib.h>
+
+namespace icinga
+{
+
+/**
+ * Compresses the messages sent over one JSON-RPC connection.
+ *
+ * All messages share one raw deflate stream which is flushed after each message.
+ * So every message may reference the previous ones, e.g. repeated object names and attributes
+ * of a config sync, and is still decompressible as soon as it has been received.
+ *
+ * @ingroup remote
+ */
+class JsonRpcDeflater
+{
+public:
+	explicit JsonRpcDeflater(int level);
+	JsonRpcDeflater(const JsonRpcDeflater&) = delete;
+	JsonRpcDeflater& operator=(const JsonRpcDeflater&) = delete;
+	~JsonRpcDeflater();
+
+	String Deflate(const String& message);
+
+private:
+	z_stream m_Stream;
+};
+
+/**
+ * Decompresses the messages compressed by the JsonRpcDeflater of the peer, in the same order.
+ *
+ * @ingroup remote
+ */
+class JsonRpcInflater
+{
+public:
+	JsonRpcInflater();
+	JsonRpcInflater(const JsonRpcInflater&) = delete;
+	JsonRpcInflater& operator=(const JsonRpcInflater&) = delete;
+	~JsonRpcInflater();
+
+	static bool IsDeflated(const String& message);
+	static bool IsDeflated(const char *message, size_t length);
+
+	String Inflate(const String& message, ssize_t maxMessageLength = -1);
+	String Inflate(const char *message, size_t length, ssize_t maxMessageLength = -1);
+
+private:
+	z_stream m_Stream;
+};
+
+}
+
+#endif /* JSONRPCCOMPRESSION_H */
@@ -6,18 +6,29 @@
 #include "remote/jsonrpc.hpp"
 #include "base/defer.hpp"
 #include "base/configtype.hpp"
+#include "base/configuration.hpp"
 #include "base/io-engine.hpp"
 #include "base/json.hpp"
+#include "base/memoryusage.hpp"
+#include "base/profiler.hpp"
+#include "base/shardedringbuffer.hpp"
 #include "base/objectlock.hpp"
 #include "base/utility.hpp"
 #include "base/logger.hpp"
 #include "base/exception.hpp"
 #include "base/convert.hpp"
 #include "base/tlsstream.hpp"
+#include <algorithm>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <string>
 #include <utility>
+#include <vector>
+#include <boost/asio/buffer.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/spawn.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/date_time/posix_time/posix_time_duration.hpp>
 #include <boost/system/system_error.hpp>
 #include <boost/thread/once.hpp>
@@ -27,7 +38,49 @@ using namespace icinga;
 static Value SetLogPositionHandler(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& params);
 REGISTER_APIFUNCTION(SetLogPosition, log, &SetLogPositionHandler);
 
-static RingBuffer l_TaskStats (15 * 60);
+static ShardedRingBuffer l_TaskStats (15 * 60);
+static ShardedRingBuffer l_WriteStats (60);
+static ShardedRingBuffer l_WrittenMessagesStats (60);
+static ShardedRingBuffer l_WrittenBytesStats (60);
+
+/* Messages are coalesced into writes of up to four full TLS records,
+ * bigger ones are written on their own without copying them. */
+static const size_t l_MaxWriteSize = 64 * 1024;
+
+/* Heartbeats may jump the queue after this many bytes written. */
+static const size_t l_MaxWriteRoundSize = 1024 * 1024;
+
+/* Bulk senders like the replay log wait while more than this is queued for the peer... */
+static const size_t l_SendCredit = 32 * 1024 * 1024;
+
+/* ...and a peer which doesn't even keep up with the rest is disconnected at this point. */
+static const size_t l_MaxQueuedBytes = 1024 * 1024 * 1024;
+
+/* Stop reading from a peer while this many of its messages are still being processed in parallel. */
+static const size_t l_MaxInFlightMessages = 1024;
+
+/* The outgoing messages per connection. */
+REGISTER_MEMORY_USAGE_REPORTER("jsonrpc_queues", [](std::vector<MemoryUsageEntry>& entries) {
+	std::set<JsonRpcConnection::Ptr> clients;
+
+	for (auto& endpoint : ConfigType::GetObjectsByType<Endpoint>()) {
+		for (auto& client : endpoint->GetClients()) {
+			clients.emplace(client);
+		}
+	}
+
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (listener) {
+		for (auto& client : listener->GetAnonymousClients()) {
+			clients.emplace(client);
+		}
+	}
+
+	for (auto& client : clients) {
+		entries.push_back({ client->GetIdentity(), client->GetQueuedMessages(), client->GetQueuedBytes() });
+	}
+});
 
 JsonRpcConnection::JsonRpcConnection(const String& identity, bool authenticated,
 	const Shared<AsioTlsStream>::Ptr& stream, ConnectionRole role)
@@ -39,7 +92,7 @@ JsonRpcConnection::JsonRpcConnection(const String& identity, bool authenticated,
 	const Shared<AsioTlsStream>::Ptr& stream, ConnectionRole role, boost::asio::io_context& io)
 	: m_Identity(identity), m_Authenticated(authenticated), m_Stream(stream), m_Role(role),
 	m_Timestamp(Utility::GetTime()), m_Seen(Utility::GetTime()), m_NextHeartbeat(0), m_IoStrand(io),
-	m_OutgoingMessagesQueued(io), m_WriterDone(io), m_ShuttingDown(false),
+	m_OutgoingMessagesQueued(io), m_WriterDone(io), m_ShuttingDown(false), m_InFlightMessagesDecreased(io),
 	m_CheckLivenessTimer(io), m_HeartbeatTimer(io)
 {
 	if (authenticated)
@@ -63,10 +116,10 @@ void JsonRpcConnection::HandleIncomingMessages(boost::asio::yield_context yc)
 	m_Stream->next_layer().SetSeen(&m_Seen);
 
 	for (;;) {
-		String message;
+		boost::string_view message;
 
 		try {
-			message = JsonRpc::ReadMessage(m_Stream, yc, m_Endpoint ? -1 : 1024 * 1024);
+			message = JsonRpc::ReadMessage(m_Reader, m_Stream, yc, m_Endpoint ? -1 : 1024 * 1024);
 		} catch (const std::exception& ex) {
 			Log(m_ShuttingDown ? LogDebug : LogNotice, "JsonRpcConnection")
 				<< "Error while reading JSON-RPC message for identity '" << m_Identity
@@ -78,9 +131,26 @@ void JsonRpcConnection::HandleIncomingMessages(boost::asio::yield_context yc)
 		m_Seen = Utility::GetTime();
 
 		try {
-			CpuBoundWork handleMessage (yc);
+			Dictionary::Ptr decoded;
+			String inflated;
+
+			{
+				CpuBoundWork decodeMessage (yc, CpuBoundPriority::High);
+
+				/* The message is a view into m_Reader's buffer, only the inflated one needs its own. */
+				if (JsonRpcInflater::IsDeflated(message.data(), message.size())) {
+					if (!m_Inflater) {
+						m_Inflater.reset(new JsonRpcInflater());
+					}
+
+					inflated = m_Inflater->Inflate(message.data(), message.size(), m_Endpoint ? -1 : 1024 * 1024);
+					message = boost::string_view(inflated.CStr(), inflated.GetLength());
+				}
 
-			MessageHandler(message);
+				decoded = JsonRpc::DecodeMessage(message.data(), message.size());
+			}
+
+			MessageHandler(decoded, message.size(), yc);
 
 			l_TaskStats.InsertValue(Utility::GetTime(), 1);
 		} catch (const std::exception& ex) {
@@ -97,40 +167,121 @@ void JsonRpcConnection::HandleIncomingMessages(boost::asio::yield_context yc)
 
 void JsonRpcConnection::WriteOutgoingMessages(boost::asio::yield_context yc)
 {
-	Defer signalWriterDone ([this]() { m_WriterDone.Set(); });
+	Defer signalWriterDone ([this]() {
+		m_WriterDone.Set();
 
-	do {
-		m_OutgoingMessagesQueued.Wait(yc);
+		{
+			std::unique_lock<std::mutex> lock (m_SendCreditMutex);
+			m_WriterStopped = true;
+		}
 
-		auto queue (std::move(m_OutgoingMessagesQueue));
+		m_SendCreditCV.notify_all();
+	});
 
-		m_OutgoingMessagesQueue.clear();
+	do {
+		m_OutgoingMessagesQueued.Wait(yc);
 		m_OutgoingMessagesQueued.Clear();
 
-		if (!queue.empty()) {
-			try {
-				for (auto& message : queue) {
-					size_t bytesSent = JsonRpc::SendRawMessage(m_Stream, message, yc);
+		try {
+			/* Write the queue in rounds, so that heartbeats queued meanwhile don't wait for the whole rest of it. */
+			while (!m_ShuttingDown && !(m_OutgoingPriorityMessagesQueue.empty() && m_OutgoingMessagesQueue.empty())) {
+				std::vector<std::shared_ptr<const String>> round (std::move(m_OutgoingPriorityMessagesQueue));
+				size_t roundBytes = 0;
 
-					if (m_Endpoint) {
-						m_Endpoint->AddMessageSent(bytesSent);
-					}
-				}
+				m_OutgoingPriorityMessagesQueue.clear();
 
-				m_Stream->async_flush(yc);
-			} catch (const std::exception& ex) {
-				Log(m_ShuttingDown ? LogDebug : LogWarning, "JsonRpcConnection")
-					<< "Error while sending JSON-RPC message for identity '"
-					<< m_Identity << "'\n" << DiagnosticInformation(ex);
+				while (!m_OutgoingMessagesQueue.empty() && roundBytes < l_MaxWriteRoundSize) {
+					roundBytes += m_OutgoingMessagesQueue.front()->GetLength();
+					round.emplace_back(std::move(m_OutgoingMessagesQueue.front()));
+					m_OutgoingMessagesQueue.pop_front();
+				}
 
-				break;
+				WriteMessages(round, yc);
 			}
+		} catch (const std::exception& ex) {
+			Log(m_ShuttingDown ? LogDebug : LogWarning, "JsonRpcConnection")
+				<< "Error while sending JSON-RPC message for identity '"
+				<< m_Identity << "'\n" << DiagnosticInformation(ex);
+
+			break;
 		}
 	} while (!m_ShuttingDown);
 
 	Disconnect();
 }
 
+void JsonRpcConnection::WriteMessages(const std::vector<std::shared_ptr<const String>>& messages, boost::asio::yield_context yc)
+{
+	std::string buffer;
+	size_t bufferedMessages = 0;
+
+	auto writeBuffer ([this, &buffer, &bufferedMessages, &yc]() {
+		if (!buffer.empty()) {
+			boost::asio::async_write(m_Stream->next_layer(), boost::asio::buffer(buffer), yc);
+			AddWriteStats(bufferedMessages, buffer.size());
+
+			buffer.clear();
+			bufferedMessages = 0;
+		}
+	});
+
+	/* Write below the stream's own write buffer which would split everything into 1 KiB TLS records.
+	 * Only the icinga::Hello message could be still in there. */
+	m_Stream->async_flush(yc);
+
+	buffer.reserve(l_MaxWriteSize);
+
+	size_t queuedBytes = 0;
+
+	for (auto& encoded : messages) {
+		/* Shared with other connections, hence never modified. */
+		const String* message = encoded.get();
+		String deflated;
+
+		size_t uncompressedLength = message->GetLength();
+		queuedBytes += uncompressedLength;
+
+		if (m_Deflater) {
+			deflated = m_Deflater->Deflate(*message);
+			message = &deflated;
+		}
+
+		size_t bytesSent;
+
+		if (message->GetLength() >= l_MaxWriteSize) {
+			writeBuffer();
+
+			bytesSent = JsonRpc::SendRawMessage(m_Stream->next_layer(), *message, yc);
+			AddWriteStats(1, bytesSent);
+		} else {
+			if (buffer.size() + message->GetLength() > l_MaxWriteSize) {
+				writeBuffer();
+			}
+
+			bytesSent = JsonRpc::AppendRawMessage(buffer, *message);
+			++bufferedMessages;
+		}
+
+		if (m_Endpoint) {
+			m_Endpoint->AddMessageSent(bytesSent);
+
+			if (m_Deflater) {
+				m_Endpoint->AddCompressedMessageSent(uncompressedLength, message->GetLength());
+			}
+		}
+	}
+
+	writeBuffer();
+
+	{
+		std::unique_lock<std::mutex> lock (m_SendCreditMutex);
+		m_QueuedMessages -= messages.size();
+		m_QueuedBytes -= queuedBytes;
+	}
+
+	m_SendCreditCV.notify_all();
+}
+
 double JsonRpcConnection::GetTimestamp() const
 {
 	return m_Timestamp;
@@ -168,20 +319,121 @@ void JsonRpcConnection::SendMessage(const Dictionary::Ptr& message)
 	m_IoStrand.post([this, keepAlive, message]() { SendMessageInternal(message); });
 }
 
+/**
+ * Sends a message which is also sent to other connections.
+ * It's encoded only once for all connections using the same encoding.
+ */
+void JsonRpcConnection::SendMessage(const SharedMessage::Ptr& message)
+{
+	Ptr keepAlive (this);
+
+	m_IoStrand.post([this, keepAlive, message]() { EnqueueMessage(message->GetEncoded(m_BinaryMessages.load())); });
+}
+
 void JsonRpcConnection::SendRawMessage(const String& message)
+{
+	Ptr keepAlive (this);
+	auto encoded (std::make_shared<const String>(message));
+
+	m_IoStrand.post([this, keepAlive, encoded]() { EnqueueMessage(encoded); });
+}
+
+/**
+ * Blocks while a lot of messages are still queued for the peer. Call this between the messages of a bulk transfer
+ * (e.g. log replay) not to buffer all of them in memory at once and not to delay other messages for too long.
+ * Must not be called from within the I/O engine.
+ */
+void JsonRpcConnection::WaitForSendCredit()
+{
+	std::unique_lock<std::mutex> lock (m_SendCreditMutex);
+
+	m_SendCreditCV.wait(lock, [this]() { return m_WriterStopped || m_QueuedBytes <= l_SendCredit; });
+}
+
+/**
+ * @returns The number of messages queued for the peer, but not yet written.
+ */
+size_t JsonRpcConnection::GetQueuedMessages()
+{
+	std::unique_lock<std::mutex> lock (m_SendCreditMutex);
+	return m_QueuedMessages;
+}
+
+/**
+ * @returns The size of the messages queued for the peer. Messages sent to several peers
+ *          share their memory, i.e. they're counted once per connection.
+ */
+size_t JsonRpcConnection::GetQueuedBytes()
+{
+	std::unique_lock<std::mutex> lock (m_SendCreditMutex);
+	return m_QueuedBytes;
+}
+
+/**
+ * Switches the encoding of all messages sent via SendMessage() from now on.
+ * Received messages are always accepted in both encodings.
+ */
+void JsonRpcConnection::SetBinaryMessages(bool binary)
+{
+	m_BinaryMessages.store(binary);
+}
+
+/**
+ * Compresses all messages sent from now on. Only call this if the peer has ApiCapabilities::DeflateJsonRpc.
+ *
+ * @param level zlib compression level, 1 (fastest) - 9 (smallest)
+ */
+void JsonRpcConnection::EnableCompression(int level)
 {
 	Ptr keepAlive (this);
 
-	m_IoStrand.post([this, keepAlive, message]() {
-		m_OutgoingMessagesQueue.emplace_back(message);
-		m_OutgoingMessagesQueued.Set();
+	m_IoStrand.post([this, keepAlive, level]() {
+		if (!m_Deflater) {
+			m_Deflater.reset(new JsonRpcDeflater(level));
+		}
 	});
 }
 
-void JsonRpcConnection::SendMessageInternal(const Dictionary::Ptr& message)
+void JsonRpcConnection::SendMessageInternal(const Dictionary::Ptr& message, bool priority)
 {
-	m_OutgoingMessagesQueue.emplace_back(JsonEncode(message));
+	EnqueueMessage(std::make_shared<const String>(JsonRpc::EncodeMessage(message, m_BinaryMessages.load())), priority);
+}
+
+/**
+ * Queues an encoded message for WriteOutgoingMessages(). Must be called from within m_IoStrand.
+ *
+ * The peer drops messages with a "ts" older than the newest one it got (see MessageHandler()),
+ * so only messages without one (i.e. heartbeats) may have priority over the others.
+ */
+void JsonRpcConnection::EnqueueMessage(std::shared_ptr<const String> message, bool priority)
+{
+	if (m_ShuttingDown) {
+		return;
+	}
+
+	size_t queuedBytes;
+
+	{
+		std::unique_lock<std::mutex> lock (m_SendCreditMutex);
+		++m_QueuedMessages;
+		queuedBytes = m_QueuedBytes += message->GetLength();
+	}
+
+	if (priority) {
+		m_OutgoingPriorityMessagesQueue.emplace_back(std::move(message));
+	} else {
+		m_OutgoingMessagesQueue.emplace_back(std::move(message));
+	}
+
 	m_OutgoingMessagesQueued.Set();
+
+	if (queuedBytes > l_MaxQueuedBytes) {
+		Log(LogWarning, "JsonRpcConnection")
+			<< "Disconnecting API client for identity '" << m_Identity << "': It doesn't keep up with receiving messages ("
+			<< queuedBytes << " bytes queued).";
+
+		Disconnect();
+	}
 }
 
 void JsonRpcConnection::Disconnect()
@@ -204,7 +456,11 @@ void JsonRpcConnection::Disconnect()
 			if (m_Endpoint) {
 				m_Endpoint->RemoveClient(this);
 			} else {
-				ApiListener::GetInstance()->RemoveAnonymousClient(this);
+				/* Connections may be used without an ApiListener, e.g. by the cluster benchmark. */
+				ApiListener::Ptr listener = ApiListener::GetInstance();
+
+				if (listener)
+					listener->RemoveAnonymousClient(this);
 			}
 
 			m_OutgoingMessagesQueued.Set();
@@ -245,10 +501,61 @@ void JsonRpcConnection::Disconnect()
 	});
 }
 
-void JsonRpcConnection::MessageHandler(const String& jsonString)
+/**
+ * Get the key of the checkable a message is about, e.g. "host!service".
+ *
+ * Messages with the same key are processed in order, the others in parallel.
+ * Only events qualify, they don't depend on any other object than their checkable.
+ *
+ * @return The key or an empty string if the message has to be processed after all previous ones
+ */
+static String GetMessageOrderingKey(const String& method, const Dictionary::Ptr& message)
+{
+	if (method.SubStr(0, 7) != "event::")
+		return String();
+
+	Dictionary::Ptr params = message->Get("params");
+
+	if (!params)
+		return String();
+
+	String host = params->Get("host");
+
+	if (host.IsEmpty())
+		return String();
+
+	String service = params->Get("service");
+
+	return service.IsEmpty() ? host : host + "!" + service;
+}
+
+/**
+ * Get the queue for processing all messages with the given ordering key.
+ */
+static WorkQueue& GetMessageQueue(const String& key)
 {
-	Dictionary::Ptr message = JsonRpc::DecodeMessage(jsonString);
+	static std::vector<std::unique_ptr<WorkQueue>> queues;
+	static std::once_flag queuesOnce;
+
+	std::call_once(queuesOnce, []() {
+		auto concurrency (std::max(Configuration::Concurrency, 1));
+
+		for (int i = 0; i < concurrency; i++) {
+			queues.emplace_back(new WorkQueue(0, 1, LogNotice));
+			queues.back()->SetName("JsonRpcConnection, MessageQueue #" + Convert::ToString(i));
 
+			queues.back()->SetExceptionCallback([](boost::exception_ptr exp) {
+				Log(LogCritical, "JsonRpcConnection")
+					<< "Exception while processing JSON-RPC message: " << DiagnosticInformation(exp, false);
+			});
+		}
+	});
+
+	return *queues[std::hash<String>()(key) % queues.size()];
+}
+
+void JsonRpcConnection::MessageHandler(const Dictionary::Ptr& message, size_t length, boost::asio::yield_context yc)
+{
 	if (m_Endpoint && message->Contains("ts")) {
 		double ts = message->Get("ts");
 
@@ -268,7 +575,7 @@ void JsonRpcConnection::MessageHandler(const String& jsonString)
 		else
 			origin->FromZone = Zone::GetByName(message->Get("originZone"));
 
-		m_Endpoint->AddMessageReceived(jsonString.GetLength());
+		m_Endpoint->AddMessageReceived(length);
 	}
 
 	Value vmethod;
@@ -290,6 +597,53 @@ void JsonRpcConnection::MessageHandler(const String& jsonString)
 	Log(LogNotice, "JsonRpcConnection")
 		<< "Received '" << method << "' message from identity '" << m_Identity << "'.";
 
+	String key = GetMessageOrderingKey(method, message);
+
+	if (key.IsEmpty()) {
+		WaitForInFlightMessages(0, yc);
+
+		CpuBoundWork handleMessage (yc, CpuBoundPriority::High);
+
+		InvokeMessage(origin, message, method);
+	} else {
+		WaitForInFlightMessages(l_MaxInFlightMessages - 1u, yc);
+
+		Ptr keepAlive (this);
+
+		m_InFlightMessages.fetch_add(1);
+
+		GetMessageQueue(key).Enqueue([this, keepAlive, origin, message, method]() {
+			Defer done ([this, keepAlive]() {
+				if (m_InFlightMessages.fetch_sub(1) - 1u < m_InFlightMessagesWakeBelow.load()) {
+					m_IoStrand.post([this, keepAlive]() { m_InFlightMessagesDecreased.Set(); });
+				}
+			});
+
+			InvokeMessage(origin, message, method);
+		});
+	}
+}
+
+/**
+ * Waits until at most the given number of messages are still being processed in parallel.
+ */
+void JsonRpcConnection::WaitForInFlightMessages(size_t max, boost::asio::yield_context yc)
+{
+	while (m_InFlightMessages.load() > max) {
+		m_InFlightMessagesDecreased.Clear();
+		m_InFlightMessagesWakeBelow.store(max + 1u);
+
+		if (m_InFlightMessages.load() <= max)
+			break;
+
+		m_InFlightMessagesDecreased.Wait(yc);
+	}
+
+	m_InFlightMessagesWakeBelow.store(0);
+}
+
+void JsonRpcConnection::InvokeMessage(const MessageOrigin::Ptr& origin, const Dictionary::Ptr& message, const String& method)
+{
 	Dictionary::Ptr resultMessage = new Dictionary();
 
 	try {
@@ -299,6 +653,9 @@ void JsonRpcConnection::MessageHandler(const String& jsonString)
 			Log(LogNotice, "JsonRpcConnection")
 				<< "Call to non-existent function '" << method << "' from endpoint '" << m_Identity << "'.";
 		} else {
+			/* Only the names of existing functions, so that peers can't blow up the number of spans. */
+			ProfilerScope span ("json_rpc", method);
+
 			Dictionary::Ptr params = message->Get("params");
 			if (params)
 				resultMessage->Set("result", afunc->Invoke(origin, params));
@@ -317,7 +674,8 @@ void JsonRpcConnection::MessageHandler(const String& jsonString)
 		resultMessage->Set("jsonrpc", "2.0");
 		resultMessage->Set("id", message->Get("id"));
 
-		SendMessageInternal(resultMessage);
+		/* May run outside of m_IoStrand. */
+		SendMessage(resultMessage);
 	}
 }
 
@@ -384,3 +742,34 @@ double JsonRpcConnection::GetWorkQueueRate()
 {
 	return l_TaskStats.UpdateAndGetValues(Utility::GetTime(), 60) / 60.0;
 }
+
+void JsonRpcConnection::AddWriteStats(size_t messages, size_t bytes)
+{
+	double now = Utility::GetTime();
+
+	l_WriteStats.InsertValue(now, 1);
+	l_WrittenMessagesStats.InsertValue(now, messages);
+	l_WrittenBytesStats.InsertValue(now, bytes);
+}
+
+/**
+ * Average number of messages sent by a single write to the TLS layer within the last minute.
+ */
+double JsonRpcConnection::GetMessagesPerWrite()
+{
+	double now = Utility::GetTime();
+	int writes = l_WriteStats.UpdateAndGetValues(now, 60);
+
+	return writes ? l_WrittenMessagesStats.UpdateAndGetValues(now, 60) / (double)writes : 0;
+}
+
+/**
+ * Average number of bytes sent by a single write to the TLS layer within the last minute.
+ */
+double JsonRpcConnection::GetBytesPerWrite()
+{
+	double now = Utility::GetTime();
+	int writes = l_WriteStats.UpdateAndGetValues(now, 60);
+
+	return writes ? l_WrittenBytesStats.UpdateAndGetValues(now, 60) / (double)writes : 0;
+}
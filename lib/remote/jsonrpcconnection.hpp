@@ -5,11 +5,18 @@
 
 #include "remote/i2-remote.hpp"
 #include "remote/endpoint.hpp"
+#include "remote/jsonrpc.hpp"
+#include "remote/jsonrpccompression.hpp"
 #include "base/io-engine.hpp"
+#include "base/netstring.hpp"
 #include "base/tlsstream.hpp"
 #include "base/timer.hpp"
 #include "base/workqueue.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/io_context_strand.hpp>
@@ -43,6 +50,7 @@ public:
 	DECLARE_PTR_TYPEDEFS(JsonRpcConnection);
 
 	JsonRpcConnection(const String& identity, bool authenticated, const Shared<AsioTlsStream>::Ptr& stream, ConnectionRole role);
+	JsonRpcConnection(const String& identity, bool authenticated, const Shared<AsioTlsStream>::Ptr& stream, ConnectionRole role, boost::asio::io_context& io);
 
 	void Start();
 
@@ -56,11 +64,22 @@ public:
 	void Disconnect();
 
 	void SendMessage(const Dictionary::Ptr& request);
+	void SendMessage(const SharedMessage::Ptr& request);
 	void SendRawMessage(const String& request);
 
+	void WaitForSendCredit();
+
+	size_t GetQueuedMessages();
+	size_t GetQueuedBytes();
+
+	void SetBinaryMessages(bool binary);
+	void EnableCompression(int level);
+
 	static Value HeartbeatAPIHandler(const intrusive_ptr<MessageOrigin>& origin, const Dictionary::Ptr& params);
 
 	static double GetWorkQueueRate();
+	static double GetMessagesPerWrite();
+	static double GetBytesPerWrite();
 
 	static void SendCertificateRequest(const JsonRpcConnection::Ptr& aclient, const intrusive_ptr<MessageOrigin>& origin, const String& path);
 
@@ -74,25 +93,41 @@ private:
 	double m_Seen;
 	double m_NextHeartbeat;
 	boost::asio::io_context::strand m_IoStrand;
-	std::vector<String> m_OutgoingMessagesQueue;
+	std::deque<std::shared_ptr<const String>> m_OutgoingMessagesQueue;
+	std::vector<std::shared_ptr<const String>> m_OutgoingPriorityMessagesQueue;
 	AsioConditionVariable m_OutgoingMessagesQueued;
 	AsioConditionVariable m_WriterDone;
 	bool m_ShuttingDown;
+	std::atomic<bool> m_BinaryMessages{false}; /**< Whether to send MessagePack instead of JSON */
+	std::unique_ptr<JsonRpcDeflater> m_Deflater; /**< Compresses outgoing messages if set, only used inside m_IoStrand */
+	std::unique_ptr<JsonRpcInflater> m_Inflater; /**< Created on the first compressed incoming message */
+	NetStringReader m_Reader; /**< Only used by HandleIncomingMessages() */
+	std::mutex m_SendCreditMutex;
+	std::condition_variable m_SendCreditCV;
+	size_t m_QueuedMessages = 0; /**< Not yet written, protected by m_SendCreditMutex */
+	size_t m_QueuedBytes = 0; /**< Not yet written, protected by m_SendCreditMutex */
+	bool m_WriterStopped = false; /**< Protected by m_SendCreditMutex */
+	std::atomic<size_t> m_InFlightMessages{0}; /**< Received messages being processed in parallel */
+	std::atomic<size_t> m_InFlightMessagesWakeBelow{0}; /**< Notify m_InFlightMessagesDecreased once less are in flight */
+	AsioConditionVariable m_InFlightMessagesDecreased;
 	boost::asio::deadline_timer m_CheckLivenessTimer, m_HeartbeatTimer;
 
-	JsonRpcConnection(const String& identity, bool authenticated, const Shared<AsioTlsStream>::Ptr& stream, ConnectionRole role, boost::asio::io_context& io);
-
 	void HandleIncomingMessages(boost::asio::yield_context yc);
 	void WriteOutgoingMessages(boost::asio::yield_context yc);
+	void WriteMessages(const std::vector<std::shared_ptr<const String>>& messages, boost::asio::yield_context yc);
 	void HandleAndWriteHeartbeats(boost::asio::yield_context yc);
 	void CheckLiveness(boost::asio::yield_context yc);
 
-	bool ProcessMessage();
-	void MessageHandler(const String& jsonString);
+	void MessageHandler(const Dictionary::Ptr& message, size_t length, boost::asio::yield_context yc);
+	void WaitForInFlightMessages(size_t max, boost::asio::yield_context yc);
+	void InvokeMessage(const intrusive_ptr<MessageOrigin>& origin, const Dictionary::Ptr& message, const String& method);
 
 	void CertificateRequestResponseHandler(const Dictionary::Ptr& message);
 
-	void SendMessageInternal(const Dictionary::Ptr& request);
+	void SendMessageInternal(const Dictionary::Ptr& request, bool priority = false);
+	void EnqueueMessage(std::shared_ptr<const String> message, bool priority = false);
+
+	static void AddWriteStats(size_t messages, size_t bytes);
 };
 
 }
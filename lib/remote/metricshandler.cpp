@@ -0,0 +1,83 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "remote/metricshandler.hpp"
+#include "remote/apilistener.hpp"
+#include "remote/filterutility.hpp"
+#include "base/metrics.hpp"
+
+using namespace icinga;
+
+REGISTER_URLHANDLER("/v1/metrics", MetricsHandler);
+
+/**
+ * Returns the user unauthenticated requests for /v1/metrics run as if ApiListener#enable_anonymous_metrics is set.
+ * Its only permission is "metrics".
+ *
+ * @return The anonymous user or nullptr for any other request
+ */
+ApiUser::Ptr MetricsHandler::GetAnonymousUser(const boost::beast::http::request<boost::beast::http::string_body>& request)
+{
+	namespace http = boost::beast::http;
+
+	static const ApiUser::Ptr anonymousUser ([]() {
+		ApiUser::Ptr user = new ApiUser();
+
+		user->SetName("<anonymous>", true);
+		user->SetPermissions(new Array({ "metrics" }), true);
+
+		return user;
+	}());
+
+	if (request.method() != http::verb::get)
+		return nullptr;
+
+	ApiListener::Ptr listener = ApiListener::GetInstance();
+
+	if (!listener || !listener->GetEnableAnonymousMetrics())
+		return nullptr;
+
+	Url::Ptr url;
+
+	try {
+		url = new Url(std::string(request.target()));
+	} catch (const std::exception&) {
+		return nullptr;
+	}
+
+	auto& path (url->GetPath());
+
+	if (path.size() != 2 || path[0] != "v1" || path[1] != "metrics")
+		return nullptr;
+
+	return anonymousUser;
+}
+
+bool MetricsHandler::HandleRequest(
+	AsioTlsStream& stream,
+	const ApiUser::Ptr& user,
+	boost::beast::http::request<boost::beast::http::string_body>& request,
+	const Url::Ptr& url,
+	boost::beast::http::response<boost::beast::http::string_body>& response,
+	const Dictionary::Ptr& params,
+	boost::asio::yield_context& yc,
+	HttpServerConnection& server
+)
+{
+	namespace http = boost::beast::http;
+
+	if (url->GetPath().size() != 2)
+		return false;
+
+	if (request.method() != http::verb::get)
+		return false;
+
+	FilterUtility::CheckPermission(user, "metrics");
+
+	/* Unlike /v1/status this doesn't call the StatsFunctions, the metrics are read from their counters directly. */
+	response.result(http::status::ok);
+	response.set(http::field::content_type, "text/plain; version=0.0.4; charset=utf-8");
+	response.body() = MetricsRegistry::Collect();
+	response.content_length(response.body().size());
+
+	return true;
+}
@@ -4,21 +4,86 @@
 #include "remote/httputility.hpp"
 #include "remote/filterutility.hpp"
 #include "base/serializer.hpp"
+#include "base/base64.hpp"
 #include "base/dependencygraph.hpp"
 #include "base/configtype.hpp"
+#include "base/convert.hpp"
+#include "base/json.hpp"
+#include "base/tlsutility.hpp"
 #include <boost/algorithm/string/case_conv.hpp>
+#include <algorithm>
+#include <limits>
 #include <set>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 using namespace icinga;
 
 REGISTER_URLHANDLER("/v1/objects", ObjectQueryHandler);
 
-Dictionary::Ptr ObjectQueryHandler::SerializeObjectAttrs(const Object::Ptr& object,
-	const String& attrPrefix, const Array::Ptr& attrs, bool isJoin, bool allAttrs)
+/**
+ * @returns An ETag for the results of the given query of objects of the given type, made of the current counter
+ *          of the latest change of these objects (see ConfigObject::BumpChangeCounter()) and a hash of everything
+ *          else the results depend on. An empty string if the type doesn't track changes.
+ */
+static String GetCollectionETag(const Type::Ptr& type, const ApiUser::Ptr& user, const Dictionary::Ptr& params)
 {
-	Type::Ptr type = object->GetReflectionType();
+	uint_fast64_t counter = ConfigObject::GetChangeCounter(type);
+
+	if (!counter)
+		return String();
+
+	/* Permission changes change the results as well. */
+	counter = std::max(counter, user->GetChangeCounter());
+
+	return "\"" + Convert::ToString(counter) + "-" + SHA1(user->GetName() + "\n" + JsonEncode(params)).SubStr(0, 16) + "\"";
+}
 
+/**
+ * @returns The given ETag with its counter raised to the one of the given type's latest change (if greater).
+ */
+static String MergeCollectionETag(const String& etag, const Type::Ptr& type)
+{
+	auto dash (etag.Find("-"));
+	uint_fast64_t counter = Convert::ToDouble(etag.SubStr(1, dash - 1));
+	uint_fast64_t typeCounter = ConfigObject::GetChangeCounter(type);
+
+	if (typeCounter <= counter)
+		return etag;
+
+	return "\"" + Convert::ToString(typeCounter) + etag.SubStr(dash);
+}
+
+/**
+ * @returns Whether the given If-None-Match header value matches the given ETag.
+ */
+static bool MatchesETag(const String& ifNoneMatch, const String& etag)
+{
+	std::vector<String> tags = ifNoneMatch.Split(",");
+
+	for (auto& tag : tags) {
+		String trimmedTag = tag.Trim();
+
+		if (trimmedTag.SubStr(0, 2) == "W/")
+			trimmedTag = trimmedTag.SubStr(2);
+
+		if (trimmedTag == etag || trimmedTag == "*")
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Determines which of the given type's fields the requested attributes consist of. Computed once per
+ * request (and joined type), instead of per object.
+ *
+ * @returns The ids of the user-visible fields to serialize.
+ */
+std::vector<int> ObjectQueryHandler::GetFieldIds(const Type::Ptr& type,
+	const String& attrPrefix, const Array::Ptr& attrs, bool isJoin, bool allAttrs)
+{
 	std::vector<int> fids;
 
 	if (isJoin && attrs) {
@@ -65,29 +130,103 @@ Dictionary::Ptr ObjectQueryHandler::SerializeObjectAttrs(const Object::Ptr& obje
 		}
 	}
 
-	DictionaryData resultAttrs;
-	resultAttrs.reserve(fids.size());
-
-	for (int fid : fids) {
+	fids.erase(std::remove_if(fids.begin(), fids.end(), [&type](int fid) {
 		Field field = type->GetFieldInfo(fid);
 
-		Value val = object->GetField(fid);
-
 		/* hide attributes which shouldn't be user-visible */
 		if (field.Attributes & FANoUserView)
-			continue;
+			return true;
 
 		/* hide internal navigation fields */
 		if (field.Attributes & FANavigation && !(field.Attributes & (FAConfig | FAState)))
-			continue;
+			return true;
+
+		return false;
+	}), fids.end());
+
+	return fids;
+}
 
-		Value sval = Serialize(val, FAConfig | FAState);
-		resultAttrs.emplace_back(field.Name, sval);
+/**
+ * @returns An opaque cursor for the page of objects of the given type after the one of the given name.
+ */
+static String EncodeCursor(const Type::Ptr& type, const String& after)
+{
+	String cursor = Base64::Encode(JsonEncode(new Dictionary({
+		{ "type", type->GetName() },
+		{ "after", after }
+	})));
+
+	/* Make it safe for URLs. */
+	for (auto& ch : cursor) {
+		if (ch == '+')
+			ch = '-';
+		else if (ch == '/')
+			ch = '_';
+		else if (ch == '=')
+			ch = '.';
+	}
+
+	return cursor;
+}
+
+/**
+ * @returns The name of the object after which the page of the given cursor begins.
+ * @exception invalid_argument The cursor isn't one of the given type.
+ */
+static String DecodeCursor(const Type::Ptr& type, String cursor)
+{
+	for (auto& ch : cursor) {
+		if (ch == '-')
+			ch = '+';
+		else if (ch == '_')
+			ch = '/';
+		else if (ch == '.')
+			ch = '=';
+	}
+
+	Value data = JsonDecode(Base64::Decode(cursor));
+
+	if (!data.IsObjectType<Dictionary>())
+		BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid cursor"));
+
+	Dictionary::Ptr dict = data;
+
+	if (dict->Get("type") != type->GetName() || !dict->Get("after").IsString())
+		BOOST_THROW_EXCEPTION(std::invalid_argument("Invalid cursor"));
+
+	return dict->Get("after");
+}
+
+/**
+ * @param fids The fields to serialize, see GetFieldIds()
+ */
+Dictionary::Ptr ObjectQueryHandler::SerializeObjectAttrs(const Object::Ptr& object, const std::vector<int>& fids)
+{
+	Type::Ptr type = object->GetReflectionType();
+
+	DictionaryData resultAttrs;
+	resultAttrs.reserve(fids.size());
+
+	for (int fid : fids) {
+		resultAttrs.emplace_back(type->GetFieldInfo(fid).Name, Serialize(object->GetField(fid), FAConfig | FAState));
 	}
 
 	return new Dictionary(std::move(resultAttrs));
 }
 
+/**
+ * A navigation field to join and the objects already joined via it during a request, serialized once
+ * for all rows they're joined to (e.g. a host for all of its services).
+ */
+struct ObjectQueryJoin
+{
+	int Fid;
+	String Prefix;
+	std::unordered_map<Type*, std::vector<int>> Fids;
+	std::unordered_map<Object*, std::pair<Object::Ptr, Dictionary::Ptr>> Serialized;
+};
+
 bool ObjectQueryHandler::HandleRequest(
 	AsioTlsStream& stream,
 	const ApiUser::Ptr& user,
@@ -154,20 +293,6 @@ bool ObjectQueryHandler::HandleRequest(
 		params->Set(attr, url->GetPath()[3]);
 	}
 
-	std::vector<Value> objs;
-
-	try {
-		objs = FilterUtility::GetFilterTargets(qd, params, user);
-	} catch (const std::exception& ex) {
-		HttpUtility::SendJsonError(response, params, 404,
-			"No objects found.",
-			DiagnosticInformation(ex));
-		return true;
-	}
-
-	ArrayData results;
-	results.reserve(objs.size());
-
 	std::set<String> joinAttrs;
 	std::set<String> userJoinAttrs;
 
@@ -178,6 +303,9 @@ bool ObjectQueryHandler::HandleRequest(
 		}
 	}
 
+	/* Determined before the objects are, so that changes while querying don't go unnoticed. */
+	String etag = GetCollectionETag(type, user, params);
+
 	for (int fid = 0; fid < type->GetFieldCount(); fid++) {
 		Field field = type->GetFieldInfo(fid);
 
@@ -188,15 +316,191 @@ bool ObjectQueryHandler::HandleRequest(
 			continue;
 
 		joinAttrs.insert(field.Name);
+
+		/* Changes of joined objects change the results as well. */
+		Type::Ptr joinedType = field.RefTypeName ? Type::GetByName(field.RefTypeName) : nullptr;
+
+		if (!joinedType || !ConfigObject::GetChangeCounter(joinedType))
+			etag = String();
+		else if (!etag.IsEmpty())
+			etag = MergeCollectionETag(etag, joinedType);
+	}
+
+	if (!etag.IsEmpty()) {
+		response.set(http::field::etag, etag);
+
+		if (MatchesETag(std::string(request[http::field::if_none_match]), etag)) {
+			response.result(http::status::not_modified);
+			return true;
+		}
 	}
 
+	Value changedSince = HttpUtility::GetLastParameter(params, "changed_since");
+	double since = 0;
+
+	if (!changedSince.IsEmpty()) {
+		try {
+			since = Convert::ToDouble(changedSince);
+		} catch (const std::exception&) {
+			since = -1;
+		}
+
+		if (!(since >= 0)) {
+			HttpUtility::SendJsonError(response, params, 400, "Invalid 'changed_since' specified. A non-negative number is required.");
+			return true;
+		}
+	}
+
+	std::vector<Value> objs;
+
+	try {
+		objs = FilterUtility::GetFilterTargets(qd, params, user);
+	} catch (const std::exception& ex) {
+		HttpUtility::SendJsonError(response, params, 404,
+			"No objects found.",
+			DiagnosticInformation(ex));
+		return true;
+	}
+
+	if (!changedSince.IsEmpty()) {
+		auto counter (std::numeric_limits<uint_fast64_t>::max());
+
+		if (since < (double)counter)
+			counter = since;
+
+		objs.erase(std::remove_if(objs.begin(), objs.end(), [counter](const Value& obj) {
+			return static_cast<ConfigObject::Ptr>(obj)->GetChangeCounter() <= counter;
+		}), objs.end());
+	}
+
+	/* Pages are taken in name order. As names never change, every object which exists during the whole
+	 * iteration is returned exactly once, no matter what is created or deleted in between. */
+	Value limitParam = HttpUtility::GetLastParameter(params, "limit");
+	Value cursorParam = HttpUtility::GetLastParameter(params, "cursor");
+	String nextCursor;
+
+	if (!limitParam.IsEmpty() || !cursorParam.IsEmpty()) {
+		double limit = 0;
+
+		if (!limitParam.IsEmpty()) {
+			try {
+				limit = Convert::ToDouble(limitParam);
+			} catch (const std::exception&) {
+			}
+
+			if (!(limit >= 1)) {
+				HttpUtility::SendJsonError(response, params, 400, "Invalid 'limit' specified. A positive number is required.");
+				return true;
+			}
+		}
+
+		std::vector<std::pair<String, Value>> names;
+		names.reserve(objs.size());
+
+		for (auto& obj : objs) {
+			names.emplace_back(static_cast<ConfigObject::Ptr>(obj)->GetName(), std::move(obj));
+		}
+
+		if (!cursorParam.IsEmpty()) {
+			String after;
+
+			try {
+				after = DecodeCursor(type, cursorParam);
+			} catch (const std::exception&) {
+				HttpUtility::SendJsonError(response, params, 400, "Invalid 'cursor' specified.");
+				return true;
+			}
+
+			names.erase(std::remove_if(names.begin(), names.end(), [&after](const std::pair<String, Value>& name) {
+				return !(after < name.first);
+			}), names.end());
+		}
+
+		auto byName ([](const std::pair<String, Value>& a, const std::pair<String, Value>& b) {
+			return a.first < b.first;
+		});
+
+		/* Only the page itself has to be sorted. */
+		if (limit && names.size() > limit) {
+			std::partial_sort(names.begin(), names.begin() + (size_t)limit, names.end(), byName);
+			names.resize((size_t)limit);
+
+			nextCursor = EncodeCursor(type, names.back().first);
+		} else {
+			std::sort(names.begin(), names.end(), byName);
+		}
+
+		objs.clear();
+
+		for (auto& name : names) {
+			objs.emplace_back(std::move(name.second));
+		}
+	}
+
+	std::vector<ObjectQueryJoin> joinFields;
+
+	for (const String& joinAttr : joinAttrs) {
+		int fid = type->GetFieldId(joinAttr);
+
+		if (fid < 0) {
+			HttpUtility::SendJsonError(response, params, 400, "Invalid field specified for join: " + joinAttr);
+			return true;
+		}
+
+		Field field = type->GetFieldInfo(fid);
+
+		if (!(field.Attributes & FANavigation)) {
+			HttpUtility::SendJsonError(response, params, 400, "Not a joinable field: " + joinAttr);
+			return true;
+		}
+
+		joinFields.emplace_back();
+		joinFields.back().Fid = fid;
+		joinFields.back().Prefix = field.NavigationName;
+	}
+
+	if (umetas) {
+		ObjectLock olock(umetas);
+		for (const String& meta : umetas) {
+			if (meta != "used_by" && meta != "location") {
+				HttpUtility::SendJsonError(response, params, 400, "Invalid field specified for meta: " + meta);
+				return true;
+			}
+		}
+	}
+
+	std::unordered_map<Type*, std::vector<int>> attrFids;
 	std::unordered_map<Type*, std::pair<bool, std::unique_ptr<Expression>>> typePermissions;
 	std::unordered_map<Object*, bool> objectAccessAllowed;
 
-	for (const ConfigObject::Ptr& obj : objs) {
+	/* Invalid attributes are rejected before any result is sent, see below. */
+	try {
+		attrFids.emplace(type.get(), GetFieldIds(type, String(), uattrs, false, false));
+
+		for (auto& join : joinFields) {
+			Field field = type->GetFieldInfo(join.Fid);
+			Type::Ptr joinedType = field.RefTypeName ? Type::GetByName(field.RefTypeName) : nullptr;
+
+			if (joinedType)
+				join.Fids.emplace(joinedType.get(), GetFieldIds(joinedType, join.Prefix, ujoins, true, allJoins));
+		}
+	} catch (const ScriptError& ex) {
+		HttpUtility::SendJsonError(response, params, 400, ex.what());
+		return true;
+	}
+
+	auto obj (objs.begin());
+
+	/* Each result is serialized only once it's sent. */
+	auto nextResult ([&](Value& result) {
+		if (obj == objs.end())
+			return false;
+
+		ConfigObject::Ptr object = *obj++;
+
 		DictionaryData result1{
-			{ "name", obj->GetName() },
-			{ "type", obj->GetReflectionType()->GetName() }
+			{ "name", object->GetName() },
+			{ "type", object->GetReflectionType()->GetName() }
 		};
 
 		DictionaryData metaAttrs;
@@ -208,7 +512,7 @@ bool ObjectQueryHandler::HandleRequest(
 					Array::Ptr used_by = new Array();
 					metaAttrs.emplace_back("used_by", used_by);
 
-					for (const Object::Ptr& pobj : DependencyGraph::GetParents((obj)))
+					for (const Object::Ptr& pobj : DependencyGraph::GetParents((object)))
 					{
 						ConfigObject::Ptr configObj = dynamic_pointer_cast<ConfigObject>(pobj);
 
@@ -221,42 +525,25 @@ bool ObjectQueryHandler::HandleRequest(
 						}));
 					}
 				} else if (meta == "location") {
-					metaAttrs.emplace_back("location", obj->GetSourceLocation());
-				} else {
-					HttpUtility::SendJsonError(response, params, 400, "Invalid field specified for meta: " + meta);
-					return true;
+					metaAttrs.emplace_back("location", object->GetSourceLocation());
 				}
 			}
 		}
 
 		result1.emplace_back("meta", new Dictionary(std::move(metaAttrs)));
 
-		try {
-			result1.emplace_back("attrs", SerializeObjectAttrs(obj, String(), uattrs, false, false));
-		} catch (const ScriptError& ex) {
-			HttpUtility::SendJsonError(response, params, 400, ex.what());
-			return true;
-		}
+		Type::Ptr objType = object->GetReflectionType();
+		auto fids (attrFids.find(objType.get()));
 
-		DictionaryData joins;
+		if (fids == attrFids.end())
+			fids = attrFids.emplace(objType.get(), GetFieldIds(objType, String(), uattrs, false, false)).first;
 
-		for (const String& joinAttr : joinAttrs) {
-			Object::Ptr joinedObj;
-			int fid = type->GetFieldId(joinAttr);
+		result1.emplace_back("attrs", SerializeObjectAttrs(object, fids->second));
 
-			if (fid < 0) {
-				HttpUtility::SendJsonError(response, params, 400, "Invalid field specified for join: " + joinAttr);
-				return true;
-			}
-
-			Field field = type->GetFieldInfo(fid);
-
-			if (!(field.Attributes & FANavigation)) {
-				HttpUtility::SendJsonError(response, params, 400, "Not a joinable field: " + joinAttr);
-				return true;
-			}
+		DictionaryData joins;
 
-			joinedObj = obj->NavigateField(fid);
+		for (auto& join : joinFields) {
+			Object::Ptr joinedObj = object->NavigateField(join.Fid);
 
 			if (!joinedObj)
 				continue;
@@ -304,27 +591,36 @@ bool ObjectQueryHandler::HandleRequest(
 				continue;
 			}
 
-			String prefix = field.NavigationName;
+			auto serialized (join.Serialized.find(joinedObj.get()));
 
-			try {
-				joins.emplace_back(prefix, SerializeObjectAttrs(joinedObj, prefix, ujoins, true, allJoins));
-			} catch (const ScriptError& ex) {
-				HttpUtility::SendJsonError(response, params, 400, ex.what());
-				return true;
+			if (serialized == join.Serialized.end()) {
+				auto joinFids (join.Fids.find(reflectionType.get()));
+
+				if (joinFids == join.Fids.end())
+					joinFids = join.Fids.emplace(reflectionType.get(), GetFieldIds(reflectionType, join.Prefix, ujoins, true, allJoins)).first;
+
+				serialized = join.Serialized.emplace(joinedObj.get(),
+					std::make_pair(joinedObj, SerializeObjectAttrs(joinedObj, joinFids->second))).first;
 			}
+
+			joins.emplace_back(join.Prefix, serialized->second.second);
 		}
 
 		result1.emplace_back("joins", new Dictionary(std::move(joins)));
 
-		results.push_back(new Dictionary(std::move(result1)));
-	}
-
-	Dictionary::Ptr result = new Dictionary({
-		{ "results", new Array(std::move(results)) }
+		result = new Dictionary(std::move(result1));
+		return true;
 	});
 
 	response.result(http::status::ok);
-	HttpUtility::SendJsonBody(response, params, result);
+
+	try {
+		HttpUtility::SendJsonResults(stream, response, params, nextResult, yc, server,
+			nextCursor.IsEmpty() ? nullptr : new Dictionary({ { "next_cursor", nextCursor } }));
+	} catch (const ScriptError& ex) {
+		/* Only reached for types not known up front. Once streaming, the connection is just closed. */
+		HttpUtility::SendJsonError(response, params, 400, ex.what());
+	}
 
 	return true;
 }
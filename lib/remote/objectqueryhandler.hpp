@@ -4,6 +4,7 @@
 #define OBJECTQUERYHANDLER_H
 
 #include "remote/httphandler.hpp"
+#include <vector>
 
 namespace icinga
 {
@@ -25,8 +26,9 @@ public:
 	) override;
 
 private:
-	static Dictionary::Ptr SerializeObjectAttrs(const Object::Ptr& object, const String& attrPrefix,
+	static std::vector<int> GetFieldIds(const Type::Ptr& type, const String& attrPrefix,
 		const Array::Ptr& attrs, bool isJoin, bool allAttrs);
+	static Dictionary::Ptr SerializeObjectAttrs(const Object::Ptr& object, const std::vector<int>& fids);
 };
 
 }
@@ -0,0 +1,63 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/allocator.hpp"
+#include "base/objectlock.hpp"
+#include "base/perfdatavalue.hpp"
+#include <memory>
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_allocator)
+
+BOOST_AUTO_TEST_CASE(stats)
+{
+	String name = Allocator::GetName();
+
+	BOOST_CHECK(name == "jemalloc" || name == "mimalloc" || name == "system");
+
+	std::unique_ptr<char[]> block (new char[1024 * 1024]);
+	block[0] = 1;
+
+	Dictionary::Ptr stats = Allocator::GetStats();
+
+	BOOST_CHECK(stats->Get("name") == name);
+
+	for (const char *key : { "allocated", "active", "resident" }) {
+		if (stats->Contains(key))
+			BOOST_CHECK(stats->Get(key) >= 0);
+	}
+
+	if (stats->Contains("allocated"))
+		BOOST_CHECK(stats->Get("allocated") >= 1024 * 1024);
+
+	if (stats->Contains("fragmentation")) {
+		double fragmentation = stats->Get("fragmentation");
+
+		BOOST_CHECK(fragmentation >= 0 && fragmentation <= 1);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(statsfunc)
+{
+	Dictionary::Ptr status = new Dictionary();
+	Array::Ptr perfdata = new Array();
+
+	Allocator::StatsFunc(status, perfdata);
+
+	Dictionary::Ptr stats = status->Get("allocator");
+
+	BOOST_REQUIRE(stats);
+	BOOST_CHECK(stats->Get("name") == Allocator::GetName());
+
+	ObjectLock olock (perfdata);
+
+	for (const Value& pdv : perfdata) {
+		PerfdataValue::Ptr value = pdv;
+
+		BOOST_REQUIRE(value);
+		BOOST_CHECK(value->GetLabel().SubStr(0, 10) == "allocator_");
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
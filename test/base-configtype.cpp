@@ -0,0 +1,48 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/configtype.hpp"
+#include "base/filelogger.hpp"
+#include <BoostTestTargetConfig.h>
+#include <algorithm>
+
+using namespace icinga;
+
+static bool SnapshotContains(const ConfigObjectSnapshot<FileLogger>& snapshot, const FileLogger::Ptr& logger)
+{
+	return std::find(snapshot.begin(), snapshot.end(), logger.get()) != snapshot.end();
+}
+
+BOOST_AUTO_TEST_SUITE(base_configtype)
+
+BOOST_AUTO_TEST_CASE(snapshot)
+{
+	FileLogger::Ptr logger1 = new FileLogger();
+	logger1->SetName("base-configtype-1", true);
+	logger1->Register();
+
+	auto before (ConfigType::GetObjectSnapshot<FileLogger>());
+	BOOST_CHECK(SnapshotContains(before, logger1));
+
+	FileLogger::Ptr logger2 = new FileLogger();
+	logger2->SetName("base-configtype-2", true);
+	logger2->Register();
+
+	/* Existing snapshots never change. */
+	BOOST_CHECK(!SnapshotContains(before, logger2));
+
+	auto after (ConfigType::GetObjectSnapshot<FileLogger>());
+	BOOST_CHECK(SnapshotContains(after, logger1));
+	BOOST_CHECK(SnapshotContains(after, logger2));
+	BOOST_CHECK_EQUAL(after.size(), before.size() + 1u);
+
+	logger1->Unregister();
+
+	auto removed (ConfigType::GetObjectSnapshot<FileLogger>());
+	BOOST_CHECK(!SnapshotContains(removed, logger1));
+	BOOST_CHECK(SnapshotContains(removed, logger2));
+	BOOST_CHECK(SnapshotContains(after, logger1));
+
+	logger2->Unregister();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
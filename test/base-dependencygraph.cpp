@@ -0,0 +1,57 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/dependencygraph.hpp"
+#include <BoostTestTargetConfig.h>
+#include <algorithm>
+
+using namespace icinga;
+
+static bool ParentsContain(const Object::Ptr& child, const Object::Ptr& parent)
+{
+	auto parents (DependencyGraph::GetParents(child));
+
+	return std::find(parents.begin(), parents.end(), parent) != parents.end();
+}
+
+BOOST_AUTO_TEST_SUITE(base_dependencygraph)
+
+BOOST_AUTO_TEST_CASE(references)
+{
+	Object::Ptr parent = new Object();
+	Object::Ptr child = new Object();
+
+	DependencyGraph::AddDependency(parent.get(), child.get());
+	DependencyGraph::AddDependency(parent.get(), child.get());
+	BOOST_CHECK_EQUAL(DependencyGraph::GetParents(child).size(), 1u);
+
+	/* The parent references the child twice. */
+	DependencyGraph::RemoveDependency(parent.get(), child.get());
+	BOOST_CHECK(ParentsContain(child, parent));
+
+	DependencyGraph::RemoveDependency(parent.get(), child.get());
+	BOOST_CHECK(DependencyGraph::GetParents(child).empty());
+}
+
+BOOST_AUTO_TEST_CASE(batch)
+{
+	Object::Ptr parent = new Object();
+	std::vector<Object::Ptr> children;
+	std::vector<Object *> refs;
+
+	for (int i = 0; i < 1000; i++) {
+		children.emplace_back(new Object());
+		refs.emplace_back(children.back().get());
+	}
+
+	DependencyGraph::AddDependencies(parent.get(), refs);
+
+	for (auto& child : children)
+		BOOST_CHECK(ParentsContain(child, parent));
+
+	DependencyGraph::RemoveDependencies(parent.get(), refs);
+
+	for (auto& child : children)
+		BOOST_CHECK(DependencyGraph::GetParents(child).empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -197,4 +197,60 @@ BOOST_AUTO_TEST_CASE(keys_ordered)
 	BOOST_CHECK(std::is_sorted(keys.begin(), keys.end()));
 }
 
+BOOST_AUTO_TEST_CASE(many_keys)
+{
+	Dictionary::Ptr dictionary = new Dictionary();
+
+	for (int i = 0; i < 1000; i++) {
+		dictionary->Set(std::to_string((i * 7919) % 1000), i);
+	}
+
+	BOOST_CHECK(dictionary->GetLength() == 1000);
+	BOOST_CHECK(dictionary->Get("0") == 0);
+	BOOST_CHECK(dictionary->Get("999") == 321);
+	BOOST_CHECK(!dictionary->Contains("1000"));
+
+	std::vector<String> keys = dictionary->GetKeys();
+	BOOST_CHECK(keys.size() == 1000);
+	BOOST_CHECK(std::is_sorted(keys.begin(), keys.end()));
+
+	{
+		ObjectLock olock(dictionary);
+
+		for (auto it = dictionary->Begin(); it != dictionary->End();) {
+			if (static_cast<int>(it->second) % 2) {
+				it = dictionary->Remove(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	BOOST_CHECK(dictionary->GetLength() == 500);
+
+	int count = 0;
+
+	{
+		ObjectLock olock(dictionary);
+
+		for (const Dictionary::Pair& kv : dictionary) {
+			BOOST_CHECK(static_cast<int>(kv.second) % 2 == 0);
+			count++;
+		}
+	}
+
+	BOOST_CHECK(count == 500);
+
+	for (const String& key : keys) {
+		dictionary->Remove(key);
+	}
+
+	BOOST_CHECK(dictionary->GetLength() == 0);
+
+	{
+		ObjectLock olock(dictionary);
+		BOOST_CHECK(dictionary->Begin() == dictionary->End());
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,58 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/function.hpp"
+#include "base/functionprofiler.hpp"
+#include "base/objectlock.hpp"
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_functionprofiler)
+
+static Dictionary::Ptr GetEntry(const String& name)
+{
+	Array::Ptr report = FunctionProfiler::GetReport();
+	ObjectLock olock (report);
+
+	for (const Dictionary::Ptr& entry : report) {
+		if (entry->Get("name") == name)
+			return entry;
+	}
+
+	return nullptr;
+}
+
+BOOST_AUTO_TEST_CASE(calls)
+{
+	Configuration::ProfileFunctions = true;
+	FunctionProfiler::Reset();
+
+	Function::Ptr inner = new Function("profiler-test-inner", []() { return 1; });
+	Function::Ptr outer = new Function("profiler-test-outer", [inner]() { return inner->Invoke() + inner->Invoke(); });
+
+	for (int i = 0; i < 3; i++)
+		BOOST_CHECK(outer->Invoke() == 2);
+
+	/* Functions of the same name and location share their profile. */
+	Function::Ptr other = new Function("profiler-test-inner", []() { return 1; });
+	other->Invoke();
+
+	Configuration::ProfileFunctions = false;
+	outer->Invoke();
+
+	Dictionary::Ptr innerEntry = GetEntry("profiler-test-inner");
+	Dictionary::Ptr outerEntry = GetEntry("profiler-test-outer");
+
+	BOOST_REQUIRE(innerEntry);
+	BOOST_REQUIRE(outerEntry);
+	BOOST_CHECK(innerEntry->Get("calls") == 7);
+	BOOST_CHECK(outerEntry->Get("calls") == 3);
+	BOOST_CHECK(outerEntry->Get("self") <= outerEntry->Get("total"));
+	BOOST_CHECK(!outerEntry->Contains("location"));
+
+	FunctionProfiler::Reset();
+
+	BOOST_CHECK(!GetEntry("profiler-test-outer"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
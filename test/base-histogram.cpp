@@ -0,0 +1,53 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/histogram.hpp"
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_histogram)
+
+BOOST_AUTO_TEST_CASE(empty)
+{
+	Histogram histogram;
+
+	BOOST_CHECK(histogram.GetCount() == 0);
+	BOOST_CHECK(histogram.GetPercentile(50) == 0);
+	BOOST_CHECK(histogram.GetMax() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(percentiles)
+{
+	Histogram histogram;
+
+	for (int i = 1; i <= 1000; i++)
+		histogram.Record(i / 1000.0);
+
+	BOOST_CHECK(histogram.GetCount() == 1000);
+	BOOST_CHECK_CLOSE(histogram.GetSum(), 500.5, 0.01);
+	BOOST_CHECK_CLOSE(histogram.GetMax(), 1, 0.01);
+	BOOST_CHECK_CLOSE(histogram.GetPercentile(50), 0.5, 3.2);
+	BOOST_CHECK_CLOSE(histogram.GetPercentile(99), 0.99, 3.2);
+	BOOST_CHECK_CLOSE(histogram.GetPercentile(99.9), 0.999, 3.2);
+	BOOST_CHECK_CLOSE(histogram.GetPercentile(100), 1, 0.01);
+}
+
+BOOST_AUTO_TEST_CASE(range)
+{
+	Histogram histogram;
+
+	histogram.Record(-1);
+	histogram.Record(0.000005);
+	histogram.Record(1e9);
+
+	BOOST_CHECK(histogram.GetCount() == 3);
+	BOOST_CHECK(histogram.GetPercentile(0) == 0);
+	BOOST_CHECK_CLOSE(histogram.GetPercentile(50), 0.000005, 0.01);
+	BOOST_CHECK(histogram.GetPercentile(100) > 4e6);
+
+	histogram.Reset();
+
+	BOOST_CHECK(histogram.GetCount() == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,43 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/internpool.hpp"
+#include "base/array.hpp"
+#include "base/dictionary.hpp"
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_internpool)
+
+BOOST_AUTO_TEST_CASE(equal)
+{
+	Array::Ptr cmd1 = new Array({ "/usr/lib/nagios/plugins/check_ping", "-H", "192.0.2.1" });
+	Array::Ptr cmd2 = new Array({ "/usr/lib/nagios/plugins/check_ping", "-H", "192.0.2.1" });
+	Array::Ptr cmd3 = new Array({ "/usr/lib/nagios/plugins/check_ping", "-H", "192.0.2.2" });
+
+	uint_fast64_t hits = InternPool::GetHits();
+
+	Array::Ptr interned1 = InternPool::Intern(cmd1);
+	BOOST_CHECK(interned1 == cmd1);
+	BOOST_CHECK(cmd1->IsFrozen());
+
+	BOOST_CHECK(InternPool::Intern(cmd2) == cmd1);
+	BOOST_CHECK(InternPool::GetHits() == hits + 1);
+	BOOST_CHECK(!cmd2->IsFrozen());
+
+	BOOST_CHECK(InternPool::Intern(cmd3) == cmd3);
+	BOOST_CHECK(InternPool::Intern(Value(cmd2)).Get<Object::Ptr>() == cmd1);
+}
+
+BOOST_AUTO_TEST_CASE(objects)
+{
+	Array::Ptr arr = new Array({ "a", new Dictionary() });
+
+	BOOST_CHECK(InternPool::Intern(arr) == arr);
+	BOOST_CHECK(!arr->IsFrozen());
+
+	BOOST_CHECK(InternPool::Intern(Value("output")) == "output");
+	BOOST_CHECK(!InternPool::Intern(Array::Ptr()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
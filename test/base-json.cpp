@@ -100,6 +100,30 @@ BOOST_AUTO_TEST_CASE(decode)
 	BOOST_CHECK(uint.IsNumber() && uint.Get<double>() == 23.0);
 }
 
+BOOST_AUTO_TEST_CASE(decode_nested)
+{
+	auto output ((Dictionary::Ptr)JsonDecode(R"EOF({"z":{"b":[1,{"c":[]},[2]],"a":{}},"y":[{"x":3}],"dup":1,"dup":2})EOF"));
+	BOOST_CHECK(output->GetKeys() == std::vector<String>({"dup", "y", "z"}));
+	BOOST_CHECK(output->Get("dup") == 2);
+
+	auto z ((Dictionary::Ptr)output->Get("z"));
+	BOOST_CHECK(z->GetKeys() == std::vector<String>({"a", "b"}));
+	BOOST_CHECK(((Dictionary::Ptr)z->Get("a"))->GetLength() == 0u);
+
+	auto b ((Array::Ptr)z->Get("b"));
+	BOOST_CHECK(b->GetLength() == 3u);
+	BOOST_CHECK(b->Get(0) == 1);
+	BOOST_CHECK(((Array::Ptr)((Dictionary::Ptr)b->Get(1))->Get("c"))->GetLength() == 0u);
+	BOOST_CHECK(((Array::Ptr)b->Get(2))->Get(0) == 2);
+
+	auto y ((Array::Ptr)output->Get("y"));
+	BOOST_CHECK(y->GetLength() == 1u);
+	BOOST_CHECK(((Dictionary::Ptr)y->Get(0))->Get("x") == 3);
+
+	BOOST_CHECK(JsonDecode("[]").IsObjectType<Array>());
+	BOOST_CHECK(JsonDecode("\"s\"") == "s");
+}
+
 BOOST_AUTO_TEST_CASE(invalid1)
 {
 	BOOST_CHECK_THROW(JsonDecode("\"1.7"), std::exception);
@@ -107,4 +131,32 @@ BOOST_AUTO_TEST_CASE(invalid1)
 	BOOST_CHECK_THROW(JsonDecode("{\"test\": \"test\""), std::exception);
 }
 
+BOOST_AUTO_TEST_CASE(msgpack)
+{
+	Dictionary::Ptr input (new Dictionary({
+		{ "array", new Array({ new Namespace(), 1, "two" }) },
+		{ "false", false },
+		{ "float", -1.25 },
+		{ "fx", new Function("<test>", []() {}) },
+		{ "int", -42 },
+		{ "large", 1234567890123.0 },
+		{ "null", Value() },
+		{ "string", "LF\nTAB\tAUml\xC3\xA4Ill\xC3" },
+		{ "true", true },
+		{ "uint", 23u }
+	}));
+
+	String output (MsgPackEncode(input));
+
+	BOOST_CHECK((unsigned char)output[0] == 0x8a);
+	BOOST_CHECK(JsonEncode(MsgPackDecode(output)) == JsonEncode(input));
+
+	BOOST_CHECK(MsgPackEncode(Value()) == String("\xC0"));
+	BOOST_CHECK(MsgPackEncode(5) == String("\x05"));
+	BOOST_CHECK(MsgPackEncode(-1) == String("\xFF"));
+	BOOST_CHECK(MsgPackEncode("a") == String("\xA1" "a"));
+
+	BOOST_CHECK_THROW(MsgPackDecode(output.SubStr(0, output.GetLength() - 1u)), std::exception);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
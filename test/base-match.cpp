@@ -1,7 +1,12 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
+#include "base/regexcache.hpp"
 #include "base/utility.hpp"
+#include "base/wildcardpattern.hpp"
 #include <BoostTestTargetConfig.h>
+#include <boost/regex.hpp>
+#include <cctype>
+#include <random>
 
 using namespace icinga;
 
@@ -24,4 +29,78 @@ BOOST_AUTO_TEST_CASE(tolong)
 	BOOST_CHECK(Utility::Match("he**o", "hello"));
 }
 
+BOOST_AUTO_TEST_CASE(escape_and_case)
+{
+	BOOST_CHECK(Utility::Match("HELLO", "hello"));
+	BOOST_CHECK(Utility::Match("he\\?lo", "he?lo"));
+	BOOST_CHECK(!Utility::Match("he\\?lo", "hello"));
+	BOOST_CHECK(Utility::Match("he\\llo", "he\\llo"));
+	BOOST_CHECK(Utility::Match("*.conf", "hosts.conf"));
+	BOOST_CHECK(!Utility::Match("*.conf", "hosts.conf.bak"));
+	BOOST_CHECK(Utility::Match("*ab*ab*", "xabyab"));
+	BOOST_CHECK(!Utility::Match("*ab*ab*", "xaby"));
+	BOOST_CHECK(!Utility::Match("*?", ""));
+	BOOST_CHECK(Utility::Match("", ""));
+	BOOST_CHECK(!Utility::Match("", "a"));
+
+	BOOST_CHECK(WildcardPattern("host-1").IsLiteral());
+	BOOST_CHECK(!WildcardPattern("host-?").IsLiteral());
+	BOOST_CHECK(!WildcardPattern("host-*").IsLiteral());
+	BOOST_CHECK(WildcardPattern("host-\\*").IsLiteral());
+}
+
+/* What match() used to do, just slower. */
+static bool ReferenceMatch(const char *pattern, const char *text)
+{
+	if (*pattern == '*')
+		return ReferenceMatch(pattern + 1, text) || (*text && ReferenceMatch(pattern, text + 1));
+
+	if (!*pattern)
+		return !*text;
+
+	if (!*text)
+		return false;
+
+	if (*pattern == '?')
+		return ReferenceMatch(pattern + 1, text + 1);
+
+	if (*pattern == '\\' && (pattern[1] == '*' || pattern[1] == '?'))
+		pattern++;
+
+	return tolower(*pattern) == tolower(*text) && ReferenceMatch(pattern + 1, text + 1);
+}
+
+BOOST_AUTO_TEST_CASE(random)
+{
+	std::mt19937 rng (42);
+
+	for (int i = 0; i < 100000; i++) {
+		String pattern, text;
+
+		for (auto length (rng() % 7); length; length--)
+			pattern += "ab*?\\A"[rng() % 6];
+
+		for (auto length (rng() % 8); length; length--)
+			text += "abAB*?\\"[rng() % 7];
+
+		BOOST_CHECK_MESSAGE(WildcardPattern(pattern).Match(text) == ReferenceMatch(pattern.CStr(), text.CStr()),
+			"pattern '" << pattern << "', text '" << text << "'");
+	}
+}
+
+BOOST_AUTO_TEST_CASE(regex_cache)
+{
+	auto regex (RegexCache::Get("^(db|app)-[0-9]+"));
+
+	BOOST_CHECK(boost::regex_search("app-42.example.com", *regex));
+	BOOST_CHECK(RegexCache::Get("^(db|app)-[0-9]+") == regex);
+	BOOST_CHECK_THROW(RegexCache::Get("("), boost::regex_error);
+
+	for (size_t i = 0; i < RegexCache::Capacity + 10; i++)
+		RegexCache::Get("^host-" + std::to_string(i) + "$");
+
+	BOOST_CHECK_EQUAL(RegexCache::GetSize(), RegexCache::Capacity);
+	BOOST_CHECK(RegexCache::Get("^(db|app)-[0-9]+") != regex);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
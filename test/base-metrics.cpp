@@ -0,0 +1,67 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/metrics.hpp"
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_metrics)
+
+BOOST_AUTO_TEST_CASE(format)
+{
+	MetricsWriter writer;
+
+	writer.AddCounter("requests_total", "Requests", 3, { { "method", "GET" } });
+	writer.AddGauge("backlog", "Backlog", 1.5);
+	writer.AddCounter("requests_total", "Requests", 4, { { "method", "POST" } });
+
+	BOOST_CHECK_EQUAL(writer.Format(),
+		"# HELP requests_total Requests\n"
+		"# TYPE requests_total counter\n"
+		"requests_total{method=\"GET\"} 3\n"
+		"requests_total{method=\"POST\"} 4\n"
+		"# HELP backlog Backlog\n"
+		"# TYPE backlog gauge\n"
+		"backlog 1.5\n");
+}
+
+BOOST_AUTO_TEST_CASE(escape)
+{
+	MetricsWriter writer;
+
+	writer.AddGauge("up", "Line\nbreak", 1, { { "name", "a\"b\\c" } });
+
+	BOOST_CHECK_EQUAL(writer.Format(),
+		"# HELP up Line\\nbreak\n"
+		"# TYPE up gauge\n"
+		"up{name=\"a\\\"b\\\\c\"} 1\n");
+}
+
+BOOST_AUTO_TEST_CASE(summary)
+{
+	MetricsWriter writer;
+	Histogram histogram;
+
+	histogram.Record(1);
+	histogram.Record(1);
+
+	writer.AddSummary("latency_seconds", "Latency", histogram);
+
+	String text = writer.Format();
+
+	BOOST_CHECK(text.Contains("# TYPE latency_seconds summary\n"));
+	BOOST_CHECK(text.Contains("latency_seconds{quantile=\"0.5\"} "));
+	BOOST_CHECK(text.Contains("latency_seconds_sum 2\n"));
+	BOOST_CHECK(text.Contains("latency_seconds_count 2\n"));
+}
+
+BOOST_AUTO_TEST_CASE(type_mismatch)
+{
+	MetricsWriter writer;
+
+	writer.AddGauge("up", "Up", 1);
+
+	BOOST_CHECK_THROW(writer.AddCounter("up", "Up", 1), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
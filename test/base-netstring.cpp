@@ -3,6 +3,8 @@
 #include "base/netstring.hpp"
 #include "base/fifo.hpp"
 #include <BoostTestTargetConfig.h>
+#include <algorithm>
+#include <cstring>
 
 using namespace icinga;
 
@@ -22,4 +24,73 @@ BOOST_AUTO_TEST_CASE(netstring)
 	fifo->Close();
 }
 
+BOOST_AUTO_TEST_CASE(buffer)
+{
+	std::string buffer;
+
+	BOOST_CHECK(NetString::WriteStringToBuffer(buffer, "hello") == 8u);
+	BOOST_CHECK(NetString::WriteStringToBuffer(buffer, "") == 3u);
+	BOOST_CHECK(buffer == "5:hello,0:,");
+
+	FIFO::Ptr fifo = new FIFO();
+	fifo->Write(buffer.data(), buffer.size());
+
+	String s;
+	StreamReadContext src;
+	BOOST_CHECK(NetString::ReadStringFromStream(fifo, &s, src) == StatusNewItem);
+	BOOST_CHECK(s == "hello");
+	BOOST_CHECK(NetString::ReadStringFromStream(fifo, &s, src) == StatusNewItem);
+	BOOST_CHECK(s == "");
+
+	fifo->Close();
+}
+
+/* Like NetStringReader::Read(), the data may take several reads. */
+static void Feed(NetStringReader& reader, const std::string& data)
+{
+	for (size_t offset = 0; offset < data.size();) {
+		auto buffer (reader.Prepare());
+		size_t bytes = std::min(buffer.size(), data.size() - offset);
+
+		memcpy(buffer.data(), data.data() + offset, bytes);
+		reader.Commit(bytes);
+
+		offset += bytes;
+	}
+}
+
+BOOST_AUTO_TEST_CASE(reader)
+{
+	NetStringReader reader (16);
+	boost::string_view message;
+
+	BOOST_CHECK(!reader.Parse(message));
+
+	Feed(reader, "5:hello,0:,1");
+	BOOST_CHECK(reader.Parse(message) && message == "hello");
+	BOOST_CHECK(reader.Parse(message) && message == "");
+	BOOST_CHECK(!reader.Parse(message));
+
+	/* Longer than the buffer, which has to grow. */
+	std::string payload (100, 'x');
+
+	Feed(reader, "00:" + payload.substr(0, 50));
+	BOOST_CHECK(!reader.Parse(message));
+
+	Feed(reader, payload.substr(50) + ",");
+	BOOST_CHECK(reader.Parse(message) && message == payload);
+	BOOST_CHECK(reader.GetCapacity() >= 105u);
+}
+
+BOOST_AUTO_TEST_CASE(reader_invalid)
+{
+	for (const char *data : { ":hi,", "01:x,", "1234567890:", "1x", "2:hi;", "10:" }) {
+		NetStringReader reader;
+		boost::string_view message;
+
+		Feed(reader, data);
+		BOOST_CHECK_THROW(reader.Parse(message, 5), std::invalid_argument);
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
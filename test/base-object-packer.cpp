@@ -5,11 +5,14 @@
 #include "base/string.hpp"
 #include "base/array.hpp"
 #include "base/dictionary.hpp"
+#include "base/tlsutility.hpp"
 #include <BoostTestTargetConfig.h>
 #include <climits>
 #include <initializer_list>
 #include <iomanip>
 #include <sstream>
+#include <stdexcept>
+#include <string>
 
 using namespace icinga;
 
@@ -261,4 +264,69 @@ BOOST_AUTO_TEST_CASE(pack_object)
 	));
 }
 
+BOOST_AUTO_TEST_CASE(pack_object_sha1)
+{
+	Dictionary::Ptr dict = new Dictionary({
+		{"null", Empty},
+		{"true", true},
+		{"42.125", 42.125},
+		{"foobar", "foobar"},
+		{"long", String(10000, 'x')},
+		{"[]", (Array::Ptr)new Array({1, "2", (Dictionary::Ptr)new Dictionary()})}
+	});
+
+	BOOST_CHECK_EQUAL(PackObjectSHA1(Empty), SHA1(PackObject(Empty)));
+	BOOST_CHECK_EQUAL(PackObjectSHA1("foobar"), SHA1(PackObject("foobar")));
+	BOOST_CHECK_EQUAL(PackObjectSHA1(dict), SHA1(PackObject(dict)));
+
+	BOOST_CHECK_EQUAL(PackObjectSHA1(dict, {"long", "true"}, false), SHA1(PackObject((Dictionary::Ptr)new Dictionary({
+		{"null", Empty},
+		{"42.125", 42.125},
+		{"foobar", "foobar"},
+		{"[]", dict->Get("[]")}
+	}))));
+
+	BOOST_CHECK_EQUAL(PackObjectSHA1(dict, {"long", "true", "missing"}, true), SHA1(PackObject((Dictionary::Ptr)new Dictionary({
+		{"long", dict->Get("long")},
+		{"true", true}
+	}))));
+
+	BOOST_CHECK_EQUAL(PackObjectSHA1(dict, {}, true), SHA1(PackObject(dict)));
+}
+
+BOOST_AUTO_TEST_CASE(unpack_object)
+{
+	Dictionary::Ptr dict = new Dictionary({
+		{"null", Empty},
+		{"true", true},
+		{"false", false},
+		{"42.125", 42.125},
+		{"foobar", "foobar"},
+		{"[]", (Array::Ptr)new Array({1, "2", (Dictionary::Ptr)new Dictionary()})}
+	});
+
+	std::string packed;
+	PackObject(dict, packed);
+	PackUInt64(42, packed);
+	PackObject("foobar", packed);
+
+	BOOST_CHECK_EQUAL(packed, PackObject(dict).GetData() + std::string("\0\0\0\0\0\0\0\x2a", 8) + PackObject("foobar").GetData());
+
+	const char *begin = packed.data();
+	const char *end = packed.data() + packed.size();
+
+	Dictionary::Ptr unpacked = UnpackObject(begin, end);
+	BOOST_CHECK_EQUAL(PackObject(unpacked), PackObject(dict));
+	BOOST_CHECK_EQUAL(UnpackUInt64(begin, end), 42);
+	BOOST_CHECK_EQUAL(String(UnpackObject(begin, end)), "foobar");
+	BOOST_CHECK(begin == end);
+
+	begin = packed.data();
+	BOOST_CHECK_THROW(UnpackObject(begin, packed.data() + 20), std::invalid_argument);
+
+	std::string invalid ("\7");
+	begin = invalid.data();
+	BOOST_CHECK_THROW(UnpackObject(begin, invalid.data() + invalid.size()), std::invalid_argument);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,78 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/dictionary.hpp"
+#include "base/objectlock.hpp"
+#include "base/objectlockprofiler.hpp"
+#include <BoostTestTargetConfig.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_objectlock)
+
+BOOST_AUTO_TEST_CASE(contended)
+{
+	Dictionary::Ptr dict = new Dictionary();
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < 4; i++) {
+		threads.emplace_back([&dict]() {
+			for (int j = 0; j < 10000; j++) {
+				ObjectLock olock (dict);
+				dict->Set("counter", dict->Get("counter") + 1);
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	BOOST_CHECK(dict->Get("counter") == 40000);
+}
+
+BOOST_AUTO_TEST_CASE(profile)
+{
+	Configuration::ProfileObjectLocks = true;
+	ObjectLockProfiler::Reset();
+
+	Dictionary::Ptr dict = new Dictionary();
+	std::thread waiter;
+
+	{
+		ObjectLock olock (dict);
+
+		waiter = std::thread([&dict]() {
+			ObjectLock olock (dict);
+		});
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+
+	waiter.join();
+	Configuration::ProfileObjectLocks = false;
+
+	Array::Ptr report = ObjectLockProfiler::GetReport();
+	Dictionary::Ptr entry;
+
+	{
+		ObjectLock olock (report);
+
+		for (const Dictionary::Ptr& typeEntry : report) {
+			if (typeEntry->Get("type") == "Dictionary")
+				entry = typeEntry;
+		}
+	}
+
+	BOOST_REQUIRE(entry);
+	BOOST_CHECK(entry->Get("contentions") >= 1);
+	BOOST_CHECK(entry->Get("wait_max") > 0.01);
+	BOOST_CHECK(Array::Ptr(entry->Get("sites"))->GetLength() >= 1);
+
+	ObjectLockProfiler::Reset();
+
+	BOOST_CHECK(ObjectLockProfiler::GetReport()->GetLength() == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
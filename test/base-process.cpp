@@ -0,0 +1,43 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/process.hpp"
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_process)
+
+BOOST_AUTO_TEST_CASE(max_output_size)
+{
+#ifdef __linux__
+	Process::Ptr process = new Process({ "/bin/sh", "-c", "head -c 1000000 /dev/zero | tr '\\0' x; exit 3" });
+	process->SetMaxOutputSize(1000);
+	process->Run();
+
+	auto& result (process->WaitForResult());
+
+	BOOST_CHECK_EQUAL(result.ExitStatus, 3);
+	BOOST_CHECK_EQUAL(result.Output, String(1000, 'x') + "<Output truncated after 1000 bytes.>");
+
+	process = new Process({ "/bin/sh", "-c", "printf ok" });
+	process->SetMaxOutputSize(2);
+	process->Run();
+
+	BOOST_CHECK_EQUAL(process->WaitForResult().Output, "ok");
+#endif /* __linux__ */
+}
+
+BOOST_AUTO_TEST_CASE(usage)
+{
+#ifdef __linux__
+	Process::Ptr process = new Process({ "/bin/sh", "-c", "i=0; while [ $i -lt 200000 ]; do i=$((i+1)); done" });
+	process->Run();
+
+	auto& usage (process->WaitForResult().Usage);
+
+	BOOST_CHECK(usage.UserTime + usage.SystemTime > 0);
+	BOOST_CHECK(usage.MaxRss > 0);
+#endif /* __linux__ */
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,5 +1,6 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
+#include "base/filelogger.hpp"
 #include "base/perfdatavalue.hpp"
 #include "base/dictionary.hpp"
 #include "base/objectlock.hpp"
@@ -7,6 +8,7 @@
 #include "base/array.hpp"
 #include "base/dictionary.hpp"
 #include <BoostTestTargetConfig.h>
+#include <map>
 
 using namespace icinga;
 
@@ -65,4 +67,27 @@ BOOST_AUTO_TEST_CASE(object)
 	BOOST_CHECK(result->GetValue() == pdv->GetValue());
 }
 
+BOOST_AUTO_TEST_CASE(object_fields_once)
+{
+	FileLogger::Ptr logger = new FileLogger();
+	logger->SetName("serialize", true);
+	logger->SetPath("/dev/null", true);
+
+	std::map<String, int> visits;
+
+	logger->VisitFields(0, [&visits](const char *name, const Value&) {
+		visits[name]++;
+	});
+
+	BOOST_CHECK_EQUAL(visits.size(), static_cast<size_t>(FileLogger::TypeInstance->GetFieldCount()));
+
+	for (auto& kv : visits)
+		BOOST_CHECK_MESSAGE(kv.second == 1, "Field '" << kv.first << "' visited " << kv.second << " times");
+
+	Dictionary::Ptr config = Serialize(logger, FAConfig);
+
+	BOOST_CHECK(config->Get("name") == "serialize");
+	BOOST_CHECK(config->Get("path") == "/dev/null");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
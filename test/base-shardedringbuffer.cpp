@@ -0,0 +1,73 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/shardedringbuffer.hpp"
+#include <BoostTestTargetConfig.h>
+#include <thread>
+#include <vector>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_shardedringbuffer)
+
+BOOST_AUTO_TEST_CASE(sum)
+{
+	ShardedRingBuffer rb (10);
+
+	rb.InsertValue(100, 1);
+	rb.InsertValue(100, 2);
+	rb.InsertValue(101, 4);
+
+	BOOST_CHECK_EQUAL(rb.UpdateAndGetValues(101, 10), 7);
+	BOOST_CHECK_EQUAL(rb.UpdateAndGetValues(101, 1), 4);
+	BOOST_CHECK_EQUAL(rb.UpdateAndGetValues(101, 100), 7);
+}
+
+BOOST_AUTO_TEST_CASE(expiry)
+{
+	ShardedRingBuffer rb (10);
+
+	rb.InsertValue(100, 1);
+	rb.InsertValue(105, 2);
+
+	BOOST_CHECK_EQUAL(rb.UpdateAndGetValues(109, 10), 3);
+	BOOST_CHECK_EQUAL(rb.UpdateAndGetValues(110, 10), 2);
+
+	/* Reuses the slot of the second 100. */
+	rb.InsertValue(120, 5);
+	BOOST_CHECK_EQUAL(rb.UpdateAndGetValues(120, 10), 5);
+
+	/* Too old for the ring. */
+	rb.InsertValue(100, 1);
+	BOOST_CHECK_EQUAL(rb.UpdateAndGetValues(120, 10), 5);
+}
+
+BOOST_AUTO_TEST_CASE(rate)
+{
+	ShardedRingBuffer rb (60);
+
+	rb.InsertValue(100, 3);
+	rb.InsertValue(101, 3);
+
+	BOOST_CHECK_CLOSE(rb.CalculateRate(101, 60), 3.0, 0.001);
+	BOOST_CHECK_CLOSE(rb.CalculateRate(105, 60), 1.0, 0.001);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent)
+{
+	ShardedRingBuffer rb (60);
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < 8; i++) {
+		threads.emplace_back([&rb]() {
+			for (int j = 0; j < 10000; j++)
+				rb.InsertValue(1000, 1);
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	BOOST_CHECK_EQUAL(rb.UpdateAndGetValues(1000, 60), 80000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,111 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/signal.hpp"
+#include <memory>
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_signal)
+
+BOOST_AUTO_TEST_CASE(emit)
+{
+	Signal<void (int)> signal;
+	int sum = 0;
+
+	BOOST_CHECK(signal.empty());
+
+	signal(1);
+
+	SignalConnection a = signal.connect([&sum](int value) { sum += value; });
+	SignalConnection b = signal.connect([&sum](int value) { sum += value * 10; });
+
+	BOOST_CHECK(!signal.empty());
+	BOOST_CHECK(a.connected());
+
+	signal(2);
+	BOOST_CHECK_EQUAL(sum, 22);
+
+	a.disconnect();
+	BOOST_CHECK(!a.connected());
+
+	signal(3);
+	BOOST_CHECK_EQUAL(sum, 52);
+
+	b.disconnect();
+	BOOST_CHECK(signal.empty());
+}
+
+BOOST_AUTO_TEST_CASE(scoped)
+{
+	Signal<void ()> signal;
+	int calls = 0;
+
+	{
+		ScopedSignalConnection c (signal.connect([&calls]() { calls++; }));
+		signal();
+	}
+
+	signal();
+	BOOST_CHECK_EQUAL(calls, 1);
+}
+
+BOOST_AUTO_TEST_CASE(disconnect_during_emit)
+{
+	Signal<void ()> signal;
+	SignalConnection self;
+	int calls = 0;
+
+	self = signal.connect([&self, &calls]() {
+		calls++;
+		self.disconnect();
+	});
+
+	signal();
+	signal();
+	BOOST_CHECK_EQUAL(calls, 1);
+}
+
+BOOST_AUTO_TEST_CASE(release_disconnected)
+{
+	Signal<void ()> signal;
+	auto capture (std::make_shared<int>(0));
+
+	SignalConnection c = signal.connect([capture]() { (*capture)++; });
+	SignalConnection self;
+
+	self = signal.connect([&self, &c]() {
+		c.disconnect();
+		self.disconnect();
+	});
+
+	BOOST_CHECK_EQUAL(capture.use_count(), 2);
+
+	signal();
+	BOOST_CHECK_EQUAL(*capture, 1);
+
+	/* Released once the emission which disconnected it is done. */
+	BOOST_CHECK_EQUAL(capture.use_count(), 1);
+
+	for (int i = 0; i < 100; i++) {
+		ScopedSignalConnection scoped (signal.connect([capture]() { }));
+	}
+
+	BOOST_CHECK_EQUAL(capture.use_count(), 1);
+	BOOST_CHECK(signal.empty());
+}
+
+BOOST_AUTO_TEST_CASE(outlive_signal)
+{
+	SignalConnection c;
+
+	{
+		Signal<void ()> signal;
+		c = signal.connect([]() { });
+	}
+
+	c.disconnect();
+	BOOST_CHECK(!c.connected());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
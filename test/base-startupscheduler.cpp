@@ -0,0 +1,159 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/startupscheduler.hpp"
+#include "base/scriptglobal.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+/**
+ * Records the order in which the callbacks of StartupScheduler::Run() ran.
+ */
+class StartupTaskLog : public std::enable_shared_from_this<StartupTaskLog>
+{
+public:
+	std::function<void()> Record(const String& name)
+	{
+		auto self (shared_from_this());
+
+		return [self, name]() {
+			std::unique_lock<std::mutex> lock (self->m_Mutex);
+			self->m_Names.push_back(name);
+			self->m_CV.notify_all();
+		};
+	}
+
+	std::vector<String> WaitFor(size_t count, double timeout = 10)
+	{
+		std::unique_lock<std::mutex> lock (m_Mutex);
+
+		m_CV.wait_for(lock, std::chrono::duration<double>(timeout), [this, count]() { return m_Names.size() >= count; });
+
+		return m_Names;
+	}
+
+private:
+	std::mutex m_Mutex;
+	std::condition_variable m_CV;
+	std::vector<String> m_Names;
+};
+
+static Dictionary::Ptr GetTaskStats(const String& name)
+{
+	Dictionary::Ptr tasks = StartupScheduler::GetStats()->Get("tasks");
+
+	return tasks->Get(name);
+}
+
+BOOST_AUTO_TEST_SUITE(base_startupscheduler)
+
+BOOST_AUTO_TEST_CASE(priority)
+{
+	ScriptGlobal::Set("StartupConcurrency", 1);
+
+	auto log (std::make_shared<StartupTaskLog>());
+
+	{
+		StartupScheduler::Slot slot ({ "priority-blocker", 0, 0, "" });
+
+		StartupScheduler::Run({ "priority-low", 1, 0, "" }, log->Record("low"));
+		StartupScheduler::Run({ "priority-high", 5, 0, "" }, log->Record("high"));
+		StartupScheduler::Run({ "priority-medium", 3, 0, "" }, log->Record("medium"));
+
+		BOOST_CHECK_EQUAL(GetTaskStats("priority-low")->Get("waiting"), 1);
+		BOOST_CHECK(log->WaitFor(1, 0.2).empty());
+	}
+
+	std::vector<String> order = log->WaitFor(3);
+
+	BOOST_REQUIRE_EQUAL(order.size(), 3u);
+	BOOST_CHECK_EQUAL(order[0], "high");
+	BOOST_CHECK_EQUAL(order[1], "medium");
+	BOOST_CHECK_EQUAL(order[2], "low");
+
+	ScriptGlobal::Set("StartupConcurrency", 0);
+}
+
+BOOST_AUTO_TEST_CASE(max_concurrent)
+{
+	ScriptGlobal::Set("StartupConcurrency", 0);
+
+	auto log (std::make_shared<StartupTaskLog>());
+
+	{
+		StartupScheduler::Slot slot ({ "limited", 10, 1, "limited done" });
+
+		StartupScheduler::Run({ "limited", 10, 1, "limited done" }, log->Record("limited"));
+		StartupScheduler::Run({ "unlimited", 0, 0, "" }, log->Record("unlimited"));
+
+		/* The other task may run in the meantime, as it has a budget of its own. */
+		std::vector<String> order = log->WaitFor(1);
+
+		BOOST_REQUIRE_EQUAL(order.size(), 1u);
+		BOOST_CHECK_EQUAL(order[0], "unlimited");
+
+		Dictionary::Ptr stats = GetTaskStats("limited");
+
+		BOOST_CHECK_EQUAL(stats->Get("running"), 1);
+		BOOST_CHECK_EQUAL(stats->Get("waiting"), 1);
+	}
+
+	std::vector<String> order = log->WaitFor(2);
+
+	BOOST_REQUIRE_EQUAL(order.size(), 2u);
+	BOOST_CHECK_EQUAL(order[1], "limited");
+}
+
+BOOST_AUTO_TEST_CASE(overrides)
+{
+	ScriptGlobal::Set("StartupConcurrency", 0);
+	ScriptGlobal::Set("StartupTasks", new Dictionary({
+		{ "overridden", new Dictionary({ { "priority", 42 }, { "max_concurrent", 3 } }) }
+	}));
+
+	auto log (std::make_shared<StartupTaskLog>());
+
+	StartupScheduler::Run({ "overridden", 1, 1, "" }, log->Record("overridden"));
+
+	BOOST_CHECK_EQUAL(log->WaitFor(1).size(), 1u);
+
+	Dictionary::Ptr stats = GetTaskStats("overridden");
+
+	BOOST_CHECK_EQUAL(stats->Get("priority"), 42);
+	BOOST_CHECK_EQUAL(stats->Get("max_concurrent"), 3);
+
+	ScriptGlobal::Set("StartupTasks", Empty);
+}
+
+/* Keep this one last, the limits don't apply anymore afterwards. */
+BOOST_AUTO_TEST_CASE(finish)
+{
+	ScriptGlobal::Set("StartupConcurrency", 1);
+
+	auto log (std::make_shared<StartupTaskLog>());
+
+	StartupScheduler::Slot slot ({ "finish-blocker", 0, 0, "" });
+
+	StartupScheduler::Run({ "finish-waiting", 0, 0, "" }, log->Record("waiting"));
+
+	BOOST_CHECK(log->WaitFor(1, 0.2).empty());
+
+	StartupScheduler::Finish();
+
+	BOOST_CHECK_EQUAL(log->WaitFor(1).size(), 1u);
+	BOOST_CHECK(StartupScheduler::GetStats()->Get("finished").ToBool());
+
+	Dictionary::Ptr phases = StartupScheduler::GetStats()->Get("phases");
+
+	BOOST_CHECK(phases->Contains("startup finished"));
+
+	ScriptGlobal::Set("StartupConcurrency", 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
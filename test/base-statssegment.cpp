@@ -0,0 +1,72 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/metrics.hpp"
+#include "base/statssegment.hpp"
+#include "base/utility.hpp"
+#include <boost/filesystem.hpp>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_statssegment)
+
+static std::vector<char> ReadFile(const String& path)
+{
+	std::ifstream fp (path.CStr(), std::ifstream::binary);
+
+	return std::vector<char>(std::istreambuf_iterator<char>(fp), std::istreambuf_iterator<char>());
+}
+
+BOOST_AUTO_TEST_CASE(update)
+{
+	namespace fs = boost::filesystem;
+
+	String path = (fs::temp_directory_path() / fs::unique_path("icinga2-stats-%%%%-%%%%")).string();
+
+	{
+		StatsSegment segment (path);
+
+		MetricsWriter writer;
+		writer.AddCounter("requests_total", "Requests", 3, { { "method", "GET" } });
+		writer.AddGauge("backlog", "Backlog", 1.5);
+		writer.AddGauge("too_long", "Too long", 1, { { "name", String(200, 'x') } });
+
+		segment.Update(writer);
+
+		std::vector<char> data (ReadFile(path));
+
+		BOOST_REQUIRE(data.size() == sizeof(StatsSegmentHeader) + StatsSegment::Capacity * sizeof(StatsSegmentRecord));
+
+		auto header (reinterpret_cast<const StatsSegmentHeader *>(data.data()));
+		auto records (reinterpret_cast<const StatsSegmentRecord *>(data.data() + header->HeaderSize));
+
+		BOOST_CHECK(strcmp(header->Magic, "I2STATS") == 0);
+		BOOST_CHECK_EQUAL(header->Version, StatsSegment::Version);
+		BOOST_CHECK_EQUAL(header->RecordSize, sizeof(StatsSegmentRecord));
+		BOOST_CHECK_EQUAL(header->Sequence.load(), 2);
+		BOOST_CHECK_EQUAL(header->Pid, Utility::GetPid());
+		BOOST_REQUIRE_EQUAL(header->Count, 2);
+		BOOST_CHECK_EQUAL(header->Dropped, 1);
+
+		BOOST_CHECK_EQUAL(String(records[0].Key), "requests_total{method=\"GET\"}");
+		BOOST_CHECK_EQUAL(records[0].Value, 3);
+		BOOST_CHECK_EQUAL(String(records[1].Key), "backlog");
+		BOOST_CHECK_EQUAL(records[1].Value, 1.5);
+
+		segment.Update(MetricsWriter());
+
+		data = ReadFile(path);
+		header = reinterpret_cast<const StatsSegmentHeader *>(data.data());
+
+		BOOST_CHECK_EQUAL(header->Sequence.load(), 4);
+		BOOST_CHECK_EQUAL(header->Count, 0);
+	}
+
+	BOOST_CHECK(!Utility::PathExists(path));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,8 +1,12 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
+#include "base/convert.hpp"
+#include "base/gzipfilestream.hpp"
 #include "base/stdiostream.hpp"
 #include "base/string.hpp"
+#include "base/utility.hpp"
 #include <BoostTestTargetConfig.h>
+#include <fstream>
 #include <sstream>
 
 using namespace icinga;
@@ -36,4 +40,50 @@ BOOST_AUTO_TEST_CASE(readline_stdio)
 	stdstream->Close();
 }
 
+BOOST_AUTO_TEST_CASE(gzip_file)
+{
+	String path = "icinga2-test-gzip-" + Convert::ToString(Utility::GetPid());
+
+	GzipFileStream::Ptr out = new GzipFileStream(path, "wb1");
+	out->Write("Hello\nWorld\n", 12);
+	out->Close();
+
+	String line;
+
+	{
+		GzipFileStream::Ptr in = new GzipFileStream(path, "rb");
+		in->Seek(6);
+
+		StreamReadContext rlc;
+
+		BOOST_CHECK(in->ReadLine(&line, rlc) == StatusNewItem);
+		BOOST_CHECK(line == "World");
+
+		BOOST_CHECK(in->ReadLine(&line, rlc) == StatusNewItem);
+		BOOST_CHECK(line == "");
+
+		BOOST_CHECK(in->ReadLine(&line, rlc) == StatusEof);
+
+		in->Close();
+	}
+
+	/* Uncompressed files are read as they are. */
+	{
+		std::ofstream fp (path.CStr(), std::ofstream::trunc);
+		fp << "Hello\n";
+	}
+
+	{
+		GzipFileStream::Ptr in = new GzipFileStream(path, "rb");
+		StreamReadContext rlc;
+
+		BOOST_CHECK(in->ReadLine(&line, rlc) == StatusNewItem);
+		BOOST_CHECK(line == "Hello");
+
+		in->Close();
+	}
+
+	Utility::Remove(path);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,22 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/threadaffinity.hpp"
+#include <BoostTestTargetConfig.h>
+#include <stdexcept>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_threadaffinity)
+
+BOOST_AUTO_TEST_CASE(parse_cpu_list)
+{
+	BOOST_CHECK(ThreadAffinity::ParseCpuList("3") == std::vector<int>({ 3 }));
+	BOOST_CHECK(ThreadAffinity::ParseCpuList("0-3,8, 10-11") == std::vector<int>({ 0, 1, 2, 3, 8, 10, 11 }));
+
+	BOOST_CHECK_THROW(ThreadAffinity::ParseCpuList(""), std::invalid_argument);
+	BOOST_CHECK_THROW(ThreadAffinity::ParseCpuList("0-"), std::invalid_argument);
+	BOOST_CHECK_THROW(ThreadAffinity::ParseCpuList("3-1"), std::invalid_argument);
+	BOOST_CHECK_THROW(ThreadAffinity::ParseCpuList("node0"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
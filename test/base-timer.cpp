@@ -43,6 +43,24 @@ BOOST_AUTO_TEST_CASE(invoke)
 	BOOST_CHECK(counter >= 4 && counter <= 6);
 }
 
+BOOST_AUTO_TEST_CASE(invoke_wheel)
+{
+	Timer::SetTimingWheel(true);
+
+	Timer::Ptr timer = Timer::Create();
+	timer->OnTimerExpired.connect(&Callback);
+	timer->SetInterval(0.5);
+
+	counter = 0;
+	timer->Start();
+	Utility::Sleep(2.75);
+	timer->Stop();
+
+	Timer::SetTimingWheel(false);
+
+	BOOST_CHECK(counter >= 4 && counter <= 6);
+}
+
 BOOST_AUTO_TEST_CASE(scope)
 {
 	Timer::Ptr timer = Timer::Create();
@@ -80,6 +80,27 @@ BOOST_AUTO_TEST_CASE(validateutf8)
 	BOOST_CHECK(Utility::ValidateUTF8("\xC3\xA4") == "\xC3\xA4");
 }
 
+BOOST_AUTO_TEST_CASE(isvalidutf8)
+{
+	std::string ascii (37, 'a');
+
+	BOOST_CHECK(Utility::IsValidUTF8(""));
+	BOOST_CHECK(Utility::IsValidUTF8(ascii));
+
+	for (size_t i = 0; i <= ascii.size(); i++) {
+		std::string valid (ascii), invalid (ascii), truncated (ascii);
+
+		valid.insert(i, "\xC3\xA4");
+		invalid.insert(i, "\xFF");
+		truncated.insert(i, "\xE2\x82");
+
+		BOOST_CHECK(Utility::IsValidUTF8(valid));
+		BOOST_CHECK(!Utility::IsValidUTF8(invalid));
+		BOOST_CHECK(!Utility::IsValidUTF8(truncated));
+		BOOST_CHECK(Utility::ValidateUTF8(invalid) == ascii.substr(0, i) + "\xEF\xBF\xBD" + ascii.substr(i));
+	}
+}
+
 BOOST_AUTO_TEST_CASE(EscapeCreateProcessArg)
 {
 #ifdef _WIN32
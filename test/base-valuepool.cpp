@@ -0,0 +1,85 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/valuepool.hpp"
+#include "base/array.hpp"
+#include "base/dictionary.hpp"
+#include "base/function.hpp"
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_valuepool)
+
+static Dictionary::Ptr MakeVars()
+{
+	return new Dictionary({
+		{ "ports", new Array({ 22, 80, 443 }) },
+		{ "thresholds", new Dictionary({ { "warn", 80 }, { "crit", 90 } }) },
+		{ "team", "ops" }
+	});
+}
+
+BOOST_AUTO_TEST_CASE(share)
+{
+	ValuePool pool;
+
+	Dictionary::Ptr vars1 = MakeVars();
+	Dictionary::Ptr vars2 = MakeVars();
+
+	pool.ShareElements(vars1);
+	BOOST_CHECK(pool.GetSharedCount() == 0);
+	BOOST_CHECK(!Array::Ptr(vars1->Get("ports"))->IsFrozen());
+
+	pool.ShareElements(vars2);
+	BOOST_CHECK(pool.GetSharedCount() == 2);
+
+	BOOST_CHECK(vars1 != vars2);
+	BOOST_CHECK(vars1->Get("ports") == vars2->Get("ports"));
+	BOOST_CHECK(vars1->Get("thresholds") == vars2->Get("thresholds"));
+
+	/* shared values are frozen, the dictionaries they're elements of aren't */
+	BOOST_CHECK(Array::Ptr(vars2->Get("ports"))->IsFrozen());
+	BOOST_CHECK(Dictionary::Ptr(vars2->Get("thresholds"))->IsFrozen());
+	BOOST_CHECK(!vars2->IsFrozen());
+
+	vars2->Set("team", "dev");
+	BOOST_CHECK(vars1->Get("team") == "ops");
+}
+
+BOOST_AUTO_TEST_CASE(different)
+{
+	ValuePool pool;
+
+	Dictionary::Ptr vars1 = MakeVars();
+	Dictionary::Ptr vars2 = MakeVars();
+	Dictionary::Ptr(vars2->Get("thresholds"))->Set("crit", 95);
+
+	pool.ShareElements(vars1);
+	pool.ShareElements(vars2);
+
+	BOOST_CHECK(pool.GetSharedCount() == 1);
+	BOOST_CHECK(vars1->Get("ports") == vars2->Get("ports"));
+	BOOST_CHECK(vars1->Get("thresholds") != vars2->Get("thresholds"));
+}
+
+static Value TestFunction(const std::vector<Value>&)
+{
+	return Empty;
+}
+
+BOOST_AUTO_TEST_CASE(functions)
+{
+	ValuePool pool;
+
+	Function::Ptr func = new Function("test", TestFunction);
+
+	Value value1 = new Array({ func });
+	Value value2 = new Array({ func });
+
+	/* values other than dictionaries, arrays and scalars aren't compared */
+	BOOST_CHECK(pool.Share(value1) == value1);
+	BOOST_CHECK(pool.Share(value2) == value2);
+	BOOST_CHECK(pool.GetSharedCount() == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/workqueue.hpp"
+#include "base/lock-free-queue.hpp"
+#include "base/utility.hpp"
+#include <BoostTestTargetConfig.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(base_workqueue)
+
+BOOST_AUTO_TEST_CASE(lockfreequeue)
+{
+	LockFreeQueue<int> queue (3);
+	BOOST_CHECK(queue.GetCapacity() == 4);
+
+	for (int i = 0; i < 4; i++) {
+		int item = i;
+		BOOST_CHECK(queue.TryPush(item));
+	}
+
+	int item = 42;
+	BOOST_CHECK(!queue.TryPush(item));
+	BOOST_CHECK(item == 42);
+	BOOST_CHECK(queue.GetLength() == 4);
+
+	for (int i = 0; i < 4; i++) {
+		BOOST_CHECK(queue.TryPop(item));
+		BOOST_CHECK(item == i);
+	}
+
+	BOOST_CHECK(!queue.TryPop(item));
+	BOOST_CHECK(queue.GetLength() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(lockfree_order)
+{
+	WorkQueue wq (0, 1, LogInformation, true);
+	wq.SetName("lockfree_order");
+	BOOST_CHECK(wq.IsLockFree());
+
+	std::vector<int> order;
+
+	for (int i = 0; i < 1000; i++) {
+		wq.Enqueue([&order, i]() { order.push_back(i); });
+	}
+
+	wq.Join();
+
+	BOOST_CHECK(wq.GetLength() == 0);
+	BOOST_REQUIRE(order.size() == 1000);
+
+	for (int i = 0; i < 1000; i++) {
+		BOOST_CHECK(order[i] == i);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(lockfree_producers)
+{
+	/* A small limit exercises backpressure as well as the overflow lists. */
+	WorkQueue wq (8, 4, LogInformation, true);
+	wq.SetName("lockfree_producers");
+
+	std::atomic<int> counter (0);
+	std::vector<std::thread> producers;
+
+	for (int i = 0; i < 4; i++) {
+		producers.emplace_back([&wq, &counter, i]() {
+			for (int j = 0; j < 2500; j++) {
+				wq.Enqueue([&wq, &counter, j]() {
+					counter++;
+
+					if (j % 100 == 0) {
+						/* Enqueued from within a worker, so this must never block. */
+						wq.Enqueue([&counter]() { counter++; }, PriorityHigh);
+					}
+				}, static_cast<WorkQueuePriority>(i % 3));
+			}
+		});
+	}
+
+	for (auto& producer : producers) {
+		producer.join();
+	}
+
+	wq.Join();
+
+	BOOST_CHECK(counter.load() == 4 * 2500 + 4 * 25);
+	BOOST_CHECK(wq.GetLength() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(parallelfor_stealing)
+{
+	WorkQueue wq (0, 4);
+	wq.SetName("parallelfor_stealing");
+
+	std::vector<int> items;
+
+	for (int i = 0; i < 1000; i++) {
+		items.push_back(i);
+	}
+
+	std::vector<std::atomic<int>> seen (items.size());
+
+	/* All the expensive items end up in the share of the first worker. */
+	wq.ParallelForStealing(items, [&seen](int item) {
+		if (item < 100)
+			Utility::Sleep(0.002);
+
+		seen[item]++;
+	});
+
+	wq.Join();
+
+	for (auto& count : seen) {
+		BOOST_CHECK(count.load() == 1);
+	}
+
+	BOOST_CHECK(wq.GetParallelForSteals() > 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,84 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "benchutility.hpp"
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+
+#ifndef _WIN32
+#	include <sys/resource.h>
+#	include <unistd.h>
+#endif /* _WIN32 */
+
+using namespace icinga;
+
+/**
+ * @returns A monotonic timestamp in seconds, only meaningful relative to another one.
+ */
+double BenchUtility::GetMonotonicTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @returns The CPU time (user and system) used by this process so far, in seconds.
+ */
+double BenchUtility::GetCpuTime()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0;
+
+	auto toSeconds ([](const FILETIME& ft) {
+		return ((static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) / 1e7;
+	});
+
+	return toSeconds(kernel) + toSeconds(user);
+#else /* _WIN32 */
+	rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		return 0;
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif /* _WIN32 */
+}
+
+/**
+ * @returns The resident set size of this process in bytes or 0 if unknown.
+ */
+double BenchUtility::GetResidentMemory()
+{
+#ifdef __linux__
+	std::ifstream fp ("/proc/self/statm");
+	double pages = 0, resident = 0;
+
+	if (fp >> pages >> resident)
+		return resident * sysconf(_SC_PAGESIZE);
+#endif /* __linux__ */
+
+	return 0;
+}
+
+/**
+ * @returns The peak resident set size of this process so far in bytes or 0 if unknown.
+ */
+double BenchUtility::GetPeakResidentMemory()
+{
+#ifdef _WIN32
+	return 0;
+#else /* _WIN32 */
+	rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		return 0;
+
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else /* __APPLE__ */
+	return usage.ru_maxrss * 1024.0;
+#endif /* __APPLE__ */
+#endif /* _WIN32 */
+}
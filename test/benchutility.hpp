@@ -0,0 +1,28 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef BENCHUTILITY_H
+#define BENCHUTILITY_H
+
+#include "base/i2-base.hpp"
+
+namespace icinga
+{
+
+/**
+ * Timing and memory probes shared by the benchmark programs.
+ */
+class BenchUtility
+{
+public:
+	static double GetMonotonicTime();
+	static double GetCpuTime();
+	static double GetResidentMemory();
+	static double GetPeakResidentMemory();
+
+private:
+	BenchUtility();
+};
+
+}
+
+#endif /* BENCHUTILITY_H */
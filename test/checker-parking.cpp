@@ -0,0 +1,131 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "checker/checkercomponent.hpp"
+#include "icinga/host.hpp"
+#include "icinga/timeperiod.hpp"
+#include "base/utility.hpp"
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+static TimePeriod::Ptr MakeTimePeriod(const String& name, double now, double begin, double end)
+{
+	TimePeriod::Ptr tp = new TimePeriod();
+	tp->SetName(name);
+	tp->SetValidBegin(now - 3600);
+	tp->SetValidEnd(now + 2 * 86400);
+	tp->SetSegments(new Array({ new Dictionary({ { "begin", begin }, { "end", end } }) }));
+	tp->Register();
+
+	return tp;
+}
+
+/**
+ * Activates a host whose next check was postponed before, like after a restart.
+ */
+static Host::Ptr MakeParkedHost(const String& name, const String& period, double nextCheck)
+{
+	Host::Ptr host = new Host();
+	host->SetName(name);
+	host->SetCheckInterval(300);
+	host->SetRetryInterval(60);
+	host->SetCheckPeriodRaw(period);
+	host->SetNextCheck(nextCheck);
+	host->Register();
+	host->SetActive(true);
+
+	return host;
+}
+
+static bool WaitForNextCheck(const Host::Ptr& host, double previous)
+{
+	for (int i = 0; i < 100 && host->GetNextCheck() == previous; i++)
+		Utility::Sleep(0.1);
+
+	return host->GetNextCheck() != previous;
+}
+
+struct CheckerParkingFixture
+{
+	CheckerParkingFixture()
+		: Checker(new CheckerComponent())
+	{
+		Checker->SetName("checker-parking");
+		Checker->OnConfigLoaded();
+	}
+
+	CheckerComponent::Ptr Checker;
+};
+
+BOOST_FIXTURE_TEST_SUITE(checker_parking, CheckerParkingFixture)
+
+BOOST_AUTO_TEST_CASE(segments_changed)
+{
+	double now = Utility::GetTime();
+	TimePeriod::Ptr tp = MakeTimePeriod("parking-segments", now, now + 86400, now + 86400 + 3600);
+	Host::Ptr host = MakeParkedHost("parking-segments", "parking-segments", now + 86400 + 100);
+
+	/* Still the first one inside the next segment */
+	BOOST_CHECK_EQUAL(host->GetNextCheck(), now + 86400 + 100);
+
+	/* The period starts earlier now. */
+	tp->SetSegments(new Array({ new Dictionary({ { "begin", now + 3600 }, { "end", now + 7200 } }) }));
+
+	BOOST_REQUIRE(WaitForNextCheck(host, now + 86400 + 100));
+	BOOST_CHECK_GT(host->GetNextCheck(), now + 3600);
+	BOOST_CHECK_LE(host->GetNextCheck(), now + 3600 + 300);
+}
+
+BOOST_AUTO_TEST_CASE(period_switched)
+{
+	double now = Utility::GetTime();
+	MakeTimePeriod("parking-old", now, now + 86400, now + 86400 + 3600);
+	MakeTimePeriod("parking-new", now, now + 600, now + 1200);
+	Host::Ptr host = MakeParkedHost("parking-switched", "parking-old", now + 86400 + 100);
+
+	host->SetCheckPeriodRaw("parking-new");
+
+	BOOST_CHECK_GT(host->GetNextCheck(), now + 600);
+	BOOST_CHECK_LE(host->GetNextCheck(), now + 900 + 1);
+
+	/* Without a check period the check is back at its usual time. */
+	host->SetCheckPeriodRaw("");
+
+	BOOST_CHECK_LE(host->GetNextCheck(), Utility::GetTime() + 300);
+}
+
+BOOST_AUTO_TEST_CASE(period_active)
+{
+	double now = Utility::GetTime();
+	MakeTimePeriod("parking-active", now, now - 60, now + 86400);
+
+	/* Parked before the period changed while the daemon wasn't running */
+	Host::Ptr host = MakeParkedHost("parking-active", "parking-active", now + 3 * 86400 / 2);
+
+	BOOST_CHECK_LE(host->GetNextCheck(), Utility::GetTime() + 300);
+}
+
+BOOST_AUTO_TEST_CASE(retry_interval)
+{
+	double now = Utility::GetTime();
+	MakeTimePeriod("parking-retry", now, now + 600, now + 1200);
+
+	CheckResult::Ptr cr = new CheckResult();
+	cr->SetState(ServiceCritical);
+
+	Host::Ptr host = new Host();
+	host->SetName("parking-retry");
+	host->SetCheckInterval(3600);
+	host->SetRetryInterval(60);
+	host->SetCheckPeriodRaw("parking-retry");
+	host->SetStateType(StateTypeSoft);
+	host->SetLastCheckResult(cr);
+	host->SetNextCheck(now + 86400);
+	host->Register();
+	host->SetActive(true);
+
+	BOOST_CHECK_GT(host->GetNextCheck(), now + 600);
+	BOOST_CHECK_LE(host->GetNextCheck(), now + 660 + 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,129 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "checker/passiveresultlistener.hpp"
+#include "icinga/host.hpp"
+#include "remote/apiuser.hpp"
+#include "base/convert.hpp"
+#include "base/tlsutility.hpp"
+#include "base/utility.hpp"
+#include <BoostTestTargetConfig.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+using namespace icinga;
+
+static String MakeDatagram(const String& user, const String& password, double timestamp, const String& results)
+{
+	String payload = user + " " + Convert::ToString(static_cast<long>(timestamp)) + "\n" + results;
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digestLength = 0;
+
+	HMAC(EVP_sha256(), password.CStr(), password.GetLength(), reinterpret_cast<const unsigned char *>(payload.CStr()),
+		payload.GetLength(), digest, &digestLength);
+
+	return "PR1 " + BinaryToHex(digest, digestLength) + " " + payload;
+}
+
+struct PassiveResultListenerFixture
+{
+	PassiveResultListenerFixture()
+		: Listener(new PassiveResultListener()), Telemetry(new Host())
+	{
+		Listener->SetName("passive-results");
+		Listener->Register();
+
+		ApiUser::Ptr user = new ApiUser();
+		user->SetName("telemetry");
+		user->SetPassword("secret");
+		user->SetPermissions(new Array({ "actions/process-check-result" }), true);
+		user->Register();
+
+		Telemetry->SetName("gateway1");
+		Telemetry->Register();
+		Telemetry->SetActive(true);
+	}
+
+	void Process(const String& datagram)
+	{
+		Listener->ProcessDatagram(datagram.CStr(), datagram.GetLength());
+	}
+
+	double GetStat(const String& name)
+	{
+		Dictionary::Ptr status = new Dictionary();
+		PassiveResultListener::StatsFunc(status, new Array());
+
+		Dictionary::Ptr listeners = status->Get("passiveresultlistener");
+		Dictionary::Ptr stats = listeners->Get(Listener->GetName());
+
+		return stats->Get(name);
+	}
+
+	PassiveResultListener::Ptr Listener;
+	Host::Ptr Telemetry;
+};
+
+BOOST_FIXTURE_TEST_SUITE(checker_passiveresultlistener, PassiveResultListenerFixture)
+
+BOOST_AUTO_TEST_CASE(parse)
+{
+	Process(MakeDatagram("telemetry", "secret", Utility::GetTime(),
+		"gateway1\t\t1\tuplink\\tdown\\\\\tthroughput=0\n"
+		"gateway1\tuplink\n"
+		"unknown\t\t0\tOK\n"
+		"\n"));
+
+	BOOST_CHECK_EQUAL(GetStat("results"), 1);
+	BOOST_CHECK_EQUAL(GetStat("invalid_results"), 2);
+	BOOST_CHECK_EQUAL(GetStat("rejected_datagrams"), 0);
+
+	CheckResult::Ptr cr = Telemetry->GetLastCheckResult();
+	BOOST_REQUIRE(cr);
+	BOOST_CHECK_EQUAL(cr->GetOutput(), "uplink\tdown\\");
+	BOOST_CHECK_EQUAL(cr->GetState(), ServiceCritical);
+	BOOST_CHECK(!cr->GetActive());
+	BOOST_CHECK_EQUAL(cr->GetPerformanceData()->GetLength(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(auth_failure)
+{
+	double now = Utility::GetTime();
+
+	/* Malformed header */
+	Process("PR1 deadbeef telemetry\ngateway1\t\t0\tOK\n");
+	/* Wrong password */
+	Process(MakeDatagram("telemetry", "wrong", now, "gateway1\t\t0\tOK\n"));
+	/* Unknown user */
+	Process(MakeDatagram("nobody", "secret", now, "gateway1\t\t0\tOK\n"));
+	/* Outside max_clock_skew */
+	Process(MakeDatagram("telemetry", "secret", now - Listener->GetMaxClockSkew() - 60, "gateway1\t\t0\tOK\n"));
+
+	/* Tampered results */
+	String datagram = MakeDatagram("telemetry", "secret", now, "gateway1\t\t0\tOK\n");
+	Process(datagram.SubStr(0, datagram.GetLength() - 3) + "UP\n");
+
+	BOOST_CHECK_EQUAL(GetStat("rejected_datagrams"), 5);
+	BOOST_CHECK_EQUAL(GetStat("results"), 0);
+	BOOST_CHECK(!Telemetry->GetLastCheckResult());
+}
+
+BOOST_AUTO_TEST_CASE(replay)
+{
+	double now = Utility::GetTime();
+	String datagram = MakeDatagram("telemetry", "secret", now, "gateway1\t\t0\tOK\n");
+
+	Process(datagram);
+	Process(datagram);
+
+	BOOST_CHECK_EQUAL(GetStat("results"), 1);
+	BOOST_CHECK_EQUAL(GetStat("replayed_datagrams"), 1);
+	BOOST_CHECK_EQUAL(GetStat("rejected_datagrams"), 0);
+
+	/* Same results, but a new timestamp */
+	Process(MakeDatagram("telemetry", "secret", now + 1, "gateway1\t\t0\tOK\n"));
+
+	BOOST_CHECK_EQUAL(GetStat("results"), 2);
+	BOOST_CHECK_EQUAL(GetStat("replayed_datagrams"), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
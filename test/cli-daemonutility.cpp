@@ -0,0 +1,128 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "cli/daemonutility.hpp"
+#include "config/configcompiler.hpp"
+#include "config/configitem.hpp"
+#include "icinga/host.hpp"
+#include "base/configuration.hpp"
+#include "base/scriptframe.hpp"
+#include "base/utility.hpp"
+#include "base/workqueue.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+static void WriteReloadConfig(const String& path, const String& checkCommand, int version)
+{
+	std::ofstream fp (path.CStr(), std::ofstream::out | std::ofstream::trunc);
+
+	fp << "object CheckCommand \"reload-command\" {\n"
+		<< "\tcommand = [ \"true\" ]\n"
+		<< "}\n"
+		<< "\n"
+		<< "object Host \"reload-host\" {\n"
+		<< "\tcheck_command = \"" << checkCommand << "\"\n"
+		<< "\tvars.version = " << version << "\n"
+		<< "}\n";
+}
+
+/**
+ * Loads the config file the way the daemon does with incremental reloads enabled.
+ */
+static void LoadReloadConfig(const String& path)
+{
+	std::vector<ConfigItem::Ptr> newItems;
+
+	{
+		ActivationScope ascope;
+
+		ConfigCompiler::SetRecordCompiledFiles(true);
+
+		ScriptFrame frame (true);
+		ConfigCompiler::CompileFile(path, String(), "_etc")->Evaluate(frame);
+
+		ConfigCompiler::SetRecordCompiledFiles(false);
+
+		WorkQueue upq (25000, Configuration::Concurrency);
+
+		BOOST_REQUIRE(ConfigItem::CommitItems(ascope.GetContext(), upq, newItems, true));
+	}
+
+	BOOST_REQUIRE(ConfigItem::ActivateItems(newItems));
+
+	DaemonUtility::EnableIncrementalReload({ path.GetData() });
+}
+
+static void CheckReloadHost(int version)
+{
+	Host::Ptr host = Host::GetByName("reload-host");
+
+	BOOST_REQUIRE(host);
+	BOOST_CHECK(host->IsActive());
+	BOOST_CHECK_EQUAL(host->GetVars()->Get("version"), version);
+}
+
+BOOST_AUTO_TEST_SUITE(cli_daemonutility)
+
+BOOST_AUTO_TEST_CASE(reload_failed)
+{
+	namespace fs = boost::filesystem;
+
+	fs::path dir = fs::temp_directory_path() / fs::unique_path("icinga2-reload-%%%%-%%%%");
+	fs::create_directories(dir);
+
+	Configuration::ZonesDir = (dir / "zones.d").string();
+	Configuration::DataDir = (dir / "data").string();
+
+	String path = (dir / "icinga2.conf").string();
+
+	WriteReloadConfig(path, "reload-command", 1);
+	LoadReloadConfig(path);
+	CheckReloadHost(1);
+
+	/* The changed definition doesn't validate, the previous host is restored. */
+	WriteReloadConfig(path, "reload-missing", 2);
+
+	BOOST_CHECK(!DaemonUtility::ReloadConfigFiles());
+	CheckReloadHost(1);
+
+	/* The failed attempt doesn't count as applied. */
+	BOOST_CHECK(!DaemonUtility::ReloadConfigFiles());
+	CheckReloadHost(1);
+
+	WriteReloadConfig(path, "reload-command", 3);
+
+	BOOST_CHECK(DaemonUtility::ReloadConfigFiles());
+	CheckReloadHost(3);
+
+	fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(reload_new_file)
+{
+	namespace fs = boost::filesystem;
+
+	fs::path dir = fs::temp_directory_path() / fs::unique_path("icinga2-reload-%%%%-%%%%");
+	fs::create_directories(dir);
+
+	Configuration::ZonesDir = (dir / "zones.d").string();
+	Configuration::DataDir = (dir / "data").string();
+
+	String path = (dir / "icinga2.conf").string();
+
+	WriteReloadConfig(path, "reload-command", 1);
+	LoadReloadConfig(path);
+
+	/* New files need a full reload, the objects stay as they are. */
+	std::ofstream ((dir / "new.conf").string()) << "object Host \"reload-new\" { check_command = \"reload-command\" }\n";
+
+	BOOST_CHECK(!DaemonUtility::ReloadConfigFiles());
+	CheckReloadHost(1);
+	BOOST_CHECK(!Host::GetByName("reload-new"));
+
+	fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
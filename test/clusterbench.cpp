@@ -0,0 +1,436 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "benchutility.hpp"
+#include "remote/apifunction.hpp"
+#include "remote/jsonrpcconnection.hpp"
+#include "remote/messageorigin.hpp"
+#include "base/application.hpp"
+#include "base/array.hpp"
+#include "base/configuration.hpp"
+#include "base/convert.hpp"
+#include "base/dictionary.hpp"
+#include "base/exception.hpp"
+#include "base/histogram.hpp"
+#include "base/io-engine.hpp"
+#include "base/json.hpp"
+#include "base/tlsstream.hpp"
+#include "base/tlsutility.hpp"
+#include "base/utility.hpp"
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/program_options.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <thread>
+
+using namespace icinga;
+namespace asio = boost::asio;
+namespace po = boost::program_options;
+
+enum BenchMessageKind
+{
+	BenchCheckResult,
+	BenchSetNextCheck,
+	BenchUpdateObject,
+	BenchMessageKinds
+};
+
+static const char * const l_KindNames[] = { "check_result", "set_next_check", "update_object" };
+
+static Histogram l_Latency[BenchMessageKinds];
+static Histogram l_LatencyTotal;
+static std::atomic<uint_fast64_t> l_Received[BenchMessageKinds];
+
+/**
+ * Records the end-to-end latency of a received benchmark message.
+ */
+static Value RecordBenchMessage(BenchMessageKind kind, const Dictionary::Ptr& params)
+{
+	double latency = BenchUtility::GetMonotonicTime() - static_cast<double>(params->Get("bench_sent"));
+
+	l_Latency[kind].Record(latency);
+	l_LatencyTotal.Record(latency);
+	l_Received[kind].fetch_add(1);
+
+	return Empty;
+}
+
+/* The names differ from the real messages, but they take the same dispatch paths:
+ * events for one checkable run in parallel, config updates one after another.
+ */
+REGISTER_APIFUNCTION(BenchCheckResult, event, [](const MessageOrigin::Ptr&, const Dictionary::Ptr& params) {
+	return RecordBenchMessage(BenchCheckResult, params);
+});
+
+REGISTER_APIFUNCTION(BenchSetNextCheck, event, [](const MessageOrigin::Ptr&, const Dictionary::Ptr& params) {
+	return RecordBenchMessage(BenchSetNextCheck, params);
+});
+
+REGISTER_APIFUNCTION(BenchUpdateObject, config, [](const MessageOrigin::Ptr&, const Dictionary::Ptr& params) {
+	return RecordBenchMessage(BenchUpdateObject, params);
+});
+
+/**
+ * @returns A check result as sent by event::CheckResult.
+ */
+static Dictionary::Ptr MakeCheckResult()
+{
+	return new Dictionary({
+		{ "type", "CheckResult" },
+		{ "output", "DISK OK - free space: / 3326 MB (56% inode=60%); /boot 68 MB (69% inode=99%);" },
+		{ "performance_data", new Array({
+			"/=2643MB;5948;5958;0;5968",
+			"/boot=68MB;88;93;0;98",
+			"/home=69357MB;253404;253409;0;253414",
+			"/var/log=818MB;970;975;0;980"
+		}) },
+		{ "command", new Array({ "/usr/lib/nagios/plugins/check_disk", "-c", "10%", "-w", "20%", "-X", "none", "-X", "tmpfs", "-m" }) },
+		{ "state", 0 },
+		{ "exit_status", 0 },
+		{ "active", true },
+		{ "check_source", "icinga2-satellite1.localdomain" },
+		{ "scheduling_source", "icinga2-satellite1.localdomain" },
+		{ "schedule_start", 1700000000.123456 },
+		{ "schedule_end", 1700000000.234567 },
+		{ "execution_start", 1700000000.125 },
+		{ "execution_end", 1700000000.233 },
+		{ "ttl", 0 },
+		{ "vars_before", new Dictionary({ { "attempt", 1 }, { "reachable", true }, { "state", 0 }, { "state_type", 1 } }) },
+		{ "vars_after", new Dictionary({ { "attempt", 1 }, { "reachable", true }, { "state", 0 }, { "state_type", 1 } }) }
+	});
+}
+
+/**
+ * @returns The body of a config::UpdateObject message for a service.
+ */
+static String MakeServiceConfig()
+{
+	return "object Service \"disk\" {\n"
+		"\tcheck_command = \"disk\"\n"
+		"\tcheck_interval = 60\n"
+		"\tretry_interval = 30\n"
+		"\tenable_perfdata = true\n"
+		"\tvars.disk_wfree = \"20%\"\n"
+		"\tvars.disk_cfree = \"10%\"\n"
+		"\tvars.notification[\"mail\"] = { groups = [ \"icingaadmins\" ] }\n"
+		"\tversion = 1700000000.5\n"
+		"\tzone = \"satellite\"\n"
+		"}\n";
+}
+
+static Dictionary::Ptr MakeMessage(BenchMessageKind kind, const String& host, const Dictionary::Ptr& cr, const String& config)
+{
+	Dictionary::Ptr params;
+	String method;
+
+	switch (kind) {
+		case BenchCheckResult:
+			method = "event::BenchCheckResult";
+			params = new Dictionary({ { "host", host }, { "service", "disk" }, { "cr", cr } });
+			break;
+		case BenchSetNextCheck:
+			method = "event::BenchSetNextCheck";
+			params = new Dictionary({ { "host", host }, { "service", "disk" }, { "next_check", Utility::GetTime() + 60 } });
+			break;
+		default:
+			method = "config::BenchUpdateObject";
+			params = new Dictionary({
+				{ "name", host + "!disk" },
+				{ "type", "Service" },
+				{ "version", Utility::GetTime() },
+				{ "config", config },
+				{ "zone", "satellite" }
+			});
+	}
+
+	params->Set("bench_sent", BenchUtility::GetMonotonicTime());
+
+	return new Dictionary({
+		{ "jsonrpc", "2.0" },
+		{ "method", method },
+		{ "params", params },
+		{ "ts", Utility::GetTime() }
+	});
+}
+
+static Dictionary::Ptr GetLatencyStats(const Histogram& histogram)
+{
+	return new Dictionary({
+		{ "count", static_cast<double>(histogram.GetCount()) },
+		{ "avg", histogram.GetCount() ? histogram.GetSum() / histogram.GetCount() : 0.0 },
+		{ "p50", histogram.GetPercentile(50) },
+		{ "p99", histogram.GetPercentile(99) },
+		{ "max", histogram.GetMax() }
+	});
+}
+
+/**
+ * Connects two JSON-RPC connections of this process via TLS over the loopback interface.
+ *
+ * @returns The sending (client) and the receiving (server) side
+ */
+static std::pair<JsonRpcConnection::Ptr, JsonRpcConnection::Ptr> ConnectPair(const String& certDir)
+{
+	/* Shared with the coroutines, they may outlive a timeout. */
+	auto promise (std::make_shared<std::promise<std::pair<JsonRpcConnection::Ptr, JsonRpcConnection::Ptr>>>());
+	auto future (promise->get_future());
+
+	String senderCert = certDir + "/sender.crt", senderKey = certDir + "/sender.key";
+	String receiverCert = certDir + "/receiver.crt", receiverKey = certDir + "/receiver.key";
+
+	MakeX509CSR("sender", senderKey, String(), senderCert);
+	MakeX509CSR("receiver", receiverKey, String(), receiverCert);
+
+	auto senderContext (MakeAsioSslContext(senderCert, senderKey, receiverCert));
+	auto receiverContext (MakeAsioSslContext(receiverCert, receiverKey, senderCert));
+
+	auto& io (IoEngine::Get().GetIoContext());
+	auto acceptor (Shared<asio::ip::tcp::acceptor>::Make(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0)));
+	auto endpoint (acceptor->local_endpoint());
+	auto server (Shared<AsioTlsStream>::Make(io, *receiverContext));
+	auto client (Shared<AsioTlsStream>::Make(io, *senderContext, "receiver"));
+	auto pending (std::make_shared<std::atomic<int>>(2));
+
+	auto ready ([promise, pending, server, client]() {
+		if (pending->fetch_sub(1) == 1) {
+			JsonRpcConnection::Ptr sender = new JsonRpcConnection("receiver", true, client, RoleClient);
+			JsonRpcConnection::Ptr receiver = new JsonRpcConnection("sender", true, server, RoleServer);
+
+			receiver->Start();
+			sender->Start();
+
+			promise->set_value({ sender, receiver });
+		}
+	});
+
+	IoEngine::SpawnCoroutine(io, [acceptor, server, ready](asio::yield_context yc) {
+		acceptor->async_accept(server->lowest_layer(), yc);
+		server->next_layer().async_handshake(server->next_layer().server, yc);
+		ready();
+	});
+
+	IoEngine::SpawnCoroutine(io, [endpoint, client, ready](asio::yield_context yc) {
+		client->lowest_layer().async_connect(endpoint, yc);
+		client->next_layer().async_handshake(client->next_layer().client, yc);
+		ready();
+	});
+
+	if (future.wait_for(std::chrono::seconds(10)) != std::future_status::ready)
+		BOOST_THROW_EXCEPTION(std::runtime_error("Cannot connect via the loopback interface."));
+
+	return future.get();
+}
+
+/**
+ * Sends a mix of cluster messages from one JSON-RPC connection to another one of the same process
+ * and writes the throughput, the CPU time per message, the end-to-end latency and the memory growth as JSON.
+ */
+int main(int argc, char **argv)
+{
+	po::options_description desc ("Options");
+	desc.add_options()
+		("help,h", "show this help message")
+		("duration", po::value<double>()->default_value(10), "how long to send messages in seconds")
+		("rate", po::value<double>()->default_value(0), "messages per second to send, 0 for as many as possible")
+		("hosts", po::value<int>()->default_value(1000), "number of hosts the messages are about")
+		("check-results", po::value<int>()->default_value(90), "weight of event::CheckResult-like messages")
+		("next-checks", po::value<int>()->default_value(9), "weight of event::SetNextCheck-like messages")
+		("config-updates", po::value<int>()->default_value(1), "weight of config::UpdateObject-like messages")
+		("max-pending", po::value<int>()->default_value(10000), "maximum number of sent messages not yet processed")
+		("binary", "use the binary message encoding")
+		("compression", po::value<int>(), "compress the messages with the specified zlib level")
+		("tmp-dir", po::value<std::string>(), "directory for the temporary certificates")
+		("output,o", po::value<std::string>(), "write the results to the specified file instead of stdout")
+	;
+
+	po::variables_map vm;
+
+	try {
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	} catch (const std::exception& ex) {
+		std::cerr << ex.what() << "\n" << desc;
+		return EXIT_FAILURE;
+	}
+
+	if (vm.count("help")) {
+		std::cout << desc;
+		return EXIT_SUCCESS;
+	}
+
+	double duration = vm["duration"].as<double>();
+	double rate = vm["rate"].as<double>();
+	int hosts = vm["hosts"].as<int>();
+	int maxPending = vm["max-pending"].as<int>();
+	int weights[BenchMessageKinds] = { vm["check-results"].as<int>(), vm["next-checks"].as<int>(), vm["config-updates"].as<int>() };
+	int totalWeight = 0;
+
+	for (int weight : weights) {
+		if (weight < 0) {
+			std::cerr << "The weights of the messages must not be negative.\n";
+			return EXIT_FAILURE;
+		}
+
+		totalWeight += weight;
+	}
+
+	if (duration <= 0 || rate < 0 || hosts < 1 || maxPending < 1 || totalWeight < 1) {
+		std::cerr << "The duration, the number of hosts, the pending messages and the sum of the weights must be greater than 0.\n";
+		return EXIT_FAILURE;
+	}
+
+	/* Process the messages as the daemon does, not just on one core. */
+	Configuration::Concurrency = std::thread::hardware_concurrency();
+
+	Application::InitializeBase();
+
+	String tmpDir;
+
+	if (vm.count("tmp-dir")) {
+		tmpDir = vm["tmp-dir"].as<std::string>();
+	} else {
+		const char *envTmp = getenv("TMPDIR");
+		tmpDir = envTmp ? envTmp : "/tmp";
+	}
+
+	String certDir = tmpDir + "/icinga2-clusterbench-" + Convert::ToString(Utility::GetPid());
+	std::pair<JsonRpcConnection::Ptr, JsonRpcConnection::Ptr> connections;
+
+	try {
+		Utility::MkDirP(certDir, 0700);
+		connections = ConnectPair(certDir);
+		Utility::RemoveDirRecursive(certDir);
+	} catch (const std::exception& ex) {
+		std::cerr << "Cannot set up the connections: " << DiagnosticInformation(ex, false) << "\n";
+		return EXIT_FAILURE;
+	}
+
+	auto& sender (connections.first);
+
+	if (vm.count("binary"))
+		sender->SetBinaryMessages(true);
+
+	if (vm.count("compression"))
+		sender->EnableCompression(vm["compression"].as<int>());
+
+	std::vector<String> hostNames;
+
+	for (int i = 0; i < hosts; i++)
+		hostNames.emplace_back("bench-host-" + Convert::ToString(i));
+
+	Dictionary::Ptr cr = MakeCheckResult();
+	String config = MakeServiceConfig();
+
+	uint_fast64_t sent[BenchMessageKinds] = {};
+	uint_fast64_t totalSent = 0, maxQueued = 0;
+	int credit[BenchMessageKinds] = {};
+
+	double memoryStart = BenchUtility::GetResidentMemory();
+	double cpuStart = BenchUtility::GetCpuTime();
+	double start = BenchUtility::GetMonotonicTime();
+	double end = start + duration;
+
+	auto getReceived ([]() {
+		uint_fast64_t received = 0;
+
+		for (auto& count : l_Received)
+			received += count.load();
+
+		return received;
+	});
+
+	for (double now = start; now < end; now = BenchUtility::GetMonotonicTime()) {
+		if (rate > 0 && totalSent >= (now - start) * rate) {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			continue;
+		}
+
+		if (totalSent - getReceived() >= static_cast<uint_fast64_t>(maxPending)) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		/* Smooth weighted round-robin, i.e. the kinds are interleaved instead of sent in bursts. */
+		int kind = 0;
+
+		for (int i = 0; i < BenchMessageKinds; i++) {
+			credit[i] += weights[i];
+
+			if (credit[i] > credit[kind])
+				kind = i;
+		}
+
+		credit[kind] -= totalWeight;
+
+		sender->SendMessage(MakeMessage(static_cast<BenchMessageKind>(kind), hostNames[totalSent % hostNames.size()], cr, config));
+		sender->WaitForSendCredit();
+
+		sent[kind]++;
+		totalSent++;
+
+		if (totalSent % 1024 == 0)
+			maxQueued = std::max<uint_fast64_t>(maxQueued, sender->GetQueuedMessages());
+	}
+
+	double sendEnd = BenchUtility::GetMonotonicTime();
+
+	/* Wait for the messages still in flight. */
+	while (getReceived() < totalSent && BenchUtility::GetMonotonicTime() < sendEnd + 60)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	double elapsed = BenchUtility::GetMonotonicTime() - start;
+	double cpu = BenchUtility::GetCpuTime() - cpuStart;
+	double memoryEnd = BenchUtility::GetResidentMemory();
+	uint_fast64_t received = getReceived();
+
+	Dictionary::Ptr kinds = new Dictionary();
+
+	for (int i = 0; i < BenchMessageKinds; i++) {
+		kinds->Set(l_KindNames[i], new Dictionary({
+			{ "sent", static_cast<double>(sent[i]) },
+			{ "received", static_cast<double>(l_Received[i].load()) },
+			{ "latency", GetLatencyStats(l_Latency[i]) }
+		}));
+	}
+
+	Dictionary::Ptr output = new Dictionary({
+		{ "version", Application::GetAppVersion() },
+		{ "time", Utility::GetTime() },
+		{ "duration", elapsed },
+		{ "concurrency", Configuration::Concurrency },
+		{ "binary", vm.count("binary") > 0 },
+		{ "compression", vm.count("compression") ? vm["compression"].as<int>() : 0 },
+		{ "sent", static_cast<double>(totalSent) },
+		{ "received", static_cast<double>(received) },
+		{ "messages_per_second", received / elapsed },
+		{ "cpu_seconds", cpu },
+		{ "cpu_us_per_message", received ? cpu * 1e6 / received : 0.0 },
+		{ "latency", GetLatencyStats(l_LatencyTotal) },
+		{ "max_queued_messages", static_cast<double>(maxQueued) },
+		{ "rss_start", memoryStart },
+		{ "rss_end", memoryEnd },
+		{ "rss_growth", memoryEnd - memoryStart },
+		{ "messages", kinds }
+	});
+
+	String json = JsonEncode(output, true);
+
+	if (vm.count("output")) {
+		std::ofstream fp (vm["output"].as<std::string>());
+		fp << json << "\n";
+
+		if (!fp) {
+			std::cerr << "Cannot write the results.\n";
+			return EXIT_FAILURE;
+		}
+	} else {
+		std::cout << json << "\n";
+	}
+
+	/* Like the test runner, don't wait for the thread pool and the timer thread. */
+	std::cout << std::flush;
+	std::_Exit(received == totalSent ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -77,6 +77,29 @@ static void GetTargetServicesHelper(
 	}
 }
 
+static void GetTargetHostVarsHelper(
+	const String& filter, const Dictionary::Ptr& constants, bool targeted, const std::vector<String>& predicates = {}
+)
+{
+	auto compiled (ConfigCompiler::CompileText("<test>", filter));
+	auto expr (RequireActualExpression(compiled));
+	std::vector<ApplyRule::HostVarPredicate> actualPredicates;
+
+	BOOST_CHECK_EQUAL(ApplyRule::GetTargetHostVars(expr, actualPredicates, constants), targeted);
+
+	if (targeted) {
+		std::vector<String> actualPredicateStrings;
+
+		actualPredicateStrings.reserve(actualPredicates.size());
+
+		for (auto& p : actualPredicates) {
+			actualPredicateStrings.emplace_back(*p.Var + (p.In ? " contains " : " == ") + *p.Value);
+		}
+
+		BOOST_CHECK_EQUAL_COLLECTIONS(actualPredicateStrings.begin(), actualPredicateStrings.end(), predicates.begin(), predicates.end());
+	}
+}
+
 BOOST_AUTO_TEST_SUITE(config_apply)
 
 BOOST_AUTO_TEST_CASE(gettargethosts_literal)
@@ -147,6 +170,27 @@ BOOST_AUTO_TEST_CASE(gettargethosts_noindexer)
 	GetTargetHostsHelper("name == \"foo\"", nullptr, false);
 }
 
+BOOST_AUTO_TEST_CASE(gettargetobjects_user)
+{
+	auto compiled (ConfigCompiler::CompileText("<test>", "user.name == \"foo\" || \"bar\" == user.name"));
+	auto expr (RequireActualExpression(compiled));
+	std::vector<const String*> users;
+
+	BOOST_REQUIRE(ApplyRule::GetTargetObjects(expr, "user", users));
+	BOOST_REQUIRE_EQUAL(users.size(), 2u);
+	BOOST_CHECK_EQUAL(*users.at(0), "foo");
+	BOOST_CHECK_EQUAL(*users.at(1), "bar");
+}
+
+BOOST_AUTO_TEST_CASE(gettargetobjects_wrongtype)
+{
+	auto compiled (ConfigCompiler::CompileText("<test>", "host.name == \"foo\""));
+	auto expr (RequireActualExpression(compiled));
+	std::vector<const String*> users;
+
+	BOOST_CHECK(!ApplyRule::GetTargetObjects(expr, "user", users));
+}
+
 BOOST_AUTO_TEST_CASE(gettargetservices_literal)
 {
 	GetTargetServicesHelper("host.name == \"foo\" && service.name == \"bar\"", nullptr, true, {{"foo", "bar"}});
@@ -248,4 +292,73 @@ BOOST_AUTO_TEST_CASE(gettargetservices_noindexer_service)
 	GetTargetServicesHelper("host.name == \"foo\" && name == \"bar\"", nullptr, false);
 }
 
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_equal)
+{
+	GetTargetHostVarsHelper("host.vars.os == \"Linux\"", nullptr, true, {"os == Linux"});
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_swapped)
+{
+	GetTargetHostVarsHelper("\"Linux\" == host.vars[\"os\"]", nullptr, true, {"os == Linux"});
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_in)
+{
+	GetTargetHostVarsHelper("\"web\" in host.vars.roles", nullptr, true, {"roles contains web"});
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_mixed)
+{
+	GetTargetHostVarsHelper(
+		"host.vars.os == \"Linux\" || \"web\" in host.vars.roles || host.vars.os == \"BSD\"", nullptr, true,
+		{"os == Linux", "roles contains web", "os == BSD"}
+	);
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_and)
+{
+	GetTargetHostVarsHelper("host.vars.os == \"Linux\" && !(\"db\" in host.vars.roles)", nullptr, true, {"os == Linux"});
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_const)
+{
+	GetTargetHostVarsHelper("host.vars.os == x", new Dictionary({{"x", "Linux"}}), true, {"os == Linux"});
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_and_right)
+{
+	GetTargetHostVarsHelper("host.vars.env.len() > 0 && host.vars.os == \"Linux\"", nullptr, false);
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_or_notindexed)
+{
+	GetTargetHostVarsHelper("host.vars.os == \"Linux\" || host.address == \"127.0.0.1\"", nullptr, false);
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_emptystring)
+{
+	GetTargetHostVarsHelper("host.vars.os == \"\"", nullptr, false);
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_notstring)
+{
+	GetTargetHostVarsHelper("host.vars.port == 22", nullptr, false);
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_wrongop)
+{
+	GetTargetHostVarsHelper("host.vars.os != \"Linux\"", nullptr, false);
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_wrongvar)
+{
+	GetTargetHostVarsHelper("service.vars.os == \"Linux\"", nullptr, false);
+}
+
+BOOST_AUTO_TEST_CASE(gettargethostvars_notvars)
+{
+	GetTargetHostVarsHelper("host.name == \"foo\"", nullptr, false);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
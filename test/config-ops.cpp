@@ -1,7 +1,14 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "config/configcompiler.hpp"
+#include "config/bytecode.hpp"
+#include "config/constantfolder.hpp"
+#include "base/configuration.hpp"
 #include "base/exception.hpp"
+#include "base/json.hpp"
+#include "base/scriptglobal.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
 #include <BoostTestTargetConfig.h>
 
 using namespace icinga;
@@ -243,4 +250,215 @@ BOOST_AUTO_TEST_CASE(advanced)
 	BOOST_CHECK(func->Invoke() == 3);
 }
 
+BOOST_AUTO_TEST_CASE(field_cache)
+{
+	ScriptFrame frame(true);
+	std::unique_ptr<Expression> expr;
+	Array::Ptr result;
+
+	expr = ConfigCompiler::CompileText("<test>", "var f = function(x) { return x.name }; [ f(Array), f(Array), f({ name = \"d\" }), f(String) ]");
+	result = expr->Evaluate(frame).GetValue();
+	BOOST_CHECK(result->Get(0) == "Array");
+	BOOST_CHECK(result->Get(1) == "Array");
+	BOOST_CHECK(result->Get(2) == "d");
+	BOOST_CHECK(result->Get(3) == "String");
+
+	expr = ConfigCompiler::CompileText("<test>", "var f = function(x) { return x.type }; [ f(Array), f({ type = \"t\" }), f(Array) ]");
+	result = expr->Evaluate(frame).GetValue();
+	BOOST_CHECK(result->Get(0) == "Type");
+	BOOST_CHECK(result->Get(1) == "t");
+	BOOST_CHECK(result->Get(2) == "Type");
+
+	expr = ConfigCompiler::CompileText("<test>", "var f = function(x) { return x.type }; [ f({ type = \"t\" }), f(Array) ]");
+	result = expr->Evaluate(frame).GetValue();
+	BOOST_CHECK(result->Get(0) == "t");
+	BOOST_CHECK(result->Get(1) == "Type");
+}
+
+BOOST_AUTO_TEST_CASE(field_cache_set)
+{
+	ScriptFrame frame(true);
+	std::unique_ptr<Expression> expr;
+	Array::Ptr result;
+
+	expr = ConfigCompiler::CompileText("<test>", "var f = function(d, v) { d.x = v; d.x += 1; d.y.z = v; d }; "
+		"var a = f({}, 1); var b = f({ y = { z = 0 } }, 2); [ a.x, a.y.z, b.x, b.y.z ]");
+	result = expr->Evaluate(frame).GetValue();
+	BOOST_CHECK(result->Get(0) == 2);
+	BOOST_CHECK(result->Get(1) == 1);
+	BOOST_CHECK(result->Get(2) == 3);
+	BOOST_CHECK(result->Get(3) == 2);
+
+	expr = ConfigCompiler::CompileText("<test>", "var f = function(d) { d.x = 1 }; f({}); f(Array)");
+	BOOST_CHECK_THROW(expr->Evaluate(frame), ScriptError);
+}
+
+BOOST_AUTO_TEST_CASE(bytecode)
+{
+	const char *scripts[] = {
+		"1 + 2 * 3 - 4 / 2 % 3",
+		"(7 & 3) | (1 << 4) ^ (64 >> 2)",
+		"~5 == -6 && !false && 2 < 3 && 3 <= 3 && 4 > 3 && 4 >= 5",
+		"[ 3 in [ 1, 2, 3 ], 4 in [ 1, 2, 3 ], 4 !in [ 1 ], 1 in null, 1 !in null ]",
+		"var x = { a = { b = \"c\" } }; [ x.a.b, x[\"a\"][\"b\"], x.d, x.d.e ]",
+		"var f = function(a, b) { if (a > b) { return a } else { return b } }; [ f(1, 2), f(3, 1) ]",
+		"var f = function(a) { if (a) { 1 } }; [ f(true), f(false) ]",
+		"[ 0 || \"\" || \"x\", 1 && 0 && 2, 1 && 2, null || false ]",
+		"var f = function(x) { return x.type }; [ f(Array), f({ type = \"t\" }), f(Array) ]",
+		"var a = []; for (i in [ 1, 2, 3 ]) { a.add(i * 2) }; a",
+		"[ match(\"web*\", \"WEB-01\"), match(\"web*\", \"db\"), match(\"web*\", [ \"web1\", \"db\" ]), match(\"1?\", 12) ]",
+		"var match = function(p, t) { return p + t }; match(\"a\", \"b\")",
+		"[ regex(\"^(db|app)-[0-9]+\", \"db-12\"), regex(\"^db\", \"web\"), regex(\"^d\", [ \"db\", \"dc\" ]), regex(\"1\", 21) ]"
+	};
+
+	bool scriptBytecode = Configuration::ScriptBytecode;
+
+	for (auto script : scripts) {
+		Expression::Ptr expr = new BytecodeExpression(ConfigCompiler::CompileText("<test>", script).release());
+		BOOST_CHECK(static_cast<BytecodeExpression *>(expr.get())->IsCompiled());
+
+		ScriptFrame frame(true);
+
+		Configuration::ScriptBytecode = true;
+		String bytecodeResult = JsonEncode(expr->Evaluate(frame).GetValue());
+
+		Configuration::ScriptBytecode = false;
+		String treeResult = JsonEncode(expr->Evaluate(frame).GetValue());
+
+		BOOST_CHECK_MESSAGE(bytecodeResult == treeResult, script << ": " << bytecodeResult << " != " << treeResult);
+	}
+
+	Configuration::ScriptBytecode = true;
+
+	ScriptFrame frame(true);
+	Expression::Ptr expr = new BytecodeExpression(ConfigCompiler::CompileText("<test>", "1 in 2").release());
+	BOOST_CHECK_THROW(expr->Evaluate(frame), ScriptError);
+
+	expr = new BytecodeExpression(ConfigCompiler::CompileText("<test>", "3()").release());
+	BOOST_CHECK_THROW(expr->Evaluate(frame), ScriptError);
+
+	expr = new BytecodeExpression(ConfigCompiler::CompileText("<test>", "regex(\"[\", \"x\")").release());
+	BOOST_CHECK_THROW(expr->Evaluate(frame), ScriptError);
+
+	Configuration::ScriptBytecode = scriptBytecode;
+}
+
+BOOST_AUTO_TEST_CASE(constant_folding)
+{
+	ScriptGlobal::GetGlobals()->Set("FoldingTestZone", "master", true);
+
+	const char *scripts[] = {
+		"1 + 2 * 3 - 4 / 2",
+		"\"a\" + \"b\" == \"ab\" && !false",
+		"if (FoldingTestZone == \"master\") { x } else { 2 }",
+		"false || x > 1",
+		"x in [ 1, 2 ] && FoldingTestZone",
+		"var FoldingTestZone = 1; FoldingTestZone + x"
+	};
+
+	for (auto script : scripts) {
+		std::unique_ptr<Expression> folded = ConfigCompiler::CompileText("<test>", script);
+		ConstantFolder::FoldFilter(folded, { "x" });
+
+		std::unique_ptr<Expression> tree = ConfigCompiler::CompileText("<test>", script);
+
+		ScriptFrame frame(true);
+		frame.Locals->Set("x", 2);
+		String foldedResult = JsonEncode(folded->Evaluate(frame).GetValue());
+
+		frame.Locals = new Dictionary({ { "x", 2 } });
+		String treeResult = JsonEncode(tree->Evaluate(frame).GetValue());
+
+		BOOST_CHECK_MESSAGE(foldedResult == treeResult, script << ": " << foldedResult << " != " << treeResult);
+	}
+
+	auto fold ([](const char *script, std::set<String> locals) {
+		std::unique_ptr<Expression> expr = ConfigCompiler::CompileText("<test>", script);
+		ConstantFolder::FoldFilter(expr, std::move(locals));
+		return expr;
+	});
+
+	/* CompileText() returns a block, the folded expression is its last statement. */
+	auto statement ([](const std::unique_ptr<Expression>& expr) {
+		return static_cast<DictExpression *>(expr.get())->GetExpressions().back().get();
+	});
+
+	std::unique_ptr<Expression> expr = fold("1 + 2 * 3", {});
+	auto literal (dynamic_cast<LiteralExpression *>(statement(expr)));
+	BOOST_REQUIRE(literal);
+	BOOST_CHECK(literal->GetValue() == 7);
+
+	expr = fold("FoldingTestZone == \"master\" && x", { "x" });
+	BOOST_CHECK(dynamic_cast<VariableExpression *>(statement(expr)));
+
+	expr = fold("FoldingTestZone == \"master\" && x", { "x", "FoldingTestZone" });
+	BOOST_CHECK(dynamic_cast<LogicalAndExpression *>(statement(expr)));
+
+	/* Errors are raised at run time. */
+	expr = fold("1 / 0", {});
+	BOOST_CHECK(dynamic_cast<DivideExpression *>(statement(expr)));
+
+	ScriptFrame frame(true);
+	BOOST_CHECK_THROW(expr->Evaluate(frame), ScriptError);
+}
+
+BOOST_AUTO_TEST_CASE(string_concatenation)
+{
+	bool scriptBytecode = Configuration::ScriptBytecode;
+
+	for (bool bytecode : { false, true }) {
+		Configuration::ScriptBytecode = bytecode;
+
+		ScriptFrame frame(true);
+		frame.Locals->Set("s", "x");
+
+		std::unique_ptr<Expression> expr = new BytecodeExpression(ConfigCompiler::CompileText("<test>", "s + \"a\" + s + \"\" + s").release());
+		BOOST_CHECK(expr->Evaluate(frame).GetValue() == "xaxx");
+
+		/* The left side is a variable, it must not be changed by appending to it. */
+		BOOST_CHECK(frame.Locals->Get("s") == "x");
+
+		expr = new BytecodeExpression(ConfigCompiler::CompileText("<test>", "1 + 2 + s + 3 + s").release());
+		BOOST_CHECK(expr->Evaluate(frame).GetValue() == "3x3x");
+
+		expr = new BytecodeExpression(ConfigCompiler::CompileText("<test>", "s + \"b\" < s + \"c\" && s + \"b\" == \"xb\"").release());
+		BOOST_CHECK(expr->Evaluate(frame).GetValue() == true);
+	}
+
+	Configuration::ScriptBytecode = scriptBytecode;
+}
+
+BOOST_AUTO_TEST_CASE(collect_includes)
+{
+	namespace fs = boost::filesystem;
+
+	fs::path dir = fs::temp_directory_path() / fs::unique_path("icinga2-collect-includes-%%%%-%%%%");
+	fs::create_directories(dir);
+
+	std::vector<String> files;
+
+	for (int i = 0; i < 50; i++) {
+		String file = (dir / ("file" + std::to_string(i) + ".conf")).string();
+		std::ofstream(file.CStr()) << i << "\n";
+		files.emplace_back(file);
+	}
+
+	int concurrency = Configuration::Concurrency;
+	Configuration::Concurrency = 4;
+
+	std::vector<std::unique_ptr<Expression> > expressions;
+	ConfigCompiler::CollectIncludes(expressions, files, String(), String());
+
+	Configuration::Concurrency = concurrency;
+	fs::remove_all(dir);
+
+	/* compiled in parallel, but in the order of the files */
+	BOOST_REQUIRE(expressions.size() == files.size());
+
+	ScriptFrame frame(true);
+
+	for (int i = 0; i < 50; i++)
+		BOOST_CHECK(expressions[i]->Evaluate(frame).GetValue() == i);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
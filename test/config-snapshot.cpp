@@ -0,0 +1,109 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "config/configcompiler.hpp"
+#include "config/configcompilercontext.hpp"
+#include "config/configitem.hpp"
+#include "icinga/host.hpp"
+#include "icinga/hostgroup.hpp"
+#include "base/configuration.hpp"
+#include "base/scriptframe.hpp"
+#include "base/utility.hpp"
+#include "base/workqueue.hpp"
+#include <boost/filesystem.hpp>
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+static const char *l_SnapshotConfig = R"CONFIG(
+object CheckCommand "snapshot-command" {
+	command = [ "true" ]
+}
+
+object HostGroup "snapshot-group" {
+	assign where host.vars.snapshot
+}
+
+object Host "snapshot-host" {
+	check_command = "snapshot-command"
+	vars.snapshot = true
+}
+
+object Host "snapshot-other" {
+	check_command = "snapshot-command"
+}
+)CONFIG";
+
+/**
+ * Evaluates the config and commits its items, either while writing the snapshot or restored from it.
+ */
+static std::vector<ConfigItem::Ptr> CommitSnapshotConfig(const String& snapshot, bool restore)
+{
+	ActivationScope ascope;
+
+	ScriptFrame frame (true);
+	ConfigCompiler::CompileText("<snapshot>", l_SnapshotConfig)->Evaluate(frame);
+
+	if (restore)
+		BOOST_REQUIRE(ConfigItem::LoadSnapshot(snapshot, "test", ascope.GetContext()));
+	else
+		ConfigCompilerContext::GetInstance()->OpenSnapshotFile(snapshot, "test");
+
+	WorkQueue upq (25000, Configuration::Concurrency);
+	std::vector<ConfigItem::Ptr> newItems;
+
+	BOOST_REQUIRE(ConfigItem::CommitItems(ascope.GetContext(), upq, newItems, true));
+
+	if (!restore)
+		ConfigCompilerContext::GetInstance()->FinishSnapshotFile();
+
+	return newItems;
+}
+
+static void CheckGroups()
+{
+	Host::Ptr host = Host::GetByName("snapshot-host");
+	Host::Ptr other = Host::GetByName("snapshot-other");
+
+	BOOST_REQUIRE(host && other);
+
+	Array::Ptr groups = host->GetGroups();
+
+	BOOST_CHECK(groups && groups->Contains("snapshot-group"));
+
+	groups = other->GetGroups();
+
+	BOOST_CHECK(!groups || !groups->Contains("snapshot-group"));
+}
+
+BOOST_AUTO_TEST_SUITE(config_snapshot)
+
+BOOST_AUTO_TEST_CASE(group_assign)
+{
+	namespace fs = boost::filesystem;
+
+	String snapshot = (fs::temp_directory_path() / fs::unique_path("icinga2-snapshot-%%%%-%%%%")).string();
+
+	std::vector<ConfigItem::Ptr> items = CommitSnapshotConfig(snapshot, false);
+
+	BOOST_REQUIRE(Utility::PathExists(snapshot));
+	CheckGroups();
+
+	for (auto& item : items)
+		item->Unregister();
+
+	items = CommitSnapshotConfig(snapshot, true);
+
+	ConfigItem::Ptr restored = ConfigItem::GetByTypeAndName(HostGroup::TypeInstance, "snapshot-group");
+
+	BOOST_REQUIRE(restored);
+	BOOST_CHECK(restored->GetFilter());
+
+	CheckGroups();
+
+	for (auto& item : items)
+		item->Unregister();
+
+	Utility::Remove(snapshot);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
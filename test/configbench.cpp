@@ -0,0 +1,488 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "benchutility.hpp"
+#include "config/activationcontext.hpp"
+#include "config/configcompiler.hpp"
+#include "config/configitem.hpp"
+#include "config/configprofiler.hpp"
+#include "icinga/dependency.hpp"
+#include "base/application.hpp"
+#include "base/configuration.hpp"
+#include "base/convert.hpp"
+#include "base/dictionary.hpp"
+#include "base/exception.hpp"
+#include "base/json.hpp"
+#include "base/logger.hpp"
+#include "base/scriptframe.hpp"
+#include "base/scriptglobal.hpp"
+#include "base/utility.hpp"
+#include "base/workqueue.hpp"
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+using namespace icinga;
+namespace po = boost::program_options;
+
+/* Objects per host: the host, about five services, a notification, a dependency and every fourth host a downtime. */
+static const double l_ObjectsPerHost = 8.25;
+
+static const char * const l_Roles[] = { "web", "db", "cache", "worker" };
+
+/**
+ * @returns The number of objects of a scale class like "100k".
+ */
+static double ParseScale(const String& scale)
+{
+	if (scale == "10k")
+		return 1e4;
+	else if (scale == "100k")
+		return 1e5;
+	else if (scale == "1m" || scale == "1M")
+		return 1e6;
+
+	BOOST_THROW_EXCEPTION(std::invalid_argument("Unknown scale class '" + scale + "', expected 10k, 100k or 1m."));
+}
+
+static void WriteFile(const String& path, const String& content)
+{
+	std::ofstream fp (path.CStr());
+	fp << content;
+	fp.close();
+
+	if (!fp)
+		BOOST_THROW_EXCEPTION(std::runtime_error("Cannot write '" + path + "'."));
+}
+
+/**
+ * Writes the commands, users, groups and deep template chains for hosts and services.
+ */
+static String GenerateTemplates(int depth)
+{
+	std::ostringstream conf;
+
+	conf << "object CheckCommand \"bench-check\" {\n"
+		<< "\tcommand = [ \"/bin/true\" ]\n"
+		<< "\targuments = {\n"
+		<< "\t\t\"-H\" = \"$address$\"\n"
+		<< "\t\t\"-w\" = { value = \"$bench_warn$\"; set_if = {{ macro(\"$bench_warn$\") != \"\" }} }\n"
+		<< "\t\t\"-p\" = { value = \"$bench_path$\"; repeat_key = true }\n"
+		<< "\t}\n"
+		<< "\tvars.bench_warn = 80\n"
+		<< "}\n\n"
+		<< "object NotificationCommand \"bench-notify\" {\n"
+		<< "\tcommand = [ \"/bin/true\" ]\n"
+		<< "\tenv = { NOTIFICATIONTYPE = \"$notification.type$\", HOSTNAME = \"$host.name$\" }\n"
+		<< "}\n\n"
+		<< "object User \"bench-user\" {\n"
+		<< "\temail = \"bench@example.com\"\n"
+		<< "}\n\n";
+
+	for (auto role : l_Roles) {
+		conf << "object HostGroup \"bench-" << role << "\" {\n"
+			<< "\tassign where host.vars.role == \"" << role << "\"\n"
+			<< "}\n\n";
+	}
+
+	for (int i = 0; i < depth; i++) {
+		conf << "template Host \"bench-host-template-" << i << "\" {\n";
+
+		if (i > 0)
+			conf << "\timport \"bench-host-template-" << (i - 1) << "\"\n";
+		else
+			conf << "\tcheck_command = \"bench-check\"\n"
+				<< "\tmax_check_attempts = 3\n"
+				<< "\tvars.tags = []\n";
+
+		conf << "\tcheck_interval = " << (60 + i) << "s\n"
+			<< "\tvars.level" << i << " = " << i << "\n"
+			<< "\tvars.tags += [ \"level-" << i << "\" ]\n"
+			<< "}\n\n";
+
+		conf << "template Service \"bench-service-template-" << i << "\" {\n";
+
+		if (i > 0)
+			conf << "\timport \"bench-service-template-" << (i - 1) << "\"\n";
+		else
+			conf << "\tcheck_command = \"bench-check\"\n";
+
+		conf << "\tretry_interval = " << (30 + i) << "s\n"
+			<< "\tvars.level" << i << " = " << i << "\n"
+			<< "}\n\n";
+	}
+
+	return conf.str();
+}
+
+/**
+ * Writes the apply rules, in the styles used in practice: assign where on custom variables, name patterns,
+ * for loops over dictionaries and rules for hosts and services.
+ */
+static String GenerateApplyRules(int depth)
+{
+	std::ostringstream conf;
+	String serviceTemplate = "bench-service-template-" + Convert::ToString(depth - 1);
+
+	conf << "apply Service \"ping\" {\n"
+		<< "\timport \"" << serviceTemplate << "\"\n"
+		<< "\tassign where host.address\n"
+		<< "}\n\n"
+		<< "apply Service \"http\" {\n"
+		<< "\timport \"" << serviceTemplate << "\"\n"
+		<< "\tvars.http_vhost = host.name + \".example.com\"\n"
+		<< "\tassign where host.vars.role in [ \"web\", \"db\" ]\n"
+		<< "\tignore where host.vars.decommissioned\n"
+		<< "}\n\n"
+		<< "apply Service \"load\" {\n"
+		<< "\timport \"" << serviceTemplate << "\"\n"
+		<< "\tassign where match(\"bench-host-*1\", host.name) || match(\"bench-host-*3\", host.name)\n"
+		<< "\tassign where match(\"bench-host-*5\", host.name) || match(\"bench-host-*7\", host.name) || match(\"bench-host-*9\", host.name)\n"
+		<< "}\n\n"
+		<< "apply Service for (disk => config in host.vars.disks) {\n"
+		<< "\timport \"" << serviceTemplate << "\"\n"
+		<< "\tvars += config\n"
+		<< "}\n\n"
+		<< "apply Notification \"bench-mail\" to Service {\n"
+		<< "\tcommand = \"bench-notify\"\n"
+		<< "\tusers = [ \"bench-user\" ]\n"
+		<< "\tinterval = 2h\n"
+		<< "\tassign where service.vars.notify == true\n"
+		<< "}\n\n"
+		<< "apply Dependency \"bench-parent\" to Host {\n"
+		<< "\tparent_host_name = host.vars.parent\n"
+		<< "\tdisable_checks = true\n"
+		<< "\tassign where host.vars.parent\n"
+		<< "}\n\n"
+		<< "apply ScheduledDowntime \"bench-maintenance\" to Host {\n"
+		<< "\tauthor = \"bench\"\n"
+		<< "\tcomment = \"Weekly maintenance\"\n"
+		<< "\tranges = { \"sunday\" = \"02:00-04:00\" }\n"
+		<< "\tassign where host.vars.role == \"db\"\n"
+		<< "}\n";
+
+	return conf.str();
+}
+
+/**
+ * Writes the hosts [begin, end) with heavy custom variables.
+ */
+static String GenerateHosts(int begin, int end, int depth, int vars)
+{
+	std::ostringstream conf;
+
+	for (int i = begin; i < end; i++) {
+		conf << "object Host \"bench-host-" << i << "\" {\n"
+			<< "\timport \"bench-host-template-" << (depth - 1) << "\"\n"
+			<< "\taddress = \"10." << (i >> 16 & 255) << "." << (i >> 8 & 255) << "." << (i & 255) << "\"\n"
+			<< "\tvars.role = \"" << l_Roles[i % 4] << "\"\n";
+
+		if (i > 0)
+			conf << "\tvars.parent = \"bench-host-" << (i - 1) / 10 << "\"\n";
+
+		conf << "\tvars.disks[\"disk /\"] = { bench_path = \"/\", notify = true }\n"
+			<< "\tvars.disks[\"disk /var\"] = { bench_path = [ \"/var\", \"/var/log\" ] }\n"
+			<< "\tvars.disks[\"disk /home\"] = { bench_path = \"/home\", bench_warn = 90 }\n";
+
+		for (int k = 0; k < vars; k++) {
+			conf << "\tvars.bench_" << k << " = ";
+
+			switch (k % 4) {
+				case 0:
+					conf << "\"value " << i << "-" << k << "\"";
+					break;
+				case 1:
+					conf << (i * 31 + k) % 1000;
+					break;
+				case 2:
+					conf << "[ \"a" << k << "\", \"b" << k << "\", " << k << " ]";
+					break;
+				default:
+					conf << "{ owner = \"team-" << i % 16 << "\", sla = " << (k % 2 == 0 ? "true" : "false") << ", prio = " << k << " }";
+			}
+
+			conf << "\n";
+		}
+
+		conf << "}\n\n";
+	}
+
+	return conf.str();
+}
+
+/**
+ * Writes a config with about the given number of objects to dir.
+ *
+ * @returns The files in the order to load them.
+ */
+static std::vector<String> GenerateConfig(const String& dir, double objects, int depth, int vars)
+{
+	static const int hostsPerFile = 10000;
+
+	Utility::MkDirP(dir + "/hosts", 0750);
+
+	std::vector<String> files { dir + "/templates.conf", dir + "/apply.conf" };
+
+	WriteFile(files[0], GenerateTemplates(depth));
+	WriteFile(files[1], GenerateApplyRules(depth));
+
+	int hosts = std::max(1, static_cast<int>(objects / l_ObjectsPerHost));
+
+	for (int begin = 0; begin < hosts; begin += hostsPerFile) {
+		files.emplace_back(dir + "/hosts/hosts-" + Convert::ToString(begin / hostsPerFile) + ".conf");
+		WriteFile(files.back(), GenerateHosts(begin, std::min(begin + hostsPerFile, hosts), depth, vars));
+	}
+
+	/* For "icinga2 daemon -C -c <dir>/bench.conf". */
+	WriteFile(dir + "/bench.conf", "include \"templates.conf\"\ninclude \"apply.conf\"\ninclude \"hosts/*.conf\"\n");
+
+	return files;
+}
+
+/**
+ * Measures one phase of loading the config.
+ */
+class ConfigBenchPhase
+{
+public:
+	ConfigBenchPhase(const char *name, const Dictionary::Ptr& phases)
+		: m_Name(name), m_Phases(phases), m_Start(BenchUtility::GetMonotonicTime()), m_CpuStart(BenchUtility::GetCpuTime())
+	{
+		std::cerr << "Phase '" << name << "'...\n";
+	}
+
+	ConfigBenchPhase(const ConfigBenchPhase&) = delete;
+	ConfigBenchPhase& operator=(const ConfigBenchPhase&) = delete;
+
+	~ConfigBenchPhase()
+	{
+		double duration = BenchUtility::GetMonotonicTime() - m_Start;
+
+		m_Phases->Set(m_Name, new Dictionary({
+			{ "seconds", duration },
+			{ "cpu_seconds", BenchUtility::GetCpuTime() - m_CpuStart },
+			{ "peak_rss", BenchUtility::GetPeakResidentMemory() }
+		}));
+
+		std::cerr << "Phase '" << m_Name << "' took " << duration << "s.\n";
+	}
+
+private:
+	const char *m_Name;
+	Dictionary::Ptr m_Phases;
+	double m_Start;
+	double m_CpuStart;
+};
+
+/**
+ * Sums up the profiled self times of committing the items by what they did.
+ */
+static Dictionary::Ptr GetCommitBreakdown()
+{
+	std::map<String, double> breakdown {
+		{ "evaluate", 0 },
+		{ "apply", 0 },
+		{ "validate", 0 },
+		{ "other", 0 }
+	};
+
+	for (auto& kv : ConfigProfiler::GetSelfTimes()) {
+		auto& category (kv.first.first);
+		auto& name (kv.first.second);
+
+		if (category == "import" || (category == "commit" && name.SubStr(0, 9) == "evaluate "))
+			breakdown["evaluate"] += kv.second;
+		else if (category == "apply" || (category == "commit" && name.SubStr(0, 19) == "CreateChildObjects "))
+			breakdown["apply"] += kv.second;
+		else if (category == "commit" && name.SubStr(0, 9) == "validate ")
+			breakdown["validate"] += kv.second;
+		else if (category == "commit")
+			breakdown["other"] += kv.second;
+	}
+
+	Dictionary::Ptr result = new Dictionary();
+
+	for (auto& kv : breakdown)
+		result->Set(kv.first, kv.second);
+
+	return result;
+}
+
+/**
+ * Generates a config of a given scale and loads it the way "icinga2 daemon -C" does,
+ * then writes the time, the CPU time and the peak memory of every phase as JSON.
+ */
+int main(int argc, char **argv)
+{
+	po::options_description desc ("Options");
+	desc.add_options()
+		("help,h", "show this help message")
+		("scale", po::value<std::string>()->default_value("10k"), "number of objects: 10k, 100k or 1m")
+		("objects", po::value<double>(), "number of objects, overrides --scale")
+		("template-depth", po::value<int>()->default_value(8), "number of templates each host and service imports transitively")
+		("vars", po::value<int>()->default_value(20), "number of additional custom variables per host")
+		("dir", po::value<std::string>(), "directory for the generated config, kept afterwards")
+		("generate-only", "only generate the config")
+		("no-profile", "don't break down the commit phase, i.e. measure it without the profiler's overhead")
+		("output,o", po::value<std::string>(), "write the results to the specified file instead of stdout")
+	;
+
+	po::variables_map vm;
+
+	try {
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	} catch (const std::exception& ex) {
+		std::cerr << ex.what() << "\n" << desc;
+		return EXIT_FAILURE;
+	}
+
+	if (vm.count("help")) {
+		std::cout << desc;
+		return EXIT_SUCCESS;
+	}
+
+	double objects;
+
+	try {
+		objects = vm.count("objects") ? vm["objects"].as<double>() : ParseScale(vm["scale"].as<std::string>());
+	} catch (const std::exception& ex) {
+		std::cerr << DiagnosticInformation(ex, false) << "\n";
+		return EXIT_FAILURE;
+	}
+
+	int depth = vm["template-depth"].as<int>();
+	int vars = vm["vars"].as<int>();
+
+	if (objects < 1 || depth < 1 || vars < 0) {
+		std::cerr << "The number of objects and the template depth must be greater than 0.\n";
+		return EXIT_FAILURE;
+	}
+
+	/* Commit the items as the daemon does, not just on one core. */
+	Configuration::Concurrency = std::thread::hardware_concurrency();
+
+	Application::InitializeBase();
+	Logger::SetConsoleLogSeverity(LogWarning);
+
+	String dir;
+	bool keepDir = vm.count("dir");
+
+	if (keepDir) {
+		dir = vm["dir"].as<std::string>();
+	} else {
+		const char *envTmp = getenv("TMPDIR");
+		dir = String(envTmp ? envTmp : "/tmp") + "/icinga2-configbench-" + Convert::ToString(Utility::GetPid());
+	}
+
+	std::vector<String> files;
+
+	try {
+		files = GenerateConfig(dir, objects, depth, vars);
+	} catch (const std::exception& ex) {
+		std::cerr << "Cannot generate the config: " << DiagnosticInformation(ex, false) << "\n";
+		return EXIT_FAILURE;
+	}
+
+	if (vm.count("generate-only")) {
+		std::cerr << "Generated the config in '" << dir << "'.\n";
+		return EXIT_SUCCESS;
+	}
+
+	bool profile = !vm.count("no-profile");
+
+	if (profile)
+		ConfigProfiler::Enable();
+
+	Dictionary::Ptr phases = new Dictionary();
+	std::vector<ConfigItem::Ptr> newItems;
+	bool success = true;
+
+	try {
+		ActivationScope ascope;
+		std::vector<std::unique_ptr<Expression>> expressions;
+
+		{
+			ConfigBenchPhase phase ("parse", phases);
+
+			for (auto& file : files)
+				expressions.emplace_back(ConfigCompiler::CompileFile(file, String(), "_etc"));
+		}
+
+		{
+			ConfigBenchPhase phase ("evaluate", phases);
+
+			for (auto& expression : expressions) {
+				ScriptFrame frame (true);
+				expression->Evaluate(frame);
+			}
+
+			ScriptGlobal::GetGlobals()->Freeze();
+		}
+
+		expressions.clear();
+
+		{
+			ConfigBenchPhase phase ("commit", phases);
+
+			WorkQueue upq (25000, Configuration::Concurrency);
+			upq.SetName("ConfigBench");
+
+			success = ConfigItem::CommitItems(ascope.GetContext(), upq, newItems, true);
+		}
+
+		if (success) {
+			ConfigBenchPhase phase ("validate_dependencies", phases);
+
+			Dependency::AssertNoCycles();
+		}
+	} catch (const std::exception& ex) {
+		std::cerr << "Cannot load the config: " << DiagnosticInformation(ex, false) << "\n";
+		success = false;
+	}
+
+	if (!keepDir)
+		Utility::RemoveDirRecursive(dir);
+
+	if (!success) {
+		std::cerr << "The generated config is invalid.\n";
+		std::_Exit(EXIT_FAILURE);
+	}
+
+	Dictionary::Ptr output = new Dictionary({
+		{ "version", Application::GetAppVersion() },
+		{ "time", Utility::GetTime() },
+		{ "concurrency", Configuration::Concurrency },
+		{ "template_depth", depth },
+		{ "vars", vars },
+		{ "files", static_cast<double>(files.size()) },
+		{ "objects", static_cast<double>(newItems.size()) },
+		{ "phases", phases },
+		{ "peak_rss", BenchUtility::GetPeakResidentMemory() }
+	});
+
+	/* Times of all threads, not wall clock time. */
+	if (profile)
+		output->Set("commit_breakdown", GetCommitBreakdown());
+
+	String json = JsonEncode(output, true);
+
+	if (vm.count("output")) {
+		std::ofstream fp (vm["output"].as<std::string>());
+		fp << json << "\n";
+
+		if (!fp) {
+			std::cerr << "Cannot write the results.\n";
+			return EXIT_FAILURE;
+		}
+	} else {
+		std::cout << json << "\n";
+	}
+
+	/* Like the test runner, don't wait for the thread pool and the timer thread. */
+	std::cout << std::flush;
+	std::_Exit(EXIT_SUCCESS);
+}
@@ -1029,4 +1029,49 @@ BOOST_AUTO_TEST_CASE(suppressed_notification)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(state_snapshot)
+{
+	Host::Ptr host = new Host();
+	host->SetActive(true);
+	host->SetMaxCheckAttempts(3);
+	host->Activate();
+	host->SetAuthority(true);
+	host->SetStateRaw(ServiceOK);
+	host->SetStateType(StateTypeHard);
+
+	auto initial (host->GetStateSnapshot());
+	BOOST_CHECK(initial->Active);
+	BOOST_CHECK(!initial->HasBeenChecked());
+	BOOST_CHECK(initial == host->GetStateSnapshot());
+
+	host->ProcessCheckResult(MakeCheckResult(ServiceCritical));
+
+	auto state (host->GetStateSnapshot());
+	BOOST_CHECK(state != initial);
+	BOOST_CHECK(state->HasBeenChecked());
+	BOOST_CHECK(state->LastCheckResult == host->GetLastCheckResult());
+	BOOST_CHECK(Host::CalculateState(state->StateRaw) == HostDown);
+	BOOST_CHECK(state->Type == StateTypeSoft);
+	BOOST_CHECK(state->CheckAttempt == 1);
+	BOOST_CHECK(state->Problem);
+	BOOST_CHECK(!state->IsAcknowledged());
+
+	/* A snapshot taken once stays as it is. */
+	BOOST_CHECK(!initial->HasBeenChecked());
+
+	host->AcknowledgeProblem("icingaadmin", "test", AcknowledgementNormal, false);
+
+	state = host->GetStateSnapshot();
+	BOOST_CHECK(state->IsAcknowledged());
+	BOOST_CHECK(state->Acknowledgement == AcknowledgementNormal);
+
+	host->ProcessCheckResult(MakeCheckResult(ServiceOK));
+
+	state = host->GetStateSnapshot();
+	BOOST_CHECK(Host::CalculateState(state->StateRaw) == HostUp);
+	BOOST_CHECK(state->Type == StateTypeHard);
+	BOOST_CHECK(!state->Problem);
+	BOOST_CHECK(!state->IsAcknowledged());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,51 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "icinga/clusterevents.hpp"
+#include "remote/apilistener.hpp"
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+static Endpoint::Ptr MakeEndpoint(const String& name, uint_fast64_t capabilities)
+{
+	Endpoint::Ptr endpoint = new Endpoint();
+	endpoint->SetName(name);
+	endpoint->SetCapabilities(capabilities);
+	endpoint->Register();
+
+	return endpoint;
+}
+
+static Zone::Ptr MakeZone(const String& name, const Array::Ptr& endpoints)
+{
+	Zone::Ptr zone = new Zone();
+	zone->SetName(name);
+	zone->SetEndpointsRaw(endpoints);
+	zone->Register();
+
+	return zone;
+}
+
+BOOST_AUTO_TEST_SUITE(icinga_clusterevents)
+
+BOOST_AUTO_TEST_CASE(batch_disconnected)
+{
+	auto batched ((uint_fast64_t)ApiCapabilities::BatchedExecuteCommands);
+
+	MakeEndpoint("batch-master1", batched);
+	MakeEndpoint("batch-master2", batched | (uint_fast64_t)ApiCapabilities::ExecuteArbitraryCommand);
+	MakeEndpoint("batch-old", (uint_fast64_t)ApiCapabilities::ExecuteArbitraryCommand);
+	MakeEndpoint("batch-unknown", 0);
+
+	/* The replay log is only read by endpoints which could handle the batches when they were connected last. */
+	BOOST_CHECK(ClusterEvents::CanBatchCheckResults(MakeZone("batch-masters", new Array({ "batch-master1", "batch-master2" }))));
+	BOOST_CHECK(!ClusterEvents::CanBatchCheckResults(MakeZone("batch-mixed", new Array({ "batch-master1", "batch-old" }))));
+
+	/* Never connected */
+	BOOST_CHECK(!ClusterEvents::CanBatchCheckResults(MakeZone("batch-new", new Array({ "batch-unknown" }))));
+
+	/* Nothing is logged for no parent. */
+	BOOST_CHECK(ClusterEvents::CanBatchCheckResults(nullptr));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
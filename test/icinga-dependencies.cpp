@@ -98,4 +98,64 @@ BOOST_AUTO_TEST_CASE(multi_parent)
 	BOOST_CHECK(childHost->IsReachable() == false);
 }
 
+static Host::Ptr CreateActiveHost(const String& name)
+{
+	Host::Ptr host = new Host();
+
+	host->SetName(name, true);
+	host->SetActive(true);
+	host->Activate();
+
+	return host;
+}
+
+static Dependency::Ptr AddDependency(const Host::Ptr& parent, const Host::Ptr& child)
+{
+	Dependency::Ptr dep = new Dependency();
+
+	dep->SetParent(parent);
+	dep->SetChild(child);
+
+	child->AddDependency(dep);
+	parent->AddReverseDependency(dep);
+
+	return dep;
+}
+
+BOOST_AUTO_TEST_CASE(all_children)
+{
+	/* a -> b -> d -> e, a -> c -> d */
+	Host::Ptr a = CreateActiveHost("a");
+	Host::Ptr b = CreateActiveHost("b");
+	Host::Ptr c = CreateActiveHost("c");
+	Host::Ptr d = CreateActiveHost("d");
+	Host::Ptr e = CreateActiveHost("e");
+
+	AddDependency(a, b);
+	AddDependency(a, c);
+	AddDependency(b, d);
+	Dependency::Ptr cd = AddDependency(c, d);
+	Dependency::Ptr de = AddDependency(d, e);
+
+	BOOST_CHECK(a->GetAllChildren() == std::set<Checkable::Ptr>({ b, c, d, e }));
+	BOOST_CHECK(c->GetAllChildren() == std::set<Checkable::Ptr>({ d, e }));
+	BOOST_CHECK(e->GetAllChildren().empty());
+
+	int visits = 0;
+	a->VisitAllChildren([&visits](const Checkable::Ptr&) { visits++; });
+	BOOST_CHECK_EQUAL(visits, 4);
+
+	/* Removed edges must be left out by the next traversal. */
+	d->RemoveReverseDependency(de);
+	BOOST_CHECK(a->GetAllChildren() == std::set<Checkable::Ptr>({ b, c, d }));
+
+	c->RemoveReverseDependency(cd);
+	BOOST_CHECK(c->GetAllChildren().empty());
+	BOOST_CHECK(a->GetAllChildren() == std::set<Checkable::Ptr>({ b, c, d }));
+
+	/* Deactivated checkables are left out, too. */
+	b->Deactivate();
+	BOOST_CHECK(a->GetAllChildren() == std::set<Checkable::Ptr>({ c }));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,58 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "icinga/downtime.hpp"
+#include <BoostTestTargetConfig.h>
+#include <limits>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(icinga_downtime)
+
+BOOST_AUTO_TEST_CASE(fixed_transitions)
+{
+	Downtime::Ptr downtime = new Downtime();
+	downtime->SetFixed(true);
+	downtime->SetStartTime(100);
+	downtime->SetEndTime(200);
+
+	double next = std::numeric_limits<double>::infinity();
+	BOOST_CHECK(!downtime->IsInEffect(50, &next));
+	BOOST_CHECK_EQUAL(next, 100);
+
+	next = std::numeric_limits<double>::infinity();
+	BOOST_CHECK(downtime->IsInEffect(100, &next));
+	BOOST_CHECK_EQUAL(next, 200);
+
+	next = 150;
+	BOOST_CHECK(downtime->IsInEffect(120, &next));
+	BOOST_CHECK_EQUAL(next, 150);
+
+	next = std::numeric_limits<double>::infinity();
+	BOOST_CHECK(!downtime->IsInEffect(200, &next));
+	BOOST_CHECK(next == std::numeric_limits<double>::infinity());
+}
+
+BOOST_AUTO_TEST_CASE(flexible_transitions)
+{
+	Downtime::Ptr downtime = new Downtime();
+	downtime->SetFixed(false);
+	downtime->SetStartTime(100);
+	downtime->SetEndTime(1000);
+	downtime->SetDuration(60);
+
+	/* Not triggered yet, only triggering changes that. */
+	double next = std::numeric_limits<double>::infinity();
+	BOOST_CHECK(!downtime->IsInEffect(150, &next));
+	BOOST_CHECK(next == std::numeric_limits<double>::infinity());
+
+	downtime->SetTriggerTime(150);
+
+	BOOST_CHECK(downtime->IsInEffect(160, &next));
+	BOOST_CHECK_EQUAL(next, 210);
+
+	next = std::numeric_limits<double>::infinity();
+	BOOST_CHECK(!downtime->IsInEffect(210, &next));
+	BOOST_CHECK(next == std::numeric_limits<double>::infinity());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
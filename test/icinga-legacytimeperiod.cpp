@@ -691,4 +691,61 @@ BOOST_AUTO_TEST_CASE(dst_isinside)
 	}
 }
 
+// This test checks that ScriptFunc() doesn't keep using the parsed ranges after they've been replaced.
+BOOST_AUTO_TEST_CASE(compiled_ranges)
+{
+	TimePeriod::Ptr tp = new TimePeriod();
+	tp->SetRanges(new Dictionary({{"monday", "10:00-12:00"}}), true);
+
+	// Mon 01 Nov 2021 00:00:00 UTC - Sun 07 Nov 2021 23:59:59 UTC
+	double begin = 1635724800, end = 1636329599;
+
+	Array::Ptr segments = LegacyTimePeriod::ScriptFunc(tp, begin, end);
+	BOOST_CHECK_EQUAL(segments->GetLength(), 1);
+
+	tp->SetRanges(new Dictionary({{"monday", "10:00-12:00,14:00-16:00"}, {"tuesday", "10:00-12:00"}}), true);
+
+	segments = LegacyTimePeriod::ScriptFunc(tp, begin, end);
+	BOOST_CHECK_EQUAL(segments->GetLength(), 3);
+}
+
+static Array::Ptr OverlappingSegments(const TimePeriod::Ptr&, double, double)
+{
+	return new Array({
+		new Dictionary({{"begin", 300}, {"end", 400}}),
+		new Dictionary({{"begin", 100}, {"end", 200}}),
+		new Dictionary({{"begin", 150}, {"end", 250}}),
+		new Dictionary({{"begin", 250}, {"end", 260}}),
+	});
+}
+
+// This test checks that overlapping and touching segments are merged and looked up correctly.
+BOOST_AUTO_TEST_CASE(merged_segments)
+{
+	TimePeriod::Ptr tp = new TimePeriod();
+	tp->SetUpdate(new Function("OverlappingSegments", OverlappingSegments, {"tp", "begin", "end"}), true);
+
+	tp->UpdateRegion(0, 1000, true);
+
+	Array::Ptr segments = tp->GetSegments();
+	BOOST_REQUIRE_EQUAL(segments->GetLength(), 2);
+	BOOST_CHECK(Dictionary::Ptr(segments->Get(0))->Get("begin") == 100);
+	BOOST_CHECK(Dictionary::Ptr(segments->Get(0))->Get("end") == 260);
+	BOOST_CHECK(Dictionary::Ptr(segments->Get(1))->Get("begin") == 300);
+	BOOST_CHECK(Dictionary::Ptr(segments->Get(1))->Get("end") == 400);
+
+	BOOST_CHECK(!tp->IsInside(50));
+	BOOST_CHECK(!tp->IsInside(100));
+	BOOST_CHECK(tp->IsInside(150));
+	BOOST_CHECK(tp->IsInside(250));
+	BOOST_CHECK(!tp->IsInside(280));
+	BOOST_CHECK(tp->IsInside(350));
+	BOOST_CHECK(!tp->IsInside(500));
+
+	BOOST_CHECK_EQUAL(tp->FindNextTransition(0), 100);
+	BOOST_CHECK_EQUAL(tp->FindNextTransition(100), 260);
+	BOOST_CHECK_EQUAL(tp->FindNextTransition(260), 300);
+	BOOST_CHECK_EQUAL(tp->FindNextTransition(400), -1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,7 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "icinga/macroprocessor.hpp"
+#include "base/function.hpp"
 #include <BoostTestTargetConfig.h>
 
 using namespace icinga;
@@ -47,4 +48,62 @@ BOOST_AUTO_TEST_CASE(simple)
 
 }
 
+BOOST_AUTO_TEST_CASE(parsed_once)
+{
+	Dictionary::Ptr macrosA = new Dictionary();
+	macrosA->Set("test", "hello");
+
+	Dictionary::Ptr macrosB = new Dictionary();
+	macrosB->Set("test", "world");
+
+	MacroProcessor::ResolverList resolversA;
+	resolversA.emplace_back("macros", macrosA);
+
+	MacroProcessor::ResolverList resolversB;
+	resolversB.emplace_back("macros", macrosB);
+
+	/* The same string resolves differently depending on the resolvers, also once it's been parsed. */
+	for (int i = 0; i < 2; i++) {
+		BOOST_CHECK(MacroProcessor::ResolveMacros("a $macros.test$ $$b$$ $test$c", resolversA) == "a hello $b$ helloc");
+		BOOST_CHECK(MacroProcessor::ResolveMacros("a $macros.test$ $$b$$ $test$c", resolversB) == "a world $b$ worldc");
+	}
+
+	BOOST_CHECK(MacroProcessor::ResolveMacros("no macros", resolversA) == "no macros");
+	BOOST_CHECK(MacroProcessor::ResolveMacros("$$", resolversA) == "$");
+
+	String missingMacro;
+	BOOST_CHECK(MacroProcessor::ResolveMacros("x$macros.missing$y", resolversA, nullptr, &missingMacro) == "xy");
+	BOOST_CHECK(missingMacro == "macros.missing");
+
+	BOOST_CHECK_THROW(MacroProcessor::ResolveMacros("$macros.test", resolversA), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(stability)
+{
+	Dictionary::Ptr macros = new Dictionary();
+	macros->Set("test", "hello");
+	macros->Set("func", new Function("test", [](const std::vector<Value>&) -> Value { return "world"; }));
+
+	MacroProcessor::ResolverList resolvers;
+	resolvers.emplace_back("macros", macros);
+
+	{
+		MacroProcessor::StabilityTracker tracker;
+		BOOST_CHECK(MacroProcessor::ResolveMacros("$macros.test$ $macros.missing$", resolvers) == "hello ");
+		BOOST_CHECK(tracker.IsStable());
+	}
+
+	{
+		MacroProcessor::StabilityTracker outer;
+
+		{
+			MacroProcessor::StabilityTracker inner;
+			BOOST_CHECK(MacroProcessor::ResolveMacros("$macros.func$", resolvers) == "world");
+			BOOST_CHECK(!inner.IsStable());
+		}
+
+		BOOST_CHECK(!outer.IsStable());
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
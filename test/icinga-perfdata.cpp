@@ -1,6 +1,7 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "base/perfdatavalue.hpp"
+#include "icinga/checkresult.hpp"
 #include "icinga/pluginutility.hpp"
 #include <BoostTestTargetConfig.h>
 
@@ -413,4 +414,27 @@ BOOST_AUTO_TEST_CASE(parse_edgecases)
 	BOOST_CHECK_EQUAL(pv->GetUnit(), "bytes");
 }
 
+BOOST_AUTO_TEST_CASE(parsed_cache)
+{
+	CheckResult::Ptr cr = new CheckResult();
+	BOOST_CHECK(!cr->GetParsedPerformanceData());
+
+	cr->SetPerformanceData(PluginUtility::SplitPerfdata("a=1s;2;3 invalid=x b=5%"));
+
+	Array::Ptr parsed = cr->GetParsedPerformanceData();
+	BOOST_CHECK_EQUAL(parsed->GetLength(), 3);
+	BOOST_CHECK(parsed->Get(0).IsObjectType<PerfdataValue>());
+	BOOST_CHECK_EQUAL(static_cast<PerfdataValue::Ptr>(parsed->Get(0))->GetUnit(), "seconds");
+	BOOST_CHECK_EQUAL(parsed->Get(1), "invalid=x");
+	BOOST_CHECK_EQUAL(static_cast<PerfdataValue::Ptr>(parsed->Get(2))->GetValue(), 5);
+
+	/* parsed once and shared */
+	BOOST_CHECK(cr->GetParsedPerformanceData() == parsed);
+	BOOST_CHECK_THROW(parsed->Add(1), std::exception);
+
+	cr->SetPerformanceData(PluginUtility::SplitPerfdata("c=7"));
+	BOOST_CHECK(cr->GetParsedPerformanceData() != parsed);
+	BOOST_CHECK_EQUAL(cr->GetParsedPerformanceData()->GetLength(), 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,455 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "microbench.hpp"
+#include "icinga/macroprocessor.hpp"
+#include "icinga/pluginutility.hpp"
+#include "base/array.hpp"
+#include "base/base64.hpp"
+#include "base/convert.hpp"
+#include "base/dictionary.hpp"
+#include "base/json.hpp"
+#include "base/objectlock.hpp"
+#include "base/perfdatavalue.hpp"
+#include "base/serializer.hpp"
+#include "base/utility.hpp"
+#include "base/value.hpp"
+#include "base/wildcardpattern.hpp"
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace icinga;
+
+/* Outputs of common plugins as they're received by Icinga. */
+static const char * const l_CheckOutputs[] = {
+	"PING OK - Packet loss = 0%, RTA = 0.80 ms|rta=0.800000ms;100.000000;500.000000;0.000000 pl=0%;20;60;0",
+	"DISK OK - free space: / 3326 MB (56% inode=99%); /boot 68 MB (69% inode=99%); /home 69357 MB (84% inode=99%);"
+		"| /=2643MB;5948;5958;0;5968 /boot=68MB;88;93;0;98 /home=13043MB;81322;81342;0;81362",
+	"OK - load average: 0.12, 0.09, 0.08|load1=0.120;5.000;10.000;0; load5=0.090;4.000;6.000;0; load15=0.080;3.000;4.000;0;",
+	"HTTP OK: HTTP/1.1 200 OK - 5548 bytes in 0.052 second response time |time=0.051908s;5.000000;10.000000;0.000000 size=5548B;;;0",
+	"OK - eth0 is up/up, eth1 is up/up, eth2 is up/up\n"
+		"eth0 in: 0.01% out: 0.02%\neth1 in: 1.52% out: 0.61%\neth2 in: 0.00% out: 0.00%"
+		"|'eth0_usage_in'=0.01%;80;90;0;100 'eth0_usage_out'=0.02%;80;90;0;100 'eth0_traffic_in'=10254.93;800000000;900000000;0;1000000000"
+		" 'eth0_traffic_out'=16821.49;800000000;900000000;0;1000000000 'eth0_errors_in'=0;1;10;; 'eth0_errors_out'=0;1;10;;"
+		" 'eth1_usage_in'=1.52%;80;90;0;100 'eth1_usage_out'=0.61%;80;90;0;100 'eth1_traffic_in'=15213489.27;800000000;900000000;0;1000000000"
+		" 'eth1_traffic_out'=6104572.31;800000000;900000000;0;1000000000 'eth1_errors_in'=0;1;10;; 'eth1_errors_out'=0;1;10;;"
+		" 'eth2_usage_in'=0%;80;90;0;100 'eth2_usage_out'=0%;80;90;0;100 'eth2_traffic_in'=0;800000000;900000000;0;1000000000"
+		" 'eth2_traffic_out'=0;800000000;900000000;0;1000000000 'eth2_errors_in'=0;1;10;; 'eth2_errors_out'=0;1;10;;"
+};
+
+static Dictionary::Ptr MakeCheckResult(const String& output)
+{
+	auto co (PluginUtility::ParseCheckOutput(output));
+
+	return new Dictionary({
+		{ "type", "CheckResult" },
+		{ "output", co.first },
+		{ "performance_data", PluginUtility::SplitPerfdata(co.second) },
+		{ "command", new Array({ "/usr/lib/nagios/plugins/check_disk", "-c", "10%", "-w", "20%", "-X", "none", "-X", "tmpfs", "-m" }) },
+		{ "state", 0 },
+		{ "exit_status", 0 },
+		{ "active", true },
+		{ "check_source", "icinga2-master1.localdomain" },
+		{ "scheduling_source", "icinga2-master1.localdomain" },
+		{ "schedule_start", 1700000000.123456 },
+		{ "schedule_end", 1700000000.234567 },
+		{ "execution_start", 1700000000.125 },
+		{ "execution_end", 1700000000.233 },
+		{ "ttl", 0 },
+		{ "vars_before", new Dictionary({ { "attempt", 1 }, { "reachable", true }, { "state", 0 }, { "state_type", 1 } }) },
+		{ "vars_after", new Dictionary({ { "attempt", 1 }, { "reachable", true }, { "state", 0 }, { "state_type", 1 } }) }
+	});
+}
+
+/**
+ * @returns A host as returned by /v1/objects/hosts: all attributes, a few dozen custom variables and the last check result.
+ */
+static Dictionary::Ptr MakeApiObject()
+{
+	Dictionary::Ptr vars = new Dictionary({
+		{ "os", "Linux" },
+		{ "env", "production" },
+		{ "notification", new Dictionary({ { "mail", new Dictionary({ { "groups", new Array({ "icingaadmins", "linux-admins" }) } }) } }) }
+	});
+
+	for (int i = 0; i < 8; i++) {
+		vars->Set("disk_srv_data" + Convert::ToString(i), new Dictionary({
+			{ "disk_partitions", "/srv/data" + Convert::ToString(i) },
+			{ "disk_wfree", "20%" },
+			{ "disk_cfree", "10%" }
+		}));
+
+		vars->Set("http_vhost_" + Convert::ToString(i), new Dictionary({
+			{ "http_uri", "/status" },
+			{ "http_vhost", "app" + Convert::ToString(i) + ".example.com" },
+			{ "http_ssl", true },
+			{ "http_port", 443 + i }
+		}));
+	}
+
+	Dictionary::Ptr attrs = new Dictionary({
+		{ "__name", "web-frontend-042.example.com" },
+		{ "name", "web-frontend-042.example.com" },
+		{ "display_name", "Web frontend 042" },
+		{ "type", "Host" },
+		{ "address", "192.0.2.42" },
+		{ "address6", "2001:db8::42" },
+		{ "check_command", "hostalive" },
+		{ "check_interval", 60 },
+		{ "retry_interval", 30 },
+		{ "max_check_attempts", 3 },
+		{ "check_attempt", 1 },
+		{ "check_period", "" },
+		{ "check_timeout", Empty },
+		{ "command_endpoint", "" },
+		{ "enable_active_checks", true },
+		{ "enable_event_handler", true },
+		{ "enable_flapping", false },
+		{ "enable_notifications", true },
+		{ "enable_passive_checks", true },
+		{ "enable_perfdata", true },
+		{ "event_command", "" },
+		{ "flapping", false },
+		{ "flapping_current", 0 },
+		{ "flapping_threshold_high", 30 },
+		{ "flapping_threshold_low", 25 },
+		{ "force_next_check", false },
+		{ "force_next_notification", false },
+		{ "groups", new Array({ "linux-servers", "web-servers", "production" }) },
+		{ "ha_mode", 0 },
+		{ "icon_image", "" },
+		{ "last_check", 1700000000.234567 },
+		{ "last_check_result", MakeCheckResult(l_CheckOutputs[0]) },
+		{ "last_hard_state", 0 },
+		{ "last_hard_state_changed", 1699000000.5 },
+		{ "last_reachable", true },
+		{ "last_state", 0 },
+		{ "last_state_change", 1699000000.5 },
+		{ "last_state_type", 1 },
+		{ "last_state_up", 1700000000.234567 },
+		{ "next_check", 1700000060.1 },
+		{ "next_update", 1700000120.2 },
+		{ "notes", "Managed by the web team" },
+		{ "notes_url", "https://wiki.example.com/hosts/web-frontend-042" },
+		{ "package", "_etc" },
+		{ "source_location", new Dictionary({
+			{ "first_column", 1 }, { "first_line", 42 }, { "last_column", 39 }, { "last_line", 42 },
+			{ "path", "/etc/icinga2/zones.d/master/hosts.conf" }
+		}) },
+		{ "state", 0 },
+		{ "state_type", 1 },
+		{ "templates", new Array({ "web-frontend-042.example.com", "generic-host", "linux-host" }) },
+		{ "vars", vars },
+		{ "version", 0 },
+		{ "volatile", false },
+		{ "zone", "master" }
+	});
+
+	return new Dictionary({
+		{ "attrs", attrs },
+		{ "joins", new Dictionary() },
+		{ "meta", new Dictionary() },
+		{ "name", "web-frontend-042.example.com" },
+		{ "type", "Host" }
+	});
+}
+
+MICROBENCH(object_ptr_copy)
+{
+	Object::Ptr object = new Dictionary();
+
+	state.Measure([&object]() {
+		Object::Ptr copy (object);
+		DoNotOptimize(copy);
+	});
+}
+
+/* The same with other threads copying the same pointer all the time, i.e. contending for its reference count. */
+MICROBENCH(object_ptr_copy_contended)
+{
+	Object::Ptr object = new Dictionary();
+	std::atomic<bool> stop (false);
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < 3; i++) {
+		threads.emplace_back([&object, &stop]() {
+			while (!stop.load(std::memory_order_relaxed)) {
+				Object::Ptr copy (object);
+				DoNotOptimize(copy);
+			}
+		});
+	}
+
+	state.Measure([&object]() {
+		Object::Ptr copy (object);
+		DoNotOptimize(copy);
+	});
+
+	stop.store(true);
+
+	for (auto& thread : threads)
+		thread.join();
+}
+
+MICROBENCH(dictionary_set)
+{
+	std::vector<String> keys;
+
+	for (int i = 0; i < 32; i++)
+		keys.emplace_back("attribute_" + Convert::ToString(i));
+
+	state.Measure([&keys]() {
+		Dictionary::Ptr dict = new Dictionary();
+
+		for (auto& key : keys)
+			dict->Set(key, 42);
+
+		DoNotOptimize(dict);
+	});
+}
+
+/* Beyond Dictionary::MaxBlockSize keys, so insertions shift pairs within blocks and split them. */
+MICROBENCH(dictionary_set_random_2000)
+{
+	std::vector<String> keys;
+
+	for (int i = 0; i < 2000; i++)
+		keys.emplace_back("attribute_" + Convert::ToString(i));
+
+	std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+	state.Measure([&keys]() {
+		Dictionary::Ptr dict = new Dictionary();
+
+		for (auto& key : keys)
+			dict->Set(key, 42);
+
+		DoNotOptimize(dict);
+	});
+}
+
+MICROBENCH(dictionary_get)
+{
+	Dictionary::Ptr attrs = MakeApiObject()->Get("attrs");
+	String key = "last_check_result";
+
+	state.Measure([&attrs, &key]() {
+		DoNotOptimize(attrs->Get(key));
+	});
+}
+
+MICROBENCH(dictionary_get_missing)
+{
+	Dictionary::Ptr attrs = MakeApiObject()->Get("attrs");
+	String key = "no_such_attribute";
+
+	state.Measure([&attrs, &key]() {
+		DoNotOptimize(attrs->Get(key));
+	});
+}
+
+MICROBENCH(dictionary_shallow_clone)
+{
+	Dictionary::Ptr attrs = MakeApiObject()->Get("attrs");
+
+	state.Measure([&attrs]() {
+		DoNotOptimize(attrs->ShallowClone());
+	});
+}
+
+MICROBENCH(value_add_number)
+{
+	Value a = 42, b = 0.5;
+
+	state.Measure([&a, &b]() {
+		DoNotOptimize(a + b);
+	});
+}
+
+MICROBENCH(value_add_string)
+{
+	Value a = "web-frontend-042", b = ".example.com";
+
+	state.Measure([&a, &b]() {
+		DoNotOptimize(a + b);
+	});
+}
+
+MICROBENCH(value_equal_string)
+{
+	Value a = "web-frontend-042.example.com", b = "web-frontend-043.example.com";
+
+	state.Measure([&a, &b]() {
+		DoNotOptimize(a == b);
+	});
+}
+
+MICROBENCH(value_less_number)
+{
+	Value a = 42, b = 43.5;
+
+	state.Measure([&a, &b]() {
+		DoNotOptimize(a < b);
+	});
+}
+
+MICROBENCH(value_to_string)
+{
+	Value value = 1700000000.234567;
+
+	state.Measure([&value]() {
+		DoNotOptimize(Convert::ToString(value));
+	});
+}
+
+MICROBENCH(json_encode_api_object)
+{
+	Dictionary::Ptr object = MakeApiObject();
+
+	state.Measure([&object]() {
+		DoNotOptimize(JsonEncode(object));
+	});
+}
+
+MICROBENCH(json_decode_api_object)
+{
+	String json = JsonEncode(MakeApiObject());
+
+	state.Measure([&json]() {
+		DoNotOptimize(JsonDecode(json));
+	});
+}
+
+MICROBENCH(json_encode_check_result)
+{
+	Dictionary::Ptr cr = MakeCheckResult(l_CheckOutputs[4]);
+
+	state.Measure([&cr]() {
+		DoNotOptimize(JsonEncode(cr));
+	});
+}
+
+MICROBENCH(json_decode_check_result)
+{
+	String json = JsonEncode(MakeCheckResult(l_CheckOutputs[4]));
+
+	state.Measure([&json]() {
+		DoNotOptimize(JsonDecode(json));
+	});
+}
+
+MICROBENCH(utility_match_wildcard)
+{
+	String pattern = "web-*.example.com", text = "web-frontend-042.example.com";
+
+	state.Measure([&pattern, &text]() {
+		DoNotOptimize(Utility::Match(pattern, text));
+	});
+}
+
+MICROBENCH(utility_match_mismatch)
+{
+	String pattern = "db-*-primary.example.com", text = "web-frontend-042.example.com";
+
+	state.Measure([&pattern, &text]() {
+		DoNotOptimize(Utility::Match(pattern, text));
+	});
+}
+
+/* What a loop over many texts, e.g. match() with a literal pattern in a filter, does per text. */
+MICROBENCH(wildcard_pattern_match)
+{
+	WildcardPattern pattern ("web-*.example.com");
+	String text = "web-frontend-042.example.com";
+
+	state.Measure([&pattern, &text]() {
+		DoNotOptimize(pattern.Match(text));
+	});
+}
+
+MICROBENCH(base64_encode)
+{
+	String data = JsonEncode(MakeCheckResult(l_CheckOutputs[4]));
+
+	state.Measure([&data]() {
+		DoNotOptimize(Base64::Encode(data));
+	});
+}
+
+MICROBENCH(base64_decode)
+{
+	String data = Base64::Encode(JsonEncode(MakeCheckResult(l_CheckOutputs[4])));
+
+	state.Measure([&data]() {
+		DoNotOptimize(Base64::Decode(data));
+	});
+}
+
+MICROBENCH(serialize_api_object)
+{
+	Dictionary::Ptr object = MakeApiObject();
+
+	state.Measure([&object]() {
+		DoNotOptimize(Serialize(object, FAConfig | FAState));
+	});
+}
+
+MICROBENCH(macro_resolve_command_line)
+{
+	Dictionary::Ptr host = new Dictionary({
+		{ "name", "web-frontend-042.example.com" },
+		{ "address", "192.0.2.42" },
+		{ "vars", new Dictionary({ { "disk_wfree", "20%" }, { "disk_cfree", "10%" } }) }
+	});
+
+	Dictionary::Ptr service = new Dictionary({
+		{ "name", "disk /srv/data0" },
+		{ "vars", new Dictionary({ { "disk_partitions", "/srv/data0" } }) }
+	});
+
+	Dictionary::Ptr command = new Dictionary({
+		{ "vars", new Dictionary({ { "disk_wfree", "15%" }, { "disk_units", "MB" } }) }
+	});
+
+	MacroProcessor::ResolverList resolvers;
+	resolvers.emplace_back("service", service);
+	resolvers.emplace_back("host", host);
+	resolvers.emplace_back("command", command);
+
+	String commandLine = "/usr/lib/nagios/plugins/check_disk -H $host.address$ -w $host.vars.disk_wfree$ -c $host.vars.disk_cfree$"
+		" -p $service.vars.disk_partitions$ -u $command.vars.disk_units$";
+
+	state.Measure([&commandLine, &resolvers]() {
+		DoNotOptimize(MacroProcessor::ResolveMacros(commandLine, resolvers));
+	});
+}
+
+MICROBENCH(perfdata_parse_value)
+{
+	String perfdata = "'eth1_traffic_in'=15213489.27;800000000;900000000;0;1000000000";
+
+	state.Measure([&perfdata]() {
+		DoNotOptimize(PerfdataValue::Parse(perfdata));
+	});
+}
+
+MICROBENCH(perfdata_parse_check_outputs)
+{
+	std::vector<String> perfdata;
+
+	for (auto output : l_CheckOutputs)
+		perfdata.emplace_back(PluginUtility::ParseCheckOutput(output).second);
+
+	state.Measure([&perfdata]() {
+		for (auto& text : perfdata) {
+			Array::Ptr values = PluginUtility::SplitPerfdata(text);
+
+			ObjectLock olock (values);
+
+			for (const String& value : values)
+				DoNotOptimize(PerfdataValue::Parse(value));
+		}
+	});
+}
@@ -0,0 +1,97 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "microbench.hpp"
+#include "microbench-icinga.hpp"
+#include "icinga/checkresult.hpp"
+#include "icinga/pluginutility.hpp"
+#include "base/array.hpp"
+#include "base/convert.hpp"
+#include "base/dictionary.hpp"
+#include "base/serializer.hpp"
+
+using namespace icinga;
+
+static CheckResult::Ptr MakeMicrobenchCheckResult()
+{
+	auto co (PluginUtility::ParseCheckOutput("DISK OK - free space: / 3326 MB (56% inode=99%); /boot 68 MB (69% inode=99%);"
+		" /home 69357 MB (84% inode=99%);| /=2643MB;5948;5958;0;5968 /boot=68MB;88;93;0;98 /home=13043MB;81322;81342;0;81362"));
+
+	CheckResult::Ptr cr = new CheckResult();
+	cr->SetOutput(co.first);
+	cr->SetPerformanceData(PluginUtility::SplitPerfdata(co.second));
+	cr->SetCommand(new Array({ "/usr/lib/nagios/plugins/check_disk", "-c", "10%", "-w", "20%", "-X", "none", "-X", "tmpfs", "-m" }));
+	cr->SetState(ServiceOK);
+	cr->SetExitStatus(0);
+	cr->SetCheckSource("icinga2-master1.localdomain");
+	cr->SetSchedulingSource("icinga2-master1.localdomain");
+	cr->SetScheduleStart(1700000000.123456);
+	cr->SetScheduleEnd(1700000000.234567);
+	cr->SetExecutionStart(1700000000.125);
+	cr->SetExecutionEnd(1700000000.233);
+	cr->SetVarsBefore(new Dictionary({ { "attempt", 1 }, { "reachable", true }, { "state", 0 }, { "state_type", 1 } }));
+	cr->SetVarsAfter(new Dictionary({ { "attempt", 1 }, { "reachable", true }, { "state", 0 }, { "state_type", 1 } }));
+
+	return cr;
+}
+
+/**
+ * @returns A checked host with the attributes and custom variables of a typical config. It isn't activated.
+ */
+Host::Ptr icinga::MakeMicrobenchHost()
+{
+	Dictionary::Ptr vars = new Dictionary({
+		{ "os", "Linux" },
+		{ "env", "production" },
+		{ "notification", new Dictionary({ { "mail", new Dictionary({ { "groups", new Array({ "icingaadmins", "linux-admins" }) } }) } }) }
+	});
+
+	for (int i = 0; i < 8; i++) {
+		vars->Set("disk_srv_data" + Convert::ToString(i), new Dictionary({
+			{ "disk_partitions", "/srv/data" + Convert::ToString(i) },
+			{ "disk_wfree", "20%" },
+			{ "disk_cfree", "10%" }
+		}));
+	}
+
+	Host::Ptr host = new Host();
+	host->SetName("web-frontend-042.example.com");
+	host->SetDisplayName("Web frontend 042");
+	host->SetAddress("192.0.2.42");
+	host->SetAddress6("2001:db8::42");
+	host->SetGroups(new Array({ "linux-servers", "web-servers", "production" }));
+	host->SetVars(vars);
+	host->SetNotes("Managed by the web team");
+	host->SetNotesUrl("https://wiki.example.com/hosts/web-frontend-042");
+	host->SetZoneName("master");
+	host->SetMaxCheckAttempts(3);
+	host->SetCheckTimeout(30);
+	host->SetCheckInterval(60);
+	host->SetRetryInterval(30);
+	host->SetStateRaw(ServiceOK);
+	host->SetStateType(StateTypeHard);
+	host->SetLastStateChange(1699000000.5);
+	host->SetLastHardStateChange(1699000000.5);
+	host->SetNextCheck(1700000060.1);
+	host->SetLastCheckResult(MakeMicrobenchCheckResult());
+
+	return host;
+}
+
+/* All the fields of a host, e.g. for the state file or the /v1/objects API. Built in one go, not by Dictionary::Set(). */
+MICROBENCH(serialize_host)
+{
+	Host::Ptr host = MakeMicrobenchHost();
+
+	state.Measure([&host]() {
+		DoNotOptimize(Serialize(host, FAConfig | FAState));
+	});
+}
+
+MICROBENCH(serialize_check_result)
+{
+	CheckResult::Ptr cr = MakeMicrobenchCheckResult();
+
+	state.Measure([&cr]() {
+		DoNotOptimize(Serialize(cr));
+	});
+}
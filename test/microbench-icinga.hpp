@@ -0,0 +1,15 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef MICROBENCH_ICINGA_H
+#define MICROBENCH_ICINGA_H
+
+#include "icinga/host.hpp"
+
+namespace icinga
+{
+
+Host::Ptr MakeMicrobenchHost();
+
+}
+
+#endif /* MICROBENCH_ICINGA_H */
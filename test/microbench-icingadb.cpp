@@ -0,0 +1,59 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "microbench.hpp"
+#include "microbench-icinga.hpp"
+#include "icingadb/icingadb.hpp"
+#include "base/json.hpp"
+
+namespace icinga
+{
+
+/**
+ * Calls the private state serialization of IcingaDB.
+ */
+class IcingaDBMicrobench
+{
+public:
+	static Dictionary::Ptr SerializeState(const IcingaDB::Ptr& icingadb, const Checkable::Ptr& checkable)
+	{
+		return icingadb->SerializeState(checkable);
+	}
+
+	static String HashValue(const Value& value)
+	{
+		return IcingaDB::HashValue(value);
+	}
+};
+
+}
+
+using namespace icinga;
+
+/* IcingaDB does these three per state update, unless the state didn't change (see IcingaDB::GetPreparedState()). */
+MICROBENCH(icingadb_serialize_state)
+{
+	IcingaDB::Ptr icingadb = new IcingaDB();
+	Host::Ptr host = MakeMicrobenchHost();
+
+	state.Measure([&icingadb, &host]() {
+		DoNotOptimize(IcingaDBMicrobench::SerializeState(icingadb, host));
+	});
+}
+
+MICROBENCH(icingadb_hash_state)
+{
+	Dictionary::Ptr attrs = IcingaDBMicrobench::SerializeState(new IcingaDB(), MakeMicrobenchHost());
+
+	state.Measure([&attrs]() {
+		DoNotOptimize(IcingaDBMicrobench::HashValue(attrs));
+	});
+}
+
+MICROBENCH(icingadb_json_encode_state)
+{
+	Dictionary::Ptr attrs = IcingaDBMicrobench::SerializeState(new IcingaDB(), MakeMicrobenchHost());
+
+	state.Measure([&attrs]() {
+		DoNotOptimize(JsonEncode(attrs));
+	});
+}
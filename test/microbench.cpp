@@ -0,0 +1,175 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "microbench.hpp"
+#include "base/application.hpp"
+#include "base/array.hpp"
+#include "base/dictionary.hpp"
+#include "base/exception.hpp"
+#include "base/json.hpp"
+#include "base/objectlock.hpp"
+#include "base/utility.hpp"
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+using namespace icinga;
+namespace po = boost::program_options;
+
+void Microbench::Register(const String& name, const Callback& func)
+{
+	GetRegistry().push_back({ name, func });
+}
+
+const std::vector<Microbench::Case>& Microbench::GetCases()
+{
+	return GetRegistry();
+}
+
+std::vector<Microbench::Case>& Microbench::GetRegistry()
+{
+	static std::vector<Case> registry;
+	return registry;
+}
+
+/**
+ * Reads the median of every benchmark from a previous run.
+ */
+static std::map<String, double> LoadBaseline(const String& path)
+{
+	std::ifstream fp (path.CStr());
+
+	if (!fp)
+		BOOST_THROW_EXCEPTION(std::runtime_error("Cannot open baseline file '" + path + "'."));
+
+	std::ostringstream msgbuf;
+	msgbuf << fp.rdbuf();
+
+	Dictionary::Ptr result = JsonDecode(msgbuf.str());
+	Array::Ptr benchmarks = result->Get("benchmarks");
+	std::map<String, double> baseline;
+
+	ObjectLock olock (benchmarks);
+
+	for (const Dictionary::Ptr& benchmark : benchmarks)
+		baseline[static_cast<String>(benchmark->Get("name"))] = benchmark->Get("ns_per_op");
+
+	return baseline;
+}
+
+/**
+ * Runs the microbenchmarks and writes their results as JSON. Results of the same machine and build type
+ * can be compared across commits, e.g. by passing the output of a previous run as --baseline.
+ */
+int main(int argc, char **argv)
+{
+	po::options_description desc ("Options");
+	desc.add_options()
+		("help,h", "show this help message")
+		("filter,f", po::value<std::string>(), "only run the benchmarks whose name contains the specified string")
+		("min-time", po::value<double>()->default_value(0.1), "minimum duration of a sample in seconds")
+		("samples", po::value<int>()->default_value(5), "number of samples per benchmark")
+		("baseline", po::value<std::string>(), "compare the results with the output of a previous run")
+		("output,o", po::value<std::string>(), "write the results to the specified file instead of stdout")
+	;
+
+	po::variables_map vm;
+
+	try {
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	} catch (const std::exception& ex) {
+		std::cerr << ex.what() << "\n" << desc;
+		return EXIT_FAILURE;
+	}
+
+	if (vm.count("help")) {
+		std::cout << desc;
+		return EXIT_SUCCESS;
+	}
+
+	double minTime = vm["min-time"].as<double>();
+	int samples = vm["samples"].as<int>();
+
+	if (minTime <= 0 || samples < 1) {
+		std::cerr << "The minimum time and the number of samples must be greater than 0.\n";
+		return EXIT_FAILURE;
+	}
+
+	Application::InitializeBase();
+
+	std::map<String, double> baseline;
+
+	try {
+		if (vm.count("baseline"))
+			baseline = LoadBaseline(vm["baseline"].as<std::string>());
+	} catch (const std::exception& ex) {
+		std::cerr << "Cannot load the baseline: " << DiagnosticInformation(ex, false) << "\n";
+		return EXIT_FAILURE;
+	}
+
+	String filter = vm.count("filter") ? String(vm["filter"].as<std::string>()) : String();
+	ArrayData benchmarks;
+
+	for (auto& benchmark : Microbench::GetCases()) {
+		if (!filter.IsEmpty() && benchmark.Name.Find(filter) == String::NPos)
+			continue;
+
+		MicrobenchState state (minTime, samples);
+		benchmark.Func(state);
+
+		auto& nsPerOp (state.GetNsPerOp());
+
+		if (nsPerOp.empty())
+			continue;
+
+		double median = nsPerOp[nsPerOp.size() / 2];
+
+		Dictionary::Ptr result = new Dictionary({
+			{ "name", benchmark.Name },
+			{ "iterations", static_cast<double>(state.GetIterations()) },
+			{ "samples", static_cast<double>(nsPerOp.size()) },
+			{ "ns_per_op", median },
+			{ "ns_per_op_min", nsPerOp.front() },
+			{ "ns_per_op_max", nsPerOp.back() }
+		});
+
+		auto base (baseline.find(benchmark.Name));
+
+		if (base != baseline.end() && base->second > 0) {
+			result->Set("baseline_ns_per_op", base->second);
+			result->Set("change", median / base->second - 1);
+		}
+
+		std::cerr << benchmark.Name << ": " << median << " ns/op\n";
+
+		benchmarks.emplace_back(std::move(result));
+	}
+
+	Dictionary::Ptr output = new Dictionary({
+		{ "version", Application::GetAppVersion() },
+		{ "time", Utility::GetTime() },
+		{ "min_time", minTime },
+		{ "benchmarks", new Array(std::move(benchmarks)) }
+	});
+
+	String json = JsonEncode(output, true);
+
+	if (vm.count("output")) {
+		std::ofstream fp (vm["output"].as<std::string>());
+		fp << json << "\n";
+
+		if (!fp) {
+			std::cerr << "Cannot write the results.\n";
+			return EXIT_FAILURE;
+		}
+	} else {
+		std::cout << json << "\n";
+	}
+
+	/* Like the test runner, don't wait for the thread pool and the timer thread. */
+	std::cout << std::flush;
+	std::_Exit(EXIT_SUCCESS);
+}
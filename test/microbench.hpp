@@ -0,0 +1,134 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include "base/initialize.hpp"
+#include "base/string.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace icinga
+{
+
+/**
+ * Keeps the compiler from optimizing away the computation of a value which isn't used otherwise.
+ */
+template<typename T>
+inline void DoNotOptimize(const T& value)
+{
+#ifdef _MSC_VER
+	static const volatile void *sink;
+	sink = &value;
+#else /* _MSC_VER */
+	asm volatile("" : : "r,m"(value) : "memory");
+#endif /* _MSC_VER */
+}
+
+/**
+ * The measurements of one microbenchmark, passed to its function.
+ */
+class MicrobenchState
+{
+public:
+	MicrobenchState(double minTime, int samples)
+		: m_MinTime(minTime), m_Samples(samples)
+	{ }
+
+	/**
+	 * Calls func repeatedly. The number of calls per sample grows until a sample takes at least the minimum
+	 * time, then the samples are taken. Only func is measured, so the benchmark may prepare its input before.
+	 */
+	template<typename F>
+	void Measure(F&& func)
+	{
+		uint_fast64_t iterations = 1;
+
+		for (;;) {
+			double duration = RunBatch(func, iterations);
+
+			if (duration >= m_MinTime || iterations >= (UINT64_C(1) << 40))
+				break;
+
+			/* Aim a bit above the minimum time, but grow at most by 10x at once. */
+			double factor = duration > 0 ? m_MinTime * 1.2 / duration : 10;
+			iterations = static_cast<uint_fast64_t>(iterations * std::min(std::max(factor, 2.0), 10.0));
+		}
+
+		m_Iterations = iterations;
+		m_NsPerOp.clear();
+
+		for (int i = 0; i < m_Samples; i++)
+			m_NsPerOp.push_back(RunBatch(func, iterations) * 1e9 / iterations);
+
+		std::sort(m_NsPerOp.begin(), m_NsPerOp.end());
+	}
+
+	uint_fast64_t GetIterations() const
+	{
+		return m_Iterations;
+	}
+
+	/**
+	 * @returns The nanoseconds per call of all samples, sorted.
+	 */
+	const std::vector<double>& GetNsPerOp() const
+	{
+		return m_NsPerOp;
+	}
+
+private:
+	double m_MinTime;
+	int m_Samples;
+	uint_fast64_t m_Iterations{0};
+	std::vector<double> m_NsPerOp;
+
+	template<typename F>
+	static double RunBatch(F& func, uint_fast64_t iterations)
+	{
+		auto start (std::chrono::steady_clock::now());
+
+		for (uint_fast64_t i = 0; i < iterations; i++)
+			func();
+
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+/**
+ * The registry of microbenchmarks (see MICROBENCH).
+ */
+class Microbench
+{
+public:
+	typedef std::function<void (MicrobenchState& state)> Callback;
+
+	struct Case
+	{
+		String Name;
+		Callback Func;
+	};
+
+	static void Register(const String& name, const Callback& func);
+	static const std::vector<Case>& GetCases();
+
+private:
+	static std::vector<Case>& GetRegistry();
+};
+
+/**
+ * Defines a microbenchmark. Its body gets a MicrobenchState& state and calls state.Measure() once.
+ */
+#define MICROBENCH(name) \
+	static void MicrobenchFunc_ ## name(icinga::MicrobenchState& state); \
+	INITIALIZE_ONCE([]() { \
+		icinga::Microbench::Register(#name, &MicrobenchFunc_ ## name); \
+	}) \
+	static void MicrobenchFunc_ ## name(icinga::MicrobenchState& state)
+
+}
+
+#endif /* MICROBENCH_H */
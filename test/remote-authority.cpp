@@ -0,0 +1,69 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "remote/apilistener.hpp"
+#include "base/convert.hpp"
+#include <BoostTestTargetConfig.h>
+#include <map>
+#include <utility>
+#include <vector>
+
+using namespace icinga;
+
+static String GetOwner(const String& objectName, const std::vector<std::pair<String, double>>& endpoints)
+{
+	String owner;
+	double ownerScore = -1;
+
+	for (auto& endpoint : endpoints) {
+		double score = ApiListener::GetAuthorityScore(objectName, endpoint.first, endpoint.second);
+
+		if (score > ownerScore) {
+			owner = endpoint.first;
+			ownerScore = score;
+		}
+	}
+
+	return owner;
+}
+
+BOOST_AUTO_TEST_SUITE(remote_authority)
+
+BOOST_AUTO_TEST_CASE(minimal_moves)
+{
+	std::vector<std::pair<String, double>> three ({ { "master1", 1 }, { "master2", 1 }, { "master3", 1 } });
+	std::vector<std::pair<String, double>> two ({ { "master1", 1 }, { "master2", 1 } });
+	std::map<String, int> counts;
+
+	for (int i = 0; i < 30000; i++) {
+		String name = "host" + Convert::ToString(i) + "!ping";
+		String before = GetOwner(name, three);
+		String after = GetOwner(name, two);
+
+		counts[before]++;
+
+		/* Only the objects of the removed endpoint move. */
+		if (before != "master3")
+			BOOST_CHECK_EQUAL(before, after);
+	}
+
+	for (auto& count : counts) {
+		BOOST_CHECK_GT(count.second, 9000);
+		BOOST_CHECK_LT(count.second, 11000);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(weights)
+{
+	std::vector<std::pair<String, double>> endpoints ({ { "master1", 2 }, { "master2", 1 } });
+	int master1 = 0;
+
+	for (int i = 0; i < 30000; i++) {
+		if (GetOwner("service" + Convert::ToString(i), endpoints) == "master1")
+			master1++;
+	}
+
+	BOOST_CHECK_GT(master1, 19000);
+	BOOST_CHECK_LT(master1, 21000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
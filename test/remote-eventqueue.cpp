@@ -0,0 +1,65 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "remote/eventqueue.hpp"
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(remote_eventqueue)
+
+BOOST_AUTO_TEST_CASE(drop_oldest)
+{
+	EventsInbox::Ptr inbox = new EventsInbox("", "<test>", 2, EventsOverflowPolicy::DropOldest);
+
+	for (int i = 0; i < 5; i++) {
+		inbox->Push(new SharedMessage(new Dictionary({ { "i", i } })));
+	}
+
+	BOOST_CHECK_EQUAL(inbox->GetDroppedEvents(), 3);
+	BOOST_CHECK(!inbox->IsOverflowed());
+
+	SharedMessage::Ptr event = inbox->TryShift();
+	BOOST_REQUIRE(event);
+	BOOST_CHECK_EQUAL(event->GetMessage()->Get("i"), 3);
+
+	event = inbox->TryShift();
+	BOOST_REQUIRE(event);
+	BOOST_CHECK_EQUAL(event->GetMessage()->Get("i"), 4);
+
+	BOOST_CHECK(!inbox->TryShift());
+}
+
+BOOST_AUTO_TEST_CASE(disconnect)
+{
+	EventsInbox::Ptr inbox = new EventsInbox("", "<test>", 1, EventsOverflowPolicy::Disconnect);
+
+	inbox->Push(new SharedMessage(new Dictionary({ { "i", 0 } })));
+	BOOST_CHECK(!inbox->IsOverflowed());
+
+	inbox->Push(new SharedMessage(new Dictionary({ { "i", 1 } })));
+	BOOST_CHECK(inbox->IsOverflowed());
+	BOOST_CHECK_EQUAL(inbox->GetDroppedEvents(), 1);
+
+	SharedMessage::Ptr event = inbox->TryShift();
+	BOOST_REQUIRE(event);
+	BOOST_CHECK_EQUAL(event->GetMessage()->Get("i"), 0);
+}
+
+BOOST_AUTO_TEST_CASE(shared_encoding)
+{
+	EventsInbox::Ptr inbox1 = new EventsInbox("", "<test>");
+	EventsInbox::Ptr inbox2 = new EventsInbox("", "<test>");
+
+	EventsFilter filter ({ { Expression::Ptr(), { inbox1, inbox2 } } });
+	filter.Push(new Dictionary({ { "type", "CheckResult" } }));
+
+	SharedMessage::Ptr event1 = inbox1->TryShift();
+	SharedMessage::Ptr event2 = inbox2->TryShift();
+
+	BOOST_REQUIRE(event1);
+	BOOST_CHECK_EQUAL(event1, event2);
+	BOOST_CHECK_EQUAL(event1->GetEncoded(), event2->GetEncoded());
+	BOOST_CHECK_EQUAL(EventsFilter::GetEncodesPerEvent(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
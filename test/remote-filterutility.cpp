@@ -0,0 +1,116 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "remote/filterutility.hpp"
+#include "icinga/host.hpp"
+#include "base/array.hpp"
+#include <BoostTestTargetConfig.h>
+#include <algorithm>
+
+using namespace icinga;
+
+struct FilterUtilityFixture
+{
+	std::vector<Host::Ptr> Hosts;
+	ApiUser::Ptr User = new ApiUser();
+
+	FilterUtilityFixture()
+	{
+		User->SetPermissions(new Array({ "*" }), true);
+
+		for (auto& kv : std::vector<std::pair<String, String>>{ { "web1", "web" }, { "web2", "web" }, { "db1", "db" } }) {
+			Host::Ptr host = new Host();
+			host->SetName("filterutility-" + kv.first, true);
+			host->SetVars(new Dictionary({ { "team", kv.second } }));
+			host->Register();
+
+			/* Without events, so that custom var changes are signalled, but the checker etc. don't get involved. */
+			host->SetActive(true, true);
+
+			Hosts.emplace_back(host);
+		}
+
+		/* Activation with events would have done the same. */
+		FilterIndex::Invalidate();
+	}
+
+	~FilterUtilityFixture()
+	{
+		for (auto& host : Hosts) {
+			host->SetActive(false, true);
+			host->Unregister();
+		}
+	}
+
+	std::vector<String> Query(const String& filter, const Dictionary::Ptr& filterVars = nullptr)
+	{
+		QueryDescription qd;
+		qd.Types.insert("Host");
+		qd.Permission = "objects/query/Host";
+
+		Dictionary::Ptr query = new Dictionary({ { "type", "Host" }, { "filter", filter } });
+
+		if (filterVars)
+			query->Set("filter_vars", filterVars);
+
+		std::vector<String> names;
+
+		for (const Value& target : FilterUtility::GetFilterTargets(qd, query, User)) {
+			names.emplace_back(static_cast<Host::Ptr>(target)->GetName());
+		}
+
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(remote_filterutility, FilterUtilityFixture)
+
+BOOST_AUTO_TEST_CASE(indexed)
+{
+	std::vector<String> web ({ "filterutility-web1", "filterutility-web2" });
+	std::vector<String> db ({ "filterutility-db1" });
+
+	BOOST_CHECK(Query("host.name == \"filterutility-db1\"") == db);
+	BOOST_CHECK(Query("host.vars.team == \"web\"") == web);
+	BOOST_CHECK(Query("match(\"filterutility-web*\", host.name)") == web);
+	BOOST_CHECK(Query("host.vars.team == team", new Dictionary({ { "team", "db" } })) == db);
+	BOOST_CHECK(Query("host.vars.team == \"web\" && host.name != \"filterutility-web2\"")
+		== std::vector<String>({ "filterutility-web1" }));
+	BOOST_CHECK(Query("host.vars.team == \"db\" || match(\"*-web2\", host.name)")
+		== std::vector<String>({ "filterutility-db1", "filterutility-web2" }));
+	BOOST_CHECK(Query("host.vars.team == \"db\" && host.name == \"filterutility-web1\"").empty());
+}
+
+BOOST_AUTO_TEST_CASE(invalidation)
+{
+	BOOST_CHECK(Query("host.vars.team == \"db\"") == std::vector<String>({ "filterutility-db1" }));
+
+	Hosts.at(0)->SetVars(new Dictionary({ { "team", "db" } }));
+
+	BOOST_CHECK(Query("host.vars.team == \"db\"") == std::vector<String>({ "filterutility-db1", "filterutility-web1" }));
+}
+
+BOOST_AUTO_TEST_CASE(compiled_cache)
+{
+	BOOST_CHECK(FilterUtility::CompileFilter("host.name == \"x\"") == FilterUtility::CompileFilter("host.name == \"x\""));
+	BOOST_CHECK(FilterUtility::CompileFilter("host.name == \"x\"") != FilterUtility::CompileFilter("host.name == \"y\""));
+}
+
+BOOST_AUTO_TEST_CASE(permission_cache)
+{
+	ApiUser::Ptr user = new ApiUser();
+	user->SetPermissions(new Array({ "objects/query/*" }), true);
+	user->SetActive(true, true);
+
+	BOOST_CHECK(FilterUtility::HasPermission(user, "objects/query/Host"));
+	BOOST_CHECK(!FilterUtility::HasPermission(user, "objects/modify/Host"));
+
+	user->SetPermissions(new Array({ "objects/modify/*" }));
+
+	BOOST_CHECK(!FilterUtility::HasPermission(user, "objects/query/Host"));
+	BOOST_CHECK(FilterUtility::HasPermission(user, "objects/modify/Host"));
+
+	user->SetActive(false, true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
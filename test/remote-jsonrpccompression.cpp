@@ -0,0 +1,45 @@
+/* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
+
+#include "base/convert.hpp"
+#include "remote/jsonrpccompression.hpp"
+#include <BoostTestTargetConfig.h>
+
+using namespace icinga;
+
+BOOST_AUTO_TEST_SUITE(remote_jsonrpccompression)
+
+BOOST_AUTO_TEST_CASE(roundtrip)
+{
+	JsonRpcDeflater deflater (6);
+	JsonRpcInflater inflater;
+	size_t uncompressed = 0, compressed = 0;
+
+	for (int i = 0; i < 100; i++) {
+		String message = "{\"jsonrpc\":\"2.0\",\"method\":\"event::CheckResult\",\"params\":{\"host\":\"host"
+			+ Convert::ToString(i) + "\",\"cr\":{\"output\":\"OK - " + String(i, 'x') + "\"}}}";
+
+		String deflated = deflater.Deflate(message);
+
+		BOOST_CHECK(JsonRpcInflater::IsDeflated(deflated));
+		BOOST_CHECK(!JsonRpcInflater::IsDeflated(message));
+		BOOST_CHECK(inflater.Inflate(deflated) == message);
+
+		uncompressed += message.GetLength();
+		compressed += deflated.GetLength();
+	}
+
+	/* Later messages refer to the earlier ones. */
+	BOOST_CHECK(compressed * 4u < uncompressed);
+}
+
+BOOST_AUTO_TEST_CASE(max_length)
+{
+	JsonRpcDeflater deflater (1);
+	JsonRpcInflater inflater;
+
+	String deflated = deflater.Deflate(String(1024 * 1024, 'a'));
+
+	BOOST_CHECK_THROW(inflater.Inflate(deflated, 1024), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,7 @@
 /* Icinga 2 | (c) 2012 Icinga GmbH | GPLv2+ */
 
 #include "classcompiler.hpp"
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -138,6 +139,38 @@ static bool FieldTypeCmp(const Field& a, const Field& b)
 	return a.Type.GetRealType() < b.Type.GetRealType();
 }
 
+/* Hot fields first, cold ones (stored separately anyway) last. */
+static int FieldTemperature(const Field& field)
+{
+	if (field.Attributes & FAHot)
+		return 0;
+	else if (field.Attributes & FACold)
+		return 2;
+	else
+		return 1;
+}
+
+static bool FieldTemperatureCmp(const Field& a, const Field& b)
+{
+	return FieldTemperature(a) < FieldTemperature(b);
+}
+
+static bool IsColdField(const Field& field)
+{
+	return (field.Attributes & FACold) && !(field.Attributes & FANoStorage);
+}
+
+static bool HasColdFields(const Klass& klass)
+{
+	return std::any_of(klass.Fields.begin(), klass.Fields.end(), IsColdField);
+}
+
+/* The member a field is stored in. */
+static std::string FieldStorage(const Field& field)
+{
+	return (IsColdField(field) ? "m_Cold->m_" : "m_") + field.GetFriendlyName();
+}
+
 static std::string FieldTypeToIcingaName(const Field& field, bool inner)
 {
 	std::string ftype = field.Type.TypeName;
@@ -166,6 +199,7 @@ void ClassCompiler::OptimizeStructLayout(std::vector<Field>& fields)
 {
 	std::sort(fields.begin(), fields.end(), FieldTypeCmp);
 	std::stable_sort(fields.begin(), fields.end(), FieldLayoutCmp);
+	std::stable_sort(fields.begin(), fields.end(), FieldTemperatureCmp);
 }
 
 void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
@@ -398,6 +432,14 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 		<< "\t" << "return " << klass.ActivationPriority << ";" << std::endl
 		<< "}" << std::endl << std::endl;
 
+	/* GetInstanceSize */
+	m_Header << "\t" << "size_t GetInstanceSize() const override;" << std::endl;
+
+	m_Impl << "size_t TypeImpl<" << klass.Name << ">::GetInstanceSize() const" << std::endl
+		<< "{" << std::endl
+		<< "\t" << "return sizeof(" << klass.Name << ") + ObjectImpl<" << klass.Name << ">::GetColdFieldsSize();" << std::endl
+		<< "}" << std::endl << std::endl;
+
 	/* RegisterAttributeHandler */
 	m_Header << "public:" << std::endl
 			<< "\t" << "void RegisterAttributeHandler(int fieldId, const Type::AttributeHandler& callback) override;" << std::endl;
@@ -556,8 +598,12 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 	m_Header << "public:" << std::endl
 			<< "\t" << "ObjectImpl<" << klass.Name << ">();" << std::endl;
 
-	m_Impl << "ObjectImpl<" << klass.Name << ">::ObjectImpl()" << std::endl
-		<< "{" << std::endl;
+	m_Impl << "ObjectImpl<" << klass.Name << ">::ObjectImpl()" << std::endl;
+
+	if (HasColdFields(klass))
+		m_Impl << "\t" << ": m_Cold(std::make_unique<ColdFields>())" << std::endl;
+
+	m_Impl << "{" << std::endl;
 
 	for (const Field& field : klass.Fields) {
 		if (!field.PureSetAccessor)
@@ -573,6 +619,37 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 	m_Impl << "ObjectImpl<" << klass.Name << ">::~ObjectImpl()" << std::endl
 		<< "{ }" << std::endl << std::endl;
 
+	/* GetColdFieldsSize */
+	m_Header << "public:" << std::endl
+			<< "\t" << "static size_t GetColdFieldsSize();" << std::endl;
+
+	m_Impl << "size_t ObjectImpl<" << klass.Name << ">::GetColdFieldsSize()" << std::endl
+		<< "{" << std::endl
+		<< "\t" << "return " << (HasColdFields(klass) ? "sizeof(ColdFields)" : "0");
+
+	if (!klass.Parent.empty())
+		m_Impl << " + " << klass.Parent << "::GetColdFieldsSize()";
+
+	m_Impl << ";" << std::endl
+		<< "}" << std::endl << std::endl;
+
+	/* VisitFields, also for classes without fields so the generic implementation doesn't visit the fields twice */
+	m_Header << "public:" << std::endl
+			<< "\t" << "void VisitFields(int attributeTypes, const FieldVisitor& visitor) const override;" << std::endl;
+
+	m_Impl << "void ObjectImpl<" << klass.Name << ">::VisitFields(int attributeTypes, const FieldVisitor& visitor) const" << std::endl
+		<< "{" << std::endl;
+
+	if (!klass.Parent.empty())
+		m_Impl << "\t" << klass.Parent << "::VisitFields(attributeTypes, visitor);" << std::endl << std::endl;
+
+	for (const Field& field : klass.Fields) {
+		m_Impl << "\t" << "if (attributeTypes == 0 || (attributeTypes & " << field.Attributes << "))" << std::endl
+			<< "\t\t" << "visitor(\"" << field.Name << "\", Get" << field.GetFriendlyName() << "());" << std::endl;
+	}
+
+	m_Impl << "}" << std::endl << std::endl;
+
 	if (!klass.Fields.empty()) {
 		/* SetField */
 		m_Header << "public:" << std::endl
@@ -650,7 +727,7 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 			<< "\t" << "}" << std::endl;
 
 		m_Impl << "}" << std::endl << std::endl;
-		
+
 		/* ValidateField */
 		m_Header << "public:" << std::endl
 				<< "\t" << "void ValidateField(int id, const Lazy<Value>& lvalue, const ValidationUtils& utils) override;" << std::endl;
@@ -806,7 +883,7 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 					<< "{" << std::endl;
 
 				if (field.GetAccessor.empty() && !(field.Attributes & FANoStorage))
-					m_Impl << "\t" << "return m_" << field.GetFriendlyName() << ".load();" << std::endl;
+					m_Impl << "\t" << "return " << FieldStorage(field) << ".load();" << std::endl;
 				else
 					m_Impl << field.GetAccessor << std::endl;
 
@@ -844,7 +921,7 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 						<< "\t" << "auto *dobj = dynamic_cast<ConfigObject *>(this);" << std::endl;
 
 				if (field.SetAccessor.empty() && !(field.Attributes & FANoStorage))
-					m_Impl << "\t" << "m_" << field.GetFriendlyName() << ".store(value);" << std::endl;
+					m_Impl << "\t" << FieldStorage(field) << ".store(value);" << std::endl;
 				else
 					m_Impl << field.SetAccessor << std::endl << std::endl;
 
@@ -892,9 +969,11 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 			if (field.Type.TypeName != "String") {
 				if (field.Type.ArrayRank > 0) {
 					m_Impl << "\t" << "if (oldValue) {" << std::endl
+						<< "\t\t" << "std::vector<Object *> refs;" << std::endl
 						<< "\t\t" << "ObjectLock olock(oldValue);" << std::endl
+						<< "\t\t" << "refs.reserve(oldValue->GetLength());" << std::endl
 						<< "\t\t" << "for (const String& ref : oldValue) {" << std::endl
-						<< "\t\t\t" << "DependencyGraph::RemoveDependency(this, ConfigObject::GetObject";
+						<< "\t\t\t" << "refs.emplace_back(ConfigObject::GetObject";
 
 					/* Ew */
 					if (field.Type.TypeName == "Zone" && m_Library == "base")
@@ -904,11 +983,14 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 
 					m_Impl << "ref).get());" << std::endl
 						<< "\t\t" << "}" << std::endl
+						<< "\t\t" << "DependencyGraph::RemoveDependencies(this, refs);" << std::endl
 						<< "\t" << "}" << std::endl
 						<< "\t" << "if (newValue) {" << std::endl
+						<< "\t\t" << "std::vector<Object *> refs;" << std::endl
 						<< "\t\t" << "ObjectLock olock(newValue);" << std::endl
+						<< "\t\t" << "refs.reserve(newValue->GetLength());" << std::endl
 						<< "\t\t" << "for (const String& ref : newValue) {" << std::endl
-						<< "\t\t\t" << "DependencyGraph::AddDependency(this, ConfigObject::GetObject";
+						<< "\t\t\t" << "refs.emplace_back(ConfigObject::GetObject";
 
 					/* Ew */
 					if (field.Type.TypeName == "Zone" && m_Library == "base")
@@ -918,6 +1000,7 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 
 					m_Impl << "ref).get());" << std::endl
 						<< "\t\t" << "}" << std::endl
+						<< "\t\t" << "DependencyGraph::AddDependencies(this, refs);" << std::endl
 						<< "\t" << "}" << std::endl;
 				} else {
 					m_Impl << "\t" << "if (!oldValue.IsEmpty())" << std::endl
@@ -1004,6 +1087,7 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 		}
 
 		/* notify */
+		num = 0;
 		for (const Field& field : klass.Fields) {
 			std::string prot;
 
@@ -1020,12 +1104,38 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 
 			if (field.Name != "active") {
 				m_Impl << "\t" << "auto *dobj = dynamic_cast<ConfigObject *>(this);" << std::endl
-					<< "\t" << "if (!dobj || dobj->IsActive())" << std::endl
-					<< "\t";
+					<< "\t" << "if (dobj) {" << std::endl
+					<< "\t\t" << "if (!dobj->IsActive())" << std::endl
+					<< "\t\t\t" << "return;" << std::endl
+					<< std::endl
+					<< "\t\t" << "if (!FieldUpdateBatch::Defer(dobj, ";
+
+				std::ostringstream fieldId;
+
+				if (field.Attributes & FAState) {
+					fieldId << num;
+
+					if (!klass.Parent.empty())
+						fieldId << " + " << klass.Parent << "::TypeInstance->GetFieldCount()";
+				} else {
+					fieldId << "-1";
+				}
+
+				m_Impl << fieldId.str() << ")) {" << std::endl
+					<< "\t\t\t" << "dobj->BumpChangeCounter();" << std::endl;
+
+				if (field.Attributes & FAState)
+					m_Impl << "\t\t\t" << "dobj->MarkStateDirty(" << fieldId.str() << ");" << std::endl;
+
+				m_Impl << "\t\t" << "}" << std::endl
+					<< "\t" << "}" << std::endl
+					<< std::endl;
 			}
 
 			m_Impl << "\t" << "On" << field.GetFriendlyName() << "Changed(static_cast<" << klass.Name << " *>(this), cookie);" << std::endl
 				<< "}" << std::endl << std::endl;
+
+			num++;
 		}
 		
 		/* default */
@@ -1056,24 +1166,38 @@ void ClassCompiler::HandleClass(const Klass& klass, const ClassDebugInfo&)
 		m_Header << "private:" << std::endl;
 
 		for (const Field& field : klass.Fields) {
-			if (field.Attributes & FANoStorage)
+			if ((field.Attributes & FANoStorage) || IsColdField(field))
 				continue;
 
 			m_Header << "\tAtomicOrLocked<" << field.Type.GetRealType() << "> m_" << field.GetFriendlyName() << ";" << std::endl;
 		}
+
+		/* rarely used fields, allocated separately to keep the others close together */
+		if (HasColdFields(klass)) {
+			m_Header << "\t" << "struct ColdFields" << std::endl
+				<< "\t" << "{" << std::endl;
+
+			for (const Field& field : klass.Fields) {
+				if (IsColdField(field))
+					m_Header << "\t\tAtomicOrLocked<" << field.Type.GetRealType() << "> m_" << field.GetFriendlyName() << ";" << std::endl;
+			}
+
+			m_Header << "\t" << "};" << std::endl << std::endl
+				<< "\t" << "std::unique_ptr<ColdFields> m_Cold;" << std::endl;
+		}
 		
 		/* signal */
 		m_Header << "public:" << std::endl;
 		
 		for (const Field& field : klass.Fields) {
-			m_Header << "\t" << "static boost::signals2::signal<void (const intrusive_ptr<" << klass.Name << ">&, const Value&)> On" << field.GetFriendlyName() << "Changed;" << std::endl;
-			m_Impl << std::endl << "boost::signals2::signal<void (const intrusive_ptr<" << klass.Name << ">&, const Value&)> ObjectImpl<" << klass.Name << ">::On" << field.GetFriendlyName() << "Changed;" << std::endl << std::endl;
+			m_Header << "\t" << "static Signal<void (const intrusive_ptr<" << klass.Name << ">&, const Value&)> On" << field.GetFriendlyName() << "Changed;" << std::endl;
+			m_Impl << std::endl << "Signal<void (const intrusive_ptr<" << klass.Name << ">&, const Value&)> ObjectImpl<" << klass.Name << ">::On" << field.GetFriendlyName() << "Changed;" << std::endl << std::endl;
 
 			if (field.Attributes & FASignalWithOldValue) {
-				m_Header << "\t" << "static boost::signals2::signal<void (const intrusive_ptr<" << klass.Name
+				m_Header << "\t" << "static Signal<void (const intrusive_ptr<" << klass.Name
 					<< ">&, const Value&, const Value&)> On" << field.GetFriendlyName() << "ChangedWithOldValue;"
 					<< std::endl;
-				m_Impl << std::endl << "boost::signals2::signal<void (const intrusive_ptr<" << klass.Name
+				m_Impl << std::endl << "Signal<void (const intrusive_ptr<" << klass.Name
 					<< ">&, const Value&, const Value&)> ObjectImpl<" << klass.Name << ">::On"
 					<< field.GetFriendlyName() << "ChangedWithOldValue;" << std::endl << std::endl;
 			}
@@ -1457,7 +1581,9 @@ void ClassCompiler::CompileStream(const std::string& path, std::istream& input,
 		<< "#include \"base/array.hpp\"" << std::endl
 		<< "#include \"base/atomic.hpp\"" << std::endl
 		<< "#include \"base/dictionary.hpp\"" << std::endl
-		<< "#include <boost/signals2.hpp>" << std::endl << std::endl;
+		<< "#include \"base/signal.hpp\"" << std::endl
+		<< "#include <boost/signals2.hpp>" << std::endl
+		<< "#include <memory>" << std::endl << std::endl;
 
 	oimpl << "#include \"base/exception.hpp\"" << std::endl
 		<< "#include \"base/objectlock.hpp\"" << std::endl
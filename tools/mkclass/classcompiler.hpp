@@ -62,6 +62,8 @@ enum FieldAttribute
 	FASetVirtual = 16384,
 	FAActivationPriority = 32768,
 	FASignalWithOldValue = 65536,
+	FAHot = 131072,
+	FACold = 262144,
 };
 
 struct FieldType